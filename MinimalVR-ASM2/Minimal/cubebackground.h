@@ -0,0 +1,230 @@
+#pragma once
+// Std. Includes
+#include <cstring>
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include <OVR_CAPI_GL.h>
+#include "imagefile.h"
+
+// ovrLayerType_Cube is newer than the SDK in Include/LibOVR, which only has the ovrTexture_Cube swap chain. The layer
+// is declared here as the runtime lays it out: a cube map swap chain and the orientation it is shown at, around the
+// head at infinity.
+#define CUBE_LAYER_TYPE 10
+
+struct OVR_ALIGNAS(OVR_PTR_SIZE) CubeBackgroundLayer
+{
+	ovrLayerHeader Header;
+	ovrQuatf Orientation;
+	ovrTextureSwapChain CubeMapTexture;
+};
+
+// Drawn in place of the layer: one triangle over the viewport at the far plane, so it only fills what the scene
+// left at the cleared depth. The direction of each pixel comes back from clip space through the eye's projection
+// and rotation, the position is left out as for the layer.
+static const char* CUBE_BACKGROUND_VERTEX_SHADER = R"SHADER(
+#version 410 core
+
+uniform mat4 InverseViewProjection;
+
+out vec3 direction;
+
+void main(void) {
+	vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+	vec4 world = InverseViewProjection * vec4(position, 1.0, 1.0);
+	direction = world.xyz / world.w;
+	gl_Position = vec4(position, 1.0, 1.0);
+}
+)SHADER";
+
+static const char* CUBE_BACKGROUND_FRAGMENT_SHADER = R"SHADER(
+#version 410 core
+
+uniform samplerCube Background;
+
+in vec3 direction;
+out vec4 fragColor;
+
+void main(void) {
+	fragColor = vec4(texture(Background, direction).rgb, 1.0);
+}
+)SHADER";
+
+// The environment's backdrop, a compressed cube map loaded once. Where the runtime takes cube layers it goes to the
+// compositor in a static swap chain under the scene layer, which is cleared transparent around the scene: the
+// compositor samples it at its own resolution and nothing of it is filled into the eye buffer. Where it doesn't, the
+// swap chain can't be made or a submit with the layer fails, it is drawn into each eye after the scene instead.
+//
+// The swap chain is sRGB while the fallback texture isn't: the eye texture is written without GL_FRAMEBUFFER_SRGB,
+// so the encoded values are copied through unchanged and look the same as the compositor's decoded layer.
+class CubeBackground
+{
+public:
+	CubeBackground()
+	{
+		memset(&this->layer, 0, sizeof(CubeBackgroundLayer));
+	}
+
+	CubeBackground(const CubeBackground&) = delete;
+	CubeBackground& operator=(const CubeBackground&) = delete;
+
+	// --no-cube-layer, before init: always drawn in the app
+	void setLayerAllowed(bool allowed) { this->layerAllowed = allowed; }
+
+	// Needs the GL context. False, and nothing drawn or submitted, if path isn't a cube map MappedCubeMap reads.
+	bool init(ovrSession session, const string& path)
+	{
+		if (!this->source.open(path))
+		{
+			std::cout << "ERROR::BACKGROUND::CUBE_MAP_NOT_LOADED " << path << std::endl;
+			return false;
+		}
+		if (this->layerAllowed && this->initLayer(session))
+			return true;
+		this->initFallback();
+		return true;
+	}
+
+	bool loaded() const { return this->source.loaded(); }
+	// The layer goes under the scene layer; the scene is cleared transparent for it
+	bool layerActive() const { return this->chain != nullptr && !this->layerDropped; }
+	ovrLayerHeader* header() { return &this->layer.Header; }
+
+	// A submit with the layer failed: the runtime doesn't take cube layers, from now on the app draws it
+	void dropLayer()
+	{
+		if (!this->layerActive())
+			return;
+		std::cout << "ERROR::BACKGROUND::CUBE_LAYER_REJECTED, drawn in the app" << std::endl;
+		this->layerDropped = true;
+		this->initFallback();
+	}
+
+	// Last in each eye, with the scene's depth still bound; does nothing while the layer is active
+	void draw(const glm::mat4& projection, const glm::mat4& headPose)
+	{
+		if (this->layerActive() || !this->texture)
+			return;
+		const glm::mat4 rotation = glm::mat4(glm::mat3(glm::inverse(headPose)));
+		const glm::mat4 inverseViewProjection = glm::inverse(projection * rotation);
+
+		glUseProgram(this->program);
+		glUniformMatrix4fv(this->inverseViewProjectionLocation, 1, GL_FALSE, &inverseViewProjection[0][0]);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, this->texture);
+		glBindVertexArray(this->vao);
+
+		GLint depthFunc;
+		glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+		glDepthFunc(GL_LEQUAL);
+		glDepthMask(GL_FALSE);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glDepthMask(GL_TRUE);
+		glDepthFunc(depthFunc);
+
+		glBindVertexArray(0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		glUseProgram(0);
+	}
+
+private:
+	MappedCubeMap source;
+	bool layerAllowed = true;
+	bool layerDropped = false;
+	ovrTextureSwapChain chain = nullptr;
+	CubeBackgroundLayer layer;
+	GLuint texture = 0;
+	GLuint program = 0;
+	GLuint vao = 0;
+	GLint inverseViewProjectionLocation = -1;
+
+	// Faces and mips go straight from the mapping into the bound cube map, allocating them or into the ones there
+	void upload(GLenum format, bool allocate)
+	{
+		for (int face = 0; face < 6; face++)
+		{
+			for (GLsizei level = 0; level < this->source.levels(); level++)
+			{
+				GLsizei edge, bytes;
+				const uint8_t* data = this->source.face(face, level, &edge, &bytes);
+				if (allocate)
+					glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, format, edge, edge, 0, bytes, data);
+				else
+					glCompressedTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0, edge, edge, format, bytes, data);
+			}
+		}
+	}
+
+	bool initLayer(ovrSession session)
+	{
+		ovrTextureSwapChainDesc desc = {};
+		desc.Type = ovrTexture_Cube;
+		desc.ArraySize = 6;
+		desc.Width = this->source.size();
+		desc.Height = this->source.size();
+		desc.MipLevels = this->source.levels();
+		desc.Format = this->source.dxt5() ? OVR_FORMAT_BC3_UNORM_SRGB : OVR_FORMAT_BC1_UNORM_SRGB;
+		desc.SampleCount = 1;
+		desc.StaticImage = ovrTrue;
+		if (!OVR_SUCCESS(ovr_CreateTextureSwapChainGL(session, &desc, &this->chain)))
+		{
+			std::cout << "ERROR::BACKGROUND::CUBE_SWAP_CHAIN_NOT_CREATED, drawn in the app" << std::endl;
+			this->chain = nullptr;
+			return false;
+		}
+
+		// A static image has the one buffer, committed once and never again
+		GLuint chainTexId;
+		ovr_GetTextureSwapChainBufferGL(session, this->chain, 0, &chainTexId);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, chainTexId);
+		this->upload(this->source.dxt5() ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, false);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		ovr_CommitTextureSwapChain(session, this->chain);
+
+		this->layer.Header.Type = (ovrLayerType)CUBE_LAYER_TYPE;
+		this->layer.Header.Flags = 0;
+		this->layer.Orientation.w = 1.0f;
+		this->layer.CubeMapTexture = this->chain;
+		return true;
+	}
+
+	void initFallback()
+	{
+		if (this->texture)
+			return;
+		const GLenum format = this->source.dxt5() ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		glGenTextures(1, &this->texture);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, this->texture);
+		this->upload(format, true);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, this->source.levels() - 1);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, this->source.levels() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+		char errorBuffer[512];
+		this->program = _compileProgramFromSource(CUBE_BACKGROUND_VERTEX_SHADER, CUBE_BACKGROUND_FRAGMENT_SHADER, sizeof(errorBuffer), errorBuffer);
+		if (!this->program)
+		{
+			std::cout << "ERROR::BACKGROUND::PROGRAM_NOT_LINKED " << errorBuffer << std::endl;
+			glDeleteTextures(1, &this->texture);
+			this->texture = 0;
+			return;
+		}
+		this->inverseViewProjectionLocation = glGetUniformLocation(this->program, "InverseViewProjection");
+		glUseProgram(this->program);
+		glUniform1i(glGetUniformLocation(this->program, "Background"), 0);
+		glUseProgram(0);
+		// The triangle is made from gl_VertexID, the core profile still wants a vertex array bound
+		glGenVertexArrays(1, &this->vao);
+	}
+};
+
+static CubeBackground _cubeBackground;
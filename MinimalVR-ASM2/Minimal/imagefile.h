@@ -0,0 +1,294 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cctype>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "mappedfile.h"
+
+// Raw images are pixels already in the layout the driver uploads fastest, so nothing is converted at load:
+//   RawImageHeader, then width * height BGRA8 pixels, rows in the same order as the PPM they came from.
+// Written by _writeRawImage, e.g. with --convert-image on the command line.
+#define RAW_IMAGE_MAGIC 0x58455452 // "RTEX"
+#define RAW_IMAGE_VERSION 1
+
+struct RawImageHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+};
+
+// A binary PPM (P6, 8 bit) or raw image mapped straight from disk. The header is parsed in place and
+// pixels() points into the mapping, so the only copy of the pixel data ever made is the driver's.
+class MappedImage
+{
+public:
+	MappedImage() {}
+
+	MappedImage(const MappedImage&) = delete;
+	MappedImage& operator=(const MappedImage&) = delete;
+
+	bool open(const string& path)
+	{
+		this->pixelData = nullptr;
+		if (!this->file.open(path))
+			return false;
+		if (this->parseRaw() || this->parsePPM())
+			return true;
+		cout << "ERROR::IMAGE::UNSUPPORTED_FORMAT " << path << endl;
+		this->file.close();
+		return false;
+	}
+
+	GLsizei width() const { return this->w; }
+	GLsizei height() const { return this->h; }
+	// Arguments for glTexImage2D
+	GLenum internalFormat() const { return this->raw ? GL_RGBA8 : GL_RGB8; }
+	GLenum format() const { return this->raw ? GL_BGRA : GL_RGB; }
+	GLenum type() const { return this->raw ? GL_UNSIGNED_INT_8_8_8_8_REV : GL_UNSIGNED_BYTE; }
+	// PPM rows are tightly packed RGB, not padded to 4 bytes
+	GLint alignment() const { return this->raw ? 4 : 1; }
+	const uint8_t* pixels() const { return this->pixelData; }
+	bool isRaw() const { return this->raw; }
+
+private:
+	MappedFile file;
+	const uint8_t* pixelData = nullptr;
+	GLsizei w = 0;
+	GLsizei h = 0;
+	bool raw = false;
+
+	bool parseRaw()
+	{
+		if (this->file.size() < sizeof(RawImageHeader))
+			return false;
+		const RawImageHeader* header = (const RawImageHeader*)this->file.data();
+		if (header->magic != RAW_IMAGE_MAGIC || header->version != RAW_IMAGE_VERSION)
+			return false;
+		if (sizeof(RawImageHeader) + (uint64_t)header->width * header->height * 4 > this->file.size())
+			return false;
+		this->w = (GLsizei)header->width;
+		this->h = (GLsizei)header->height;
+		this->raw = true;
+		this->pixelData = this->file.data() + sizeof(RawImageHeader);
+		return true;
+	}
+
+	// "P6", width, height and maxval separated by whitespace and # comments, then one whitespace byte and the pixels
+	bool parsePPM()
+	{
+		const char* cursor = (const char*)this->file.data();
+		const char* end = cursor + this->file.size();
+		if (end - cursor < 2 || cursor[0] != 'P' || cursor[1] != '6')
+			return false;
+		cursor += 2;
+
+		unsigned long fields[3];
+		for (int i = 0; i < 3; i++)
+		{
+			while (cursor < end && (isspace((unsigned char)*cursor) || *cursor == '#'))
+			{
+				if (*cursor == '#')
+				{
+					while (cursor < end && *cursor != '\n')
+						cursor++;
+				}
+				else
+				{
+					cursor++;
+				}
+			}
+			if (cursor == end || !isdigit((unsigned char)*cursor))
+				return false;
+			fields[i] = 0;
+			while (cursor < end && isdigit((unsigned char)*cursor))
+				fields[i] = fields[i] * 10 + (*cursor++ - '0');
+		}
+		if (cursor == end || !isspace((unsigned char)*cursor) || fields[2] != 255)
+			return false;
+		cursor++;
+
+		if ((uint64_t)fields[0] * fields[1] * 3 > (uint64_t)(end - cursor))
+			return false;
+		this->w = (GLsizei)fields[0];
+		this->h = (GLsizei)fields[1];
+		this->raw = false;
+		this->pixelData = (const uint8_t*)cursor;
+		return true;
+	}
+};
+
+// DDS cube maps, block compressed so they upload and sample as they are on disk. Only what the background needs
+// is read: a DXT1 or DXT5 four character code, all six faces, and each face's mip chain after the one before.
+#define DDS_MAGIC 0x20534444 // "DDS "
+#define DDS_FOURCC_DXT1 0x31545844
+#define DDS_FOURCC_DXT5 0x35545844
+#define DDS_CAPS2_CUBEMAP_ALL_FACES 0xFE00
+// GL_MAX_CUBE_MAP_TEXTURE_SIZE on current hardware; a header claiming a larger face is taken for a bad one
+#define DDS_MAX_CUBE_MAP_EDGE 16384
+
+struct DdsHeader
+{
+	uint32_t magic;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitchOrLinearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	uint32_t reserved1[11];
+	uint32_t pixelFormatSize;
+	uint32_t pixelFormatFlags;
+	uint32_t fourCC;
+	uint32_t rgbBitCount;
+	uint32_t bitMasks[4];
+	uint32_t caps;
+	uint32_t caps2;
+	uint32_t caps3;
+	uint32_t caps4;
+	uint32_t reserved2;
+};
+
+// A compressed cube map mapped straight from disk, like MappedImage: face() points into the mapping
+class MappedCubeMap
+{
+public:
+	MappedCubeMap() {}
+
+	MappedCubeMap(const MappedCubeMap&) = delete;
+	MappedCubeMap& operator=(const MappedCubeMap&) = delete;
+
+	bool open(const string& path)
+	{
+		this->levelCount = 0;
+		if (!this->file.open(path))
+			return false;
+		if (this->parse())
+			return true;
+		cout << "ERROR::IMAGE::UNSUPPORTED_CUBE_MAP " << path << endl;
+		this->file.close();
+		return false;
+	}
+
+	bool loaded() const { return this->levelCount > 0; }
+	GLsizei size() const { return this->edge; }
+	GLsizei levels() const { return this->levelCount; }
+	bool dxt5() const { return this->blockBytes == 16; }
+	// GL_TEXTURE_CUBE_MAP_POSITIVE_X + face is the target, the faces are in the same order in DDS
+	const uint8_t* face(int face, int level, GLsizei* edgeOut, GLsizei* bytesOut) const
+	{
+		const uint8_t* data = this->file.data() + sizeof(DdsHeader) + face * this->faceBytes;
+		GLsizei levelEdge = this->edge;
+		for (int i = 0; i < level; i++)
+		{
+			data += this->levelBytes(levelEdge);
+			levelEdge = std::max(1, levelEdge / 2);
+		}
+		*edgeOut = levelEdge;
+		// At most DDS_MAX_CUBE_MAP_EDGE, so a level is well inside a GLsizei
+		*bytesOut = (GLsizei)this->levelBytes(levelEdge);
+		return data;
+	}
+
+private:
+	MappedFile file;
+	GLsizei edge = 0;
+	GLsizei levelCount = 0;
+	GLsizei blockBytes = 0;
+	uint64_t faceBytes = 0;
+
+	uint64_t levelBytes(GLsizei levelEdge) const
+	{
+		const uint64_t blocks = (uint64_t)std::max(1, (levelEdge + 3) / 4);
+		return blocks * blocks * (uint64_t)this->blockBytes;
+	}
+
+	bool parse()
+	{
+		if (this->file.size() < sizeof(DdsHeader))
+			return false;
+		const DdsHeader* header = (const DdsHeader*)this->file.data();
+		if (header->magic != DDS_MAGIC || header->size != sizeof(DdsHeader) - sizeof(uint32_t))
+			return false;
+		if ((header->caps2 & DDS_CAPS2_CUBEMAP_ALL_FACES) != DDS_CAPS2_CUBEMAP_ALL_FACES || header->width != header->height || !header->width
+			|| header->width > DDS_MAX_CUBE_MAP_EDGE)
+			return false;
+		if (header->fourCC == DDS_FOURCC_DXT1)
+			this->blockBytes = 8;
+		else if (header->fourCC == DDS_FOURCC_DXT5)
+			this->blockBytes = 16;
+		else
+			return false;
+
+		this->edge = (GLsizei)header->width;
+		// No more levels than halving the edge down to 1 makes, whatever the header claims
+		GLsizei fullChain = 1;
+		for (GLsizei levelEdge = this->edge; levelEdge > 1; levelEdge /= 2)
+			fullChain++;
+		const GLsizei mips = header->mipMapCount ? (GLsizei)std::min(header->mipMapCount, (uint32_t)fullChain) : 1;
+		this->faceBytes = 0;
+		for (GLsizei level = 0, levelEdge = this->edge; level < mips; level++, levelEdge = std::max(1, levelEdge / 2))
+			this->faceBytes += this->levelBytes(levelEdge);
+		if ((uint64_t)sizeof(DdsHeader) + this->faceBytes * 6 > (uint64_t)this->file.size())
+			return false;
+		this->levelCount = mips;
+		return true;
+	}
+};
+
+// Creates a mipmapped texture straight from the mapping, needs a current GL context
+static GLuint _uploadMappedImage(const MappedImage& image)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, image.alignment());
+	glTexImage2D(GL_TEXTURE_2D, 0, image.internalFormat(), image.width(), image.height(), 0, image.format(), image.type(), image.pixels());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+// Converts a PPM into the raw format, one row at a time so a 4K image never needs a second full copy in memory
+static bool _writeRawImage(const MappedImage& source, const string& path)
+{
+	if (source.isRaw())
+		return false;
+	ofstream out(path.c_str(), ios::binary | ios::trunc);
+	if (!out)
+		return false;
+
+	RawImageHeader header;
+	header.magic = RAW_IMAGE_MAGIC;
+	header.version = RAW_IMAGE_VERSION;
+	header.width = (uint32_t)source.width();
+	header.height = (uint32_t)source.height();
+	out.write((const char*)&header, sizeof(header));
+
+	vector<uint8_t> row((size_t)source.width() * 4);
+	for (GLsizei y = 0; y < source.height(); y++)
+	{
+		const uint8_t* in = source.pixels() + (size_t)y * source.width() * 3;
+		for (GLsizei x = 0; x < source.width(); x++)
+		{
+			row[x * 4 + 0] = in[x * 3 + 2];
+			row[x * 4 + 1] = in[x * 3 + 1];
+			row[x * 4 + 2] = in[x * 3 + 0];
+			row[x * 4 + 3] = 255;
+		}
+		out.write((const char*)row.data(), row.size());
+	}
+	return (bool)out;
+}
@@ -29,6 +29,7 @@ limitations under the License.
 #include <utility>
 #include "mesh.h"
 #include "model.h"
+#include "imagefile.h"
 
 #define __STDC_FORMAT_MACROS 1
 
@@ -437,6 +438,7 @@ private:
 
 #include <map>
 #include <chrono>
+#include "cubebackground.h"
 
 /************************************************************************************
 * Constants
@@ -1574,7 +1576,17 @@ protected:
 		ovr_GetTextureSwapChainBufferGL(_session, _eyeTexture, curIndex, &curTexId);
 		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
 		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curTexId, 0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		if (_cubeBackground.layerActive()) {
+			// The background layer shows through wherever the scene leaves the clear
+			GLfloat clearColor[4];
+			glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+		}
+		else {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		}
 
 		ovr::for_each_eye([&](ovrEyeType eye) {
 			const auto& vp = _sceneLayer.Viewport[eye];
@@ -1611,12 +1623,25 @@ protected:
 				//_renderAvatar(_avatar, ovrAvatarVisibilityFlag_ThirdPerson, view * reflection, proj, glm::vec3(reflection * glm::vec4(eyeWorld, 1.0f)), false);
 				glFrontFace(GL_CCW);
 			}
+
+			// Without the layer the background goes last, into what is left at the far plane
+			_cubeBackground.draw(_eyeProjections[eye], ovr::toGlm(eyePoses[eye]));
 		});
 		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
 		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 		ovr_CommitTextureSwapChain(_session, _eyeTexture);
-		ovrLayerHeader* headerList = &_sceneLayer.Header;
-		ovr_SubmitFrame(_session, frame, &_viewScaleDesc, &headerList, 1);
+		// The background layer, when there is one, goes under the scene
+		ovrLayerHeader* headerList[2];
+		unsigned int layerCount = 0;
+		const bool backgroundLayer = _cubeBackground.layerActive();
+		if (backgroundLayer) {
+			headerList[layerCount++] = _cubeBackground.header();
+		}
+		headerList[layerCount++] = &_sceneLayer.Header;
+		ovrResult submitted = ovr_SubmitFrame(_session, frame, &_viewScaleDesc, headerList, layerCount);
+		if (backgroundLayer && !OVR_SUCCESS(submitted) && submitted != ovrError_DisplayLost) {
+			_cubeBackground.dropLayer();
+		}
 
 		GLuint mirrorTextureId;
 		ovr_GetMirrorTextureBufferGL(_session, _mirrorTexture, &mirrorTextureId);
@@ -1778,7 +1803,9 @@ struct ColorCubeScene {
 	oglplus::VertexArray vao;
 	GLuint instanceCount;
 	oglplus::Buffer instances;
-	unsigned char * _data;
+	// The test pattern and its UVs, decoded and uploaded once when the scene is built
+	GLuint texture_ID{ 0 };
+	GLuint uv_ID{ 0 };
 	int _width = 0;
 	int _height = 0;
 	MyShader sd;
@@ -1869,6 +1896,36 @@ public:
 				instance_attr.Enable();
 			}
 		}
+
+		loadTexture();
+	}
+
+	~ColorCubeScene() {
+		glDeleteTextures(1, &texture_ID);
+		glDeleteBuffers(1, &uv_ID);
+	}
+
+	// Maps the test pattern once and uploads it straight from the mapping. A raw conversion of it
+	// (see --convert-image) is preferred when there is one, it uploads without any swizzling.
+	void loadTexture() {
+		MappedImage image;
+		if (image.open("./vr_test_pattern.rawtex") || image.open("./vr_test_pattern.ppm")) {
+			_width = image.width();
+			_height = image.height();
+			texture_ID = _uploadMappedImage(image);
+		}
+		else {
+			std::cerr << "error reading test pattern, could not locate vr_test_pattern.ppm" << std::endl;
+		}
+
+		glGenBuffers(1, &uv_ID);
+		glBindBuffer(GL_ARRAY_BUFFER, uv_ID);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(uvs), uvs, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// Set our "myTextureSampler" sampler to user Texture Unit 0, it never changes
+		sd.Use();
+		glUniform1i(glGetUniformLocation(sd.Program, "myTextureSampler"), 0);
 	}
 
 	void render(const mat4 & projection, const mat4 & modelview) {
@@ -1878,37 +1935,13 @@ public:
 		Uniform<mat4>(prog, "CameraMatrix").Set(modelview);
 		mat4 model = glm::scale(mat4(1), glm::vec3(1.5f, 1.5f, 1.5f));
 		Uniform<mat4>(prog, "model").Set(model);
-		vao.Bind();
-		cube.Draw(instanceCount);
 
-		_data = loadPPM(".\vr_test_pattern.ppm", _width, _height);
-		GLuint texture_ID;
-		glGenTextures(1, &texture_ID);
-		glBindTexture(GL_TEXTURE_2D, texture_ID);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _width, _height, 0, GL_RGB,
-			GL_UNSIGNED_BYTE, _data);
-		// Setup filtering (explained on slide 13)
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		// Get a handle for our "myTextureSampler" uniform, and an ID for uv coordinates.
-		GLuint textureSpl_handle = glGetUniformLocation(sd.Program, "myTextureSampler");
-		GLuint uv_ID;
-		glGenBuffers(1, &uv_ID);
-		glBindBuffer(GL_ARRAY_BUFFER, uv_ID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(uvs), uvs, GL_STATIC_DRAW);
-
-		// Bind texture in Texture Unit 0
+		// Bind texture in Texture Unit 0, everything else about it was set up once in loadTexture
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, texture_ID);
-		// Set our "myTextureSampler" sampler to user Texture Unit 0
-		glUniform1i(textureSpl_handle, 0);
-
-		// Second attribute buffer: UVs. assuming you were using attribArry(0) for vertex positions.
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uv_ID);
 
-		// Do not forget to disable this one the same way you disable AttribArray(0)
-		glDisableVertexAttribArray(0);
+		vao.Bind();
+		cube.Draw(instanceCount);
 	}
 };
 
@@ -1941,6 +1974,9 @@ protected:
 		ovr_RecenterTrackingOrigin(_session);
 
 		cubeScene = std::shared_ptr<ColorCubeScene>(new ColorCubeScene());
+
+		// The environment's backdrop, to the compositor as a cube layer where the runtime takes one
+		_cubeBackground.init(_session, "./environment.dds");
 	}
 
 	void shutdownGl() override {
@@ -1967,6 +2003,20 @@ protected:
 // Execute our example class
 int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
 	int result = -1;
+	// --convert-image <in.ppm> <out.rawtex> converts offline and exits
+	if (const char * convert = strstr(lpCmdLine, "--convert-image")) {
+		char input[MAX_PATH], output[MAX_PATH];
+		MappedImage image;
+		if (sscanf(convert, "--convert-image %259s %259s", input, output) != 2 || !image.open(input) || !_writeRawImage(image, output)) {
+			std::cerr << "usage: --convert-image <in.ppm> <out.rawtex>" << std::endl;
+			return -1;
+		}
+		return 0;
+	}
+	// --no-cube-layer draws the background in the app even where the runtime takes cube layers
+	if (strstr(lpCmdLine, "--no-cube-layer")) {
+		_cubeBackground.setLayerAllowed(false);
+	}
 	try {
 		// Initialization call
 		if (ovr_PlatformInitializeWindows(MIRROR_SAMPLE_APP_ID) != ovrPlatformInitialize_Success)
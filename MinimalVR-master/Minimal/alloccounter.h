@@ -0,0 +1,200 @@
+#pragma once
+// Std. Includes
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+// Windows Includes
+#include <Windows.h>
+#include "alloctag.h"
+
+// Process wide count of global operator new calls, used to check that the render loop doesn't allocate.
+//
+// The replacement allocation functions below may only be defined once per program, so this header
+// must only be included from one translation unit (main.cpp).
+//
+// Each allocation carries a header in front of it with its size and AllocationTag, so the bytes it was charged
+// are taken off the same tag when it is freed. The header is the size of malloc's alignment, which the pointer
+// handed out keeps.
+#define ALLOCATION_HEADER_BYTES 16
+
+static std::atomic<uint64_t> _allocationCount(0);
+static std::atomic<uint64_t> _allocationBytes(0);
+
+// Per tag: allocations made, bytes ever allocated and bytes still allocated
+struct AllocationTagCounters
+{
+	std::atomic<uint64_t> count{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+	std::atomic<int64_t> live{ 0 };
+};
+static AllocationTagCounters _allocationTags[(int)AllocationTag::Count];
+
+// Allocations made inside a CriticalAllocationScope, on any thread, and the size of the latest
+static std::atomic<uint64_t> _criticalAllocationCount(0);
+static std::atomic<uint64_t> _criticalAllocationSize(0);
+// Set by --break-on-critical-alloc, traps into the debugger at the allocation so its stack can be read
+static bool _allocationBreakOnCritical = false;
+
+struct AllocationHeader
+{
+	uint64_t size;
+	uint8_t tag;
+};
+static_assert(sizeof(AllocationHeader) <= ALLOCATION_HEADER_BYTES, "allocation header outgrew its slot");
+
+// The calling thread's own counts, which no other thread's allocations disturb
+static uint64_t& _threadAllocationCount()
+{
+	static thread_local uint64_t count = 0;
+	return count;
+}
+
+static uint64_t& _threadAllocationBytes()
+{
+	static thread_local uint64_t bytes = 0;
+	return bytes;
+}
+
+static void* _countedAlloc(size_t size)
+{
+	uint8_t* block = (uint8_t*)malloc(ALLOCATION_HEADER_BYTES + size);
+	if (!block)
+		return nullptr;
+	_allocationCount.fetch_add(1, std::memory_order_relaxed);
+	_allocationBytes.fetch_add(size, std::memory_order_relaxed);
+	_threadAllocationCount()++;
+	_threadAllocationBytes() += size;
+	const AllocationTag tag = _allocationTag();
+	AllocationTagCounters& counters = _allocationTags[(int)tag];
+	counters.count.fetch_add(1, std::memory_order_relaxed);
+	counters.bytes.fetch_add(size, std::memory_order_relaxed);
+	counters.live.fetch_add((int64_t)size, std::memory_order_relaxed);
+	if (_allocationCriticalDepth() > 0)
+	{
+		_criticalAllocationCount.fetch_add(1, std::memory_order_relaxed);
+		_criticalAllocationSize.store(size, std::memory_order_relaxed);
+		if (_allocationBreakOnCritical)
+			DebugBreak();
+	}
+
+	AllocationHeader* header = (AllocationHeader*)block;
+	header->size = size;
+	header->tag = (uint8_t)tag;
+	return block + ALLOCATION_HEADER_BYTES;
+}
+
+static void _countedFree(void* p)
+{
+	if (!p)
+		return;
+	uint8_t* block = (uint8_t*)p - ALLOCATION_HEADER_BYTES;
+	const AllocationHeader* header = (const AllocationHeader*)block;
+	_allocationTags[header->tag].live.fetch_sub((int64_t)header->size, std::memory_order_relaxed);
+	free(block);
+}
+
+void* operator new(size_t size)
+{
+	void* p = _countedAlloc(size);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	void* p = _countedAlloc(size);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return _countedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return _countedAlloc(size); }
+void operator delete(void* p) noexcept { _countedFree(p); }
+void operator delete[](void* p) noexcept { _countedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { _countedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { _countedFree(p); }
+
+// Snapshot of the counters, subtract two to get the allocations made in between
+struct AllocationSample
+{
+	uint64_t count;
+	uint64_t bytes;
+
+	static AllocationSample now()
+	{
+		AllocationSample sample;
+		sample.count = _allocationCount.load(std::memory_order_relaxed);
+		sample.bytes = _allocationBytes.load(std::memory_order_relaxed);
+		return sample;
+	}
+
+	// The calling thread's allocations only
+	static AllocationSample thread()
+	{
+		AllocationSample sample;
+		sample.count = _threadAllocationCount();
+		sample.bytes = _threadAllocationBytes();
+		return sample;
+	}
+
+	AllocationSample operator-(const AllocationSample& other) const
+	{
+		AllocationSample delta;
+		delta.count = this->count - other.count;
+		delta.bytes = this->bytes - other.bytes;
+		return delta;
+	}
+};
+
+// Marks a stretch of the calling thread that must not allocate. Allocations inside it still succeed but count
+// in _criticalAllocationCount, and break into the debugger with --break-on-critical-alloc.
+class CriticalAllocationScope
+{
+public:
+	CriticalAllocationScope() : start(AllocationSample::thread())
+	{
+		_allocationCriticalDepth()++;
+	}
+	~CriticalAllocationScope()
+	{
+		this->end();
+	}
+
+	CriticalAllocationScope(const CriticalAllocationScope&) = delete;
+	CriticalAllocationScope& operator=(const CriticalAllocationScope&) = delete;
+
+	// Closes the scope early, returns what this thread allocated inside it
+	AllocationSample end()
+	{
+		if (this->open)
+		{
+			this->open = false;
+			_allocationCriticalDepth()--;
+			this->allocated = AllocationSample::thread() - this->start;
+		}
+		return this->allocated;
+	}
+
+private:
+	AllocationSample start;
+	AllocationSample allocated{ 0, 0 };
+	bool open = true;
+};
+
+// Heap use by tag so far, one line each
+static void _printAllocationTags()
+{
+	printf("Heap by subsystem:\r\n");
+	for (int tag = 0; tag < (int)AllocationTag::Count; tag++)
+	{
+		const AllocationTagCounters& counters = _allocationTags[tag];
+		printf("  %-16s %10llu allocations %10llu KB allocated %10lld KB live\r\n", ALLOCATION_TAG_NAMES[tag],
+			(unsigned long long)counters.count.load(std::memory_order_relaxed),
+			(unsigned long long)(counters.bytes.load(std::memory_order_relaxed) / 1024),
+			(long long)(counters.live.load(std::memory_order_relaxed) / 1024));
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+using namespace std;
+
+// Subsystems heap allocations are attributed to, see alloccounter.h. Every allocation is charged to the tag
+// current on its thread when it was made, and its bytes stay charged there until it is freed, whoever frees it.
+enum class AllocationTag : uint8_t {
+	Untagged,
+	ModelImport,
+	// Vertex and index vectors of meshes, as converted, optimized, simplified or read from the mesh cache
+	MeshData,
+	AvatarAssets,
+	Textures,
+	Gameplay,
+	// Anything the render loop allocates that nothing more specific claims
+	FrameTransient,
+	Count,
+};
+
+static const char* const ALLOCATION_TAG_NAMES[(int)AllocationTag::Count] = {
+	"untagged", "model_import", "mesh_data", "avatar_assets", "textures", "gameplay", "frame_transient",
+};
+
+// The calling thread's current tag
+static AllocationTag& _allocationTag()
+{
+	static thread_local AllocationTag tag = AllocationTag::Untagged;
+	return tag;
+}
+
+// Depth of CriticalAllocationScopes open on the calling thread, allocating while it isn't zero is flagged
+static int& _allocationCriticalDepth()
+{
+	static thread_local int depth = 0;
+	return depth;
+}
+
+// Makes tag current on this thread for its lifetime, then puts back whatever was. Jobs run under the tag of the
+// thread that queued them, so a scope covers the parallelFor bodies it starts too.
+class AllocationTagScope
+{
+public:
+	explicit AllocationTagScope(AllocationTag tag) : outer(_allocationTag())
+	{
+		_allocationTag() = tag;
+	}
+	~AllocationTagScope()
+	{
+		_allocationTag() = this->outer;
+	}
+
+	AllocationTagScope(const AllocationTagScope&) = delete;
+	AllocationTagScope& operator=(const AllocationTagScope&) = delete;
+
+private:
+	AllocationTag outer;
+};
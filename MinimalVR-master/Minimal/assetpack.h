@@ -0,0 +1,238 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+#include "mappedfile.h"
+
+// Baked assets in one file, mapped once at startup, so loading them never opens another file. Written offline by
+// --pack-assets from mesh caches (already optimized and with their levels of detail), shader sources and
+// prebuilt .dds/.ktx textures; any of them may instead be left loose on disk.
+//
+// Layout (all little endian):
+//   AssetPackHeader
+//   AssetPackEntry[entryCount], sorted by name
+//   the names, back to back
+//   each asset's bytes, starting ASSET_PACK_ALIGNMENT aligned
+//
+// What is in a pack is what is used: mesh caches in it aren't checked against their source model, rebuilding the
+// pack is what makes them current.
+
+#define ASSET_PACK_MAGIC 0x4B415041 // "APAK"
+#define ASSET_PACK_VERSION 1
+// Enough for any vertex or block data read in place, and a cache line
+#define ASSET_PACK_ALIGNMENT 64
+
+struct AssetPackHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t reserved;
+};
+
+struct AssetPackEntry
+{
+	// From the start of the file
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	uint64_t offset;
+	uint64_t size;
+};
+
+// Bytes of one asset inside the mapped pack, valid as long as the pack stays open
+struct AssetSpan
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+};
+
+// The name an asset is packed under: its path with "./" in front dropped and '\' as '/'
+static string _assetPackName(const string& path)
+{
+	string name = path;
+	std::replace(name.begin(), name.end(), '\\', '/');
+	while (name.compare(0, 2, "./") == 0)
+		name.erase(0, 2);
+	return name;
+}
+
+class AssetPack
+{
+public:
+	AssetPack() {}
+
+	AssetPack(const AssetPack&) = delete;
+	AssetPack& operator=(const AssetPack&) = delete;
+
+	// False, and nothing is found, if the file is missing or not a pack of this version
+	bool open(const string& path)
+	{
+		this->close();
+		if (!this->file.open(path))
+			return false;
+		const uint8_t* data = this->file.data();
+		const size_t size = this->file.size();
+		const AssetPackHeader* header = (const AssetPackHeader*)data;
+		if (size < sizeof(AssetPackHeader) || header->magic != ASSET_PACK_MAGIC || header->version != ASSET_PACK_VERSION ||
+			sizeof(AssetPackHeader) + (size_t)header->entryCount * sizeof(AssetPackEntry) > size)
+		{
+			cout << "ERROR::ASSETPACK::INVALID " << path << endl;
+			this->file.close();
+			return false;
+		}
+		const AssetPackEntry* entries = (const AssetPackEntry*)(data + sizeof(AssetPackHeader));
+		for (uint32_t i = 0; i < header->entryCount; i++)
+		{
+			const AssetPackEntry& entry = entries[i];
+			if ((size_t)entry.nameOffset + entry.nameLength > size || entry.offset > size || entry.size > size - entry.offset)
+			{
+				cout << "ERROR::ASSETPACK::INVALID " << path << endl;
+				this->file.close();
+				return false;
+			}
+		}
+		this->entries = entries;
+		this->count = header->entryCount;
+		return true;
+	}
+
+	void close()
+	{
+		this->file.close();
+		this->entries = nullptr;
+		this->count = 0;
+	}
+
+	bool isOpen() const { return this->file.isOpen(); }
+
+	// The asset packed for path, by binary search over the sorted names so nothing is allocated
+	bool find(const string& path, AssetSpan* span) const
+	{
+		if (!this->count)
+			return false;
+		const string name = _assetPackName(path);
+		const uint8_t* data = this->file.data();
+		const AssetPackEntry* first = this->entries;
+		const AssetPackEntry* last = this->entries + this->count;
+		const AssetPackEntry* found = std::lower_bound(first, last, name, [data](const AssetPackEntry& entry, const string& key)
+		{
+			return key.compare(0, string::npos, (const char*)data + entry.nameOffset, entry.nameLength) > 0;
+		});
+		if (found == last || name.compare(0, string::npos, (const char*)data + found->nameOffset, found->nameLength) != 0)
+			return false;
+		span->data = data + found->offset;
+		span->size = (size_t)found->size;
+		return true;
+	}
+
+	uint32_t size() const { return this->count; }
+
+private:
+	MappedFile file;
+	const AssetPackEntry* entries = nullptr;
+	uint32_t count = 0;
+};
+
+// The pack next to the executable, opened by WinMain unless --no-pack
+static AssetPack _assetPack;
+
+static inline size_t _assetPackAlign(size_t size)
+{
+	return (size + ASSET_PACK_ALIGNMENT - 1) & ~(size_t)(ASSET_PACK_ALIGNMENT - 1);
+}
+
+// Offline, for --pack-assets: packs every file of paths under its _assetPackName. Written under a temporary name
+// and moved into place like a mesh cache, so a pack is never seen half written.
+static bool _writeAssetPack(const string& packPath, const vector<string>& paths)
+{
+	vector<string> names;
+	for (size_t i = 0; i < paths.size(); i++)
+		names.push_back(_assetPackName(paths[i]));
+	vector<size_t> order(paths.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&names](size_t a, size_t b) { return names[a] < names[b]; });
+	for (size_t i = 1; i < order.size(); i++)
+	{
+		if (names[order[i]] == names[order[i - 1]])
+		{
+			cout << "ERROR::ASSETPACK::DUPLICATE " << names[order[i]] << endl;
+			return false;
+		}
+	}
+
+	vector<MappedFile> files(paths.size());
+	vector<AssetPackEntry> entries(paths.size());
+	size_t offset = sizeof(AssetPackHeader) + entries.size() * sizeof(AssetPackEntry);
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		entries[i].nameOffset = (uint32_t)offset;
+		entries[i].nameLength = (uint32_t)names[order[i]].size();
+		offset += names[order[i]].size();
+	}
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		MappedFile& file = files[order[i]];
+		if (!file.open(paths[order[i]]))
+		{
+			cout << "ERROR::ASSETPACK::UNREADABLE " << paths[order[i]] << endl;
+			return false;
+		}
+		offset = _assetPackAlign(offset);
+		entries[i].offset = offset;
+		entries[i].size = file.size();
+		offset += file.size();
+	}
+
+	const string tempPath = packPath + ".tmp";
+	{
+		ofstream out(tempPath.c_str(), ios::binary | ios::trunc);
+		if (!out)
+			return false;
+
+		AssetPackHeader header;
+		header.magic = ASSET_PACK_MAGIC;
+		header.version = ASSET_PACK_VERSION;
+		header.entryCount = (uint32_t)entries.size();
+		header.reserved = 0;
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)entries.data(), entries.size() * sizeof(AssetPackEntry));
+		size_t written = sizeof(header) + entries.size() * sizeof(AssetPackEntry);
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			out.write(names[order[i]].data(), names[order[i]].size());
+			written += names[order[i]].size();
+		}
+
+		const char padding[ASSET_PACK_ALIGNMENT] = {};
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			out.write(padding, entries[i].offset - written);
+			const MappedFile& file = files[order[i]];
+			out.write((const char*)file.data(), file.size());
+			written = (size_t)(entries[i].offset + entries[i].size);
+		}
+		if (!out)
+		{
+			out.close();
+			DeleteFileA(tempPath.c_str());
+			return false;
+		}
+	}
+
+	if (!MoveFileExA(tempPath.c_str(), packPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		cout << "ERROR::ASSETPACK:: Could not write " << packPath << endl;
+		DeleteFileA(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,175 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+#include <assimp/Importer.hpp>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+#include "mappedfile.h"
+#include "assetpack.h"
+
+// Read-only Assimp stream over bytes in memory: a span of _assetPack, or a file it maps itself and unmaps on close.
+// Reads are a memcpy out of the view, the file is never read through stdio.
+class MappedIOStream : public Assimp::IOStream
+{
+public:
+	explicit MappedIOStream(const AssetSpan& span) : data(span.data), length(span.size) {}
+	explicit MappedIOStream(const string& path)
+	{
+		if (this->file.open(path))
+		{
+			this->data = this->file.data();
+			this->length = this->file.size();
+		}
+	}
+
+	MappedIOStream(const MappedIOStream&) = delete;
+	MappedIOStream& operator=(const MappedIOStream&) = delete;
+
+	bool valid() const { return this->data != nullptr; }
+
+	size_t Read(void* buffer, size_t size, size_t count) override
+	{
+		if (!size)
+			return 0;
+		count = std::min(count, (this->length - this->position) / size);
+		memcpy(buffer, this->data + this->position, size * count);
+		this->position += size * count;
+		return count;
+	}
+
+	size_t Write(const void*, size_t, size_t) override { return 0; }
+
+	aiReturn Seek(size_t offset, aiOrigin origin) override
+	{
+		size_t target;
+		switch (origin)
+		{
+		case aiOrigin_SET: target = offset; break;
+		case aiOrigin_CUR: target = this->position + offset; break;
+		case aiOrigin_END: target = this->length - offset; break;
+		default: return aiReturn_FAILURE;
+		}
+		if (target > this->length)
+			return aiReturn_FAILURE;
+		this->position = target;
+		return aiReturn_SUCCESS;
+	}
+
+	size_t Tell() const override { return this->position; }
+	size_t FileSize() const override { return this->length; }
+	void Flush() override {}
+
+private:
+	MappedFile file;
+	const uint8_t* data = nullptr;
+	size_t length = 0;
+	size_t position = 0;
+};
+
+// What Assimp opens, the OBJ and every MTL it references, comes out of _assetPack if it's packed and is mapped
+// from disk otherwise. Opening for writing fails, the importer only ever reads.
+class MappedIOSystem : public Assimp::IOSystem
+{
+public:
+	bool Exists(const char* path) const override
+	{
+		AssetSpan span;
+		FileStamp stamp;
+		return _assetPack.find(path, &span) || _getFileStamp(path, &stamp);
+	}
+
+	char getOsSeparator() const override { return '/'; }
+
+	Assimp::IOStream* Open(const char* path, const char* mode = "rb") override
+	{
+		if (strchr(mode, 'w') || strchr(mode, 'a') || strchr(mode, '+'))
+			return nullptr;
+		AssetSpan span;
+		if (_assetPack.find(path, &span))
+			return new MappedIOStream(span);
+		MappedIOStream* stream = new MappedIOStream(string(path));
+		if (!stream->valid())
+		{
+			delete stream;
+			return nullptr;
+		}
+		return stream;
+	}
+
+	void Close(Assimp::IOStream* stream) override
+	{
+		delete stream;
+	}
+};
+
+// Importers kept across models, each with its own MappedIOSystem, so a load doesn't build Assimp's loader and
+// post-processing tables again. Safe from the render and loader threads at once: each load takes an importer of
+// its own and puts it back when done.
+class ImporterPool
+{
+public:
+	ImporterPool() {}
+
+	ImporterPool(const ImporterPool&) = delete;
+	ImporterPool& operator=(const ImporterPool&) = delete;
+
+	// An importer for one load, returned to the pool with its scene freed when the handle goes away
+	class Handle
+	{
+	public:
+		Handle(ImporterPool& pool, unique_ptr<Assimp::Importer> importer) : pool(pool), importer(std::move(importer)) {}
+		Handle(Handle&& other) : pool(other.pool), importer(std::move(other.importer)) {}
+		~Handle()
+		{
+			if (this->importer)
+				this->pool.release(std::move(this->importer));
+		}
+
+		Handle(const Handle&) = delete;
+		Handle& operator=(const Handle&) = delete;
+
+		Assimp::Importer* operator->() const { return this->importer.get(); }
+
+	private:
+		ImporterPool& pool;
+		unique_ptr<Assimp::Importer> importer;
+	};
+
+	Handle acquire()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (!this->idle.empty())
+			{
+				unique_ptr<Assimp::Importer> importer = std::move(this->idle.back());
+				this->idle.pop_back();
+				return Handle(*this, std::move(importer));
+			}
+		}
+		unique_ptr<Assimp::Importer> importer(new Assimp::Importer());
+		// The importer owns and deletes its IO system
+		importer->SetIOHandler(new MappedIOSystem());
+		return Handle(*this, std::move(importer));
+	}
+
+private:
+	void release(unique_ptr<Assimp::Importer> importer)
+	{
+		importer->FreeScene();
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->idle.push_back(std::move(importer));
+	}
+
+	std::mutex mutex;
+	vector<unique_ptr<Assimp::Importer>> idle;
+};
+
+static ImporterPool _importers;
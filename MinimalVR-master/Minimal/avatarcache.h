@@ -0,0 +1,138 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+#include "mappedfile.h"
+
+// Avatar assets as the render thread uploads them, one file per asset in AVATAR_CACHE_DIRECTORY named by its
+// ovrAvatarAssetID. A mesh is its packed vertices, indices and bind pose, a texture its whole mip chain in the
+// format the SDK delivered it (DXT1 and DXT5 stay block compressed). A later launch maps the file and uploads
+// straight from it, without waiting for the asset to come over the network.
+//
+// The SDK is still asked for every asset. sourceHash is a hash of what it delivered when the file was written, and
+// when it delivers the asset again the pump compares the two: the same and the file stays, different and the file
+// is rewritten and the fresh data uploaded over the cached. AVATAR_CACHE_VERSION goes up whenever what is stored per
+// asset changes, older files then simply miss.
+#define AVATAR_CACHE_DIRECTORY "avatarcache"
+#define AVATAR_CACHE_MAGIC 0x43565641 // "AVVC"
+#define AVATAR_CACHE_VERSION 1
+
+struct AvatarCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	// ovrAvatarAssetType
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t assetID;
+	uint64_t sourceHash;
+	// Mesh: vertex, index and joint counts. Texture: ovrAvatarTextureFormat, width, height, mip count.
+	uint32_t counts[4];
+	// Bytes after the header
+	uint64_t payloadSize;
+};
+
+static inline uint64_t _avatarCacheHash(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+static string _avatarCachePath(uint64_t assetID)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.asset", (unsigned long long)assetID);
+	return string(AVATAR_CACHE_DIRECTORY "/") + name;
+}
+
+// One cached asset mapped for upload, the payload valid for as long as the object is
+struct AvatarCachedAsset
+{
+	MappedFile file;
+	AvatarCacheHeader header;
+	const uint8_t* payload = nullptr;
+
+	// False if there is no file for assetID or it isn't one of this version
+	bool open(uint64_t assetID)
+	{
+		if (!this->file.open(_avatarCachePath(assetID)))
+			return false;
+		if (this->file.size() < sizeof(AvatarCacheHeader))
+		{
+			this->file.close();
+			return false;
+		}
+		memcpy(&this->header, this->file.data(), sizeof(this->header));
+		if (this->header.magic != AVATAR_CACHE_MAGIC || this->header.version != AVATAR_CACHE_VERSION || this->header.assetID != assetID ||
+			this->header.payloadSize != this->file.size() - sizeof(AvatarCacheHeader))
+		{
+			this->file.close();
+			return false;
+		}
+		this->payload = this->file.data() + sizeof(AvatarCacheHeader);
+		return true;
+	}
+};
+
+// sourceHash of the file for assetID, false if there isn't one of this version. Reads the header only.
+static bool _avatarCacheSourceHash(uint64_t assetID, uint64_t* hash)
+{
+	ifstream in(_avatarCachePath(assetID).c_str(), ios::binary);
+	AvatarCacheHeader header;
+	in.read((char*)&header, sizeof(header));
+	if (!in || header.magic != AVATAR_CACHE_MAGIC || header.version != AVATAR_CACHE_VERSION || header.assetID != assetID)
+		return false;
+	*hash = header.sourceHash;
+	return true;
+}
+
+// Bytes of one part of a payload
+struct AvatarCacheSection
+{
+	const void* data;
+	size_t size;
+};
+
+// Writes header and sections back to back under header's asset, through a temporary name like the program cache.
+// Fails, leaving the old file, while the render thread still has that one mapped.
+static bool _storeAvatarCache(AvatarCacheHeader header, const AvatarCacheSection* sections, int count)
+{
+	header.magic = AVATAR_CACHE_MAGIC;
+	header.version = AVATAR_CACHE_VERSION;
+	header.reserved = 0;
+	header.payloadSize = 0;
+	for (int i = 0; i < count; i++)
+		header.payloadSize += sections[i].size;
+
+	CreateDirectoryA(AVATAR_CACHE_DIRECTORY, NULL);
+	const string path = _avatarCachePath(header.assetID);
+	const string tempPath = path + ".tmp";
+	{
+		ofstream out(tempPath.c_str(), ios::binary | ios::trunc);
+		if (!out)
+			return false;
+		out.write((const char*)&header, sizeof(header));
+		for (int i = 0; i < count; i++)
+			out.write((const char*)sections[i].data, sections[i].size);
+		if (!out)
+		{
+			out.close();
+			DeleteFileA(tempPath.c_str());
+			return false;
+		}
+	}
+	if (!MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileA(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
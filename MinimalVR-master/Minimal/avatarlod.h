@@ -0,0 +1,111 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <utility>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+// OVR Includes
+#include <OVR_Avatar.h>
+#include "flathashmap.h"
+
+// Distances from the viewer, in metres, past which an avatar drops to the next level
+#define AVATAR_LOD_REDUCED_DISTANCE 3.0f
+#define AVATAR_LOD_DISTANT_DISTANCE 8.0f
+// An avatar must pass a boundary by this much before its level changes, so one standing on it doesn't flip
+#define AVATAR_LOD_HYSTERESIS 0.5f
+
+// How much of itself an avatar gets for where it stands
+enum class AvatarLod : uint8_t
+{
+	// Posed every frame, every part at its material's full shading
+	Full,
+	// Posed every other frame, the whole avatar at reduced shading
+	Reduced,
+	// Posed every fourth frame at reduced shading, without its projectors
+	Distant,
+	Count,
+};
+
+// Frames from one pose update of an avatar to the next at each level
+static const uint32_t _avatarLodPoseInterval[(size_t)AvatarLod::Count] = { 1, 2, 4 };
+
+// Where the avatar stands: its body, or for an avatar without one its first component
+static glm::vec3 _avatarLodPosition(const ovrAvatar* avatar)
+{
+	const ovrAvatarBodyComponent* body = ovrAvatarPose_GetBodyComponent(const_cast<ovrAvatar*>(avatar));
+	const ovrAvatarComponent* component = body && body->renderComponent ? body->renderComponent
+		: ovrAvatarComponent_Count(avatar) ? ovrAvatarComponent_Get(avatar, 0) : nullptr;
+	if (!component)
+		return glm::vec3(0.0f);
+	return glm::vec3(component->transform.position.x, component->transform.position.y, component->transform.position.z);
+}
+
+// The level for distance, given the level the avatar had before
+static AvatarLod _avatarLodForDistance(float distance, AvatarLod previous)
+{
+	static const float boundaries[] = { AVATAR_LOD_REDUCED_DISTANCE, AVATAR_LOD_DISTANT_DISTANCE };
+	uint32_t level = 0;
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		// Going back up takes coming nearer than the boundary, going down getting further than it
+		const float boundary = boundaries[i] + ((uint32_t)previous > i ? -AVATAR_LOD_HYSTERESIS : AVATAR_LOD_HYSTERESIS);
+		if (distance > boundary)
+			level = i + 1;
+	}
+	return (AvatarLod)level;
+}
+
+// Levels of the remote avatars by their distance from the viewer, worked out once a frame before they are posed.
+// The network poses each at its level's rate and the queue shades it at its level; the local avatar is never in here,
+// so it always comes out Full. The reflection asks levelFor() with its own viewer, the avatars are further away there.
+class AvatarLodManager
+{
+public:
+	void setEnabled(bool enabled) { this->on = enabled; }
+	bool enabled() const { return this->on; }
+
+	// avatars are the ones drawn last frame, their poses are where they are now. Avatars gone since drop out.
+	void update(const vector<ovrAvatar*>& avatars, const glm::vec3& viewer)
+	{
+		this->next.clear();
+		for (size_t i = 0; i < (size_t)AvatarLod::Count; i++)
+			this->counts[i] = 0;
+		for (size_t i = 0; i < avatars.size(); i++)
+		{
+			const AvatarLod lod = this->on ? this->levelFor(avatars[i], viewer) : AvatarLod::Full;
+			bool inserted;
+			this->next.insert((uintptr_t)avatars[i], &inserted) = lod;
+			this->counts[(size_t)lod]++;
+		}
+		std::swap(this->levels, this->next);
+	}
+
+	AvatarLod level(const ovrAvatar* avatar) const
+	{
+		const AvatarLod* lod = this->levels.find((uintptr_t)avatar);
+		return lod ? *lod : AvatarLod::Full;
+	}
+
+	// The level avatar would have seen from viewer, from the level it has from the frame's viewer
+	AvatarLod levelFor(const ovrAvatar* avatar, const glm::vec3& viewer) const
+	{
+		if (!this->on)
+			return AvatarLod::Full;
+		return _avatarLodForDistance(glm::length(_avatarLodPosition(avatar) - viewer), this->level(avatar));
+	}
+
+	uint32_t poseInterval(const ovrAvatar* avatar) const { return _avatarLodPoseInterval[(size_t)this->level(avatar)]; }
+
+	// Avatars at lod after the last update()
+	uint32_t count(AvatarLod lod) const { return this->counts[(size_t)lod]; }
+
+private:
+	FlatHashMap<uintptr_t, AvatarLod> levels;
+	FlatHashMap<uintptr_t, AvatarLod> next;
+	uint32_t counts[(size_t)AvatarLod::Count] = {};
+	bool on = true;
+};
+
+static AvatarLodManager _avatarLod;
@@ -0,0 +1,597 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <algorithm>
+using namespace std;
+// Windows Includes
+#include <winsock2.h>
+#include <ws2tcpip.h>
+// OVR Includes
+#include <OVR_Avatar.h>
+
+#define AVATAR_NET_DEFAULT_PORT 40190
+// Remote avatars kept at most, and specifications waited for at most; packets from further users are ignored
+#define AVATAR_NET_MAX_REMOTES 16
+// A remote avatar not heard from for this long is destroyed, its slot free for someone else
+#define AVATAR_NET_IDLE_SECONDS 5.0f
+// A specification asked for that hasn't come after this long no longer holds a place, one arriving later is dropped
+#define AVATAR_NET_REQUEST_SECONDS 10.0f
+// Length of the packets cut for the network, short so a remote pose is never more than this plus the jitter buffer old
+#define AVATAR_NET_PACKET_SECONDS (1.0f / 15.0f)
+// Every this many packets one goes out whole, the others as deltas against it, so a lost keyframe costs a second
+#define AVATAR_NET_KEYFRAME_INTERVAL 15
+// Pose a remote avatar buffers before it starts playing, what absorbs the network's jitter
+#define AVATAR_NET_JITTER_SECONDS 0.1f
+// Beyond this much buffered the oldest packets are skipped, so a stall doesn't leave the avatar behind for good
+#define AVATAR_NET_MAX_BUFFERED_SECONDS 0.4f
+// Encoded bytes per datagram, under a typical MTU once the header and UDP/IP are added
+#define AVATAR_NET_FRAGMENT_BYTES 1200
+#define AVATAR_NET_MAX_FRAGMENTS 16
+// Largest packet a header may claim to expand to, anything bigger is taken for a bad one
+#define AVATAR_NET_MAX_PACKET_BYTES (256 * 1024)
+// Packet durations travel as 16 bits of this unit
+#define AVATAR_NET_DURATION_UNIT (1.0f / 10000.0f)
+#define AVATAR_NET_MAGIC 0x4E41 // "AN"
+#define AVATAR_NET_KEYFRAME 1
+
+// Leads every datagram. A packet that encodes to more than AVATAR_NET_FRAGMENT_BYTES is sent as several datagrams
+// with the same sequence, reassembled on arrival.
+struct AvatarNetHeader
+{
+	uint64_t userID;
+	uint32_t sequence;
+	// Sequence of the keyframe a delta was taken against, a keyframe's own
+	uint32_t reference;
+	// ovrAvatarPacket_Write size the encoded bytes expand to
+	uint32_t packetSize;
+	uint16_t magic;
+	uint16_t duration;
+	uint16_t payloadSize;
+	uint8_t flags;
+	uint8_t fragment;
+	uint8_t fragmentCount;
+	uint8_t reserved[3];
+};
+static_assert(sizeof(AvatarNetHeader) == 32, "AvatarNetHeader is sent as it is");
+
+// The stream's compression. Packets are opaque SDK bytes that change a little from one to the next, so a delta is
+// the XOR with the keyframe, mostly zeros, and every packet is then run length coded as pairs of a zero run and a
+// literal run, each at most 255, with the literals after them. A keyframe is coded against nothing.
+static void _encodeAvatarDelta(const uint8_t* data, uint32_t size, const uint8_t* reference, uint32_t referenceSize, vector<uint8_t>* out)
+{
+	out->clear();
+	uint32_t i = 0;
+	while (i < size)
+	{
+		uint32_t zeros = 0;
+		while (i + zeros < size && zeros < 255 && (data[i + zeros] ^ (i + zeros < referenceSize ? reference[i + zeros] : 0)) == 0)
+			zeros++;
+		i += zeros;
+		const size_t literalsAt = out->size() + 2;
+		out->push_back((uint8_t)zeros);
+		out->push_back(0);
+		uint32_t literals = 0;
+		while (i < size && literals < 255)
+		{
+			const uint8_t value = data[i] ^ (i < referenceSize ? reference[i] : 0);
+			if (value == 0)
+				break;
+			out->push_back(value);
+			literals++;
+			i++;
+		}
+		(*out)[literalsAt - 1] = (uint8_t)literals;
+	}
+}
+
+// False if the coded bytes don't make exactly size bytes. size comes off the wire, so it is checked against what
+// the coded bytes could expand to, 510 bytes a run pair, before anything is allocated for it.
+static bool _decodeAvatarDelta(const uint8_t* coded, size_t codedSize, const uint8_t* reference, uint32_t referenceSize, uint32_t size, vector<uint8_t>* out)
+{
+	if (size > AVATAR_NET_MAX_PACKET_BYTES || size > codedSize / 2 * 510)
+		return false;
+	out->assign(size, 0);
+	uint32_t o = 0;
+	size_t c = 0;
+	while (c + 2 <= codedSize)
+	{
+		const uint32_t zeros = coded[c], literals = coded[c + 1];
+		c += 2;
+		if (o + zeros + literals > size || c + literals > codedSize)
+			return false;
+		for (uint32_t k = 0; k < zeros; k++, o++)
+			(*out)[o] = o < referenceSize ? reference[o] : 0;
+		for (uint32_t k = 0; k < literals; k++, o++)
+			(*out)[o] = coded[c++] ^ (o < referenceSize ? reference[o] : 0);
+	}
+	return o == size && c == codedSize;
+}
+
+// Totals since the last takeCounters(), for the profiler
+struct AvatarNetCounters
+{
+	uint32_t bytesSent = 0;
+	uint32_t bytesReceived = 0;
+	uint32_t packetsLost = 0;
+	// Mean pose buffered ahead of playback over the remote avatars, the latency the jitter buffer adds
+	float bufferedSeconds = 0.0f;
+};
+
+// Someone else's avatar, posed from the packets they send. It only exists once their specification has arrived and
+// been attach()ed; packets before that are dropped, the next keyframe starts the stream.
+struct RemoteAvatar
+{
+	struct Buffered
+	{
+		uint32_t sequence;
+		ovrAvatarPacket* packet;
+		float duration;
+	};
+
+	uint64_t userID = 0;
+	ovrAvatar* avatar = nullptr;
+	// The network's clock when a datagram of theirs last came, what idle avatars are destroyed by
+	float heard = 0.0f;
+
+	// Latest keyframe, what deltas decode against
+	uint32_t keySequence = 0;
+	bool haveKey = false;
+	vector<uint8_t> keyframe;
+
+	// Fragments of the packet being reassembled
+	uint32_t assemblySequence = 0;
+	uint32_t assemblyMask = 0;
+	uint8_t assemblyFragments = 0;
+	vector<uint8_t> assembly;
+	size_t assemblySize = 0;
+
+	// Decoded packets in sequence order, then the one playing and how far into it playback is
+	deque<Buffered> buffer;
+	ovrAvatarPacket* playing = nullptr;
+	uint32_t playingSequence = 0;
+	float playingDuration = 0.0f;
+	float playbackTime = 0.0f;
+	bool started = false;
+
+	// Posed once every poseInterval frames, those in between keep the last pose while playback runs on
+	uint32_t poseInterval = 1;
+	uint32_t framesSincePose = 0;
+	float unposedSeconds = 0.0f;
+
+	float bufferedSeconds() const
+	{
+		float seconds = this->playing ? std::max(this->playingDuration - this->playbackTime, 0.0f) : 0.0f;
+		for (size_t i = 0; i < this->buffer.size(); i++)
+			seconds += this->buffer[i].duration;
+		return seconds;
+	}
+};
+
+// Sends the local avatar's packets to every peer over UDP and poses an avatar per remote user from theirs.
+// One non-blocking socket, drained once a frame on the render thread; nothing here blocks.
+class AvatarNetwork
+{
+public:
+	AvatarNetwork() {}
+	~AvatarNetwork() { this->close(); }
+
+	AvatarNetwork(const AvatarNetwork&) = delete;
+	AvatarNetwork& operator=(const AvatarNetwork&) = delete;
+
+	bool open(uint16_t port, uint64_t localUserID)
+	{
+		WSADATA data;
+		if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		{
+			printf("ERROR::AVATAR_NET::WINSOCK_NOT_STARTED\n");
+			return false;
+		}
+		this->started = true;
+		this->localUserID = localUserID;
+		this->socket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		unsigned long nonBlocking = 1;
+		if (this->socket == INVALID_SOCKET || ::bind(this->socket, (const sockaddr*)&address, sizeof(address)) == SOCKET_ERROR
+			|| ioctlsocket(this->socket, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+		{
+			printf("ERROR::AVATAR_NET::SOCKET_NOT_BOUND %d\n", WSAGetLastError());
+			this->close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+		for (size_t i = 0; i < this->remotes.size(); i++)
+			this->release(this->remotes[i]);
+		this->remotes.clear();
+		this->requests.clear();
+		if (this->socket != INVALID_SOCKET)
+			closesocket(this->socket);
+		this->socket = INVALID_SOCKET;
+		if (this->started)
+			WSACleanup();
+		this->started = false;
+	}
+
+	bool isOpen() const { return this->socket != INVALID_SOCKET; }
+
+	// host is dotted IPv4
+	bool addPeer(const char* host, uint16_t port)
+	{
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		if (inet_pton(AF_INET, host, &address.sin_addr) != 1)
+		{
+			printf("ERROR::AVATAR_NET::BAD_PEER_ADDRESS %s\n", host);
+			return false;
+		}
+		this->peers.push_back(address);
+		return true;
+	}
+
+	// One packet of the local avatar, as AvatarPacketRecorder hands it out
+	void send(const uint8_t* data, uint32_t size, float duration)
+	{
+		if (!this->isOpen() || this->peers.empty())
+			return;
+		const bool key = this->sent % AVATAR_NET_KEYFRAME_INTERVAL == 0;
+		if (key)
+			_encodeAvatarDelta(data, size, nullptr, 0, &this->coded);
+		else
+			_encodeAvatarDelta(data, size, this->keyframe.data(), (uint32_t)this->keyframe.size(), &this->coded);
+		// A packet too large to go is dropped before it counts: deltas stay against the keyframe the peers have, and
+		// a keyframe is tried again with the next packet
+		const size_t fragments = (this->coded.size() + AVATAR_NET_FRAGMENT_BYTES - 1) / AVATAR_NET_FRAGMENT_BYTES;
+		if (fragments > AVATAR_NET_MAX_FRAGMENTS)
+		{
+			printf("ERROR::AVATAR_NET::PACKET_TOO_LARGE %u\n", size);
+			return;
+		}
+		if (key)
+		{
+			this->keyframe.assign(data, data + size);
+			this->keySequence = this->sequence;
+		}
+		this->sent++;
+		AvatarNetHeader header;
+		memset(&header, 0, sizeof(header));
+		header.userID = this->localUserID;
+		header.sequence = this->sequence++;
+		header.reference = this->keySequence;
+		header.packetSize = size;
+		header.magic = AVATAR_NET_MAGIC;
+		header.duration = (uint16_t)std::min(duration / AVATAR_NET_DURATION_UNIT + 0.5f, 65535.0f);
+		header.flags = key ? AVATAR_NET_KEYFRAME : 0;
+		header.fragmentCount = (uint8_t)std::max(fragments, (size_t)1);
+		for (uint8_t f = 0; f < header.fragmentCount; f++)
+		{
+			const size_t begin = f * AVATAR_NET_FRAGMENT_BYTES;
+			header.fragment = f;
+			header.payloadSize = (uint16_t)std::min(this->coded.size() - std::min(begin, this->coded.size()), (size_t)AVATAR_NET_FRAGMENT_BYTES);
+			memcpy(this->datagram, &header, sizeof(header));
+			if (header.payloadSize)
+				memcpy(this->datagram + sizeof(header), this->coded.data() + begin, header.payloadSize);
+			const int length = (int)(sizeof(header) + header.payloadSize);
+			for (size_t p = 0; p < this->peers.size(); p++)
+			{
+				if (sendto(this->socket, (const char*)this->datagram, length, 0, (const sockaddr*)&this->peers[p], sizeof(sockaddr_in)) == length)
+					this->counters.bytesSent += length;
+			}
+		}
+	}
+
+	// Drains the socket. newUser is called for a user heard from who has no avatar and none asked for, who then needs
+	// an avatar specification requested and attach()ed.
+	void receive(const std::function<void(uint64_t userID)>& newUser)
+	{
+		if (!this->isOpen())
+			return;
+		for (;;)
+		{
+			sockaddr_in from;
+			int fromLength = sizeof(from);
+			const int length = recvfrom(this->socket, (char*)this->datagram, sizeof(this->datagram), 0, (sockaddr*)&from, &fromLength);
+			if (length == SOCKET_ERROR)
+			{
+				// WSAECONNRESET is an ICMP from a peer that isn't up yet, the socket keeps working
+				if (WSAGetLastError() == WSAECONNRESET)
+					continue;
+				break;
+			}
+			if (length < (int)sizeof(AvatarNetHeader))
+				continue;
+			AvatarNetHeader header;
+			memcpy(&header, this->datagram, sizeof(header));
+			if (header.magic != AVATAR_NET_MAGIC || header.userID == this->localUserID || header.fragment >= header.fragmentCount
+				|| header.fragmentCount > AVATAR_NET_MAX_FRAGMENTS || (int)(sizeof(header) + header.payloadSize) != length)
+				continue;
+			this->counters.bytesReceived += length;
+			RemoteAvatar* remote = this->find(header.userID);
+			if (!remote)
+			{
+				// Only asked for with room for the avatar, and once until it comes or the request runs out
+				if (this->remotes.size() + this->requests.size() < AVATAR_NET_MAX_REMOTES && !this->requested(header.userID))
+				{
+					this->requests.push_back({ header.userID, this->clock });
+					newUser(header.userID);
+				}
+				continue;
+			}
+			remote->heard = this->clock;
+			this->assemble(*remote, header, this->datagram + sizeof(header));
+		}
+	}
+
+	// Gives a remote user the avatar created from their specification, which the network owns from then on. False
+	// if their specification wasn't asked for or they already have one; the avatar is then the caller's to destroy.
+	bool attach(uint64_t userID, ovrAvatar* avatar)
+	{
+		auto request = std::find_if(this->requests.begin(), this->requests.end(), [userID](const Request& r) { return r.userID == userID; });
+		if (request == this->requests.end() || this->find(userID))
+			return false;
+		this->requests.erase(request);
+		RemoteAvatar* remote = new RemoteAvatar();
+		remote->userID = userID;
+		remote->avatar = avatar;
+		remote->heard = this->clock;
+		this->remotes.push_back(remote);
+		return true;
+	}
+
+	// Whether userID's specification is a remote user's: anyone's but the local user's once the network is open
+	bool isRemote(uint64_t userID) const
+	{
+		return this->isOpen() && userID != this->localUserID;
+	}
+
+	// Moves every remote avatar's playback on by deltaSeconds and poses it there. Avatars idle for
+	// AVATAR_NET_IDLE_SECONDS are destroyed first, so avatars() no longer has them.
+	void update(float deltaSeconds)
+	{
+		this->clock += deltaSeconds;
+		const float now = this->clock;
+		this->requests.erase(std::remove_if(this->requests.begin(), this->requests.end(),
+			[now](const Request& r) { return now - r.asked > AVATAR_NET_REQUEST_SECONDS; }), this->requests.end());
+		for (size_t i = 0; i < this->remotes.size();)
+		{
+			if (now - this->remotes[i]->heard > AVATAR_NET_IDLE_SECONDS)
+			{
+				this->release(this->remotes[i]);
+				this->remotes.erase(this->remotes.begin() + i);
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		float buffered = 0.0f;
+		int counted = 0;
+		for (size_t i = 0; i < this->remotes.size(); i++)
+		{
+			RemoteAvatar& remote = *this->remotes[i];
+			this->play(remote, deltaSeconds);
+			if (remote.started)
+			{
+				buffered += remote.bufferedSeconds();
+				counted++;
+			}
+		}
+		this->counters.bufferedSeconds = counted ? buffered / counted : 0.0f;
+	}
+
+	// Frames from one pose of avatar to the next, from its level of detail; 1 poses it every frame
+	void setPoseInterval(const ovrAvatar* avatar, uint32_t frames)
+	{
+		for (size_t i = 0; i < this->remotes.size(); i++)
+		{
+			if (this->remotes[i]->avatar == avatar)
+				this->remotes[i]->poseInterval = std::max(frames, 1u);
+		}
+	}
+
+	// Remote avatars that exist and have a pose to draw
+	void avatars(vector<ovrAvatar*>* out) const
+	{
+		for (size_t i = 0; i < this->remotes.size(); i++)
+		{
+			if (this->remotes[i]->avatar && this->remotes[i]->started)
+				out->push_back(this->remotes[i]->avatar);
+		}
+	}
+
+	AvatarNetCounters takeCounters()
+	{
+		AvatarNetCounters taken = this->counters;
+		this->counters = AvatarNetCounters();
+		this->counters.bufferedSeconds = taken.bufferedSeconds;
+		return taken;
+	}
+
+private:
+	// A specification asked for and not yet attach()ed
+	struct Request
+	{
+		uint64_t userID;
+		float asked;
+	};
+
+	bool requested(uint64_t userID) const
+	{
+		for (size_t i = 0; i < this->requests.size(); i++)
+		{
+			if (this->requests[i].userID == userID)
+				return true;
+		}
+		return false;
+	}
+
+	RemoteAvatar* find(uint64_t userID)
+	{
+		for (size_t i = 0; i < this->remotes.size(); i++)
+		{
+			if (this->remotes[i]->userID == userID)
+				return this->remotes[i];
+		}
+		return nullptr;
+	}
+
+	void assemble(RemoteAvatar& remote, const AvatarNetHeader& header, const uint8_t* payload)
+	{
+		if (header.sequence != remote.assemblySequence || !remote.assemblyMask)
+		{
+			// A packet left incomplete by a newer one starting is lost
+			if (remote.assemblyMask)
+				this->counters.packetsLost++;
+			remote.assemblySequence = header.sequence;
+			remote.assemblyMask = 0;
+			remote.assemblySize = 0;
+			remote.assemblyFragments = header.fragmentCount;
+			remote.assembly.assign((size_t)header.fragmentCount * AVATAR_NET_FRAGMENT_BYTES, 0);
+		}
+		// The buffer is sized by the first fragment's count, and decoding reads the fragments as one run of bytes:
+		// a fragment disagreeing on the count, or short without being the last, can't be part of this packet
+		const bool last = header.fragment + 1 == header.fragmentCount;
+		if (header.fragmentCount != remote.assemblyFragments || (!last && header.payloadSize != AVATAR_NET_FRAGMENT_BYTES))
+			return;
+		const uint32_t bit = 1u << header.fragment;
+		if (remote.assemblyMask & bit)
+			return;
+		remote.assemblyMask |= bit;
+		memcpy(remote.assembly.data() + header.fragment * AVATAR_NET_FRAGMENT_BYTES, payload, header.payloadSize);
+		remote.assemblySize += header.payloadSize;
+		if (remote.assemblyMask != (1u << header.fragmentCount) - 1)
+			return;
+		remote.assemblyMask = 0;
+
+		const bool key = (header.flags & AVATAR_NET_KEYFRAME) != 0;
+		const bool decodable = key || (remote.haveKey && header.reference == remote.keySequence);
+		if (!decodable || !_decodeAvatarDelta(remote.assembly.data(), remote.assemblySize, key ? nullptr : remote.keyframe.data(),
+			key ? 0 : (uint32_t)remote.keyframe.size(), header.packetSize, &this->decoded))
+		{
+			this->counters.packetsLost++;
+			return;
+		}
+		if (key && (!remote.haveKey || (int32_t)(header.sequence - remote.keySequence) > 0))
+		{
+			remote.keyframe = this->decoded;
+			remote.keySequence = header.sequence;
+			remote.haveKey = true;
+		}
+		// Late packets, behind what is already playing, are of no use any more
+		if (remote.started && (int32_t)(header.sequence - remote.playingSequence) <= 0)
+			return;
+		ovrAvatarPacket* packet = ovrAvatarPacket_Read((uint32_t)this->decoded.size(), this->decoded.data());
+		if (!packet)
+		{
+			this->counters.packetsLost++;
+			return;
+		}
+		RemoteAvatar::Buffered buffered = { header.sequence, packet, header.duration * AVATAR_NET_DURATION_UNIT };
+		auto at = remote.buffer.end();
+		while (at != remote.buffer.begin() && (int32_t)((at - 1)->sequence - header.sequence) > 0)
+			--at;
+		if (at != remote.buffer.begin() && (at - 1)->sequence == header.sequence)
+		{
+			ovrAvatarPacket_Free(packet);
+			return;
+		}
+		remote.buffer.insert(at, buffered);
+	}
+
+	// The existing per packet playback of _updateAvatar: time runs through the packet and carries into the next one.
+	// Running dry holds the end of the last packet until more arrive. Playback runs every frame, the pose is only
+	// taken from it every poseInterval frames, with the time since the last one.
+	void play(RemoteAvatar& remote, float deltaSeconds)
+	{
+		if (!remote.avatar)
+			return;
+		bool due = ++remote.framesSincePose >= remote.poseInterval;
+		if (!remote.started)
+		{
+			if (remote.buffer.empty() || remote.bufferedSeconds() < AVATAR_NET_JITTER_SECONDS)
+				return;
+			remote.started = true;
+			this->next(remote);
+			remote.playbackTime = 0.0f;
+			due = true;
+		}
+		else
+		{
+			remote.playbackTime += deltaSeconds;
+		}
+		while (remote.bufferedSeconds() > AVATAR_NET_MAX_BUFFERED_SECONDS && !remote.buffer.empty())
+		{
+			remote.playbackTime = 0.0f;
+			this->next(remote);
+		}
+		while (remote.playbackTime > remote.playingDuration && !remote.buffer.empty())
+		{
+			remote.playbackTime -= remote.playingDuration;
+			this->next(remote);
+		}
+		remote.playbackTime = std::min(remote.playbackTime, remote.playingDuration);
+		remote.unposedSeconds += deltaSeconds;
+		if (!due)
+			return;
+		ovrAvatar_UpdatePoseFromPacket(remote.avatar, remote.playing, remote.playbackTime);
+		ovrAvatarPose_Finalize(remote.avatar, remote.unposedSeconds);
+		remote.framesSincePose = 0;
+		remote.unposedSeconds = 0.0f;
+	}
+
+	void next(RemoteAvatar& remote)
+	{
+		if (remote.playing)
+			ovrAvatarPacket_Free(remote.playing);
+		const RemoteAvatar::Buffered& front = remote.buffer.front();
+		remote.playing = front.packet;
+		remote.playingSequence = front.sequence;
+		remote.playingDuration = front.duration;
+		remote.buffer.pop_front();
+	}
+
+	void release(RemoteAvatar* remote)
+	{
+		if (remote->playing)
+			ovrAvatarPacket_Free(remote->playing);
+		for (size_t i = 0; i < remote->buffer.size(); i++)
+			ovrAvatarPacket_Free(remote->buffer[i].packet);
+		if (remote->avatar)
+			ovrAvatar_Destroy(remote->avatar);
+		delete remote;
+	}
+
+	SOCKET socket = INVALID_SOCKET;
+	bool started = false;
+	uint64_t localUserID = 0;
+	vector<sockaddr_in> peers;
+	vector<RemoteAvatar*> remotes;
+	vector<Request> requests;
+	// Seconds of update(), what heard and asked are on
+	float clock = 0.0f;
+
+	// Send side of the stream
+	uint32_t sequence = 0;
+	uint32_t sent = 0;
+	uint32_t keySequence = 0;
+	vector<uint8_t> keyframe;
+	vector<uint8_t> coded;
+
+	vector<uint8_t> decoded;
+	uint8_t datagram[sizeof(AvatarNetHeader) + AVATAR_NET_FRAGMENT_BYTES];
+	AvatarNetCounters counters;
+};
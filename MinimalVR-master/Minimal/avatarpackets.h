@@ -0,0 +1,311 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <functional>
+using namespace std;
+// OVR Includes
+#include <OVR_Avatar.h>
+#include "mappedfile.h"
+
+// Seconds of pose each recorded packet holds
+#define AVATAR_PACKET_SECONDS 0.25f
+// Playback advances by this much every frame whatever the frame took, so a replay is the same on every run
+#define AVATAR_PACKET_PLAYBACK_STEP (1.0f / 90.0f)
+
+// Layout of a pose log. The file starts with an AvatarPacketFileHeader, then one record per packet: an
+// AvatarPacketRecord and the packet's ovrAvatarPacket_Write bytes, padded to 8. Records are only ever appended.
+// Closing the log appends the index, one AvatarPacketIndexEntry per record, and an AvatarPacketFooter last.
+// A log cut short by a crash has no footer and is indexed by walking its records instead.
+#define AVATAR_PACKET_MAGIC 0x544B5041u // "APKT"
+#define AVATAR_PACKET_INDEX_MAGIC 0x58444941u // "AIDX"
+#define AVATAR_PACKET_VERSION 1
+
+struct AvatarPacketFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct AvatarPacketRecord
+{
+	uint32_t size;
+	float duration;
+};
+
+struct AvatarPacketIndexEntry
+{
+	uint64_t offset;
+	// Seconds from the start of the log to the start of this packet
+	float start;
+	uint32_t size;
+};
+
+struct AvatarPacketFooter
+{
+	uint64_t indexOffset;
+	uint32_t count;
+	uint32_t magic;
+};
+
+static_assert(sizeof(AvatarPacketRecord) == 8 && sizeof(AvatarPacketIndexEntry) == 16 && sizeof(AvatarPacketFooter) == 16,
+	"AvatarPacket log structures are written as they are");
+
+// Cuts the avatar's pose updates into AVATAR_PACKET_SECONDS packets and appends them to a log as they complete.
+// Listeners get every packet too, log or not, as the ovrAvatarPacket_Write bytes.
+class AvatarPacketRecorder
+{
+public:
+	typedef std::function<void(const uint8_t* data, uint32_t size, float duration)> Listener;
+
+	AvatarPacketRecorder() {}
+	~AvatarPacketRecorder()
+	{
+		if (this->file)
+			fclose(this->file);
+	}
+
+	AvatarPacketRecorder(const AvatarPacketRecorder&) = delete;
+	AvatarPacketRecorder& operator=(const AvatarPacketRecorder&) = delete;
+
+	bool open(const char* path)
+	{
+		this->file = fopen(path, "wb");
+		if (!this->file)
+		{
+			printf("ERROR::AVATAR_PACKETS::LOG_NOT_OPENED %s\n", path);
+			return false;
+		}
+		const AvatarPacketFileHeader header = { AVATAR_PACKET_MAGIC, AVATAR_PACKET_VERSION };
+		fwrite(&header, sizeof(header), 1, this->file);
+		this->offset = sizeof(header);
+		return true;
+	}
+
+	bool isOpen() const { return this->file != nullptr; }
+
+	// Called on the thread that updates the avatar, right after each packet is written
+	void subscribe(Listener listener)
+	{
+		this->listeners.push_back(listener);
+	}
+
+	// Shorter packets for listeners that need them sooner, the network, apply from the next packet
+	void setPacketSeconds(float seconds)
+	{
+		this->packetSeconds = seconds;
+	}
+
+	// After every pose update of avatar
+	void update(ovrAvatar* avatar, float deltaSeconds)
+	{
+		if (!this->file && this->listeners.empty())
+			return;
+		if (!this->recording)
+		{
+			ovrAvatarPacket_BeginRecording(avatar);
+			this->recording = true;
+			this->elapsed = 0.0f;
+			return;
+		}
+		this->elapsed += deltaSeconds;
+		if (this->elapsed >= this->packetSeconds)
+		{
+			this->finishPacket(avatar);
+			ovrAvatarPacket_BeginRecording(avatar);
+			this->recording = true;
+			this->elapsed = 0.0f;
+		}
+	}
+
+	// Writes the packet in progress and the index. avatar may be null when it is already gone, the partial packet is
+	// then lost.
+	void close(ovrAvatar* avatar)
+	{
+		if (!this->file)
+			return;
+		if (this->recording && avatar)
+			this->finishPacket(avatar);
+		this->recording = false;
+		if (!this->index.empty())
+			fwrite(this->index.data(), sizeof(AvatarPacketIndexEntry), this->index.size(), this->file);
+		const AvatarPacketFooter footer = { this->offset, (uint32_t)this->index.size(), AVATAR_PACKET_INDEX_MAGIC };
+		fwrite(&footer, sizeof(footer), 1, this->file);
+		fclose(this->file);
+		this->file = nullptr;
+		this->index.clear();
+	}
+
+private:
+	void finishPacket(ovrAvatar* avatar)
+	{
+		this->recording = false;
+		ovrAvatarPacket* packet = ovrAvatarPacket_EndRecording(avatar);
+		if (!packet)
+			return;
+		const uint32_t size = ovrAvatarPacket_GetSize(packet);
+		this->buffer.resize((size + 7) & ~7u, 0);
+		const bool written = size && ovrAvatarPacket_Write(packet, size, this->buffer.data());
+		const AvatarPacketRecord record = { size, ovrAvatarPacket_GetDurationSeconds(packet) };
+		ovrAvatarPacket_Free(packet);
+		if (!written)
+			return;
+		for (size_t i = 0; i < this->listeners.size(); i++)
+			this->listeners[i](this->buffer.data(), size, record.duration);
+		if (this->file)
+		{
+			AvatarPacketIndexEntry entry = { this->offset, this->time, size };
+			fwrite(&record, sizeof(record), 1, this->file);
+			fwrite(this->buffer.data(), 1, this->buffer.size(), this->file);
+			// Flushed per packet so a crash loses at most the one being recorded
+			fflush(this->file);
+			this->index.push_back(entry);
+			this->offset += sizeof(record) + this->buffer.size();
+			this->time += record.duration;
+		}
+	}
+
+	FILE* file = nullptr;
+	vector<Listener> listeners;
+	float packetSeconds = AVATAR_PACKET_SECONDS;
+	bool recording = false;
+	float elapsed = 0.0f;
+	float time = 0.0f;
+	uint64_t offset = 0;
+	vector<uint8_t> buffer;
+	vector<AvatarPacketIndexEntry> index;
+};
+
+// Plays a pose log back onto an avatar in place of live tracking, from the mapped file, one packet decoded at a
+// time, and from the start again after the last one
+class AvatarPacketPlayer
+{
+public:
+	AvatarPacketPlayer() {}
+	~AvatarPacketPlayer() { this->release(); }
+
+	AvatarPacketPlayer(const AvatarPacketPlayer&) = delete;
+	AvatarPacketPlayer& operator=(const AvatarPacketPlayer&) = delete;
+
+	bool open(const char* path)
+	{
+		this->release();
+		if (!this->log.open(path) || this->log.size() < sizeof(AvatarPacketFileHeader))
+		{
+			printf("ERROR::AVATAR_PACKETS::LOG_NOT_READ %s\n", path);
+			return false;
+		}
+		AvatarPacketFileHeader header;
+		memcpy(&header, this->log.data(), sizeof(header));
+		if (header.magic != AVATAR_PACKET_MAGIC || header.version != AVATAR_PACKET_VERSION)
+		{
+			printf("ERROR::AVATAR_PACKETS::NOT_A_POSE_LOG %s\n", path);
+			this->log.close();
+			return false;
+		}
+		if (!this->readIndex())
+			this->scanIndex();
+		if (this->index.empty())
+		{
+			printf("ERROR::AVATAR_PACKETS::EMPTY_LOG %s\n", path);
+			this->log.close();
+			return false;
+		}
+		this->current = 0;
+		this->time = 0.0f;
+		return this->load(0);
+	}
+
+	bool isOpen() const { return this->packet != nullptr; }
+	size_t packetCount() const { return this->index.size(); }
+
+	// Moves the playback on by AVATAR_PACKET_PLAYBACK_STEP and poses avatar there
+	void advance(ovrAvatar* avatar)
+	{
+		if (!this->packet)
+			return;
+		this->time += AVATAR_PACKET_PLAYBACK_STEP;
+		while (this->time > this->duration)
+		{
+			this->time -= this->duration;
+			if (!this->load((this->current + 1) % this->index.size()))
+				return;
+		}
+		ovrAvatar_UpdatePoseFromPacket(avatar, this->packet, this->time);
+	}
+
+private:
+	// The footer's index, false if the log has no usable one
+	bool readIndex()
+	{
+		if (this->log.size() < sizeof(AvatarPacketFileHeader) + sizeof(AvatarPacketFooter))
+			return false;
+		AvatarPacketFooter footer;
+		memcpy(&footer, this->log.data() + this->log.size() - sizeof(footer), sizeof(footer));
+		const uint64_t indexBytes = (uint64_t)footer.count * sizeof(AvatarPacketIndexEntry);
+		if (footer.magic != AVATAR_PACKET_INDEX_MAGIC || footer.indexOffset + indexBytes + sizeof(footer) != this->log.size())
+			return false;
+		this->index.resize(footer.count);
+		if (footer.count)
+			memcpy(this->index.data(), this->log.data() + footer.indexOffset, (size_t)indexBytes);
+		return true;
+	}
+
+	// Walks the records of a log that was never closed, up to the first one that runs past the end
+	void scanIndex()
+	{
+		this->index.clear();
+		uint64_t offset = sizeof(AvatarPacketFileHeader);
+		float start = 0.0f;
+		while (offset + sizeof(AvatarPacketRecord) <= this->log.size())
+		{
+			AvatarPacketRecord record;
+			memcpy(&record, this->log.data() + offset, sizeof(record));
+			const uint64_t padded = (record.size + 7) & ~7u;
+			if (!record.size || offset + sizeof(record) + padded > this->log.size())
+				break;
+			const AvatarPacketIndexEntry entry = { offset, start, record.size };
+			this->index.push_back(entry);
+			offset += sizeof(record) + padded;
+			start += record.duration;
+		}
+	}
+
+	bool load(size_t which)
+	{
+		if (this->packet)
+			ovrAvatarPacket_Free(this->packet);
+		const AvatarPacketIndexEntry& entry = this->index[which];
+		this->packet = ovrAvatarPacket_Read(entry.size, this->log.data() + entry.offset + sizeof(AvatarPacketRecord));
+		this->current = which;
+		if (!this->packet)
+		{
+			printf("ERROR::AVATAR_PACKETS::PACKET_NOT_DECODED %u\n", (uint32_t)which);
+			return false;
+		}
+		this->duration = ovrAvatarPacket_GetDurationSeconds(this->packet);
+		// An empty packet would never be left
+		if (this->duration <= 0.0f)
+			this->duration = AVATAR_PACKET_PLAYBACK_STEP;
+		return true;
+	}
+
+	void release()
+	{
+		if (this->packet)
+			ovrAvatarPacket_Free(this->packet);
+		this->packet = nullptr;
+		this->index.clear();
+		this->log.close();
+	}
+
+	MappedFile log;
+	vector<AvatarPacketIndexEntry> index;
+	ovrAvatarPacket* packet = nullptr;
+	size_t current = 0;
+	float time = 0.0f;
+	float duration = 0.0f;
+};
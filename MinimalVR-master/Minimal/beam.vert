@@ -0,0 +1,62 @@
+#version 410 core
+// STEREO_MULTIVIEW is defined by the app for the GL_OVR_multiview2 variant, see RiftApp::StereoMode
+#ifdef STEREO_MULTIVIEW
+#extension GL_OVR_multiview2 : require
+layout(num_views = 2) in;
+#endif
+// LaserBeams: no vertex attributes, every instance is a strip of four vertices along one hand's -Z axis, turned
+// about that axis to face the eye. Only built with LATE_LATCH, the hands come from the block.
+
+// x the left hand's length, y the right's
+uniform vec2 beamLength;
+uniform vec4 beamColor[2];
+// Half the width in world units
+uniform float beamWidth;
+
+out vec4 beamTint;
+// x -1 to 1 across the beam, y 0 at the hand to 1 at the end
+out vec2 beamCoord;
+
+layout(std140) uniform LateLatch
+{
+	mat4 view[2];
+	mat4 projection[2];
+	mat4 hands[2];
+};
+// Instanced stereo: every draw is issued with eyeCount times the instances, eye = gl_InstanceID % eyeCount.
+// eyeViewport squeezes each eye into its half of the shared target: xy scale, zw offset in NDC.
+uniform int eyeCount = 1;
+uniform vec4 eyeViewport[2];
+
+void main()
+{
+#ifdef STEREO_MULTIVIEW
+	int eye = int(gl_ViewID_OVR);
+	int hand = gl_InstanceID;
+#else
+	int eye = gl_InstanceID % eyeCount;
+	int hand = gl_InstanceID / eyeCount;
+#endif
+	float along = float(gl_VertexID >> 1);
+	float across = float(gl_VertexID & 1) * 2.0 - 1.0;
+	float reach = hand == 0 ? beamLength.x : beamLength.y;
+
+	// Both ends in view space, pushed sideways across the beam as the eye sees it
+	vec3 start = (view[eye] * hands[hand] * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
+	vec3 end = (view[eye] * hands[hand] * vec4(0.0, 0.0, -reach, 1.0)).xyz;
+	vec3 point = mix(start, end, along);
+	vec3 side = cross(end - start, point);
+	side = dot(side, side) > 0.0 ? normalize(side) : vec3(1.0, 0.0, 0.0);
+	vec4 clip = projection[eye] * vec4(point + side * beamWidth * across, 1.0);
+#ifndef STEREO_MULTIVIEW
+	if (eyeCount > 1)
+	{
+		// Keep each eye out of the other's half, GL_CLIP_DISTANCE0 is enabled by RiftApp
+		gl_ClipDistance[0] = eye == 0 ? clip.w - clip.x : clip.w + clip.x;
+		clip.xy = clip.xy * eyeViewport[eye].xy + eyeViewport[eye].zw * clip.w;
+	}
+#endif
+	gl_Position = reach > 0.0 ? clip : vec4(0.0);
+	beamTint = beamColor[hand];
+	beamCoord = vec2(across, along);
+}
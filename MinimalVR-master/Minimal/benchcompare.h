@@ -0,0 +1,274 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+#include "json.h"
+#include "mappedfile.h"
+#include "random.h"
+#include "jobs.h"
+#include "benchhmd.h"
+
+// Resamples each comparison is bootstrapped from, and frames per resampled block. Frame times follow each other
+// closely, a hitch takes several frames, so blocks of frames are drawn rather than single ones, or the intervals
+// would come out narrower than they are.
+#define BENCH_BOOTSTRAP_RESAMPLES 2000
+#define BENCH_BOOTSTRAP_BLOCK 16
+// Two sided confidence of the intervals. A suite makes well over a hundred comparisons, at 95% a few of them would
+// be flagged by chance every time.
+#define BENCH_BOOTSTRAP_CONFIDENCE 0.99f
+// Smallest change flagged however sure the interval is of it, less doesn't matter against a frame's budget
+#define BENCH_CHANGE_MIN_PERCENT 2.0f
+
+// One run of a report, what --bench-compare needs of it
+struct BenchRunSamples
+{
+	string scenario;
+	vector<float> cpuFrameMs;
+	vector<float> gpuFrameMs;
+};
+
+struct BenchReport
+{
+	string path;
+	string build;
+	string started;
+	string gpu;
+	string driver;
+	vector<BenchRunSamples> runs;
+
+	const BenchRunSamples* find(const string& scenario) const
+	{
+		for (size_t i = 0; i < this->runs.size(); i++)
+		{
+			if (this->runs[i].scenario == scenario)
+				return &this->runs[i];
+		}
+		return nullptr;
+	}
+};
+
+static void _readBenchSamples(const JsonValue* samples, vector<float>* values)
+{
+	if (!samples || samples->type != JsonValue::Type::Array)
+		return;
+	values->reserve(samples->items.size());
+	for (size_t i = 0; i < samples->items.size(); i++)
+		values->push_back((float)samples->items[i].number);
+}
+
+// A BenchHmd report, false if it can't be read or predates the samples
+static bool _loadBenchReport(const string& path, BenchReport* report)
+{
+	MappedFile file;
+	if (!file.open(path))
+	{
+		printf("ERROR::BENCH::REPORT_NOT_FOUND %s\n", path.c_str());
+		return false;
+	}
+	const char* text = (const char*)file.data();
+	JsonValue document;
+	if (!_parseJson(text, text + file.size(), &document) || document.type != JsonValue::Type::Object)
+	{
+		printf("ERROR::BENCH::REPORT_NOT_JSON %s\n", path.c_str());
+		return false;
+	}
+	if (document.intOr("version", 0) < 2)
+	{
+		printf("ERROR::BENCH::REPORT_WITHOUT_SAMPLES %s\n", path.c_str());
+		return false;
+	}
+	report->path = path;
+	report->build = document.textOr("build", "");
+	report->started = document.textOr("started", "");
+	report->gpu = document.textOr("gpu", "");
+	report->driver = document.textOr("driver", "");
+	report->runs.clear();
+	if (const JsonValue* runs = document.get("runs"))
+	{
+		for (size_t i = 0; i < runs->items.size(); i++)
+		{
+			const JsonValue& run = runs->items[i];
+			BenchRunSamples samples;
+			samples.scenario = run.textOr("scenario", "");
+			if (const JsonValue* values = run.get("samples"))
+			{
+				_readBenchSamples(values->get("cpu_frame_ms"), &samples.cpuFrameMs);
+				_readBenchSamples(values->get("gpu_frame_ms"), &samples.gpuFrameMs);
+			}
+			if (!samples.scenario.empty() && !samples.gpuFrameMs.empty())
+				report->runs.push_back(samples);
+		}
+	}
+	return true;
+}
+
+// The newest report in directory from current's GPU and driver, other than current itself. Reports are named after
+// when they started, so the newest sorts last.
+static bool _findBenchBaseline(const string& directory, const BenchReport& current, BenchReport* baseline)
+{
+	vector<string> names;
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA((directory + "\\bench_*.json").c_str(), &found);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+			names.push_back(found.cFileName);
+		while (FindNextFileA(find, &found));
+		FindClose(find);
+	}
+	std::sort(names.rbegin(), names.rend());
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		BenchReport report;
+		if (!_loadBenchReport(directory + "\\" + names[i], &report))
+			continue;
+		if (report.started == current.started || report.gpu != current.gpu || report.driver != current.driver)
+			continue;
+		*baseline = report;
+		return true;
+	}
+	printf("ERROR::BENCH::NO_BASELINE %s has no earlier report from %s, %s\n", directory.c_str(), current.gpu.c_str(), current.driver.c_str());
+	return false;
+}
+
+// Nearest rank percentile, as BenchHmd's report has them. Reorders values.
+static float _benchPercentile(vector<float>& values, float p)
+{
+	const size_t i = std::min((size_t)(p * (values.size() - 1) + 0.5f), values.size() - 1);
+	std::nth_element(values.begin(), values.begin() + i, values.end());
+	return values[i];
+}
+
+// values again, as blocks of BENCH_BOOTSTRAP_BLOCK frames from random places
+static void _benchResample(const vector<float>& values, Random& random, vector<float>* resampled)
+{
+	const size_t block = std::min((size_t)BENCH_BOOTSTRAP_BLOCK, values.size());
+	const uint32_t starts = (uint32_t)(values.size() - block + 1);
+	resampled->clear();
+	while (resampled->size() < values.size())
+	{
+		const size_t start = random.below(starts);
+		const size_t count = std::min(block, values.size() - resampled->size());
+		resampled->insert(resampled->end(), values.begin() + start, values.begin() + start + count);
+	}
+}
+
+enum class BenchVerdict { Same, Regression, Improvement };
+
+// One percentile of one frame time of one scenario, baseline against current
+struct BenchComparison
+{
+	string scenario;
+	const char* metric = "";
+	float percentile = 0.5f;
+	bool gpu = true;
+	float baseline = 0.0f;
+	float current = 0.0f;
+	// Confidence interval of current - baseline, ms
+	float low = 0.0f;
+	float high = 0.0f;
+	BenchVerdict verdict = BenchVerdict::Same;
+};
+
+// Bootstraps the interval of the change in comparison's percentile. It is a regression when the whole interval is
+// above zero and the change is at least BENCH_CHANGE_MIN_PERCENT, an improvement the other way round.
+static void _compareBenchRun(const BenchRunSamples& baseline, const BenchRunSamples& current, uint64_t seed, BenchComparison* comparison)
+{
+	const vector<float>& before = comparison->gpu ? baseline.gpuFrameMs : baseline.cpuFrameMs;
+	const vector<float>& after = comparison->gpu ? current.gpuFrameMs : current.cpuFrameMs;
+	if (before.empty() || after.empty())
+		return;
+	vector<float> scratch = before;
+	comparison->baseline = _benchPercentile(scratch, comparison->percentile);
+	scratch = after;
+	comparison->current = _benchPercentile(scratch, comparison->percentile);
+
+	Random random(seed, RANDOM_STREAM_BENCHMARK);
+	vector<float> deltas(BENCH_BOOTSTRAP_RESAMPLES);
+	vector<float> resampled;
+	for (size_t r = 0; r < deltas.size(); r++)
+	{
+		_benchResample(after, random, &resampled);
+		const float resampledAfter = _benchPercentile(resampled, comparison->percentile);
+		_benchResample(before, random, &resampled);
+		deltas[r] = resampledAfter - _benchPercentile(resampled, comparison->percentile);
+	}
+	const float tail = (1.0f - BENCH_BOOTSTRAP_CONFIDENCE) * 0.5f;
+	comparison->low = _benchPercentile(deltas, tail);
+	comparison->high = _benchPercentile(deltas, 1.0f - tail);
+
+	const float change = comparison->baseline > 0.0f ? (comparison->current - comparison->baseline) / comparison->baseline * 100.0f : 0.0f;
+	if (comparison->low > 0.0f && change >= BENCH_CHANGE_MIN_PERCENT)
+		comparison->verdict = BenchVerdict::Regression;
+	else if (comparison->high < 0.0f && change <= -BENCH_CHANGE_MIN_PERCENT)
+		comparison->verdict = BenchVerdict::Improvement;
+}
+
+// Compares the p50 and p99 of the GPU and CPU frame times of every scenario both reports ran, prints a line for
+// each and returns how many regressed. The comparisons are seeded by their place in the list, so comparing the
+// same two reports again gives the same intervals.
+static int _compareBenchReports(JobSystem& jobs, const BenchReport& baseline, const BenchReport& current)
+{
+	printf("Baseline %s: build %s, %s, %s\r\n", baseline.path.c_str(), baseline.build.c_str(), baseline.gpu.c_str(), baseline.driver.c_str());
+	printf("Current  %s: build %s, %s, %s\r\n", current.path.c_str(), current.build.c_str(), current.gpu.c_str(), current.driver.c_str());
+	if (baseline.gpu != current.gpu || baseline.driver != current.driver)
+		printf("Bench: the reports come from different GPUs or drivers, changes may not be the build's\r\n");
+
+	struct Metric { const char* name; bool gpu; float percentile; };
+	static const Metric metrics[] = {
+		{ "gpu_p50", true, 0.5f }, { "gpu_p99", true, 0.99f }, { "cpu_p50", false, 0.5f }, { "cpu_p99", false, 0.99f },
+	};
+	vector<BenchComparison> comparisons;
+	vector<pair<const BenchRunSamples*, const BenchRunSamples*>> runs;
+	for (size_t i = 0; i < current.runs.size(); i++)
+	{
+		const BenchRunSamples* before = baseline.find(current.runs[i].scenario);
+		if (!before)
+		{
+			printf("%-40s only in the current report\r\n", current.runs[i].scenario.c_str());
+			continue;
+		}
+		for (const Metric& metric : metrics)
+		{
+			BenchComparison comparison;
+			comparison.scenario = current.runs[i].scenario;
+			comparison.metric = metric.name;
+			comparison.gpu = metric.gpu;
+			comparison.percentile = metric.percentile;
+			comparisons.push_back(comparison);
+			runs.push_back(make_pair(before, &current.runs[i]));
+		}
+	}
+	for (size_t i = 0; i < baseline.runs.size(); i++)
+	{
+		if (!current.find(baseline.runs[i].scenario))
+			printf("%-40s only in the baseline\r\n", baseline.runs[i].scenario.c_str());
+	}
+
+	jobs.parallelFor(comparisons.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			_compareBenchRun(*runs[i].first, *runs[i].second, (uint64_t)i, &comparisons[i]);
+	});
+
+	int regressions = 0;
+	printf("%-40s %-8s %9s %9s %8s  %-20s\r\n", "scenario", "metric", "base ms", "now ms", "change", "interval ms");
+	for (const BenchComparison& c : comparisons)
+	{
+		const float change = c.baseline > 0.0f ? (c.current - c.baseline) / c.baseline * 100.0f : 0.0f;
+		char interval[32];
+		snprintf(interval, sizeof(interval), "[%+.3f, %+.3f]", c.low, c.high);
+		printf("%-40s %-8s %9.3f %9.3f %+7.1f%%  %-20s %s\r\n", c.scenario.c_str(), c.metric, c.baseline, c.current, change, interval,
+			c.verdict == BenchVerdict::Regression ? "REGRESSION" : c.verdict == BenchVerdict::Improvement ? "improved" : "");
+		if (c.verdict == BenchVerdict::Regression)
+			regressions++;
+	}
+	printf("Bench: %d regression%s in %u comparisons\r\n", regressions, regressions == 1 ? "" : "s", (unsigned)comparisons.size());
+	return regressions;
+}
@@ -0,0 +1,666 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include <OVR_CAPI_GL.h>
+#include "profiler.h"
+#include "posetrace.h"
+#include "gpumemory.h"
+#include "json.h"
+#include "remotehmd.h"
+
+// Frames rendered and thrown away before --bench starts measuring, while shaders and assets settle
+#define BENCH_WARMUP_FRAMES 90
+// The fixed display rate the scripted poses advance at, whatever the frames actually take
+#define BENCH_REFRESH_RATE 90.0f
+// Pixels per unit of tangent at density 1, about the Rift CV1's at the centre of the lens
+#define BENCH_PIXELS_PER_TAN 620.0f
+#define BENCH_SWAP_CHAIN_LENGTH 3
+#define BENCH_IPD 0.064f
+// Levels of detail a suite forces in turn, one run per level each drawing every molecule at it
+#define BENCH_LOD_LEVELS 3
+// Bumped whenever the report's fields change meaning. 2 added the machine, the scenario names and the samples.
+#define BENCH_REPORT_VERSION 2
+// What a report says it was built from. A build script can pass its commit, /DBENCH_BUILD_ID="\"...\"".
+#ifndef BENCH_BUILD_ID
+#define BENCH_BUILD_ID __DATE__ " " __TIME__
+#endif
+// Where every finished report is kept as well, bench_<date>_<time>.json, for --bench-compare to compare against
+#define BENCH_HISTORY_DIRECTORY "bench_history"
+
+// How a run draws the stereo pair, Default being whatever the app picked for this machine
+enum class BenchStereo { Default, Sequential, Instanced, Multiview };
+
+// The settings of one run. A molecule count of 0 leaves the game as it plays, anything else is a stress scene of that
+// many molecules with the game stopped.
+struct BenchConfig
+{
+	uint32_t molecules = 0;
+	// Level of detail every molecule is drawn at, -1 to pick by projected size as the game does. The levels are the
+	// same model at falling triangle counts, so forcing each in turn sweeps model complexity too.
+	int lod = -1;
+	// Off draws every molecule with a draw call of its own
+	bool instancing = true;
+	BenchStereo stereo = BenchStereo::Default;
+};
+
+// The headset --bench renders for, so the rendering can be timed on machines without one. A fixed CV1 like field of
+// view and eye offsets, swap chains that are plain textures, and head and hands following a script from the frame
+// number, so every run draws the same frames. Nothing is presented; the timings of the measured frames of each run
+// are written out as JSON as the run finishes, every frame's CPU and GPU time with them so later reports can be
+// compared run by run (see benchcompare.h). The report names the build, GPU and driver and how the app was started,
+// and once the last run is through a copy goes to the history directory.
+class BenchHmd
+{
+public:
+	BenchHmd() {}
+	~BenchHmd()
+	{
+		for (size_t i = 0; i < this->chains.size(); i++)
+			delete this->chains[i];
+	}
+
+	BenchHmd(const BenchHmd&) = delete;
+	BenchHmd& operator=(const BenchHmd&) = delete;
+
+	// frames measured per run. A suite sweeps the molecule counts against each setting, otherwise there is one run
+	// of the game as it plays.
+	void init(int frames, const char* reportPath, bool suite, const char* commandLine, const char* historyDirectory = BENCH_HISTORY_DIRECTORY)
+	{
+		this->frames = frames;
+		this->reportPath = reportPath;
+		this->commandLine = commandLine;
+		this->historyDirectory = historyDirectory ? historyDirectory : "";
+		this->start = std::chrono::steady_clock::now();
+		char started[32];
+		const time_t now = time(nullptr);
+		strftime(started, sizeof(started), "%Y%m%d_%H%M%S", localtime(&now));
+		this->started = started;
+		this->configs.clear();
+		if (!suite)
+		{
+			this->configs.push_back(BenchConfig());
+			return;
+		}
+		// One setting changed at a time from the baseline, each over the whole range of counts, so every
+		// optimization shows as its own scaling curve
+		static const uint32_t counts[] = { 100, 1000, 10000, 100000 };
+		for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+		{
+			BenchConfig config;
+			config.molecules = counts[i];
+			this->configs.push_back(config);
+			for (int lod = 0; lod < BENCH_LOD_LEVELS; lod++)
+			{
+				BenchConfig forced = config;
+				forced.lod = lod;
+				this->configs.push_back(forced);
+			}
+			BenchConfig separate = config;
+			separate.instancing = false;
+			this->configs.push_back(separate);
+			for (int stereo = (int)BenchStereo::Sequential; stereo <= (int)BenchStereo::Multiview; stereo++)
+			{
+				BenchConfig mode = config;
+				mode.stereo = (BenchStereo)stereo;
+				this->configs.push_back(mode);
+			}
+		}
+	}
+
+	bool active() const { return this->frames > 0; }
+
+	ovrHmdDesc hmdDesc() const
+	{
+		ovrHmdDesc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.Type = ovrHmd_CV1;
+		strcpy(desc.ProductName, "Bench HMD");
+		for (int eye = 0; eye < ovrEye_Count; eye++)
+		{
+			// The outer side of each eye is the wider one
+			ovrFovPort& fov = desc.DefaultEyeFov[eye];
+			fov.UpTan = fov.DownTan = 1.329f;
+			fov.LeftTan = eye == ovrEye_Left ? 1.092f : 1.059f;
+			fov.RightTan = eye == ovrEye_Left ? 1.059f : 1.092f;
+			desc.MaxEyeFov[eye] = fov;
+		}
+		desc.Resolution.w = 2160;
+		desc.Resolution.h = 1200;
+		desc.DisplayRefreshRate = BENCH_REFRESH_RATE;
+		return desc;
+	}
+
+	ovrEyeRenderDesc renderDesc(ovrEyeType eye, const ovrFovPort& fov) const
+	{
+		ovrEyeRenderDesc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.Eye = eye;
+		desc.Fov = fov;
+		desc.DistortedViewport.Pos.x = eye == ovrEye_Left ? 0 : 1080;
+		desc.DistortedViewport.Size.w = 1080;
+		desc.DistortedViewport.Size.h = 1200;
+		desc.PixelsPerTanAngleAtCenter.x = desc.PixelsPerTanAngleAtCenter.y = BENCH_PIXELS_PER_TAN;
+		desc.HmdToEyeOffset.x = (eye == ovrEye_Left ? -0.5f : 0.5f) * BENCH_IPD;
+		return desc;
+	}
+
+	ovrSizei fovTextureSize(const ovrFovPort& fov, float density) const
+	{
+		ovrSizei size;
+		size.w = (int)ceilf((fov.LeftTan + fov.RightTan) * BENCH_PIXELS_PER_TAN * density);
+		size.h = (int)ceilf((fov.UpTan + fov.DownTan) * BENCH_PIXELS_PER_TAN * density);
+		return size;
+	}
+
+	// A ring of BENCH_SWAP_CHAIN_LENGTH textures, stored the way the runtime would store desc
+	ovrTextureSwapChain createSwapChain(const ovrTextureSwapChainDesc& desc)
+	{
+		SwapChain* chain = new SwapChain();
+		glGenTextures(BENCH_SWAP_CHAIN_LENGTH, chain->textures);
+		for (int i = 0; i < BENCH_SWAP_CHAIN_LENGTH; i++)
+		{
+			glBindTexture(GL_TEXTURE_2D, chain->textures[i]);
+			glTexStorage2D(GL_TEXTURE_2D, 1, textureFormat(desc.Format), desc.Width, desc.Height);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		this->chains.push_back(chain);
+		return reinterpret_cast<ovrTextureSwapChain>(chain);
+	}
+
+	GLuint swapChainTexture(ovrTextureSwapChain chain, int index) const
+	{
+		return reinterpret_cast<const SwapChain*>(chain)->textures[index];
+	}
+
+	int swapChainIndex(ovrTextureSwapChain chain) const
+	{
+		return reinterpret_cast<const SwapChain*>(chain)->current;
+	}
+
+	void commit(ovrTextureSwapChain chain)
+	{
+		SwapChain* swapChain = reinterpret_cast<SwapChain*>(chain);
+		swapChain->current = (swapChain->current + 1) % BENCH_SWAP_CHAIN_LENGTH;
+	}
+
+	// The texture the latest commit() moved past, the one a layer submitted after it shows
+	GLuint committedTexture(ovrTextureSwapChain chain) const
+	{
+		const SwapChain* swapChain = reinterpret_cast<const SwapChain*>(chain);
+		return swapChain->textures[(swapChain->current + BENCH_SWAP_CHAIN_LENGTH - 1) % BENCH_SWAP_CHAIN_LENGTH];
+	}
+
+	double seconds() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - this->start).count();
+	}
+
+	// Display times are the frame number at BENCH_REFRESH_RATE, which is all the script looks at
+	double displayTime(long long frameIndex) const
+	{
+		return frameIndex / (double)BENCH_REFRESH_RATE;
+	}
+
+	double lastDisplayTime() const { return this->scriptTime; }
+
+	// The head looking around the scene, yawing and nodding, with the hands circling in front of it
+	ovrTrackingState tracking(double displayTime)
+	{
+		this->scriptTime = displayTime;
+		const float t = (float)displayTime;
+		ovrTrackingState state;
+		memset(&state, 0, sizeof(state));
+		state.StatusFlags = ovrStatus_OrientationTracked | ovrStatus_PositionTracked;
+		const glm::quat head = glm::angleAxis(0.6f * sinf(t * 0.8f), glm::vec3(0.0f, 1.0f, 0.0f))
+			* glm::angleAxis(0.2f * sinf(t * 1.3f), glm::vec3(1.0f, 0.0f, 0.0f));
+		state.HeadPose.ThePose.Orientation = toOvr(head);
+		state.HeadPose.ThePose.Position.x = 0.05f * sinf(t * 0.5f);
+		state.HeadPose.TimeInSeconds = displayTime;
+		for (int hand = 0; hand < ovrHand_Count; hand++)
+		{
+			const float side = hand == ovrHand_Left ? -1.0f : 1.0f;
+			const float phase = t * 2.0f + hand * 3.1416f;
+			ovrPoseStatef& pose = state.HandPoses[hand];
+			pose.ThePose.Orientation = toOvr(glm::angleAxis(-0.3f + 0.2f * sinf(phase), glm::vec3(1.0f, 0.0f, 0.0f)));
+			pose.ThePose.Position.x = side * 0.2f + 0.05f * cosf(phase);
+			pose.ThePose.Position.y = -0.3f + 0.05f * sinf(phase);
+			pose.ThePose.Position.z = -0.35f;
+			pose.TimeInSeconds = displayTime;
+			state.HandStatusFlags[hand] = ovrStatus_OrientationTracked | ovrStatus_PositionTracked;
+		}
+		return state;
+	}
+
+	// Each trigger pulled half of every two seconds, so the lasers and anything they hit change too
+	ovrInputState input(double displayTime) const
+	{
+		ovrInputState state;
+		memset(&state, 0, sizeof(state));
+		state.TimeInSeconds = displayTime;
+		state.ControllerType = ovrControllerType_Touch;
+		for (int hand = 0; hand < ovrHand_Count; hand++)
+		{
+			const bool pulled = fmod(displayTime + hand, 2.0) < 1.0;
+			state.IndexTrigger[hand] = state.IndexTriggerNoDeadzone[hand] = pulled ? 1.0f : 0.0f;
+		}
+		return state;
+	}
+
+	// The runs the benchmark goes through, once every frame of the one before is measured. A single plain run
+	// without a sweep.
+	const vector<BenchConfig>& runs() const { return this->configs; }
+
+	// The next run's settings, nullptr when every run has been measured
+	const BenchConfig* nextRun()
+	{
+		return this->run < this->configs.size() ? &this->configs[this->run] : nullptr;
+	}
+
+	// After nextRun() ran out, keeps the report in the history directory, if there is one
+	void finish()
+	{
+		if (this->historyDirectory.empty() || this->results.empty())
+			return;
+		CreateDirectoryA(this->historyDirectory.c_str(), NULL);
+		const string path = this->historyDirectory + "\\bench_" + this->started + ".json";
+		if (this->writeReport(path))
+			printf("Bench: report kept as %s\r\n", path.c_str());
+	}
+
+	// Skips the run nextRun() returned, for settings this machine can't do
+	void skipRun()
+	{
+		printf("Bench: run %u skipped, not supported here\r\n", (unsigned)this->run);
+		this->run++;
+	}
+
+	// Measuring starts BENCH_WARMUP_FRAMES after frameIndex, the frame the run's settings were applied in. stereo is
+	// the stereo mode the run actually got.
+	void beginRun(uint64_t frameIndex, const char* stereo)
+	{
+		this->measureFrom = frameIndex + BENCH_WARMUP_FRAMES;
+		this->stereo = stereo;
+		this->cpuFrameMs.clear();
+		this->gpuFrameMs.clear();
+		this->phases.clear();
+	}
+
+	// After FrameProfiler::endFrame(). True once the last measured frame of the run has resolved, the run is then
+	// added to the report, which is rewritten so a suite cut short still has the runs before.
+	bool sample(const FrameProfiler& profiler, uint32_t culledInstances)
+	{
+		const uint64_t resolved = profiler.resolvedFrame();
+		if (resolved == this->lastResolved)
+			return false;
+		this->lastResolved = resolved;
+		if (resolved < this->measureFrom)
+			return false;
+		this->cpuFrameMs.push_back(profiler.cpuFrameMs());
+		this->gpuFrameMs.push_back(profiler.gpuFrameMs());
+		if (this->phases.empty())
+			this->phases.resize(profiler.phaseCount());
+		for (size_t i = 0; i < this->phases.size(); i++)
+		{
+			this->phases[i].cpuMs += profiler.cpuMs((int)i);
+			this->phases[i].gpuMs += profiler.gpuMs((int)i);
+		}
+		this->culled = culledInstances;
+		if ((int)this->cpuFrameMs.size() < this->frames)
+			return false;
+		this->finishRun(profiler);
+		this->run++;
+		return true;
+	}
+
+private:
+	// The depth layers' chains are depth textures, anything else is colour
+	static GLenum textureFormat(ovrTextureFormat format)
+	{
+		if (format == OVR_FORMAT_D32_FLOAT)
+			return GL_DEPTH_COMPONENT32F;
+		if (format == OVR_FORMAT_R11G11B10_FLOAT)
+			return GL_R11F_G11F_B10F;
+		return format == OVR_FORMAT_R8G8B8A8_UNORM_SRGB ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+	}
+
+	struct SwapChain
+	{
+		GLuint textures[BENCH_SWAP_CHAIN_LENGTH];
+		int current = 0;
+	};
+
+	struct PhaseTotals
+	{
+		double cpuMs = 0.0;
+		double gpuMs = 0.0;
+	};
+
+	static ovrQuatf toOvr(const glm::quat& q)
+	{
+		ovrQuatf result;
+		result.x = q.x;
+		result.y = q.y;
+		result.z = q.z;
+		result.w = q.w;
+		return result;
+	}
+
+	static float percentile(const vector<float>& sorted, float p)
+	{
+		const size_t i = std::min((size_t)(p * (sorted.size() - 1) + 0.5f), sorted.size() - 1);
+		return sorted[i];
+	}
+
+	// What --bench-compare matches runs of two reports by, e.g. m1000_lod1_instanced_multiview; the game as it
+	// plays is m0
+	static string scenarioName(const BenchConfig& config, const string& stereo)
+	{
+		char name[96];
+		snprintf(name, sizeof(name), "m%u_lod%s_%s_%s", config.molecules, config.lod < 0 ? "auto" : std::to_string(config.lod).c_str(),
+			config.instancing ? "instanced" : "separate", stereo.c_str());
+		return name;
+	}
+
+	// Every value, for the comparison to resample
+	static string samples(const vector<float>& values)
+	{
+		string text = "[";
+		char number[16];
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			snprintf(number, sizeof(number), i ? ",%.3f" : "%.3f", values[i]);
+			text += number;
+		}
+		return text + "]";
+	}
+
+	// The distribution of one frame time, as its mean and percentiles
+	static string stats(vector<float> values)
+	{
+		std::sort(values.begin(), values.end());
+		double sum = 0.0;
+		for (size_t i = 0; i < values.size(); i++)
+			sum += values[i];
+		char text[256];
+		snprintf(text, sizeof(text), "{ \"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+			sum / values.size(), values.front(), percentile(values, 0.5f), percentile(values, 0.9f), percentile(values, 0.95f),
+			percentile(values, 0.99f), values.back());
+		return text;
+	}
+
+	void finishRun(const FrameProfiler& profiler)
+	{
+		const BenchConfig& config = this->configs[this->run];
+		char text[512];
+		snprintf(text, sizeof(text), "    {\n      \"scenario\": \"%s\",\n      \"molecules\": %u,\n      \"lod\": %d,\n"
+			"      \"instancing\": %s,\n      \"stereo\": \"%s\",\n      \"frames\": %u,\n      \"culled_instances\": %u,\n",
+			scenarioName(config, this->stereo).c_str(), config.molecules, config.lod, config.instancing ? "true" : "false",
+			this->stereo.c_str(), (unsigned)this->cpuFrameMs.size(), this->culled);
+		string json = text;
+		json += "      \"cpu_frame_ms\": " + stats(this->cpuFrameMs) + ",\n";
+		json += "      \"gpu_frame_ms\": " + stats(this->gpuFrameMs) + ",\n";
+		json += "      \"phases\": {\n";
+		for (size_t i = 0; i < this->phases.size(); i++)
+		{
+			snprintf(text, sizeof(text), "        \"%s\": { \"cpu_ms\": %.4f, \"gpu_ms\": %.4f }%s\n", profiler.phaseName((int)i).c_str(),
+				this->phases[i].cpuMs / this->cpuFrameMs.size(), this->phases[i].gpuMs / this->cpuFrameMs.size(),
+				i + 1 < this->phases.size() ? "," : "");
+			json += text;
+		}
+		json += "      },\n";
+		json += "      \"samples\": {\n        \"cpu_frame_ms\": " + samples(this->cpuFrameMs) + ",\n";
+		json += "        \"gpu_frame_ms\": " + samples(this->gpuFrameMs) + "\n      }\n    }";
+		this->results.push_back(json);
+		this->writeReport(this->reportPath);
+
+		vector<float> sorted = this->gpuFrameMs;
+		std::sort(sorted.begin(), sorted.end());
+		printf("Bench: run %u/%u, %u molecules, lod %d, instancing %s, %s: GPU p50 %.2f ms\r\n", (unsigned)this->run + 1,
+			(unsigned)this->configs.size(), config.molecules, config.lod, config.instancing ? "on" : "off", this->stereo.c_str(),
+			percentile(sorted, 0.5f));
+	}
+
+	bool writeReport(const string& path)
+	{
+		FILE* file = fopen(path.c_str(), "w");
+		if (!file)
+		{
+			printf("ERROR::BENCH::REPORT_NOT_OPENED %s\n", path.c_str());
+			return false;
+		}
+		// Runs are only finished with the GL context current
+		const char* renderer = (const char*)glGetString(GL_RENDERER);
+		const char* vendor = (const char*)glGetString(GL_VENDOR);
+		const char* driver = (const char*)glGetString(GL_VERSION);
+		fprintf(file, "{\n  \"version\": %d,\n  \"build\": \"%s\",\n  \"started\": \"%s\",\n  \"gpu\": \"%s\",\n  \"vendor\": \"%s\",\n"
+			"  \"driver\": \"%s\",\n  \"command_line\": \"%s\",\n  \"warmup_frames\": %d,\n  \"frames_per_run\": %d,\n  \"runs\": [\n",
+			BENCH_REPORT_VERSION, _jsonEscape(BENCH_BUILD_ID).c_str(), this->started.c_str(), _jsonEscape(renderer ? renderer : "").c_str(),
+			_jsonEscape(vendor ? vendor : "").c_str(), _jsonEscape(driver ? driver : "").c_str(), _jsonEscape(this->commandLine).c_str(),
+			BENCH_WARMUP_FRAMES, this->frames);
+		for (size_t i = 0; i < this->results.size(); i++)
+			fprintf(file, "%s%s\n", this->results[i].c_str(), i + 1 < this->results.size() ? "," : "");
+		fprintf(file, "  ]\n}\n");
+		fclose(file);
+		return true;
+	}
+
+	int frames = 0;
+	string reportPath;
+	string commandLine;
+	string historyDirectory;
+	// When the benchmark started, local time, what the history copy is named after
+	string started;
+	std::chrono::steady_clock::time_point start;
+	double scriptTime = 0.0;
+	vector<SwapChain*> chains;
+
+	vector<BenchConfig> configs;
+	size_t run = 0;
+	uint64_t measureFrom = 0;
+	uint64_t lastResolved = 0;
+	string stereo;
+	uint32_t culled = 0;
+	vector<float> cpuFrameMs;
+	vector<float> gpuFrameMs;
+	vector<PhaseTotals> phases;
+	// Each finished run as its JSON object
+	vector<string> results;
+};
+
+static BenchHmd _benchHmd;
+
+// The LibOVR calls RiftApp makes, answered by _benchHmd instead while --bench is on and by _remoteHmd while
+// --remote is. The rest of LibOVR that is used, the projection and eye pose helpers, is plain math and works
+// without a session. Tracking and input pass through _poseTrace on the way back, whichever answered them.
+
+// Whether something other than the runtime stands in for the headset, with _benchHmd's swap chains either way
+static bool _hmdStandIn()
+{
+	return _benchHmd.active() || _remoteHmd.active();
+}
+
+static ovrEyeRenderDesc _hmdGetRenderDesc(ovrSession session, ovrEyeType eye, ovrFovPort fov)
+{
+	if (_remoteHmd.active())
+		return _remoteHmd.renderDesc(eye, fov);
+	return _benchHmd.active() ? _benchHmd.renderDesc(eye, fov) : ovr_GetRenderDesc(session, eye, fov);
+}
+
+static ovrSizei _hmdGetFovTextureSize(ovrSession session, ovrEyeType eye, ovrFovPort fov, float density)
+{
+	if (_remoteHmd.active())
+		return _remoteHmd.fovTextureSize(eye, fov, density);
+	return _benchHmd.active() ? _benchHmd.fovTextureSize(fov, density) : ovr_GetFovTextureSize(session, eye, fov, density);
+}
+
+// Every buffer of a chain created is charged to GpuMemoryCategory::SwapChains, chains last as long as the session
+static ovrResult _hmdCreateTextureSwapChainGL(ovrSession session, const ovrTextureSwapChainDesc* desc, ovrTextureSwapChain* chain)
+{
+	int length = BENCH_SWAP_CHAIN_LENGTH;
+	if (!_hmdStandIn())
+	{
+		const ovrResult result = ovr_CreateTextureSwapChainGL(session, desc, chain);
+		if (!OVR_SUCCESS(result) || !OVR_SUCCESS(ovr_GetTextureSwapChainLength(session, *chain, &length)))
+			return result;
+	}
+	else
+	{
+		*chain = _benchHmd.createSwapChain(*desc);
+	}
+	_gpuMemory.charge(GpuMemoryCategory::SwapChains,
+		_gpuImageBytes(GL_RGBA8, desc->Width, desc->Height, std::max(desc->ArraySize, 1), desc->SampleCount) * length);
+	return ovrSuccess;
+}
+
+static ovrResult _hmdGetTextureSwapChainLength(ovrSession session, ovrTextureSwapChain chain, int* length)
+{
+	if (!_hmdStandIn())
+		return ovr_GetTextureSwapChainLength(session, chain, length);
+	*length = BENCH_SWAP_CHAIN_LENGTH;
+	return ovrSuccess;
+}
+
+static ovrResult _hmdGetTextureSwapChainCurrentIndex(ovrSession session, ovrTextureSwapChain chain, int* index)
+{
+	if (!_hmdStandIn())
+		return ovr_GetTextureSwapChainCurrentIndex(session, chain, index);
+	*index = _benchHmd.swapChainIndex(chain);
+	return ovrSuccess;
+}
+
+static ovrResult _hmdGetTextureSwapChainBufferGL(ovrSession session, ovrTextureSwapChain chain, int index, GLuint* texture)
+{
+	if (!_hmdStandIn())
+		return ovr_GetTextureSwapChainBufferGL(session, chain, index, texture);
+	*texture = _benchHmd.swapChainTexture(chain, index);
+	return ovrSuccess;
+}
+
+static ovrResult _hmdCommitTextureSwapChain(ovrSession session, ovrTextureSwapChain chain)
+{
+	if (!_hmdStandIn())
+		return ovr_CommitTextureSwapChain(session, chain);
+	_benchHmd.commit(chain);
+	return ovrSuccess;
+}
+
+// Benchmarked layers go nowhere, but the GPU still has to finish the frame, as it would for the compositor.
+// The remote headset is sent the first eye layer, the scene; the others are left to a local compositor.
+static ovrResult _hmdSubmitFrame(ovrSession session, long long frameIndex, const ovrViewScaleDesc* viewScaleDesc,
+	ovrLayerHeader const* const* layers, unsigned int layerCount)
+{
+	if (!_hmdStandIn())
+		return ovr_SubmitFrame(session, frameIndex, viewScaleDesc, layers, layerCount);
+	if (_remoteHmd.active())
+	{
+		for (unsigned int i = 0; i < layerCount; i++)
+		{
+			if (!layers[i] || layers[i]->Type != ovrLayerType_EyeFov)
+				continue;
+			const ovrLayerEyeFov* layer = reinterpret_cast<const ovrLayerEyeFov*>(layers[i]);
+			_remoteHmd.submit(_benchHmd.committedTexture(layer->ColorTexture[0]), *layer);
+			return ovrSuccess;
+		}
+	}
+	glFlush();
+	return ovrSuccess;
+}
+
+// Visible and worn throughout while benchmarking, and while the remote headset keeps sending
+static ovrResult _hmdGetSessionStatus(ovrSession session, ovrSessionStatus* status)
+{
+	if (_remoteHmd.active())
+	{
+		*status = _remoteHmd.status();
+		return ovrSuccess;
+	}
+	if (!_benchHmd.active())
+		return ovr_GetSessionStatus(session, status);
+	memset(status, 0, sizeof(*status));
+	status->IsVisible = ovrTrue;
+	status->HmdPresent = ovrTrue;
+	status->HmdMounted = ovrTrue;
+	status->HasInputFocus = ovrTrue;
+	return ovrSuccess;
+}
+
+static double _hmdGetPredictedDisplayTime(ovrSession session, long long frameIndex)
+{
+	if (_remoteHmd.active())
+		return _remoteHmd.displayTime();
+	return _benchHmd.active() ? _benchHmd.displayTime(frameIndex) : ovr_GetPredictedDisplayTime(session, frameIndex);
+}
+
+static double _hmdGetTimeInSeconds()
+{
+	if (_remoteHmd.active())
+		return _remoteHmd.seconds();
+	return _benchHmd.active() ? _benchHmd.seconds() : ovr_GetTimeInSeconds();
+}
+
+static ovrTrackingState _hmdGetTrackingState(ovrSession session, double displayTime, ovrBool latencyMarker)
+{
+	ovrTrackingState state;
+	if (_remoteHmd.active())
+		state = _remoteHmd.tracking(displayTime);
+	else
+		state = _benchHmd.active() ? _benchHmd.tracking(displayTime) : ovr_GetTrackingState(session, displayTime, latencyMarker);
+	_poseTrace.exchange(PoseTraceKind::Tracking, &state);
+	return state;
+}
+
+static ovrResult _hmdGetInputState(ovrSession session, ovrControllerType controllerType, ovrInputState* state)
+{
+	ovrResult result = ovrSuccess;
+	if (_remoteHmd.active())
+		*state = _remoteHmd.input();
+	else if (!_benchHmd.active())
+		result = ovr_GetInputState(session, controllerType, state);
+	else
+		// The script runs off the pose's display time, which the avatar update sampled last
+		*state = _benchHmd.input(_benchHmd.lastDisplayTime());
+	_poseTrace.exchange(PoseTraceKind::Input, state);
+	return result;
+}
+
+static ovrResult _hmdSetControllerVibration(ovrSession session, ovrControllerType controllerType, float frequency, float amplitude)
+{
+	return _hmdStandIn() ? ovrSuccess : ovr_SetControllerVibration(session, controllerType, frequency, amplitude);
+}
+
+static ovrResult _hmdSubmitControllerVibration(ovrSession session, ovrControllerType controllerType, const ovrHapticsBuffer* buffer)
+{
+	return _hmdStandIn() ? ovrSuccess : ovr_SubmitControllerVibration(session, controllerType, buffer);
+}
+
+// Zeroed while benchmarking or remote, which tells the haptics there is no buffered playback
+static ovrTouchHapticsDesc _hmdGetTouchHapticsDesc(ovrSession session, ovrControllerType controllerType)
+{
+	ovrTouchHapticsDesc desc;
+	if (_hmdStandIn())
+		memset(&desc, 0, sizeof(desc));
+	else
+		desc = ovr_GetTouchHapticsDesc(session, controllerType);
+	return desc;
+}
+
+static ovrResult _hmdRecenterTrackingOrigin(ovrSession session)
+{
+	return _hmdStandIn() ? ovrSuccess : ovr_RecenterTrackingOrigin(session);
+}
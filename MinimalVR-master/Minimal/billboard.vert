@@ -0,0 +1,95 @@
+#version 330 core
+// STEREO_MULTIVIEW is defined by the app for the GL_OVR_multiview2 variant, see RiftApp::StereoMode
+#ifdef STEREO_MULTIVIEW
+#extension GL_OVR_multiview2 : require
+layout(num_views = 2) in;
+#endif
+// Far molecules as one card each, see MoleculeBillboards. There are no vertex attributes: every instance is a strip
+// of four vertices, turned to the baked view nearest the eyes' and textured with its tile of the atlas.
+// One model matrix per instance (per pair of instances in instanced stereo), see InstanceBuffer
+layout (location = 5) in mat4 instanceTransform;
+
+// Model space directions the atlas was baked from, BILLBOARD_VIEWS and BILLBOARD_GRID are defined by the app.
+// The extent is half a tile's side in model units.
+uniform vec4 billboardViews[BILLBOARD_VIEWS];
+uniform float billboardExtent;
+
+// World space, what the scene light and the clustered point lights are worked out in
+out vec3 WorldPos;
+out vec2 atlasCoord;
+// The baked camera's axes in world space, the atlas' normals are in them
+flat out mat3 cardBasis;
+// 0 to 1 into the crossfade from the meshes, as molecule.vert works it out
+flat out float billboardFade;
+
+// Element 0 is the left eye. Mono rendering only uses element 0.
+// With LATE_LATCH the cameras come from the block RiftApp rewrites right before the draws are issued.
+#ifdef LATE_LATCH
+layout(std140) uniform LateLatch
+{
+	mat4 view[2];
+	mat4 projection[2];
+	mat4 hands[2];
+};
+#else
+uniform mat4 view[2];
+uniform mat4 projection[2];
+#endif
+// Instanced stereo: every draw is issued with eyeCount times the instances, eye = gl_InstanceID % eyeCount.
+// eyeViewport squeezes each eye into its half of the shared target: xy scale, zw offset in NDC.
+uniform int eyeCount = 1;
+uniform vec4 eyeViewport[2];
+
+// See molecule.vert
+uniform vec2 lodFade = vec2(0.0, -1.0);
+uniform vec3 lodEye;
+uniform float lodFocal;
+uniform float lodRadius;
+
+void main()
+{
+#ifdef STEREO_MULTIVIEW
+	int eye = int(gl_ViewID_OVR);
+#else
+	int eye = gl_InstanceID % eyeCount;
+#endif
+	vec3 centre = instanceTransform[3].xyz;
+	mat3 turn = mat3(instanceTransform);
+
+	// From between the eyes, so both pick the same tile. Only compared, the scale doesn't matter.
+	vec3 toEye = transpose(turn) * (lodEye - centre);
+	int best = 0;
+	float bestDot = -1e30f;
+	for (int i = 0; i < BILLBOARD_VIEWS; i++)
+	{
+		float d = dot(billboardViews[i].xyz, toEye);
+		if (d > bestDot)
+		{
+			bestDot = d;
+			best = i;
+		}
+	}
+	vec3 forward = billboardViews[best].xyz;
+	vec3 right = normalize(cross(vec3(0.0f, 1.0f, 0.0f), forward));
+	vec3 up = cross(forward, right);
+
+	vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.0f - 1.0f;
+	vec3 point = vec3(instanceTransform * vec4((corner.x * right + corner.y * up) * billboardExtent, 1.0f));
+	vec4 clip = projection[eye] * view[eye] * vec4(point, 1.0f);
+#ifndef STEREO_MULTIVIEW
+	if (eyeCount > 1)
+	{
+		// Keep each eye out of the other's half, GL_CLIP_DISTANCE0 is enabled by RiftApp
+		gl_ClipDistance[0] = eye == 0 ? clip.w - clip.x : clip.w + clip.x;
+		clip.xy = clip.xy * eyeViewport[eye].xy + eyeViewport[eye].zw * clip.w;
+	}
+#endif
+	gl_Position = clip;
+	WorldPos = point;
+	vec2 tile = vec2(float(best % BILLBOARD_GRID), float(best / BILLBOARD_GRID));
+	atlasCoord = (tile + corner * 0.5f + 0.5f) / float(BILLBOARD_GRID);
+	cardBasis = mat3(normalize(turn * right), normalize(turn * up), normalize(turn * forward));
+
+	float size = lodRadius * length(instanceTransform[0].xyz) * lodFocal / max(length(lodEye - centre), 0.01f);
+	billboardFade = clamp((lodFade.x - size) / (lodFade.x - lodFade.y), 0.0f, 1.0f);
+}
@@ -0,0 +1,201 @@
+#pragma once
+// Std. Includes
+#include <iostream>
+#include <vector>
+#include <cmath>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "glstate.h"
+#include "shader.h"
+#include "instancing.h"
+#include "model.h"
+#include "glcapture.h"
+
+// Directions the atlas is baked from, a tile each in BILLBOARD_GRID rows of BILLBOARD_GRID, BILLBOARD_TILE_SIZE
+// pixels square. The shaders get both as defines.
+#define BILLBOARD_GRID 8
+#define BILLBOARD_VIEWS (BILLBOARD_GRID * BILLBOARD_GRID)
+#define BILLBOARD_TILE_SIZE 64
+// Mip levels of the atlas, the last one still a few texels per tile so the tiles don't bleed into each other
+#define BILLBOARD_MIP_LEVELS 4
+// A tile spans this much more than the model's bounding radius, to keep the filtering inside it
+#define BILLBOARD_MARGIN 1.1f
+#define BILLBOARD_COLOR_UNIT 11
+#define BILLBOARD_NORMAL_UNIT 12
+// The billboard variant of billboard.vert with shader.frag, the mesh programs that fade out into it, and the bake
+#define MOLECULE_BILLBOARD_DEFINE "#define MOLECULE_BILLBOARD\n#define BILLBOARD_FADE\n#define BILLBOARD_VIEWS 64\n#define BILLBOARD_GRID 8\n"
+#define BILLBOARD_FADE_DEFINE "#define BILLBOARD_FADE\n"
+#define BILLBOARD_BAKE_DEFINE "#define PACKED_VERTEX\n#define BILLBOARD_BAKE\n"
+
+// One molecule type as a single card per instance, for the molecules so far away that even the coarsest mesh
+// level is mostly triangles smaller than a pixel. The model is rendered once, when it has loaded, from
+// BILLBOARD_VIEWS directions spread evenly over the sphere into an atlas of diffuse color and camera space
+// normals. billboard.vert turns each instance's card to face the baked direction nearest the eyes' and samples
+// that tile, shader.frag lights it like the mesh. Every instance costs four vertices whatever the model.
+//
+// The baked cameras look at the model from direction d with right = cross(up, d) for up the y axis, billboard.vert
+// rebuilds the same axes to turn the card and the normals.
+class MoleculeBillboards
+{
+public:
+	MoleculeBillboards()
+	{
+		// A Fibonacci spiral, the directions about equally far apart wherever the eyes are
+		for (int i = 0; i < BILLBOARD_VIEWS; i++)
+		{
+			const float y = 1.0f - (2.0f * i + 1.0f) / BILLBOARD_VIEWS;
+			const float r = sqrtf(1.0f - y * y);
+			const float phi = 2.39996323f * i;
+			this->views[i] = glm::vec4(cosf(phi) * r, y, sinf(phi) * r, 0.0f);
+		}
+	}
+	~MoleculeBillboards()
+	{
+		if (this->framebuffer)
+			glDeleteFramebuffers(1, &this->framebuffer);
+		if (this->depthBuffer)
+			glDeleteRenderbuffers(1, &this->depthBuffer);
+		if (this->colorAtlas)
+			glDeleteTextures(1, &this->colorAtlas);
+		if (this->normalAtlas)
+			glDeleteTextures(1, &this->normalAtlas);
+		if (this->vertexArray)
+			glDeleteVertexArrays(1, &this->vertexArray);
+	}
+
+	MoleculeBillboards(const MoleculeBillboards&) = delete;
+	MoleculeBillboards& operator=(const MoleculeBillboards&) = delete;
+
+	// Renders model's level 0 into the atlas with shader, a BILLBOARD_BAKE_DEFINE program. Outside the eye passes:
+	// it leaves the default framebuffer bound, and level 0 drawing from its own buffer, which the owner has to
+	// attach its own to again.
+	void bake(Model& model, Shader& shader, bool reversedDepth)
+	{
+		if (!this->framebuffer)
+			this->allocate();
+		this->extent = model.boundingRadius() * BILLBOARD_MARGIN;
+
+		// Every view is an instance: turned so the view's camera axes are x, y and z, scaled to fit a tile and moved
+		// onto it, with the whole atlas as one -1..1 target. The normals then come out in the camera's space.
+		vector<glm::mat4> tiles(BILLBOARD_VIEWS);
+		const float scale = 1.0f / (BILLBOARD_GRID * this->extent);
+		for (int i = 0; i < BILLBOARD_VIEWS; i++)
+		{
+			const glm::vec3 forward(this->views[i]);
+			const glm::vec3 right = glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), forward));
+			const glm::vec3 up = glm::cross(forward, right);
+			const glm::mat4 rotation(glm::transpose(glm::mat3(right, up, forward)));
+			const glm::vec2 centre(-1.0f + (2.0f * (i % BILLBOARD_GRID) + 1.0f) / BILLBOARD_GRID,
+				-1.0f + (2.0f * (i / BILLBOARD_GRID) + 1.0f) / BILLBOARD_GRID);
+			tiles[i] = glm::scale(glm::translate(glm::mat4(), glm::vec3(centre, 0.0f)), glm::vec3(scale)) * rotation;
+		}
+		this->bakeInstances.update(tiles);
+		model.attachInstanceBuffer(this->bakeInstances.id(), 1, 0);
+
+		// Depth only has to sort within a tile, towards the eye is nearer whichever way it runs
+		const glm::mat4 projection = glm::scale(glm::translate(glm::mat4(), glm::vec3(0.0f, 0.0f, 0.5f)),
+			glm::vec3(1.0f, 1.0f, reversedDepth ? 1.0f : -1.0f));
+		const glm::mat4 views[2] = { glm::mat4(), glm::mat4() };
+		const glm::mat4 projections[2] = { projection, projection };
+
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->framebuffer);
+		glViewport(0, 0, BILLBOARD_GRID * BILLBOARD_TILE_SIZE, BILLBOARD_GRID * BILLBOARD_TILE_SIZE);
+		_glState.depthMask(GL_TRUE);
+		_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		_glState.depthFunc(GL_LESS);
+		const GLfloat transparent[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		const GLfloat farDepth = reversedDepth ? 0.0f : 1.0f;
+		glClearBufferfv(GL_COLOR, 0, transparent);
+		glClearBufferfv(GL_COLOR, 1, transparent);
+		glClearBufferfv(GL_DEPTH, 0, &farDepth);
+		shader.Use();
+		shader.set("view", views, 2);
+		shader.set("projection", projections, 2);
+		shader.set("eyeCount", (GLint)1);
+		shader.set("depthOnly", (GLint)0);
+		model.DrawInstanced(shader, BILLBOARD_VIEWS, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+		_glState.selectTexture(BILLBOARD_COLOR_UNIT, this->colorAtlas);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		_glState.selectTexture(BILLBOARD_NORMAL_UNIT, this->normalAtlas);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		this->ready = true;
+	}
+
+	// The atlas is there to draw with
+	bool baked() const { return this->ready; }
+
+	// Points the card's vertex array at buffer's transforms, see _attachInstanceTransforms for divisor
+	void attach(GLuint buffer, GLuint divisor)
+	{
+		if (!this->vertexArray)
+			glGenVertexArrays(1, &this->vertexArray);
+		_attachInstanceTransforms(this->vertexArray, buffer, divisor);
+	}
+
+	// instances as the mesh would draw them, eye count included. The program must be in use with its view uniforms set.
+	void draw(Shader& shader, GLsizei instances)
+	{
+		if (!instances || !this->ready || !this->vertexArray)
+			return;
+		shader.set("billboardViews", this->views, BILLBOARD_VIEWS);
+		shader.set("billboardExtent", this->extent);
+		shader.set("billboardColor", (GLint)BILLBOARD_COLOR_UNIT);
+		shader.set("billboardNormal", (GLint)BILLBOARD_NORMAL_UNIT);
+		_glState.bindTexture(BILLBOARD_COLOR_UNIT, this->colorAtlas);
+		_glState.bindTexture(BILLBOARD_NORMAL_UNIT, this->normalAtlas);
+		_glState.bindVertexArray(this->vertexArray);
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instances);
+		_glCapture.drawArrays(GL_TRIANGLE_STRIP, 0, 4, instances);
+		_renderStats.draw(GL_TRIANGLE_STRIP, 4, instances);
+		_glState.bindVertexArray(0);
+	}
+
+private:
+	void allocate()
+	{
+		const GLsizei size = BILLBOARD_GRID * BILLBOARD_TILE_SIZE;
+		GLuint* atlases[2] = { &this->colorAtlas, &this->normalAtlas };
+		const GLuint units[2] = { BILLBOARD_COLOR_UNIT, BILLBOARD_NORMAL_UNIT };
+		for (int i = 0; i < 2; i++)
+		{
+			glGenTextures(1, atlases[i]);
+			_glState.selectTexture(units[i], *atlases[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, BILLBOARD_MIP_LEVELS - 1);
+		}
+		glGenRenderbuffers(1, &this->depthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->depthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &this->framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->framebuffer);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->colorAtlas, 0);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->normalAtlas, 0);
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depthBuffer);
+		const GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, buffers);
+		if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::BILLBOARDS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	}
+
+	glm::vec4 views[BILLBOARD_VIEWS];
+	float extent = 1.0f;
+	InstanceBuffer bakeInstances;
+	GLuint framebuffer = 0;
+	GLuint depthBuffer = 0;
+	GLuint colorAtlas = 0;
+	GLuint normalAtlas = 0;
+	GLuint vertexArray = 0;
+	bool ready = false;
+};
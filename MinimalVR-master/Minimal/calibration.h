@@ -0,0 +1,374 @@
+#pragma once
+// Std. Includes
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "glstate.h"
+#include "timing.h"
+#include "programcache.h"
+
+// Where the measurements are kept between runs, next to the frame profile
+#define GPU_CALIBRATION_PATH "gpu_calibration.txt"
+// Bumped whenever the tests change, so older measurements are taken again
+#define GPU_CALIBRATION_VERSION 1
+// The fill test's target, blended over GPU_CALIBRATION_FILL_LAYERS times
+#define GPU_CALIBRATION_FILL_SIZE 2048
+#define GPU_CALIBRATION_FILL_LAYERS 16
+// Triangles of the vertex test, each smaller than a pixel
+#define GPU_CALIBRATION_TRIANGLES 1000000
+// Draws of the draw call test, a uniform changed before each
+#define GPU_CALIBRATION_DRAWS 2000
+// Each test is timed this many times and the fastest kept, the others were disturbed by something
+#define GPU_CALIBRATION_REPETITIONS 3
+
+// The eye presets, tried in order until one fits: MSAA gives way before the resolution does, as it does to the
+// quality governor
+#define GPU_CALIBRATION_SCALE_COUNT 4
+static const float GPU_CALIBRATION_SCALES[GPU_CALIBRATION_SCALE_COUNT] = { 1.0f, 0.9f, 0.8f, 0.7f };
+// Layers of the eyes' pixels a frame fills, the scene's overdraw and the passes over it together
+#define GPU_CALIBRATION_OVERDRAW 3.0f
+// What each sample after the first adds to a pixel's fill
+#define GPU_CALIBRATION_SAMPLE_COST 0.25f
+// Share of the frame budget the eyes' fill may take at the preset, the rest is for everything else and headroom
+#define GPU_CALIBRATION_FILL_SHARE 0.5f
+
+// What a machine measured, per GPU and driver
+struct GpuCalibrationResult
+{
+	// Blended pixels per second, in billions
+	float fillGpixels = 0.0f;
+	// Vertices per second through a trivial vertex shader, in millions
+	float vertexMillions = 0.0f;
+	// Cost of one small draw with a uniform change before it, the CPU's or the GPU's whichever is longer
+	float drawMicroseconds = 0.0f;
+
+	bool valid() const { return this->fillGpixels > 0.0f && this->vertexMillions > 0.0f && this->drawMicroseconds > 0.0f; }
+
+	// What that much of each costs a frame, in ms
+	float fillMs(double pixels) const { return (float)(pixels / (this->fillGpixels * 1e6)); }
+	float vertexMs(double vertices) const { return (float)(vertices / (this->vertexMillions * 1e3)); }
+	float drawMs(double draws) const { return (float)(draws * this->drawMicroseconds * 1e-3); }
+};
+
+// The eye target's share of a preset, see GpuCalibration::eyePreset
+struct GpuEyePreset
+{
+	// Ceiling of the dynamic resolution's scale
+	float resolutionScale = 1.0f;
+	int msaaSamples = 1;
+};
+
+static const char GPU_CALIBRATION_VERTEX[] =
+	"#version 410 core\n"
+	"uniform int scatter;\n"
+	"void main() {\n"
+	"    int corner = gl_VertexID % 3;\n"
+	"    vec2 offset = vec2(corner == 1 ? 1.0 : 0.0, corner == 2 ? 1.0 : 0.0);\n"
+	"    if (scatter == 0) {\n"
+	"        gl_Position = vec4(offset * 4.0 - 1.0, 0.0, 1.0);\n"
+	"        return;\n"
+	"    }\n"
+	"    float t = float(gl_VertexID / 3);\n"
+	"    vec2 at = fract(vec2(t * 0.6180339, t * 0.7548777)) * 2.0 - 1.0;\n"
+	"    gl_Position = vec4(at + offset * 1e-4, 0.0, 1.0);\n"
+	"}\n";
+
+static const char GPU_CALIBRATION_FRAGMENT[] =
+	"#version 410 core\n"
+	"uniform vec4 color;\n"
+	"out vec4 fragColor;\n"
+	"void main() {\n"
+	"    fragColor = color;\n"
+	"}\n";
+
+// A short measurement of the GPU, taken the first time the app runs on a machine, that the startup quality preset
+// is picked from. Three tests on a target of their own, timed with GL_TIME_ELAPSED: blended full screen triangles
+// for the fill rate, a million subpixel triangles for the vertex rate, and small draws with a uniform change
+// between each for the cost of a draw call. RiftApp runs it while the loading layer holds the headset, so the
+// second or so it takes is covered.
+//
+// The measurements, rather than the presets, are kept in GPU_CALIBRATION_PATH under a key of the GL vendor, renderer
+// and version, like the program cache; a new GPU or driver misses the key and measures again. What is picked from
+// them can then follow the command line and the headset of the session. --recalibrate measures again anyway,
+// --no-calibration leaves the presets at their best.
+class GpuCalibration
+{
+public:
+	void setEnabled(bool enabled) { this->on = enabled; }
+	void setForced(bool forced) { this->force = forced; }
+
+	// On the render thread once the context is up, loads the machine's measurements or takes them
+	void init()
+	{
+		if (!this->on)
+			return;
+		const uint64_t key = this->identity();
+		if (!this->force && this->load(key))
+		{
+			printf("GPU calibration: %.2f Gpixels/s, %.0f Mvertices/s, %.2f us per draw, from " GPU_CALIBRATION_PATH "\r\n",
+				this->measured.fillGpixels, this->measured.vertexMillions, this->measured.drawMicroseconds);
+			return;
+		}
+		if (!this->run())
+		{
+			std::cout << "ERROR::CALIBRATION::NOT_MEASURED" << std::endl;
+			this->measured = GpuCalibrationResult();
+			return;
+		}
+		printf("GPU calibration: %.2f Gpixels/s, %.0f Mvertices/s, %.2f us per draw, measured\r\n",
+			this->measured.fillGpixels, this->measured.vertexMillions, this->measured.drawMicroseconds);
+		this->save(key);
+	}
+
+	bool available() const { return this->measured.valid(); }
+	const GpuCalibrationResult& result() const { return this->measured; }
+
+	// The best eye target whose fill fits its share of the frame: eyePixels at full resolution, up to maxSamples.
+	// What frameDraws draw calls cost comes off the share first. The best there is without measurements.
+	GpuEyePreset eyePreset(double eyePixels, float refreshRate, int maxSamples, double frameDraws) const
+	{
+		GpuEyePreset preset;
+		preset.msaaSamples = maxSamples;
+		if (!this->available())
+			return preset;
+		const float budgetMs = 1000.0f / std::max(refreshRate, 1.0f) * GPU_CALIBRATION_FILL_SHARE - this->measured.drawMs(frameDraws);
+		for (int s = 0; s < GPU_CALIBRATION_SCALE_COUNT; s++)
+		{
+			preset.resolutionScale = GPU_CALIBRATION_SCALES[s];
+			for (preset.msaaSamples = maxSamples; preset.msaaSamples >= 1; preset.msaaSamples /= 2)
+			{
+				const double pixels = eyePixels * preset.resolutionScale * preset.resolutionScale * GPU_CALIBRATION_OVERDRAW;
+				const float samples = 1.0f + GPU_CALIBRATION_SAMPLE_COST * (preset.msaaSamples - 1);
+				if (this->measured.fillMs(pixels * samples) <= budgetMs)
+					return preset;
+			}
+		}
+		// Nothing fits, the cheapest there is and the quality governor takes it from there
+		preset.msaaSamples = 1;
+		return preset;
+	}
+
+private:
+	GpuCalibrationResult measured;
+	bool on = true;
+	bool force = false;
+
+	static uint64_t identity()
+	{
+		uint64_t hash = 14695981039346656037ull;
+		const uint32_t version = GPU_CALIBRATION_VERSION;
+		hash = _programCacheHash(&version, sizeof(version), hash);
+		const GLenum identity[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (int i = 0; i < 3; i++)
+		{
+			const char* text = (const char*)glGetString(identity[i]);
+			if (text)
+				hash = _programCacheHash(text, strlen(text) + 1, hash);
+		}
+		return hash;
+	}
+
+	bool load(uint64_t key)
+	{
+		ifstream in(GPU_CALIBRATION_PATH);
+		if (!in)
+			return false;
+		GpuCalibrationResult loaded;
+		bool matched = false;
+		string name;
+		while (in >> name)
+		{
+			if (name == "gpu")
+			{
+				string hex;
+				in >> hex;
+				matched = strtoull(hex.c_str(), nullptr, 16) == key;
+			}
+			else if (name == "fill_gpixels")
+				in >> loaded.fillGpixels;
+			else if (name == "vertex_millions")
+				in >> loaded.vertexMillions;
+			else if (name == "draw_us")
+				in >> loaded.drawMicroseconds;
+			else
+				in.ignore(1024, '\n');
+		}
+		if (!matched || !loaded.valid())
+			return false;
+		this->measured = loaded;
+		return true;
+	}
+
+	void save(uint64_t key) const
+	{
+		FILE* out = fopen(GPU_CALIBRATION_PATH, "w");
+		if (!out)
+		{
+			std::cout << "ERROR::CALIBRATION::NOT_SAVED " GPU_CALIBRATION_PATH << std::endl;
+			return;
+		}
+		const char* renderer = (const char*)glGetString(GL_RENDERER);
+		fprintf(out, "# %s\n", renderer ? renderer : "");
+		fprintf(out, "gpu %016llx\n", (unsigned long long)key);
+		fprintf(out, "fill_gpixels %g\n", this->measured.fillGpixels);
+		fprintf(out, "vertex_millions %g\n", this->measured.vertexMillions);
+		fprintf(out, "draw_us %g\n", this->measured.drawMicroseconds);
+		fclose(out);
+	}
+
+	bool run()
+	{
+		GLuint program = link();
+		if (!program)
+			return false;
+		GLuint texture = 0, framebuffer = 0, vertexArray = 0, query = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, GPU_CALIBRATION_FILL_SIZE, GPU_CALIBRATION_FILL_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+		const bool complete = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		// The vertices come out of gl_VertexID. Every triangle winds counter-clockwise and the target has no depth,
+		// so culling and the depth test pass them whatever they are set to.
+		glGenVertexArrays(1, &vertexArray);
+		glGenQueries(1, &query);
+
+		if (complete)
+		{
+			glViewport(0, 0, GPU_CALIBRATION_FILL_SIZE, GPU_CALIBRATION_FILL_SIZE);
+			_glState.useProgram(program);
+			_glState.bindVertexArray(vertexArray);
+			_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			const GLint scatter = glGetUniformLocation(program, "scatter");
+			const GLint color = glGetUniformLocation(program, "color");
+			glUniform4f(color, 0.5f, 0.5f, 0.5f, 0.5f);
+
+			// Blended, so every layer reads the target as well as writing it, as overdraw does
+			_glState.blend(true);
+			glUniform1i(scatter, 0);
+			const double fillSeconds = this->fastest(query, [] {
+				glDrawArrays(GL_TRIANGLES, 0, 3 * GPU_CALIBRATION_FILL_LAYERS);
+			});
+			_glState.blend(false);
+
+			glUniform1i(scatter, 1);
+			const double vertexSeconds = this->fastest(query, [] {
+				glDrawArrays(GL_TRIANGLES, 0, 3 * GPU_CALIBRATION_TRIANGLES);
+			});
+
+			double drawCpuSeconds = 0.0;
+			const double drawGpuSeconds = this->fastest(query, [&] {
+				const int64_t start = _timeTicks();
+				for (int i = 0; i < GPU_CALIBRATION_DRAWS; i++)
+				{
+					glUniform4f(color, (float)(i & 1), 0.5f, 0.5f, 1.0f);
+					glDrawArrays(GL_TRIANGLES, 3 * i, 3);
+				}
+				const double cpu = _timeTicksToSeconds(_timeTicks() - start);
+				drawCpuSeconds = drawCpuSeconds > 0.0 ? std::min(drawCpuSeconds, cpu) : cpu;
+			});
+
+			if (fillSeconds > 0.0 && vertexSeconds > 0.0 && drawGpuSeconds > 0.0)
+			{
+				const double pixels = (double)GPU_CALIBRATION_FILL_SIZE * GPU_CALIBRATION_FILL_SIZE * GPU_CALIBRATION_FILL_LAYERS;
+				this->measured.fillGpixels = (float)(pixels / fillSeconds * 1e-9);
+				this->measured.vertexMillions = (float)(3.0 * GPU_CALIBRATION_TRIANGLES / vertexSeconds * 1e-6);
+				this->measured.drawMicroseconds = (float)(std::max(drawCpuSeconds, drawGpuSeconds) / GPU_CALIBRATION_DRAWS * 1e6);
+			}
+			_glState.bindVertexArray(0);
+			_glState.useProgram(0);
+		}
+		else
+		{
+			std::cout << "ERROR::CALIBRATION::FRAMEBUFFER_INCOMPLETE" << std::endl;
+		}
+
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glDeleteQueries(1, &query);
+		glDeleteVertexArrays(1, &vertexArray);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteTextures(1, &texture);
+		glDeleteProgram(program);
+		return this->measured.valid();
+	}
+
+	// GPU seconds of the fastest of GPU_CALIBRATION_REPETITIONS runs of draw, after one untimed run that leaves the
+	// driver nothing to set up on the first timed one; 0 if the query has no result
+	template <typename Draw>
+	static double fastest(GLuint query, Draw draw)
+	{
+		draw();
+		double best = 0.0;
+		for (int i = 0; i < GPU_CALIBRATION_REPETITIONS; i++)
+		{
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			draw();
+			glEndQuery(GL_TIME_ELAPSED);
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+			const double seconds = nanoseconds * 1e-9;
+			if (seconds > 0.0 && (best == 0.0 || seconds < best))
+				best = seconds;
+		}
+		return best;
+	}
+
+	static GLuint compile(GLenum type, const char* source)
+	{
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+		GLint success = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::CALIBRATION::COMPILATION_FAILED\n" << infoLog << std::endl;
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+
+	static GLuint link()
+	{
+		GLuint vertex = compile(GL_VERTEX_SHADER, GPU_CALIBRATION_VERTEX);
+		GLuint fragment = compile(GL_FRAGMENT_SHADER, GPU_CALIBRATION_FRAGMENT);
+		if (!vertex || !fragment)
+		{
+			glDeleteShader(vertex);
+			glDeleteShader(fragment);
+			return 0;
+		}
+		GLuint linked = glCreateProgram();
+		glAttachShader(linked, vertex);
+		glAttachShader(linked, fragment);
+		glLinkProgram(linked);
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		GLint success = 0;
+		glGetProgramiv(linked, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetProgramInfoLog(linked, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::CALIBRATION::LINKING_FAILED\n" << infoLog << std::endl;
+			glDeleteProgram(linked);
+			return 0;
+		}
+		return linked;
+	}
+};
+
+static GpuCalibration _gpuCalibration;
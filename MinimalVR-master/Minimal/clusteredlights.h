@@ -0,0 +1,249 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "glstate.h"
+
+// Clusters across, up and in depth. Depth slices are exponential from CLUSTER_NEAR, so each is about as deep as it
+// is wide.
+#define CLUSTER_X 16
+#define CLUSTER_Y 8
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define CLUSTER_NEAR 0.05f
+#define CLUSTER_FAR 20.0f
+// Length of the light array in shader.frag, which spells it out too. 32 bytes each fits the 16KB minimum block size.
+#define CLUSTER_MAX_LIGHTS 256
+// Light indices of all clusters together, past this lights are dropped from the clusters that would overflow
+#define CLUSTER_MAX_INDICES 32768
+// Uniform block binding of ClusterLights in shader.frag
+#define CLUSTER_LIGHTS_BINDING 5
+// Texture units of the cluster grid and index buffer textures, below HIZ_TEXTURE_UNIT
+#define CLUSTER_GRID_UNIT 13
+#define CLUSTER_INDEX_UNIT 14
+
+// std140 element of the ClusterLights array: world position and range, then color with the intensity in w
+struct ClusterLight
+{
+	glm::vec4 positionRange;
+	glm::vec4 color;
+};
+static_assert(sizeof(ClusterLight) == 32, "ClusterLight must match the std140 layout of PointLight");
+
+// Point lights for shader.frag, sorted into a froxel grid so a fragment only loops over the lights whose range
+// reaches its cluster.
+//
+// The grid hangs off one camera between the eyes whose tangents cover both, so one assignment serves instanced,
+// multiview and per eye draws alike. Fragments outside it clamp to the edge clusters, which is why lights beyond the
+// edges are assigned to those too. Assignment is on the CPU, a few dozen lights against the clusters their bounding
+// box projects to; the grid (offset and count per cluster) and the index list go up as buffer textures, the lights
+// as a uniform block, all plain GL 4.1.
+class ClusteredLights
+{
+public:
+	ClusteredLights() {}
+	~ClusteredLights()
+	{
+		GLuint buffers[3] = { this->lightBuffer, this->gridBuffer, this->indexBuffer };
+		glDeleteBuffers(3, buffers);
+		GLuint textures[2] = { this->gridTexture, this->indexTexture };
+		glDeleteTextures(2, textures);
+	}
+
+	ClusteredLights(const ClusteredLights&) = delete;
+	ClusteredLights& operator=(const ClusteredLights&) = delete;
+
+	void init()
+	{
+		glGenBuffers(1, &this->lightBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, this->lightBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, CLUSTER_MAX_LIGHTS * sizeof(ClusterLight), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		glGenBuffers(1, &this->gridBuffer);
+		glGenBuffers(1, &this->indexBuffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, this->gridBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, CLUSTER_COUNT * 2 * sizeof(GLuint), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, this->indexBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, CLUSTER_MAX_INDICES * sizeof(GLushort), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glGenTextures(1, &this->gridTexture);
+		_glState.bindBufferTexture(CLUSTER_GRID_UNIT, this->gridTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, this->gridBuffer);
+		glGenTextures(1, &this->indexTexture);
+		_glState.bindBufferTexture(CLUSTER_INDEX_UNIT, this->indexTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, this->indexBuffer);
+		_glState.bindBufferTexture(CLUSTER_INDEX_UNIT, 0);
+		_glState.bindBufferTexture(CLUSTER_GRID_UNIT, 0);
+	}
+
+	// The lights from now on, only the first CLUSTER_MAX_LIGHTS are kept
+	void setLights(const vector<ClusterLight>& lights)
+	{
+		this->lights.assign(lights.begin(), lights.begin() + std::min(lights.size(), (size_t)CLUSTER_MAX_LIGHTS));
+		if (this->lights.empty())
+			return;
+		glBindBuffer(GL_UNIFORM_BUFFER, this->lightBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, this->lights.size() * sizeof(ClusterLight), this->lights.data());
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		_renderStats.uniforms(this->lights.size() * sizeof(ClusterLight));
+	}
+
+	size_t size() const { return this->lights.size(); }
+
+	// Sorts the lights into the clusters of the camera at view (world to view) whose tangents x / -z and y / -z
+	// run over tangents (min x, max x, min y, max y), and uploads the result
+	void assign(const glm::mat4& view, const glm::vec4& tangents)
+	{
+		this->clusterView = view;
+		this->clusterTangents = tangents;
+		this->counts.assign(CLUSTER_COUNT, 0);
+		this->ranges.clear();
+		for (size_t l = 0; l < this->lights.size(); l++)
+		{
+			ClusterRange range;
+			if (this->clusterRange(this->lights[l], &range))
+			{
+				range.light = (uint16_t)l;
+				this->ranges.push_back(range);
+				this->forEachCluster(range, [&](size_t c) { this->counts[c]++; });
+			}
+		}
+
+		// Prefix sum into each cluster's offset, then the indices in light order
+		this->grid.resize(CLUSTER_COUNT * 2);
+		GLuint offset = 0;
+		this->overflowed = false;
+		for (size_t c = 0; c < CLUSTER_COUNT; c++)
+		{
+			GLuint count = this->counts[c];
+			if (offset + count > CLUSTER_MAX_INDICES)
+			{
+				count = CLUSTER_MAX_INDICES - offset;
+				this->overflowed = true;
+			}
+			this->grid[c * 2] = offset;
+			this->grid[c * 2 + 1] = count;
+			this->counts[c] = 0;
+			offset += count;
+		}
+		this->indices.resize(std::max(offset, (GLuint)1));
+		for (size_t r = 0; r < this->ranges.size(); r++)
+		{
+			const ClusterRange& range = this->ranges[r];
+			this->forEachCluster(range, [&](size_t c) {
+				if (this->counts[c] < this->grid[c * 2 + 1])
+					this->indices[this->grid[c * 2] + this->counts[c]++] = range.light;
+			});
+		}
+		if (this->overflowed && !this->reported)
+			std::cout << "ERROR::CLUSTERED_LIGHTS::INDEX_OVERFLOW" << std::endl;
+		this->reported = this->reported || this->overflowed;
+
+		glBindBuffer(GL_TEXTURE_BUFFER, this->gridBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, CLUSTER_COUNT * 2 * sizeof(GLuint), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, this->grid.size() * sizeof(GLuint), this->grid.data());
+		glBindBuffer(GL_TEXTURE_BUFFER, this->indexBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, CLUSTER_MAX_INDICES * sizeof(GLushort), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, offset * sizeof(GLushort), this->indices.data());
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		_renderStats.uploaded(this->grid.size() * sizeof(GLuint) + offset * sizeof(GLushort));
+	}
+
+	// Binds the block and buffer textures for the draws that follow
+	void bind()
+	{
+		glBindBufferBase(GL_UNIFORM_BUFFER, CLUSTER_LIGHTS_BINDING, this->lightBuffer);
+		_glState.bindBufferTexture(CLUSTER_GRID_UNIT, this->gridTexture);
+		_glState.bindBufferTexture(CLUSTER_INDEX_UNIT, this->indexTexture);
+	}
+
+	const glm::mat4& view() const { return this->clusterView; }
+	const glm::vec4& tangents() const { return this->clusterTangents; }
+
+private:
+	// Clusters a light's bounding box covers, inclusive
+	struct ClusterRange
+	{
+		int x0, x1, y0, y1, z0, z1;
+		uint16_t light;
+	};
+
+	template <typename F>
+	void forEachCluster(const ClusterRange& range, F f)
+	{
+		for (int z = range.z0; z <= range.z1; z++)
+		{
+			for (int y = range.y0; y <= range.y1; y++)
+			{
+				for (int x = range.x0; x <= range.x1; x++)
+					f((size_t)((z * CLUSTER_Y + y) * CLUSTER_X + x));
+			}
+		}
+	}
+
+	// False if the light is entirely behind the grid's near plane or past its far plane
+	bool clusterRange(const ClusterLight& light, ClusterRange* range) const
+	{
+		const glm::vec4 p = this->clusterView * glm::vec4(light.positionRange.x, light.positionRange.y, light.positionRange.z, 1.0f);
+		const float r = light.positionRange.w;
+		const float nearest = -p.z - r, farthest = -p.z + r;
+		if (farthest < CLUSTER_NEAR || nearest > CLUSTER_FAR)
+			return false;
+		range->z0 = slice(nearest);
+		range->z1 = slice(farthest);
+		const glm::vec4& t = this->clusterTangents;
+		if (nearest <= CLUSTER_NEAR)
+		{
+			// Reaches round the camera, every direction
+			range->x0 = range->y0 = 0;
+			range->x1 = CLUSTER_X - 1;
+			range->y1 = CLUSTER_Y - 1;
+			return true;
+		}
+		// Tangents of the box around the light, each extreme at the depth that makes it most extreme
+		const float x0 = p.x - r, x1 = p.x + r, y0 = p.y - r, y1 = p.y + r;
+		const float tx0 = x0 / (x0 < 0.0f ? nearest : farthest), tx1 = x1 / (x1 > 0.0f ? nearest : farthest);
+		const float ty0 = y0 / (y0 < 0.0f ? nearest : farthest), ty1 = y1 / (y1 > 0.0f ? nearest : farthest);
+		range->x0 = tile(tx0, t.x, t.y, CLUSTER_X);
+		range->x1 = tile(tx1, t.x, t.y, CLUSTER_X);
+		range->y0 = tile(ty0, t.z, t.w, CLUSTER_Y);
+		range->y1 = tile(ty1, t.z, t.w, CLUSTER_Y);
+		return true;
+	}
+
+	// The same mappings as clusterIndex in shader.frag, clamped so what lies past the grid lands on its edge
+	static int slice(float depth)
+	{
+		const float s = logf(std::max(depth, CLUSTER_NEAR) / CLUSTER_NEAR) / logf(CLUSTER_FAR / CLUSTER_NEAR) * CLUSTER_Z;
+		return std::min(std::max((int)floorf(s), 0), CLUSTER_Z - 1);
+	}
+
+	static int tile(float tangent, float lo, float hi, int count)
+	{
+		const float s = (tangent - lo) / (hi - lo) * count;
+		return std::min(std::max((int)floorf(s), 0), count - 1);
+	}
+
+	GLuint lightBuffer = 0;
+	GLuint gridBuffer = 0;
+	GLuint indexBuffer = 0;
+	GLuint gridTexture = 0;
+	GLuint indexTexture = 0;
+	vector<ClusterLight> lights;
+	vector<ClusterRange> ranges;
+	vector<GLuint> counts;
+	vector<GLuint> grid;
+	vector<GLushort> indices;
+	glm::mat4 clusterView;
+	glm::vec4 clusterTangents = glm::vec4(-1.0f, 1.0f, -1.0f, 1.0f);
+	bool overflowed = false;
+	bool reported = false;
+};
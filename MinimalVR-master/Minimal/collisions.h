@@ -0,0 +1,137 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+#include "molecules.h"
+
+// Equal mass elastic collisions between the molecules of a MoleculeStore, every molecule a sphere of one radius.
+//
+// build() hashes the molecules into cells a diameter wide, counting sorted into one array so a rebuild every step
+// is a few linear passes and no allocation once the arrays have grown. Spheres touching are then always in the same
+// or neighbouring cells. collide() handles each molecule on its own: it reads everyone's velocity and writes only
+// its own change, the same one its partner works out with the sign flipped, so disjoint ranges can run on different
+// threads and the result doesn't depend on how they were split. apply() adds the changes in afterwards.
+class MoleculeCollisions
+{
+public:
+	void setRadius(float radius) { this->cellSize = radius * 2.0f; }
+
+	// Buckets every molecule by its position now
+	void build(const MoleculeStore& store)
+	{
+		const size_t n = store.size();
+		// At least twice as many buckets as molecules keeps the unrelated cells sharing one rare
+		size_t buckets = 64;
+		while (buckets < n * 2)
+			buckets *= 2;
+		this->mask = (uint32_t)buckets - 1;
+		this->starts.assign(buckets + 1, 0);
+		this->moleculeCells.resize(n);
+		this->sorted.resize(n);
+		this->deltaX.assign(n, 0.0f);
+		this->deltaY.assign(n, 0.0f);
+		this->deltaZ.assign(n, 0.0f);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			const uint32_t bucket = this->bucketOf(this->cellOf(store.posX[i], store.posY[i], store.posZ[i]));
+			this->moleculeCells[i] = bucket;
+			this->starts[bucket + 1]++;
+		}
+		for (size_t b = 0; b < buckets; b++)
+			this->starts[b + 1] += this->starts[b];
+		this->cursors.assign(this->starts.begin(), this->starts.end() - 1);
+		for (size_t i = 0; i < n; i++)
+			this->sorted[this->cursors[this->moleculeCells[i]]++] = (uint32_t)i;
+	}
+
+	// The velocity changes of molecules [begin, end) from everything they touch while closing in on it,
+	// returns how many contacts that was
+	uint32_t collide(const MoleculeStore& store, size_t begin, size_t end)
+	{
+		const float diameterSquared = this->cellSize * this->cellSize;
+		uint32_t contacts = 0;
+		uint32_t neighbourhood[27];
+		for (size_t i = begin; i < end; i++)
+		{
+			const glm::vec3 p(store.posX[i], store.posY[i], store.posZ[i]);
+			const glm::vec3 v(store.velX[i], store.velY[i], store.velZ[i]);
+			const glm::ivec3 cell = this->cellOf(p.x, p.y, p.z);
+			// Neighbouring cells can share a bucket, each is walked once
+			int count = 0;
+			for (int z = -1; z <= 1; z++)
+				for (int y = -1; y <= 1; y++)
+					for (int x = -1; x <= 1; x++)
+					{
+						const uint32_t bucket = this->bucketOf(cell + glm::ivec3(x, y, z));
+						if (std::find(neighbourhood, neighbourhood + count, bucket) == neighbourhood + count)
+							neighbourhood[count++] = bucket;
+					}
+
+			glm::vec3 delta(0.0f);
+			for (int c = 0; c < count; c++)
+			{
+				for (uint32_t e = this->starts[neighbourhood[c]]; e < this->starts[neighbourhood[c] + 1]; e++)
+				{
+					const uint32_t j = this->sorted[e];
+					if (j == i)
+						continue;
+					const glm::vec3 offset = p - glm::vec3(store.posX[j], store.posY[j], store.posZ[j]);
+					const float distanceSquared = glm::dot(offset, offset);
+					// On top of each other there is no direction to push along, they drift apart by themselves
+					if (distanceSquared >= diameterSquared || distanceSquared < 1e-12f)
+						continue;
+					const glm::vec3 normal = offset / sqrtf(distanceSquared);
+					const float closing = glm::dot(v - glm::vec3(store.velX[j], store.velY[j], store.velZ[j]), normal);
+					// Already separating, from this contact or an earlier step's
+					if (closing >= 0.0f)
+						continue;
+					// Equal masses swap their velocities along the normal
+					delta -= normal * closing;
+					contacts++;
+				}
+			}
+			this->deltaX[i] = delta.x;
+			this->deltaY[i] = delta.y;
+			this->deltaZ[i] = delta.z;
+		}
+		return contacts;
+	}
+
+	// Once collide() has been through every molecule
+	void apply(MoleculeStore& store, size_t begin, size_t end) const
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			store.velX[i] += this->deltaX[i];
+			store.velY[i] += this->deltaY[i];
+			store.velZ[i] += this->deltaZ[i];
+		}
+	}
+
+private:
+	glm::ivec3 cellOf(float x, float y, float z) const
+	{
+		return glm::ivec3((int)floorf(x / this->cellSize), (int)floorf(y / this->cellSize), (int)floorf(z / this->cellSize));
+	}
+
+	uint32_t bucketOf(const glm::ivec3& cell) const
+	{
+		return (((uint32_t)cell.x * 73856093u) ^ ((uint32_t)cell.y * 19349663u) ^ ((uint32_t)cell.z * 83492791u)) & this->mask;
+	}
+
+	// A molecule's diameter
+	float cellSize = 0.05f;
+	uint32_t mask = 0;
+	// starts[b] to starts[b + 1] is bucket b's range of sorted
+	vector<uint32_t> starts;
+	vector<uint32_t> sorted;
+	vector<uint32_t> cursors;
+	vector<uint32_t> moleculeCells;
+	vector<float> deltaX, deltaY, deltaZ;
+};
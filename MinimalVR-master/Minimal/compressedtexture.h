@@ -0,0 +1,384 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "mappedfile.h"
+#include "assetpack.h"
+
+// Block compressed textures with their full mip chain, read in place from DDS or KTX (version 1) files.
+//
+// BC1 (DXT1), BC3 (DXT5) and BC7 are understood, as plain or sRGB. BC7 needs ARB_texture_compression_bptc,
+// files in it are refused without. DDS may use the legacy FourCC header or the DX10 extension, KTX must hold
+// a single 2D image. Only the block data ever leaves the mapping, and only into the driver.
+
+// Bytes per 4x4 block
+static GLsizei _compressedBlockSize(GLenum format)
+{
+	return (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT || format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT) ? 8 : 16;
+}
+
+static GLsizei _compressedLevelSize(GLenum format, GLsizei width, GLsizei height)
+{
+	return std::max((width + 3) / 4, 1) * std::max((height + 3) / 4, 1) * _compressedBlockSize(format);
+}
+
+static bool _compressedFormatSupported(GLenum format)
+{
+	switch (format)
+	{
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+		return GLEW_EXT_texture_compression_s3tc != 0;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+	case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+		return GLEW_ARB_texture_compression_bptc != 0;
+	}
+	return false;
+}
+
+class CompressedImage
+{
+public:
+	struct Level
+	{
+		GLsizei width;
+		GLsizei height;
+		const uint8_t* data;
+		GLsizei size;
+	};
+
+	CompressedImage() {}
+
+	CompressedImage(const CompressedImage&) = delete;
+	CompressedImage& operator=(const CompressedImage&) = delete;
+
+	// False if the file is missing, not a DDS/KTX this class understands, or in a format the driver lacks.
+	// A file in _assetPack is read from there.
+	bool open(const string& path)
+	{
+		this->levels.clear();
+		this->file.close();
+		AssetSpan packed;
+		if (_assetPack.find(path, &packed))
+		{
+			this->bytes = packed.data;
+			this->length = packed.size;
+		}
+		else if (this->file.open(path))
+		{
+			this->bytes = this->file.data();
+			this->length = this->file.size();
+		}
+		else
+		{
+			return false;
+		}
+		if ((this->parseDDS() || this->parseKTX()) && _compressedFormatSupported(this->glFormat))
+			return true;
+		this->levels.clear();
+		this->file.close();
+		this->bytes = nullptr;
+		this->length = 0;
+		return false;
+	}
+
+	GLenum format() const { return this->glFormat; }
+	const vector<Level>& mipLevels() const { return this->levels; }
+
+private:
+	MappedFile file;
+	// The file's mapping or the span of the pack
+	const uint8_t* bytes = nullptr;
+	size_t length = 0;
+	GLenum glFormat = 0;
+	vector<Level> levels;
+
+	// Fills levels from consecutive blocks starting at offset, false if a level doesn't fit in the file
+	bool addLevels(size_t offset, GLsizei width, GLsizei height, uint32_t count, bool ktxSizes)
+	{
+		for (uint32_t i = 0; i < std::max(count, 1u); i++)
+		{
+			Level level;
+			level.width = width;
+			level.height = height;
+			level.size = _compressedLevelSize(this->glFormat, width, height);
+			if (ktxSizes)
+			{
+				// Every KTX level is prefixed by its size and padded to 4 bytes
+				if (offset + 4 > this->length)
+					return false;
+				uint32_t imageSize;
+				memcpy(&imageSize, this->bytes + offset, 4);
+				if ((GLsizei)imageSize != level.size)
+					return false;
+				offset += 4;
+			}
+			if (offset + level.size > this->length)
+				return false;
+			level.data = this->bytes + offset;
+			offset += ktxSizes ? ((level.size + 3) & ~3) : level.size;
+			this->levels.push_back(level);
+
+			width = std::max(width / 2, 1);
+			height = std::max(height / 2, 1);
+		}
+		return true;
+	}
+
+	bool parseDDS()
+	{
+		// "DDS ", then a 124 byte header whose pixel format starts 72 bytes in
+		const uint8_t* data = this->bytes;
+		if (this->length < 128 || memcmp(data, "DDS ", 4) != 0)
+			return false;
+		uint32_t header[31];
+		memcpy(header, data + 4, sizeof(header));
+		const uint32_t height = header[2], width = header[3], mipCount = header[6];
+		const uint32_t pixelFlags = header[19], fourCC = header[20];
+		const uint32_t DDPF_FOURCC = 0x4;
+		if (!(pixelFlags & DDPF_FOURCC))
+			return false;
+
+		size_t offset = 128;
+		if (fourCC == 0x31545844) // "DXT1"
+			this->glFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		else if (fourCC == 0x35545844) // "DXT5"
+			this->glFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		else if (fourCC == 0x30315844) // "DX10", a DXGI format follows the header
+		{
+			if (this->length < 148)
+				return false;
+			uint32_t dxgiFormat;
+			memcpy(&dxgiFormat, data + offset, 4);
+			offset += 20;
+			switch (dxgiFormat)
+			{
+			case 71: this->glFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+			case 72: this->glFormat = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT; break;
+			case 77: this->glFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+			case 78: this->glFormat = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT; break;
+			case 98: this->glFormat = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+			case 99: this->glFormat = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; break;
+			default: return false;
+			}
+		}
+		else
+		{
+			return false;
+		}
+		return this->addLevels(offset, (GLsizei)width, (GLsizei)height, mipCount, false);
+	}
+
+	bool parseKTX()
+	{
+		static const uint8_t identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+		const uint8_t* data = this->bytes;
+		if (this->length < 64 || memcmp(data, identifier, 12) != 0)
+			return false;
+		// endianness, glType, glTypeSize, glFormat, glInternalFormat, glBaseInternalFormat, width, height, depth,
+		// array elements, faces, mip levels, key/value bytes
+		uint32_t header[13];
+		memcpy(header, data + 12, sizeof(header));
+		if (header[0] != 0x04030201 || header[1] != 0 || header[8] != 0 || header[9] != 0 || header[10] != 1)
+			return false;
+		this->glFormat = header[4];
+		return this->addLevels(64 + (size_t)header[12], (GLsizei)header[6], (GLsizei)header[7], header[11], true);
+	}
+};
+
+// Creates a texture from the levels of image from firstLevel on, in the style of the avatar texture upload. The
+// levels before firstLevel are left undefined and sampling starts at firstLevel, the TextureCache streams them in
+// later. Needs a current GL context.
+static GLuint _uploadCompressedImage(const CompressedImage& image, size_t firstLevel = 0)
+{
+	const vector<CompressedImage::Level>& levels = image.mipLevels();
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	for (size_t i = firstLevel; i < levels.size(); i++)
+		glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, image.format(), levels[i].width, levels[i].height, 0, levels[i].size, levels[i].data);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)firstLevel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+//////////////////////////////////////////////////////////////////////
+//
+// Offline encoding, for --compress-texture. Bounding box endpoints inset by 1/16 of the range, then the nearest
+// palette entry per pixel: quick and fine for environment art, not a replacement for a proper BC7 encoder.
+//
+
+static inline uint16_t _packRgb565(const int* rgb)
+{
+	return (uint16_t)(((rgb[0] * 31 + 127) / 255) << 11 | ((rgb[1] * 63 + 127) / 255) << 5 | ((rgb[2] * 31 + 127) / 255));
+}
+
+static inline void _unpackRgb565(uint16_t packed, int* rgb)
+{
+	rgb[0] = ((packed >> 11) & 31) * 255 / 31;
+	rgb[1] = ((packed >> 5) & 63) * 255 / 63;
+	rgb[2] = (packed & 31) * 255 / 31;
+}
+
+// 16 RGBA pixels of one block into 8 bytes of BC1 color data, always in four color mode
+static void _encodeColorBlock(const uint8_t* pixels, uint8_t* out)
+{
+	int low[3] = { 255, 255, 255 }, high[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			low[c] = std::min(low[c], (int)pixels[i * 4 + c]);
+			high[c] = std::max(high[c], (int)pixels[i * 4 + c]);
+		}
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		int inset = (high[c] - low[c]) / 16;
+		low[c] += inset;
+		high[c] -= inset;
+	}
+
+	uint16_t color0 = _packRgb565(high), color1 = _packRgb565(low);
+	uint32_t indices = 0;
+	if (color0 < color1)
+		std::swap(color0, color1);
+	if (color0 != color1)
+	{
+		int palette[4][3];
+		_unpackRgb565(color0, palette[0]);
+		_unpackRgb565(color1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestDistance = INT_MAX;
+			for (int p = 0; p < 4; p++)
+			{
+				int distance = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					int d = (int)pixels[i * 4 + c] - palette[p][c];
+					distance += d * d;
+				}
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices |= (uint32_t)best << (i * 2);
+		}
+	}
+	memcpy(out, &color0, 2);
+	memcpy(out + 2, &color1, 2);
+	memcpy(out + 4, &indices, 4);
+}
+
+// Alpha of 16 RGBA pixels into the 8 byte BC3 alpha block, in eight value mode
+static void _encodeAlphaBlock(const uint8_t* pixels, uint8_t* out)
+{
+	int low = 255, high = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		low = std::min(low, (int)pixels[i * 4 + 3]);
+		high = std::max(high, (int)pixels[i * 4 + 3]);
+	}
+	uint64_t bits = 0;
+	if (high != low)
+	{
+		int palette[8] = { high, low };
+		for (int p = 1; p < 7; p++)
+			palette[p + 1] = ((7 - p) * high + p * low) / 7;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestDistance = INT_MAX;
+			for (int p = 0; p < 8; p++)
+			{
+				int distance = std::abs((int)pixels[i * 4 + 3] - palette[p]);
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			bits |= (uint64_t)best << (i * 3);
+		}
+	}
+	out[0] = (uint8_t)high;
+	out[1] = (uint8_t)low;
+	for (int b = 0; b < 6; b++)
+		out[2 + b] = (uint8_t)(bits >> (b * 8));
+}
+
+// One RGBA8 level into BC1, or BC3 when withAlpha. Edge blocks repeat the last row and column.
+static void _encodeCompressedLevel(const uint8_t* rgba, GLsizei width, GLsizei height, bool withAlpha, vector<uint8_t>* out)
+{
+	const GLenum format = withAlpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	out->resize(_compressedLevelSize(format, width, height));
+	uint8_t* block = out->data();
+	uint8_t pixels[16 * 4];
+	for (GLsizei by = 0; by < height; by += 4)
+	{
+		for (GLsizei bx = 0; bx < width; bx += 4)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				GLsizei x = std::min(bx + (i & 3), width - 1), y = std::min(by + (i >> 2), height - 1);
+				memcpy(&pixels[i * 4], rgba + ((size_t)y * width + x) * 4, 4);
+			}
+			if (withAlpha)
+			{
+				_encodeAlphaBlock(pixels, block);
+				block += 8;
+			}
+			_encodeColorBlock(pixels, block);
+			block += 8;
+		}
+	}
+}
+
+// Writes already encoded levels as a legacy DXT1/DXT5 DDS, level 0 first
+static bool _writeCompressedDDS(const string& path, GLsizei width, GLsizei height, bool withAlpha, const vector<vector<uint8_t>>& levels)
+{
+	ofstream out(path.c_str(), ios::binary | ios::trunc);
+	if (!out)
+		return false;
+	uint32_t header[31] = {};
+	header[0] = 124;
+	// CAPS | HEIGHT | WIDTH | PIXELFORMAT | MIPMAPCOUNT | LINEARSIZE
+	header[1] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;
+	header[2] = (uint32_t)height;
+	header[3] = (uint32_t)width;
+	header[4] = levels.empty() ? 0 : (uint32_t)levels[0].size();
+	header[6] = (uint32_t)levels.size();
+	header[18] = 32;
+	header[19] = 0x4;
+	header[20] = withAlpha ? 0x35545844 : 0x31545844;
+	// TEXTURE | COMPLEX | MIPMAP
+	header[26] = 0x1000 | 0x8 | 0x400000;
+	out.write("DDS ", 4);
+	out.write((const char*)header, sizeof(header));
+	for (size_t i = 0; i < levels.size(); i++)
+		out.write((const char*)levels[i].data(), levels[i].size());
+	return (bool)out;
+}
@@ -0,0 +1,201 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <cstddef>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <emmintrin.h>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+
+// Axis aligned box, empty until something is added
+struct Aabb
+{
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	bool empty() const { return this->min.x > this->max.x; }
+
+	void add(const glm::vec3& point)
+	{
+		this->min = glm::min(this->min, point);
+		this->max = glm::max(this->max, point);
+	}
+};
+
+// The box under transform, as the centre and half extent of the axis aligned box around it (Arvo)
+static void _transformAabb(const Aabb& box, const glm::mat4& transform, glm::vec3* centre, glm::vec3* extent)
+{
+	const glm::vec3 localCentre = (box.min + box.max) * 0.5f;
+	const glm::vec3 localExtent = (box.max - box.min) * 0.5f;
+	const glm::vec4 c = transform * glm::vec4(localCentre, 1.0f);
+	*centre = glm::vec3(c.x, c.y, c.z);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		(*extent)[axis] = fabsf(transform[0][axis]) * localExtent.x + fabsf(transform[1][axis]) * localExtent.y
+			+ fabsf(transform[2][axis]) * localExtent.z;
+	}
+}
+
+// Left, right, bottom, top, near, far. xyz is the unit inward normal and w the offset, a point p is inside
+// a plane when dot(xyz, p) + w >= 0.
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+
+// Gribb and Hartmann: the planes of GL clip space (-w <= x, y, z <= w) in the space viewProjection maps from.
+// zeroToOne is for projections made for a 0 <= z <= w clip space (glClipControl's GL_ZERO_TO_ONE).
+static Frustum _frustumFromMatrix(const glm::mat4& viewProjection, bool zeroToOne = false)
+{
+	// glm is column major, so row i is the i-th component of every column
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	Frustum frustum;
+	for (int i = 0; i < 3; i++)
+	{
+		frustum.planes[i * 2] = rows[3] + rows[i];
+		frustum.planes[i * 2 + 1] = rows[3] - rows[i];
+	}
+	if (zeroToOne)
+		frustum.planes[4] = rows[2];
+	for (int i = 0; i < 6; i++)
+	{
+		glm::vec4& plane = frustum.planes[i];
+		plane /= glm::length(glm::vec3(plane.x, plane.y, plane.z));
+	}
+	return frustum;
+}
+
+// Both eyes, and one frustum holding the two that is tested first
+struct StereoFrustum
+{
+	Frustum eyes[2];
+	Frustum combined;
+};
+
+// The combined frustum takes the left eye's planes but the right eye's right side, each plane moved out just far
+// enough for the other eye's corners to be inside too. Eyes are close to parallel, so that is barely larger than
+// the union of the two. A mono view passes the same matrix twice and gets three copies of one frustum.
+static StereoFrustum _stereoFrustum(const glm::mat4& leftViewProjection, const glm::mat4& rightViewProjection, bool zeroToOne = false)
+{
+	StereoFrustum stereo;
+	stereo.eyes[0] = _frustumFromMatrix(leftViewProjection, zeroToOne);
+	stereo.eyes[1] = _frustumFromMatrix(rightViewProjection, zeroToOne);
+
+	glm::vec3 corners[2][8];
+	const glm::mat4 inverses[2] = { glm::inverse(leftViewProjection), glm::inverse(rightViewProjection) };
+	for (int eye = 0; eye < 2; eye++)
+	{
+		for (int corner = 0; corner < 8; corner++)
+		{
+			const glm::vec4 ndc((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : (zeroToOne ? 0.0f : -1.0f), 1.0f);
+			const glm::vec4 world = inverses[eye] * ndc;
+			corners[eye][corner] = glm::vec3(world.x, world.y, world.z) / world.w;
+		}
+	}
+	for (int i = 0; i < 6; i++)
+	{
+		const int base = i == 1 ? 1 : 0;
+		glm::vec4 plane = stereo.eyes[base].planes[i];
+		const glm::vec3 normal(plane.x, plane.y, plane.z);
+		for (int corner = 0; corner < 8; corner++)
+			plane.w = std::max(plane.w, -glm::dot(normal, corners[1 - base][corner]));
+		stereo.combined.planes[i] = plane;
+	}
+	return stereo;
+}
+
+// Lanes of four points that are within reach of every plane, reach being per lane and per plane
+static inline __m128 _frustumLanes(const Frustum& frustum, __m128 px, __m128 py, __m128 pz, const __m128 reach[6])
+{
+	__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	for (int i = 0; i < 6; i++)
+	{
+		const glm::vec4& plane = frustum.planes[i];
+		__m128 distance = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(plane.x)), _mm_mul_ps(py, _mm_set1_ps(plane.y)));
+		distance = _mm_add_ps(_mm_add_ps(distance, _mm_mul_ps(pz, _mm_set1_ps(plane.z))), _mm_set1_ps(plane.w));
+		inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach[i]), _mm_setzero_ps()));
+	}
+	return inside;
+}
+
+// Four lanes from each SoA array starting at i, the ones past n read as zero
+static inline __m128 _cullLoad(const float* values, size_t i, size_t n)
+{
+	if (i + 4 <= n)
+		return _mm_loadu_ps(values + i);
+	float padded[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (size_t lane = 0; i + lane < n; lane++)
+		padded[lane] = values[i + lane];
+	return _mm_loadu_ps(padded);
+}
+
+// Sets bit e of masks[i] when eye e of frustum sees the sphere at (x[i], y[i], z[i]) of radius r[i], four spheres
+// a step. Groups the combined frustum rejects entirely skip the per eye tests.
+static void _cullSpheres(const float* x, const float* y, const float* z, const float* r, size_t n, const StereoFrustum& frustum, uint8_t* masks)
+{
+	for (size_t i = 0; i < n; i += 4)
+	{
+		const __m128 px = _cullLoad(x, i, n), py = _cullLoad(y, i, n), pz = _cullLoad(z, i, n);
+		const __m128 radius = _cullLoad(r, i, n);
+		const __m128 reach[6] = { radius, radius, radius, radius, radius, radius };
+		int eyeMasks[2] = { 0, 0 };
+		if (_mm_movemask_ps(_frustumLanes(frustum.combined, px, py, pz, reach)))
+		{
+			for (int eye = 0; eye < 2; eye++)
+				eyeMasks[eye] = _mm_movemask_ps(_frustumLanes(frustum.eyes[eye], px, py, pz, reach));
+		}
+		for (size_t lane = 0; lane < 4 && i + lane < n; lane++)
+			masks[i + lane] = (uint8_t)(((eyeMasks[0] >> lane) & 1) | (((eyeMasks[1] >> lane) & 1) << 1));
+	}
+}
+
+// As _cullSpheres for boxes given by centre (cx, cy, cz) and half extent (ex, ey, ez). A box reaches
+// |normal| . extent towards each plane.
+static void _cullBoxes(const float* cx, const float* cy, const float* cz, const float* ex, const float* ey, const float* ez, size_t n,
+	const StereoFrustum& frustum, uint8_t* masks)
+{
+	for (size_t i = 0; i < n; i += 4)
+	{
+		const __m128 px = _cullLoad(cx, i, n), py = _cullLoad(cy, i, n), pz = _cullLoad(cz, i, n);
+		const __m128 extentX = _cullLoad(ex, i, n), extentY = _cullLoad(ey, i, n), extentZ = _cullLoad(ez, i, n);
+		int eyeMasks[2] = { 0, 0 };
+		for (int f = -1; f < 2; f++)
+		{
+			const Frustum& tested = f < 0 ? frustum.combined : frustum.eyes[f];
+			__m128 reach[6];
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4& plane = tested.planes[p];
+				reach[p] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(extentX, _mm_set1_ps(fabsf(plane.x))), _mm_mul_ps(extentY, _mm_set1_ps(fabsf(plane.y)))),
+					_mm_mul_ps(extentZ, _mm_set1_ps(fabsf(plane.z))));
+			}
+			const int lanes = _mm_movemask_ps(_frustumLanes(tested, px, py, pz, reach));
+			if (f < 0 && !lanes)
+				break;
+			if (f >= 0)
+				eyeMasks[f] = lanes;
+		}
+		for (size_t lane = 0; lane < 4 && i + lane < n; lane++)
+			masks[i + lane] = (uint8_t)(((eyeMasks[0] >> lane) & 1) | (((eyeMasks[1] >> lane) & 1) << 1));
+	}
+}
+
+// What culling dropped this frame, summed over the frame's scene passes, for the profiler
+struct CullStats
+{
+	uint32_t meshes = 0;
+	uint32_t instances = 0;
+
+	void beginFrame()
+	{
+		this->meshes = 0;
+		this->instances = 0;
+	}
+};
+
+static CullStats _cullStats;
@@ -0,0 +1,184 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstring>
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "glstate.h"
+#include "glcapture.h"
+
+// Frames of vertex data in flight, the persistent buffer is split into this many regions
+#define DEBUG_DRAW_FRAMES 3
+
+// Immediate mode debug primitives. Anything can add world space lines during the frame; each eye
+// then draws all of them with one flush(), and endFrame() starts over.
+//
+// With ARB_buffer_storage the vertices are written straight into a persistently mapped ring with
+// one region per frame in flight, guarded by fences. Without it the buffer is orphaned every frame.
+class DebugDraw
+{
+public:
+	DebugDraw() {}
+
+	DebugDraw(const DebugDraw&) = delete;
+	DebugDraw& operator=(const DebugDraw&) = delete;
+
+	// program must have a worldViewProj uniform and take position/color at locations 0/1
+	void init(GLuint program, size_t maxVertices = 8192)
+	{
+		this->program = program;
+		this->worldViewProjLocation = glGetUniformLocation(program, "worldViewProj");
+		this->capacity = maxVertices;
+		this->vertices.reserve(maxVertices);
+
+		glGenVertexArrays(1, &this->vertexArray);
+		glGenBuffers(1, &this->vertexBuffer);
+		glBindVertexArray(this->vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertexBuffer);
+		if (GLEW_ARB_buffer_storage)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			const GLsizeiptr size = (GLsizeiptr)(sizeof(Vertex) * this->capacity * DEBUG_DRAW_FRAMES);
+			glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+			this->mapped = (Vertex*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+		}
+
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)sizeof(glm::vec3));
+		glEnableVertexAttribArray(1);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void line(const glm::vec3& a, const glm::vec3& b, const glm::vec4& aColor, const glm::vec4& bColor)
+	{
+		if (this->vertices.size() + 2 > this->capacity)
+		{
+			if (!this->reported)
+				std::cout << "ERROR::DEBUG_DRAW::VERTEX_CAPACITY_EXCEEDED" << std::endl;
+			this->reported = true;
+			return;
+		}
+		Vertex va = { a, aColor };
+		Vertex vb = { b, bColor };
+		this->vertices.push_back(va);
+		this->vertices.push_back(vb);
+	}
+
+	void line(const glm::vec3& a, const glm::vec3& b, const glm::vec4& color)
+	{
+		this->line(a, b, color, color);
+	}
+
+	// Three axis aligned segments through center, for hit markers
+	void cross(const glm::vec3& center, float size, const glm::vec4& color)
+	{
+		const float h = size * 0.5f;
+		this->line(center - glm::vec3(h, 0, 0), center + glm::vec3(h, 0, 0), color);
+		this->line(center - glm::vec3(0, h, 0), center + glm::vec3(0, h, 0), color);
+		this->line(center - glm::vec3(0, 0, h), center + glm::vec3(0, 0, h), color);
+	}
+
+	// The twelve edges of an axis aligned box
+	void box(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4& color)
+	{
+		// Corner i takes max on axis k when bit k of i is set
+		glm::vec3 corners[8];
+		for (int i = 0; i < 8; i++)
+			corners[i] = glm::vec3((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+		// Every edge joins two corners that differ in exactly one bit
+		for (int i = 0; i < 8; i++)
+		{
+			for (int bit = 1; bit < 8; bit <<= 1)
+			{
+				if (!(i & bit))
+					this->line(corners[i], corners[i | bit], color);
+			}
+		}
+	}
+
+	// Draws everything added so far this frame in one call. The vertices are uploaded on the first flush.
+	void flush(const glm::mat4& viewProj)
+	{
+		if (this->vertices.empty() || !this->vertexArray)
+			return;
+		if (!this->uploaded)
+			this->upload();
+
+		_glState.useProgram(this->program);
+		glUniformMatrix4fv(this->worldViewProjLocation, 1, 0, glm::value_ptr(viewProj));
+		_glState.bindVertexArray(this->vertexArray);
+		_glState.depthFunc(GL_LEQUAL);
+		glLineWidth(25);
+		glDrawArrays(GL_LINES, this->first, (GLsizei)this->vertices.size());
+		_glCapture.drawArrays(GL_LINES, this->first, (GLsizei)this->vertices.size());
+		_renderStats.draw(GL_LINES, (GLsizei)this->vertices.size());
+	}
+
+	// Call once after the last flush of the frame
+	void endFrame()
+	{
+		if (this->uploaded && this->mapped)
+		{
+			this->fences[this->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			this->region = (this->region + 1) % DEBUG_DRAW_FRAMES;
+		}
+		this->vertices.clear();
+		this->uploaded = false;
+	}
+
+private:
+	struct Vertex
+	{
+		glm::vec3 p;
+		glm::vec4 c;
+	};
+
+	GLuint program = 0;
+	GLint worldViewProjLocation = -1;
+	GLuint vertexArray = 0;
+	GLuint vertexBuffer = 0;
+	size_t capacity = 0;
+	vector<Vertex> vertices;
+	bool uploaded = false;
+	bool reported = false;
+
+	// Persistent ring, null when falling back to orphaning
+	Vertex* mapped = nullptr;
+	GLsync fences[DEBUG_DRAW_FRAMES] = {};
+	int region = 0;
+	GLint first = 0;
+
+	void upload()
+	{
+		const size_t bytes = sizeof(Vertex) * this->vertices.size();
+		if (this->mapped)
+		{
+			// Only waits if the GPU is still reading this region from DEBUG_DRAW_FRAMES frames ago
+			GLsync& fence = this->fences[this->region];
+			if (fence)
+			{
+				glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+				glDeleteSync(fence);
+				fence = 0;
+			}
+			this->first = (GLint)(this->region * this->capacity);
+			memcpy(this->mapped + this->first, this->vertices.data(), bytes);
+		}
+		else
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, this->vertexBuffer);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * this->capacity, NULL, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, this->vertices.data());
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			this->first = 0;
+		}
+		_renderStats.uploaded(bytes);
+		this->uploaded = true;
+	}
+};
@@ -0,0 +1,425 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <memory>
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "jobs.h"
+#include "culling.h"
+#include "picking.h"
+#include "molecules.h"
+#include "scenegraph.h"
+
+// Entities of one archetype per chunk, small enough that a chunk's components stay in cache while a system walks
+// them and big enough that handing chunks out to the job system is worth it
+#define ENTITY_CHUNK_SIZE 256
+
+/*  Components  */
+// position, rotation and scale are what systems move, world is the matrix the draws use
+struct TransformComponent
+{
+	glm::vec3 position;
+	glm::quat rotation;
+	glm::vec3 scale;
+	glm::mat4 world;
+};
+
+// model indexes the scene's own model table, radius bounds it around the transform's position for culling
+struct RenderableComponent
+{
+	uint32_t model = 0;
+	float radius = 0.0f;
+	// As of the last _cullEntities
+	bool visible = true;
+};
+
+// Movement per step, like MoleculeStore's
+struct VelocityComponent
+{
+	glm::vec3 value;
+};
+
+// Rotation every step applies, a unit quaternion
+struct SpinComponent
+{
+	glm::quat value;
+};
+
+// Hit by the rays of the last _pickEntities, bit r for ray r
+struct PickableComponent
+{
+	float radius = 0.0f;
+	uint8_t hits = 0;
+};
+
+struct MoleculeTypeComponent
+{
+	MoleculeType value = MoleculeType::CO2;
+};
+
+// Placed by a TransformHierarchy node instead of its own position, rotation and scale
+struct SceneNodeComponent
+{
+	uint32_t node = 0;
+};
+
+// An archetype is the set of components its entities have, one bit each
+static const uint32_t COMPONENT_TRANSFORM = 1u << 0;
+static const uint32_t COMPONENT_RENDERABLE = 1u << 1;
+static const uint32_t COMPONENT_VELOCITY = 1u << 2;
+static const uint32_t COMPONENT_SPIN = 1u << 3;
+static const uint32_t COMPONENT_PICKABLE = 1u << 4;
+static const uint32_t COMPONENT_MOLECULE_TYPE = 1u << 5;
+static const uint32_t COMPONENT_SCENE_NODE = 1u << 6;
+
+// The same generational scheme as MoleculeHandle: index into the world's entity table, and the generation that
+// entry has to still be at
+struct Entity
+{
+	uint32_t index;
+	uint32_t generation;
+};
+
+static const Entity ENTITY_NONE = { 0, 0 };
+
+// ENTITY_CHUNK_SIZE entities of one archetype, each component in an array of its own. Only the arrays of the
+// archetype's components are allocated.
+struct EntityChunk
+{
+	uint32_t mask = 0;
+	uint32_t count = 0;
+	Entity entities[ENTITY_CHUNK_SIZE];
+	unique_ptr<TransformComponent[]> transforms;
+	unique_ptr<RenderableComponent[]> renderables;
+	unique_ptr<VelocityComponent[]> velocities;
+	unique_ptr<SpinComponent[]> spins;
+	unique_ptr<PickableComponent[]> pickables;
+	unique_ptr<MoleculeTypeComponent[]> moleculeTypes;
+	unique_ptr<SceneNodeComponent[]> sceneNodes;
+
+	explicit EntityChunk(uint32_t mask) : mask(mask)
+	{
+		if (mask & COMPONENT_TRANSFORM)
+			this->transforms.reset(new TransformComponent[ENTITY_CHUNK_SIZE]);
+		if (mask & COMPONENT_RENDERABLE)
+			this->renderables.reset(new RenderableComponent[ENTITY_CHUNK_SIZE]);
+		if (mask & COMPONENT_VELOCITY)
+			this->velocities.reset(new VelocityComponent[ENTITY_CHUNK_SIZE]);
+		if (mask & COMPONENT_SPIN)
+			this->spins.reset(new SpinComponent[ENTITY_CHUNK_SIZE]);
+		if (mask & COMPONENT_PICKABLE)
+			this->pickables.reset(new PickableComponent[ENTITY_CHUNK_SIZE]);
+		if (mask & COMPONENT_MOLECULE_TYPE)
+			this->moleculeTypes.reset(new MoleculeTypeComponent[ENTITY_CHUNK_SIZE]);
+		if (mask & COMPONENT_SCENE_NODE)
+			this->sceneNodes.reset(new SceneNodeComponent[ENTITY_CHUNK_SIZE]);
+	}
+
+	// Row to's components become row from's, the entity included
+	void copyRow(uint32_t from, EntityChunk& source, uint32_t to)
+	{
+		this->entities[to] = source.entities[from];
+		if (this->transforms)
+			this->transforms[to] = source.transforms[from];
+		if (this->renderables)
+			this->renderables[to] = source.renderables[from];
+		if (this->velocities)
+			this->velocities[to] = source.velocities[from];
+		if (this->spins)
+			this->spins[to] = source.spins[from];
+		if (this->pickables)
+			this->pickables[to] = source.pickables[from];
+		if (this->moleculeTypes)
+			this->moleculeTypes[to] = source.moleculeTypes[from];
+		if (this->sceneNodes)
+			this->sceneNodes[to] = source.sceneNodes[from];
+	}
+};
+
+// Which of EntityChunk's arrays holds T
+template <typename T> struct ComponentTraits;
+template <> struct ComponentTraits<TransformComponent>
+{
+	static TransformComponent* array(EntityChunk& chunk) { return chunk.transforms.get(); }
+};
+template <> struct ComponentTraits<RenderableComponent>
+{
+	static RenderableComponent* array(EntityChunk& chunk) { return chunk.renderables.get(); }
+};
+template <> struct ComponentTraits<VelocityComponent>
+{
+	static VelocityComponent* array(EntityChunk& chunk) { return chunk.velocities.get(); }
+};
+template <> struct ComponentTraits<SpinComponent>
+{
+	static SpinComponent* array(EntityChunk& chunk) { return chunk.spins.get(); }
+};
+template <> struct ComponentTraits<PickableComponent>
+{
+	static PickableComponent* array(EntityChunk& chunk) { return chunk.pickables.get(); }
+};
+template <> struct ComponentTraits<MoleculeTypeComponent>
+{
+	static MoleculeTypeComponent* array(EntityChunk& chunk) { return chunk.moleculeTypes.get(); }
+};
+template <> struct ComponentTraits<SceneNodeComponent>
+{
+	static SceneNodeComponent* array(EntityChunk& chunk) { return chunk.sceneNodes.get(); }
+};
+
+// A scene's entities, sorted by archetype into chunks. Every archetype's chunks are kept full but for the last:
+// destroy() moves the archetype's last entity into the hole, so a system walking an archetype touches only live
+// rows, each component array front to back. Systems pick chunks by the components they need and run them in
+// parallel through forEachChunk(), a chunk per job.
+//
+// An entity's components are fixed when it's created, there is no adding or removing them later.
+class EntityWorld
+{
+public:
+	EntityWorld() {}
+
+	EntityWorld(const EntityWorld&) = delete;
+	EntityWorld& operator=(const EntityWorld&) = delete;
+
+	size_t size() const { return this->live; }
+
+	// With every component of mask default initialized, get<T>() to fill them in
+	Entity create(uint32_t mask)
+	{
+		Archetype& archetype = this->archetypeOf(mask);
+		if (archetype.chunks.empty() || archetype.chunks.back()->count == ENTITY_CHUNK_SIZE)
+			archetype.chunks.emplace_back(new EntityChunk(mask));
+		EntityChunk& chunk = *archetype.chunks.back();
+
+		uint32_t index;
+		if (this->freeRecords.empty())
+		{
+			index = (uint32_t)this->records.size();
+			this->records.push_back(Record());
+			this->records.back().generation = 1;
+		}
+		else
+		{
+			index = this->freeRecords.back();
+			this->freeRecords.pop_back();
+		}
+		Record& record = this->records[index];
+		record.archetype = (uint32_t)(&archetype - this->archetypes.data());
+		record.chunk = (uint32_t)archetype.chunks.size() - 1;
+		record.row = chunk.count++;
+		const Entity entity = { index, record.generation };
+		chunk.entities[record.row] = entity;
+		this->live++;
+		return entity;
+	}
+
+	bool alive(const Entity& entity) const
+	{
+		return entity.index < this->records.size() && this->records[entity.index].generation == entity.generation;
+	}
+
+	void destroy(const Entity& entity)
+	{
+		if (!this->alive(entity))
+			return;
+		Record& record = this->records[entity.index];
+		Archetype& archetype = this->archetypes[record.archetype];
+		EntityChunk& chunk = *archetype.chunks[record.chunk];
+		EntityChunk& last = *archetype.chunks.back();
+		const uint32_t lastRow = last.count - 1;
+		if (&last != &chunk || lastRow != record.row)
+		{
+			chunk.copyRow(lastRow, last, record.row);
+			Record& moved = this->records[chunk.entities[record.row].index];
+			moved.chunk = record.chunk;
+			moved.row = record.row;
+		}
+		// Emptied chunks stay for the next create(), only the count moves
+		if (--last.count == 0 && archetype.chunks.size() > 1)
+			archetype.chunks.pop_back();
+		record.generation++;
+		this->freeRecords.push_back(entity.index);
+		this->live--;
+	}
+
+	// The entity's T, nullptr once it's gone or if its archetype has no T
+	template <typename T>
+	T* get(const Entity& entity)
+	{
+		if (!this->alive(entity))
+			return nullptr;
+		const Record& record = this->records[entity.index];
+		EntityChunk& chunk = *this->archetypes[record.archetype].chunks[record.chunk];
+		T* values = ComponentTraits<T>::array(chunk);
+		return values ? values + record.row : nullptr;
+	}
+
+	// body(chunk) for every chunk holding all of mask and none of exclude, on this thread
+	template <typename Body>
+	void forEachChunk(uint32_t mask, uint32_t exclude, Body body)
+	{
+		for (Archetype& archetype : this->archetypes)
+		{
+			if ((archetype.mask & mask) != mask || (archetype.mask & exclude))
+				continue;
+			for (unique_ptr<EntityChunk>& chunk : archetype.chunks)
+			{
+				if (chunk->count)
+					body(*chunk);
+			}
+		}
+	}
+
+	// The same a chunk per job. Chunks are disjoint, so body may write any of its own chunk's components, but
+	// mustn't create or destroy entities.
+	template <typename Body>
+	void forEachChunk(JobSystem& jobs, uint32_t mask, uint32_t exclude, Body body)
+	{
+		this->matching.clear();
+		this->forEachChunk(mask, exclude, [this](EntityChunk& chunk) { this->matching.push_back(&chunk); });
+		jobs.parallelFor(this->matching.size(), 1, [&](size_t begin, size_t end) {
+			for (size_t c = begin; c < end; c++)
+				body(*this->matching[c]);
+		});
+	}
+
+	template <typename Body>
+	void forEachChunk(JobSystem& jobs, uint32_t mask, Body body)
+	{
+		this->forEachChunk(jobs, mask, 0, body);
+	}
+
+private:
+	struct Archetype
+	{
+		uint32_t mask;
+		vector<unique_ptr<EntityChunk>> chunks;
+	};
+
+	struct Record
+	{
+		uint32_t archetype = 0;
+		uint32_t chunk = 0;
+		uint32_t row = 0;
+		uint32_t generation = 0;
+	};
+
+	// A scene has a handful of archetypes, a linear search finds them fastest
+	Archetype& archetypeOf(uint32_t mask)
+	{
+		for (Archetype& archetype : this->archetypes)
+		{
+			if (archetype.mask == mask)
+				return archetype;
+		}
+		this->archetypes.push_back(Archetype());
+		this->archetypes.back().mask = mask;
+		return this->archetypes.back();
+	}
+
+	vector<Archetype> archetypes;
+	vector<Record> records;
+	vector<uint32_t> freeRecords;
+	vector<EntityChunk*> matching;
+	size_t live = 0;
+};
+
+/*  Systems  */
+
+// One step for everything that moves: position by velocity, rotation by spin, then the world matrix
+static void _integrateEntities(EntityWorld& world, JobSystem& jobs)
+{
+	world.forEachChunk(jobs, COMPONENT_TRANSFORM | COMPONENT_VELOCITY, COMPONENT_SCENE_NODE, [](EntityChunk& chunk) {
+		for (uint32_t i = 0; i < chunk.count; i++)
+			chunk.transforms[i].position += chunk.velocities[i].value;
+		if (chunk.spins)
+		{
+			for (uint32_t i = 0; i < chunk.count; i++)
+				chunk.transforms[i].rotation = glm::normalize(chunk.spins[i].value * chunk.transforms[i].rotation);
+		}
+		for (uint32_t i = 0; i < chunk.count; i++)
+		{
+			TransformComponent& transform = chunk.transforms[i];
+			transform.world = _composeTransform(transform.position, transform.rotation, transform.scale);
+		}
+	});
+}
+
+// The world matrices of the entities a hierarchy places, after its update()
+static void _placeSceneNodes(EntityWorld& world, JobSystem& jobs, const TransformHierarchy& hierarchy)
+{
+	world.forEachChunk(jobs, COMPONENT_TRANSFORM | COMPONENT_SCENE_NODE, [&hierarchy](EntityChunk& chunk) {
+		for (uint32_t i = 0; i < chunk.count; i++)
+		{
+			TransformComponent& transform = chunk.transforms[i];
+			transform.world = hierarchy.world(chunk.sceneNodes[i].node);
+			transform.position = glm::vec3(transform.world[3]);
+		}
+	});
+}
+
+// Sets the hits of every pickable entity against rayCount rays, up to 8
+static void _pickEntities(EntityWorld& world, JobSystem& jobs, const PickRay* rays, int rayCount)
+{
+	world.forEachChunk(jobs, COMPONENT_TRANSFORM | COMPONENT_PICKABLE, [rays, rayCount](EntityChunk& chunk) {
+		for (uint32_t i = 0; i < chunk.count; i++)
+		{
+			PickableComponent& pickable = chunk.pickables[i];
+			pickable.hits = 0;
+			for (int r = 0; r < rayCount; r++)
+			{
+				if (_rayDistanceSquared(rays[r], chunk.transforms[i].position) <= pickable.radius * pickable.radius)
+					pickable.hits |= (uint8_t)(1 << r);
+			}
+		}
+	});
+}
+
+// Sets visible for every renderable whose bounding sphere reaches into either eye's frustum
+static void _cullEntities(EntityWorld& world, JobSystem& jobs, const StereoFrustum& frustum)
+{
+	world.forEachChunk(jobs, COMPONENT_TRANSFORM | COMPONENT_RENDERABLE, [&frustum](EntityChunk& chunk) {
+		for (uint32_t i = 0; i < chunk.count; i++)
+		{
+			const glm::vec4 centre(chunk.transforms[i].position, 1.0f);
+			const float radius = chunk.renderables[i].radius;
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; p++)
+				inside = glm::dot(frustum.combined.planes[p], centre) >= -radius;
+			chunk.renderables[i].visible = inside;
+		}
+	});
+}
+
+// One model's share of a draw list
+struct EntityDraws
+{
+	vector<glm::mat4> transforms;
+	vector<Entity> entities;
+};
+
+// The visible renderables' world matrices by model, draws[m] for model m. Runs on the calling thread: appending
+// is all it does, and the lists keep their capacity from one frame to the next.
+static void _buildDrawList(EntityWorld& world, vector<EntityDraws>& draws)
+{
+	for (EntityDraws& model : draws)
+	{
+		model.transforms.clear();
+		model.entities.clear();
+	}
+	world.forEachChunk(COMPONENT_TRANSFORM | COMPONENT_RENDERABLE, 0, [&draws](EntityChunk& chunk) {
+		for (uint32_t i = 0; i < chunk.count; i++)
+		{
+			const RenderableComponent& renderable = chunk.renderables[i];
+			if (!renderable.visible)
+				continue;
+			if (renderable.model >= draws.size())
+				draws.resize(renderable.model + 1);
+			draws[renderable.model].transforms.push_back(chunk.transforms[i].world);
+			draws[renderable.model].entities.push_back(chunk.entities[i]);
+		}
+	});
+}
@@ -0,0 +1,204 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include <OVR_CAPI_GL.h>
+#include "benchhmd.h"
+#include "gpumemory.h"
+#include "gldebug.h"
+#include "glcapture.h"
+
+// The least rate the environment is rendered at, the compositor reprojects it on the frames between. Refresh rates
+// at least twice it render every other frame, lower ones every frame.
+#define ENVIRONMENT_LAYER_MIN_HZ 45.0f
+
+// ovrLayerType_EyeFovDepth is newer than the SDK in Include/LibOVR. The layer is declared here as the runtime lays it
+// out: the eye layer followed by a depth swap chain and the projection it was rendered with, which is what the
+// compositor reprojects it by position as well as orientation with.
+#define ENVIRONMENT_LAYER_TYPE_EYE_FOV_DEPTH 2
+
+struct OVR_ALIGNAS(OVR_PTR_SIZE) EnvironmentLayerEyeFovDepth
+{
+	ovrLayerHeader Header;
+	ovrTextureSwapChain ColorTexture[ovrEye_Count];
+	ovrRecti Viewport[ovrEye_Count];
+	ovrFovPort Fov[ovrEye_Count];
+	ovrPosef RenderPose[ovrEye_Count];
+	double SensorSampleTime;
+	ovrTextureSwapChain DepthTexture[ovrEye_Count];
+	ovrTimewarpProjectionDesc ProjectionDesc;
+};
+
+// Split rate rendering: the scene's static environment in an eye layer of its own under the scene layer, rendered
+// every interval() frames. The frames between submit it as it was with the poses it was rendered
+// at, and the compositor reprojects it to the new ones; the scene layer then only has the moving content, cleared
+// transparent around it.
+//
+// Its swap chains are laid out like the eye texture, both eyes side by side in one, and it takes the scene layer's
+// FOVs and viewports, the dynamic resolution's included, each time it renders. The depth goes into a swap chain of its
+// own where the runtime takes one; a runtime that turns the depth layer down gets the plain eye layer instead.
+class EnvironmentLayer
+{
+public:
+	EnvironmentLayer()
+	{
+		memset(&this->layer, 0, sizeof(EnvironmentLayerEyeFovDepth));
+	}
+
+	EnvironmentLayer(const EnvironmentLayer&) = delete;
+	EnvironmentLayer& operator=(const EnvironmentLayer&) = delete;
+
+	// size and colorFormat are the eye texture's, sceneLayer the eye layer as set up; projection what the eyes are
+	// rendered with, for the compositor to undo the depth with. False and never submitted if the color swap chain
+	// couldn't be made.
+	bool init(ovrSession session, const glm::uvec2& size, const ovrLayerEyeFov& sceneLayer, ovrTextureFormat colorFormat, GLenum depthFormat,
+		const ovrTimewarpProjectionDesc& projection)
+	{
+		ovrTextureSwapChainDesc desc = {};
+		desc.Type = ovrTexture_2D;
+		desc.ArraySize = 1;
+		desc.Width = size.x;
+		desc.Height = size.y;
+		desc.MipLevels = 1;
+		desc.Format = colorFormat;
+		desc.SampleCount = 1;
+		desc.StaticImage = ovrFalse;
+		if (!OVR_SUCCESS(_hmdCreateTextureSwapChainGL(session, &desc, &this->color)))
+		{
+			std::cout << "ERROR::ENVIRONMENT::SWAP_CHAIN_NOT_CREATED" << std::endl;
+			this->color = nullptr;
+			return false;
+		}
+		desc.Format = OVR_FORMAT_D32_FLOAT;
+		if (!OVR_SUCCESS(_hmdCreateTextureSwapChainGL(session, &desc, &this->depth)))
+		{
+			std::cout << "ERROR::ENVIRONMENT::DEPTH_SWAP_CHAIN_NOT_CREATED, reprojected by orientation only" << std::endl;
+			this->depth = nullptr;
+		}
+
+		glGenFramebuffers(1, &this->fbo);
+		_glLabel(GL_FRAMEBUFFER, this->fbo, "environment target");
+		if (!this->depth)
+		{
+			glGenRenderbuffers(1, &this->depthBuffer);
+			glBindRenderbuffer(GL_RENDERBUFFER, this->depthBuffer);
+			_glLabel(GL_RENDERBUFFER, this->depthBuffer, "environment depth");
+			glRenderbufferStorage(GL_RENDERBUFFER, depthFormat, size.x, size.y);
+			glBindRenderbuffer(GL_RENDERBUFFER, 0);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->fbo);
+			glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depthBuffer);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+			_gpuMemory.charge(GpuMemoryCategory::EyeTargets, _gpuImageBytes(depthFormat, size.x, size.y));
+		}
+
+		this->size = size;
+		this->layer.Header.Type = this->depth ? (ovrLayerType)ENVIRONMENT_LAYER_TYPE_EYE_FOV_DEPTH : ovrLayerType_EyeFov;
+		this->layer.Header.Flags = sceneLayer.Header.Flags;
+		for (int eye = 0; eye < ovrEye_Count; eye++)
+		{
+			this->layer.Fov[eye] = sceneLayer.Fov[eye];
+			this->layer.Viewport[eye] = sceneLayer.Viewport[eye];
+		}
+		this->layer.ColorTexture[0] = this->color;
+		this->layer.DepthTexture[0] = this->depth;
+		this->layer.ProjectionDesc = projection;
+		return true;
+	}
+
+	bool initialized() const { return this->color != nullptr; }
+
+	// A submit with the depth layer failed: from now on it goes as the plain eye layer, without the depth
+	void dropDepth()
+	{
+		if (this->layer.Header.Type != (ovrLayerType)ENVIRONMENT_LAYER_TYPE_EYE_FOV_DEPTH)
+			return;
+		std::cout << "ERROR::ENVIRONMENT::DEPTH_LAYER_REJECTED, reprojected by orientation only" << std::endl;
+		this->layer.Header.Type = ovrLayerType_EyeFov;
+	}
+	bool hasDepth() const { return this->layer.Header.Type == (ovrLayerType)ENVIRONMENT_LAYER_TYPE_EYE_FOV_DEPTH; }
+
+	// The display's refresh rate, which the interval follows
+	void setRefreshRate(float hz)
+	{
+		this->renderInterval = std::max((int)(hz / ENVIRONMENT_LAYER_MIN_HZ), 1);
+	}
+	int interval() const { return this->renderInterval; }
+
+	// Whether frame renders the environment again, the first one always does
+	bool due(uint64_t frame) const
+	{
+		return !this->committed || frame - this->renderedFrame >= (uint64_t)this->renderInterval;
+	}
+
+	// Renders the environment for sceneLayer's viewports at eyePoses: the swap chains' next buffers are bound and
+	// cleared to clearColor, and draw(eye) is called with each eye's viewport set. Both are committed after.
+	template <typename DrawFn>
+	void redraw(ovrSession session, uint64_t frame, const ovrLayerEyeFov& sceneLayer, const ovrPosef eyePoses[2], const GLfloat clearColor[4], DrawFn draw)
+	{
+		if (!this->color)
+			return;
+		int curIndex;
+		GLuint curTexId;
+		_hmdGetTextureSwapChainCurrentIndex(session, this->color, &curIndex);
+		_hmdGetTextureSwapChainBufferGL(session, this->color, curIndex, &curTexId);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->fbo);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curTexId, 0);
+		if (this->depth)
+		{
+			_hmdGetTextureSwapChainCurrentIndex(session, this->depth, &curIndex);
+			_hmdGetTextureSwapChainBufferGL(session, this->depth, curIndex, &curTexId);
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, curTexId, 0);
+		}
+
+		GLfloat previousColor[4];
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, previousColor);
+		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+		glViewport(0, 0, this->size.x, this->size.y);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		_glCapture.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glClearColor(previousColor[0], previousColor[1], previousColor[2], previousColor[3]);
+
+		for (int eye = 0; eye < ovrEye_Count; eye++)
+		{
+			const ovrRecti& vp = this->layer.Viewport[eye] = sceneLayer.Viewport[eye];
+			this->layer.RenderPose[eye] = eyePoses[eye];
+			glViewport(vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h);
+			draw((ovrEyeType)eye);
+		}
+		this->layer.SensorSampleTime = sceneLayer.SensorSampleTime;
+
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+		if (this->depth)
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+		_hmdCommitTextureSwapChain(session, this->color);
+		if (this->depth)
+			_hmdCommitTextureSwapChain(session, this->depth);
+		this->renderedFrame = frame;
+		this->committed = true;
+	}
+
+	// Nothing is submitted before the first commit, a swap chain without one isn't a valid layer
+	bool submittable() const { return this->committed; }
+	ovrLayerHeader* header() { return &this->layer.Header; }
+
+private:
+	ovrTextureSwapChain color = nullptr;
+	ovrTextureSwapChain depth = nullptr;
+	GLuint fbo = 0;
+	GLuint depthBuffer = 0;
+	EnvironmentLayerEyeFovDepth layer;
+	glm::uvec2 size = glm::uvec2(0);
+	uint64_t renderedFrame = 0;
+	int renderInterval = 2;
+	bool committed = false;
+};
+
+static EnvironmentLayer _environmentLayer;
@@ -0,0 +1,123 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+using namespace std;
+
+// Open addressing hash map with linear probing for small, trivially copyable keys and values.
+// Entries sit in one flat array, so a lookup is a hash and usually a single cache line.
+// There is no erase: the maps this is used for only grow until they are cleared.
+template <typename Key, typename Value>
+class FlatHashMap
+{
+public:
+	FlatHashMap() {}
+
+	size_t size() const { return this->count; }
+	bool empty() const { return this->count == 0; }
+
+	void clear()
+	{
+		this->slots.clear();
+		this->count = 0;
+	}
+
+	// Pointer to the value stored for key, nullptr if there is none. Never inserts.
+	Value* find(const Key& key)
+	{
+		if (this->slots.empty())
+			return nullptr;
+		const size_t mask = this->slots.size() - 1;
+		for (size_t i = _hash(key) & mask;; i = (i + 1) & mask)
+		{
+			Slot& slot = this->slots[i];
+			if (!slot.used)
+				return nullptr;
+			if (slot.key == key)
+				return &slot.value;
+		}
+	}
+
+	const Value* find(const Key& key) const
+	{
+		return const_cast<FlatHashMap*>(this)->find(key);
+	}
+
+	// Value for key, default constructed if the key is new. *inserted tells which one it was.
+	Value& insert(const Key& key, bool* inserted = nullptr)
+	{
+		// Keep the load factor under 0.5 so probe sequences stay short
+		if ((this->count + 1) * 2 > this->slots.size())
+			this->rehash(this->slots.empty() ? 16 : this->slots.size() * 2);
+
+		const size_t mask = this->slots.size() - 1;
+		for (size_t i = _hash(key) & mask;; i = (i + 1) & mask)
+		{
+			Slot& slot = this->slots[i];
+			if (slot.used && slot.key == key)
+			{
+				if (inserted)
+					*inserted = false;
+				return slot.value;
+			}
+			if (!slot.used)
+			{
+				slot.used = true;
+				slot.key = key;
+				slot.value = Value();
+				this->count++;
+				if (inserted)
+					*inserted = true;
+				return slot.value;
+			}
+		}
+	}
+
+	// Calls visit(key, value) for every entry, in no particular order
+	template <typename Visitor>
+	void forEach(Visitor visit)
+	{
+		for (size_t i = 0; i < this->slots.size(); i++)
+		{
+			if (this->slots[i].used)
+				visit(this->slots[i].key, this->slots[i].value);
+		}
+	}
+
+private:
+	struct Slot
+	{
+		Key key;
+		Value value;
+		bool used = false;
+	};
+
+	vector<Slot> slots;
+	size_t count = 0;
+
+	// 64 bit finalizer from MurmurHash3, asset ids are already random but small integer keys are not
+	static size_t _hash(const Key& key)
+	{
+		uint64_t h = (uint64_t)key;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return (size_t)h;
+	}
+
+	void rehash(size_t capacity)
+	{
+		vector<Slot> old;
+		old.swap(this->slots);
+		this->slots.resize(capacity);
+		this->count = 0;
+		for (size_t i = 0; i < old.size(); i++)
+		{
+			if (old[i].used)
+				this->insert(old[i].key) = old[i].value;
+		}
+	}
+};
@@ -0,0 +1,705 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+using namespace std;
+// Windows Includes
+#include <winsock2.h>
+#include <ws2tcpip.h>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include "json.h"
+#include "mappedfile.h"
+#include "threading.h"
+#include "trace.h"
+
+// Histogram layout, which every summary states and only summaries of the same layout merge: values are counted in
+// units of FLEET_HISTOGRAM_UNIT_MS, exactly below 2^SUB_BITS units, and above that each power of two is split into
+// 2^(SUB_BITS - 1) buckets, so a value is known to within 1/32 of itself from 10 us to about three hours
+#define FLEET_HISTOGRAM_UNIT_MS 0.01
+#define FLEET_HISTOGRAM_SUB_BITS 6
+#define FLEET_HISTOGRAM_OCTAVES 24
+#define FLEET_HISTOGRAM_SUB_COUNT (1 << FLEET_HISTOGRAM_SUB_BITS)
+#define FLEET_HISTOGRAM_HALF (1 << (FLEET_HISTOGRAM_SUB_BITS - 1))
+#define FLEET_HISTOGRAM_BUCKETS (FLEET_HISTOGRAM_SUB_COUNT + FLEET_HISTOGRAM_OCTAVES * FLEET_HISTOGRAM_HALF)
+#define FLEET_HISTOGRAM_MAX_UNITS (1ull << (FLEET_HISTOGRAM_SUB_BITS + FLEET_HISTOGRAM_OCTAVES))
+#define FLEET_SUMMARY_VERSION 1
+// Startup tasks and marks timed, past these the rest aren't
+#define FLEET_STARTUP_PHASES 16
+#define FLEET_PHASE_NAME 32
+// Where the hourly summaries wait to be uploaded, and how many are kept while the endpoint can't be reached: a week
+#define FLEET_SPOOL_DIRECTORY "fleet"
+#define FLEET_SPOOL_FILES 168
+#define FLEET_UPLOAD_TIMEOUT_MS 5000
+#define FLEET_UPLOAD_PATH "/fleet"
+
+// A latency distribution in fixed memory, HDR style: log-linear buckets of counts that merge by adding them up, so
+// hours merge into days and installations into the fleet without anything but the buckets
+class LatencyHistogram
+{
+public:
+	LatencyHistogram() { this->clear(); }
+
+	void clear()
+	{
+		memset(this->counts, 0, sizeof(this->counts));
+		this->total = 0;
+		this->sumMs = 0.0;
+		this->maxMs = 0.0f;
+	}
+
+	void record(float ms)
+	{
+		if (!(ms >= 0.0f))
+			return;
+		this->counts[bucketOf(ms)]++;
+		this->total++;
+		this->sumMs += ms;
+		this->maxMs = std::max(this->maxMs, ms);
+	}
+
+	void merge(const LatencyHistogram& other)
+	{
+		for (int i = 0; i < FLEET_HISTOGRAM_BUCKETS; i++)
+			this->counts[i] += other.counts[i];
+		this->total += other.total;
+		this->sumMs += other.sumMs;
+		this->maxMs = std::max(this->maxMs, other.maxMs);
+	}
+
+	uint64_t count() const { return this->total; }
+	float mean() const { return this->total ? (float)(this->sumMs / (double)this->total) : 0.0f; }
+	float peak() const { return this->maxMs; }
+
+	// Nearest rank, as the bench reports have them, to the middle of the bucket it falls in; 0 without samples
+	float percentile(float p) const
+	{
+		if (!this->total)
+			return 0.0f;
+		const uint64_t rank = std::min((uint64_t)(p * (double)(this->total - 1) + 0.5), this->total - 1) + 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < FLEET_HISTOGRAM_BUCKETS; i++)
+		{
+			seen += this->counts[i];
+			if (seen >= rank)
+				return std::min(middleOf(i), this->maxMs);
+		}
+		return this->maxMs;
+	}
+
+	// {"count", "sum_ms", "max_ms", "buckets"}, the buckets as pairs of the step from the previous bucket with
+	// samples and the count, only those with samples
+	string json() const
+	{
+		string out;
+		char text[96];
+		snprintf(text, sizeof(text), "{\"count\": %llu, \"sum_ms\": %.3f, \"max_ms\": %.3f, \"buckets\": [",
+			(unsigned long long)this->total, this->sumMs, this->maxMs);
+		out += text;
+		int previous = 0;
+		bool first = true;
+		for (int i = 0; i < FLEET_HISTOGRAM_BUCKETS; i++)
+		{
+			if (!this->counts[i])
+				continue;
+			snprintf(text, sizeof(text), "%s%d, %u", first ? "" : ", ", i - previous, this->counts[i]);
+			out += text;
+			previous = i;
+			first = false;
+		}
+		out += "]}";
+		return out;
+	}
+
+	// What json() wrote, false if it doesn't fit the layout
+	bool read(const JsonValue& value)
+	{
+		this->clear();
+		const JsonValue* buckets = value.get("buckets");
+		if (!buckets || buckets->type != JsonValue::Type::Array || buckets->items.size() % 2)
+			return false;
+		int bucket = 0;
+		for (size_t i = 0; i < buckets->items.size(); i += 2)
+		{
+			bucket += (int)buckets->items[i].number;
+			if (bucket < 0 || bucket >= FLEET_HISTOGRAM_BUCKETS)
+				return false;
+			this->counts[bucket] += (uint32_t)buckets->items[i + 1].number;
+		}
+		this->total = (uint64_t)value.numberOr("count", 0.0);
+		this->sumMs = value.numberOr("sum_ms", 0.0);
+		this->maxMs = (float)value.numberOr("max_ms", 0.0);
+		return true;
+	}
+
+	static int bucketOf(float ms)
+	{
+		const double units = (double)ms / FLEET_HISTOGRAM_UNIT_MS;
+		const uint64_t v = units >= (double)FLEET_HISTOGRAM_MAX_UNITS ? FLEET_HISTOGRAM_MAX_UNITS - 1 : (uint64_t)units;
+		if (v < FLEET_HISTOGRAM_SUB_COUNT)
+			return (int)v;
+		int highest = 0;
+		for (uint64_t rest = v; rest >>= 1;)
+			highest++;
+		const int shift = highest - (FLEET_HISTOGRAM_SUB_BITS - 1);
+		return FLEET_HISTOGRAM_SUB_COUNT + (highest - FLEET_HISTOGRAM_SUB_BITS) * FLEET_HISTOGRAM_HALF + (int)(v >> shift) - FLEET_HISTOGRAM_HALF;
+	}
+
+	// The middle of bucket's range, ms
+	static float middleOf(int bucket)
+	{
+		if (bucket < FLEET_HISTOGRAM_SUB_COUNT)
+			return (float)(((double)bucket + 0.5) * FLEET_HISTOGRAM_UNIT_MS);
+		const int step = bucket - FLEET_HISTOGRAM_SUB_COUNT;
+		const int shift = step / FLEET_HISTOGRAM_HALF + 1;
+		const double low = (double)((uint64_t)(FLEET_HISTOGRAM_HALF + step % FLEET_HISTOGRAM_HALF) << shift);
+		return (float)((low + (double)(1ull << shift) * 0.5) * FLEET_HISTOGRAM_UNIT_MS);
+	}
+
+private:
+	uint32_t counts[FLEET_HISTOGRAM_BUCKETS];
+	uint64_t total;
+	double sumMs;
+	float maxMs;
+};
+
+enum class FleetMetric
+{
+	// FrameProfiler's, each resolved frame
+	FrameCpu,
+	FrameGpu,
+	// ovr_GetPerfStats', each compositor frame
+	AppGpu,
+	CompositorGpu,
+	MotionToPhoton,
+	// AssetStreamer's, from request to ready
+	AssetLoad,
+	Count
+};
+
+static const char* const FLEET_METRIC_NAMES[] = {
+	"frame_cpu_ms", "frame_gpu_ms", "app_gpu_ms", "compositor_gpu_ms", "motion_to_photon_ms", "asset_load_ms",
+};
+static_assert(sizeof(FLEET_METRIC_NAMES) / sizeof(FLEET_METRIC_NAMES[0]) == (size_t)FleetMetric::Count, "A name for each metric");
+
+// One hour of one installation, or any number of them merged
+struct FleetSummary
+{
+	string installation;
+	string build;
+	string hour;
+	uint64_t compositorFrames = 0;
+	uint64_t appDropped = 0;
+	uint64_t compositorDropped = 0;
+	LatencyHistogram metrics[(int)FleetMetric::Count];
+	vector<pair<string, LatencyHistogram>> startup;
+
+	void merge(const FleetSummary& other)
+	{
+		this->compositorFrames += other.compositorFrames;
+		this->appDropped += other.appDropped;
+		this->compositorDropped += other.compositorDropped;
+		for (int m = 0; m < (int)FleetMetric::Count; m++)
+			this->metrics[m].merge(other.metrics[m]);
+		for (size_t i = 0; i < other.startup.size(); i++)
+			this->phase(other.startup[i].first).merge(other.startup[i].second);
+	}
+
+	LatencyHistogram& phase(const string& name)
+	{
+		for (size_t i = 0; i < this->startup.size(); i++)
+		{
+			if (this->startup[i].first == name)
+				return this->startup[i].second;
+		}
+		this->startup.push_back(make_pair(name, LatencyHistogram()));
+		return this->startup.back().second;
+	}
+};
+
+// A summary FleetStats wrote, false if it can't be read or has another histogram layout
+static bool _loadFleetSummary(const string& path, FleetSummary* summary)
+{
+	MappedFile file;
+	if (!file.open(path))
+	{
+		printf("ERROR::FLEET::SUMMARY_NOT_FOUND %s\n", path.c_str());
+		return false;
+	}
+	const char* text = (const char*)file.data();
+	JsonValue document;
+	if (!_parseJson(text, text + file.size(), &document) || document.type != JsonValue::Type::Object)
+	{
+		printf("ERROR::FLEET::SUMMARY_NOT_JSON %s\n", path.c_str());
+		return false;
+	}
+	const JsonValue* layout = document.get("histogram");
+	if (document.intOr("version", 0) != FLEET_SUMMARY_VERSION || !layout || layout->numberOr("unit_ms", 0.0) != FLEET_HISTOGRAM_UNIT_MS ||
+		layout->intOr("sub_bits", 0) != FLEET_HISTOGRAM_SUB_BITS || layout->intOr("octaves", 0) != FLEET_HISTOGRAM_OCTAVES)
+	{
+		printf("ERROR::FLEET::SUMMARY_LAYOUT_DIFFERS %s\n", path.c_str());
+		return false;
+	}
+	summary->installation = document.textOr("installation", "");
+	summary->build = document.textOr("build", "");
+	summary->hour = document.textOr("hour", "");
+	if (const JsonValue* counters = document.get("counters"))
+	{
+		summary->compositorFrames = (uint64_t)counters->numberOr("compositor_frames", 0.0);
+		summary->appDropped = (uint64_t)counters->numberOr("app_dropped", 0.0);
+		summary->compositorDropped = (uint64_t)counters->numberOr("compositor_dropped", 0.0);
+	}
+	const JsonValue* metrics = document.get("metrics");
+	for (int m = 0; m < (int)FleetMetric::Count; m++)
+	{
+		const JsonValue* metric = metrics ? metrics->get(FLEET_METRIC_NAMES[m]) : nullptr;
+		if (metric && !summary->metrics[m].read(*metric))
+		{
+			printf("ERROR::FLEET::SUMMARY_DAMAGED %s\n", path.c_str());
+			return false;
+		}
+	}
+	if (const JsonValue* startup = document.get("startup"))
+	{
+		for (size_t i = 0; i < startup->members.size(); i++)
+		{
+			if (!summary->phase(startup->members[i].first).read(startup->members[i].second))
+			{
+				printf("ERROR::FLEET::SUMMARY_DAMAGED %s\n", path.c_str());
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// The installation's performance for the fleet: frame times, compositor drops, asset loads and startup phases
+// collected over each UTC hour into histograms of fixed size, then written as one small JSON summary into
+// FLEET_SPOOL_DIRECTORY and, with an endpoint, POSTed to it over HTTP by a background thread. A summary stays in the
+// spool until the endpoint takes it with a 2xx, so a venue that is offline for a while catches up; only the
+// FLEET_SPOOL_FILES newest are kept. The hour still running is written when the app closes, the next start's
+// summary of that hour merges with it wherever they end up, as summaries of different installations do.
+//
+// Nothing is collected without open(), which only --fleet-stats or --fleet-upload call. Render thread only.
+class FleetStats
+{
+public:
+	FleetStats() {}
+	~FleetStats() { this->close(); }
+
+	FleetStats(const FleetStats&) = delete;
+	FleetStats& operator=(const FleetStats&) = delete;
+
+	// endpoint is "address:port" with an optional path, numeric, or null to only keep the summaries
+	bool open(const char* installation, const char* build, const char* endpoint)
+	{
+		this->close();
+		if (endpoint && endpoint[0] && !this->parseEndpoint(endpoint))
+			return false;
+		CreateDirectoryA(FLEET_SPOOL_DIRECTORY, NULL);
+		this->summary = FleetSummary();
+		this->summary.installation = installation;
+		this->summary.build = build;
+		this->hour = (int64_t)time(nullptr) / 3600;
+		this->opened = true;
+		if (this->uploading)
+		{
+			// Whatever earlier runs left goes first
+			this->stopping = false;
+			this->spooled = true;
+			this->uploader = std::thread([this]() { this->run(); });
+		}
+		return true;
+	}
+
+	// Writes the hour so far and stops the uploader, an upload under way is let finish
+	void close()
+	{
+		if (!this->opened)
+			return;
+		this->flush();
+		this->opened = false;
+		if (this->uploader.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->stopping = true;
+			}
+			this->wake.notify_one();
+			this->uploader.join();
+		}
+	}
+
+	bool isOpen() const { return this->opened; }
+
+	// After FrameProfiler::endFrame(), each resolved frame is counted once
+	void frame(uint64_t resolvedFrame, float cpuMs, float gpuMs)
+	{
+		if (!this->opened || resolvedFrame == this->lastFrame)
+			return;
+		this->lastFrame = resolvedFrame;
+		this->summary.metrics[(int)FleetMetric::FrameCpu].record(cpuMs);
+		this->summary.metrics[(int)FleetMetric::FrameGpu].record(gpuMs);
+	}
+
+	// Each compositor frame CompositorTelemetry sees. Its drop counts are totals since the session's, so the
+	// hour gets what they went up by.
+	void compositorFrame(const ovrPerfStatsPerCompositorFrame& f)
+	{
+		if (!this->opened)
+			return;
+		this->summary.metrics[(int)FleetMetric::AppGpu].record(f.AppGpuElapsedTime * 1000.0f);
+		this->summary.metrics[(int)FleetMetric::CompositorGpu].record(f.CompositorGpuElapsedTime * 1000.0f);
+		this->summary.metrics[(int)FleetMetric::MotionToPhoton].record(f.AppMotionToPhotonLatency * 1000.0f);
+		this->summary.compositorFrames++;
+		if (this->appDroppedSeen >= 0 && f.AppDroppedFrameCount > this->appDroppedSeen)
+			this->summary.appDropped += f.AppDroppedFrameCount - this->appDroppedSeen;
+		if (this->compositorDroppedSeen >= 0 && f.CompositorDroppedFrameCount > this->compositorDroppedSeen)
+			this->summary.compositorDropped += f.CompositorDroppedFrameCount - this->compositorDroppedSeen;
+		this->appDroppedSeen = f.AppDroppedFrameCount;
+		this->compositorDroppedSeen = f.CompositorDroppedFrameCount;
+	}
+
+	void assetLoaded(float ms)
+	{
+		if (this->opened)
+			this->summary.metrics[(int)FleetMetric::AssetLoad].record(ms);
+	}
+
+	// A startup task's time, or a mark's time since the process started
+	void startupPhase(const char* name, float ms)
+	{
+		if (!this->opened)
+			return;
+		for (int i = 0; i < this->phaseCount; i++)
+		{
+			if (!strcmp(this->phaseNames[i], name))
+			{
+				this->phases[i].record(ms);
+				return;
+			}
+		}
+		if (this->phaseCount == FLEET_STARTUP_PHASES)
+			return;
+		snprintf(this->phaseNames[this->phaseCount], FLEET_PHASE_NAME, "%s", name);
+		this->phases[this->phaseCount++].record(ms);
+	}
+
+	// Once a frame, writes the summary out when the hour turns
+	void tick()
+	{
+		if (!this->opened)
+			return;
+		const int64_t now = (int64_t)time(nullptr) / 3600;
+		if (now == this->hour)
+			return;
+		this->flush();
+		this->hour = now;
+	}
+
+private:
+	bool opened = false;
+	FleetSummary summary;
+	// Hours since 1970, UTC, of the summary being collected
+	int64_t hour = 0;
+	uint64_t lastFrame = UINT64_MAX;
+	int appDroppedSeen = -1;
+	int compositorDroppedSeen = -1;
+	LatencyHistogram phases[FLEET_STARTUP_PHASES];
+	char phaseNames[FLEET_STARTUP_PHASES][FLEET_PHASE_NAME];
+	int phaseCount = 0;
+
+	bool uploading = false;
+	sockaddr_in address;
+	string host;
+	string path;
+	std::thread uploader;
+	std::mutex mutex;
+	std::condition_variable wake;
+	// Under mutex
+	bool stopping = false;
+	bool spooled = false;
+
+	// The hour's summary into the spool, then starts collecting the next
+	void flush()
+	{
+		const bool empty = !this->summary.compositorFrames && !this->summary.metrics[(int)FleetMetric::FrameCpu].count() &&
+			!this->summary.metrics[(int)FleetMetric::AssetLoad].count() && !this->phaseCount;
+		if (!empty)
+			this->write();
+		for (int m = 0; m < (int)FleetMetric::Count; m++)
+			this->summary.metrics[m].clear();
+		this->summary.compositorFrames = this->summary.appDropped = this->summary.compositorDropped = 0;
+		for (int i = 0; i < this->phaseCount; i++)
+			this->phases[i].clear();
+		this->phaseCount = 0;
+		if (empty || !this->uploading)
+			return;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->spooled = true;
+		}
+		this->wake.notify_one();
+	}
+
+	// fleet_<hour>_<now>.json, so the names sort oldest first and a restart within the hour doesn't overwrite
+	void write()
+	{
+		const time_t hourStart = (time_t)(this->hour * 3600);
+		char hourText[32], name[96];
+		strftime(hourText, sizeof(hourText), "%Y-%m-%dT%H:00Z", gmtime(&hourStart));
+		char hourKey[16];
+		strftime(hourKey, sizeof(hourKey), "%Y%m%d%H", gmtime(&hourStart));
+		snprintf(name, sizeof(name), FLEET_SPOOL_DIRECTORY "\\fleet_%s_%lld.json", hourKey, (long long)time(nullptr));
+		FILE* file = fopen(name, "w");
+		if (!file)
+		{
+			printf("ERROR::FLEET::SUMMARY_NOT_WRITTEN %s\n", name);
+			return;
+		}
+		fprintf(file, "{\n  \"version\": %d,\n  \"installation\": \"%s\",\n  \"build\": \"%s\",\n  \"hour\": \"%s\",\n"
+			"  \"histogram\": {\"unit_ms\": %g, \"sub_bits\": %d, \"octaves\": %d},\n"
+			"  \"counters\": {\"compositor_frames\": %llu, \"app_dropped\": %llu, \"compositor_dropped\": %llu},\n  \"metrics\": {\n",
+			FLEET_SUMMARY_VERSION, _jsonEscape(this->summary.installation).c_str(), _jsonEscape(this->summary.build).c_str(), hourText,
+			FLEET_HISTOGRAM_UNIT_MS, FLEET_HISTOGRAM_SUB_BITS, FLEET_HISTOGRAM_OCTAVES, (unsigned long long)this->summary.compositorFrames,
+			(unsigned long long)this->summary.appDropped, (unsigned long long)this->summary.compositorDropped);
+		for (int m = 0; m < (int)FleetMetric::Count; m++)
+			fprintf(file, "    \"%s\": %s%s\n", FLEET_METRIC_NAMES[m], this->summary.metrics[m].json().c_str(), m + 1 < (int)FleetMetric::Count ? "," : "");
+		fprintf(file, "  },\n  \"startup\": {\n");
+		for (int i = 0; i < this->phaseCount; i++)
+			fprintf(file, "    \"%s\": %s%s\n", _jsonEscape(this->phaseNames[i]).c_str(), this->phases[i].json().c_str(), i + 1 < this->phaseCount ? "," : "");
+		fprintf(file, "  }\n}\n");
+		fclose(file);
+		this->prune();
+	}
+
+	// The spool's summaries, oldest first
+	static vector<string> spooledFiles()
+	{
+		vector<string> names;
+		WIN32_FIND_DATAA found;
+		HANDLE find = FindFirstFileA(FLEET_SPOOL_DIRECTORY "\\fleet_*.json", &found);
+		if (find != INVALID_HANDLE_VALUE)
+		{
+			do
+				names.push_back(string(FLEET_SPOOL_DIRECTORY "\\") + found.cFileName);
+			while (FindNextFileA(find, &found));
+			FindClose(find);
+		}
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+	static void prune()
+	{
+		const vector<string> names = spooledFiles();
+		for (size_t i = 0; i + FLEET_SPOOL_FILES < names.size(); i++)
+			DeleteFileA(names[i].c_str());
+	}
+
+	bool parseEndpoint(const char* endpoint)
+	{
+		char hostText[64], pathText[128] = FLEET_UPLOAD_PATH;
+		unsigned port = 0;
+		if (sscanf(endpoint, "%63[^:]:%u%127s", hostText, &port, pathText) < 2 || !port || port > 65535 || pathText[0] != '/')
+		{
+			printf("ERROR::FLEET::BAD_ENDPOINT %s\n", endpoint);
+			return false;
+		}
+		memset(&this->address, 0, sizeof(this->address));
+		this->address.sin_family = AF_INET;
+		this->address.sin_port = htons((u_short)port);
+		if (inet_pton(AF_INET, hostText, &this->address.sin_addr) != 1)
+		{
+			printf("ERROR::FLEET::BAD_ENDPOINT %s\n", endpoint);
+			return false;
+		}
+		this->host = string(hostText) + ":" + std::to_string(port);
+		this->path = pathText;
+		this->uploading = true;
+		return true;
+	}
+
+	void run()
+	{
+		TRACE_THREAD("fleet uploader");
+		_threadPolicy.apply(ThreadRole::Background);
+		WSADATA data;
+		if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		{
+			printf("ERROR::FLEET::WINSOCK_NOT_STARTED\n");
+			return;
+		}
+		std::unique_lock<std::mutex> lock(this->mutex);
+		for (;;)
+		{
+			this->wake.wait(lock, [this]() { return this->stopping || this->spooled; });
+			if (this->stopping)
+				break;
+			this->spooled = false;
+			lock.unlock();
+			this->uploadSpool();
+			lock.lock();
+		}
+		lock.unlock();
+		WSACleanup();
+	}
+
+	// Oldest first, stopping at the first the endpoint doesn't take; they are tried again at the next hour
+	void uploadSpool()
+	{
+		const vector<string> names = spooledFiles();
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				if (this->stopping)
+					return;
+			}
+			string body;
+			{
+				MappedFile file;
+				if (!file.open(names[i]))
+					continue;
+				body.assign((const char*)file.data(), file.size());
+			}
+			if (!this->post(body))
+			{
+				printf("ERROR::FLEET::UPLOAD_FAILED %s, %u summaries kept\n", this->host.c_str(), (unsigned)(names.size() - i));
+				return;
+			}
+			DeleteFileA(names[i].c_str());
+		}
+	}
+
+	// One HTTP/1.1 POST, true on a 2xx. Connecting gives up after FLEET_UPLOAD_TIMEOUT_MS as sending and
+	// receiving do, so close() never waits on an unreachable endpoint for long.
+	bool post(const string& body)
+	{
+		SOCKET s = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (s == INVALID_SOCKET)
+			return false;
+		const DWORD timeout = FLEET_UPLOAD_TIMEOUT_MS;
+		setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+		setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+
+		u_long nonBlocking = 1;
+		ioctlsocket(s, FIONBIO, &nonBlocking);
+		bool ok = connect(s, (const sockaddr*)&this->address, sizeof(this->address)) != SOCKET_ERROR || WSAGetLastError() == WSAEWOULDBLOCK;
+		if (ok)
+		{
+			fd_set writable, failed;
+			FD_ZERO(&writable);
+			FD_SET(s, &writable);
+			FD_ZERO(&failed);
+			FD_SET(s, &failed);
+			timeval wait = { FLEET_UPLOAD_TIMEOUT_MS / 1000, (FLEET_UPLOAD_TIMEOUT_MS % 1000) * 1000 };
+			ok = select(0, NULL, &writable, &failed, &wait) == 1 && FD_ISSET(s, &writable);
+		}
+		nonBlocking = 0;
+		ioctlsocket(s, FIONBIO, &nonBlocking);
+
+		if (ok)
+		{
+			const string request = "POST " + this->path + " HTTP/1.1\r\nHost: " + this->host + "\r\nContent-Type: application/json\r\n"
+				"Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+			for (size_t sent = 0; ok && sent < request.size();)
+			{
+				const int n = send(s, request.data() + sent, (int)(request.size() - sent), 0);
+				ok = n > 0;
+				if (ok)
+					sent += n;
+			}
+		}
+		// Only the status line is needed, "HTTP/1.1 200"
+		char status[64] = {};
+		int received = 0;
+		while (ok && received < 12)
+		{
+			const int n = recv(s, status + received, (int)sizeof(status) - 1 - received, 0);
+			if (n <= 0)
+				break;
+			received += n;
+		}
+		closesocket(s);
+		int code = 0;
+		return ok && sscanf(status, "HTTP/%*s %d", &code) == 1 && code >= 200 && code < 300;
+	}
+};
+
+static FleetStats _fleetStats;
+
+// Merges every summary in directory, as an endpoint would collect them, and prints each installation's frames and
+// drops, then the fleet's percentiles of every metric and startup phase. False if none could be read.
+static bool _mergeFleetSummaries(const string& directory)
+{
+	vector<string> names;
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA((directory + "\\*.json").c_str(), &found);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+			names.push_back(directory + "\\" + found.cFileName);
+		while (FindNextFileA(find, &found));
+		FindClose(find);
+	}
+	std::sort(names.begin(), names.end());
+
+	FleetSummary fleet;
+	vector<FleetSummary> installations;
+	size_t merged = 0;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		FleetSummary summary;
+		if (!_loadFleetSummary(names[i], &summary))
+			continue;
+		merged++;
+		fleet.merge(summary);
+		size_t at = 0;
+		while (at < installations.size() && installations[at].installation != summary.installation)
+			at++;
+		if (at == installations.size())
+		{
+			installations.push_back(FleetSummary());
+			installations.back().installation = summary.installation;
+		}
+		installations[at].merge(summary);
+	}
+	if (!merged)
+	{
+		printf("ERROR::FLEET::NO_SUMMARIES in %s\n", directory.c_str());
+		return false;
+	}
+
+	printf("Fleet: %u summaries from %u installations\r\n", (unsigned)merged, (unsigned)installations.size());
+	printf("%-32s %12s %10s %10s %10s %10s\r\n", "installation", "frames", "app drop", "comp drop", "gpu p50", "gpu p99");
+	for (const FleetSummary& s : installations)
+	{
+		const LatencyHistogram& gpu = s.metrics[(int)FleetMetric::FrameGpu];
+		printf("%-32s %12llu %10llu %10llu %10.2f %10.2f\r\n", s.installation.c_str(), (unsigned long long)s.compositorFrames,
+			(unsigned long long)s.appDropped, (unsigned long long)s.compositorDropped, gpu.percentile(0.5f), gpu.percentile(0.99f));
+	}
+	printf("%-32s %12s %10s %10s %10s %10s\r\n", "metric", "samples", "p50 ms", "p90 ms", "p99 ms", "max ms");
+	for (int m = 0; m < (int)FleetMetric::Count; m++)
+	{
+		const LatencyHistogram& h = fleet.metrics[m];
+		printf("%-32s %12llu %10.2f %10.2f %10.2f %10.2f\r\n", FLEET_METRIC_NAMES[m], (unsigned long long)h.count(), h.percentile(0.5f),
+			h.percentile(0.9f), h.percentile(0.99f), h.peak());
+	}
+	for (size_t i = 0; i < fleet.startup.size(); i++)
+	{
+		const LatencyHistogram& h = fleet.startup[i].second;
+		printf("startup %-24s %12llu %10.1f %10.1f %10.1f %10.1f\r\n", fleet.startup[i].first.c_str(), (unsigned long long)h.count(),
+			h.percentile(0.5f), h.percentile(0.9f), h.percentile(0.99f), h.peak());
+	}
+	return true;
+}
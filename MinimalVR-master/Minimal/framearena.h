@@ -0,0 +1,146 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+using namespace std;
+
+// Frames an allocation stays valid for: the one it was made in and the two after it, long enough for anything
+// handed from the render thread to the simulation thread or to a draw the GPU is still working on
+#define FRAME_ARENA_FRAMES 3
+// Each frame's first block, grown to whatever a frame turns out to need
+#define FRAME_ARENA_BLOCK_BYTES (256 * 1024)
+// Every allocation is aligned to this, enough for glm's types and for SIMD loads
+#define FRAME_ARENA_ALIGNMENT 16
+
+struct FrameArenaStats
+{
+	// Handed out since the last beginFrame()
+	uint64_t bytesUsed;
+	// Most any frame has used so far
+	uint64_t highWater;
+	// Held by all FRAME_ARENA_FRAMES frames together
+	uint64_t bytesResident;
+};
+
+// Bump allocation for data that only lives for a frame: cull scratch, joint positions and the like. Nothing is
+// freed on its own, beginFrame() takes everything made FRAME_ARENA_FRAMES frames ago back at once. A frame that
+// outgrows its block chains on another one, and the next time that frame comes round its blocks are replaced by a
+// single one of the size they added up to, so after the first few frames no frame touches the heap.
+// Only destructors of trivially destructible types may be skipped, so that is all allocate() hands out.
+// Not thread safe, the render thread's alone.
+class FrameArena
+{
+public:
+	FrameArena() {}
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	// Start of a frame, reclaims what the frame FRAME_ARENA_FRAMES ago allocated
+	void beginFrame()
+	{
+		this->current = (this->current + 1) % FRAME_ARENA_FRAMES;
+		Frame& frame = this->frames[this->current];
+		if (frame.blocks.size() > 1)
+		{
+			size_t total = 0;
+			for (size_t i = 0; i < frame.blocks.size(); i++)
+				total += frame.blocks[i].size;
+			frame.blocks.clear();
+			this->addBlock(frame, total);
+		}
+		for (size_t i = 0; i < frame.blocks.size(); i++)
+			frame.blocks[i].used = 0;
+		frame.bytesUsed = 0;
+	}
+
+	// Uninitialized storage for count Ts, valid until FRAME_ARENA_FRAMES more beginFrame() calls
+	template <typename T>
+	T* allocate(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Frame arena memory is reclaimed without destructors");
+		return static_cast<T*>(this->allocateBytes(count * sizeof(T)));
+	}
+
+	void* allocateBytes(size_t size)
+	{
+		Frame& frame = this->frames[this->current];
+		size = (size + FRAME_ARENA_ALIGNMENT - 1) & ~(size_t)(FRAME_ARENA_ALIGNMENT - 1);
+		if (frame.blocks.empty() || frame.blocks.back().used + size > frame.blocks.back().size)
+			this->addBlock(frame, std::max(size, (size_t)FRAME_ARENA_BLOCK_BYTES));
+		Block& block = frame.blocks.back();
+		void* p = block.data.get() + block.used;
+		block.used += size;
+		frame.bytesUsed += size;
+		this->highWater = std::max(this->highWater, frame.bytesUsed);
+		return p;
+	}
+
+	FrameArenaStats stats() const
+	{
+		FrameArenaStats stats = { this->frames[this->current].bytesUsed, this->highWater, 0 };
+		for (int f = 0; f < FRAME_ARENA_FRAMES; f++)
+		{
+			for (size_t i = 0; i < this->frames[f].blocks.size(); i++)
+				stats.bytesResident += this->frames[f].blocks[i].size;
+		}
+		return stats;
+	}
+
+private:
+	struct Block
+	{
+		unique_ptr<uint8_t[]> data;
+		size_t size;
+		size_t used;
+	};
+
+	struct Frame
+	{
+		vector<Block> blocks;
+		uint64_t bytesUsed = 0;
+	};
+
+	void addBlock(Frame& frame, size_t size)
+	{
+		Block block;
+		// new[] is aligned for any fundamental type, which FRAME_ARENA_ALIGNMENT doesn't exceed on x64
+		block.data.reset(new uint8_t[size]);
+		block.size = size;
+		block.used = 0;
+		frame.blocks.push_back(std::move(block));
+	}
+
+	Frame frames[FRAME_ARENA_FRAMES];
+	int current = 0;
+	uint64_t highWater = 0;
+};
+
+static FrameArena _frameArena;
+
+// Puts a standard container's storage into _frameArena. Deallocation does nothing, so only containers that are
+// done with by the end of the frame, and of trivially destructible elements, belong in one.
+template <typename T>
+struct FrameAllocator
+{
+	typedef T value_type;
+
+	FrameAllocator() {}
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U>&) {}
+
+	T* allocate(size_t count) { return static_cast<T*>(_frameArena.allocateBytes(count * sizeof(T))); }
+	void deallocate(T*, size_t) {}
+
+	template <typename U>
+	bool operator==(const FrameAllocator<U>&) const { return true; }
+	template <typename U>
+	bool operator!=(const FrameAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using FrameVector = vector<T, FrameAllocator<T>>;
@@ -0,0 +1,213 @@
+#pragma once
+// Std. Includes
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+using namespace std;
+// OVR Includes
+#include <OVR_CAPI.h>
+#include <OVR_Version.h>
+#include "benchhmd.h"
+#include "trace.h"
+
+// LibOVR 1.19 split ovr_SubmitFrame into ovr_WaitToBeginFrame, ovr_BeginFrame and ovr_EndFrame. Older runtimes
+// pace the app by blocking in ovr_SubmitFrame instead, which this falls back to.
+#if OVR_MAJOR_VERSION > 1 || OVR_MINOR_VERSION >= 19
+#define FRAME_PACING_SPLIT 1
+#else
+#define FRAME_PACING_SPLIT 0
+#endif
+
+// Frame intervals longer than this many refresh periods count as a missed slot
+#define FRAME_PACING_LATE 1.5f
+// The rate assumed until the runtime says otherwise, or if it reports none
+#define FRAME_PACING_DEFAULT_HZ 90.0f
+// Seconds of compositor vsyncs a measured refresh rate is taken over, and how far it may be from the current one
+// before two windows in a row of it count as a switch
+#define FRAME_PACING_RATE_WINDOW 1.0
+#define FRAME_PACING_RATE_TOLERANCE 0.03f
+
+// Rates headsets run at, a measured one within the tolerance of one of them is taken to be it
+static const float _refreshRates[] = { 60.0f, 72.0f, 80.0f, 90.0f, 120.0f, 144.0f };
+
+static float _nearestRefreshRate(float measured)
+{
+	for (float rate : _refreshRates)
+	{
+		if (fabsf(measured - rate) <= rate * FRAME_PACING_RATE_TOLERANCE)
+			return rate;
+	}
+	return floorf(measured + 0.5f);
+}
+
+// How the last frame was paced, in microseconds
+struct FramePacingStats
+{
+	// Blocked waiting for the compositor to take a frame
+	uint32_t waitUs = 0;
+	// From the start of one frame to the start of the next
+	uint32_t intervalUs = 0;
+	// Frames so far whose interval was over FRAME_PACING_LATE refresh periods
+	uint32_t missed = 0;
+};
+
+// The frame loop's side of the compositor handshake: waitToBegin() before anything of the frame is predicted or
+// sampled, begin() before its first GL work, end() to hand it over.
+//
+// With the split API the wait happens up front, so what the frame samples is as fresh as the compositor allows
+// and whatever the app did before waitToBegin() (the update, the simulation's kick) overlaps the wait. With
+// ovr_SubmitFrame the same blocking happens inside end(), at the end of the previous frame, and is timed there.
+// --bench never waits, its frames run back to back.
+//
+// The refresh rate starts at the one the HMD was created with and follows the display's vsyncs after that, so a
+// runtime that switches the rate mid-session, as Link does on 72/80/90/120 Hz headsets, moves every deadline taken
+// from periodSeconds() with it. LibOVR has no call to ask for a rate, the runtime's own settings choose it.
+class FramePacer
+{
+public:
+	FramePacer() {}
+
+	FramePacer(const FramePacer&) = delete;
+	FramePacer& operator=(const FramePacer&) = delete;
+
+	void init(float refreshRate)
+	{
+		this->setRefreshRate(refreshRate > 0.0f ? refreshRate : FRAME_PACING_DEFAULT_HZ);
+		this->rateVsync = -1;
+	}
+
+	// The display's rate as of the last observeVsync(), and its period
+	float refreshRate() const { return this->rate; }
+	double periodSeconds() const { return 1.0 / this->rate; }
+	float periodMs() const { return 1000.0f / this->rate; }
+
+	// Once a frame with the newest compositor frame's HmdVsyncIndex and the time it was polled at. True when this
+	// measured a new refresh rate, refreshRate() has it.
+	bool observeVsync(int vsyncIndex, double seconds)
+	{
+		if (this->rateVsync < 0 || vsyncIndex < this->rateVsync)
+		{
+			this->rateVsync = vsyncIndex;
+			this->rateSeconds = seconds;
+			return false;
+		}
+		const double elapsed = seconds - this->rateSeconds;
+		if (elapsed < FRAME_PACING_RATE_WINDOW)
+			return false;
+		const float measured = (float)((vsyncIndex - this->rateVsync) / elapsed);
+		this->rateVsync = vsyncIndex;
+		this->rateSeconds = seconds;
+		if (fabsf(measured - this->rate) <= this->rate * FRAME_PACING_RATE_TOLERANCE)
+		{
+			this->candidateRate = 0.0f;
+			return false;
+		}
+		// A stall in the polls can make one window look off, a switch holds for the next too
+		const bool confirmed = this->candidateRate > 0.0f && fabsf(measured - this->candidateRate) <= this->candidateRate * FRAME_PACING_RATE_TOLERANCE;
+		this->candidateRate = measured;
+		if (!confirmed)
+			return false;
+		this->setRefreshRate(_nearestRefreshRate(measured));
+		this->candidateRate = 0.0f;
+		return true;
+	}
+
+	void waitToBegin(ovrSession session, long long frameIndex)
+	{
+		TRACE_ZONE("wait to begin frame");
+		this->waitUs = 0;
+#if FRAME_PACING_SPLIT
+		if (!_hmdStandIn())
+		{
+			const Clock::time_point start = Clock::now();
+			ovr_WaitToBeginFrame(session, frameIndex);
+			this->waitUs = elapsedUs(start);
+		}
+#endif
+		// Nothing paces a remote headset's frames but the wait for its refresh
+		if (_remoteHmd.active())
+		{
+			const Clock::time_point start = Clock::now();
+			_remoteHmd.waitToBegin();
+			this->waitUs = elapsedUs(start);
+		}
+		const Clock::time_point now = Clock::now();
+		if (this->started)
+		{
+			this->last.intervalUs = elapsedUs(this->frameStart, now);
+			if (this->refreshPeriodUs > 0.0f && this->last.intervalUs > this->refreshPeriodUs * FRAME_PACING_LATE)
+				this->last.missed++;
+		}
+		this->last.waitUs = this->waitUs + this->submitWaitUs;
+		this->frameStart = now;
+		this->started = true;
+	}
+
+	void begin(ovrSession session, long long frameIndex)
+	{
+#if FRAME_PACING_SPLIT
+		if (!_hmdStandIn())
+			ovr_BeginFrame(session, frameIndex);
+#endif
+	}
+
+	ovrResult end(ovrSession session, long long frameIndex, const ovrViewScaleDesc* viewScaleDesc,
+		ovrLayerHeader const* const* layers, unsigned int layerCount)
+	{
+		TRACE_ZONE("submit frame");
+		const Clock::time_point start = Clock::now();
+		ovrResult result;
+#if FRAME_PACING_SPLIT
+		if (!_hmdStandIn())
+			result = ovr_EndFrame(session, frameIndex, viewScaleDesc, layers, layerCount);
+		else
+#endif
+		result = _hmdSubmitFrame(session, frameIndex, viewScaleDesc, layers, layerCount);
+		// With the split API ending is quick, without it this is the frame's wait
+		this->submitWaitUs = FRAME_PACING_SPLIT ? 0 : elapsedUs(start);
+		return result;
+	}
+
+	// Frames stopped for a while, see SessionMonitor: the first one after has no interval to count as missed, and
+	// the refresh rate is measured afresh
+	void pause()
+	{
+		this->started = false;
+		this->rateVsync = -1;
+		this->candidateRate = 0.0f;
+		this->last.intervalUs = 0;
+		this->last.waitUs = 0;
+		this->submitWaitUs = 0;
+	}
+
+	// The previous frame's numbers, known once this one has waited
+	const FramePacingStats& stats() const { return this->last; }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	void setRefreshRate(float refreshRate)
+	{
+		this->rate = refreshRate;
+		this->refreshPeriodUs = 1000000.0f / refreshRate;
+	}
+
+	static uint32_t elapsedUs(Clock::time_point start, Clock::time_point end = Clock::now())
+	{
+		return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	}
+
+	float rate = FRAME_PACING_DEFAULT_HZ;
+	float refreshPeriodUs = 1000000.0f / FRAME_PACING_DEFAULT_HZ;
+	// Start of the window the rate is being measured over, and a rate the last window saw but the one before didn't
+	int rateVsync = -1;
+	double rateSeconds = 0.0;
+	float candidateRate = 0.0f;
+	bool started = false;
+	Clock::time_point frameStart;
+	uint32_t waitUs = 0;
+	uint32_t submitWaitUs = 0;
+	FramePacingStats last;
+};
+
+static FramePacer _framePacer;
@@ -0,0 +1,256 @@
+#pragma once
+// Std. Includes
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+using namespace std;
+#include "trace.h"
+#include "threading.h"
+
+// Single producer, single consumer handoff of whole values without locks.
+//
+// There are three slots: the producer fills back(), the consumer reads front(), and the third one holds the
+// most recently published value. publish() and acquire() swap a private slot with that shared one, so neither
+// side ever waits and the consumer always sees the newest complete value. Values the consumer was too slow to
+// pick up are overwritten, which is the point for frame data but means counters should be cumulative.
+// Slots are reused, so containers inside T keep their capacity from frame to frame.
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() {}
+
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	// Producer side
+	T& back() { return this->slots[this->backIndex]; }
+
+	void publish()
+	{
+		uint8_t previous = this->shared.exchange((uint8_t)(this->backIndex | FRESH), std::memory_order_acq_rel);
+		this->backIndex = previous & INDEX_MASK;
+	}
+
+	// Consumer side. Returns false, and leaves front() as it was, if nothing was published since the last call.
+	bool acquire()
+	{
+		if (!(this->shared.load(std::memory_order_acquire) & FRESH))
+			return false;
+		uint8_t previous = this->shared.exchange(this->frontIndex, std::memory_order_acq_rel);
+		this->frontIndex = previous & INDEX_MASK;
+		return true;
+	}
+
+	T& front() { return this->slots[this->frontIndex]; }
+	const T& front() const { return this->slots[this->frontIndex]; }
+
+private:
+	static const uint8_t INDEX_MASK = 0x3;
+	static const uint8_t FRESH = 0x4;
+
+	T slots[3];
+	// Index of the shared slot, FRESH while it holds a value the consumer hasn't taken yet
+	std::atomic<uint8_t> shared{ 1 };
+	uint8_t backIndex = 0;
+	uint8_t frontIndex = 2;
+};
+
+// Single producer, single consumer FIFO of up to Capacity values without locks, for streams where every value
+// matters, unlike TripleBuffer. Each side owns one index and only reads the other's, so push() and pop() never
+// wait; a full queue makes push() return false and the producer holds on to the value until there is room.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+	SpscQueue() {}
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	// Producer side
+	bool push(T value)
+	{
+		const size_t tail = this->tail.load(std::memory_order_relaxed);
+		if (tail - this->head.load(std::memory_order_acquire) == Capacity)
+			return false;
+		this->slots[tail & (Capacity - 1)] = std::move(value);
+		this->tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, false if the queue is empty
+	bool pop(T* value)
+	{
+		const size_t head = this->head.load(std::memory_order_relaxed);
+		if (head == this->tail.load(std::memory_order_acquire))
+			return false;
+		*value = std::move(this->slots[head & (Capacity - 1)]);
+		this->head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	T slots[Capacity];
+	// Kept on their own cache lines so the two threads don't fight over one
+	alignas(64) std::atomic<size_t> head{ 0 };
+	alignas(64) std::atomic<size_t> tail{ 0 };
+};
+
+// Many producers, single consumer FIFO of up to Capacity values without locks, for any thread handing values to
+// one drainer. Each slot carries a sequence number that says whose turn it is: producers claim a position with a
+// compare and swap on the tail and publish the slot by advancing its sequence, the consumer frees it by advancing
+// it a lap further. A full queue makes push() return false, nobody waits.
+template <typename T, size_t Capacity>
+class MpscQueue
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "MpscQueue capacity must be a power of two");
+
+public:
+	MpscQueue()
+	{
+		for (size_t i = 0; i < Capacity; i++)
+			this->slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	MpscQueue(const MpscQueue&) = delete;
+	MpscQueue& operator=(const MpscQueue&) = delete;
+
+	// Any thread
+	bool push(const T& value)
+	{
+		size_t tail = this->tail.load(std::memory_order_relaxed);
+		Slot* slot;
+		for (;;)
+		{
+			slot = &this->slots[tail & (Capacity - 1)];
+			const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			const ptrdiff_t lap = (ptrdiff_t)(sequence - tail);
+			if (lap == 0)
+			{
+				if (this->tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (lap < 0)
+				return false;
+			else
+				tail = this->tail.load(std::memory_order_relaxed);
+		}
+		slot->value = value;
+		slot->sequence.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, false if the queue is empty or the oldest value is still being written
+	bool pop(T* value)
+	{
+		Slot& slot = this->slots[this->head & (Capacity - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) != this->head + 1)
+			return false;
+		*value = slot.value;
+		slot.sequence.store(this->head + Capacity, std::memory_order_release);
+		this->head++;
+		return true;
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	Slot slots[Capacity];
+	// Only the consumer touches head
+	alignas(64) size_t head = 0;
+	alignas(64) std::atomic<size_t> tail{ 0 };
+};
+
+// A thread that runs one step of work each time it is kicked. Kicks that arrive while a step is running
+// are folded into a single next step, the data itself travels through TripleBuffers and never through here.
+class FrameWorker
+{
+public:
+	FrameWorker() {}
+	~FrameWorker()
+	{
+		this->stop();
+	}
+
+	FrameWorker(const FrameWorker&) = delete;
+	FrameWorker& operator=(const FrameWorker&) = delete;
+
+	bool running() const { return this->worker.joinable(); }
+
+	// name is the thread's on a timeline profiler, see trace.h, role how it is scheduled, see threading.h
+	void start(std::function<void()> step, const char* name = "frame worker", ThreadRole role = ThreadRole::Simulation)
+	{
+		if (this->running())
+			return;
+		this->step = step;
+		this->name = name;
+		this->role = role;
+		this->stopping = false;
+		this->pending = false;
+		this->worker = std::thread([this]() { this->run(); });
+	}
+
+	void kick()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->pending = true;
+		}
+		this->wake.notify_one();
+	}
+
+	// Lets the current step finish, then joins
+	void stop()
+	{
+		if (!this->running())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stopping = true;
+		}
+		this->wake.notify_one();
+		this->worker.join();
+	}
+
+private:
+	std::thread worker;
+	std::function<void()> step;
+	const char* name = nullptr;
+	ThreadRole role = ThreadRole::Simulation;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool pending = false;
+	bool stopping = false;
+
+	void run()
+	{
+		TRACE_THREAD(this->name);
+		_threadPolicy.apply(this->role);
+		std::unique_lock<std::mutex> lock(this->mutex);
+		for (;;)
+		{
+			this->wake.wait(lock, [this]() { return this->pending || this->stopping; });
+			if (this->stopping)
+				return;
+			this->pending = false;
+			lock.unlock();
+			{
+				TRACE_ZONE("step");
+				this->step();
+			}
+			lock.lock();
+		}
+	}
+};
@@ -0,0 +1,115 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "framepipeline.h"
+#include "picking.h"
+
+// Events the game can have queued for the render side before it drains them, more are dropped
+#define GAME_EVENT_QUEUE 64
+
+// The player's side of one frame: where the controllers point and what they ask for. RiftApp::draw fills it in,
+// the next updateScene() reads it.
+struct GameInput
+{
+	// The controllers' lasers, from the frame's TrackingSnapshot
+	PickRay rays[2] = { { glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f) }, { glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f) } };
+	bool triggers[2] = { false, false };
+	// Counts up with every reset asked for, so none is lost when the game only sees the newest input
+	uint32_t resetRequests = 0;
+};
+
+enum class GameEventKind : uint8_t {
+	// count molecules turned into O2
+	Conversion,
+	Won,
+	Lost,
+	// A new round started
+	Reset,
+	// Buzz the hand for seconds at amplitude
+	Vibration,
+	// One molecule turned into O2 at position, for the effect there
+	Burst,
+};
+
+struct GameEvent
+{
+	GameEventKind kind;
+	int hand;
+	uint32_t count;
+	float amplitude;
+	float seconds;
+	// World space, Burst only
+	glm::vec3 position;
+};
+
+// The hand off between the render side, which samples the player, and the game side, which runs the rules.
+//
+// Input goes one way a whole GameInput at a time through a TripleBuffer, so the game always plays the newest one and
+// neither side waits. What the game decided comes back as GameEvents through an SpscQueue, in order and each once,
+// and the render side keeps the outcome (won, lost) from them. Each side only calls its own half, which is what lets
+// the two run on different threads.
+class GameState
+{
+public:
+	GameState() {}
+
+	GameState(const GameState&) = delete;
+	GameState& operator=(const GameState&) = delete;
+
+	// Render side: this frame's input, for the game's next turn
+	void publishInput(const GameInput& input)
+	{
+		this->inputs.back() = input;
+		this->inputs.publish();
+	}
+
+	// Game side: the newest input, the one before again if nothing new was published
+	const GameInput& input()
+	{
+		this->inputs.acquire();
+		return this->inputs.front();
+	}
+
+	// Game side
+	void emit(const GameEvent& event)
+	{
+		// A queue this full means the render side stopped draining, the haptics it would miss don't matter then
+		this->events.push(event);
+	}
+
+	// Render side, one event at a time until false. Won, Lost and Reset also update won() and lost().
+	bool poll(GameEvent* event)
+	{
+		if (!this->events.pop(event))
+			return false;
+		switch (event->kind)
+		{
+		case GameEventKind::Won:
+			this->isWon = true;
+			break;
+		case GameEventKind::Lost:
+			this->isLost = true;
+			break;
+		case GameEventKind::Reset:
+			this->isWon = this->isLost = false;
+			break;
+		default:
+			break;
+		}
+		return true;
+	}
+
+	// Render side, as of the last event polled
+	bool won() const { return this->isWon; }
+	bool lost() const { return this->isLost; }
+
+private:
+	TripleBuffer<GameInput> inputs;
+	SpscQueue<GameEvent, GAME_EVENT_QUEUE> events;
+	bool isWon = false;
+	bool isLost = false;
+};
@@ -0,0 +1,1186 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "renderstats.h"
+
+// Layout of a GL capture. The file starts with a GLCaptureHeader, then each section in GLCaptureSection order as an
+// array of its structure, counts[] long, then the bytes every GLCaptureBlob points into. Objects refer to each other by
+// their index in a section, GL_CAPTURE_NONE for none.
+#define GL_CAPTURE_MAGIC 0x50414347u // "GCAP"
+#define GL_CAPTURE_VERSION 1
+#define GL_CAPTURE_NONE 0xFFFFFFFFu
+#define GL_CAPTURE_ATTRIBUTES 16
+#define GL_CAPTURE_COLOR_ATTACHMENTS 4
+// Buffers up to this size are read again at every draw that uses them, so what the frame writes between draws (instance
+// lists, indirect commands) comes along. Larger ones, the arena pages, are kept as they were when first drawn from.
+#define GL_CAPTURE_RECHECK_BYTES (256 * 1024)
+// Frame --capture-gl takes unless --capture-frame says otherwise, late enough for startup streaming to have settled
+#define GL_CAPTURE_DEFAULT_FRAME 300
+
+enum class GLCaptureSection : uint32_t {
+	Programs,
+	Attributes,
+	Blocks,
+	Uniforms,
+	Buffers,
+	Textures,
+	Levels,
+	Renderbuffers,
+	Framebuffers,
+	VertexArrays,
+	States,
+	Bindings,
+	Commands,
+	Blobs,
+	Count,
+};
+
+enum class GLCaptureKind : uint32_t {
+	DrawArrays,
+	DrawElements,
+	// One command or several out of indirectBuffer, drawCount says
+	DrawIndirect,
+	Clear,
+	Blit,
+};
+
+struct GLCaptureHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	// Of the default framebuffer, which the replay swaps for a target of its own
+	uint32_t width;
+	uint32_t height;
+	// Blob of the capturing driver's GL_RENDERER
+	uint32_t renderer;
+	uint32_t counts[(int)GLCaptureSection::Count];
+	uint64_t bytes;
+};
+
+struct GLCaptureBlob
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+// Sources are linked again by the replay, so a capture runs on any driver. Attribute locations, block bindings and
+// uniforms are looked up by name there.
+struct GLCaptureProgram
+{
+	uint32_t vertexSource;
+	uint32_t fragmentSource;
+	uint32_t firstAttribute;
+	uint32_t attributeCount;
+	uint32_t firstBlock;
+	uint32_t blockCount;
+	uint32_t firstUniform;
+	uint32_t uniformCount;
+	// 32 bit words a draw's uniforms blob holds, every uniform's elements in order
+	uint32_t uniformWords;
+};
+
+// An attribute's location or a block's binding, by name
+struct GLCaptureNamed
+{
+	uint32_t name;
+	int32_t value;
+};
+
+struct GLCaptureUniform
+{
+	uint32_t name;
+	uint32_t type;
+	int32_t size;
+	uint32_t firstWord;
+};
+
+// contents is the buffer as first drawn from, draws that find it changed carry an update
+struct GLCaptureBuffer
+{
+	uint32_t contents;
+	uint32_t reserved;
+	uint64_t size;
+};
+
+// firstLevel indexes Levels, a blob per level or GL_CAPTURE_NONE for targets the frame draws into. Cube maps keep their
+// six faces in one blob as layers. Buffer textures take buffer as their store.
+struct GLCaptureTexture
+{
+	uint32_t target;
+	uint32_t internalFormat;
+	int32_t width;
+	int32_t height;
+	// Layers of arrays, 6 for cube maps
+	int32_t depth;
+	int32_t levels;
+	int32_t samples;
+	uint32_t compressed;
+	uint32_t minFilter;
+	uint32_t magFilter;
+	uint32_t wrapS;
+	uint32_t wrapT;
+	uint32_t compareMode;
+	uint32_t compareFunc;
+	uint32_t firstLevel;
+	uint32_t buffer;
+};
+
+struct GLCaptureRenderbuffer
+{
+	uint32_t internalFormat;
+	int32_t width;
+	int32_t height;
+	int32_t samples;
+};
+
+struct GLCaptureAttachment
+{
+	// GL_NONE, GL_TEXTURE or GL_RENDERBUFFER
+	uint32_t type;
+	uint32_t object;
+	int32_t level;
+	// The layer of an array attached by layer, the first view of a multiview attachment
+	int32_t layer;
+	// 0 unless attached with glFramebufferTextureMultiviewOVR
+	int32_t views;
+};
+
+// A framebuffer as it was attached at the time, the eye targets have one of these per swap chain texture drawn to.
+// defaultFramebuffer is the window's.
+struct GLCaptureFramebuffer
+{
+	uint32_t defaultFramebuffer;
+	GLCaptureAttachment color[GL_CAPTURE_COLOR_ATTACHMENTS];
+	GLCaptureAttachment depth;
+	uint32_t drawBuffers[GL_CAPTURE_COLOR_ATTACHMENTS];
+	uint32_t readBuffer;
+};
+
+struct GLCaptureAttribute
+{
+	uint32_t enabled;
+	uint32_t buffer;
+	int32_t size;
+	uint32_t type;
+	uint32_t normalized;
+	uint32_t integer;
+	int32_t stride;
+	uint32_t divisor;
+	uint64_t offset;
+	// The generic value a disabled attribute the program reads has, as floats or as ints when currentInteger.
+	// currentSet is 0 for attributes nothing reads.
+	uint32_t current[4];
+	uint32_t currentInteger;
+	uint32_t currentSet;
+};
+
+struct GLCaptureVertexArray
+{
+	GLCaptureAttribute attributes[GL_CAPTURE_ATTRIBUTES];
+	uint32_t elementBuffer;
+	uint32_t reserved;
+};
+
+// Fixed function state a draw, clear or blit ran with
+struct GLCaptureState
+{
+	int32_t viewport[4];
+	int32_t scissor[4];
+	uint32_t scissorTest;
+	uint32_t depthTest;
+	uint32_t depthFunc;
+	uint32_t depthMask;
+	uint32_t blend;
+	uint32_t blendSource[2];
+	uint32_t blendDestination[2];
+	uint32_t cullFace;
+	uint32_t cullMode;
+	uint32_t frontFace;
+	uint32_t colorMask[4];
+	uint32_t srgb;
+	// GL_ZERO_TO_ONE under reversed depth, 0 where glClipControl isn't there
+	uint32_t clipDepth;
+	float clearColor[4];
+	float clearDepth;
+	float lineWidth;
+};
+
+// slot is a uniform block binding, a texture unit or a buffer; object a blob, a texture or a blob
+struct GLCaptureBinding
+{
+	uint32_t slot;
+	uint32_t object;
+	uint64_t offset;
+};
+
+struct GLCaptureCommand
+{
+	GLCaptureKind kind;
+	// The RenderPass and RenderEye it was counted under
+	uint32_t pass;
+	uint32_t eye;
+	uint32_t program;
+	uint32_t vertexArray;
+	uint32_t framebuffer;
+	uint32_t readFramebuffer;
+	uint32_t state;
+	// Blob of the program's uniforms, GLCaptureProgram::uniformWords long
+	uint32_t uniforms;
+	// Bindings: uniform blocks by binding, textures by unit, then buffers to bring up to date before the draw
+	uint32_t firstBlock;
+	uint32_t blockCount;
+	uint32_t firstTexture;
+	uint32_t textureCount;
+	uint32_t firstUpdate;
+	uint32_t updateCount;
+	uint32_t mode;
+	uint32_t type;
+	int32_t count;
+	int32_t instances;
+	// The first vertex of DrawArrays
+	int32_t baseVertex;
+	uint32_t baseInstance;
+	uint32_t indirectBuffer;
+	int32_t drawCount;
+	int32_t stride;
+	// Clears and blits
+	uint32_t mask;
+	uint32_t filter;
+	int32_t source[4];
+	int32_t destination[4];
+	// First index or indirect command, in bytes
+	uint64_t offset;
+};
+
+static_assert(sizeof(GLCaptureHeader) == 88 && sizeof(GLCaptureCommand) == 144, "GLCapture structures are written as they are");
+
+static uint64_t _glCaptureHash(const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+// The texture target a sampler of type reads, 0 if it isn't one
+static GLenum _glCaptureSamplerTarget(GLenum type)
+{
+	switch (type)
+	{
+	case GL_SAMPLER_2D: case GL_SAMPLER_2D_SHADOW: case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+		return GL_TEXTURE_2D;
+	case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_2D_ARRAY_SHADOW: case GL_INT_SAMPLER_2D_ARRAY: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+		return GL_TEXTURE_2D_ARRAY;
+	case GL_SAMPLER_3D: case GL_INT_SAMPLER_3D: case GL_UNSIGNED_INT_SAMPLER_3D:
+		return GL_TEXTURE_3D;
+	case GL_SAMPLER_CUBE: case GL_SAMPLER_CUBE_SHADOW: case GL_INT_SAMPLER_CUBE: case GL_UNSIGNED_INT_SAMPLER_CUBE:
+		return GL_TEXTURE_CUBE_MAP;
+	case GL_SAMPLER_BUFFER: case GL_INT_SAMPLER_BUFFER: case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+		return GL_TEXTURE_BUFFER;
+	case GL_SAMPLER_2D_MULTISAMPLE: case GL_INT_SAMPLER_2D_MULTISAMPLE: case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE:
+		return GL_TEXTURE_2D_MULTISAMPLE;
+	}
+	return 0;
+}
+
+// Components of one element of a uniform of type, 0 for types a capture doesn't carry. kind is GL_FLOAT, GL_INT or
+// GL_UNSIGNED_INT, as they are read and set; booleans and samplers go as ints.
+static int _glCaptureUniformComponents(GLenum type, GLenum* kind)
+{
+	*kind = GL_FLOAT;
+	switch (type)
+	{
+	case GL_FLOAT: return 1;
+	case GL_FLOAT_VEC2: return 2;
+	case GL_FLOAT_VEC3: return 3;
+	case GL_FLOAT_VEC4: return 4;
+	case GL_FLOAT_MAT2: return 4;
+	case GL_FLOAT_MAT3: return 9;
+	case GL_FLOAT_MAT4: return 16;
+	}
+	*kind = GL_UNSIGNED_INT;
+	switch (type)
+	{
+	case GL_UNSIGNED_INT: return 1;
+	case GL_UNSIGNED_INT_VEC2: return 2;
+	case GL_UNSIGNED_INT_VEC3: return 3;
+	case GL_UNSIGNED_INT_VEC4: return 4;
+	}
+	*kind = GL_INT;
+	switch (type)
+	{
+	case GL_INT: case GL_BOOL: return 1;
+	case GL_INT_VEC2: case GL_BOOL_VEC2: return 2;
+	case GL_INT_VEC3: case GL_BOOL_VEC3: return 3;
+	case GL_INT_VEC4: case GL_BOOL_VEC4: return 4;
+	}
+	return _glCaptureSamplerTarget(type) ? 1 : 0;
+}
+
+// What the texels of an uncompressed internalFormat are read and uploaded as. False for formats a capture doesn't
+// carry the contents of.
+static bool _glCapturePixelFormat(GLenum internalFormat, GLenum* format, GLenum* type, int* bytes)
+{
+	*type = GL_UNSIGNED_BYTE;
+	switch (internalFormat)
+	{
+	case GL_RGBA8: case GL_SRGB8_ALPHA8: case GL_RGB8: case GL_SRGB8:
+		*format = GL_RGBA; *bytes = 4; return true;
+	case GL_R8:
+		*format = GL_RED; *bytes = 1; return true;
+	case GL_RG8:
+		*format = GL_RG; *bytes = 2; return true;
+	case GL_R8UI:
+		*format = GL_RED_INTEGER; *bytes = 1; return true;
+	case GL_RGBA16F:
+		*format = GL_RGBA; *type = GL_HALF_FLOAT; *bytes = 8; return true;
+	case GL_RGBA32F:
+		*format = GL_RGBA; *type = GL_FLOAT; *bytes = 16; return true;
+	case GL_R32F:
+		*format = GL_RED; *type = GL_FLOAT; *bytes = 4; return true;
+	case GL_R11F_G11F_B10F:
+		*format = GL_RGB; *type = GL_UNSIGNED_INT_10F_11F_11F_REV; *bytes = 4; return true;
+	case GL_DEPTH_COMPONENT16: case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F:
+		*format = GL_DEPTH_COMPONENT; *type = GL_FLOAT; *bytes = 4; return true;
+	case GL_DEPTH24_STENCIL8:
+		*format = GL_DEPTH_STENCIL; *type = GL_UNSIGNED_INT_24_8; *bytes = 4; return true;
+	case GL_DEPTH32F_STENCIL8:
+		*format = GL_DEPTH_STENCIL; *type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV; *bytes = 8; return true;
+	}
+	return false;
+}
+
+// Records one frame of what the render thread draws as a GLCapture, for --replay-gl to draw again without the game.
+//
+// The draw paths call the hook of their GL call right after it, clear() and blit() likewise. Nothing of the calls
+// themselves is kept; at each draw the capture reads back the state the draw ran with: program, default block
+// uniforms, uniform block ranges, vertex array, textures, framebuffer and fixed function state, along with the
+// contents of every buffer and texture it reads. What the frame wrote with the GPU itself (pre-skinned avatars,
+// molecule culling) comes along as data, so the replay draws exactly what the headset saw and skips making it.
+// Bindless handles can't be carried, --capture-gl turns them off.
+//
+// Readback uses GL_ARB_direct_state_access, so nothing the state cache shadows gets rebound. Only the frame the capture
+// was asked for pays for any of it, the hooks return straight away on every other.
+class GLCapture
+{
+public:
+	GLCapture() {}
+
+	GLCapture(const GLCapture&) = delete;
+	GLCapture& operator=(const GLCapture&) = delete;
+
+	// Before the context exists, so program sources are kept from the first build on
+	void request(const char* path, uint64_t frame)
+	{
+		this->path = path;
+		this->frame = frame;
+		this->requested = true;
+	}
+	bool isRequested() const { return this->requested; }
+	bool recording() const { return this->active; }
+
+	// Every program the frame may draw with has to come through here when it is linked
+	void programSources(GLuint program, const char* vertexSource, const char* fragmentSource)
+	{
+		if (!this->requested || !program)
+			return;
+		Sources& sources = this->sources[program];
+		sources.vertex = vertexSource;
+		sources.fragment = fragmentSource;
+	}
+
+	// Around draw(), width and height the default framebuffer's
+	void beginFrame(uint64_t frame, int width, int height)
+	{
+		if (!this->requested || frame != this->frame)
+			return;
+		if (!GLEW_ARB_direct_state_access)
+		{
+			std::cout << "ERROR::GL_CAPTURE::NO_DIRECT_STATE_ACCESS" << std::endl;
+			this->requested = false;
+			return;
+		}
+		this->header = GLCaptureHeader();
+		this->header.magic = GL_CAPTURE_MAGIC;
+		this->header.version = GL_CAPTURE_VERSION;
+		this->header.width = (uint32_t)width;
+		this->header.height = (uint32_t)height;
+		const char* renderer = (const char*)glGetString(GL_RENDERER);
+		this->header.renderer = this->addBlob(renderer, renderer ? strlen(renderer) : 0);
+		glGetIntegerv(GL_PACK_ALIGNMENT, &this->packAlignment);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		this->active = true;
+	}
+
+	void endFrame()
+	{
+		if (!this->active)
+			return;
+		this->active = false;
+		this->requested = false;
+		glPixelStorei(GL_PACK_ALIGNMENT, this->packAlignment);
+		if (this->write())
+			printf("GL capture: %u commands, %u skipped, %llu KB to %s\r\n", (uint32_t)this->commands.size(), this->skipped,
+				(unsigned long long)(this->bytes.size() / 1024), this->path.c_str());
+		this->release();
+	}
+
+	void drawArrays(GLenum mode, GLint first, GLsizei count, GLsizei instances = 1, GLuint baseInstance = 0)
+	{
+		if (!this->active)
+			return;
+		GLCaptureCommand command = this->command(GLCaptureKind::DrawArrays);
+		command.mode = mode;
+		command.baseVertex = first;
+		command.count = count;
+		command.instances = instances;
+		command.baseInstance = baseInstance;
+		this->draw(command);
+	}
+
+	// offset in bytes into the element buffer, as the draw call has it
+	void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* offset, GLsizei instances = 1, GLint baseVertex = 0,
+		GLuint baseInstance = 0)
+	{
+		if (!this->active)
+			return;
+		GLCaptureCommand command = this->command(GLCaptureKind::DrawElements);
+		command.mode = mode;
+		command.count = count;
+		command.type = type;
+		command.offset = (uint64_t)(uintptr_t)offset;
+		command.instances = instances;
+		command.baseVertex = baseVertex;
+		command.baseInstance = baseInstance;
+		this->draw(command);
+	}
+
+	void drawElementsIndirect(GLenum mode, GLenum type, const GLvoid* offset, GLsizei drawCount = 1, GLsizei stride = 0)
+	{
+		if (!this->active)
+			return;
+		GLCaptureCommand command = this->command(GLCaptureKind::DrawIndirect);
+		command.mode = mode;
+		command.type = type;
+		command.offset = (uint64_t)(uintptr_t)offset;
+		command.drawCount = drawCount;
+		command.stride = stride;
+		GLint indirect = 0;
+		glGetIntegerv(GL_DRAW_INDIRECT_BUFFER_BINDING, &indirect);
+		command.indirectBuffer = this->buffer((GLuint)indirect);
+		this->draw(command);
+	}
+
+	void clear(GLbitfield mask)
+	{
+		if (!this->active)
+			return;
+		GLCaptureCommand command = this->command(GLCaptureKind::Clear);
+		command.mask = mask;
+		this->commands.push_back(command);
+	}
+
+	void blit(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1,
+		GLbitfield mask, GLenum filter)
+	{
+		if (!this->active)
+			return;
+		GLCaptureCommand command = this->command(GLCaptureKind::Blit);
+		command.readFramebuffer = this->framebuffer(GL_READ_FRAMEBUFFER);
+		const int32_t source[4] = { srcX0, srcY0, srcX1, srcY1 }, destination[4] = { dstX0, dstY0, dstX1, dstY1 };
+		memcpy(command.source, source, sizeof(source));
+		memcpy(command.destination, destination, sizeof(destination));
+		command.mask = mask;
+		command.filter = filter;
+		this->commands.push_back(command);
+	}
+
+private:
+	struct Sources
+	{
+		std::string vertex;
+		std::string fragment;
+	};
+
+	// What the capture needs of a program beyond what goes in the file
+	struct ProgramInfo
+	{
+		uint32_t index = GL_CAPTURE_NONE;
+		// Per uniform element, in blob order
+		vector<GLint> locations;
+		vector<int> components;
+		vector<GLenum> kinds;
+		// Per uniform element that is a sampler, its target and where in the blob its unit is
+		vector<GLenum> samplerTargets;
+		vector<uint32_t> samplerWords;
+		// Per active block, its binding and how much of the bound range it reads
+		vector<GLuint> blockBindings;
+		vector<GLint> blockSizes;
+		// Per active attribute, its location and whether it is read as ints
+		vector<GLint> attributeLocations;
+		vector<bool> attributeIntegers;
+	};
+
+	std::string path;
+	uint64_t frame = 0;
+	bool requested = false;
+	bool active = false;
+	GLint packAlignment = 4;
+	std::unordered_map<GLuint, Sources> sources;
+
+	GLCaptureHeader header;
+	vector<GLCaptureProgram> programs;
+	vector<GLCaptureNamed> attributes;
+	vector<GLCaptureNamed> blocks;
+	vector<GLCaptureUniform> uniforms;
+	vector<GLCaptureBuffer> buffers;
+	vector<GLCaptureTexture> textures;
+	vector<uint32_t> levels;
+	vector<GLCaptureRenderbuffer> renderbuffers;
+	vector<GLCaptureFramebuffer> framebuffers;
+	vector<GLCaptureVertexArray> vertexArrays;
+	vector<GLCaptureState> states;
+	vector<GLCaptureBinding> bindings;
+	vector<GLCaptureCommand> commands;
+	vector<GLCaptureBlob> blobs;
+	vector<uint8_t> bytes;
+	// Blob by hash, so the same contents are stored once however often they are drawn from
+	std::unordered_multimap<uint64_t, uint32_t> blobsByHash;
+	std::unordered_map<GLuint, ProgramInfo> programInfo;
+	std::unordered_map<GLuint, uint32_t> bufferIndex;
+	std::unordered_map<GLuint, uint32_t> textureIndex;
+	std::unordered_map<GLuint, uint32_t> renderbufferIndex;
+	// Per buffer, its GL name and the blob a replay has in it at this point of the frame
+	vector<GLuint> bufferNames;
+	vector<uint32_t> bufferContents;
+	uint32_t skipped = 0;
+	// Per draw, gathered before they go into bindings
+	vector<GLCaptureBinding> drawBlocks;
+	vector<GLCaptureBinding> drawTextures;
+	vector<GLCaptureBinding> drawUpdates;
+	vector<uint8_t> scratch;
+	vector<uint32_t> words;
+
+	GLCaptureCommand command(GLCaptureKind kind)
+	{
+		GLCaptureCommand command;
+		memset(&command, 0, sizeof(command));
+		command.kind = kind;
+		command.pass = (uint32_t)_renderStats.currentPass();
+		command.eye = (uint32_t)_renderStats.currentEye();
+		command.program = command.vertexArray = command.readFramebuffer = command.uniforms = command.indirectBuffer = GL_CAPTURE_NONE;
+		command.framebuffer = this->framebuffer(GL_DRAW_FRAMEBUFFER);
+		command.state = this->state();
+		return command;
+	}
+
+	void draw(GLCaptureCommand& command)
+	{
+		// Whatever compute wrote has to have landed before it is read back
+		if (GLEW_ARB_shader_image_load_store)
+			glMemoryBarrier(GL_ALL_BARRIER_BITS);
+		GLint current = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+		ProgramInfo* program = this->program((GLuint)current);
+		if (!program)
+		{
+			this->skipped++;
+			return;
+		}
+		command.program = program->index;
+		this->drawBlocks.clear();
+		this->drawTextures.clear();
+		this->drawUpdates.clear();
+
+		// Default block uniforms, the samplers' units among them
+		this->words.assign(this->programs[program->index].uniformWords, 0);
+		uint32_t word = 0;
+		for (size_t i = 0; i < program->locations.size(); i++)
+		{
+			uint32_t* values = this->words.data() + word;
+			if (program->kinds[i] == GL_FLOAT)
+				glGetUniformfv((GLuint)current, program->locations[i], (GLfloat*)values);
+			else if (program->kinds[i] == GL_INT)
+				glGetUniformiv((GLuint)current, program->locations[i], (GLint*)values);
+			else
+				glGetUniformuiv((GLuint)current, program->locations[i], (GLuint*)values);
+			word += (uint32_t)program->components[i];
+		}
+		command.uniforms = this->addBlob(this->words.data(), this->words.size() * sizeof(uint32_t));
+
+		for (size_t i = 0; i < program->blockBindings.size(); i++)
+			this->uniformBlock(program->blockBindings[i], program->blockSizes[i]);
+		this->samplers(*program);
+		command.vertexArray = this->vertexArray(*program, command);
+		if (command.indirectBuffer != GL_CAPTURE_NONE)
+			this->recheck(command.indirectBuffer);
+
+		command.firstBlock = (uint32_t)this->bindings.size();
+		command.blockCount = (uint32_t)this->drawBlocks.size();
+		this->bindings.insert(this->bindings.end(), this->drawBlocks.begin(), this->drawBlocks.end());
+		command.firstTexture = (uint32_t)this->bindings.size();
+		command.textureCount = (uint32_t)this->drawTextures.size();
+		this->bindings.insert(this->bindings.end(), this->drawTextures.begin(), this->drawTextures.end());
+		command.firstUpdate = (uint32_t)this->bindings.size();
+		command.updateCount = (uint32_t)this->drawUpdates.size();
+		this->bindings.insert(this->bindings.end(), this->drawUpdates.begin(), this->drawUpdates.end());
+		this->commands.push_back(command);
+	}
+
+	// Null for programs whose sources never came through programSources()
+	ProgramInfo* program(GLuint name)
+	{
+		auto known = this->programInfo.find(name);
+		if (known != this->programInfo.end())
+			return &known->second;
+		auto sources = this->sources.find(name);
+		if (!name || sources == this->sources.end())
+			return nullptr;
+
+		ProgramInfo& info = this->programInfo[name];
+		GLCaptureProgram program;
+		memset(&program, 0, sizeof(program));
+		program.vertexSource = this->addBlob(sources->second.vertex.data(), sources->second.vertex.size());
+		program.fragmentSource = this->addBlob(sources->second.fragment.data(), sources->second.fragment.size());
+		char text[256];
+		GLint count = 0, size = 0;
+		GLenum type = 0;
+
+		program.firstAttribute = (uint32_t)this->attributes.size();
+		glGetProgramiv(name, GL_ACTIVE_ATTRIBUTES, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			glGetActiveAttrib(name, (GLuint)i, sizeof(text), NULL, &size, &type, text);
+			const GLint location = glGetAttribLocation(name, text);
+			if (location < 0)
+				continue;
+			this->attributes.push_back(GLCaptureNamed{ this->addBlob(text, strlen(text)), location });
+			GLenum kind;
+			_glCaptureUniformComponents(type, &kind);
+			info.attributeLocations.push_back(location);
+			info.attributeIntegers.push_back(kind != GL_FLOAT);
+		}
+		program.attributeCount = (uint32_t)this->attributes.size() - program.firstAttribute;
+
+		program.firstBlock = (uint32_t)this->blocks.size();
+		glGetProgramiv(name, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLint binding = 0, dataSize = 0;
+			glGetActiveUniformBlockName(name, (GLuint)i, sizeof(text), NULL, text);
+			glGetActiveUniformBlockiv(name, (GLuint)i, GL_UNIFORM_BLOCK_BINDING, &binding);
+			glGetActiveUniformBlockiv(name, (GLuint)i, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+			this->blocks.push_back(GLCaptureNamed{ this->addBlob(text, strlen(text)), binding });
+			info.blockBindings.push_back((GLuint)binding);
+			info.blockSizes.push_back(dataSize);
+		}
+		program.blockCount = (uint32_t)this->blocks.size() - program.firstBlock;
+
+		program.firstUniform = (uint32_t)this->uniforms.size();
+		glGetProgramiv(name, GL_ACTIVE_UNIFORMS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			const GLuint index = (GLuint)i;
+			GLint block = -1;
+			glGetActiveUniformsiv(name, 1, &index, GL_UNIFORM_BLOCK_INDEX, &block);
+			glGetActiveUniform(name, index, sizeof(text), NULL, &size, &type, text);
+			GLenum kind;
+			const int components = _glCaptureUniformComponents(type, &kind);
+			if (block >= 0 || !components || !strncmp(text, "gl_", 3))
+				continue;
+			// Arrays are listed as their first element, the rest are found by index
+			std::string base = text;
+			if (base.size() > 3 && !base.compare(base.size() - 3, 3, "[0]"))
+				base.resize(base.size() - 3);
+			GLCaptureUniform uniform = { this->addBlob(base.data(), base.size()), type, size, program.uniformWords };
+			for (GLint element = 0; element < size; element++)
+			{
+				const std::string elementName = size > 1 ? base + "[" + std::to_string(element) + "]" : base;
+				if (_glCaptureSamplerTarget(type))
+				{
+					info.samplerTargets.push_back(_glCaptureSamplerTarget(type));
+					info.samplerWords.push_back(program.uniformWords);
+				}
+				info.locations.push_back(glGetUniformLocation(name, elementName.c_str()));
+				info.components.push_back(components);
+				info.kinds.push_back(kind);
+				program.uniformWords += (uint32_t)components;
+			}
+			this->uniforms.push_back(uniform);
+		}
+		program.uniformCount = (uint32_t)this->uniforms.size() - program.firstUniform;
+
+		info.index = (uint32_t)this->programs.size();
+		this->programs.push_back(program);
+		return &info;
+	}
+
+	void uniformBlock(GLuint binding, GLint dataSize)
+	{
+		GLint name = 0;
+		GLint64 start = 0, size = 0;
+		glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, binding, &name);
+		glGetInteger64i_v(GL_UNIFORM_BUFFER_START, binding, &start);
+		glGetInteger64i_v(GL_UNIFORM_BUFFER_SIZE, binding, &size);
+		if (!name)
+			return;
+		// glBindBufferBase leaves the size 0, the block reads from the start then
+		if (!size)
+		{
+			glGetNamedBufferParameteri64v((GLuint)name, GL_BUFFER_SIZE, &size);
+			size -= start;
+		}
+		size = std::min<GLint64>(size, dataSize);
+		this->scratch.resize((size_t)size);
+		glGetNamedBufferSubData((GLuint)name, (GLintptr)start, (GLsizeiptr)size, this->scratch.data());
+		this->drawBlocks.push_back(GLCaptureBinding{ binding, this->addBlob(this->scratch.data(), this->scratch.size()), 0 });
+	}
+
+	// The textures the program's samplers read, looked up unit by unit on the active texture the state cache left
+	void samplers(const ProgramInfo& program)
+	{
+		if (program.samplerTargets.empty())
+			return;
+		const uint32_t* values = this->words.data();
+		GLint active = GL_TEXTURE0;
+		glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+		for (size_t i = 0; i < program.samplerTargets.size(); i++)
+		{
+			const GLenum target = program.samplerTargets[i];
+			const GLuint unit = values[program.samplerWords[i]];
+			GLenum binding = GL_TEXTURE_BINDING_2D;
+			switch (target)
+			{
+			case GL_TEXTURE_2D_ARRAY: binding = GL_TEXTURE_BINDING_2D_ARRAY; break;
+			case GL_TEXTURE_3D: binding = GL_TEXTURE_BINDING_3D; break;
+			case GL_TEXTURE_CUBE_MAP: binding = GL_TEXTURE_BINDING_CUBE_MAP; break;
+			case GL_TEXTURE_BUFFER: binding = GL_TEXTURE_BINDING_BUFFER; break;
+			case GL_TEXTURE_2D_MULTISAMPLE: binding = GL_TEXTURE_BINDING_2D_MULTISAMPLE; break;
+			}
+			GLint name = 0;
+			glActiveTexture(GL_TEXTURE0 + unit);
+			glGetIntegerv(binding, &name);
+			if (!name)
+				continue;
+			const uint32_t texture = this->texture((GLuint)name, false);
+			if (texture == GL_CAPTURE_NONE)
+				continue;
+			if (this->textures[texture].buffer != GL_CAPTURE_NONE)
+				this->recheck(this->textures[texture].buffer);
+			this->drawTextures.push_back(GLCaptureBinding{ unit, texture, 0 });
+		}
+		glActiveTexture((GLenum)active);
+	}
+
+	uint32_t vertexArray(const ProgramInfo& program, GLCaptureCommand& command)
+	{
+		GLCaptureVertexArray vertexArray;
+		memset(&vertexArray, 0, sizeof(vertexArray));
+		for (GLuint i = 0; i < GL_CAPTURE_ATTRIBUTES; i++)
+		{
+			GLCaptureAttribute& attribute = vertexArray.attributes[i];
+			attribute.buffer = GL_CAPTURE_NONE;
+			GLint value = 0;
+			glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &value);
+			attribute.enabled = value != 0;
+			if (!attribute.enabled)
+				continue;
+			glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &value);
+			attribute.buffer = this->buffer((GLuint)value);
+			if (attribute.buffer != GL_CAPTURE_NONE)
+				this->recheck(attribute.buffer);
+			glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_SIZE, &attribute.size);
+			glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_TYPE, &value);
+			attribute.type = (uint32_t)value;
+			glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED, &value);
+			attribute.normalized = value != 0;
+			glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_INTEGER, &value);
+			attribute.integer = value != 0;
+			glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &attribute.stride);
+			glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_DIVISOR, &value);
+			attribute.divisor = (uint32_t)value;
+			GLvoid* pointer = nullptr;
+			glGetVertexAttribPointerv(i, GL_VERTEX_ATTRIB_ARRAY_POINTER, &pointer);
+			attribute.offset = (uint64_t)(uintptr_t)pointer;
+		}
+		// Attributes the program reads with no array behind them take the current generic value
+		for (size_t i = 0; i < program.attributeLocations.size(); i++)
+		{
+			const GLint location = program.attributeLocations[i];
+			if (location >= GL_CAPTURE_ATTRIBUTES || vertexArray.attributes[location].enabled)
+				continue;
+			GLCaptureAttribute& attribute = vertexArray.attributes[location];
+			attribute.currentSet = 1;
+			attribute.currentInteger = program.attributeIntegers[i];
+			if (attribute.currentInteger)
+				glGetVertexAttribIiv((GLuint)location, GL_CURRENT_VERTEX_ATTRIB, (GLint*)attribute.current);
+			else
+				glGetVertexAttribfv((GLuint)location, GL_CURRENT_VERTEX_ATTRIB, (GLfloat*)attribute.current);
+		}
+		GLint elements = 0;
+		glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &elements);
+		vertexArray.elementBuffer = this->buffer((GLuint)elements);
+		if (command.kind != GLCaptureKind::DrawArrays && vertexArray.elementBuffer != GL_CAPTURE_NONE)
+			this->recheck(vertexArray.elementBuffer);
+		return this->find(this->vertexArrays, vertexArray);
+	}
+
+	// Index of buffer name, read in full the first time it is drawn from
+	uint32_t buffer(GLuint name)
+	{
+		if (!name)
+			return GL_CAPTURE_NONE;
+		auto known = this->bufferIndex.find(name);
+		if (known != this->bufferIndex.end())
+			return known->second;
+		GLCaptureBuffer buffer;
+		memset(&buffer, 0, sizeof(buffer));
+		GLint64 size = 0;
+		glGetNamedBufferParameteri64v(name, GL_BUFFER_SIZE, &size);
+		buffer.size = (uint64_t)size;
+		buffer.contents = this->readBuffer(name, buffer.size);
+		const uint32_t index = (uint32_t)this->buffers.size();
+		this->buffers.push_back(buffer);
+		this->bufferNames.push_back(name);
+		this->bufferContents.push_back(buffer.contents);
+		this->bufferIndex[name] = index;
+		return index;
+	}
+
+	// Reads a small buffer once more and has the draw bring the replay's copy up to date if it changed
+	void recheck(uint32_t index)
+	{
+		if (this->buffers[index].size > GL_CAPTURE_RECHECK_BYTES)
+			return;
+		const uint32_t contents = this->readBuffer(this->bufferNames[index], this->buffers[index].size);
+		if (contents != this->bufferContents[index])
+		{
+			this->bufferContents[index] = contents;
+			this->drawUpdates.push_back(GLCaptureBinding{ index, contents, 0 });
+		}
+	}
+
+	uint32_t readBuffer(GLuint name, uint64_t size)
+	{
+		this->scratch.resize((size_t)size);
+		if (size)
+			glGetNamedBufferSubData(name, 0, (GLsizeiptr)size, this->scratch.data());
+		return this->addBlob(this->scratch.data(), this->scratch.size());
+	}
+
+	// Index of texture name; attached is whether a framebuffer refers to it, its contents only matter to a sampler
+	uint32_t texture(GLuint name, bool attached)
+	{
+		auto known = this->textureIndex.find(name);
+		if (known != this->textureIndex.end())
+			return known->second;
+		GLCaptureTexture texture;
+		memset(&texture, 0, sizeof(texture));
+		GLint value = 0;
+		glGetTextureParameteriv(name, GL_TEXTURE_TARGET, &value);
+		texture.target = (uint32_t)value;
+		texture.buffer = GL_CAPTURE_NONE;
+		glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_INTERNAL_FORMAT, &value);
+		texture.internalFormat = (uint32_t)value;
+		glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_WIDTH, &texture.width);
+		glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_HEIGHT, &texture.height);
+		glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_DEPTH, &texture.depth);
+		glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_SAMPLES, &texture.samples);
+		glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_COMPRESSED, &value);
+		texture.compressed = value != 0;
+		texture.firstLevel = (uint32_t)this->levels.size();
+
+		switch (texture.target)
+		{
+		case GL_TEXTURE_BUFFER:
+			glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_BUFFER_DATA_STORE_BINDING, &value);
+			texture.buffer = this->buffer((GLuint)value);
+			texture.levels = 0;
+			break;
+		case GL_TEXTURE_2D:
+		case GL_TEXTURE_2D_ARRAY:
+		case GL_TEXTURE_3D:
+		case GL_TEXTURE_CUBE_MAP:
+		case GL_TEXTURE_2D_MULTISAMPLE:
+			if (texture.target == GL_TEXTURE_CUBE_MAP)
+				texture.depth = 6;
+			glGetTextureParameteriv(name, GL_TEXTURE_MIN_FILTER, &value);
+			texture.minFilter = (uint32_t)value;
+			glGetTextureParameteriv(name, GL_TEXTURE_MAG_FILTER, &value);
+			texture.magFilter = (uint32_t)value;
+			glGetTextureParameteriv(name, GL_TEXTURE_WRAP_S, &value);
+			texture.wrapS = (uint32_t)value;
+			glGetTextureParameteriv(name, GL_TEXTURE_WRAP_T, &value);
+			texture.wrapT = (uint32_t)value;
+			glGetTextureParameteriv(name, GL_TEXTURE_COMPARE_MODE, &value);
+			texture.compareMode = (uint32_t)value;
+			glGetTextureParameteriv(name, GL_TEXTURE_COMPARE_FUNC, &value);
+			texture.compareFunc = (uint32_t)value;
+			for (GLint level = 0; level < 16; level++)
+			{
+				GLint width = 0;
+				glGetTextureLevelParameteriv(name, level, GL_TEXTURE_WIDTH, &width);
+				if (!width)
+					break;
+				texture.levels++;
+				this->levels.push_back(attached || texture.samples > 0 ? GL_CAPTURE_NONE : this->readLevel(name, texture, level));
+			}
+			break;
+		default:
+			std::cout << "ERROR::GL_CAPTURE::TEXTURE_TARGET " << texture.target << std::endl;
+			return GL_CAPTURE_NONE;
+		}
+		const uint32_t index = (uint32_t)this->textures.size();
+		this->textures.push_back(texture);
+		this->textureIndex[name] = index;
+		return index;
+	}
+
+	uint32_t readLevel(GLuint name, const GLCaptureTexture& texture, GLint level)
+	{
+		GLint size = 0;
+		if (texture.compressed)
+		{
+			glGetTextureLevelParameteriv(name, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+			this->scratch.resize((size_t)size);
+			glGetCompressedTextureImage(name, level, size, this->scratch.data());
+			return this->addBlob(this->scratch.data(), this->scratch.size());
+		}
+		GLenum format, type;
+		int texel;
+		if (!_glCapturePixelFormat(texture.internalFormat, &format, &type, &texel))
+			return GL_CAPTURE_NONE;
+		GLint width = 0, height = 0, depth = 0;
+		glGetTextureLevelParameteriv(name, level, GL_TEXTURE_WIDTH, &width);
+		glGetTextureLevelParameteriv(name, level, GL_TEXTURE_HEIGHT, &height);
+		glGetTextureLevelParameteriv(name, level, GL_TEXTURE_DEPTH, &depth);
+		if (texture.target == GL_TEXTURE_CUBE_MAP)
+			depth = 6;
+		size = width * height * std::max(depth, 1) * texel;
+		this->scratch.resize((size_t)size);
+		glGetTextureImage(name, level, format, type, size, this->scratch.data());
+		return this->addBlob(this->scratch.data(), this->scratch.size());
+	}
+
+	uint32_t renderbuffer(GLuint name)
+	{
+		auto known = this->renderbufferIndex.find(name);
+		if (known != this->renderbufferIndex.end())
+			return known->second;
+		GLCaptureRenderbuffer renderbuffer;
+		GLint value = 0;
+		glGetNamedRenderbufferParameteriv(name, GL_RENDERBUFFER_INTERNAL_FORMAT, &value);
+		renderbuffer.internalFormat = (uint32_t)value;
+		glGetNamedRenderbufferParameteriv(name, GL_RENDERBUFFER_WIDTH, &renderbuffer.width);
+		glGetNamedRenderbufferParameteriv(name, GL_RENDERBUFFER_HEIGHT, &renderbuffer.height);
+		glGetNamedRenderbufferParameteriv(name, GL_RENDERBUFFER_SAMPLES, &renderbuffer.samples);
+		const uint32_t index = (uint32_t)this->renderbuffers.size();
+		this->renderbuffers.push_back(renderbuffer);
+		this->renderbufferIndex[name] = index;
+		return index;
+	}
+
+	// The framebuffer bound to target as it is attached now
+	uint32_t framebuffer(GLenum target)
+	{
+		GLCaptureFramebuffer framebuffer;
+		memset(&framebuffer, 0, sizeof(framebuffer));
+		GLint name = 0;
+		glGetIntegerv(target == GL_READ_FRAMEBUFFER ? GL_READ_FRAMEBUFFER_BINDING : GL_DRAW_FRAMEBUFFER_BINDING, &name);
+		if (!name)
+		{
+			framebuffer.defaultFramebuffer = 1;
+			return this->find(this->framebuffers, framebuffer);
+		}
+		for (int i = 0; i <= GL_CAPTURE_COLOR_ATTACHMENTS; i++)
+		{
+			const GLenum point = i < GL_CAPTURE_COLOR_ATTACHMENTS ? GL_COLOR_ATTACHMENT0 + i : GL_DEPTH_ATTACHMENT;
+			GLCaptureAttachment& attachment = i < GL_CAPTURE_COLOR_ATTACHMENTS ? framebuffer.color[i] : framebuffer.depth;
+			GLint type = GL_NONE, object = 0;
+			glGetFramebufferAttachmentParameteriv(target, point, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+			if (type != GL_TEXTURE && type != GL_RENDERBUFFER)
+				continue;
+			glGetFramebufferAttachmentParameteriv(target, point, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &object);
+			attachment.type = (uint32_t)type;
+			if (type == GL_RENDERBUFFER)
+			{
+				attachment.object = this->renderbuffer((GLuint)object);
+				continue;
+			}
+			attachment.object = this->texture((GLuint)object, true);
+			glGetFramebufferAttachmentParameteriv(target, point, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_LEVEL, &attachment.level);
+			glGetFramebufferAttachmentParameteriv(target, point, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_LAYER, &attachment.layer);
+			if (GLEW_OVR_multiview)
+			{
+				glGetFramebufferAttachmentParameteriv(target, point, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_NUM_VIEWS_OVR, &attachment.views);
+				if (attachment.views)
+					glGetFramebufferAttachmentParameteriv(target, point, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_BASE_VIEW_INDEX_OVR, &attachment.layer);
+			}
+		}
+		for (int i = 0; i < GL_CAPTURE_COLOR_ATTACHMENTS; i++)
+		{
+			GLint buffer = GL_NONE;
+			glGetIntegerv(GL_DRAW_BUFFER0 + i, &buffer);
+			framebuffer.drawBuffers[i] = (uint32_t)buffer;
+		}
+		GLint readBuffer = GL_NONE;
+		glGetIntegerv(GL_READ_BUFFER, &readBuffer);
+		framebuffer.readBuffer = (uint32_t)readBuffer;
+		return this->find(this->framebuffers, framebuffer);
+	}
+
+	uint32_t state()
+	{
+		GLCaptureState state;
+		memset(&state, 0, sizeof(state));
+		GLint value = 0;
+		GLboolean mask[4];
+		glGetIntegerv(GL_VIEWPORT, state.viewport);
+		glGetIntegerv(GL_SCISSOR_BOX, state.scissor);
+		state.scissorTest = glIsEnabled(GL_SCISSOR_TEST);
+		state.depthTest = glIsEnabled(GL_DEPTH_TEST);
+		glGetIntegerv(GL_DEPTH_FUNC, &value);
+		state.depthFunc = (uint32_t)value;
+		glGetBooleanv(GL_DEPTH_WRITEMASK, mask);
+		state.depthMask = mask[0];
+		state.blend = glIsEnabled(GL_BLEND);
+		glGetIntegerv(GL_BLEND_SRC_RGB, (GLint*)&state.blendSource[0]);
+		glGetIntegerv(GL_BLEND_SRC_ALPHA, (GLint*)&state.blendSource[1]);
+		glGetIntegerv(GL_BLEND_DST_RGB, (GLint*)&state.blendDestination[0]);
+		glGetIntegerv(GL_BLEND_DST_ALPHA, (GLint*)&state.blendDestination[1]);
+		state.cullFace = glIsEnabled(GL_CULL_FACE);
+		glGetIntegerv(GL_CULL_FACE_MODE, &value);
+		state.cullMode = (uint32_t)value;
+		glGetIntegerv(GL_FRONT_FACE, &value);
+		state.frontFace = (uint32_t)value;
+		glGetBooleanv(GL_COLOR_WRITEMASK, mask);
+		for (int i = 0; i < 4; i++)
+			state.colorMask[i] = mask[i];
+		state.srgb = glIsEnabled(GL_FRAMEBUFFER_SRGB);
+		if (GLEW_ARB_clip_control)
+		{
+			glGetIntegerv(GL_CLIP_DEPTH_MODE, &value);
+			state.clipDepth = (uint32_t)value;
+		}
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, state.clearColor);
+		glGetFloatv(GL_DEPTH_CLEAR_VALUE, &state.clearDepth);
+		glGetFloatv(GL_LINE_WIDTH, &state.lineWidth);
+		return this->find(this->states, state);
+	}
+
+	// Index of value in list, appended if it isn't there yet. For the few dozen distinct states and targets a frame has.
+	template <typename T>
+	static uint32_t find(vector<T>& list, const T& value)
+	{
+		for (size_t i = 0; i < list.size(); i++)
+		{
+			if (!memcmp(&list[i], &value, sizeof(T)))
+				return (uint32_t)i;
+		}
+		list.push_back(value);
+		return (uint32_t)list.size() - 1;
+	}
+
+	uint32_t addBlob(const void* data, size_t size)
+	{
+		const uint64_t hash = _glCaptureHash(data, size);
+		auto range = this->blobsByHash.equal_range(hash);
+		for (auto candidate = range.first; candidate != range.second; ++candidate)
+		{
+			const GLCaptureBlob& blob = this->blobs[candidate->second];
+			if (blob.size == size && (!size || !memcmp(this->bytes.data() + blob.offset, data, size)))
+				return candidate->second;
+		}
+		const GLCaptureBlob blob = { (uint64_t)this->bytes.size(), (uint64_t)size };
+		this->bytes.insert(this->bytes.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+		// Padded, so every blob starts 8 aligned in the file
+		this->bytes.resize((this->bytes.size() + 7) & ~(size_t)7);
+		const uint32_t index = (uint32_t)this->blobs.size();
+		this->blobs.push_back(blob);
+		this->blobsByHash.insert(std::make_pair(hash, index));
+		return index;
+	}
+
+	template <typename T>
+	void writeSection(FILE* file, GLCaptureSection section, const vector<T>& list)
+	{
+		this->header.counts[(int)section] = (uint32_t)list.size();
+		if (!list.empty())
+			fwrite(list.data(), sizeof(T), list.size(), file);
+	}
+
+	bool write()
+	{
+		FILE* file = fopen(this->path.c_str(), "wb");
+		if (!file)
+		{
+			std::cout << "ERROR::GL_CAPTURE::NOT_OPENED " << this->path << std::endl;
+			return false;
+		}
+		// Counts are filled in as the sections go out, the header is written again once they are known
+		fwrite(&this->header, sizeof(this->header), 1, file);
+		this->writeSection(file, GLCaptureSection::Programs, this->programs);
+		this->writeSection(file, GLCaptureSection::Attributes, this->attributes);
+		this->writeSection(file, GLCaptureSection::Blocks, this->blocks);
+		this->writeSection(file, GLCaptureSection::Uniforms, this->uniforms);
+		this->writeSection(file, GLCaptureSection::Buffers, this->buffers);
+		this->writeSection(file, GLCaptureSection::Textures, this->textures);
+		this->writeSection(file, GLCaptureSection::Levels, this->levels);
+		this->writeSection(file, GLCaptureSection::Renderbuffers, this->renderbuffers);
+		this->writeSection(file, GLCaptureSection::Framebuffers, this->framebuffers);
+		this->writeSection(file, GLCaptureSection::VertexArrays, this->vertexArrays);
+		this->writeSection(file, GLCaptureSection::States, this->states);
+		this->writeSection(file, GLCaptureSection::Bindings, this->bindings);
+		this->writeSection(file, GLCaptureSection::Commands, this->commands);
+		this->writeSection(file, GLCaptureSection::Blobs, this->blobs);
+		this->header.bytes = this->bytes.size();
+		const bool written = fwrite(this->bytes.data(), 1, this->bytes.size(), file) == this->bytes.size();
+		fseek(file, 0, SEEK_SET);
+		fwrite(&this->header, sizeof(this->header), 1, file);
+		fclose(file);
+		if (!written)
+			std::cout << "ERROR::GL_CAPTURE::NOT_WRITTEN " << this->path << std::endl;
+		return written;
+	}
+
+	void release()
+	{
+		this->sources.clear();
+		this->programs.clear();
+		this->attributes.clear();
+		this->blocks.clear();
+		this->uniforms.clear();
+		this->buffers.clear();
+		this->textures.clear();
+		this->levels.clear();
+		this->renderbuffers.clear();
+		this->framebuffers.clear();
+		this->vertexArrays.clear();
+		this->states.clear();
+		this->bindings.clear();
+		this->commands.clear();
+		this->blobs.clear();
+		vector<uint8_t>().swap(this->bytes);
+		vector<uint8_t>().swap(this->scratch);
+		this->blobsByHash.clear();
+		this->programInfo.clear();
+		this->bufferIndex.clear();
+		this->textureIndex.clear();
+		this->renderbufferIndex.clear();
+		this->bufferNames.clear();
+		this->bufferContents.clear();
+	}
+};
+
+static GLCapture _glCapture;
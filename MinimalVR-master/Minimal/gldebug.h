@@ -0,0 +1,301 @@
+#pragma once
+// Std. Includes
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+// GL Includes
+#include <GL/glew.h>
+#include "trace.h"
+#include "threading.h"
+
+// Messages that can wait for the drain thread at once, more are dropped and counted
+#define GL_DEBUG_QUEUE_MESSAGES 256
+// Characters of a message kept, the rest is cut off
+#define GL_DEBUG_MESSAGE_CHARS 240
+// Times one message id is let through per second, the repeats past it only count as dropped
+#define GL_DEBUG_RATE_LIMIT 4
+// Slots of the rate limiter, ids that collide share a limit
+#define GL_DEBUG_RATE_SLOTS 64
+// How often the drain thread wakes
+#define GL_DEBUG_DRAIN_MS 50
+
+struct GLDebugMessage
+{
+	GLenum source;
+	GLenum type;
+	GLenum severity;
+	GLuint id;
+	char text[GL_DEBUG_MESSAGE_CHARS];
+};
+
+// KHR_debug output without the per message cost landing on the thread that made the GL call.
+//
+// The driver filters by severity and source before calling back (glDebugMessageControl), so what is filtered costs
+// nothing. The callback only checks the rate limit and copies the message into a bounded ring that any number of
+// threads push to without locks, the render context's and the loader's alike; a thread of its own drains it to
+// the debugger and stdout. Output stays asynchronous unless init() is asked for synchronous output, where a
+// breakpoint in the callback then stops on the call that caused the message.
+//
+// Markers (GLDebugGroup, _glLabel) only need KHR_debug, not a debug context, so captures in RenderDoc or Nsight
+// read by pass and resource name either way.
+class GLDebugOutput
+{
+public:
+	GLDebugOutput()
+	{
+		for (size_t i = 0; i < GL_DEBUG_QUEUE_MESSAGES; i++)
+			this->slots[i].sequence.store(i, std::memory_order_relaxed);
+		for (size_t i = 0; i < GL_DEBUG_RATE_SLOTS; i++)
+			this->rates[i].store(0, std::memory_order_relaxed);
+	}
+	// Past the context, so only the thread is stopped
+	~GLDebugOutput()
+	{
+		if (!this->drainer.joinable())
+			return;
+		this->running = false;
+		this->drainer.join();
+	}
+
+	GLDebugOutput(const GLDebugOutput&) = delete;
+	GLDebugOutput& operator=(const GLDebugOutput&) = delete;
+
+	// With the context current, after glewInit. verbose lets low severity and notifications through too.
+	void init(bool verbose, bool synchronous)
+	{
+		this->markersEnabled = GLEW_KHR_debug != 0;
+		if (!GLEW_KHR_debug)
+			return;
+		GLint flags = 0;
+		glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
+		if (!(flags & GL_CONTEXT_FLAG_DEBUG_BIT))
+			return;
+
+		glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+		if (!verbose)
+		{
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_LOW, 0, nullptr, GL_FALSE);
+		}
+		// Our own markers would come straight back as messages, and nothing else uses the application sources
+		glDebugMessageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+		glDebugMessageControl(GL_DEBUG_SOURCE_THIRD_PARTY, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+		glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_PUSH_GROUP, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+		glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_POP_GROUP, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+
+		this->running = true;
+		this->drainer = std::thread([this] { this->drainLoop(); });
+		glDebugMessageCallback(&GLDebugOutput::callback, this);
+		glEnable(GL_DEBUG_OUTPUT);
+		if (synchronous)
+			glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+		else
+			glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	}
+
+	// Before the context goes, whatever is still queued is written out
+	void shutdown()
+	{
+		if (!this->drainer.joinable())
+			return;
+		glDebugMessageCallback(nullptr, nullptr);
+		this->running = false;
+		this->drainer.join();
+		this->drain();
+	}
+
+	bool enabled() const { return this->drainer.joinable(); }
+	bool markers() const { return this->markersEnabled; }
+
+	// Messages the rate limit or a full queue threw away so far
+	uint32_t dropped() const { return this->droppedCount.load(std::memory_order_relaxed); }
+	// Messages of high severity so far, whether or not they were dropped
+	uint32_t errors() const { return this->errorCount.load(std::memory_order_relaxed); }
+
+private:
+	struct Slot
+	{
+		// Vyukov's bounded queue: equal to the position a producer may write, position + 1 once it is readable
+		std::atomic<size_t> sequence;
+		GLDebugMessage message;
+	};
+
+	Slot slots[GL_DEBUG_QUEUE_MESSAGES];
+	alignas(64) std::atomic<size_t> tail{ 0 };
+	// The drain thread's alone
+	alignas(64) size_t head = 0;
+	// Per slot the second a window began in the upper half, messages in it so far in the lower
+	std::atomic<uint64_t> rates[GL_DEBUG_RATE_SLOTS];
+	std::atomic<uint32_t> droppedCount{ 0 };
+	std::atomic<uint32_t> errorCount{ 0 };
+	std::atomic<bool> running{ false };
+	std::thread drainer;
+	bool markersEnabled = false;
+
+	static void GLAPIENTRY callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* text, const void* user)
+	{
+		((GLDebugOutput*)user)->post(source, type, id, severity, length, text);
+	}
+
+	// Any thread the driver calls back on
+	void post(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* text)
+	{
+		if (severity == GL_DEBUG_SEVERITY_HIGH)
+			this->errorCount.fetch_add(1, std::memory_order_relaxed);
+		if (!this->admit(id))
+		{
+			this->droppedCount.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		size_t position = this->tail.load(std::memory_order_relaxed);
+		Slot* slot;
+		for (;;)
+		{
+			slot = &this->slots[position & (GL_DEBUG_QUEUE_MESSAGES - 1)];
+			const intptr_t lag = (intptr_t)slot->sequence.load(std::memory_order_acquire) - (intptr_t)position;
+			if (lag == 0)
+			{
+				if (this->tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (lag < 0)
+			{
+				this->droppedCount.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			else
+			{
+				position = this->tail.load(std::memory_order_relaxed);
+			}
+		}
+		GLDebugMessage& message = slot->message;
+		message.source = source;
+		message.type = type;
+		message.severity = severity;
+		message.id = id;
+		const size_t chars = length < 0 ? strlen(text) : (size_t)length;
+		const size_t kept = chars < GL_DEBUG_MESSAGE_CHARS - 1 ? chars : GL_DEBUG_MESSAGE_CHARS - 1;
+		memcpy(message.text, text, kept);
+		message.text[kept] = 0;
+		slot->sequence.store(position + 1, std::memory_order_release);
+	}
+
+	// False once id has had GL_DEBUG_RATE_LIMIT messages this second
+	bool admit(GLuint id)
+	{
+		const uint64_t second = (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count() & 0xFFFFFFFF;
+		std::atomic<uint64_t>& rate = this->rates[id % GL_DEBUG_RATE_SLOTS];
+		uint64_t current = rate.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			if ((current >> 32) != second)
+			{
+				if (rate.compare_exchange_weak(current, second << 32 | 1, std::memory_order_relaxed))
+					return true;
+				continue;
+			}
+			if ((current & 0xFFFFFFFF) >= GL_DEBUG_RATE_LIMIT)
+				return false;
+			if (rate.compare_exchange_weak(current, current + 1, std::memory_order_relaxed))
+				return true;
+		}
+	}
+
+	void drainLoop()
+	{
+		TRACE_THREAD("gl debug");
+		_threadPolicy.apply(ThreadRole::Background);
+		while (this->running.load(std::memory_order_relaxed))
+		{
+			this->drain();
+			std::this_thread::sleep_for(std::chrono::milliseconds(GL_DEBUG_DRAIN_MS));
+		}
+	}
+
+	void drain()
+	{
+		for (;;)
+		{
+			Slot& slot = this->slots[this->head & (GL_DEBUG_QUEUE_MESSAGES - 1)];
+			if (slot.sequence.load(std::memory_order_acquire) != this->head + 1)
+				return;
+			this->write(slot.message);
+			slot.sequence.store(this->head + GL_DEBUG_QUEUE_MESSAGES, std::memory_order_release);
+			this->head++;
+		}
+	}
+
+	void write(const GLDebugMessage& message)
+	{
+		char line[GL_DEBUG_MESSAGE_CHARS + 64];
+		snprintf(line, sizeof(line), "%s::GL::%s::%s %u: %s\n", message.severity == GL_DEBUG_SEVERITY_HIGH ? "ERROR" : "WARNING",
+			sourceName(message.source), typeName(message.type), message.id, message.text);
+		OutputDebugStringA(line);
+		std::cout << line;
+	}
+
+	static const char* sourceName(GLenum source)
+	{
+		switch (source)
+		{
+		case GL_DEBUG_SOURCE_API: return "API";
+		case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "WINDOW_SYSTEM";
+		case GL_DEBUG_SOURCE_SHADER_COMPILER: return "SHADER_COMPILER";
+		default: return "OTHER";
+		}
+	}
+
+	static const char* typeName(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_DEBUG_TYPE_ERROR: return "ERROR";
+		case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "DEPRECATED";
+		case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "UNDEFINED";
+		case GL_DEBUG_TYPE_PORTABILITY: return "PORTABILITY";
+		case GL_DEBUG_TYPE_PERFORMANCE: return "PERFORMANCE";
+		default: return "OTHER";
+		}
+	}
+};
+
+static GLDebugOutput _glDebug;
+
+// The enclosing block as a named group in GPU captures, one per pass. Also works outside the frame.
+class GLDebugGroup
+{
+public:
+	explicit GLDebugGroup(const char* name) : pushed(_glDebug.markers())
+	{
+		if (this->pushed)
+			glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+	}
+	~GLDebugGroup()
+	{
+		if (this->pushed)
+			glPopDebugGroup();
+	}
+
+	GLDebugGroup(const GLDebugGroup&) = delete;
+	GLDebugGroup& operator=(const GLDebugGroup&) = delete;
+
+private:
+	bool pushed;
+};
+
+// Names a GL object in captures, identifier is GL_BUFFER, GL_TEXTURE, GL_FRAMEBUFFER, GL_RENDERBUFFER,
+// GL_PROGRAM or GL_VERTEX_ARRAY. The object must have been bound once already.
+static void _glLabel(GLenum identifier, GLuint name, const char* label)
+{
+	if (_glDebug.markers() && name)
+		glObjectLabel(identifier, name, -1, label);
+}
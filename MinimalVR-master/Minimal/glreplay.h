@@ -0,0 +1,781 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "glcapture.h"
+#include "mappedfile.h"
+#include "profiler.h"
+
+static const char* const GL_REPLAY_PASS_NAMES[(int)RenderPass::Count] = {
+	"other", "scene", "avatar", "reflection", "inset", "spectator", "environment",
+};
+static const char* const GL_REPLAY_EYE_NAMES[(int)RenderEye::Count] = {
+	"left", "right", "both",
+};
+
+// Draws a GLCapture again, as often as asked, with no game, avatar SDK or headset behind it.
+//
+// Everything the capture holds is made into GL objects up front: buffers with their contents, textures with theirs,
+// the capture's framebuffers, programs linked from their sources, and one buffer with every uniform block range any
+// draw reads, so a frame binds ranges of it the way the uniform ring does. frame() then only sets state and draws,
+// apart from the buffers the captured frame changed between draws, which it writes again where the capture says.
+// What went to the window goes to a target of the window's captured size.
+//
+// The passes are timed as profiler phases, one per pass and eye the capture has, so a replay's CSV lines up with the
+// app's own profile. Needs a current context for everything but addPhases().
+class GLReplay
+{
+public:
+	GLReplay()
+	{
+		for (int pass = 0; pass < (int)RenderPass::Count; pass++)
+			for (int eye = 0; eye < (int)RenderEye::Count; eye++)
+				this->phases[pass][eye] = -1;
+	}
+
+	GLReplay(const GLReplay&) = delete;
+	GLReplay& operator=(const GLReplay&) = delete;
+
+	bool load(const char* path)
+	{
+		this->release();
+		if (!this->file.open(path) || this->file.size() < sizeof(GLCaptureHeader))
+		{
+			std::cout << "ERROR::GL_REPLAY::NOT_READ " << path << std::endl;
+			return false;
+		}
+		memcpy(&this->header, this->file.data(), sizeof(this->header));
+		if (this->header.magic != GL_CAPTURE_MAGIC || this->header.version != GL_CAPTURE_VERSION)
+		{
+			std::cout << "ERROR::GL_REPLAY::NOT_A_CAPTURE " << path << std::endl;
+			this->file.close();
+			return false;
+		}
+		size_t offset = sizeof(this->header);
+		const bool read = this->read(GLCaptureSection::Programs, &offset, this->programs) &&
+			this->read(GLCaptureSection::Attributes, &offset, this->attributes) &&
+			this->read(GLCaptureSection::Blocks, &offset, this->blocks) &&
+			this->read(GLCaptureSection::Uniforms, &offset, this->uniforms) &&
+			this->read(GLCaptureSection::Buffers, &offset, this->buffers) &&
+			this->read(GLCaptureSection::Textures, &offset, this->textures) &&
+			this->read(GLCaptureSection::Levels, &offset, this->levels) &&
+			this->read(GLCaptureSection::Renderbuffers, &offset, this->renderbuffers) &&
+			this->read(GLCaptureSection::Framebuffers, &offset, this->framebuffers) &&
+			this->read(GLCaptureSection::VertexArrays, &offset, this->vertexArrays) &&
+			this->read(GLCaptureSection::States, &offset, this->states) &&
+			this->read(GLCaptureSection::Bindings, &offset, this->bindings) &&
+			this->read(GLCaptureSection::Commands, &offset, this->commands) &&
+			this->read(GLCaptureSection::Blobs, &offset, this->blobs);
+		if (!read || offset + this->header.bytes > this->file.size())
+		{
+			std::cout << "ERROR::GL_REPLAY::TRUNCATED " << path << std::endl;
+			this->file.close();
+			return false;
+		}
+		for (size_t i = 0; i < this->commands.size(); i++)
+		{
+			if (this->commands[i].pass >= (uint32_t)RenderPass::Count || this->commands[i].eye >= (uint32_t)RenderEye::Count)
+			{
+				std::cout << "ERROR::GL_REPLAY::BAD_COMMAND " << i << std::endl;
+				this->file.close();
+				return false;
+			}
+		}
+		this->bytes = this->file.data() + offset;
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		this->createBuffers();
+		this->createTextures();
+		this->createFramebuffers();
+		this->createPrograms();
+		this->createVertexArrays();
+		this->createUniformArena();
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		this->loaded = true;
+		return true;
+	}
+
+	// The capturing driver's GL_RENDERER
+	std::string renderer() const
+	{
+		uint64_t size = 0;
+		const uint8_t* text = this->blob(this->header.renderer, &size);
+		return text ? std::string((const char*)text, (size_t)size) : std::string();
+	}
+
+	size_t commandCount() const { return this->commands.size(); }
+
+	// A phase for each pass and eye the capture draws, before profiler.init()
+	void addPhases(FrameProfiler& profiler)
+	{
+		for (int pass = 0; pass < (int)RenderPass::Count; pass++)
+			for (int eye = 0; eye < (int)RenderEye::Count; eye++)
+				this->phases[pass][eye] = -1;
+		for (size_t i = 0; i < this->commands.size(); i++)
+		{
+			int& phase = this->phases[this->commands[i].pass][this->commands[i].eye];
+			if (phase >= 0)
+				continue;
+			const std::string name = std::string(GL_REPLAY_PASS_NAMES[this->commands[i].pass]) + "_" + GL_REPLAY_EYE_NAMES[this->commands[i].eye];
+			phase = profiler.addPhase(name.c_str());
+		}
+	}
+
+	// Draws the captured frame once, returns the draws it issued
+	uint32_t frame(FrameProfiler& profiler)
+	{
+		if (!this->loaded)
+			return 0;
+		// Buffers the frame changes start over as they were when first drawn from
+		for (size_t i = 0; i < this->resetBuffers.size(); i++)
+			this->upload(this->resetBuffers[i], this->buffers[this->resetBuffers[i]].contents);
+		this->currentProgram = this->currentVertexArray = this->currentFramebuffer = this->currentReadFramebuffer = this->currentState = GL_CAPTURE_NONE;
+		this->currentUniforms.assign(this->programs.size(), GL_CAPTURE_NONE);
+
+		uint32_t draws = 0;
+		int open = -1;
+		for (size_t i = 0; i < this->commands.size(); i++)
+		{
+			const GLCaptureCommand& command = this->commands[i];
+			const int phase = this->phases[command.pass][command.eye];
+			if (phase != open)
+			{
+				if (open >= 0)
+					profiler.end(open);
+				profiler.begin(phase);
+				open = phase;
+			}
+			draws += this->execute(command);
+		}
+		if (open >= 0)
+			profiler.end(open);
+		glBindVertexArray(0);
+		glUseProgram(0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return draws;
+	}
+
+	void release()
+	{
+		if (!this->buffersGl.empty())
+			glDeleteBuffers((GLsizei)this->buffersGl.size(), this->buffersGl.data());
+		if (!this->texturesGl.empty())
+			glDeleteTextures((GLsizei)this->texturesGl.size(), this->texturesGl.data());
+		if (!this->renderbuffersGl.empty())
+			glDeleteRenderbuffers((GLsizei)this->renderbuffersGl.size(), this->renderbuffersGl.data());
+		for (size_t i = 0; i < this->framebuffersGl.size(); i++)
+		{
+			if (this->framebuffersGl[i] != this->defaultFramebuffer)
+				glDeleteFramebuffers(1, &this->framebuffersGl[i]);
+		}
+		for (size_t i = 0; i < this->programsGl.size(); i++)
+			glDeleteProgram(this->programsGl[i]);
+		if (!this->vertexArraysGl.empty())
+			glDeleteVertexArrays((GLsizei)this->vertexArraysGl.size(), this->vertexArraysGl.data());
+		if (this->defaultFramebuffer)
+		{
+			glDeleteFramebuffers(1, &this->defaultFramebuffer);
+			glDeleteRenderbuffers(2, this->defaultTargets);
+		}
+		if (this->uniformArena)
+			glDeleteBuffers(1, &this->uniformArena);
+		this->buffersGl.clear();
+		this->texturesGl.clear();
+		this->renderbuffersGl.clear();
+		this->framebuffersGl.clear();
+		this->programsGl.clear();
+		this->vertexArraysGl.clear();
+		this->uniformLocations.clear();
+		this->resetBuffers.clear();
+		this->defaultFramebuffer = 0;
+		this->defaultTargets[0] = this->defaultTargets[1] = 0;
+		this->uniformArena = 0;
+		this->loaded = false;
+		this->file.close();
+	}
+
+private:
+	MappedFile file;
+	GLCaptureHeader header;
+	const uint8_t* bytes = nullptr;
+	bool loaded = false;
+	vector<GLCaptureProgram> programs;
+	vector<GLCaptureNamed> attributes;
+	vector<GLCaptureNamed> blocks;
+	vector<GLCaptureUniform> uniforms;
+	vector<GLCaptureBuffer> buffers;
+	vector<GLCaptureTexture> textures;
+	vector<uint32_t> levels;
+	vector<GLCaptureRenderbuffer> renderbuffers;
+	vector<GLCaptureFramebuffer> framebuffers;
+	vector<GLCaptureVertexArray> vertexArrays;
+	vector<GLCaptureState> states;
+	vector<GLCaptureBinding> bindings;
+	vector<GLCaptureCommand> commands;
+	vector<GLCaptureBlob> blobs;
+
+	// GL names by capture index, 0 for what couldn't be made
+	vector<GLuint> buffersGl;
+	vector<GLuint> texturesGl;
+	vector<GLuint> renderbuffersGl;
+	vector<GLuint> framebuffersGl;
+	vector<GLuint> programsGl;
+	vector<GLuint> vertexArraysGl;
+	// Per program, per uniform
+	vector<vector<GLint>> uniformLocations;
+	// Buffers some draw updates, put back at the start of every frame
+	vector<uint32_t> resetBuffers;
+	// Stands in for the window, color then depth
+	GLuint defaultFramebuffer = 0;
+	GLuint defaultTargets[2] = { 0, 0 };
+	// Every blob a uniform block binding reads, at uniformOffsets by blob, -1 for blobs not in it
+	GLuint uniformArena = 0;
+	vector<GLintptr> uniformOffsets;
+	int phases[(int)RenderPass::Count][(int)RenderEye::Count];
+
+	// What the GL has now, so repeats are skipped
+	uint32_t currentProgram = GL_CAPTURE_NONE;
+	uint32_t currentVertexArray = GL_CAPTURE_NONE;
+	uint32_t currentFramebuffer = GL_CAPTURE_NONE;
+	uint32_t currentReadFramebuffer = GL_CAPTURE_NONE;
+	uint32_t currentState = GL_CAPTURE_NONE;
+	vector<uint32_t> currentUniforms;
+
+	template <typename T>
+	bool read(GLCaptureSection section, size_t* offset, vector<T>& list)
+	{
+		const size_t count = this->header.counts[(int)section];
+		if (*offset + count * sizeof(T) > this->file.size())
+			return false;
+		list.resize(count);
+		if (count)
+			memcpy(list.data(), this->file.data() + *offset, count * sizeof(T));
+		*offset += count * sizeof(T);
+		return true;
+	}
+
+	// Null for GL_CAPTURE_NONE and anything out of range
+	const uint8_t* blob(uint32_t index, uint64_t* size) const
+	{
+		*size = 0;
+		if (index >= this->blobs.size() || this->blobs[index].offset + this->blobs[index].size > this->header.bytes)
+			return nullptr;
+		*size = this->blobs[index].size;
+		return this->bytes + this->blobs[index].offset;
+	}
+
+	std::string blobString(uint32_t index) const
+	{
+		uint64_t size = 0;
+		const uint8_t* text = this->blob(index, &size);
+		return text ? std::string((const char*)text, (size_t)size) : std::string();
+	}
+
+	void upload(uint32_t buffer, uint32_t contents)
+	{
+		uint64_t size = 0;
+		const uint8_t* data = this->blob(contents, &size);
+		if (!data || size > this->buffers[buffer].size)
+			return;
+		glBindBuffer(GL_COPY_WRITE_BUFFER, this->buffersGl[buffer]);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr)size, data);
+	}
+
+	void createBuffers()
+	{
+		vector<bool> updated(this->buffers.size(), false);
+		for (size_t i = 0; i < this->commands.size(); i++)
+		{
+			for (uint32_t b = 0; b < this->commands[i].updateCount; b++)
+			{
+				const uint32_t buffer = this->bindings[this->commands[i].firstUpdate + b].slot;
+				if (buffer < updated.size() && !updated[buffer])
+				{
+					updated[buffer] = true;
+					this->resetBuffers.push_back(buffer);
+				}
+			}
+		}
+		this->buffersGl.assign(this->buffers.size(), 0);
+		glGenBuffers((GLsizei)this->buffers.size(), this->buffersGl.data());
+		for (size_t i = 0; i < this->buffers.size(); i++)
+		{
+			uint64_t size = 0;
+			const uint8_t* data = this->blob(this->buffers[i].contents, &size);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, this->buffersGl[i]);
+			glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)this->buffers[i].size, size == this->buffers[i].size ? data : NULL,
+				updated[i] ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+		}
+	}
+
+	void createTextures()
+	{
+		this->texturesGl.assign(this->textures.size(), 0);
+		glGenTextures((GLsizei)this->textures.size(), this->texturesGl.data());
+		for (size_t i = 0; i < this->textures.size(); i++)
+		{
+			const GLCaptureTexture& texture = this->textures[i];
+			glBindTexture(texture.target, this->texturesGl[i]);
+			if (texture.target == GL_TEXTURE_BUFFER)
+			{
+				if (texture.buffer < this->buffersGl.size())
+					glTexBuffer(GL_TEXTURE_BUFFER, texture.internalFormat, this->buffersGl[texture.buffer]);
+				continue;
+			}
+			if (texture.target == GL_TEXTURE_2D_MULTISAMPLE)
+			{
+				glTexImage2DMultisample(texture.target, texture.samples, texture.internalFormat, texture.width, texture.height, GL_TRUE);
+				continue;
+			}
+			GLenum format = GL_RGBA, type = GL_UNSIGNED_BYTE;
+			int texel = 4;
+			_glCapturePixelFormat(texture.internalFormat, &format, &type, &texel);
+			for (int32_t level = 0; level < texture.levels; level++)
+			{
+				const GLsizei width = std::max(texture.width >> level, 1), height = std::max(texture.height >> level, 1);
+				const GLsizei depth = texture.target == GL_TEXTURE_3D ? std::max(texture.depth >> level, 1) : texture.depth;
+				uint64_t size = 0;
+				const uint8_t* data = this->blob(texture.firstLevel + level < this->levels.size() ? this->levels[texture.firstLevel + level] : GL_CAPTURE_NONE, &size);
+				if (texture.compressed && !data)
+					continue;
+				switch (texture.target)
+				{
+				case GL_TEXTURE_2D:
+					if (texture.compressed)
+						glCompressedTexImage2D(texture.target, level, texture.internalFormat, width, height, 0, (GLsizei)size, data);
+					else
+						glTexImage2D(texture.target, level, texture.internalFormat, width, height, 0, format, type, data);
+					break;
+				case GL_TEXTURE_2D_ARRAY:
+				case GL_TEXTURE_3D:
+					if (texture.compressed)
+						glCompressedTexImage3D(texture.target, level, texture.internalFormat, width, height, depth, 0, (GLsizei)size, data);
+					else
+						glTexImage3D(texture.target, level, texture.internalFormat, width, height, depth, 0, format, type, data);
+					break;
+				case GL_TEXTURE_CUBE_MAP:
+					for (int face = 0; face < 6; face++)
+					{
+						const uint8_t* faceData = data ? data + size / 6 * face : nullptr;
+						if (texture.compressed)
+							glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, texture.internalFormat, width, height, 0, (GLsizei)(size / 6), faceData);
+						else
+							glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, texture.internalFormat, width, height, 0, format, type, faceData);
+					}
+					break;
+				}
+			}
+			glTexParameteri(texture.target, GL_TEXTURE_BASE_LEVEL, 0);
+			glTexParameteri(texture.target, GL_TEXTURE_MAX_LEVEL, std::max(texture.levels - 1, 0));
+			glTexParameteri(texture.target, GL_TEXTURE_MIN_FILTER, texture.minFilter);
+			glTexParameteri(texture.target, GL_TEXTURE_MAG_FILTER, texture.magFilter);
+			glTexParameteri(texture.target, GL_TEXTURE_WRAP_S, texture.wrapS);
+			glTexParameteri(texture.target, GL_TEXTURE_WRAP_T, texture.wrapT);
+			glTexParameteri(texture.target, GL_TEXTURE_COMPARE_MODE, texture.compareMode);
+			glTexParameteri(texture.target, GL_TEXTURE_COMPARE_FUNC, texture.compareFunc);
+			glBindTexture(texture.target, 0);
+		}
+	}
+
+	void createFramebuffers()
+	{
+		this->renderbuffersGl.assign(this->renderbuffers.size(), 0);
+		glGenRenderbuffers((GLsizei)this->renderbuffers.size(), this->renderbuffersGl.data());
+		for (size_t i = 0; i < this->renderbuffers.size(); i++)
+		{
+			const GLCaptureRenderbuffer& renderbuffer = this->renderbuffers[i];
+			glBindRenderbuffer(GL_RENDERBUFFER, this->renderbuffersGl[i]);
+			glRenderbufferStorageMultisample(GL_RENDERBUFFER, renderbuffer.samples, renderbuffer.internalFormat, renderbuffer.width, renderbuffer.height);
+		}
+
+		glGenRenderbuffers(2, this->defaultTargets);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->defaultTargets[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, this->header.width, this->header.height);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->defaultTargets[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, this->header.width, this->header.height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glGenFramebuffers(1, &this->defaultFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->defaultFramebuffer);
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->defaultTargets[0]);
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->defaultTargets[1]);
+
+		this->framebuffersGl.assign(this->framebuffers.size(), 0);
+		for (size_t i = 0; i < this->framebuffers.size(); i++)
+		{
+			const GLCaptureFramebuffer& framebuffer = this->framebuffers[i];
+			if (framebuffer.defaultFramebuffer)
+			{
+				this->framebuffersGl[i] = this->defaultFramebuffer;
+				continue;
+			}
+			glGenFramebuffers(1, &this->framebuffersGl[i]);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->framebuffersGl[i]);
+			for (int a = 0; a <= GL_CAPTURE_COLOR_ATTACHMENTS; a++)
+			{
+				const GLenum point = a < GL_CAPTURE_COLOR_ATTACHMENTS ? GL_COLOR_ATTACHMENT0 + a : GL_DEPTH_ATTACHMENT;
+				this->attach(point, a < GL_CAPTURE_COLOR_ATTACHMENTS ? framebuffer.color[a] : framebuffer.depth);
+			}
+			glDrawBuffers(GL_CAPTURE_COLOR_ATTACHMENTS, (const GLenum*)framebuffer.drawBuffers);
+			glReadBuffer(framebuffer.readBuffer);
+			if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+				std::cout << "ERROR::GL_REPLAY::FRAMEBUFFER_INCOMPLETE " << i << std::endl;
+		}
+	}
+
+	void attach(GLenum point, const GLCaptureAttachment& attachment)
+	{
+		if (attachment.type == GL_RENDERBUFFER && attachment.object < this->renderbuffersGl.size())
+		{
+			glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, point, GL_RENDERBUFFER, this->renderbuffersGl[attachment.object]);
+			return;
+		}
+		if (attachment.type != GL_TEXTURE || attachment.object >= this->texturesGl.size())
+			return;
+		const GLuint texture = this->texturesGl[attachment.object];
+		const GLenum target = this->textures[attachment.object].target;
+		if (attachment.views > 0)
+		{
+			if (GLEW_OVR_multiview)
+				glFramebufferTextureMultiviewOVR(GL_DRAW_FRAMEBUFFER, point, texture, attachment.level, attachment.layer, attachment.views);
+			else
+				std::cout << "ERROR::GL_REPLAY::NO_MULTIVIEW" << std::endl;
+		}
+		else if (target == GL_TEXTURE_2D_ARRAY || target == GL_TEXTURE_3D)
+		{
+			glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, point, texture, attachment.level, attachment.layer);
+		}
+		else
+		{
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, point, target, texture, attachment.level);
+		}
+	}
+
+	void createPrograms()
+	{
+		this->programsGl.assign(this->programs.size(), 0);
+		this->uniformLocations.resize(this->programs.size());
+		for (size_t i = 0; i < this->programs.size(); i++)
+		{
+			const GLCaptureProgram& captured = this->programs[i];
+			const std::string vertexSource = this->blobString(captured.vertexSource);
+			const std::string fragmentSource = this->blobString(captured.fragmentSource);
+			const GLuint vertex = this->compile(GL_VERTEX_SHADER, vertexSource);
+			const GLuint fragment = this->compile(GL_FRAGMENT_SHADER, fragmentSource);
+			if (!vertex || !fragment)
+			{
+				glDeleteShader(vertex);
+				glDeleteShader(fragment);
+				continue;
+			}
+			const GLuint program = glCreateProgram();
+			glAttachShader(program, vertex);
+			glAttachShader(program, fragment);
+			for (uint32_t a = 0; a < captured.attributeCount; a++)
+			{
+				const GLCaptureNamed& attribute = this->attributes[captured.firstAttribute + a];
+				glBindAttribLocation(program, (GLuint)attribute.value, this->blobString(attribute.name).c_str());
+			}
+			glLinkProgram(program);
+			glDeleteShader(vertex);
+			glDeleteShader(fragment);
+			GLint success = 0;
+			glGetProgramiv(program, GL_LINK_STATUS, &success);
+			if (!success)
+			{
+				char infoLog[512];
+				glGetProgramInfoLog(program, sizeof(infoLog), NULL, infoLog);
+				std::cout << "ERROR::GL_REPLAY::LINKING_FAILED\n" << infoLog << std::endl;
+				glDeleteProgram(program);
+				continue;
+			}
+			for (uint32_t b = 0; b < captured.blockCount; b++)
+			{
+				const GLCaptureNamed& block = this->blocks[captured.firstBlock + b];
+				const GLuint index = glGetUniformBlockIndex(program, this->blobString(block.name).c_str());
+				if (index != GL_INVALID_INDEX)
+					glUniformBlockBinding(program, index, (GLuint)block.value);
+			}
+			for (uint32_t u = 0; u < captured.uniformCount; u++)
+				this->uniformLocations[i].push_back(glGetUniformLocation(program, this->blobString(this->uniforms[captured.firstUniform + u].name).c_str()));
+			this->programsGl[i] = program;
+		}
+	}
+
+	GLuint compile(GLenum type, const std::string& source)
+	{
+		GLuint shader = glCreateShader(type);
+		const char* text = source.c_str();
+		glShaderSource(shader, 1, &text, NULL);
+		glCompileShader(shader);
+		GLint success = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::GL_REPLAY::COMPILATION_FAILED\n" << infoLog << std::endl;
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+
+	void createVertexArrays()
+	{
+		this->vertexArraysGl.assign(this->vertexArrays.size(), 0);
+		glGenVertexArrays((GLsizei)this->vertexArrays.size(), this->vertexArraysGl.data());
+		for (size_t i = 0; i < this->vertexArrays.size(); i++)
+		{
+			const GLCaptureVertexArray& vertexArray = this->vertexArrays[i];
+			glBindVertexArray(this->vertexArraysGl[i]);
+			for (GLuint a = 0; a < GL_CAPTURE_ATTRIBUTES; a++)
+			{
+				const GLCaptureAttribute& attribute = vertexArray.attributes[a];
+				if (!attribute.enabled || attribute.buffer >= this->buffersGl.size())
+					continue;
+				glBindBuffer(GL_ARRAY_BUFFER, this->buffersGl[attribute.buffer]);
+				glEnableVertexAttribArray(a);
+				if (attribute.integer)
+					glVertexAttribIPointer(a, attribute.size, attribute.type, attribute.stride, (const GLvoid*)(uintptr_t)attribute.offset);
+				else
+					glVertexAttribPointer(a, attribute.size, attribute.type, (GLboolean)attribute.normalized, attribute.stride, (const GLvoid*)(uintptr_t)attribute.offset);
+				glVertexAttribDivisor(a, attribute.divisor);
+			}
+			if (vertexArray.elementBuffer < this->buffersGl.size())
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffersGl[vertexArray.elementBuffer]);
+		}
+		glBindVertexArray(0);
+	}
+
+	void createUniformArena()
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		alignment = std::max(alignment, 16);
+		this->uniformOffsets.assign(this->blobs.size(), -1);
+		GLintptr size = 0;
+		for (size_t i = 0; i < this->commands.size(); i++)
+		{
+			for (uint32_t b = 0; b < this->commands[i].blockCount; b++)
+			{
+				const uint32_t index = this->bindings[this->commands[i].firstBlock + b].object;
+				if (index >= this->blobs.size() || this->uniformOffsets[index] >= 0)
+					continue;
+				this->uniformOffsets[index] = size;
+				size += ((GLintptr)this->blobs[index].size + alignment - 1) / alignment * alignment;
+			}
+		}
+		if (!size)
+			return;
+		glGenBuffers(1, &this->uniformArena);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, this->uniformArena);
+		glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+		for (size_t i = 0; i < this->uniformOffsets.size(); i++)
+		{
+			uint64_t blobSize = 0;
+			const uint8_t* data = this->blob((uint32_t)i, &blobSize);
+			if (this->uniformOffsets[i] >= 0 && data && blobSize)
+				glBufferSubData(GL_COPY_WRITE_BUFFER, this->uniformOffsets[i], (GLsizeiptr)blobSize, data);
+		}
+	}
+
+	void bindFramebuffer(GLenum target, uint32_t framebuffer, uint32_t* current)
+	{
+		if (framebuffer == *current || framebuffer >= this->framebuffersGl.size())
+			return;
+		*current = framebuffer;
+		glBindFramebuffer(target, this->framebuffersGl[framebuffer]);
+	}
+
+	static void enable(GLenum capability, uint32_t enabled)
+	{
+		if (enabled)
+			glEnable(capability);
+		else
+			glDisable(capability);
+	}
+
+	void applyState(uint32_t index)
+	{
+		if (index == this->currentState || index >= this->states.size())
+			return;
+		this->currentState = index;
+		const GLCaptureState& state = this->states[index];
+		glViewport(state.viewport[0], state.viewport[1], state.viewport[2], state.viewport[3]);
+		glScissor(state.scissor[0], state.scissor[1], state.scissor[2], state.scissor[3]);
+		enable(GL_SCISSOR_TEST, state.scissorTest);
+		enable(GL_DEPTH_TEST, state.depthTest);
+		glDepthFunc(state.depthFunc);
+		glDepthMask((GLboolean)state.depthMask);
+		enable(GL_BLEND, state.blend);
+		glBlendFuncSeparate(state.blendSource[0], state.blendDestination[0], state.blendSource[1], state.blendDestination[1]);
+		enable(GL_CULL_FACE, state.cullFace);
+		glCullFace(state.cullMode);
+		glFrontFace(state.frontFace);
+		glColorMask((GLboolean)state.colorMask[0], (GLboolean)state.colorMask[1], (GLboolean)state.colorMask[2], (GLboolean)state.colorMask[3]);
+		enable(GL_FRAMEBUFFER_SRGB, state.srgb);
+		if (state.clipDepth && GLEW_ARB_clip_control)
+			glClipControl(GL_LOWER_LEFT, state.clipDepth);
+		glClearColor(state.clearColor[0], state.clearColor[1], state.clearColor[2], state.clearColor[3]);
+		glClearDepth(state.clearDepth);
+		glLineWidth(state.lineWidth);
+	}
+
+	void setUniforms(uint32_t program, uint32_t uniforms)
+	{
+		uint64_t size = 0;
+		const uint8_t* data = this->blob(uniforms, &size);
+		if (!data || size < this->programs[program].uniformWords * sizeof(uint32_t))
+			return;
+		const GLCaptureProgram& captured = this->programs[program];
+		for (uint32_t u = 0; u < captured.uniformCount; u++)
+		{
+			const GLCaptureUniform& uniform = this->uniforms[captured.firstUniform + u];
+			const GLint location = this->uniformLocations[program][u];
+			if (location < 0)
+				continue;
+			const void* values = data + uniform.firstWord * sizeof(uint32_t);
+			const GLfloat* floats = (const GLfloat*)values;
+			const GLint* ints = (const GLint*)values;
+			const GLuint* uints = (const GLuint*)values;
+			switch (uniform.type)
+			{
+			case GL_FLOAT: glUniform1fv(location, uniform.size, floats); break;
+			case GL_FLOAT_VEC2: glUniform2fv(location, uniform.size, floats); break;
+			case GL_FLOAT_VEC3: glUniform3fv(location, uniform.size, floats); break;
+			case GL_FLOAT_VEC4: glUniform4fv(location, uniform.size, floats); break;
+			case GL_FLOAT_MAT2: glUniformMatrix2fv(location, uniform.size, GL_FALSE, floats); break;
+			case GL_FLOAT_MAT3: glUniformMatrix3fv(location, uniform.size, GL_FALSE, floats); break;
+			case GL_FLOAT_MAT4: glUniformMatrix4fv(location, uniform.size, GL_FALSE, floats); break;
+			case GL_UNSIGNED_INT: glUniform1uiv(location, uniform.size, uints); break;
+			case GL_UNSIGNED_INT_VEC2: glUniform2uiv(location, uniform.size, uints); break;
+			case GL_UNSIGNED_INT_VEC3: glUniform3uiv(location, uniform.size, uints); break;
+			case GL_UNSIGNED_INT_VEC4: glUniform4uiv(location, uniform.size, uints); break;
+			case GL_INT_VEC2: case GL_BOOL_VEC2: glUniform2iv(location, uniform.size, ints); break;
+			case GL_INT_VEC3: case GL_BOOL_VEC3: glUniform3iv(location, uniform.size, ints); break;
+			case GL_INT_VEC4: case GL_BOOL_VEC4: glUniform4iv(location, uniform.size, ints); break;
+			// Ints, booleans and samplers
+			default: glUniform1iv(location, uniform.size, ints); break;
+			}
+		}
+	}
+
+	// The draws it issued, 0 or 1
+	uint32_t execute(const GLCaptureCommand& command)
+	{
+		switch (command.kind)
+		{
+		case GLCaptureKind::Clear:
+			this->bindFramebuffer(GL_DRAW_FRAMEBUFFER, command.framebuffer, &this->currentFramebuffer);
+			this->applyState(command.state);
+			glClear(command.mask);
+			return 0;
+		case GLCaptureKind::Blit:
+			this->bindFramebuffer(GL_READ_FRAMEBUFFER, command.readFramebuffer, &this->currentReadFramebuffer);
+			this->bindFramebuffer(GL_DRAW_FRAMEBUFFER, command.framebuffer, &this->currentFramebuffer);
+			this->applyState(command.state);
+			glBlitFramebuffer(command.source[0], command.source[1], command.source[2], command.source[3], command.destination[0],
+				command.destination[1], command.destination[2], command.destination[3], command.mask, command.filter);
+			return 0;
+		default:
+			break;
+		}
+		if (command.program >= this->programsGl.size() || !this->programsGl[command.program] || command.vertexArray >= this->vertexArraysGl.size())
+			return 0;
+
+		for (uint32_t i = 0; i < command.updateCount; i++)
+		{
+			const GLCaptureBinding& update = this->bindings[command.firstUpdate + i];
+			if (update.slot < this->buffersGl.size())
+				this->upload(update.slot, update.object);
+		}
+		this->bindFramebuffer(GL_DRAW_FRAMEBUFFER, command.framebuffer, &this->currentFramebuffer);
+		this->applyState(command.state);
+		if (command.program != this->currentProgram)
+		{
+			this->currentProgram = command.program;
+			glUseProgram(this->programsGl[command.program]);
+		}
+		if (command.uniforms != this->currentUniforms[command.program])
+		{
+			this->currentUniforms[command.program] = command.uniforms;
+			this->setUniforms(command.program, command.uniforms);
+		}
+		if (command.vertexArray != this->currentVertexArray)
+		{
+			this->currentVertexArray = command.vertexArray;
+			glBindVertexArray(this->vertexArraysGl[command.vertexArray]);
+		}
+		const GLCaptureVertexArray& vertexArray = this->vertexArrays[command.vertexArray];
+		for (GLuint a = 0; a < GL_CAPTURE_ATTRIBUTES; a++)
+		{
+			const GLCaptureAttribute& attribute = vertexArray.attributes[a];
+			if (!attribute.currentSet)
+				continue;
+			if (attribute.currentInteger)
+				glVertexAttribI4iv(a, (const GLint*)attribute.current);
+			else
+				glVertexAttrib4fv(a, (const GLfloat*)attribute.current);
+		}
+		for (uint32_t i = 0; i < command.blockCount; i++)
+		{
+			const GLCaptureBinding& block = this->bindings[command.firstBlock + i];
+			if (block.object < this->uniformOffsets.size() && this->uniformOffsets[block.object] >= 0)
+				glBindBufferRange(GL_UNIFORM_BUFFER, block.slot, this->uniformArena, this->uniformOffsets[block.object], (GLsizeiptr)this->blobs[block.object].size);
+		}
+		for (uint32_t i = 0; i < command.textureCount; i++)
+		{
+			const GLCaptureBinding& texture = this->bindings[command.firstTexture + i];
+			if (texture.object >= this->texturesGl.size())
+				continue;
+			glActiveTexture(GL_TEXTURE0 + texture.slot);
+			glBindTexture(this->textures[texture.object].target, this->texturesGl[texture.object]);
+		}
+
+		const GLvoid* offset = (const GLvoid*)(uintptr_t)command.offset;
+		switch (command.kind)
+		{
+		case GLCaptureKind::DrawArrays:
+			if (command.baseInstance && GLEW_ARB_base_instance)
+				glDrawArraysInstancedBaseInstance(command.mode, command.baseVertex, command.count, command.instances, command.baseInstance);
+			else if (command.instances != 1)
+				glDrawArraysInstanced(command.mode, command.baseVertex, command.count, command.instances);
+			else
+				glDrawArrays(command.mode, command.baseVertex, command.count);
+			break;
+		case GLCaptureKind::DrawElements:
+			if (command.baseInstance && GLEW_ARB_base_instance)
+				glDrawElementsInstancedBaseVertexBaseInstance(command.mode, command.count, command.type, offset, command.instances, command.baseVertex, command.baseInstance);
+			else if (command.baseVertex)
+				glDrawElementsInstancedBaseVertex(command.mode, command.count, command.type, offset, command.instances, command.baseVertex);
+			else if (command.instances != 1)
+				glDrawElementsInstanced(command.mode, command.count, command.type, offset, command.instances);
+			else
+				glDrawElements(command.mode, command.count, command.type, offset);
+			break;
+		case GLCaptureKind::DrawIndirect:
+			if (command.indirectBuffer >= this->buffersGl.size())
+				return 0;
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->buffersGl[command.indirectBuffer]);
+			if (command.drawCount > 1 && GLEW_ARB_multi_draw_indirect)
+				glMultiDrawElementsIndirect(command.mode, command.type, offset, command.drawCount, command.stride);
+			else
+				glDrawElementsIndirect(command.mode, command.type, offset);
+			break;
+		default:
+			return 0;
+		}
+		return 1;
+	}
+};
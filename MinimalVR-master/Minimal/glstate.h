@@ -0,0 +1,246 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "renderstats.h"
+
+// Texture units whose GL_TEXTURE_2D and GL_TEXTURE_2D_ARRAY bindings are tracked, units past these are always bound
+#define GL_STATE_TEXTURE_UNITS 16
+
+// Render thread shadow of the GL state the draw paths set most, so setting what is already set costs no driver call.
+//
+// Only trusted between beginFrame() and endFrame(). Uploads and setup code run outside the frame and use GL
+// directly, so beginFrame() forgets everything and the first set of each state always goes through; inside the
+// frame every change to these states has to come through here. endFrame() unbinds the vertex array, so buffer
+// binds made between frames can't land in a VAO a draw left bound. Each frame counts the calls it made and the
+// ones it dropped.
+class GLStateCache
+{
+public:
+	GLStateCache() {}
+
+	GLStateCache(const GLStateCache&) = delete;
+	GLStateCache& operator=(const GLStateCache&) = delete;
+
+	void beginFrame()
+	{
+		this->known = 0;
+		this->textureKnown = 0;
+		this->textureArrayKnown = 0;
+		this->frameChanges = 0;
+		this->frameFiltered = 0;
+	}
+
+	void endFrame()
+	{
+		this->bindVertexArray(0);
+	}
+
+	void useProgram(GLuint program)
+	{
+		if (this->unchanged(KNOWN_PROGRAM, this->program == program))
+			return;
+		this->program = program;
+		_renderStats.programBind();
+		glUseProgram(program);
+	}
+
+	void bindVertexArray(GLuint vertexArray)
+	{
+		if (this->unchanged(KNOWN_VERTEX_ARRAY, this->vertexArray == vertexArray))
+			return;
+		this->vertexArray = vertexArray;
+		_renderStats.vertexArrayBind();
+		glBindVertexArray(vertexArray);
+	}
+
+	// Binds texture to GL_TEXTURE_2D of unit, making unit the active one only if the binding has to change
+	void bindTexture(GLuint unit, GLuint texture)
+	{
+		this->bindTarget(GL_TEXTURE_2D, this->textureKnown, this->textures, unit, texture);
+	}
+
+	// bindTexture(), and unit left active whatever was bound, for the glTex* calls that follow
+	void selectTexture(GLuint unit, GLuint texture)
+	{
+		this->bindTexture(unit, texture);
+		this->activeTexture(unit);
+	}
+
+	// The same for GL_TEXTURE_2D_ARRAY, whose binding on a unit is separate from the GL_TEXTURE_2D one
+	void bindTextureArray(GLuint unit, GLuint texture)
+	{
+		this->bindTarget(GL_TEXTURE_2D_ARRAY, this->textureArrayKnown, this->textureArrays, unit, texture);
+	}
+
+	void selectTextureArray(GLuint unit, GLuint texture)
+	{
+		this->bindTextureArray(unit, texture);
+		this->activeTexture(unit);
+	}
+
+	// GL_TEXTURE_BUFFER of unit, which isn't tracked, so it always goes through
+	void bindBufferTexture(GLuint unit, GLuint texture)
+	{
+		this->activeTexture(unit);
+		this->frameChanges++;
+		_renderStats.textureBind();
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+	}
+
+	// GL_TEXTURE_2D_MULTISAMPLE of unit, untracked the same way
+	void bindMultisampleTexture(GLuint unit, GLuint texture)
+	{
+		this->activeTexture(unit);
+		this->frameChanges++;
+		_renderStats.textureBind();
+		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, texture);
+	}
+
+	// Reversed-Z: callers keep passing the comparison a standard depth buffer wants, it is mirrored on the way to GL
+	void reverseDepth(bool reversed)
+	{
+		this->depthReversed = reversed;
+	}
+
+	void depthFunc(GLenum func)
+	{
+		if (this->depthReversed)
+		{
+			switch (func)
+			{
+			case GL_LESS: func = GL_GREATER; break;
+			case GL_LEQUAL: func = GL_GEQUAL; break;
+			case GL_GREATER: func = GL_LESS; break;
+			case GL_GEQUAL: func = GL_LEQUAL; break;
+			}
+		}
+		if (this->unchanged(KNOWN_DEPTH_FUNC, this->depthFuncValue == func))
+			return;
+		this->depthFuncValue = func;
+		glDepthFunc(func);
+	}
+
+	void depthMask(GLboolean mask)
+	{
+		if (this->unchanged(KNOWN_DEPTH_MASK, this->depthMaskValue == mask))
+			return;
+		this->depthMaskValue = mask;
+		glDepthMask(mask);
+	}
+
+	// Color write mask of draw buffer 0
+	void colorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a)
+	{
+		const uint8_t mask = (uint8_t)((r ? 1 : 0) | (g ? 2 : 0) | (b ? 4 : 0) | (a ? 8 : 0));
+		if (this->unchanged(KNOWN_COLOR_MASK, this->colorMaskValue == mask))
+			return;
+		this->colorMaskValue = mask;
+		glColorMaski(0, r, g, b, a);
+	}
+
+	// GL_BLEND, with the function ExampleApp::initGl sets once
+	void blend(bool enabled)
+	{
+		if (this->unchanged(KNOWN_BLEND, this->blendValue == enabled))
+			return;
+		this->blendValue = enabled;
+		if (enabled)
+			glEnable(GL_BLEND);
+		else
+			glDisable(GL_BLEND);
+	}
+
+	void frontFace(GLenum mode)
+	{
+		if (this->unchanged(KNOWN_FRONT_FACE, this->frontFaceValue == mode))
+			return;
+		this->frontFaceValue = mode;
+		glFrontFace(mode);
+	}
+
+	// Calls made and calls dropped since beginFrame()
+	uint32_t changes() const { return this->frameChanges; }
+	uint32_t filtered() const { return this->frameFiltered; }
+
+private:
+	enum : uint32_t
+	{
+		KNOWN_PROGRAM = 1 << 0,
+		KNOWN_VERTEX_ARRAY = 1 << 1,
+		KNOWN_ACTIVE_TEXTURE = 1 << 2,
+		KNOWN_DEPTH_FUNC = 1 << 3,
+		KNOWN_DEPTH_MASK = 1 << 4,
+		KNOWN_COLOR_MASK = 1 << 5,
+		KNOWN_FRONT_FACE = 1 << 6,
+		KNOWN_BLEND = 1 << 7,
+	};
+
+	uint32_t known = 0;
+	uint32_t textureKnown = 0;
+	uint32_t textureArrayKnown = 0;
+	GLuint program = 0;
+	GLuint vertexArray = 0;
+	GLuint activeUnit = 0;
+	GLuint textures[GL_STATE_TEXTURE_UNITS];
+	GLuint textureArrays[GL_STATE_TEXTURE_UNITS];
+	GLenum depthFuncValue = GL_LESS;
+	bool depthReversed = false;
+	GLboolean depthMaskValue = GL_TRUE;
+	uint8_t colorMaskValue = 0xF;
+	GLenum frontFaceValue = GL_CCW;
+	bool blendValue = false;
+	uint32_t frameChanges = 0;
+	uint32_t frameFiltered = 0;
+
+	// True, and counted as filtered, when the state is known to hold the value already. Otherwise marks it
+	// known and counts the call the caller is about to make.
+	bool unchanged(uint32_t state, bool same)
+	{
+		if ((this->known & state) && same)
+		{
+			this->frameFiltered++;
+			return true;
+		}
+		this->known |= state;
+		this->frameChanges++;
+		return false;
+	}
+
+	void bindTarget(GLenum target, uint32_t& knownUnits, GLuint* bound, GLuint unit, GLuint texture)
+	{
+		if (unit >= GL_STATE_TEXTURE_UNITS)
+		{
+			this->activeTexture(unit);
+			this->frameChanges++;
+			_renderStats.textureBind();
+			glBindTexture(target, texture);
+			return;
+		}
+		const uint32_t bit = 1u << unit;
+		if ((knownUnits & bit) && bound[unit] == texture)
+		{
+			this->frameFiltered++;
+			return;
+		}
+		this->activeTexture(unit);
+		knownUnits |= bit;
+		bound[unit] = texture;
+		this->frameChanges++;
+		_renderStats.textureBind();
+		glBindTexture(target, texture);
+	}
+
+	void activeTexture(GLuint unit)
+	{
+		if (this->unchanged(KNOWN_ACTIVE_TEXTURE, this->activeUnit == unit))
+			return;
+		this->activeUnit = unit;
+		glActiveTexture(GL_TEXTURE0 + unit);
+	}
+};
+
+// The render thread's context, see GlfwApp::run for the frame it brackets
+static GLStateCache _glState;
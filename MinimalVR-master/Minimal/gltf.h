@@ -0,0 +1,430 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <cctype>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <assimp/types.h>
+#include "mesh.h"
+#include "mappedfile.h"
+#include "assetpack.h"
+#include "json.h"
+
+// glTF 2.0 binary (.glb) import, for what the content pipeline exports.
+//
+// The file stays mapped while the model is built. A primitive whose POSITION, NORMAL and TEXCOORD_0 are floats
+// interleaved in one buffer view as a Vertex is, with 16 or 32 bit indices, is uploaded straight out of the BIN
+// chunk; anything else is gathered into Vertex first. glTF's texture origin is top left, the same as Assimp's after
+// aiProcess_FlipUVs, so texture coordinates are taken as they are.
+//
+// The node tree of the default scene is kept as placements, one model space matrix per time a primitive is drawn:
+// a node's world matrix, times each instance of EXT_mesh_gpu_instancing where the node has them. Only TRIANGLES
+// primitives, the BIN chunk as the single buffer and the base color factor of the materials are supported.
+
+#define GLB_MAGIC 0x46546C67 // "glTF"
+#define GLB_VERSION 2
+#define GLB_CHUNK_JSON 0x4E4F534A
+#define GLB_CHUNK_BIN 0x004E4942
+
+static bool _isGltfPath(const string& path)
+{
+	string extension = path.substr(path.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == "glb";
+}
+
+// Where the elements of one accessor are in the BIN chunk
+struct GltfAccessor
+{
+	const uint8_t* data = nullptr;
+	size_t stride = 0;
+	size_t count = 0;
+	int componentType = 0;
+	int components = 0;
+	bool normalized = false;
+	// The buffer view it reads, to tell interleaved attributes apart
+	int bufferView = -1;
+};
+
+// One primitive as it is uploaded: straight from the file where vertices/indices point into the mapping, or from
+// the gathered copies where they don't
+struct GltfPrimitive
+{
+	const Vertex* vertices = nullptr;
+	GLsizei vertexCount = 0;
+	const void* indices = nullptr;
+	// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT for indices in the file, gathered ones are always GLuint
+	GLenum indexType = GL_UNSIGNED_INT;
+	GLsizei indexCount = 0;
+	vector<Vertex> gatheredVertices;
+	vector<GLuint> gatheredIndices;
+	// Diffuse, ambient, specular as Model uses them
+	vector<aiColor3D> colors;
+	// Model space transform of every copy drawn
+	vector<glm::mat4> placements;
+};
+
+// An imported .glb, valid as long as it is kept: primitives may point into file
+struct GltfScene
+{
+	MappedFile file;
+	vector<GltfPrimitive> primitives;
+};
+
+static size_t _gltfComponentSize(int componentType)
+{
+	switch (componentType)
+	{
+	case GL_BYTE: case GL_UNSIGNED_BYTE: return 1;
+	case GL_SHORT: case GL_UNSIGNED_SHORT: return 2;
+	case GL_UNSIGNED_INT: case GL_FLOAT: return 4;
+	default: return 0;
+	}
+}
+
+static int _gltfComponents(const string& type)
+{
+	if (type == "SCALAR") return 1;
+	if (type == "VEC2") return 2;
+	if (type == "VEC3") return 3;
+	if (type == "VEC4") return 4;
+	if (type == "MAT4") return 16;
+	return 0;
+}
+
+// Resolves accessor index against the document, false if it is missing, sparse or reaches past the BIN chunk
+static bool _gltfAccessor(const JsonValue& document, const uint8_t* bin, size_t binSize, int index, GltfAccessor* accessor)
+{
+	const JsonValue* accessors = document.get("accessors");
+	const JsonValue* views = document.get("bufferViews");
+	const JsonValue* json = accessors ? accessors->at(index) : nullptr;
+	if (!json || !views || json->get("sparse"))
+		return false;
+	const JsonValue* view = views->at(json->intOr("bufferView", -1));
+	if (!view || view->intOr("buffer", 0) != 0)
+		return false;
+	const JsonValue* type = json->get("type");
+	const JsonValue* normalized = json->get("normalized");
+	accessor->componentType = json->intOr("componentType", 0);
+	accessor->components = type ? _gltfComponents(type->text) : 0;
+	accessor->count = (size_t)json->numberOr("count", 0);
+	accessor->normalized = normalized && normalized->number != 0.0;
+	accessor->bufferView = json->intOr("bufferView", -1);
+	const size_t elementSize = _gltfComponentSize(accessor->componentType) * accessor->components;
+	accessor->stride = (size_t)view->numberOr("byteStride", 0);
+	if (!accessor->stride)
+		accessor->stride = elementSize;
+	const size_t offset = (size_t)view->numberOr("byteOffset", 0) + (size_t)json->numberOr("byteOffset", 0);
+	const size_t viewEnd = (size_t)view->numberOr("byteOffset", 0) + (size_t)view->numberOr("byteLength", 0);
+	if (!elementSize || !accessor->count || viewEnd > binSize || offset + (accessor->count - 1) * accessor->stride + elementSize > viewEnd)
+		return false;
+	accessor->data = bin + offset;
+	return true;
+}
+
+// Element i of a float or normalized integer accessor, components beyond the accessor's left as they are
+static void _gltfRead(const GltfAccessor& accessor, size_t i, float* out)
+{
+	const uint8_t* element = accessor.data + i * accessor.stride;
+	for (int c = 0; c < accessor.components; c++)
+	{
+		switch (accessor.componentType)
+		{
+		case GL_FLOAT: memcpy(&out[c], element + c * 4, 4); break;
+		case GL_UNSIGNED_BYTE: out[c] = element[c] / 255.0f; break;
+		case GL_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, element + c * 2, 2); out[c] = v / 65535.0f; } break;
+		case GL_BYTE: out[c] = std::max((int8_t)element[c] / 127.0f, -1.0f); break;
+		case GL_SHORT: { int16_t v; memcpy(&v, element + c * 2, 2); out[c] = std::max(v / 32767.0f, -1.0f); } break;
+		default: out[c] = 0.0f; break;
+		}
+	}
+}
+
+// The glTF mesh's primitives into scene, one entry per primitive in the order of the file
+static bool _gltfPrimitives(const JsonValue& document, const JsonValue& mesh, const uint8_t* bin, size_t binSize, GltfScene* scene)
+{
+	const JsonValue* primitives = mesh.get("primitives");
+	if (!primitives)
+		return false;
+	for (const JsonValue& json : primitives->items)
+	{
+		scene->primitives.emplace_back();
+		GltfPrimitive& primitive = scene->primitives.back();
+		const JsonValue* attributes = json.get("attributes");
+		GltfAccessor position, normal, texCoord, indices;
+		if (json.intOr("mode", GL_TRIANGLES) != GL_TRIANGLES || !attributes ||
+			!_gltfAccessor(document, bin, binSize, attributes->intOr("POSITION", -1), &position) ||
+			position.componentType != GL_FLOAT || position.components != 3)
+		{
+			cout << "ERROR::GLTF::UNSUPPORTED_PRIMITIVE" << endl;
+			return false;
+		}
+		const bool hasNormal = _gltfAccessor(document, bin, binSize, attributes->intOr("NORMAL", -1), &normal) && normal.count == position.count;
+		const bool hasTexCoord = _gltfAccessor(document, bin, binSize, attributes->intOr("TEXCOORD_0", -1), &texCoord) && texCoord.count == position.count;
+		primitive.vertexCount = (GLsizei)position.count;
+
+		// Laid out as Vertex already: the three attributes side by side in one view with Vertex's stride
+		const bool interleaved = hasNormal && hasTexCoord && position.stride == sizeof(Vertex) &&
+			normal.bufferView == position.bufferView && texCoord.bufferView == position.bufferView &&
+			normal.componentType == GL_FLOAT && texCoord.componentType == GL_FLOAT &&
+			normal.data == position.data + offsetof(Vertex, Normal) && texCoord.data == position.data + offsetof(Vertex, TexCoords) &&
+			((uintptr_t)position.data & 3) == 0;
+		if (interleaved)
+		{
+			primitive.vertices = (const Vertex*)position.data;
+		}
+		else
+		{
+			primitive.gatheredVertices.resize(position.count);
+			for (size_t i = 0; i < position.count; i++)
+			{
+				Vertex& vertex = primitive.gatheredVertices[i];
+				vertex.Normal = glm::vec3(0.0f);
+				vertex.TexCoords = glm::vec2(0.0f);
+				_gltfRead(position, i, glm::value_ptr(vertex.Position));
+				if (hasNormal && normal.components == 3)
+					_gltfRead(normal, i, glm::value_ptr(vertex.Normal));
+				if (hasTexCoord && texCoord.components == 2)
+					_gltfRead(texCoord, i, glm::value_ptr(vertex.TexCoords));
+			}
+			primitive.vertices = primitive.gatheredVertices.data();
+		}
+
+		if (_gltfAccessor(document, bin, binSize, json.intOr("indices", -1), &indices))
+		{
+			primitive.indexCount = (GLsizei)indices.count;
+			const size_t size = _gltfComponentSize(indices.componentType);
+			if ((indices.componentType == GL_UNSIGNED_SHORT || indices.componentType == GL_UNSIGNED_INT) && indices.stride == size &&
+				((uintptr_t)indices.data & (size - 1)) == 0)
+			{
+				primitive.indices = indices.data;
+				primitive.indexType = (GLenum)indices.componentType;
+			}
+			else
+			{
+				primitive.gatheredIndices.resize(indices.count);
+				for (size_t i = 0; i < indices.count; i++)
+				{
+					const uint8_t* element = indices.data + i * indices.stride;
+					uint32_t index = 0;
+					memcpy(&index, element, size);
+					primitive.gatheredIndices[i] = index;
+				}
+			}
+		}
+		else
+		{
+			// Not indexed, every three vertices are a triangle
+			primitive.indexCount = primitive.vertexCount;
+			primitive.gatheredIndices.resize(primitive.vertexCount);
+			for (GLsizei i = 0; i < primitive.vertexCount; i++)
+				primitive.gatheredIndices[i] = (GLuint)i;
+		}
+		if (!primitive.indices)
+		{
+			primitive.indices = primitive.gatheredIndices.data();
+			primitive.indexType = GL_UNSIGNED_INT;
+		}
+
+		glm::vec4 baseColor(1.0f);
+		const JsonValue* materials = document.get("materials");
+		const JsonValue* material = materials ? materials->at(json.intOr("material", -1)) : nullptr;
+		const JsonValue* pbr = material ? material->get("pbrMetallicRoughness") : nullptr;
+		const JsonValue* factor = pbr ? pbr->get("baseColorFactor") : nullptr;
+		if (factor && factor->size() == 4)
+		{
+			for (int c = 0; c < 4; c++)
+				baseColor[c] = (float)factor->items[c].number;
+		}
+		const aiColor3D color(baseColor.x, baseColor.y, baseColor.z);
+		primitive.colors = { color, color, aiColor3D(1.0f, 1.0f, 1.0f) };
+	}
+	return true;
+}
+
+// The node's own transform, a matrix or translation/rotation/scale
+static glm::mat4 _gltfLocalTransform(const JsonValue& node)
+{
+	glm::mat4 transform;
+	const JsonValue* matrix = node.get("matrix");
+	if (matrix && matrix->size() == 16)
+	{
+		// Column major, like glm
+		for (int i = 0; i < 16; i++)
+			glm::value_ptr(transform)[i] = (float)matrix->items[i].number;
+		return transform;
+	}
+	const JsonValue* translation = node.get("translation");
+	const JsonValue* rotation = node.get("rotation");
+	const JsonValue* scale = node.get("scale");
+	if (translation && translation->size() == 3)
+		transform = glm::translate(transform, glm::vec3((float)translation->items[0].number, (float)translation->items[1].number, (float)translation->items[2].number));
+	if (rotation && rotation->size() == 4)
+	{
+		// x, y, z, w in the file, w first for glm
+		const glm::quat q((float)rotation->items[3].number, (float)rotation->items[0].number, (float)rotation->items[1].number, (float)rotation->items[2].number);
+		transform = transform * glm::mat4_cast(q);
+	}
+	if (scale && scale->size() == 3)
+		transform = glm::scale(transform, glm::vec3((float)scale->items[0].number, (float)scale->items[1].number, (float)scale->items[2].number));
+	return transform;
+}
+
+// Adds the placements of node and its children, parent being the world matrix above node. meshFirst holds the
+// index in scene->primitives of each glTF mesh's first primitive.
+static void _gltfPlaceNode(const JsonValue& document, int index, const glm::mat4& parent, const uint8_t* bin, size_t binSize,
+	const vector<size_t>& meshFirst, GltfScene* scene, int depth = 0)
+{
+	const JsonValue* nodes = document.get("nodes");
+	const JsonValue* node = nodes ? nodes->at(index) : nullptr;
+	if (!node || depth > 64)
+		return;
+	const glm::mat4 world = parent * _gltfLocalTransform(*node);
+
+	const int mesh = node->intOr("mesh", -1);
+	if (mesh >= 0 && (size_t)mesh + 1 < meshFirst.size())
+	{
+		vector<glm::mat4> placements;
+		const JsonValue* extensions = node->get("extensions");
+		const JsonValue* instancing = extensions ? extensions->get("EXT_mesh_gpu_instancing") : nullptr;
+		const JsonValue* attributes = instancing ? instancing->get("attributes") : nullptr;
+		if (attributes)
+		{
+			GltfAccessor translation, rotation, scale;
+			const bool hasTranslation = _gltfAccessor(document, bin, binSize, attributes->intOr("TRANSLATION", -1), &translation) && translation.components == 3;
+			const bool hasRotation = _gltfAccessor(document, bin, binSize, attributes->intOr("ROTATION", -1), &rotation) && rotation.components == 4;
+			const bool hasScale = _gltfAccessor(document, bin, binSize, attributes->intOr("SCALE", -1), &scale) && scale.components == 3;
+			const size_t count = hasTranslation ? translation.count : hasRotation ? rotation.count : hasScale ? scale.count : 0;
+			placements.reserve(count);
+			for (size_t i = 0; i < count; i++)
+			{
+				glm::vec3 t(0.0f), s(1.0f);
+				float r[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+				if (hasTranslation && i < translation.count)
+					_gltfRead(translation, i, glm::value_ptr(t));
+				if (hasRotation && i < rotation.count)
+					_gltfRead(rotation, i, r);
+				if (hasScale && i < scale.count)
+					_gltfRead(scale, i, glm::value_ptr(s));
+				placements.push_back(world * glm::translate(glm::mat4(), t) * glm::mat4_cast(glm::quat(r[3], r[0], r[1], r[2])) * glm::scale(glm::mat4(), s));
+			}
+		}
+		else
+		{
+			placements.push_back(world);
+		}
+		for (size_t p = meshFirst[mesh]; p < meshFirst[mesh + 1]; p++)
+			scene->primitives[p].placements.insert(scene->primitives[p].placements.end(), placements.begin(), placements.end());
+	}
+
+	const JsonValue* children = node->get("children");
+	if (children)
+	{
+		for (const JsonValue& child : children->items)
+			_gltfPlaceNode(document, (int)child.number, world, bin, binSize, meshFirst, scene, depth + 1);
+	}
+}
+
+// Imports the .glb at path, from _assetPack if it's packed. Primitives no node of the scene places are dropped.
+static bool _importGltf(const string& path, GltfScene* scene)
+{
+	AssetSpan span;
+	if (!_assetPack.find(path, &span))
+	{
+		if (!scene->file.open(path))
+		{
+			cout << "ERROR::GLTF::NOT_FOUND " << path << endl;
+			return false;
+		}
+		span.data = scene->file.data();
+		span.size = scene->file.size();
+	}
+
+	// 12 byte header, then chunks of a length, a type and the data padded to 4 bytes
+	uint32_t header[3];
+	if (span.size < sizeof(header))
+	{
+		cout << "ERROR::GLTF::NOT_GLB " << path << endl;
+		return false;
+	}
+	memcpy(header, span.data, sizeof(header));
+	if (header[0] != GLB_MAGIC || header[1] != GLB_VERSION || header[2] > span.size)
+	{
+		cout << "ERROR::GLTF::NOT_GLB " << path << endl;
+		return false;
+	}
+	const uint8_t* json = nullptr;
+	const uint8_t* bin = nullptr;
+	size_t jsonSize = 0, binSize = 0;
+	for (size_t offset = sizeof(header); offset + 8 <= header[2];)
+	{
+		uint32_t chunk[2];
+		memcpy(chunk, span.data + offset, sizeof(chunk));
+		offset += sizeof(chunk);
+		if (chunk[0] > header[2] - offset)
+			break;
+		if (chunk[1] == GLB_CHUNK_JSON && !json)
+		{
+			json = span.data + offset;
+			jsonSize = chunk[0];
+		}
+		else if (chunk[1] == GLB_CHUNK_BIN && !bin)
+		{
+			bin = span.data + offset;
+			binSize = chunk[0];
+		}
+		offset += (chunk[0] + 3) & ~3u;
+	}
+	JsonValue document;
+	if (!json || !_parseJson((const char*)json, (const char*)json + jsonSize, &document) || document.type != JsonValue::Type::Object)
+	{
+		cout << "ERROR::GLTF::BAD_JSON " << path << endl;
+		return false;
+	}
+
+	// Every mesh's primitives, then placed by walking the scene's nodes
+	vector<size_t> meshFirst;
+	const JsonValue* meshes = document.get("meshes");
+	if (meshes)
+	{
+		for (const JsonValue& mesh : meshes->items)
+		{
+			meshFirst.push_back(scene->primitives.size());
+			if (!_gltfPrimitives(document, mesh, bin, binSize, scene))
+			{
+				cout << "ERROR::GLTF::BAD_MESH " << path << endl;
+				return false;
+			}
+		}
+	}
+	meshFirst.push_back(scene->primitives.size());
+
+	const JsonValue* scenes = document.get("scenes");
+	const JsonValue* root = scenes ? scenes->at(document.intOr("scene", 0)) : nullptr;
+	const JsonValue* roots = root ? root->get("nodes") : nullptr;
+	if (roots)
+	{
+		for (const JsonValue& node : roots->items)
+			_gltfPlaceNode(document, (int)node.number, glm::mat4(), bin, binSize, meshFirst, scene);
+	}
+
+	// Moving a primitive moves its gathered copies' storage with it, so its pointers stay valid
+	vector<GltfPrimitive> placed;
+	for (GltfPrimitive& primitive : scene->primitives)
+	{
+		if (!primitive.placements.empty())
+			placed.push_back(std::move(primitive));
+	}
+	scene->primitives = std::move(placed);
+	return true;
+}
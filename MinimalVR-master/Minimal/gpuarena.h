@@ -0,0 +1,299 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <mutex>
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "renderstats.h"
+#include "gpumemory.h"
+#include "gldebug.h"
+
+// Size of a regular page. Larger allocations get a page of their own, freed again once it empties. Empty regular
+// pages stay until trim().
+#define GPU_ARENA_PAGE_BYTES (8 * 1024 * 1024)
+// Every offset and size is rounded to this, a multiple of sizeof(Vertex) so a mesh's first vertex is also a base vertex
+#define GPU_ARENA_ALIGNMENT 32
+
+// A range of one arena page. Vertex attributes and index pointers are relative to offset.
+struct GpuBlock
+{
+	GLuint buffer = 0;
+	GLintptr offset = 0;
+	GLsizeiptr size = 0;
+
+	bool valid() const { return this->buffer != 0; }
+};
+
+struct GpuArenaStats
+{
+	uint32_t pages;
+	uint32_t blocks;
+	// Page storage held on the GPU, and the part of it handed out
+	uint64_t bytesResident;
+	uint64_t bytesUsed;
+	// Largest single free range, a request above it needs a new page even if bytesResident - bytesUsed is enough
+	uint64_t largestFree;
+
+	// 0 when all free space is one range, towards 1 as it splinters
+	float fragmentation() const
+	{
+		uint64_t freeBytes = this->bytesResident - this->bytesUsed;
+		return freeBytes ? 1.0f - (float)this->largestFree / (float)freeBytes : 0.0f;
+	}
+};
+
+// Sub-allocates vertex and index storage out of a few large buffers instead of a buffer pair per mesh.
+//
+// Pages are immutable storage (glBufferStorage, uploads through glBufferSubData) where ARB_buffer_storage is
+// there, plain glBufferData otherwise. Each page keeps its free ranges sorted by offset; allocation is first
+// fit and freeing merges with the neighbours, so a scene that is rebuilt reuses the ranges the last one had.
+// Freed ranges only become reusable once a fence put in at the following endFrame() has signalled, since a
+// draw still in flight may read them. Callable from the loader context as well as the render thread.
+class GpuArena
+{
+public:
+	// Pages live as long as the app's context, the one arena is only destroyed with it
+	GpuArena() {}
+
+	GpuArena(const GpuArena&) = delete;
+	GpuArena& operator=(const GpuArena&) = delete;
+
+	// An empty block if size is 0
+	GpuBlock allocate(GLsizeiptr size)
+	{
+		GpuBlock block;
+		if (size <= 0)
+			return block;
+		const GLsizeiptr aligned = align(size);
+		std::lock_guard<std::mutex> lock(this->mutex);
+		for (size_t i = 0; i < this->pages.size(); i++)
+		{
+			if (this->pages[i].buffer && this->take(this->pages[i], aligned, &block))
+				return block;
+		}
+		Page& page = this->addPage(aligned > GPU_ARENA_PAGE_BYTES ? aligned : GPU_ARENA_PAGE_BYTES);
+		this->take(page, aligned, &block);
+		return block;
+	}
+
+	// Allocates and fills a block, data may be NULL to leave it undefined
+	GpuBlock upload(const void* data, GLsizeiptr size)
+	{
+		GpuBlock block = this->allocate(size);
+		if (block.valid() && data)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, block.buffer);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, block.offset, size, data);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			_renderStats.uploaded(size);
+		}
+		return block;
+	}
+
+	// Hands the range back after the frames that may still draw from it, and clears block
+	void free(GpuBlock& block)
+	{
+		if (!block.valid())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->pending.push_back(block);
+		}
+		block = GpuBlock();
+	}
+
+	// Render thread, after the frame's draws: fences the ranges freed since the last call, and returns the
+	// ones whose fence has signalled to their pages
+	void endFrame()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (!this->pending.empty())
+		{
+			Retiring retiring;
+			retiring.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			retiring.blocks.swap(this->pending);
+			this->retiring.push_back(std::move(retiring));
+		}
+		size_t done = 0;
+		while (done < this->retiring.size())
+		{
+			GLenum status = glClientWaitSync(this->retiring[done].fence, 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				break;
+			glDeleteSync(this->retiring[done].fence);
+			for (size_t i = 0; i < this->retiring[done].blocks.size(); i++)
+				this->give(this->retiring[done].blocks[i]);
+			done++;
+		}
+		this->retiring.erase(this->retiring.begin(), this->retiring.begin() + done);
+	}
+
+	// Deletes the empty regular pages past the first one, for when the Meshes budget is exceeded. Returns the bytes
+	// given back.
+	int64_t trim()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		int64_t freed = 0;
+		bool keptOne = false;
+		for (size_t i = 0; i < this->pages.size(); i++)
+		{
+			Page& page = this->pages[i];
+			if (!page.buffer || page.blocks > 0)
+				continue;
+			if (!keptOne)
+			{
+				keptOne = true;
+				continue;
+			}
+			freed += page.size;
+			this->deletePage(page);
+		}
+		return freed;
+	}
+
+	GpuArenaStats stats()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		GpuArenaStats stats = {};
+		for (size_t i = 0; i < this->pages.size(); i++)
+		{
+			const Page& page = this->pages[i];
+			if (!page.buffer)
+				continue;
+			stats.pages++;
+			stats.blocks += page.blocks;
+			stats.bytesResident += (uint64_t)page.size;
+			GLsizeiptr freeBytes = 0;
+			for (size_t j = 0; j < page.free.size(); j++)
+			{
+				freeBytes += page.free[j].size;
+				if ((uint64_t)page.free[j].size > stats.largestFree)
+					stats.largestFree = (uint64_t)page.free[j].size;
+			}
+			stats.bytesUsed += (uint64_t)(page.size - freeBytes);
+		}
+		return stats;
+	}
+
+private:
+	struct Range
+	{
+		GLintptr offset;
+		GLsizeiptr size;
+	};
+
+	struct Page
+	{
+		GLuint buffer;
+		GLsizeiptr size;
+		// Sorted by offset, never two adjacent
+		vector<Range> free;
+		uint32_t blocks;
+	};
+
+	struct Retiring
+	{
+		GLsync fence;
+		vector<GpuBlock> blocks;
+	};
+
+	std::mutex mutex;
+	// Slots of released oversized pages are reused, so a Page is found by its buffer
+	vector<Page> pages;
+	vector<GpuBlock> pending;
+	vector<Retiring> retiring;
+
+	static GLsizeiptr align(GLsizeiptr size)
+	{
+		return (size + GPU_ARENA_ALIGNMENT - 1) & ~(GLsizeiptr)(GPU_ARENA_ALIGNMENT - 1);
+	}
+
+	Page& addPage(GLsizeiptr size)
+	{
+		Page page;
+		page.size = size;
+		page.blocks = 0;
+		page.free.push_back(Range{ 0, size });
+		glGenBuffers(1, &page.buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, page.buffer);
+		_glLabel(GL_BUFFER, page.buffer, "gpu arena page");
+		if (GLEW_ARB_buffer_storage)
+			glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, GL_DYNAMIC_STORAGE_BIT);
+		else
+			glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		_gpuMemory.charge(GpuMemoryCategory::Meshes, size);
+		for (size_t i = 0; i < this->pages.size(); i++)
+		{
+			if (!this->pages[i].buffer)
+			{
+				this->pages[i] = std::move(page);
+				return this->pages[i];
+			}
+		}
+		this->pages.push_back(std::move(page));
+		return this->pages.back();
+	}
+
+	bool take(Page& page, GLsizeiptr size, GpuBlock* block)
+	{
+		for (size_t i = 0; i < page.free.size(); i++)
+		{
+			Range& range = page.free[i];
+			if (range.size < size)
+				continue;
+			block->buffer = page.buffer;
+			block->offset = range.offset;
+			block->size = size;
+			range.offset += size;
+			range.size -= size;
+			if (range.size == 0)
+				page.free.erase(page.free.begin() + i);
+			page.blocks++;
+			return true;
+		}
+		return false;
+	}
+
+	void give(const GpuBlock& block)
+	{
+		for (size_t p = 0; p < this->pages.size(); p++)
+		{
+			Page& page = this->pages[p];
+			if (page.buffer != block.buffer)
+				continue;
+			vector<Range>& ranges = page.free;
+			size_t i = 0;
+			while (i < ranges.size() && ranges[i].offset < block.offset)
+				i++;
+			ranges.insert(ranges.begin() + i, Range{ block.offset, block.size });
+			if (i + 1 < ranges.size() && ranges[i].offset + ranges[i].size == ranges[i + 1].offset)
+			{
+				ranges[i].size += ranges[i + 1].size;
+				ranges.erase(ranges.begin() + i + 1);
+			}
+			if (i > 0 && ranges[i - 1].offset + ranges[i - 1].size == ranges[i].offset)
+			{
+				ranges[i - 1].size += ranges[i].size;
+				ranges.erase(ranges.begin() + i);
+			}
+			page.blocks--;
+			if (page.blocks == 0 && page.size > GPU_ARENA_PAGE_BYTES)
+				this->deletePage(page);
+			return;
+		}
+	}
+
+	void deletePage(Page& page)
+	{
+		glDeleteBuffers(1, &page.buffer);
+		_gpuMemory.release(GpuMemoryCategory::Meshes, page.size);
+		page.buffer = 0;
+		page.free.clear();
+	}
+};
+
+// Vertex and index storage of every Mesh and avatar mesh
+static GpuArena _gpuArena;
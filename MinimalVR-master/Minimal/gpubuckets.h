@@ -0,0 +1,248 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "profiler.h"
+#include "telemetrysink.h"
+
+// Buckets a GpuBucketTimer can attribute to, and timed ranges a frame may open across all of them
+#define GPU_BUCKET_MAX 16
+#define GPU_BUCKET_RANGES 128
+// Frames a bucket's time is averaged over before it is shown and sent, about half a second at 90 Hz
+#define GPU_BUCKET_WINDOW 45
+static_assert(GPU_BUCKET_MAX * 2 * sizeof(float) <= TELEMETRY_MAX_PARTS * TELEMETRY_RECORD_PAYLOAD, "A window's record fits its parts");
+
+// GPU time by what was drawn rather than by phase: the factory, each molecule type, the avatar's parts and so on.
+//
+// A bucket may be timed any number of times a frame, once per eye and again for a depth pre-pass, and its ranges
+// are summed. Each range is a pair of GL_TIMESTAMP queries from a pool of GPU_BUCKET_RANGES a frame, in a ring
+// PROFILER_LATENCY frames deep like FrameProfiler's, read back without waiting. Ranges past the pool are dropped
+// and counted. Frames are averaged over GPU_BUCKET_WINDOW so no one frame's noise, or a frame read late, moves
+// the numbers; ms() and peakMs() are the last full window's, and with a TelemetrySink each window goes to it as a
+// DrawBuckets record. Buckets may be added at any time, a bucket with the name of one already there is that one.
+//
+// Render thread only. Buckets shouldn't overlap each other, so they add up to no more than the GPU's frame.
+class GpuBucketTimer
+{
+public:
+	GpuBucketTimer() {}
+
+	GpuBucketTimer(const GpuBucketTimer&) = delete;
+	GpuBucketTimer& operator=(const GpuBucketTimer&) = delete;
+
+	int addBucket(const char* name)
+	{
+		for (size_t i = 0; i < this->names.size(); i++)
+		{
+			if (this->names[i] == name)
+				return (int)i;
+		}
+		if (this->names.size() >= GPU_BUCKET_MAX)
+			return -1;
+		this->names.push_back(name);
+		return (int)this->names.size() - 1;
+	}
+
+	// Needs a current GL context, sink may be null to write no records
+	void init(TelemetrySink* sink = nullptr)
+	{
+		glGenQueries(PROFILER_LATENCY * GPU_BUCKET_RANGES * 2, &this->queries[0][0][0]);
+		if (sink && sink->isOpen())
+			this->sink = sink;
+		this->initialized = true;
+	}
+
+	size_t bucketCount() const { return this->names.size(); }
+	const string& bucketName(int bucket) const { return this->names[bucket]; }
+
+	void beginFrame(uint64_t frameIndex)
+	{
+		if (!this->initialized)
+			return;
+		this->slot = (this->slot + 1) % PROFILER_LATENCY;
+		Frame& frame = this->frames[this->slot];
+		if (frame.pending)
+			this->resolve(frame, true);
+		frame.index = frameIndex;
+		frame.pending = true;
+		frame.ranges = 0;
+		for (int i = 0; i < GPU_BUCKET_MAX; i++)
+			this->open[i] = -1;
+	}
+
+	// A bucket already open this frame isn't opened again, nesting a bucket in itself would count it twice
+	void begin(int bucket)
+	{
+		if (!this->initialized || bucket < 0 || this->open[bucket] >= 0)
+			return;
+		Frame& frame = this->frames[this->slot];
+		if (frame.ranges >= GPU_BUCKET_RANGES)
+		{
+			this->overflows++;
+			return;
+		}
+		const int range = frame.ranges++;
+		frame.buckets[range] = (uint8_t)bucket;
+		frame.closed[range] = false;
+		this->open[bucket] = range;
+		glQueryCounter(this->queries[this->slot][range][0], GL_TIMESTAMP);
+	}
+
+	void end(int bucket)
+	{
+		if (!this->initialized || bucket < 0 || this->open[bucket] < 0)
+			return;
+		const int range = this->open[bucket];
+		this->open[bucket] = -1;
+		this->frames[this->slot].closed[range] = true;
+		glQueryCounter(this->queries[this->slot][range][1], GL_TIMESTAMP);
+	}
+
+	// Collects the oldest frame whose queries have landed
+	void endFrame()
+	{
+		if (!this->initialized)
+			return;
+		Frame& oldest = this->frames[(this->slot + 1) % PROFILER_LATENCY];
+		if (oldest.pending)
+			this->resolve(oldest, false);
+	}
+
+	// The last full window's average GPU ms a frame, and its worst frame
+	float ms(int bucket) const { return bucket < 0 ? 0.0f : this->latest[bucket]; }
+	float peakMs(int bucket) const { return bucket < 0 ? 0.0f : this->latestPeak[bucket]; }
+	// Last frame of the last full window
+	uint64_t windowFrame() const { return this->latestFrame; }
+	// Ranges dropped for want of queries, since init()
+	uint32_t overflowCount() const { return this->overflows; }
+
+private:
+	struct Frame
+	{
+		uint64_t index = 0;
+		bool pending = false;
+		int ranges = 0;
+		uint8_t buckets[GPU_BUCKET_RANGES];
+		bool closed[GPU_BUCKET_RANGES];
+	};
+
+	vector<string> names;
+	bool initialized = false;
+	GLuint queries[PROFILER_LATENCY][GPU_BUCKET_RANGES][2];
+	Frame frames[PROFILER_LATENCY];
+	int slot = 0;
+	// The range each bucket has open in the current frame, -1 for none
+	int open[GPU_BUCKET_MAX];
+	uint32_t overflows = 0;
+	// The window being summed up
+	float sum[GPU_BUCKET_MAX] = {};
+	float peak[GPU_BUCKET_MAX] = {};
+	uint32_t windowFrames = 0;
+	float latest[GPU_BUCKET_MAX] = {};
+	float latestPeak[GPU_BUCKET_MAX] = {};
+	uint64_t latestFrame = 0;
+	TelemetrySink* sink = nullptr;
+	// Buckets the sink's schema names, more may have been added since
+	size_t described = 0;
+
+	// Reads the GPU side of a frame into the window. Unless forced, gives up without blocking if a result isn't
+	// there yet.
+	void resolve(Frame& frame, bool force)
+	{
+		const int frameSlot = (int)(&frame - this->frames);
+		if (!force)
+		{
+			for (int i = 0; i < frame.ranges; i++)
+			{
+				if (!frame.closed[i])
+					continue;
+				GLint available = 0;
+				glGetQueryObjectiv(this->queries[frameSlot][i][1], GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available)
+					return;
+			}
+		}
+
+		float ms[GPU_BUCKET_MAX] = {};
+		for (int i = 0; i < frame.ranges; i++)
+		{
+			if (!frame.closed[i])
+				continue;
+			GLuint64 start = 0, stop = 0;
+			glGetQueryObjectui64v(this->queries[frameSlot][i][0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(this->queries[frameSlot][i][1], GL_QUERY_RESULT, &stop);
+			if (stop > start)
+				ms[frame.buckets[i]] += (float)((double)(stop - start) * 1e-6);
+		}
+		frame.pending = false;
+
+		for (size_t b = 0; b < this->names.size(); b++)
+		{
+			this->sum[b] += ms[b];
+			this->peak[b] = std::max(this->peak[b], ms[b]);
+		}
+		if (++this->windowFrames < GPU_BUCKET_WINDOW)
+			return;
+		for (size_t b = 0; b < GPU_BUCKET_MAX; b++)
+		{
+			this->latest[b] = this->sum[b] / (float)this->windowFrames;
+			this->latestPeak[b] = this->peak[b];
+			this->sum[b] = 0.0f;
+			this->peak[b] = 0.0f;
+		}
+		this->latestFrame = frame.index;
+		this->windowFrames = 0;
+		this->publish();
+	}
+
+	void publish()
+	{
+		if (!this->sink || this->names.empty())
+			return;
+		if (this->described != this->names.size())
+		{
+			string schema = "f32 ";
+			for (size_t b = 0; b < this->names.size(); b++)
+				schema += (b ? "," : "") + this->names[b] + "_gpu_ms";
+			for (size_t b = 0; b < this->names.size(); b++)
+				schema += "," + this->names[b] + "_peak_gpu_ms";
+			this->sink->describe(TelemetryKind::DrawBuckets, schema);
+			this->described = this->names.size();
+		}
+		float times[GPU_BUCKET_MAX * 2];
+		for (size_t b = 0; b < this->names.size(); b++)
+		{
+			times[b] = this->latest[b];
+			times[this->names.size() + b] = this->latestPeak[b];
+		}
+		this->sink->writeParts(TelemetryKind::DrawBuckets, times, this->names.size() * 2 * sizeof(float), (uint32_t)this->latestFrame);
+	}
+};
+
+static GpuBucketTimer _gpuBuckets;
+
+// Times the enclosing block as one range of a bucket
+class GpuBucketScope
+{
+public:
+	explicit GpuBucketScope(int bucket) : bucket(bucket)
+	{
+		_gpuBuckets.begin(this->bucket);
+	}
+	~GpuBucketScope()
+	{
+		_gpuBuckets.end(this->bucket);
+	}
+
+	GpuBucketScope(const GpuBucketScope&) = delete;
+	GpuBucketScope& operator=(const GpuBucketScope&) = delete;
+
+private:
+	int bucket;
+};
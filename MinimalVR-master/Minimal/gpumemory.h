@@ -0,0 +1,280 @@
+#pragma once
+// Std. Includes
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+
+#ifndef GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX
+#define GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX 0x9048
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#define GL_GPU_MEMORY_INFO_EVICTED_MEMORY_NVX 0x904B
+#endif
+#ifndef GL_TEXTURE_FREE_MEMORY_ATI
+#define GL_VBO_FREE_MEMORY_ATI 0x87FB
+#define GL_TEXTURE_FREE_MEMORY_ATI 0x87FC
+#endif
+
+// Frames between driver queries, some drivers take a lock for them
+#define GPU_MEMORY_QUERY_FRAMES 90
+// Default budgets of the categories that can give memory back, in MB. --texture-budget and --mesh-budget set them.
+#define GPU_MEMORY_TEXTURE_BUDGET_MB 512
+#define GPU_MEMORY_MESH_BUDGET_MB 256
+// Video memory the driver should always have left, in MB, --vram-reserve sets it. Below it the evictable
+// categories are treated as over budget by the shortfall, whatever their own budgets say.
+#define GPU_MEMORY_DEFAULT_RESERVE_MB 256
+
+// What GPU memory is held for
+enum class GpuMemoryCategory : uint8_t {
+	// Compositor swap chains and the mirror texture, every buffer of each
+	SwapChains,
+	// What the eyes are drawn into before the swap chains: depth, the MSAA and multiview targets, the inset's depth
+	// and the reflection
+	EyeTargets,
+	// _gpuArena pages, which hold every Mesh and avatar mesh
+	Meshes,
+	// TextureCache textures and avatar texture pages
+	Textures,
+	UniformRing,
+	Count,
+};
+
+static const char* const GPU_MEMORY_CATEGORY_NAMES[(int)GpuMemoryCategory::Count] = {
+	"swap_chains", "eye_targets", "meshes", "textures", "uniform_ring",
+};
+
+// What the driver says about video memory, in KB. valid is false where neither GL_NVX_gpu_memory_info nor
+// GL_ATI_meminfo is there; ATI only reports what is free, so total stays 0 there.
+struct GpuDriverMemory
+{
+	bool valid = false;
+	int64_t totalKB = 0;
+	int64_t availableKB = 0;
+	// NVX only: what the driver had to page out to system memory since the start
+	int64_t evictedKB = 0;
+};
+
+// Bytes the app holds on the GPU by category, against a budget per category.
+//
+// Whoever creates GL storage charges it here and gives the charge back when the storage is deleted, either
+// through charge()/release() for things that live as long as the context, or by holding a GpuAllocation next to
+// the GL name. The counts are what the app asked for, format sizes times texels; drivers pad and keep more
+// besides, which the driver query shows. Charging is safe from any thread, the query needs the render context.
+class GpuMemoryTracker
+{
+public:
+	GpuMemoryTracker()
+	{
+		for (int i = 0; i < (int)GpuMemoryCategory::Count; i++)
+		{
+			this->used[i].store(0, std::memory_order_relaxed);
+			this->budgets[i] = 0;
+		}
+		this->budgets[(int)GpuMemoryCategory::Textures] = (int64_t)GPU_MEMORY_TEXTURE_BUDGET_MB << 20;
+		this->budgets[(int)GpuMemoryCategory::Meshes] = (int64_t)GPU_MEMORY_MESH_BUDGET_MB << 20;
+	}
+
+	GpuMemoryTracker(const GpuMemoryTracker&) = delete;
+	GpuMemoryTracker& operator=(const GpuMemoryTracker&) = delete;
+
+	// After glewInit, picks whichever vendor query the driver has
+	void init()
+	{
+		if (GLEW_NVX_gpu_memory_info)
+			this->vendor = Vendor::Nvx;
+		else if (GLEW_ATI_meminfo)
+			this->vendor = Vendor::Ati;
+		this->query();
+	}
+
+	void charge(GpuMemoryCategory category, int64_t bytes)
+	{
+		this->used[(int)category].fetch_add(bytes, std::memory_order_relaxed);
+	}
+
+	void release(GpuMemoryCategory category, int64_t bytes)
+	{
+		this->used[(int)category].fetch_sub(bytes, std::memory_order_relaxed);
+	}
+
+	int64_t bytes(GpuMemoryCategory category) const
+	{
+		return this->used[(int)category].load(std::memory_order_relaxed);
+	}
+
+	int64_t total() const
+	{
+		int64_t sum = 0;
+		for (int i = 0; i < (int)GpuMemoryCategory::Count; i++)
+			sum += this->used[i].load(std::memory_order_relaxed);
+		return sum;
+	}
+
+	// 0 is no budget. Only Meshes and Textures have anything to evict, the others' budgets just get reported.
+	void setBudget(GpuMemoryCategory category, int64_t bytes) { this->budgets[(int)category] = bytes; }
+	int64_t budget(GpuMemoryCategory category) const { return this->budgets[(int)category]; }
+
+	void setReserve(int64_t bytes) { this->reserve = bytes; }
+
+	// Bytes category has to give back: what it holds past its budget, or for Meshes and Textures the driver's
+	// shortfall below the reserve if that is more. 0 when nothing needs to go.
+	int64_t excess(GpuMemoryCategory category) const
+	{
+		const int64_t budget = this->budgets[(int)category];
+		int64_t over = budget > 0 ? std::max<int64_t>(this->bytes(category) - budget, 0) : 0;
+		if ((category == GpuMemoryCategory::Meshes || category == GpuMemoryCategory::Textures) && this->driver.valid && this->reserve > 0)
+			over = std::max(over, this->reserve - this->driver.availableKB * 1024);
+		return over;
+	}
+
+	// Once a frame on the render thread, queries the driver every GPU_MEMORY_QUERY_FRAMES frames
+	void update(uint64_t frame)
+	{
+		if (frame - this->queriedFrame >= GPU_MEMORY_QUERY_FRAMES)
+		{
+			this->queriedFrame = frame;
+			this->query();
+		}
+	}
+
+	// As of the latest query
+	const GpuDriverMemory& driverMemory() const { return this->driver; }
+
+	void print() const
+	{
+		printf("GPU memory by category:\r\n");
+		for (int i = 0; i < (int)GpuMemoryCategory::Count; i++)
+		{
+			printf("  %-16s %8lld KB", GPU_MEMORY_CATEGORY_NAMES[i], (long long)(this->used[i].load(std::memory_order_relaxed) / 1024));
+			if (this->budgets[i] > 0)
+				printf(" of %lld KB", (long long)(this->budgets[i] / 1024));
+			printf("\r\n");
+		}
+		if (this->driver.valid)
+			printf("  driver available %lld KB of %lld KB, %lld KB evicted\r\n", (long long)this->driver.availableKB,
+				(long long)this->driver.totalKB, (long long)this->driver.evictedKB);
+	}
+
+private:
+	enum class Vendor : uint8_t { None, Nvx, Ati };
+
+	std::atomic<int64_t> used[(int)GpuMemoryCategory::Count];
+	int64_t budgets[(int)GpuMemoryCategory::Count];
+	int64_t reserve = (int64_t)GPU_MEMORY_DEFAULT_RESERVE_MB << 20;
+	Vendor vendor = Vendor::None;
+	GpuDriverMemory driver;
+	uint64_t queriedFrame = 0;
+
+	void query()
+	{
+		GLint values[4] = {};
+		switch (this->vendor)
+		{
+		case Vendor::Nvx:
+			glGetIntegerv(GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &values[0]);
+			glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &values[1]);
+			glGetIntegerv(GL_GPU_MEMORY_INFO_EVICTED_MEMORY_NVX, &values[2]);
+			this->driver.valid = true;
+			this->driver.totalKB = values[0];
+			this->driver.availableKB = values[1];
+			this->driver.evictedKB = values[2];
+			break;
+		case Vendor::Ati:
+			// Total free, largest free block, then the same two for shared memory; the texture and buffer pools are the
+			// same memory on current drivers
+			glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, values);
+			this->driver.valid = true;
+			this->driver.availableKB = values[0];
+			break;
+		default:
+			break;
+		}
+	}
+};
+
+static GpuMemoryTracker _gpuMemory;
+
+// One charge against a category, given back when it is reset or destroyed. Move only, so exactly one owner
+// gives each charge back.
+class GpuAllocation
+{
+public:
+	GpuAllocation() {}
+	GpuAllocation(GpuMemoryCategory category, int64_t bytes)
+	{
+		this->reset(category, bytes);
+	}
+	~GpuAllocation()
+	{
+		this->reset();
+	}
+
+	GpuAllocation(const GpuAllocation&) = delete;
+	GpuAllocation& operator=(const GpuAllocation&) = delete;
+
+	GpuAllocation(GpuAllocation&& other) : category(other.category), size(other.size)
+	{
+		other.size = 0;
+	}
+	GpuAllocation& operator=(GpuAllocation&& other)
+	{
+		if (this != &other)
+		{
+			this->reset();
+			this->category = other.category;
+			this->size = other.size;
+			other.size = 0;
+		}
+		return *this;
+	}
+
+	// Gives back what was held and charges bytes to category instead
+	void reset(GpuMemoryCategory category, int64_t bytes)
+	{
+		this->reset();
+		this->category = category;
+		this->size = bytes;
+		_gpuMemory.charge(category, bytes);
+	}
+
+	void reset()
+	{
+		if (this->size)
+			_gpuMemory.release(this->category, this->size);
+		this->size = 0;
+	}
+
+	int64_t bytes() const { return this->size; }
+
+private:
+	GpuMemoryCategory category = GpuMemoryCategory::Textures;
+	int64_t size = 0;
+};
+
+// Bytes per texel of the uncompressed formats the app allocates, and an estimate of 4 for anything else
+static int64_t _gpuTexelBytes(GLenum format)
+{
+	switch (format)
+	{
+	case GL_R8:
+	case GL_R8UI:
+		return 1;
+	case GL_DEPTH_COMPONENT16:
+		return 2;
+	case GL_DEPTH32F_STENCIL8:
+	case GL_RGBA16F:
+		return 8;
+	default:
+		// RGB8 is padded to four bytes by every driver we know of, depth 24 keeps 8 bits beside it
+		return 4;
+	}
+}
+
+// Bytes of a width by height image of format, layers deep, times its samples. Mip chains are the caller's to add.
+static int64_t _gpuImageBytes(GLenum format, int64_t width, int64_t height, int64_t layers = 1, int64_t samples = 1)
+{
+	return _gpuTexelBytes(format) * width * height * layers * std::max<int64_t>(samples, 1);
+}
@@ -0,0 +1,510 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <initializer_list>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "glstate.h"
+#include "molecules.h"
+#include "picking.h"
+#include "culling.h"
+#include "hiz.h"
+#include "instancing.h"
+#include "model.h"
+#include "gldebug.h"
+
+// Levels of detail the cull pass sorts into, MOLECULE_LOD_LEVELS of the scene
+#define GPU_MOLECULE_LEVELS 3
+// Invocations per work group of the simulation and cull passes
+#define GPU_MOLECULE_GROUP_SIZE 64
+// Indirect draws the cull pass can fill in, meshes of every level of both types together
+#define GPU_MOLECULE_MAX_COMMANDS 64
+// Frames between a pick and reading its result back, so the read never waits on the GPU
+#define GPU_MOLECULE_READBACK_FRAMES 3
+
+// One molecule as the compute passes see it: the MoleculeType in position.w, orientation and per step spin as
+// quaternions, xyz the vector part, as MoleculeStore keeps them
+struct GpuMolecule
+{
+	glm::vec4 position;
+	glm::vec4 velocity;
+	glm::vec4 rotation;
+	glm::vec4 spin;
+};
+
+static const char GPU_MOLECULE_COMMON[] =
+	"#version 410 core\n"
+	"#extension GL_ARB_compute_shader : require\n"
+	"#extension GL_ARB_shader_storage_buffer_object : require\n"
+	"layout(local_size_x = 64) in;\n"
+	"struct Molecule { vec4 position; vec4 velocity; vec4 rotation; vec4 spin; };\n"
+	"layout(std430) buffer Molecules { Molecule molecules[]; };\n"
+	"uniform uint count;\n";
+
+// MoleculeStore::integrate for steps steps, then the test ColorCubeScene::pick makes: a CO2 molecule both lasers
+// pass within pickRadius of turns into O2
+static const char GPU_MOLECULE_SIMULATE[] =
+	"layout(std430) buffer Picks { uint conversions; };\n"
+	"uniform int steps;\n"
+	"uniform vec3 boundsMin;\n"
+	"uniform vec3 boundsMax;\n"
+	"uniform vec3 rayOrigin[2];\n"
+	"uniform vec3 rayDirection[2];\n"
+	"uniform float pickRadius;\n"
+	"uniform int picking;\n"
+	"bool nearRay(int r, vec3 p) {\n"
+	"    vec3 w = p - rayOrigin[r];\n"
+	"    vec3 closest = w - rayDirection[r] * max(dot(w, rayDirection[r]), 0.0);\n"
+	"    return dot(closest, closest) <= pickRadius * pickRadius;\n"
+	"}\n"
+	"void main() {\n"
+	"    uint i = gl_GlobalInvocationID.x;\n"
+	"    if (i >= count) return;\n"
+	"    Molecule m = molecules[i];\n"
+	"    for (int s = 0; s < steps; s++) {\n"
+	"        m.position.xyz += m.velocity.xyz;\n"
+	"        vec3 outside = max(vec3(greaterThanEqual(m.position.xyz, boundsMax)), vec3(lessThanEqual(m.position.xyz, boundsMin)));\n"
+	"        m.velocity.xyz *= 1.0 - 2.0 * outside;\n"
+	"        m.rotation = vec4(m.spin.w * m.rotation.xyz + m.rotation.w * m.spin.xyz + cross(m.spin.xyz, m.rotation.xyz),\n"
+	"                          m.spin.w * m.rotation.w - dot(m.spin.xyz, m.rotation.xyz));\n"
+	"        m.rotation *= 1.5 - 0.5 * dot(m.rotation, m.rotation);\n"
+	"    }\n"
+	"    if (picking != 0 && m.position.w == 0.0 && nearRay(0, m.position.xyz) && nearRay(1, m.position.xyz)) {\n"
+	"        m.position.w = 1.0;\n"
+	"        atomicAdd(conversions, 1u);\n"
+	"    }\n"
+	"    molecules[i] = m;\n"
+	"}\n";
+
+// Culls against both eyes' frustums and, when hiZLevels isn't 0, against a HiZPyramid of what is already drawn, then
+// picks the level the projected size asks for and appends the transform of every visible molecule to the instance
+// buffer of its type and level. counts[type * 3 + level] ends up as each buffer's length.
+static const char GPU_MOLECULE_CULL[] =
+	"layout(std430) buffer Counts { uint counts[6]; };\n"
+	"layout(std430) buffer Co2Level0 { mat4 co2Level0[]; };\n"
+	"layout(std430) buffer Co2Level1 { mat4 co2Level1[]; };\n"
+	"layout(std430) buffer Co2Level2 { mat4 co2Level2[]; };\n"
+	"layout(std430) buffer O2Level0 { mat4 o2Level0[]; };\n"
+	"layout(std430) buffer O2Level1 { mat4 o2Level1[]; };\n"
+	"layout(std430) buffer O2Level2 { mat4 o2Level2[]; };\n"
+	"uniform vec4 planes[12];\n"
+	"uniform vec3 eye;\n"
+	"uniform float focal;\n"
+	"uniform float scale;\n"
+	"uniform float radius[2];\n"
+	"uniform int levels[2];\n"
+	"uniform int forcedLod;\n"
+	"uniform float lodSizes[2];\n"
+	"uniform sampler2D hiZ;\n"
+	"uniform int hiZLevels;\n"
+	"uniform mat4 viewProjection[2];\n"
+	"uniform vec4 eyeViewport[2];\n"
+	"uniform int reversedDepth;\n"
+	"bool inside(int first, vec3 p, float r) {\n"
+	"    for (int k = 0; k < 6; k++)\n"
+	"        if (dot(planes[first + k].xyz, p) + planes[first + k].w < -r) return false;\n"
+	"    return true;\n"
+	"}\n"
+	// The sphere's box projected into the eye's part of the pyramid, tested at the level where it spans two texels.
+	// A box reaching behind the eye is never occluded.
+	"bool occluded(int e, vec3 p, float r) {\n"
+	"    if (hiZLevels == 0) return false;\n"
+	"    vec3 lo = vec3(1.0e9), hi = vec3(-1.0e9);\n"
+	"    for (int c = 0; c < 8; c++) {\n"
+	"        vec3 corner = p + r * vec3((c & 1) != 0 ? 1.0 : -1.0, (c & 2) != 0 ? 1.0 : -1.0, (c & 4) != 0 ? 1.0 : -1.0);\n"
+	"        vec4 clip = viewProjection[e] * vec4(corner, 1.0);\n"
+	"        if (clip.w <= 0.0) return false;\n"
+	"        lo = min(lo, clip.xyz / clip.w);\n"
+	"        hi = max(hi, clip.xyz / clip.w);\n"
+	"    }\n"
+	"    vec2 uvLo = clamp((lo.xy * eyeViewport[e].xy + eyeViewport[e].zw) * 0.5 + 0.5, 0.0, 1.0);\n"
+	"    vec2 uvHi = clamp((hi.xy * eyeViewport[e].xy + eyeViewport[e].zw) * 0.5 + 0.5, 0.0, 1.0);\n"
+	"    float nearest = reversedDepth != 0 ? hi.z : lo.z * 0.5 + 0.5;\n"
+	"    vec2 extent = (uvHi - uvLo) * vec2(textureSize(hiZ, 0));\n"
+	"    int level = min(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), hiZLevels - 1);\n"
+	"    ivec2 last = textureSize(hiZ, level) - 1;\n"
+	"    ivec2 a = min(ivec2(uvLo * vec2(last + 1)), last), b = min(ivec2(uvHi * vec2(last + 1)), last);\n"
+	"    vec4 d = vec4(texelFetch(hiZ, a, level).r, texelFetch(hiZ, b, level).r,\n"
+	"                  texelFetch(hiZ, ivec2(a.x, b.y), level).r, texelFetch(hiZ, ivec2(b.x, a.y), level).r);\n"
+	"    if (reversedDepth != 0) return nearest < min(min(d.x, d.y), min(d.z, d.w));\n"
+	"    return nearest > max(max(d.x, d.y), max(d.z, d.w));\n"
+	"}\n"
+	// MoleculeStore::transform, through _composeTransform
+	"mat4 transform(Molecule m) {\n"
+	"    vec4 q = m.rotation;\n"
+	"    mat3 r = mat3(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y),\n"
+	"                  2.0 * (q.x * q.y - q.w * q.z), 1.0 - 2.0 * (q.x * q.x + q.z * q.z), 2.0 * (q.y * q.z + q.w * q.x),\n"
+	"                  2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));\n"
+	"    return mat4(vec4(r[0] * scale, 0.0), vec4(r[1] * scale, 0.0), vec4(r[2] * scale, 0.0), vec4(m.position.xyz, 1.0));\n"
+	"}\n"
+	"void main() {\n"
+	"    uint i = gl_GlobalInvocationID.x;\n"
+	"    if (i >= count) return;\n"
+	"    Molecule m = molecules[i];\n"
+	"    int type = int(m.position.w);\n"
+	"    float r = radius[type] * scale;\n"
+	"    bool left = inside(0, m.position.xyz, r) && !occluded(0, m.position.xyz, r);\n"
+	"    if (!left && !(inside(6, m.position.xyz, r) && !occluded(1, m.position.xyz, r))) return;\n"
+	"    int level = levels[type] - 1;\n"
+	"    float size = r * focal / max(length(m.position.xyz - eye), 0.01);\n"
+	"    for (int l = levels[type] - 2; l >= 0; l--)\n"
+	"        if (size >= lodSizes[l]) level = l;\n"
+	"    if (forcedLod >= 0) level = min(forcedLod, levels[type] - 1);\n"
+	"    int bucket = type * 3 + level;\n"
+	"    uint slot = atomicAdd(counts[bucket], 1u);\n"
+	"    mat4 x = transform(m);\n"
+	"    if (bucket == 0) co2Level0[slot] = x;\n"
+	"    else if (bucket == 1) co2Level1[slot] = x;\n"
+	"    else if (bucket == 2) co2Level2[slot] = x;\n"
+	"    else if (bucket == 3) o2Level0[slot] = x;\n"
+	"    else if (bucket == 4) o2Level1[slot] = x;\n"
+	"    else o2Level2[slot] = x;\n"
+	"}\n";
+
+// Copies the cull pass's counts into the instance counts of the indirect draws
+static const char GPU_MOLECULE_FINALIZE[] =
+	"struct Command { uint count; uint instanceCount; uint firstIndex; uint baseVertex; uint baseInstance; };\n"
+	"layout(std430) buffer Commands { Command commands[]; };\n"
+	"layout(std430) buffer Counts { uint counts[6]; };\n"
+	"uniform uint commandCount;\n"
+	"uniform uint commandBucket[64];\n"
+	"uniform uint eyeCount;\n"
+	"void main() {\n"
+	"    if (gl_GlobalInvocationID.x != 0u) return;\n"
+	"    for (uint c = 0u; c < commandCount; c++)\n"
+	"        commands[c].instanceCount = counts[commandBucket[c]] * eyeCount;\n"
+	"}\n";
+
+static GLuint _compileMoleculeProgram(const char* name, const char* body)
+{
+	const char* sources[2] = { GPU_MOLECULE_COMMON, body };
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 2, sources, NULL);
+	glCompileShader(shader);
+	GLint success = 0;
+	char infoLog[512];
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+		std::cout << "ERROR::GPU_MOLECULES::COMPILATION_FAILED " << name << "\n" << infoLog << std::endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glLinkProgram(program);
+	glDeleteShader(shader);
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(program, sizeof(infoLog), NULL, infoLog);
+		std::cout << "ERROR::GPU_MOLECULES::LINKING_FAILED " << name << "\n" << infoLog << std::endl;
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+// The molecules of a scene simulated, picked, culled and sorted by level of detail in compute shaders, so the
+// CPU never touches them after load(). The transforms are written straight into the scene's instance buffers and
+// drawn with indirect draws whose instance counts the GPU fills in. Picks are read back through a small buffer
+// GPU_MOLECULE_READBACK_FRAMES frames later, when its fence has long passed.
+// Levels are picked by projected size alone, without the CPU path's hysteresis. Needs GL_ARB_compute_shader and
+// GL_ARB_shader_storage_buffer_object on top of the 4.1 context, see supported().
+class GpuMoleculeSimulation
+{
+public:
+	GpuMoleculeSimulation() {}
+	~GpuMoleculeSimulation()
+	{
+		GLuint buffers[] = { this->moleculeBuffer, this->countBuffer, this->pickBuffer, this->commandBuffer };
+		glDeleteBuffers(4, buffers);
+		glDeleteBuffers(GPU_MOLECULE_READBACK_FRAMES, this->readbackBuffers);
+		for (int i = 0; i < GPU_MOLECULE_READBACK_FRAMES; i++)
+		{
+			if (this->fences[i])
+				glDeleteSync(this->fences[i]);
+		}
+		glDeleteProgram(this->simulateProgram);
+		glDeleteProgram(this->cullProgram);
+		glDeleteProgram(this->finalizeProgram);
+	}
+
+	GpuMoleculeSimulation(const GpuMoleculeSimulation&) = delete;
+	GpuMoleculeSimulation& operator=(const GpuMoleculeSimulation&) = delete;
+
+	static bool supported()
+	{
+		return GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_program_interface_query
+			&& GLEW_ARB_draw_indirect;
+	}
+
+	// False if a program doesn't build, the scene then stays on the CPU
+	bool init()
+	{
+		this->simulateProgram = _compileMoleculeProgram("simulate", GPU_MOLECULE_SIMULATE);
+		this->cullProgram = _compileMoleculeProgram("cull", GPU_MOLECULE_CULL);
+		this->finalizeProgram = _compileMoleculeProgram("finalize", GPU_MOLECULE_FINALIZE);
+		if (!this->simulateProgram || !this->cullProgram || !this->finalizeProgram)
+			return false;
+		this->bindBlocks(this->simulateProgram, { "Molecules", "Picks" });
+		this->bindBlocks(this->cullProgram, { "Molecules", "Counts", "Co2Level0", "Co2Level1", "Co2Level2", "O2Level0", "O2Level1", "O2Level2" });
+		this->bindBlocks(this->finalizeProgram, { "Commands", "Counts" });
+
+		glGenBuffers(1, &this->moleculeBuffer);
+		glGenBuffers(1, &this->countBuffer);
+		glGenBuffers(1, &this->pickBuffer);
+		glGenBuffers(1, &this->commandBuffer);
+		glGenBuffers(GPU_MOLECULE_READBACK_FRAMES, this->readbackBuffers);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->countBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 2 * GPU_MOLECULE_LEVELS, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->pickBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->commandBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawElementsIndirectCommand) * GPU_MOLECULE_MAX_COMMANDS, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		for (int i = 0; i < GPU_MOLECULE_READBACK_FRAMES; i++)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, this->readbackBuffers[i]);
+			glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint), NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		this->ready = true;
+		return true;
+	}
+
+	bool initialized() const { return this->ready; }
+	bool loaded() const { return this->count > 0; }
+	size_t size() const { return this->count; }
+
+	// Takes the molecules over from the CPU, the store can be thrown away after this
+	void load(const MoleculeStore& store)
+	{
+		this->count = store.size();
+		this->converted = 0;
+		// Readbacks still in flight count the molecules of the last load
+		for (int i = 0; i < GPU_MOLECULE_READBACK_FRAMES; i++)
+		{
+			if (this->fences[i])
+				glDeleteSync(this->fences[i]);
+			this->fences[i] = 0;
+		}
+		vector<GpuMolecule> packed(this->count);
+		for (size_t i = 0; i < this->count; i++)
+		{
+			packed[i].position = glm::vec4(store.posX[i], store.posY[i], store.posZ[i], (float)store.type[i]);
+			packed[i].velocity = glm::vec4(store.velX[i], store.velY[i], store.velZ[i], 0.0f);
+			packed[i].rotation = glm::vec4(store.rotX[i], store.rotY[i], store.rotZ[i], store.rotW[i]);
+			packed[i].spin = glm::vec4(store.spinX[i], store.spinY[i], store.spinZ[i], store.spinW[i]);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->moleculeBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(this->count, (size_t)1) * sizeof(GpuMolecule), packed.data(), GL_DYNAMIC_COPY);
+		const GLuint zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->pickBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	void unload() { this->count = 0; }
+
+	// Runs steps fixed steps, then the lasers' test when picking. The conversions come back a few calls later.
+	void simulate(int steps, const MoleculeBounds& bounds, const PickRay rays[2], bool picking, float pickRadius)
+	{
+		this->pollReadback();
+		if (!this->count)
+			return;
+		_glState.useProgram(this->simulateProgram);
+		glUniform1ui(glGetUniformLocation(this->simulateProgram, "count"), (GLuint)this->count);
+		glUniform1i(glGetUniformLocation(this->simulateProgram, "steps"), steps);
+		glUniform3fv(glGetUniformLocation(this->simulateProgram, "boundsMin"), 1, glm::value_ptr(bounds.min));
+		glUniform3fv(glGetUniformLocation(this->simulateProgram, "boundsMax"), 1, glm::value_ptr(bounds.max));
+		const glm::vec3 origins[2] = { rays[0].origin, rays[1].origin };
+		const glm::vec3 directions[2] = { rays[0].direction, rays[1].direction };
+		glUniform3fv(glGetUniformLocation(this->simulateProgram, "rayOrigin"), 2, glm::value_ptr(origins[0]));
+		glUniform3fv(glGetUniformLocation(this->simulateProgram, "rayDirection"), 2, glm::value_ptr(directions[0]));
+		glUniform1f(glGetUniformLocation(this->simulateProgram, "pickRadius"), pickRadius);
+		glUniform1i(glGetUniformLocation(this->simulateProgram, "picking"), picking ? 1 : 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->moleculeBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->pickBuffer);
+		glDispatchCompute(this->groups(), 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		if (picking && !this->fences[this->readbackSlot])
+		{
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			glBindBuffer(GL_COPY_READ_BUFFER, this->pickBuffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, this->readbackBuffers[this->readbackSlot]);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(GLuint));
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			this->fences[this->readbackSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			this->readbackSlot = (this->readbackSlot + 1) % GPU_MOLECULE_READBACK_FRAMES;
+		}
+	}
+
+	// Molecules turned into O2 since load(), as of the newest readback
+	uint32_t conversions() const { return this->converted; }
+
+	// Fills the instance buffers of both models for one view, buffers[type][level] sized to the molecule count.
+	// A view's draws must follow its cull, the next cull reuses the buffers. Molecules behind the depth in hiZ are
+	// dropped too if it is valid, viewProjections and eyeViewports are then the cameras it was drawn with.
+	void cull(Model* models[2], InstanceBuffer* buffers[2][GPU_MOLECULE_LEVELS], float scale, const StereoFrustum& frustum,
+		const glm::vec3& eye, float focal, const float* lodSizes, int forcedLod, int eyeCount,
+		const HiZPyramid& hiZ, const glm::mat4 viewProjections[2], const glm::vec4 eyeViewports[2], bool reversedDepth)
+	{
+		if (!this->count)
+			return;
+		GLDebugGroup group("molecule cull");
+		this->commands.clear();
+		GLuint buckets[GPU_MOLECULE_MAX_COMMANDS];
+		GLint levels[2];
+		float radius[2];
+		for (int t = 0; t < 2; t++)
+		{
+			levels[t] = (GLint)std::min(models[t]->lodCount(), (uint32_t)GPU_MOLECULE_LEVELS);
+			radius[t] = models[t]->boundingRadius();
+			this->firstCommand[t] = this->commands.size();
+			for (GLint l = 0; l < levels[t]; l++)
+			{
+				const size_t first = this->commands.size();
+				models[t]->indirectCommands(l, this->commands);
+				for (size_t c = first; c < this->commands.size() && c < GPU_MOLECULE_MAX_COMMANDS; c++)
+					buckets[c] = (GLuint)(t * GPU_MOLECULE_LEVELS + l);
+				buffers[t][l]->reserve(this->count);
+			}
+		}
+		if (this->commands.size() > GPU_MOLECULE_MAX_COMMANDS)
+		{
+			std::cout << "ERROR::GPU_MOLECULES::TOO_MANY_MESHES" << std::endl;
+			this->commands.resize(GPU_MOLECULE_MAX_COMMANDS);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->commandBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, this->commands.size() * sizeof(DrawElementsIndirectCommand), this->commands.data());
+		const GLuint zeros[2 * GPU_MOLECULE_LEVELS] = {};
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->countBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		_renderStats.uploaded(this->commands.size() * sizeof(DrawElementsIndirectCommand) + sizeof(zeros));
+
+		glm::vec4 planes[12];
+		for (int e = 0; e < 2; e++)
+		{
+			for (int k = 0; k < 6; k++)
+				planes[e * 6 + k] = frustum.eyes[e].planes[k];
+		}
+		const GLuint cull = this->cullProgram;
+		_glState.useProgram(cull);
+		glUniform1ui(glGetUniformLocation(cull, "count"), (GLuint)this->count);
+		glUniform4fv(glGetUniformLocation(cull, "planes"), 12, glm::value_ptr(planes[0]));
+		glUniform3fv(glGetUniformLocation(cull, "eye"), 1, glm::value_ptr(eye));
+		glUniform1f(glGetUniformLocation(cull, "focal"), focal);
+		glUniform1f(glGetUniformLocation(cull, "scale"), scale);
+		glUniform1fv(glGetUniformLocation(cull, "radius"), 2, radius);
+		glUniform1iv(glGetUniformLocation(cull, "levels"), 2, levels);
+		glUniform1i(glGetUniformLocation(cull, "forcedLod"), forcedLod);
+		glUniform1fv(glGetUniformLocation(cull, "lodSizes"), GPU_MOLECULE_LEVELS - 1, lodSizes);
+		glUniform1i(glGetUniformLocation(cull, "hiZLevels"), hiZ.valid() ? hiZ.levels() : 0);
+		if (hiZ.valid())
+		{
+			_glState.bindTexture(HIZ_TEXTURE_UNIT, hiZ.id());
+			glUniform1i(glGetUniformLocation(cull, "hiZ"), HIZ_TEXTURE_UNIT);
+			glUniformMatrix4fv(glGetUniformLocation(cull, "viewProjection"), 2, GL_FALSE, glm::value_ptr(viewProjections[0]));
+			glUniform4fv(glGetUniformLocation(cull, "eyeViewport"), 2, glm::value_ptr(eyeViewports[0]));
+			glUniform1i(glGetUniformLocation(cull, "reversedDepth"), reversedDepth ? 1 : 0);
+		}
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->moleculeBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->countBuffer);
+		for (int t = 0; t < 2; t++)
+		{
+			for (int l = 0; l < GPU_MOLECULE_LEVELS; l++)
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2 + t * GPU_MOLECULE_LEVELS + l, buffers[t][l]->id());
+		}
+		glDispatchCompute(this->groups(), 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		const GLuint finalize = this->finalizeProgram;
+		_glState.useProgram(finalize);
+		glUniform1ui(glGetUniformLocation(finalize, "commandCount"), (GLuint)this->commands.size());
+		glUniform1uiv(glGetUniformLocation(finalize, "commandBucket"), (GLsizei)this->commands.size(), buckets);
+		glUniform1ui(glGetUniformLocation(finalize, "eyeCount"), (GLuint)eyeCount);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->countBuffer);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	}
+
+	// Draws what the last cull left for type, the model must be the one it was culled with. programFor(level) gives
+	// the program each level draws with, levels can light differently (see LightingModel).
+	template <typename ProgramFor>
+	void draw(Model& model, int type, ProgramFor programFor)
+	{
+		if (!this->count)
+			return;
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->commandBuffer);
+		GLintptr command = (GLintptr)(this->firstCommand[type] * sizeof(DrawElementsIndirectCommand));
+		const uint32_t levels = std::min(model.lodCount(), (uint32_t)GPU_MOLECULE_LEVELS);
+		for (uint32_t l = 0; l < levels; l++)
+			model.DrawIndirect(programFor(l), l, &command);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+private:
+	void bindBlocks(GLuint program, std::initializer_list<const char*> names)
+	{
+		GLuint binding = 0;
+		for (const char* name : names)
+			glShaderStorageBlockBinding(program, glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, name), binding++);
+	}
+
+	GLuint groups() const
+	{
+		return (GLuint)((this->count + GPU_MOLECULE_GROUP_SIZE - 1) / GPU_MOLECULE_GROUP_SIZE);
+	}
+
+	// Takes the oldest readback whose fence has passed, without waiting for one that hasn't
+	void pollReadback()
+	{
+		for (int i = 0; i < GPU_MOLECULE_READBACK_FRAMES; i++)
+		{
+			const int slot = (this->readbackSlot + i) % GPU_MOLECULE_READBACK_FRAMES;
+			GLsync& fence = this->fences[slot];
+			if (!fence)
+				continue;
+			if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+				break;
+			glDeleteSync(fence);
+			fence = 0;
+			GLuint total = 0;
+			glBindBuffer(GL_COPY_READ_BUFFER, this->readbackBuffers[slot]);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(total), &total);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			this->converted = total;
+		}
+	}
+
+	bool ready = false;
+	GLuint simulateProgram = 0;
+	GLuint cullProgram = 0;
+	GLuint finalizeProgram = 0;
+	GLuint moleculeBuffer = 0;
+	GLuint countBuffer = 0;
+	GLuint pickBuffer = 0;
+	GLuint commandBuffer = 0;
+	size_t count = 0;
+
+	vector<DrawElementsIndirectCommand> commands;
+	size_t firstCommand[2] = {};
+
+	GLuint readbackBuffers[GPU_MOLECULE_READBACK_FRAMES] = {};
+	GLsync fences[GPU_MOLECULE_READBACK_FRAMES] = {};
+	int readbackSlot = 0;
+	uint32_t converted = 0;
+};
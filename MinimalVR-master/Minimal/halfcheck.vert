@@ -0,0 +1,14 @@
+#version 330 core
+// HalfPrecisionCheck's test card for shader.frag's lighting: one full screen triangle, no vertex attributes, whose
+// normals sweep a wide cone and whose points span a wall before the light, so the diffuse falloff and the
+// highlights between them cover the image
+out vec3 WorldPos;
+out vec3 WorldNormal;
+
+void main()
+{
+	vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0f - 1.0f;
+	gl_Position = vec4(p, 0.0f, 1.0f);
+	WorldPos = vec3(p * 2.0f, -1.0f);
+	WorldNormal = vec3(p, 0.75f);
+}
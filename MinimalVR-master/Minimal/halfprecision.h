@@ -0,0 +1,136 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "shader.h"
+
+// Side of the square the test card is drawn at, and the most any of its pixels may move at 16 bits, in steps of
+// the 8 bit eye buffer
+#define HALF_PRECISION_CHECK_SIZE 256
+#define HALF_PRECISION_MAX_STEPS 3
+// The card is drawn in one band per shininess, the range the factory's and the molecules' materials have
+#define HALF_PRECISION_CHECK_BANDS 4
+static const float HALF_PRECISION_CHECK_SHININESS[HALF_PRECISION_CHECK_BANDS] = { 8.0f, 32.0f, 64.0f, 128.0f };
+
+// How far the 16 bit image is from the 32 bit one
+struct HalfPrecisionDiff
+{
+	int maxSteps = 0;
+	float meanSteps = 0.0f;
+	// Share of the pixels more than one step off
+	float offPixels = 0.0f;
+};
+
+// Whether the scene and avatar programs can shade at 16 bits (HALF_PRECISION). GPUs with double rate half floats
+// give GLSL float16_t through GL_AMD_gpu_shader_half_float or GL_NV_gpu_shader5, extension() is the #extension line
+// of the one the driver has. Both are written against later GLSL than the shaders' 330, so a driver may still
+// refuse them: compiles() builds shader.frag's lit path with the defines the app would use. compare() draws
+// halfcheck.vert's test card with that program and with the 32 bit one and diffs the two images.
+class HalfPrecisionCheck
+{
+public:
+	static const char* extension()
+	{
+		if (GLEW_AMD_gpu_shader_half_float)
+			return "#extension GL_AMD_gpu_shader_half_float : require\n";
+		if (GLEW_NV_gpu_shader5)
+			return "#extension GL_NV_gpu_shader5 : require\n";
+		return nullptr;
+	}
+
+	static bool compiles(const std::string& halfDefines)
+	{
+		Shader shader("./halfcheck.vert", "./shader.frag", halfDefines);
+		if (!shader.Program)
+			return false;
+		glDeleteProgram(shader.Program);
+		return true;
+	}
+
+	static bool compare(const std::string& halfDefines, HalfPrecisionDiff* diff)
+	{
+		Shader full("./halfcheck.vert", "./shader.frag");
+		Shader half("./halfcheck.vert", "./shader.frag", halfDefines);
+		bool drawn = false;
+		if (full.Program && half.Program)
+		{
+			GLuint texture = 0, framebuffer = 0, vertexArray = 0;
+			glGenTextures(1, &texture);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, HALF_PRECISION_CHECK_SIZE, HALF_PRECISION_CHECK_SIZE);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			glGenFramebuffers(1, &framebuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+			glGenVertexArrays(1, &vertexArray);
+			glBindVertexArray(vertexArray);
+			glDisable(GL_DEPTH_TEST);
+			glDisable(GL_BLEND);
+
+			vector<uint8_t> fullPixels, halfPixels;
+			draw(full, fullPixels);
+			draw(half, halfPixels);
+			*diff = HalfPrecisionDiff();
+			uint64_t total = 0;
+			size_t off = 0;
+			for (size_t i = 0; i < fullPixels.size(); i += 4)
+			{
+				int pixelSteps = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					const int steps = abs((int)fullPixels[i + c] - (int)halfPixels[i + c]);
+					pixelSteps = steps > pixelSteps ? steps : pixelSteps;
+				}
+				diff->maxSteps = pixelSteps > diff->maxSteps ? pixelSteps : diff->maxSteps;
+				total += pixelSteps;
+				off += pixelSteps > 1 ? 1 : 0;
+			}
+			const size_t pixels = fullPixels.size() / 4;
+			diff->meanSteps = (float)total / (float)pixels;
+			diff->offPixels = (float)off / (float)pixels;
+			drawn = true;
+
+			glBindVertexArray(0);
+			glDeleteVertexArrays(1, &vertexArray);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glDeleteFramebuffers(1, &framebuffer);
+			glDeleteTextures(1, &texture);
+			glEnable(GL_DEPTH_TEST);
+		}
+		if (full.Program)
+			glDeleteProgram(full.Program);
+		if (half.Program)
+			glDeleteProgram(half.Program);
+		return drawn;
+	}
+
+private:
+	// The card into the bound framebuffer band by band, lit by the scene light's values, then read back
+	static void draw(Shader& shader, vector<uint8_t>& pixels)
+	{
+		const GLsizei band = HALF_PRECISION_CHECK_SIZE / HALF_PRECISION_CHECK_BANDS;
+		shader.Use();
+		shader.set("light.position", glm::vec3(1.0f, 1.0f, 1.0f));
+		shader.set("light.ambient", glm::vec3(0.2f));
+		shader.set("light.diffuse", glm::vec3(1.0f));
+		shader.set("light.specular", glm::vec3(1.0f));
+		shader.set("material.ambient", glm::vec3(1.0f));
+		shader.set("material.diffuse", glm::vec3(0.8f, 0.5f, 0.3f));
+		shader.set("material.specular", glm::vec3(0.5f));
+		shader.set("viewPos", glm::vec3(0.0f, 0.0f, 2.0f));
+		for (int i = 0; i < HALF_PRECISION_CHECK_BANDS; i++)
+		{
+			glViewport(0, i * band, HALF_PRECISION_CHECK_SIZE, band);
+			shader.set("material.shininess", HALF_PRECISION_CHECK_SHININESS[i]);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+		}
+		pixels.resize(HALF_PRECISION_CHECK_SIZE * HALF_PRECISION_CHECK_SIZE * 4);
+		glReadPixels(0, 0, HALF_PRECISION_CHECK_SIZE, HALF_PRECISION_CHECK_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	}
+};
@@ -0,0 +1,141 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+using namespace std;
+// OVR Includes
+#include <OVR_CAPI.h>
+#include "benchhmd.h"
+
+// Seconds between two driver calls for the same hand, requests in between wait and merge
+#define HAPTICS_MIN_INTERVAL 0.05
+// Longest pulse, in seconds, longer ones are cut short
+#define HAPTICS_MAX_PULSE 0.5f
+
+// The Touch controllers' vibration, asked for during the frame and sent to the runtime once per frame by flush().
+//
+// ovr_SetControllerVibration and ovr_SubmitControllerVibration are synchronous calls into the runtime that can
+// stall the main thread, so nothing else calls them. Each hand has a constant vibration, set() and stop(), and
+// pulses, pulse(). Requests for a hand within a frame are merged, the strongest winning, a constant vibration that
+// is what the runtime already has is never sent again, and no hand gets more than one call per HAPTICS_MIN_INTERVAL.
+//
+// Pulses are played from a sample buffer when the runtime has buffered haptics for the controller, at a constant
+// vibration with a timeout otherwise.
+class HapticsScheduler
+{
+public:
+	HapticsScheduler() {}
+
+	HapticsScheduler(const HapticsScheduler&) = delete;
+	HapticsScheduler& operator=(const HapticsScheduler&) = delete;
+
+	// Vibration until changed, frequency and amplitude from 0 to 1
+	void set(ovrHandType hand, float frequency, float amplitude)
+	{
+		Hand& h = this->hands[hand];
+		if (!h.requested || amplitude > h.amplitude)
+		{
+			h.frequency = frequency;
+			h.amplitude = amplitude;
+		}
+		h.requested = true;
+	}
+
+	void stop(ovrHandType hand)
+	{
+		this->set(hand, 0.0f, 0.0f);
+	}
+
+	// A buzz of amplitude for seconds, played over whatever constant vibration the hand has
+	void pulse(ovrHandType hand, float amplitude, float seconds)
+	{
+		Hand& h = this->hands[hand];
+		h.pulseAmplitude = std::max(h.pulseAmplitude, std::min(std::max(amplitude, 0.0f), 1.0f));
+		h.pulseSeconds = std::min(std::max(h.pulseSeconds, seconds), HAPTICS_MAX_PULSE);
+	}
+
+	// Sends what this frame asked for, now being the time on _hmdGetTimeInSeconds()'s clock
+	void flush(ovrSession session, double now)
+	{
+		if (!session)
+			return;
+		for (int hand = 0; hand < ovrHand_Count; hand++)
+		{
+			Hand& h = this->hands[hand];
+			if (h.requested)
+			{
+				if (!h.targeted || h.frequency != h.targetFrequency || h.amplitude != h.targetAmplitude)
+				{
+					h.targeted = true;
+					h.targetFrequency = h.frequency;
+					h.targetAmplitude = h.amplitude;
+					h.current = false;
+				}
+				h.requested = false;
+			}
+			if (now - h.lastCall < HAPTICS_MIN_INTERVAL)
+				continue;
+			const ovrControllerType controller = hand == ovrHand_Left ? ovrControllerType_LTouch : ovrControllerType_RTouch;
+			if (h.pulseSeconds > 0.0f)
+			{
+				this->sendPulse(session, controller, h, now);
+				h.lastCall = now;
+			}
+			else if (now >= h.pulseEnd && !h.current)
+			{
+				// Also what ends a pulse played as a constant vibration
+				_hmdSetControllerVibration(session, controller, h.targetFrequency, h.targetAmplitude);
+				h.current = true;
+				h.lastCall = now;
+			}
+		}
+	}
+
+private:
+	struct Hand
+	{
+		// This frame's constant vibration, if one was asked for
+		bool requested = false;
+		float frequency = 0.0f;
+		float amplitude = 0.0f;
+		// The constant vibration the hand should have, and whether the runtime has it
+		bool targeted = false;
+		float targetFrequency = 0.0f;
+		float targetAmplitude = 0.0f;
+		bool current = true;
+		float pulseAmplitude = 0.0f;
+		float pulseSeconds = 0.0f;
+		// Until when a pulse played without a buffer holds off the constant vibration
+		double pulseEnd = 0.0;
+		double lastCall = -HAPTICS_MIN_INTERVAL;
+	};
+
+	void sendPulse(ovrSession session, ovrControllerType controller, Hand& h, double now)
+	{
+		const ovrTouchHapticsDesc desc = _hmdGetTouchHapticsDesc(session, controller);
+		if (desc.SampleRateHz > 0 && desc.SampleSizeInBytes == 1 && desc.SubmitMaxSamples > 0)
+		{
+			const int count = std::min(std::max((int)(h.pulseSeconds * desc.SampleRateHz), 1), desc.SubmitMaxSamples);
+			this->samples.assign(count, (uint8_t)(h.pulseAmplitude * 255.0f));
+			ovrHapticsBuffer buffer;
+			buffer.Samples = this->samples.data();
+			buffer.SamplesCount = count;
+			buffer.SubmitMode = ovrHapticsBufferSubmit_Enqueue;
+			_hmdSubmitControllerVibration(session, controller, &buffer);
+		}
+		else
+		{
+			_hmdSetControllerVibration(session, controller, 1.0f, h.pulseAmplitude);
+			h.pulseEnd = now + h.pulseSeconds;
+			h.current = false;
+		}
+		h.pulseAmplitude = 0.0f;
+		h.pulseSeconds = 0.0f;
+	}
+
+	Hand hands[ovrHand_Count];
+	vector<uint8_t> samples;
+};
+
+static HapticsScheduler _haptics;
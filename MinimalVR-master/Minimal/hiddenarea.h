@@ -0,0 +1,305 @@
+#pragma once
+// Std. Includes
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include "glstate.h"
+#include "glcapture.h"
+
+// ovr_GetFovStencil came with LibOVR 1.17, after the SDK in Include/LibOVR. Its structures are declared here as the
+// runtime lays them out and the call is looked up in the runtime DLL, so runtimes that have it mask the eyes and
+// older ones simply don't.
+#define HIDDEN_AREA_STENCIL_HIDDEN_AREA 0
+#define HIDDEN_AREA_STENCIL_VISIBLE_AREA 1
+#define HIDDEN_AREA_MESH_ORIGIN_AT_BOTTOM_LEFT 0x01
+
+struct OVR_ALIGNAS(OVR_PTR_SIZE) HiddenAreaStencilDesc
+{
+	int32_t StencilType;
+	uint32_t StencilFlags;
+	ovrEyeType Eye;
+	ovrFovPort FovPort;
+	ovrQuatf HmdToEyeRotation;
+};
+
+struct HiddenAreaMeshBuffer
+{
+	int AllocVertexCount;
+	int UsedVertexCount;
+	ovrVector2f* VertexBuffer;
+	int AllocIndexCount;
+	int UsedIndexCount;
+	uint16_t* IndexBuffer;
+};
+
+typedef ovrResult(OVR_CDECL* HiddenAreaGetFovStencil)(ovrSession session, const HiddenAreaStencilDesc* desc, HiddenAreaMeshBuffer* meshBuffer);
+
+// x and y across the eye's viewport from its lower left corner, z the eye. eyeViewports scale and offset each eye's
+// viewport into the one set, as StereoView's do.
+static const char HIDDEN_AREA_VERTEX[] =
+	"layout(location = 0) in vec3 position;\n"
+	"uniform vec4 eyeViewports[2];\n"
+	"uniform float nearDepth;\n"
+	"void main() {\n"
+	"    int eye = int(position.z);\n"
+	"    vec4 viewport = eyeViewports[eye];\n"
+	"    gl_Position = vec4((position.xy * 2.0 - 1.0) * viewport.xy + viewport.zw, nearDepth, 1.0);\n"
+	"#ifdef STEREO_MULTIVIEW\n"
+	"    if (eye != int(gl_ViewID_OVR))\n"
+	"        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+	"#endif\n"
+	"}\n";
+
+static const char HIDDEN_AREA_FRAGMENT[] =
+	"#version 410 core\n"
+	"void main() {\n"
+	"}\n";
+
+// The parts of the eye viewports the lenses never show, from the runtime's hidden area mesh. Drawn into depth at the
+// near plane right after the eye target is cleared, the scene's fragments under it then fail the depth test before
+// they are shaded, and the avatar's after them.
+//
+// Both eyes' meshes share one buffer, each eye's triangles one range of it: the sequential pass draws an eye's range
+// into its own viewport, the instanced pass both into their halves of the target, and the multiview pass both once
+// with each layer only keeping the triangles of its own eye.
+//
+// The box around each eye's visible area comes along, so the eye clears can leave out what the mask covers anyway.
+class HiddenAreaMask
+{
+public:
+	HiddenAreaMask() {}
+	~HiddenAreaMask()
+	{
+		if (this->program)
+			glDeleteProgram(this->program);
+		if (this->multiviewProgram)
+			glDeleteProgram(this->multiviewProgram);
+		if (this->vertexArray)
+			glDeleteVertexArrays(1, &this->vertexArray);
+		if (this->vertexBuffer)
+			glDeleteBuffers(1, &this->vertexBuffer);
+		if (this->indexBuffer)
+			glDeleteBuffers(1, &this->indexBuffer);
+	}
+
+	HiddenAreaMask(const HiddenAreaMask&) = delete;
+	HiddenAreaMask& operator=(const HiddenAreaMask&) = delete;
+
+	// Fetches both eyes' meshes for fovs. False, and nothing is drawn, when the runtime has no hidden area mesh.
+	bool init(ovrSession session, const ovrFovPort fovs[2])
+	{
+#if defined(_WIN64)
+		HMODULE runtime = GetModuleHandleA("LibOVRRT64_1.dll");
+#else
+		HMODULE runtime = GetModuleHandleA("LibOVRRT32_1.dll");
+#endif
+		HiddenAreaGetFovStencil getFovStencil = runtime ? (HiddenAreaGetFovStencil)GetProcAddress(runtime, "ovr_GetFovStencil") : nullptr;
+		if (!getFovStencil)
+		{
+			std::cout << "ERROR::HIDDEN_AREA::NO_FOV_STENCIL, the eyes are drawn unmasked" << std::endl;
+			return false;
+		}
+
+		vector<glm::vec3> vertices;
+		vector<GLushort> indices;
+		for (int eye = 0; eye < ovrEye_Count; eye++)
+		{
+			vector<ovrVector2f> eyeVertices;
+			vector<uint16_t> eyeIndices;
+			if (!stencilMesh(getFovStencil, session, HIDDEN_AREA_STENCIL_HIDDEN_AREA, (ovrEyeType)eye, fovs[eye], &eyeVertices, &eyeIndices) ||
+				vertices.size() + eyeVertices.size() > 0x10000)
+				continue;
+
+			const GLushort base = (GLushort)vertices.size();
+			for (size_t i = 0; i < eyeVertices.size(); i++)
+				vertices.push_back(glm::vec3(eyeVertices[i].x, eyeVertices[i].y, (float)eye));
+			this->firstIndex[eye] = (GLsizei)indices.size();
+			this->indexCount[eye] = (GLsizei)eyeIndices.size();
+			for (size_t i = 0; i < eyeIndices.size(); i++)
+				indices.push_back((GLushort)(base + eyeIndices[i]));
+
+			// Without the visible area's mesh the clear covers the whole viewport
+			if (!stencilMesh(getFovStencil, session, HIDDEN_AREA_STENCIL_VISIBLE_AREA, (ovrEyeType)eye, fovs[eye], &eyeVertices, &eyeIndices))
+				continue;
+			glm::vec2 lo(1.0f), hi(0.0f);
+			for (const ovrVector2f& v : eyeVertices)
+			{
+				lo = glm::min(lo, glm::vec2(v.x, v.y));
+				hi = glm::max(hi, glm::vec2(v.x, v.y));
+			}
+			if (lo.x < hi.x && lo.y < hi.y)
+				this->visible[eye] = glm::clamp(glm::vec4(lo, hi), 0.0f, 1.0f);
+		}
+		if (indices.empty())
+		{
+			std::cout << "ERROR::HIDDEN_AREA::NO_MESH, the eyes are drawn unmasked" << std::endl;
+			return false;
+		}
+
+		this->program = this->link(false);
+		if (GLEW_OVR_multiview2)
+			this->multiviewProgram = this->link(true);
+		if (!this->program)
+			return false;
+
+		glGenVertexArrays(1, &this->vertexArray);
+		glGenBuffers(1, &this->vertexBuffer);
+		glGenBuffers(1, &this->indexBuffer);
+		_glState.bindVertexArray(this->vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBuffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+		_glState.bindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return true;
+	}
+
+	bool initialized() const { return this->program != 0; }
+
+	// The box around what eye's lens shows, as fractions of its viewport from the lower left corner: x0, y0, x1, y1.
+	// Everything outside is under the mask. The whole viewport when the runtime has no visible area mesh.
+	glm::vec4 visibleBounds(int eye) const { return this->visible[eye]; }
+
+	// eye's mesh over the whole viewport as it is set now
+	void draw(int eye, bool reversedDepth)
+	{
+		const glm::vec4 viewports[2] = { glm::vec4(1, 1, 0, 0), glm::vec4(1, 1, 0, 0) };
+		this->mask(this->program, viewports, this->firstIndex[eye], this->indexCount[eye], reversedDepth);
+	}
+
+	// Both eyes' meshes in one draw, into eyeViewports of the viewport set now. multiview draws into both layers of a
+	// GL_OVR_multiview2 target.
+	void drawStereo(const glm::vec4 eyeViewports[2], bool multiview, bool reversedDepth)
+	{
+		this->mask(multiview ? this->multiviewProgram : this->program, eyeViewports, 0,
+			this->indexCount[ovrEye_Left] + this->indexCount[ovrEye_Right], reversedDepth);
+	}
+
+private:
+	// One of the runtime's meshes for eye, asked once for the sizes and then for the mesh
+	static bool stencilMesh(HiddenAreaGetFovStencil getFovStencil, ovrSession session, int32_t type, ovrEyeType eye, const ovrFovPort& fov,
+		vector<ovrVector2f>* vertices, vector<uint16_t>* indices)
+	{
+		HiddenAreaStencilDesc desc = {};
+		desc.StencilType = type;
+		desc.StencilFlags = HIDDEN_AREA_MESH_ORIGIN_AT_BOTTOM_LEFT;
+		desc.Eye = eye;
+		desc.FovPort = fov;
+		desc.HmdToEyeRotation.w = 1.0f;
+
+		HiddenAreaMeshBuffer mesh = {};
+		if (!OVR_SUCCESS(getFovStencil(session, &desc, &mesh)) || mesh.UsedVertexCount <= 0 || mesh.UsedIndexCount <= 0)
+			return false;
+		vertices->resize(mesh.UsedVertexCount);
+		indices->resize(mesh.UsedIndexCount);
+		mesh.AllocVertexCount = mesh.UsedVertexCount;
+		mesh.VertexBuffer = vertices->data();
+		mesh.AllocIndexCount = mesh.UsedIndexCount;
+		mesh.IndexBuffer = indices->data();
+		return OVR_SUCCESS(getFovStencil(session, &desc, &mesh));
+	}
+
+	// Depth only, at the near plane whichever way round depth goes. Leaves the depth test and color writes as the
+	// frame sets them up after the clear.
+	void mask(GLuint maskProgram, const glm::vec4 eyeViewports[2], GLsizei first, GLsizei count, bool reversedDepth)
+	{
+		if (!maskProgram || !count)
+			return;
+		const GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+		glDisable(GL_CULL_FACE);
+		_glState.useProgram(maskProgram);
+		_glState.bindVertexArray(this->vertexArray);
+		_glState.depthFunc(GL_ALWAYS);
+		_glState.depthMask(GL_TRUE);
+		_glState.colorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glUniform4fv(glGetUniformLocation(maskProgram, "eyeViewports"), 2, &eyeViewports[0].x);
+		// Reversed depth clips to 0..1 with near at 1, standard depth to -1..1 with near at -1
+		glUniform1f(glGetUniformLocation(maskProgram, "nearDepth"), reversedDepth ? 1.0f : -1.0f);
+		glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, (GLvoid*)(first * sizeof(GLushort)));
+		_glCapture.drawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, (GLvoid*)(first * sizeof(GLushort)));
+		_renderStats.draw(GL_TRIANGLES, count);
+		_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		_glState.depthFunc(GL_LESS);
+		if (cullFace)
+			glEnable(GL_CULL_FACE);
+	}
+
+	GLuint compile(GLenum type, GLsizei count, const char** sources)
+	{
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, count, sources, NULL);
+		glCompileShader(shader);
+		GLint success = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::HIDDEN_AREA::COMPILATION_FAILED\n" << infoLog << std::endl;
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+
+	GLuint link(bool multiview)
+	{
+		const char* vertexSources[2] = {
+			multiview ?
+				"#version 410 core\n"
+				"#define STEREO_MULTIVIEW\n"
+				"#extension GL_OVR_multiview2 : require\n"
+				"layout(num_views = 2) in;\n" :
+				"#version 410 core\n",
+			HIDDEN_AREA_VERTEX };
+		const char* fragmentSource = HIDDEN_AREA_FRAGMENT;
+		GLuint vertex = this->compile(GL_VERTEX_SHADER, 2, vertexSources);
+		GLuint fragment = this->compile(GL_FRAGMENT_SHADER, 1, &fragmentSource);
+		if (!vertex || !fragment)
+		{
+			glDeleteShader(vertex);
+			glDeleteShader(fragment);
+			return 0;
+		}
+		GLuint linked = glCreateProgram();
+		glAttachShader(linked, vertex);
+		glAttachShader(linked, fragment);
+		glLinkProgram(linked);
+		if (_glCapture.isRequested())
+			_glCapture.programSources(linked, (std::string(vertexSources[0]) + vertexSources[1]).c_str(), fragmentSource);
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		GLint success = 0;
+		glGetProgramiv(linked, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetProgramInfoLog(linked, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::HIDDEN_AREA::LINKING_FAILED\n" << infoLog << std::endl;
+			glDeleteProgram(linked);
+			return 0;
+		}
+		return linked;
+	}
+
+	GLuint program{ 0 };
+	GLuint multiviewProgram{ 0 };
+	GLuint vertexArray{ 0 };
+	GLuint vertexBuffer{ 0 };
+	GLuint indexBuffer{ 0 };
+	GLsizei firstIndex[2] = { 0, 0 };
+	GLsizei indexCount[2] = { 0, 0 };
+	glm::vec4 visible[2] = { glm::vec4(0.0f, 0.0f, 1.0f, 1.0f), glm::vec4(0.0f, 0.0f, 1.0f, 1.0f) };
+};
@@ -0,0 +1,284 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <memory>
+using namespace std;
+#include "profiler.h"
+#include "jobs.h"
+#include "timing.h"
+
+// Frames the ring holds, a bit under six seconds at 90 Hz, and upload and load events
+#define HITCH_RING_FRAMES 512
+#define HITCH_EVENT_RING 64
+// Frames still recorded after a hitch before the ring is written, so the dump shows the way out of it as well
+#define HITCH_AFTER_FRAMES 45
+// No dump closer to the last than this, and no more than HITCH_MAX_DUMPS a session, so a machine that hitches all
+// the time doesn't fill its disk
+#define HITCH_COOLDOWN_SECONDS 30.0
+#define HITCH_MAX_DUMPS 20
+// The default budget, this many refresh periods, see --hitch-budget
+#define HITCH_BUDGET_PERIODS 1.5f
+
+// What the frame was doing besides drawing, as the app last set it
+struct HitchContext
+{
+	uint32_t molecules = 0;
+	// Avatar assets still to load and uploads queued for the frame, models and textures the streamer is working on
+	int32_t loadingAssets = 0;
+	uint32_t avatarUploads = 0;
+	int32_t streaming = 0;
+};
+
+// One frame of the ring. The profiler's times are of resolvedFrame, PROFILER_LATENCY frames older; the compositor's
+// of the newest compositor frame ovr_GetPerfStats had.
+struct HitchFrame
+{
+	uint64_t frame = 0;
+	double seconds = 0.0;
+	// Frame pacing: start to start, and blocked on the compositor
+	uint32_t intervalUs = 0;
+	uint32_t waitUs = 0;
+	// The tracking snapshot: how far ahead it predicted, and whether it was relatched
+	float predictionMs = 0.0f;
+	bool relatched = false;
+
+	uint64_t resolvedFrame = 0;
+	float cpuFrameMs = 0.0f;
+	float gpuFrameMs = 0.0f;
+	float phaseCpuMs[PROFILER_MAX_PHASES] = {};
+	float phaseGpuMs[PROFILER_MAX_PHASES] = {};
+
+	uint32_t draws = 0;
+	uint32_t triangles = 0;
+	uint32_t programBinds = 0;
+	uint32_t uploadKB = 0;
+
+	int compositorFrame = -1;
+	float appGpuMs = 0.0f;
+	float appCpuMs = 0.0f;
+	float compositorGpuMs = 0.0f;
+	float latencyMs = 0.0f;
+	int appDropped = 0;
+	int compositorDropped = 0;
+	bool aswActive = false;
+
+	HitchContext context;
+};
+
+enum class HitchEventKind : uint8_t
+{
+	// An avatar mesh or texture finished uploading
+	AvatarAsset,
+	// A streamed model replaced its proxy
+	Model,
+	// A world cell landed, see WorldPartition
+	WorldCell,
+	Count
+};
+
+static const char* _hitchEventNames[(size_t)HitchEventKind::Count] = { "avatar_asset", "model", "world_cell" };
+
+struct HitchEvent
+{
+	uint64_t frame = 0;
+	double seconds = 0.0;
+	HitchEventKind kind = HitchEventKind::AvatarAsset;
+	uint64_t id = 0;
+	char label[48] = {};
+};
+
+// Everything one dump writes, copied off the ring so the write runs on a worker while the ring moves on
+struct HitchDump
+{
+	string path;
+	string reason;
+	uint64_t frame = 0;
+	double budgetMs = 0.0;
+	vector<string> phases;
+	vector<HitchFrame> frames;
+	vector<HitchEvent> events;
+};
+
+// The dump as a CSV of the ring's frames, oldest first, after '#' lines with the trigger and the events
+static void _writeHitchDump(const HitchDump& dump)
+{
+	FILE* file = fopen(dump.path.c_str(), "w");
+	if (!file)
+	{
+		printf("ERROR::HITCH::DUMP_NOT_OPENED %s\n", dump.path.c_str());
+		return;
+	}
+	fprintf(file, "# hitch at frame %llu: %s, budget %.2f ms\n", (unsigned long long)dump.frame, dump.reason.c_str(), dump.budgetMs);
+	for (const HitchEvent& event : dump.events)
+		fprintf(file, "# event frame %llu at %.4f s: %s %llu %s\n", (unsigned long long)event.frame, event.seconds,
+			_hitchEventNames[(size_t)event.kind], (unsigned long long)event.id, event.label);
+	fprintf(file, "frame,seconds,interval_ms,pacing_wait_ms,prediction_ms,relatched,resolved_frame,cpu_frame_ms,gpu_frame_ms");
+	for (const string& phase : dump.phases)
+		fprintf(file, ",%s_cpu_ms,%s_gpu_ms", phase.c_str(), phase.c_str());
+	fprintf(file, ",draws,triangles,program_binds,upload_kb,compositor_frame,app_gpu_ms,app_cpu_ms,compositor_gpu_ms,latency_ms,"
+		"app_dropped,compositor_dropped,asw_active,molecules,loading_assets,avatar_uploads,streaming\n");
+	for (const HitchFrame& f : dump.frames)
+	{
+		fprintf(file, "%llu,%.4f,%.3f,%.3f,%.3f,%d,%llu,%.3f,%.3f", (unsigned long long)f.frame, f.seconds, f.intervalUs / 1000.0f,
+			f.waitUs / 1000.0f, f.predictionMs, f.relatched ? 1 : 0, (unsigned long long)f.resolvedFrame, f.cpuFrameMs, f.gpuFrameMs);
+		for (size_t i = 0; i < dump.phases.size(); i++)
+			fprintf(file, ",%.3f,%.3f", f.phaseCpuMs[i], f.phaseGpuMs[i]);
+		fprintf(file, ",%u,%u,%u,%u,%d,%.3f,%.3f,%.3f,%.3f,%d,%d,%d,%u,%d,%u,%d\n", f.draws, f.triangles, f.programBinds, f.uploadKB,
+			f.compositorFrame, f.appGpuMs, f.appCpuMs, f.compositorGpuMs, f.latencyMs, f.appDropped, f.compositorDropped,
+			f.aswActive ? 1 : 0, f.context.molecules, f.context.loadingAssets, f.context.avatarUploads, f.context.streaming);
+	}
+	fclose(file);
+	printf("Hitch at frame %llu (%s) written to %s\n", (unsigned long long)dump.frame, dump.reason.c_str(), dump.path.c_str());
+}
+
+// Black box for frame spikes in the field: the last HITCH_RING_FRAMES frames of profiler phases, render counts,
+// tracking and pacing times and compositor stats are kept in memory all the time, at no cost but a copy a frame.
+// A frame over the budget, or one the compositor or the app dropped, triggers a dump of the ring once
+// HITCH_AFTER_FRAMES more have been recorded, with the recent uploads and loads and what the scene held. The file is
+// written by a background job, hitch_<date>_<time>_f<frame>.csv beside the other logs.
+//
+// Render thread only.
+class HitchRecorder
+{
+public:
+	HitchRecorder() {}
+
+	HitchRecorder(const HitchRecorder&) = delete;
+	HitchRecorder& operator=(const HitchRecorder&) = delete;
+
+	// budgetMs is the frame interval that counts as a hitch, 0 turns the recorder off
+	void init(JobSystem& jobs, const FrameProfiler& profiler, double budgetMs)
+	{
+		this->jobs = &jobs;
+		this->profiler = &profiler;
+		this->budgetMs = budgetMs;
+		this->frames.assign(HITCH_RING_FRAMES, HitchFrame());
+		this->events.assign(HITCH_EVENT_RING, HitchEvent());
+	}
+
+	bool enabled() const { return this->jobs && this->budgetMs > 0.0; }
+
+	// The frame interval that counts as a hitch from here on, after the refresh rate changed
+	void setBudget(double budgetMs)
+	{
+		this->budgetMs = budgetMs;
+	}
+
+	// What the app keeps up to date for the frames recorded from here on
+	HitchContext& context() { return this->current; }
+
+	// An upload or load finished, label cut to fit
+	void note(HitchEventKind kind, uint64_t id, const char* label)
+	{
+		if (!this->enabled())
+			return;
+		HitchEvent& event = this->events[this->eventCount % HITCH_EVENT_RING];
+		event.frame = this->lastFrame;
+		event.seconds = _sessionSeconds();
+		event.kind = kind;
+		event.id = id;
+		strncpy(event.label, label ? label : "", sizeof(event.label) - 1);
+		event.label[sizeof(event.label) - 1] = 0;
+		this->eventCount++;
+	}
+
+	// Once a frame, after the frame is submitted: frame has the pacing, tracking, render and compositor numbers,
+	// the profiler's and the context are filled in here
+	void endFrame(HitchFrame frame)
+	{
+		if (!this->enabled())
+			return;
+		frame.resolvedFrame = this->profiler->resolvedFrame();
+		frame.cpuFrameMs = this->profiler->cpuFrameMs();
+		frame.gpuFrameMs = this->profiler->gpuFrameMs();
+		for (size_t i = 0; i < this->profiler->phaseCount(); i++)
+		{
+			frame.phaseCpuMs[i] = this->profiler->cpuMs((int)i);
+			frame.phaseGpuMs[i] = this->profiler->gpuMs((int)i);
+		}
+		frame.context = this->current;
+		this->lastFrame = frame.frame;
+
+		// The first frames load and compile, and the dropped counts start wherever the SDK had them
+		const bool warm = this->recorded >= HITCH_RING_FRAMES / 4;
+		char reason[64] = "";
+		if (warm && frame.intervalUs > this->budgetMs * 1000.0)
+			snprintf(reason, sizeof(reason), "interval %.2f ms", frame.intervalUs / 1000.0f);
+		else if (warm && frame.appDropped > this->appDropped)
+			snprintf(reason, sizeof(reason), "app dropped %d", frame.appDropped - this->appDropped);
+		else if (warm && frame.compositorDropped > this->compositorDropped)
+			snprintf(reason, sizeof(reason), "compositor dropped %d", frame.compositorDropped - this->compositorDropped);
+		this->appDropped = frame.appDropped;
+		this->compositorDropped = frame.compositorDropped;
+
+		this->frames[this->recorded % HITCH_RING_FRAMES] = frame;
+		this->recorded++;
+
+		if (reason[0] && !this->afterFrames && this->dumps < HITCH_MAX_DUMPS
+			&& (this->lastDumpSeconds < 0.0 || frame.seconds - this->lastDumpSeconds >= HITCH_COOLDOWN_SECONDS))
+		{
+			this->afterFrames = HITCH_AFTER_FRAMES;
+			this->hitchFrame = frame.frame;
+			this->reason = reason;
+			this->lastDumpSeconds = frame.seconds;
+		}
+		else if (this->afterFrames && --this->afterFrames == 0)
+			this->dump();
+	}
+
+	uint32_t dumpCount() const { return this->dumps; }
+
+private:
+	JobSystem* jobs = nullptr;
+	const FrameProfiler* profiler = nullptr;
+	double budgetMs = 0.0;
+	vector<HitchFrame> frames;
+	uint64_t recorded = 0;
+	vector<HitchEvent> events;
+	uint64_t eventCount = 0;
+	HitchContext current;
+	uint64_t lastFrame = 0;
+	int appDropped = 0;
+	int compositorDropped = 0;
+	// Counting down to the dump of the hitch at hitchFrame
+	uint32_t afterFrames = 0;
+	uint64_t hitchFrame = 0;
+	std::string reason;
+	double lastDumpSeconds = -1.0;
+	uint32_t dumps = 0;
+
+	void dump()
+	{
+		shared_ptr<HitchDump> dump = make_shared<HitchDump>();
+		char name[64];
+		time_t now = time(nullptr);
+		strftime(name, sizeof(name), "hitch_%Y%m%d_%H%M%S", localtime(&now));
+		dump->path = std::string(name) + "_f" + std::to_string(this->hitchFrame) + ".csv";
+		dump->reason = this->reason;
+		dump->frame = this->hitchFrame;
+		dump->budgetMs = this->budgetMs;
+		for (size_t i = 0; i < this->profiler->phaseCount(); i++)
+			dump->phases.push_back(this->profiler->phaseName((int)i));
+		const uint64_t frameCount = std::min(this->recorded, (uint64_t)HITCH_RING_FRAMES);
+		dump->frames.reserve((size_t)frameCount);
+		for (uint64_t i = this->recorded - frameCount; i < this->recorded; i++)
+			dump->frames.push_back(this->frames[i % HITCH_RING_FRAMES]);
+		const uint64_t eventCount = std::min(this->eventCount, (uint64_t)HITCH_EVENT_RING);
+		for (uint64_t i = this->eventCount - eventCount; i < this->eventCount; i++)
+			dump->events.push_back(this->events[i % HITCH_EVENT_RING]);
+		this->dumps++;
+
+		// Behind the frame's jobs, the file is wanted but not soon
+		const JobPriority priority = _jobPriority();
+		_jobPriority() = JobPriority::Background;
+		this->jobs->run([dump]() { _writeHitchDump(*dump); });
+		_jobPriority() = priority;
+	}
+};
+
+static HitchRecorder _hitchRecorder;
@@ -0,0 +1,254 @@
+#pragma once
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "glstate.h"
+#include "shadingrate.h"
+#include "gldebug.h"
+#include "glcapture.h"
+
+// Texture unit the pyramid is bound to while a cull pass samples it, out of the way of the material textures
+#define HIZ_TEXTURE_UNIT 15
+
+// Full screen triangle from the vertex index alone
+static const char HIZ_VERTEX[] =
+	"#version 410 core\n"
+	"void main() {\n"
+	"    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+	"    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+	"}\n";
+
+// One level from the one above: the farthest of the 2x2 texels it covers, and of the extra row and column an odd
+// sized level leaves over, so no texel of a level is ever nearer than what it stands for.
+// The level above is the only one the texture exposes while this runs.
+static const char HIZ_DOWNSAMPLE[] =
+	"#version 410 core\n"
+	"uniform sampler2D depth;\n"
+	"uniform int reversed;\n"
+	"float farther(float a, float b) { return reversed != 0 ? min(a, b) : max(a, b); }\n"
+	"void main() {\n"
+	"    ivec2 last = textureSize(depth, 0) - 1;\n"
+	"    ivec2 c = ivec2(gl_FragCoord.xy) * 2;\n"
+	"    float d = texelFetch(depth, min(c, last), 0).r;\n"
+	"    d = farther(d, texelFetch(depth, min(c + ivec2(1, 0), last), 0).r);\n"
+	"    d = farther(d, texelFetch(depth, min(c + ivec2(0, 1), last), 0).r);\n"
+	"    d = farther(d, texelFetch(depth, min(c + ivec2(1, 1), last), 0).r);\n"
+	"    bool oddX = (last.x & 1) == 0 && c.x + 2 == last.x;\n"
+	"    bool oddY = (last.y & 1) == 0 && c.y + 2 == last.y;\n"
+	"    if (oddX) {\n"
+	"        d = farther(d, texelFetch(depth, ivec2(c.x + 2, min(c.y, last.y)), 0).r);\n"
+	"        d = farther(d, texelFetch(depth, ivec2(c.x + 2, min(c.y + 1, last.y)), 0).r);\n"
+	"    }\n"
+	"    if (oddY) {\n"
+	"        d = farther(d, texelFetch(depth, ivec2(min(c.x, last.x), c.y + 2), 0).r);\n"
+	"        d = farther(d, texelFetch(depth, ivec2(min(c.x + 1, last.x), c.y + 2), 0).r);\n"
+	"    }\n"
+	"    if (oddX && oddY)\n"
+	"        d = farther(d, texelFetch(depth, c + ivec2(2, 2), 0).r);\n"
+	"    gl_FragDepth = d;\n"
+	"}\n";
+
+// A mip chain of the depth buffer where every texel holds the farthest depth of the pixels under it. A sphere
+// whose nearest point is behind the texels its screen rectangle covers, at the level where that rectangle is
+// about two texels across, is hidden by what was drawn before the pyramid was built.
+//
+// build() copies the viewport of the bound draw framebuffer into level 0 and reduces each level into the next with
+// a depth-only full screen pass, so it works on any GL 4.1 eye target, multisampled or not. A multisampled target
+// is resolved with GL_NEAREST, one sample per pixel, which can miss a pixel's farthest sample along an occluder's
+// silhouette; the tests are per bounding box, well outside that. Layered multiview targets aren't read.
+class HiZPyramid
+{
+public:
+	HiZPyramid() {}
+	~HiZPyramid()
+	{
+		this->release();
+		if (this->program)
+			glDeleteProgram(this->program);
+		if (this->vertexArray)
+			glDeleteVertexArrays(1, &this->vertexArray);
+		if (this->framebuffer)
+			glDeleteFramebuffers(1, &this->framebuffer);
+	}
+
+	HiZPyramid(const HiZPyramid&) = delete;
+	HiZPyramid& operator=(const HiZPyramid&) = delete;
+
+	bool init()
+	{
+		GLuint vertex = this->compile(GL_VERTEX_SHADER, HIZ_VERTEX);
+		GLuint fragment = this->compile(GL_FRAGMENT_SHADER, HIZ_DOWNSAMPLE);
+		if (!vertex || !fragment)
+		{
+			glDeleteShader(vertex);
+			glDeleteShader(fragment);
+			return false;
+		}
+		this->program = glCreateProgram();
+		glAttachShader(this->program, vertex);
+		glAttachShader(this->program, fragment);
+		glLinkProgram(this->program);
+		_glCapture.programSources(this->program, HIZ_VERTEX, HIZ_DOWNSAMPLE);
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		GLint success = 0;
+		glGetProgramiv(this->program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetProgramInfoLog(this->program, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::HIZ::LINKING_FAILED\n" << infoLog << std::endl;
+			glDeleteProgram(this->program);
+			this->program = 0;
+			return false;
+		}
+		glGenVertexArrays(1, &this->vertexArray);
+		glGenFramebuffers(1, &this->framebuffer);
+		_glLabel(GL_PROGRAM, this->program, "hi-z reduce");
+		return true;
+	}
+
+	bool initialized() const { return this->program != 0; }
+
+	// The viewport of the draw framebuffer as it is now, whose depth format must be depthFormat. Leaves the
+	// framebuffer, viewport and depth state as it found them.
+	void build(GLenum depthFormat, bool reversed)
+	{
+		this->built = false;
+		if (!this->program)
+			return;
+		GLDebugGroup group("hi-z build");
+		GLint viewport[4], drawFramebuffer = 0, readFramebuffer = 0;
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+		if (viewport[2] <= 0 || viewport[3] <= 0)
+			return;
+		if (viewport[2] != this->width || viewport[3] != this->height || depthFormat != this->format)
+			this->allocate(viewport[2], viewport[3], depthFormat);
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, drawFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->framebuffer);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->texture, 0);
+		glBlitFramebuffer(viewport[0], viewport[1], viewport[0] + viewport[2], viewport[1] + viewport[3],
+			0, 0, this->width, this->height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		_glCapture.blit(viewport[0], viewport[1], viewport[0] + viewport[2], viewport[1] + viewport[3],
+			0, 0, this->width, this->height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+		const GLboolean clipDistance = glIsEnabled(GL_CLIP_DISTANCE0);
+		const GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+		// Each texel has to reduce its own 2x2, one coarse fragment would write its depth over a whole tile
+		const bool coarse = _shadingRate.suspend();
+		glDisable(GL_CLIP_DISTANCE0);
+		glDisable(GL_CULL_FACE);
+		_glState.useProgram(this->program);
+		_glState.bindVertexArray(this->vertexArray);
+		_glState.selectTexture(HIZ_TEXTURE_UNIT, this->texture);
+		_glState.depthFunc(GL_ALWAYS);
+		_glState.depthMask(GL_TRUE);
+		_glState.colorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glUniform1i(glGetUniformLocation(this->program, "depth"), HIZ_TEXTURE_UNIT);
+		glUniform1i(glGetUniformLocation(this->program, "reversed"), reversed ? 1 : 0);
+		GLint w = this->width, h = this->height;
+		for (GLint level = 1; level < this->levelCount; level++)
+		{
+			w = std::max(w / 2, 1);
+			h = std::max(h / 2, 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->texture, level);
+			glViewport(0, 0, w, h);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+			_glCapture.drawArrays(GL_TRIANGLES, 0, 3);
+			_renderStats.draw(GL_TRIANGLES, 3);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, this->levelCount - 1);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+
+		_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		_glState.depthFunc(GL_LESS);
+		if (clipDistance)
+			glEnable(GL_CLIP_DISTANCE0);
+		if (cullFace)
+			glEnable(GL_CULL_FACE);
+		if (coarse)
+			_shadingRate.resume();
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		this->built = true;
+	}
+
+	// Whether the last build() made a pyramid, a cull pass tests nothing against it otherwise
+	bool valid() const { return this->built; }
+	GLuint id() const { return this->texture; }
+	GLint levels() const { return this->levelCount; }
+	GLint sizeX() const { return this->width; }
+	GLint sizeY() const { return this->height; }
+
+private:
+	GLuint compile(GLenum type, const char* source)
+	{
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+		GLint success = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::HIZ::COMPILATION_FAILED\n" << infoLog << std::endl;
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+
+	void allocate(GLint width, GLint height, GLenum depthFormat)
+	{
+		this->release();
+		this->width = width;
+		this->height = height;
+		this->format = depthFormat;
+		this->levelCount = 1;
+		while ((std::max(width, height) >> this->levelCount) > 0)
+			this->levelCount++;
+		glGenTextures(1, &this->texture);
+		_glState.selectTexture(HIZ_TEXTURE_UNIT, this->texture);
+		_glLabel(GL_TEXTURE, this->texture, "hi-z pyramid");
+		for (GLint level = 0; level < this->levelCount; level++)
+		{
+			glTexImage2D(GL_TEXTURE_2D, level, depthFormat, std::max(width >> level, 1), std::max(height >> level, 1), 0,
+				GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, this->levelCount - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+	}
+
+	void release()
+	{
+		if (this->texture)
+			glDeleteTextures(1, &this->texture);
+		this->texture = 0;
+		this->width = this->height = 0;
+	}
+
+	GLuint program = 0;
+	GLuint vertexArray = 0;
+	GLuint framebuffer = 0;
+	GLuint texture = 0;
+	GLenum format = GL_NONE;
+	GLint width = 0;
+	GLint height = 0;
+	GLint levelCount = 0;
+	bool built = false;
+};
@@ -0,0 +1,121 @@
+#pragma once
+// Std. Includes
+#include <cstring>
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include <OVR_CAPI_GL.h>
+#include "benchhmd.h"
+
+// A quad layer of its own for HUD and status content, which the compositor samples straight onto the display.
+//
+// The eye passes never see it: nothing of it is drawn twice or rasterized again per frame. Its swap chain is only
+// redrawn and committed when something marked it dirty, frames in between submit the layer as it was and the compositor
+// keeps showing the last commit.
+class HudLayer
+{
+public:
+	HudLayer()
+	{
+		memset(&this->layer, 0, sizeof(ovrLayerQuad));
+	}
+
+	HudLayer(const HudLayer&) = delete;
+	HudLayer& operator=(const HudLayer&) = delete;
+
+	// width by height pixels, shown size metres wide and high at pose, relative to the head if headLocked and to the
+	// tracking origin otherwise. False and never visible if the swap chain couldn't be made.
+	bool init(ovrSession session, int width, int height, const ovrPosef& pose, const ovrVector2f& size, bool headLocked)
+	{
+		ovrTextureSwapChainDesc desc = {};
+		desc.Type = ovrTexture_2D;
+		desc.ArraySize = 1;
+		desc.Width = width;
+		desc.Height = height;
+		desc.MipLevels = 1;
+		desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+		desc.SampleCount = 1;
+		desc.StaticImage = ovrFalse;
+		if (!OVR_SUCCESS(_hmdCreateTextureSwapChainGL(session, &desc, &this->texture)))
+		{
+			std::cout << "ERROR::HUD::SWAP_CHAIN_NOT_CREATED" << std::endl;
+			this->texture = nullptr;
+			return false;
+		}
+		glGenFramebuffers(1, &this->fbo);
+
+		this->width = width;
+		this->height = height;
+		this->layer.Header.Type = ovrLayerType_Quad;
+		this->layer.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft | (headLocked ? ovrLayerFlag_HeadLocked : 0);
+		this->layer.ColorTexture = this->texture;
+		this->layer.Viewport.Pos = { 0, 0 };
+		this->layer.Viewport.Size = { width, height };
+		this->layer.QuadPoseCenter = pose;
+		this->layer.QuadSize = size;
+		return true;
+	}
+
+	// Whether the layer goes into this frame's submit at all, hiding it costs nothing and keeps what was drawn
+	void show(bool visible)
+	{
+		this->shown = visible;
+	}
+	bool visible() const { return this->shown && this->committed; }
+
+	// The content changed, the next redraw() draws it again
+	void markDirty()
+	{
+		this->dirty = true;
+	}
+
+	// Once a frame, before the submit. If visible and dirty, draw(width, height) fills the swap chain's next buffer,
+	// bound as the draw framebuffer with the viewport over all of it, and the buffer is committed. The clear colour
+	// and scissor test are put back after.
+	template <typename DrawFn>
+	void redraw(ovrSession session, DrawFn draw)
+	{
+		if (!this->texture || !this->shown || !this->dirty)
+			return;
+		int curIndex;
+		_hmdGetTextureSwapChainCurrentIndex(session, this->texture, &curIndex);
+		GLuint curTexId;
+		_hmdGetTextureSwapChainBufferGL(session, this->texture, curIndex, &curTexId);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->fbo);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curTexId, 0);
+
+		GLfloat clearColor[4];
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+		const GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+		glViewport(0, 0, this->width, this->height);
+		draw(this->width, this->height);
+		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+		if (scissor)
+			glEnable(GL_SCISSOR_TEST);
+		else
+			glDisable(GL_SCISSOR_TEST);
+
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+		_hmdCommitTextureSwapChain(session, this->texture);
+		this->dirty = false;
+		this->committed = true;
+	}
+
+	ovrLayerHeader* header() { return &this->layer.Header; }
+
+private:
+	ovrTextureSwapChain texture = nullptr;
+	GLuint fbo = 0;
+	ovrLayerQuad layer;
+	int width = 0;
+	int height = 0;
+	bool shown = false;
+	bool dirty = true;
+	// Nothing is submitted before the first commit, a swap chain without one isn't a valid layer
+	bool committed = false;
+};
+
+static HudLayer _hud;
@@ -0,0 +1,87 @@
+#version 330 core
+// STEREO_MULTIVIEW is defined by the app for the GL_OVR_multiview2 variant, see RiftApp::StereoMode
+#ifdef STEREO_MULTIVIEW
+#extension GL_OVR_multiview2 : require
+layout(num_views = 2) in;
+#endif
+// The atoms of one molecule type as ray cast spheres, see SphereImpostors. There are no vertex attributes: every
+// atom is six vertices, two triangles of a quad facing the eye that shader.frag's SPHERE_IMPOSTOR variant casts
+// the sphere in.
+// One model matrix per instance (per pair of instances in instanced stereo), see InstanceBuffer
+layout (location = 5) in mat4 instanceTransform;
+
+// Model space centre and radius, and diffuse color, of each atom. SPHERE_IMPOSTOR_MAX_ATOMS is defined by the app.
+uniform vec4 atomSpheres[SPHERE_IMPOSTOR_MAX_ATOMS];
+uniform vec4 atomColors[SPHERE_IMPOSTOR_MAX_ATOMS];
+
+// World space: the point on the quad, the sphere, and the eye the ray starts from
+out vec3 impostorPoint;
+flat out vec4 impostorSphere;
+flat out vec3 impostorEye;
+// Rows z and w of the eye's view projection, for the depth of the point the ray hits
+flat out vec4 impostorClipZ;
+flat out vec4 impostorClipW;
+flat out vec3 atomDiffuse;
+
+// Element 0 is the left eye. Mono rendering only uses element 0.
+// With LATE_LATCH the cameras come from the block RiftApp rewrites right before the draws are issued.
+#ifdef LATE_LATCH
+layout(std140) uniform LateLatch
+{
+	mat4 view[2];
+	mat4 projection[2];
+	mat4 hands[2];
+};
+#else
+uniform mat4 view[2];
+uniform mat4 projection[2];
+#endif
+// Instanced stereo: every draw is issued with eyeCount times the instances, eye = gl_InstanceID % eyeCount.
+// eyeViewport squeezes each eye into its half of the shared target: xy scale, zw offset in NDC.
+uniform int eyeCount = 1;
+uniform vec4 eyeViewport[2];
+
+const vec2 corners[6] = vec2[6](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0), vec2(-1.0, 1.0), vec2(1.0, -1.0), vec2(1.0, 1.0));
+
+void main()
+{
+#ifdef STEREO_MULTIVIEW
+	int eye = int(gl_ViewID_OVR);
+#else
+	int eye = gl_InstanceID % eyeCount;
+#endif
+	int atom = gl_VertexID / 6;
+	vec4 sphere = atomSpheres[atom];
+	vec3 centre = vec3(instanceTransform * vec4(sphere.xyz, 1.0f));
+	float radius = sphere.w * length(instanceTransform[0].xyz);
+
+	// The view is rigid, so the eye is where its inverse takes the origin
+	mat4 eyeView = view[eye];
+	vec3 eyePos = -(transpose(mat3(eyeView)) * eyeView[3].xyz);
+	vec3 toCentre = centre - eyePos;
+	float distance = length(toCentre);
+	vec3 forward = toCentre / distance;
+	vec3 right = normalize(cross(forward, abs(forward.y) < 0.99f ? vec3(0.0f, 1.0f, 0.0f) : vec3(1.0f, 0.0f, 0.0f)));
+	vec3 up = cross(right, forward);
+	// Half the size of the sphere's silhouette where the quad is, in the plane through the centre
+	float extent = radius * distance / sqrt(max(distance * distance - radius * radius, 1e-8f));
+	vec3 point = centre + (corners[gl_VertexID % 6].x * right + corners[gl_VertexID % 6].y * up) * extent;
+
+	mat4 viewProjection = projection[eye] * eyeView;
+	vec4 clip = viewProjection * vec4(point, 1.0f);
+#ifndef STEREO_MULTIVIEW
+	if (eyeCount > 1)
+	{
+		// Keep each eye out of the other's half, GL_CLIP_DISTANCE0 is enabled by RiftApp
+		gl_ClipDistance[0] = eye == 0 ? clip.w - clip.x : clip.w + clip.x;
+		clip.xy = clip.xy * eyeViewport[eye].xy + eyeViewport[eye].zw * clip.w;
+	}
+#endif
+	gl_Position = clip;
+	impostorPoint = point;
+	impostorSphere = vec4(centre, radius);
+	impostorEye = eyePos;
+	impostorClipZ = vec4(viewProjection[0].z, viewProjection[1].z, viewProjection[2].z, viewProjection[3].z);
+	impostorClipW = vec4(viewProjection[0].w, viewProjection[1].w, viewProjection[2].w, viewProjection[3].w);
+	atomDiffuse = atomColors[atom].rgb;
+}
@@ -0,0 +1,109 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "glstate.h"
+#include "shader.h"
+#include "instancing.h"
+#include "molecules.h"
+#include "glcapture.h"
+
+// Most atoms one molecule type may have, the length of impostor.vert's atom arrays
+#define SPHERE_IMPOSTOR_MAX_ATOMS 4
+// Selects the impostor variant of shader.frag, impostor.vert needs it too
+#define SPHERE_IMPOSTOR_DEFINE "#define SPHERE_IMPOSTOR\n#define SPHERE_IMPOSTOR_MAX_ATOMS 4\n"
+
+// One atom of a molecule in the molecule's model space, where the models fill about -0.5 to 0.5
+struct ImpostorAtom
+{
+	glm::vec3 centre;
+	float radius;
+	glm::vec3 diffuse;
+};
+
+struct MoleculeAtoms
+{
+	const ImpostorAtom* atoms;
+	uint32_t count;
+};
+
+// Linear, carbon in the middle, in the colors co2.mtl and o2.mtl give the models
+static const ImpostorAtom _co2Atoms[] = {
+	{ glm::vec3(0.0f, 0.0f, 0.0f), 0.2f, glm::vec3(0.64f, 0.64f, 0.64f) },
+	{ glm::vec3(-0.32f, 0.0f, 0.0f), 0.18f, glm::vec3(0.639f, 0.024f, 0.045f) },
+	{ glm::vec3(0.32f, 0.0f, 0.0f), 0.18f, glm::vec3(0.639f, 0.024f, 0.045f) },
+};
+static const ImpostorAtom _o2Atoms[] = {
+	{ glm::vec3(-0.2f, 0.0f, 0.0f), 0.24f, glm::vec3(0.01f, 0.13f, 0.639f) },
+	{ glm::vec3(0.2f, 0.0f, 0.0f), 0.24f, glm::vec3(0.01f, 0.13f, 0.639f) },
+};
+// By MoleculeType
+static const MoleculeAtoms _moleculeAtoms[(int)MoleculeType::Count] = {
+	{ _co2Atoms, sizeof(_co2Atoms) / sizeof(_co2Atoms[0]) },
+	{ _o2Atoms, sizeof(_o2Atoms) / sizeof(_o2Atoms[0]) },
+};
+
+// One molecule type drawn as its atoms, each a quad the fragment shader ray casts a sphere in, instead of as a
+// tessellated mesh. Reads the same instance buffers as the mesh, the vertex arrays only source the instance
+// transforms, so the triangle count is two per atom whatever the models' tessellation and level of detail.
+class SphereImpostors
+{
+public:
+	SphereImpostors() {}
+	~SphereImpostors()
+	{
+		if (!this->vertexArrays.empty())
+			glDeleteVertexArrays((GLsizei)this->vertexArrays.size(), this->vertexArrays.data());
+	}
+
+	SphereImpostors(const SphereImpostors&) = delete;
+	SphereImpostors& operator=(const SphereImpostors&) = delete;
+
+	void init(const MoleculeAtoms& molecule)
+	{
+		this->atomCount = std::min(molecule.count, (uint32_t)SPHERE_IMPOSTOR_MAX_ATOMS);
+		for (uint32_t i = 0; i < this->atomCount; i++)
+		{
+			const ImpostorAtom& atom = molecule.atoms[i];
+			this->spheres[i] = glm::vec4(atom.centre, atom.radius);
+			this->colors[i] = glm::vec4(atom.diffuse, 1.0f);
+		}
+	}
+
+	// Points slot's vertex array at buffer's transforms, see _attachInstanceTransforms for divisor
+	void attach(uint32_t slot, GLuint buffer, GLuint divisor)
+	{
+		while (this->vertexArrays.size() <= slot)
+		{
+			GLuint vertexArray = 0;
+			glGenVertexArrays(1, &vertexArray);
+			this->vertexArrays.push_back(vertexArray);
+		}
+		_attachInstanceTransforms(this->vertexArrays[slot], buffer, divisor);
+	}
+
+	// instances as the mesh would draw them, eye count included. The program must be in use with its view uniforms set.
+	void draw(Shader& shader, uint32_t slot, GLsizei instances)
+	{
+		if (!instances || slot >= this->vertexArrays.size() || !this->atomCount)
+			return;
+		shader.set("atomSpheres", this->spheres, SPHERE_IMPOSTOR_MAX_ATOMS);
+		shader.set("atomColors", this->colors, SPHERE_IMPOSTOR_MAX_ATOMS);
+		_glState.bindVertexArray(this->vertexArrays[slot]);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, (GLsizei)this->atomCount * 6, instances);
+		_glCapture.drawArrays(GL_TRIANGLES, 0, (GLsizei)this->atomCount * 6, instances);
+		_renderStats.draw(GL_TRIANGLES, (GLsizei)this->atomCount * 6, instances);
+		_glState.bindVertexArray(0);
+	}
+
+private:
+	vector<GLuint> vertexArrays;
+	uint32_t atomCount = 0;
+	glm::vec4 spheres[SPHERE_IMPOSTOR_MAX_ATOMS];
+	glm::vec4 colors[SPHERE_IMPOSTOR_MAX_ATOMS];
+};
@@ -0,0 +1,174 @@
+#pragma once
+// Std. Includes
+#include <atomic>
+#include <thread>
+#include <cstdint>
+using namespace std;
+#include <Windows.h>
+#include <mmsystem.h>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include "framepipeline.h"
+#include "trace.h"
+#include "threading.h"
+#include "timing.h"
+
+// How often the input thread samples the controllers
+#define INPUT_POLL_HZ 500
+// Samples the input thread can get ahead of the frame by, a bit over a second at INPUT_POLL_HZ
+#define INPUT_RING_SIZE 1024
+// Index trigger travel past which the trigger counts as pressed
+#define INPUT_TRIGGER_PRESSED 0.5f
+
+// One sample of the Touch controllers, at TimeInSeconds on ovr_GetTimeInSeconds()'s clock
+struct InputSample
+{
+	ovrInputState input;
+	ovrPoseStatef hands[ovrHand_Count];
+};
+
+// What happened to one hand between two frames
+struct HandEdges
+{
+	// The trigger is pressed in the newest sample
+	bool trigger = false;
+	// Times of the first press and the last release of the trigger since the last frame, 0 if there was none;
+	// a press and release both between two frames is a tap that frame samples alone would miss
+	double triggerPressed = 0.0;
+	double triggerReleased = 0.0;
+	// Buttons of the hand that went down since the last frame, and when the first of them did
+	uint32_t buttonsPressed = 0;
+	double buttonTime = 0.0;
+};
+
+static uint32_t _handButtons(ovrHandType hand)
+{
+	return hand == ovrHand_Left ? (ovrButton_X | ovrButton_Y | ovrButton_LThumb | ovrButton_Enter)
+		: (ovrButton_A | ovrButton_B | ovrButton_RThumb | ovrButton_Home);
+}
+
+// Samples the controllers on a thread of its own at INPUT_POLL_HZ into an SpscQueue the frame drains, so edges
+// between frames keep the time they happened at instead of the time the next frame looked.
+//
+// Only the raw state crosses threads. The frame turns it into HandEdges against the last sample it saw, whether
+// that came from the thread or, while it isn't running, from the frame's own poll through add(). The thread calls
+// LibOVR directly, not through the _hmd wrappers, so --bench and pose traces, which answer or record input per
+// frame, keep it stopped.
+class InputPoller
+{
+public:
+	InputPoller() {}
+	~InputPoller()
+	{
+		this->stop();
+	}
+
+	InputPoller(const InputPoller&) = delete;
+	InputPoller& operator=(const InputPoller&) = delete;
+
+	bool running() const { return this->thread.joinable(); }
+
+	void start(ovrSession session)
+	{
+		if (this->running() || !session)
+			return;
+		this->stopping = false;
+		this->thread = std::thread([this, session]() { this->run(session); });
+	}
+
+	void stop()
+	{
+		if (!this->running())
+			return;
+		this->stopping = true;
+		this->thread.join();
+	}
+
+	// Frame side, for a sample it took itself while the thread isn't running
+	void add(const InputSample& sample)
+	{
+		this->consume(sample);
+	}
+
+	// Frame side: everything sampled since the last call, into the edges per hand
+	void drain()
+	{
+		InputSample sample;
+		while (this->samples.pop(&sample))
+			this->consume(sample);
+	}
+
+	// Edges since the last clearEdges()
+	const HandEdges& edges(ovrHandType hand) const { return this->hands[hand]; }
+	// The newest sample the frame has seen
+	const InputSample& latest() const { return this->last; }
+
+	// Frame side, after use: the next drain() starts collecting afresh
+	void clearEdges()
+	{
+		for (int hand = 0; hand < ovrHand_Count; hand++)
+		{
+			HandEdges& e = this->hands[hand];
+			e.triggerPressed = e.triggerReleased = e.buttonTime = 0.0;
+			e.buttonsPressed = 0;
+		}
+	}
+
+private:
+	void run(ovrSession session)
+	{
+		TRACE_THREAD("input poller");
+		_threadPolicy.apply(ThreadRole::Input);
+		// The default scheduler tick is ~15ms, a 2ms sleep needs it finer where there is no high resolution timer
+		timeBeginPeriod(1);
+		const int64_t interval = _timeTicksPerSecond() / INPUT_POLL_HZ;
+		Deadline next = Deadline::in(0.0);
+		while (!this->stopping)
+		{
+			InputSample sample;
+			if (OVR_SUCCESS(ovr_GetInputState(session, ovrControllerType_Touch, &sample.input)))
+			{
+				// Time 0 is the newest pose the runtime has, not a prediction
+				const ovrTrackingState tracking = ovr_GetTrackingState(session, 0.0, ovrFalse);
+				sample.hands[ovrHand_Left] = tracking.HandPoses[ovrHand_Left];
+				sample.hands[ovrHand_Right] = tracking.HandPoses[ovrHand_Right];
+				// A full ring means the frame has stalled for a second, the oldest unread samples matter more
+				this->samples.push(sample);
+			}
+			next.ticks += interval;
+			// A sample a timer's slack late is fine, spinning 500 times a second isn't
+			_sleepUntil(next, false);
+		}
+		timeEndPeriod(1);
+	}
+
+	void consume(const InputSample& sample)
+	{
+		for (int hand = 0; hand < ovrHand_Count; hand++)
+		{
+			HandEdges& e = this->hands[hand];
+			const bool trigger = sample.input.IndexTrigger[hand] > INPUT_TRIGGER_PRESSED;
+			if (trigger && !e.trigger && e.triggerPressed == 0.0)
+				e.triggerPressed = sample.input.TimeInSeconds;
+			if (!trigger && e.trigger)
+				e.triggerReleased = sample.input.TimeInSeconds;
+			e.trigger = trigger;
+
+			const uint32_t mask = _handButtons((ovrHandType)hand);
+			const uint32_t pressed = sample.input.Buttons & ~this->last.input.Buttons & mask;
+			if (pressed && !e.buttonsPressed)
+				e.buttonTime = sample.input.TimeInSeconds;
+			e.buttonsPressed |= pressed;
+		}
+		this->last = sample;
+	}
+
+	std::thread thread;
+	std::atomic<bool> stopping{ false };
+	SpscQueue<InputSample, INPUT_RING_SIZE> samples;
+	// Frame side only
+	InputSample last = {};
+	HandEdges hands[ovrHand_Count];
+};
+
+static InputPoller _inputPoller;
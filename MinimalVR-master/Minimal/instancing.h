@@ -0,0 +1,130 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "glstate.h"
+
+// Attribute location of the per-instance model matrix, takes four consecutive slots (5..8)
+#define INSTANCE_TRANSFORM_LOCATION 5
+
+// A GPU buffer of per-instance model matrices that gets refilled as a whole every frame.
+// Attach it to a mesh VAO with _attachInstanceTransforms, then draw with glDrawElementsInstanced.
+class InstanceBuffer
+{
+public:
+	InstanceBuffer() {}
+	~InstanceBuffer()
+	{
+		if (this->buffer)
+			glDeleteBuffers(1, &this->buffer);
+	}
+
+	InstanceBuffer(const InstanceBuffer&) = delete;
+	InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+	GLuint id()
+	{
+		if (!this->buffer)
+			glGenBuffers(1, &this->buffer);
+		return this->buffer;
+	}
+
+	GLsizei count() const { return this->instanceCount; }
+
+	// Replaces the contents. The old storage is orphaned so the driver never waits on draws still reading it.
+	void update(const vector<glm::mat4>& transforms)
+	{
+		this->instanceCount = (GLsizei)transforms.size();
+		if (transforms.empty())
+			return;
+
+		glBindBuffer(GL_ARRAY_BUFFER, this->id());
+		if (transforms.size() > this->capacity)
+		{
+			// Grow geometrically so a steadily growing molecule count doesn't reallocate every frame
+			this->capacity = std::max(transforms.size(), this->capacity * 2);
+		}
+		glBufferData(GL_ARRAY_BUFFER, this->capacity * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, transforms.size() * sizeof(glm::mat4), glm::value_ptr(transforms[0]));
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		_renderStats.uploaded(transforms.size() * sizeof(glm::mat4));
+	}
+
+	// Room for count transforms that something on the GPU writes, the contents are undefined until it does
+	void reserve(size_t count)
+	{
+		if (count <= this->capacity)
+			return;
+		this->capacity = std::max(count, this->capacity * 2);
+		glBindBuffer(GL_ARRAY_BUFFER, this->id());
+		glBufferData(GL_ARRAY_BUFFER, this->capacity * sizeof(glm::mat4), NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+private:
+	GLuint buffer = 0;
+	size_t capacity = 0;
+	GLsizei instanceCount = 0;
+};
+
+// Per-instance model matrices that never change once uploaded, in immutable storage where ARB_buffer_storage is
+// there. Attached and drawn the same as an InstanceBuffer.
+class StaticInstanceBuffer
+{
+public:
+	StaticInstanceBuffer() {}
+	~StaticInstanceBuffer()
+	{
+		if (this->buffer)
+			glDeleteBuffers(1, &this->buffer);
+	}
+
+	StaticInstanceBuffer(const StaticInstanceBuffer&) = delete;
+	StaticInstanceBuffer& operator=(const StaticInstanceBuffer&) = delete;
+
+	// Once, the storage can't be resized or written again
+	void init(const vector<glm::mat4>& transforms)
+	{
+		if (this->buffer || transforms.empty())
+			return;
+		const GLsizeiptr size = transforms.size() * sizeof(glm::mat4);
+		glGenBuffers(1, &this->buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, this->buffer);
+		if (GLEW_ARB_buffer_storage)
+			glBufferStorage(GL_ARRAY_BUFFER, size, glm::value_ptr(transforms[0]), 0);
+		else
+			glBufferData(GL_ARRAY_BUFFER, size, glm::value_ptr(transforms[0]), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		this->instanceCount = (GLsizei)transforms.size();
+	}
+
+	GLuint id() const { return this->buffer; }
+
+	GLsizei count() const { return this->instanceCount; }
+
+private:
+	GLuint buffer = 0;
+	GLsizei instanceCount = 0;
+};
+
+// Points the instance transform attribute of a VAO at buffer, one mat4 per instance.
+// A divisor of 2 repeats every transform for two consecutive instances (instanced stereo, one per eye).
+static void _attachInstanceTransforms(GLuint vertexArray, GLuint buffer, GLuint divisor = 1)
+{
+	_glState.bindVertexArray(vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	for (GLuint column = 0; column < 4; column++)
+	{
+		GLuint location = INSTANCE_TRANSFORM_LOCATION + column;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid*)(sizeof(glm::vec4) * column));
+		glVertexAttribDivisor(location, divisor);
+	}
+	_glState.bindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,282 @@
+#pragma once
+// Std. Includes
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <algorithm>
+using namespace std;
+#include "trace.h"
+#include "alloctag.h"
+#include "threading.h"
+
+// Counts the unfinished jobs of a batch, JobSystem::wait() returns once it drops to zero
+struct JobCounter
+{
+	std::atomic<int> pending{ 0 };
+
+	bool done() const { return this->pending.load(std::memory_order_acquire) == 0; }
+};
+
+// Which jobs a worker takes first. Frame jobs are the ones a frame waits on; Background ones come from the loader
+// and startup, and only run when no frame job is queued.
+enum class JobPriority : uint8_t
+{
+	Frame,
+	Background,
+	Count,
+};
+
+// What the jobs this thread queues are. Threads set it once for themselves, and a worker takes on the priority of the
+// job it is running, so the jobs a job queues stay at its priority.
+static JobPriority& _jobPriority()
+{
+	static thread_local JobPriority priority = JobPriority::Frame;
+	return priority;
+}
+
+// Index of the JobSystem worker running on this thread, -1 on every other thread
+static int& _jobWorkerIndex()
+{
+	static thread_local int index = -1;
+	return index;
+}
+
+// Small work stealing scheduler for the CPU heavy parts of a frame.
+//
+// Every worker owns a deque: it pushes and pops its own jobs at the back, which keeps recently
+// split work hot in its cache, while idle workers steal from the front of the others. Threads that
+// aren't workers (the render and simulation threads) queue into one extra shared deque, and help
+// run jobs instead of blocking while they wait(). The deques are short and each has its own lock,
+// so contention stays low without a lock free deque.
+// With priorities on, each deque keeps a lane per JobPriority and every worker looks through all the Frame lanes
+// before any Background one, so a streaming burst can't hold up a frame's parallelFor.
+// Before init(), or with no workers, every job simply runs inline on the calling thread.
+class JobSystem
+{
+public:
+	JobSystem() {}
+	~JobSystem()
+	{
+		this->shutdown();
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// threadCount 0 leaves one core for the thread that calls init()
+	void init(unsigned threadCount = 0)
+	{
+		if (!this->threads.empty())
+			return;
+		if (threadCount == 0)
+			threadCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+		if (threadCount == 0)
+			return;
+
+		// One deque per worker, then the shared one for outside threads
+		for (unsigned i = 0; i <= threadCount; i++)
+			this->queues.emplace_back(new Queue());
+		this->stopping = false;
+		for (unsigned i = 0; i < threadCount; i++)
+			this->threads.emplace_back([this, i]() { this->workerLoop((int)i); });
+	}
+
+	// Finishes whatever is queued, then joins the workers
+	void shutdown()
+	{
+		if (this->threads.empty())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(this->sleepMutex);
+			this->stopping = true;
+		}
+		this->wake.notify_all();
+		for (size_t i = 0; i < this->threads.size(); i++)
+			this->threads[i].join();
+		this->threads.clear();
+		this->queues.clear();
+	}
+
+	size_t workerCount() const { return this->threads.size(); }
+
+	// --no-job-priorities puts every job in the Frame lane, first come first served
+	void setPrioritized(bool prioritized) { this->prioritized = prioritized; }
+
+	// Queues job; counter, if any, is incremented now and decremented when the job has run
+	void run(std::function<void()> job, JobCounter* counter = nullptr)
+	{
+		if (this->threads.empty())
+		{
+			job();
+			return;
+		}
+		if (counter)
+			counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+		int self = _jobWorkerIndex();
+		Queue& queue = *this->queues[self >= 0 ? self : this->threads.size()];
+		const JobPriority priority = this->prioritized ? _jobPriority() : JobPriority::Frame;
+		{
+			std::lock_guard<TraceMutex> lock(queue.mutex);
+			queue.jobs[(size_t)priority].push_back(Job{ std::move(job), counter, _allocationTag(), priority });
+		}
+		this->queued.fetch_add(1, std::memory_order_release);
+		{
+			// Taken so a worker between its empty check and its wait can't miss the notification
+			std::lock_guard<std::mutex> lock(this->sleepMutex);
+		}
+		this->wake.notify_one();
+	}
+
+	// Splits [0, count) into chunks of at least grain items and calls body(begin, end) for each.
+	// The calling thread runs the last chunk itself and then helps with the rest until all are done.
+	template <typename Body>
+	void parallelFor(size_t count, size_t grain, Body body)
+	{
+		if (count == 0)
+			return;
+		grain = std::max<size_t>(grain, 1);
+		if (this->threads.empty() || count <= grain)
+		{
+			body((size_t)0, count);
+			return;
+		}
+		// A few chunks per thread so stealing can even out uneven chunks
+		size_t chunks = std::min((count + grain - 1) / grain, (this->threads.size() + 1) * 4);
+		size_t chunkSize = (count + chunks - 1) / chunks;
+
+		JobCounter counter;
+		size_t begin = 0;
+		for (; begin + chunkSize < count; begin += chunkSize)
+		{
+			size_t end = begin + chunkSize;
+			this->run([&body, begin, end]() { body(begin, end); }, &counter);
+		}
+		body(begin, count);
+		this->wait(counter);
+	}
+
+	// Runs queued jobs on this thread until counter is done
+	void wait(JobCounter& counter)
+	{
+		int self = _jobWorkerIndex();
+		while (!counter.done())
+		{
+			if (!this->runOne(self))
+				std::this_thread::yield();
+		}
+	}
+
+private:
+	struct Job
+	{
+		std::function<void()> function;
+		JobCounter* counter;
+		// What the queuing thread's allocations were charged to, the job's are too
+		AllocationTag allocationTag;
+		JobPriority priority;
+	};
+
+	struct Queue
+	{
+		TRACE_MUTEX(mutex, "job queue");
+		std::deque<Job> jobs[(size_t)JobPriority::Count];
+	};
+
+	vector<unique_ptr<Queue>> queues;
+	vector<std::thread> threads;
+	std::atomic<int> queued{ 0 };
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	bool prioritized = true;
+
+	// Lane by lane: own deque from the back, otherwise steal from the front of the others, starting next to our own
+	bool pop(int self, Job* job)
+	{
+		for (size_t lane = 0; lane < (size_t)JobPriority::Count; lane++)
+		{
+			if (this->pop(self, lane, job))
+				return true;
+		}
+		return false;
+	}
+
+	bool pop(int self, size_t lane, Job* job)
+	{
+		const size_t queueCount = this->queues.size();
+		if (self >= 0)
+		{
+			std::deque<Job>& own = this->queues[self]->jobs[lane];
+			std::lock_guard<TraceMutex> lock(this->queues[self]->mutex);
+			if (!own.empty())
+			{
+				*job = std::move(own.back());
+				own.pop_back();
+				return true;
+			}
+		}
+		size_t start = self >= 0 ? (size_t)self + 1 : 0;
+		for (size_t i = 0; i < queueCount; i++)
+		{
+			size_t victim = (start + i) % queueCount;
+			if ((int)victim == self)
+				continue;
+			Queue& queue = *this->queues[victim];
+			std::lock_guard<TraceMutex> lock(queue.mutex);
+			if (!queue.jobs[lane].empty())
+			{
+				*job = std::move(queue.jobs[lane].front());
+				queue.jobs[lane].pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool runOne(int self)
+	{
+		if (this->queued.load(std::memory_order_acquire) == 0)
+			return false;
+		Job job;
+		if (!this->pop(self, &job))
+			return false;
+		this->queued.fetch_sub(1, std::memory_order_relaxed);
+		{
+			TRACE_ZONE("job");
+			AllocationTagScope tagScope(job.allocationTag);
+			const JobPriority outer = _jobPriority();
+			_jobPriority() = job.priority;
+			job.function();
+			_jobPriority() = outer;
+		}
+		if (job.counter)
+			job.counter->pending.fetch_sub(1, std::memory_order_release);
+		return true;
+	}
+
+	void workerLoop(int index)
+	{
+		_jobWorkerIndex() = index;
+		TRACE_THREAD("job worker");
+		_threadPolicy.apply(ThreadRole::Worker, (unsigned)index);
+		for (;;)
+		{
+			if (this->runOne(index))
+				continue;
+			std::unique_lock<std::mutex> lock(this->sleepMutex);
+			this->wake.wait(lock, [this]() { return this->stopping || this->queued.load(std::memory_order_acquire) > 0; });
+			if (this->stopping && this->queued.load(std::memory_order_acquire) == 0)
+				return;
+		}
+	}
+};
+
+// The app's workers, started and stopped by GlfwApp::run
+static JobSystem _jobs;
@@ -0,0 +1,199 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+using namespace std;
+
+// Just enough JSON for glTF documents and bench reports: no escapes other than the simple ones, numbers as double
+struct JsonValue
+{
+	enum class Type
+	{
+		Null,
+		Bool,
+		Number,
+		String,
+		Array,
+		Object
+	};
+
+	Type type = Type::Null;
+	double number = 0.0;
+	string text;
+	vector<JsonValue> items;
+	vector<pair<string, JsonValue>> members;
+
+	// Member key of an object, nullptr if there is none or this isn't an object
+	const JsonValue* get(const char* key) const
+	{
+		for (size_t i = 0; i < this->members.size(); i++)
+		{
+			if (this->members[i].first == key)
+				return &this->members[i].second;
+		}
+		return nullptr;
+	}
+
+	// Element index of an array, nullptr past its end
+	const JsonValue* at(size_t index) const
+	{
+		return index < this->items.size() ? &this->items[index] : nullptr;
+	}
+
+	size_t size() const { return this->type == Type::Array ? this->items.size() : this->members.size(); }
+
+	double numberOr(const char* key, double fallback) const
+	{
+		const JsonValue* value = this->get(key);
+		return value && value->type == Type::Number ? value->number : fallback;
+	}
+
+	int intOr(const char* key, int fallback) const
+	{
+		return (int)this->numberOr(key, fallback);
+	}
+
+	string textOr(const char* key, const char* fallback) const
+	{
+		const JsonValue* value = this->get(key);
+		return value && value->type == Type::String ? value->text : fallback;
+	}
+};
+
+static const char* _skipJsonSpace(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		p++;
+	return p;
+}
+
+// Parses the value at p into value, nullptr if it isn't valid JSON
+static const char* _parseJson(const char* p, const char* end, JsonValue* value, int depth = 0)
+{
+	p = _skipJsonSpace(p, end);
+	if (p == end || depth > 64)
+		return nullptr;
+	if (*p == '{' || *p == '[')
+	{
+		const bool object = *p == '{';
+		value->type = object ? JsonValue::Type::Object : JsonValue::Type::Array;
+		p = _skipJsonSpace(p + 1, end);
+		if (p < end && *p == (object ? '}' : ']'))
+			return p + 1;
+		while (p < end)
+		{
+			JsonValue* element;
+			if (object)
+			{
+				JsonValue key;
+				p = _parseJson(p, end, &key, depth + 1);
+				if (!p || key.type != JsonValue::Type::String)
+					return nullptr;
+				p = _skipJsonSpace(p, end);
+				if (p == end || *p != ':')
+					return nullptr;
+				p++;
+				value->members.push_back(make_pair(std::move(key.text), JsonValue()));
+				element = &value->members.back().second;
+			}
+			else
+			{
+				value->items.emplace_back();
+				element = &value->items.back();
+			}
+			p = _parseJson(p, end, element, depth + 1);
+			if (!p)
+				return nullptr;
+			p = _skipJsonSpace(p, end);
+			if (p < end && *p == ',')
+			{
+				p++;
+				continue;
+			}
+			if (p < end && *p == (object ? '}' : ']'))
+				return p + 1;
+			return nullptr;
+		}
+		return nullptr;
+	}
+	if (*p == '"')
+	{
+		value->type = JsonValue::Type::String;
+		for (p++; p < end && *p != '"'; p++)
+		{
+			if (*p == '\\' && p + 1 < end)
+			{
+				p++;
+				switch (*p)
+				{
+				case 'n': value->text += '\n'; break;
+				case 't': value->text += '\t'; break;
+				case 'r': value->text += '\r'; break;
+				case 'b': value->text += '\b'; break;
+				case 'f': value->text += '\f'; break;
+				// \uXXXX only shows up in names, which nothing here looks at
+				case 'u': p = std::min(p + 4, end - 1); value->text += '?'; break;
+				default: value->text += *p; break;
+				}
+			}
+			else
+			{
+				value->text += *p;
+			}
+		}
+		return p < end ? p + 1 : nullptr;
+	}
+	if (end - p >= 4 && memcmp(p, "true", 4) == 0)
+	{
+		value->type = JsonValue::Type::Bool;
+		value->number = 1.0;
+		return p + 4;
+	}
+	if (end - p >= 5 && memcmp(p, "false", 5) == 0)
+	{
+		value->type = JsonValue::Type::Bool;
+		return p + 5;
+	}
+	if (end - p >= 4 && memcmp(p, "null", 4) == 0)
+		return p + 4;
+
+	// strtod needs a terminated string, and numbers are short
+	char number[64];
+	size_t length = 0;
+	while (p + length < end && length < sizeof(number) - 1 && strchr("+-.eE0123456789", p[length]))
+		length++;
+	if (!length)
+		return nullptr;
+	memcpy(number, p, length);
+	number[length] = '\0';
+	value->type = JsonValue::Type::Number;
+	value->number = strtod(number, nullptr);
+	return p + length;
+}
+
+// text as the inside of a JSON string, the escapes _parseJson reads back
+static string _jsonEscape(const string& text)
+{
+	string escaped;
+	escaped.reserve(text.size());
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		switch (text[i])
+		{
+		case '"': escaped += "\\\""; break;
+		case '\\': escaped += "\\\\"; break;
+		case '\n': escaped += "\\n"; break;
+		case '\t': escaped += "\\t"; break;
+		case '\r': escaped += "\\r"; break;
+		default:
+			if ((unsigned char)text[i] >= 0x20)
+				escaped += text[i];
+			break;
+		}
+	}
+	return escaped;
+}
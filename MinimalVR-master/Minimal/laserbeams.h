@@ -0,0 +1,68 @@
+#pragma once
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "glstate.h"
+#include "shader.h"
+#include "gldebug.h"
+#include "renderstats.h"
+
+// Farthest a beam reaches when nothing stops it, in metres
+#define LASER_BEAM_MAX_LENGTH 200.0f
+// Half the width of a beam in metres
+#define LASER_BEAM_WIDTH 0.004f
+// Selects the beam variant of shader.frag
+#define LASER_BEAM_DEFINE "#define LASER_BEAM\n"
+
+// The controllers' lasers as quads turned to face the eye, drawn by beam.vert from the LateLatch block's hands so
+// they stay on the controllers however late the poses are latched. Both hands and every eye are one instanced
+// draw with no vertex data. aim() sets how far each reaches, usually to where its ray hits the factory.
+class LaserBeams
+{
+public:
+	LaserBeams() {}
+
+	LaserBeams(const LaserBeams&) = delete;
+	LaserBeams& operator=(const LaserBeams&) = delete;
+
+	void init()
+	{
+		// The draw reads no attributes, but a core context still wants a vertex array bound
+		glGenVertexArrays(1, &this->vertexArray);
+	}
+
+	bool initialized() const { return this->vertexArray != 0; }
+
+	// hand 0 is the left; a length of 0 hides that beam
+	void aim(int hand, float length, const glm::vec4& color)
+	{
+		this->lengths[hand] = length;
+		this->colors[hand] = color;
+	}
+
+	// With a program built from beam.vert, whose view uniforms are set
+	void draw(Shader& shader, GLuint eyeCount)
+	{
+		if (!this->vertexArray || (this->lengths.x <= 0.0f && this->lengths.y <= 0.0f))
+			return;
+		GLDebugGroup group("laser beams");
+		shader.set("beamLength", this->lengths);
+		shader.set("beamColor", this->colors, 2);
+		shader.set("beamWidth", LASER_BEAM_WIDTH);
+		_glState.bindVertexArray(this->vertexArray);
+		_glState.depthMask(GL_FALSE);
+		_glState.blend(true);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, 2 * eyeCount);
+		_renderStats.draw(GL_TRIANGLE_STRIP, 4, 2 * eyeCount);
+		// Back to the function ExampleApp::initGl sets
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		_glState.blend(false);
+		_glState.depthMask(GL_TRUE);
+	}
+
+private:
+	GLuint vertexArray = 0;
+	glm::vec2 lengths = glm::vec2(0.0f);
+	glm::vec4 colors[2];
+};
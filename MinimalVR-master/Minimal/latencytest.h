@@ -0,0 +1,383 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include "framepipeline.h"
+#include "hudlayer.h"
+#include "inputpoller.h"
+#include "trace.h"
+#include "threading.h"
+
+// The marker's pixels, and where it hangs: head locked low on the left, clear of the profiler overlay, so a
+// photodiode taped over that part of a lens sees it and nothing else
+#define LATENCY_MARKER_PIXELS 16
+#define LATENCY_MARKER_SIZE 0.08f
+// Seconds after a press by which its compositor frame and photodiode edge are given up on
+#define LATENCY_TIMEOUT_SECONDS 0.5
+// Presses still waiting for either, and presses a session keeps for the report
+#define LATENCY_PENDING 16
+#define LATENCY_MAX_PRESSES 4096
+// Photodiode edges the reader can get ahead of the frame by
+#define LATENCY_PHOTODIODE_RING 64
+#define LATENCY_PHOTODIODE_BAUD CBR_115200
+
+// One press, all on ovr_GetTimeInSeconds()'s clock. Times not known are 0.
+struct LatencyPress
+{
+	// When the input thread's sample saw the trigger go down
+	double pressed = 0.0;
+	// The frame whose marker shows it, its tracking sample, the display time it was predicted for, and its submit
+	uint64_t frame = 0;
+	double sampleTime = 0.0;
+	double displayTime = 0.0;
+	double submitted = 0.0;
+	// The compositor frame that first showed it, and when its photons were out by the SDK's motion to photon
+	// latency; -1 and 0 if the compositor skipped the frame
+	int compositorFrame = -1;
+	double photon = 0.0;
+	// The photodiode's edge, if there is a photodiode
+	double photodiode = 0.0;
+	bool bright = false;
+	bool correlated = false;
+};
+
+// Reads a photodiode trigger on a serial port, a USB one being a virtual COM port, on a thread of its own. Each
+// byte the device sends is one crossing of its light threshold, say from a microcontroller comparing the diode
+// against a level, and is timestamped as it arrives; its value doesn't matter. The port's own buffering adds to
+// the times, a device that sends the moment it crosses at 115200 baud adds well under a millisecond.
+class PhotodiodeReader
+{
+public:
+	PhotodiodeReader() {}
+	~PhotodiodeReader()
+	{
+		this->close();
+	}
+
+	PhotodiodeReader(const PhotodiodeReader&) = delete;
+	PhotodiodeReader& operator=(const PhotodiodeReader&) = delete;
+
+	// port as in COM3, false if it can't be opened
+	bool open(const char* port)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "\\\\.\\%s", port);
+		this->port = CreateFileA(path, GENERIC_READ, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (this->port == INVALID_HANDLE_VALUE)
+		{
+			printf("ERROR::LATENCY::PHOTODIODE_NOT_OPENED %s\n", port);
+			return false;
+		}
+		DCB dcb = {};
+		dcb.DCBlength = sizeof(dcb);
+		GetCommState(this->port, &dcb);
+		dcb.BaudRate = LATENCY_PHOTODIODE_BAUD;
+		dcb.ByteSize = 8;
+		dcb.Parity = NOPARITY;
+		dcb.StopBits = ONESTOPBIT;
+		SetCommState(this->port, &dcb);
+		// A read returns as soon as a byte is there, or empty after 50ms so close() is never kept waiting
+		COMMTIMEOUTS timeouts = {};
+		timeouts.ReadIntervalTimeout = MAXDWORD;
+		timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+		timeouts.ReadTotalTimeoutConstant = 50;
+		SetCommTimeouts(this->port, &timeouts);
+		PurgeComm(this->port, PURGE_RXCLEAR);
+		this->stopping = false;
+		this->thread = std::thread([this]() { this->run(); });
+		return true;
+	}
+
+	bool isOpen() const { return this->thread.joinable(); }
+
+	void close()
+	{
+		if (this->thread.joinable())
+		{
+			this->stopping = true;
+			this->thread.join();
+		}
+		if (this->port != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(this->port);
+			this->port = INVALID_HANDLE_VALUE;
+		}
+	}
+
+	// Frame side, false once every edge so far was taken
+	bool pop(double* seconds)
+	{
+		return this->edges.pop(seconds);
+	}
+
+private:
+	HANDLE port = INVALID_HANDLE_VALUE;
+	std::thread thread;
+	std::atomic<bool> stopping{ false };
+	SpscQueue<double, LATENCY_PHOTODIODE_RING> edges;
+
+	void run()
+	{
+		TRACE_THREAD("photodiode");
+		_threadPolicy.apply(ThreadRole::Input);
+		uint8_t bytes[16];
+		while (!this->stopping)
+		{
+			DWORD read = 0;
+			if (!ReadFile(this->port, bytes, sizeof(bytes), &read, nullptr))
+			{
+				printf("ERROR::LATENCY::PHOTODIODE_READ_FAILED %lu\n", GetLastError());
+				return;
+			}
+			// Bytes read together arrived within a read's latency of each other, the first is the edge
+			if (read)
+				this->edges.push(ovr_GetTimeInSeconds());
+		}
+	}
+};
+
+// --latency-test: input to photon latency through the whole frame, pipeline and compositor included.
+//
+// A trigger press the input thread sampled flips a marker quad between black and white in the frame that drains
+// it. The marker is a head locked layer of its own, committed only on a press, submitted with the eye layer, so it
+// reaches the display with that frame. Each press keeps its frame's tracking sample and predicted display time,
+// and is matched to the compositor frame ovr_GetPerfStats says showed the frame, whose motion to photon latency
+// from the same sample puts a time on the photons. With --latency-photodiode <port> a photodiode over the marker
+// gives the ground truth besides. The report has the distribution of each, per press in latency_test.csv.
+//
+// The marker reacts on the render thread, the simulation's answer to the same press comes a pipelined frame later.
+// Render thread only.
+class LatencyTest
+{
+public:
+	LatencyTest() {}
+
+	LatencyTest(const LatencyTest&) = delete;
+	LatencyTest& operator=(const LatencyTest&) = delete;
+
+	// photodiodePort may be null or empty to go without one. False if the marker couldn't be made.
+	bool init(ovrSession session, const char* photodiodePort)
+	{
+		ovrPosef pose;
+		pose.Orientation = { 0.0f, 0.0f, 0.0f, 1.0f };
+		pose.Position = { -0.3f, -0.25f, -0.8f };
+		if (!this->marker.init(session, LATENCY_MARKER_PIXELS, LATENCY_MARKER_PIXELS, pose, { LATENCY_MARKER_SIZE, LATENCY_MARKER_SIZE }, true))
+			return false;
+		this->marker.show(true);
+		this->pending.reserve(LATENCY_PENDING);
+		this->presses.reserve(LATENCY_MAX_PRESSES);
+		if (photodiodePort && photodiodePort[0])
+			this->photodiode.open(photodiodePort);
+		this->initialized = true;
+		printf("Latency test: press a trigger to flip the marker%s\n", this->photodiode.isOpen() ? ", the photodiode times it" : "");
+		return true;
+	}
+
+	bool active() const { return this->initialized; }
+
+	// After the input thread's samples are drained, before the frame draws: the first trigger press of either hand
+	// since the last frame flips the marker for this one
+	void input(const HandEdges& left, const HandEdges& right, uint64_t frame)
+	{
+		if (!this->initialized)
+			return;
+		double pressed = left.triggerPressed;
+		if (right.triggerPressed != 0.0 && (pressed == 0.0 || right.triggerPressed < pressed))
+			pressed = right.triggerPressed;
+		if (pressed == 0.0 || this->pending.size() >= LATENCY_PENDING)
+			return;
+		this->bright = !this->bright;
+		this->marker.markDirty();
+		LatencyPress press;
+		press.pressed = pressed;
+		press.frame = frame;
+		press.bright = this->bright;
+		this->pending.push_back(press);
+	}
+
+	// With the other layers, before the submit
+	void redraw(ovrSession session)
+	{
+		if (!this->initialized)
+			return;
+		const float level = this->bright ? 1.0f : 0.0f;
+		this->marker.redraw(session, [level](int width, int height) {
+			glDisable(GL_SCISSOR_TEST);
+			glClearColor(level, level, level, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT);
+		});
+	}
+
+	ovrLayerHeader* header() { return this->marker.header(); }
+
+	// Right after the frame's submit, with the tracking it went out with
+	void submitted(uint64_t frame, double sampleTime, double displayTime)
+	{
+		if (!this->initialized)
+			return;
+		const double now = ovr_GetTimeInSeconds();
+		for (LatencyPress& press : this->pending)
+		{
+			if (press.frame != frame)
+				continue;
+			press.sampleTime = sampleTime;
+			press.displayTime = displayTime;
+			press.submitted = now;
+		}
+	}
+
+	// Each new compositor frame, oldest first, see CompositorTelemetry::subscribeFrames()
+	void compositorFrame(const ovrPerfStatsPerCompositorFrame& f)
+	{
+		for (LatencyPress& press : this->pending)
+		{
+			if (press.correlated || press.submitted == 0.0 || f.AppFrameIndex < (int)press.frame)
+				continue;
+			press.correlated = true;
+			// A later frame means the press's own was never shown, the marker got out with the next one
+			if (f.AppFrameIndex != (int)press.frame)
+				continue;
+			press.compositorFrame = f.CompositorFrameIndex;
+			press.photon = press.sampleTime + f.AppMotionToPhotonLatency;
+		}
+	}
+
+	// Once a frame, after the compositor's stats were polled: photodiode edges go to the oldest press that can
+	// have caused them, and presses that are done or timed out go to the report
+	void endFrame()
+	{
+		if (!this->initialized)
+			return;
+		double edge;
+		while (this->photodiode.pop(&edge))
+		{
+			LatencyPress* owner = nullptr;
+			for (LatencyPress& press : this->pending)
+			{
+				if (press.photodiode == 0.0 && press.sampleTime != 0.0 && edge > press.sampleTime)
+				{
+					owner = &press;
+					break;
+				}
+			}
+			if (owner)
+				owner->photodiode = edge;
+			else
+				this->strayEdges++;
+		}
+
+		const double now = ovr_GetTimeInSeconds();
+		size_t kept = 0;
+		for (size_t i = 0; i < this->pending.size(); i++)
+		{
+			const LatencyPress& press = this->pending[i];
+			const bool done = press.correlated && (!this->photodiode.isOpen() || press.photodiode != 0.0);
+			if (!done && now - press.pressed < LATENCY_TIMEOUT_SECONDS)
+			{
+				this->pending[kept++] = press;
+				continue;
+			}
+			if (this->presses.size() < LATENCY_MAX_PRESSES)
+				this->presses.push_back(press);
+			printf("Latency: frame %llu, %.1f ms to the predicted display, %.1f ms to photons%s", (unsigned long long)press.frame,
+				(press.displayTime - press.pressed) * 1000.0, press.photon != 0.0 ? (press.photon - press.pressed) * 1000.0 : 0.0,
+				press.photon != 0.0 ? "" : " (not shown on its own frame)");
+			if (press.photodiode != 0.0)
+				printf(", %.1f ms to the photodiode", (press.photodiode - press.pressed) * 1000.0);
+			printf("\n");
+		}
+		this->pending.resize(kept);
+	}
+
+	// The distributions to the console and every press to path
+	void finish(const char* path)
+	{
+		if (!this->initialized)
+			return;
+		this->photodiode.close();
+		this->initialized = false;
+		if (this->presses.empty())
+		{
+			printf("Latency test: no presses\n");
+			return;
+		}
+
+		vector<float> toFrame, toDisplay, toPhoton, toPhotodiode, photodiodeError;
+		for (const LatencyPress& press : this->presses)
+		{
+			if (press.sampleTime != 0.0)
+			{
+				toFrame.push_back((float)((press.sampleTime - press.pressed) * 1000.0));
+				toDisplay.push_back((float)((press.displayTime - press.pressed) * 1000.0));
+			}
+			if (press.photon != 0.0)
+				toPhoton.push_back((float)((press.photon - press.pressed) * 1000.0));
+			if (press.photodiode != 0.0)
+			{
+				toPhotodiode.push_back((float)((press.photodiode - press.pressed) * 1000.0));
+				if (press.photon != 0.0)
+					photodiodeError.push_back((float)((press.photodiode - press.photon) * 1000.0));
+			}
+		}
+		printf("Latency test: %u presses, %u shown on their own frame, %u stray photodiode edges\n", (unsigned)this->presses.size(),
+			(unsigned)toPhoton.size(), this->strayEdges);
+		printf("%-32s %6s %8s %8s %8s %8s\n", "ms", "count", "p50", "p90", "p99", "max");
+		printRow("input to frame sample", toFrame);
+		printRow("input to predicted display", toDisplay);
+		printRow("input to photons, SDK", toPhoton);
+		printRow("input to photons, photodiode", toPhotodiode);
+		printRow("photodiode after SDK photons", photodiodeError);
+
+		FILE* file = fopen(path, "w");
+		if (!file)
+		{
+			printf("ERROR::LATENCY::REPORT_NOT_OPENED %s\n", path);
+			return;
+		}
+		fprintf(file, "frame,bright,pressed_s,input_to_sample_ms,input_to_display_ms,compositor_frame,input_to_photon_ms,input_to_photodiode_ms\n");
+		for (const LatencyPress& press : this->presses)
+		{
+			fprintf(file, "%llu,%d,%.6f,%.3f,%.3f,%d,%.3f,%.3f\n", (unsigned long long)press.frame, press.bright ? 1 : 0, press.pressed,
+				press.sampleTime != 0.0 ? (press.sampleTime - press.pressed) * 1000.0 : 0.0,
+				press.displayTime != 0.0 ? (press.displayTime - press.pressed) * 1000.0 : 0.0, press.compositorFrame,
+				press.photon != 0.0 ? (press.photon - press.pressed) * 1000.0 : 0.0,
+				press.photodiode != 0.0 ? (press.photodiode - press.pressed) * 1000.0 : 0.0);
+		}
+		fclose(file);
+		printf("Latency test written to %s\n", path);
+	}
+
+private:
+	HudLayer marker;
+	PhotodiodeReader photodiode;
+	bool initialized = false;
+	bool bright = false;
+	vector<LatencyPress> pending;
+	vector<LatencyPress> presses;
+	uint32_t strayEdges = 0;
+
+	// Nearest rank percentiles of values, reordering them
+	static void printRow(const char* name, vector<float>& values)
+	{
+		if (values.empty())
+		{
+			printf("%-32s %6u\n", name, 0u);
+			return;
+		}
+		std::sort(values.begin(), values.end());
+		auto at = [&](float p) { return values[std::min((size_t)(p * (values.size() - 1) + 0.5f), values.size() - 1)]; };
+		printf("%-32s %6u %8.2f %8.2f %8.2f %8.2f\n", name, (unsigned)values.size(), at(0.5f), at(0.9f), at(0.99f), values.back());
+	}
+};
+
+static LatencyTest _latencyTest;
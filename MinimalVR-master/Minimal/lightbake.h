@@ -0,0 +1,278 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "mesh.h"
+#include "culling.h"
+#include "jobs.h"
+#include "trace.h"
+
+// Attribute location of the baked lighting, between the texture coordinates and the instance transform
+#define LIGHT_BAKE_LOCATION 3
+// Hemisphere rays per vertex for the ambient occlusion
+#define LIGHT_BAKE_RAYS 48
+// How far an occluder counts for the ambient occlusion, as a fraction of the model's radius
+#define LIGHT_BAKE_AO_RANGE 0.08f
+// Ray origins are lifted off the surface by this fraction of the model's radius, so a vertex doesn't hit its own faces
+#define LIGHT_BAKE_OFFSET 0.0005f
+// Triangles a BVH leaf holds at most
+#define LIGHT_BAKE_LEAF_SIZE 4
+// Shader define of the programs that read the bake instead of lighting the scene light themselves
+#define LIGHT_BAKE_DEFINE "#define BAKED_LIGHTING\n"
+
+// What Model bakes at import: the scene light's position in the model's space, enabled or not. The light goes into
+// the mesh cache's key, a cache baked for another light is imported again.
+struct LightBakeOptions
+{
+	bool enabled = false;
+	glm::vec3 light = glm::vec3(0.0f);
+};
+
+// One vertex's bake, RGBA8 as the attribute reads it: r the ambient occlusion, g the light's Lambert term with its
+// shadow applied, b whether the light reaches the vertex at all, for the specular. 1 is unoccluded and lit.
+static inline uint32_t _packLightBake(float ambient, float direct, float visibility)
+{
+	const uint32_t r = (uint32_t)(glm::clamp(ambient, 0.0f, 1.0f) * 255.0f + 0.5f);
+	const uint32_t g = (uint32_t)(glm::clamp(direct, 0.0f, 1.0f) * 255.0f + 0.5f);
+	const uint32_t b = (uint32_t)(glm::clamp(visibility, 0.0f, 1.0f) * 255.0f + 0.5f);
+	return r | (g << 8) | (b << 16) | (255u << 24);
+}
+
+// Any hit ray queries against a triangle soup, for the bake only. Median split on the longest axis of the centroids,
+// nodes laid out depth first so the left child follows its parent.
+class LightBakeBvh
+{
+public:
+	// triangles holds three corners per triangle
+	void build(vector<glm::vec3>&& triangles)
+	{
+		this->corners = std::move(triangles);
+		const uint32_t count = (uint32_t)(this->corners.size() / 3);
+		this->order.resize(count);
+		this->centroids.resize(count);
+		for (uint32_t t = 0; t < count; t++)
+		{
+			this->order[t] = t;
+			this->centroids[t] = (this->corners[t * 3] + this->corners[t * 3 + 1] + this->corners[t * 3 + 2]) / 3.0f;
+		}
+		this->nodes.clear();
+		this->nodes.reserve(count ? count * 2 / LIGHT_BAKE_LEAF_SIZE + 1 : 0);
+		if (count)
+			this->split(0, count);
+		vector<glm::vec3>().swap(this->centroids);
+	}
+
+	// Whether anything lies along direction from origin, closer than maxDistance. direction need not be unit length,
+	// maxDistance is in its units.
+	bool occluded(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const
+	{
+		if (this->nodes.empty())
+			return false;
+		const glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+		uint32_t stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const Node& node = this->nodes[stack[--top]];
+			if (!this->slab(node, origin, inverse, maxDistance))
+				continue;
+			if (node.count)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+				{
+					if (this->intersects(this->order[i], origin, direction, maxDistance))
+						return true;
+				}
+				continue;
+			}
+			const uint32_t self = (uint32_t)(&node - this->nodes.data());
+			if (top + 2 > 64)
+				return false;
+			stack[top++] = node.first;
+			stack[top++] = self + 1;
+		}
+		return false;
+	}
+
+private:
+	// A leaf when count is nonzero, its triangles order[first] on. An inner node's left child is the next node and
+	// its right one first.
+	struct Node
+	{
+		glm::vec3 low, high;
+		uint32_t first;
+		uint32_t count;
+	};
+
+	vector<glm::vec3> corners;
+	vector<glm::vec3> centroids;
+	vector<uint32_t> order;
+	vector<Node> nodes;
+
+	uint32_t split(uint32_t begin, uint32_t end)
+	{
+		const uint32_t index = (uint32_t)this->nodes.size();
+		this->nodes.push_back(Node());
+		Aabb box, centres;
+		for (uint32_t i = begin; i < end; i++)
+		{
+			const uint32_t t = this->order[i];
+			for (int c = 0; c < 3; c++)
+				box.add(this->corners[t * 3 + c]);
+			centres.add(this->centroids[t]);
+		}
+		this->nodes[index].low = box.min;
+		this->nodes[index].high = box.max;
+		const glm::vec3 extent = centres.max - centres.min;
+		if (end - begin <= LIGHT_BAKE_LEAF_SIZE || glm::max(extent.x, glm::max(extent.y, extent.z)) <= 0.0f)
+		{
+			this->nodes[index].first = begin;
+			this->nodes[index].count = end - begin;
+			return index;
+		}
+		const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+		const uint32_t middle = (begin + end) / 2;
+		std::nth_element(this->order.begin() + begin, this->order.begin() + middle, this->order.begin() + end,
+			[&](uint32_t a, uint32_t b) { return this->centroids[a][axis] < this->centroids[b][axis]; });
+		this->split(begin, middle);
+		const uint32_t right = this->split(middle, end);
+		this->nodes[index].first = right;
+		this->nodes[index].count = 0;
+		return index;
+	}
+
+	bool slab(const Node& node, const glm::vec3& origin, const glm::vec3& inverse, float maxDistance) const
+	{
+		const glm::vec3 t0 = (node.low - origin) * inverse;
+		const glm::vec3 t1 = (node.high - origin) * inverse;
+		const glm::vec3 entries = glm::min(t0, t1);
+		const glm::vec3 exits = glm::max(t0, t1);
+		const float enter = std::max(std::max(entries.x, entries.y), std::max(entries.z, 0.0f));
+		const float leave = std::min(std::min(exits.x, exits.y), std::min(exits.z, maxDistance));
+		return enter <= leave;
+	}
+
+	// Möller-Trumbore, both sides of the triangle
+	bool intersects(uint32_t triangle, const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const
+	{
+		const glm::vec3& a = this->corners[triangle * 3];
+		const glm::vec3 ab = this->corners[triangle * 3 + 1] - a;
+		const glm::vec3 ac = this->corners[triangle * 3 + 2] - a;
+		const glm::vec3 p = glm::cross(direction, ac);
+		const float determinant = glm::dot(ab, p);
+		if (fabsf(determinant) < 1e-12f)
+			return false;
+		const float inverse = 1.0f / determinant;
+		const glm::vec3 s = origin - a;
+		const float u = glm::dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		const glm::vec3 q = glm::cross(s, ab);
+		const float v = glm::dot(direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		const float t = glm::dot(ac, q) * inverse;
+		return t > 0.0f && t < maxDistance;
+	}
+};
+
+// Cosine weighted directions over the +z hemisphere, a Hammersley set, the same for every vertex
+static void _lightBakeDirections(glm::vec3* directions)
+{
+	for (uint32_t i = 0; i < LIGHT_BAKE_RAYS; i++)
+	{
+		uint32_t bits = i;
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		const float u = (i + 0.5f) / LIGHT_BAKE_RAYS;
+		const float v = (float)bits * 2.3283064365386963e-10f;
+		const float radius = sqrtf(u);
+		const float angle = 6.2831853f * v;
+		directions[i] = glm::vec3(radius * cosf(angle), radius * sinf(angle), sqrtf(std::max(0.0f, 1.0f - u)));
+	}
+}
+
+// Bakes every level 0 mesh's vertices, a copy per placement if there are placements, against all of them: ambient
+// occlusion within LIGHT_BAKE_AO_RANGE of radius, and options.light's Lambert term and hard shadow. bakes gets one
+// array per mesh, copy after copy in placement order, as StaticBatch lays the copies out. The meshes must still
+// have their CPU data. Spread over the job system, meshes and their vertices both.
+static void _bakeLighting(const vector<Mesh>& meshes, const vector<vector<glm::mat4>>& placements, float radius,
+	const LightBakeOptions& options, vector<vector<uint32_t>>* bakes)
+{
+	TRACE_ZONE("bake lighting");
+	const glm::mat4 identity;
+	auto copies = [&](size_t mesh) { return placements.empty() ? (size_t)1 : placements[mesh].size(); };
+	auto placement = [&](size_t mesh, size_t copy) -> const glm::mat4& { return placements.empty() ? identity : placements[mesh][copy]; };
+
+	vector<glm::vec3> triangles;
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		const Mesh& mesh = meshes[m];
+		for (size_t c = 0; c < copies(m); c++)
+		{
+			const glm::mat4& transform = placement(m, c);
+			for (GLuint index : mesh.indices)
+				triangles.push_back(glm::vec3(transform * glm::vec4(mesh.vertices[index].Position, 1.0f)));
+		}
+	}
+	LightBakeBvh bvh;
+	bvh.build(std::move(triangles));
+
+	glm::vec3 directions[LIGHT_BAKE_RAYS];
+	_lightBakeDirections(directions);
+	const float range = std::max(radius, 1e-6f) * LIGHT_BAKE_AO_RANGE;
+	const float offset = std::max(radius, 1e-6f) * LIGHT_BAKE_OFFSET;
+
+	bakes->assign(meshes.size(), vector<uint32_t>());
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		const Mesh& mesh = meshes[m];
+		const size_t vertexCount = mesh.vertices.size();
+		vector<uint32_t>& bake = (*bakes)[m];
+		bake.resize(vertexCount * copies(m));
+		_jobs.parallelFor(bake.size(), 256, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				const glm::mat4& transform = placement(m, i / vertexCount);
+				const Vertex& vertex = mesh.vertices[i % vertexCount];
+				const glm::vec3 position = glm::vec3(transform * glm::vec4(vertex.Position, 1.0f));
+				glm::vec3 normal = glm::transpose(glm::inverse(glm::mat3(transform))) * vertex.Normal;
+				if (glm::dot(normal, normal) <= 0.0f)
+				{
+					bake[i] = _packLightBake(1.0f, 0.0f, 0.0f);
+					continue;
+				}
+				normal = glm::normalize(normal);
+				const glm::vec3 origin = position + normal * offset;
+
+				// Any basis around the normal does, the directions are spread evenly about it
+				const glm::vec3 helper = fabsf(normal.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+				const glm::vec3 tangent = glm::normalize(glm::cross(helper, normal));
+				const glm::vec3 bitangent = glm::cross(normal, tangent);
+				uint32_t open = 0;
+				for (uint32_t r = 0; r < LIGHT_BAKE_RAYS; r++)
+				{
+					const glm::vec3 direction = tangent * directions[r].x + bitangent * directions[r].y + normal * directions[r].z;
+					open += bvh.occluded(origin, direction, range) ? 0 : 1;
+				}
+
+				const glm::vec3 toLight = options.light - position;
+				const float distance = glm::length(toLight);
+				const float lambert = distance > 0.0f ? std::max(glm::dot(normal, toLight / distance), 0.0f) : 0.0f;
+				const float visible = lambert > 0.0f && !bvh.occluded(origin, options.light - origin, 1.0f) ? 1.0f : 0.0f;
+				bake[i] = _packLightBake((float)open / LIGHT_BAKE_RAYS, lambert * visible, visible);
+			}
+		});
+	}
+}
@@ -0,0 +1,139 @@
+#pragma once
+// Std. Includes
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include <OVR_CAPI_GL.h>
+#include "benchhmd.h"
+#include "trace.h"
+#include "threading.h"
+
+// A quad layer with one static image in it, shown while the scene isn't there yet.
+//
+// The image is drawn and committed once, after that the compositor needs nothing from us to show it. Frames the render
+// loop submits put it over the scene layer while it is shown, and around work that holds the render thread up for
+// longer than a frame hold() starts a thread that submits nothing but the quad until release(), so the headset keeps
+// getting frames and the runtime never sees the app stop responding.
+class LoadingLayer
+{
+public:
+	LoadingLayer()
+	{
+		memset(&this->layer, 0, sizeof(ovrLayerQuad));
+	}
+	~LoadingLayer()
+	{
+		this->release();
+	}
+
+	LoadingLayer(const LoadingLayer&) = delete;
+	LoadingLayer& operator=(const LoadingLayer&) = delete;
+
+	// width by height pixels, size metres wide and high at pose relative to the tracking origin. draw(width, height)
+	// fills the image once, bound as the draw framebuffer with the viewport over all of it. The clear colour and
+	// scissor test are put back after. False and never visible if the swap chain couldn't be made.
+	template <typename DrawFn>
+	bool init(ovrSession session, int width, int height, const ovrPosef& pose, const ovrVector2f& size, DrawFn draw)
+	{
+		ovrTextureSwapChainDesc desc = {};
+		desc.Type = ovrTexture_2D;
+		desc.ArraySize = 1;
+		desc.Width = width;
+		desc.Height = height;
+		desc.MipLevels = 1;
+		desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+		desc.SampleCount = 1;
+		desc.StaticImage = ovrTrue;
+		if (!OVR_SUCCESS(_hmdCreateTextureSwapChainGL(session, &desc, &this->texture)))
+		{
+			std::cout << "ERROR::LOADING::SWAP_CHAIN_NOT_CREATED" << std::endl;
+			this->texture = nullptr;
+			return false;
+		}
+
+		GLuint texId;
+		_hmdGetTextureSwapChainBufferGL(session, this->texture, 0, &texId);
+		GLuint fbo;
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texId, 0);
+		GLfloat clearColor[4];
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+		const GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+		glViewport(0, 0, width, height);
+		draw(width, height);
+		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+		if (scissor)
+			glEnable(GL_SCISSOR_TEST);
+		else
+			glDisable(GL_SCISSOR_TEST);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		// The swap chain's one buffer keeps the image, the framebuffer was only for drawing it
+		glDeleteFramebuffers(1, &fbo);
+		_hmdCommitTextureSwapChain(session, this->texture);
+
+		this->layer.Header.Type = ovrLayerType_Quad;
+		this->layer.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft;
+		this->layer.ColorTexture = this->texture;
+		this->layer.Viewport.Pos = { 0, 0 };
+		this->layer.Viewport.Size = { width, height };
+		this->layer.QuadPoseCenter = pose;
+		this->layer.QuadSize = size;
+		this->shown = true;
+		return true;
+	}
+
+	void show(bool visible)
+	{
+		this->shown = visible;
+	}
+	bool visible() const { return this->shown && this->texture; }
+
+	// Submits the quad alone from a thread of its own until release(). The render thread mustn't submit meanwhile.
+	// Nothing under --bench, which has no compositor to keep fed.
+	void hold(ovrSession session)
+	{
+		if (!this->visible() || !session || this->holder.joinable())
+			return;
+		this->holding.store(true, std::memory_order_release);
+		this->holder = std::thread([this, session]() {
+			TRACE_THREAD("loading layer");
+			_threadPolicy.apply(ThreadRole::Background);
+			ovrLayerHeader* header = &this->layer.Header;
+			while (this->holding.load(std::memory_order_acquire))
+			{
+				// Frame index 0 leaves the count to the runtime, it blocks here for the display's pace. While the
+				// headset isn't worn it returns straight away with nothing shown, so back off instead of spinning.
+				if (_hmdSubmitFrame(session, 0, nullptr, &header, 1) != ovrSuccess)
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		});
+	}
+
+	// Returns once the holding thread's last submit has, the render thread may submit again then
+	void release()
+	{
+		if (!this->holder.joinable())
+			return;
+		this->holding.store(false, std::memory_order_release);
+		this->holder.join();
+	}
+
+	ovrLayerHeader* header() { return &this->layer.Header; }
+
+private:
+	ovrTextureSwapChain texture = nullptr;
+	ovrLayerQuad layer;
+	bool shown = false;
+	std::thread holder;
+	std::atomic<bool> holding{ false };
+};
+
+static LoadingLayer _loadingLayer;
@@ -22,13 +22,57 @@ limitations under the License.
 #include <memory>
 #include <exception>
 #include <algorithm>
+// Ahead of Windows.h, which would otherwise pull in the old winsock
+#include <winsock2.h>
 #include <Windows.h>
 #include <vector>
 #include <string>
+#include <sstream>
 #include <ctime>
 #include <utility>
+#include <random>
+#include <deque>
+#include <mutex>
+#include <atomic>
 #include "mesh.h"
 #include "model.h"
+#include "resources.h"
+#include "worldpartition.h"
+#include "alloccounter.h"
+#include "molecules.h"
+#include "gpumolecules.h"
+#include "moleculearena.h"
+#include "clusteredlights.h"
+#include "picking.h"
+#include "spatialgrid.h"
+#include "collisions.h"
+#include "random.h"
+#include "moleculegame.h"
+#include "moleculeserver.h"
+#include "ecs.h"
+#include "debugdraw.h"
+#include "reflection.h"
+#include "spectator.h"
+#include "sessionrecord.h"
+#include "framepipeline.h"
+#include "timing.h"
+#include "jobs.h"
+#include "profiler.h"
+#include "gpubuckets.h"
+#include "hitchrecorder.h"
+#include "qualitygovernor.h"
+#include "calibration.h"
+#include "framearena.h"
+#include "uniformring.h"
+#include "renderstats.h"
+#include "trace.h"
+#include "assetpack.h"
+#include "avatarcache.h"
+#include "warmup.h"
+#include "gldebug.h"
+#include "glcapture.h"
+#include "glreplay.h"
+#include "microbench.h"
 
 #define __STDC_FORMAT_MACROS 1
 
@@ -43,11 +87,11 @@ limitations under the License.
 #include <glm/gtc/noise.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
-#include <glm/gtx/matrix_decompose.hpp>
 
 // Import the most commonly used types into the default namespace
 using glm::ivec3;
@@ -60,12 +104,6 @@ using glm::vec3;
 using glm::vec4;
 using glm::quat;
 
-bool left_trig = false;
-bool right_trig = false;
-bool win = false;
-bool lost = false;
-bool reset_flag = false;
-
 
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -150,65 +188,21 @@ bool checkGlError() {
 	}
 }
 
-void glDebugCallbackHandler(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *msg, GLvoid* data) {
-	OutputDebugStringA(msg);
-	std::cout << "debug call: " << msg << std::endl;
-}
+// KHR_debug output, see GLDebugOutput. --no-gl-debug asks for a plain context instead of a debug one,
+// --gl-debug-verbose lets low severity messages and notifications through, --gl-debug-sync delivers each message
+// on the call that caused it.
+static bool _glDebugContext = true;
+static bool _glDebugVerbose = false;
+static bool _glDebugSynchronous = false;
 
 /************************************************************************************
 * GL helpers
 ************************************************************************************/
 
-enum {
-	VERTEX,
-	FRAGMENT,
-	SHADER_COUNT
-};
-
+// Also linked on an earlier run with the same sources and driver, out of the program cache
 static GLuint _compileProgramFromSource(const char vertexShaderSource[], const char fragmentShaderSource[], size_t errorBufferSize, char* errorBuffer) {
-	const GLenum types[SHADER_COUNT] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
-	const char* sources[SHADER_COUNT] = { vertexShaderSource, fragmentShaderSource };
-	GLint shaders[SHADER_COUNT] { 0, 0 };
-	bool success = true;
-
-	// Compile all of the shader program objects
-	for (int i = 0; i < SHADER_COUNT; ++i) {
-		shaders[i] = glCreateShader(types[i]);
-		glShaderSource(shaders[i], 1, &sources[i], NULL);
-		glCompileShader(shaders[i]);
-
-		GLint compileSuccess;
-		glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compileSuccess);
-		if (!compileSuccess) {
-			glGetShaderInfoLog(shaders[i], (GLsizei)errorBufferSize, NULL, errorBuffer);
-			success = false;
-			break;
-		}
-	}
-
-	// Create and link the program
-	GLuint program = 0;
-	if (success) {
-		program = glCreateProgram();
-		for (int i = 0; i < SHADER_COUNT; ++i) {
-			glAttachShader(program, shaders[i]);
-		}
-		glLinkProgram(program);
-
-		GLint linkSuccess;
-		glGetProgramiv(program, GL_LINK_STATUS, &linkSuccess);
-		if (!linkSuccess) {
-			glGetProgramInfoLog(program, (GLsizei)errorBufferSize, NULL, errorBuffer);
-			glDeleteProgram(program);
-			program = 0;
-		}
-	}
-	for (int i = 0; i < SHADER_COUNT; ++i) {
-		if (shaders[i]) {
-			glDeleteShader(shaders[i]);
-		}
-	}
-	return program;
+	ProgramBuild build = _beginProgramBuild(vertexShaderSource, fragmentShaderSource);
+	return _finishProgramBuild(build, errorBufferSize, errorBuffer);
 }
 
 static std::string ExePath() {
@@ -218,40 +212,96 @@ static std::string ExePath() {
 	return std::string(buffer).substr(0, pos+1);
 }
 
-static GLuint _compileProgramFromFiles(const char vertexShaderPath[], const char fragmentShaderPath[], size_t errorBufferSize, char* errorBuffer) {
-	const char* fileSources[SHADER_COUNT] = { vertexShaderPath, fragmentShaderPath };
-	char* fileBuffers[SHADER_COUNT] = { NULL, NULL };
-	bool success = true;
+// Puts defines on the line after the source's #version
+static void _insertShaderDefines(std::string& source, const char defines[]) {
+	size_t line = source.find("#version");
+	line = line == std::string::npos ? 0 : source.find('\n', line);
+	line = line == std::string::npos ? source.size() : line + 1;
+	source.insert(line, defines);
+}
+
+// A shader source beside the executable, out of _assetPack if it's in there
+static bool _loadShaderSource(const char path[], std::string* source, size_t errorBufferSize, char* errorBuffer) {
+	AssetSpan packed;
+	if (_assetPack.find(path, &packed)) {
+		source->assign((const char*)packed.data, packed.size);
+		return true;
+	}
+	std::string fullPath = ExePath();
+	fullPath += path;
+	FILE* file = fopen(fullPath.c_str(), "rb");
+	if (!file) {
+		strncpy(errorBuffer, "Failed to open shader files.", errorBufferSize);
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	source->assign(size, '\0');
+	fread(&(*source)[0], 1, size, file);
+	fclose(file);
+	return true;
+}
 
-	// Load each of the shader files
-	for (int i = 0; i < SHADER_COUNT; ++i) {
-		std::string fullPath = ExePath();
-		fullPath += fileSources[i];
-		FILE* file = fopen(fullPath.c_str(), "rb");
-		if (!file) {
-			strncpy(errorBuffer, "Failed to open shader files.", errorBufferSize);
-			success = false;
-			break;
-		}
-		fseek(file, 0, SEEK_END);
-		long offset = ftell(file);
-		fseek(file, 0, SEEK_SET);
-		fileBuffers[i] = (char*)malloc(offset + 1);
-		fread(fileBuffers[i], 1, offset, file);
-		fileBuffers[i][offset] = '\0';
+// fragmentDefines and vertexDefines, if given, go on the line after each shader's #version. False, with nothing begun,
+// if a source couldn't be read.
+static bool _beginProgramFromFiles(const char vertexShaderPath[], const char fragmentShaderPath[], size_t errorBufferSize, char* errorBuffer,
+	const char fragmentDefines[], const char vertexDefines[], ProgramBuild* build) {
+	std::string vertexSource, fragmentSource;
+	if (!_loadShaderSource(vertexShaderPath, &vertexSource, errorBufferSize, errorBuffer) ||
+		!_loadShaderSource(fragmentShaderPath, &fragmentSource, errorBufferSize, errorBuffer)) {
+		return false;
+	}
+	if (vertexDefines) {
+		_insertShaderDefines(vertexSource, vertexDefines);
 	}
+	if (fragmentDefines) {
+		_insertShaderDefines(fragmentSource, fragmentDefines);
+	}
+	*build = _beginProgramBuild(vertexSource.c_str(), fragmentSource.c_str());
+	return true;
+}
 
-	// Compile the program
-	GLuint program = 0;
-	if (success) {
-		program = _compileProgramFromSource(fileBuffers[VERTEX], fileBuffers[FRAGMENT], errorBufferSize, errorBuffer);
+static GLuint _compileProgramFromFiles(const char vertexShaderPath[], const char fragmentShaderPath[], size_t errorBufferSize, char* errorBuffer, const char fragmentDefines[] = NULL,
+	const char vertexDefines[] = NULL) {
+	ProgramBuild build;
+	if (!_beginProgramFromFiles(vertexShaderPath, fragmentShaderPath, errorBufferSize, errorBuffer, fragmentDefines, vertexDefines, &build)) {
+		return 0;
 	}
+	return _finishProgramBuild(build, errorBufferSize, errorBuffer);
+}
 
-	// Clean up the loaded data
-	for (int i = 0; i < SHADER_COUNT; ++i) {
-		if (fileBuffers[i]) {
-			free(fileBuffers[i]);
-		}
+// A vertex shader alone, linked to capture varyings interleaved into GL_TRANSFORM_FEEDBACK_BUFFER binding 0.
+// Not in the program binary cache, there is only the one and it's small.
+static GLuint _compileFeedbackProgramFromFile(const char vertexShaderPath[], const char* const varyings[], GLsizei varyingCount, size_t errorBufferSize, char* errorBuffer) {
+	std::string source;
+	if (!_loadShaderSource(vertexShaderPath, &source, errorBufferSize, errorBuffer)) {
+		return 0;
+	}
+
+	GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+	const char* sourcePtr = source.c_str();
+	glShaderSource(shader, 1, &sourcePtr, NULL);
+	glCompileShader(shader);
+	GLint compileSuccess;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileSuccess);
+	if (!compileSuccess) {
+		glGetShaderInfoLog(shader, (GLsizei)errorBufferSize, NULL, errorBuffer);
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glTransformFeedbackVaryings(program, varyingCount, varyings, GL_INTERLEAVED_ATTRIBS);
+	glLinkProgram(program);
+	glDeleteShader(shader);
+	GLint linkSuccess;
+	glGetProgramiv(program, GL_LINK_STATUS, &linkSuccess);
+	if (!linkSuccess) {
+		glGetProgramInfoLog(program, (GLsizei)errorBufferSize, NULL, errorBuffer);
+		glDeleteProgram(program);
+		return 0;
 	}
 	return program;
 }
@@ -284,6 +334,8 @@ protected:
 	ivec2 windowPosition;
 	GLFWwindow * window{ nullptr };
 	unsigned int frame{ 0 };
+	// The render thread's allocation counts as the current frame began
+	AllocationSample frameAllocationStart{ 0, 0 };
 
 public:
 	// Run the main loop
@@ -315,17 +367,47 @@ public:
 
 		postCreate();
 
+		// Workers and the loader exist before initGl so loading can already use them
+		_jobs.init();
+		_assets.init(window);
 		initGl();
 
+		TRACE_THREAD("render");
+		_threadPolicy.apply(ThreadRole::Render);
 		while (!glfwWindowShouldClose(window)) {
+			TRACE_ZONE("frame");
+			AllocationTagScope frameTag(AllocationTag::FrameTransient);
+			frameAllocationStart = AllocationSample::thread();
 			++frame;
+			_frameArena.beginFrame();
 			glfwPollEvents();
+			// Counted from here, so what the frame uploads before it draws belongs to it
+			_renderStats.beginFrame();
+			// Swaps in whatever finished streaming since the last frame
+			_assets.update();
 			update();
+			// Everything draw() sets through _glState is shadowed from here until endFrame()
+			_glState.beginFrame();
+			_uniformRing.beginFrame();
+			_glCapture.beginFrame(frame, windowSize.x, windowSize.y);
 			draw();
+			_glCapture.endFrame();
+			_uniformRing.endFrame();
+			_glState.endFrame();
+			// Ranges freed this frame are fenced here, older ones whose fence passed become reusable
+			_gpuArena.endFrame();
+			_renderStats.endFrame();
 			finishFrame();
+			TRACE_GPU_COLLECT();
+			TRACE_FRAME();
 		}
 
+		// Nothing may land in the scene while it is being torn down
+		_assets.shutdown();
 		shutdownGl();
+		_glDebug.shutdown();
+		_jobs.shutdown();
+		_threadPolicy.leave();
 
 		return 0;
 	}
@@ -341,7 +423,7 @@ protected:
 		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
 		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-		glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, true);
+		glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, _glDebugContext);
 	}
 
 
@@ -359,14 +441,9 @@ protected:
 			FAIL("Failed to initialize GLEW");
 		}
 		glGetError();
-
-		if (GLEW_KHR_debug) {
-			GLint v;
-			glGetIntegerv(GL_CONTEXT_FLAGS, &v);
-			if (v & GL_CONTEXT_FLAG_DEBUG_BIT) {
-				//glDebugMessageCallback(glDebugCallbackHandler, this);
-			}
-		}
+		TRACE_GPU_CONTEXT();
+		_gpuMemory.init();
+		_glDebug.init(_glDebugVerbose, _glDebugSynchronous);
 	}
 
 	virtual void initGl() {
@@ -433,6 +510,45 @@ private:
 #include <OVR_Platform.h>
 
 #include <OVR_Avatar.h>
+#include "skinning.h"
+#include "transforms.h"
+#include "avatarpackets.h"
+#include "avatarnet.h"
+#include "avatarlod.h"
+#include "flathashmap.h"
+#include "telemetry.h"
+#include "fleetstats.h"
+#include "posetrace.h"
+#include "benchhmd.h"
+#include "benchcompare.h"
+#include "haptics.h"
+#include "framepacing.h"
+#include "sessionstatus.h"
+#include "inputpoller.h"
+#include "tracking.h"
+#include "voicecapture.h"
+#include "gamestate.h"
+#include "hudlayer.h"
+#include "latencytest.h"
+#include "environmentlayer.h"
+#include "rendergraph.h"
+#include "temporalupscale.h"
+#include "oit.h"
+#include "halfprecision.h"
+#include "loadinglayer.h"
+#include "renderqueue.h"
+#include "occlusionqueries.h"
+#include "hiddenarea.h"
+#include "shadingrate.h"
+#include "multigpu.h"
+#include "impostors.h"
+#include "billboards.h"
+#include "shadowmaps.h"
+#include "virtualtexture.h"
+#include "particles.h"
+#include "laserbeams.h"
+#include "scenegraph.h"
+#include "startup.h"
 
 #include <map>
 #include <chrono>
@@ -448,6 +564,9 @@ private:
 // Disable MIRROR_ALLOW_OVR to force 2D rendering
 #define MIRROR_ALLOW_OVR true
 
+// Padding around an avatar part's joints for the skin that covers them, joints alone would cull fingertips
+#define AVATAR_SKIN_MARGIN 0.12f
+
 
 /************************************************************************************
 * Static state
@@ -455,22 +574,62 @@ private:
 
 static GLuint _skinnedMeshProgram;
 static GLuint _skinnedMeshPBSProgram;
+// Skins positions alone for RENDER_PASS_DEPTH, see _queueAvatarDepth
+static GLuint _avatarDepthProgram;
 static GLuint _debugLineProgram;
-static GLuint _debugVertexArray;
-static GLuint _debugVertexBuffer;
+static DebugDraw _debugDraw;
+
+// What WinMain starts before the app is constructed, the app's own startup tasks come after these
+static StartupTask _startupPack = STARTUP_TASK_NONE;
+static StartupTask _startupPlatform = STARTUP_TASK_NONE;
+static StartupTask _startupEntitlement = STARTUP_TASK_NONE;
+// Set by --require-entitlement
+static bool _requireEntitlement = false;
+static GLuint _reflectionProgram;
+static PlanarMirror _planarMirror;
 static ovrAvatar* _avatar;
 static int _loadingAssets;
-static float _elapsedSeconds;
-static std::map<ovrAvatarAssetID, void*> _assetMap;
-std::chrono::steady_clock::time_point lastTime;
+// What the avatars are created with, so the SDK only references, loads and poses those components. --avatar-parts
+// hands|head|full picks it; voice visualization only comes with --voice, which also starts _voiceCapture.
+static ovrAvatarCapabilities _avatarCapabilities =
+	(ovrAvatarCapabilities)(ovrAvatarCapability_Body | ovrAvatarCapability_Hands | ovrAvatarCapability_Base);
+static bool _voiceEnabled;
+// Set while the avatar is over its GPU budget or the quality governor has turned its shading down, the body and
+// base are then queued with cheaper shading
+static bool _avatarReducedShading;
+// Projectors are shaded inside the draw of the part they land on when the textures are bindless, see AVATAR_DECAL.
+// --no-decal-fold draws each one again over its part instead.
+static bool _foldAvatarDecals = true;
+// Each eye draws avatar components on last frame's occlusion query of their bounds, see _queryAvatarOcclusion.
+// --no-avatar-queries draws them whatever hides them.
+static OcclusionQueries _avatarOcclusion;
+static bool _avatarOcclusionQueries = true;
+static bool _avatarOverBudget;
+static bool _avatarShadingLowered;
+// --record-avatar <log> writes the avatar's poses out as it moves, --play-avatar <log> drives it from one instead of tracking
+static AvatarPacketRecorder _avatarRecorder;
+static AvatarPacketPlayer _avatarPlayer;
+static std::string _avatarPlaybackPath;
+// --factory-model <file> swaps the factory for another model, a .glb keeping its nodes and instancing
+static std::string _factoryModelPath = "./factory1.obj";
+// --no-repeat-instancing keeps every repeated part of the factory a mesh of its own
+static RepeatedMeshes _factoryRepeats = RepeatedMeshes::Instanced;
+// --world <world.json> streams a facility --partition-world split into cells around the factory, keeping at most
+// --world-budget <MB> of their meshes resident
+static std::string _worldManifest;
+static int _worldBudgetMb = WORLD_DEFAULT_BUDGET_MB;
+// --net-port <port> streams the avatar to every --net-peer <ip:port> and shows theirs, see avatarnet.h
+static AvatarNetwork _avatarNetwork;
+static int _netPort;
+static std::vector<std::pair<std::string, int>> _netPeers;
+// The remote avatars with a pose this frame, refreshed before the poses are evaluated
+static std::vector<ovrAvatar*> _remoteAvatars;
+// Frame time summed up since the start, as the avatar shaders animate by it; a double so it keeps its precision
+static double _elapsedSeconds;
+static double _lastFrameSeconds;
 static glm::vec4 laserColorLeft(0, 1, 0, 1);
 static glm::vec4 laserColorRight(0, 1, 0, 1);
 
-pair<vec3, ovrQuatf> left_line_pos;
-pair<vec3, ovrQuatf> right_line_pos;
-
-ovrSession tempOvrSession;
-
 /************************************************************************************
 * Math helpers and type conversions
 ************************************************************************************/
@@ -497,10 +656,7 @@ static glm::vec3 _nextPointFromPosition(const glm::vec3& position, const glm::qu
 }
 
 static void _glmFromOvrAvatarTransform(const ovrAvatarTransform& transform, glm::mat4* target) {
-	glm::vec3 position(transform.position.x, transform.position.y, transform.position.z);
-	glm::quat orientation(transform.orientation.w, transform.orientation.x, transform.orientation.y, transform.orientation.z);
-	glm::vec3 scale(transform.scale.x, transform.scale.y, transform.scale.z);
-	*target = glm::translate(position) * glm::mat4_cast(orientation) * glm::scale(scale);
+	_mat4FromOvrAvatarTransform(transform, target);
 }
 
 static void _ovrAvatarTransformFromGlm(const glm::vec3& position, const glm::quat& orientation, const glm::vec3& scale, ovrAvatarTransform* target) {
@@ -516,14 +672,11 @@ static void _ovrAvatarTransformFromGlm(const glm::vec3& position, const glm::qua
 	target->scale.z = scale.z;
 }
 
+// matrix must be translate * rotate * scale, without shear or perspective
 static void _ovrAvatarTransformFromGlm(const glm::mat4& matrix, ovrAvatarTransform* target) {
-	glm::vec3 scale;
-	glm::quat orientation;
-	glm::vec3 translation;
-	glm::vec3 skew;
-	glm::vec4 perspective;
-	glm::decompose(matrix, scale, orientation, translation, skew, perspective);
-	_ovrAvatarTransformFromGlm(translation, orientation, scale, target);
+	TrsTransform trs;
+	_trsFromAffine(matrix, &trs);
+	_ovrAvatarTransformFromTrs(trs, target);
 }
 
 static void _ovrAvatarHandInputStateFromOvr(const ovrAvatarTransform& transform, const ovrInputState& inputState, ovrHandType hand, ovrAvatarHandInputState* state)
@@ -587,1417 +740,8093 @@ static void _computeWorldPose(const ovrAvatarSkinnedMeshPose& localPose, glm::ma
 	}
 }
 
-static glm::mat4 _computeReflectionMatrix(const glm::vec4& plane)
+// Times _computeWorldPose plus the inverse bind pose multiply against _evaluateSkinningPalette on a
+// chain of OVR_AVATAR_MAXIMUM_JOINT_COUNT joints. Start the app with --bench-skinning to run it.
+static void _benchmarkSkinning(int iterations)
 {
-	return glm::mat4(
-		1.0f - 2.0f * plane.x * plane.x,
-		-2.0f * plane.x * plane.y,
-		-2.0f * plane.x * plane.z,
-		-2.0f * plane.w * plane.x,
+	ovrAvatarSkinnedMeshPose pose;
+	memset(&pose, 0, sizeof(pose));
+	pose.jointCount = OVR_AVATAR_MAXIMUM_JOINT_COUNT;
+	glm::mat4 inverseBind[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
+	Affine34 inverseBindAffine[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
+	Random random(1234, RANDOM_STREAM_BENCHMARK);
+	for (uint32_t i = 0; i < pose.jointCount; ++i)
+	{
+		const glm::vec3 axis = random.uniform(glm::vec3(0.0f), glm::vec3(1.0f));
+		glm::quat q = glm::normalize(glm::quat(1.0f, axis.x, axis.y, axis.z));
+		glm::vec3 t = random.uniform(glm::vec3(0.0f), glm::vec3(0.1f));
+		_ovrAvatarTransformFromGlm(t, q, glm::vec3(1.0f), &pose.jointTransform[i]);
+		pose.jointParents[i] = (int)i - 1;
+		inverseBind[i] = glm::inverse(glm::translate(t) * glm::mat4_cast(q));
+		_affineFromMat4(inverseBind[i], &inverseBindAffine[i]);
+	}
 
-		-2.0f * plane.y * plane.x,
-		1.0f - 2.0f * plane.y * plane.y,
-		-2.0f * plane.y * plane.z,
-		-2.0f * plane.w * plane.y,
+	glm::mat4 reference[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
+	glm::mat4 palette[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
+	float checksum = 0.0f;
 
-		-2.0f * plane.z * plane.x,
-		-2.0f * plane.z * plane.y,
-		1.0f - 2.0f * plane.z * plane.z,
-		-2.0f * plane.w * plane.z,
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int n = 0; n < iterations; ++n)
+	{
+		_computeWorldPose(pose, reference);
+		for (uint32_t i = 0; i < pose.jointCount; ++i)
+		{
+			reference[i] = reference[i] * inverseBind[i];
+		}
+		checksum += reference[n % pose.jointCount][3][0];
+	}
+	std::chrono::duration<double, std::micro> referenceTime = std::chrono::steady_clock::now() - start;
 
-		0.0f,
-		0.0f,
-		0.0f,
-		1.0f
-	);
+	start = std::chrono::steady_clock::now();
+	for (int n = 0; n < iterations; ++n)
+	{
+		_evaluateSkinningPalette(pose, inverseBindAffine, palette);
+		checksum += palette[n % pose.jointCount][3][0];
+	}
+	std::chrono::duration<double, std::micro> simdTime = std::chrono::steady_clock::now() - start;
+
+	float maxError = 0.0f;
+	for (uint32_t i = 0; i < pose.jointCount; ++i)
+		for (int c = 0; c < 4; ++c)
+			for (int r = 0; r < 4; ++r)
+				maxError = std::max(maxError, fabsf(reference[i][c][r] - palette[i][c][r]));
+
+	char message[256];
+	snprintf(message, sizeof(message), "Skinning %u joints: reference %.3f us, affine SSE %.3f us per pose, max error %g (checksum %g)\n",
+		pose.jointCount, referenceTime.count() / iterations, simdTime.count() / iterations, maxError, checksum);
+	OutputDebugStringA(message);
+	std::cout << message;
 }
 
-
 /************************************************************************************
 * Wrappers for GL representations of avatar assets
 ************************************************************************************/
 
+// Avatar vertex as the GPU keeps it, 44 bytes to ovrAvatarMeshVertex's 68: normal and tangent as halves, blend
+// weights as UNORM8. The vertex shader reads the same vec3/vec4 inputs either way.
+struct AvatarPackedVertex {
+	float position[3];
+	// w of the normal is padding
+	GLushort normal[4];
+	GLushort tangent[4];
+	float uv[2];
+	uint8_t blendIndices[4];
+	uint8_t blendWeights[4];
+};
+static_assert(sizeof(AvatarPackedVertex) == 44, "AvatarPackedVertex must stay 44 bytes");
+
+// What AvatarVertexShader.glsl and AvatarSkinShader.glsl read
+template <>
+struct VertexLayout<AvatarPackedVertex>
+{
+	static constexpr VertexAttributes attributes()
+	{
+		return { 6, {
+			{ 0, 3, GL_FLOAT, GL_FALSE, false, offsetof(AvatarPackedVertex, position), GL_FLOAT_VEC3, "position" },
+			{ 1, 3, GL_HALF_FLOAT, GL_FALSE, false, offsetof(AvatarPackedVertex, normal), GL_FLOAT_VEC3, "normal" },
+			{ 2, 4, GL_HALF_FLOAT, GL_FALSE, false, offsetof(AvatarPackedVertex, tangent), GL_FLOAT_VEC4, "tangent" },
+			{ 3, 2, GL_FLOAT, GL_FALSE, false, offsetof(AvatarPackedVertex, uv), GL_FLOAT_VEC2, "texCoord" },
+			{ 4, 4, GL_UNSIGNED_BYTE, GL_FALSE, false, offsetof(AvatarPackedVertex, blendIndices), GL_FLOAT_VEC4, "poseIndices" },
+			{ 5, 4, GL_UNSIGNED_BYTE, GL_TRUE, false, offsetof(AvatarPackedVertex, blendWeights), GL_FLOAT_VEC4, "poseWeights" },
+		} };
+	}
+};
+
 struct MeshData {
+	// Shared by every mesh whose vertices and indices are in the same two _gpuArena pages, see _avatarVertexArray
 	GLuint vertexArray;
-	GLuint vertexBuffer;
-	GLuint elementBuffer;
+	// AvatarPackedVertices and GLushort indices in _gpuArena, the draws start at elementBlock.offset with
+	// baseVertex added to every index
+	GpuBlock vertexBlock;
+	GpuBlock elementBlock;
+	GLint baseVertex;
+	GLuint vertexCount;
 	GLuint elementCount;
 	glm::mat4 bindPose[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
 	glm::mat4 inverseBindPose[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
+	// Same as inverseBindPose, in the layout _evaluateSkinningPalette consumes
+	Affine34 inverseBindAffine[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
 };
 
+// Avatar textures of the same format, size and mip count share GL_TEXTURE_2D_ARRAY pages of this many layers, so
+// the parts of an avatar mostly sample from the same few arrays and keep them bound from draw to draw
+#define AVATAR_TEXTURE_ARRAY_LAYERS 8
+
+// A texture is one layer of a page, arrayID 0 for a format we don't load. handle is the page's, 0 unless bindless.
 struct TextureData {
-	GLuint textureID;
+	GLuint arrayID;
+	GLint layer;
+	GLuint64 handle;
 };
 
-static MeshData* _loadMesh(const ovrAvatarMeshAssetData* data)
-{
-	MeshData* mesh = new MeshData();
-
-	// Create the vertex array and buffer
-	glGenVertexArrays(1, &mesh->vertexArray);
-	glGenBuffers(1, &mesh->vertexBuffer);
-	glGenBuffers(1, &mesh->elementBuffer);
-
-	// Bind the vertex buffer and assign the vertex data
-	glBindVertexArray(mesh->vertexArray);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, data->vertexCount * sizeof(ovrAvatarMeshVertex), data->vertexBuffer, GL_STATIC_DRAW);
-
-	// Bind the index buffer and assign the index data
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->elementBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, data->indexCount * sizeof(GLushort), data->indexBuffer, GL_STATIC_DRAW);
-	mesh->elementCount = data->indexCount;
+struct AvatarTexturePage {
+	GLenum format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipCount;
+	GLuint texture;
+	// Bit per layer holding a texture, the page is deleted once the last of them is released
+	uint32_t layers;
+	GLuint64 handle;
+	// Charged to GpuMemoryCategory::Textures while the page exists
+	int64_t bytes;
+};
 
-	// Fill in the array attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ovrAvatarMeshVertex), &((ovrAvatarMeshVertex*)0)->x);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ovrAvatarMeshVertex), &((ovrAvatarMeshVertex*)0)->nx);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(ovrAvatarMeshVertex), &((ovrAvatarMeshVertex*)0)->tx);
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(ovrAvatarMeshVertex), &((ovrAvatarMeshVertex*)0)->u);
-	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(4, 4, GL_BYTE, GL_FALSE, sizeof(ovrAvatarMeshVertex), &((ovrAvatarMeshVertex*)0)->blendIndices);
-	glEnableVertexAttribArray(4);
-	glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(ovrAvatarMeshVertex), &((ovrAvatarMeshVertex*)0)->blendWeights);
-	glEnableVertexAttribArray(5);
+static std::vector<AvatarTexturePage> _avatarTexturePages;
 
-	// Clean up
-	glBindVertexArray(0);
+// Avatar materials reference their arrays by resident GL_ARB_bindless_texture handles in the material block instead
+// of binding them, where the driver has the extension and --no-bindless didn't turn it off. Textures not loaded
+// yet sample a black 1x1 array, as an unbound unit would read.
+static bool _bindlessAllowed = true;
+static bool _bindlessTextures = false;
+static GLuint _avatarBlankTexture = 0;
+static GLuint64 _avatarBlankHandle = 0;
 
-	// Translate the bind pose
-	_computeWorldPose(data->skinnedBindPose, mesh->bindPose);
-	for (uint32_t i = 0; i < data->skinnedBindPose.jointCount; ++i)
+// Gives texture's layer back to its page, and deletes the page if that was the last one in use. Draws already
+// submitted keep sampling it, GL only deletes the storage once they are through. Outside the frame only, so
+// _glState doesn't go on believing the page bound.
+static void _releaseAvatarTextureLayer(TextureData* texture)
+{
+	for (size_t i = 0; i < _avatarTexturePages.size(); ++i)
 	{
-		mesh->inverseBindPose[i] = glm::inverse(mesh->bindPose[i]);
+		AvatarTexturePage& page = _avatarTexturePages[i];
+		if (page.texture != texture->arrayID)
+		{
+			continue;
+		}
+		page.layers &= ~(1u << texture->layer);
+		if (page.layers == 0)
+		{
+			if (page.handle)
+			{
+				glMakeTextureHandleNonResidentARB(page.handle);
+			}
+			glDeleteTextures(1, &page.texture);
+			_gpuMemory.release(GpuMemoryCategory::Textures, page.bytes);
+			_avatarTexturePages.erase(_avatarTexturePages.begin() + i);
+		}
+		break;
 	}
-	return mesh;
+	texture->arrayID = 0;
+	texture->layer = 0;
+	texture->handle = 0;
 }
 
-static TextureData* _loadTexture(const ovrAvatarTextureAssetData* data)
+// Frees what an avatar mesh holds in _gpuArena along with the MeshData. The shared vertex array stays, other
+// meshes in the same pages still use it.
+static void _releaseAvatarMesh(MeshData* mesh)
 {
-	// Create a texture
-	TextureData* texture = new TextureData();
-	glGenTextures(1, &texture->textureID);
-	glBindTexture(GL_TEXTURE_2D, texture->textureID);
+	_gpuArena.free(mesh->vertexBlock);
+	_gpuArena.free(mesh->elementBlock);
+	delete mesh;
+}
 
-	// Load the image data
-	switch (data->format)
-	{
+// Frames an avatar asset must have gone undrawn before it may be evicted, a minute at 90Hz
+#define AVATAR_ASSET_IDLE_FRAMES 5400
+
+enum class AvatarAssetState : uint8_t {
+	// Never requested
+	Missing,
+	// ovrAvatarAsset_BeginLoading was called, the data hasn't arrived yet
+	Pending,
+	Loaded,
+	// The SDK delivered an asset type we don't load
+	Unsupported,
+	// Loaded once, then dropped for being over budget; drawing it asks for it again
+	Evicted,
+};
 
-		// Handle uncompressed image data
-	case ovrAvatarTextureFormat_RGB24:
-		for (uint32_t level = 0, offset = 0, width = data->sizeX, height = data->sizeY; level < data->mipCount; ++level)
-		{
-			glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data->textureData + offset);
-			offset += width * height * 3;
-			width /= 2;
-			height /= 2;
-		}
-		break;
+// GL data for every avatar asset we have asked for, keyed by asset id. The registry owns the MeshData and
+// TextureData it is given, and frees them when they are replaced or evicted.
+class AvatarAssetRegistry {
+public:
+	// Before the frame's lookups, their frame is what evict() measures idleness by
+	void beginFrame(uint64_t frame) {
+		_frame = frame;
+	}
 
-		// Handle compressed image data
-	case ovrAvatarTextureFormat_DXT1:
-	case ovrAvatarTextureFormat_DXT5:
-		GLenum glFormat;
-		int blockSize;
-		if (data->format == ovrAvatarTextureFormat_DXT1)
-		{
-			blockSize = 8;
-			glFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	// Returns false if the asset was already requested, so callers don't count it twice
+	bool request(ovrAvatarAssetID id) {
+		bool inserted;
+		Entry& entry = _entries.insert(id, &inserted);
+		if (inserted) {
+			entry.state = AvatarAssetState::Pending;
 		}
-		else
-		{
-			blockSize = 16;
-			glFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		return inserted;
+	}
+
+	// Replaces the cached upload if there was one
+	void loaded(ovrAvatarAssetID id, MeshData* mesh) {
+		Entry& entry = _entries.insert(id);
+		if (entry.mesh && entry.mesh != mesh) {
+			_releaseAvatarMesh(entry.mesh);
 		}
+		entry.state = AvatarAssetState::Loaded;
+		entry.mesh = mesh;
+		entry.lastUsed = _frame;
+	}
 
-		for (uint32_t level = 0, offset = 0, width = data->sizeX, height = data->sizeY; level < data->mipCount; ++level)
-		{
-			GLsizei levelSize = (width < 4 || height < 4) ? blockSize : blockSize * (width / 4) * (height / 4);
-			glCompressedTexImage2D(GL_TEXTURE_2D, level, glFormat, width, height, 0, levelSize, data->textureData + offset);
-			offset += levelSize;
-			width /= 2;
-			height /= 2;
+	void loaded(ovrAvatarAssetID id, TextureData* texture) {
+		Entry& entry = _entries.insert(id);
+		if (entry.texture && entry.texture != texture) {
+			_releaseAvatarTextureLayer(entry.texture);
+			delete entry.texture;
 		}
-		break;
+		entry.state = AvatarAssetState::Loaded;
+		entry.texture = texture;
+		entry.lastUsed = _frame;
 	}
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	return texture;
-}
 
+	void unsupported(ovrAvatarAssetID id) {
+		_entries.insert(id).state = AvatarAssetState::Unsupported;
+	}
 
-/************************************************************************************
-* Rendering functions
-************************************************************************************/
+	// Its upload was queued from the avatar cache, the SDK's copy only replaces it if it turns out to differ
+	void markCached(ovrAvatarAssetID id) {
+		_entries.insert(id).cached = true;
+	}
 
-static void _setTextureSampler(GLuint program, int textureUnit, const char uniformName[], ovrAvatarAssetID assetID)
-{
-	GLuint textureID = 0;
-	if (assetID)
-	{
-		void* data = _assetMap[assetID];
-		TextureData* textureData = (TextureData*)data;
-		textureID = textureData->textureID;
+	bool cached(ovrAvatarAssetID id) const {
+		const Entry* entry = _entries.find(id);
+		return entry && entry->cached;
 	}
-	glActiveTexture(GL_TEXTURE0 + textureUnit);
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glUniform1i(glGetUniformLocation(program, uniformName), textureUnit);
-}
 
-static void _setTextureSamplers(GLuint program, const char uniformName[], size_t count, const int textureUnits[], const ovrAvatarAssetID assetIDs[])
-{
-	for (int i = 0; i < count; ++i)
-	{
-		ovrAvatarAssetID assetID = assetIDs[i];
+	AvatarAssetState state(ovrAvatarAssetID id) const {
+		const Entry* entry = _entries.find(id);
+		return entry ? entry->state : AvatarAssetState::Missing;
+	}
 
-		GLuint textureID = 0;
-		if (assetID)
-		{
-			void* data = _assetMap[assetID];
-			if (data)
-			{
-				TextureData* textureData = (TextureData*)data;
-				textureID = textureData->textureID;
+	// nullptr unless the asset is a loaded mesh. Counts as a use this frame, and an evicted asset looked up is
+	// queued for takeReloads().
+	MeshData* mesh(ovrAvatarAssetID id) {
+		Entry* entry = use(id);
+		return entry ? entry->mesh : nullptr;
+	}
+
+	// nullptr unless the asset is a loaded texture, used the way mesh() is
+	TextureData* texture(ovrAvatarAssetID id) {
+		Entry* entry = use(id);
+		return entry ? entry->texture : nullptr;
+	}
+
+	// Moves the evicted assets drawn since the last call into ids, they are Pending again
+	void takeReloads(std::vector<ovrAvatarAssetID>* ids) {
+		ids->swap(_reloads);
+		_reloads.clear();
+	}
+
+	// Evicts loaded meshes, or textures if textures, that weren't drawn for AVATAR_ASSET_IDLE_FRAMES, least
+	// recently drawn first, until bytes are freed. Returns what was freed. A texture's share of its page only
+	// comes off the Textures charge once the whole page is free.
+	int64_t evict(bool textures, int64_t bytes) {
+		_candidates.clear();
+		_entries.forEach([&](ovrAvatarAssetID id, const Entry& entry) {
+			if (entry.state == AvatarAssetState::Loaded && (textures ? entry.texture != nullptr : entry.mesh != nullptr) &&
+				_frame - entry.lastUsed >= AVATAR_ASSET_IDLE_FRAMES) {
+				_candidates.push_back(std::make_pair(entry.lastUsed, id));
+			}
+		});
+		std::sort(_candidates.begin(), _candidates.end());
+		int64_t freed = 0;
+		for (size_t i = 0; i < _candidates.size() && freed < bytes; ++i) {
+			Entry& entry = *_entries.find(_candidates[i].second);
+			if (textures) {
+				for (size_t p = 0; p < _avatarTexturePages.size(); ++p) {
+					if (_avatarTexturePages[p].texture == entry.texture->arrayID) {
+						freed += _avatarTexturePages[p].bytes / AVATAR_TEXTURE_ARRAY_LAYERS;
+					}
+				}
+				_releaseAvatarTextureLayer(entry.texture);
+				delete entry.texture;
+				entry.texture = nullptr;
 			}
+			else {
+				freed += (int64_t)(entry.mesh->vertexBlock.size + entry.mesh->elementBlock.size);
+				_releaseAvatarMesh(entry.mesh);
+				entry.mesh = nullptr;
+			}
+			entry.state = AvatarAssetState::Evicted;
+			entry.cached = false;
+			++_evictions;
 		}
-		glActiveTexture(GL_TEXTURE0 + textureUnits[i]);
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		return freed;
 	}
-	GLint uniformLocation = glGetUniformLocation(program, uniformName);
-	glUniform1iv(uniformLocation, (GLsizei)count, textureUnits);
-}
 
-static void _setMeshState(
-	GLuint program,
-	const ovrAvatarTransform& localTransform,
-	const MeshData* data,
-	const ovrAvatarSkinnedMeshPose& skinnedPose,
-	const glm::mat4& world,
-	const glm::mat4& view,
-	const glm::mat4 proj,
-	const glm::vec3& viewPos
-) {
-	// Compute the final world and viewProjection matrices for this part
-	glm::mat4 local;
-	_glmFromOvrAvatarTransform(localTransform, &local);
-	glm::mat4 worldMat = world * local;
-	glm::mat4 viewProjMat = proj * view;
+	// Assets evicted so far
+	uint32_t evictions() const {
+		return _evictions;
+	}
 
-	// Compute the skinned pose
-	glm::mat4* skinnedPoses = (glm::mat4*)alloca(sizeof(glm::mat4) * skinnedPose.jointCount);
-	_computeWorldPose(skinnedPose, skinnedPoses);
-	for (uint32_t i = 0; i < skinnedPose.jointCount; ++i)
-	{
-		skinnedPoses[i] = skinnedPoses[i] * data->inverseBindPose[i];
+private:
+	struct Entry {
+		AvatarAssetState state = AvatarAssetState::Missing;
+		MeshData* mesh = nullptr;
+		TextureData* texture = nullptr;
+		bool cached = false;
+		// Frame of the latest lookup
+		uint64_t lastUsed = 0;
+	};
+
+	Entry* use(ovrAvatarAssetID id) {
+		Entry* entry = _entries.find(id);
+		if (!entry) {
+			return nullptr;
+		}
+		entry->lastUsed = _frame;
+		if (entry->state == AvatarAssetState::Evicted) {
+			entry->state = AvatarAssetState::Pending;
+			_reloads.push_back(id);
+		}
+		return entry;
 	}
 
-	// Pass the world view position to the shader for view-dependent rendering
-	glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, glm::value_ptr(viewPos));
+	FlatHashMap<ovrAvatarAssetID, Entry> _entries;
+	uint64_t _frame = 0;
+	uint32_t _evictions = 0;
+	std::vector<ovrAvatarAssetID> _reloads;
+	std::vector<std::pair<uint64_t, ovrAvatarAssetID>> _candidates;
+};
 
-	// Assign the vertex uniforms
-	glUniformMatrix4fv(glGetUniformLocation(program, "world"), 1, 0, glm::value_ptr(worldMat));
-	glUniformMatrix4fv(glGetUniformLocation(program, "viewProj"), 1, 0, glm::value_ptr(viewProjMat));
-	glUniformMatrix4fv(glGetUniformLocation(program, "meshPose"), (GLsizei)skinnedPose.jointCount, 0, glm::value_ptr(*skinnedPoses));
-}
+static AvatarAssetRegistry _avatarAssets;
 
-static void _setMaterialState(GLuint program, const ovrAvatarMaterialState* state, glm::mat4* projectorInv)
-{
-	// Assign the fragment uniforms
-	glUniform1i(glGetUniformLocation(program, "useAlpha"), state->alphaMaskTextureID != 0);
-	glUniform1i(glGetUniformLocation(program, "useNormalMap"), state->normalMapTextureID != 0);
-	glUniform1i(glGetUniformLocation(program, "useRoughnessMap"), state->roughnessMapTextureID != 0);
+// Avatar assets are uploaded from AVATAR_CACHE_DIRECTORY when they are there, and written to it as they arrive,
+// unless --no-avatar-cache
+static bool _avatarCacheEnabled = true;
 
-	glUniform1f(glGetUniformLocation(program, "elapsedSeconds"), _elapsedSeconds);
+// Uniform buffer binding of the MeshPose block in AvatarVertexShader.glsl
+#define AVATAR_POSE_BINDING 0
 
-	if (projectorInv)
-	{
-		glUniform1i(glGetUniformLocation(program, "useProjector"), 1);
-		glUniformMatrix4fv(glGetUniformLocation(program, "projectorInv"), 1, 0, glm::value_ptr(*projectorInv));
-	}
-	else
-	{
-		glUniform1i(glGetUniformLocation(program, "useProjector"), 0);
-	}
-
-	int textureSlot = 1;
-	glUniform4fv(glGetUniformLocation(program, "baseColor"), 1, &state->baseColor.x);
-	glUniform1i(glGetUniformLocation(program, "baseMaskType"), state->baseMaskType);
-	glUniform4fv(glGetUniformLocation(program, "baseMaskParameters"), 1, &state->baseMaskParameters.x);
-	glUniform4fv(glGetUniformLocation(program, "baseMaskAxis"), 1, &state->baseMaskAxis.x);
-	_setTextureSampler(program, textureSlot++, "alphaMask", state->alphaMaskTextureID);
-	glUniform4fv(glGetUniformLocation(program, "alphaMaskScaleOffset"), 1, &state->alphaMaskScaleOffset.x);
-	_setTextureSampler(program, textureSlot++, "normalMap", state->normalMapTextureID);
-	glUniform4fv(glGetUniformLocation(program, "normalMapScaleOffset"), 1, &state->normalMapScaleOffset.x);
-	_setTextureSampler(program, textureSlot++, "parallaxMap", state->parallaxMapTextureID);
-	glUniform4fv(glGetUniformLocation(program, "parallaxMapScaleOffset"), 1, &state->parallaxMapScaleOffset.x);
-	_setTextureSampler(program, textureSlot++, "roughnessMap", state->roughnessMapTextureID);
-	glUniform4fv(glGetUniformLocation(program, "roughnessMapScaleOffset"), 1, &state->roughnessMapScaleOffset.x);
-
-	struct LayerUniforms {
-		int layerSamplerModes[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
-		int layerBlendModes[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
-		int layerMaskTypes[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
-		ovrAvatarVector4f layerColors[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
-		int layerSurfaces[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
-		ovrAvatarAssetID layerSurfaceIDs[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
-		ovrAvatarVector4f layerSurfaceScaleOffsets[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
-		ovrAvatarVector4f layerSampleParameters[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
-		ovrAvatarVector4f layerMaskParameters[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
-		ovrAvatarVector4f layerMaskAxes[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
-	} layerUniforms;
-	memset(&layerUniforms, 0, sizeof(layerUniforms));
-	for (uint32_t i = 0; i < state->layerCount; ++i)
-	{
-		const ovrAvatarMaterialLayerState& layerState = state->layers[i];
-		layerUniforms.layerSamplerModes[i] = layerState.sampleMode;
-		layerUniforms.layerBlendModes[i] = layerState.blendMode;
-		layerUniforms.layerMaskTypes[i] = layerState.maskType;
-		layerUniforms.layerColors[i] = layerState.layerColor;
-		layerUniforms.layerSurfaces[i] = textureSlot++;
-		layerUniforms.layerSurfaceIDs[i] = layerState.sampleTexture;
-		layerUniforms.layerSurfaceScaleOffsets[i] = layerState.sampleScaleOffset;
-		layerUniforms.layerSampleParameters[i] = layerState.sampleParameters;
-		layerUniforms.layerMaskParameters[i] = layerState.maskParameters;
-		layerUniforms.layerMaskAxes[i] = layerState.maskAxis;
-	}
-
-	glUniform1i(glGetUniformLocation(program, "layerCount"), state->layerCount);
-	glUniform1iv(glGetUniformLocation(program, "layerSamplerModes"), OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT, layerUniforms.layerSamplerModes);
-	glUniform1iv(glGetUniformLocation(program, "layerBlendModes"), OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT, layerUniforms.layerBlendModes);
-	glUniform1iv(glGetUniformLocation(program, "layerMaskTypes"), OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT, layerUniforms.layerMaskTypes);
-	glUniform4fv(glGetUniformLocation(program, "layerColors"), OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT, (float*)layerUniforms.layerColors);
-	_setTextureSamplers(program, "layerSurfaces", OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT, layerUniforms.layerSurfaces, layerUniforms.layerSurfaceIDs);
-	glUniform4fv(glGetUniformLocation(program, "layerSurfaceScaleOffsets"), OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT, (float*)layerUniforms.layerSurfaceScaleOffsets);
-	glUniform4fv(glGetUniformLocation(program, "layerSampleParameters"), OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT, (float*)layerUniforms.layerSampleParameters);
-	glUniform4fv(glGetUniformLocation(program, "layerMaskParameters"), OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT, (float*)layerUniforms.layerMaskParameters);
-	glUniform4fv(glGetUniformLocation(program, "layerMaskAxes"), OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT, (float*)layerUniforms.layerMaskAxes);
+// Uniform buffer binding of the MeshTransform block in AvatarVertexShader.glsl, written per draw into _uniformRing
+#define AVATAR_TRANSFORM_BINDING 4
 
-}
+// CPU image of the MeshTransform uniform block
+struct AvatarTransformBlock {
+	glm::mat4 world;
+	glm::mat4 viewProj;
+	// xyz, w is std140 padding
+	glm::vec4 viewPos;
+};
+static_assert(sizeof(AvatarTransformBlock) == 144, "AvatarTransformBlock must match the std140 layout of MeshTransform");
+
+// Final skinning palettes (joint world pose * inverse bind pose) of every skinned render part,
+// computed once per avatar update and shared by both eyes and the projector pass.
+// All palettes live in one uniform buffer, one OVR_AVATAR_MAXIMUM_JOINT_COUNT block per part.
+struct AvatarPoseCache {
+	GLuint buffer;
+	// Distance between blocks in matrices, a palette rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	size_t blockStride;
+	std::vector<glm::mat4> palettes;
+	// Pose of each block, and the block of each pose by its address. Every avatar's parts share the buffer, which
+	// is too many for a linear search once there are a few remote avatars.
+	std::vector<const ovrAvatarSkinnedMeshPose*> blocks;
+	FlatHashMap<uintptr_t, uint32_t> blockOf;
+	// Inverse bind pose of each block's mesh, for evaluating the palettes once all blocks are known
+	std::vector<const Affine34*> inverseBinds;
+	// Each block's mesh, and with _preskinAvatars the first of its vertices in _avatarPreskin.buffer
+	std::vector<const MeshData*> meshes;
+	std::vector<GLint> skinnedBases;
+};
 
-static void _setPBSState(GLuint program, const ovrAvatarAssetID albedoTextureID, const ovrAvatarAssetID surfaceTextureID)
-{
-	int textureSlot = 0;
-	_setTextureSampler(program, textureSlot++, "albedo", albedoTextureID);
-	_setTextureSampler(program, textureSlot++, "surface", surfaceTextureID);
-}
+static AvatarPoseCache _avatarPoses;
 
-static void _renderDebugLine(const glm::mat4& worldViewProj, const glm::vec3& a, const glm::vec3& b, const glm::vec4& aColor, const glm::vec4& bColor)
-{
-	glUseProgram(_debugLineProgram);
-	glUniformMatrix4fv(glGetUniformLocation(_debugLineProgram, "worldViewProj"), 1, 0, glm::value_ptr(worldViewProj));
-	struct {
-		glm::vec3 p;
-		glm::vec4 c;
-	} vertices[2] = {
-		{ a, aColor },
-		{ b, bColor },
-	};
+// Uniform buffer binding of the AvatarMaterial block in AvatarFragmentShader.glsl
+#define AVATAR_MATERIAL_BINDING 1
+// And of its AvatarDecal block, the material of a projector folded into its target's draw
+#define AVATAR_DECAL_BINDING 6
+// Distinct materials kept before the cache starts over
+#define AVATAR_MATERIAL_MAX_SLOTS 64
 
-	glBindVertexArray(_debugVertexArray);
-	glDepthFunc(GL_LEQUAL);
-	glBindBuffer(GL_ARRAY_BUFFER, _debugVertexArray);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
+// std140 pads every element of a scalar array to 16 bytes
+struct Std140Int {
+	int32_t value;
+	int32_t padding[3];
+};
 
-	// Fill in the array attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), 0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (void*)sizeof(glm::vec3));
-	glEnableVertexAttribArray(1);
-	glLineWidth(25);
-	glDrawArrays(GL_LINES, 0, 2);
-}
+// CPU image of the AvatarMaterial uniform block, member for member
+struct AvatarMaterialBlock {
+	glm::vec4 baseColor;
+	glm::vec4 baseMaskParameters;
+	glm::vec4 baseMaskAxis;
+	glm::vec4 alphaMaskScaleOffset;
+	glm::vec4 normalMapScaleOffset;
+	glm::vec4 parallaxMapScaleOffset;
+	glm::vec4 roughnessMapScaleOffset;
+	glm::mat4 projectorInv;
+	int32_t baseMaskType;
+	int32_t layerCount;
+	uint32_t useAlpha;
+	uint32_t useNormalMap;
+	uint32_t useRoughnessMap;
+	uint32_t useProjector;
+	int32_t padding[2];
+	Std140Int layerSamplerModes[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
+	Std140Int layerBlendModes[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
+	Std140Int layerMaskTypes[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
+	glm::vec4 layerColors[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
+	glm::vec4 layerSurfaceScaleOffsets[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
+	glm::vec4 layerSampleParameters[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
+	glm::vec4 layerMaskParameters[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
+	glm::vec4 layerMaskAxes[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
+	// Layers of the alpha mask, normal, parallax and roughness maps in their arrays, then of each layer's surface
+	int32_t mapLayers[4];
+	Std140Int layerSurfaceLayers[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
+	// Bindless only: the arrays' handles in the same order, as the shader's uvec4 pairs
+	GLuint64 textureHandles[4 + OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
+};
+static_assert(sizeof(AvatarMaterialBlock) == 1472, "AvatarMaterialBlock must match the std140 layout of AvatarMaterial");
+
+// Texture slots of a material: the alpha mask, normal, parallax and roughness maps, then one per layer. Slot i
+// samples texture unit 1 + i.
+#define AVATAR_TEXTURE_SLOTS (4 + OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT)
+
+// The array each slot of a material samples and the layer in it, 0 and 0 for textures not loaded (yet), and the
+// array's handle when bindless
+struct AvatarMaterialTextures {
+	GLuint arrays[AVATAR_TEXTURE_SLOTS];
+	int32_t layers[AVATAR_TEXTURE_SLOTS];
+	GLuint64 handles[AVATAR_TEXTURE_SLOTS];
+};
+
+// Last material written to one slot of the material buffer
+struct AvatarMaterialEntry {
+	const ovrAvatarMaterialState* key;
+	bool valid;
+	bool projector;
+	ovrAvatarMaterialState state;
+	glm::mat4 projectorInv;
+	// A texture that finishes loading moves its slots off layer 0 and the blank handle without the state changing
+	int32_t layers[AVATAR_TEXTURE_SLOTS];
+	GLuint64 handles[AVATAR_TEXTURE_SLOTS];
+};
 
-static void _renderPose(const glm::mat4& worldViewProj, const ovrAvatarSkinnedMeshPose& pose, bool isRight)
+// Avatar materials live in one uniform buffer, one slot per render part, and are rarely rewritten
+struct AvatarMaterialCache {
+	GLuint buffer;
+	size_t stride;
+	size_t capacity;
+	std::vector<AvatarMaterialEntry> entries;
+};
+
+static AvatarMaterialCache _avatarMaterials;
+
+// A linked AvatarFragmentShader.glsl program and the uniform it sets on every draw
+struct AvatarProgram {
+	GLuint program;
+	GLint elapsedSecondsLocation;
+};
+
+// The generic program reads every material switch from the AvatarMaterial block. Variants are the same shader
+// specialized for one combination of switches, compiled the first time a part needs it (and after that loaded
+// from the program binary cache). One that fails to build keeps program 0, so it is tried once and the parts
+// that wanted it fall back to the generic program.
+struct AvatarProgramCache {
+	AvatarProgram generic;
+	FlatHashMap<uint64_t, AvatarProgram> variants;
+};
+
+static AvatarProgramCache _avatarPrograms;
+
+// Share of the refresh period the avatar uploader may spend on GL uploads each frame, 2ms at 90 Hz. At least one
+// step runs every frame, so the largest single mip level bounds the worst case.
+#define AVATAR_UPLOAD_FRAME_SHARE 0.18f
+
+// An asset waiting for, or part way through, its GL upload. Meshes go in two steps (vertices, indices), their
+// bind pose already worked out by the avatar pump, textures in one step per mip level.
+struct AvatarUploadJob {
+	// Owned until the upload finishes, it keeps the asset data alive. Handed back to the pump to free.
+	ovrAvatarMessage* message;
+	ovrAvatarAssetID assetID;
+	ovrAvatarAssetType type;
+	const ovrAvatarMeshAssetData* meshData;
+	const ovrAvatarTextureAssetData* textureData;
+	// Mesh vertices packed by the pump, freed once they're uploaded
+	AvatarPackedVertex* packedVertices;
+	uint32_t step;
+	// Texture upload position: byte offset and size of the next mip level
+	uint32_t offset;
+	uint32_t width;
+	uint32_t height;
+	MeshData* mesh;
+	TextureData* texture;
+	// Uploading from the avatar cache instead of a message: meshData, textureData and packedVertices point into it
+	struct AvatarCacheUpload* cached;
+	// Set by the pump: the cache file already holds what the message delivered
+	bool cacheCurrent;
+	// The message's data differs from the cached upload queued before it, and goes up in its place
+	bool replacesCached;
+};
+
+// A mapped cache file, and the SDK structures the upload steps read, filled in from it
+struct AvatarCacheUpload {
+	AvatarCachedAsset asset;
+	ovrAvatarMeshAssetData mesh;
+	ovrAvatarTextureAssetData texture;
+};
+
+static std::vector<AvatarUploadJob> _avatarUploads;
+static size_t _avatarUploadHead;
+
+// Avatar uploads are staged, with ARB_buffer_storage as the other streamed buffers are, in one persistently mapped
+// ring written front to back, each upload fenced once the GL has been told to read it so its bytes are only written
+// over once the GPU is through with them. Without the extension, and for an upload bigger than the ring, the one
+// buffer is orphaned for every upload instead.
+#define AVATAR_STAGING_RING_BYTES (16 * 1024 * 1024)
+struct AvatarStagingFence {
+	GLintptr begin;
+	GLintptr end;
+	GLsync fence;
+};
+static GLuint _avatarStagingBuffer;
+static GLuint _avatarStagingRing;
+static uint8_t* _avatarStagingMapped;
+static GLintptr _avatarStagingHead;
+// The ring's uploads the GPU may still be reading, oldest first, and the one just staged waiting for its fence
+static std::deque<AvatarStagingFence> _avatarStagingFences;
+static AvatarStagingFence _avatarStagingPending;
+
+// Every avatar SDK call that isn't drawing or posing runs on the avatar pump's thread: it pops the SDK's messages,
+// creates avatars, starts asset loads, frees messages and does the CPU side of preparing each asset. The render
+// thread sends it AvatarPumpRequests and takes AvatarPumpResults back, each through an SpscQueue, and only does
+// the GL uploads itself. Whichever side finds a queue full keeps the rest in a backlog and retries next frame.
+#define AVATAR_PUMP_QUEUE 1024
+
+enum class AvatarPumpRequestKind : uint8_t {
+	RequestSpecification,
+	BeginLoading,
+	FreeMessage,
+};
+
+struct AvatarPumpRequest {
+	AvatarPumpRequestKind kind;
+	uint64_t id;
+	ovrAvatarMessage* message;
+};
+
+enum class AvatarPumpResultKind : uint8_t {
+	Specification,
+	Asset,
+};
+
+struct AvatarPumpResult {
+	AvatarPumpResultKind kind;
+	// Specification: whose avatar was created, and every asset it references
+	uint64_t userID;
+	ovrAvatar* avatar;
+	std::vector<ovrAvatarAssetID> assets;
+	// Asset: the message keeping its data alive, and the upload it needs with the CPU work done
+	AvatarUploadJob job;
+};
+
+static SpscQueue<AvatarPumpRequest, AVATAR_PUMP_QUEUE> _avatarPumpRequests;
+static SpscQueue<AvatarPumpResult, AVATAR_PUMP_QUEUE> _avatarPumpResults;
+// Render thread side: requests the queue had no room for
+static std::deque<AvatarPumpRequest> _avatarRequestBacklog;
+// Pump side: results the queue had no room for, no more messages are popped until they are through
+static std::deque<AvatarPumpResult> _avatarResultBacklog;
+static FrameWorker _avatarPump;
+
+// Where in the ring size bytes go next, once every upload still being read there is through. -1 if they don't fit.
+static GLintptr _allocateAvatarStaging(size_t size)
 {
-	glm::mat4* skinnedPoses = (glm::mat4*)alloca(sizeof(glm::mat4) * pose.jointCount);
-	_computeWorldPose(pose, skinnedPoses);
-	if (!isRight) {
-		_renderDebugLine(worldViewProj, glm::vec3(0, 0, 0), glm::vec3(0, 0, -200), laserColorLeft, glm::vec4(1, 1, 1, 1));
+	if (!_avatarStagingMapped || size > AVATAR_STAGING_RING_BYTES)
+	{
+		return -1;
 	}
-	else {
-		_renderDebugLine(worldViewProj, glm::vec3(0, 0, 0), glm::vec3(0, 0, -200), laserColorRight, glm::vec4(1, 1, 1, 1));
+	GLintptr offset = (_avatarStagingHead + 255) & ~(GLintptr)255;
+	if (offset + (GLintptr)size > AVATAR_STAGING_RING_BYTES)
+	{
+		offset = 0;
+	}
+	const GLintptr end = offset + (GLintptr)size;
+	// Fences signal in order, so waiting on the newest one in the way covers every older one
+	size_t waits = 0;
+	for (size_t i = 0; i < _avatarStagingFences.size(); ++i)
+	{
+		if (_avatarStagingFences[i].begin < end && offset < _avatarStagingFences[i].end)
+		{
+			waits = i + 1;
+		}
+	}
+	if (waits)
+	{
+		glClientWaitSync(_avatarStagingFences[waits - 1].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+	}
+	for (size_t i = 0; i < waits; ++i)
+	{
+		glDeleteSync(_avatarStagingFences.front().fence);
+		_avatarStagingFences.pop_front();
 	}
+	_avatarStagingHead = end;
+	return offset;
 }
 
-static void _renderSkinnedMeshPart(const ovrAvatarRenderPart_SkinnedMeshRender* mesh, uint32_t visibilityMask, const glm::mat4& world, const glm::mat4& view, const glm::mat4 proj, const glm::vec3& viewPos, bool isRight)
+// Copies size bytes into staging, which is left bound to target. The offset sources then read from; the read is to
+// be followed by _releaseAvatarStaging().
+static GLintptr _stageAvatarData(GLenum target, const void* data, size_t size)
 {
-	// If this part isn't visible from the viewpoint we're rendering from, do nothing
-	if ((mesh->visibilityMask & visibilityMask) == 0)
+	if (!_avatarStagingRing && GLEW_ARB_buffer_storage)
 	{
-		return;
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &_avatarStagingRing);
+		glBindBuffer(target, _avatarStagingRing);
+		_glLabel(GL_BUFFER, _avatarStagingRing, "avatar staging ring");
+		glBufferStorage(target, AVATAR_STAGING_RING_BYTES, NULL, flags);
+		_avatarStagingMapped = (uint8_t*)glMapBufferRange(target, 0, AVATAR_STAGING_RING_BYTES, flags);
+	}
+	const GLintptr offset = _allocateAvatarStaging(size);
+	if (offset >= 0)
+	{
+		glBindBuffer(target, _avatarStagingRing);
+		memcpy(_avatarStagingMapped + offset, data, size);
+		_avatarStagingPending = { offset, offset + (GLintptr)size, 0 };
+		_renderStats.uploaded((GLsizeiptr)size);
+		return offset;
 	}
 
-	// Get the GL mesh data for this mesh's asset
-	MeshData* data = (MeshData*)_assetMap[mesh->meshAssetID];
-
-	glUseProgram(_skinnedMeshProgram);
-
-	// Apply the vertex state
-	_setMeshState(_skinnedMeshProgram, mesh->localTransform, data, mesh->skinnedPose, world, view, proj, viewPos);
-
-	// Apply the material state
-	_setMaterialState(_skinnedMeshProgram, &mesh->materialState, nullptr);
-
-	// Draw the mesh
-	glBindVertexArray(data->vertexArray);
-	glDepthFunc(GL_LEQUAL);
+	// Orphaning the storage first means the copy never waits on an upload still in flight
+	if (!_avatarStagingBuffer)
+	{
+		glGenBuffers(1, &_avatarStagingBuffer);
+		glBindBuffer(target, _avatarStagingBuffer);
+		_glLabel(GL_BUFFER, _avatarStagingBuffer, "avatar staging");
+	}
+	glBindBuffer(target, _avatarStagingBuffer);
+	glBufferData(target, size, NULL, GL_STREAM_DRAW);
+	void* mapped = glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (mapped)
+	{
+		memcpy(mapped, data, size);
+		glUnmapBuffer(target);
+	}
+	else
+	{
+		glBufferSubData(target, 0, size, data);
+	}
+	_renderStats.uploaded((GLsizeiptr)size);
+	return 0;
+}
 
-	// Write to depth first for self-occlusion
-	if (mesh->visibilityMask & ovrAvatarVisibilityFlag_SelfOccluding)
+// After the GL call reading what _stageAvatarData() staged: fences it if it went through the ring
+static void _releaseAvatarStaging()
+{
+	if (_avatarStagingPending.end > _avatarStagingPending.begin)
 	{
-		glDrawElements(GL_TRIANGLES, (GLsizei)data->elementCount, GL_UNSIGNED_SHORT, 0);
+		_avatarStagingPending.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		_avatarStagingFences.push_back(_avatarStagingPending);
 	}
+	_avatarStagingPending = {};
+}
 
-	// Render to color buffer
-	glColorMaski(0, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-	glDrawElements(GL_TRIANGLES, (GLsizei)data->elementCount, GL_UNSIGNED_SHORT, 0);
-	glBindVertexArray(0);
+// Fills size bytes of buffer at offset through the staging buffer
+static void _copyToAvatarBuffer(GLuint buffer, GLintptr offset, const void* data, size_t size)
+{
+	const GLintptr staged = _stageAvatarData(GL_COPY_READ_BUFFER, data, size);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staged, offset, size);
+	_releaseAvatarStaging();
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
 
-	glm::mat4 local;
-	_glmFromOvrAvatarTransform(mesh->localTransform, &local);
-	glDepthFunc(GL_ALWAYS);
-	_renderPose(proj * view * world * local, mesh->skinnedPose, isRight);
+// Allocates size bytes of _gpuArena and fills them
+static GpuBlock _uploadAvatarBlock(const void* data, size_t size)
+{
+	GpuBlock block = _gpuArena.allocate((GLsizeiptr)size);
+	_copyToAvatarBuffer(block.buffer, block.offset, data, size);
+	return block;
 }
 
-/* this part does not use */
-static void _renderSkinnedMeshPartPBS(const ovrAvatarRenderPart_SkinnedMeshRenderPBS* mesh, uint32_t visibilityMask, const glm::mat4& world, const glm::mat4& view, const glm::mat4 proj, const glm::vec3& viewPos, bool isRight)
+// Pump thread: ovrAvatarMeshVertex into AvatarPackedVertex. Weights are rounded to bytes and the largest takes up
+// the rounding error, so they still sum to exactly one in the shader.
+static void _packAvatarVertices(const ovrAvatarMeshVertex* vertices, uint32_t count, AvatarPackedVertex* packed)
 {
-	// If this part isn't visible from the viewpoint we're rendering from, do nothing
-	if ((mesh->visibilityMask & visibilityMask) == 0)
+	for (uint32_t i = 0; i < count; ++i)
 	{
-		return;
+		const ovrAvatarMeshVertex& v = vertices[i];
+		AvatarPackedVertex& p = packed[i];
+		p.position[0] = v.x;
+		p.position[1] = v.y;
+		p.position[2] = v.z;
+		p.normal[0] = _packHalf(v.nx);
+		p.normal[1] = _packHalf(v.ny);
+		p.normal[2] = _packHalf(v.nz);
+		p.normal[3] = 0;
+		p.tangent[0] = _packHalf(v.tx);
+		p.tangent[1] = _packHalf(v.ty);
+		p.tangent[2] = _packHalf(v.tz);
+		p.tangent[3] = _packHalf(v.tw);
+		p.uv[0] = v.u;
+		p.uv[1] = v.v;
+		int sum = 0, largest = 0;
+		for (int j = 0; j < 4; ++j)
+		{
+			p.blendIndices[j] = (uint8_t)v.blendIndices[j];
+			const int weight = (int)(glm::clamp(v.blendWeights[j], 0.0f, 1.0f) * 255.0f + 0.5f);
+			p.blendWeights[j] = (uint8_t)weight;
+			sum += weight;
+			if (v.blendWeights[j] > v.blendWeights[largest])
+				largest = j;
+		}
+		if (sum > 0)
+			p.blendWeights[largest] = (uint8_t)glm::clamp(p.blendWeights[largest] + 255 - sum, 0, 255);
 	}
+}
 
-	// Get the GL mesh data for this mesh's asset
-	MeshData* data = (MeshData*)_assetMap[mesh->meshAssetID];
+// One vertex array per pair of _gpuArena pages avatar vertices and indices are in, its attributes starting at
+// offset 0 of the vertex page. With all of an avatar's meshes in one page pair, which 8MB pages make the usual
+// case, the whole avatar draws from one VAO and the render queue never switches it.
+struct AvatarVertexArray {
+	GLuint vertexBuffer;
+	GLuint elementBuffer;
+	GLuint vertexArray;
+};
 
-	glUseProgram(_skinnedMeshPBSProgram);
+static std::vector<AvatarVertexArray> _avatarVertexArrays;
 
-	// Apply the vertex state
-	_setMeshState(_skinnedMeshPBSProgram, mesh->localTransform, data, mesh->skinnedPose, world, view, proj, viewPos);
+static GLuint _avatarVertexArray(GLuint vertexBuffer, GLuint elementBuffer)
+{
+	for (const AvatarVertexArray& a : _avatarVertexArrays)
+	{
+		if (a.vertexBuffer == vertexBuffer && a.elementBuffer == elementBuffer)
+			return a.vertexArray;
+	}
 
-	// Apply the material state
-	_setPBSState(_skinnedMeshPBSProgram, mesh->albedoTextureAssetID, mesh->surfaceTextureAssetID);
+	AvatarVertexArray a = { vertexBuffer, elementBuffer, 0 };
+	glGenVertexArrays(1, &a.vertexArray);
+	_glState.bindVertexArray(a.vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	_setVertexAttributes<AvatarPackedVertex>();
+	// The element binding is recorded in the VAO
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+	_glState.bindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	_avatarVertexArrays.push_back(a);
+	return a.vertexArray;
+}
 
-	// Draw the mesh
-	glBindVertexArray(data->vertexArray);
-	glDepthFunc(GL_LESS);
+// One vertex of the pre-skin pass, as transform feedback writes it and AvatarVertexShader.glsl reads it with
+// PRESKINNED: position, normal and tangent skinned in mesh space, the rest copied through
+struct AvatarSkinnedVertex {
+	float position[3];
+	float normal[3];
+	float tangent[4];
+	float uv[2];
+	float objPosition[3];
+};
+static_assert(sizeof(AvatarSkinnedVertex) == 60, "AvatarSkinnedVertex must match the varyings of AvatarSkinShader.glsl");
 
-	// Write to depth first for self-occlusion
-	if (mesh->visibilityMask & ovrAvatarVisibilityFlag_SelfOccluding)
+// What AvatarVertexShader.glsl reads with PRESKINNED
+template <>
+struct VertexLayout<AvatarSkinnedVertex>
+{
+	static constexpr VertexAttributes attributes()
 	{
-		glDepthMask(GL_TRUE);
-		glColorMaski(0, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-		glDrawElements(GL_TRIANGLES, (GLsizei)data->elementCount, GL_UNSIGNED_SHORT, 0);
-		glDepthFunc(GL_EQUAL);
+		return { 5, {
+			{ 0, 3, GL_FLOAT, GL_FALSE, false, offsetof(AvatarSkinnedVertex, position), GL_FLOAT_VEC3, "position" },
+			{ 1, 3, GL_FLOAT, GL_FALSE, false, offsetof(AvatarSkinnedVertex, normal), GL_FLOAT_VEC3, "normal" },
+			{ 2, 4, GL_FLOAT, GL_FALSE, false, offsetof(AvatarSkinnedVertex, tangent), GL_FLOAT_VEC4, "tangent" },
+			{ 3, 2, GL_FLOAT, GL_FALSE, false, offsetof(AvatarSkinnedVertex, uv), GL_FLOAT_VEC2, "texCoord" },
+			{ 6, 3, GL_FLOAT, GL_FALSE, false, offsetof(AvatarSkinnedVertex, objPosition), GL_FLOAT_VEC3, "objPosition" },
+		} };
 	}
-	glDepthMask(GL_FALSE);
+};
 
-	// Draw the mesh
-	glColorMaski(0, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-	glDrawElements(GL_TRIANGLES, (GLsizei)data->elementCount, GL_UNSIGNED_SHORT, 0);
-	glBindVertexArray(0);
+// Where the driver links the pre-skin program and --no-preskin didn't turn it off, every skinned part is skinned
+// once per frame by AvatarSkinShader.glsl into one buffer, and all passes after (both eyes, self-occluding depth,
+// projectors, the mirror) draw it as static geometry instead of skinning each vertex again per draw.
+struct AvatarPreskin {
+	GLuint program;
+	GLuint buffer;
+	// Vertices there is room for in buffer
+	size_t capacity;
+	// Vertex arrays over buffer, one per index page, dropped whenever buffer grows
+	std::vector<AvatarVertexArray> vertexArrays;
+};
 
-	glm::mat4 local;
-	_glmFromOvrAvatarTransform(mesh->localTransform, &local);
-	glDepthFunc(GL_ALWAYS);
-	_renderPose(proj * view * world * local, mesh->skinnedPose, isRight);
-}
+static AvatarPreskin _avatarPreskin;
+static bool _preskinAllowed = true;
+static bool _preskinAvatars = false;
 
-static void _renderProjector(const ovrAvatarRenderPart_ProjectorRender* projector, ovrAvatar* avatar, uint32_t visibilityMask, const glm::mat4& world, const glm::mat4& view, const glm::mat4 proj, const glm::vec3& viewPos)
+static GLuint _avatarSkinnedVertexArray(GLuint elementBuffer)
 {
-
-	// Compute the mesh transform
-	const ovrAvatarComponent* component = ovrAvatarComponent_Get(avatar, projector->componentIndex);
-	const ovrAvatarRenderPart* renderPart = component->renderParts[projector->renderPartIndex];
-	const ovrAvatarRenderPart_SkinnedMeshRender* mesh = ovrAvatarRenderPart_GetSkinnedMeshRender(renderPart);
-
-	// If this part isn't visible from the viewpoint we're rendering from, do nothing
-	if ((mesh->visibilityMask & visibilityMask) == 0)
+	for (const AvatarVertexArray& a : _avatarPreskin.vertexArrays)
 	{
-		return;
+		if (a.elementBuffer == elementBuffer)
+			return a.vertexArray;
 	}
 
-	// Compute the projection matrix
-	glm::mat4 projection;
-	_glmFromOvrAvatarTransform(projector->localTransform, &projection);
-	glm::mat4 worldProjection = world * projection;
-	glm::mat4 projectionInv = glm::inverse(worldProjection);
-
-	// Compute the mesh transform
-	glm::mat4 meshWorld;
-	_glmFromOvrAvatarTransform(component->transform, &meshWorld);
-
-	// Get the GL mesh data for this mesh's asset
-	MeshData* data = (MeshData*)_assetMap[mesh->meshAssetID];
-
-	glUseProgram(_skinnedMeshProgram);
-
-	// Apply the vertex state
-	_setMeshState(_skinnedMeshProgram, mesh->localTransform, data, mesh->skinnedPose, meshWorld, view, proj, viewPos);
-
-	// Apply the material state
-	_setMaterialState(_skinnedMeshProgram, &projector->materialState, &projectionInv);
+	AvatarVertexArray a = { _avatarPreskin.buffer, elementBuffer, 0 };
+	glGenVertexArrays(1, &a.vertexArray);
+	_glState.bindVertexArray(a.vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, _avatarPreskin.buffer);
+	_setVertexAttributes<AvatarSkinnedVertex>();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+	_glState.bindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	_avatarPreskin.vertexArrays.push_back(a);
+	return a.vertexArray;
+}
 
-	// Draw the mesh
-	glBindVertexArray(data->vertexArray);
-	glDepthMask(GL_FALSE);
-	glDepthFunc(GL_EQUAL);
-	glDrawElements(GL_TRIANGLES, (GLsizei)data->elementCount, GL_UNSIGNED_SHORT, 0);
-	glBindVertexArray(0);
+// Runs the next step of a mesh upload, true once the mesh is complete
+static bool _uploadMeshStep(AvatarUploadJob& job)
+{
+	const ovrAvatarMeshAssetData* data = job.meshData;
+	MeshData* mesh = job.mesh;
+	switch (job.step++)
+	{
+	case 0:
+	{
+		// The shared vertex array's attributes start at the top of the page, so the vertices go at the first whole
+		// vertex past where the block starts; one vertex of slack makes room for that
+		const size_t size = data->vertexCount * sizeof(AvatarPackedVertex);
+		mesh->vertexBlock = _gpuArena.allocate((GLsizeiptr)(size + sizeof(AvatarPackedVertex)));
+		mesh->baseVertex = (GLint)((mesh->vertexBlock.offset + sizeof(AvatarPackedVertex) - 1) / sizeof(AvatarPackedVertex));
+		_copyToAvatarBuffer(mesh->vertexBlock.buffer, (GLintptr)mesh->baseVertex * sizeof(AvatarPackedVertex), job.packedVertices, size);
+		mesh->vertexCount = data->vertexCount;
+		if (!job.cached)
+		{
+			delete[] job.packedVertices;
+		}
+		job.packedVertices = nullptr;
+		return false;
+	}
+	default:
+		// 16 bit indices stay enough, they count from baseVertex rather than from the top of the page
+		mesh->elementBlock = _uploadAvatarBlock(data->indexBuffer, data->indexCount * sizeof(GLushort));
+		mesh->vertexArray = _avatarVertexArray(mesh->vertexBlock.buffer, mesh->elementBlock.buffer);
+		mesh->elementCount = data->indexCount;
+		return true;
+	}
 }
 
-static void _renderAvatar(ovrAvatar* avatar, uint32_t visibilityMask, const glm::mat4& view, const glm::mat4& proj, const glm::vec3& viewPos, bool renderJoints)
+// The GL internal format of an avatar texture format, 0 for ones we don't load
+static GLenum _avatarTextureFormat(ovrAvatarTextureFormat format)
 {
-	// Traverse over all components on the avatar
-	uint32_t componentCount = ovrAvatarComponent_Count(avatar);
-	//printf("%zu", componentCount);
-	for (uint32_t i = 4; i < 6; ++i)
+	switch (format)
 	{
-		const ovrAvatarComponent* component = ovrAvatarComponent_Get(avatar, i);
-		bool isRight = false;
+	case ovrAvatarTextureFormat_RGB24:
+		return GL_RGB8;
+	case ovrAvatarTextureFormat_DXT1:
+		return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	case ovrAvatarTextureFormat_DXT5:
+		return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	default:
+		return 0;
+	}
+}
 
-		//printf("%s\n", component->name);
+// Bytes of one width by height level of one layer
+static GLsizei _avatarTextureLevelSize(GLenum format, uint32_t width, uint32_t height)
+{
+	if (format == GL_RGB8)
+	{
+		return width * height * 3;
+	}
+	const int blockSize = format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 8 : 16;
+	return (width < 4 || height < 4) ? blockSize : blockSize * (width / 4) * (height / 4);
+}
 
-		if (i == 5) {
-			isRight = true;
+// Puts texture in a free layer of a page of this shape, making a new page once all of them are full. Pages get
+// immutable storage through glTexStorage3D where GL_ARB_texture_storage is there, every level allocated up front
+// otherwise. The page is left bound to unit 0.
+static void _allocateAvatarTextureLayer(GLenum format, uint32_t width, uint32_t height, uint32_t mipCount, TextureData* texture)
+{
+	for (size_t i = 0; i < _avatarTexturePages.size(); ++i)
+	{
+		AvatarTexturePage& page = _avatarTexturePages[i];
+		if (page.format == format && page.width == width && page.height == height && page.mipCount == mipCount &&
+			page.layers != (1u << AVATAR_TEXTURE_ARRAY_LAYERS) - 1)
+		{
+			GLint layer = 0;
+			while (page.layers & (1u << layer))
+			{
+				++layer;
+			}
+			page.layers |= 1u << layer;
+			texture->arrayID = page.texture;
+			texture->layer = layer;
+			texture->handle = page.handle;
+			_glState.selectTextureArray(0, page.texture);
+			return;
 		}
+	}
 
-		// Compute the transform for this component
-		glm::mat4 world;
-		_glmFromOvrAvatarTransform(component->transform, &world);
-
-		// Render each rebder part attached to the component
-		for (uint32_t j = 0; j < component->renderPartCount; ++j)
+	AvatarTexturePage page = { format, width, height, mipCount, 0, 0, 0, 0 };
+	for (uint32_t level = 0; level < mipCount; ++level)
+	{
+		page.bytes += (int64_t)_avatarTextureLevelSize(format, std::max(1u, width >> level), std::max(1u, height >> level)) * AVATAR_TEXTURE_ARRAY_LAYERS;
+	}
+	_gpuMemory.charge(GpuMemoryCategory::Textures, page.bytes);
+	glGenTextures(1, &page.texture);
+	_glState.selectTextureArray(0, page.texture);
+	_glLabel(GL_TEXTURE, page.texture, "avatar texture page");
+	if (GLEW_ARB_texture_storage)
+	{
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, mipCount, format, width, height, AVATAR_TEXTURE_ARRAY_LAYERS);
+	}
+	else
+	{
+		for (uint32_t level = 0; level < mipCount; ++level)
 		{
-			
-			const ovrAvatarRenderPart* renderPart = component->renderParts[j];
-			ovrAvatarRenderPartType type = ovrAvatarRenderPart_GetType(renderPart);
-			switch (type)
+			const uint32_t levelWidth = std::max(1u, width >> level);
+			const uint32_t levelHeight = std::max(1u, height >> level);
+			if (format == GL_RGB8)
 			{
-			case ovrAvatarRenderPartType_SkinnedMeshRender:
-				_renderSkinnedMeshPart(ovrAvatarRenderPart_GetSkinnedMeshRender(renderPart), visibilityMask, world, view, proj, viewPos, isRight);
-				break;
-			case ovrAvatarRenderPartType_SkinnedMeshRenderPBS:
-				_renderSkinnedMeshPartPBS(ovrAvatarRenderPart_GetSkinnedMeshRenderPBS(renderPart), visibilityMask, world, view, proj, viewPos, isRight);
-				break;
-			case ovrAvatarRenderPartType_ProjectorRender:
-				_renderProjector(ovrAvatarRenderPart_GetProjectorRender(renderPart), avatar, visibilityMask, world, view, proj, viewPos);
-				break;
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, levelWidth, levelHeight, AVATAR_TEXTURE_ARRAY_LAYERS, 0, GL_BGR, GL_UNSIGNED_BYTE, NULL);
+			}
+			else
+			{
+				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, levelWidth, levelHeight, AVATAR_TEXTURE_ARRAY_LAYERS, 0,
+					_avatarTextureLevelSize(format, levelWidth, levelHeight) * AVATAR_TEXTURE_ARRAY_LAYERS, NULL);
 			}
 		}
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, mipCount - 1);
 	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// The handle freezes the sampling state set above, the contents are still uploaded level by level after
+	if (_bindlessTextures)
+	{
+		page.handle = glGetTextureHandleARB(page.texture);
+		glMakeTextureHandleResidentARB(page.handle);
+	}
+	page.layers = 1;
+	texture->arrayID = page.texture;
+	texture->layer = 0;
+	texture->handle = page.handle;
+	_avatarTexturePages.push_back(page);
 }
 
-static void _updateAvatar(
-	ovrAvatar* avatar,
-	float deltaSeconds,
-	const ovrAvatarTransform& hmd,
-	const ovrAvatarHandInputState& left,
-	const ovrAvatarHandInputState& right,
-	ovrMicrophone* mic,
-	ovrAvatarPacket* packet,
-	float* packetPlaybackTime
-) {
-	if (packet)
+// The black array bindless materials sample for textures that aren't loaded
+static void _initAvatarBlankTexture()
+{
+	const uint8_t black[4] = { 0, 0, 0, 255 };
+	glGenTextures(1, &_avatarBlankTexture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _avatarBlankTexture);
+	_glLabel(GL_TEXTURE, _avatarBlankTexture, "avatar blank");
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, black);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	_avatarBlankHandle = glGetTextureHandleARB(_avatarBlankTexture);
+	glMakeTextureHandleResidentARB(_avatarBlankHandle);
+}
+
+// Uploads the next mip level of a texture into its array layer through the pixel unpack buffer, true once every
+// level is in
+static bool _uploadTextureStep(AvatarUploadJob& job)
+{
+	const ovrAvatarTextureAssetData* data = job.textureData;
+	const GLenum format = _avatarTextureFormat(data->format);
+	if (job.step == 0)
 	{
-		float packetDuration = ovrAvatarPacket_GetDurationSeconds(packet);
-		*packetPlaybackTime += deltaSeconds;
-		if (*packetPlaybackTime > packetDuration)
+		job.texture = new TextureData();
+		job.texture->arrayID = 0;
+		job.texture->layer = 0;
+		job.texture->handle = 0;
+		job.width = data->sizeX;
+		job.height = data->sizeY;
+		job.offset = 0;
+		if (!format)
 		{
-			ovrAvatarPose_Finalize(avatar, 0.0f);
-			*packetPlaybackTime = 0;
+			return true;
 		}
-		ovrAvatar_UpdatePoseFromPacket(avatar, packet, *packetPlaybackTime);
+		_allocateAvatarTextureLayer(format, data->sizeX, data->sizeY, data->mipCount, job.texture);
 	}
 	else
 	{
-		//// If we have a mic update the voice visualization
-		//if (mic)
-		//{
-		//	float micSamples[48000];
-		//	size_t sampleCount = ovr_Microphone_ReadData(mic, micSamples, sizeof(micSamples) / sizeof(micSamples[0]));
-		//	if (sampleCount > 0)
-		//	{
-		//		ovrAvatarPose_UpdateVoiceVisualization(_avatar, (uint32_t)sampleCount, micSamples);
-		//	}
-		//}
-
-		// Update the avatar pose from the inputs
-		ovrAvatarPose_UpdateBody(avatar, hmd);
-		ovrAvatarPose_UpdateHands(avatar, left, right);
+		_glState.selectTextureArray(0, job.texture->arrayID);
 	}
-	ovrAvatarPose_Finalize(avatar, deltaSeconds);
-}
-
-
-/************************************************************************************
-* OVR helpers
-************************************************************************************/
-
-//static ovrSession _initOVR()
-//{
-//	ovrSession ovr;
-//	if (OVR_SUCCESS(ovr_Initialize(NULL)))
-//	{
-//		ovrGraphicsLuid luid;
-//		if (OVR_SUCCESS(ovr_Create(&ovr, &luid)))
-//		{
-//			return ovr;
-//		}
-//		ovr_Shutdown();
-//	}
-//	return NULL;
-//}
-//
-//static void _destroyOVR(ovrSession session)
-//{
-//	if (session)
-//	{
-//		ovr_Destroy(session);
-//		ovr_Shutdown();
-//	}
-//}
 
-/************************************************************************************
-* Avatar message handlers
-************************************************************************************/
+	uint32_t level = job.step++;
+	if (level < data->mipCount)
+	{
+		GLsizei levelSize = _avatarTextureLevelSize(format, job.width, job.height);
+		const GLintptr staged = _stageAvatarData(GL_PIXEL_UNPACK_BUFFER, data->textureData + job.offset, levelSize);
+		if (format == GL_RGB8)
+		{
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, job.texture->layer, job.width, job.height, 1, GL_BGR, GL_UNSIGNED_BYTE, (const void*)staged);
+		}
+		else
+		{
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, job.texture->layer, job.width, job.height, 1, format, levelSize, (const void*)staged);
+		}
+		_releaseAvatarStaging();
+		job.offset += levelSize;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		job.width = std::max(1u, job.width / 2);
+		job.height = std::max(1u, job.height / 2);
+	}
+	return job.step >= data->mipCount;
+}
 
-static void _handleAvatarSpecification(const ovrAvatarMessage_AvatarSpecification* message)
+// Render thread: hands the pump a request, it runs the next time the pump is kicked
+static void _requestAvatarPump(const AvatarPumpRequest& request)
 {
-	// Create the avatar instance
-	_avatar = ovrAvatar_Create(message->avatarSpec, ovrAvatarCapability_All);
-
-	// Trigger load operations for all of the assets referenced by the avatar
-	uint32_t refCount = ovrAvatar_GetReferencedAssetCount(_avatar);
-	for (uint32_t i = 0; i < refCount; ++i)
+	if (!_avatarRequestBacklog.empty() || !_avatarPumpRequests.push(request))
 	{
-		ovrAvatarAssetID id = ovrAvatar_GetReferencedAsset(_avatar, i);
-		ovrAvatarAsset_BeginLoading(id);
-		++_loadingAssets;
+		_avatarRequestBacklog.push_back(request);
 	}
-	printf("Loading %d assets...\r\n", _loadingAssets);
 }
 
-static void _handleAssetLoaded(const ovrAvatarMessage_AssetLoaded* message)
+// Render thread: moves what the pump's queue now has room for in, in order, then kicks it
+static void _kickAvatarPump()
 {
-	// Determine the type of the asset that got loaded
-	ovrAvatarAssetType assetType = ovrAvatarAsset_GetType(message->asset);
-	void* data = nullptr;
-
-	// Call the appropriate loader function
-	switch (assetType)
+	while (!_avatarRequestBacklog.empty() && _avatarPumpRequests.push(_avatarRequestBacklog.front()))
 	{
-	case ovrAvatarAssetType_Mesh:
-		data = _loadMesh(ovrAvatarAsset_GetMeshData(message->asset));
-		break;
-	case ovrAvatarAssetType_Texture:
-		data = _loadTexture(ovrAvatarAsset_GetTextureData(message->asset));
-		break;
+		_avatarRequestBacklog.pop_front();
 	}
-
-	// Store the data that we loaded for the asset in the asset map
-	_assetMap[message->assetID] = data;
-	--_loadingAssets;
-	printf("Loading %d assets...\r\n", _loadingAssets);
+	_avatarPump.kick();
 }
 
-namespace ovr {
-
-	// Convenience method for looping over each eye with a lambda
-	template <typename Function>
-	inline void for_each_eye(Function function) {
-		for (ovrEyeType eye = ovrEyeType::ovrEye_Left;
-			eye < ovrEyeType::ovrEye_Count;
-			eye = static_cast<ovrEyeType>(eye + 1)) {
-			function(eye);
+// The mesh and texture assets the render parts of component draw with, meshes first
+static void _avatarComponentAssets(const ovrAvatarComponent* component, std::vector<ovrAvatarAssetID>* ids)
+{
+	for (uint32_t i = 0; i < component->renderPartCount; ++i)
+	{
+		const ovrAvatarRenderPart* renderPart = component->renderParts[i];
+		const ovrAvatarMaterialState* state = nullptr;
+		switch (ovrAvatarRenderPart_GetType(renderPart))
+		{
+		case ovrAvatarRenderPartType_SkinnedMeshRender:
+			ids->push_back(ovrAvatarRenderPart_GetSkinnedMeshRender(renderPart)->meshAssetID);
+			state = &ovrAvatarRenderPart_GetSkinnedMeshRender(renderPart)->materialState;
+			break;
+		case ovrAvatarRenderPartType_SkinnedMeshRenderPBS:
+		{
+			const ovrAvatarRenderPart_SkinnedMeshRenderPBS* mesh = ovrAvatarRenderPart_GetSkinnedMeshRenderPBS(renderPart);
+			ids->push_back(mesh->meshAssetID);
+			ids->push_back(mesh->albedoTextureAssetID);
+			ids->push_back(mesh->surfaceTextureAssetID);
+			break;
+		}
+		default:
+			break;
+		}
+		if (state)
+		{
+			const ovrAvatarAssetID maps[4] = { state->alphaMaskTextureID, state->normalMapTextureID, state->parallaxMapTextureID, state->roughnessMapTextureID };
+			ids->insert(ids->end(), maps, maps + 4);
+			for (uint32_t layer = 0; layer < state->layerCount && layer < OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT; ++layer)
+			{
+				ids->push_back(state->layers[layer].sampleTexture);
+			}
 		}
 	}
+}
 
-	inline mat4 toGlm(const ovrMatrix4f & om) {
-		return glm::transpose(glm::make_mat4(&om.M[0][0]));
+// Pump thread: the specification's avatar and the assets it needs, the render thread decides which to load
+static AvatarPumpResult _prepareAvatarSpecification(const ovrAvatarMessage_AvatarSpecification* message)
+{
+	AvatarPumpResult result;
+	result.kind = AvatarPumpResultKind::Specification;
+	result.userID = message->oculusUserID;
+	result.avatar = ovrAvatar_Create(message->avatarSpec, _avatarCapabilities);
+	const uint32_t refCount = ovrAvatar_GetReferencedAssetCount(result.avatar);
+	for (uint32_t i = 0; i < refCount; ++i)
+	{
+		result.assets.push_back(ovrAvatar_GetReferencedAsset(result.avatar, i));
 	}
 
-	inline mat4 toGlm(const ovrFovPort & fovport, float nearPlane = 0.01f, float farPlane = 10000.0f) {
-		return toGlm(ovrMatrix4f_Projection(fovport, nearPlane, farPlane, true));
+	// The hands' meshes and textures go first, they are what the player looks at and they draw as soon as they're in
+	std::vector<ovrAvatarAssetID> handAssets;
+	const ovrAvatarHandComponent* hands[2] = { ovrAvatarPose_GetLeftHandComponent(result.avatar), ovrAvatarPose_GetRightHandComponent(result.avatar) };
+	for (int i = 0; i < 2; ++i)
+	{
+		if (hands[i] && hands[i]->renderComponent)
+		{
+			_avatarComponentAssets(hands[i]->renderComponent, &handAssets);
+		}
 	}
+	std::stable_partition(result.assets.begin(), result.assets.end(), [&handAssets](ovrAvatarAssetID id) {
+		return std::find(handAssets.begin(), handAssets.end(), id) != handAssets.end();
+	});
+	return result;
+}
 
-	inline vec3 toGlm(const ovrVector3f & ov) {
-		return glm::make_vec3(&ov.x);
+// Pump thread: compares what the SDK delivered with the avatar cache, and writes the cache file if there is none yet
+// or it holds something else. Leaves job.cacheCurrent set when the file was already right.
+static void _storeAvatarAsset(AvatarUploadJob& job)
+{
+	AllocationTagScope tagScope(AllocationTag::AvatarAssets);
+	AvatarCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.type = (uint32_t)job.type;
+	header.assetID = job.assetID;
+	AvatarCacheSection sections[3];
+	int sectionCount = 0;
+	if (job.type == ovrAvatarAssetType_Mesh)
+	{
+		const ovrAvatarMeshAssetData* data = job.meshData;
+		header.sourceHash = _avatarCacheHash(data->vertexBuffer, data->vertexCount * sizeof(ovrAvatarMeshVertex));
+		header.sourceHash = _avatarCacheHash(data->indexBuffer, data->indexCount * sizeof(uint16_t), header.sourceHash);
+		header.sourceHash = _avatarCacheHash(&data->skinnedBindPose, sizeof(data->skinnedBindPose), header.sourceHash);
+		header.counts[0] = data->vertexCount;
+		header.counts[1] = data->indexCount;
+		header.counts[2] = data->skinnedBindPose.jointCount;
+		sections[sectionCount++] = { job.mesh->bindPose, data->skinnedBindPose.jointCount * sizeof(glm::mat4) };
+		sections[sectionCount++] = { job.packedVertices, data->vertexCount * sizeof(AvatarPackedVertex) };
+		sections[sectionCount++] = { data->indexBuffer, data->indexCount * sizeof(uint16_t) };
 	}
-
-	inline vec2 toGlm(const ovrVector2f & ov) {
-		return glm::make_vec2(&ov.x);
+	else if (job.type == ovrAvatarAssetType_Texture)
+	{
+		const ovrAvatarTextureAssetData* data = job.textureData;
+		header.counts[0] = (uint32_t)data->format;
+		header.counts[1] = data->sizeX;
+		header.counts[2] = data->sizeY;
+		header.counts[3] = data->mipCount;
+		header.sourceHash = _avatarCacheHash(header.counts, sizeof(header.counts));
+		header.sourceHash = _avatarCacheHash(data->textureData, (size_t)data->textureDataSize, header.sourceHash);
+		sections[sectionCount++] = { data->textureData, (size_t)data->textureDataSize };
 	}
-
-	inline uvec2 toGlm(const ovrSizei & ov) {
-		return uvec2(ov.w, ov.h);
+	else
+	{
+		return;
 	}
 
-	inline quat toGlm(const ovrQuatf & oq) {
-		return glm::make_quat(&oq.x);
+	uint64_t storedHash = 0;
+	job.cacheCurrent = _avatarCacheSourceHash(job.assetID, &storedHash) && storedHash == header.sourceHash;
+	if (!job.cacheCurrent && !_storeAvatarCache(header, sections, sectionCount))
+	{
+		printf("Could not cache avatar asset %016llx\r\n", (unsigned long long)job.assetID);
 	}
+}
 
-	inline mat4 toGlm(const ovrPosef & op) {
-		mat4 orientation = glm::mat4_cast(toGlm(op.Orientation));
-		mat4 translation = glm::translate(mat4(), ovr::toGlm(op.Position));
-		return translation * orientation;
+// Pump thread: everything about an asset that doesn't need GL, which for a mesh is its bind pose
+static AvatarPumpResult _prepareAvatarAsset(ovrAvatarMessage* message)
+{
+	const ovrAvatarMessage_AssetLoaded* loaded = ovrAvatarMessage_GetAssetLoaded(message);
+	AvatarPumpResult result;
+	result.kind = AvatarPumpResultKind::Asset;
+	memset(&result.job, 0, sizeof(result.job));
+	AvatarUploadJob& job = result.job;
+	job.message = message;
+	job.assetID = loaded->assetID;
+	job.type = ovrAvatarAsset_GetType(loaded->asset);
+	if (job.type == ovrAvatarAssetType_Mesh)
+	{
+		job.meshData = ovrAvatarAsset_GetMeshData(loaded->asset);
+		job.mesh = new MeshData();
+		_computeWorldPose(job.meshData->skinnedBindPose, job.mesh->bindPose);
+		for (uint32_t i = 0; i < job.meshData->skinnedBindPose.jointCount; ++i)
+		{
+			job.mesh->inverseBindPose[i] = glm::inverse(job.mesh->bindPose[i]);
+			_affineFromMat4(job.mesh->inverseBindPose[i], &job.mesh->inverseBindAffine[i]);
+		}
+		job.packedVertices = new AvatarPackedVertex[job.meshData->vertexCount];
+		_packAvatarVertices(job.meshData->vertexBuffer, job.meshData->vertexCount, job.packedVertices);
 	}
-
-	inline ovrMatrix4f fromGlm(const mat4 & m) {
-		ovrMatrix4f result;
-		mat4 transposed(glm::transpose(m));
-		memcpy(result.M, &(transposed[0][0]), sizeof(float) * 16);
-		return result;
+	else if (job.type == ovrAvatarAssetType_Texture)
+	{
+		job.textureData = ovrAvatarAsset_GetTextureData(loaded->asset);
 	}
-
-	inline ovrVector3f fromGlm(const vec3 & v) {
-		ovrVector3f result;
-		result.x = v.x;
-		result.y = v.y;
-		result.z = v.z;
-		return result;
+	if (_avatarCacheEnabled)
+	{
+		_storeAvatarAsset(job);
 	}
+	return result;
+}
 
-	inline ovrVector2f fromGlm(const vec2 & v) {
-		ovrVector2f result;
-		result.x = v.x;
-		result.y = v.y;
-		return result;
+// Pump thread, once per kick: the render thread's requests first, so loads asked for are under way before the
+// messages are looked at, then every message the SDK has until the results queue fills
+static void _avatarPumpStep()
+{
+	TRACE_ZONE("avatar messages");
+	AllocationTagScope tagScope(AllocationTag::AvatarAssets);
+	AvatarPumpRequest request;
+	while (_avatarPumpRequests.pop(&request))
+	{
+		switch (request.kind)
+		{
+		case AvatarPumpRequestKind::RequestSpecification:
+			ovrAvatar_RequestAvatarSpecification(request.id);
+			break;
+		case AvatarPumpRequestKind::BeginLoading:
+			ovrAvatarAsset_BeginLoading(request.id);
+			break;
+		case AvatarPumpRequestKind::FreeMessage:
+			ovrAvatarMessage_Free(request.message);
+			break;
+		}
 	}
 
-	inline ovrSizei fromGlm(const uvec2 & v) {
-		ovrSizei result;
-		result.w = v.x;
-		result.h = v.y;
-		return result;
+	while (!_avatarResultBacklog.empty() && _avatarPumpResults.push(std::move(_avatarResultBacklog.front())))
+	{
+		_avatarResultBacklog.pop_front();
 	}
-
-	inline ovrQuatf fromGlm(const quat & q) {
-		ovrQuatf result;
-		result.x = q.x;
-		result.y = q.y;
-		result.z = q.z;
-		result.w = q.w;
-		return result;
+	while (_avatarResultBacklog.empty())
+	{
+		ovrAvatarMessage* message = ovrAvatarMessage_Pop();
+		if (!message)
+		{
+			break;
+		}
+		AvatarPumpResult result;
+		switch (ovrAvatarMessage_GetType(message))
+		{
+		case ovrAvatarMessageType_AvatarSpecification:
+			result = _prepareAvatarSpecification(ovrAvatarMessage_GetAvatarSpecification(message));
+			ovrAvatarMessage_Free(message);
+			break;
+		case ovrAvatarMessageType_AssetLoaded:
+			// Freed once the render thread has uploaded the asset
+			result = _prepareAvatarAsset(message);
+			break;
+		default:
+			ovrAvatarMessage_Free(message);
+			continue;
+		}
+		if (!_avatarPumpResults.push(std::move(result)))
+		{
+			_avatarResultBacklog.push_back(std::move(result));
+		}
 	}
 }
 
-class RiftManagerApp {
-protected:
-	ovrSession _session;
-	ovrHmdDesc _hmdDesc;
-	ovrGraphicsLuid _luid;
+// Works through queued uploads until budgetSeconds of wall clock time is used, once per frame
+static void _pumpAvatarUploads(float budgetSeconds)
+{
+	if (_avatarUploadHead == _avatarUploads.size())
+	{
+		return;
+	}
 
-public:
-	RiftManagerApp() {
-		if (!OVR_SUCCESS(ovr_Create(&_session, &_luid))) {
-			FAIL("Unable to create HMD session");
+	const Deadline deadline = Deadline::in(budgetSeconds);
+	do
+	{
+		AvatarUploadJob& job = _avatarUploads[_avatarUploadHead];
+		bool done = false;
+		switch (job.type)
+		{
+		case ovrAvatarAssetType_Mesh:
+			done = _uploadMeshStep(job);
+			if (done)
+			{
+				_avatarAssets.loaded(job.assetID, job.mesh);
+			}
+			break;
+		case ovrAvatarAssetType_Texture:
+			done = _uploadTextureStep(job);
+			if (done)
+			{
+				_avatarAssets.loaded(job.assetID, job.texture);
+			}
+			break;
+		default:
+			_avatarAssets.unsupported(job.assetID);
+			done = true;
+			break;
 		}
-		tempOvrSession = _session;
 
-		_hmdDesc = ovr_GetHmdDesc(_session);
-	}
+		if (done)
+		{
+			if (job.cached)
+			{
+				delete job.cached;
+			}
+			else
+			{
+				_requestAvatarPump({ AvatarPumpRequestKind::FreeMessage, 0, job.message });
+			}
+			++_avatarUploadHead;
+			_hitchRecorder.note(HitchEventKind::AvatarAsset, job.assetID, job.type == ovrAvatarAssetType_Mesh ? "mesh" : "texture");
+			// A replacement was counted when its cached copy went up
+			if (!job.replacesCached)
+			{
+				--_loadingAssets;
+				printf("Loading %d assets...\r\n", _loadingAssets);
+			}
+		}
+	} while (_avatarUploadHead < _avatarUploads.size() && !deadline.passed());
 
-	~RiftManagerApp() {
-		ovr_Destroy(_session);
-		_session = nullptr;
+	if (_avatarUploadHead == _avatarUploads.size())
+	{
+		_avatarUploads.clear();
+		_avatarUploadHead = 0;
 	}
-};
-
-class RiftApp : public GlfwApp, public RiftManagerApp {
-public:
-
-private:
-	GLuint _fbo{ 0 };
-	GLuint _depthBuffer{ 0 };
-	ovrTextureSwapChain _eyeTexture;
-
-	GLuint _mirrorFbo{ 0 };
-	ovrMirrorTexture _mirrorTexture;
+}
 
-	ovrEyeRenderDesc _eyeRenderDescs[2];
 
-	mat4 _eyeProjections[2];
+/************************************************************************************
+* Rendering functions
+************************************************************************************/
 
-	ovrLayerEyeFov _sceneLayer;
-	ovrViewScaleDesc _viewScaleDesc;
+// The array and layer an avatar texture is in, 0 and 0 while it isn't loaded, and the handle of the array or of
+// the blank one
+static void _avatarTextureLayer(ovrAvatarAssetID assetID, GLuint* array, int32_t* layer, GLuint64* handle = nullptr)
+{
+	TextureData* textureData = _avatarAssets.texture(assetID);
+	*array = textureData ? textureData->arrayID : 0;
+	*layer = textureData ? textureData->layer : 0;
+	if (handle)
+	{
+		*handle = textureData && textureData->handle ? textureData->handle : _avatarBlankHandle;
+	}
+}
 
-	uvec2 _renderTargetSize;
-	uvec2 _mirrorSize;
+static void _setTextureSampler(GLuint program, int textureUnit, const char uniformName[], const char layerName[], ovrAvatarAssetID assetID)
+{
+	GLuint array;
+	int32_t layer;
+	_avatarTextureLayer(assetID, &array, &layer);
+	_glState.bindTextureArray(textureUnit, array);
+	glUniform1i(glGetUniformLocation(program, uniformName), textureUnit);
+	glUniform1i(glGetUniformLocation(program, layerName), layer);
+}
 
-public:
+// Points the MeshPose block at this part's palette in the pose cache
+static void _bindAvatarPose(const ovrAvatarSkinnedMeshPose& skinnedPose)
+{
+	const uint32_t* block = _avatarPoses.blockOf.find((uintptr_t)&skinnedPose);
+	if (block)
+	{
+		GLintptr offset = (GLintptr)(*block * _avatarPoses.blockStride * sizeof(glm::mat4));
+		glBindBufferRange(GL_UNIFORM_BUFFER, AVATAR_POSE_BINDING, _avatarPoses.buffer, offset, sizeof(glm::mat4) * OVR_AVATAR_MAXIMUM_JOINT_COUNT);
+	}
+}
 
-	RiftApp() {
-		using namespace ovr;
-		_viewScaleDesc.HmdSpaceToWorldScaleInMeters = 1.0f;
+// The final world and viewProjection matrices of a part, the world view position is for view-dependent rendering
+static void _fillAvatarTransformBlock(const ovrAvatarTransform& localTransform, const glm::mat4& world, const glm::mat4& viewProj,
+	const glm::vec3& viewPos, AvatarTransformBlock* block)
+{
+	glm::mat4 local;
+	_glmFromOvrAvatarTransform(localTransform, &local);
+	block->world = world * local;
+	block->viewProj = viewProj;
+	block->viewPos = glm::vec4(viewPos, 1.0f);
+}
 
-		memset(&_sceneLayer, 0, sizeof(ovrLayerEyeFov));
-		_sceneLayer.Header.Type = ovrLayerType_EyeFov;
-		_sceneLayer.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft;
+static void _setMeshState(
+	const ovrAvatarTransform& localTransform,
+	const ovrAvatarSkinnedMeshPose& skinnedPose,
+	const glm::mat4& world,
+	const glm::mat4& viewProj,
+	const glm::vec3& viewPos
+) {
+	AvatarTransformBlock block;
+	_fillAvatarTransformBlock(localTransform, world, viewProj, viewPos, &block);
+	_uniformRing.push(AVATAR_TRANSFORM_BINDING, &block, sizeof(block));
+	if (!_preskinAvatars)
+	{
+		_bindAvatarPose(skinnedPose);
+	}
+}
 
-		ovr::for_each_eye([&](ovrEyeType eye) {
-			ovrEyeRenderDesc& erd = _eyeRenderDescs[eye] = ovr_GetRenderDesc(_session, eye, _hmdDesc.DefaultEyeFov[eye]);
-			ovrMatrix4f ovrPerspectiveProjection =
-				ovrMatrix4f_Projection(erd.Fov, 0.01f, 1000.0f, ovrProjection_ClipRangeOpenGL);
-			_eyeProjections[eye] = ovr::toGlm(ovrPerspectiveProjection);
-			_viewScaleDesc.HmdToEyeOffset[eye] = erd.HmdToEyeOffset;
+static glm::vec4 _glmFromOvrAvatarVector(const ovrAvatarVector4f& v)
+{
+	return glm::vec4(v.x, v.y, v.z, v.w);
+}
 
-			ovrFovPort & fov = _sceneLayer.Fov[eye] = _eyeRenderDescs[eye].Fov;
-			auto eyeSize = ovr_GetFovTextureSize(_session, eye, fov, 1.0f);
-			_sceneLayer.Viewport[eye].Size = eyeSize;
-			_sceneLayer.Viewport[eye].Pos = { (int)_renderTargetSize.x, 0 };
+// Builds the std140 image of a material, unused layers stay zero
+// Whether the fragment shader can put out an alpha below 1 for state: through the alpha mask, the base color or its mask
+static bool _avatarMaterialBlends(const ovrAvatarMaterialState& state)
+{
+	return state.alphaMaskTextureID != 0 || state.baseColor.w < 1.0f || state.baseMaskType != ovrAvatarMaterialMaskType_None;
+}
 
-			_renderTargetSize.y = std::max(_renderTargetSize.y, (uint32_t)eyeSize.h);
-			_renderTargetSize.x += eyeSize.w;
-		});
-		// Make the on screen window 1/4 the resolution of the render target
-		_mirrorSize = _renderTargetSize;
-		_mirrorSize /= 4;
+static void _fillAvatarMaterialBlock(const ovrAvatarMaterialState& state, const glm::mat4* projectorInv, const AvatarMaterialTextures& textures,
+	AvatarMaterialBlock* block)
+{
+	memset(block, 0, sizeof(*block));
+	block->baseColor = _glmFromOvrAvatarVector(state.baseColor);
+	block->baseMaskParameters = _glmFromOvrAvatarVector(state.baseMaskParameters);
+	block->baseMaskAxis = _glmFromOvrAvatarVector(state.baseMaskAxis);
+	block->alphaMaskScaleOffset = _glmFromOvrAvatarVector(state.alphaMaskScaleOffset);
+	block->normalMapScaleOffset = _glmFromOvrAvatarVector(state.normalMapScaleOffset);
+	block->parallaxMapScaleOffset = _glmFromOvrAvatarVector(state.parallaxMapScaleOffset);
+	block->roughnessMapScaleOffset = _glmFromOvrAvatarVector(state.roughnessMapScaleOffset);
+	block->projectorInv = projectorInv ? *projectorInv : glm::mat4(1.0f);
+	block->baseMaskType = state.baseMaskType;
+	block->layerCount = state.layerCount;
+	block->useAlpha = state.alphaMaskTextureID != 0;
+	block->useNormalMap = state.normalMapTextureID != 0;
+	block->useRoughnessMap = state.roughnessMapTextureID != 0;
+	block->useProjector = projectorInv != nullptr;
+	for (uint32_t i = 0; i < state.layerCount && i < OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT; ++i)
+	{
+		const ovrAvatarMaterialLayerState& layerState = state.layers[i];
+		block->layerSamplerModes[i].value = layerState.sampleMode;
+		block->layerBlendModes[i].value = layerState.blendMode;
+		block->layerMaskTypes[i].value = layerState.maskType;
+		block->layerColors[i] = _glmFromOvrAvatarVector(layerState.layerColor);
+		block->layerSurfaceScaleOffsets[i] = _glmFromOvrAvatarVector(layerState.sampleScaleOffset);
+		block->layerSampleParameters[i] = _glmFromOvrAvatarVector(layerState.sampleParameters);
+		block->layerMaskParameters[i] = _glmFromOvrAvatarVector(layerState.maskParameters);
+		block->layerMaskAxes[i] = _glmFromOvrAvatarVector(layerState.maskAxis);
 	}
-
-protected:
-	GLFWwindow * createRenderingTarget(uvec2 & outSize, ivec2 & outPosition) override {
-		return glfw::createWindow(_mirrorSize);
+	for (int i = 0; i < 4; ++i)
+	{
+		block->mapLayers[i] = textures.layers[i];
 	}
+	for (int i = 0; i < OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT; ++i)
+	{
+		block->layerSurfaceLayers[i].value = textures.layers[4 + i];
+	}
+	for (int i = 0; i < AVATAR_TEXTURE_SLOTS; ++i)
+	{
+		block->textureHandles[i] = _bindlessTextures ? textures.handles[i] : 0;
+	}
+}
 
-	void initGl() override {
-		GlfwApp::initGl();
-
-		// Compile the reference shaders
-		char errorBuffer[512];
-		_skinnedMeshProgram = _compileProgramFromFiles("AvatarVertexShader.glsl", "AvatarFragmentShader.glsl", sizeof(errorBuffer), errorBuffer);
-		if (!_skinnedMeshProgram) {
-			FAIL("Unable to _compileProgramFromFiles");
-		}
-		_skinnedMeshPBSProgram = _compileProgramFromFiles("AvatarVertexShader.glsl", "AvatarFragmentShaderPBS.glsl", sizeof(errorBuffer), errorBuffer);
-		if (!_skinnedMeshPBSProgram) {
-			FAIL("Unable to count swap chain textures");
-		}
-
-		const char debugLineVertexShader[] =
-			"#version 330 core\n"
-			"layout (location = 0) in vec3 position;\n"
-			"layout (location = 1) in vec4 color;\n"
-			"out vec4 vertexColor;\n"
-			"uniform mat4 worldViewProj;\n"
-			"void main() {\n"
-			"    gl_Position = worldViewProj * vec4(position, 1.0);\n"
-			"    vertexColor = color;\n"
-			"}";
-
-		const char debugLineFragmentShader[] =
-			"#version 330 core\n"
-			"in vec4 vertexColor;\n"
-			"out vec4 fragmentColor;\n"
-			"void main() {\n"
-			"    fragmentColor = vertexColor;"
-			"}";
-
-		_debugLineProgram = _compileProgramFromSource(debugLineVertexShader, debugLineFragmentShader, sizeof(errorBuffer), errorBuffer);
-		if (!_debugLineProgram) {
-			FAIL("Unable to compile _debugLineProgram");
-		}
-
-		glGenVertexArrays(1, &_debugVertexArray);
-		glGenBuffers(1, &_debugVertexBuffer);
-
-		// Disable the v-sync for buffer swap
-		glfwSwapInterval(0);
+// Points the AvatarMaterial block, or the block at binding, at this material's slot, re-uploading the slot only if
+// the material differs from what was last written there. In steady state that is a memcmp and a bind per draw.
+static void _bindAvatarMaterial(const ovrAvatarMaterialState& state, const glm::mat4* projectorInv, const AvatarMaterialTextures& textures,
+	GLuint binding = AVATAR_MATERIAL_BINDING)
+{
+	AvatarMaterialCache& cache = _avatarMaterials;
+	if (!cache.buffer)
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		cache.stride = (sizeof(AvatarMaterialBlock) + alignment - 1) / alignment * alignment;
+		glGenBuffers(1, &cache.buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, cache.buffer);
+		_glLabel(GL_BUFFER, cache.buffer, "avatar materials");
+	}
 
-		ovrTextureSwapChainDesc desc = {};
-		desc.Type = ovrTexture_2D;
-		desc.ArraySize = 1;
-		desc.Width = _renderTargetSize.x;
-		desc.Height = _renderTargetSize.y;
-		desc.MipLevels = 1;
-		desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
-		desc.SampleCount = 1;
-		desc.StaticImage = ovrFalse;
-		ovrResult result = ovr_CreateTextureSwapChainGL(_session, &desc, &_eyeTexture);
-		_sceneLayer.ColorTexture[0] = _eyeTexture;
-		if (!OVR_SUCCESS(result)) {
-			FAIL("Failed to create swap textures");
+	size_t slot = 0;
+	while (slot < cache.entries.size() && cache.entries[slot].key != &state)
+	{
+		++slot;
+	}
+	if (slot == cache.entries.size())
+	{
+		// Render part memory is owned by the SDK. If it keeps moving, start over rather than grow forever.
+		if (slot >= AVATAR_MATERIAL_MAX_SLOTS)
+		{
+			cache.entries.clear();
+			slot = 0;
 		}
+		AvatarMaterialEntry entry;
+		entry.key = &state;
+		entry.valid = false;
+		cache.entries.push_back(entry);
+	}
 
-		int length = 0;
-		result = ovr_GetTextureSwapChainLength(_session, _eyeTexture, &length);
-		if (!OVR_SUCCESS(result) || !length) {
-			FAIL("Unable to count swap chain textures");
-		}
-		for (int i = 0; i < length; ++i) {
-			GLuint chainTexId;
-			ovr_GetTextureSwapChainBufferGL(_session, _eyeTexture, i, &chainTexId);
-			glBindTexture(GL_TEXTURE_2D, chainTexId);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindBuffer(GL_UNIFORM_BUFFER, cache.buffer);
+	if (cache.entries.size() > cache.capacity)
+	{
+		cache.capacity = std::max<size_t>(16, cache.capacity * 2);
+		glBufferData(GL_UNIFORM_BUFFER, cache.capacity * cache.stride, NULL, GL_DYNAMIC_DRAW);
+		for (size_t i = 0; i < cache.entries.size(); ++i)
+		{
+			cache.entries[i].valid = false;
 		}
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		// Set up the framebuffer object
-		glGenFramebuffers(1, &_fbo);
-		glGenRenderbuffers(1, &_depthBuffer);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
-		glBindRenderbuffer(GL_RENDERBUFFER, _depthBuffer);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, _renderTargetSize.x, _renderTargetSize.y);
-		glBindRenderbuffer(GL_RENDERBUFFER, 0);
-		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _depthBuffer);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	}
 
-		ovrMirrorTextureDesc mirrorDesc;
-		memset(&mirrorDesc, 0, sizeof(mirrorDesc));
-		mirrorDesc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
-		mirrorDesc.Width = _mirrorSize.x;
-		mirrorDesc.Height = _mirrorSize.y;
-		if (!OVR_SUCCESS(ovr_CreateMirrorTextureGL(_session, &mirrorDesc, &_mirrorTexture))) {
-			FAIL("Could not create mirror texture");
-		}
-		glGenFramebuffers(1, &_mirrorFbo);
-		lastTime = std::chrono::steady_clock::now();
+	AvatarMaterialEntry& entry = cache.entries[slot];
+	bool projector = projectorInv != nullptr;
+	if (!entry.valid || entry.projector != projector || memcmp(&entry.state, &state, sizeof(state)) != 0 ||
+		(projector && entry.projectorInv != *projectorInv) || memcmp(entry.layers, textures.layers, sizeof(entry.layers)) != 0 ||
+		memcmp(entry.handles, textures.handles, sizeof(entry.handles)) != 0)
+	{
+		entry.state = state;
+		entry.projector = projector;
+		entry.projectorInv = projector ? *projectorInv : glm::mat4(1.0f);
+		memcpy(entry.layers, textures.layers, sizeof(entry.layers));
+		memcpy(entry.handles, textures.handles, sizeof(entry.handles));
+		entry.valid = true;
+
+		AvatarMaterialBlock block;
+		_fillAvatarMaterialBlock(state, projectorInv, textures, &block);
+		glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr)(slot * cache.stride), sizeof(block), &block);
+		_renderStats.uniforms(sizeof(block));
 	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, cache.buffer, (GLintptr)(slot * cache.stride), sizeof(AvatarMaterialBlock));
+}
 
-	void onKey(int key, int scancode, int action, int mods) override {
-		if (GLFW_PRESS == action) switch (key) {
-		case GLFW_KEY_R:
-			ovr_RecenterTrackingOrigin(_session);
-			return;
-		}
+// Where each texture slot of a material samples from
+static void _avatarMaterialTextures(const ovrAvatarMaterialState& state, AvatarMaterialTextures* textures)
+{
+	const ovrAvatarAssetID ids[4] = { state.alphaMaskTextureID, state.normalMapTextureID, state.parallaxMapTextureID, state.roughnessMapTextureID };
+	for (int i = 0; i < AVATAR_TEXTURE_SLOTS; ++i)
+	{
+		const uint32_t layer = i - 4;
+		const ovrAvatarAssetID id = i < 4 ? ids[i] : (layer < state.layerCount ? state.layers[layer].sampleTexture : 0);
+		_avatarTextureLayer(id, &textures->arrays[i], &textures->layers[i], &textures->handles[i]);
+	}
+}
 
-		GlfwApp::onKey(key, scancode, action, mods);
+// Texture units used by AvatarFragmentShader.glsl: 1-4 for the material maps, then one per layer.
+// They never change, so the sampler uniforms are assigned once after linking.
+static void _assignAvatarSamplerUnits(GLuint program)
+{
+	_glState.useProgram(program);
+	glUniform1i(glGetUniformLocation(program, "alphaMask"), 1);
+	glUniform1i(glGetUniformLocation(program, "normalMap"), 2);
+	glUniform1i(glGetUniformLocation(program, "parallaxMap"), 3);
+	glUniform1i(glGetUniformLocation(program, "roughnessMap"), 4);
+	int layerUnits[OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT];
+	for (int i = 0; i < OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT; ++i)
+	{
+		layerUnits[i] = 5 + i;
 	}
+	glUniform1iv(glGetUniformLocation(program, "layerSurfaces"), OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT, layerUnits);
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "AvatarMaterial"), AVATAR_MATERIAL_BINDING);
+	_glState.useProgram(0);
+}
 
-	void update() final override {
-		while (ovrAvatarMessage* message = ovrAvatarMessage_Pop())
-		{
-			switch (ovrAvatarMessage_GetType(message))
-			{
-			case ovrAvatarMessageType_AvatarSpecification:
-				_handleAvatarSpecification(ovrAvatarMessage_GetAvatarSpecification(message));
-				break;
-			case ovrAvatarMessageType_AssetLoaded:
-				_handleAssetLoaded(ovrAvatarMessage_GetAssetLoaded(message));
-				break;
-			}
-			ovrAvatarMessage_Free(message);
-		}
+// Per program setup shared by the generic program and every variant
+static AvatarProgram _setupAvatarProgram(GLuint program)
+{
+	// Pre-skinned programs have no palette
+	const GLuint poseBlock = glGetUniformBlockIndex(program, "MeshPose");
+	if (poseBlock != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(program, poseBlock, AVATAR_POSE_BINDING);
 	}
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "MeshTransform"), AVATAR_TRANSFORM_BINDING);
+	const GLuint decalBlock = glGetUniformBlockIndex(program, "AvatarDecal");
+	if (decalBlock != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(program, decalBlock, AVATAR_DECAL_BINDING);
+	}
+	_assignAvatarSamplerUnits(program);
+	AvatarProgram result;
+	result.program = program;
+	result.elapsedSecondsLocation = glGetUniformLocation(program, "elapsedSeconds");
+	return result;
+}
 
-	void draw() final override {
-		// Compute how much time has elapsed since the last frame
-		std::chrono::steady_clock::time_point currentTime = std::chrono::steady_clock::now();
-		std::chrono::duration<float> deltaTime = currentTime - lastTime;
-		float deltaSeconds = deltaTime.count();
-		lastTime = currentTime;
-		_elapsedSeconds += deltaSeconds;
+// Colour format of the eye buffers, --eye-format <srgb8|r11g11b10f>. Both are 32 bits a pixel. sRGB8 stores
+// display values as the shaders write them. R11G11B10F stores linear values with more range in the darks but
+// no alpha, so the scene and avatar programs get LINEAR_EYE_BUFFER and decode what they write. The Eye mirror and
+// the spectator show the stored values as they are, darker than in the HMD.
+enum class EyeBufferFormat {
+	Srgb8,
+	R11G11B10F,
+};
+static EyeBufferFormat _eyeBufferFormat = EyeBufferFormat::Srgb8;
 
-		ovrPosef eyePoses[2];
-		ovr_GetEyePoses(_session, frame, true, _viewScaleDesc.HmdToEyeOffset, eyePoses, &_sceneLayer.SensorSampleTime);
+static bool _eyeBufferLinear() {
+	return _eyeBufferFormat == EyeBufferFormat::R11G11B10F;
+}
 
-		if (_avatar)
-		{
-			// Convert the OVR inputs into Avatar SDK inputs
-			ovrInputState touchState;
-			ovr_GetInputState(_session, ovrControllerType_Active, &touchState);
-			ovrTrackingState trackingState = ovr_GetTrackingState(_session, 0.0, false);
+static GLenum _eyeColorFormat() {
+	return _eyeBufferLinear() ? GL_R11F_G11F_B10F : GL_SRGB8_ALPHA8;
+}
 
-			glm::vec3 hmdP = _glmFromOvrVector(trackingState.HeadPose.ThePose.Position);
-			glm::quat hmdQ = _glmFromOvrQuat(trackingState.HeadPose.ThePose.Orientation);
-			glm::vec3 leftP = _glmFromOvrVector(trackingState.HandPoses[ovrHand_Left].ThePose.Position);
-			glm::quat leftQ = _glmFromOvrQuat(trackingState.HandPoses[ovrHand_Left].ThePose.Orientation);
-			glm::vec3 rightP = _glmFromOvrVector(trackingState.HandPoses[ovrHand_Right].ThePose.Position);
-			glm::quat rightQ = _glmFromOvrQuat(trackingState.HandPoses[ovrHand_Right].ThePose.Orientation);
+static ovrTextureFormat _eyeSwapChainFormat() {
+	return _eyeBufferLinear() ? OVR_FORMAT_R11G11B10_FLOAT : OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+}
 
-			ovrAvatarTransform hmd;
-			_ovrAvatarTransformFromGlm(hmdP, hmdQ, glm::vec3(1.0f), &hmd);
+// Appended to the defines of every program writing into the eye buffers
+static const char* _eyeColorDefine() {
+	return _eyeBufferLinear() ? "#define LINEAR_EYE_BUFFER\n" : "";
+}
 
-			ovrAvatarTransform left;
-			_ovrAvatarTransformFromGlm(leftP, leftQ, glm::vec3(1.0f), &left);
+// color as the eye buffer should store it, clear colours being given as display values
+static void _eyeClearColor(const GLfloat color[4], GLfloat out[4]) {
+	for (int i = 0; i < 3; i++)
+		out[i] = !_eyeBufferLinear() ? color[i] : color[i] <= 0.04045f ? color[i] / 12.92f : powf((color[i] + 0.055f) / 1.055f, 2.4f);
+	out[3] = color[3];
+}
 
-			ovrAvatarTransform right;
-			_ovrAvatarTransformFromGlm(rightP, rightQ, glm::vec3(1.0f), &right);
+// 16 bit shading, see HALF_PRECISION in shader.frag and AvatarFragmentShader.glsl: on where the driver has GLSL's
+// float16_t and the probe compiles, --no-half-precision keeps every program at 32 bits. --half-precision-check also
+// draws the probe both ways and keeps 32 bits if the two differ by more than HALF_PRECISION_MAX_STEPS.
+static bool _halfPrecisionAllowed = true;
+static bool _halfPrecisionCheck = false;
+static const char* _halfPrecisionExtension = nullptr;
 
-			ovrAvatarHandInputState inputStateLeft;
-			_ovrAvatarHandInputStateFromOvr(left, touchState, ovrHand_Left, &inputStateLeft);
+// Appended to the defines of every program lighting or blending colours into the eye buffers, with the eye colour one
+static std::string _halfPrecisionDefine() {
+	return _halfPrecisionExtension ? std::string(_halfPrecisionExtension) + "#define HALF_PRECISION\n" : std::string();
+}
 
-			ovrAvatarHandInputState inputStateRight;
-			_ovrAvatarHandInputStateFromOvr(right, touchState, ovrHand_Right, &inputStateRight);
+// Set in a variant key for the AVATAR_DECAL variant, above the bits _avatarProgramKey uses
+#define AVATAR_DECAL_KEY ((uint64_t)1 << 59)
+// And for the WEIGHTED_OIT variant a translucent part draws with in the eyes, see WeightedBlendedOit
+#define AVATAR_OIT_KEY ((uint64_t)1 << 60)
+// Translucent avatar parts go into WeightedBlendedOit's targets in the eyes instead of being blended far to near.
+// --no-oit sorts them again.
+static bool _weightedOit = true;
+
+// Packs everything that picks a variant. Sampler modes and mask types have five values each and blend modes two,
+// so a layer fits in six bits: 11 bits of material switches and the eight layers make 59. _avatarVariantKey adds
+// AVATAR_DECAL_KEY above them.
+static uint64_t _avatarProgramKey(const ovrAvatarMaterialState& state, bool projector)
+{
+	uint32_t layerCount = std::min<uint32_t>(state.layerCount, OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT);
+	uint64_t key = 0;
+	key |= state.alphaMaskTextureID != 0 ? 1 : 0;
+	key |= state.normalMapTextureID != 0 ? 2 : 0;
+	key |= state.roughnessMapTextureID != 0 ? 4 : 0;
+	key |= projector ? 8 : 0;
+	key |= (uint64_t)(state.baseMaskType & 7) << 4;
+	key |= (uint64_t)layerCount << 7;
+	for (uint32_t i = 0; i < layerCount; ++i)
+	{
+		const ovrAvatarMaterialLayerState& layer = state.layers[i];
+		uint64_t modes = ((uint64_t)layer.sampleMode * 5 + layer.maskType) * 2 + layer.blendMode;
+		key |= modes << (11 + 6 * i);
+	}
+	return key;
+}
 
-			_updateAvatar(_avatar, deltaSeconds, hmd, inputStateLeft, inputStateRight, nullptr, nullptr, 0);
+// The #defines that specialize AvatarFragmentShader.glsl for one key, unused layers are padded with zeros
+static std::string _avatarProgramDefines(uint64_t key)
+{
+	uint32_t layerCount = (uint32_t)(key >> 7) & 15;
+	std::string samplerModes, maskTypes, blendModes;
+	for (uint32_t i = 0; i < OVR_AVATAR_MAX_MATERIAL_LAYER_COUNT; ++i)
+	{
+		uint32_t modes = i < layerCount ? (uint32_t)(key >> (11 + 6 * i)) & 63 : 0;
+		const char* separator = i > 0 ? ", " : "";
+		samplerModes += separator + std::to_string(modes / 10);
+		maskTypes += separator + std::to_string(modes / 2 % 5);
+		blendModes += separator + std::to_string(modes % 2);
+	}
+	std::string defines = "#define AVATAR_PERMUTATION\n";
+	defines += std::string("#define PERM_USE_ALPHA ") + ((key & 1) ? "true" : "false") + "\n";
+	defines += std::string("#define PERM_USE_NORMAL_MAP ") + ((key & 2) ? "true" : "false") + "\n";
+	defines += std::string("#define PERM_USE_ROUGHNESS_MAP ") + ((key & 4) ? "true" : "false") + "\n";
+	defines += std::string("#define PERM_USE_PROJECTOR ") + ((key & 8) ? "true" : "false") + "\n";
+	defines += "#define PERM_BASE_MASK_TYPE " + std::to_string((key >> 4) & 7) + "\n";
+	defines += "#define PERM_LAYER_COUNT " + std::to_string(layerCount) + "\n";
+	defines += "#define PERM_LAYER_SAMPLER_MODES " + samplerModes + "\n";
+	defines += "#define PERM_LAYER_MASK_TYPES " + maskTypes + "\n";
+	defines += "#define PERM_LAYER_BLEND_MODES " + blendModes + "\n";
+	if (key & AVATAR_DECAL_KEY)
+	{
+		defines += "#define AVATAR_DECAL\n";
+	}
+	if (key & AVATAR_OIT_KEY)
+	{
+		defines += "#define WEIGHTED_OIT\n";
+	}
+	return defines;
+}
 
-			uint8_t amplitudeL = (uint8_t)round(inputStateLeft.indexTrigger * 150);
-			uint8_t amplitudeR = (uint8_t)round(inputStateRight.indexTrigger * 150);
+// What every avatar program is compiled with on top of its own defines
+static std::string _avatarBindlessDefines()
+{
+	return _bindlessTextures ? "#extension GL_ARB_bindless_texture : require\n#define BINDLESS_TEXTURES\n" : "";
+}
 
-			left_line_pos = { vec3(inputStateLeft.transform.position.x,inputStateLeft.transform.position.y,inputStateLeft.transform.position.z), 
-				trackingState.HandPoses[ovrHand_Left].ThePose.Orientation };
-			right_line_pos = { vec3(inputStateRight.transform.position.x,inputStateRight.transform.position.y,inputStateRight.transform.position.z),
-				trackingState.HandPoses[ovrHand_Right].ThePose.Orientation };
+// And their vertex shader
+static const char* _avatarVertexDefines()
+{
+	return _preskinAvatars ? "#define PRESKINNED\n" : "";
+}
 
-			if (inputStateLeft.buttonMask != 0 || inputStateRight.buttonMask != 0) {
-				if (win || lost)
-				{
-					reset_flag = true;
-				}
-			}
+// The key of the same material without its normal and roughness maps and with only its first layer
+static uint64_t _reducedAvatarProgramKey(uint64_t key)
+{
+	const uint64_t layerCount = std::min<uint64_t>((key >> 7) & 15, 1);
+	return (key & 0x79) | (layerCount << 7) | (key & ((uint64_t)63 << 11));
+}
 
-			if (inputStateLeft.indexTrigger > 0.5) {
-				laserColorLeft = glm::vec4(1, 0, 0, 1);
-				left_trig = true;
-			}
-			else {
-				ovr_SetControllerVibration(_session, ovrControllerType_LTouch, 0.0f, 0);
-				laserColorLeft = glm::vec4(0, 1, 0, 1);
-				left_trig = false;
-			}
-			if (inputStateRight.indexTrigger > 0.5) {
-				laserColorRight = glm::vec4(1, 0, 0, 1);
-				right_trig = true;
-			}
-			else {
-				ovr_SetControllerVibration(_session, ovrControllerType_RTouch, 0.0f, 0);
-				laserColorRight = glm::vec4(0, 1, 0, 1);
-				right_trig = false;
-			}
-		}
+// The key of the same material with no textures at all, only its base color and mask
+static uint64_t _placeholderAvatarProgramKey(uint64_t key)
+{
+	return key & 0x78;
+}
 
-		int curIndex;
-		ovr_GetTextureSwapChainCurrentIndex(_session, _eyeTexture, &curIndex);
-		GLuint curTexId;
-		ovr_GetTextureSwapChainBufferGL(_session, _eyeTexture, curIndex, &curTexId);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
-		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curTexId, 0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		ovr::for_each_eye([&](ovrEyeType eye) {
-			const auto& vp = _sceneLayer.Viewport[eye];
-			glViewport(vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h);
-			_sceneLayer.RenderPose[eye] = eyePoses[eye];
-			renderScene(_eyeProjections[eye], ovr::toGlm(eyePoses[eye]));
-
-			ovrVector3f eyePosition = eyePoses[eye].Position;
-			ovrQuatf eyeOrientation = eyePoses[eye].Orientation;
-			glm::quat glmOrientation = _glmFromOvrQuat(eyeOrientation);
-			glm::vec3 eyeWorld = _glmFromOvrVector(eyePosition);
-			glm::vec3 eyeForward = glmOrientation * glm::vec3(0, 0, -1);
-			glm::vec3 eyeUp = glmOrientation * glm::vec3(0, 1, 0);
-			glm::mat4 view = glm::lookAt(eyeWorld, eyeWorld + eyeForward, eyeUp);
-
-			ovrMatrix4f ovrProjection = ovrMatrix4f_Projection(_hmdDesc.DefaultEyeFov[eye], 0.01f, 1000.0f, ovrProjection_None);
-
-			glm::mat4 proj(
-				ovrProjection.M[0][0], ovrProjection.M[1][0], ovrProjection.M[2][0], ovrProjection.M[3][0],
-				ovrProjection.M[0][1], ovrProjection.M[1][1], ovrProjection.M[2][1], ovrProjection.M[3][1],
-				ovrProjection.M[0][2], ovrProjection.M[1][2], ovrProjection.M[2][2], ovrProjection.M[3][2],
-				ovrProjection.M[0][3], ovrProjection.M[1][3], ovrProjection.M[2][3], ovrProjection.M[3][3]
-			);
-
-			// If we have the avatar and have finished loading assets, render it
-			if (_avatar && !_loadingAssets)
-			{
-				_renderAvatar(_avatar, ovrAvatarVisibilityFlag_FirstPerson, view, proj, eyeWorld, false);
-
-				glm::vec4 reflectionPlane = glm::vec4(0.0, 0.0, -1.0, 0.0);
-				glm::mat4 reflection = _computeReflectionMatrix(reflectionPlane);
-
-				glFrontFace(GL_CW);
-				//_renderAvatar(_avatar, ovrAvatarVisibilityFlag_ThirdPerson, view * reflection, proj, glm::vec3(reflection * glm::vec4(eyeWorld, 1.0f)), false);
-				glFrontFace(GL_CCW);
-			}
-		});
-		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-		ovr_CommitTextureSwapChain(_session, _eyeTexture);
-		ovrLayerHeader* headerList = &_sceneLayer.Header;
-		ovr_SubmitFrame(_session, frame, &_viewScaleDesc, &headerList, 1);
-
-		GLuint mirrorTextureId;
-		ovr_GetMirrorTextureBufferGL(_session, _mirrorTexture, &mirrorTextureId);
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, _mirrorFbo);
-		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirrorTextureId, 0);
-		glBlitFramebuffer(0, 0, _mirrorSize.x, _mirrorSize.y, 0, _mirrorSize.y, _mirrorSize.x, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+// Whether every texture state samples has loaded, or never will. Assets that aren't textures count as resident.
+static bool _avatarTexturesResident(const ovrAvatarMaterialState& state)
+{
+	const ovrAvatarAssetID ids[4] = { state.alphaMaskTextureID, state.normalMapTextureID, state.parallaxMapTextureID, state.roughnessMapTextureID };
+	for (uint32_t i = 0; i < 4 + state.layerCount && i < AVATAR_TEXTURE_SLOTS; ++i)
+	{
+		const ovrAvatarAssetID id = i < 4 ? ids[i] : state.layers[i - 4].sampleTexture;
+		if (id != 0 && _avatarAssets.state(id) == AvatarAssetState::Pending)
+		{
+			return false;
+		}
 	}
+	return true;
+}
 
-	virtual void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose) = 0;
-};
-
-//////////////////////////////////////////////////////////////////////
-//
-// The remainder of this code is specific to the scene we want to 
-// render.  I use oglplus to render an array of cubes, but your 
-// application would perform whatever rendering you want
-//
+// The variant key for a material. reduced picks the cheaper variant of _reducedAvatarProgramKey, placeholder the
+// untextured one for a part whose textures are still loading, decal the one with a projector folded in, oit the
+// one writing WeightedBlendedOit's targets.
+static uint64_t _avatarVariantKey(const ovrAvatarMaterialState& state, bool projector, bool reduced, bool placeholder, bool decal = false,
+	bool oit = false)
+{
+	uint64_t key = _avatarProgramKey(state, projector);
+	if (reduced)
+	{
+		key = _reducedAvatarProgramKey(key);
+	}
+	if (placeholder)
+	{
+		key = _placeholderAvatarProgramKey(key);
+	}
+	if (decal)
+	{
+		key |= AVATAR_DECAL_KEY;
+	}
+	if (oit)
+	{
+		key |= AVATAR_OIT_KEY;
+	}
+	return key;
+}
 
+static bool _beginAvatarVariant(uint64_t key, ProgramBuild* build, size_t errorBufferSize, char* errorBuffer)
+{
+	std::string defines = _avatarBindlessDefines() + _eyeColorDefine() + _halfPrecisionDefine() + _avatarProgramDefines(key);
+	return _beginProgramFromFiles("AvatarVertexShader.glsl", "AvatarFragmentShader.glsl", errorBufferSize, errorBuffer, defines.c_str(),
+		_avatarVertexDefines(), build);
+}
 
-//////////////////////////////////////////////////////////////////////
-//
-// OGLplus is a set of wrapper classes for giving OpenGL a more object
-// oriented interface
-//
-#define OGLPLUS_USE_GLCOREARB_H 0
-#define OGLPLUS_USE_GLEW 1
-#define OGLPLUS_USE_BOOST_CONFIG 0
-#define OGLPLUS_NO_SITE_CONFIG 1
-#define OGLPLUS_LOW_PROFILE 1
+// Collects a variant begun by _beginAvatarVariant into its slot, which stays empty if it didn't compile
+static void _finishAvatarVariant(ProgramBuild& build, AvatarProgram& variant)
+{
+	char errorBuffer[512];
+	GLuint program = _finishProgramBuild(build, sizeof(errorBuffer), errorBuffer);
+	if (program)
+	{
+		variant = _setupAvatarProgram(program);
+	}
+	else
+	{
+		std::cout << "ERROR::AVATAR::VARIANT_NOT_COMPILED " << errorBuffer << std::endl;
+	}
+}
 
-#pragma warning( disable : 4068 4244 4267 4065)
-#include <oglplus/config/basic.hpp>
-#include <oglplus/config/gl.hpp>
-#include <oglplus/all.hpp>
-#include <oglplus/interop/glm.hpp>
-#include <oglplus/bound/texture.hpp>
-#include <oglplus/bound/framebuffer.hpp>
-#include <oglplus/bound/renderbuffer.hpp>
-#include <oglplus/bound/buffer.hpp>
-#include <oglplus/shapes/cube.hpp>
-#include <oglplus/shapes/wrapper.hpp>
-#pragma warning( default : 4068 4244 4267 4065)
+// The variant for a material, compiling it on first use, see _avatarVariantKey
+static const AvatarProgram& _avatarProgramFor(const ovrAvatarMaterialState& state, bool projector, bool reduced = false,
+	bool placeholder = false, bool decal = false, bool oit = false)
+{
+	const uint64_t key = _avatarVariantKey(state, projector, reduced, placeholder, decal, oit);
+	bool inserted = false;
+	AvatarProgram& variant = _avatarPrograms.variants.insert(key, &inserted);
+	if (inserted)
+	{
+		char errorBuffer[512];
+		ProgramBuild build;
+		if (_beginAvatarVariant(key, &build, sizeof(errorBuffer), errorBuffer))
+		{
+			_finishAvatarVariant(build, variant);
+		}
+		else
+		{
+			std::cout << "ERROR::AVATAR::VARIANT_NOT_COMPILED " << errorBuffer << std::endl;
+		}
+	}
+	return variant.program ? variant : _avatarPrograms.generic;
+}
 
+// Draws once with every program linked from source since the last call, so no frame waits on the driver finishing them
+static void _warmUpFreshPrograms()
+{
+	const uint32_t warmed = _programWarmup.run(_freshPrograms);
+	_freshPrograms.clear();
+	if (warmed)
+	{
+		printf("Warmed up %u programs\r\n", warmed);
+	}
+}
 
+// Compiles every variant avatar's materials can ask for, full, reduced and untextured, and warms them up. Their
+// textures are only starting to load then, so the switch from one variant to another never compiles mid-game. The
+// variants not compiled yet all go to the driver before the first is collected.
+static void _warmUpAvatarPrograms(ovrAvatar* avatar)
+{
+	std::vector<uint64_t> keys;
+	const uint32_t componentCount = ovrAvatarComponent_Count(avatar);
+	for (uint32_t i = 0; i < componentCount; ++i)
+	{
+		const ovrAvatarComponent* component = ovrAvatarComponent_Get(avatar, i);
+		for (uint32_t j = 0; j < component->renderPartCount; ++j)
+		{
+			const ovrAvatarRenderPart* renderPart = component->renderParts[j];
+			switch (ovrAvatarRenderPart_GetType(renderPart))
+			{
+			case ovrAvatarRenderPartType_SkinnedMeshRender:
+			{
+				const ovrAvatarMaterialState& state = ovrAvatarRenderPart_GetSkinnedMeshRender(renderPart)->materialState;
+				// Translucent parts draw through their WEIGHTED_OIT variants in the eyes, the plain ones elsewhere
+				const bool oit = _weightedOit && _avatarMaterialBlends(state);
+				for (int variant = 0; variant < (oit ? 8 : 4); ++variant)
+				{
+					keys.push_back(_avatarVariantKey(state, false, (variant & 1) != 0, (variant & 2) != 0, false, (variant & 4) != 0));
+				}
+				break;
+			}
+			case ovrAvatarRenderPartType_ProjectorRender:
+			{
+				const ovrAvatarRenderPart_ProjectorRender* projector = ovrAvatarRenderPart_GetProjectorRender(renderPart);
+				keys.push_back(_avatarVariantKey(projector->materialState, true, false, false));
+				keys.push_back(_avatarVariantKey(projector->materialState, true, true, false));
+				// And the target's variants it is folded into
+				if (_bindlessTextures && _foldAvatarDecals)
+				{
+					const ovrAvatarComponent* target = ovrAvatarComponent_Get(avatar, projector->componentIndex);
+					const ovrAvatarMaterialState& targetState = ovrAvatarRenderPart_GetSkinnedMeshRender(target->renderParts[projector->renderPartIndex])->materialState;
+					keys.push_back(_avatarVariantKey(targetState, false, false, false, true));
+					keys.push_back(_avatarVariantKey(targetState, false, true, false, true));
+				}
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
 
-namespace Attribute {
-	enum {
-		Position = 0,
-		TexCoord0 = 1,
-		Normal = 2,
-		Color = 3,
-		TexCoord1 = 4,
-		InstanceTransform = 5,
-	};
+	std::vector<std::pair<uint64_t, ProgramBuild>> builds;
+	for (size_t i = 0; i < keys.size(); ++i)
+	{
+		bool inserted = false;
+		_avatarPrograms.variants.insert(keys[i], &inserted);
+		if (!inserted)
+		{
+			continue;
+		}
+		char errorBuffer[512];
+		ProgramBuild build;
+		if (_beginAvatarVariant(keys[i], &build, sizeof(errorBuffer), errorBuffer))
+		{
+			builds.push_back(std::make_pair(keys[i], build));
+		}
+		else
+		{
+			std::cout << "ERROR::AVATAR::VARIANT_NOT_COMPILED " << errorBuffer << std::endl;
+		}
+	}
+	// Looked up again only now, inserting may have moved the slots
+	for (size_t i = 0; i < builds.size(); ++i)
+	{
+		_finishAvatarVariant(builds[i].second, *_avatarPrograms.variants.find(builds[i].first));
+	}
+	_warmUpFreshPrograms();
 }
 
-static const char * VERTEX_SHADER = R"SHADER(
-#version 410 core
+static void _setMaterialState(const AvatarProgram& program, const ovrAvatarMaterialState* state, glm::mat4* projectorInv)
+{
+	glUniform1f(program.elapsedSecondsLocation, (float)_elapsedSeconds);
+	AvatarMaterialTextures textures;
+	_avatarMaterialTextures(*state, &textures);
+	_bindAvatarMaterial(*state, projectorInv, textures);
+
+	// The layers are in the material block, so parts whose textures share arrays bind nothing new here, and
+	// bindless materials bind nothing at all
+	if (_bindlessTextures)
+	{
+		return;
+	}
+	for (int i = 0; i < AVATAR_TEXTURE_SLOTS; ++i)
+	{
+		_glState.bindTextureArray(1 + i, textures.arrays[i]);
+	}
+}
 
-uniform mat4 ProjectionMatrix = mat4(1);
-uniform mat4 CameraMatrix = mat4(1);
+static void _setPBSState(GLuint program, const ovrAvatarAssetID albedoTextureID, const ovrAvatarAssetID surfaceTextureID)
+{
+	int textureSlot = 0;
+	_setTextureSampler(program, textureSlot++, "albedo", "albedoLayer", albedoTextureID);
+	_setTextureSampler(program, textureSlot++, "surface", "surfaceLayer", surfaceTextureID);
+}
 
-layout(location = 0) in vec4 Position;
-layout(location = 2) in vec3 Normal;
-layout(location = 5) in mat4 InstanceTransform;
+// One avatar part queued for this frame, RenderItem::data indexes _avatarDraws
+struct AvatarDraw {
+	const ovrAvatarRenderPart* part;
+	// The skinned mesh a projector lands on, the part itself otherwise
+	const ovrAvatarRenderPart* target;
+	// A skinned part's folded projector, whose inverse projection is then projectionInv, see _collectAvatarDecals
+	const ovrAvatarRenderPart* decal = nullptr;
+	const MeshData* data;
+	AvatarProgram program;
+	// Transform of the component the mesh belongs to, and of the mesh within it
+	glm::mat4 world;
+	const ovrAvatarTransform* localTransform;
+	glm::mat4 projectionInv;
+	// Where the draw reads its vertices, data's own or the pre-skinned ones
+	GLuint vertexArray;
+	GLint baseVertex;
+	// The component whose occlusion query the draw is conditional on in the eyes, 0 for none
+	uintptr_t occluder = 0;
+	// What the draw was queued with, for _queueAvatar to tell whether the queue it keeps still holds it
+	uint32_t pass;
+	const void* material;
+	RenderCallback callback;
+	float depth;
+	// *localTransform as it was queued, the pose moves it in place
+	ovrAvatarTransform local;
+	// Whether world or local differ from the last frame's, so the eyes' blocks of the draw are out of date
+	bool moved = true;
+};
 
-out vec3 vertNormal;
+// A projector shaded inside its target part's draw, see _collectAvatarDecals
+struct AvatarDecal {
+	const ovrAvatarRenderPart* projector;
+	glm::mat4 projectionInv;
+};
 
-void main(void) {
-   mat4 ViewXfm = CameraMatrix * InstanceTransform;
-   //mat4 ViewXfm = CameraMatrix;
-   vertNormal = Normal;
-   gl_Position = ProjectionMatrix * ViewXfm * Position;
+// Avatar parts are queued once per frame after the pose update, then every eye draws the sorted queue. The eyes'
+// queue is kept from frame to frame while the same parts go in with the same state, see _queueAvatar.
+static std::vector<AvatarDraw> _avatarDraws;
+// The draws the queue was built from, the last frame's while _queueAvatar collects this frame's
+static std::vector<AvatarDraw> _avatarKeptDraws;
+// The components of the queue's draws with an occluder, by address
+static std::vector<uintptr_t> _avatarOccluders;
+// The queue's folded projectors, by the address of the part they land on
+static FlatHashMap<uintptr_t, AvatarDecal> _avatarDecals;
+static RenderQueue _avatarQueue;
+// Each eye's transform blocks for _avatarDraws, by draw, worked out on the job threads while the GL thread draws
+// the scene. Valid from _prepareAvatarEyes() until the queue is rebuilt, once _avatarEyesPrepared is done.
+static std::vector<AvatarTransformBlock> _avatarEyeTransforms[ovrEye_Count];
+// The views they were worked out for, a block only has to change when its view or its draw moved
+static RenderView _avatarEyeViews[ovrEye_Count];
+static JobCounter _avatarEyesPrepared;
+static bool _avatarEyesQueued = false;
+// Whether this frame's queue is the last frame's, kept rather than rebuilt
+static bool _avatarQueueKept = false;
+// Where _renderAvatar sets the eyes' queue aside while it draws a view of its own
+static RenderQueue _avatarViewQueue;
+static std::vector<AvatarDraw> _avatarViewDraws;
+// Whether the queue's translucent parts are WEIGHTED_OIT draws, left out of the color submits for the eyes'
+// translucent pass to draw into its own targets. Their keys then order them by state, not far to near.
+static bool _avatarOitQueued = false;
+
+// The part's transforms for view, from view.list's prepared blocks if it has them. Pre-skinned parts need no palette.
+static void _applyMeshState(const RenderItem& item, const RenderView& view, const AvatarDraw& draw, const ovrAvatarSkinnedMeshPose& skinnedPose)
+{
+	if (view.list < 0)
+	{
+		_setMeshState(*draw.localTransform, skinnedPose, draw.world, view.viewProj, view.viewPos);
+		return;
+	}
+	_uniformRing.push(AVATAR_TRANSFORM_BINDING, &_avatarEyeTransforms[view.list][item.data], sizeof(AvatarTransformBlock));
+	if (!_preskinAvatars)
+	{
+		_bindAvatarPose(skinnedPose);
+	}
 }
-)SHADER";
-
-static const char * FRAGMENT_SHADER = R"SHADER(
-#version 410 core
 
-in vec3 vertNormal;
-out vec4 fragColor;
+// In the eyes, skipped on the GPU if the box of the draw's component was hidden the frame before
+static void _drawAvatarElements(const AvatarDraw& draw, const RenderView& view)
+{
+	const bool conditional = draw.occluder && view.list >= 0 && _avatarOcclusion.beginConditional(draw.occluder, view.list);
+	glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)draw.data->elementCount, GL_UNSIGNED_SHORT, (GLvoid*)draw.data->elementBlock.offset, draw.baseVertex);
+	_glCapture.drawElements(GL_TRIANGLES, (GLsizei)draw.data->elementCount, GL_UNSIGNED_SHORT, (GLvoid*)draw.data->elementBlock.offset, 1, draw.baseVertex);
+	_renderStats.draw(GL_TRIANGLES, (GLsizei)draw.data->elementCount);
+	if (conditional)
+	{
+		_avatarOcclusion.endConditional();
+	}
+}
 
-void main(void) {
-    vec3 color = vertNormal;
-    if (!all(equal(color, abs(color)))) {
-        color = vec3(1.0) - abs(color);
-    }
-    fragColor = vec4(color, 1.0);
+// Binds the material of the projector folded into draw at AVATAR_DECAL_BINDING. Its projection moves with the
+// avatar, so it is bound every draw rather than only when the part's material changes.
+static void _setDecalState(const AvatarDraw& draw)
+{
+	const ovrAvatarMaterialState& state = ovrAvatarRenderPart_GetProjectorRender(draw.decal)->materialState;
+	AvatarMaterialTextures textures;
+	_avatarMaterialTextures(state, &textures);
+	_bindAvatarMaterial(state, &draw.projectionInv, textures, AVATAR_DECAL_BINDING);
 }
-)SHADER";
 
-// a class for encapsulating building and rendering an RGB cube
-struct ColorCubeScene {
+static void _drawSkinnedMeshPart(const RenderItem& item, const RenderView& view, bool materialChanged)
+{
+	const AvatarDraw& draw = _avatarDraws[item.data];
+	const ovrAvatarRenderPart_SkinnedMeshRender* mesh = ovrAvatarRenderPart_GetSkinnedMeshRender(draw.part);
 
-	// Program
-	//oglplus::shapes::ShapeWrapper cube;
-	
+	// Apply the vertex state
+	_applyMeshState(item, view, draw, mesh->skinnedPose);
 
-	Model fac1;
-	Model co2_tmp;
-	Model o2_tmp;
-	vector<string> co2_arr;
-	std::vector<string> o2_arr;
-	std::vector<mat4> co2_pos;
-	std::clock_t start;
-	float duration;
-	vector<vector<float>> velocity;
-	vector<float> cur_rotate_val;
-	vector<float> rotate_incre_val;
-	vector<vec3> rotate_axis;
-	int count_o2 = 0;
-	Shader sd;
-	vector<mat4> los_pos;
+	// Apply the material state
+	if (materialChanged)
+	{
+		_setMaterialState(draw.program, &mesh->materialState, nullptr);
+	}
+	if (draw.decal)
+	{
+		_setDecalState(draw);
+	}
 
-	// VBOs for the cube's vertices and normals
+	// Draw the mesh, self-occluding parts over the depth RENDER_PASS_DEPTH wrote for them
+	_glState.depthFunc(GL_LEQUAL);
+	_drawAvatarElements(draw, view);
+}
 
-	const unsigned int GRID_SIZE{ 5 };
+/* this part does not use */
+static void _drawSkinnedMeshPartPBS(const RenderItem& item, const RenderView& view, bool materialChanged)
+{
+	const AvatarDraw& draw = _avatarDraws[item.data];
+	const ovrAvatarRenderPart_SkinnedMeshRenderPBS* mesh = ovrAvatarRenderPart_GetSkinnedMeshRenderPBS(draw.part);
 
-public:
+	// Apply the vertex state
+	_applyMeshState(item, view, draw, mesh->skinnedPose);
 
-	inline bool check_type(string & str1) {
-		return str1 == "co2";
+	// Apply the material state
+	if (materialChanged)
+	{
+		_setPBSState(_skinnedMeshPBSProgram, mesh->albedoTextureAssetID, mesh->surfaceTextureAssetID);
 	}
 
-	ColorCubeScene(){
-		sd = Shader("./shader.vert", "./shader.frag");
-		fac1 = Model("./factory1.obj", "CO2");
-		co2_tmp = Model("./co2.obj", "CO2");
-		o2_tmp = Model("./o2.obj", "O2");
-
-		for (int i = 0; i < 5; i++)
-		{
-			co2_arr.push_back("co2");
-			float xpos = -0.7f + (rand()) / (float)(RAND_MAX / 1.4f);
-			float ypos = -1.0f + (rand()) / (float)(RAND_MAX);
-			float zpos = -2.4f + (rand()) / (float)(RAND_MAX / 2.0f);
-			vec3 relativePosition = vec3(xpos, ypos, zpos);
-
-			co2_pos.push_back(glm::translate(glm::mat4(1.0f), relativePosition));
-			float v1 = 0.0003f + (rand()) / (float)(RAND_MAX / (0.0008f - 0.0003f));
-			float v2 = 0.0003f + (rand()) / (float)(RAND_MAX / (0.0008f - 0.0003f));
-			float v3 = 0.0003f + (rand()) / (float)(RAND_MAX / (0.0008f - 0.0003f));
+	// Draw the mesh, self-occluding parts only where they are the nearest, as RENDER_PASS_DEPTH found
+	_glState.depthFunc((mesh->visibilityMask & ovrAvatarVisibilityFlag_SelfOccluding) ? GL_EQUAL : GL_LESS);
+	_glState.depthMask(GL_FALSE);
+	_drawAvatarElements(draw, view);
+}
 
-			(rand() / (float)(RAND_MAX) > 0.5f) ? v1 *= -1.0f : v1;
-			(rand() / (float)(RAND_MAX) > 0.5f) ? v2 *= -1.0f : v2;
-			(rand() / (float)(RAND_MAX) > 0.5f) ? v3 *= -1.0f : v3;
+// A self-occluding part's depth, for the color passes after to test against
+static void _drawAvatarDepth(const RenderItem& item, const RenderView& view, bool materialChanged)
+{
+	const AvatarDraw& draw = _avatarDraws[item.data];
+	const ovrAvatarSkinnedMeshPose& pose = ovrAvatarRenderPart_GetType(draw.part) == ovrAvatarRenderPartType_SkinnedMeshRenderPBS ?
+		ovrAvatarRenderPart_GetSkinnedMeshRenderPBS(draw.part)->skinnedPose : ovrAvatarRenderPart_GetSkinnedMeshRender(draw.part)->skinnedPose;
+	_applyMeshState(item, view, draw, pose);
+	_glState.depthFunc(GL_LESS);
+	_glState.depthMask(GL_TRUE);
+	_drawAvatarElements(draw, view);
+}
 
-			vector<float> tmp = { v1,v2,v3 };
-			velocity.push_back(tmp);
+static void _drawProjector(const RenderItem& item, const RenderView& view, bool materialChanged)
+{
+	AvatarDraw& draw = _avatarDraws[item.data];
+	const ovrAvatarRenderPart_ProjectorRender* projector = ovrAvatarRenderPart_GetProjectorRender(draw.part);
+	const ovrAvatarRenderPart_SkinnedMeshRender* mesh = ovrAvatarRenderPart_GetSkinnedMeshRender(draw.target);
 
+	// Apply the vertex state
+	_applyMeshState(item, view, draw, mesh->skinnedPose);
 
-			float r = 0.01f + (rand()) / (float)(RAND_MAX / (0.02f - 0.01f));
-			cur_rotate_val.push_back(r);
-			rotate_incre_val.push_back(r);
-			rotate_axis.push_back(vec3((rand()) / (float)(RAND_MAX), (rand()) / (float)(RAND_MAX), (rand()) / (float)(RAND_MAX)));
-		}
+	// Apply the material state
+	if (materialChanged)
+	{
+		_setMaterialState(draw.program, &projector->materialState, &draw.projectionInv);
+	}
 
-		
-		for (int i = 0; i < 100; i++)
-		{
-			float xpos = -0.7f + (rand()) / (float)(RAND_MAX / 1.4f);
-			float ypos = -1.0f + (rand()) / (float)(RAND_MAX);
-			float zpos = -2.4f + (rand()) / (float)(RAND_MAX / 2.0f);
-			vec3 relativePosition = vec3(xpos, ypos, zpos);
-			float r = (rand()) / (float)(RAND_MAX / 10.0f);
-			
-			
-			los_pos.push_back(glm::rotate(glm::translate(glm::mat4(1.0f), relativePosition), r, vec3((rand()) / (float)(RAND_MAX), (rand()) / (float)(RAND_MAX), (rand()) / (float)(RAND_MAX))));
-		}
-		start = clock();
+	// Draw the mesh
+	_glState.depthMask(GL_FALSE);
+	_glState.depthFunc(GL_EQUAL);
+	_drawAvatarElements(draw, view);
+}
 
+// Distance from viewPos to the origin of a part, what the queue orders its depth by
+static float _avatarPartDepth(const glm::mat4& world, const ovrAvatarTransform& localTransform, const glm::vec3& viewPos)
+{
+	glm::mat4 local;
+	_glmFromOvrAvatarTransform(localTransform, &local);
+	return glm::length(glm::vec3((world * local)[3]) - viewPos);
+}
 
-	}
+// Where draw goes in the queue
+static uint64_t _avatarDrawKey(const AvatarDraw& draw)
+{
+	return RenderQueue::makeKey(draw.pass, draw.program.program, draw.material, draw.vertexArray, draw.depth,
+		draw.pass == RENDER_PASS_BLENDED && !_avatarOitQueued);
+}
 
-	void render(const mat4 & projection, const mat4 & modelview) {
-		
+// Whether a and b go in the queue alike, wherever they are
+static bool _avatarDrawsAlike(const AvatarDraw& a, const AvatarDraw& b)
+{
+	return a.part == b.part && a.target == b.target && a.decal == b.decal && a.data == b.data && a.program.program == b.program.program &&
+		a.vertexArray == b.vertexArray && a.baseVertex == b.baseVertex && a.occluder == b.occluder && a.pass == b.pass &&
+		a.material == b.material && a.callback == b.callback;
+}
 
-		if (o2_arr.size() == co2_arr.size())
+// Collects draw of a part skinned by pose, from the pre-skinned vertices if there are any, for _queueAvatar to queue.
+// A mesh that finished loading after this frame's pose update has none yet and waits for the next frame.
+static void _queueDraw(uint32_t pass, AvatarDraw& draw, const ovrAvatarSkinnedMeshPose& pose, const void* material, RenderCallback callback, float depth)
+{
+	draw.vertexArray = draw.data->vertexArray;
+	draw.baseVertex = draw.data->baseVertex;
+	if (_preskinAvatars)
+	{
+		const uint32_t* block = _avatarPoses.blockOf.find((uintptr_t)&pose);
+		if (!block)
 		{
-			win = true;
-			glClearColor(0.0f, 0.73f, 1.0f, 0.0f);
+			return;
 		}
+		draw.vertexArray = _avatarSkinnedVertexArray(draw.data->elementBlock.buffer);
+		draw.baseVertex = _avatarPoses.skinnedBases[*block];
+	}
+	draw.pass = pass;
+	draw.material = material;
+	draw.callback = callback;
+	draw.depth = depth;
+	draw.local = *draw.localTransform;
+	_avatarDraws.push_back(draw);
+}
 
-		if (co2_arr.size() - o2_arr.size() >= 10)
-		{
-			lost = true;
-		}
+// Queues the depth of a self-occluding part ahead of its color. Every such part goes in RENDER_PASS_DEPTH with the
+// one program that skins nothing but positions, so the material programs then shade each pixel once instead of
+// drawing the part twice.
+static void _queueAvatarDepth(const AvatarDraw& part, const ovrAvatarSkinnedMeshPose& pose, float depth)
+{
+	AvatarDraw draw = part;
+	draw.program.program = _avatarDepthProgram;
+	draw.program.elapsedSecondsLocation = -1;
+	draw.decal = nullptr;
+	_queueDraw(RENDER_PASS_DEPTH, draw, pose, nullptr, _drawAvatarDepth, depth);
+}
 
-		sd.Use();
+static void _queueSkinnedMeshPart(const ovrAvatarRenderPart* renderPart, uint32_t visibilityMask, const glm::mat4& world, const glm::vec3& viewPos, bool reduced)
+{
+	const ovrAvatarRenderPart_SkinnedMeshRender* mesh = ovrAvatarRenderPart_GetSkinnedMeshRender(renderPart);
 
-		glUniformMatrix4fv(glGetUniformLocation(sd.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-		glUniformMatrix4fv(glGetUniformLocation(sd.Program, "view"), 1, GL_FALSE, glm::value_ptr(modelview));
-		glm::mat4 mod;
-		mod = glm::translate(mod, glm::vec3(0.0f, -0.8f, -2.0f));
-		mod = glm::scale(mod, glm::vec3(0.05f, 0.05f, 0.05f));
-		glUniformMatrix4fv(glGetUniformLocation(sd.Program, "model"), 1, GL_FALSE, glm::value_ptr(mod));
+	// If this part isn't visible from the viewpoint we're rendering from, do nothing
+	if ((mesh->visibilityMask & visibilityMask) == 0)
+	{
+		return;
+	}
 
-		/* get the light */
-		glUniformMatrix4fv(glGetUniformLocation(sd.Program, "viewPos"), 1, GL_FALSE, glm::value_ptr(modelview));
-		GLint lightAmbientLoc = glGetUniformLocation(sd.Program, "light.ambient");
-		GLint lightDiffuseLoc = glGetUniformLocation(sd.Program, "light.diffuse");
-		GLint lightSpecularLoc = glGetUniformLocation(sd.Program, "light.specular");
-		GLint lightPos = glGetUniformLocation(sd.Program, "light.position");
-		glUniform3f(lightAmbientLoc, 0.2f, 0.2f, 0.2f);
-		glUniform3f(lightDiffuseLoc, 1.0f, 1.0f, 1.0f); // Let's darken the light a bit to fit the scene
-		glUniform3f(lightSpecularLoc, 1.0f, 1.0f, 1.0f);
-		glUniform3f(lightPos, 1.0f, 1.0f, 1.0f);
+	// Get the GL mesh data for this mesh's asset
+	AvatarDraw draw;
+	draw.data = _avatarAssets.mesh(mesh->meshAssetID);
+	if (!draw.data)
+	{
+		return;
+	}
+	draw.part = renderPart;
+	draw.target = renderPart;
+	// The variant specialized for this part's material, plain base color until its textures are in
+	const AvatarDecal* decal = _avatarDecals.find((uintptr_t)renderPart);
+	const bool blends = _avatarMaterialBlends(mesh->materialState);
+	draw.program = _avatarProgramFor(mesh->materialState, false, reduced, !_avatarTexturesResident(mesh->materialState), decal != nullptr,
+		blends && _avatarOitQueued);
+	if (decal)
+	{
+		draw.decal = decal->projector;
+		draw.projectionInv = decal->projectionInv;
+	}
+	draw.world = world;
+	draw.localTransform = &mesh->localTransform;
 
-		duration = (std::clock() - start) / (float)CLOCKS_PER_SEC;
+	// Parts whose alpha can drop below 1 blend with what is behind them, so they go after the opaque ones, far to near
+	// unless they are WEIGHTED_OIT draws
+	uint32_t pass = blends ? RENDER_PASS_BLENDED : RENDER_PASS_OPAQUE;
+	const float depth = _avatarPartDepth(world, mesh->localTransform, viewPos);
+	if (mesh->visibilityMask & ovrAvatarVisibilityFlag_SelfOccluding)
+	{
+		_queueAvatarDepth(draw, mesh->skinnedPose, depth);
+	}
+	_queueDraw(pass, draw, mesh->skinnedPose, &mesh->materialState, _drawSkinnedMeshPart, depth);
+}
 
-		/* checking whether need to spawn a co2 */
-		if (duration > 1.5f && !win && !lost)
-		{
-			co2_arr.push_back("co2");
-			duration = 0;
-			float v1 = 0.0003f + (rand()) / (float)(RAND_MAX / (0.0008f - 0.0003f));
-			float v2 = 0.0003f + (rand()) / (float)(RAND_MAX / (0.0008f - 0.0003f));
-			float v3 = 0.0003f + (rand()) / (float)(RAND_MAX / (0.0008f - 0.0003f));
+static void _queueSkinnedMeshPartPBS(const ovrAvatarRenderPart* renderPart, uint32_t visibilityMask, const glm::mat4& world, const glm::vec3& viewPos)
+{
+	const ovrAvatarRenderPart_SkinnedMeshRenderPBS* mesh = ovrAvatarRenderPart_GetSkinnedMeshRenderPBS(renderPart);
 
-			(rand() / (float)(RAND_MAX) > 0.5f) ? v1 *= -1.0f : v1;
-			(rand() / (float)(RAND_MAX) > 0.5f) ? v2 *= -1.0f : v2;
-			(rand() / (float)(RAND_MAX) > 0.5f) ? v3 *= -1.0f : v3;
+	// If this part isn't visible from the viewpoint we're rendering from, do nothing
+	if ((mesh->visibilityMask & visibilityMask) == 0)
+	{
+		return;
+	}
+
+	// Get the GL mesh data for this mesh's asset
+	AvatarDraw draw;
+	draw.data = _avatarAssets.mesh(mesh->meshAssetID);
+	if (!draw.data)
+	{
+		return;
+	}
+	draw.part = renderPart;
+	draw.target = renderPart;
+	draw.program.program = _skinnedMeshPBSProgram;
+	draw.program.elapsedSecondsLocation = -1;
+	draw.world = world;
+	draw.localTransform = &mesh->localTransform;
+	const float depth = _avatarPartDepth(world, mesh->localTransform, viewPos);
+	if (mesh->visibilityMask & ovrAvatarVisibilityFlag_SelfOccluding)
+	{
+		_queueAvatarDepth(draw, mesh->skinnedPose, depth);
+	}
+	_queueDraw(RENDER_PASS_OPAQUE, draw, mesh->skinnedPose, renderPart, _drawSkinnedMeshPartPBS, depth);
+}
 
-			vector<float> tmp = { v1,v2,v3 };
-			velocity.push_back(tmp);
+static void _queueProjector(const ovrAvatarRenderPart* renderPart, ovrAvatar* avatar, uint32_t visibilityMask, const glm::mat4& world, const glm::vec3& viewPos, bool reduced)
+{
+	const ovrAvatarRenderPart_ProjectorRender* projector = ovrAvatarRenderPart_GetProjectorRender(renderPart);
 
-			float r = 0.01f + (rand()) / (float)(RAND_MAX / (0.02f - 0.01f));
-			cur_rotate_val.push_back(r);
-			rotate_incre_val.push_back(r);
-			rotate_axis.push_back(vec3((rand()) / (float)(RAND_MAX), (rand()) / (float)(RAND_MAX), (rand()) / (float)(RAND_MAX)));
-			co2_pos.push_back(glm::scale(mod, glm::vec3(20.0f, 20.0f, 20.0f)));
-			start = clock();
-		}
+	// Compute the mesh transform
+	const ovrAvatarComponent* component = ovrAvatarComponent_Get(avatar, projector->componentIndex);
+	const ovrAvatarRenderPart* targetPart = component->renderParts[projector->renderPartIndex];
+	const ovrAvatarRenderPart_SkinnedMeshRender* mesh = ovrAvatarRenderPart_GetSkinnedMeshRender(targetPart);
+
+	// If this part isn't visible from the viewpoint we're rendering from, or is shaded with it, do nothing
+	const AvatarDecal* folded = _avatarDecals.find((uintptr_t)targetPart);
+	if ((mesh->visibilityMask & visibilityMask) == 0 || (folded && folded->projector == renderPart))
+	{
+		return;
+	}
+
+	// Get the GL mesh data for this mesh's asset. A decal is nothing but its textures, so it waits for them.
+	AvatarDraw draw;
+	draw.data = _avatarAssets.mesh(mesh->meshAssetID);
+	if (!draw.data || !_avatarTexturesResident(projector->materialState))
+	{
+		return;
+	}
+
+	// Compute the projection matrix
+	glm::mat4 projection;
+	_glmFromOvrAvatarTransform(projector->localTransform, &projection);
+	glm::mat4 worldProjection = world * projection;
+	draw.projectionInv = glm::inverse(worldProjection);
+
+	// Compute the mesh transform
+	_glmFromOvrAvatarTransform(component->transform, &draw.world);
+
+	draw.part = renderPart;
+	draw.target = targetPart;
+	draw.localTransform = &mesh->localTransform;
+	draw.program = _avatarProgramFor(projector->materialState, true, reduced);
+	_queueDraw(RENDER_PASS_DECAL, draw, mesh->skinnedPose, &projector->materialState, _drawProjector, _avatarPartDepth(draw.world, mesh->localTransform, viewPos));
+}
+
+// World space box of the skinned parts of every avatar's components, by component address, rebuilt with the poses.
+// Components without a loaded skinned part keep an empty box and are never culled, there is nothing of them to
+// queue anyway.
+static FlatHashMap<uintptr_t, Aabb> _avatarComponentBounds;
 
-		fac1.Draw(sd);
+// Whether component can be seen by either eye of frustum and, given a mirror, isn't entirely behind it
+static bool _avatarComponentShown(const ovrAvatarComponent* component, const StereoFrustum* frustum, const PlanarMirror* mirror)
+{
+	const Aabb* bounds = _avatarComponentBounds.find((uintptr_t)component);
+	if (!bounds || bounds->empty())
+	{
+		return true;
+	}
+	const Aabb& box = *bounds;
+	const glm::vec3 centre = (box.min + box.max) * 0.5f;
+	const glm::vec3 extent = (box.max - box.min) * 0.5f;
+	if (mirror && !mirror->reflects(centre, glm::length(extent)))
+	{
+		return false;
+	}
+	if (frustum)
+	{
+		uint8_t mask;
+		_cullBoxes(&centre.x, &centre.y, &centre.z, &extent.x, &extent.y, &extent.z, 1, *frustum, &mask);
+		return mask != 0;
+	}
+	return true;
+}
 
-		if (lost)
+// Picks the projectors of avatar that _queueSkinnedMeshPart folds into the part they land on: the first on each part,
+// once its textures and the part's are all in. The rest, and all of them without bindless textures, are queued as
+// draws of their own by _queueProjector, the part drawn again under them.
+static void _collectAvatarDecals(ovrAvatar* avatar, AvatarLod lod)
+{
+	if (!_bindlessTextures || !_foldAvatarDecals || lod == AvatarLod::Distant)
+	{
+		return;
+	}
+	const uint32_t componentCount = ovrAvatarComponent_Count(avatar);
+	for (uint32_t i = 0; i < componentCount; ++i)
+	{
+		const ovrAvatarComponent* component = ovrAvatarComponent_Get(avatar, i);
+		for (uint32_t j = 0; j < component->renderPartCount; ++j)
 		{
-			mod = mat4();
-			for (int i = 0; i < los_pos.size(); i++)
+			const ovrAvatarRenderPart* renderPart = component->renderParts[j];
+			if (ovrAvatarRenderPart_GetType(renderPart) != ovrAvatarRenderPartType_ProjectorRender)
+			{
+				continue;
+			}
+			const ovrAvatarRenderPart_ProjectorRender* projector = ovrAvatarRenderPart_GetProjectorRender(renderPart);
+			const ovrAvatarRenderPart* targetPart = ovrAvatarComponent_Get(avatar, projector->componentIndex)->renderParts[projector->renderPartIndex];
+			const ovrAvatarRenderPart_SkinnedMeshRender* mesh = ovrAvatarRenderPart_GetSkinnedMeshRender(targetPart);
+			if (!_avatarTexturesResident(projector->materialState) || !_avatarTexturesResident(mesh->materialState))
 			{
-				mod = los_pos[i];
-				mod = glm::scale(mod, glm::vec3(0.05f, 0.05f, 0.05f));
-				glUniformMatrix4fv(glGetUniformLocation(sd.Program, "model"), 1, GL_FALSE, glm::value_ptr(mod));
-				co2_tmp.Draw(sd);
+				continue;
 			}
+			bool inserted = false;
+			AvatarDecal& decal = _avatarDecals.insert((uintptr_t)targetPart, &inserted);
+			if (!inserted)
+			{
+				continue;
+			}
+			glm::mat4 world, projection;
+			_glmFromOvrAvatarTransform(component->transform, &world);
+			_glmFromOvrAvatarTransform(projector->localTransform, &projection);
+			decal.projector = renderPart;
+			decal.projectionInv = glm::inverse(world * projection);
 		}
-		else
+	}
+}
+
+// Adds the visible parts of every component to _avatarDraws. viewPos only orders the parts, so one point between
+// the eyes serves both. Components outside frustum, or entirely behind mirror, are left out.
+static void _appendAvatar(ovrAvatar* avatar, uint32_t visibilityMask, const glm::vec3& viewPos, const StereoFrustum* frustum = nullptr,
+	const PlanarMirror* mirror = nullptr)
+{
+	// Avatars further off shade every part reduced and at a distance lose their projectors. In the mirror the
+	// distance is the reflected one, from the mirror's camera.
+	const AvatarLod lod = mirror ? _avatarLod.levelFor(avatar, viewPos) : _avatarLod.level(avatar);
+	// The body and base are what drops to reduced shading, the hands stay as they are
+	const ovrAvatarBodyComponent* body = ovrAvatarPose_GetBodyComponent(avatar);
+	const ovrAvatarBaseComponent* base = ovrAvatarPose_GetBaseComponent(avatar);
+	const ovrAvatarComponent* bodyComponent = body ? body->renderComponent : nullptr;
+	const ovrAvatarComponent* baseComponent = base ? base->renderComponent : nullptr;
+	_collectAvatarDecals(avatar, lod);
+
+	// Traverse over all components on the avatar
+	uint32_t componentCount = ovrAvatarComponent_Count(avatar);
+	for (uint32_t i = 0; i < componentCount; ++i)
+	{
+		const ovrAvatarComponent* component = ovrAvatarComponent_Get(avatar, i);
+		if (!_avatarComponentShown(component, frustum, mirror))
+		{
+			_cullStats.meshes++;
+			_renderStats.culled(1);
+			continue;
+		}
+		const bool reduced = lod != AvatarLod::Full || (_avatarReducedShading && (component == bodyComponent || component == baseComponent));
+
+		// Compute the transform for this component
+		glm::mat4 world;
+		_glmFromOvrAvatarTransform(component->transform, &world);
+
+		// Queue each render part attached to the component
+		const size_t firstDraw = _avatarDraws.size();
+		for (uint32_t j = 0; j < component->renderPartCount; ++j)
 		{
-			for (int i = 0; i < co2_arr.size(); i++)
+			
+			const ovrAvatarRenderPart* renderPart = component->renderParts[j];
+			ovrAvatarRenderPartType type = ovrAvatarRenderPart_GetType(renderPart);
+			switch (type)
 			{
-				if (win)
+			case ovrAvatarRenderPartType_SkinnedMeshRender:
+				_queueSkinnedMeshPart(renderPart, visibilityMask, world, viewPos, reduced);
+				break;
+			case ovrAvatarRenderPartType_SkinnedMeshRenderPBS:
+				_queueSkinnedMeshPartPBS(renderPart, visibilityMask, world, viewPos);
+				break;
+			case ovrAvatarRenderPartType_ProjectorRender:
+				if (lod != AvatarLod::Distant)
 				{
-					mod = co2_pos[i];
-					glUniformMatrix4fv(glGetUniformLocation(sd.Program, "model"), 1, GL_FALSE, glm::value_ptr(mod));
-					o2_tmp.Draw(sd);
+					_queueProjector(renderPart, avatar, visibilityMask, world, viewPos, reduced);
 				}
-				else
-				{
-					mod = mat4();
-					/* transformation for this molecule with scale rotate and translate */
-					mod = glm::translate(mod, glm::vec3(velocity[i][0], velocity[i][1], velocity[i][2]));
-					mod = glm::translate(mod, vec3(co2_pos[i][3][0], co2_pos[i][3][1], co2_pos[i][3][2]));
-					mod = glm::rotate(mod, (float)cur_rotate_val[i], rotate_axis[i]);
-					mod = glm::scale(mod, glm::vec3(0.05f, 0.05f, 0.05f));
-
-					co2_pos[i] = mod;
-
-					/* checking whether the molecule is outside the bounding box */
-					(mod[3][0] >= 1.0f || mod[3][0] <= -1.0f) ? velocity[i][0] *= -1.0f : velocity[i][0];
-					(mod[3][1] >= 0.3f || mod[3][1] <= -1.2f) ? velocity[i][1] *= -1.0f : velocity[i][1];
-					(mod[3][2] >= -0.8f || mod[3][2] <= -3.0f) ? velocity[i][2] *= -1.0f : velocity[i][2];
-
-					cur_rotate_val[i] += rotate_incre_val[i];
-
-					/* calculating the two hand intersection with the co2 obj */
-					if (check_type(co2_arr[i]))
-					{
-						// left hand
-						glm::quat qut_L = quat(left_line_pos.second.w, left_line_pos.second.x, left_line_pos.second.y, left_line_pos.second.z);
-						vec3 dir_vect = qut_L * vec3(0.0f, 0.0f, -1.0f);
-						vec3 endPoint = dir_vect * 100000.0f;
-						vec3 nextDist = (endPoint - left_line_pos.first);
-						vec3 tmp = glm::cross(nextDist, (left_line_pos.first - vec3(mod[3])));
-						float tmp2 = sqrt(pow(nextDist.x, 2) + pow(nextDist.y, 2) + pow(nextDist.z, 2));
-						float dist_L = sqrt(pow(tmp.x, 2) + pow(tmp.y, 2) + pow(tmp.z, 2)) / tmp2;
-
-						// right hand
-						glm::quat qut_R = quat(right_line_pos.second.w, right_line_pos.second.x, right_line_pos.second.y, right_line_pos.second.z);
-						dir_vect = qut_R * vec3(0.0f, 0.0f, -1.0f);
-						endPoint = dir_vect * 100000.0f;
-						nextDist = (endPoint - right_line_pos.first);
-						tmp = glm::cross(nextDist, (right_line_pos.first - vec3(mod[3])));
-						tmp2 = sqrt(pow(nextDist.x, 2) + pow(nextDist.y, 2) + pow(nextDist.z, 2));
-						float dist_R = sqrt(pow(tmp.x, 2) + pow(tmp.y, 2) + pow(tmp.z, 2)) / tmp2;
-						
-						// both intersected
-						if (dist_R <= 0.06f && dist_L <= 0.06f && left_trig && right_trig)
-						{
-							ovr_SetControllerVibration(tempOvrSession, ovrControllerType_LTouch, 1.0f, 255);
-							ovr_SetControllerVibration(tempOvrSession, ovrControllerType_RTouch, 1.0f, 255);
-							co2_arr[i] = "o2";
-							o2_arr.push_back("o2");
-						}
-					}
-					
-					glUniformMatrix4fv(glGetUniformLocation(sd.Program, "model"), 1, GL_FALSE, glm::value_ptr(mod));
+				break;
+			}
+		}
 
-					(check_type(co2_arr[i])) ? co2_tmp.Draw(sd) : o2_tmp.Draw(sd);
-					
-				}
+		// The component's draws hang on its box's occlusion query, if it has a box to query
+		const Aabb* bounds = _avatarComponentBounds.find((uintptr_t)component);
+		if (_avatarOcclusion.initialized() && bounds && !bounds->empty() && firstDraw < _avatarDraws.size())
+		{
+			for (size_t k = firstDraw; k < _avatarDraws.size(); ++k)
+			{
+				_avatarDraws[k].occluder = (uintptr_t)component;
 			}
+			_avatarOccluders.push_back((uintptr_t)component);
 		}
 	}
-};
-
+}
 
-// An example application that renders a simple cube
-class ExampleApp : public RiftApp {
-	std::shared_ptr<ColorCubeScene> cubeScene;
+// Fills _avatarQueue with the avatar's parts, and the remote avatars' as everyone else sees them. oit queues the
+// translucent parts for the eyes' translucent pass, see _avatarOitQueued.
+//
+// keep lets the queue stay as it was when every part goes in as it did the last frame, the same draws of the same
+// meshes with the same programs and materials. Those draws only take their new transforms and the queue isn't
+// pushed or sorted again, bar blended parts coming out of their far to near order; the eyes then only work out
+// the blocks of the draws that moved, or of all of them if the eye did, see _prepareAvatarEyes. Any part that
+// culls in or out, switches program with its LOD or textures, or loads rebuilds the whole queue.
+static void _queueAvatar(ovrAvatar* avatar, uint32_t visibilityMask, const glm::vec3& viewPos, const StereoFrustum* frustum = nullptr,
+	const PlanarMirror* mirror = nullptr, bool oit = false, bool keep = false)
+{
+	// Whatever is still preparing reads the old draws
+	_jobs.wait(_avatarEyesPrepared);
+	_avatarEyesQueued = false;
+	keep = keep && oit == _avatarOitQueued;
+	_avatarOitQueued = oit;
+	_avatarKeptDraws.swap(_avatarDraws);
+	_avatarDraws.clear();
+	_avatarOccluders.clear();
+	_avatarDecals.clear();
+	_appendAvatar(avatar, visibilityMask, viewPos, frustum, mirror);
+	for (size_t i = 0; i < _remoteAvatars.size(); ++i)
+	{
+		_appendAvatar(_remoteAvatars[i], ovrAvatarVisibilityFlag_ThirdPerson, viewPos, frustum, mirror);
+	}
 
-public:
-	ExampleApp() {}
-protected:
-	void initGl() override {
-		RiftApp::initGl();
-		glClearColor(0.0f, 0.0f, 0.55f, 0.0f);
-		glEnable(GL_CULL_FACE);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		glClearDepth(1.0f);
+	_avatarQueueKept = keep && _avatarDraws.size() == _avatarKeptDraws.size();
+	for (size_t i = 0; _avatarQueueKept && i < _avatarDraws.size(); ++i)
+	{
+		_avatarQueueKept = _avatarDrawsAlike(_avatarDraws[i], _avatarKeptDraws[i]);
+	}
+	if (_avatarQueueKept)
+	{
+		for (size_t i = 0; i < _avatarDraws.size(); ++i)
+		{
+			AvatarDraw& draw = _avatarDraws[i];
+			const AvatarDraw& kept = _avatarKeptDraws[i];
+			draw.moved = draw.world != kept.world || memcmp(&draw.local, &kept.local, sizeof(ovrAvatarTransform)) != 0;
+		}
+		// Only blended parts have to follow their depth, the rest stay in the order they were queued in
+		if (!oit)
+		{
+			_avatarQueue.rekey([](const RenderItem& item)
+			{
+				const AvatarDraw& draw = _avatarDraws[item.data];
+				return draw.pass == RENDER_PASS_BLENDED ? _avatarDrawKey(draw) : item.key;
+			});
+		}
+		return;
+	}
+	_avatarQueue.clear();
+	for (size_t i = 0; i < _avatarDraws.size(); ++i)
+	{
+		const AvatarDraw& draw = _avatarDraws[i];
+		_avatarQueue.push(_avatarDrawKey(draw), draw.program.program, draw.vertexArray, draw.material, draw.callback, (uint32_t)i);
+	}
+}
 
-		// Initialize the avatar module
-		ovrAvatar_Initialize(MIRROR_SAMPLE_APP_ID);
+// Sorts the queue and builds every eye's transform blocks on the job threads, for views[eye].list to replay.
+// _avatarEyesPrepared is done once they are, nothing may push to the queue meanwhile. A kept queue's blocks are
+// the last frame's, only those of draws that moved are worked out again unless the eye moved too.
+static void _prepareAvatarEyes(const RenderView views[ovrEye_Count])
+{
+	for (int eye = 0; eye < ovrEye_Count; ++eye)
+	{
+		_avatarEyeTransforms[eye].resize(_avatarDraws.size());
+	}
+	_jobs.run([]() { _avatarQueue.sort(); }, &_avatarEyesPrepared);
+	for (int eye = 0; eye < ovrEye_Count; ++eye)
+	{
+		const RenderView view = views[eye];
+		const bool all = !_avatarQueueKept || view.viewProj != _avatarEyeViews[eye].viewProj || view.viewPos != _avatarEyeViews[eye].viewPos;
+		_avatarEyeViews[eye] = view;
+		_jobs.run([eye, view, all]()
+		{
+			for (size_t i = 0; i < _avatarDraws.size(); ++i)
+			{
+				const AvatarDraw& draw = _avatarDraws[i];
+				if (all || draw.moved)
+				{
+					_fillAvatarTransformBlock(draw.local, draw.world, view.viewProj, view.viewPos, &_avatarEyeTransforms[eye][i]);
+				}
+			}
+		}, &_avatarEyesPrepared);
+	}
+	_avatarEyesQueued = true;
+}
 
-		// Start retrieving the avatar specification
-		printf("Requesting avatar specification...\r\n");
-		ovrID userID = ovr_GetLoggedInUserID();
-		ovrAvatar_RequestAvatarSpecification(userID);
+// Queries the boxes of the queue's components from eye against the depth drawn so far, for the next frame's draws
+// of them in that eye to be conditional on. Goes before the avatars, so only the rest of the scene hides them.
+static void _queryAvatarOcclusion(const RenderView& view, int eye)
+{
+	if (_avatarOccluders.empty())
+	{
+		return;
+	}
+	GLDebugGroup group("avatar occlusion");
+	_avatarOcclusion.begin(view.viewProj, view.viewPos);
+	for (size_t i = 0; i < _avatarOccluders.size(); ++i)
+	{
+		const Aabb* bounds = _avatarComponentBounds.find(_avatarOccluders[i]);
+		if (bounds)
+		{
+			_avatarOcclusion.query(_avatarOccluders[i], eye, *bounds);
+		}
+	}
+	_avatarOcclusion.end();
+}
 
-		// Recenter the tracking origin at startup so that the reflection avatar appears directly in front of the user
-		ovr_RecenterTrackingOrigin(_session);
+// Queues and draws the avatars for a single view, for views that aren't part of the frame's eyes. The eyes' queue
+// is set aside meanwhile, for the next frame's eyes to keep.
+static void _renderAvatar(ovrAvatar* avatar, uint32_t visibilityMask, const glm::mat4& view, const glm::mat4& proj, const glm::vec3& viewPos, bool renderJoints,
+	const PlanarMirror* mirror = nullptr)
+{
+	_jobs.wait(_avatarEyesPrepared);
+	const bool eyesQueued = _avatarEyesQueued;
+	const bool oitQueued = _avatarOitQueued;
+	const bool queueKept = _avatarQueueKept;
+	_avatarQueue.swap(_avatarViewQueue);
+	_avatarDraws.swap(_avatarViewDraws);
+	_queueAvatar(avatar, visibilityMask, viewPos, nullptr, mirror);
+	RenderView renderView;
+	renderView.view = view;
+	renderView.proj = proj;
+	renderView.viewProj = proj * view;
+	renderView.viewPos = viewPos;
+	_avatarQueue.submit(renderView);
+	_avatarQueue.swap(_avatarViewQueue);
+	_avatarDraws.swap(_avatarViewDraws);
+	_avatarEyesQueued = eyesQueued;
+	_avatarOitQueued = oitQueued;
+	_avatarQueueKept = queueKept;
+}
 
-		cubeScene = std::shared_ptr<ColorCubeScene>(new ColorCubeScene());
+// Appends the final palette of one skinned part, parts whose mesh isn't loaded yet are skipped
+static void _cacheSkinnedPose(ovrAvatarAssetID meshAssetID, const ovrAvatarSkinnedMeshPose& pose)
+{
+	const MeshData* data = _avatarAssets.mesh(meshAssetID);
+	if (!data)
+	{
+		return;
 	}
 
-	void shutdownGl() override {
-		cubeScene.reset();
+	_avatarPoses.blockOf.insert((uintptr_t)&pose) = (uint32_t)_avatarPoses.blocks.size();
+	_avatarPoses.blocks.push_back(&pose);
+	_avatarPoses.inverseBinds.push_back(data->inverseBindAffine);
+	_avatarPoses.meshes.push_back(data);
+}
+
+// Grows box by the joints of a skinned part in world space, transform being its component's world * local
+static void _addSkinnedPoseBounds(const glm::mat4& transform, const ovrAvatarSkinnedMeshPose& pose, Aabb* box)
+{
+	glm::vec3* joints = _frameArena.allocate<glm::vec3>(pose.jointCount);
+	_evaluateJointPositions(pose, joints);
+	for (uint32_t i = 0; i < pose.jointCount; ++i)
+	{
+		const glm::vec4 joint = transform * glm::vec4(joints[i], 1.0f);
+		box->add(glm::vec3(joint.x, joint.y, joint.z) - glm::vec3(AVATAR_SKIN_MARGIN));
+		box->add(glm::vec3(joint.x, joint.y, joint.z) + glm::vec3(AVATAR_SKIN_MARGIN));
 	}
+}
 
-	void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose) override {
-		if (win || lost)
+// Adds the parts of one finalized avatar to the pose cache and its components to the bounds
+static void _cacheAvatarPoses(ovrAvatar* avatar)
+{
+	uint32_t componentCount = ovrAvatarComponent_Count(avatar);
+	for (uint32_t i = 0; i < componentCount; ++i)
+	{
+		const ovrAvatarComponent* component = ovrAvatarComponent_Get(avatar, i);
+		glm::mat4 world;
+		_glmFromOvrAvatarTransform(component->transform, &world);
+		Aabb bounds;
+		for (uint32_t j = 0; j < component->renderPartCount; ++j)
 		{
-			if (reset_flag)
+			const ovrAvatarRenderPart* renderPart = component->renderParts[j];
+			glm::mat4 local;
+			switch (ovrAvatarRenderPart_GetType(renderPart))
 			{
-				win = false;
-				lost = false;
-				reset_flag = false;
-				glClearColor(0.0f, 0.0f, 0.55f, 0.0f);
-				cubeScene = std::shared_ptr<ColorCubeScene>(new ColorCubeScene());
+			case ovrAvatarRenderPartType_SkinnedMeshRender:
+			{
+				const ovrAvatarRenderPart_SkinnedMeshRender* mesh = ovrAvatarRenderPart_GetSkinnedMeshRender(renderPart);
+				_cacheSkinnedPose(mesh->meshAssetID, mesh->skinnedPose);
+				_glmFromOvrAvatarTransform(mesh->localTransform, &local);
+				_addSkinnedPoseBounds(world * local, mesh->skinnedPose, &bounds);
+				break;
+			}
+			case ovrAvatarRenderPartType_SkinnedMeshRenderPBS:
+			{
+				const ovrAvatarRenderPart_SkinnedMeshRenderPBS* mesh = ovrAvatarRenderPart_GetSkinnedMeshRenderPBS(renderPart);
+				_cacheSkinnedPose(mesh->meshAssetID, mesh->skinnedPose);
+				_glmFromOvrAvatarTransform(mesh->localTransform, &local);
+				_addSkinnedPoseBounds(world * local, mesh->skinnedPose, &bounds);
+				break;
+			}
+			default:
+				// Projectors reuse the palette of the skinned part they project onto
+				break;
 			}
 		}
-		cubeScene->render(projection, glm::inverse(headPose));
+		_avatarComponentBounds.insert((uintptr_t)component) = bounds;
+	}
+}
 
+// Skins every block's mesh by its palette into _avatarPreskin.buffer, one transform feedback draw of points per
+// block with the rasterizer off. Blocks go one after another, so a block's vertices start at skinnedBases[block].
+static void _preskinAvatarPoses()
+{
+	size_t vertexCount = 0;
+	_avatarPoses.skinnedBases.resize(_avatarPoses.blocks.size());
+	for (size_t block = 0; block < _avatarPoses.blocks.size(); ++block)
+	{
+		_avatarPoses.skinnedBases[block] = (GLint)vertexCount;
+		vertexCount += _avatarPoses.meshes[block]->vertexCount;
+	}
+	if (vertexCount > _avatarPreskin.capacity)
+	{
+		// Half again as much, so avatars joining one by one don't regrow it every time
+		_avatarPreskin.capacity = vertexCount + vertexCount / 2;
+		if (!_avatarPreskin.buffer)
+		{
+			glGenBuffers(1, &_avatarPreskin.buffer);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, _avatarPreskin.buffer);
+		glBufferData(GL_ARRAY_BUFFER, _avatarPreskin.capacity * sizeof(AvatarSkinnedVertex), NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		_glLabel(GL_BUFFER, _avatarPreskin.buffer, "avatar preskinned vertices");
+		for (const AvatarVertexArray& a : _avatarPreskin.vertexArrays)
+		{
+			glDeleteVertexArrays(1, &a.vertexArray);
+		}
+		_avatarPreskin.vertexArrays.clear();
 	}
-};
 
-// Execute our example class
-int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
-	int result = -1;
-	try {
-		// Initialization call
-		if (ovr_PlatformInitializeWindows(MIRROR_SAMPLE_APP_ID) != ovrPlatformInitialize_Success)
+	_glState.useProgram(_avatarPreskin.program);
+	glEnable(GL_RASTERIZER_DISCARD);
+	for (size_t block = 0; block < _avatarPoses.blocks.size(); ++block)
+	{
+		const MeshData* mesh = _avatarPoses.meshes[block];
+		GLintptr offset = (GLintptr)(block * _avatarPoses.blockStride * sizeof(glm::mat4));
+		glBindBufferRange(GL_UNIFORM_BUFFER, AVATAR_POSE_BINDING, _avatarPoses.buffer, offset, sizeof(glm::mat4) * OVR_AVATAR_MAXIMUM_JOINT_COUNT);
+		glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, _avatarPreskin.buffer,
+			(GLintptr)_avatarPoses.skinnedBases[block] * sizeof(AvatarSkinnedVertex), mesh->vertexCount * sizeof(AvatarSkinnedVertex));
+		_glState.bindVertexArray(mesh->vertexArray);
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, mesh->baseVertex, (GLsizei)mesh->vertexCount);
+		_renderStats.draw(GL_POINTS, (GLsizei)mesh->vertexCount);
+		glEndTransformFeedback();
+	}
+	glDisable(GL_RASTERIZER_DISCARD);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	_glState.bindVertexArray(0);
+}
+
+// Rebuilds the pose cache and the component bounds from the finalized poses of the local avatar and the remote
+// ones, then evaluates every palette in one parallel pass and uploads them in one go
+static void _updateAvatarPoses(ovrAvatar* avatar, const std::vector<ovrAvatar*>& remotes)
+{
+	if (!_avatarPoses.buffer)
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		size_t bytes = sizeof(glm::mat4) * OVR_AVATAR_MAXIMUM_JOINT_COUNT;
+		bytes = (bytes + alignment - 1) / alignment * alignment;
+		_avatarPoses.blockStride = (bytes + sizeof(glm::mat4) - 1) / sizeof(glm::mat4);
+		glGenBuffers(1, &_avatarPoses.buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, _avatarPoses.buffer);
+		_glLabel(GL_BUFFER, _avatarPoses.buffer, "avatar palettes");
+	}
+
+	_avatarPoses.blocks.clear();
+	_avatarPoses.blockOf.clear();
+	_avatarPoses.inverseBinds.clear();
+	_avatarPoses.meshes.clear();
+	_avatarComponentBounds.clear();
+	_cacheAvatarPoses(avatar);
+	for (size_t i = 0; i < remotes.size(); ++i)
+	{
+		_cacheAvatarPoses(remotes[i]);
+	}
+
+	if (_avatarPoses.blocks.empty())
+	{
+		return;
+	}
+	// Parts are independent, one job per part
+	_avatarPoses.palettes.resize(_avatarPoses.blocks.size() * _avatarPoses.blockStride);
+	_jobs.parallelFor(_avatarPoses.blocks.size(), 1, [](size_t begin, size_t end)
+	{
+		for (size_t block = begin; block < end; ++block)
 		{
-			FAIL("Failed to initialize the Oculus Platform");
-			// Exit.  Initialization failed which means either the oculus service isnt on the machine or theyve hacked their DLL
+			_evaluateSkinningPalette(*_avatarPoses.blocks[block], _avatarPoses.inverseBinds[block], &_avatarPoses.palettes[block * _avatarPoses.blockStride]);
+		}
+	});
+	glBindBuffer(GL_UNIFORM_BUFFER, _avatarPoses.buffer);
+	glBufferData(GL_UNIFORM_BUFFER, _avatarPoses.palettes.size() * sizeof(glm::mat4), _avatarPoses.palettes.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	_renderStats.uniforms(_avatarPoses.palettes.size() * sizeof(glm::mat4));
+	if (_preskinAvatars)
+	{
+		GLDebugGroup debugGroup("avatar preskin");
+		_preskinAvatarPoses();
+	}
+}
+
+static void _updateAvatar(
+	ovrAvatar* avatar,
+	float deltaSeconds,
+	const ovrAvatarTransform& hmd,
+	const ovrAvatarHandInputState& left,
+	const ovrAvatarHandInputState& right,
+	VoiceCapture* voice,
+	AvatarPacketPlayer* player
+) {
+	if (player && player->isOpen())
+	{
+		// The recorded motion at a fixed rate, so the pose is the same frame for frame on every run
+		player->advance(avatar);
+		deltaSeconds = AVATAR_PACKET_PLAYBACK_STEP;
+	}
+	else
+	{
+		// The voice visualization takes what the capture thread got since the last frame
+		if (voice && voice->running())
+		{
+			uint32_t sampleCount;
+			const float* samples = voice->window(&sampleCount);
+			if (sampleCount > 0)
+			{
+				ovrAvatarPose_UpdateVoiceVisualization(avatar, sampleCount, samples);
+			}
 		}
-		ovr_Entitlement_GetIsViewerEntitled();
-		if (!OVR_SUCCESS(ovr_Initialize(nullptr))) {
+
+		// Update the avatar pose from the inputs. The head pose goes in whatever the capabilities, the hands are
+		// placed from it too.
+		ovrAvatarPose_UpdateBody(avatar, hmd);
+		ovrAvatarPose_UpdateHands(avatar, left, right);
+	}
+	ovrAvatarPose_Finalize(avatar, deltaSeconds);
+	_avatarRecorder.update(avatar, deltaSeconds);
+}
+
+
+/************************************************************************************
+* OVR helpers
+************************************************************************************/
+
+//static ovrSession _initOVR()
+//{
+//	ovrSession ovr;
+//	if (OVR_SUCCESS(ovr_Initialize(NULL)))
+//	{
+//		ovrGraphicsLuid luid;
+//		if (OVR_SUCCESS(ovr_Create(&ovr, &luid)))
+//		{
+//			return ovr;
+//		}
+//		ovr_Shutdown();
+//	}
+//	return NULL;
+//}
+//
+//static void _destroyOVR(ovrSession session)
+//{
+//	if (session)
+//	{
+//		ovr_Destroy(session);
+//		ovr_Shutdown();
+//	}
+//}
+
+/************************************************************************************
+* Avatar message handlers
+************************************************************************************/
+
+// Queues an upload of id straight from its avatar cache file, false if there is none that is usable
+static bool _queueCachedAvatarAsset(ovrAvatarAssetID id)
+{
+	AvatarCacheUpload* cached = new AvatarCacheUpload();
+	if (!cached->asset.open(id))
+	{
+		delete cached;
+		return false;
+	}
+	const AvatarCacheHeader& header = cached->asset.header;
+	const uint8_t* payload = cached->asset.payload;
+	AvatarUploadJob job;
+	memset(&job, 0, sizeof(job));
+	job.assetID = id;
+	job.type = (ovrAvatarAssetType)header.type;
+	job.cached = cached;
+	if (job.type == ovrAvatarAssetType_Mesh)
+	{
+		const uint32_t vertexCount = header.counts[0], indexCount = header.counts[1], jointCount = header.counts[2];
+		const size_t bindBytes = jointCount * sizeof(glm::mat4);
+		const size_t vertexBytes = vertexCount * sizeof(AvatarPackedVertex);
+		if (jointCount > OVR_AVATAR_MAXIMUM_JOINT_COUNT || header.payloadSize != bindBytes + vertexBytes + indexCount * sizeof(uint16_t))
+		{
+			delete cached;
+			return false;
+		}
+		job.mesh = new MeshData();
+		memcpy(job.mesh->bindPose, payload, bindBytes);
+		for (uint32_t i = 0; i < jointCount; ++i)
+		{
+			job.mesh->inverseBindPose[i] = glm::inverse(job.mesh->bindPose[i]);
+			_affineFromMat4(job.mesh->inverseBindPose[i], &job.mesh->inverseBindAffine[i]);
+		}
+		job.packedVertices = (AvatarPackedVertex*)(payload + bindBytes);
+		memset(&cached->mesh, 0, sizeof(cached->mesh));
+		cached->mesh.vertexCount = vertexCount;
+		cached->mesh.indexCount = indexCount;
+		cached->mesh.indexBuffer = (const uint16_t*)(payload + bindBytes + vertexBytes);
+		job.meshData = &cached->mesh;
+	}
+	else if (job.type == ovrAvatarAssetType_Texture)
+	{
+		cached->texture.format = (ovrAvatarTextureFormat)header.counts[0];
+		cached->texture.sizeX = header.counts[1];
+		cached->texture.sizeY = header.counts[2];
+		cached->texture.mipCount = header.counts[3];
+		cached->texture.textureDataSize = header.payloadSize;
+		cached->texture.textureData = payload;
+		job.textureData = &cached->texture;
+	}
+	else
+	{
+		delete cached;
+		return false;
+	}
+	_avatarUploads.push_back(job);
+	return true;
+}
+
+// Asks the SDK for an asset the registry has just marked Pending, and queues its cached copy if there is one.
+// Still asked for when it is cached, the SDK's copy is what tells whether the cache is current.
+static void _loadAvatarAsset(ovrAvatarAssetID id)
+{
+	_requestAvatarPump({ AvatarPumpRequestKind::BeginLoading, id, nullptr });
+	++_loadingAssets;
+	if (_avatarCacheEnabled && _queueCachedAvatarAsset(id))
+	{
+		_avatarAssets.markCached(id);
+	}
+}
+
+// The avatar the pump created for a specification, and the assets it references
+static void _handleAvatarSpecification(AvatarPumpResult& result)
+{
+	TRACE_ZONE("avatar specification");
+	AllocationTagScope tagScope(AllocationTag::AvatarAssets);
+	ovrAvatar* avatar = result.avatar;
+	if (_avatarNetwork.isRemote(result.userID))
+	{
+		// Posed from their packets, the network owns it from here. One it no longer waits for, a request that ran
+		// out or a user who already has one, isn't loaded at all.
+		if (!_avatarNetwork.attach(result.userID, avatar))
+		{
+			ovrAvatar_Destroy(avatar);
+			return;
+		}
+	}
+	else
+	{
+		_avatar = avatar;
+		// Packets are only decoded once the avatar SDK is up and running
+		if (!_avatarPlaybackPath.empty())
+		{
+			_avatarPlayer.open(_avatarPlaybackPath.c_str());
+		}
+	}
+
+	// Trigger load operations for all of the assets referenced by the avatar, assets shared with avatars already
+	// loaded are only requested once
+	for (size_t i = 0; i < result.assets.size(); ++i)
+	{
+		const ovrAvatarAssetID id = result.assets[i];
+		if (_avatarAssets.request(id))
+		{
+			_loadAvatarAsset(id);
+		}
+	}
+	printf("Loading %d assets...\r\n", _loadingAssets);
+	_warmUpAvatarPrograms(avatar);
+}
+
+// Evicted avatar assets drawn last frame are loaded again, they show once their uploads are through
+static void _reloadEvictedAvatarAssets()
+{
+	static std::vector<ovrAvatarAssetID> reloads;
+	_avatarAssets.takeReloads(&reloads);
+	for (size_t i = 0; i < reloads.size(); ++i)
+	{
+		_loadAvatarAsset(reloads[i]);
+	}
+	if (!reloads.empty())
+	{
+		printf("Reloading %d evicted assets...\r\n", (int)reloads.size());
+	}
+}
+
+// Gives memory back from the categories over their budget, or all evictable ones when the driver is low: unused
+// TextureCache textures first, then the streamed levels nothing has drawn lately, then idle avatar textures; idle avatar meshes, then the arena pages that left
+// empty. Scene meshes in use are never evicted, so the Meshes budget can stay exceeded by a large enough scene.
+static void _enforceGpuBudgets(uint64_t frame)
+{
+	_gpuMemory.update(frame);
+	const int64_t textures = _gpuMemory.excess(GpuMemoryCategory::Textures);
+	if (textures > 0)
+	{
+		int64_t freed = _textures.evict(textures);
+		if (freed < textures)
+		{
+			freed += _textures.trim(textures - freed);
+		}
+		if (freed < textures)
+		{
+			_avatarAssets.evict(true, textures - freed);
+		}
+	}
+	const int64_t meshes = _gpuMemory.excess(GpuMemoryCategory::Meshes);
+	if (meshes > 0)
+	{
+		_avatarAssets.evict(false, meshes);
+		// Freed ranges only go back to their pages once their fence has passed, so a page emptied now is
+		// trimmed on one of the next frames the budget is still exceeded
+		_gpuArena.trim();
+	}
+}
+
+// Queues the asset for upload by _pumpAvatarUploads, which takes ownership of the message. An asset already going
+// up from the avatar cache only goes up again if the SDK delivered something different.
+static void _handleAssetLoaded(const AvatarPumpResult& result)
+{
+	TRACE_ZONE("avatar asset loaded");
+	AllocationTagScope tagScope(AllocationTag::AvatarAssets);
+	AvatarUploadJob job = result.job;
+	if (_avatarAssets.cached(job.assetID))
+	{
+		if (job.cacheCurrent)
+		{
+			delete[] job.packedVertices;
+			delete job.mesh;
+			_requestAvatarPump({ AvatarPumpRequestKind::FreeMessage, 0, job.message });
+			return;
+		}
+		job.replacesCached = true;
+	}
+	_avatarUploads.push_back(job);
+}
+
+namespace ovr {
+
+	// Convenience method for looping over each eye with a lambda
+	template <typename Function>
+	inline void for_each_eye(Function function) {
+		for (ovrEyeType eye = ovrEyeType::ovrEye_Left;
+			eye < ovrEyeType::ovrEye_Count;
+			eye = static_cast<ovrEyeType>(eye + 1)) {
+			function(eye);
+		}
+	}
+
+	inline mat4 toGlm(const ovrMatrix4f & om) {
+		return glm::transpose(glm::make_mat4(&om.M[0][0]));
+	}
+
+	inline mat4 toGlm(const ovrFovPort & fovport, float nearPlane = 0.01f, float farPlane = 10000.0f) {
+		return toGlm(ovrMatrix4f_Projection(fovport, nearPlane, farPlane, true));
+	}
+
+	inline vec3 toGlm(const ovrVector3f & ov) {
+		return glm::make_vec3(&ov.x);
+	}
+
+	inline vec2 toGlm(const ovrVector2f & ov) {
+		return glm::make_vec2(&ov.x);
+	}
+
+	inline uvec2 toGlm(const ovrSizei & ov) {
+		return uvec2(ov.w, ov.h);
+	}
+
+	inline quat toGlm(const ovrQuatf & oq) {
+		return glm::make_quat(&oq.x);
+	}
+
+	inline mat4 toGlm(const ovrPosef & op) {
+		return _mat4FromOvrPose(op);
+	}
+
+	inline ovrMatrix4f fromGlm(const mat4 & m) {
+		ovrMatrix4f result;
+		mat4 transposed(glm::transpose(m));
+		memcpy(result.M, &(transposed[0][0]), sizeof(float) * 16);
+		return result;
+	}
+
+	inline ovrVector3f fromGlm(const vec3 & v) {
+		ovrVector3f result;
+		result.x = v.x;
+		result.y = v.y;
+		result.z = v.z;
+		return result;
+	}
+
+	inline ovrVector2f fromGlm(const vec2 & v) {
+		ovrVector2f result;
+		result.x = v.x;
+		result.y = v.y;
+		return result;
+	}
+
+	inline ovrSizei fromGlm(const uvec2 & v) {
+		ovrSizei result;
+		result.w = v.x;
+		result.h = v.y;
+		return result;
+	}
+
+	inline ovrQuatf fromGlm(const quat & q) {
+		ovrQuatf result;
+		result.x = q.x;
+		result.y = q.y;
+		result.z = q.z;
+		result.w = q.w;
+		return result;
+	}
+}
+
+class RiftManagerApp {
+protected:
+	ovrSession _session;
+	ovrHmdDesc _hmdDesc;
+	ovrGraphicsLuid _luid;
+
+public:
+	RiftManagerApp() {
+		// No session at all under --bench, every call that would take one goes to _benchHmd
+		if (_benchHmd.active()) {
+			_session = nullptr;
+			_hmdDesc = _benchHmd.hmdDesc();
+			return;
+		}
+		// Nor under --remote, whose headset's optics are the ones rendered for
+		if (_remoteHmd.active()) {
+			_session = nullptr;
+			_remoteHmd.waitForHeadset();
+			_hmdDesc = _remoteHmd.hmdDesc();
+			return;
+		}
+		if (!OVR_SUCCESS(ovr_Create(&_session, &_luid))) {
+			FAIL("Unable to create HMD session");
+		}
+
+		_hmdDesc = ovr_GetHmdDesc(_session);
+	}
+
+	~RiftManagerApp() {
+		if (_session) {
+			ovr_Destroy(_session);
+		}
+		_session = nullptr;
+	}
+};
+
+// Both eyes' cameras for scenes that draw the pair in a single pass, see RiftApp::StereoMode
+struct StereoView {
+	mat4 projections[2];
+	mat4 views[2];
+	// Per eye NDC scale (xy) and offset (zw) into the side by side target, used by instanced stereo
+	vec4 eyeViewports[2];
+	// Instances issued per object: 2 for instanced stereo, 1 otherwise
+	GLint eyeCount;
+	// The target is a two layer GL_OVR_multiview2 framebuffer, programs must be the STEREO_MULTIVIEW variant
+	bool multiview;
+};
+
+// One eye's camera for the frame, what every pass drawing that eye derives from its pose and projection
+struct EyeConstants {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProj;
+	// The eye's pose in the world, renderScene() takes this rather than the view
+	mat4 inverseView;
+	vec3 position;
+};
+
+// Both eyes of the scene layer, worked out once from the frame's eye poses. The culling frustum, the scene, the
+// avatar lists and the LateLatch block all read their cameras from it, so none of them can disagree.
+struct FrameConstants {
+	EyeConstants eyes[ovrEye_Count];
+};
+
+#define LATE_LATCH_BINDING 2
+// Shader define for programs that read their cameras from the LateLatch block
+#define LATE_LATCH_DEFINE "#define LATE_LATCH\n"
+
+// std140 layout of the LateLatch block in shader.vert and molecule.vert
+struct LateLatchBlock {
+	mat4 views[2];
+	mat4 projections[2];
+	// World transforms of the left and right controllers
+	mat4 hands[2];
+};
+
+// A single eye expressed as a StereoView, both elements hold the same camera
+static StereoView _monoStereoView(const mat4 & projection, const mat4 & view) {
+	StereoView stereo;
+	for (int eye = 0; eye < 2; ++eye) {
+		stereo.projections[eye] = projection;
+		stereo.views[eye] = view;
+		stereo.eyeViewports[eye] = vec4(1, 1, 0, 0);
+	}
+	stereo.eyeCount = 1;
+	stereo.multiview = false;
+	return stereo;
+}
+
+// Profiler overlay texture in pixels, its budget marker stands for the refresh period
+#define PROFILER_OVERLAY_WIDTH 256
+#define PROFILER_OVERLAY_HEIGHT 80
+// Draw calls a frame's bar reaches the budget marker at
+#define PROFILER_DRAW_BUDGET 500
+
+// Status HUD layer texture in pixels
+#define HUD_WIDTH 256
+#define HUD_HEIGHT 64
+
+// Loading layer image in pixels
+#define LOADING_WIDTH 512
+#define LOADING_HEIGHT 256
+
+// Dynamic resolution: pixel density the eye texture is allocated at, and the range the viewports scale within
+#define DYNAMIC_RESOLUTION_MAX_DENSITY 1.0f
+#define DYNAMIC_RESOLUTION_MIN_SCALE 0.6f
+// Fraction of the frame budget the GPU is steered towards, the rest is headroom for spikes
+#define DYNAMIC_RESOLUTION_TARGET 0.85f
+// Frames between adjustments, longer than PROFILER_LATENCY so each change is measured before the next
+#define DYNAMIC_RESOLUTION_INTERVAL 8
+#define DYNAMIC_RESOLUTION_STEP 0.02f
+
+// Fixed foveation: the inset covers this fraction of each eye's FOV tangents at full density,
+// and the eye layer underneath it drops to this fraction of its resolution
+#define FOVEATION_INSET_TANGENT 0.5f
+#define FOVEATION_PERIPHERY_SCALE 0.5f
+
+// Clip planes of every projection into the eye targets
+#define EYE_NEAR_PLANE 0.01f
+#define EYE_FAR_PLANE 1000.0f
+
+// Reversed-Z: the eye targets get a float depth buffer cleared to 0 and tested with GL_GREATER, and the projections
+// put far at 0 and near at 1. With glClipControl's 0..1 depth range nothing is lost converting to window depth, so
+// the float spends its precision on the distance instead of next to the near plane. --standard-depth turns it off,
+// as does a driver without ARB_clip_control.
+static bool _reversedDepth = true;
+
+// The lens' hidden area is laid into the eye depth at the near plane before the scene, where the runtime provides the
+// mesh. --no-hidden-area leaves the eyes unmasked, for measuring what it saves.
+static bool _hiddenAreaMask = true;
+
+// Coarse shading of the periphery where the driver has NV_shading_rate_image, at the level the quality controller
+// picks. --no-shading-rate keeps every pixel shaded.
+static bool _shadingRateAllowed = true;
+
+// --multi-gpu renders each eye on its own GPU of a linked pair, where the driver runs the app with NV_gpu_multicast,
+// see EyeGpus. The eyes are then always submitted one after the other.
+static bool _multiGpuAllowed = false;
+
+// Split rate rendering, --split-rate: scenes with a static environment render it into a layer of its own every
+// EnvironmentLayer::interval() frames, and only its depth into the eye target, see EnvironmentLayer
+static bool _splitRateAllowed = false;
+
+// Temporal upscaling, --temporal-upscale: the eyes render jittered below the swap chain's size, from
+// TEMPORAL_UPSCALE_SCALE down, and are reconstructed to the full viewports from the history, see TemporalUpscaler
+static bool _temporalUpscaleAllowed = false;
+
+// Depth format of the eye targets, which anything copying their depth has to allocate too
+static GLenum _eyeDepthFormat() {
+	return _reversedDepth ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT16;
+}
+
+// Most MSAA samples the eye target may use, --msaa <n> sets it and 1 turns MSAA off. The quality controller moves
+// between 1 and this, and the driver's GL_MAX_SAMPLES caps it.
+static GLint _msaaMaxSamples = 4;
+// Frames between sample count increases, much longer than DYNAMIC_RESOLUTION_INTERVAL: each one reallocates the
+// target, and one that doesn't fit the budget is taken back at the next adjustment
+#define DYNAMIC_MSAA_INTERVAL 90
+// Times the quality governor may halve the spectator's rate
+#define QUALITY_SPECTATOR_HALVINGS 2
+
+// What the desktop window shows. The compositor's mirror is the distorted view the HMD gets and costs the
+// compositor a copy every frame, Eye blits the undistorted left eye straight from the swap chain texture
+// without asking the compositor for a mirror at all, and Off leaves the window alone for unattended installs.
+// Spectator draws the scene again from a third person camera, see spectator.h.
+enum class MirrorMode {
+	Off,
+	Eye,
+	Compositor,
+	Spectator,
+};
+static MirrorMode _mirrorMode = MirrorMode::Compositor;
+// Mirrors only every Nth frame (--mirror-every <n>), and at most at this rate (--mirror-hz <hz>, 0 for any).
+// The window is only swapped on the frames it is mirrored on.
+static int _mirrorEvery = 1;
+static float _mirrorHz = 0.0f;
+// The spectator's target against the window's size, --spectator-scale <fraction>
+static float _spectatorScale = 0.5f;
+// The window's frames also go to this video, --record-session <file.mp4>, see sessionrecord.h
+static char _sessionRecordPath[MAX_PATH] = "";
+// Where the profiler's and the compositor's numbers go when it is open, instead of their CSVs on the render thread:
+// --telemetry-file <path> for rotating compressed files, --telemetry-udp <address:port> for a listener, see
+// telemetrysink.h. Anything may write to it once WinMain has opened it.
+static TelemetrySink _telemetrySink;
+// A frame interval over this many ms, or a dropped frame, dumps the hitch recorder's ring, see hitchrecorder.h.
+// --hitch-budget <ms>, 0 turns the recorder off; HITCH_BUDGET_PERIODS refresh periods unless given.
+static double _hitchBudgetMs = -1.0;
+// --latency-test times trigger presses to the display, see latencytest.h; --latency-photodiode <port> adds a
+// photodiode on a serial port, COM3 and the like, and turns the test on with it
+static bool _latencyTestEnabled = false;
+static char _latencyPhotodiodePort[32] = "";
+// Stop simulating and drawing while the HMD is off or the app isn't visible in it, see SessionMonitor. --no-idle
+// draws every frame regardless, pose traces always do so their frames line up.
+static bool _sessionIdleAllowed = true;
+
+// The mirror the third person avatar shows up in, facing the user after the startup recenter.
+// --reflection-size <pixels> sets its texture's larger side, 0 leaves the mirror out.
+#define REFLECTION_DISTANCE 1.0f
+#define REFLECTION_WIDTH 0.8f
+#define REFLECTION_HEIGHT 1.2f
+static GLsizei _reflectionSize = 512;
+
+// GPU time the avatar may take over both eyes and the reflection, --avatar-budget <ms>. Going over it switches
+// the body and base to reduced shading, which stays until the avatar is back under half the budget.
+static float _avatarBudgetMs = 2.0f;
+// Frames between reduced shading switches, long enough for the timings of the last switch to come back
+#define AVATAR_BUDGET_INTERVAL 30
+
+// Whether the scene lays down depth before shading, see RiftApp::_updateDepthPrepass. --depth-prepass and
+// --no-depth-prepass fix it either way.
+enum class DepthPrepassMode {
+	Auto,
+	On,
+	Off,
+};
+static DepthPrepassMode _depthPrepassMode = DepthPrepassMode::Auto;
+// Frames between pre-pass decisions, and how long Auto waits after a trial that didn't pay
+#define DEPTH_PREPASS_INTERVAL 30
+#define DEPTH_PREPASS_RETRY 900
+
+class RiftApp : public GlfwApp, public RiftManagerApp {
+public:
+	// How the scene (not the avatar) is drawn into the two eye viewports
+	enum class StereoMode {
+		// renderScene() once per eye
+		Sequential,
+		// renderSceneStereo() once, every draw doubles its instance count and the vertex shader picks the eye
+		Instanced,
+		// renderSceneStereo() once into a two layer texture through GL_OVR_multiview2, then copied into the eye texture
+		Multiview,
+	};
+
+private:
+	// The eye, MSAA and inset targets and the passes between them, see _buildRenderGraph. Compiled again when the
+	// samples it was built for change.
+	RenderGraph _renderGraph;
+	GLint _renderGraphSamples{ 0 };
+	RenderGraphTarget _targetEyeColor{ RENDER_GRAPH_NONE };
+	RenderGraphTarget _targetInsetColor{ RENDER_GRAPH_NONE };
+	RenderGraphPass _passEyes{ RENDER_GRAPH_NONE };
+	// With the upscaler the eyes go into the scene pair, sampled by the upscale pass that writes the swap chain
+	RenderGraphTarget _targetSceneColor{ RENDER_GRAPH_NONE };
+	RenderGraphTarget _targetSceneDepth{ RENDER_GRAPH_NONE };
+	RenderGraphTarget _targetUpscaleHistory{ RENDER_GRAPH_NONE };
+	// The eyes' depth sent along to a --remote headset
+	RenderGraphTarget _targetRemoteDepth{ RENDER_GRAPH_NONE };
+	bool _upscaling{ false };
+	// Each eye's sub-pixel offset this frame in NDC, already in the projections of _frameConstants
+	vec2 _upscaleJitter[2];
+	// The scene and avatar draw into a multisampled target while more than one sample is in use, bypassed in
+	// multiview, resolved into the swap chain texture
+	GLint _msaaSamples{ 1 };
+	unsigned int _avatarBudgetChangedFrame{ 0 };
+	bool _depthPrepass{ false };
+	// See environmentOwnLayer()
+	bool _environmentOwnLayer{ false };
+	// A pre-pass just turned on, kept at the next decision only if the scene got cheaper than baselineMs
+	bool _depthPrepassTrial{ false };
+	float _depthPrepassBaselineMs{ 0 };
+	unsigned int _depthPrepassChangedFrame{ 0 };
+	unsigned int _depthPrepassRetryFrame{ 0 };
+	ovrTextureSwapChain _eyeTexture;
+
+	GLuint _mirrorFbo{ 0 };
+	ovrMirrorTexture _mirrorTexture{ nullptr };
+	// Whether this frame is an idle one, only polling the session, see _sessionIdle
+	bool _idleFrame{ false };
+	// Whether this frame was drawn into the window, and when that last happened
+	bool _mirrored{ false };
+	double _mirrorTime{ 0 };
+	// Frames the pacer had missed when the spectator last looked
+	uint32_t _spectatorMissed{ 0 };
+	// Whether the startup timeline has gone into _fleetStats
+	bool _fleetStartupTimed{ false };
+	// Halvings of the spectator's rate the quality governor has made, and what its last frame cost the GPU
+	int _spectatorRateLevel{ 0 };
+	float _spectatorGpuMs{ 0 };
+
+	ovrEyeRenderDesc _eyeRenderDescs[2];
+
+	mat4 _eyeProjections[2];
+	// The scene layer's cameras of this frame, see _updateFrameConstants()
+	FrameConstants _frameConstants;
+	// What of each eye viewport the lenses hide, masked out of the scene layer's eyes only
+	HiddenAreaMask _hiddenArea;
+
+	ovrLayerEyeFov _sceneLayer;
+	ovrViewScaleDesc _viewScaleDesc;
+
+	uvec2 _renderTargetSize;
+	uvec2 _mirrorSize;
+
+	// Wall clock time between the last two calls to update()
+	float _frameDeltaSeconds{ 0 };
+
+	// Heap allocations made by the eye render loop since the last report
+	AllocationSample _drawAllocations{ 0, 0 };
+
+	StereoMode _stereoMode{ StereoMode::Sequential };
+	// This frame's texture of the eye swap chain
+	GLuint _eyeTextureId{ 0 };
+	// What initGl settled on for this machine, benchmark runs that don't pick a mode go back to it
+	StereoMode _initialStereoMode{ StereoMode::Sequential };
+	bool _benchRunStarted{ false };
+	// Multiview target, one array layer per eye, both eyes at the size of the larger one
+	GLuint _multiviewFbo{ 0 };
+	GLuint _multiviewReadFbo{ 0 };
+	GLuint _multiviewColor{ 0 };
+	GLuint _multiviewDepth{ 0 };
+	uvec2 _multiviewSize;
+
+	// Frame phases, see the constructor for what each one covers
+	FrameProfiler _profiler;
+	CompositorTelemetry _telemetry;
+	int _phaseUpdate, _phaseAvatarPose, _phaseReflection, _phaseScene[2], _phaseAvatar[2], _phaseInset, _phaseEnvironment, _phaseUpscale, _phaseSubmit, _phaseMirror, _phaseRecord;
+	int _counterStateChanges, _counterStateFiltered;
+	int _counterArenaResident, _counterArenaFragmentation;
+	int _counterCulledMeshes, _counterCulledInstances;
+	int _counterMsaaSamples;
+	int _counterShadingRate;
+	int _counterNetIn, _counterNetOut, _counterNetBuffer, _counterNetLost;
+	int _counterAvatarsReduced, _counterAvatarsDistant;
+	int _counterFrameArenaPeak;
+	int _counterPacingWait, _counterFrameInterval, _counterPacingMissed;
+	int _counterFrameAllocations, _counterCriticalAllocations;
+	int _counterHeapTags[(int)AllocationTag::Count];
+	int _counterGpuMemory[(int)GpuMemoryCategory::Count];
+	int _counterVramAvailable, _counterAvatarEvictions;
+	// The whole frame's RenderStats, then the draw calls of each pass and eye that has one
+	int _counterDraws, _counterInstances, _counterTriangles;
+	int _counterProgramBinds, _counterVertexArrayBinds, _counterTextureBinds;
+	int _counterUniformBytes, _counterUploadBytes;
+	int _counterPassDraws[(int)RenderPass::Count][(int)RenderEye::Count];
+	// _gpuBuckets' buckets of what RiftApp draws, the scene adds its own
+	int _bucketAvatarSkinned, _bucketAvatarProjector, _bucketOverlays;
+	// Head locked bar graph of the profiler, toggled with P
+	ovrTextureSwapChain _overlayTexture{ nullptr };
+	GLuint _overlayFbo{ 0 };
+	ovrLayerQuad _overlayLayer;
+	bool _showOverlay{ false };
+
+	// The eye texture is sized for DYNAMIC_RESOLUTION_MAX_DENSITY once; only the viewports inside it follow the GPU time
+	ovrSizei _maxViewportSize[2];
+	float _resolutionScale{ 1.0f };
+	// Most the scale goes up to, lower than 1 where the GPU calibration's preset found the full size too much
+	float _resolutionCeiling{ 1.0f };
+
+	// Fixed foveation, toggled with F. A second eye layer with a narrower FOV, rendered at full density into its own
+	// swap chain, is composited over the centre of the low resolution eye layer.
+	bool _foveated{ false };
+	ovrLayerEyeFov _insetLayer;
+	ovrTextureSwapChain _insetTexture{ nullptr };
+	uvec2 _insetTargetSize;
+	mat4 _insetProjections[2];
+
+	// Late latching, toggled with L. Poses are predicted for the display time of the frame either way;
+	// with it on they are sampled again after the avatar update, right before the first draw.
+	bool _lateLatch{ true };
+	GLuint _lateLatchBuffer{ 0 };
+	mat4 _latchedHands[2];
+	// The player as sampled this frame, handed to the game once the poses are final
+	GameInput _gameInput;
+
+public:
+
+	RiftApp() {
+		using namespace ovr;
+		_viewScaleDesc.HmdSpaceToWorldScaleInMeters = 1.0f;
+
+		memset(&_sceneLayer, 0, sizeof(ovrLayerEyeFov));
+		_sceneLayer.Header.Type = ovrLayerType_EyeFov;
+		_sceneLayer.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft;
+
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			ovrEyeRenderDesc& erd = _eyeRenderDescs[eye] = _hmdGetRenderDesc(_session, eye, _hmdDesc.DefaultEyeFov[eye]);
+			_viewScaleDesc.HmdToEyeOffset[eye] = erd.HmdToEyeOffset;
+
+			ovrFovPort & fov = _sceneLayer.Fov[eye] = _eyeRenderDescs[eye].Fov;
+			auto eyeSize = _hmdGetFovTextureSize(_session, eye, fov, DYNAMIC_RESOLUTION_MAX_DENSITY);
+			_maxViewportSize[eye] = eyeSize;
+			_sceneLayer.Viewport[eye].Size = eyeSize;
+			_sceneLayer.Viewport[eye].Pos = { (int)_renderTargetSize.x, 0 };
+
+			_renderTargetSize.y = std::max(_renderTargetSize.y, (uint32_t)eyeSize.h);
+			_renderTargetSize.x += eyeSize.w;
+		});
+		// Make the on screen window 1/4 the resolution of the render target, or half an eye when it only shows one
+		_mirrorSize = _renderTargetSize;
+		_mirrorSize /= 4;
+		if (_mirrorMode == MirrorMode::Eye) {
+			const ovrSizei & eyeSize = _sceneLayer.Viewport[ovrEye_Left].Size;
+			_mirrorSize = uvec2(eyeSize.w / 2, eyeSize.h / 2);
+		}
+		// A camera of its own, so a window shaped for a desktop rather than the eyes
+		if (_mirrorMode == MirrorMode::Spectator) {
+			_mirrorSize = uvec2(MIRROR_WINDOW_WIDTH, MIRROR_WINDOW_HEIGHT);
+		}
+
+		// The inset shares the eye layer's optical axis, so scaling every tangent keeps it centred on the lens
+		_insetLayer = _sceneLayer;
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			ovrFovPort & fov = _insetLayer.Fov[eye];
+			fov.UpTan *= FOVEATION_INSET_TANGENT;
+			fov.DownTan *= FOVEATION_INSET_TANGENT;
+			fov.LeftTan *= FOVEATION_INSET_TANGENT;
+			fov.RightTan *= FOVEATION_INSET_TANGENT;
+
+			auto eyeSize = _hmdGetFovTextureSize(_session, eye, fov, DYNAMIC_RESOLUTION_MAX_DENSITY);
+			_insetLayer.Viewport[eye].Size = eyeSize;
+			_insetLayer.Viewport[eye].Pos = { (int)_insetTargetSize.x, 0 };
+			_insetTargetSize.y = std::max(_insetTargetSize.y, (uint32_t)eyeSize.h);
+			_insetTargetSize.x += eyeSize.w;
+		});
+
+		// In the stereo modes both eyes of the scene are one pass, timed as scene_left
+		_phaseUpdate = _profiler.addPhase("update");
+		_phaseAvatarPose = _profiler.addPhase("avatar_pose");
+		_phaseReflection = _profiler.addPhase("reflection");
+		_phaseScene[ovrEye_Left] = _profiler.addPhase("scene_left");
+		_phaseScene[ovrEye_Right] = _profiler.addPhase("scene_right");
+		_phaseAvatar[ovrEye_Left] = _profiler.addPhase("avatar_left");
+		_phaseAvatar[ovrEye_Right] = _profiler.addPhase("avatar_right");
+		_phaseInset = _profiler.addPhase("foveation_inset");
+		_phaseEnvironment = _profiler.addPhase("environment");
+		_phaseUpscale = _profiler.addPhase("upscale");
+		_phaseSubmit = _profiler.addPhase("submit");
+		_phaseMirror = _profiler.addPhase("mirror");
+		_phaseRecord = _profiler.addPhase("record");
+		_counterStateChanges = _profiler.addCounter("gl_state_changes");
+		_counterStateFiltered = _profiler.addCounter("gl_state_filtered");
+		_counterArenaResident = _profiler.addCounter("gpu_arena_kb");
+		_counterArenaFragmentation = _profiler.addCounter("gpu_arena_frag_pct");
+		_counterCulledMeshes = _profiler.addCounter("culled_meshes");
+		_counterCulledInstances = _profiler.addCounter("culled_instances");
+		_counterMsaaSamples = _profiler.addCounter("msaa_samples");
+		_counterShadingRate = _profiler.addCounter("shading_rate_level");
+		_counterNetIn = _profiler.addCounter("net_in_kbps");
+		_counterNetOut = _profiler.addCounter("net_out_kbps");
+		_counterNetBuffer = _profiler.addCounter("net_buffer_ms");
+		_counterNetLost = _profiler.addCounter("net_lost_packets");
+		_counterAvatarsReduced = _profiler.addCounter("avatars_reduced");
+		_counterAvatarsDistant = _profiler.addCounter("avatars_distant");
+		_counterFrameArenaPeak = _profiler.addCounter("frame_arena_peak_kb");
+		_counterPacingWait = _profiler.addCounter("pacing_wait_us");
+		_counterFrameInterval = _profiler.addCounter("frame_interval_us");
+		_counterPacingMissed = _profiler.addCounter("pacing_missed_frames");
+		_counterFrameAllocations = _profiler.addCounter("render_thread_allocs");
+		_counterCriticalAllocations = _profiler.addCounter("critical_allocs");
+		for (int tag = 0; tag < (int)AllocationTag::Count; ++tag) {
+			_counterHeapTags[tag] = _profiler.addCounter((std::string("heap_") + ALLOCATION_TAG_NAMES[tag] + "_kb").c_str());
+		}
+		for (int category = 0; category < (int)GpuMemoryCategory::Count; ++category) {
+			_counterGpuMemory[category] = _profiler.addCounter((std::string("gpu_") + GPU_MEMORY_CATEGORY_NAMES[category] + "_kb").c_str());
+		}
+		_counterVramAvailable = _profiler.addCounter("vram_available_kb");
+		_counterAvatarEvictions = _profiler.addCounter("avatar_evictions");
+		_counterDraws = _profiler.addCounter("draw_calls");
+		_counterInstances = _profiler.addCounter("instances");
+		_counterTriangles = _profiler.addCounter("triangles");
+		_counterProgramBinds = _profiler.addCounter("program_binds");
+		_counterVertexArrayBinds = _profiler.addCounter("vao_binds");
+		_counterTextureBinds = _profiler.addCounter("texture_binds");
+		_counterUniformBytes = _profiler.addCounter("uniform_kb");
+		_counterUploadBytes = _profiler.addCounter("upload_kb");
+		struct PassCounter { RenderPass pass; RenderEye eye; const char* name; };
+		static const PassCounter passCounters[] = {
+			{ RenderPass::Scene, RenderEye::Left, "draws_scene_left" },
+			{ RenderPass::Scene, RenderEye::Right, "draws_scene_right" },
+			{ RenderPass::Scene, RenderEye::Both, "draws_scene_stereo" },
+			{ RenderPass::Avatar, RenderEye::Left, "draws_avatar_left" },
+			{ RenderPass::Avatar, RenderEye::Right, "draws_avatar_right" },
+			{ RenderPass::Reflection, RenderEye::Both, "draws_reflection" },
+			{ RenderPass::Inset, RenderEye::Left, "draws_inset_left" },
+			{ RenderPass::Inset, RenderEye::Right, "draws_inset_right" },
+			{ RenderPass::Spectator, RenderEye::Both, "draws_spectator" },
+			{ RenderPass::Environment, RenderEye::Left, "draws_environment_left" },
+			{ RenderPass::Environment, RenderEye::Right, "draws_environment_right" },
+			{ RenderPass::Other, RenderEye::Both, "draws_other" },
+		};
+		for (int pass = 0; pass < (int)RenderPass::Count; ++pass) {
+			for (int eye = 0; eye < (int)RenderEye::Count; ++eye) {
+				_counterPassDraws[pass][eye] = -1;
+			}
+		}
+		for (const PassCounter& c : passCounters) {
+			_counterPassDraws[(int)c.pass][(int)c.eye] = _profiler.addCounter(c.name);
+		}
+		// The avatar's parts in every view they are drawn in, projectors folded into a part counting as the part.
+		// Overlays are the debug lines, the profiler overlay and the HUD.
+		_bucketAvatarSkinned = _gpuBuckets.addBucket("avatar_skinned");
+		_bucketAvatarProjector = _gpuBuckets.addBucket("avatar_projector");
+		_bucketOverlays = _gpuBuckets.addBucket("overlays");
+		_avatarQueue.timePass(RENDER_PASS_DEPTH, _bucketAvatarSkinned);
+		_avatarQueue.timePass(RENDER_PASS_OPAQUE, _bucketAvatarSkinned);
+		_avatarQueue.timePass(RENDER_PASS_BLENDED, _bucketAvatarSkinned);
+		_avatarQueue.timePass(RENDER_PASS_DECAL, _bucketAvatarProjector);
+
+		memset(&_overlayLayer, 0, sizeof(ovrLayerQuad));
+		_overlayLayer.Header.Type = ovrLayerType_Quad;
+		_overlayLayer.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft | ovrLayerFlag_HeadLocked;
+		_overlayLayer.Viewport.Size = { PROFILER_OVERLAY_WIDTH, PROFILER_OVERLAY_HEIGHT };
+		_overlayLayer.QuadPoseCenter.Orientation.w = 1.0f;
+		_overlayLayer.QuadPoseCenter.Position = { 0.0f, -0.25f, -0.8f };
+		_overlayLayer.QuadSize = { 0.4f, 0.125f };
+	}
+
+protected:
+	// The profiler's latest GPU times of the scene passes and of the avatar passes, for the cost models of knobs
+	// registered from outside RiftApp
+	float _sceneGpuMs() const {
+		return _profiler.gpuMs(_phaseScene[ovrEye_Left]) + _profiler.gpuMs(_phaseScene[ovrEye_Right]);
+	}
+	float _avatarGpuMs() const {
+		return _profiler.gpuMs(_phaseAvatar[ovrEye_Left]) + _profiler.gpuMs(_phaseAvatar[ovrEye_Right]) + _profiler.gpuMs(_phaseReflection);
+	}
+
+	GLFWwindow * createRenderingTarget(uvec2 & outSize, ivec2 & outPosition) override {
+		// The benchmark only needs the window for its context
+		if (_benchHmd.active()) {
+			glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		}
+		return glfw::createWindow(_mirrorSize);
+	}
+
+	void initGl() override {
+		// The shaders compiled from here on may come out of the pack
+		_startup.wait(_startupPack);
+		GlfwApp::initGl();
+
+		// Everything from here to the first frame takes its time, the headset shows the loading image meanwhile.
+		// A metre and a half in front of the tracking origin, the scene's frames carry it on until the scene is in.
+		ovrPosef loadingPose;
+		loadingPose.Orientation = { 0.0f, 0.0f, 0.0f, 1.0f };
+		loadingPose.Position = { 0.0f, 0.0f, -1.5f };
+		_loadingLayer.init(_session, LOADING_WIDTH, LOADING_HEIGHT, loadingPose, { 0.8f, 0.4f },
+			[this](int width, int height) { drawLoading(width, height); });
+		_loadingLayer.hold(_session);
+		_programWarmup.init();
+		// Covered by the loading layer too, benchmarks keep the settings they were asked for
+		if (!_benchHmd.active()) {
+			_gpuCalibration.init();
+		}
+
+		// Avatar textures are paged into arrays as they load, bindless or not has to be known before the first
+		_bindlessTextures = _bindlessAllowed && GLEW_ARB_bindless_texture;
+		if (_bindlessTextures) {
+			_initAvatarBlankTexture();
+		}
+
+		// 16 bit shading is settled before the first program that would have it, see HalfPrecisionCheck
+		_halfPrecisionExtension = _halfPrecisionAllowed ? HalfPrecisionCheck::extension() : nullptr;
+		if (_halfPrecisionExtension && !HalfPrecisionCheck::compiles(_halfPrecisionDefine())) {
+			printf("Half precision shading doesn't compile, shading at 32 bits\r\n");
+			_halfPrecisionExtension = nullptr;
+		}
+		HalfPrecisionDiff halfDiff;
+		if (_halfPrecisionExtension && _halfPrecisionCheck && HalfPrecisionCheck::compare(_halfPrecisionDefine(), &halfDiff)) {
+			printf("Half precision check: %d steps at most, %.3f on average, %.2f%% of pixels more than one off\r\n",
+				halfDiff.maxSteps, halfDiff.meanSteps, halfDiff.offPixels * 100.0f);
+			if (halfDiff.maxSteps > HALF_PRECISION_MAX_STEPS) {
+				printf("Half precision shading is off by more than %d steps, shading at 32 bits\r\n", HALF_PRECISION_MAX_STEPS);
+				_halfPrecisionExtension = nullptr;
+			}
+		}
+
+		// The avatar programs skin in their vertex shader unless the pre-skin pass does it for them
+		char errorBuffer[512];
+		if (_preskinAllowed) {
+			const char* varyings[] = { "skinnedPosition", "skinnedNormal", "skinnedTangent", "skinnedUV", "skinnedObjPosition" };
+			_avatarPreskin.program = _compileFeedbackProgramFromFile("AvatarSkinShader.glsl", varyings, 5, sizeof(errorBuffer), errorBuffer);
+			if (_avatarPreskin.program) {
+				_glLabel(GL_PROGRAM, _avatarPreskin.program, "avatar preskin");
+				_checkVertexInputs<AvatarPackedVertex>(_avatarPreskin.program, "avatar preskin");
+				glUniformBlockBinding(_avatarPreskin.program, glGetUniformBlockIndex(_avatarPreskin.program, "MeshPose"), AVATAR_POSE_BINDING);
+			}
+			else {
+				std::cout << "ERROR::AVATAR::PRESKIN_NOT_COMPILED " << errorBuffer << std::endl;
+			}
+		}
+		_preskinAvatars = _avatarPreskin.program != 0;
+
+		// The reference shaders, the debug line and the reflection programs all go to the driver at once. The swap
+		// chain and framebuffers are set up while they compile, then each is collected.
+		ProgramBuild skinnedBuild, skinnedPBSBuild, depthBuild;
+		const std::string skinnedDefines = _avatarBindlessDefines() + _eyeColorDefine() + _halfPrecisionDefine();
+		if (!_beginProgramFromFiles("AvatarVertexShader.glsl", "AvatarFragmentShader.glsl", sizeof(errorBuffer), errorBuffer,
+			skinnedDefines.c_str(), _avatarVertexDefines(), &skinnedBuild)) {
+			FAIL("Unable to _compileProgramFromFiles");
+		}
+		if (!_beginProgramFromFiles("AvatarVertexShader.glsl", "AvatarFragmentShaderPBS.glsl", sizeof(errorBuffer), errorBuffer,
+			_eyeColorDefine(), _avatarVertexDefines(), &skinnedPBSBuild)) {
+			FAIL("Unable to _compileProgramFromFiles");
+		}
+		const std::string depthDefines = std::string(_avatarVertexDefines()) + "#define DEPTH_ONLY\n";
+		if (!_beginProgramFromFiles("AvatarVertexShader.glsl", "AvatarDepthShader.glsl", sizeof(errorBuffer), errorBuffer,
+			NULL, depthDefines.c_str(), &depthBuild)) {
+			FAIL("Unable to _compileProgramFromFiles");
+		}
+
+		const char debugLineVertexShader[] =
+			"#version 330 core\n"
+			"layout (location = 0) in vec3 position;\n"
+			"layout (location = 1) in vec4 color;\n"
+			"out vec4 vertexColor;\n"
+			"uniform mat4 worldViewProj;\n"
+			"void main() {\n"
+			"    gl_Position = worldViewProj * vec4(position, 1.0);\n"
+			"    vertexColor = color;\n"
+			"}";
+
+		const char debugLineFragmentShader[] =
+			"#version 330 core\n"
+			"in vec4 vertexColor;\n"
+			"out vec4 fragmentColor;\n"
+			"void main() {\n"
+			"    fragmentColor = vertexColor;"
+			"}";
+
+		ProgramBuild debugLineBuild = _beginProgramBuild(debugLineVertexShader, debugLineFragmentShader);
+
+		const char reflectionVertexShader[] =
+			"#version 330 core\n"
+			"uniform mat4 worldViewProj;\n"
+			"layout(location = 0) in vec3 position;\n"
+			"layout(location = 1) in vec2 texcoord;\n"
+			"out vec2 vertexTexcoord;\n"
+			"void main() {\n"
+			"    gl_Position = worldViewProj * vec4(position, 1.0);\n"
+			"    vertexTexcoord = texcoord;\n"
+			"}";
+
+		const char reflectionFragmentShader[] =
+			"#version 330 core\n"
+			"uniform sampler2D reflection;\n"
+			"in vec2 vertexTexcoord;\n"
+			"out vec4 fragmentColor;\n"
+			"void main() {\n"
+			"    fragmentColor = texture(reflection, vertexTexcoord);\n"
+			"}";
+
+		ProgramBuild reflectionBuild = _beginProgramBuild(reflectionVertexShader, reflectionFragmentShader);
+		_uniformRing.init();
+
+		// Disable the v-sync for buffer swap
+		glfwSwapInterval(0);
+
+		_initDepth();
+		// The bench headset has no lenses to hide anything, the remote one's aren't known
+		if (_hiddenAreaMask && !_hmdStandIn()) {
+			_hiddenArea.init(_session, _sceneLayer.Fov);
+		}
+
+		ovrTextureSwapChainDesc desc = {};
+		desc.Type = ovrTexture_2D;
+		desc.ArraySize = 1;
+		desc.Width = _renderTargetSize.x;
+		desc.Height = _renderTargetSize.y;
+		desc.MipLevels = 1;
+		desc.Format = _eyeSwapChainFormat();
+		desc.SampleCount = 1;
+		desc.StaticImage = ovrFalse;
+		ovrResult result = _hmdCreateTextureSwapChainGL(_session, &desc, &_eyeTexture);
+		_sceneLayer.ColorTexture[0] = _eyeTexture;
+		if (!OVR_SUCCESS(result)) {
+			FAIL("Failed to create swap textures");
+		}
+
+		int length = 0;
+		result = _hmdGetTextureSwapChainLength(_session, _eyeTexture, &length);
+		if (!OVR_SUCCESS(result) || !length) {
+			FAIL("Unable to count swap chain textures");
+		}
+		for (int i = 0; i < length; ++i) {
+			GLuint chainTexId;
+			_hmdGetTextureSwapChainBufferGL(_session, _eyeTexture, i, &chainTexId);
+			glBindTexture(GL_TEXTURE_2D, chainTexId);
+			_glLabel(GL_TEXTURE, chainTexId, "eye swap chain");
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// Starts at the most samples allowed, the quality controller takes them away if they don't fit
+		GLint maxSamples = 1;
+		glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+		_msaaMaxSamples = glm::clamp(_msaaMaxSamples, 1, maxSamples);
+		// The calibration's preset lowers the ceilings the quality controller moves under, on machines it measured
+		// short of them. A frame is counted at the draw calls the profiler overlay budgets for.
+		const GpuEyePreset eyePreset = _gpuCalibration.eyePreset((double)_renderTargetSize.x * _renderTargetSize.y,
+			_hmdDesc.DisplayRefreshRate, _msaaMaxSamples, PROFILER_DRAW_BUDGET);
+		if (_gpuCalibration.available()) {
+			printf("GPU calibration preset: resolution scale %.2f, %d MSAA samples\r\n", eyePreset.resolutionScale, eyePreset.msaaSamples);
+		}
+		_msaaMaxSamples = eyePreset.msaaSamples;
+		_resolutionCeiling = std::max(eyePreset.resolutionScale, DYNAMIC_RESOLUTION_MIN_SCALE);
+		_setResolutionScale(_resolutionCeiling);
+		// The upscaler makes up the rest, the governor still raises the scale to the ceiling where there is room
+		if (_temporalUpscaleAllowed && _temporalUpscaler.init(_renderTargetSize)) {
+			_upscaling = true;
+			_setResolutionScale(std::min(_resolutionCeiling, TEMPORAL_UPSCALE_SCALE));
+			printf("Temporal upscaling from resolution scale %.2f\r\n", _resolutionScale);
+		}
+		if (_weightedOit && !(WeightedBlendedOit::supported() && _oit.init())) {
+			printf("Weighted blended OIT unavailable, translucent avatar parts are sorted\r\n");
+			_weightedOit = false;
+		}
+		_setMsaaSamples(_msaaMaxSamples);
+
+		// Without one the compositor has no mirror to produce
+		if (_mirrorMode == MirrorMode::Compositor) {
+			ovrMirrorTextureDesc mirrorDesc;
+			memset(&mirrorDesc, 0, sizeof(mirrorDesc));
+			mirrorDesc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+			mirrorDesc.Width = _mirrorSize.x;
+			mirrorDesc.Height = _mirrorSize.y;
+			if (!OVR_SUCCESS(ovr_CreateMirrorTextureGL(_session, &mirrorDesc, &_mirrorTexture))) {
+				FAIL("Could not create mirror texture");
+			}
+			_gpuMemory.charge(GpuMemoryCategory::SwapChains, _gpuImageBytes(GL_RGBA8, _mirrorSize.x, _mirrorSize.y));
+			glGenFramebuffers(1, &_mirrorFbo);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, _mirrorFbo);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+			_glLabel(GL_FRAMEBUFFER, _mirrorFbo, "compositor mirror");
+		}
+		if (_mirrorMode == MirrorMode::Spectator) {
+			_spectator.resize(uvec2(glm::max(vec2(_mirrorSize) * _spectatorScale, vec2(1.0f))), _depthFormat());
+		}
+		if (_sessionRecordPath[0] && _mirrorMode != MirrorMode::Off) {
+			const float recordHz = _mirrorHz > 0.0f ? _mirrorHz : _hmdDesc.DisplayRefreshRate / _mirrorEvery;
+			if (!_sessionRecorder.open(_sessionRecordPath, windowSize, recordHz)) {
+				std::cout << "ERROR::SESSION_RECORD::NOT_STARTED " << _sessionRecordPath << std::endl;
+			}
+		}
+
+		_skinnedMeshProgram = _finishProgramBuild(skinnedBuild, sizeof(errorBuffer), errorBuffer);
+		if (!_skinnedMeshProgram) {
+			FAIL("Unable to _compileProgramFromFiles");
+		}
+		_skinnedMeshPBSProgram = _finishProgramBuild(skinnedPBSBuild, sizeof(errorBuffer), errorBuffer);
+		if (!_skinnedMeshPBSProgram) {
+			FAIL("Unable to count swap chain textures");
+		}
+		// Both avatar programs read their skinning palette from the pose cache and their transforms from the
+		// uniform ring. The generic one also backs any material whose variant won't compile.
+		_avatarPrograms.generic = _setupAvatarProgram(_skinnedMeshProgram);
+		if (!_preskinAvatars) {
+			glUniformBlockBinding(_skinnedMeshPBSProgram, glGetUniformBlockIndex(_skinnedMeshPBSProgram, "MeshPose"), AVATAR_POSE_BINDING);
+		}
+		glUniformBlockBinding(_skinnedMeshPBSProgram, glGetUniformBlockIndex(_skinnedMeshPBSProgram, "MeshTransform"), AVATAR_TRANSFORM_BINDING);
+		_avatarDepthProgram = _finishProgramBuild(depthBuild, sizeof(errorBuffer), errorBuffer);
+		if (!_avatarDepthProgram) {
+			FAIL("Unable to compile _avatarDepthProgram");
+		}
+		if (!_preskinAvatars) {
+			glUniformBlockBinding(_avatarDepthProgram, glGetUniformBlockIndex(_avatarDepthProgram, "MeshPose"), AVATAR_POSE_BINDING);
+		}
+		glUniformBlockBinding(_avatarDepthProgram, glGetUniformBlockIndex(_avatarDepthProgram, "MeshTransform"), AVATAR_TRANSFORM_BINDING);
+
+		_debugLineProgram = _finishProgramBuild(debugLineBuild, sizeof(errorBuffer), errorBuffer);
+		if (!_debugLineProgram) {
+			FAIL("Unable to compile _debugLineProgram");
+		}
+		_debugDraw.init(_debugLineProgram);
+
+		_reflectionProgram = _finishProgramBuild(reflectionBuild, sizeof(errorBuffer), errorBuffer);
+		if (!_reflectionProgram) {
+			FAIL("Unable to compile _reflectionProgram");
+		}
+		if (_avatarOcclusionQueries && !_avatarOcclusion.init()) {
+			std::cout << "ERROR::AVATAR::OCCLUSION_QUERIES_OFF" << std::endl;
+		}
+		_planarMirror.init(_reflectionProgram, vec3(0.0f, 0.0f, -REFLECTION_DISTANCE), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f),
+			vec2(REFLECTION_WIDTH, REFLECTION_HEIGHT), _reflectionSize, _depthFormat());
+
+		_initFoveationInset();
+		if (_splitRateAllowed && supportsEnvironmentLayer()) {
+			const unsigned int flags = _projectionFlags();
+			const ovrMatrix4f projection = ovrMatrix4f_Projection(_sceneLayer.Fov[ovrEye_Left], EYE_NEAR_PLANE, EYE_FAR_PLANE, flags);
+			_environmentLayer.init(_session, _renderTargetSize, _sceneLayer, _eyeSwapChainFormat(), _depthFormat(), ovrTimewarpProjectionDesc_FromProjection(projection, flags));
+		}
+		glGenBuffers(1, &_lateLatchBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, _lateLatchBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(LateLatchBlock), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		_glLabel(GL_BUFFER, _lateLatchBuffer, "late latch");
+		_glLabel(GL_PROGRAM, _skinnedMeshProgram, "avatar skinned");
+		_glLabel(GL_PROGRAM, _skinnedMeshPBSProgram, "avatar skinned pbs");
+		_glLabel(GL_PROGRAM, _avatarDepthProgram, "avatar depth");
+		_glLabel(GL_PROGRAM, _debugLineProgram, "debug lines");
+		_glLabel(GL_PROGRAM, _reflectionProgram, "reflection");
+		_profiler.init(_telemetrySink.isOpen() ? nullptr : "frame_profile.csv", &_telemetrySink);
+		_gpuBuckets.init(&_telemetrySink);
+		_framePacer.init(_hmdDesc.DisplayRefreshRate);
+		_hitchRecorder.init(_jobs, _profiler, _hitchBudgetMs >= 0.0 ? _hitchBudgetMs : _framePacer.periodMs() * HITCH_BUDGET_PERIODS);
+		_environmentLayer.setRefreshRate(_framePacer.refreshRate());
+		_initProfilerOverlay();
+		// Head locked above the middle of the view, out of the profiler overlay's way
+		ovrPosef hudPose;
+		hudPose.Orientation = { 0.0f, 0.0f, 0.0f, 1.0f };
+		hudPose.Position = { 0.0f, 0.2f, -1.0f };
+		_hud.init(_session, HUD_WIDTH, HUD_HEIGHT, hudPose, { 0.4f, 0.1f }, true);
+		if (_latencyTestEnabled) {
+			_latencyTest.init(_session, _latencyPhotodiodePort);
+		}
+		_initTelemetry();
+		_initQualityKnobs();
+		// Benchmarks, remote headsets and pose traces answer or record input once a frame, the frame polls it itself for those
+		if (!_hmdStandIn() && !_poseTrace.active()) {
+			_inputPoller.start(_session);
+		}
+
+		if (supportsStereo()) {
+			if (GLEW_OVR_multiview2) {
+				_initMultiview();
+			}
+			_stereoMode = GLEW_OVR_multiview2 ? StereoMode::Multiview : StereoMode::Instanced;
+		}
+		if (_multiGpuAllowed && _eyeGpus.init()) {
+			// One submission per eye, each masked to its GPU
+			_stereoMode = StereoMode::Sequential;
+			std::cout << "Multi-GPU: one eye per GPU" << std::endl;
+		}
+		_initialStereoMode = _stereoMode;
+		if (_shadingRateAllowed) {
+			_shadingRate.init(_renderTargetSize, _multiviewSize);
+		}
+		_lastFrameSeconds = _sessionSeconds();
+	}
+
+	// Settles on reversed or standard depth, then builds the projections and GL state that go with it
+	void _initDepth() {
+		if (_reversedDepth && !GLEW_ARB_clip_control) {
+			std::cout << "ERROR::DEPTH::NO_CLIP_CONTROL, using standard depth" << std::endl;
+			_reversedDepth = false;
+		}
+		if (_reversedDepth) {
+			glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+		}
+		glClearDepth(_reversedDepth ? 0.0 : 1.0);
+		_glState.reverseDepth(_reversedDepth);
+
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			_eyeProjections[eye] = ovr::toGlm(ovrMatrix4f_Projection(_sceneLayer.Fov[eye], EYE_NEAR_PLANE, EYE_FAR_PLANE, _projectionFlags()));
+			_insetProjections[eye] = ovr::toGlm(ovrMatrix4f_Projection(_insetLayer.Fov[eye], EYE_NEAR_PLANE, EYE_FAR_PLANE, _projectionFlags()));
+		});
+		// The remote headset reprojects with the depth it is sent, and has to know how to read it back
+		_remoteHmd.setProjection(EYE_NEAR_PLANE, EYE_FAR_PLANE, _reversedDepth, _eyeBufferLinear());
+	}
+
+	// Every projection into the eye targets, the scene's and the avatar's, has to use the same depth convention
+	unsigned int _projectionFlags() const {
+		return _reversedDepth ? ovrProjection_FarLessThanNear : ovrProjection_ClipRangeOpenGL;
+	}
+
+	GLenum _depthFormat() const {
+		return _eyeDepthFormat();
+	}
+
+	// Takes effect at the next frame, when the render graph is compiled for it; 1 turns MSAA off
+	void _setMsaaSamples(GLint samples) {
+		_msaaSamples = std::max(samples, 1);
+	}
+
+	// The frame's targets and passes for the current MSAA samples: the eyes into the swap chain texture with the
+	// eye depth, or into the multisampled pair and resolved into it, then the mirror and the foveation inset. Only the
+	// passes something leaves the frame through are kept, so the targets of a mode not in use are never allocated.
+	// If the driver turns the samples down, MSAA is off from then on. The upscaler puts the sampled scene pair
+	// where the swap chain texture was, and its pass between that and the swap chain. With _weightedOit the eyes
+	// and the inset each have their translucent passes after them, see _declareTranslucentPasses.
+	void _buildRenderGraph() {
+		const GLint samples = _msaaActive() ? _msaaSamples : 1;
+		_renderGraph.reset();
+		RenderTargetDesc eyeDepth;
+		eyeDepth.size = _renderTargetSize;
+		eyeDepth.format = _depthFormat();
+		RenderTargetDesc msaaColor = eyeDepth, msaaDepth = eyeDepth;
+		// The upscaler samples the encoded values, an sRGB format would have them decoded on the way; a resolve
+		// needs the same format on both sides. Linear eye buffers have nothing to decode.
+		const GLenum sceneColorFormat = _eyeBufferLinear() ? GL_R11F_G11F_B10F : GL_RGBA8;
+		msaaColor.format = _upscaling ? sceneColorFormat : _eyeColorFormat();
+		msaaColor.samples = msaaDepth.samples = samples;
+
+		_targetEyeColor = _renderGraph.importedTexture("eye swap chain");
+		_renderGraph.output(_targetEyeColor);
+		const RenderGraphTarget window = _renderGraph.importedFramebuffer("window", 0);
+		_renderGraph.output(window);
+
+		// What the eyes or the resolve leave the frame in, the upscaler's input while it is on
+		RenderGraphTarget eyeColor = _targetEyeColor;
+		RenderGraphTarget resolvedDepth = RENDER_GRAPH_NONE;
+		if (_upscaling) {
+			RenderTargetDesc sceneColor = eyeDepth, sceneDepth = eyeDepth;
+			sceneColor.format = sceneColorFormat;
+			sceneColor.sampled = sceneDepth.sampled = true;
+			eyeColor = _targetSceneColor = _renderGraph.transient("scene color", sceneColor);
+			resolvedDepth = _targetSceneDepth = _renderGraph.transient("scene depth", sceneDepth);
+		}
+
+		// What the eyes pass draws into, the translucent passes after it too
+		_passEyes = _renderGraph.pass("eyes", [this] { _renderEyes(); });
+		RenderGraphTarget color = eyeColor, depth = resolvedDepth;
+		if (samples > 1) {
+			color = _renderGraph.transient("msaa color", msaaColor);
+			depth = _renderGraph.transient("msaa depth", msaaDepth);
+		}
+		else if (!_upscaling) {
+			depth = _renderGraph.transient("eye depth", eyeDepth);
+		}
+		_renderGraph.write(_passEyes, color, GL_COLOR_ATTACHMENT0);
+		_renderGraph.write(_passEyes, depth, GL_DEPTH_ATTACHMENT);
+		if (_weightedOit) {
+			_declareTranslucentPasses(color, depth, samples > 1 ? msaaDepth : eyeDepth, false);
+		}
+		// The remote headset reprojects with the eyes' depth, copied out at the size it was drawn at
+		if (_remoteHmd.active()) {
+			_targetRemoteDepth = _renderGraph.importedTexture("remote depth");
+			_renderGraph.output(_targetRemoteDepth);
+			const RenderGraphPass remoteDepth = _renderGraph.pass("remote depth", [this] { _copyRemoteDepth(); });
+			_renderGraph.read(remoteDepth, depth, GL_DEPTH_ATTACHMENT);
+			_renderGraph.write(remoteDepth, _targetRemoteDepth, GL_DEPTH_ATTACHMENT);
+		}
+		if (samples > 1) {
+			const RenderGraphPass resolve = _renderGraph.pass("msaa resolve", [this] { _resolveMsaa(); });
+			_renderGraph.read(resolve, color, GL_COLOR_ATTACHMENT0);
+			_renderGraph.write(resolve, eyeColor, GL_COLOR_ATTACHMENT0);
+			if (_upscaling) {
+				_renderGraph.read(resolve, depth, GL_DEPTH_ATTACHMENT);
+				_renderGraph.write(resolve, resolvedDepth, GL_DEPTH_ATTACHMENT);
+			}
+		}
+
+		if (_upscaling) {
+			_targetUpscaleHistory = _renderGraph.importedTexture("upscale history");
+			const RenderGraphPass upscale = _renderGraph.pass("upscale", [this] { _upscaleEyes(); });
+			_renderGraph.read(upscale, _targetSceneColor, GL_NONE);
+			_renderGraph.read(upscale, _targetSceneDepth, GL_NONE);
+			_renderGraph.write(upscale, _targetEyeColor, GL_COLOR_ATTACHMENT0);
+			_renderGraph.write(upscale, _targetUpscaleHistory, GL_COLOR_ATTACHMENT1);
+		}
+
+		// The right eye's GPU hands its half over before anything reads the eyes on the GPU the compositor reads
+		if (_eyeGpus.active()) {
+			const RenderGraphPass gather = _renderGraph.pass("multi-gpu gather", [this] {
+				const ovrRecti& vp = _sceneLayer.Viewport[ovrEye_Right];
+				_eyeGpus.gather(_eyeTextureId, vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h);
+			});
+			_renderGraph.write(gather, _targetEyeColor, GL_COLOR_ATTACHMENT0);
+		}
+
+		if (_mirrorMode == MirrorMode::Eye) {
+			const RenderGraphPass mirror = _renderGraph.pass("mirror", [this] {
+				ProfileScope mirrorScope(_profiler, _phaseMirror);
+				TRACE_ZONE("mirror");
+				TRACE_GPU_ZONE("mirror");
+				GLDebugGroup debugGroup("mirror");
+				_mirrorEye();
+			}, [this] { return _mirrored; });
+			_renderGraph.read(mirror, _targetEyeColor, GL_COLOR_ATTACHMENT0);
+			_renderGraph.write(mirror, window);
+		}
+
+		if (_insetTexture) {
+			RenderTargetDesc insetDepth = eyeDepth;
+			insetDepth.size = _insetTargetSize;
+			_targetInsetColor = _renderGraph.importedTexture("inset swap chain");
+			_renderGraph.output(_targetInsetColor);
+			const RenderGraphPass inset = _renderGraph.pass("foveation inset", [this] { _renderFoveationInset(_sceneLayer.RenderPose); },
+				[this] { return _foveated; });
+			const RenderGraphTarget insetDepthTarget = _renderGraph.transient("inset depth", insetDepth);
+			_renderGraph.write(inset, _targetInsetColor, GL_COLOR_ATTACHMENT0);
+			_renderGraph.write(inset, insetDepthTarget, GL_DEPTH_ATTACHMENT);
+			if (_weightedOit) {
+				_declareTranslucentPasses(_targetInsetColor, insetDepthTarget, insetDepth, true);
+			}
+		}
+
+		if (!_renderGraph.compile()) {
+			if (samples > 1) {
+				std::cout << "ERROR::MSAA::FRAMEBUFFER_INCOMPLETE with " << samples << " samples" << std::endl;
+				_msaaMaxSamples = 1;
+				_setMsaaSamples(1);
+				_buildRenderGraph();
+				return;
+			}
+			FAIL("Eye render graph is incomplete");
+		}
+		_renderGraphSamples = samples;
+		printf("Render graph: %d samples, %d transient targets in %d renderbuffers\r\n", samples,
+			(int)_renderGraph.transientCount(), (int)_renderGraph.physicalCount());
+	}
+
+	// The translucent and composite passes of the eyes, or the inset, over the colour and depth their pass drew into;
+	// depthDesc is the depth's, the accumulation and revealage targets match its size and samples. Declared before
+	// any pass reading the colour after, and skipped on frames with nothing translucent, see WeightedBlendedOit.
+	void _declareTranslucentPasses(RenderGraphTarget color, RenderGraphTarget depth, const RenderTargetDesc& depthDesc, bool inset) {
+		RenderTargetDesc accumDesc = depthDesc, revealageDesc = depthDesc;
+		accumDesc.format = OIT_ACCUM_FORMAT;
+		revealageDesc.format = OIT_REVEALAGE_FORMAT;
+		accumDesc.sampled = revealageDesc.sampled = true;
+		const RenderGraphTarget accum = _renderGraph.transient(inset ? "inset oit accum" : "oit accum", accumDesc);
+		const RenderGraphTarget revealage = _renderGraph.transient(inset ? "inset oit revealage" : "oit revealage", revealageDesc);
+		const auto drawn = [this, inset] { return _avatar && _avatarOitQueued && _avatarQueue.has(RENDER_PASS_BLENDED) && (!inset || _foveated); };
+
+		const RenderGraphPass translucent = _renderGraph.pass(inset ? "inset translucent" : "translucent", [this, inset] {
+			_renderTranslucent(inset);
+		}, drawn);
+		_renderGraph.write(translucent, accum, GL_COLOR_ATTACHMENT0);
+		_renderGraph.write(translucent, revealage, GL_COLOR_ATTACHMENT1);
+		// Tested against, not written
+		_renderGraph.write(translucent, depth, GL_DEPTH_ATTACHMENT);
+
+		const glm::uvec2 size = depthDesc.size;
+		const GLint samples = depthDesc.samples;
+		const RenderGraphPass composite = _renderGraph.pass(inset ? "inset oit composite" : "oit composite", [this, accum, revealage, size, samples] {
+			_oit.composite(_renderGraph.texture(accum), _renderGraph.texture(revealage), (GLsizei)size.x, (GLsizei)size.y, samples);
+		}, drawn);
+		_renderGraph.read(composite, accum, GL_NONE);
+		_renderGraph.read(composite, revealage, GL_NONE);
+		_renderGraph.write(composite, color, GL_COLOR_ATTACHMENT0);
+	}
+
+	// The avatars' translucent parts of the eyes or the inset into the translucent pass's targets, each eye in its
+	// viewport with the camera its opaque parts drew with
+	void _renderTranslucent(bool inset) {
+		TRACE_ZONE("translucent");
+		TRACE_GPU_ZONE("translucent");
+		GLDebugGroup debugGroup(inset ? "inset translucent" : "translucent");
+		_oit.begin();
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			RenderView view = _eyeRenderView(eye);
+			const ovrRecti& vp = inset ? _insetLayer.Viewport[eye] : _sceneLayer.Viewport[eye];
+			if (inset) {
+				view.proj = _insetProjections[eye];
+				view.viewProj = view.proj * view.view;
+			}
+			else {
+				_eyeGpus.renderEye(eye);
+				if (_avatarEyesQueued) {
+					view.list = eye;
+				}
+			}
+			glViewport(vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h);
+			RenderPassScope passScope(inset ? RenderPass::Inset : RenderPass::Avatar, (RenderEye)eye);
+			_avatarQueue.submit(view, RENDER_PASS_BIT(RENDER_PASS_BLENDED));
+		});
+		if (!inset) {
+			_eyeGpus.renderBoth();
+		}
+		_oit.end();
+	}
+
+	// x, y, width and height of what eye's clear covers of a viewport width by height. Only the box around what the
+	// lens shows where the hidden area mask lays its depth over the rest, the compositor never samples its colour.
+	// The Eye mirror shows the whole viewport, so it gets it cleared whole.
+	glm::ivec4 _eyeClearBox(ovrEyeType eye, int width, int height) const {
+		if (!_hiddenArea.initialized() || _mirrorMode == MirrorMode::Eye) {
+			return glm::ivec4(0, 0, width, height);
+		}
+		const vec4 bounds = _hiddenArea.visibleBounds(eye);
+		const int x0 = (int)floorf(bounds.x * width), y0 = (int)floorf(bounds.y * height);
+		const int x1 = (int)ceilf(bounds.z * width), y1 = (int)ceilf(bounds.w * height);
+		return glm::ivec4(x0, y0, x1 - x0, y1 - y0);
+	}
+
+	// Each eye's viewport of the eyes pass's target, scissored to its clear box. Past the viewports is never
+	// shown, the dynamic resolution's shrunk ones included.
+	void _clearEyes() {
+		glEnable(GL_SCISSOR_TEST);
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			const auto& vp = _sceneLayer.Viewport[eye];
+			const glm::ivec4 box = _eyeClearBox(eye, vp.Size.w, vp.Size.h);
+			glScissor(vp.Pos.x + box.x, vp.Pos.y + box.y, box.z, box.w);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			_glCapture.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		});
+		glDisable(GL_SCISSOR_TEST);
+	}
+
+	// The scene then the avatar into the eyes pass's target, cleared first. Multiview copies over both viewports
+	// whole, so only its own layers are cleared.
+	void _renderEyes() {
+		if (_stereoMode != StereoMode::Multiview) {
+			_clearEyes();
+		}
+		// The scene draws with the default test, not whatever the avatar and debug lines left set last frame
+		_glState.depthFunc(GL_LESS);
+		// The scene and the avatar passes, not the inset or the layers drawn after them
+		_shadingRate.update(_sceneLayer.Viewport, _sceneLayer.Fov);
+		_shadingRate.begin(false);
+
+		if (_stereoMode == StereoMode::Sequential) {
+			ovr::for_each_eye([&](ovrEyeType eye) {
+				_eyeGpus.renderEye(eye);
+				const auto& vp = _sceneLayer.Viewport[eye];
+				glViewport(vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h);
+				ProfileScope sceneScope(_profiler, _phaseScene[eye]);
+				TRACE_ZONE("scene");
+				TRACE_GPU_ZONE("scene");
+				GLDebugGroup debugGroup(eye == ovrEye_Left ? "scene left" : "scene right");
+				RenderPassScope passScope(RenderPass::Scene, (RenderEye)eye);
+				_hiddenArea.draw(eye, _reversedDepth);
+				const EyeConstants& camera = _frameConstants.eyes[eye];
+				_latchView(_monoStereoView(camera.projection, camera.view));
+				renderScene(camera.projection, camera.inverseView);
+			});
+		}
+		else {
+			ProfileScope sceneScope(_profiler, _phaseScene[ovrEye_Left]);
+			TRACE_ZONE("scene stereo");
+			TRACE_GPU_ZONE("scene stereo");
+			GLDebugGroup debugGroup("scene stereo");
+			RenderPassScope passScope(RenderPass::Scene, RenderEye::Both);
+			_renderStereo();
+		}
+
+		// The avatar SDK renders one eye at a time whatever the stereo mode
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			_eyeGpus.renderEye(eye);
+			const auto& vp = _sceneLayer.Viewport[eye];
+			glViewport(vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h);
+			ProfileScope avatarScope(_profiler, _phaseAvatar[eye]);
+			TRACE_ZONE("avatar");
+			TRACE_GPU_ZONE("avatar");
+			GLDebugGroup debugGroup(eye == ovrEye_Left ? "avatar left" : "avatar right");
+			RenderPassScope passScope(RenderPass::Avatar, (RenderEye)eye);
+
+			_renderAvatarEye(_eyeRenderView(eye), eye);
+		});
+		_eyeGpus.renderBoth();
+		_shadingRate.end();
+	}
+
+	// Whether this frame goes to the window, by _mirrorEvery and _mirrorHz
+	bool _mirrorDue() {
+		if (_mirrorMode == MirrorMode::Off || (_mirrorEvery > 1 && frame % _mirrorEvery != 0)) {
+			return false;
+		}
+		const double now = _sessionSeconds();
+		const float hz = _mirrorRate();
+		if (hz > 0.0f && now - _mirrorTime < 1.0 / hz) {
+			return false;
+		}
+		// The spectator is the first to give way when the headset is short of time: the GPU over the budget the
+		// quality governor aims for, or a frame missed since the last spectator frame
+		if (_mirrorMode == MirrorMode::Spectator) {
+			const uint32_t missed = _framePacer.stats().missed;
+			const bool pressured = _profiler.gpuFrameMs() > _framePacer.periodMs() * DYNAMIC_RESOLUTION_TARGET || missed != _spectatorMissed;
+			_spectatorMissed = missed;
+			if (pressured || !_spectator.enabled()) {
+				return false;
+			}
+		}
+		_mirrorTime = now;
+		return true;
+	}
+
+	// The display switched rates mid-session. Everything that budgets by the frame reads _framePacer's period as it
+	// goes, what took it at startup is told here.
+	void _refreshRateChanged() {
+		const float hz = _framePacer.refreshRate();
+		printf("Display refresh rate now %.0f Hz\r\n", hz);
+		if (_hitchBudgetMs < 0.0) {
+			_hitchRecorder.setBudget(_framePacer.periodMs() * HITCH_BUDGET_PERIODS);
+		}
+		_environmentLayer.setRefreshRate(hz);
+	}
+
+	// The rate the window is mirrored at, 0 for every frame _mirrorEvery lets through. The governor halves the
+	// spectator's, see _initQualityKnobs.
+	float _mirrorRate() const {
+		if (_mirrorMode != MirrorMode::Spectator || !_spectatorRateLevel) {
+			return _mirrorHz;
+		}
+		const float full = _mirrorHz > 0.0f ? _mirrorHz : _framePacer.refreshRate() / _mirrorEvery;
+		return full / (float)(1 << _spectatorRateLevel);
+	}
+
+	// The scene and the third person avatars from the spectator camera, scaled up into the window
+	void _renderSpectator() {
+		ProfileScope spectatorScope(_profiler, _phaseMirror);
+		TRACE_ZONE("spectator");
+		TRACE_GPU_ZONE("spectator");
+		GLDebugGroup debugGroup("spectator");
+		RenderPassScope passScope(RenderPass::Spectator, RenderEye::Both);
+		ovrFovPort fov;
+		_spectator.tangents(&fov.UpTan, &fov.DownTan, &fov.LeftTan, &fov.RightTan);
+		const mat4 proj = ovr::toGlm(ovrMatrix4f_Projection(fov, EYE_NEAR_PLANE, EYE_FAR_PLANE, _projectionFlags()));
+		const mat4 view = _spectator.view();
+		_spectator.begin();
+		_glState.depthFunc(GL_LESS);
+		_latchView(_monoStereoView(proj, view));
+		renderScene(proj, _rigidInverseMat4(view));
+		if (_avatar) {
+			_renderAvatar(_avatar, ovrAvatarVisibilityFlag_ThirdPerson, view, proj, _spectator.position(), false);
+		}
+		_spectator.present(_mirrorSize);
+	}
+
+	// The left eye's viewport of the resolved swap chain texture into the window, scaled to fit; the render graph
+	// has the one bound for reading and the other for drawing
+	void _mirrorEye() {
+		const auto& vp = _sceneLayer.Viewport[ovrEye_Left];
+		glBlitFramebuffer(vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h,
+			0, 0, _mirrorSize.x, _mirrorSize.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	}
+
+	// What startup left for the render thread runs after a frame is submitted, so none of it holds up the first
+	void _pumpStartup() {
+		_startup.pump();
+		// A benchmark or remote headset goes on without the platform, there is just no avatar to draw then
+		if (!_hmdStandIn() && _startup.state(_startupPlatform) == StartupTaskState::Failed) {
+			// Exit.  Initialization failed which means either the oculus service isn't on the machine or they've hacked their DLL
+			FAIL("Failed to initialize the Oculus Platform");
+		}
+		if (_requireEntitlement && _startup.state(_startupEntitlement) == StartupTaskState::Failed) {
+			glfwSetWindowShouldClose(window, 1);
+		}
+		if (_fleetStats.isOpen() && !_fleetStartupTimed) {
+			_fleetStartupTimed = _startup.timeline([](const char* name, float ms) {
+				_fleetStats.startupPhase(name, ms);
+			});
+		}
+	}
+
+	// Only frames that were mirrored are presented, the rest would swap an unchanged window
+	void finishFrame() override {
+		if (_mirrored) {
+			glfwSwapBuffers(window);
+		}
+	}
+
+	// The multiview pass has its own single sampled target, so MSAA only covers the other stereo modes
+	bool _msaaActive() const {
+		return _msaaSamples > 1 && _stereoMode != StereoMode::Multiview;
+	}
+
+	// Averages the eye viewports of the multisampled target into the swap chain texture, bound for reading and
+	// drawing by the render graph, which then tells the driver the samples are dead. For the upscaler the depth goes
+	// too, into the scene pair; a depth resolve takes one of the samples.
+	void _resolveMsaa() {
+		GLDebugGroup debugGroup("msaa resolve");
+		const GLbitfield mask = _upscaling ? GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT;
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			const auto& vp = _sceneLayer.Viewport[eye];
+			glBlitFramebuffer(vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h,
+				vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h, mask, GL_NEAREST);
+			_glCapture.blit(vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h,
+				vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h, mask, GL_NEAREST);
+		});
+	}
+
+	// Each eye's depth into the remote headset's texture, resolving it when it is multisampled
+	void _copyRemoteDepth() {
+		GLDebugGroup debugGroup("remote depth");
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			const auto& vp = _sceneLayer.Viewport[eye];
+			glBlitFramebuffer(vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h,
+				vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+			_glCapture.blit(vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h,
+				vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		});
+		_remoteHmd.depthDrawn(_sceneLayer.Viewport);
+	}
+
+	// The scene pair at the scaled viewports up to the eyes' full ones in the swap chain texture. The scene layer
+	// goes out with those, the mirror after this takes them too; they go back to the scaled ones once it is submitted.
+	void _upscaleEyes() {
+		ProfileScope upscaleScope(_profiler, _phaseUpscale);
+		TRACE_ZONE("upscale");
+		TRACE_GPU_ZONE("upscale");
+		GLDebugGroup debugGroup("upscale");
+		const float scale = _foveated ? FOVEATION_PERIPHERY_SCALE : 1.0f;
+		ovrRecti inputs[2], outputs[2];
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			inputs[eye] = outputs[eye] = _sceneLayer.Viewport[eye];
+			outputs[eye].Size.w = std::max(2, (int)(_maxViewportSize[eye].w * scale) & ~1);
+			outputs[eye].Size.h = std::max(2, (int)(_maxViewportSize[eye].h * scale) & ~1);
+		});
+		_temporalUpscaler.begin(frame, outputs);
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			const EyeConstants& camera = _frameConstants.eyes[eye];
+			_temporalUpscaler.resolve(eye, _renderGraph.texture(_targetSceneColor), _renderGraph.texture(_targetSceneDepth),
+				inputs[eye], _upscaleJitter[eye], _eyeProjections[eye] * camera.view, _reversedDepth);
+			_sceneLayer.Viewport[eye] = outputs[eye];
+		});
+		_temporalUpscaler.end();
+	}
+
+	void _initMultiview() {
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			_multiviewSize.x = std::max(_multiviewSize.x, (uint32_t)_sceneLayer.Viewport[eye].Size.w);
+			_multiviewSize.y = std::max(_multiviewSize.y, (uint32_t)_sceneLayer.Viewport[eye].Size.h);
+		});
+
+		// Same formats as the eye texture and the eye depth so the per eye copy is a straight blit
+		glGenTextures(1, &_multiviewColor);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, _multiviewColor);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, _eyeColorFormat(), _multiviewSize.x, _multiviewSize.y, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glGenTextures(1, &_multiviewDepth);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, _multiviewDepth);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, _depthFormat(), _multiviewSize.x, _multiviewSize.y, 2, 0, GL_DEPTH_COMPONENT,
+			_reversedDepth ? GL_FLOAT : GL_UNSIGNED_SHORT, NULL);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		_gpuMemory.charge(GpuMemoryCategory::EyeTargets, _gpuImageBytes(_eyeColorFormat(), _multiviewSize.x, _multiviewSize.y, 2) +
+			_gpuImageBytes(_depthFormat(), _multiviewSize.x, _multiviewSize.y, 2));
+
+		glGenFramebuffers(1, &_multiviewFbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _multiviewFbo);
+		glFramebufferTextureMultiviewOVR(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, _multiviewColor, 0, 0, 2);
+		glFramebufferTextureMultiviewOVR(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _multiviewDepth, 0, 0, 2);
+		_glLabel(GL_FRAMEBUFFER, _multiviewFbo, "multiview target");
+		_glLabel(GL_TEXTURE, _multiviewColor, "multiview color");
+		_glLabel(GL_TEXTURE, _multiviewDepth, "multiview depth");
+		if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER)) {
+			FAIL("Multiview framebuffer is incomplete");
+		}
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glGenFramebuffers(1, &_multiviewReadFbo);
+	}
+
+	// Only the swap chain is allocated here, its depth is the render graph's. The inset is just not drawn or
+	// submitted while foveation is off.
+	void _initFoveationInset() {
+		ovrTextureSwapChainDesc desc = {};
+		desc.Type = ovrTexture_2D;
+		desc.ArraySize = 1;
+		desc.Width = _insetTargetSize.x;
+		desc.Height = _insetTargetSize.y;
+		desc.MipLevels = 1;
+		desc.Format = _eyeSwapChainFormat();
+		desc.SampleCount = 1;
+		desc.StaticImage = ovrFalse;
+		if (!OVR_SUCCESS(_hmdCreateTextureSwapChainGL(_session, &desc, &_insetTexture))) {
+			std::cout << "ERROR::FOVEATION::INSET_SWAP_CHAIN_NOT_CREATED" << std::endl;
+			_insetTexture = nullptr;
+			return;
+		}
+		_insetLayer.ColorTexture[0] = _insetTexture;
+	}
+
+	// One compositor log per run, named after the time it started
+	void _initTelemetry() {
+		if (!_session) {
+			return;
+		}
+		char logPath[64];
+		time_t now = time(nullptr);
+		strftime(logPath, sizeof(logPath), "perf_stats_%Y%m%d_%H%M%S.csv", localtime(&now));
+		_telemetry.open(_session, _telemetrySink.isOpen() ? nullptr : logPath, &_telemetrySink);
+		_telemetry.subscribe([](const TelemetrySummary& summary) {
+			_qualityGovernor.compositor(summary, _framePacer.periodMs() * DYNAMIC_RESOLUTION_TARGET);
+			if (!summary.appDroppedRecently && !summary.compositorDroppedRecently) {
+				return;
+			}
+			char message[160];
+			snprintf(message, sizeof(message), "Dropped %d app / %d compositor frames, app GPU p99 %.2f ms, latency p99 %.2f ms%s\n",
+				summary.appDroppedRecently, summary.compositorDroppedRecently, summary.appGpuP99, summary.latencyP99,
+				summary.aswActive ? ", ASW active" : "");
+			OutputDebugStringA(message);
+		});
+		if (_latencyTest.active()) {
+			_telemetry.subscribeFrames([](const ovrPerfStatsPerCompositorFrame& f) {
+				_latencyTest.compositorFrame(f);
+			});
+		}
+		if (_fleetStats.isOpen()) {
+			_telemetry.subscribeFrames([](const ovrPerfStatsPerCompositorFrame& f) {
+				_fleetStats.compositorFrame(f);
+			});
+		}
+	}
+
+	void _initProfilerOverlay() {
+		ovrTextureSwapChainDesc desc = {};
+		desc.Type = ovrTexture_2D;
+		desc.ArraySize = 1;
+		desc.Width = PROFILER_OVERLAY_WIDTH;
+		desc.Height = PROFILER_OVERLAY_HEIGHT;
+		desc.MipLevels = 1;
+		desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+		desc.SampleCount = 1;
+		desc.StaticImage = ovrFalse;
+		if (!OVR_SUCCESS(_hmdCreateTextureSwapChainGL(_session, &desc, &_overlayTexture))) {
+			std::cout << "ERROR::PROFILER::OVERLAY_SWAP_CHAIN_NOT_CREATED" << std::endl;
+			_overlayTexture = nullptr;
+			return;
+		}
+		_overlayLayer.ColorTexture = _overlayTexture;
+		glGenFramebuffers(1, &_overlayFbo);
+	}
+
+	// Five rows of bars, scaled so the white marker in the middle is the refresh period. There's no text; the CSVs have the numbers.
+	// Top: CPU phases of the latest resolved frame, stacked, one colour per phase. Second: the same phases on the GPU.
+	// Third: compositor percentiles, app GPU p50 then the stretch to p99, then the compositor's own GPU p50,
+	// with a red block on the right while the last telemetry summary saw dropped frames and a yellow one under ASW.
+	// Fourth: the last frame's draw calls stacked by RenderPass, the marker standing for PROFILER_DRAW_BUDGET.
+	// Bottom: _gpuBuckets' last window, each bucket's average GPU time stacked, in the phases' scale.
+	void _drawProfilerOverlay() {
+		GLDebugGroup debugGroup("profiler overlay");
+		static const vec3 colors[] = {
+			vec3(0.9f, 0.6f, 0.1f), vec3(0.8f, 0.2f, 0.8f), vec3(0.1f, 0.5f, 0.9f), vec3(0.1f, 0.8f, 0.9f),
+			vec3(0.2f, 0.8f, 0.2f), vec3(0.6f, 0.9f, 0.4f), vec3(0.9f, 0.2f, 0.2f), vec3(0.6f, 0.6f, 0.6f),
+		};
+		const float pixelsPerMs = PROFILER_OVERLAY_WIDTH / (2.0f * _framePacer.periodMs());
+		const int rowPitch = PROFILER_OVERLAY_HEIGHT / 5;
+		const int rowHeight = rowPitch - 4;
+
+		int curIndex;
+		_hmdGetTextureSwapChainCurrentIndex(_session, _overlayTexture, &curIndex);
+		GLuint curTexId;
+		_hmdGetTextureSwapChainBufferGL(_session, _overlayTexture, curIndex, &curTexId);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _overlayFbo);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curTexId, 0);
+
+		GLfloat clearColor[4];
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+		glViewport(0, 0, PROFILER_OVERLAY_WIDTH, PROFILER_OVERLAY_HEIGHT);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.6f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glEnable(GL_SCISSOR_TEST);
+
+		// Fills [x0, x1) pixels of a row, row 0 being the top one
+		auto bar = [&](int row, int x0, int x1, const vec3 & c) {
+			x1 = std::min(x1, PROFILER_OVERLAY_WIDTH);
+			if (x1 <= x0) {
+				return;
+			}
+			glScissor(x0, PROFILER_OVERLAY_HEIGHT - (row + 1) * rowPitch + 2, x1 - x0, rowHeight);
+			glClearColor(c.x, c.y, c.z, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT);
+		};
+
+		for (int row = 0; row < 2; ++row) {
+			float x = 0;
+			for (int phase = 0; phase < (int)_profiler.phaseCount(); ++phase) {
+				int x0 = (int)x;
+				x += (row == 0 ? _profiler.cpuMs(phase) : _profiler.gpuMs(phase)) * pixelsPerMs;
+				bar(row, x0, (int)x, colors[phase % (sizeof(colors) / sizeof(colors[0]))]);
+			}
+		}
+
+		const TelemetrySummary & t = _telemetry.summary();
+		int p50 = (int)(t.appGpuP50 * pixelsPerMs);
+		int p99 = (int)(t.appGpuP99 * pixelsPerMs);
+		bar(2, 0, p50, vec3(0.2f, 0.8f, 0.2f));
+		bar(2, p50, p99, vec3(0.1f, 0.4f, 0.1f));
+		bar(2, p99, p99 + (int)(t.compositorGpuP50 * pixelsPerMs), vec3(0.1f, 0.5f, 0.9f));
+		if (t.appDroppedRecently || t.compositorDroppedRecently) {
+			bar(2, PROFILER_OVERLAY_WIDTH - 16, PROFILER_OVERLAY_WIDTH, vec3(1.0f, 0.0f, 0.0f));
+		}
+		if (t.aswActive) {
+			bar(2, PROFILER_OVERLAY_WIDTH - 34, PROFILER_OVERLAY_WIDTH - 18, vec3(1.0f, 0.9f, 0.0f));
+		}
+
+		const float pixelsPerDraw = PROFILER_OVERLAY_WIDTH / (2.0f * PROFILER_DRAW_BUDGET);
+		float x = 0;
+		for (int pass = 0; pass < (int)RenderPass::Count; ++pass) {
+			int x0 = (int)x;
+			x += _renderStats.last().pass((RenderPass)pass).draws * pixelsPerDraw;
+			bar(3, x0, (int)x, colors[pass % (sizeof(colors) / sizeof(colors[0]))]);
+		}
+		x = 0;
+		for (int bucket = 0; bucket < (int)_gpuBuckets.bucketCount(); ++bucket) {
+			int x0 = (int)x;
+			x += _gpuBuckets.ms(bucket) * pixelsPerMs;
+			bar(4, x0, (int)x, colors[bucket % (sizeof(colors) / sizeof(colors[0]))]);
+		}
+
+		glScissor(PROFILER_OVERLAY_WIDTH / 2 - 1, 0, 2, PROFILER_OVERLAY_HEIGHT);
+		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glDisable(GL_SCISSOR_TEST);
+		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+		_hmdCommitTextureSwapChain(_session, _overlayTexture);
+	}
+
+	void onKey(int key, int scancode, int action, int mods) override {
+		if (GLFW_PRESS == action) switch (key) {
+		case GLFW_KEY_R:
+			_hmdRecenterTrackingOrigin(_session);
+			return;
+
+		case GLFW_KEY_V:
+			_cycleStereoMode();
+			return;
+
+		case GLFW_KEY_P:
+			_showOverlay = !_showOverlay && _overlayTexture;
+			return;
+
+		case GLFW_KEY_L:
+			_lateLatch = !_lateLatch;
+			printf("Late latching: %s\r\n", _lateLatch ? "on" : "off");
+			return;
+
+		case GLFW_KEY_F:
+			_foveated = !_foveated && _insetTexture;
+			_applyViewportSizes();
+			return;
+		}
+		// The spectator camera turns with the arrow keys and moves in and out with Page Up/Down
+		if (_mirrorMode == MirrorMode::Spectator && (GLFW_PRESS == action || GLFW_REPEAT == action)) switch (key) {
+		case GLFW_KEY_LEFT: _spectator.orbit(-1, 0); return;
+		case GLFW_KEY_RIGHT: _spectator.orbit(1, 0); return;
+		case GLFW_KEY_UP: _spectator.orbit(0, -1); return;
+		case GLFW_KEY_DOWN: _spectator.orbit(0, 1); return;
+		case GLFW_KEY_PAGE_UP: _spectator.zoom(-1); return;
+		case GLFW_KEY_PAGE_DOWN: _spectator.zoom(1); return;
+		}
+
+		GlfwApp::onKey(key, scancode, action, mods);
+	}
+
+	// Polls the session status, see SessionMonitor. True while idle, the frame having slept: update() and draw()
+	// then do nothing else.
+	bool _sessionIdle() {
+		const double now = _sessionSeconds();
+		const bool changed = _sessionMonitor.poll(_session, now);
+		if (_sessionMonitor.shouldQuit()) {
+			glfwSetWindowShouldClose(window, 1);
+		}
+		if (!_sessionIdleAllowed || _poseTrace.active()) {
+			return false;
+		}
+		if (changed && _sessionMonitor.idle()) {
+			printf("Idle, %s\r\n", _sessionMonitor.activity() == SessionActivity::Hidden ? "the app isn't visible in the HMD" : "the HMD is off");
+			_haptics.stop(ovrHand_Left);
+			_haptics.stop(ovrHand_Right);
+			_haptics.flush(_session, _hmdGetTimeInSeconds());
+			_framePacer.pause();
+		}
+		else if (changed) {
+			printf("Resumed\r\n");
+			// The time spent idle is nobody's frame, the simulation goes on from where it stopped
+			_lastFrameSeconds = now;
+		}
+		if (!_sessionMonitor.idle()) {
+			return false;
+		}
+		if (_sessionMonitor.releaseDue(now)) {
+			// The first frame back builds the graph and allocates its targets again
+			_renderGraph.release();
+			_renderGraphSamples = 0;
+			printf("Idle for %.0f s, eye targets released\r\n", SESSION_IDLE_RELEASE_SECONDS);
+		}
+		_mirrored = false;
+		_sessionMonitor.wait();
+		return true;
+	}
+
+	void update() final override {
+		_idleFrame = _sessionIdle();
+		if (_idleFrame) {
+			return;
+		}
+		_profiler.beginFrame(frame);
+		_gpuBuckets.beginFrame(frame);
+		ProfileScope updateScope(_profiler, _phaseUpdate);
+		TRACE_ZONE("update");
+
+		// Compute how much time has elapsed since the last frame
+		const double currentTime = _sessionSeconds();
+		_frameDeltaSeconds = (float)(currentTime - _lastFrameSeconds);
+		_poseTrace.exchange(PoseTraceKind::FrameDelta, &_frameDeltaSeconds);
+		_lastFrameSeconds = currentTime;
+		_elapsedSeconds += _frameDeltaSeconds;
+
+		// Users heard from without an avatar get their specification requested, it comes back from the pump
+		_avatarNetwork.receive([](uint64_t userID) {
+			_requestAvatarPump({ AvatarPumpRequestKind::RequestSpecification, userID, nullptr });
+		});
+		AvatarPumpResult result;
+		while (_avatarPumpResults.pop(&result))
+		{
+			if (result.kind == AvatarPumpResultKind::Specification)
+				_handleAvatarSpecification(result);
+			else
+				_handleAssetLoaded(result);
+		}
+		_avatarAssets.beginFrame(frame);
+		_reloadEvictedAvatarAssets();
+		_enforceGpuBudgets(frame);
+		// Last frame's draws said which texture levels they need
+		_textures.stream(frame, TEXTURE_STREAM_FRAME_BYTES);
+		_pumpAvatarUploads((float)(_framePacer.periodSeconds() * AVATAR_UPLOAD_FRAME_SHARE));
+		// Whatever this frame asked for, and the messages that came in meanwhile, are worked through as it renders
+		_kickAvatarPump();
+
+		updateScene(_frameDeltaSeconds);
+	}
+
+	void draw() final override {
+		if (_idleFrame) {
+			return;
+		}
+		TRACE_ZONE("draw");
+		// Startup may still be submitting the loading layer on its own, from here on the frames are ours
+		_loadingLayer.release();
+		// The update and the simulation kicked in it are through, the rest of the frame waits for its slot
+		_framePacer.waitToBegin(_session, frame);
+		_framePacer.begin(_session, frame);
+		float deltaSeconds = _frameDeltaSeconds;
+		_updateQuality();
+		_updateAvatarBudget();
+		_avatarReducedShading = _avatarOverBudget || _avatarShadingLowered;
+		_updateDepthPrepass();
+		_cullStats.beginFrame();
+		_planarMirror.beginFrame();
+
+		// Head, eyes and hands are all predicted for when this frame reaches the display.
+		// The sample that frame timing measures latency against is the one the draws use.
+		// Everything below reads this one snapshot, the input state only comes along for the avatar's controllers
+		const double displayTime = _hmdGetPredictedDisplayTime(_session, frame);
+		const TrackingSnapshot& tracking = _tracking.sample(_session, frame, displayTime, _viewScaleDesc.HmdToEyeOffset,
+			!_lateLatch, _avatar != nullptr || _latencyTest.active());
+		_sceneLayer.SensorSampleTime = tracking.sampleTime;
+		_updateFrameConstants(tracking.eyePoses);
+
+		_profiler.begin(_phaseAvatarPose);
+		// The queue stays for _queueAvatar to keep
+		_avatarEyesQueued = false;
+		_avatarOcclusion.beginFrame(frame);
+		// What the game decided in the last updateScene()
+		GameEvent gameEvent;
+		while (_game.poll(&gameEvent)) {
+			if (gameEvent.kind == GameEventKind::Vibration) {
+				_haptics.pulse((ovrHandType)gameEvent.hand, gameEvent.amplitude, gameEvent.seconds);
+			}
+			playGameEvent(gameEvent);
+		}
+		// Trigger and button edges since the last frame, at the times the input thread saw them
+		_inputPoller.drain();
+		if (!_inputPoller.running() && (_avatar || _latencyTest.active())) {
+			InputSample sample;
+			sample.input = tracking.input;
+			sample.hands[ovrHand_Left] = tracking.hands[ovrHand_Left].state;
+			sample.hands[ovrHand_Right] = tracking.hands[ovrHand_Right].state;
+			_inputPoller.add(sample);
+		}
+		_latencyTest.input(_inputPoller.edges(ovrHand_Left), _inputPoller.edges(ovrHand_Right), (uint64_t)frame);
+		if (_avatar)
+		{
+			// Convert the OVR inputs into Avatar SDK inputs
+			const HandEdges& leftEdges = _inputPoller.edges(ovrHand_Left);
+			const HandEdges& rightEdges = _inputPoller.edges(ovrHand_Right);
+
+			ovrAvatarHandInputState inputStateLeft;
+			_ovrAvatarHandInputStateFromOvr(tracking.hands[ovrHand_Left].avatar, tracking.input, ovrHand_Left, &inputStateLeft);
+
+			ovrAvatarHandInputState inputStateRight;
+			_ovrAvatarHandInputStateFromOvr(tracking.hands[ovrHand_Right].avatar, tracking.input, ovrHand_Right, &inputStateRight);
+
+			_updateAvatar(_avatar, deltaSeconds, tracking.head, inputStateLeft, inputStateRight, &_voiceCapture, &_avatarPlayer);
+			// Levels from where last frame's remote avatars stand, so the network knows which to pose this frame
+			_avatarLod.update(_remoteAvatars, tracking.headPosition);
+			for (size_t i = 0; i < _remoteAvatars.size(); ++i) {
+				_avatarNetwork.setPoseInterval(_remoteAvatars[i], _avatarLod.poseInterval(_remoteAvatars[i]));
+			}
+			_avatarNetwork.update(deltaSeconds);
+			_remoteAvatars.clear();
+			_avatarNetwork.avatars(&_remoteAvatars);
+			_updateAvatarPoses(_avatar, _remoteAvatars);
+
+			uint8_t amplitudeL = (uint8_t)round(inputStateLeft.indexTrigger * 150);
+			uint8_t amplitudeR = (uint8_t)round(inputStateRight.indexTrigger * 150);
+
+			_publishHands(tracking);
+
+			if (inputStateLeft.buttonMask != 0 || inputStateRight.buttonMask != 0 || leftEdges.buttonsPressed || rightEdges.buttonsPressed) {
+				if (_game.won() || _game.lost())
+				{
+					_gameInput.resetRequests++;
+				}
+			}
+
+			// A tap that came and went between two frames still fires for one
+			if (leftEdges.trigger || leftEdges.triggerPressed != 0.0) {
+				laserColorLeft = glm::vec4(1, 0, 0, 1);
+				_gameInput.triggers[ovrHand_Left] = true;
+			}
+			else {
+				_haptics.stop(ovrHand_Left);
+				laserColorLeft = glm::vec4(0, 1, 0, 1);
+				_gameInput.triggers[ovrHand_Left] = false;
+			}
+			if (rightEdges.trigger || rightEdges.triggerPressed != 0.0) {
+				laserColorRight = glm::vec4(1, 0, 0, 1);
+				_gameInput.triggers[ovrHand_Right] = true;
+			}
+			else {
+				_haptics.stop(ovrHand_Right);
+				laserColorRight = glm::vec4(0, 1, 0, 1);
+				_gameInput.triggers[ovrHand_Right] = false;
+			}
+
+			// Every part whose mesh is in draws, the rest follow as their assets arrive
+			// Uses the avatar queue too, so it goes before the eyes' parts are queued
+			_renderReflection(tracking.headPosition);
+			// Sorted by the first eye that draws it, the other eyes and the inset reuse the order. The inset lies inside
+			// the eyes' fields of view, so their frustum covers it too.
+			const StereoFrustum frustum = _stereoFrustum(_frameConstants.eyes[ovrEye_Left].viewProj,
+				_frameConstants.eyes[ovrEye_Right].viewProj, _reversedDepth);
+			_queueAvatar(_avatar, ovrAvatarVisibilityFlag_FirstPerson, tracking.headPosition, &frustum, nullptr, _weightedOit, true);
+			// Done with by the time the scene has drawn, the eyes then only replay them
+			const RenderView eyeViews[ovrEye_Count] = { _eyeRenderView(ovrEye_Left), _eyeRenderView(ovrEye_Right) };
+			_prepareAvatarEyes(eyeViews);
+		}
+		_inputPoller.clearEdges();
+		_profiler.end(_phaseAvatarPose);
+		// Everything this frame asked the controllers for, updateScene's included, in one go
+		_haptics.flush(_session, _hmdGetTimeInSeconds());
+
+		// The environment's layer on its frames, at the poses the layer then carries. The eye target is cleared
+		// transparent around what moves, for the layer to show through, and the app's clear colour put back after.
+		// Linear eye buffers are cleared to the colour decoded.
+		const bool environmentLayered = _environmentLayer.initialized();
+		GLfloat clearColor[4], eyeClearColor[4];
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+		_eyeClearColor(clearColor, eyeClearColor);
+		if (environmentLayered && _environmentLayer.due(frame)) {
+			_renderEnvironmentLayer(tracking.eyePoses, eyeClearColor);
+		}
+		if (environmentLayered) {
+			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		}
+		else {
+			glClearColor(eyeClearColor[0], eyeClearColor[1], eyeClearColor[2], eyeClearColor[3]);
+		}
+		_environmentOwnLayer = environmentLayered;
+
+		if (_renderGraphSamples != (_msaaActive() ? _msaaSamples : 1)) {
+			_buildRenderGraph();
+		}
+		int curIndex;
+		_hmdGetTextureSwapChainCurrentIndex(_session, _eyeTexture, &curIndex);
+		GLuint curTexId;
+		_hmdGetTextureSwapChainBufferGL(_session, _eyeTexture, curIndex, &curTexId);
+		_renderGraph.setTexture(_targetEyeColor, curTexId);
+		_eyeTextureId = curTexId;
+		if (_upscaling) {
+			_renderGraph.setTexture(_targetUpscaleHistory, _temporalUpscaler.historyTarget());
+		}
+		if (_remoteHmd.active()) {
+			_renderGraph.setTexture(_targetRemoteDepth, _remoteHmd.depthTexture(_renderTargetSize, _depthFormat()));
+		}
+		if (_foveated) {
+			_hmdGetTextureSwapChainCurrentIndex(_session, _insetTexture, &curIndex);
+			_hmdGetTextureSwapChainBufferGL(_session, _insetTexture, curIndex, &curTexId);
+			_renderGraph.setTexture(_targetInsetColor, curTexId);
+		}
+
+		if (_lateLatch) {
+			_tracking.relatch(_session, _viewScaleDesc.HmdToEyeOffset);
+			_sceneLayer.SensorSampleTime = tracking.sampleTime;
+			// The avatar lists keep the cameras they were prepared with, everything drawn from here takes the newer ones
+			_updateFrameConstants(tracking.eyePoses);
+			if (_avatar) {
+				// Picks next frame with the newer controller poses too
+				_publishHands(tracking);
+			}
+		}
+		_game.publishInput(_gameInput);
+		_latchedHands[ovrHand_Left] = tracking.hands[ovrHand_Left].transform;
+		_latchedHands[ovrHand_Right] = tracking.hands[ovrHand_Right].transform;
+
+		// From here to the HUD the frame must not allocate
+		CriticalAllocationScope drawCritical;
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			_sceneLayer.RenderPose[eye] = tracking.eyePoses[eye];
+		});
+		_mirrored = _mirrorDue();
+		// The eyes, the resolve, the upscale, the mirror and the inset, each with its targets bound
+		_renderGraph.execute();
+		_environmentOwnLayer = false;
+		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+		_debugDraw.endFrame();
+		_reportDrawAllocations(drawCritical.end());
+		{
+			GpuBucketScope overlayBucket(_bucketOverlays);
+			if (_showOverlay) {
+				_drawProfilerOverlay();
+			}
+			_hud.redraw(_session, [this](int width, int height) {
+				GLDebugGroup debugGroup("hud");
+				drawHud(width, height);
+			});
+			_latencyTest.redraw(_session);
+		}
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+		_profiler.begin(_phaseSubmit);
+		_hmdCommitTextureSwapChain(_session, _eyeTexture);
+		// Later layers are composited on top
+		ovrLayerHeader* headerList[7];
+		int layerCount = 0;
+		if (environmentLayered && _environmentLayer.submittable()) {
+			headerList[layerCount++] = _environmentLayer.header();
+		}
+		headerList[layerCount++] = &_sceneLayer.Header;
+		if (_foveated) {
+			headerList[layerCount++] = &_insetLayer.Header;
+		}
+		if (_loadingLayer.visible()) {
+			headerList[layerCount++] = _loadingLayer.header();
+		}
+		if (_hud.visible()) {
+			headerList[layerCount++] = _hud.header();
+		}
+		if (_showOverlay) {
+			headerList[layerCount++] = &_overlayLayer.Header;
+		}
+		if (_latencyTest.active()) {
+			headerList[layerCount++] = _latencyTest.header();
+		}
+		const ovrResult submitted = _framePacer.end(_session, frame, &_viewScaleDesc, headerList, layerCount);
+		// A runtime that doesn't know the depth layer fails the whole submit, the next goes without it
+		if (!OVR_SUCCESS(submitted) && environmentLayered && _environmentLayer.hasDepth()) {
+			_environmentLayer.dropDepth();
+		}
+		// The upscale pass submitted the full viewports, the next frame renders at the scaled ones again
+		if (_upscaling) {
+			_applyViewportSizes();
+		}
+		_profiler.end(_phaseSubmit);
+		_latencyTest.submitted((uint64_t)frame, tracking.sampleTime, tracking.displayTime);
+		if (frame == 1) {
+			_startup.mark("first frame submitted");
+		}
+		_pumpStartup();
+		if (_session) {
+			_telemetry.poll(_session);
+			const ovrPerfStatsPerCompositorFrame * compositor = _telemetry.newestFrame();
+			if (compositor && _framePacer.observeVsync(compositor->HmdVsyncIndex, _hmdGetTimeInSeconds())) {
+				_refreshRateChanged();
+			}
+		}
+		_latencyTest.endFrame();
+
+		// The spectator window after the headset's frame is out, so it never holds that up
+		if (_mirrorMode == MirrorMode::Spectator) {
+			_spectator.follow(tracking.headPosition, deltaSeconds);
+			if (_mirrored) {
+				_renderSpectator();
+			}
+		}
+		if (_mirrored && _mirrorMode == MirrorMode::Compositor) {
+			_profiler.begin(_phaseMirror);
+			GLuint mirrorTextureId;
+			ovr_GetMirrorTextureBufferGL(_session, _mirrorTexture, &mirrorTextureId);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, _mirrorFbo);
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirrorTextureId, 0);
+			glBlitFramebuffer(0, 0, _mirrorSize.x, _mirrorSize.y, 0, _mirrorSize.y, _mirrorSize.x, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+			_profiler.end(_phaseMirror);
+		}
+		// The back buffer has the whole of the window's frame by now, whichever mode drew it
+		if (_sessionRecorder.recording()) {
+			ProfileScope recordScope(_profiler, _phaseRecord);
+			_sessionRecorder.poll();
+			if (_mirrored) {
+				_sessionRecorder.capture({ frame, _sessionSeconds(), _profiler.resolvedFrame(), _profiler.cpuFrameMs(), _profiler.gpuFrameMs() });
+			}
+		}
+		_profiler.count(_counterStateChanges, _glState.changes());
+		_profiler.count(_counterStateFiltered, _glState.filtered());
+		const GpuArenaStats arena = _gpuArena.stats();
+		_profiler.count(_counterArenaResident, (uint32_t)(arena.bytesResident / 1024));
+		_profiler.count(_counterArenaFragmentation, (uint32_t)(arena.fragmentation() * 100.0f));
+		_profiler.count(_counterCulledMeshes, _cullStats.meshes);
+		_profiler.count(_counterCulledInstances, _cullStats.instances);
+		_profiler.count(_counterMsaaSamples, _msaaActive() ? (uint32_t)_msaaSamples : 1);
+		_profiler.count(_counterShadingRate, (uint32_t)_shadingRate.level());
+		const AvatarNetCounters net = _avatarNetwork.takeCounters();
+		const float kilobitsPerByte = deltaSeconds > 0.0f ? 8.0f / 1000.0f / deltaSeconds : 0.0f;
+		_profiler.count(_counterNetIn, (uint32_t)(net.bytesReceived * kilobitsPerByte));
+		_profiler.count(_counterNetOut, (uint32_t)(net.bytesSent * kilobitsPerByte));
+		_profiler.count(_counterNetBuffer, (uint32_t)(net.bufferedSeconds * 1000.0f));
+		_profiler.count(_counterNetLost, net.packetsLost);
+		_profiler.count(_counterAvatarsReduced, _avatarLod.count(AvatarLod::Reduced));
+		_profiler.count(_counterAvatarsDistant, _avatarLod.count(AvatarLod::Distant));
+		_profiler.count(_counterFrameArenaPeak, (uint32_t)(_frameArena.stats().highWater / 1024));
+		const FramePacingStats& pacing = _framePacer.stats();
+		_profiler.count(_counterPacingWait, pacing.waitUs);
+		_profiler.count(_counterFrameInterval, pacing.intervalUs);
+		_profiler.count(_counterPacingMissed, pacing.missed);
+		_profiler.count(_counterFrameAllocations, (uint32_t)(AllocationSample::thread() - frameAllocationStart).count);
+		_profiler.count(_counterCriticalAllocations, (uint32_t)_criticalAllocationCount.exchange(0, std::memory_order_relaxed));
+		for (int tag = 0; tag < (int)AllocationTag::Count; ++tag) {
+			const int64_t live = _allocationTags[tag].live.load(std::memory_order_relaxed);
+			_profiler.count(_counterHeapTags[tag], (uint32_t)(std::max<int64_t>(live, 0) / 1024));
+		}
+		for (int category = 0; category < (int)GpuMemoryCategory::Count; ++category) {
+			_profiler.count(_counterGpuMemory[category], (uint32_t)(std::max<int64_t>(_gpuMemory.bytes((GpuMemoryCategory)category), 0) / 1024));
+		}
+		_profiler.count(_counterVramAvailable, (uint32_t)_gpuMemory.driverMemory().availableKB);
+		_profiler.count(_counterAvatarEvictions, _avatarAssets.evictions());
+		// Nothing draws after this point of the frame
+		const RenderFrameStats& renderStats = _renderStats.frame();
+		const RenderCounts renderTotal = renderStats.total();
+		_profiler.count(_counterDraws, renderTotal.draws);
+		TRACE_PLOT("draw calls", renderTotal.draws);
+		_profiler.count(_counterInstances, renderTotal.instances);
+		_profiler.count(_counterTriangles, (uint32_t)renderTotal.triangles);
+		_profiler.count(_counterProgramBinds, renderTotal.programBinds);
+		_profiler.count(_counterVertexArrayBinds, renderTotal.vertexArrayBinds);
+		_profiler.count(_counterTextureBinds, renderTotal.textureBinds);
+		_profiler.count(_counterUniformBytes, (uint32_t)(renderTotal.uniformBytes / 1024));
+		_profiler.count(_counterUploadBytes, (uint32_t)(renderTotal.uploadBytes / 1024));
+		for (int pass = 0; pass < (int)RenderPass::Count; ++pass) {
+			for (int eye = 0; eye < (int)RenderEye::Count; ++eye) {
+				_profiler.count(_counterPassDraws[pass][eye], renderStats.passes[pass][eye].draws);
+			}
+		}
+		_profiler.endFrame();
+		_gpuBuckets.endFrame();
+		_fleetStats.frame(_profiler.resolvedFrame(), _profiler.cpuFrameMs(), _profiler.gpuFrameMs());
+		_fleetStats.tick();
+		if (_hitchRecorder.enabled()) {
+			HitchContext & context = _hitchRecorder.context();
+			context.loadingAssets = _loadingAssets;
+			context.avatarUploads = (uint32_t)(_avatarUploads.size() - _avatarUploadHead);
+			context.streaming = _assets.pending();
+			HitchFrame hitch;
+			hitch.frame = (uint64_t)frame;
+			hitch.seconds = _sessionSeconds();
+			hitch.intervalUs = pacing.intervalUs;
+			hitch.waitUs = pacing.waitUs;
+			hitch.predictionMs = (float)((tracking.displayTime - tracking.sampleTime) * 1000.0);
+			hitch.relatched = tracking.relatched;
+			hitch.draws = renderTotal.draws;
+			hitch.triangles = (uint32_t)renderTotal.triangles;
+			hitch.programBinds = renderTotal.programBinds;
+			hitch.uploadKB = (uint32_t)(renderTotal.uploadBytes / 1024);
+			if (const ovrPerfStatsPerCompositorFrame * compositor = _telemetry.newestFrame()) {
+				hitch.compositorFrame = compositor->CompositorFrameIndex;
+				hitch.appGpuMs = compositor->AppGpuElapsedTime * 1000.0f;
+				hitch.appCpuMs = compositor->AppCpuElapsedTime * 1000.0f;
+				hitch.compositorGpuMs = compositor->CompositorGpuElapsedTime * 1000.0f;
+				hitch.latencyMs = compositor->AppMotionToPhotonLatency * 1000.0f;
+				hitch.appDropped = compositor->AppDroppedFrameCount;
+				hitch.compositorDropped = compositor->CompositorDroppedFrameCount;
+				hitch.aswActive = compositor->AswIsActive != ovrFalse;
+			}
+			_hitchRecorder.endFrame(hitch);
+		}
+		// The first run starts once the app's initGl is through, so the scene is there to apply it to
+		if (_poseTrace.finished()) {
+			glfwSetWindowShouldClose(window, 1);
+		}
+		if (_benchHmd.active() && (!_benchRunStarted || _benchHmd.sample(_profiler, _profiler.counter(_counterCulledInstances)))) {
+			_startBenchRun();
+		}
+	}
+
+	// Called once per frame before draw(), this is where everything that isn't per-eye should advance
+	virtual void updateScene(float deltaSeconds) {}
+
+	// Each event the game queued, as draw() drains them, after the haptics RiftApp plays itself
+	virtual void playGameEvent(const GameEvent & event) {}
+
+	// A benchmark run's scene settings, false if this machine can't do them and the run is to be skipped
+	virtual bool applyBenchConfig(const BenchConfig & config) { return true; }
+
+	// Fills the HUD layer, width by height pixels, whenever _hud was marked dirty while shown
+	virtual void drawHud(int width, int height) {}
+
+	// Fills the loading layer's image, width by height pixels, once at startup
+	virtual void drawLoading(int width, int height) {
+		glDisable(GL_SCISSOR_TEST);
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+
+	// Whether this frame's scene draws its opaque geometry depth only first, then shades with GL_EQUAL
+	bool depthPrepass() const { return _depthPrepass; }
+
+	// The eye target's full size, what the eye viewports are at most
+	uvec2 renderTargetSize() const { return _renderTargetSize; }
+
+	// While the eye target's scene pass draws: its static environment is in the environment layer, the pass only
+	// lays the environment's depth for the rest to sort against
+	bool environmentOwnLayer() const { return _environmentOwnLayer; }
+
+	// draw() publishes the player's input and plays the game's events, updateScene() runs the game's side
+	GameState _game;
+
+	virtual void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose) = 0;
+
+	// Scenes that implement renderSceneStereo() return true, RiftApp then defaults to a single pass stereo mode
+	virtual bool supportsStereo() const { return false; }
+
+	virtual void renderSceneStereo(const StereoView & stereo) {}
+
+	// Scenes that can draw their static environment alone return true, --split-rate then gives it its own layer
+	virtual bool supportsEnvironmentLayer() const { return false; }
+
+	// The static environment alone, shaded, into the environment layer one eye at a time
+	virtual void renderEnvironment(const StereoView & view) {}
+
+private:
+	// Both eyes in one renderSceneStereo() call, into the eyes pass's target
+	void _renderStereo() {
+		StereoView stereo;
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			stereo.projections[eye] = _frameConstants.eyes[eye].projection;
+			stereo.views[eye] = _frameConstants.eyes[eye].view;
+			stereo.eyeViewports[eye] = vec4(1, 1, 0, 0);
+		});
+		_latchView(stereo);
+
+		if (_stereoMode == StereoMode::Multiview) {
+			stereo.eyeCount = 1;
+			stereo.multiview = true;
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _multiviewFbo);
+			// Both layers share one viewport, which follows the dynamic resolution like the eye viewports do
+			const auto& left = _sceneLayer.Viewport[ovrEye_Left].Size;
+			const auto& right = _sceneLayer.Viewport[ovrEye_Right].Size;
+			const uvec2 layerSize(std::max(left.w, right.w), std::max(left.h, right.h));
+			glViewport(0, 0, layerSize.x, layerSize.y);
+			// One clear for both layers, over both eyes' clear boxes
+			glm::ivec4 box = _eyeClearBox(ovrEye_Left, left.w, left.h);
+			const glm::ivec4 rightBox = _eyeClearBox(ovrEye_Right, right.w, right.h);
+			const glm::ivec2 boxEnd = glm::max(glm::ivec2(box.x + box.z, box.y + box.w), glm::ivec2(rightBox.x + rightBox.z, rightBox.y + rightBox.w));
+			box.x = std::min(box.x, rightBox.x);
+			box.y = std::min(box.y, rightBox.y);
+			glEnable(GL_SCISSOR_TEST);
+			glScissor(box.x, box.y, boxEnd.x - box.x, boxEnd.y - box.y);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			_glCapture.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glDisable(GL_SCISSOR_TEST);
+			// Each eye's part of its layer is the lower left corner the copy below takes
+			vec4 maskViewports[ovrEye_Count];
+			ovr::for_each_eye([&](ovrEyeType eye) {
+				const auto& size = _sceneLayer.Viewport[eye].Size;
+				vec2 scale = vec2(size.w, size.h) / vec2(layerSize);
+				maskViewports[eye] = vec4(scale.x, scale.y, scale.x - 1.0f, scale.y - 1.0f);
+			});
+			_hiddenArea.drawStereo(maskViewports, true, _reversedDepth);
+			_shadingRate.begin(true);
+			renderSceneStereo(stereo);
+			_shadingRate.begin(false);
+
+			// Depth comes along so the avatar pass still sorts against the scene
+			GLDebugGroup copyGroup("multiview copy");
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _renderGraph.framebuffer(_passEyes));
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, _multiviewReadFbo);
+			ovr::for_each_eye([&](ovrEyeType eye) {
+				const auto& vp = _sceneLayer.Viewport[eye];
+				glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, _multiviewColor, 0, eye);
+				glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _multiviewDepth, 0, eye);
+				glBlitFramebuffer(0, 0, vp.Size.w, vp.Size.h, vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h,
+					GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+				_glCapture.blit(0, 0, vp.Size.w, vp.Size.h, vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h,
+					GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+			});
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+			// The layers are cleared again before they are next drawn, nothing needs them kept in memory
+			if (GLEW_ARB_invalidate_subdata) {
+				static const GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_DEPTH_ATTACHMENT };
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _multiviewFbo);
+				glInvalidateFramebuffer(GL_DRAW_FRAMEBUFFER, 2, attachments);
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _renderGraph.framebuffer(_passEyes));
+			}
+			return;
+		}
+
+		// Instanced: the whole target is the viewport and each eye is squeezed into its own half in the vertex shader
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			const auto& vp = _sceneLayer.Viewport[eye];
+			vec2 scale = vec2(vp.Size.w, vp.Size.h) / vec2(_renderTargetSize);
+			vec2 offset = vec2(2 * vp.Pos.x + vp.Size.w, 2 * vp.Pos.y + vp.Size.h) / vec2(_renderTargetSize) - vec2(1);
+			stereo.eyeViewports[eye] = vec4(scale.x, scale.y, offset.x, offset.y);
+		});
+		stereo.eyeCount = 2;
+		stereo.multiview = false;
+		glViewport(0, 0, _renderTargetSize.x, _renderTargetSize.y);
+		_hiddenArea.drawStereo(stereo.eyeViewports, false, _reversedDepth);
+		glEnable(GL_CLIP_DISTANCE0);
+		renderSceneStereo(stereo);
+		glDisable(GL_CLIP_DISTANCE0);
+	}
+
+	// Steps one of the governor's knobs by the GPU time against DYNAMIC_RESOLUTION_TARGET of the budget
+	void _updateQuality() {
+		// A benchmark measures one fixed quality, the most the settings allow
+		if (_benchHmd.active()) {
+			return;
+		}
+		// Only frames the spectator drew have its time
+		if (_profiler.gpuMs(_phaseMirror) > 0.0f && _mirrorMode == MirrorMode::Spectator) {
+			_spectatorGpuMs = _profiler.gpuMs(_phaseMirror);
+		}
+		QualityFrame quality;
+		quality.frame = frame;
+		quality.gpuMs = _profiler.gpuFrameMs();
+		quality.targetMs = _framePacer.periodMs() * DYNAMIC_RESOLUTION_TARGET;
+		_qualityGovernor.update(quality);
+	}
+
+	// RiftApp's knobs, first to give way first. The spectator only costs the window, MSAA samples go before any
+	// resolution is given up and, each one reallocating the target, only come back after DYNAMIC_MSAA_INTERVAL.
+	// Coarser shading of the periphery, where the driver can, goes next, then the avatars' shading, and the eye
+	// resolution last: it shrinks quickly when the GPU runs over and grows back slowly. The cost models are rough
+	// shares of the passes a knob touches, they only have to rank the steps and keep a step up from overshooting.
+	void _initQualityKnobs() {
+		QualityKnob spectator;
+		spectator.name = "spectator_hz";
+		spectator.priority = QUALITY_PRIORITY_SPECTATOR;
+		spectator.lowerable = [this] { return _mirrorMode == MirrorMode::Spectator && _spectatorRateLevel < QUALITY_SPECTATOR_HALVINGS; };
+		spectator.lowered = [this] { return _spectatorRateLevel > 0; };
+		// Drawn at the rate out of the display's, halving the rate halves what it costs per frame
+		spectator.lowerSavesMs = spectator.raiseCostsMs = [this](const QualityFrame&) {
+			const float share = _mirrorRate() > 0.0f ? std::min(_mirrorRate() / _framePacer.refreshRate(), 1.0f) : 1.0f;
+			return _spectatorGpuMs * share * 0.5f;
+		};
+		spectator.lower = [this](const QualityFrame&) { _spectatorRateLevel++; };
+		spectator.raise = [this](const QualityFrame&) { _spectatorRateLevel--; };
+		spectator.value = [this] { return _mirrorRate(); };
+		_qualityGovernor.add(spectator);
+
+		QualityKnob msaa;
+		msaa.name = "msaa_samples";
+		msaa.priority = QUALITY_PRIORITY_MSAA;
+		msaa.lowerable = [this] { return _msaaActive(); };
+		msaa.lowered = [this] { return _stereoMode != StereoMode::Multiview && _msaaSamples < _msaaMaxSamples; };
+		msaa.lowerSavesMs = msaa.raiseCostsMs = [this](const QualityFrame&) { return _sceneGpuMs() * 0.25f; };
+		msaa.lower = [this](const QualityFrame&) { _setMsaaSamples(_msaaSamples / 2); };
+		msaa.raise = [this](const QualityFrame&) { _setMsaaSamples(std::min(_msaaSamples * 2, _msaaMaxSamples)); };
+		msaa.value = [this] { return (float)_msaaSamples; };
+		msaa.raiseInterval = DYNAMIC_MSAA_INTERVAL;
+		_qualityGovernor.add(msaa);
+
+		QualityKnob shadingRate;
+		shadingRate.name = "shading_rate";
+		shadingRate.priority = QUALITY_PRIORITY_SHADING_RATE;
+		shadingRate.lowerable = [this] { return _shadingRate.supported() && _shadingRate.level() < SHADING_RATE_LEVELS - 1; };
+		shadingRate.lowered = [this] { return _shadingRate.level() > 0; };
+		shadingRate.lowerSavesMs = shadingRate.raiseCostsMs = [this](const QualityFrame&) { return _sceneGpuMs() * 0.15f; };
+		shadingRate.lower = [this](const QualityFrame&) { _shadingRate.setLevel(_shadingRate.level() + 1); };
+		shadingRate.raise = [this](const QualityFrame&) { _shadingRate.setLevel(_shadingRate.level() - 1); };
+		shadingRate.value = [this] { return (float)_shadingRate.level(); };
+		_qualityGovernor.add(shadingRate);
+
+		QualityKnob avatarShading;
+		avatarShading.name = "avatar_shading";
+		avatarShading.priority = QUALITY_PRIORITY_AVATAR_SHADING;
+		avatarShading.lowerable = [] { return !_avatarShadingLowered; };
+		avatarShading.lowered = [] { return _avatarShadingLowered; };
+		avatarShading.lowerSavesMs = avatarShading.raiseCostsMs = [this](const QualityFrame&) { return _avatarGpuMs() * 0.3f; };
+		avatarShading.lower = [](const QualityFrame&) { _avatarShadingLowered = true; };
+		avatarShading.raise = [](const QualityFrame&) { _avatarShadingLowered = false; };
+		avatarShading.value = [] { return _avatarShadingLowered ? 1.0f : 0.0f; };
+		_qualityGovernor.add(avatarShading);
+
+		QualityKnob resolution;
+		resolution.name = "resolution_scale";
+		resolution.priority = QUALITY_PRIORITY_RESOLUTION;
+		resolution.lowerable = [this] { return _resolutionScale > DYNAMIC_RESOLUTION_MIN_SCALE; };
+		resolution.lowered = [this] { return _resolutionScale < _resolutionCeiling; };
+		// GPU time goes with the pixel count, so the linear scale goes with its square root
+		resolution.lowerSavesMs = [this](const QualityFrame& quality) {
+			const float scale = std::max(_resolutionScale * _resolutionLowerFactor(quality), DYNAMIC_RESOLUTION_MIN_SCALE);
+			return quality.gpuMs * (1.0f - (scale * scale) / (_resolutionScale * _resolutionScale));
+		};
+		resolution.raiseCostsMs = [this](const QualityFrame& quality) {
+			const float scale = std::min(_resolutionScale + DYNAMIC_RESOLUTION_STEP, _resolutionCeiling);
+			return quality.gpuMs * ((scale * scale) / (_resolutionScale * _resolutionScale) - 1.0f);
+		};
+		resolution.lower = [this](const QualityFrame& quality) {
+			_setResolutionScale(_resolutionScale * _resolutionLowerFactor(quality));
+		};
+		resolution.raise = [this](const QualityFrame&) { _setResolutionScale(_resolutionScale + DYNAMIC_RESOLUTION_STEP); };
+		resolution.value = [this] { return _resolutionScale; };
+		_qualityGovernor.add(resolution);
+	}
+
+	// Shrinks quickly, as far as the GPU is over at once though never by more than 15% a step
+	float _resolutionLowerFactor(const QualityFrame& quality) const {
+		return std::max(sqrtf(quality.targetMs / quality.gpuMs), 0.85f);
+	}
+
+	void _setResolutionScale(float scale) {
+		_resolutionScale = glm::clamp(scale, DYNAMIC_RESOLUTION_MIN_SCALE, _resolutionCeiling);
+		_applyViewportSizes();
+	}
+
+	// Positions stay where the full size layout put them, each eye just uses less of its area
+	void _applyViewportSizes() {
+		float scale = _resolutionScale * (_foveated ? FOVEATION_PERIPHERY_SCALE : 1.0f);
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			_sceneLayer.Viewport[eye].Size.w = std::max(2, (int)(_maxViewportSize[eye].w * scale) & ~1);
+			_sceneLayer.Viewport[eye].Size.h = std::max(2, (int)(_maxViewportSize[eye].h * scale) & ~1);
+		});
+	}
+
+	// The snapshot's controllers as the game picks with them next updateScene()
+	void _publishHands(const TrackingSnapshot& tracking) {
+		for (int hand = 0; hand < ovrHand_Count; ++hand) {
+			_gameInput.rays[hand] = tracking.hands[hand].ray;
+		}
+	}
+
+	// Rewrites the LateLatch block with the cameras of the draws about to be issued
+	void _latchView(const StereoView & stereo) {
+		LateLatchBlock block;
+		for (int i = 0; i < 2; ++i) {
+			block.views[i] = stereo.views[i];
+			block.projections[i] = stereo.projections[i];
+			block.hands[i] = _latchedHands[i];
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, _lateLatchBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LateLatchBlock), &block);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		_renderStats.uniforms(sizeof(LateLatchBlock));
+		glBindBufferBase(GL_UNIFORM_BUFFER, LATE_LATCH_BINDING, _lateLatchBuffer);
+	}
+
+	// The scene layer's cameras for eyePoses, the view is the rigid inverse of the pose. The upscaler's jitter for
+	// the frame is in the projections, for the viewports the eyes render at.
+	void _updateFrameConstants(const ovrPosef eyePoses[2]) {
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			EyeConstants& camera = _frameConstants.eyes[eye];
+			RigidTransform pose, inversePose;
+			_rigidFromOvrPose(eyePoses[eye], &pose);
+			_rigidInverse(pose, &inversePose);
+			_mat4FromRigid(pose, &camera.inverseView);
+			_mat4FromRigid(inversePose, &camera.view);
+			camera.projection = _eyeProjections[eye];
+			if (_upscaling) {
+				_upscaleJitter[eye] = _temporalUpscaler.jitter(frame, _sceneLayer.Viewport[eye].Size);
+				camera.projection = TemporalUpscaler::jittered(_eyeProjections[eye], _upscaleJitter[eye]);
+			}
+			camera.viewProj = camera.projection * camera.view;
+			camera.position = _glmFromOvrVector(eyePoses[eye].Position);
+		});
+	}
+
+	// A scene layer eye's camera as the avatar queue draws with it
+	RenderView _eyeRenderView(int eye) const {
+		const EyeConstants& camera = _frameConstants.eyes[eye];
+		RenderView renderView;
+		renderView.view = camera.view;
+		renderView.proj = camera.projection;
+		renderView.viewProj = camera.viewProj;
+		renderView.viewPos = camera.position;
+		return renderView;
+	}
+
+	// Avatar and debug lines for one eye, into whatever target and viewport are bound. eye picks the command list
+	// _prepareAvatarEyes() built for that eye of the scene layer, -1 for views it didn't, like the inset's.
+	void _renderAvatarEye(RenderView renderView, int eye = -1) {
+
+		// The frame's reflection, it is behind the hands so it goes first
+		_planarMirror.draw(renderView.viewProj);
+
+		// If we have the avatar, render what of it has loaded from this frame's queue
+		if (_avatar)
+		{
+			if (eye >= 0 && _avatarEyesQueued) {
+				_jobs.wait(_avatarEyesPrepared);
+				renderView.list = eye;
+				_queryAvatarOcclusion(renderView, eye);
+			}
+			// The translucent parts, if they are WEIGHTED_OIT draws, come in the translucent pass after
+			_avatarQueue.submit(renderView, _avatarOitQueued ? RENDER_PASSES_ALL & ~RENDER_PASS_BIT(RENDER_PASS_BLENDED) : RENDER_PASSES_ALL);
+		}
+
+		// Any debug lines of the frame, one draw per eye
+		GpuBucketScope overlayBucket(_bucketOverlays);
+		_debugDraw.flush(renderView.viewProj);
+	}
+
+	// Flips the body and base between full and reduced shading by the avatar passes' GPU time against _avatarBudgetMs
+	void _updateAvatarBudget() {
+		if (_benchHmd.active() || frame - _avatarBudgetChangedFrame < AVATAR_BUDGET_INTERVAL) {
+			return;
+		}
+		const float avatarMs = _avatarGpuMs();
+		const bool reduce = _avatarOverBudget ? avatarMs > _avatarBudgetMs * 0.5f : avatarMs > _avatarBudgetMs;
+		if (reduce != _avatarOverBudget) {
+			_avatarOverBudget = reduce;
+			_avatarBudgetChangedFrame = frame;
+		}
+	}
+
+	// Auto turns the scene's depth pre-pass on when the frame is over budget and the scene passes take most of it,
+	// the fragment bound case, and keeps it only if the scene's GPU time then drops. Times are per full size pixel,
+	// so the dynamic resolution moving at the same time doesn't decide the trial. With plenty of headroom again the
+	// pre-pass is dropped, its extra vertex work no longer buying anything.
+	void _updateDepthPrepass() {
+		if (_depthPrepassMode != DepthPrepassMode::Auto) {
+			_depthPrepass = _depthPrepassMode == DepthPrepassMode::On;
+			return;
+		}
+		if (_benchHmd.active() || frame - _depthPrepassChangedFrame < DEPTH_PREPASS_INTERVAL) {
+			return;
+		}
+		const float gpuMs = _profiler.gpuFrameMs();
+		const float sceneMs = _profiler.gpuMs(_phaseScene[ovrEye_Left]) + _profiler.gpuMs(_phaseScene[ovrEye_Right]);
+		if (gpuMs <= 0.0f || sceneMs <= 0.0f) {
+			return;
+		}
+		const float pixelMs = sceneMs / (_resolutionScale * _resolutionScale);
+		const float targetMs = _framePacer.periodMs() * DYNAMIC_RESOLUTION_TARGET;
+		if (_depthPrepassTrial) {
+			_depthPrepassTrial = false;
+			_depthPrepassChangedFrame = frame;
+			if (pixelMs >= _depthPrepassBaselineMs) {
+				_depthPrepass = false;
+				_depthPrepassRetryFrame = frame + DEPTH_PREPASS_RETRY;
+			}
+			return;
+		}
+		const bool fragmentBound = gpuMs > targetMs && sceneMs > gpuMs * 0.5f;
+		if (!_depthPrepass && fragmentBound && frame >= _depthPrepassRetryFrame) {
+			_depthPrepass = true;
+			_depthPrepassTrial = true;
+			_depthPrepassBaselineMs = pixelMs;
+			_depthPrepassChangedFrame = frame;
+		}
+		else if (_depthPrepass && gpuMs < targetMs * 0.5f) {
+			_depthPrepass = false;
+			_depthPrepassChangedFrame = frame;
+		}
+	}
+
+	// The third person avatar in _planarMirror, once from the head for both eyes, at the texture's resolution
+	void _renderReflection(const glm::vec3 & viewer) {
+		ReflectionCamera camera;
+		if (!_planarMirror.enabled() || !_planarMirror.camera(viewer, &camera)) {
+			return;
+		}
+		ProfileScope reflectionScope(_profiler, _phaseReflection);
+		TRACE_ZONE("reflection");
+		TRACE_GPU_ZONE("reflection");
+		GLDebugGroup debugGroup("reflection");
+		RenderPassScope passScope(RenderPass::Reflection, RenderEye::Both);
+		ovrFovPort fov;
+		fov.UpTan = camera.upTan;
+		fov.DownTan = camera.downTan;
+		fov.LeftTan = camera.leftTan;
+		fov.RightTan = camera.rightTan;
+		const mat4 proj = ovr::toGlm(ovrMatrix4f_Projection(fov, camera.nearPlane, EYE_FAR_PLANE, _projectionFlags()));
+		_planarMirror.begin();
+		_renderAvatar(_avatar, ovrAvatarVisibilityFlag_ThirdPerson, camera.view, proj, camera.viewPos, false, &_planarMirror);
+		_planarMirror.end();
+	}
+
+	// The environment eye by eye whatever the stereo mode, every EnvironmentLayer::interval() frames
+	void _renderEnvironmentLayer(const ovrPosef eyePoses[2], const GLfloat clearColor[4]) {
+		ProfileScope environmentScope(_profiler, _phaseEnvironment);
+		TRACE_ZONE("environment");
+		TRACE_GPU_ZONE("environment");
+		GLDebugGroup debugGroup("environment");
+		_glState.depthFunc(GL_LESS);
+		_environmentLayer.redraw(_session, frame, _sceneLayer, eyePoses, clearColor, [&](ovrEyeType eye) {
+			RenderPassScope passScope(RenderPass::Environment, (RenderEye)eye);
+			GLDebugGroup eyeGroup(eye == ovrEye_Left ? "environment left" : "environment right");
+			_hiddenArea.draw(eye, _reversedDepth);
+			// Not upscaled, the compositor reprojects it as rendered, so without the jitter
+			const EyeConstants& camera = _frameConstants.eyes[eye];
+			const StereoView view = _monoStereoView(_eyeProjections[eye], camera.view);
+			_latchView(view);
+			renderEnvironment(view);
+		});
+	}
+
+	// The centre of each eye again, at full density into the inset swap chain the render graph has bound
+	void _renderFoveationInset(const ovrPosef eyePoses[2]) {
+		ProfileScope insetScope(_profiler, _phaseInset);
+		TRACE_ZONE("foveation inset");
+		TRACE_GPU_ZONE("foveation inset");
+		GLDebugGroup debugGroup("foveation inset");
+		glViewport(0, 0, _insetTargetSize.x, _insetTargetSize.y);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		_glCapture.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			_insetLayer.RenderPose[eye] = eyePoses[eye];
+			RenderPassScope passScope(RenderPass::Inset, (RenderEye)eye);
+			GLDebugGroup eyeGroup(eye == ovrEye_Left ? "inset left" : "inset right");
+			const auto& vp = _insetLayer.Viewport[eye];
+			glViewport(vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h);
+			// The scene layer's eye with the inset's narrower projection
+			RenderView view = _eyeRenderView(eye);
+			view.proj = _insetProjections[eye];
+			view.viewProj = view.proj * view.view;
+			_latchView(_monoStereoView(view.proj, view.view));
+			renderScene(view.proj, _frameConstants.eyes[eye].inverseView);
+			_renderAvatarEye(view);
+		});
+		_insetLayer.SensorSampleTime = _sceneLayer.SensorSampleTime;
+		_hmdCommitTextureSwapChain(_session, _insetTexture);
+	}
+
+	// V switches between the stereo modes the scene and driver support, for comparing their cost
+	void _cycleStereoMode() {
+		if (!supportsStereo() || _eyeGpus.active()) {
+			return;
+		}
+		switch (_stereoMode) {
+		case StereoMode::Sequential:
+			_stereoMode = StereoMode::Instanced;
+			break;
+		case StereoMode::Instanced:
+			_stereoMode = _multiviewFbo ? StereoMode::Multiview : StereoMode::Sequential;
+			break;
+		default:
+			_stereoMode = StereoMode::Sequential;
+			break;
+		}
+		printf("Stereo mode: %s\r\n", _stereoModeName());
+	}
+
+	const char * _stereoModeName() const {
+		const char * names[] = { "sequential", "instanced", "multiview" };
+		return names[(int)_stereoMode];
+	}
+
+	// Applies the next benchmark run that this machine can do, or ends the benchmark after the last one
+	void _startBenchRun() {
+		_benchRunStarted = true;
+		while (const BenchConfig * config = _benchHmd.nextRun()) {
+			if (_applyBenchStereo(config->stereo) && applyBenchConfig(*config)) {
+				_benchHmd.beginRun(frame, _stereoModeName());
+				return;
+			}
+			_benchHmd.skipRun();
+		}
+		_benchHmd.finish();
+		glfwSetWindowShouldClose(window, 1);
+	}
+
+	bool _applyBenchStereo(BenchStereo stereo) {
+		switch (stereo) {
+		case BenchStereo::Sequential:
+			_stereoMode = StereoMode::Sequential;
+			return true;
+		case BenchStereo::Instanced:
+			_stereoMode = StereoMode::Instanced;
+			return supportsStereo() && !_eyeGpus.active();
+		case BenchStereo::Multiview:
+			_stereoMode = StereoMode::Multiview;
+			return _multiviewFbo != 0 && !_eyeGpus.active();
+		default:
+			_stereoMode = _initialStereoMode;
+			return true;
+		}
+	}
+
+	// The draw loop is expected to be allocation free, complain about once a second if it isn't
+	void _reportDrawAllocations(const AllocationSample& frameAllocations) {
+		TRACE_PLOT("draw allocations", frameAllocations.count);
+		TRACE_PLOT("draw allocation bytes", frameAllocations.bytes);
+		_drawAllocations.count += frameAllocations.count;
+		_drawAllocations.bytes += frameAllocations.bytes;
+		if (frame % 90 != 0) {
+			return;
+		}
+		if (_drawAllocations.count) {
+			char message[128];
+			snprintf(message, sizeof(message), "Render loop made %llu allocations (%llu bytes, the latest %llu) in the last 90 frames\n",
+				(unsigned long long)_drawAllocations.count, (unsigned long long)_drawAllocations.bytes,
+				(unsigned long long)_criticalAllocationSize.load(std::memory_order_relaxed));
+			OutputDebugStringA(message);
+		}
+		_drawAllocations = AllocationSample{ 0, 0 };
+	}
+};
+
+//////////////////////////////////////////////////////////////////////
+//
+// The remainder of this code is specific to the scene we want to 
+// render.  I use oglplus to render an array of cubes, but your 
+// application would perform whatever rendering you want
+//
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// OGLplus is a set of wrapper classes for giving OpenGL a more object
+// oriented interface
+//
+#define OGLPLUS_USE_GLCOREARB_H 0
+#define OGLPLUS_USE_GLEW 1
+#define OGLPLUS_USE_BOOST_CONFIG 0
+#define OGLPLUS_NO_SITE_CONFIG 1
+#define OGLPLUS_LOW_PROFILE 1
+
+#pragma warning( disable : 4068 4244 4267 4065)
+#include <oglplus/config/basic.hpp>
+#include <oglplus/config/gl.hpp>
+#include <oglplus/all.hpp>
+#include <oglplus/interop/glm.hpp>
+#include <oglplus/bound/texture.hpp>
+#include <oglplus/bound/framebuffer.hpp>
+#include <oglplus/bound/renderbuffer.hpp>
+#include <oglplus/bound/buffer.hpp>
+#include <oglplus/shapes/cube.hpp>
+#include <oglplus/shapes/wrapper.hpp>
+#pragma warning( default : 4068 4244 4267 4065)
+
+
+
+namespace Attribute {
+	enum {
+		Position = 0,
+		TexCoord0 = 1,
+		Normal = 2,
+		Color = 3,
+		TexCoord1 = 4,
+		InstanceTransform = 5,
+	};
+}
+
+static const char * VERTEX_SHADER = R"SHADER(
+#version 410 core
+
+uniform mat4 ProjectionMatrix = mat4(1);
+uniform mat4 CameraMatrix = mat4(1);
+
+layout(location = 0) in vec4 Position;
+layout(location = 2) in vec3 Normal;
+layout(location = 5) in mat4 InstanceTransform;
+
+out vec3 vertNormal;
+
+void main(void) {
+   mat4 ViewXfm = CameraMatrix * InstanceTransform;
+   //mat4 ViewXfm = CameraMatrix;
+   vertNormal = Normal;
+   gl_Position = ProjectionMatrix * ViewXfm * Position;
+}
+)SHADER";
+
+static const char * FRAGMENT_SHADER = R"SHADER(
+#version 410 core
+
+in vec3 vertNormal;
+out vec4 fragColor;
+
+void main(void) {
+    vec3 color = vertNormal;
+    if (!all(equal(color, abs(color)))) {
+        color = vec3(1.0) - abs(color);
+    }
+    fragColor = vec4(color, 1.0);
+}
+)SHADER";
+
+// The capacity rounds play at, lower than MOLECULE_GAME_CAPACITY where the GPU calibration found that many too much
+static size_t _moleculeCapacity = MOLECULE_GAME_CAPACITY;
+// The calibration's reckoning of the molecules: vertices of one at full detail, the fraction of them each step of
+// the LOD bias keeps, and the share of the frame budget both eyes' molecules may take
+static const double MOLECULE_CALIBRATION_VERTICES = 2000.0;
+static const double MOLECULE_CALIBRATION_BIAS_KEEPS = 0.6;
+static const float MOLECULE_CALIBRATION_SHARE = 0.15f;
+// Capacities the calibration tries in turn, as fractions of MOLECULE_GAME_CAPACITY. A round needs room for its 10
+// CO2 and the O2 they turn into.
+static const int MOLECULE_CALIBRATION_CAPACITY_COUNT = 3;
+static const float MOLECULE_CALIBRATION_CAPACITIES[MOLECULE_CALIBRATION_CAPACITY_COUNT] = { 1.0f, 0.75f, 0.5f };
+// Levels of detail of the molecule models, and the projected size (diameter over view height) each level
+// above the last is used down to
+static const uint32_t MOLECULE_LOD_LEVELS = 3;
+static const float MOLECULE_LOD_SIZES[MOLECULE_LOD_LEVELS - 1] = { 0.05f, 0.02f };
+// Steps the quality governor may raise the sizes by, each by this factor, see ColorCubeScene::setLodBias
+static const int MOLECULE_LOD_BIAS_LEVELS = 2;
+static const float MOLECULE_LOD_BIAS_STEP = 1.5f;
+static_assert(MOLECULE_LOD_LEVELS == GPU_MOLECULE_LEVELS, "The GPU cull pass sorts into the scene's levels");
+static_assert(MOLECULE_MAX_CONVERSION_POINTS == PARTICLE_MAX_BURSTS, "Every conversion point of a frame is a burst");
+// The scene light, which never changes, baked into the scene's programs as constants (see shader.frag) so the
+// compiler folds what it can of the lighting instead of reading uniforms per fragment
+#define SCENE_LIGHT_POSITION_XYZ 1.0f, 1.0f, 1.0f
+#define SCENE_LIGHT_AMBIENT_XYZ 0.2f, 0.2f, 0.2f
+#define SCENE_LIGHT_DIFFUSE_XYZ 1.0f, 1.0f, 1.0f
+#define SCENE_LIGHT_SPECULAR_XYZ 1.0f, 1.0f, 1.0f
+#define _GLSL_VEC3(...) "vec3(" #__VA_ARGS__ ")"
+#define _GLSL_VEC3_OF(xyz) _GLSL_VEC3(xyz)
+#define SCENE_LIGHT_DEFINE "#define SCENE_LIGHT_POSITION " _GLSL_VEC3_OF(SCENE_LIGHT_POSITION_XYZ) "\n" \
+	"#define SCENE_LIGHT_AMBIENT " _GLSL_VEC3_OF(SCENE_LIGHT_AMBIENT_XYZ) "\n" \
+	"#define SCENE_LIGHT_DIFFUSE " _GLSL_VEC3_OF(SCENE_LIGHT_DIFFUSE_XYZ) "\n" \
+	"#define SCENE_LIGHT_SPECULAR " _GLSL_VEC3_OF(SCENE_LIGHT_SPECULAR_XYZ) "\n"
+// What every program drawing the scene's camera is built with, the eye buffers' colour define included
+#define SCENE_DEFINE (std::string(LATE_LATCH_DEFINE SCENE_LIGHT_DEFINE) + _eyeColorDefine() + _halfPrecisionDefine())
+// Projected size below which a molecule is only its billboard, and how many times that size the billboard starts
+// fading in over the meshes from
+static const float MOLECULE_BILLBOARD_SIZE = 0.008f;
+static const float MOLECULE_BILLBOARD_FADE = 1.5f;
+// Run ColorCubeScene::step on its own thread, see ExampleApp
+static bool _pipelinedSimulation = true;
+// Hand the stress scene's molecules to GpuMoleculeSimulation where the compute extensions are there
+static bool _gpuMolecules = false;
+// With the molecules on the GPU, also drop the ones the factory hides, see HiZPyramid. --no-occlusion turns it off.
+static bool _occlusionCulling = true;
+// Draw the CPU simulated molecules as ray cast atom spheres rather than their meshes, see SphereImpostors. --impostors.
+static bool _moleculeImpostors = false;
+// Draw the CPU simulated molecules' meshes from one MoleculeArena, both types and each level one draw. --molecule-pulling.
+static bool _moleculePulling = false;
+// Draw the far CPU simulated molecules as MoleculeBillboards, --no-billboards keeps them meshes at any distance
+static bool _moleculeBillboards = true;
+// Bounce the CPU simulated molecules off each other as well as the walls, --no-collisions lets them pass through
+static bool _moleculeCollisions = true;
+// Shadows from the scene light, see ShadowMaps. --no-shadows lights everything as before.
+static bool _shadowMaps = true;
+// Light the factory from its import time bake rather than per fragment, see _bakeLighting. --no-light-bake.
+static bool _factoryLightBake = true;
+// Directory of a virtual texture laid over the factory's texture coordinates, see VirtualTexture. --virtual-texture.
+static std::string _factoryVirtualTexture;
+// Draw the batched factory meshlet by meshlet, culled per eye on the GPU, see StaticBatch::cullMeshlets. --no-meshlets.
+static bool _meshletCulling = true;
+// Sparks where molecules convert, see GpuParticles. --no-particles.
+static bool _conversionParticles = true;
+// Color of the sparks, the O2 models' blue brightened
+static const vec4 CONVERSION_PARTICLE_COLOR = vec4(0.35f, 0.6f, 1.0f, 1.0f);
+// Half the side of a new spark in meters
+static const float CONVERSION_PARTICLE_SIZE = 0.012f;
+
+// A round as the command line and the GPU calibration set it up
+static MoleculeGameConfig _moleculeGameConfig(uint32_t seed) {
+	MoleculeGameConfig config;
+	config.capacity = _moleculeCapacity;
+	config.collisions = _moleculeCollisions;
+	config.seed = seed;
+	return config;
+}
+
+// a class for encapsulating building and rendering an RGB cube
+//
+// The game (MoleculeGame) belongs to whichever thread calls step(); the GPU side (models, programs, instance
+// buffers) to the render thread, which only sees the game through SceneFrames.
+struct ColorCubeScene {
+
+	// Program
+	//oglplus::shapes::ShapeWrapper cube;
+	
+
+	shared_ptr<Model> fac1;
+	shared_ptr<Model> co2_tmp;
+	shared_ptr<Model> o2_tmp;
+	// The molecules, the lasers' conversions and the round's outcome, stepped by step()
+	MoleculeGame game;
+	shared_ptr<Shader> sd;
+	shared_ptr<Shader> mol_sd;
+	// STEREO_MULTIVIEW variants, only built when the driver has GL_OVR_multiview2
+	shared_ptr<Shader> sd_multiview;
+	shared_ptr<Shader> mol_sd_multiview;
+	// PACKED_VERTEX variants for the molecules once their packed meshes have loaded
+	shared_ptr<Shader> mol_sd_packed;
+	shared_ptr<Shader> mol_sd_packed_multiview;
+	// The same by lighting model, the Phong ones being the two above, see moleculeShader
+	shared_ptr<Shader> mol_sd_packed_lit[(int)LightingModel::Count];
+	shared_ptr<Shader> mol_sd_packed_lit_multiview[(int)LightingModel::Count];
+	// The factory program with STATIC_BATCH, for when the factory's meshes are merged
+	shared_ptr<Shader> sd_batch;
+	shared_ptr<Shader> sd_batch_multiview;
+	// The same reading the factory's baked lighting, once its batch has it
+	shared_ptr<Shader> sd_baked;
+	shared_ptr<Shader> sd_baked_multiview;
+	// The molecules as atom spheres, see SphereImpostors
+	shared_ptr<Shader> imp_sd;
+	shared_ptr<Shader> imp_sd_multiview;
+	// The far molecules as cards, and the program baking their atlases, see MoleculeBillboards
+	shared_ptr<Shader> billboard_sd;
+	shared_ptr<Shader> billboard_sd_multiview;
+	shared_ptr<Shader> billboard_bake_sd;
+	// Both molecule types' meshes pulled from arena, and the transforms uploadPulledInstances() hands it
+	MoleculeArena arena;
+	shared_ptr<Shader> pull_sd;
+	shared_ptr<Shader> pull_sd_multiview;
+	vector<mat4> pulled_transforms;
+	// Until arena fails to build, or without --molecule-pulling
+	bool pull_molecules{ false };
+	// Depth only from the light's cameras, so no LATE_LATCH: the factory plain and batched, placed meshes and the
+	// molecules through the molecule programs
+	shared_ptr<Shader> shadow_sd;
+	shared_ptr<Shader> shadow_batch_sd;
+	shared_ptr<Shader> shadow_mol_sd;
+	shared_ptr<Shader> shadow_mol_packed_sd;
+	// Where the scene's fixed pieces stand, read by the culling and the draws alike. The molecules keep their own
+	// positions in MoleculeStore, where the simulation and picking work on them.
+	TransformHierarchy scene_graph;
+	uint32_t factory_node{ 0 };
+	// The scene's entities, so far the factory hung off factory_node. Its Renderable's model 0 is fac1.
+	EntityWorld entities;
+	Entity factory_entity = ENTITY_NONE;
+	// The molecules the loss screen fills the room with, placed once with the scene and drawn while a round is lost
+	StaticInstanceBuffer loss_field;
+
+	// One molecule type's instance transforms, culled and split by level of detail. Each level draws from its own buffer.
+	struct LodInstances {
+		// Everything in the last SceneFrame, visible or not
+		vector<mat4> transforms;
+		InstanceBuffer buffers[MOLECULE_LOD_LEVELS];
+		vector<mat4> buckets[MOLECULE_LOD_LEVELS];
+		// Level each instance was drawn at last, by instance index, for the hysteresis in _selectLod
+		vector<uint8_t> levels;
+		// The same buffers drawn as the type's atoms
+		SphereImpostors impostors;
+		// In place of buffers[0] while set, see loss_field
+		GLuint static_buffer{ 0 };
+		GLsizei static_count{ 0 };
+		GLuint levelBuffer(uint32_t l) { return l == 0 && static_buffer ? static_buffer : buffers[l].id(); }
+		GLsizei levelCount(uint32_t l) const { return l == 0 && static_buffer ? static_count : buffers[l].count(); }
+		// The instances small enough for their billboard, those fading in from the last mesh level included
+		InstanceBuffer billboard_buffer;
+		vector<mat4> billboard_bucket;
+		MoleculeBillboards billboards;
+		// Every instance, culled or not, for the dynamic shadow map
+		InstanceBuffer shadow_buffer;
+	};
+
+	// Per-type instance transforms, taken from each SceneFrame
+	LodInstances co2_instances;
+	LodInstances o2_instances;
+	// Instances sharing one transform, follows StereoView::eyeCount
+	GLuint instance_divisor{ 1 };
+	// Render thread benchmark settings: the level every molecule is drawn at (-1 picks by size), and whether
+	// the molecules are instanced or drawn one call each
+	int forced_lod{ -1 };
+	bool instancing{ true };
+	// Render thread: the quality governor's steps of the LOD sizes, the fewest it may go to (the GPU calibration's
+	// preset), and the sizes the molecules are levelled by
+	int lod_bias_level{ 0 };
+	int lod_bias_floor{ 0 };
+	float lod_sizes[MOLECULE_LOD_LEVELS - 1] = { MOLECULE_LOD_SIZES[0], MOLECULE_LOD_SIZES[1] };
+	// Where bucketInstances() measured the sizes from this view, and the focal length, for the crossfade in the shaders
+	vec3 lod_eye;
+	float lod_focal{ 1.0f };
+	// Render thread: lay the factory and molecules down depth only, then shade only what won, see RiftApp::depthPrepass
+	bool depth_prepass{ false };
+	// Render thread: half the eye target's height in pixels, what the textures' on screen sizes are measured in
+	float target_half_height{ 720.0f };
+	// Render thread: the factory's virtual texture pages, and the left eye's camera of the last view rendered, which
+	// the next feedback pass draws from
+	VirtualTextureCache virtual_textures;
+	shared_ptr<Shader> virtual_texture_feedback_sd;
+	mat4 virtual_texture_view;
+	mat4 virtual_texture_projection;
+	uint64_t virtual_texture_frame{ 0 };
+	// Render thread: the factory is shaded into the environment layer, render() only lays its depth, see
+	// RiftApp::environmentOwnLayer
+	bool environment_layered{ false };
+	// Render thread: the stress scene's molecules while the GPU simulates them, and the last step it ran
+	GpuMoleculeSimulation gpu_molecules;
+	// Sparks where molecules convert, and the programs drawing them
+	GpuParticles particles;
+	shared_ptr<Shader> particle_sd;
+	shared_ptr<Shader> particle_sd_multiview;
+	// The controllers' lasers, and the programs drawing them
+	LaserBeams beams;
+	shared_ptr<Shader> beam_sd;
+	shared_ptr<Shader> beam_sd_multiview;
+	// _gpuBuckets' buckets of the scene's draws. A molecule type's cards and impostors count as the type, the GPU
+	// simulation's culling and the pyramid it culls against as molecule_cull.
+	int bucket_factory{ -1 };
+	int bucket_molecules[(int)MoleculeType::Count] = { -1, -1 };
+	int bucket_molecule_cull{ -1 };
+	int bucket_particles{ -1 };
+	int bucket_lasers{ -1 };
+	int bucket_world{ -1 };
+	uint64_t gpu_steps_seen{ 0 };
+	// The factory's depth, built each view before the GPU culls the molecules against it
+	HiZPyramid hi_z;
+	// The factory's indicator lights on top of the one scene light, sorted into clusters every view
+	ClusteredLights cluster_lights;
+	// Where the one scene light is, and its shadows: the factory's map cached, the molecules' redrawn every frame
+	const vec3 light_position{ SCENE_LIGHT_POSITION_XYZ };
+	// Where factory_node stands, also what the factory's bake takes the light into its space with
+	const vec3 factory_position{ 0.0f, -0.8f, -2.0f };
+	const float factory_scale{ 0.05f };
+	ShadowMaps shadows;
+	// The facility beyond the factory, streamed in cells when --world names one
+	WorldPartition world;
+
+	// Box the molecules bounce around in, in front of the factory
+	const MoleculeBounds bounds{ MOLECULE_GAME_BOUNDS };
+	const float molecule_scale{ MOLECULE_SCALE };
+
+	// VBOs for the cube's vertices and normals
+
+	const unsigned int GRID_SIZE{ 5 };
+
+public:
+
+	// Models and the program come from the registry, so building a scene never touches the disk or the shader compiler twice
+	ColorCubeScene(ResourceRegistry & resources, uint32_t seed) : game(_moleculeGameConfig(seed), _jobs) {
+		bucket_factory = _gpuBuckets.addBucket("factory");
+		bucket_molecules[(int)MoleculeType::CO2] = _gpuBuckets.addBucket("molecules_co2");
+		bucket_molecules[(int)MoleculeType::O2] = _gpuBuckets.addBucket("molecules_o2");
+		bucket_molecule_cull = _gpuBuckets.addBucket("molecule_cull");
+		bucket_particles = _gpuBuckets.addBucket("particles");
+		bucket_lasers = _gpuBuckets.addBucket("lasers");
+		// Every variant is handed to the driver before the first is collected below. The factory's unbatched program
+		// samples its virtual texture, if it has one.
+		const std::string factory_defines = _factoryVirtualTexture.empty() ? SCENE_DEFINE : SCENE_DEFINE + VIRTUAL_TEXTURE_DEFINE;
+		resources.prepareShader("./shader.vert", "./shader.frag", factory_defines);
+		resources.prepareShader("./molecule.vert", "./shader.frag", SCENE_DEFINE);
+		const std::string packed_defines = SCENE_DEFINE + BILLBOARD_FADE_DEFINE "#define PACKED_VERTEX\n";
+		for (int m = 0; m < (int)LightingModel::Count; m++)
+			resources.prepareShader("./molecule.vert", "./shader.frag", packed_defines + LIGHTING_MODEL_DEFINES[m]);
+		resources.prepareShader("./impostor.vert", "./shader.frag", SCENE_DEFINE + SPHERE_IMPOSTOR_DEFINE);
+		resources.prepareShader("./billboard.vert", "./shader.frag", SCENE_DEFINE + MOLECULE_BILLBOARD_DEFINE);
+		resources.prepareShader("./molecule.vert", "./shader.frag", BILLBOARD_BAKE_DEFINE);
+		resources.prepareShader("./shader.vert", "./shader.frag", SCENE_DEFINE + STATIC_BATCH_DEFINE);
+		if (_factoryLightBake)
+			resources.prepareShader("./shader.vert", "./shader.frag", SCENE_DEFINE + STATIC_BATCH_DEFINE LIGHT_BAKE_DEFINE);
+		pull_molecules = _moleculePulling && MoleculeArena::supported();
+		const std::string pull_defines = SCENE_DEFINE + BILLBOARD_FADE_DEFINE STATIC_BATCH_DEFINE MOLECULE_ARENA_DEFINE;
+		if (pull_molecules)
+			resources.prepareShader("./moleculepull.vert", "./shader.frag", pull_defines);
+		if (_shadowMaps)
+		{
+			resources.prepareShader("./shader.vert", "./shader.frag");
+			resources.prepareShader("./shader.vert", "./shader.frag", STATIC_BATCH_DEFINE);
+			resources.prepareShader("./molecule.vert", "./shader.frag");
+			resources.prepareShader("./molecule.vert", "./shader.frag", "#define PACKED_VERTEX\n");
+		}
+		if (GLEW_OVR_multiview2)
+		{
+			resources.prepareShader("./shader.vert", "./shader.frag", factory_defines + "#define STEREO_MULTIVIEW\n");
+			resources.prepareShader("./molecule.vert", "./shader.frag", SCENE_DEFINE + "#define STEREO_MULTIVIEW\n");
+			for (int m = 0; m < (int)LightingModel::Count; m++)
+				resources.prepareShader("./molecule.vert", "./shader.frag", packed_defines + LIGHTING_MODEL_DEFINES[m] + "#define STEREO_MULTIVIEW\n");
+			resources.prepareShader("./impostor.vert", "./shader.frag", SCENE_DEFINE + SPHERE_IMPOSTOR_DEFINE "#define STEREO_MULTIVIEW\n");
+			resources.prepareShader("./billboard.vert", "./shader.frag", SCENE_DEFINE + MOLECULE_BILLBOARD_DEFINE "#define STEREO_MULTIVIEW\n");
+			resources.prepareShader("./shader.vert", "./shader.frag", SCENE_DEFINE + STATIC_BATCH_DEFINE "#define STEREO_MULTIVIEW\n");
+			if (_factoryLightBake)
+				resources.prepareShader("./shader.vert", "./shader.frag", SCENE_DEFINE + STATIC_BATCH_DEFINE LIGHT_BAKE_DEFINE "#define STEREO_MULTIVIEW\n");
+			if (pull_molecules)
+				resources.prepareShader("./moleculepull.vert", "./shader.frag", pull_defines + "#define STEREO_MULTIVIEW\n");
+		}
+		sd = resources.shader("./shader.vert", "./shader.frag", factory_defines);
+		mol_sd = resources.shader("./molecule.vert", "./shader.frag", SCENE_DEFINE);
+		sd->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+		mol_sd->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+		for (int m = 0; m < (int)LightingModel::Count; m++) {
+			mol_sd_packed_lit[m] = resources.shader("./molecule.vert", "./shader.frag", packed_defines + LIGHTING_MODEL_DEFINES[m]);
+			mol_sd_packed_lit[m]->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+		}
+		mol_sd_packed = mol_sd_packed_lit[(int)LightingModel::Phong];
+		_checkVertexInputs<Vertex>(sd->Program, "shader.vert");
+		_checkVertexInputs<Vertex>(mol_sd->Program, "molecule.vert");
+		_checkVertexInputs<PackedVertex>(mol_sd_packed->Program, "molecule.vert PACKED_VERTEX");
+		if (GLEW_OVR_multiview2)
+		{
+			sd_multiview = resources.shader("./shader.vert", "./shader.frag", factory_defines + "#define STEREO_MULTIVIEW\n");
+			mol_sd_multiview = resources.shader("./molecule.vert", "./shader.frag", SCENE_DEFINE + "#define STEREO_MULTIVIEW\n");
+			sd_multiview->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+			mol_sd_multiview->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+			for (int m = 0; m < (int)LightingModel::Count; m++) {
+				mol_sd_packed_lit_multiview[m] = resources.shader("./molecule.vert", "./shader.frag", packed_defines + LIGHTING_MODEL_DEFINES[m]
+					+ "#define STEREO_MULTIVIEW\n");
+				mol_sd_packed_lit_multiview[m]->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+			}
+			mol_sd_packed_multiview = mol_sd_packed_lit_multiview[(int)LightingModel::Phong];
+		}
+		imp_sd = resources.shader("./impostor.vert", "./shader.frag", SCENE_DEFINE + SPHERE_IMPOSTOR_DEFINE);
+		imp_sd->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+		if (GLEW_OVR_multiview2)
+		{
+			imp_sd_multiview = resources.shader("./impostor.vert", "./shader.frag", SCENE_DEFINE + SPHERE_IMPOSTOR_DEFINE "#define STEREO_MULTIVIEW\n");
+			imp_sd_multiview->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+		}
+		billboard_sd = resources.shader("./billboard.vert", "./shader.frag", SCENE_DEFINE + MOLECULE_BILLBOARD_DEFINE);
+		billboard_sd->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+		if (GLEW_OVR_multiview2)
+		{
+			billboard_sd_multiview = resources.shader("./billboard.vert", "./shader.frag", SCENE_DEFINE + MOLECULE_BILLBOARD_DEFINE "#define STEREO_MULTIVIEW\n");
+			billboard_sd_multiview->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+		}
+		// Cameras of its own, so no LATE_LATCH
+		billboard_bake_sd = resources.shader("./molecule.vert", "./shader.frag", BILLBOARD_BAKE_DEFINE);
+		sd_batch = resources.shader("./shader.vert", "./shader.frag", SCENE_DEFINE + STATIC_BATCH_DEFINE);
+		sd_batch->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+		sd_batch->bindUniformBlock("StaticBatchMaterials", STATIC_BATCH_BINDING);
+		if (GLEW_OVR_multiview2)
+		{
+			sd_batch_multiview = resources.shader("./shader.vert", "./shader.frag", SCENE_DEFINE + STATIC_BATCH_DEFINE "#define STEREO_MULTIVIEW\n");
+			sd_batch_multiview->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+			sd_batch_multiview->bindUniformBlock("StaticBatchMaterials", STATIC_BATCH_BINDING);
+		}
+		if (_factoryLightBake)
+		{
+			sd_baked = resources.shader("./shader.vert", "./shader.frag", SCENE_DEFINE + STATIC_BATCH_DEFINE LIGHT_BAKE_DEFINE);
+			sd_baked->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+			sd_baked->bindUniformBlock("StaticBatchMaterials", STATIC_BATCH_BINDING);
+			if (GLEW_OVR_multiview2)
+			{
+				sd_baked_multiview = resources.shader("./shader.vert", "./shader.frag", SCENE_DEFINE + STATIC_BATCH_DEFINE LIGHT_BAKE_DEFINE
+					"#define STEREO_MULTIVIEW\n");
+				sd_baked_multiview->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+				sd_baked_multiview->bindUniformBlock("StaticBatchMaterials", STATIC_BATCH_BINDING);
+			}
+		}
+		// Every level lights as Phong, the one program draws them all
+		if (pull_molecules)
+		{
+			pull_sd = resources.shader("./moleculepull.vert", "./shader.frag", pull_defines);
+			pull_sd->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+			pull_sd->bindUniformBlock("StaticBatchMaterials", STATIC_BATCH_BINDING);
+			if (GLEW_OVR_multiview2)
+			{
+				pull_sd_multiview = resources.shader("./moleculepull.vert", "./shader.frag", pull_defines + "#define STEREO_MULTIVIEW\n");
+				pull_sd_multiview->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+				pull_sd_multiview->bindUniformBlock("StaticBatchMaterials", STATIC_BATCH_BINDING);
+			}
+		}
+		if (_shadowMaps)
+		{
+			shadow_sd = resources.shader("./shader.vert", "./shader.frag");
+			shadow_batch_sd = resources.shader("./shader.vert", "./shader.frag", STATIC_BATCH_DEFINE);
+			shadow_batch_sd->bindUniformBlock("StaticBatchMaterials", STATIC_BATCH_BINDING);
+			shadow_mol_sd = resources.shader("./molecule.vert", "./shader.frag");
+			shadow_mol_packed_sd = resources.shader("./molecule.vert", "./shader.frag", "#define PACKED_VERTEX\n");
+		}
+		// Streamed in, until they arrive the factory and molecules are drawn as boxes of about their size
+		// The factory's repeated pipes, bolts and tanks are one mesh each, drawn instanced wherever they appear
+		// Neither it nor the light moves, so its lighting is baked with the light in its space
+		LightBakeOptions factory_bake;
+		factory_bake.enabled = _factoryLightBake;
+		factory_bake.light = (light_position - factory_position) / factory_scale;
+		fac1 = resources.model(_factoryModelPath, "CO2", 4.0f, VertexFormat::Full, 1, _factoryRepeats, factory_bake);
+		// The facility around it, in its space, is never all resident: cells come and go with the head
+		if (!_worldManifest.empty() && world.open(_worldManifest)) {
+			world.setBudget((size_t)_worldBudgetMb * 1024 * 1024);
+			bucket_world = _gpuBuckets.addBucket("world");
+		}
+		// Drawn many times over, so the molecules keep half size vertices on the GPU
+		co2_tmp = resources.model("./co2.obj", "CO2", 0.5f, VertexFormat::Packed, MOLECULE_LOD_LEVELS);
+		o2_tmp = resources.model("./o2.obj", "O2", 0.5f, VertexFormat::Packed, MOLECULE_LOD_LEVELS);
+
+		// Each level of each molecule type draws all of its instances from its own buffer
+		co2_instances.impostors.init(_moleculeAtoms[(int)MoleculeType::CO2]);
+		o2_instances.impostors.init(_moleculeAtoms[(int)MoleculeType::O2]);
+		attachInstances(*co2_tmp, co2_instances);
+		attachInstances(*o2_tmp, o2_instances);
+
+		buildLossField(seed);
+		factory_node = scene_graph.add(TRANSFORM_ROOT, factory_position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), vec3(factory_scale));
+		scene_graph.update();
+		factory_entity = entities.create(COMPONENT_TRANSFORM | COMPONENT_RENDERABLE | COMPONENT_SCENE_NODE);
+		entities.get<SceneNodeComponent>(factory_entity)->node = factory_node;
+		_placeSceneNodes(entities, _jobs, scene_graph);
+
+		Shader * lit[] = { sd.get(), mol_sd.get(), sd_batch.get(), sd_multiview.get(), mol_sd_multiview.get(),
+			sd_batch_multiview.get(), imp_sd.get(), imp_sd_multiview.get(),
+			billboard_sd.get(), billboard_sd_multiview.get(), sd_baked.get(), sd_baked_multiview.get() };
+		for (Shader * program : lit) {
+			if (program)
+				program->bindUniformBlock("ClusterLights", CLUSTER_LIGHTS_BINDING);
+		}
+		for (int m = 0; m < (int)LightingModel::Count; m++) {
+			mol_sd_packed_lit[m]->bindUniformBlock("ClusterLights", CLUSTER_LIGHTS_BINDING);
+			if (mol_sd_packed_lit_multiview[m])
+				mol_sd_packed_lit_multiview[m]->bindUniformBlock("ClusterLights", CLUSTER_LIGHTS_BINDING);
+		}
+		cluster_lights.init();
+		cluster_lights.setLights(indicatorLights());
+		if (_shadowMaps)
+		{
+			shadows.init(_reversedDepth);
+		}
+		if (!_factoryVirtualTexture.empty() && virtual_textures.init(_reversedDepth))
+		{
+			// Its own camera, so no LATE_LATCH
+			virtual_texture_feedback_sd = resources.shader("./shader.vert", "./shader.frag", VIRTUAL_TEXTURE_DEFINE VIRTUAL_TEXTURE_FEEDBACK_DEFINE);
+			fac1->setVirtualTexture(virtual_textures.open(_factoryVirtualTexture));
+		}
+
+		if (_conversionParticles && GpuParticles::supported() && particles.init())
+		{
+			particle_sd = resources.shader("./particle.vert", "./shader.frag", SCENE_DEFINE + PARTICLE_DEFINE);
+			particle_sd->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+			particles.attach(*particle_sd);
+			if (GLEW_OVR_multiview2)
+			{
+				particle_sd_multiview = resources.shader("./particle.vert", "./shader.frag", SCENE_DEFINE + PARTICLE_DEFINE "#define STEREO_MULTIVIEW\n");
+				particle_sd_multiview->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+				particles.attach(*particle_sd_multiview);
+			}
+		}
+		beams.init();
+		beam_sd = resources.shader("./beam.vert", "./shader.frag", SCENE_DEFINE + LASER_BEAM_DEFINE);
+		beam_sd->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+		if (GLEW_OVR_multiview2)
+		{
+			beam_sd_multiview = resources.shader("./beam.vert", "./shader.frag", SCENE_DEFINE + LASER_BEAM_DEFINE "#define STEREO_MULTIVIEW\n");
+			beam_sd_multiview->bindUniformBlock("LateLatch", LATE_LATCH_BINDING);
+		}
+		if (_gpuMolecules && (!GpuMoleculeSimulation::supported() || !gpu_molecules.init()))
+		{
+			printf("GPU molecules need GL_ARB_compute_shader and GL_ARB_shader_storage_buffer_object, simulating on the CPU\r\n");
+		}
+		if (gpu_molecules.initialized() && _occlusionCulling)
+		{
+			hi_z.init();
+		}
+	}
+
+	// Two rows of status lamps along the front of the factory, green, amber and red in turn
+	vector<ClusterLight> indicatorLights() const {
+		const vec4 colors[3] = { vec4(0.2f, 1.0f, 0.3f, 0.8f), vec4(1.0f, 0.6f, 0.1f, 0.8f), vec4(1.0f, 0.15f, 0.1f, 0.8f) };
+		vector<ClusterLight> lights;
+		for (int row = 0; row < 2; row++) {
+			for (int i = 0; i < 16; i++) {
+				ClusterLight light;
+				light.positionRange = vec4(-1.6f + i * (3.2f / 15.0f), -0.75f + row * 0.55f, -2.6f, 0.6f);
+				light.color = colors[(i + row) % 3];
+				lights.push_back(light);
+			}
+		}
+		return lights;
+	}
+
+	// Render thread, once: the loss screen's molecules are the same every round, uploaded where they stay. Its own
+	// stream of seed, the game's belongs to the simulation thread.
+	void buildLossField(uint32_t seed) {
+		Random random(seed, RANDOM_STREAM_LOSS_FIELD);
+		vector<mat4> los_pos;
+		for (int i = 0; i < 100; i++)
+		{
+			vec3 relativePosition = random.uniform(vec3(-0.7f, -1.0f, -2.4f), vec3(0.7f, 0.0f, -0.4f));
+			float r = random.uniform(0.0f, 10.0f);
+			vec3 axis = random.uniform(vec3(0.0f), vec3(1.0f));
+			los_pos.push_back(glm::scale(glm::rotate(glm::translate(glm::mat4(1.0f), relativePosition), r, axis),
+				glm::vec3(molecule_scale)));
+		}
+		loss_field.init(los_pos);
+	}
+
+	// One frame of the game, see MoleculeGame::step. Touches no GL state, so it can run on any one thread.
+	void step(const SceneInput & input, SceneFrame & frame) {
+		game.step(input, frame);
+	}
+
+	// Render thread: takes the transforms of a finished frame, render() culls and uploads them for each view
+	void upload(const SceneFrame & frame) {
+		co2_instances.transforms = frame.co2Transforms;
+		o2_instances.transforms = frame.o2Transforms;
+		if (scene_graph.update())
+			_placeSceneNodes(entities, _jobs, scene_graph);
+		publishShapes();
+		aimBeams(frame);
+		bakeBillboards(*co2_tmp, co2_instances);
+		bakeBillboards(*o2_tmp, o2_instances);
+		buildArena();
+		renderShadows();
+		renderVirtualTextureFeedback();
+		// One instanced draw of the CO2 model's level 0 with the whole field, no culling or levels for 100 molecules
+		const GLuint field = frame.lost ? loss_field.id() : 0;
+		if (co2_instances.static_buffer != field) {
+			co2_instances.static_buffer = field;
+			co2_instances.static_count = frame.lost ? loss_field.count() : 0;
+			attachInstances(*co2_tmp, co2_instances);
+		}
+		if (!frame.gpuMolecules) {
+			gpu_molecules.unload();
+			return;
+		}
+		MoleculeStore handoff;
+		if (game.takeGpuMolecules(&handoff)) {
+			gpu_molecules.load(handoff);
+			gpu_steps_seen = frame.steps;
+		}
+		// Steps of frames the render thread never saw are caught up, as far as the CPU would after a stall
+		const int steps = (int)std::min(frame.steps - gpu_steps_seen, (uint64_t)MOLECULE_MAX_STEPS);
+		gpu_steps_seen = frame.steps;
+		const PickRay rays[2] = { frame.leftRay, frame.rightRay };
+		gpu_molecules.simulate(steps, bounds, rays, frame.picking, 0.06f);
+	}
+
+	// Each laser stops where its ray first hits the factory, once the factory's triangle trees have loaded
+	void aimBeams(const SceneFrame & frame) {
+		const shared_ptr<const ModelShape> factory = fac1->shape();
+		const mat4 & world = entities.get<TransformComponent>(factory_entity)->world;
+		const PickRay rays[2] = { frame.leftRay, frame.rightRay };
+		for (int hand = 0; hand < 2; hand++) {
+			float reach = LASER_BEAM_MAX_LENGTH;
+			if (factory)
+				factory->raycast(rays[hand], world, reach, &reach);
+			beams.aim(hand, reach, hand == 0 ? laserColorLeft : laserColorRight);
+		}
+	}
+
+	// Hands the game the triangle trees of the models loaded so far for its lasers, and where the factory stands
+	void publishShapes() {
+		shared_ptr<const ModelShape> co2 = co2_tmp->shape();
+		shared_ptr<const ModelShape> factory = fac1->shape();
+		game.setShapes(co2, factory, entities.get<TransformComponent>(factory_entity)->world);
+	}
+
+	// Once the model has loaded, here because it is outside the eye passes. The bake draws level 0 from a buffer of
+	// its own, the instances' are put back after.
+	void bakeBillboards(Model & model, LodInstances & instances) {
+		if (!_moleculeBillboards || instances.billboards.baked() || !model.packed()) {
+			return;
+		}
+		instances.billboards.bake(model, *billboard_bake_sd, _reversedDepth);
+		attachInstances(model, instances);
+	}
+
+	// Once both packed models have loaded. A failed build leaves the molecules to their own models' draws.
+	void buildArena() {
+		if (!pull_molecules || arena.built() || !co2_tmp->packed() || !o2_tmp->packed()) {
+			return;
+		}
+		Model * models[(int)MoleculeType::Count] = { co2_tmp.get(), o2_tmp.get() };
+		pull_molecules = arena.build(models);
+	}
+
+	// Render thread, once a frame outside the eye passes: the factory drawn from the last view into the feedback
+	// target, then the pages earlier feedback asked for are loaded and uploaded
+	void renderVirtualTextureFeedback() {
+		if (!virtual_texture_feedback_sd || !fac1->virtualTextured()) {
+			return;
+		}
+		if (virtual_textures.beginFeedback()) {
+			Shader & feedback_sd = *virtual_texture_feedback_sd;
+			feedback_sd.Use();
+			feedback_sd.set("view", &virtual_texture_view, 1);
+			feedback_sd.set("projection", &virtual_texture_projection, 1);
+			feedback_sd.set("eyeCount", (GLint)1);
+			feedback_sd.set("virtualFeedbackScale", target_half_height * 2.0f / VIRTUAL_TEXTURE_FEEDBACK_SIZE);
+			const mat4 & mod = entities.get<TransformComponent>(factory_entity)->world;
+			feedback_sd.set("model", mod);
+			const mat4 view_projection = virtual_texture_projection * virtual_texture_view;
+			fac1->cull(_stereoFrustum(view_projection, view_projection, _reversedDepth), mod);
+			fac1->DrawInstanced(feedback_sd, 1);
+			virtual_textures.endFeedback();
+		}
+		virtual_textures.update(++virtual_texture_frame);
+	}
+
+	// Render thread, once a frame outside the eye passes: the factory's map when it is due, the molecules' always.
+	// The factory is left culled for the light, render() culls it again for the eyes.
+	void renderShadows() {
+		if (!shadows.initialized()) {
+			return;
+		}
+		const mat4 & mod = entities.get<TransformComponent>(factory_entity)->world;
+		shadows.aim(ShadowMap::Static, light_position, vec3(mod[3]), fac1->boundingRadius() * glm::length(vec3(mod[0])));
+		// The proxy, the loaded model and its batch each cast differently
+		const uint32_t revision = (fac1->isProxy() ? 0u : 1u) | (fac1->batched() ? 2u : 0u);
+		if (shadows.staticDue(revision)) {
+			const mat4 light_view_projection = shadows.projection(ShadowMap::Static) * shadows.view(ShadowMap::Static);
+			fac1->cull(_stereoFrustum(light_view_projection, light_view_projection, _reversedDepth), mod);
+			shadows.begin(ShadowMap::Static);
+			if (fac1->placed() && !fac1->batched()) {
+				Shader & placed_sd = fac1->packed() ? *shadow_mol_packed_sd : *shadow_mol_sd;
+				placed_sd.Use();
+				setShadowCamera(placed_sd, ShadowMap::Static);
+				fac1->DrawPlaced(placed_sd, mod, 1);
+			}
+			else {
+				Shader & caster = fac1->batched() ? *shadow_batch_sd : *shadow_sd;
+				caster.Use();
+				setShadowCamera(caster, ShadowMap::Static);
+				caster.set("model", mod);
+				if (fac1->batched())
+					fac1->DrawBatched(caster, 1);
+				else
+					fac1->DrawInstanced(caster, 1);
+			}
+			shadows.end(ShadowMap::Static, revision);
+		}
+
+		/* the box the molecules bounce around in, widened by a molecule. The GPU simulation's molecules are only
+		   drawn through its eye culled commands, they cast nothing. */
+		const float molecule_radius = std::max(co2_tmp->boundingRadius(), o2_tmp->boundingRadius()) * molecule_scale;
+		shadows.aim(ShadowMap::Dynamic, light_position, (bounds.min + bounds.max) * 0.5f,
+			glm::length(bounds.max - bounds.min) * 0.5f + molecule_radius);
+		shadows.begin(ShadowMap::Dynamic);
+		if (!gpu_molecules.loaded()) {
+			drawMoleculeCasters(*co2_tmp, co2_instances);
+			drawMoleculeCasters(*o2_tmp, o2_instances);
+		}
+		shadows.end(ShadowMap::Dynamic);
+	}
+
+	// Every instance, in view or not, at the model's coarsest level from a buffer of its own. The level's own buffer
+	// is attached again after.
+	void drawMoleculeCasters(Model & model, LodInstances & instances) {
+		instances.shadow_buffer.update(instances.transforms);
+		if (!instances.shadow_buffer.count()) {
+			return;
+		}
+		const uint32_t level = model.lodCount() - 1;
+		Shader & caster = model.packed() ? *shadow_mol_packed_sd : *shadow_mol_sd;
+		caster.Use();
+		setShadowCamera(caster, ShadowMap::Dynamic);
+		model.attachInstanceBuffer(instances.shadow_buffer.id(), 1, level);
+		model.DrawInstanced(caster, instances.shadow_buffer.count(), level);
+		model.attachInstanceBuffer(instances.levelBuffer(level), instance_divisor, level);
+	}
+
+	// The light's camera for the map in both eye slots of a caster program, drawn as one eye
+	void setShadowCamera(Shader & shader, ShadowMap which) {
+		const mat4 views[2] = { shadows.view(which), shadows.view(which) };
+		const mat4 projections[2] = { shadows.projection(which), shadows.projection(which) };
+		shader.set("view", views, 2);
+		shader.set("projection", projections, 2);
+		shader.set("eyeCount", (GLint)1);
+		shader.set("depthOnly", (GLint)1);
+	}
+
+	// Bounding spheres for _cullSpheres and the eye masks it returns, gone with the frame. Taken from the frame arena
+	// on the render thread, so bucketInstances() can run on any.
+	struct CullScratch {
+		float * x, * y, * z, * radius;
+		uint8_t * masks;
+	};
+
+	static CullScratch allocateCullScratch(size_t count) {
+		CullScratch scratch;
+		scratch.x = _frameArena.allocate<float>(count);
+		scratch.y = _frameArena.allocate<float>(count);
+		scratch.z = _frameArena.allocate<float>(count);
+		scratch.radius = _frameArena.allocate<float>(count);
+		scratch.masks = _frameArena.allocate<uint8_t>(count);
+		return scratch;
+	}
+
+	// Render thread: level by MOLECULE_LOD_SIZES times MOLECULE_LOD_BIAS_STEP per level, so molecules drop to their
+	// coarser levels while still larger on screen
+	void setLodBias(int level) {
+		lod_bias_level = glm::clamp(level, lod_bias_floor, MOLECULE_LOD_BIAS_LEVELS);
+		const float bias = powf(MOLECULE_LOD_BIAS_STEP, (float)lod_bias_level);
+		for (uint32_t l = 0; l < MOLECULE_LOD_LEVELS - 1; l++) {
+			lod_sizes[l] = MOLECULE_LOD_SIZES[l] * bias;
+		}
+	}
+
+	// Drops the instances neither eye sees and buckets the rest by the level their projected size picks, all into
+	// level 0 while the model is the proxy. eye is where sizes are measured from, focal the projection's y scale.
+	// Once the billboards are baked the smallest go to their bucket instead, those in the crossfade to both.
+	// Touches no GL, returns how many were culled.
+	uint32_t bucketInstances(const Model & model, LodInstances & instances, const CullScratch & scratch, const StereoFrustum & frustum,
+		const vec3 & eye, float focal) {
+		const vector<mat4> & transforms = instances.transforms;
+		const size_t count = transforms.size();
+		const uint32_t levels = model.lodCount();
+		for (uint32_t l = 0; l < MOLECULE_LOD_LEVELS; l++) {
+			instances.buckets[l].clear();
+		}
+		instances.billboard_bucket.clear();
+		const bool billboards = billboardsDrawn(instances);
+		instances.levels.resize(count, 0);
+		float * x = scratch.x;
+		float * y = scratch.y;
+		float * z = scratch.z;
+		float * radius = scratch.radius;
+		uint8_t * masks = scratch.masks;
+		for (size_t i = 0; i < count; i++) {
+			const mat4 & transform = transforms[i];
+			x[i] = transform[3].x;
+			y[i] = transform[3].y;
+			z[i] = transform[3].z;
+			radius[i] = model.boundingRadius() * glm::length(vec3(transform[0].x, transform[0].y, transform[0].z));
+		}
+		_cullSpheres(x, y, z, radius, count, frustum, masks);
+		uint32_t culled = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (!masks[i]) {
+				culled++;
+				continue;
+			}
+			const vec3 position = vec3(x[i], y[i], z[i]);
+			const float distance = std::max(glm::length(position - eye), 0.01f);
+			const float size = radius[i] * focal / distance;
+			const uint8_t level = forced_lod >= 0 ? (uint8_t)std::min((uint32_t)forced_lod, levels - 1)
+				: _selectLod(size, instances.levels[i], lod_sizes, levels);
+			instances.levels[i] = level;
+			if (billboards && size < MOLECULE_BILLBOARD_SIZE * MOLECULE_BILLBOARD_FADE)
+				instances.billboard_bucket.push_back(transforms[i]);
+			if (!billboards || size >= MOLECULE_BILLBOARD_SIZE)
+				instances.buckets[level].push_back(transforms[i]);
+		}
+		return culled;
+	}
+
+	// Render thread, once bucketInstances() is through
+	void uploadInstances(LodInstances & instances) {
+		for (uint32_t l = 0; l < MOLECULE_LOD_LEVELS; l++) {
+			instances.buffers[l].update(instances.buckets[l]);
+		}
+		instances.billboard_buffer.update(instances.billboard_bucket);
+	}
+
+	// Both types' buckets into arena, level by level, each transform tagged with its type's mesh at that level.
+	// The billboards upload as uploadInstances() has them.
+	void uploadPulledInstances() {
+		LodInstances * types[(int)MoleculeType::Count] = { &co2_instances, &o2_instances };
+		GLsizei level_counts[MOLECULE_ARENA_LEVELS] = {};
+		pulled_transforms.clear();
+		for (uint32_t l = 0; l < MOLECULE_ARENA_LEVELS; l++) {
+			for (int type = 0; type < (int)MoleculeType::Count; type++) {
+				const uint32_t mesh = MoleculeArena::mesh((MoleculeType)type, l);
+				for (const mat4 & transform : types[type]->buckets[l]) {
+					pulled_transforms.push_back(transform);
+					MoleculeArena::tag(pulled_transforms.back(), mesh);
+				}
+				level_counts[l] += (GLsizei)types[type]->buckets[l].size();
+			}
+		}
+		arena.update(pulled_transforms, level_counts);
+		co2_instances.billboard_buffer.update(co2_instances.billboard_bucket);
+		o2_instances.billboard_buffer.update(o2_instances.billboard_bucket);
+	}
+
+	// The CPU simulated molecules' meshes go through arena once both packed models are in it, unless they are drawn
+	// as atoms, one call each for the benchmarks, or from the loss field's static buffer
+	bool pullingMolecules() const {
+		return arena.built() && !_moleculeImpostors && instancing && !co2_instances.static_buffer && !o2_instances.static_buffer;
+	}
+
+	// The atom spheres and benchmarks forcing a mesh level keep every molecule a mesh
+	bool billboardsDrawn(const LodInstances & instances) const {
+		return instances.billboards.baked() && !_moleculeImpostors && forced_lod < 0 && instancing;
+	}
+
+	void attachInstances(Model & model, LodInstances & instances) {
+		for (uint32_t l = 0; l < MOLECULE_LOD_LEVELS; l++) {
+			model.attachInstanceBuffer(instances.levelBuffer(l), instance_divisor, l);
+			instances.impostors.attach(l, instances.levelBuffer(l), instance_divisor);
+		}
+		instances.billboards.attach(instances.billboard_buffer.id(), instance_divisor);
+	}
+
+	// programFor(level) gives the program each level with instances draws with, see moleculeShader
+	template <typename ProgramFor>
+	void drawInstances(Model & model, LodInstances & instances, const StereoView & stereo, ProgramFor programFor) {
+		for (uint32_t l = 0; l < model.lodCount(); l++) {
+			if (!instances.levelCount(l))
+				continue;
+			Shader & shader = programFor(l);
+			if (instancing)
+				model.DrawInstanced(shader, instances.levelCount(l) * stereo.eyeCount, l);
+			else
+				model.DrawSeparately(shader, instances.levelCount(l), stereo.eyeCount, l);
+		}
+	}
+
+	// Only reads the game state, so it can be called once per eye or once for both
+	void render(const StereoView & stereo) {
+		Shader & factory_sd = factoryShader(stereo);
+		if (instance_divisor != (GLuint)stereo.eyeCount)
+		{
+			instance_divisor = (GLuint)stereo.eyeCount;
+			attachInstances(*co2_tmp, co2_instances);
+			attachInstances(*o2_tmp, o2_instances);
+		}
+
+		/* everything is culled against both eyes, a mono pass has the same camera in both */
+		const StereoFrustum frustum = _stereoFrustum(stereo.projections[0] * stereo.views[0], stereo.projections[1] * stereo.views[1], _reversedDepth);
+		const mat4 left = glm::inverse(stereo.views[0]);
+		const mat4 right = glm::inverse(stereo.views[1]);
+		const vec3 eye = (vec3(left[3].x, left[3].y, left[3].z) + vec3(right[3].x, right[3].y, right[3].z)) * 0.5f;
+		const float focal = stereo.projections[0][1][1];
+		lod_eye = eye;
+		lod_focal = focal;
+		virtual_texture_view = stereo.views[0];
+		virtual_texture_projection = stereo.projections[0];
+
+		/* the CPU molecules are culled and bucketed on the job threads, one type each, while this thread sets up
+		   the clusters and draws the factory, then only the uploads are left for it */
+		const bool cpu_molecules = !gpu_molecules.loaded();
+		JobCounter bucketed;
+		uint32_t co2_culled = 0, o2_culled = 0;
+		if (cpu_molecules) {
+			const CullScratch co2_scratch = allocateCullScratch(co2_instances.transforms.size());
+			const CullScratch o2_scratch = allocateCullScratch(o2_instances.transforms.size());
+			_jobs.run([&, co2_scratch]() { co2_culled = bucketInstances(*co2_tmp, co2_instances, co2_scratch, frustum, eye, focal); }, &bucketed);
+			_jobs.run([&, o2_scratch]() { o2_culled = bucketInstances(*o2_tmp, o2_instances, o2_scratch, frustum, eye, focal); }, &bucketed);
+		}
+		assignClusters(stereo, left, eye);
+
+		const mat4 & mod = entities.get<TransformComponent>(factory_entity)->world;
+		/* the meshlets are culled for this pass's eyes before the factory program goes in use */
+		const vec3 eyes[2] = { vec3(left[3].x, left[3].y, left[3].z), vec3(right[3].x, right[3].y, right[3].z) };
+		const bool meshlets = _meshletCulling && fac1->batched() && fac1->cullMeshlets(frustum, mod, eyes, stereo.eyeCount);
+
+		factory_sd.Use();
+		setViewUniforms(factory_sd, stereo);
+
+		const uint32_t factory_culled = fac1->cull(frustum, mod) + world.cull(frustum, mod);
+		_cullStats.meshes += factory_culled;
+		_renderStats.culled(factory_culled);
+		fac1->streamTextures(eye, focal * target_half_height);
+		factory_sd.set("model", mod);
+		if (depth_prepass || environment_layered)
+			beginDepthPass();
+		drawFactory(factory_sd, stereo, mod, depth_prepass || environment_layered, meshlets);
+		if (environment_layered && !depth_prepass)
+			_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+		/* the factory is drawn first so the molecules it hides can be culled against its depth */
+		if (!cpu_molecules) {
+			GpuBucketScope cullBucket(bucket_molecule_cull);
+			if (hi_z.initialized() && !stereo.multiview)
+				hi_z.build(_eyeDepthFormat(), _reversedDepth);
+			const mat4 view_projections[2] = { stereo.projections[0] * stereo.views[0], stereo.projections[1] * stereo.views[1] };
+			Model * models[2] = { co2_tmp.get(), o2_tmp.get() };
+			InstanceBuffer * buffers[2][MOLECULE_LOD_LEVELS] = {
+				{ &co2_instances.buffers[0], &co2_instances.buffers[1], &co2_instances.buffers[2] },
+				{ &o2_instances.buffers[0], &o2_instances.buffers[1], &o2_instances.buffers[2] } };
+			gpu_molecules.cull(models, buffers, molecule_scale, frustum, eye, focal, lod_sizes, forced_lod, stereo.eyeCount,
+				hi_z, view_projections, stereo.eyeViewports, _reversedDepth);
+		}
+		else {
+			_jobs.wait(bucketed);
+			_cullStats.instances += co2_culled + o2_culled;
+			_renderStats.culled(co2_culled + o2_culled);
+			if (pullingMolecules()) {
+				uploadPulledInstances();
+			}
+			else {
+				uploadInstances(co2_instances);
+				uploadInstances(o2_instances);
+			}
+		}
+
+		if (!depth_prepass) {
+			drawMolecules(stereo, false);
+			drawParticles(stereo);
+			drawBeams(stereo);
+			return;
+		}
+		// Building the pyramid puts the color writes back
+		beginDepthPass();
+		drawMolecules(stereo, true);
+
+		/* the shading pass, one lit fragment per pixel however many molecules overlap there */
+		_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		_glState.depthMask(GL_FALSE);
+		_glState.depthFunc(GL_EQUAL);
+		if (!environment_layered) {
+			factory_sd.Use();
+			drawFactory(factory_sd, stereo, mod, false, meshlets);
+		}
+		drawMolecules(stereo, false);
+		_glState.depthMask(GL_TRUE);
+		_glState.depthFunc(GL_LESS);
+		drawParticles(stereo);
+		drawBeams(stereo);
+	}
+
+	// The factory alone, shaded, for the environment layer. The clusters are assigned for its camera, render() assigns
+	// them again for the eyes'.
+	void renderEnvironment(const StereoView & stereo) {
+		Shader & factory_sd = factoryShader(stereo);
+		const StereoFrustum frustum = _stereoFrustum(stereo.projections[0] * stereo.views[0], stereo.projections[1] * stereo.views[1], _reversedDepth);
+		const mat4 left = glm::inverse(stereo.views[0]);
+		assignClusters(stereo, left, vec3(left[3].x, left[3].y, left[3].z));
+
+		factory_sd.Use();
+		setViewUniforms(factory_sd, stereo);
+		const mat4 & mod = entities.get<TransformComponent>(factory_entity)->world;
+		const uint32_t factory_culled = fac1->cull(frustum, mod) + world.cull(frustum, mod);
+		_cullStats.meshes += factory_culled;
+		_renderStats.culled(factory_culled);
+		factory_sd.set("model", mod);
+		drawFactory(factory_sd, stereo, mod, false, false);
+	}
+
+	// The cluster grid hangs off a camera at eye, turned like the left one, and spans the tangents of both eyes.
+	// Only the eyes' offset from it is left out, fragments it pushes past the edge clamp onto the edge clusters.
+	void assignClusters(const StereoView & stereo, const mat4 & left_pose, const vec3 & eye) {
+		mat4 pose = left_pose;
+		pose[3] = vec4(eye, 1.0f);
+		vec4 tangents(FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX);
+		for (int e = 0; e < 2; e++) {
+			const mat4 & p = stereo.projections[e];
+			// x / -z where clip x is -w and w, the same for y, whichever way depth runs
+			tangents.x = std::min(tangents.x, (p[2][0] - 1.0f) / p[0][0]);
+			tangents.y = std::max(tangents.y, (p[2][0] + 1.0f) / p[0][0]);
+			tangents.z = std::min(tangents.z, (p[2][1] - 1.0f) / p[1][1]);
+			tangents.w = std::max(tangents.w, (p[2][1] + 1.0f) / p[1][1]);
+		}
+		cluster_lights.assign(glm::inverse(pose), tangents);
+		cluster_lights.bind();
+	}
+
+	// Depth writes only, the fragment shader skipping its lighting through depthOnly
+	void beginDepthPass() {
+		_glState.colorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		_glState.depthMask(GL_TRUE);
+		_glState.depthFunc(GL_LESS);
+	}
+
+	// One multi draw for the whole factory once it has loaded, mesh by mesh while it is still the proxy. The
+	// program must be in use with its view and model uniforms set. A placed factory that couldn't be batched draws
+	// its instances with the molecule program instead, factory_sd is in use again after. meshlets draws the batch's
+	// meshlets as this pass's cullMeshlets left them. The world's cells go first.
+	void drawFactory(Shader & factory_sd, const StereoView & stereo, const mat4 & transform, bool depth_only, bool meshlets) {
+		drawWorld(factory_sd, stereo, transform, depth_only);
+		GpuBucketScope factoryBucket(bucket_factory);
+		if (fac1->placed() && !fac1->batched()) {
+			Shader & placed_sd = moleculeShader(*fac1, stereo);
+			placed_sd.Use();
+			setViewUniforms(placed_sd, stereo);
+			placed_sd.set("depthOnly", (GLint)depth_only);
+			setFadeUniforms(placed_sd, *fac1, false);
+			fac1->DrawPlaced(placed_sd, transform, stereo.eyeCount);
+			factory_sd.Use();
+			return;
+		}
+		factory_sd.set("depthOnly", (GLint)depth_only);
+		if (meshlets)
+			fac1->DrawMeshlets(factory_sd);
+		else if (fac1->batched())
+			fac1->DrawBatched(factory_sd, stereo.eyeCount);
+		else
+			fac1->DrawInstanced(factory_sd, stereo.eyeCount);
+	}
+
+	// The world's cells as the last cull picked them, full or as proxies, with the unbatched factory program whatever
+	// the factory draws with. factory_sd is in use again after.
+	void drawWorld(Shader & factory_sd, const StereoView & stereo, const mat4 & transform, bool depth_only) {
+		if (!world.loaded())
+			return;
+		GpuBucketScope worldBucket(bucket_world);
+		Shader & plain = stereo.multiview ? *sd_multiview : *sd;
+		if (&plain != &factory_sd) {
+			plain.Use();
+			setViewUniforms(plain, stereo);
+			plain.set("model", transform);
+		}
+		plain.set("depthOnly", (GLint)depth_only);
+		world.draw(plain, stereo.eyeCount);
+		factory_sd.Use();
+	}
+
+	// Once a frame: the world's cells load and unload around the head, taken into the factory's space they are in
+	void updateWorld(float deltaSeconds) {
+		if (!world.loaded())
+			return;
+		const mat4 & mod = entities.get<TransformComponent>(factory_entity)->world;
+		world.update(vec3(glm::inverse(mod) * vec4(_tracking.snapshot().headPosition, 1.0f)), deltaSeconds);
+	}
+
+	// The conversion sparks over everything opaque, one indirect draw for all of them
+	void drawParticles(const StereoView & stereo) {
+		if (!particles.initialized())
+			return;
+		GpuBucketScope particleBucket(bucket_particles);
+		Shader & particle = stereo.multiview ? *particle_sd_multiview : *particle_sd;
+		particle.Use();
+		setViewUniforms(particle, stereo);
+		particle.set("particleSize", CONVERSION_PARTICLE_SIZE);
+		particles.draw(particle, (GLuint)stereo.eyeCount);
+	}
+
+	// Both lasers for every eye of the view in one draw
+	void drawBeams(const StereoView & stereo) {
+		if (!beams.initialized())
+			return;
+		GpuBucketScope laserBucket(bucket_lasers);
+		Shader & beam = stereo.multiview ? *beam_sd_multiview : *beam_sd;
+		beam.Use();
+		setViewUniforms(beam, stereo);
+		beams.draw(beam, (GLuint)stereo.eyeCount);
+	}
+
+	// One instanced draw per molecule type and level of detail, covering both eyes in stereo
+	void drawMolecules(const StereoView & stereo, bool depth_only) {
+		// The GPU simulation's molecules draw through the mesh commands its cull pass fills in
+		if (_moleculeImpostors && !gpu_molecules.loaded()) {
+			drawImpostors(stereo, depth_only);
+			return;
+		}
+		// Levels can light differently, so a type can take more than one program: each is set up when it first draws,
+		// the fade uniforms again whenever the type changes
+		Shader * current = nullptr;
+		const Model * faded = nullptr;
+		bool fade = false;
+		auto programFor = [&](Model & model, uint32_t level) -> Shader & {
+			Shader & program = moleculeShader(model, stereo, level);
+			if (&program != current) {
+				program.Use();
+				setViewUniforms(program, stereo);
+				program.set("depthOnly", (GLint)depth_only);
+				current = &program;
+				faded = nullptr;
+			}
+			if (faded != &model) {
+				setFadeUniforms(program, model, fade);
+				faded = &model;
+			}
+			return program;
+		};
+		if (gpu_molecules.loaded()) {
+			_gpuBuckets.begin(bucket_molecules[(int)MoleculeType::CO2]);
+			gpu_molecules.draw(*co2_tmp, (int)MoleculeType::CO2, [&](uint32_t l) -> Shader & { return programFor(*co2_tmp, l); });
+			_gpuBuckets.end(bucket_molecules[(int)MoleculeType::CO2]);
+			_gpuBuckets.begin(bucket_molecules[(int)MoleculeType::O2]);
+			gpu_molecules.draw(*o2_tmp, (int)MoleculeType::O2, [&](uint32_t l) -> Shader & { return programFor(*o2_tmp, l); });
+			_gpuBuckets.end(bucket_molecules[(int)MoleculeType::O2]);
+		}
+		else if (pullingMolecules()) {
+			// Both types in the one draw per level, so the CO2 bucket times the O2 molecules too
+			GpuBucketScope typeBucket(bucket_molecules[(int)MoleculeType::CO2]);
+			Shader & pull = stereo.multiview ? *pull_sd_multiview : *pull_sd;
+			pull.Use();
+			setViewUniforms(pull, stereo);
+			pull.set("depthOnly", (GLint)depth_only);
+			setFadeUniforms(pull, *co2_tmp, billboardsDrawn(co2_instances) && billboardsDrawn(o2_instances));
+			arena.draw(pull, stereo.eyeCount);
+		}
+		else {
+			_gpuBuckets.begin(bucket_molecules[(int)MoleculeType::CO2]);
+			fade = billboardsDrawn(co2_instances);
+			drawInstances(*co2_tmp, co2_instances, stereo, [&](uint32_t l) -> Shader & { return programFor(*co2_tmp, l); });
+			_gpuBuckets.end(bucket_molecules[(int)MoleculeType::CO2]);
+			_gpuBuckets.begin(bucket_molecules[(int)MoleculeType::O2]);
+			fade = billboardsDrawn(o2_instances);
+			drawInstances(*o2_tmp, o2_instances, stereo, [&](uint32_t l) -> Shader & { return programFor(*o2_tmp, l); });
+			_gpuBuckets.end(bucket_molecules[(int)MoleculeType::O2]);
+		}
+		if (!gpu_molecules.loaded())
+			drawBillboards(stereo, depth_only);
+	}
+
+	// Every far molecule of both types, one card each, dithered in over the crossfade as the meshes dither out
+	void drawBillboards(const StereoView & stereo, bool depth_only) {
+		if (!co2_instances.billboard_buffer.count() && !o2_instances.billboard_buffer.count()) {
+			return;
+		}
+		Shader & billboard = stereo.multiview ? *billboard_sd_multiview : *billboard_sd;
+		billboard.Use();
+		setViewUniforms(billboard, stereo);
+		billboard.set("depthOnly", (GLint)depth_only);
+		_gpuBuckets.begin(bucket_molecules[(int)MoleculeType::CO2]);
+		setFadeUniforms(billboard, *co2_tmp, true);
+		co2_instances.billboards.draw(billboard, co2_instances.billboard_buffer.count() * stereo.eyeCount);
+		_gpuBuckets.end(bucket_molecules[(int)MoleculeType::CO2]);
+		_gpuBuckets.begin(bucket_molecules[(int)MoleculeType::O2]);
+		setFadeUniforms(billboard, *o2_tmp, true);
+		o2_instances.billboards.draw(billboard, o2_instances.billboard_buffer.count() * stereo.eyeCount);
+		_gpuBuckets.end(bucket_molecules[(int)MoleculeType::O2]);
+	}
+
+	// The sizes the crossfade runs over, as bucketInstances() measures them, or none for programs drawing all of model
+	void setFadeUniforms(Shader & shader, const Model & model, bool fade) {
+		shader.set("lodFade", fade ? vec2(MOLECULE_BILLBOARD_SIZE * MOLECULE_BILLBOARD_FADE, MOLECULE_BILLBOARD_SIZE) : vec2(0.0f, -1.0f));
+		shader.set("lodEye", lod_eye);
+		shader.set("lodFocal", lod_focal);
+		shader.set("lodRadius", model.boundingRadius());
+	}
+
+	// Both types' atoms with one program, every level's buffer at the same two triangles per atom
+	void drawImpostors(const StereoView & stereo, bool depth_only) {
+		Shader & imp = stereo.multiview ? *imp_sd_multiview : *imp_sd;
+		imp.Use();
+		setViewUniforms(imp, stereo);
+		imp.set("depthOnly", (GLint)depth_only);
+		imp.set("depthZeroToOne", (GLint)_reversedDepth);
+		LodInstances * types[(int)MoleculeType::Count] = { &co2_instances, &o2_instances };
+		for (int type = 0; type < (int)MoleculeType::Count; type++) {
+			GpuBucketScope typeBucket(bucket_molecules[type]);
+			for (uint32_t l = 0; l < MOLECULE_LOD_LEVELS; l++) {
+				types[type]->impostors.draw(imp, l, types[type]->levelCount(l) * stereo.eyeCount);
+			}
+		}
+	}
+
+	// One multi draw for the whole factory once it has loaded, lit from its bake if the batch has one, mesh by mesh
+	// while it is still the proxy
+	Shader & factoryShader(const StereoView & stereo) {
+		if (!fac1->batched())
+			return stereo.multiview ? *sd_multiview : *sd;
+		if (fac1->lightBaked() && sd_baked)
+			return stereo.multiview ? *sd_baked_multiview : *sd_baked;
+		return stereo.multiview ? *sd_batch_multiview : *sd_batch;
+	}
+
+	// The packed program for loaded molecules, the plain one while they are still proxy boxes. The packed program
+	// lights level as its materials need and no more; below level 0 a molecule is too small on screen for a highlight
+	// to show, so those levels go without the specular.
+	Shader & moleculeShader(Model & model, const StereoView & stereo, uint32_t level = 0) {
+		if (!model.packed())
+			return stereo.multiview ? *mol_sd_multiview : *mol_sd;
+		LightingModel lighting = model.lightingModel(level);
+		if (level > 0)
+			lighting = std::min(lighting, LightingModel::Lambert);
+		return stereo.multiview ? *mol_sd_packed_lit_multiview[(int)lighting] : *mol_sd_packed_lit[(int)lighting];
+	}
+
+	// Camera and light uniforms shared by the factory and molecule programs
+	void setViewUniforms(Shader & shader, const StereoView & stereo) {
+		shader.set("projection", stereo.projections, 2);
+		shader.set("view", stereo.views, 2);
+		shader.set("eyeCount", stereo.eyeCount);
+		shader.set("eyeViewport", stereo.eyeViewports, 2);
+
+		/* the light is baked in (SCENE_LIGHT_DEFINE), specular is computed from between the eyes so both see the same highlight */
+		shader.set("viewPos", vec3(glm::inverse(stereo.views[0])[3] + glm::inverse(stereo.views[1])[3]) * 0.5f);
+
+		const bool shadowed = shadows.sampled();
+		shader.set("shadowsEnabled", (GLint)shadowed);
+		if (shadowed) {
+			shadows.bind();
+			shader.set("shadowStatic", (GLint)SHADOW_STATIC_UNIT);
+			shader.set("shadowDynamic", (GLint)SHADOW_DYNAMIC_UNIT);
+			shader.set("shadowStaticLookup", shadows.lookup(ShadowMap::Static));
+			shader.set("shadowDynamicLookup", shadows.lookup(ShadowMap::Dynamic));
+		}
+
+		shader.set("clusterLightCount", (GLint)cluster_lights.size());
+		shader.set("clusterGrid", (GLint)CLUSTER_GRID_UNIT);
+		shader.set("clusterIndices", (GLint)CLUSTER_INDEX_UNIT);
+		shader.set("clusterView", cluster_lights.view());
+		shader.set("clusterTangents", cluster_lights.tangents());
+		shader.set("clusterSize", ivec3(CLUSTER_X, CLUSTER_Y, CLUSTER_Z));
+		shader.set("clusterDepth", vec2(CLUSTER_NEAR, logf(CLUSTER_FAR / CLUSTER_NEAR)));
+	}
+};
+
+
+// An example application that renders a simple cube
+class ExampleApp : public RiftApp {
+	ResourceRegistry resources;
+	std::shared_ptr<ColorCubeScene> cubeScene;
+
+	// Two stage pipeline: while the render thread draws frame N, the simulation thread steps the game for N+1.
+	// Inputs go one way and finished frames the other, each through a lock free triple buffer.
+	TripleBuffer<SceneInput> simInputs;
+	TripleBuffer<SceneFrame> simFrames;
+	FrameWorker simWorker;
+	double simClock{ 0 };
+	// The outcome of the newest SceneFrame, compared against to turn it into GameEvents
+	bool won{ false };
+	bool lost{ false };
+	// Ours, once the avatar SDK is up
+	ovrID userID{ 0 };
+	uint32_t conversionsSeen{ 0 };
+	uint32_t stressMolecules{ 0 };
+
+public:
+	ExampleApp() {}
+protected:
+	void initGl() override {
+		RiftApp::initGl();
+		_initMoleculeLodKnob();
+		glClearColor(0.0f, 0.0f, 0.55f, 0.0f);
+		glEnable(GL_CULL_FACE);
+		glEnable(GL_DEPTH_TEST);
+		// Blending stays off but for the render queue's blended and decal passes, which turn it on around themselves
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		// The avatar SDK comes up on a thread of its own once the platform has. Our specification request, and the
+		// network that needs our user id, then go from the render thread.
+		const StartupTask avatarSdk = _startup.add("avatar sdk", [this] {
+			ovrAvatar_Initialize(MIRROR_SAMPLE_APP_ID);
+			userID = ovr_GetLoggedInUserID();
+			return true;
+		}, { _startupPlatform });
+		_startup.add("avatar specification", [this] {
+			printf("Requesting avatar specification...\r\n");
+			_requestAvatarPump({ AvatarPumpRequestKind::RequestSpecification, userID, nullptr });
+			_avatarPump.start(_avatarPumpStep, "avatar pump");
+
+			// Remote avatars get their specifications by user id too, so the network only starts once ours is known
+			if (_netPort && _avatarNetwork.open((uint16_t)_netPort, userID)) {
+				for (size_t i = 0; i < _netPeers.size(); ++i) {
+					_avatarNetwork.addPeer(_netPeers[i].first.c_str(), (uint16_t)_netPeers[i].second);
+				}
+				_avatarRecorder.setPacketSeconds(AVATAR_NET_PACKET_SECONDS);
+				_avatarRecorder.subscribe([](const uint8_t * data, uint32_t size, float duration) {
+					_avatarNetwork.send(data, size, duration);
+				});
+			}
+			return true;
+		}, { avatarSdk }, true);
+		// The microphone belongs to the platform, it can open once that is up
+		if (_voiceEnabled) {
+			_startup.add("microphone", [] {
+				return _voiceCapture.start();
+			}, { _startupPlatform });
+		}
+
+		// Recenter the tracking origin at startup so that the reflection avatar appears directly in front of the user
+		_hmdRecenterTrackingOrigin(_session);
+
+		// The first frames go out with just the clear colour and the avatar as far as it has loaded, the scene is
+		// built between frames right after
+		_startup.add("scene", [this] {
+			// Models and shaders load for longer than a frame, the loading layer keeps the headset fed meanwhile
+			_loadingLayer.hold(_session);
+			int lodBias = 0;
+			_pickMoleculePreset(&lodBias, &_moleculeCapacity);
+			// A replayed trace seeds the threads' generators as it seeds the game
+			_seedRandom(_poseTrace.seed());
+			cubeScene = std::shared_ptr<ColorCubeScene>(new ColorCubeScene(resources, _poseTrace.seed()));
+			cubeScene->lod_bias_floor = lodBias;
+			cubeScene->setLodBias(lodBias);
+			if (_pipelinedSimulation) {
+				simWorker.start([this] { simulationStep(); }, "simulation", ThreadRole::Simulation);
+			}
+			// The scene's programs and everything RiftApp linked, while the loading layer still covers for it
+			_warmUpFreshPrograms();
+			_loadingLayer.release();
+			_loadingLayer.show(false);
+			return true;
+		}, { _startupPack }, true);
+		// A benchmark times the scene from its first frame
+		if (_benchHmd.active()) {
+			_startup.pump();
+		}
+	}
+
+	// The GPU calibration's preset for the molecules: the least LOD bias, and failing that the most capacity, whose
+	// vertices fit their share of the frame. LOD gives way before capacity, which changes how a round plays.
+	void _pickMoleculePreset(int * lodBias, size_t * capacity) const {
+		*lodBias = 0;
+		*capacity = MOLECULE_GAME_CAPACITY;
+		if (!_gpuCalibration.available()) {
+			return;
+		}
+		const GpuCalibrationResult & measured = _gpuCalibration.result();
+		const float budgetMs = _framePacer.periodMs() * MOLECULE_CALIBRATION_SHARE;
+		for (int c = 0; c < MOLECULE_CALIBRATION_CAPACITY_COUNT; c++) {
+			*capacity = (size_t)(MOLECULE_GAME_CAPACITY * MOLECULE_CALIBRATION_CAPACITIES[c]);
+			for (*lodBias = 0; *lodBias <= MOLECULE_LOD_BIAS_LEVELS; (*lodBias)++) {
+				// Both eyes draw every molecule
+				const double vertices = 2.0 * *capacity * MOLECULE_CALIBRATION_VERTICES * pow(MOLECULE_CALIBRATION_BIAS_KEEPS, *lodBias);
+				if (measured.vertexMs(vertices) <= budgetMs) {
+					printf("GPU calibration preset: molecule LOD bias %d, capacity %u\r\n", *lodBias, (unsigned)*capacity);
+					return;
+				}
+			}
+		}
+		// Nothing fits, the cheapest there is
+		*lodBias = MOLECULE_LOD_BIAS_LEVELS;
+		printf("GPU calibration preset: molecule LOD bias %d, capacity %u\r\n", *lodBias, (unsigned)*capacity);
+	}
+
+	// The molecules' LOD for the quality governor, between the shading rate and the avatars. Nothing to step before
+	// the scene is in or while a benchmark forces a level.
+	void _initMoleculeLodKnob() {
+		QualityKnob moleculeLod;
+		moleculeLod.name = "molecule_lod_bias";
+		moleculeLod.priority = QUALITY_PRIORITY_MOLECULE_LOD;
+		moleculeLod.lowerable = [this] { return cubeScene && cubeScene->forced_lod < 0 && cubeScene->lod_bias_level < MOLECULE_LOD_BIAS_LEVELS; };
+		moleculeLod.lowered = [this] { return cubeScene && cubeScene->lod_bias_level > cubeScene->lod_bias_floor; };
+		moleculeLod.lowerSavesMs = moleculeLod.raiseCostsMs = [this](const QualityFrame&) { return _sceneGpuMs() * 0.1f; };
+		moleculeLod.lower = [this](const QualityFrame&) { cubeScene->setLodBias(cubeScene->lod_bias_level + 1); };
+		moleculeLod.raise = [this](const QualityFrame&) { cubeScene->setLodBias(cubeScene->lod_bias_level - 1); };
+		moleculeLod.value = [this] { return cubeScene ? (float)cubeScene->lod_bias_level : 0.0f; };
+		_qualityGovernor.add(moleculeLod);
+	}
+
+	// The round's outcome: a banner in the won or lost colour, with a white rim, and white ticks along the bottom
+	// for the buttons that start the next round
+	void drawHud(int width, int height) override {
+		glDisable(GL_SCISSOR_TEST);
+		glClearColor(1.0f, 1.0f, 1.0f, 0.9f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glEnable(GL_SCISSOR_TEST);
+		const int rim = 4;
+		glScissor(rim, rim, width - 2 * rim, height - 2 * rim);
+		if (won) {
+			glClearColor(0.0f, 0.73f, 1.0f, 0.9f);
+		}
+		else {
+			glClearColor(0.85f, 0.1f, 0.1f, 0.9f);
+		}
+		glClear(GL_COLOR_BUFFER_BIT);
+		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+		for (int x = width / 4; x < width * 3 / 4; x += width / 8) {
+			glScissor(x, rim * 3, width / 16, rim * 2);
+			glClear(GL_COLOR_BUFFER_BIT);
+		}
+	}
+
+	// The game's blue with a white rim and a row of white ticks, the same look as the round's banner
+	void drawLoading(int width, int height) override {
+		glDisable(GL_SCISSOR_TEST);
+		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glEnable(GL_SCISSOR_TEST);
+		const int rim = 6;
+		glScissor(rim, rim, width - 2 * rim, height - 2 * rim);
+		glClearColor(0.0f, 0.0f, 0.55f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+		for (int x = width / 4; x < width * 3 / 4; x += width / 8) {
+			glScissor(x, height / 2 - rim, width / 16, rim * 2);
+			glClear(GL_COLOR_BUFFER_BIT);
+		}
+	}
+
+	void shutdownGl() override {
+		simWorker.stop();
+		_avatarPump.stop();
+		// It samples the session, which goes when the app does
+		_inputPoller.stop();
+		_latencyTest.finish("latency_test.csv");
+		_voiceCapture.stop();
+		// What is still being encoded goes into the file first
+		_sessionRecorder.close();
+		// The last slices out and the readback released, while the context is there
+		_remoteHmd.close();
+		cubeScene.reset();
+		resources.clear();
+		// The last packet and the index, while the avatar is still there to end the recording
+		_avatarRecorder.close(_avatar);
+		_avatarNetwork.close();
+		_moleculeClient.close();
+	}
+
+	// Simulation thread, or inline on the render thread when the pipeline is off. Joined to a server, the round
+	// is played there and the frame is its snapshots.
+	void simulationStep() {
+		simInputs.acquire();
+		if (_moleculeClient.isOpen()) {
+			_moleculeClient.step(simInputs.front(), simFrames.back());
+		}
+		else {
+			cubeScene->step(simInputs.front(), simFrames.back());
+		}
+		simFrames.publish();
+	}
+
+	void updateScene(float deltaSeconds) override {
+		if (!cubeScene) {
+			return;
+		}
+		simClock += deltaSeconds;
+		// Last frame's bursts, then everything moves on
+		cubeScene->particles.update(deltaSeconds);
+		cubeScene->updateWorld(deltaSeconds);
+
+		const GameInput & player = _game.input();
+		SceneInput & input = simInputs.back();
+		input.time = simClock;
+		input.leftRay = player.rays[ovrHand_Left];
+		input.rightRay = player.rays[ovrHand_Right];
+		input.leftTrigger = player.triggers[ovrHand_Left];
+		input.rightTrigger = player.triggers[ovrHand_Right];
+		input.resetRequests = player.resetRequests;
+		input.stressMolecules = stressMolecules;
+		input.gpuMolecules = cubeScene->gpu_molecules.initialized();
+		simInputs.publish();
+		if (simWorker.running()) {
+			simWorker.kick();
+		}
+		else {
+			simulationStep();
+		}
+
+		// Pipelined this is the step kicked last frame, or an older one if the simulation is falling behind
+		if (!simFrames.acquire()) {
+			return;
+		}
+		const SceneFrame & sceneFrame = simFrames.front();
+		_hitchRecorder.context().molecules = sceneFrame.gpuMolecules ? (uint32_t)cubeScene->gpu_molecules.size()
+			: (uint32_t)(sceneFrame.co2Transforms.size() + sceneFrame.o2Transforms.size());
+		if (sceneFrame.won && !won) {
+			glClearColor(0.0f, 0.73f, 1.0f, 0.0f);
+			_game.emit({ GameEventKind::Won, 0, 0, 0.0f, 0.0f });
+		}
+		if (sceneFrame.lost && !lost) {
+			_game.emit({ GameEventKind::Lost, 0, 0, 0.0f, 0.0f });
+		}
+		if ((won || lost) && !sceneFrame.won && !sceneFrame.lost) {
+			glClearColor(0.0f, 0.0f, 0.55f, 0.0f);
+			_game.emit({ GameEventKind::Reset, 0, 0, 0.0f, 0.0f });
+		}
+		if (sceneFrame.won != won || sceneFrame.lost != lost) {
+			// The banner is only drawn again when the outcome changes, every frame between submits the same commit
+			_hud.show(sceneFrame.won || sceneFrame.lost);
+			_hud.markDirty();
+		}
+		won = sceneFrame.won;
+		lost = sceneFrame.lost;
+		const uint32_t conversions = sceneFrame.conversions + cubeScene->gpu_molecules.conversions();
+		if (conversions != conversionsSeen) {
+			_game.emit({ GameEventKind::Conversion, 0, conversions - conversionsSeen, 0.0f, 0.0f });
+			conversionsSeen = conversions;
+			// A short buzz in both hands, however many converted since the last frame
+			_game.emit({ GameEventKind::Vibration, ovrHand_Left, 0, 1.0f, 0.15f });
+			_game.emit({ GameEventKind::Vibration, ovrHand_Right, 0, 1.0f, 0.15f });
+		}
+		for (const vec3 & point : sceneFrame.conversionPoints) {
+			_game.emit({ GameEventKind::Burst, 0, 1, 0.0f, 0.0f, point });
+		}
+		cubeScene->upload(sceneFrame);
+	}
+
+	void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose) override {
+		if (!cubeScene) {
+			return;
+		}
+		cubeScene->depth_prepass = depthPrepass();
+		cubeScene->environment_layered = environmentOwnLayer();
+		cubeScene->target_half_height = renderTargetSize().y * 0.5f;
+		cubeScene->render(_monoStereoView(projection, glm::inverse(headPose)));
+	}
+
+	bool supportsStereo() const override {
+		return true;
+	}
+
+	void playGameEvent(const GameEvent & event) override {
+		if (event.kind == GameEventKind::Burst && cubeScene) {
+			cubeScene->particles.burst(event.position, CONVERSION_PARTICLE_COLOR);
+		}
+	}
+
+	// The molecule count reaches the simulation with the next input, the draw settings apply from the next frame
+	bool applyBenchConfig(const BenchConfig & config) override {
+		if (!config.instancing && !GLEW_ARB_base_instance) {
+			return false;
+		}
+		stressMolecules = config.molecules;
+		cubeScene->forced_lod = config.lod;
+		cubeScene->instancing = config.instancing;
+		return true;
+	}
+
+	void renderSceneStereo(const StereoView & stereo) override {
+		if (!cubeScene) {
+			return;
+		}
+		cubeScene->depth_prepass = depthPrepass();
+		cubeScene->environment_layered = environmentOwnLayer();
+		cubeScene->target_half_height = renderTargetSize().y * 0.5f;
+		cubeScene->render(stereo);
+	}
+
+	// The factory doesn't move, it can go in the environment layer
+	bool supportsEnvironmentLayer() const override {
+		return true;
+	}
+
+	void renderEnvironment(const StereoView & view) override {
+		if (!cubeScene) {
+			return;
+		}
+		cubeScene->renderEnvironment(view);
+	}
+};
+
+// The engine's hot CPU paths, each on its own and away from the frame, for --microbench. Inputs come from a fixed seed
+// so two builds time the same work.
+static int _runMicroBenchmarks(const char* filter) {
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	MicroBenchmarks benchmarks;
+
+	// A chain as deep as an avatar may have, so every joint waits on its parent
+	auto chainPose = [&](ovrAvatarSkinnedMeshPose* pose, Affine34* inverseBind) {
+		memset(pose, 0, sizeof(*pose));
+		pose->jointCount = OVR_AVATAR_MAXIMUM_JOINT_COUNT;
+		for (uint32_t i = 0; i < pose->jointCount; ++i) {
+			const glm::quat q = glm::normalize(glm::quat(1.0f, unit(random), unit(random), unit(random)));
+			const glm::vec3 t = glm::vec3(unit(random), unit(random), unit(random)) * 0.1f;
+			_ovrAvatarTransformFromGlm(t, q, glm::vec3(1.0f), &pose->jointTransform[i]);
+			pose->jointParents[i] = (int)i - 1;
+			_affineFromMat4(glm::inverse(glm::translate(t) * glm::mat4_cast(q)), &inverseBind[i]);
+		}
+	};
+	benchmarks.add("compute_world_pose", [&](MicroBenchState& state) {
+		ovrAvatarSkinnedMeshPose pose;
+		Affine34 inverseBind[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
+		chainPose(&pose, inverseBind);
+		glm::mat4 world[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
+		while (state.keepRunning()) {
+			_computeWorldPose(pose, world);
+			_doNotOptimize(world);
+		}
+		state.setItemsPerIteration(pose.jointCount);
+	});
+	benchmarks.add("evaluate_skinning_palette", [&](MicroBenchState& state) {
+		ovrAvatarSkinnedMeshPose pose;
+		Affine34 inverseBind[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
+		chainPose(&pose, inverseBind);
+		glm::mat4 palette[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
+		while (state.keepRunning()) {
+			_evaluateSkinningPalette(pose, inverseBind, palette);
+			_doNotOptimize(palette);
+		}
+		state.setItemsPerIteration(pose.jointCount);
+	});
+	benchmarks.add("avatar_transform_from_glm", [&](MicroBenchState& state) {
+		const size_t count = 256;
+		vector<glm::mat4> matrices(count);
+		for (size_t i = 0; i < count; ++i) {
+			const glm::quat q = glm::normalize(glm::quat(unit(random), unit(random), unit(random), unit(random) + 2.0f));
+			matrices[i] = glm::translate(glm::vec3(unit(random), unit(random), unit(random))) * glm::mat4_cast(q) *
+				glm::scale(glm::vec3(1.0f + 0.5f * unit(random)));
+		}
+		vector<ovrAvatarTransform> transforms(count);
+		while (state.keepRunning()) {
+			for (size_t i = 0; i < count; ++i) {
+				_ovrAvatarTransformFromGlm(matrices[i], &transforms[i]);
+			}
+			_doNotOptimize(transforms[count - 1]);
+		}
+		state.setItemsPerIteration(count);
+	});
+
+	// Tracked poses as the renderer takes them: a pose to its matrix, to the eye's view and inverse view, and
+	// composed onto a parent pose
+	auto randomPoses = [&](vector<ovrPosef>* poses) {
+		for (ovrPosef& pose : *poses) {
+			const glm::quat q = glm::normalize(glm::quat(unit(random), unit(random), unit(random), unit(random) + 2.0f));
+			pose.Orientation = ovr::fromGlm(q);
+			pose.Position = ovr::fromGlm(glm::vec3(unit(random), unit(random) + 1.5f, unit(random)));
+		}
+	};
+	benchmarks.add("pose_to_mat4", [&](MicroBenchState& state) {
+		const size_t count = 256;
+		vector<ovrPosef> poses(count);
+		randomPoses(&poses);
+		vector<glm::mat4> matrices(count);
+		while (state.keepRunning()) {
+			for (size_t i = 0; i < count; ++i) {
+				matrices[i] = _mat4FromOvrPose(poses[i]);
+			}
+			_doNotOptimize(matrices[count - 1]);
+		}
+		state.setItemsPerIteration(count);
+	});
+	benchmarks.add("eye_view_from_pose", [&](MicroBenchState& state) {
+		const size_t count = 256;
+		vector<ovrPosef> poses(count);
+		randomPoses(&poses);
+		vector<glm::mat4> views(count * 2);
+		while (state.keepRunning()) {
+			for (size_t i = 0; i < count; ++i) {
+				RigidTransform pose, inversePose;
+				_rigidFromOvrPose(poses[i], &pose);
+				_rigidInverse(pose, &inversePose);
+				_mat4FromRigid(pose, &views[2 * i]);
+				_mat4FromRigid(inversePose, &views[2 * i + 1]);
+			}
+			_doNotOptimize(views[count * 2 - 1]);
+		}
+		state.setItemsPerIteration(count);
+	});
+	benchmarks.add("rigid_multiply", [&](MicroBenchState& state) {
+		const size_t count = 256;
+		vector<ovrPosef> poses(count);
+		randomPoses(&poses);
+		vector<RigidTransform> locals(count), worlds(count);
+		for (size_t i = 0; i < count; ++i) {
+			_rigidFromOvrPose(poses[i], &locals[i]);
+		}
+		while (state.keepRunning()) {
+			worlds[0] = locals[0];
+			for (size_t i = 1; i < count; ++i) {
+				_rigidMultiply(worlds[i - 1], locals[i], &worlds[i]);
+			}
+			_doNotOptimize(worlds[count - 1]);
+		}
+		state.setItemsPerIteration(count);
+	});
+
+	const MoleculeBounds bounds = { glm::vec3(-2.0f, 0.0f, -2.0f), glm::vec3(2.0f, 2.0f, 2.0f) };
+	auto fillMolecules = [&](MoleculeStore* store, size_t count) {
+		store->setCapacity(count);
+		for (size_t i = 0; i < count; ++i) {
+			const glm::vec3 position(unit(random) * 2.0f, unit(random) + 1.0f, unit(random) * 2.0f);
+			const glm::vec3 velocity = glm::vec3(unit(random), unit(random), unit(random)) * 0.01f;
+			store->add(i & 1 ? MoleculeType::O2 : MoleculeType::CO2, position, velocity, 0.02f, glm::vec3(unit(random), 1.0f, unit(random)));
+		}
+		store->clearEvents();
+	};
+	const size_t moleculeCounts[] = { 1000, 100000 };
+	for (size_t count : moleculeCounts) {
+		benchmarks.add(("molecule_integrate/" + std::to_string(count)).c_str(), [&, count](MicroBenchState& state) {
+			MoleculeStore store;
+			fillMolecules(&store, count);
+			while (state.keepRunning()) {
+				store.integrate(bounds);
+				_doNotOptimize(store.posX[0]);
+			}
+			state.setItemsPerIteration(count);
+		});
+		benchmarks.add(("pick_points/" + std::to_string(count)).c_str(), [&, count](MicroBenchState& state) {
+			MoleculeStore store;
+			fillMolecules(&store, count);
+			const PickRay rays[2] = {
+				_pickRayFromPose(glm::vec3(-0.2f, 1.0f, 0.5f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f)),
+				_pickRayFromPose(glm::vec3(0.2f, 1.0f, 0.5f), glm::normalize(glm::quat(1.0f, 0.0f, 0.1f, 0.0f))),
+			};
+			vector<uint8_t> hits(count);
+			while (state.keepRunning()) {
+				_pickPoints(store.posX.data(), store.posY.data(), store.posZ.data(), store.size(), rays, 2, 0.06f, hits.data());
+				_doNotOptimize(hits[0]);
+			}
+			state.setItemsPerIteration(count);
+		});
+	}
+
+	// The two mesh conversions loading does per vertex: model meshes into PackedVertex, avatar meshes into
+	// AvatarPackedVertex
+	const size_t vertexCount = 65536;
+	benchmarks.add("pack_vertices", [&](MicroBenchState& state) {
+		vector<Vertex> vertices(vertexCount);
+		for (Vertex& v : vertices) {
+			v.Position = glm::vec3(unit(random), unit(random), unit(random)) * 10.0f;
+			v.Normal = glm::normalize(glm::vec3(unit(random), unit(random), unit(random) + 2.0f));
+			v.TexCoords = glm::vec2(unit(random), unit(random)) * 0.5f + 0.5f;
+		}
+		vector<PackedVertex> packed(vertexCount);
+		glm::vec3 scale, bias;
+		while (state.keepRunning()) {
+			_packVertices(vertices.data(), vertexCount, packed.data(), &scale, &bias);
+			_doNotOptimize(packed[vertexCount - 1]);
+		}
+		state.setItemsPerIteration(vertexCount);
+	});
+	benchmarks.add("pack_avatar_vertices", [&](MicroBenchState& state) {
+		vector<ovrAvatarMeshVertex> vertices(vertexCount);
+		for (ovrAvatarMeshVertex& v : vertices) {
+			memset(&v, 0, sizeof(v));
+			v.x = unit(random); v.y = unit(random); v.z = unit(random);
+			v.nx = unit(random); v.ny = unit(random); v.nz = unit(random);
+			v.tx = unit(random); v.ty = unit(random); v.tz = unit(random); v.tw = 1.0f;
+			v.u = unit(random); v.v = unit(random);
+			for (int j = 0; j < 4; ++j) {
+				v.blendIndices[j] = (uint8_t)(random() % OVR_AVATAR_MAXIMUM_JOINT_COUNT);
+				v.blendWeights[j] = 0.25f + 0.1f * unit(random);
+			}
+		}
+		vector<AvatarPackedVertex> packed(vertexCount);
+		while (state.keepRunning()) {
+			_packAvatarVertices(vertices.data(), (uint32_t)vertexCount, packed.data());
+			_doNotOptimize(packed[vertexCount - 1]);
+		}
+		state.setItemsPerIteration(vertexCount);
+	});
+
+	if (!benchmarks.run(filter)) {
+		std::cerr << "ERROR::MICROBENCH::NO_MATCH " << filter << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+// A round played on the job system as a --serve session would, every snapshot coded against what was acknowledged and
+// decoded as a --join client would, every fourth lost on the way, for --check-replication. After each tick the
+// snapshots go on until one has nothing left to send, then every slot the client decoded must be the store's molecule
+// to within half a quantization step. The exit code is the mismatches.
+static int _checkReplication(int ticks) {
+	MoleculeGameConfig config;
+	config.seed = 1234;
+	MoleculeGame game(config, _jobs);
+	MoleculeReplicator replicator;
+	MoleculeReplica replica(MOLECULE_SERVER_TICK_SECONDS);
+	const uint32_t session = 1;
+	replicator.reset();
+	replica.join(session);
+	SceneInput input;
+	input.leftRay = { glm::vec3(-0.2f, 1.2f, 0.5f), glm::vec3(0.0f, 0.0f, -1.0f) };
+	input.rightRay = { glm::vec3(0.2f, 1.2f, 0.5f), glm::vec3(0.0f, 0.0f, -1.0f) };
+	const PickRay rays[2] = { input.leftRay, input.rightRay };
+	SceneFrame frame;
+	vector<QuantizedMolecule> quantized;
+	uint8_t datagram[MOLECULE_REPLICATION_BUDGET_BYTES];
+
+	const MoleculeBounds& bounds = MOLECULE_GAME_BOUNDS;
+	const glm::vec3 positionError = (bounds.max - bounds.min) / (float)((1u << MOLECULE_REPLICATION_POSITION_BITS) - 1) * 0.5f + 1e-5f;
+	// Each of the three sent components is off by up to half a step; the left out one, rebuilt from them, and the
+	// normalize after add a few more
+	const float rotationError = 8.0f * MOLECULE_REPLICATION_ROTATION_RANGE / (float)((1u << MOLECULE_REPLICATION_ROTATION_BITS) - 1);
+
+	uint32_t tick = 0;
+	uint32_t snapshots = 0, lost = 0, mismatches = 0;
+	size_t bytes = 0;
+	for (int t = 0; t < ticks; t++) {
+		input.time = t * MOLECULE_SERVER_TICK_SECONDS;
+		game.step(input, frame);
+		_quantizeMolecules(game.moleculeStore(), &quantized);
+		bool drained = false;
+		for (int attempt = 0; attempt < 64 && !drained; attempt++) {
+			const size_t length = replicator.encode(quantized, frame, session, ++tick, rays, datagram);
+			MoleculeSnapshotHeader header;
+			memcpy(&header, datagram, sizeof(header));
+			snapshots++;
+			bytes += length;
+			if (tick % 4 == 0) {
+				lost++;
+				continue;
+			}
+			if (!replica.receive(datagram, length)) {
+				printf("ERROR::REPLICATION::REJECTED tick %u baseline %u\n", tick, header.baseline);
+				mismatches++;
+				continue;
+			}
+			replicator.acknowledge(replica.acknowledged());
+			drained = header.recordCount == 0;
+		}
+		if (!drained) {
+			printf("ERROR::REPLICATION::NOT_DRAINED tick %d\n", t);
+			mismatches++;
+			continue;
+		}
+
+		const MoleculeStore& store = game.moleculeStore();
+		const vector<QuantizedMolecule>& decoded = *replica.newestMolecules();
+		if (decoded.size() != store.capacity()) {
+			printf("ERROR::REPLICATION::SLOT_COUNT %zu of %zu\n", decoded.size(), store.capacity());
+			mismatches++;
+			continue;
+		}
+		vector<bool> occupied(store.capacity(), false);
+		for (size_t i = 0; i < store.size(); i++) {
+			const uint32_t slot = store.handle(i).slot;
+			occupied[slot] = true;
+			const QuantizedMolecule& molecule = decoded[slot];
+			const glm::vec3 position(store.posX[i], store.posY[i], store.posZ[i]);
+			const glm::quat rotation(store.rotW[i], store.rotX[i], store.rotY[i], store.rotZ[i]);
+			glm::quat received = _dequantizeRotation(molecule.largest, molecule.rotation);
+			if (molecule.present && glm::dot(received, rotation) < 0.0f) {
+				received = -received;
+			}
+			const glm::vec3 offset = glm::abs(_dequantizePosition(molecule.position) - glm::clamp(position, bounds.min, bounds.max));
+			if (!molecule.present || molecule.type != store.type[i] || glm::any(glm::greaterThan(offset, positionError))
+				|| glm::length(glm::vec4(received.x - rotation.x, received.y - rotation.y, received.z - rotation.z, received.w - rotation.w)) > rotationError) {
+				if (mismatches < 16) {
+					printf("ERROR::REPLICATION::MISMATCH tick %d slot %u\n", t, slot);
+				}
+				mismatches++;
+			}
+		}
+		for (size_t slot = 0; slot < decoded.size(); slot++) {
+			if (decoded[slot].present && !occupied[slot]) {
+				if (mismatches < 16) {
+					printf("ERROR::REPLICATION::STALE tick %d slot %zu\n", t, slot);
+				}
+				mismatches++;
+			}
+		}
+	}
+
+	// Another session's snapshot is not the client's to take
+	const size_t length = replicator.encode(quantized, frame, session + 1, ++tick, rays, datagram);
+	if (replica.receive(datagram, length)) {
+		printf("ERROR::REPLICATION::OTHER_SESSION\n");
+		mismatches++;
+	}
+
+	printf("Replication: %d ticks, %u snapshots (%u lost), %.0f bytes a snapshot, %u mismatches\n",
+		ticks, snapshots, lost, snapshots ? (double)bytes / snapshots : 0.0, mismatches);
+	return (int)std::min(mismatches, 255u);
+}
+
+// Draws a --capture-gl file frames times on a hidden window of its own, no headset, runtime or assets involved, and
+// reports what the GPU took per frame. The profile goes to replay_profile.csv by pass and eye, so runs on two drivers
+// or two GPUs compare like for like.
+static int _replayGlCapture(const char path[], int frames) {
+	if (!glfwInit()) {
+		std::cerr << "ERROR::GL_REPLAY::NO_GLFW" << std::endl;
+		return -1;
+	}
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, _glDebugContext);
+	GLFWwindow * window = glfwCreateWindow(64, 64, "replay", nullptr, nullptr);
+	if (!window) {
+		std::cerr << "ERROR::GL_REPLAY::NO_CONTEXT" << std::endl;
+		glfwTerminate();
+		return -1;
+	}
+	glfwMakeContextCurrent(window);
+	glewExperimental = GL_TRUE;
+	glewInit();
+	glGetError();
+	_glDebug.init(_glDebugVerbose, _glDebugSynchronous);
+
+	int result = -1;
+	GLReplay replay;
+	FrameProfiler profiler;
+	if (replay.load(path)) {
+		replay.addPhases(profiler);
+		const int drawCounter = profiler.addCounter("draws");
+		profiler.init("replay_profile.csv");
+		printf("Replaying %u commands captured on %s\r\n", (uint32_t)replay.commandCount(), replay.renderer().c_str());
+		printf("Replay renderer %s, %s\r\n", (const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION));
+		double total = 0.0;
+		float fastest = 0.0f, slowest = 0.0f;
+		int resolved = 0;
+		uint64_t lastResolved = 0;
+		for (int i = 1; i <= frames + PROFILER_LATENCY; i++) {
+			profiler.beginFrame((uint64_t)i);
+			if (i <= frames) {
+				profiler.count(drawCounter, replay.frame(profiler));
+			}
+			profiler.endFrame();
+			// Nothing is presented, so this is what keeps the driver from queueing frames without bound
+			glFinish();
+			if (profiler.resolvedFrame() != lastResolved) {
+				lastResolved = profiler.resolvedFrame();
+				const float gpuMs = profiler.gpuFrameMs();
+				total += gpuMs;
+				fastest = resolved ? std::min(fastest, gpuMs) : gpuMs;
+				slowest = std::max(slowest, gpuMs);
+				resolved++;
+			}
+		}
+		if (resolved) {
+			printf("GPU frame %.3f ms mean, %.3f min, %.3f max over %d frames\r\n", total / resolved, fastest, slowest, resolved);
+		}
+		replay.release();
+		result = 0;
+	}
+	_glDebug.shutdown();
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return result;
+}
+
+// Asks the platform whether the logged in user may run the app and waits for the answer. Platform messages have no
+// other reader, anything else popped meanwhile is dropped.
+static bool _checkEntitlement() {
+	ovr_Entitlement_GetIsViewerEntitled();
+	while (!_startup.stopping()) {
+		ovrMessageHandle message = ovr_PopMessage();
+		if (!message) {
+			Sleep(10);
+			continue;
+		}
+		const bool answer = ovr_Message_GetType(message) == ovrMessage_Entitlement_GetIsViewerEntitled;
+		const bool entitled = answer && !ovr_Message_IsError(message);
+		ovr_FreeMessage(message);
+		if (answer) {
+			if (!entitled) {
+				std::cout << "ERROR::STARTUP::NOT_ENTITLED" << std::endl;
+			}
+			return entitled;
+		}
+	}
+	return false;
+}
+
+// Execute our example class
+int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
+	int result = -1;
+	TRACE_INIT();
+	// Session time starts here, see timing.h
+	_sessionSeconds();
+	// Scheduling first, every thread started from here on applies it, see threading.h.
+	// --mmcss games|audio|off picks the MMCSS task the render thread joins, Games by default
+	if (const char * mmcss = strstr(lpCmdLine, "--mmcss ")) {
+		if (!strncmp(mmcss, "--mmcss off", 11)) {
+			_threadPolicy.config().mmcss = MmcssTask::Off;
+		}
+		else if (!strncmp(mmcss, "--mmcss audio", 13)) {
+			_threadPolicy.config().mmcss = MmcssTask::ProAudio;
+		}
+	}
+	// Lays the render, simulation and input threads out on cores of their own
+	if (strstr(lpCmdLine, "--pin-threads")) {
+		_threadPolicy.pinDefault();
+	}
+	// --affinity-<role> <hex mask> pins one role's threads, over what --pin-threads chose for it
+	for (int role = 0; role < (int)ThreadRole::Count; ++role) {
+		char option[32];
+		sprintf(option, "--affinity-%s", _threadRoleNames[role]);
+		if (const char * affinity = strstr(lpCmdLine, option)) {
+			unsigned long long mask;
+			if (sscanf(affinity + strlen(option), " %llx", &mask) == 1) {
+				_threadPolicy.config().affinity[role] = mask;
+			}
+		}
+	}
+	// The sink's writer is a background thread, so after the scheduling
+	{
+		char telemetryPath[MAX_PATH] = "";
+		char telemetryEndpoint[64] = "";
+		if (const char * file = strstr(lpCmdLine, "--telemetry-file")) {
+			if (sscanf(file, "--telemetry-file %259s", telemetryPath) != 1) {
+				telemetryPath[0] = 0;
+			}
+		}
+		if (const char * udp = strstr(lpCmdLine, "--telemetry-udp")) {
+			if (sscanf(udp, "--telemetry-udp %63s", telemetryEndpoint) != 1) {
+				telemetryEndpoint[0] = 0;
+			}
+		}
+		if ((telemetryPath[0] || telemetryEndpoint[0]) && !_telemetrySink.open(telemetryPath, telemetryEndpoint)) {
+			std::cout << "ERROR::TELEMETRY_SINK::NOT_OPENED" << std::endl;
+		}
+	}
+	// --fleet-stats keeps hourly histograms of the frame times, drops, asset loads and startup in the fleet spool,
+	// --fleet-upload <address:port[/path]> also POSTs them there; --fleet-id <name> names the installation, by
+	// default the computer's name. See fleetstats.h.
+	{
+		char fleetEndpoint[192] = "";
+		if (const char * upload = strstr(lpCmdLine, "--fleet-upload")) {
+			if (sscanf(upload, "--fleet-upload %191s", fleetEndpoint) != 1) {
+				fleetEndpoint[0] = 0;
+			}
+		}
+		if (fleetEndpoint[0] || strstr(lpCmdLine, "--fleet-stats")) {
+			char installation[MAX_COMPUTERNAME_LENGTH + 1] = "unnamed";
+			DWORD length = sizeof(installation);
+			GetComputerNameA(installation, &length);
+			char fleetId[64];
+			const char * id = strstr(lpCmdLine, "--fleet-id");
+			if (id && sscanf(id, "--fleet-id %63s", fleetId) == 1) {
+				snprintf(installation, sizeof(installation), "%s", fleetId);
+			}
+			if (_fleetStats.open(installation, BENCH_BUILD_ID, fleetEndpoint)) {
+				_assets.subscribeLoads([](float ms) {
+					_fleetStats.assetLoaded(ms);
+				});
+			}
+			else {
+				std::cout << "ERROR::FLEET::NOT_OPENED" << std::endl;
+			}
+		}
+	}
+	// Workers take jobs in the order they came, without the frame's going before the loader's
+	if (strstr(lpCmdLine, "--no-job-priorities")) {
+		_jobs.setPrioritized(false);
+	}
+	// Every level of a compressed texture uploaded when it loads, see TextureCache
+	if (strstr(lpCmdLine, "--no-texture-streaming")) {
+		_textures.setStreaming(false);
+	}
+	// Breaks into the debugger at any allocation the render loop makes where it mustn't
+	if (strstr(lpCmdLine, "--break-on-critical-alloc")) {
+		_allocationBreakOnCritical = true;
+	}
+	// Kiosks close the app on a viewer the entitlement check turns down, by default it is only logged
+	if (strstr(lpCmdLine, "--require-entitlement")) {
+		_requireEntitlement = true;
+	}
+	// A context without the debug bit, for measuring what the driver's validation costs
+	if (strstr(lpCmdLine, "--no-gl-debug")) {
+		_glDebugContext = false;
+	}
+	// Driver notifications and low severity messages too, which are mostly about buffer placement
+	if (strstr(lpCmdLine, "--gl-debug-verbose")) {
+		_glDebugVerbose = true;
+	}
+	// Delivers each GL message on the call that caused it, so a breakpoint in the callback shows the stack
+	if (strstr(lpCmdLine, "--gl-debug-sync")) {
+		_glDebugSynchronous = true;
+	}
+	// Steps the game on the render thread, for debugging the simulation without the pipeline in the way
+	if (strstr(lpCmdLine, "--serial-simulation")) {
+		_pipelinedSimulation = false;
+	}
+	// Simulates the --bench-suite stress scenes in compute shaders
+	if (strstr(lpCmdLine, "--gpu-molecules")) {
+		_gpuMolecules = true;
+	}
+	// Measures the GPU again rather than trusting gpu_calibration.txt, or leaves the startup preset at its best
+	if (strstr(lpCmdLine, "--recalibrate")) {
+		_gpuCalibration.setForced(true);
+	}
+	if (strstr(lpCmdLine, "--no-calibration")) {
+		_gpuCalibration.setEnabled(false);
+	}
+	// Holds every knob of the quality governor at its best, whatever the GPU time
+	if (strstr(lpCmdLine, "--no-quality-governor")) {
+		_qualityGovernor.setEnabled(false);
+	}
+	// Every avatar posed each frame and shaded in full however far off it is
+	if (strstr(lpCmdLine, "--no-avatar-lod")) {
+		_avatarLod.setEnabled(false);
+	}
+	// Waits for every avatar asset to come from the SDK, neither reading nor writing the avatar cache
+	if (strstr(lpCmdLine, "--no-avatar-cache")) {
+		_avatarCacheEnabled = false;
+	}
+	// Binds the avatar texture arrays per draw even where bindless textures are supported
+	if (strstr(lpCmdLine, "--no-bindless")) {
+		_bindlessAllowed = false;
+	}
+	// --capture-gl <file> [--capture-frame <n>] writes what that frame draws for --replay-gl, see glcapture.h. Bindless
+	// handles mean nothing to another context, so the avatars bind their arrays for it.
+	if (const char * capture = strstr(lpCmdLine, "--capture-gl")) {
+		char path[MAX_PATH];
+		int captureFrame = GL_CAPTURE_DEFAULT_FRAME;
+		if (const char * at = strstr(lpCmdLine, "--capture-frame")) {
+			sscanf(at, "--capture-frame %d", &captureFrame);
+		}
+		if (sscanf(capture, "--capture-gl %259s", path) == 1 && captureFrame > 0) {
+			_glCapture.request(path, (uint64_t)captureFrame);
+			_bindlessAllowed = false;
+		}
+	}
+	// --avatar-parts hands|head|full: only the hands, the hands and the body with its head, or those and the base too
+	if (const char * parts = strstr(lpCmdLine, "--avatar-parts ")) {
+		if (!strncmp(parts, "--avatar-parts hands", 20)) {
+			_avatarCapabilities = ovrAvatarCapability_Hands;
+		}
+		else if (!strncmp(parts, "--avatar-parts head", 19)) {
+			_avatarCapabilities = (ovrAvatarCapabilities)(ovrAvatarCapability_Body | ovrAvatarCapability_Hands);
+		}
+	}
+	// Captures the microphone for the avatar's voice visualization
+	if (strstr(lpCmdLine, "--voice")) {
+		_voiceEnabled = true;
+		_avatarCapabilities = (ovrAvatarCapabilities)(_avatarCapabilities | ovrAvatarCapability_Voice);
+	}
+	// Skins the avatars in every draw's vertex shader instead of once per frame up front
+	if (strstr(lpCmdLine, "--no-preskin")) {
+		_preskinAllowed = false;
+	}
+	// Keeps drawing with the HMD off or the app hidden
+	if (strstr(lpCmdLine, "--no-idle")) {
+		_sessionIdleAllowed = false;
+	}
+	// Sorts the avatars' translucent parts back to front instead of weighted blended OIT
+	if (strstr(lpCmdLine, "--no-oit")) {
+		_weightedOit = false;
+	}
+	// Shades every program at 32 bits even where the driver has 16 bit floats
+	if (strstr(lpCmdLine, "--no-half-precision")) {
+		_halfPrecisionAllowed = false;
+	}
+	// Diffs the 16 bit lighting against the 32 bit at startup, see HalfPrecisionCheck
+	if (strstr(lpCmdLine, "--half-precision-check")) {
+		_halfPrecisionCheck = true;
+	}
+	if (const char * factory = strstr(lpCmdLine, "--factory-model")) {
+		char path[MAX_PATH];
+		if (sscanf(factory, "--factory-model %259s", path) == 1) {
+			_factoryModelPath = path;
+		}
+	}
+	if (const char * world = strstr(lpCmdLine, "--world ")) {
+		char path[MAX_PATH];
+		if (sscanf(world, "--world %259s", path) == 1) {
+			_worldManifest = path;
+		}
+	}
+	if (const char * budget = strstr(lpCmdLine, "--world-budget")) {
+		sscanf(budget, "--world-budget %d", &_worldBudgetMb);
+	}
+	// A facility scan too large for memory, paged in as the factory shows it
+	if (const char * scan = strstr(lpCmdLine, "--virtual-texture")) {
+		char path[MAX_PATH];
+		if (sscanf(scan, "--virtual-texture %259s", path) == 1) {
+			_factoryVirtualTexture = path;
+		}
+	}
+	if (strstr(lpCmdLine, "--no-repeat-instancing")) {
+		_factoryRepeats = RepeatedMeshes::Separate;
+	}
+	// Loads .obj models with the native parser instead of Assimp
+	if (strstr(lpCmdLine, "--native-obj")) {
+		_nativeObjImport = true;
+	}
+	// Molecules passing through each other, as before they collided
+	if (strstr(lpCmdLine, "--no-collisions")) {
+		_moleculeCollisions = false;
+	}
+	// Meshes for the molecules however far away, for comparing against the billboards
+	if (strstr(lpCmdLine, "--no-billboards")) {
+		_moleculeBillboards = false;
+	}
+	// The scene light lighting everything, nothing shadowed
+	if (strstr(lpCmdLine, "--no-shadows")) {
+		_shadowMaps = false;
+	}
+	// The factory lit per fragment like the molecules, for comparing against its bake
+	if (strstr(lpCmdLine, "--no-light-bake")) {
+		_factoryLightBake = false;
+	}
+	// Whole batch parts for the factory, culled mesh by mesh on the CPU only
+	if (strstr(lpCmdLine, "--no-meshlets")) {
+		_meshletCulling = false;
+	}
+	// Avatar components drawn whether or not last frame's queries saw them. Not --no-occlusion-queries, which
+	// strstr would also take for the molecules' --no-occlusion.
+	if (strstr(lpCmdLine, "--no-avatar-queries")) {
+		_avatarOcclusionQueries = false;
+	}
+	// Avatar projectors drawn again over their part rather than folded into its draw
+	if (strstr(lpCmdLine, "--no-decal-fold")) {
+		_foldAvatarDecals = false;
+	}
+	// No sparks where molecules convert
+	if (strstr(lpCmdLine, "--no-particles")) {
+		_conversionParticles = false;
+	}
+	// Both molecule types' meshes from one buffer, see MoleculeArena
+	if (strstr(lpCmdLine, "--molecule-pulling")) {
+		_moleculePulling = true;
+	}
+	// Atom spheres for the CPU simulated molecules, see SphereImpostors
+	if (strstr(lpCmdLine, "--impostors")) {
+		_moleculeImpostors = true;
+	}
+	// Culls the GPU molecules by the frustum alone, for measuring what the Hi-Z pass saves
+	if (strstr(lpCmdLine, "--no-occlusion")) {
+		_occlusionCulling = false;
+	}
+	// Always or never lay the scene's depth down before shading it, instead of deciding by the GPU time
+	if (strstr(lpCmdLine, "--depth-prepass")) {
+		_depthPrepassMode = DepthPrepassMode::On;
+	}
+	if (strstr(lpCmdLine, "--no-depth-prepass")) {
+		_depthPrepassMode = DepthPrepassMode::Off;
+	}
+	// Shades the whole eye viewports, the parts outside the lenses included
+	if (strstr(lpCmdLine, "--no-hidden-area")) {
+		_hiddenAreaMask = false;
+	}
+	if (strstr(lpCmdLine, "--multi-gpu")) {
+		_multiGpuAllowed = true;
+	}
+	if (strstr(lpCmdLine, "--no-shading-rate")) {
+		_shadingRateAllowed = false;
+	}
+	// The factory at half rate in a layer of its own, the compositor reprojecting it on the frames between
+	if (strstr(lpCmdLine, "--split-rate")) {
+		_splitRateAllowed = true;
+	}
+	// The eyes below full size, reconstructed to it from the jittered frames before
+	if (strstr(lpCmdLine, "--temporal-upscale")) {
+		_temporalUpscaleAllowed = true;
+	}
+	// 16 bit depth the conventional way round, for comparing against reversed-Z
+	if (strstr(lpCmdLine, "--standard-depth")) {
+		_reversedDepth = false;
+	}
+	// --eye-format srgb8|r11g11b10f picks the eye buffers' colour format
+	if (const char * format = strstr(lpCmdLine, "--eye-format ")) {
+		if (!strncmp(format, "--eye-format r11g11b10f", 23)) {
+			_eyeBufferFormat = EyeBufferFormat::R11G11B10F;
+		}
+		else if (strncmp(format, "--eye-format srgb8", 18)) {
+			printf("ERROR::MAIN::UNKNOWN_EYE_FORMAT, the eyes stay sRGB8\n");
+		}
+	}
+	// --msaa <samples>, the most the quality controller may use
+	if (const char * msaa = strstr(lpCmdLine, "--msaa")) {
+		if (sscanf(msaa, "--msaa %d", &_msaaMaxSamples) != 1 || _msaaMaxSamples < 1) {
+			_msaaMaxSamples = 1;
+		}
+	}
+	// --mirror off|eye|compositor picks what the desktop window shows
+	if (const char * mirror = strstr(lpCmdLine, "--mirror ")) {
+		if (!strncmp(mirror, "--mirror off", 12)) {
+			_mirrorMode = MirrorMode::Off;
+		}
+		else if (!strncmp(mirror, "--mirror eye", 12)) {
+			_mirrorMode = MirrorMode::Eye;
+		}
+		else if (!strncmp(mirror, "--mirror spectator", 18)) {
+			_mirrorMode = MirrorMode::Spectator;
+			_mirrorHz = SPECTATOR_DEFAULT_HZ;
+		}
+	}
+	if (const char * scale = strstr(lpCmdLine, "--spectator-scale")) {
+		if (sscanf(scale, "--spectator-scale %f", &_spectatorScale) != 1 || _spectatorScale <= 0.0f || _spectatorScale > 1.0f) {
+			_spectatorScale = 0.5f;
+		}
+	}
+	// --record-session <file.mp4> records what the window shows, and the profiler's frame times next to it
+	if (const char * record = strstr(lpCmdLine, "--record-session")) {
+		if (sscanf(record, "--record-session %259s", _sessionRecordPath) != 1) {
+			_sessionRecordPath[0] = 0;
+		}
+	}
+	if (const char * hitch = strstr(lpCmdLine, "--hitch-budget")) {
+		if (sscanf(hitch, "--hitch-budget %lf", &_hitchBudgetMs) != 1 || _hitchBudgetMs < 0.0) {
+			_hitchBudgetMs = -1.0;
+		}
+	}
+	if (strstr(lpCmdLine, "--latency-test")) {
+		_latencyTestEnabled = true;
+	}
+	if (const char * photodiode = strstr(lpCmdLine, "--latency-photodiode")) {
+		if (sscanf(photodiode, "--latency-photodiode %31s", _latencyPhotodiodePort) == 1) {
+			_latencyTestEnabled = true;
+		}
+		else {
+			_latencyPhotodiodePort[0] = 0;
+		}
+	}
+	if (const char * every = strstr(lpCmdLine, "--mirror-every")) {
+		if (sscanf(every, "--mirror-every %d", &_mirrorEvery) != 1 || _mirrorEvery < 1) {
+			_mirrorEvery = 1;
+		}
+	}
+	if (const char * hz = strstr(lpCmdLine, "--mirror-hz")) {
+		if (sscanf(hz, "--mirror-hz %f", &_mirrorHz) != 1 || _mirrorHz < 0.0f) {
+			_mirrorHz = 0.0f;
+		}
+	}
+	// --record-trace <trace> and --replay-trace <trace>, see posetrace.h. The simulation steps inline with either, so
+	// it sees every frame's input, where the pipeline could skip one when it falls behind.
+	if (const char * record = strstr(lpCmdLine, "--record-trace")) {
+		char path[MAX_PATH];
+		if (sscanf(record, "--record-trace %259s", path) == 1 && _poseTrace.record(path)) {
+			_pipelinedSimulation = false;
+		}
+	}
+	else if (const char * replay = strstr(lpCmdLine, "--replay-trace")) {
+		char path[MAX_PATH];
+		if (sscanf(replay, "--replay-trace %259s", path) == 1 && _poseTrace.replay(path)) {
+			_pipelinedSimulation = false;
+		}
+	}
+	// --record-avatar <log> and --play-avatar <log>, see avatarpackets.h
+	if (const char * record = strstr(lpCmdLine, "--record-avatar")) {
+		char path[MAX_PATH];
+		if (sscanf(record, "--record-avatar %259s", path) == 1) {
+			_avatarRecorder.open(path);
+		}
+	}
+	if (const char * play = strstr(lpCmdLine, "--play-avatar")) {
+		char path[MAX_PATH];
+		if (sscanf(play, "--play-avatar %259s", path) == 1) {
+			_avatarPlaybackPath = path;
+		}
+	}
+	// --net-port <port> [--net-peer <ip:port>]..., every peer is sent our avatar and shows up as a remote one
+	if (const char * port = strstr(lpCmdLine, "--net-port")) {
+		if (sscanf(port, "--net-port %d", &_netPort) != 1 || _netPort <= 0 || _netPort > 65535) {
+			_netPort = AVATAR_NET_DEFAULT_PORT;
+		}
+	}
+	for (const char * peer = strstr(lpCmdLine, "--net-peer"); peer; peer = strstr(peer + 1, "--net-peer")) {
+		char host[64];
+		int peerPort = AVATAR_NET_DEFAULT_PORT;
+		if (sscanf(peer, "--net-peer %63[^: ]:%d", host, &peerPort) >= 1) {
+			_netPeers.push_back(std::make_pair(std::string(host), peerPort));
+		}
+	}
+	if (const char * budget = strstr(lpCmdLine, "--avatar-budget")) {
+		if (sscanf(budget, "--avatar-budget %f", &_avatarBudgetMs) != 1 || _avatarBudgetMs <= 0.0f) {
+			_avatarBudgetMs = 2.0f;
+		}
+	}
+	if (const char * reflection = strstr(lpCmdLine, "--reflection-size")) {
+		if (sscanf(reflection, "--reflection-size %d", &_reflectionSize) != 1 || _reflectionSize < 0) {
+			_reflectionSize = 0;
+		}
+	}
+	// --texture-budget <MB> and --mesh-budget <MB> bound what each may hold before unused ones are evicted, 0 for
+	// no bound. --vram-reserve <MB> is what the driver should keep free, where it can tell.
+	if (const char * budget = strstr(lpCmdLine, "--texture-budget")) {
+		int megabytes;
+		if (sscanf(budget, "--texture-budget %d", &megabytes) == 1 && megabytes >= 0) {
+			_gpuMemory.setBudget(GpuMemoryCategory::Textures, (int64_t)megabytes << 20);
+		}
+	}
+	if (const char * budget = strstr(lpCmdLine, "--mesh-budget")) {
+		int megabytes;
+		if (sscanf(budget, "--mesh-budget %d", &megabytes) == 1 && megabytes >= 0) {
+			_gpuMemory.setBudget(GpuMemoryCategory::Meshes, (int64_t)megabytes << 20);
+		}
+	}
+	if (const char * reserve = strstr(lpCmdLine, "--vram-reserve")) {
+		int megabytes;
+		if (sscanf(reserve, "--vram-reserve %d", &megabytes) == 1 && megabytes >= 0) {
+			_gpuMemory.setReserve((int64_t)megabytes << 20);
+		}
+	}
+	// --bench <frames> [--bench-out <report.json>] times that many frames against a scripted headset, no HMD needed.
+	// --bench-suite <frames> times that many for each run of the stress sweep instead. The finished report is kept
+	// in --bench-history <dir> as well, bench_history by default.
+	const char * bench = strstr(lpCmdLine, "--bench ");
+	const char * suite = strstr(lpCmdLine, "--bench-suite");
+	if (bench || suite) {
+		int frames = 0;
+		char report[MAX_PATH] = "bench.json";
+		char history[MAX_PATH] = BENCH_HISTORY_DIRECTORY;
+		if (const char * out = strstr(lpCmdLine, "--bench-out")) {
+			sscanf(out, "--bench-out %259s", report);
+		}
+		if (const char * kept = strstr(lpCmdLine, "--bench-history")) {
+			sscanf(kept, "--bench-history %259s", history);
+		}
+		if ((suite ? sscanf(suite, "--bench-suite %d", &frames) : sscanf(bench, "--bench %d", &frames)) == 1 && frames > 0) {
+			_benchHmd.init(frames, report, suite != nullptr, lpCmdLine, history);
+			_mirrorMode = MirrorMode::Off;
+		}
+	}
+	// --remote [port] [--remote-bitrate <mbps>] renders for a standalone headset on the network instead of the Rift,
+	// see remotehmd.h. There is no compositor to mirror, the window shows the eye instead.
+	const char * remote = strstr(lpCmdLine, "--remote");
+	while (remote && remote[8] == '-') {
+		remote = strstr(remote + 8, "--remote");
+	}
+	if (remote && !_benchHmd.active()) {
+		int port = REMOTE_DEFAULT_PORT;
+		int mbps = REMOTE_DEFAULT_MBPS;
+		sscanf(remote, "--remote %d", &port);
+		if (const char * bitrate = strstr(lpCmdLine, "--remote-bitrate")) {
+			sscanf(bitrate, "--remote-bitrate %d", &mbps);
+		}
+		if (port <= 0 || port > 65535 || mbps <= 0) {
+			std::cerr << "usage: --remote [port] [--remote-bitrate <mbps>]" << std::endl;
+			return -1;
+		}
+		if (!_remoteHmd.open((uint16_t)port, (uint32_t)mbps)) {
+			return -1;
+		}
+		if (_mirrorMode == MirrorMode::Compositor) {
+			_mirrorMode = MirrorMode::Eye;
+		}
+	}
+	// --replay-gl <file> [--replay-frames <n>] draws a --capture-gl file over and over without the headset
+	if (const char * replay = strstr(lpCmdLine, "--replay-gl")) {
+		char path[MAX_PATH];
+		int frames = 500;
+		if (const char * count = strstr(lpCmdLine, "--replay-frames")) {
+			sscanf(count, "--replay-frames %d", &frames);
+		}
+		if (sscanf(replay, "--replay-gl %259s", path) != 1 || frames <= 0) {
+			std::cerr << "usage: --replay-gl <file> [--replay-frames <n>]" << std::endl;
+			return -1;
+		}
+		return _replayGlCapture(path, frames);
+	}
+	// --bench-compare <report.json> [<baseline.json | dir>] compares a report's runs against a baseline's, by
+	// default the newest report from the same GPU and driver in the bench history. Exits with 1 if any regressed.
+	if (const char * compare = strstr(lpCmdLine, "--bench-compare")) {
+		char currentPath[MAX_PATH], baselinePath[MAX_PATH] = BENCH_HISTORY_DIRECTORY;
+		if (sscanf(compare, "--bench-compare %259s %259s", currentPath, baselinePath) < 1) {
+			std::cerr << "usage: --bench-compare <report.json> [<baseline.json | dir>]" << std::endl;
+			return -1;
+		}
+		BenchReport current, baseline;
+		if (!_loadBenchReport(currentPath, &current)) {
+			return -1;
+		}
+		const DWORD attributes = GetFileAttributesA(baselinePath);
+		const bool directory = attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+		if (directory ? !_findBenchBaseline(baselinePath, current, &baseline) : !_loadBenchReport(baselinePath, &baseline)) {
+			return -1;
+		}
+		_jobs.init();
+		const int regressions = _compareBenchReports(_jobs, baseline, current);
+		_jobs.shutdown();
+		return regressions > 0 ? 1 : 0;
+	}
+	// --fleet-merge <dir> merges the fleet summaries collected in dir and prints the fleet's percentiles
+	if (const char * merge = strstr(lpCmdLine, "--fleet-merge")) {
+		char directory[MAX_PATH];
+		if (sscanf(merge, "--fleet-merge %259s", directory) != 1) {
+			std::cerr << "usage: --fleet-merge <dir>" << std::endl;
+			return -1;
+		}
+		return _mergeFleetSummaries(directory) ? 0 : -1;
+	}
+	// --microbench [filter] times the engine's hot paths one by one, only those whose name contains filter if given
+	if (const char * micro = strstr(lpCmdLine, "--microbench")) {
+		char filter[128] = "";
+		sscanf(micro, "--microbench %127s", filter);
+		if (filter[0] == '-') {
+			filter[0] = '\0';
+		}
+		return _runMicroBenchmarks(filter);
+	}
+	// --check-replication [ticks] plays a round through the snapshot coding and back and compares what a client would
+	// decode with the molecules, see _checkReplication()
+	if (const char * check = strstr(lpCmdLine, "--check-replication")) {
+		int ticks = 600;
+		sscanf(check, "--check-replication %d", &ticks);
+		_jobs.init();
+		const int mismatches = _checkReplication(std::max(ticks, 1));
+		_jobs.shutdown();
+		return mismatches;
+	}
+	// --serve [port] hosts rounds of the game for remote players on the job system, with no headset, window or GL,
+	// see moleculeserver.h
+	if (const char * serve = strstr(lpCmdLine, "--serve")) {
+		int port = MOLECULE_SERVER_DEFAULT_PORT;
+		sscanf(serve, "--serve %d", &port);
+		_jobs.init();
+		MoleculeServer server(_jobs);
+		const bool opened = server.open((uint16_t)port);
+		if (opened) {
+			server.run();
+		}
+		_jobs.shutdown();
+		return opened ? 0 : -1;
+	}
+	// --join <host> [port] [--join-session <n>] plays a --serve server's round instead of simulating one here; clients
+	// of the same session play the same round
+	if (const char * join = strstr(lpCmdLine, "--join ")) {
+		char host[256];
+		int port = MOLECULE_SERVER_DEFAULT_PORT;
+		unsigned session = 0;
+		if (sscanf(join, "--join %255s %d", host, &port) < 1 || host[0] == '-' || port <= 0 || port > 65535) {
+			std::cerr << "usage: --join <host> [port] [--join-session <n>]" << std::endl;
+			return -1;
+		}
+		if (const char * id = strstr(lpCmdLine, "--join-session")) {
+			sscanf(id, "--join-session %u", &session);
+		}
+		if (!_moleculeClient.open(host, (uint16_t)port, session)) {
+			return -1;
+		}
+	}
+	if (strstr(lpCmdLine, "--bench-skinning")) {
+		_benchmarkSkinning(100000);
+		return 0;
+	}
+	// --compress-texture <image> <out.dds> [bc3] prebuilds what TextureCache loads instead of the image
+	if (const char * compress = strstr(lpCmdLine, "--compress-texture")) {
+		char input[MAX_PATH], output[MAX_PATH];
+		if (sscanf(compress, "--compress-texture %259s %259s", input, output) != 2) {
+			std::cerr << "usage: --compress-texture <image> <out.dds> [bc3]" << std::endl;
+			return -1;
+		}
+		_jobs.init();
+		bool compressed = _compressImageFile(input, output, strstr(compress, " bc3") != nullptr);
+		_jobs.shutdown();
+		return compressed ? 0 : -1;
+	}
+	// --partition-world <model.obj> <cell size> <directory> splits a facility along the floor into cells for --world,
+	// each with a proxy, in the model's units
+	if (const char * partition = strstr(lpCmdLine, "--partition-world")) {
+		char input[MAX_PATH], output[MAX_PATH];
+		float cellSize = 0.0f;
+		if (sscanf(partition, "--partition-world %259s %f %259s", input, &cellSize, output) != 3) {
+			std::cerr << "usage: --partition-world <model.obj> <cell size> <directory>" << std::endl;
+			return -1;
+		}
+		_jobs.init();
+		const bool partitioned = _partitionWorld(input, cellSize, output);
+		_jobs.shutdown();
+		return partitioned ? 0 : -1;
+	}
+	// --pack-assets <out.pack> <file>... bakes files into a pack, each under its path as the app asks for it: models
+	// as their .meshcache (written by any earlier run) or the files Assimp reads them from, shader sources, and
+	// .dds/.ktx textures
+	if (const char * pack = strstr(lpCmdLine, "--pack-assets")) {
+		std::istringstream args(pack + strlen("--pack-assets"));
+		std::string output, path;
+		std::vector<std::string> inputs;
+		args >> output;
+		while (args >> path) {
+			inputs.push_back(path);
+		}
+		if (output.empty() || inputs.empty()) {
+			std::cerr << "usage: --pack-assets <out.pack> <file>..." << std::endl;
+			return -1;
+		}
+		return _writeAssetPack(output, inputs) ? 0 : -1;
+	}
+	// Assets come out of assets.pack beside the executable if there is one, --no-pack reads only the loose files.
+	// The pack opens alongside the rest of startup, the first shader compiled waits for it.
+	const bool usePack = !strstr(lpCmdLine, "--no-pack");
+	_startupPack = _startup.add("asset pack", [usePack] {
+		if (usePack) {
+			_assetPack.open(ExePath() + "assets.pack");
+		}
+		return true;
+	});
+	// --bench-obj <file.obj> times Assimp against the native OBJ parser on the same file
+	if (const char * obj = strstr(lpCmdLine, "--bench-obj")) {
+		char path[MAX_PATH];
+		if (sscanf(obj, "--bench-obj %259s", path) != 1) {
+			std::cerr << "usage: --bench-obj <file.obj>" << std::endl;
+			return -1;
+		}
+		_startup.wait(_startupPack);
+		_jobs.init();
+		_benchmarkObjImport(path);
+		_jobs.shutdown();
+		return 0;
+	}
+	try {
+		// The platform and the entitlement check come up beside the runtime, the HMD session and the window, the app
+		// only looks at how they went once its first frame is out
+		_startupPlatform = _startup.add("platform", [] {
+			return ovr_PlatformInitializeWindows(MIRROR_SAMPLE_APP_ID) == ovrPlatformInitialize_Success;
+		});
+		_startupEntitlement = _startup.add("entitlement", _checkEntitlement, { _startupPlatform });
+		if (!_hmdStandIn() && !OVR_SUCCESS(ovr_Initialize(nullptr))) {
 			FAIL("Failed to initialize the Oculus SDK");
 		}
+		_startup.mark("runtime initialized");
 
 		result = ExampleApp().run();
 
@@ -2006,6 +8835,13 @@ int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdL
 		OutputDebugStringA(error.what());
 		std::cerr << error.what() << std::endl;
 	}
+	// A platform still coming up or an entitlement answer still outstanding is waited for, before the runtime goes
+	_startup.join();
 	ovr_Shutdown();
+	_fleetStats.close();
+	_telemetrySink.close();
+	TRACE_SHUTDOWN();
+	_printAllocationTags();
+	_gpuMemory.print();
 	return result;
 }
\ No newline at end of file
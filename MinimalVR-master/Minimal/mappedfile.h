@@ -0,0 +1,94 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <cstdint>
+// Windows Includes
+#include <Windows.h>
+
+// Last write time and size of a file, used to decide whether derived data on disk is stale.
+struct FileStamp
+{
+	uint64_t writeTime = 0;
+	uint64_t size = 0;
+
+	bool operator==(const FileStamp& other) const { return writeTime == other.writeTime && size == other.size; }
+	bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+static bool _getFileStamp(const std::string& path, FileStamp* stamp)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes))
+		return false;
+	stamp->writeTime = ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	stamp->size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	return true;
+}
+
+// A read-only view of a whole file mapped into the address space.
+// The mapping is released when the object goes out of scope, so pointers into data() must not outlive it.
+class MappedFile
+{
+public:
+	MappedFile() {}
+	explicit MappedFile(const std::string& path) { this->open(path); }
+	~MappedFile() { this->close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& path)
+	{
+		this->close();
+		this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (this->file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(this->file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			this->close();
+			return false;
+		}
+
+		this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!this->mapping)
+		{
+			this->close();
+			return false;
+		}
+
+		this->view = MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!this->view)
+		{
+			this->close();
+			return false;
+		}
+		this->length = (size_t)fileSize.QuadPart;
+		return true;
+	}
+
+	void close()
+	{
+		if (this->view)
+			UnmapViewOfFile(this->view);
+		if (this->mapping)
+			CloseHandle(this->mapping);
+		if (this->file != INVALID_HANDLE_VALUE)
+			CloseHandle(this->file);
+		this->view = NULL;
+		this->mapping = NULL;
+		this->file = INVALID_HANDLE_VALUE;
+		this->length = 0;
+	}
+
+	bool isOpen() const { return this->view != NULL; }
+	const uint8_t* data() const { return (const uint8_t*)this->view; }
+	size_t size() const { return this->length; }
+
+private:
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+	void* view = NULL;
+	size_t length = 0;
+};
@@ -6,6 +6,14 @@
 #include <iostream>
 #include <vector>
 #include "shader.h"
+#include "instancing.h"
+#include "texturecache.h"
+#include "virtualtexture.h"
+#include "gpuarena.h"
+#include "packedvertex.h"
+#include "meshoptimize.h"
+#include "culling.h"
+#include "glcapture.h"
 #include <assimp/types.h>
 using namespace std;
 // GL Includes
@@ -23,122 +31,427 @@ struct Vertex {
 	glm::vec2 TexCoords;
 };
 
+// What shader.vert and molecule.vert read
+template <>
+struct VertexLayout<Vertex>
+{
+	static constexpr VertexAttributes attributes()
+	{
+		return { 3, {
+			{ 0, 3, GL_FLOAT, GL_FALSE, false, offsetof(Vertex, Position), GL_FLOAT_VEC3, "position" },
+			{ 1, 3, GL_FLOAT, GL_FALSE, false, offsetof(Vertex, Normal), GL_FLOAT_VEC3, "normal" },
+			{ 2, 2, GL_FLOAT, GL_FALSE, false, offsetof(Vertex, TexCoords), GL_FLOAT_VEC2, "texCoords" },
+		} };
+	}
+};
+
+// A Mesh holding one of these holds one TextureCache reference to id, and gives it back when it goes away
 struct Texture {
 	GLuint id;
 	string type;
 	aiString path;
+	// Sampler uniform this texture binds to (e.g. texture_diffuse1), resolved when the mesh is built
+	string sampler;
+	// Set for a texture_virtual, whose pages VirtualTextureCache owns; id is 0 then
+	VirtualTexture* virtualTexture = nullptr;
+};
+
+// Whether a Mesh keeps its vertices/indices in RAM once they've been uploaded
+enum class MeshRetention
+{
+	KeepCpuData,
+	ReleaseCpuData
+};
+
+// Layout of a Mesh's GPU copy. Packed stores PackedVertex instead of Vertex, for programs built with
+// PACKED_VERTEX; the CPU copy, if kept, is always Vertex.
+enum class VertexFormat
+{
+	Full,
+	Packed
+};
+
+// The cheapest lighting shader.frag draws a material right with, in order of cost. A program for each is built with
+// LIGHTING_MODEL_DEFINES; a draw of several meshes takes the costliest any of them needs.
+enum class LightingModel : uint8_t
+{
+	// No diffuse or specular color, the ambient term alone
+	Unlit,
+	// No specular color, no power per fragment
+	Lambert,
+	Phong,
+	Count
 };
 
+static const char* const LIGHTING_MODEL_DEFINES[(int)LightingModel::Count] = { "#define LIGHTING_UNLIT\n", "#define LIGHTING_LAMBERT\n", "" };
+
+// Owns its VAO and its VBO/EBO blocks of _gpuArena, so a Mesh can be moved but not copied.
+// The buffers are uploaded by whichever context builds the mesh, the VAO is only made on first use by the
+// drawing context, since VAOs aren't shared between contexts (see AssetStreamer).
 class Mesh {
 public:
 	/*  Mesh Data  */
+	// Empty after upload if the mesh was built with MeshRetention::ReleaseCpuData
 	vector<Vertex> vertices;
 	vector<GLuint> indices;
 	vector<Texture> textures;
 	vector<aiColor3D> colors;
 	/*  Functions  */
-	// Constructor
-	Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures)
+	// Constructor, takes ownership of the data
+	Mesh(vector<Vertex>&& vertices, vector<GLuint>&& indices, vector<Texture>&& textures, MeshRetention retention = MeshRetention::KeepCpuData,
+		VertexFormat format = VertexFormat::Full)
+		: vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)), format(format)
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
-
 		// Now that we have all the required data, set the vertex buffers and its attribute pointers.
 		this->setupMesh();
+		this->bakeBindings();
+		if (retention == MeshRetention::ReleaseCpuData)
+			this->releaseCpuData();
 	}
 
-	Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<aiColor3D> color)
+	Mesh(vector<Vertex>&& vertices, vector<GLuint>&& indices, vector<aiColor3D>&& color, MeshRetention retention = MeshRetention::KeepCpuData,
+		VertexFormat format = VertexFormat::Full)
+		: vertices(std::move(vertices)), indices(std::move(indices)), colors(std::move(color)), format(format)
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->colors = color;
-
 		// Now that we have all the required data, set the vertex buffers and its attribute pointers.
 		this->setupMesh();
+		this->bakeBindings();
+		if (retention == MeshRetention::ReleaseCpuData)
+			this->releaseCpuData();
+	}
+
+	// Uploads vertex data that lives elsewhere (e.g. a memory-mapped mesh cache) without keeping a CPU copy.
+	// vertices and indices stay empty for meshes built this way.
+	Mesh(const Vertex* vertexData, GLsizei vertexCount, const GLuint* indexData, GLsizei indexCount, vector<aiColor3D> color,
+		VertexFormat format = VertexFormat::Full)
+		: colors(std::move(color)), format(format)
+	{
+		this->setupMesh(vertexData, vertexCount, indexData, indexCount);
+		this->bakeBindings();
+	}
+
+	// The same for 16 bit indices, which are uploaded as they are
+	Mesh(const Vertex* vertexData, GLsizei vertexCount, const GLushort* indexData, GLsizei indexCount, vector<aiColor3D> color,
+		VertexFormat format = VertexFormat::Full)
+		: colors(std::move(color)), format(format)
+	{
+		this->indexCount = indexCount;
+		this->uploadVertices(vertexData, vertexCount);
+		this->indexType = GL_UNSIGNED_SHORT;
+		this->EBO = _gpuArena.upload(indexData, indexCount * sizeof(GLushort));
+		this->bakeBindings();
+	}
+
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+
+	Mesh(Mesh&& other) noexcept
+		: vertices(std::move(other.vertices)), indices(std::move(other.indices)), textures(std::move(other.textures)), colors(std::move(other.colors)),
+		format(other.format), VAO(other.VAO), VBO(other.VBO), EBO(other.EBO), vertexCount(other.vertexCount), indexCount(other.indexCount), indexType(other.indexType),
+		positionScale(other.positionScale), positionBias(other.positionBias), box(other.box),
+		materialDiffuse(other.materialDiffuse), materialAmbient(other.materialAmbient), materialSpecular(other.materialSpecular)
+	{
+		other.VAO = 0;
+		other.VBO = other.EBO = GpuBlock();
+		other.vertexCount = other.indexCount = 0;
+	}
+
+	Mesh& operator=(Mesh&& other) noexcept
+	{
+		if (this != &other)
+		{
+			this->deleteBuffers();
+			this->vertices = std::move(other.vertices);
+			this->indices = std::move(other.indices);
+			this->textures = std::move(other.textures);
+			this->colors = std::move(other.colors);
+			this->format = other.format;
+			this->VAO = other.VAO;
+			this->VBO = other.VBO;
+			this->EBO = other.EBO;
+			this->vertexCount = other.vertexCount;
+			this->indexCount = other.indexCount;
+			this->indexType = other.indexType;
+			this->positionScale = other.positionScale;
+			this->positionBias = other.positionBias;
+			this->box = other.box;
+			this->materialDiffuse = other.materialDiffuse;
+			this->materialAmbient = other.materialAmbient;
+			this->materialSpecular = other.materialSpecular;
+			other.VAO = 0;
+			other.VBO = other.EBO = GpuBlock();
+			other.vertexCount = other.indexCount = 0;
+		}
+		return *this;
+	}
+
+	~Mesh()
+	{
+		this->deleteBuffers();
+	}
+
+	// Frees the CPU side copy, the GPU buffers are unaffected
+	void releaseCpuData()
+	{
+		vector<Vertex>().swap(this->vertices);
+		vector<GLuint>().swap(this->indices);
 	}
 
-	// Render the mesh
-	void Draw(Shader shader)
+	// Render the mesh. Everything name based was resolved at construction, so this allocates nothing.
+	void Draw(Shader& shader)
+	{
+		this->bindMaterial(shader);
+
+		// Draw mesh. The VAO and textures stay bound, the state cache skips them if the next draw wants them too.
+		_glState.bindVertexArray(this->vertexArray());
+		glDrawElements(GL_TRIANGLES, this->indexCount, this->indexType, (GLvoid*)this->EBO.offset);
+		_glCapture.drawElements(GL_TRIANGLES, this->indexCount, this->indexType, (GLvoid*)this->EBO.offset);
+		_renderStats.draw(GL_TRIANGLES, this->indexCount);
+	}
+
+	// Render instanceCount copies, the model matrices come from the attached instance buffer
+	void DrawInstanced(Shader& shader, GLsizei instanceCount)
+	{
+		this->bindMaterial(shader);
+
+		_glState.bindVertexArray(this->vertexArray());
+		glDrawElementsInstanced(GL_TRIANGLES, this->indexCount, this->indexType, (GLvoid*)this->EBO.offset, instanceCount);
+		_glCapture.drawElements(GL_TRIANGLES, this->indexCount, this->indexType, (GLvoid*)this->EBO.offset, instanceCount);
+		_renderStats.draw(GL_TRIANGLES, this->indexCount, instanceCount);
+	}
+
+	// The same copies with a draw call each, eyeCount instances per draw for the stereo modes, so what instancing
+	// saves can be measured. Needs GL_ARB_base_instance to start each draw at its own transform.
+	void DrawSeparately(Shader& shader, GLsizei instanceCount, GLsizei eyeCount)
+	{
+		this->bindMaterial(shader);
+
+		_glState.bindVertexArray(this->vertexArray());
+		for (GLsizei i = 0; i < instanceCount; i++)
+		{
+			glDrawElementsInstancedBaseInstance(GL_TRIANGLES, this->indexCount, this->indexType, (GLvoid*)this->EBO.offset, eyeCount, (GLuint)i);
+			_glCapture.drawElements(GL_TRIANGLES, this->indexCount, this->indexType, (GLvoid*)this->EBO.offset, eyeCount, 0, (GLuint)i);
+			_renderStats.draw(GL_TRIANGLES, this->indexCount, eyeCount);
+		}
+	}
+
+	// One command of the buffer bound to GL_DRAW_INDIRECT_BUFFER, command being its byte offset there
+	void DrawIndirect(Shader& shader, GLintptr command)
+	{
+		this->bindMaterial(shader);
+
+		_glState.bindVertexArray(this->vertexArray());
+		glDrawElementsIndirect(GL_TRIANGLES, this->indexType, (GLvoid*)command);
+		_glCapture.drawElementsIndirect(GL_TRIANGLES, this->indexType, (GLvoid*)command);
+		// The instance count is the GPU's, so only the call is counted
+		_renderStats.draw(GL_TRIANGLES, 0, 0);
+	}
+
+	void attachInstanceBuffer(GLuint buffer, GLuint divisor = 1)
+	{
+		_attachInstanceTransforms(this->vertexArray(), buffer, divisor);
+	}
+
+	// Samples texture in the VIRTUAL_TEXTURE programs, nullptr takes it off again. The mesh stays out of a
+	// StaticBatch while it has one.
+	void setVirtualTexture(VirtualTexture* texture)
+	{
+		for (size_t i = 0; i < this->textures.size(); i++)
+		{
+			if (this->textures[i].virtualTexture)
+			{
+				this->textures.erase(this->textures.begin() + i);
+				break;
+			}
+		}
+		if (!texture)
+			return;
+		Texture virtualTexture;
+		virtualTexture.id = 0;
+		virtualTexture.type = "texture_virtual";
+		virtualTexture.sampler = "virtualPages";
+		virtualTexture.virtualTexture = texture;
+		this->textures.push_back(virtualTexture);
+	}
+
+	// Read by StaticBatch, which copies the buffers and material of full format meshes without textures
+	bool batchable() const { return this->textures.empty() && this->indexCount > 0 && this->format == VertexFormat::Full; }
+	const GpuBlock& vertexBlock() const { return this->VBO; }
+	const GpuBlock& elementBlock() const { return this->EBO; }
+	GLsizei uploadedVertices() const { return this->vertexCount; }
+	GLsizei uploadedIndices() const { return this->indexCount; }
+	GLenum elementType() const { return this->indexType; }
+	const glm::vec3& diffuse() const { return this->materialDiffuse; }
+	const glm::vec3& ambient() const { return this->materialAmbient; }
+	const glm::vec3& specular() const { return this->materialSpecular; }
+	LightingModel lightingModel() const
+	{
+		if (this->materialSpecular != glm::vec3(0.0f))
+			return LightingModel::Phong;
+		return this->materialDiffuse != glm::vec3(0.0f) ? LightingModel::Lambert : LightingModel::Unlit;
+	}
+
+	// Model space box of the uploaded vertices, kept when the CPU copy is released
+	const Aabb& bounds() const { return this->box; }
+	// Packed only: what PACKED_VERTEX scales the stored positions by, see positionScale
+	const glm::vec3& packedScale() const { return this->positionScale; }
+	const glm::vec3& packedBias() const { return this->positionBias; }
+
+private:
+	/*  Render data  */
+	VertexFormat format = VertexFormat::Full;
+	GLuint VAO = 0;
+	GpuBlock VBO, EBO;
+	GLsizei vertexCount = 0;
+	GLsizei indexCount = 0;
+	// GL_UNSIGNED_SHORT whenever the vertices fit, the CPU copy stays GLuint
+	GLenum indexType = GL_UNSIGNED_INT;
+	// Packed only: the shader's position = stored * positionScale + positionBias
+	glm::vec3 positionScale, positionBias;
+	Aabb box;
+	glm::vec3 materialDiffuse, materialAmbient, materialSpecular;
+
+	/*  Functions    */
+	GLuint vertexArray()
+	{
+		if (!this->VAO)
+			this->setupVertexArray();
+		return this->VAO;
+	}
+
+	void bindMaterial(Shader& shader)
 	{
 		// Bind appropriate textures
-		GLuint diffuseNr = 1;
-		GLuint specularNr = 1;
+		bool virtualTextured = false;
 		for (GLuint i = 0; i < this->textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i); // Active proper texture unit before binding
-											  // Retrieve texture number (the N in diffuse_textureN)
-			stringstream ss;
-			string number;
-			string name = this->textures[i].type;
-			if (name == "texture_diffuse")
-				ss << diffuseNr++; // Transfer GLuint to stream
-			else if (name == "texture_specular")
-				ss << specularNr++; // Transfer GLuint to stream
-			number = ss.str();
-			// Now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.Program, (name + number).c_str()), i);
-			// And finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			if (this->textures[i].virtualTexture)
+			{
+				// On units of its own, see VIRTUAL_TEXTURE_PAGES_UNIT
+				this->textures[i].virtualTexture->bind(shader);
+				virtualTextured = true;
+				continue;
+			}
+			// Set the sampler to the correct texture unit
+			shader.set(this->textures[i].sampler.c_str(), (GLint)i);
+			// And bind the texture there, the unit is only made active if the binding changes
+			_glState.bindTexture(i, this->textures[i].id);
 		}
+		// The VIRTUAL_TEXTURE programs leave the meshes without one untextured
+		if (!virtualTextured)
+			shader.set("virtualTextured", (GLint)0);
 
 		// Also set each mesh's shininess property to a default value (if you want you could extend this to another mesh property and possibly change this value)
-		//glUniform1f(glGetUniformLocation(shader.Program, "material.diffuse"), 16.0f);
-		
-		glUniform3fv(glGetUniformLocation(shader.Program, "material.diffuse"), 1, glm::value_ptr(glm::vec3(colors[0].r, colors[0].g, colors[0].b)));
-		glUniform3fv(glGetUniformLocation(shader.Program, "material.ambient"), 1, glm::value_ptr(glm::vec3(colors[1].r, colors[1].g, colors[1].b)));
-		glUniform3fv(glGetUniformLocation(shader.Program, "material.specular"), 1, glm::value_ptr(glm::vec3(colors[2].r, colors[2].g, colors[2].b)));
-		glUniform1f(glGetUniformLocation(shader.Program, "material.shininess"), 50.0f);
-
-		// Draw mesh
-		glBindVertexArray(this->VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-		// Always good practice to set everything back to defaults once configured.
+		shader.set("material.diffuse", this->materialDiffuse);
+		shader.set("material.ambient", this->materialAmbient);
+		shader.set("material.specular", this->materialSpecular);
+		shader.set("material.shininess", 50.0f);
+		if (this->format == VertexFormat::Packed)
+		{
+			shader.set("positionScale", this->positionScale);
+			shader.set("positionBias", this->positionBias);
+		}
+	}
+
+	// Works out sampler names (the N in diffuse_textureN) and material colors once, so Draw doesn't have to
+	void bakeBindings()
+	{
+		GLuint diffuseNr = 1;
+		GLuint specularNr = 1;
 		for (GLuint i = 0; i < this->textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glBindTexture(GL_TEXTURE_2D, 0);
+			Texture& texture = this->textures[i];
+			if (texture.type == "texture_diffuse")
+				texture.sampler = texture.type + to_string(diffuseNr++);
+			else if (texture.type == "texture_specular")
+				texture.sampler = texture.type + to_string(specularNr++);
+			else
+				texture.sampler = texture.type;
 		}
+
+		aiColor3D white(1.0f, 1.0f, 1.0f);
+		const aiColor3D& diffuse = this->colors.size() > 0 ? this->colors[0] : white;
+		const aiColor3D& ambient = this->colors.size() > 1 ? this->colors[1] : white;
+		const aiColor3D& specular = this->colors.size() > 2 ? this->colors[2] : white;
+		this->materialDiffuse = glm::vec3(diffuse.r, diffuse.g, diffuse.b);
+		this->materialAmbient = glm::vec3(ambient.r, ambient.g, ambient.b);
+		this->materialSpecular = glm::vec3(specular.r, specular.g, specular.b);
 	}
 
-private:
-	/*  Render data  */
-	GLuint VAO, VBO, EBO;
+	void deleteBuffers()
+	{
+		if (this->VAO)
+			glDeleteVertexArrays(1, &this->VAO);
+		this->VAO = 0;
+		_gpuArena.free(this->VBO);
+		_gpuArena.free(this->EBO);
+		for (size_t i = 0; i < this->textures.size(); i++)
+			_textures.release(this->textures[i].id);
+		this->textures.clear();
+	}
 
-	/*  Functions    */
 	// Initializes all the buffer objects/arrays
 	void setupMesh()
 	{
-		// Create buffers/arrays
-		glGenVertexArrays(1, &this->VAO);
-		glGenBuffers(1, &this->VBO);
-		glGenBuffers(1, &this->EBO);
+		this->setupMesh(this->vertices.data(), (GLsizei)this->vertices.size(), this->indices.data(), (GLsizei)this->indices.size());
+	}
+
+	void setupMesh(const Vertex* vertexData, GLsizei vertexCount, const GLuint* indexData, GLsizei indexCount)
+	{
+		this->indexCount = indexCount;
+		this->uploadVertices(vertexData, vertexCount);
+		if (vertexCount <= 65536)
+		{
+			vector<GLushort> narrow(indexData, indexData + indexCount);
+			this->indexType = GL_UNSIGNED_SHORT;
+			this->EBO = _gpuArena.upload(narrow.data(), indexCount * sizeof(GLushort));
+		}
+		else
+		{
+			this->indexType = GL_UNSIGNED_INT;
+			this->EBO = _gpuArena.upload(indexData, indexCount * sizeof(GLuint));
+		}
+	}
+
+	void uploadVertices(const Vertex* vertexData, GLsizei vertexCount)
+	{
+		this->vertexCount = vertexCount;
+		for (GLsizei i = 0; i < vertexCount; i++)
+			this->box.add(vertexData[i].Position);
 
-		glBindVertexArray(this->VAO);
-		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		// Load data into blocks of the shared arena pages
 		// A great thing about structs is that their memory layout is sequential for all its items.
 		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
 		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
-
-		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-
-		glBindVertexArray(0);
+		if (this->format == VertexFormat::Packed)
+		{
+			vector<PackedVertex> packed(vertexCount);
+			_packVertices(vertexData, packed.size(), packed.data(), &this->positionScale, &this->positionBias);
+			this->VBO = _gpuArena.upload(packed.data(), vertexCount * sizeof(PackedVertex));
+		}
+		else
+		{
+			this->VBO = _gpuArena.upload(vertexData, vertexCount * sizeof(Vertex));
+		}
+	}
+
+	// Records the buffers' layout in a new VAO, on the context that draws the mesh
+	void setupVertexArray()
+	{
+		glGenVertexArrays(1, &this->VAO);
+		_glState.bindVertexArray(this->VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO.buffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO.buffer);
+
+		// Set the vertex attribute pointers, from where the mesh's block starts in its page
+		const GLintptr base = this->VBO.offset;
+		if (this->format == VertexFormat::Packed)
+			_setVertexAttributes<PackedVertex>(base);
+		else
+			_setVertexAttributes<Vertex>(base);
+
+		_glState.bindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
 };
 
@@ -0,0 +1,331 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cfloat>
+#include <emmintrin.h>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+#include "picking.h"
+
+// Bounding volume hierarchies over the triangles of a model's level 0 meshes, for exact ray hits such as the
+// lasers'. Each mesh's tree is built at import with the binned surface area heuristic and stored in the mesh cache
+// as its nodes and the order it puts the triangles in; loading just copies the corners out in that order. A tree is
+// in the mesh's own space, queries move the ray there instead, so placed copies and instances share one.
+
+// Most triangles in a leaf, and the buckets the surface area heuristic sorts the centroids into along an axis
+#define MESH_BVH_LEAF_TRIANGLES 4
+#define MESH_BVH_BINS 12
+// Leaves can get more triangles than MESH_BVH_LEAF_TRIANGLES when splitting them wouldn't pay, up to this many
+#define MESH_BVH_MAX_LEAF_TRIANGLES 16
+
+// count 0 is an inner node with its children at first and first + 1, otherwise a leaf of count triangles from first
+struct MeshBvhNode
+{
+	glm::vec3 low;
+	uint32_t first;
+	glm::vec3 high;
+	uint32_t count;
+};
+static_assert(sizeof(MeshBvhNode) == 32, "MeshBvhNode is stored in the mesh cache as is");
+
+static inline float _bvhArea(const glm::vec3& low, const glm::vec3& high)
+{
+	const glm::vec3 size = glm::max(high - low, glm::vec3(0.0f));
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+// Builds the tree over the triangles of indices into nodes, and the triangles' leaf order into order. Touches no GL,
+// and takes any vertex with a Position, so the headless server (moleculegame.h) needs nothing of mesh.h.
+template <typename V>
+static void _buildMeshBvh(const vector<V>& vertices, const vector<uint32_t>& indices, vector<MeshBvhNode>* nodes, vector<uint32_t>* order)
+{
+	nodes->clear();
+	order->clear();
+	const size_t count = indices.size() / 3;
+	if (!count)
+		return;
+	vector<glm::vec3> lows(count), highs(count), centroids(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const glm::vec3& a = vertices[indices[i * 3]].Position;
+		const glm::vec3& b = vertices[indices[i * 3 + 1]].Position;
+		const glm::vec3& c = vertices[indices[i * 3 + 2]].Position;
+		lows[i] = glm::min(a, glm::min(b, c));
+		highs[i] = glm::max(a, glm::max(b, c));
+		centroids[i] = (lows[i] + highs[i]) * 0.5f;
+	}
+	order->resize(count);
+	for (size_t i = 0; i < count; i++)
+		(*order)[i] = (uint32_t)i;
+
+	auto bound = [&](MeshBvhNode& node)
+	{
+		node.low = glm::vec3(FLT_MAX);
+		node.high = glm::vec3(-FLT_MAX);
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+		{
+			node.low = glm::min(node.low, lows[(*order)[i]]);
+			node.high = glm::max(node.high, highs[(*order)[i]]);
+		}
+	};
+	nodes->reserve(count * 2);
+	MeshBvhNode root = { glm::vec3(0.0f), 0, glm::vec3(0.0f), (uint32_t)count };
+	bound(root);
+	nodes->push_back(root);
+
+	vector<uint32_t> pending(1, 0);
+	while (!pending.empty())
+	{
+		const uint32_t n = pending.back();
+		pending.pop_back();
+		const MeshBvhNode node = (*nodes)[n];
+		if (node.count <= MESH_BVH_LEAF_TRIANGLES)
+			continue;
+
+		glm::vec3 centreLow(FLT_MAX), centreHigh(-FLT_MAX);
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+		{
+			centreLow = glm::min(centreLow, centroids[(*order)[i]]);
+			centreHigh = glm::max(centreHigh, centroids[(*order)[i]]);
+		}
+		const glm::vec3 extent = centreHigh - centreLow;
+		const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		if (extent[axis] <= 0.0f)
+			continue;
+
+		// Binned: the cost of every split between two buckets from sweeps in from both ends
+		uint32_t binCounts[MESH_BVH_BINS] = {};
+		glm::vec3 binLows[MESH_BVH_BINS], binHighs[MESH_BVH_BINS];
+		for (int b = 0; b < MESH_BVH_BINS; b++)
+		{
+			binLows[b] = glm::vec3(FLT_MAX);
+			binHighs[b] = glm::vec3(-FLT_MAX);
+		}
+		const float scale = MESH_BVH_BINS / extent[axis];
+		auto binOf = [&](uint32_t triangle)
+		{
+			return std::min((int)((centroids[triangle][axis] - centreLow[axis]) * scale), MESH_BVH_BINS - 1);
+		};
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+		{
+			const uint32_t triangle = (*order)[i];
+			const int b = binOf(triangle);
+			binCounts[b]++;
+			binLows[b] = glm::min(binLows[b], lows[triangle]);
+			binHighs[b] = glm::max(binHighs[b], highs[triangle]);
+		}
+		float rightAreas[MESH_BVH_BINS];
+		uint32_t rightCounts[MESH_BVH_BINS];
+		glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+		uint32_t total = 0;
+		for (int b = MESH_BVH_BINS - 1; b > 0; b--)
+		{
+			low = glm::min(low, binLows[b]);
+			high = glm::max(high, binHighs[b]);
+			total += binCounts[b];
+			rightAreas[b] = _bvhArea(low, high);
+			rightCounts[b] = total;
+		}
+		float bestCost = FLT_MAX;
+		int bestSplit = 0;
+		low = glm::vec3(FLT_MAX);
+		high = glm::vec3(-FLT_MAX);
+		total = 0;
+		for (int b = 0; b < MESH_BVH_BINS - 1; b++)
+		{
+			low = glm::min(low, binLows[b]);
+			high = glm::max(high, binHighs[b]);
+			total += binCounts[b];
+			if (!total || !rightCounts[b + 1])
+				continue;
+			const float cost = total * _bvhArea(low, high) + rightCounts[b + 1] * rightAreas[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = b + 1;
+			}
+		}
+		if (bestCost >= node.count * _bvhArea(node.low, node.high) && node.count <= MESH_BVH_MAX_LEAF_TRIANGLES)
+			continue;
+
+		uint32_t* begin = order->data() + node.first;
+		uint32_t* end = begin + node.count;
+		uint32_t* middle = bestCost < FLT_MAX ? std::partition(begin, end, [&](uint32_t triangle) { return binOf(triangle) < bestSplit; }) : begin;
+		if (middle == begin || middle == end)
+		{
+			// Every centroid in one bucket, halve them by position instead
+			middle = begin + node.count / 2;
+			std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+		}
+		const uint32_t leftCount = (uint32_t)(middle - begin);
+		MeshBvhNode left = { glm::vec3(0.0f), node.first, glm::vec3(0.0f), leftCount };
+		MeshBvhNode right = { glm::vec3(0.0f), node.first + leftCount, glm::vec3(0.0f), node.count - leftCount };
+		bound(left);
+		bound(right);
+		const uint32_t children = (uint32_t)nodes->size();
+		nodes->push_back(left);
+		nodes->push_back(right);
+		(*nodes)[n].first = children;
+		(*nodes)[n].count = 0;
+		pending.push_back(children);
+		pending.push_back(children + 1);
+	}
+}
+
+// One mesh's tree with its triangles' corners copied out in leaf order, so a leaf reads one run of memory
+class MeshBvh
+{
+public:
+	MeshBvh() {}
+
+	// nodes and order from _buildMeshBvh over the same vertices and indices, possibly read back from the cache
+	template <typename V>
+	MeshBvh(const V* vertices, const uint32_t* indices, vector<MeshBvhNode>&& nodes, vector<uint32_t>&& order)
+		: nodes(std::move(nodes)), order(std::move(order))
+	{
+		this->corners.reserve(this->order.size() * 3);
+		for (uint32_t triangle : this->order)
+		{
+			for (int k = 0; k < 3; k++)
+				this->corners.push_back(vertices[indices[triangle * 3 + k]].Position);
+		}
+	}
+
+	bool empty() const { return this->nodes.empty(); }
+
+	// What the mesh cache stores
+	const vector<MeshBvhNode>& treeNodes() const { return this->nodes; }
+	const vector<uint32_t>& triangleOrder() const { return this->order; }
+
+	// Nearest hit of origin + t * direction with 0 <= t < *t, in the tree's space; direction needn't be unit length.
+	// True, with *t lowered to it, if there is one. Triangles are hit from either side.
+	bool intersect(const glm::vec3& origin, const glm::vec3& direction, float* t) const
+	{
+		if (this->nodes.empty())
+			return false;
+		// Lane 3 repeats z so the three way min and max can take all four lanes
+		const __m128 o = _mm_setr_ps(origin.x, origin.y, origin.z, origin.z);
+		const glm::vec3 inverse = 1.0f / direction;
+		const __m128 inv = _mm_setr_ps(inverse.x, inverse.y, inverse.z, inverse.z);
+		bool hit = false;
+		uint32_t stack[64];
+		int top = 0;
+		float nearRoot;
+		if (!this->slabs(this->nodes[0], o, inv, *t, &nearRoot))
+			return false;
+		stack[top++] = 0;
+		while (top)
+		{
+			const MeshBvhNode& node = this->nodes[stack[--top]];
+			if (node.count)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+					hit = this->triangle(i, origin, direction, t) || hit;
+				continue;
+			}
+			// Nearer child on top, so the far one is usually culled by then
+			float nearA, nearB;
+			const bool a = this->slabs(this->nodes[node.first], o, inv, *t, &nearA);
+			const bool b = this->slabs(this->nodes[node.first + 1], o, inv, *t, &nearB);
+			if (top + 2 > 64)
+				continue;
+			if (a && b)
+			{
+				stack[top++] = nearA < nearB ? node.first + 1 : node.first;
+				stack[top++] = nearA < nearB ? node.first : node.first + 1;
+			}
+			else if (a || b)
+			{
+				stack[top++] = a ? node.first : node.first + 1;
+			}
+		}
+		return hit;
+	}
+
+private:
+	// Whether the ray enters node's box before maxT, all three slabs at once
+	static bool slabs(const MeshBvhNode& node, __m128 origin, __m128 inverse, float maxT, float* nearT)
+	{
+		const __m128 low = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(node.low.x, node.low.y, node.low.z, node.low.z), origin), inverse);
+		const __m128 high = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(node.high.x, node.high.y, node.high.z, node.high.z), origin), inverse);
+		__m128 enter = _mm_min_ps(low, high);
+		__m128 leave = _mm_max_ps(low, high);
+		enter = _mm_max_ps(enter, _mm_shuffle_ps(enter, enter, _MM_SHUFFLE(2, 3, 0, 1)));
+		enter = _mm_max_ps(enter, _mm_shuffle_ps(enter, enter, _MM_SHUFFLE(1, 0, 3, 2)));
+		leave = _mm_min_ps(leave, _mm_shuffle_ps(leave, leave, _MM_SHUFFLE(2, 3, 0, 1)));
+		leave = _mm_min_ps(leave, _mm_shuffle_ps(leave, leave, _MM_SHUFFLE(1, 0, 3, 2)));
+		const float entered = _mm_cvtss_f32(enter);
+		const float left = _mm_cvtss_f32(leave);
+		*nearT = entered;
+		return entered <= left && left >= 0.0f && entered < maxT;
+	}
+
+	// Moller and Trumbore
+	bool triangle(uint32_t i, const glm::vec3& origin, const glm::vec3& direction, float* t) const
+	{
+		const glm::vec3& a = this->corners[i * 3];
+		const glm::vec3 ab = this->corners[i * 3 + 1] - a;
+		const glm::vec3 ac = this->corners[i * 3 + 2] - a;
+		const glm::vec3 p = glm::cross(direction, ac);
+		const float determinant = glm::dot(ab, p);
+		if (std::abs(determinant) < 1e-12f)
+			return false;
+		const float inverse = 1.0f / determinant;
+		const glm::vec3 s = origin - a;
+		const float u = glm::dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		const glm::vec3 q = glm::cross(s, ab);
+		const float v = glm::dot(direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		const float distance = glm::dot(ac, q) * inverse;
+		if (distance < 0.0f || distance >= *t)
+			return false;
+		*t = distance;
+		return true;
+	}
+
+	vector<MeshBvhNode> nodes;
+	// Kept for the mesh cache
+	vector<uint32_t> order;
+	vector<glm::vec3> corners;
+};
+
+// The trees of every level 0 mesh of a model, with the placements of its copies. Immutable once built, so any
+// thread can cast rays against it while the model is drawn.
+struct ModelShape
+{
+	vector<MeshBvh> meshes;
+	// Per mesh, as Model keeps them; empty for a model without placements
+	vector<vector<glm::mat4>> placements;
+	// Of the whole model around its origin, for a cheap test first
+	float radius = 0.0f;
+
+	// Nearest hit of ray on the model moved by transform, before maxT. True with *t set if there is one.
+	bool raycast(const PickRay& ray, const glm::mat4& transform, float maxT, float* t) const
+	{
+		float best = maxT;
+		bool hit = false;
+		const glm::mat4 identity;
+		for (size_t m = 0; m < this->meshes.size(); m++)
+		{
+			const size_t copies = this->placements.empty() ? 1 : this->placements[m].size();
+			for (size_t c = 0; c < copies; c++)
+			{
+				// The direction keeps its length in world units, so t along it is the world distance
+				const glm::mat4 inverse = glm::inverse(this->placements.empty() ? transform : transform * this->placements[m][c]);
+				const glm::vec3 origin = glm::vec3(inverse * glm::vec4(ray.origin, 1.0f));
+				const glm::vec3 direction = glm::mat3(inverse) * ray.direction;
+				hit = this->meshes[m].intersect(origin, direction, &best) || hit;
+			}
+		}
+		if (hit)
+			*t = best;
+		return hit;
+	}
+};
@@ -0,0 +1,297 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <assimp/types.h>
+#include "mappedfile.h"
+#include "assetpack.h"
+#include "mesh.h"
+#include "lightbake.h"
+#include "meshlets.h"
+#include "meshbvh.h"
+
+// Binary cache of the flattened Assimp output, written next to the source model as "<model>.meshcache".
+//
+// Layout (all little endian, 4 byte aligned):
+//   MeshCacheHeader
+//   char source path[pathLength], padded to 4 bytes
+//   meshCount x { MeshCacheEntry, Vertex[vertexCount], GLuint[indexCount], glm::mat4[placementCount],
+//   uint32_t[lightBakeCount], Meshlet[meshletCount], MeshBvhNode[bvhNodeCount], uint32_t[indexCount / 3 if bvhNodeCount] },
+//   level 0's meshes first, then those of each further level of detail
+//
+// A cache is only used when the version, import flags, repeat handling, vertex layout, level count, light bake, source
+// path and the source file's write time and size all match, otherwise the model is re-imported and the cache rewritten.
+
+#define MESH_CACHE_MAGIC 0x4843534D // "MSCH"
+// 2: meshes are stored after _optimizeMesh
+// 3: levels of detail
+// 4: placements of the meshes repeated parts were folded into
+// 5: static lighting baked per vertex, see _bakeLighting
+// 6: meshlets of level 0, see _buildMeshlets
+// 7: triangle trees of level 0, see _buildMeshBvh
+#define MESH_CACHE_VERSION 7
+
+struct MeshCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t importFlags;
+	uint32_t vertexSize;
+	uint64_t sourceWriteTime;
+	uint64_t sourceSize;
+	uint32_t pathLength;
+	// Over all levels
+	uint32_t meshCount;
+	uint32_t lodCount;
+	// 1 if repeated parts were looked for, see RepeatedMeshes
+	uint32_t instancedRepeats;
+	// 1 if level 0 has its lighting baked, for the light at bakeLight
+	uint32_t lightBaked;
+	float bakeLight[3];
+};
+
+struct MeshCacheEntry
+{
+	uint32_t lod;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	// Level 0 of a model with placements only, 0 otherwise
+	uint32_t placementCount;
+	// Diffuse, ambient, specular
+	float colors[9];
+	// Level 0 of a baked model only: vertexCount per copy, see _bakeLighting
+	uint32_t lightBakeCount;
+	// Level 0 only
+	uint32_t meshletCount;
+	// Level 0 only, followed by the triangle order when not 0
+	uint32_t bvhNodeCount;
+};
+
+// A mesh as it sits inside a mapped cache file
+struct MeshCacheView
+{
+	uint32_t lod;
+	const Vertex* vertices;
+	uint32_t vertexCount;
+	const GLuint* indices;
+	uint32_t indexCount;
+	vector<aiColor3D> colors;
+	const glm::mat4* placements;
+	uint32_t placementCount;
+	const uint32_t* lightBake;
+	uint32_t lightBakeCount;
+	const Meshlet* meshlets;
+	uint32_t meshletCount;
+	// indexCount / 3 triangles in order when bvhNodeCount isn't 0
+	const MeshBvhNode* bvhNodes;
+	uint32_t bvhNodeCount;
+	const uint32_t* bvhOrder;
+};
+
+static inline size_t _meshCacheAlign(size_t size)
+{
+	return (size + 3) & ~(size_t)3;
+}
+
+static string _meshCachePath(const string& sourcePath)
+{
+	return sourcePath + ".meshcache";
+}
+
+// Whether the cache was baked as bake asks, for the same light
+static bool _meshCacheBakeMatches(const MeshCacheHeader& header, const LightBakeOptions& bake)
+{
+	if (header.lightBaked != (bake.enabled ? 1u : 0u))
+		return false;
+	return !bake.enabled || (header.bakeLight[0] == bake.light.x && header.bakeLight[1] == bake.light.y && header.bakeLight[2] == bake.light.z);
+}
+
+// Views into the cache of sourcePath at data. stamp is the source's, null to take the cache as current.
+static bool _parseMeshCache(const uint8_t* data, size_t size, const string& sourcePath, uint32_t importFlags, bool instancedRepeats,
+	uint32_t lodCount, const LightBakeOptions& bake, const FileStamp* stamp, vector<MeshCacheView>* meshes)
+{
+	if (size < sizeof(MeshCacheHeader))
+		return false;
+
+	const MeshCacheHeader* header = (const MeshCacheHeader*)data;
+	if (header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION ||
+		header->importFlags != importFlags || header->instancedRepeats != (instancedRepeats ? 1u : 0u) ||
+		header->vertexSize != sizeof(Vertex) || header->lodCount != lodCount || !_meshCacheBakeMatches(*header, bake) ||
+		(stamp && (header->sourceWriteTime != stamp->writeTime || header->sourceSize != stamp->size)) ||
+		header->pathLength != sourcePath.size())
+	{
+		return false;
+	}
+
+	size_t offset = sizeof(MeshCacheHeader);
+	if (offset + header->pathLength > size || sourcePath.compare(0, string::npos, (const char*)data + offset, header->pathLength) != 0)
+		return false;
+	offset += _meshCacheAlign(header->pathLength);
+
+	meshes->clear();
+	meshes->reserve(header->meshCount);
+	for (uint32_t i = 0; i < header->meshCount; i++)
+	{
+		if (offset + sizeof(MeshCacheEntry) > size)
+			return false;
+		const MeshCacheEntry* entry = (const MeshCacheEntry*)(data + offset);
+		offset += sizeof(MeshCacheEntry);
+		if (entry->lod >= lodCount)
+			return false;
+
+		const size_t vertexBytes = (size_t)entry->vertexCount * sizeof(Vertex);
+		const size_t indexBytes = (size_t)entry->indexCount * sizeof(GLuint);
+		const size_t placementBytes = (size_t)entry->placementCount * sizeof(glm::mat4);
+		const size_t bakeBytes = (size_t)entry->lightBakeCount * sizeof(uint32_t);
+		const size_t meshletBytes = (size_t)entry->meshletCount * sizeof(Meshlet);
+		const size_t bvhBytes = entry->bvhNodeCount ? (size_t)entry->bvhNodeCount * sizeof(MeshBvhNode) + (size_t)(entry->indexCount / 3) * sizeof(uint32_t) : 0;
+		if (offset + vertexBytes + indexBytes + placementBytes + bakeBytes + meshletBytes + bvhBytes > size || (entry->placementCount && entry->lod != 0) ||
+			(entry->lightBakeCount && entry->lod != 0) || (entry->meshletCount && entry->lod != 0) || (entry->bvhNodeCount && entry->lod != 0))
+			return false;
+
+		MeshCacheView view;
+		view.lod = entry->lod;
+		view.vertices = (const Vertex*)(data + offset);
+		view.vertexCount = entry->vertexCount;
+		view.indices = (const GLuint*)(data + offset + vertexBytes);
+		view.indexCount = entry->indexCount;
+		view.placements = (const glm::mat4*)(data + offset + vertexBytes + indexBytes);
+		view.placementCount = entry->placementCount;
+		view.lightBake = (const uint32_t*)(data + offset + vertexBytes + indexBytes + placementBytes);
+		view.lightBakeCount = entry->lightBakeCount;
+		view.meshlets = (const Meshlet*)(data + offset + vertexBytes + indexBytes + placementBytes + bakeBytes);
+		view.meshletCount = entry->meshletCount;
+		view.bvhNodes = (const MeshBvhNode*)(data + offset + vertexBytes + indexBytes + placementBytes + bakeBytes + meshletBytes);
+		view.bvhNodeCount = entry->bvhNodeCount;
+		view.bvhOrder = (const uint32_t*)(view.bvhNodes + entry->bvhNodeCount);
+		for (int c = 0; c < 3; c++)
+			view.colors.push_back(aiColor3D(entry->colors[c * 3 + 0], entry->colors[c * 3 + 1], entry->colors[c * 3 + 2]));
+		meshes->push_back(view);
+
+		offset += vertexBytes + indexBytes + placementBytes + bakeBytes + meshletBytes + bvhBytes;
+	}
+	return true;
+}
+
+// The cache of sourcePath as views, from _assetPack if it has one and otherwise mapped from beside the source.
+// The views are only valid while file, or the pack, stays open.
+static bool _readMeshCache(const string& sourcePath, uint32_t importFlags, bool instancedRepeats, uint32_t lodCount, const LightBakeOptions& bake,
+	MappedFile* file, vector<MeshCacheView>* meshes)
+{
+	AssetSpan packed;
+	if (_assetPack.find(_meshCachePath(sourcePath), &packed))
+		return _parseMeshCache(packed.data, packed.size, sourcePath, importFlags, instancedRepeats, lodCount, bake, nullptr, meshes);
+
+	FileStamp stamp;
+	if (!_getFileStamp(sourcePath, &stamp))
+		return false;
+	if (!file->open(_meshCachePath(sourcePath)))
+		return false;
+	return _parseMeshCache(file->data(), file->size(), sourcePath, importFlags, instancedRepeats, lodCount, bake, &stamp, meshes);
+}
+
+// Writes the cache for sourcePath, with levels 1 to lodCount - 1 taken from lods, and placements, lightBakes,
+// meshlets and the trees of shape, if not empty, one per level 0 mesh. The file is written under a temporary name and moved into place, so a crash
+// mid-write never leaves a truncated cache behind.
+static bool _writeMeshCache(const string& sourcePath, uint32_t importFlags, bool instancedRepeats, const vector<Mesh>* meshes, const vector<Mesh>* lods,
+	uint32_t lodCount, const vector<vector<glm::mat4>>& placements, const LightBakeOptions& bake, const vector<vector<uint32_t>>& lightBakes,
+	const vector<vector<Meshlet>>& meshlets, const ModelShape* shape)
+{
+	FileStamp stamp;
+	if (!_getFileStamp(sourcePath, &stamp))
+		return false;
+
+	const string cachePath = _meshCachePath(sourcePath);
+	const string tempPath = cachePath + ".tmp";
+	{
+		ofstream out(tempPath.c_str(), ios::binary | ios::trunc);
+		if (!out)
+			return false;
+
+		MeshCacheHeader header;
+		header.magic = MESH_CACHE_MAGIC;
+		header.version = MESH_CACHE_VERSION;
+		header.importFlags = importFlags;
+		header.vertexSize = sizeof(Vertex);
+		header.sourceWriteTime = stamp.writeTime;
+		header.sourceSize = stamp.size;
+		header.pathLength = (uint32_t)sourcePath.size();
+		header.meshCount = 0;
+		for (uint32_t l = 0; l < lodCount; l++)
+			header.meshCount += (uint32_t)(l == 0 ? meshes : &lods[l - 1])->size();
+		header.lodCount = lodCount;
+		header.instancedRepeats = instancedRepeats ? 1 : 0;
+		header.lightBaked = bake.enabled ? 1 : 0;
+		header.bakeLight[0] = bake.light.x;
+		header.bakeLight[1] = bake.light.y;
+		header.bakeLight[2] = bake.light.z;
+		out.write((const char*)&header, sizeof(header));
+
+		const char padding[4] = { 0, 0, 0, 0 };
+		out.write(sourcePath.data(), sourcePath.size());
+		out.write(padding, _meshCacheAlign(sourcePath.size()) - sourcePath.size());
+
+		for (uint32_t l = 0; l < lodCount; l++)
+		{
+			const vector<Mesh>& level = l == 0 ? *meshes : lods[l - 1];
+			for (size_t i = 0; i < level.size(); i++)
+			{
+				const Mesh& mesh = level[i];
+				MeshCacheEntry entry;
+				entry.lod = l;
+				entry.vertexCount = (uint32_t)mesh.vertices.size();
+				entry.indexCount = (uint32_t)mesh.indices.size();
+				const vector<glm::mat4>* placed = l == 0 && i < placements.size() ? &placements[i] : nullptr;
+				entry.placementCount = placed ? (uint32_t)placed->size() : 0;
+				const vector<uint32_t>* baked = l == 0 && i < lightBakes.size() ? &lightBakes[i] : nullptr;
+				entry.lightBakeCount = baked ? (uint32_t)baked->size() : 0;
+				const vector<Meshlet>* cut = l == 0 && i < meshlets.size() ? &meshlets[i] : nullptr;
+				entry.meshletCount = cut ? (uint32_t)cut->size() : 0;
+				const MeshBvh* tree = l == 0 && shape && i < shape->meshes.size() && !shape->meshes[i].empty() ? &shape->meshes[i] : nullptr;
+				entry.bvhNodeCount = tree ? (uint32_t)tree->treeNodes().size() : 0;
+				for (int c = 0; c < 3; c++)
+				{
+					aiColor3D color = c < (int)mesh.colors.size() ? mesh.colors[c] : aiColor3D(1.0f, 1.0f, 1.0f);
+					entry.colors[c * 3 + 0] = color.r;
+					entry.colors[c * 3 + 1] = color.g;
+					entry.colors[c * 3 + 2] = color.b;
+				}
+				out.write((const char*)&entry, sizeof(entry));
+				out.write((const char*)mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+				out.write((const char*)mesh.indices.data(), mesh.indices.size() * sizeof(GLuint));
+				if (placed)
+					out.write((const char*)placed->data(), placed->size() * sizeof(glm::mat4));
+				if (baked)
+					out.write((const char*)baked->data(), baked->size() * sizeof(uint32_t));
+				if (cut)
+					out.write((const char*)cut->data(), cut->size() * sizeof(Meshlet));
+				if (tree)
+				{
+					out.write((const char*)tree->treeNodes().data(), tree->treeNodes().size() * sizeof(MeshBvhNode));
+					out.write((const char*)tree->triangleOrder().data(), tree->triangleOrder().size() * sizeof(uint32_t));
+				}
+			}
+		}
+		if (!out)
+		{
+			out.close();
+			DeleteFileA(tempPath.c_str());
+			return false;
+		}
+	}
+
+	if (!MoveFileExA(tempPath.c_str(), cachePath.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		cout << "ERROR::MESHCACHE:: Could not write " << cachePath << endl;
+		DeleteFileA(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
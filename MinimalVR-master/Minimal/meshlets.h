@@ -0,0 +1,215 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "mesh.h"
+
+// Meshlets: each optimized mesh cut at import into runs of consecutive triangles touching at most
+// MESHLET_MAX_VERTICES vertices, each with a bounding sphere and a cone around its normals. They are stored in
+// the mesh cache, and the static batch draws them as one indirect command each, whose instance count a compute
+// pass zeroes for the ones off screen or facing away from both eyes, see StaticBatch::cullMeshlets.
+// _optimizeMesh leaves the triangles in vertex cache order, so consecutive ones are already close together and
+// cutting the index list in order is enough, nothing is reordered.
+
+// The usual mesh shader limits, small enough that most meshlets face one way
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+// Invocations per work group of the cull pass
+#define MESHLET_CULL_GROUP_SIZE 64
+
+// One meshlet, laid out as the cull pass reads it (std430). sphere is the centre and radius, cone the axis its
+// triangles face around and the cutoff of the test in MESHLET_CULL; a cutoff of 1 never culls. Straight out of
+// _buildMeshlets the indices are the mesh's own and baseVertex and baseInstance are 0, the batch rebases them.
+struct Meshlet
+{
+	glm::vec4 sphere;
+	glm::vec4 cone;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t baseVertex;
+	uint32_t baseInstance;
+};
+static_assert(sizeof(Meshlet) == 48, "Meshlet must match the std430 layout of MESHLET_CULL");
+
+// Fills in meshlet's sphere and cone from its triangles
+static void _meshletBounds(const vector<Vertex>& vertices, const vector<GLuint>& indices, Meshlet* meshlet)
+{
+	glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+	const size_t end = (size_t)meshlet->firstIndex + meshlet->indexCount;
+	for (size_t i = meshlet->firstIndex; i < end; i++)
+	{
+		low = glm::min(low, vertices[indices[i]].Position);
+		high = glm::max(high, vertices[indices[i]].Position);
+	}
+	const glm::vec3 centre = (low + high) * 0.5f;
+	float radius = 0.0f;
+	for (size_t i = meshlet->firstIndex; i < end; i++)
+		radius = std::max(radius, glm::length(vertices[indices[i]].Position - centre));
+	meshlet->sphere = glm::vec4(centre, radius);
+
+	// Counter clockwise triangles face along their cross product. Degenerate ones face nowhere and are skipped.
+	glm::vec3 sum(0.0f);
+	for (size_t i = meshlet->firstIndex; i + 2 < end; i += 3)
+	{
+		const glm::vec3 a = vertices[indices[i]].Position;
+		const glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - a, vertices[indices[i + 2]].Position - a);
+		const float length = glm::length(normal);
+		if (length > 0.0f)
+			sum += normal / length;
+	}
+	meshlet->cone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	const float sumLength = glm::length(sum);
+	if (sumLength <= 0.0f)
+		return;
+	const glm::vec3 axis = sum / sumLength;
+	float minDot = 1.0f;
+	for (size_t i = meshlet->firstIndex; i + 2 < end; i += 3)
+	{
+		const glm::vec3 a = vertices[indices[i]].Position;
+		const glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - a, vertices[indices[i + 2]].Position - a);
+		const float length = glm::length(normal);
+		if (length > 0.0f)
+			minDot = std::min(minDot, glm::dot(axis, normal / length));
+	}
+	// Normals spread over more than a hemisphere have no direction all of them face away from
+	const float cutoff = minDot <= 0.0f ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+	meshlet->cone = glm::vec4(axis, cutoff);
+}
+
+// Cuts the triangles of an optimized mesh, in order, into meshlets. Touches no GL state.
+static void _buildMeshlets(const vector<Vertex>& vertices, const vector<GLuint>& indices, vector<Meshlet>* meshlets)
+{
+	meshlets->clear();
+	// The meshlet each vertex was last counted in, so one shared within a meshlet only counts once
+	vector<uint32_t> counted(vertices.size(), UINT32_MAX);
+	Meshlet meshlet = {};
+	uint32_t vertexCount = 0;
+	for (size_t t = 0; t + 2 < indices.size(); t += 3)
+	{
+		uint32_t id = (uint32_t)meshlets->size();
+		const GLuint a = indices[t], b = indices[t + 1], c = indices[t + 2];
+		const uint32_t added = (counted[a] != id ? 1 : 0) + (counted[b] != id && b != a ? 1 : 0) + (counted[c] != id && c != a && c != b ? 1 : 0);
+		if (meshlet.indexCount && (vertexCount + added > MESHLET_MAX_VERTICES || meshlet.indexCount / 3 == MESHLET_MAX_TRIANGLES))
+		{
+			_meshletBounds(vertices, indices, &meshlet);
+			meshlets->push_back(meshlet);
+			meshlet = Meshlet();
+			meshlet.firstIndex = (uint32_t)t;
+			vertexCount = 0;
+			id++;
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			if (counted[indices[t + k]] != id)
+			{
+				counted[indices[t + k]] = id;
+				vertexCount++;
+			}
+		}
+		meshlet.indexCount += 3;
+	}
+	if (meshlet.indexCount)
+	{
+		_meshletBounds(vertices, indices, &meshlet);
+		meshlets->push_back(meshlet);
+	}
+}
+
+// meshlet moved by transform, as StaticBatch::appendCopy moves its vertices. The cone only survives a transform
+// that scales all axes alike; any other turns it off.
+static Meshlet _transformMeshlet(const Meshlet& meshlet, const glm::mat4& transform)
+{
+	Meshlet moved = meshlet;
+	const glm::vec3 scales(glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])));
+	const float scale = std::max(scales.x, std::max(scales.y, scales.z));
+	moved.sphere = glm::vec4(glm::vec3(transform * glm::vec4(glm::vec3(meshlet.sphere), 1.0f)), meshlet.sphere.w * scale);
+	const glm::vec3 axis = glm::transpose(glm::inverse(glm::mat3(transform))) * glm::vec3(meshlet.cone);
+	const bool uniform = std::min(scales.x, std::min(scales.y, scales.z)) >= scale * 0.999f;
+	moved.cone = uniform && glm::length(axis) > 0.0f ? glm::vec4(glm::normalize(axis), meshlet.cone.w) : glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	return moved;
+}
+
+// Writes one draw command per meshlet: instanceCount instances of the visible ones, none of the rest. A meshlet
+// shows if its sphere is inside an eye's frustum and that eye sees the front of at least one of its triangles:
+// it faces away when the direction from the eye to every point of the sphere is within the cone's complement,
+// meshoptimizer's sphere bounded form of the test. planes are both eyes' world space frustums, see _frustumFromMatrix.
+static const char MESHLET_CULL[] =
+	"#version 410 core\n"
+	"#extension GL_ARB_compute_shader : require\n"
+	"#extension GL_ARB_shader_storage_buffer_object : require\n"
+	"layout(local_size_x = 64) in;\n"
+	"struct Meshlet { vec4 sphere; vec4 cone; uint firstIndex; uint indexCount; int baseVertex; uint baseInstance; };\n"
+	"struct Command { uint count; uint instanceCount; uint firstIndex; int baseVertex; uint baseInstance; };\n"
+	"layout(std430) readonly buffer Meshlets { Meshlet meshlets[]; };\n"
+	"layout(std430) writeonly buffer Commands { Command commands[]; };\n"
+	"uniform uint count;\n"
+	"uniform mat4 model;\n"
+	"uniform mat3 normalMatrix;\n"
+	"uniform float modelScale;\n"
+	"uniform bool coneCulling;\n"
+	"uniform vec4 planes[12];\n"
+	"uniform vec3 eyes[2];\n"
+	"uniform uint instanceCount;\n"
+	"void main()\n"
+	"{\n"
+	"	uint i = gl_GlobalInvocationID.x;\n"
+	"	if (i >= count)\n"
+	"		return;\n"
+	"	Meshlet meshlet = meshlets[i];\n"
+	"	vec3 centre = (model * vec4(meshlet.sphere.xyz, 1.0)).xyz;\n"
+	"	float radius = meshlet.sphere.w * modelScale;\n"
+	"	vec3 axis = normalize(normalMatrix * meshlet.cone.xyz);\n"
+	"	float cutoff = coneCulling ? meshlet.cone.w : 1.0;\n"
+	"	bool visible = false;\n"
+	"	for (int e = 0; e < 2 && !visible; e++)\n"
+	"	{\n"
+	"		bool inside = true;\n"
+	"		for (int p = 0; p < 6; p++)\n"
+	"			inside = inside && dot(planes[e * 6 + p].xyz, centre) + planes[e * 6 + p].w > -radius;\n"
+	"		vec3 toCentre = centre - eyes[e];\n"
+	"		visible = inside && dot(toCentre, axis) < cutoff * length(toCentre) + radius;\n"
+	"	}\n"
+	"	commands[i] = Command(meshlet.indexCount, visible ? instanceCount : 0u, meshlet.firstIndex, meshlet.baseVertex, meshlet.baseInstance);\n"
+	"}\n";
+
+// 0 if MESHLET_CULL doesn't build, the batch then draws whole parts
+static GLuint _compileMeshletCullProgram()
+{
+	const char* source = MESHLET_CULL;
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	GLint success = 0;
+	char infoLog[512];
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+		std::cout << "ERROR::MESHLETS::COMPILATION_FAILED\n" << infoLog << std::endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glLinkProgram(program);
+	glDeleteShader(shader);
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(program, sizeof(infoLog), NULL, infoLog);
+		std::cout << "ERROR::MESHLETS::LINKING_FAILED\n" << infoLog << std::endl;
+		glDeleteProgram(program);
+		return 0;
+	}
+	glShaderStorageBlockBinding(program, glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "Meshlets"), 0);
+	glShaderStorageBlockBinding(program, glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "Commands"), 1);
+	return program;
+}
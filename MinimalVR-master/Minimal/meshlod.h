@@ -0,0 +1,122 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cmath>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "flathashmap.h"
+
+// Levels a model can have, level 0 being the imported mesh
+#define MESH_LOD_MAX_LEVELS 4
+// Each level aims for this fraction of the previous level's triangles
+#define MESH_LOD_TRIANGLE_RATIO 0.35f
+// Grid resolution the simplifier starts from, along the longest side of the mesh's box
+#define MESH_LOD_MAX_CELLS 64
+// Projected size must pass a level boundary by this fraction before the level changes
+#define MESH_LOD_HYSTERESIS 0.15f
+
+// Rossignac-Borrel vertex clustering: vertices in the same cell of a grid over the mesh's box merge into their
+// average, triangles left with fewer than three cells are dropped. The grid is coarsened until at most
+// targetTriangles remain. Cruder than edge collapse, but closed shapes like the molecules' spheres stay closed,
+// and it is linear in the mesh size. V is Vertex or anything else with its three members.
+template <typename V>
+static void _simplifyClustered(const vector<V>& vertices, const vector<GLuint>& indices, size_t targetTriangles,
+	vector<V>* outVertices, vector<GLuint>* outIndices)
+{
+	outVertices->clear();
+	outIndices->clear();
+	if (vertices.empty() || indices.size() < 3)
+		return;
+
+	glm::vec3 lo = vertices[0].Position, hi = vertices[0].Position;
+	for (size_t i = 1; i < vertices.size(); i++)
+	{
+		lo = glm::min(lo, vertices[i].Position);
+		hi = glm::max(hi, vertices[i].Position);
+	}
+	const glm::vec3 extent = hi - lo;
+	const float longest = std::max(extent.x, std::max(extent.y, extent.z));
+	if (longest <= 0.0f)
+		return;
+
+	vector<uint32_t> cluster(vertices.size());
+	FlatHashMap<uint64_t, uint32_t> cells;
+	for (float resolution = (float)MESH_LOD_MAX_CELLS; ; resolution *= 0.75f)
+	{
+		const float cellSize = longest / std::max(resolution, 1.0f);
+		cells.clear();
+		outIndices->clear();
+		uint32_t clusterCount = 0;
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			const glm::vec3 cell = (vertices[i].Position - lo) / cellSize;
+			const uint64_t key = ((uint64_t)(uint32_t)cell.x << 42) | ((uint64_t)(uint32_t)cell.y << 21) | (uint64_t)(uint32_t)cell.z;
+			bool inserted;
+			uint32_t& index = cells.insert(key, &inserted);
+			if (inserted)
+				index = clusterCount++;
+			cluster[i] = index;
+		}
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+		{
+			const uint32_t a = cluster[indices[t]], b = cluster[indices[t + 1]], c = cluster[indices[t + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			outIndices->push_back(a);
+			outIndices->push_back(b);
+			outIndices->push_back(c);
+		}
+		if (outIndices->size() / 3 <= targetTriangles || resolution <= 1.0f)
+		{
+			// Each cluster becomes the average of its vertices
+			outVertices->assign(clusterCount, V());
+			vector<uint32_t> weight(clusterCount, 0);
+			for (size_t i = 0; i < vertices.size(); i++)
+			{
+				V& merged = (*outVertices)[cluster[i]];
+				merged.Position += vertices[i].Position;
+				merged.Normal += vertices[i].Normal;
+				merged.TexCoords += vertices[i].TexCoords;
+				weight[cluster[i]]++;
+			}
+			for (uint32_t c = 0; c < clusterCount; c++)
+			{
+				V& merged = (*outVertices)[c];
+				const float inverse = 1.0f / (float)weight[c];
+				merged.Position *= inverse;
+				merged.TexCoords *= inverse;
+				const float length = glm::length(merged.Normal);
+				merged.Normal = length > 0.0f ? merged.Normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+			}
+			return;
+		}
+	}
+}
+
+// Level for an object covering projectedSize (its bounding sphere's diameter as a fraction of the view height),
+// given the level it had last frame. thresholds[l] is the smallest size level l is used at, falling with l.
+// A change only happens once the size is MESH_LOD_HYSTERESIS past the boundary, so objects sitting on one
+// don't flicker between two levels.
+static uint8_t _selectLod(float projectedSize, uint8_t previous, const float* thresholds, uint32_t levelCount)
+{
+	if (levelCount <= 1)
+		return 0;
+	uint8_t target = (uint8_t)(levelCount - 1);
+	for (uint32_t l = 0; l + 1 < levelCount; l++)
+	{
+		if (projectedSize >= thresholds[l])
+		{
+			target = (uint8_t)l;
+			break;
+		}
+	}
+	if (previous >= levelCount || target == previous)
+		return target;
+	const float boundary = thresholds[std::min(target, previous)];
+	if (target < previous)
+		return projectedSize >= boundary * (1.0f + MESH_LOD_HYSTERESIS) ? target : previous;
+	return projectedSize < boundary * (1.0f - MESH_LOD_HYSTERESIS) ? target : previous;
+}
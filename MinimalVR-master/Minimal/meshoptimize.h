@@ -0,0 +1,302 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Import time clean up of a triangle list, run on each mesh before it is uploaded and written to the mesh cache:
+//   1. weld: bitwise identical vertices become one, the OBJ importer hands out one vertex per face corner
+//   2. vertex cache: Forsyth's linear speed reordering of the triangles for post-transform cache hits
+//   3. overdraw: the cache ordered triangles are cut into clusters where the cache starts cold, and the
+//      clusters sorted so the ones facing away from the mesh centre (the outside, drawn first) come first
+//   4. vertex fetch: vertices renumbered in the order the indices first use them, unused ones dropped
+// All CPU side and without shared state, so meshes are optimized in parallel by the loading jobs.
+
+// Cache the reordering aims for, and how many entries of it the cluster split simulates
+#define MESH_OPTIMIZE_CACHE_SIZE 32
+#define MESH_OPTIMIZE_CLUSTER_CACHE_SIZE 16
+
+// Vertices that compare equal byte for byte share one index
+template <typename V>
+static void _weldVertices(vector<V>& vertices, vector<GLuint>& indices)
+{
+	const size_t count = vertices.size();
+	vector<GLuint> order(count);
+	for (size_t i = 0; i < count; i++)
+		order[i] = (GLuint)i;
+	std::sort(order.begin(), order.end(), [&](GLuint a, GLuint b)
+	{
+		int c = memcmp(&vertices[a], &vertices[b], sizeof(V));
+		return c != 0 ? c < 0 : a < b;
+	});
+
+	vector<GLuint> remap(count);
+	vector<V> welded;
+	welded.reserve(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		if (i == 0 || memcmp(&vertices[order[i]], &vertices[order[i - 1]], sizeof(V)) != 0)
+			welded.push_back(vertices[order[i]]);
+		remap[order[i]] = (GLuint)(welded.size() - 1);
+	}
+	for (size_t i = 0; i < indices.size(); i++)
+		indices[i] = remap[indices[i]];
+	vertices.swap(welded);
+}
+
+static float _vertexCacheScore(int cachePosition, uint32_t liveTriangles)
+{
+	if (liveTriangles == 0)
+		return -1.0f;
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		// The last triangle's three vertices all score the same, whichever order they went in
+		if (cachePosition < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (float)(cachePosition - 3) / (MESH_OPTIMIZE_CACHE_SIZE - 3), 1.5f);
+	}
+	// Vertices with few triangles left are worth finishing off
+	return score + 2.0f / sqrtf((float)liveTriangles);
+}
+
+// Forsyth, "Linear-Speed Vertex Cache Optimisation". Greedily emits the best scoring triangle touching the
+// simulated LRU cache, falling back to the first unemitted one when none of them has any left.
+static void _optimizeVertexCache(vector<GLuint>& indices, size_t vertexCount)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount < 2)
+		return;
+
+	// Triangles of each vertex, as offsets into one array
+	vector<uint32_t> live(vertexCount, 0), first(vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		live[indices[i]]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		first[v + 1] = first[v] + live[v];
+	vector<uint32_t> adjacency(triangleCount * 3), fill(first.begin(), first.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+			adjacency[fill[indices[t * 3 + k]]++] = (uint32_t)t;
+	}
+
+	vector<int> cachePosition(vertexCount, -1);
+	vector<float> vertexScore(vertexCount), triangleScore(triangleCount, 0.0f);
+	for (size_t v = 0; v < vertexCount; v++)
+		vertexScore[v] = _vertexCacheScore(-1, live[v]);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+			triangleScore[t] += vertexScore[indices[t * 3 + k]];
+	}
+
+	vector<uint8_t> emitted(triangleCount, 0);
+	vector<GLuint> result;
+	result.reserve(triangleCount * 3);
+	// Three spare slots past the cache for the vertices a triangle pushes out of it
+	GLuint cache[MESH_OPTIMIZE_CACHE_SIZE + 3];
+	int cacheCount = 0;
+	size_t cursor = 0;
+	int64_t best = -1;
+
+	while (result.size() < triangleCount * 3)
+	{
+		if (best < 0)
+		{
+			while (emitted[cursor])
+				cursor++;
+			best = (int64_t)cursor;
+		}
+		const size_t t = (size_t)best;
+		emitted[t] = 1;
+
+		// Emit, then move its vertices to the front of the cache
+		GLuint next[MESH_OPTIMIZE_CACHE_SIZE + 3];
+		int nextCount = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			const GLuint v = indices[t * 3 + k];
+			result.push_back(v);
+			// A degenerate triangle names a vertex twice, it still takes one cache entry
+			if (nextCount == 0 || (next[0] != v && next[nextCount - 1] != v))
+				next[nextCount++] = v;
+			// Its adjacency loses t: swap t to the end of the live part
+			uint32_t* begin = &adjacency[first[v]];
+			uint32_t* end = begin + live[v];
+			for (uint32_t* it = begin; it != end; ++it)
+			{
+				if (*it == (uint32_t)t)
+				{
+					std::swap(*it, *(end - 1));
+					break;
+				}
+			}
+			live[v]--;
+		}
+		for (int i = 0; i < cacheCount; i++)
+		{
+			const GLuint v = cache[i];
+			bool inTriangle = false;
+			for (int k = 0; k < 3 && k < nextCount; k++)
+				inTriangle = inTriangle || next[k] == v;
+			if (!inTriangle)
+				next[nextCount++] = v;
+		}
+		for (int i = 0; i < nextCount; i++)
+		{
+			cachePosition[next[i]] = i < MESH_OPTIMIZE_CACHE_SIZE ? i : -1;
+			cache[i] = next[i];
+		}
+		cacheCount = nextCount < MESH_OPTIMIZE_CACHE_SIZE ? nextCount : MESH_OPTIMIZE_CACHE_SIZE;
+
+		// Rescore everything that changed place, and their remaining triangles, picking the next best on the way
+		best = -1;
+		float bestScore = -1.0f;
+		for (int i = 0; i < nextCount; i++)
+		{
+			const GLuint v = next[i];
+			const float score = _vertexCacheScore(cachePosition[v], live[v]);
+			const float delta = score - vertexScore[v];
+			vertexScore[v] = score;
+			for (uint32_t j = 0; j < live[v]; j++)
+			{
+				const uint32_t u = adjacency[first[v] + j];
+				triangleScore[u] += delta;
+				if (triangleScore[u] > bestScore)
+				{
+					bestScore = triangleScore[u];
+					best = (int64_t)u;
+				}
+			}
+		}
+	}
+	indices.swap(result);
+}
+
+// Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", on the
+// already cache ordered triangles. A cluster starts wherever all three vertices of a triangle miss a
+// MESH_OPTIMIZE_CLUSTER_CACHE_SIZE LRU, so moving whole clusters around hardly costs any cache hits.
+template <typename V>
+static void _optimizeOverdraw(vector<GLuint>& indices, const vector<V>& vertices)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount < 2)
+		return;
+
+	vector<size_t> clusters;
+	GLuint cache[MESH_OPTIMIZE_CLUSTER_CACHE_SIZE];
+	int cacheCount = 0;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			const GLuint v = indices[t * 3 + k];
+			int found = -1;
+			for (int i = 0; i < cacheCount; i++)
+			{
+				if (cache[i] == v)
+				{
+					found = i;
+					break;
+				}
+			}
+			if (found < 0)
+			{
+				misses++;
+				found = cacheCount < MESH_OPTIMIZE_CLUSTER_CACHE_SIZE ? cacheCount++ : MESH_OPTIMIZE_CLUSTER_CACHE_SIZE - 1;
+			}
+			for (int i = found; i > 0; i--)
+				cache[i] = cache[i - 1];
+			cache[0] = v;
+		}
+		if (t == 0 || misses == 3)
+			clusters.push_back(t);
+	}
+	if (clusters.size() < 2)
+		return;
+	clusters.push_back(triangleCount);
+
+	glm::vec3 meshCentre(0.0f);
+	float meshArea = 0.0f;
+	vector<float> sortKey(clusters.size() - 1);
+	vector<glm::vec3> centres(sortKey.size()), normals(sortKey.size());
+	for (size_t c = 0; c + 1 < clusters.size(); c++)
+	{
+		glm::vec3 centre(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+		{
+			const glm::vec3& a = vertices[indices[t * 3 + 0]].Position;
+			const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+			const glm::vec3& d = vertices[indices[t * 3 + 2]].Position;
+			const glm::vec3 n = glm::cross(b - a, d - a);
+			const float triangleArea = glm::length(n);
+			centre += (a + b + d) * (triangleArea / 3.0f);
+			normal += n;
+			area += triangleArea;
+		}
+		centres[c] = area > 0.0f ? centre / area : centre;
+		normals[c] = glm::length(normal) > 0.0f ? glm::normalize(normal) : normal;
+		meshCentre += centre;
+		meshArea += area;
+	}
+	if (meshArea > 0.0f)
+		meshCentre /= meshArea;
+	for (size_t c = 0; c < sortKey.size(); c++)
+		sortKey[c] = glm::dot(centres[c] - meshCentre, normals[c]);
+
+	vector<size_t> order(sortKey.size());
+	for (size_t c = 0; c < order.size(); c++)
+		order[c] = c;
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+	vector<GLuint> result;
+	result.reserve(indices.size());
+	for (size_t i = 0; i < order.size(); i++)
+		result.insert(result.end(), indices.begin() + clusters[order[i]] * 3, indices.begin() + clusters[order[i] + 1] * 3);
+	indices.swap(result);
+}
+
+// Vertices in first use order, so the draw walks the vertex buffer front to back. Drops unreferenced vertices.
+template <typename V>
+static void _optimizeVertexFetch(vector<V>& vertices, vector<GLuint>& indices)
+{
+	const GLuint unused = 0xFFFFFFFFu;
+	vector<GLuint> remap(vertices.size(), unused);
+	vector<V> ordered;
+	ordered.reserve(vertices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		GLuint& slot = remap[indices[i]];
+		if (slot == unused)
+		{
+			slot = (GLuint)ordered.size();
+			ordered.push_back(vertices[indices[i]]);
+		}
+		indices[i] = slot;
+	}
+	vertices.swap(ordered);
+}
+
+// All four steps. Only meshes that are whole triangles get reordered, points and lines are just welded.
+template <typename V>
+static void _optimizeMesh(vector<V>& vertices, vector<GLuint>& indices)
+{
+	if (vertices.empty() || indices.empty())
+		return;
+	_weldVertices(vertices, indices);
+	if (indices.size() % 3 != 0)
+		return;
+	_optimizeVertexCache(indices, vertices.size());
+	_optimizeOverdraw(indices, vertices);
+	_optimizeVertexFetch(vertices, indices);
+}
@@ -0,0 +1,150 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <assimp/types.h>
+#include "mesh.h"
+#include "flathashmap.h"
+
+// Finding the sub-meshes of a model that are the same part over again, placed somewhere else: exporters write the
+// pipes, bolts and tanks of an industrial model out once per copy, already moved into place, so the copies only
+// differ by a translation. Two meshes are taken for the same part when their indices and colors are identical and
+// every vertex matches to within MESH_REPEAT_TOLERANCE of the part's size, positions relative to the first vertex.
+
+// Of the larger of the two boxes' sizes
+#define MESH_REPEAT_TOLERANCE 1e-4f
+
+// What is compared of one mesh, pointing at the caller's vectors
+struct MeshShape
+{
+	const vector<Vertex>* vertices;
+	const vector<GLuint>* indices;
+	const vector<aiColor3D>* colors;
+};
+
+static inline uint64_t _hashRepeatBytes(uint64_t hash, const void* data, size_t size)
+{
+	// FNV-1a
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	return hash;
+}
+
+static float _meshShapeSize(const MeshShape& shape)
+{
+	glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+	for (const Vertex& vertex : *shape.vertices)
+	{
+		low = glm::min(low, vertex.Position);
+		high = glm::max(high, vertex.Position);
+	}
+	const glm::vec3 size = high - low;
+	return std::max(std::max(size.x, size.y), size.z);
+}
+
+// The same for every translated copy of a shape, bar copies that land either side of a rounding step and are
+// then only missed: the exact parts and the layout relative to the first vertex in steps of a thousandth of the size
+static uint64_t _meshShapeHash(const MeshShape& shape, float size)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const uint64_t counts[2] = { shape.vertices->size(), shape.indices->size() };
+	hash = _hashRepeatBytes(hash, counts, sizeof(counts));
+	hash = _hashRepeatBytes(hash, shape.indices->data(), shape.indices->size() * sizeof(GLuint));
+	hash = _hashRepeatBytes(hash, shape.colors->data(), shape.colors->size() * sizeof(aiColor3D));
+	if (shape.vertices->empty())
+		return hash;
+	const glm::vec3 origin = (*shape.vertices)[0].Position;
+	const float step = std::max(size * 1e-3f, 1e-6f);
+	for (const Vertex& vertex : *shape.vertices)
+	{
+		const glm::vec3 relative = (vertex.Position - origin) / step;
+		const int32_t cell[3] = { (int32_t)floorf(relative.x + 0.5f), (int32_t)floorf(relative.y + 0.5f), (int32_t)floorf(relative.z + 0.5f) };
+		hash = _hashRepeatBytes(hash, cell, sizeof(cell));
+	}
+	return hash;
+}
+
+static bool _sameMeshShape(const MeshShape& a, const MeshShape& b, float size)
+{
+	if (a.vertices->size() != b.vertices->size() || *a.indices != *b.indices || a.colors->size() != b.colors->size())
+		return false;
+	for (size_t i = 0; i < a.colors->size(); i++)
+	{
+		const aiColor3D& ca = (*a.colors)[i];
+		const aiColor3D& cb = (*b.colors)[i];
+		if (ca.r != cb.r || ca.g != cb.g || ca.b != cb.b)
+			return false;
+	}
+	if (a.vertices->empty())
+		return true;
+	const float tolerance = std::max(size * MESH_REPEAT_TOLERANCE, 1e-6f);
+	const glm::vec3 originA = (*a.vertices)[0].Position;
+	const glm::vec3 originB = (*b.vertices)[0].Position;
+	for (size_t i = 0; i < a.vertices->size(); i++)
+	{
+		const Vertex& va = (*a.vertices)[i];
+		const Vertex& vb = (*b.vertices)[i];
+		const glm::vec3 position = glm::abs((va.Position - originA) - (vb.Position - originB));
+		const glm::vec3 normal = glm::abs(va.Normal - vb.Normal);
+		const glm::vec2 texCoords = glm::abs(va.TexCoords - vb.TexCoords);
+		if (std::max(std::max(position.x, position.y), position.z) > tolerance || std::max(std::max(normal.x, normal.y), normal.z) > 1e-3f ||
+			std::max(texCoords.x, texCoords.y) > 1e-4f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// For every shape, the first one of shapes it repeats (itself if none) into canonical, and how far it is moved from
+// that one into offsets. Returns how many shapes repeat an earlier one.
+static size_t _findMeshRepeats(const vector<MeshShape>& shapes, vector<size_t>* canonical, vector<glm::vec3>* offsets)
+{
+	canonical->resize(shapes.size());
+	offsets->assign(shapes.size(), glm::vec3(0.0f));
+	vector<float> sizes(shapes.size());
+	// Shapes hashing alike, chained through next so each bucket is walked from its first shape on
+	FlatHashMap<uint64_t, size_t> firsts;
+	vector<size_t> next(shapes.size(), SIZE_MAX), last(shapes.size(), SIZE_MAX);
+	size_t repeats = 0;
+	for (size_t i = 0; i < shapes.size(); i++)
+	{
+		sizes[i] = _meshShapeSize(shapes[i]);
+		(*canonical)[i] = i;
+		bool inserted = false;
+		size_t& first = firsts.insert(_meshShapeHash(shapes[i], sizes[i]), &inserted);
+		if (inserted)
+		{
+			first = i;
+			last[i] = i;
+			continue;
+		}
+		for (size_t j = first; j != SIZE_MAX; j = next[j])
+		{
+			if (_sameMeshShape(shapes[j], shapes[i], std::max(sizes[i], sizes[j])))
+			{
+				(*canonical)[i] = j;
+				if (!shapes[i].vertices->empty())
+					(*offsets)[i] = (*shapes[i].vertices)[0].Position - (*shapes[j].vertices)[0].Position;
+				repeats++;
+				break;
+			}
+		}
+		// Only shapes of their own are compared with later ones, a repeat matches whatever its own matched
+		if ((*canonical)[i] == i)
+		{
+			next[last[first]] = i;
+			last[first] = i;
+		}
+	}
+	return repeats;
+}
@@ -0,0 +1,149 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+#include <intrin.h>
+
+// Time a benchmark has to run for before its iteration count is trusted, in ms
+#define MICRO_BENCH_MIN_MS 200.0
+// Timed runs at the settled count, the median is reported
+#define MICRO_BENCH_REPETITIONS 5
+#define MICRO_BENCH_MAX_ITERATIONS 1000000000
+
+static const void* volatile _microBenchSink;
+
+// Keeps value, and whatever computed it, from being optimized away
+template <typename T>
+static inline void _doNotOptimize(const T& value)
+{
+	_microBenchSink = &value;
+	_ReadWriteBarrier();
+}
+
+// What a benchmark body gets, in the manner of Google Benchmark's State:
+//
+//	while (state.keepRunning())
+//		work();
+//
+// Setup before the loop isn't timed. pauseTiming()/resumeTiming() take per iteration setup out too, at the cost of
+// two clock reads each, so only for work that is long next to them.
+class MicroBenchState
+{
+public:
+	explicit MicroBenchState(uint64_t iterations) : total(iterations), remaining(iterations) {}
+
+	bool keepRunning()
+	{
+		if (!this->started)
+		{
+			this->started = true;
+			this->start = std::chrono::steady_clock::now();
+		}
+		if (this->remaining > 0)
+		{
+			this->remaining--;
+			return true;
+		}
+		this->elapsed += std::chrono::steady_clock::now() - this->start;
+		return false;
+	}
+
+	void pauseTiming() { this->elapsed += std::chrono::steady_clock::now() - this->start; }
+	void resumeTiming() { this->start = std::chrono::steady_clock::now(); }
+
+	// The throughput column, in whatever the body handles per iteration: joints, molecules, vertices
+	void setItemsPerIteration(uint64_t items) { this->items = items; }
+
+	uint64_t iterations() const { return this->total; }
+	uint64_t itemsPerIteration() const { return this->items; }
+	double seconds() const { return std::chrono::duration<double>(this->elapsed).count(); }
+
+private:
+	uint64_t total;
+	uint64_t remaining;
+	uint64_t items = 0;
+	bool started = false;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::duration::zero();
+};
+
+// Named benchmark bodies, run by name filter. Each body is timed with a count of iterations grown until a run takes
+// MICRO_BENCH_MIN_MS, then run MICRO_BENCH_REPETITIONS times more at that count; the table has the median and the
+// fastest time per iteration.
+class MicroBenchmarks
+{
+public:
+	void add(const char* name, std::function<void(MicroBenchState&)> body)
+	{
+		this->cases.push_back({ name, body });
+	}
+
+	// Runs every case whose name contains filter, all of them for an empty one. The number run.
+	int run(const char* filter)
+	{
+		int ran = 0;
+		char line[256];
+		snprintf(line, sizeof(line), "%-36s %14s %14s %12s %14s\n", "benchmark", "median ns", "fastest ns", "iterations", "items/s");
+		this->print(line);
+		for (size_t c = 0; c < this->cases.size(); c++)
+		{
+			const Case& bench = this->cases[c];
+			if (filter && filter[0] && !strstr(bench.name.c_str(), filter))
+				continue;
+			uint64_t iterations = 1;
+			uint64_t items = 0;
+			for (;;)
+			{
+				MicroBenchState state(iterations);
+				bench.body(state);
+				items = state.itemsPerIteration();
+				const double ms = state.seconds() * 1000.0;
+				if (ms >= MICRO_BENCH_MIN_MS || iterations >= MICRO_BENCH_MAX_ITERATIONS)
+					break;
+				// Aim past the minimum with some margin, but never more than ten times the previous count
+				const double scale = ms > 0.0 ? MICRO_BENCH_MIN_MS * 1.4 / ms : 10.0;
+				iterations = std::min<uint64_t>((uint64_t)(iterations * std::min(std::max(scale, 1.1), 10.0)) + 1, MICRO_BENCH_MAX_ITERATIONS);
+			}
+			double perIteration[MICRO_BENCH_REPETITIONS];
+			for (int r = 0; r < MICRO_BENCH_REPETITIONS; r++)
+			{
+				MicroBenchState state(iterations);
+				bench.body(state);
+				perIteration[r] = state.seconds() * 1e9 / (double)iterations;
+			}
+			std::sort(perIteration, perIteration + MICRO_BENCH_REPETITIONS);
+			const double median = perIteration[MICRO_BENCH_REPETITIONS / 2];
+			const double throughput = items && median > 0.0 ? items * 1e9 / median : 0.0;
+			snprintf(line, sizeof(line), "%-36s %14.1f %14.1f %12llu %14.4g\n", bench.name.c_str(), median, perIteration[0],
+				(unsigned long long)iterations, throughput);
+			this->print(line);
+			ran++;
+		}
+		return ran;
+	}
+
+private:
+	struct Case
+	{
+		std::string name;
+		std::function<void(MicroBenchState&)> body;
+	};
+
+	vector<Case> cases;
+
+	void print(const char* line)
+	{
+		OutputDebugStringA(line);
+		std::cout << line;
+	}
+};
@@ -6,6 +6,9 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstring>
 using namespace std;
 // GL Includes
 #include <GL/glew.h> // Contains all the necessery OpenGL includes
@@ -17,9 +20,28 @@ using namespace std;
 #include <assimp/postprocess.h>
 #include "shader.h"
 #include "Mesh.h"
+#include "meshcache.h"
+#include "assimpio.h"
+#include "staticbatch.h"
+#include "meshlod.h"
+#include "culling.h"
+#include "jobs.h"
+#include "objimport.h"
+#include "gltf.h"
+#include "meshrepeats.h"
+#include "lightbake.h"
 
 GLint TextureFromFile(const char* path, string directory);
 
+// What loadModel does with sub-meshes that are the same part moved somewhere else, see _findMeshRepeats
+enum class RepeatedMeshes
+{
+	// Every one is a mesh of its own, node transforms are baked into the vertices
+	Separate,
+	// One mesh per part, drawn at each place it appears and where the nodes put it with DrawPlaced
+	Instanced
+};
+
 class Model
 {
 public:
@@ -27,7 +49,16 @@ public:
 	Model() {};
 	/*  Functions   */
 	// Constructor, expects a filepath to a 3D model.
-	Model(GLchar* path, string name)
+	// By default the meshes only live on the GPU once loaded, pass KeepCpuData if the vertices are needed later.
+	// VertexFormat::Packed halves the GPU copy, the model then has to be drawn with a PACKED_VERTEX program.
+	// lodLevels above 1 adds simplified copies of every mesh, see _simplifyClustered; they are cached with the model.
+	// RepeatedMeshes::Instanced is for models drawn once, a model drawn through attachInstanceBuffer needs Separate.
+	// An enabled bake lights level 0 for a light that never moves relative to the model, see _bakeLighting; it is
+	// cached with the model and drawn by the batch, with a LIGHT_BAKE_DEFINE program.
+	Model(const GLchar* path, string name, MeshRetention retention = MeshRetention::ReleaseCpuData, VertexFormat format = VertexFormat::Full,
+		uint32_t lodLevels = 1, RepeatedMeshes repeats = RepeatedMeshes::Separate, const LightBakeOptions& bake = LightBakeOptions())
+		: retention(retention), format(format), lodLevels(std::min(std::max(lodLevels, 1u), (uint32_t)MESH_LOD_MAX_LEVELS)), repeats(repeats),
+		bake(bake)
 	{
 		if (name == "O2")
 		{
@@ -37,11 +68,338 @@ public:
 		this->loadModel(path);
 	}
 
+	// Stand-in to draw while the real model streams in: one grey box from -halfExtent to halfExtent
+	static shared_ptr<Model> proxy(const string& name, float halfExtent)
+	{
+		shared_ptr<Model> model = make_shared<Model>();
+		if (name == "O2")
+		{
+			model->type = 1;
+		}
+		model->placeholder = true;
+
+		vector<Vertex> vertices;
+		vector<GLuint> indices;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (int side = -1; side <= 1; side += 2)
+			{
+				glm::vec3 normal(0.0f);
+				normal[axis] = (float)side;
+				glm::vec3 u(0.0f);
+				u[(axis + 1) % 3] = 1.0f;
+				glm::vec3 v = glm::cross(normal, u);
+				GLuint base = (GLuint)vertices.size();
+				for (int corner = 0; corner < 4; corner++)
+				{
+					float s = (corner & 1) ? 1.0f : -1.0f;
+					float t = (corner & 2) ? 1.0f : -1.0f;
+					Vertex vertex;
+					vertex.Position = (normal + u * s + v * t) * halfExtent;
+					vertex.Normal = normal;
+					vertex.TexCoords = glm::vec2(s * 0.5f + 0.5f, t * 0.5f + 0.5f);
+					vertices.push_back(vertex);
+				}
+				// Counter clockwise seen from outside, (u, v, normal) is right handed
+				const GLuint quad[6] = { 0, 1, 3, 0, 3, 2 };
+				for (int i = 0; i < 6; i++)
+					indices.push_back(base + quad[i]);
+			}
+		}
+		vector<aiColor3D> colors = { aiColor3D(0.5f, 0.5f, 0.5f), aiColor3D(0.5f, 0.5f, 0.5f), aiColor3D(0.1f, 0.1f, 0.1f) };
+		model->meshes.emplace_back(std::move(vertices), std::move(indices), std::move(colors), MeshRetention::ReleaseCpuData);
+		// The box's corners, so culling keeps it as long as any of it shows
+		model->radius = halfExtent * 1.7320508f;
+		return model;
+	}
+
+	// Render thread: swaps in the meshes of a model loaded elsewhere, keeping this model's instance buffers
+	void adopt(Model&& loaded)
+	{
+		this->meshes = std::move(loaded.meshes);
+		for (uint32_t l = 1; l < MESH_LOD_MAX_LEVELS; l++)
+			this->lods[l - 1] = std::move(loaded.lods[l - 1]);
+		this->directory = std::move(loaded.directory);
+		this->format = loaded.format;
+		this->lodLevels = loaded.lodLevels;
+		this->radius = loaded.radius;
+		this->placements = std::move(loaded.placements);
+		this->lightBakes = std::move(loaded.lightBakes);
+		this->meshlets = std::move(loaded.meshlets);
+		this->rayShape = std::move(loaded.rayShape);
+		this->placedInstances.clear();
+		this->placedEyeCount = 0;
+		this->placeholder = false;
+		this->batch.reset();
+		this->batchTried = false;
+		this->visible.clear();
+		for (uint32_t l = 0; l < MESH_LOD_MAX_LEVELS; l++)
+		{
+			if (this->instanceBuffers[l])
+				this->attachInstanceBuffer(this->instanceBuffers[l], this->instanceDivisor, l);
+		}
+		this->applyVirtualTexture();
+	}
+
+	// Every level 0 mesh samples texture with the model's texture coordinates, from now and once it has loaded; the
+	// proxy box never does. Those meshes are drawn unbatched with a VIRTUAL_TEXTURE program from then on.
+	void setVirtualTexture(VirtualTexture* texture)
+	{
+		this->virtualTexture = texture;
+		this->applyVirtualTexture();
+	}
+
+	bool virtualTextured() const { return this->virtualTexture && !this->placeholder; }
+
+	// Still drawing the proxy box
+	bool isProxy() const { return this->placeholder; }
+
+	// The meshes are PackedVertex and need a PACKED_VERTEX program. Never true of the proxy box.
+	bool packed() const { return !this->placeholder && this->format == VertexFormat::Packed; }
+
+	// Levels of detail there are to draw, always 1 for the proxy box
+	uint32_t lodCount() const { return this->placeholder ? 1 : this->lodLevels; }
+
+	// The meshes of level lod, lod below lodCount()
+	const vector<Mesh>& levelMeshes(uint32_t lod) const { return lod == 0 ? this->meshes : this->lods[lod - 1]; }
+
+	// Largest distance of a level 0 vertex from the model's origin, the proxy box's corners while it is the proxy
+	float boundingRadius() const { return this->radius; }
+
+	// The triangle trees of level 0 for exact ray hits, see ModelShape. Null for the proxy box and .glb models.
+	// Hand the pointer to other threads on the render thread, adopt replaces it.
+	shared_ptr<const ModelShape> shape() const { return this->placeholder ? nullptr : this->rayShape; }
+
+	// Tests every level 0 mesh's box, placed by transform, against both eyes. Draw, DrawInstanced(lod 0) and
+	// DrawBatched then skip the meshes neither eye sees, until the next cull. Returns how many that is.
+	uint32_t cull(const StereoFrustum& frustum, const glm::mat4& transform)
+	{
+		const size_t count = this->meshes.size();
+		for (int axis = 0; axis < 3; axis++)
+		{
+			this->cullCentres[axis].resize(count);
+			this->cullExtents[axis].resize(count);
+		}
+		this->visible.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			glm::vec3 centre(0.0f), extent(0.0f);
+			if (!this->meshes[i].bounds().empty() && this->placed())
+				this->placedBounds(i, transform, &centre, &extent);
+			else if (!this->meshes[i].bounds().empty())
+				_transformAabb(this->meshes[i].bounds(), transform, &centre, &extent);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				this->cullCentres[axis][i] = centre[axis];
+				this->cullExtents[axis][i] = extent[axis];
+			}
+		}
+		_cullBoxes(this->cullCentres[0].data(), this->cullCentres[1].data(), this->cullCentres[2].data(),
+			this->cullExtents[0].data(), this->cullExtents[1].data(), this->cullExtents[2].data(), count, frustum, this->visible.data());
+		uint32_t culled = 0;
+		for (size_t i = 0; i < count; i++)
+			culled += this->visible[i] ? 0 : 1;
+		return culled;
+	}
+
+	// Tells the TextureCache how large each mesh the last cull kept shows its textures, from the size of its box
+	// seen from eye. pixelScale is the projection's y scale times half the target's height, so a unit at distance 1
+	// covers pixelScale pixels. Assumes a texture spans its mesh once.
+	void streamTextures(const glm::vec3& eye, float pixelScale) const
+	{
+		for (size_t i = 0; i < this->meshes.size(); i++)
+		{
+			if (this->meshes[i].textures.empty() || !this->shows(i) || i >= this->cullCentres[0].size())
+				continue;
+			const glm::vec3 centre(this->cullCentres[0][i], this->cullCentres[1][i], this->cullCentres[2][i]);
+			const glm::vec3 extent(this->cullExtents[0][i], this->cullExtents[1][i], this->cullExtents[2][i]);
+			const float radius = glm::length(extent);
+			// Inside the box the nearest texel is close enough to need the finest level
+			const float distance = std::max(glm::length(centre - eye) - radius, 0.01f);
+			const float pixels = 2.0f * radius * pixelScale / distance;
+			for (const Texture& texture : this->meshes[i].textures)
+				_textures.want(texture.id, pixels);
+		}
+	}
+
+	// The meshes are drawn where the nodes of a .glb put them, with DrawPlaced instead of Draw
+	bool placed() const { return !this->placeholder && !this->placements.empty(); }
+
+	// Every copy of every level 0 mesh, each at transform times its placement, one instanced draw per mesh with a
+	// program reading instanceTransform. Meshes the last cull left out are skipped.
+	void DrawPlaced(Shader& shader, const glm::mat4& transform, GLsizei eyeCount)
+	{
+		if (this->placedInstances.size() != this->meshes.size() || transform != this->placedTransform || eyeCount != this->placedEyeCount)
+		{
+			this->placedInstances.resize(this->meshes.size());
+			vector<glm::mat4> transforms;
+			for (GLuint i = 0; i < this->meshes.size(); i++)
+			{
+				if (!this->placedInstances[i])
+					this->placedInstances[i].reset(new InstanceBuffer());
+				transforms.clear();
+				for (const glm::mat4& placement : this->placements[i])
+					transforms.push_back(transform * placement);
+				this->placedInstances[i]->update(transforms);
+				this->meshes[i].attachInstanceBuffer(this->placedInstances[i]->id(), (GLuint)eyeCount);
+			}
+			this->placedTransform = transform;
+			this->placedEyeCount = eyeCount;
+		}
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			if (this->shows(i))
+				this->meshes[i].DrawInstanced(shader, this->placedInstances[i]->count() * eyeCount);
+		}
+	}
+
 	// Draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	void Draw(Shader& shader)
 	{
 		for (GLuint i = 0; i < this->meshes.size(); i++)
-			this->meshes[i].Draw(shader);
+		{
+			if (this->shows(i))
+				this->meshes[i].Draw(shader);
+		}
+	}
+
+	// The lighting the meshes of level lod need between them, see LightingModel
+	LightingModel lightingModel(uint32_t lod = 0)
+	{
+		LightingModel model = LightingModel::Unlit;
+		if (lod >= this->lodCount())
+			return model;
+		for (const Mesh& mesh : this->level(lod))
+			model = std::max(model, mesh.lightingModel());
+		return model;
+	}
+
+	// Draws instanceCount copies of every mesh of level lod using the buffer given to attachInstanceBuffer for it
+	void DrawInstanced(Shader& shader, GLsizei instanceCount, uint32_t lod = 0)
+	{
+		if (instanceCount <= 0 || lod >= this->lodCount())
+			return;
+		vector<Mesh>& level = this->level(lod);
+		for (GLuint i = 0; i < level.size(); i++)
+		{
+			if (lod != 0 || this->shows(i))
+				level[i].DrawInstanced(shader, instanceCount);
+		}
+	}
+
+	// DrawInstanced without the instancing, instanceCount transforms from the buffer drawn one call each
+	void DrawSeparately(Shader& shader, GLsizei instanceCount, GLsizei eyeCount, uint32_t lod = 0)
+	{
+		if (instanceCount <= 0 || lod >= this->lodCount())
+			return;
+		vector<Mesh>& level = this->level(lod);
+		for (GLuint i = 0; i < level.size(); i++)
+		{
+			if (lod != 0 || this->shows(i))
+				level[i].DrawSeparately(shader, instanceCount, eyeCount);
+		}
+	}
+
+	// Appends a command per mesh DrawInstanced would draw at lod, instanceCount left for whoever fills it in
+	void indirectCommands(uint32_t lod, vector<DrawElementsIndirectCommand>& commands)
+	{
+		if (lod >= this->lodCount())
+			return;
+		vector<Mesh>& level = this->level(lod);
+		for (GLuint i = 0; i < level.size(); i++)
+		{
+			if (lod != 0 || this->shows(i))
+			{
+				const GLsizeiptr indexSize = level[i].elementType() == GL_UNSIGNED_SHORT ? 2 : 4;
+				DrawElementsIndirectCommand command = { (GLuint)level[i].uploadedIndices(), 0,
+					(GLuint)(level[i].elementBlock().offset / indexSize), 0, 0 };
+				commands.push_back(command);
+			}
+		}
+	}
+
+	// Draws lod from the commands indirectCommands made, command the byte offset of the first and moved past the last
+	void DrawIndirect(Shader& shader, uint32_t lod, GLintptr* command)
+	{
+		if (lod >= this->lodCount())
+			return;
+		vector<Mesh>& level = this->level(lod);
+		for (GLuint i = 0; i < level.size(); i++)
+		{
+			if (lod != 0 || this->shows(i))
+			{
+				level[i].DrawIndirect(shader, *command);
+				*command += sizeof(DrawElementsIndirectCommand);
+			}
+		}
+	}
+
+	// Each level draws from its own buffer. Remembered, so meshes adopted later draw from the same buffers.
+	void attachInstanceBuffer(GLuint buffer, GLuint divisor = 1, uint32_t lod = 0)
+	{
+		if (lod >= MESH_LOD_MAX_LEVELS)
+			return;
+		this->instanceBuffers[lod] = buffer;
+		this->instanceDivisor = divisor;
+		if (lod >= this->lodCount())
+			return;
+		vector<Mesh>& level = this->level(lod);
+		for (GLuint i = 0; i < level.size(); i++)
+			level[i].attachInstanceBuffer(buffer, divisor);
+		if (lod == 0 && this->batch)
+			this->batch->attachInstanceBuffer(buffer, divisor);
+	}
+
+	// True once the meshes are merged into a StaticBatch, built on the first call after loading, placed meshes
+	// pretransformed into it a copy per placement. Proxies, single unplaced meshes and textured models keep drawing
+	// mesh by mesh.
+	bool batched()
+	{
+		if (!this->batchTried && !this->placeholder)
+		{
+			this->batchTried = true;
+			if (this->meshes.size() > 1 || this->placed())
+			{
+				unique_ptr<StaticBatch> batch(new StaticBatch());
+				if (batch->build(this->meshes, this->placed() ? &this->placements : nullptr, this->lightBakes.empty() ? nullptr : &this->lightBakes,
+					this->meshlets.empty() ? nullptr : &this->meshlets))
+				{
+					if (this->instanceBuffers[0])
+						batch->attachInstanceBuffer(this->instanceBuffers[0], this->instanceDivisor);
+					this->batch = std::move(batch);
+					vector<vector<uint32_t>>().swap(this->lightBakes);
+					vector<vector<Meshlet>>().swap(this->meshlets);
+				}
+			}
+		}
+		return this->batch != nullptr;
+	}
+
+	// The batch draws the bake, and needs a LIGHT_BAKE_DEFINE program for it. Only valid when batched().
+	bool lightBaked() const { return this->batch && this->batch->lightBaked(); }
+
+	// DrawInstanced through the batch, with a shader compiled with STATIC_BATCH. Only valid when batched().
+	void DrawBatched(Shader& shader, GLsizei instanceCount)
+	{
+		shader.Use();
+		this->batch->draw(instanceCount, this->visible.empty() ? nullptr : this->visible.data());
+	}
+
+	// Culls the batch's meshlets for the eyes at eyes, see StaticBatch::cullMeshlets. False, having done nothing, if
+	// the model has no meshlets to cull; otherwise DrawMeshlets draws what is left. Only valid when batched().
+	bool cullMeshlets(const StereoFrustum& frustum, const glm::mat4& transform, const glm::vec3 eyes[2], GLsizei instanceCount)
+	{
+		if (!this->batch->meshletCulled())
+			return false;
+		this->batch->cullMeshlets(frustum, transform, eyes, (GLuint)instanceCount);
+		return true;
+	}
+
+	// The meshlets the last cullMeshlets kept, with a shader compiled with STATIC_BATCH
+	void DrawMeshlets(Shader& shader)
+	{
+		shader.Use();
+		this->batch->drawMeshlets();
 	}
 
 	bool is_O2() { return type; }
@@ -50,89 +408,466 @@ private:
 	/*  Model Data  */
 	string directory;
 	vector<Mesh> meshes;
+	MeshRetention retention = MeshRetention::ReleaseCpuData;
+	VertexFormat format = VertexFormat::Full;
+	uint32_t lodLevels = 1;
+	RepeatedMeshes repeats = RepeatedMeshes::Separate;
+	LightBakeOptions bake;
+	// Per level 0 mesh when baked, until the batch has taken them, see _bakeLighting
+	vector<vector<uint32_t>> lightBakes;
+	// Per level 0 mesh, until the batch has taken them, see _buildMeshlets
+	vector<vector<Meshlet>> meshlets;
+	shared_ptr<const ModelShape> rayShape;
+	VirtualTexture* virtualTexture = nullptr;
+	// Levels 1 and up, meshes being level 0. Every level has one mesh per level 0 mesh.
+	vector<Mesh> lods[MESH_LOD_MAX_LEVELS - 1];
+	float radius = 0.0f;
+	bool placeholder = false;
+	GLuint instanceBuffers[MESH_LOD_MAX_LEVELS] = {};
+	GLuint instanceDivisor = 1;
+	unique_ptr<StaticBatch> batch;
+	bool batchTried = false;
+	// Eye mask of each level 0 mesh from the last cull, empty when there hasn't been one since loading
+	vector<uint8_t> visible;
+	// Mesh boxes in the space cull was given, reused from call to call
+	vector<float> cullCentres[3], cullExtents[3];
+	// Per level 0 mesh, the model space transforms of its copies. Empty unless the model came from a .glb.
+	vector<vector<glm::mat4>> placements;
+	// DrawPlaced's transforms, refilled only when the model's transform or the eye count changes
+	vector<unique_ptr<InstanceBuffer>> placedInstances;
+	glm::mat4 placedTransform;
+	GLsizei placedEyeCount = 0;
 	/*  Functions   */
-	// Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-	void loadModel(string path)
+	// Box around every copy of mesh, transform applied on top of the placements
+	void placedBounds(size_t mesh, const glm::mat4& transform, glm::vec3* centre, glm::vec3* extent) const
 	{
-		// Read file via ASSIMP
-		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
-		// Check for errors
-		if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+		glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+		for (const glm::mat4& placement : this->placements[mesh])
 		{
-			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+			glm::vec3 c, e;
+			_transformAabb(this->meshes[mesh].bounds(), transform * placement, &c, &e);
+			low = glm::min(low, c - e);
+			high = glm::max(high, c + e);
+		}
+		*centre = (low + high) * 0.5f;
+		*extent = (high - low) * 0.5f;
+	}
+
+	void applyVirtualTexture()
+	{
+		if (this->placeholder || !this->virtualTexture)
 			return;
+		for (Mesh& mesh : this->meshes)
+			mesh.setVirtualTexture(this->virtualTexture);
+		// A batch built before has the meshes without it
+		this->batch.reset();
+		this->batchTried = false;
+	}
+
+	bool shows(size_t mesh) const
+	{
+		return this->visible.empty() || this->visible[mesh];
+	}
+
+	vector<Mesh>& level(uint32_t lod)
+	{
+		return lod == 0 ? this->meshes : this->lods[lod - 1];
+	}
+
+	void measure(const Vertex* vertices, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+			this->radius = std::max(this->radius, glm::length(vertices[i].Position));
+	}
+
+	// For a placed mesh, the radius of its box where each placement puts it
+	void measurePlaced(const Aabb& bounds, const vector<glm::mat4>& placements)
+	{
+		if (bounds.empty())
+			return;
+		for (const glm::mat4& placement : placements)
+		{
+			glm::vec3 centre, extent;
+			_transformAabb(bounds, placement, &centre, &extent);
+			this->radius = std::max(this->radius, glm::length(centre) + glm::length(extent));
 		}
+	}
+
+	// Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+	void loadModel(string path)
+	{
+		TRACE_ZONE("load model");
+		AllocationTagScope tagScope(AllocationTag::ModelImport);
+		const uint32_t importFlags = aiProcess_Triangulate | aiProcess_FlipUVs;
 		// Retrieve the directory path of the filepath
 		this->directory = path.substr(0, path.find_last_of('/'));
 
-		// Process ASSIMP's root node recursively
-		this->processNode(scene->mRootNode, scene);
+		if (_isGltfPath(path))
+		{
+			this->loadGltf(path);
+			return;
+		}
+
+		// Warm start: upload straight from the mapped cache and skip Assimp entirely
+		if (this->loadCache(path, importFlags))
+			return;
+
+		// Where the nodes put each source, identity for OBJ files
+		vector<MeshSource> sources;
+		vector<glm::mat4> transforms;
+		if (_nativeObjImport && _isObjPath(path))
+		{
+			// Opt-in native parser for OBJ, the sources it fills are the same as Assimp's and cache the same way
+			vector<ObjMesh> objMeshes;
+			if (!_importObj(path, &objMeshes))
+				return;
+			sources.resize(objMeshes.size());
+			_jobs.parallelFor(objMeshes.size(), 1, [&](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+				{
+					sources[i].vertices = std::move(objMeshes[i].vertices);
+					sources[i].indices = std::move(objMeshes[i].indices);
+					sources[i].colors = std::move(objMeshes[i].colors);
+				}
+			});
+			transforms.assign(sources.size(), glm::mat4());
+		}
+		else
+		{
+			// Read file via ASSIMP, with a pooled importer that reads from mapped views; the scene stays valid until it's returned
+			ImporterPool::Handle importer = _importers.acquire();
+			const aiScene* scene = importer->ReadFile(path, importFlags);
+			// Check for errors
+			if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+			{
+				cout << "ERROR::ASSIMP:: " << importer->GetErrorString() << endl;
+				return;
+			}
+
+			// Meshes in node order, then converted in parallel into preallocated sources, then uploaded on this thread
+			vector<const aiMesh*> order;
+			order.reserve(scene->mNumMeshes);
+			this->processNode(scene->mRootNode, scene, glm::mat4(), order, transforms);
+
+			sources.resize(order.size());
+			_jobs.parallelFor(order.size(), 1, [&](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+					this->processMesh(order[i], scene, sources[i]);
+			});
+		}
+
+		// Repeats are found before optimizing, which could order two copies' vertices differently
+		vector<vector<glm::mat4>> placements;
+		if (this->repeats == RepeatedMeshes::Instanced)
+			this->collapseRepeats(sources, transforms, &placements);
+		_jobs.parallelFor(sources.size(), 1, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				if (this->repeats == RepeatedMeshes::Separate)
+					this->bakeTransform(transforms[i], sources[i]);
+				this->buildLevels(sources[i]);
+			}
+		});
+
+		shared_ptr<ModelShape> shape = make_shared<ModelShape>();
+		for (uint32_t l = 0; l < this->lodLevels; l++)
+		{
+			vector<Mesh>& level = this->level(l);
+			level.reserve(sources.size());
+			for (GLuint i = 0; i < sources.size(); i++)
+			{
+				MeshSource& source = sources[i];
+				if (l == 0)
+				{
+					if (placements.empty())
+						this->measure(source.vertices.data(), source.vertices.size());
+					this->meshlets.push_back(std::move(source.meshlets));
+					shape->meshes.emplace_back(source.vertices.data(), source.indices.data(), std::move(source.bvhNodes), std::move(source.bvhOrder));
+					level.emplace_back(std::move(source.vertices), std::move(source.indices), vector<aiColor3D>(source.colors),
+						MeshRetention::KeepCpuData, this->format);
+					if (!placements.empty())
+						this->measurePlaced(level.back().bounds(), placements[i]);
+				}
+				else
+				{
+					level.emplace_back(std::move(source.lodVertices[l - 1]), std::move(source.lodIndices[l - 1]), vector<aiColor3D>(source.colors),
+						MeshRetention::KeepCpuData, this->format);
+				}
+			}
+		}
+
+		this->placements = std::move(placements);
+		if (this->bake.enabled)
+			_bakeLighting(this->meshes, this->placements, this->radius, this->bake, &this->lightBakes);
+		shape->placements = this->placements;
+		shape->radius = this->radius;
+		this->rayShape = shape;
+
+		// The cache is written from the CPU copies, so they are only dropped afterwards
+		_writeMeshCache(path, importFlags, this->repeats == RepeatedMeshes::Instanced, &this->meshes, this->lods, this->lodLevels, this->placements,
+			this->bake, this->lightBakes, this->meshlets, shape.get());
+		if (this->retention == MeshRetention::ReleaseCpuData)
+		{
+			for (uint32_t l = 0; l < this->lodLevels; l++)
+			{
+				vector<Mesh>& level = this->level(l);
+				for (GLuint i = 0; i < level.size(); i++)
+					level[i].releaseCpuData();
+			}
+		}
 	}
 
-	// Processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode* node, const aiScene* scene)
+	// Builds the meshes from a valid cache file, returns false if there is none or it is stale.
+	bool loadCache(const string& path, uint32_t importFlags)
 	{
-		// Process each mesh located at the current node
+		AllocationTagScope tagScope(AllocationTag::MeshData);
+		MappedFile file;
+		vector<MeshCacheView> views;
+		if (!_readMeshCache(path, importFlags, this->repeats == RepeatedMeshes::Instanced, this->lodLevels, this->bake, &file, &views))
+			return false;
+
+		shared_ptr<ModelShape> shape = make_shared<ModelShape>();
+		for (GLuint i = 0; i < views.size(); i++)
+		{
+			const MeshCacheView& view = views[i];
+			vector<Mesh>& level = this->level(view.lod);
+			if (view.lod == 0 && !view.placementCount)
+				this->measure(view.vertices, view.vertexCount);
+			if (this->retention == MeshRetention::KeepCpuData)
+			{
+				vector<Vertex> vertices(view.vertices, view.vertices + view.vertexCount);
+				vector<GLuint> indices(view.indices, view.indices + view.indexCount);
+				vector<aiColor3D> colors = view.colors;
+				level.emplace_back(std::move(vertices), std::move(indices), std::move(colors), MeshRetention::KeepCpuData, this->format);
+			}
+			else
+			{
+				level.emplace_back(view.vertices, view.vertexCount, view.indices, view.indexCount, view.colors, this->format);
+			}
+			if (view.placementCount)
+			{
+				this->placements.emplace_back(view.placements, view.placements + view.placementCount);
+				this->measurePlaced(level.back().bounds(), this->placements.back());
+			}
+			if (view.lod == 0 && this->bake.enabled)
+				this->lightBakes.emplace_back(view.lightBake, view.lightBake + view.lightBakeCount);
+			if (view.lod == 0)
+			{
+				this->meshlets.emplace_back(view.meshlets, view.meshlets + view.meshletCount);
+				if (view.bvhNodeCount)
+				{
+					shape->meshes.emplace_back(view.vertices, view.indices, vector<MeshBvhNode>(view.bvhNodes, view.bvhNodes + view.bvhNodeCount),
+						vector<uint32_t>(view.bvhOrder, view.bvhOrder + view.indexCount / 3));
+				}
+				else
+				{
+					shape->meshes.emplace_back();
+				}
+			}
+		}
+		shape->placements = this->placements;
+		shape->radius = this->radius;
+		this->rayShape = shape;
+		return true;
+	}
+
+	// A .glb's buffers are already what gets uploaded, so it skips the mesh cache, the optimizer, the levels of
+	// detail and the light bake. Each mesh keeps the placements its nodes give it, see DrawPlaced.
+	void loadGltf(const string& path)
+	{
+		GltfScene scene;
+		if (!_importGltf(path, &scene))
+			return;
+		this->lodLevels = 1;
+		this->meshes.reserve(scene.primitives.size());
+		for (GltfPrimitive& primitive : scene.primitives)
+		{
+			if (this->retention == MeshRetention::KeepCpuData)
+			{
+				vector<Vertex> vertices(primitive.vertices, primitive.vertices + primitive.vertexCount);
+				vector<GLuint> indices(primitive.indexCount);
+				for (GLsizei i = 0; i < primitive.indexCount; i++)
+					indices[i] = primitive.indexType == GL_UNSIGNED_SHORT ? ((const GLushort*)primitive.indices)[i] : ((const GLuint*)primitive.indices)[i];
+				this->meshes.emplace_back(std::move(vertices), std::move(indices), std::move(primitive.colors), MeshRetention::KeepCpuData, this->format);
+			}
+			else if (primitive.indexType == GL_UNSIGNED_SHORT)
+			{
+				this->meshes.emplace_back(primitive.vertices, primitive.vertexCount, (const GLushort*)primitive.indices, primitive.indexCount,
+					primitive.colors, this->format);
+			}
+			else
+			{
+				this->meshes.emplace_back(primitive.vertices, primitive.vertexCount, (const GLuint*)primitive.indices, primitive.indexCount,
+					primitive.colors, this->format);
+			}
+
+			this->measurePlaced(this->meshes.back().bounds(), primitive.placements);
+			this->placements.push_back(std::move(primitive.placements));
+		}
+	}
+
+	// CPU side of one mesh, filled by a loading job and turned into a Mesh on the GL thread
+	struct MeshSource
+	{
+		vector<Vertex> vertices;
+		vector<GLuint> indices;
+		vector<aiColor3D> colors;
+		// Levels 1 and up, when the model has them
+		vector<Vertex> lodVertices[MESH_LOD_MAX_LEVELS - 1];
+		vector<GLuint> lodIndices[MESH_LOD_MAX_LEVELS - 1];
+		// Of the optimized level 0
+		vector<Meshlet> meshlets;
+		vector<MeshBvhNode> bvhNodes;
+		vector<uint32_t> bvhOrder;
+	};
+
+	// Collects the meshes referenced by node and its children (if any) in depth first order, each with the transform
+	// of the node it hangs off, parent being that of node's parent. Nothing is converted here, the node tree is just
+	// walked so the conversion can be spread over the job system.
+	void processNode(const aiNode* node, const aiScene* scene, const glm::mat4& parent, vector<const aiMesh*>& order, vector<glm::mat4>& transforms)
+	{
+		// aiMatrix4x4 is row major
+		const glm::mat4 transform = parent * glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+		// The node object only contains indices to index the actual objects in the scene.
+		// The scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 		for (GLuint i = 0; i < node->mNumMeshes; i++)
 		{
-			// The node object only contains indices to index the actual objects in the scene. 
-			// The scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			this->meshes.push_back(this->processMesh(mesh, scene));
+			order.push_back(scene->mMeshes[node->mMeshes[i]]);
+			transforms.push_back(transform);
 		}
-		// After we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (GLuint i = 0; i < node->mNumChildren; i++)
+			this->processNode(node->mChildren[i], scene, transform, order, transforms);
+	}
+
+	// Moves source's vertices to where its node puts them. A mirroring transform also flips the triangles, so they
+	// keep facing out.
+	void bakeTransform(const glm::mat4& transform, MeshSource& source) const
+	{
+		if (transform == glm::mat4())
+			return;
+		const glm::mat3 normalTransform = glm::transpose(glm::inverse(glm::mat3(transform)));
+		for (Vertex& vertex : source.vertices)
+		{
+			vertex.Position = glm::vec3(transform * glm::vec4(vertex.Position, 1.0f));
+			if (vertex.Normal != glm::vec3(0.0f))
+				vertex.Normal = glm::normalize(normalTransform * vertex.Normal);
+		}
+		if (glm::determinant(glm::mat3(transform)) < 0.0f)
 		{
-			this->processNode(node->mChildren[i], scene);
+			for (size_t i = 0; i + 2 < source.indices.size(); i += 3)
+				std::swap(source.indices[i + 1], source.indices[i + 2]);
 		}
+	}
+
+	// Keeps the first source of every part in sources, with one placement per place it appears into placements:
+	// the node transform, moved by how far the copy is from the kept one. Leaves everything as it is if no part
+	// repeats and no node moves its meshes.
+	void collapseRepeats(vector<MeshSource>& sources, const vector<glm::mat4>& transforms, vector<vector<glm::mat4>>* placements) const
+	{
+		vector<MeshShape> shapes(sources.size());
+		for (size_t i = 0; i < sources.size(); i++)
+			shapes[i] = { &sources[i].vertices, &sources[i].indices, &sources[i].colors };
+		vector<size_t> canonical;
+		vector<glm::vec3> offsets;
+		const size_t repeated = _findMeshRepeats(shapes, &canonical, &offsets);
+		bool moved = false;
+		for (size_t i = 0; i < transforms.size(); i++)
+			moved = moved || transforms[i] != glm::mat4();
+		if (!repeated && !moved)
+			return;
 
+		vector<MeshSource> kept;
+		vector<size_t> slot(sources.size());
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			if (canonical[i] == i)
+			{
+				slot[i] = kept.size();
+				kept.push_back(std::move(sources[i]));
+				placements->emplace_back();
+			}
+			(*placements)[slot[canonical[i]]].push_back(transforms[i] * glm::translate(glm::mat4(), offsets[i]));
+		}
+		sources = std::move(kept);
 	}
 
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+	// Optimizes source's mesh, cuts it into meshlets, builds its triangle tree and simplifies it into the model's further levels. Touches no GL
+	// state.
+	void buildLevels(MeshSource& source) const
 	{
-		// Data to fill
-		vector<Vertex> vertices;
-		vector<GLuint> indices;
-		vector<Texture> textures;
-		vector<aiColor3D> col;
-		// Walk through each of the mesh's vertices
-		for (GLuint i = 0; i < mesh->mNumVertices; i++)
-		{
-			Vertex vertex;
-			glm::vec3 vector; // We declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
-							  // Positions
-			vector.x = mesh->mVertices[i].x;
-			vector.y = mesh->mVertices[i].y;
-			vector.z = mesh->mVertices[i].z;
-			vertex.Position = vector;
-			// Normals
-			vector.x = mesh->mNormals[i].x;
-			vector.y = mesh->mNormals[i].y;
-			vector.z = mesh->mNormals[i].z;
-			vertex.Normal = vector;
-			// Texture Coordinates
-			if (mesh->mTextureCoords[0]) // Does the mesh contain texture coordinates?
-			{
-				glm::vec2 vec;
-				// A vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
-				// use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-				vec.x = mesh->mTextureCoords[0][i].x;
-				vec.y = mesh->mTextureCoords[0][i].y;
-				vertex.TexCoords = vec;
+		AllocationTagScope tagScope(AllocationTag::MeshData);
+		// Welded and reordered here, so the mesh cache stores the optimized mesh and warm starts skip this too
+		_optimizeMesh(source.vertices, source.indices);
+		_buildMeshlets(source.vertices, source.indices, &source.meshlets);
+		_buildMeshBvh(source.vertices, source.indices, &source.bvhNodes, &source.bvhOrder);
+
+		// Each level simplifies the one before it. One too small to simplify any further repeats it.
+		for (uint32_t l = 1; l < this->lodLevels; l++)
+		{
+			const vector<Vertex>& coarserVertices = l == 1 ? source.vertices : source.lodVertices[l - 2];
+			const vector<GLuint>& coarserIndices = l == 1 ? source.indices : source.lodIndices[l - 2];
+			vector<Vertex>& lodVertices = source.lodVertices[l - 1];
+			vector<GLuint>& lodIndices = source.lodIndices[l - 1];
+			const size_t target = (size_t)(coarserIndices.size() / 3 * MESH_LOD_TRIANGLE_RATIO);
+			_simplifyClustered(coarserVertices, coarserIndices, target, &lodVertices, &lodIndices);
+			if (lodIndices.empty())
+			{
+				lodVertices = coarserVertices;
+				lodIndices = coarserIndices;
 			}
-			else
-				vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-			vertices.push_back(vertex);
+			_optimizeMesh(lodVertices, lodIndices);
 		}
-		// Now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+	}
+
+	// Converts one aiMesh into source, as it is in the file: loadModel places and optimizes it after. Touches no GL
+	// state and only reads the scene, so meshes convert in parallel.
+	void processMesh(const aiMesh* mesh, const aiScene* scene, MeshSource& source) const
+	{
+		AllocationTagScope tagScope(AllocationTag::MeshData);
+		// Data to fill, sized up front and written in place
+		vector<Vertex>& vertices = source.vertices;
+		vector<GLuint>& indices = source.indices;
+		vector<aiColor3D>& col = source.colors;
+		const GLuint vertexCount = mesh->mNumVertices;
+		vertices.resize(vertexCount);
+
+		// One attribute per loop: aiVector3D and glm::vec3 are both three packed floats, so each loop is a strided copy
+		static_assert(sizeof(aiVector3D) == sizeof(glm::vec3), "aiVector3D must be three packed floats");
+		for (GLuint i = 0; i < vertexCount; i++)
+			memcpy(&vertices[i].Position, &mesh->mVertices[i], sizeof(glm::vec3));
+		if (mesh->mNormals)
+		{
+			for (GLuint i = 0; i < vertexCount; i++)
+				memcpy(&vertices[i].Normal, &mesh->mNormals[i], sizeof(glm::vec3));
+		}
+		else
+		{
+			for (GLuint i = 0; i < vertexCount; i++)
+				vertices[i].Normal = glm::vec3(0.0f, 0.0f, 0.0f);
+		}
+		// A vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't
+		// use models where a vertex can have multiple texture coordinates so we always take the first set (0).
+		const aiVector3D* texCoords = mesh->mTextureCoords[0];
+		for (GLuint i = 0; i < vertexCount; i++)
+			vertices[i].TexCoords = texCoords ? glm::vec2(texCoords[i].x, texCoords[i].y) : glm::vec2(0.0f, 0.0f);
+
+		// Faces are triangles after aiProcess_Triangulate, except for the odd point or line, so size the
+		// index array exactly first and then copy each face's indices straight in
+		size_t indexCount = 0;
+		for (GLuint i = 0; i < mesh->mNumFaces; i++)
+			indexCount += mesh->mFaces[i].mNumIndices;
+		indices.resize(indexCount);
+		GLuint* out = indices.data();
 		for (GLuint i = 0; i < mesh->mNumFaces; i++)
 		{
-			aiFace face = mesh->mFaces[i];
-			// Retrieve all indices of the face and store them in the indices vector
-			for (GLuint j = 0; j < face.mNumIndices; j++)
-				indices.push_back(face.mIndices[j]);
+			const aiFace& face = mesh->mFaces[i];
+			memcpy(out, face.mIndices, face.mNumIndices * sizeof(GLuint));
+			out += face.mNumIndices;
 		}
+
 		// Process materials
 		
 		if (mesh->mMaterialIndex >= 0)
@@ -169,26 +904,28 @@ private:
 			//textures.insert(textures.end(), shininessMaps.begin(), shininessMaps.end());
 		}
 
-		// Return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, col);
 	}
 
-	// Checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// The required info is returned as a Texture struct.
-	
+	// Gets all material textures of a given type through the shared texture cache, which only loads the ones
+	// no model has loaded yet. Each returned Texture holds one cache reference. Needs a current GL context.
 	vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
 	{
-		vector<Texture> textures;
-		for (GLuint i = 0; i < mat->GetTextureCount(type); i++)
+		vector<aiString> names(mat->GetTextureCount(type));
+		vector<string> paths(names.size());
+		for (GLuint i = 0; i < names.size(); i++)
+		{
+			mat->GetTexture(type, i, &names[i]);
+			paths[i] = this->directory + '/' + names[i].C_Str();
+		}
+		vector<GLuint> ids;
+		_textures.acquire(paths, &ids);
+
+		vector<Texture> textures(names.size());
+		for (GLuint i = 0; i < names.size(); i++)
 		{
-			aiString str;
-			mat->GetTexture(type, i, &str);
-			// Check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			Texture texture;
-			texture.id = TextureFromFile(str.C_Str(), this->directory);
-			texture.type = typeName;
-			texture.path = str;
-			textures.push_back(texture);
+			textures[i].id = ids[i];
+			textures[i].type = typeName;
+			textures[i].path = names[i];
 		}
 		return textures;
 	}
@@ -196,26 +933,8 @@ private:
 
 
 
+// Decoded, mipmapped and uploaded once per path, the caller owns one reference (see TextureCache::release)
 GLint TextureFromFile(const char* path, string directory)
 {
-	//Generate texture ID and load texture data 
-	string filename = string(path);
-	filename = directory + '/' + filename;
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-	int width, height;
-	//unsigned char* image = SOIL_load_image(filename.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
-	// Assign texture to ID
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	//glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	// Parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	//SOIL_free_image_data(image);
-	return textureID;
+	return (GLint)_textures.acquire(directory + '/' + path);
 }
@@ -0,0 +1,91 @@
+#version 330 core
+// STEREO_MULTIVIEW is defined by the app for the GL_OVR_multiview2 variant, see RiftApp::StereoMode
+#ifdef STEREO_MULTIVIEW
+#extension GL_OVR_multiview2 : require
+layout(num_views = 2) in;
+#endif
+// PACKED_VERTEX reads a PackedVertex mesh: shorts scaled into the mesh's box by positionScale/positionBias,
+// an octahedral normal in the xy of a 2_10_10_10, half float texture coordinates
+#ifdef PACKED_VERTEX
+layout (location = 0) in vec3 packedPosition;
+layout (location = 1) in vec4 packedNormal;
+uniform vec3 positionScale;
+uniform vec3 positionBias;
+#else
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+#endif
+layout (location = 2) in vec2 texCoords;
+// One model matrix per instance (per pair of instances in instanced stereo), see InstanceBuffer
+layout (location = 5) in mat4 instanceTransform;
+
+// World space, what the scene light and the clustered point lights are worked out in
+out vec3 WorldPos;
+out vec3 WorldNormal;
+
+// Element 0 is the left eye. Mono rendering only uses element 0.
+// With LATE_LATCH the cameras come from the block RiftApp rewrites right before the draws are issued.
+#ifdef LATE_LATCH
+layout(std140) uniform LateLatch
+{
+	mat4 view[2];
+	mat4 projection[2];
+	mat4 hands[2];
+};
+#else
+uniform mat4 view[2];
+uniform mat4 projection[2];
+#endif
+// Instanced stereo: every draw is issued with eyeCount times the instances, eye = gl_InstanceID % eyeCount.
+// eyeViewport squeezes each eye into its half of the shared target: xy scale, zw offset in NDC.
+uniform int eyeCount = 1;
+uniform vec4 eyeViewport[2];
+
+#ifdef BILLBOARD_FADE
+// The projected size the scene buckets the molecule by: lodRadius, the model's bounding radius, as seen from lodEye
+// with lodFocal the projection's y scale. Sizes from lodFade.x down to lodFade.y fade into the billboard.
+uniform vec2 lodFade = vec2(0.0, -1.0);
+uniform vec3 lodEye;
+uniform float lodFocal;
+uniform float lodRadius;
+flat out float billboardFade;
+#endif
+
+#ifdef PACKED_VERTEX
+vec3 octahedralDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+	if (n.z < 0.0f)
+		n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	return normalize(n);
+}
+#endif
+
+void main()
+{
+#ifdef PACKED_VERTEX
+	vec3 position = packedPosition * positionScale + positionBias;
+	vec3 normal = octahedralDecode(packedNormal.xy / 511.0f);
+#endif
+#ifdef STEREO_MULTIVIEW
+	int eye = int(gl_ViewID_OVR);
+#else
+	int eye = gl_InstanceID % eyeCount;
+#endif
+    vec4 clip = projection[eye] * view[eye] * instanceTransform * vec4(position, 1.0f);
+#ifndef STEREO_MULTIVIEW
+	if (eyeCount > 1)
+	{
+		// Keep each eye out of the other's half, GL_CLIP_DISTANCE0 is enabled by RiftApp
+		gl_ClipDistance[0] = eye == 0 ? clip.w - clip.x : clip.w + clip.x;
+		clip.xy = clip.xy * eyeViewport[eye].xy + eyeViewport[eye].zw * clip.w;
+	}
+#endif
+    gl_Position = clip;
+	WorldPos = vec3(instanceTransform * vec4(position, 1.0f));
+	WorldNormal = mat3(instanceTransform) * normal;
+#ifdef BILLBOARD_FADE
+	float size = lodRadius * length(instanceTransform[0].xyz) * lodFocal / max(length(lodEye - instanceTransform[3].xyz), 0.01f);
+	billboardFade = clamp((lodFade.x - size) / (lodFade.x - lodFade.y), 0.0f, 1.0f);
+#endif
+}
@@ -0,0 +1,269 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "glstate.h"
+#include "shader.h"
+#include "instancing.h"
+#include "model.h"
+#include "molecules.h"
+#include "packedvertex.h"
+#include "staticbatch.h"
+#include "glcapture.h"
+#include "renderstats.h"
+
+// Levels of detail a type has in the arena, MOLECULE_LOD_LEVELS of the scene
+#define MOLECULE_ARENA_LEVELS 3
+// Meshes of the arena, one per type and level: mesh = type * MOLECULE_ARENA_LEVELS + level
+#define MOLECULE_ARENA_MESHES ((int)MoleculeType::Count * MOLECULE_ARENA_LEVELS)
+// Source meshes all the arena's meshes are made of between them, a material and a quantization each
+#define MOLECULE_ARENA_MAX_PARTS 32
+// Texture units of the vertex and index buffer textures moleculepull.vert fetches from, above HIZ_TEXTURE_UNIT
+#define MOLECULE_ARENA_VERTEX_UNIT 16
+#define MOLECULE_ARENA_INDEX_UNIT 17
+// moleculepull.vert's array lengths, spelled out to match the ones above. The parts' materials go through shader.frag's
+// STATIC_BATCH block, so the programs are built with STATIC_BATCH_DEFINE too.
+#define MOLECULE_ARENA_DEFINE "#define MOLECULE_ARENA_MESHES 6\n#define MOLECULE_ARENA_MAX_PARTS 32\n"
+
+// Every level of every molecule type in one vertex and one index buffer, drawn by vertex pulling: there are no
+// vertex attributes but the instance transform, moleculepull.vert fetches the index at gl_VertexID and the
+// PackedVertex it names through buffer textures. The mesh an instance draws rides in its transform's bottom right
+// element, which an affine transform has no other use for, so CO2 and O2 instances share one buffer and one draw, and
+// a conversion is nothing but a different number written there.
+//
+// A level's draw runs the longest of the types' index counts at that level; the shorter types' instances turn the
+// rest into degenerate triangles off screen. Instances are grouped by level and each level is one
+// glDrawArraysInstancedBaseInstance of every type for both eyes, which the baseInstance starts at its group.
+//
+// The meshes are copied buffer to buffer out of the models' own, no CPU copy is needed. Each part keeps its 16 bit
+// indices as they are and adds its first vertex in the shader, so nothing is rebased either. Needs
+// GL_ARB_base_instance; the buffer textures are GL 3.1.
+class MoleculeArena
+{
+public:
+	MoleculeArena() {}
+	~MoleculeArena()
+	{
+		GLuint buffers[2] = { this->vertexBuffer, this->indexBuffer };
+		glDeleteBuffers(2, buffers);
+		GLuint textures[2] = { this->vertexTexture, this->indexTexture };
+		glDeleteTextures(2, textures);
+		if (this->materialBuffer)
+			glDeleteBuffers(1, &this->materialBuffer);
+		if (this->vertexArray)
+			glDeleteVertexArrays(1, &this->vertexArray);
+	}
+
+	MoleculeArena(const MoleculeArena&) = delete;
+	MoleculeArena& operator=(const MoleculeArena&) = delete;
+
+	static bool supported()
+	{
+		return GLEW_ARB_base_instance != 0;
+	}
+
+	bool built() const { return this->ready; }
+
+	static uint32_t mesh(MoleculeType type, uint32_t level)
+	{
+		return (uint32_t)type * MOLECULE_ARENA_LEVELS + level;
+	}
+
+	// Copies every level of models[type] in. Both must be loaded and packed; false, leaving the arena empty, if a mesh
+	// has 32 bit indices or there are more parts than the shader's tables hold.
+	bool build(Model* models[(int)MoleculeType::Count])
+	{
+		vector<const Mesh*> parts;
+		for (int t = 0; t < (int)MoleculeType::Count; t++)
+		{
+			if (!models[t]->packed())
+				return false;
+			const uint32_t levels = std::min(models[t]->lodCount(), (uint32_t)MOLECULE_ARENA_LEVELS);
+			for (uint32_t l = 0; l < MOLECULE_ARENA_LEVELS; l++)
+			{
+				// A model with fewer levels draws its last one in their place
+				const vector<Mesh>& level = models[t]->levelMeshes(std::min(l, levels - 1));
+				glm::vec4& mesh = this->meshes[t * MOLECULE_ARENA_LEVELS + l];
+				mesh = glm::vec4(0.0f, 0.0f, (float)parts.size(), models[t]->boundingRadius());
+				for (const Mesh& part : level)
+				{
+					if (part.elementType() != GL_UNSIGNED_SHORT)
+					{
+						std::cout << "ERROR::MOLECULE_ARENA::WIDE_INDICES" << std::endl;
+						return false;
+					}
+					mesh.y += (float)part.uploadedIndices();
+					parts.push_back(&part);
+				}
+			}
+		}
+		if (parts.size() > MOLECULE_ARENA_MAX_PARTS)
+		{
+			std::cout << "ERROR::MOLECULE_ARENA::TOO_MANY_PARTS " << parts.size() << std::endl;
+			return false;
+		}
+
+		GLsizeiptr vertexCount = 0, indexCount = 0;
+		for (const Mesh* part : parts)
+		{
+			vertexCount += part->uploadedVertices();
+			indexCount += part->uploadedIndices();
+		}
+		GLint limit = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &limit);
+		if (vertexCount > limit || indexCount > limit)
+		{
+			std::cout << "ERROR::MOLECULE_ARENA::TOO_LARGE " << vertexCount << " vertices, " << indexCount << " indices" << std::endl;
+			return false;
+		}
+
+		glGenBuffers(1, &this->vertexBuffer);
+		glGenBuffers(1, &this->indexBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, this->vertexBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, std::max(vertexCount, (GLsizeiptr)1) * sizeof(PackedVertex), NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, this->indexBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, std::max(indexCount, (GLsizeiptr)1) * sizeof(GLushort), NULL, GL_STATIC_DRAW);
+
+		// The meshes' parts back to back in the order the table above counted them, so each mesh's indices are one range
+		vector<StaticBatchMaterial> materials(parts.size());
+		GLsizeiptr firstVertex = 0, firstIndex = 0;
+		int part = 0;
+		for (int m = 0; m < MOLECULE_ARENA_MESHES; m++)
+		{
+			glm::vec4& mesh = this->meshes[m];
+			mesh.x = (float)firstIndex;
+			const int end = m + 1 < MOLECULE_ARENA_MESHES ? (int)this->meshes[m + 1].z : (int)parts.size();
+			for (; part < end; part++)
+			{
+				const Mesh& source = *parts[part];
+				glBindBuffer(GL_COPY_READ_BUFFER, source.vertexBlock().buffer);
+				glBindBuffer(GL_COPY_WRITE_BUFFER, this->vertexBuffer);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, source.vertexBlock().offset,
+					firstVertex * sizeof(PackedVertex), source.uploadedVertices() * sizeof(PackedVertex));
+				glBindBuffer(GL_COPY_READ_BUFFER, source.elementBlock().buffer);
+				glBindBuffer(GL_COPY_WRITE_BUFFER, this->indexBuffer);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, source.elementBlock().offset,
+					firstIndex * sizeof(GLushort), source.uploadedIndices() * sizeof(GLushort));
+				firstIndex += source.uploadedIndices();
+				this->parts[2 * part] = glm::vec4(source.packedScale(), (float)firstIndex);
+				this->parts[2 * part + 1] = glm::vec4(source.packedBias(), (float)firstVertex);
+				firstVertex += source.uploadedVertices();
+
+				StaticBatchMaterial& material = materials[part];
+				material.ambient = glm::vec4(source.ambient(), 0.0f);
+				material.diffuse = glm::vec4(source.diffuse(), 0.0f);
+				material.specular = source.specular();
+				// Mesh::bindMaterial's fixed shininess
+				material.shininess = 50.0f;
+			}
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		for (uint32_t l = 0; l < MOLECULE_ARENA_LEVELS; l++)
+		{
+			this->levelIndices[l] = 0;
+			for (int t = 0; t < (int)MoleculeType::Count; t++)
+				this->levelIndices[l] = std::max(this->levelIndices[l], (GLsizei)this->meshes[t * MOLECULE_ARENA_LEVELS + l].y);
+		}
+
+		glGenTextures(1, &this->vertexTexture);
+		_glState.bindBufferTexture(MOLECULE_ARENA_VERTEX_UNIT, this->vertexTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, this->vertexBuffer);
+		glGenTextures(1, &this->indexTexture);
+		_glState.bindBufferTexture(MOLECULE_ARENA_INDEX_UNIT, this->indexTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, this->indexBuffer);
+		_glState.bindBufferTexture(MOLECULE_ARENA_INDEX_UNIT, 0);
+		_glState.bindBufferTexture(MOLECULE_ARENA_VERTEX_UNIT, 0);
+
+		glGenBuffers(1, &this->materialBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, this->materialBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, materials.size() * sizeof(StaticBatchMaterial), materials.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		glGenVertexArrays(1, &this->vertexArray);
+		this->ready = true;
+		return true;
+	}
+
+	// Replaces the instances: transforms has levelCounts[0] of level 0, then level 1's and so on, every type mixed in
+	// each level and each transform carrying its mesh, see tag()
+	void update(const vector<glm::mat4>& transforms, const GLsizei levelCounts[MOLECULE_ARENA_LEVELS])
+	{
+		GLsizei first = 0;
+		for (uint32_t l = 0; l < MOLECULE_ARENA_LEVELS; l++)
+		{
+			this->levelFirst[l] = first;
+			this->levelCount[l] = levelCounts[l];
+			first += levelCounts[l];
+		}
+		this->instances.update(transforms);
+	}
+
+	// Stamps the mesh into a transform bound for update()
+	static void tag(glm::mat4& transform, uint32_t mesh)
+	{
+		transform[3][3] = (float)mesh;
+	}
+
+	// Instance transforms repeat divisor times, once per eye in instanced stereo
+	void attach(GLuint divisor)
+	{
+		if (!this->ready || divisor == this->divisor)
+			return;
+		this->divisor = divisor;
+		_attachInstanceTransforms(this->vertexArray, this->instances.id(), divisor);
+	}
+
+	// Every instance of update() with a moleculepull.vert program already in use, eyeCount copies of each
+	void draw(Shader& shader, GLsizei eyeCount)
+	{
+		if (!this->ready || !this->instances.count())
+			return;
+		this->attach((GLuint)eyeCount);
+		_glState.bindVertexArray(this->vertexArray);
+		_glState.bindBufferTexture(MOLECULE_ARENA_VERTEX_UNIT, this->vertexTexture);
+		_glState.bindBufferTexture(MOLECULE_ARENA_INDEX_UNIT, this->indexTexture);
+		shader.set("arenaVertices", (GLint)MOLECULE_ARENA_VERTEX_UNIT);
+		shader.set("arenaIndices", (GLint)MOLECULE_ARENA_INDEX_UNIT);
+		shader.set("arenaMeshes", this->meshes, MOLECULE_ARENA_MESHES);
+		shader.set("arenaParts", this->parts, 2 * MOLECULE_ARENA_MAX_PARTS);
+		glBindBufferBase(GL_UNIFORM_BUFFER, STATIC_BATCH_BINDING, this->materialBuffer);
+		for (uint32_t l = 0; l < MOLECULE_ARENA_LEVELS; l++)
+		{
+			if (!this->levelCount[l] || !this->levelIndices[l])
+				continue;
+			const GLsizei count = this->levelCount[l] * eyeCount;
+			glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, this->levelIndices[l], count, (GLuint)this->levelFirst[l]);
+			_glCapture.drawArrays(GL_TRIANGLES, 0, this->levelIndices[l], count, (GLuint)this->levelFirst[l]);
+			_renderStats.draw(GL_TRIANGLES, this->levelIndices[l], count);
+		}
+		_glState.bindVertexArray(0);
+	}
+
+private:
+	bool ready = false;
+	GLuint vertexBuffer = 0;
+	GLuint indexBuffer = 0;
+	GLuint vertexTexture = 0;
+	GLuint indexTexture = 0;
+	GLuint materialBuffer = 0;
+	GLuint vertexArray = 0;
+	GLuint divisor = 0;
+	InstanceBuffer instances;
+
+	// moleculepull.vert's tables. Per mesh: first index, index count, first part, bounding radius. Per part, two
+	// elements: its positionScale and the end of its indices, its positionBias and its first vertex.
+	glm::vec4 meshes[MOLECULE_ARENA_MESHES];
+	glm::vec4 parts[2 * MOLECULE_ARENA_MAX_PARTS];
+	// Vertices each level's draw runs, the longest of its meshes
+	GLsizei levelIndices[MOLECULE_ARENA_LEVELS] = {};
+	// Where each level's instances start in the buffer and how many there are
+	GLsizei levelFirst[MOLECULE_ARENA_LEVELS] = {};
+	GLsizei levelCount[MOLECULE_ARENA_LEVELS] = {};
+};
@@ -0,0 +1,466 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cfloat>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+#include "molecules.h"
+#include "collisions.h"
+#include "spatialgrid.h"
+#include "picking.h"
+#include "meshbvh.h"
+#include "jobs.h"
+#include "alloctag.h"
+#include "random.h"
+
+// The molecule game on its own: spawning, the integration, the lasers' conversions and the round's outcome. Nothing
+// here touches GL or the Oculus SDK, so the app's simulation thread and the headless server (moleculeserver.h) step
+// the same code.
+
+// The molecule velocities and spin rates are per step. They were tuned when the game advanced
+// once per eye render, i.e. 180 times a second on a 90 Hz headset, so that is the step rate.
+static const float MOLECULE_STEP_SECONDS = 1.0f / 180.0f;
+static const int MOLECULE_MAX_STEPS = 8;
+// Below this many molecules a brute force SIMD pass beats walking the grid
+static const size_t PICK_GRID_THRESHOLD = 512;
+// Molecules a round has room for, sized up front so spawning never reallocates. The round is lost at 10 CO2, the rest
+// is O2, the oldest of which make way for new spawns once it's full.
+static const size_t MOLECULE_GAME_CAPACITY = 256;
+// Molecules per job below which splitting the integration across cores isn't worth it
+static const size_t MOLECULE_JOB_GRAIN = 4096;
+// The collision tests cost more per molecule than the integration, so they split finer
+static const size_t MOLECULE_COLLISION_GRAIN = 1024;
+// Radius of the sphere the molecules collide as: the models span about a unit, drawn at MOLECULE_SCALE
+static const float MOLECULE_COLLISION_RADIUS = 0.025f;
+// Scale the molecule models are placed at
+static const float MOLECULE_SCALE = 0.05f;
+// Box the molecules bounce around in, in front of the factory
+static const MoleculeBounds MOLECULE_GAME_BOUNDS = { glm::vec3(-1.0f, -1.2f, -3.0f), glm::vec3(1.0f, 0.3f, -0.8f) };
+// Conversion points one frame hands on, as many as the app's particles have bursts for
+static const size_t MOLECULE_MAX_CONVERSION_POINTS = 16;
+// Players besides the first one SceneInput carries, a server's other clients of a session
+static const uint32_t SCENE_INPUT_MAX_OTHER_PLAYERS = 3;
+
+// One player's lasers and triggers
+struct ScenePlayer {
+	PickRay leftRay, rightRay;
+	bool leftTrigger{ false };
+	bool rightTrigger{ false };
+};
+
+// What the render thread hands the simulation each frame. Requests are counters so none is lost
+// when the simulation only picks up the newest of several inputs.
+struct SceneInput {
+	// Wall clock seconds since the game started, the simulation steps through the difference
+	double time{ 0 };
+	PickRay leftRay, rightRay;
+	bool leftTrigger{ false };
+	bool rightTrigger{ false };
+	uint32_t resetRequests{ 0 };
+	// Molecules of the benchmark's stress scene, 0 for the game
+	uint32_t stressMolecules{ 0 };
+	// The render thread simulates the stress scene on the GPU
+	bool gpuMolecules{ false };
+	// Everyone else playing the same round, who pick with their own lasers as the first player does
+	ScenePlayer otherPlayers[SCENE_INPUT_MAX_OTHER_PLAYERS];
+	uint32_t otherPlayerCount{ 0 };
+};
+
+// Everything the render thread needs from one simulation step, immutable once published
+struct SceneFrame {
+	vector<glm::mat4> co2Transforms;
+	vector<glm::mat4> o2Transforms;
+	bool won{ false };
+	bool lost{ false };
+	// Molecules turned into O2 so far, the render thread buzzes the controllers when it goes up
+	uint32_t conversions{ 0 };
+	// Where the CPU simulation's conversions since the last frame happened, MOLECULE_MAX_CONVERSION_POINTS at most
+	vector<glm::vec3> conversionPoints;
+	// The molecules are on the GPU: every fixed step run so far, and the lasers to test after the ones since the
+	// last frame
+	bool gpuMolecules{ false };
+	uint64_t steps{ 0 };
+	PickRay leftRay, rightRay;
+	bool picking{ false };
+};
+
+struct MoleculeGameConfig
+{
+	// Molecules a round plays with, lower than MOLECULE_GAME_CAPACITY where the GPU calibration found that many too much
+	size_t capacity = MOLECULE_GAME_CAPACITY;
+	// Bounce the molecules off each other as well as the walls
+	bool collisions = true;
+	// Everything the game places or sets spinning comes from it, so a replayed trace spawns the same
+	uint32_t seed = 0;
+};
+
+// One round of the game. Belongs to whichever thread calls step(); only setShapes() and takeGpuMolecules() may be
+// called from another. The lasers are tested against the CO2 mesh and stopped by the factory once setShapes() has
+// them, until then against a sphere around each molecule and nothing, which is all a server without the models has.
+class MoleculeGame
+{
+public:
+	MoleculeGame(const MoleculeGameConfig& config, JobSystem& jobs)
+		: config(config), jobs(jobs), random(config.seed, RANDOM_STREAM_MOLECULES)
+	{
+		this->grid.init(MOLECULE_GAME_BOUNDS.min, MOLECULE_GAME_BOUNDS.max, 0.1f);
+		this->collisions.setRadius(MOLECULE_COLLISION_RADIUS);
+		this->reset();
+	}
+
+	MoleculeGame(const MoleculeGame&) = delete;
+	MoleculeGame& operator=(const MoleculeGame&) = delete;
+
+	// The molecules as the last step() left them, for replicating to clients (moleculereplication.h). The thread
+	// calling step(), between its calls.
+	const MoleculeStore& moleculeStore() const { return this->molecules; }
+
+	// The triangle trees pick() tests against, and where the factory stands. Any thread.
+	void setShapes(shared_ptr<const ModelShape> co2, shared_ptr<const ModelShape> factory, const glm::mat4& factoryWorld)
+	{
+		std::lock_guard<std::mutex> lock(this->shapeLock);
+		this->co2Shape = std::move(co2);
+		this->factoryShape = std::move(factory);
+		this->factoryWorld = factoryWorld;
+	}
+
+	// A stress scene bound for the GPU, once step() has handed it over: true with it moved into store. Any thread.
+	bool takeGpuMolecules(MoleculeStore* store)
+	{
+		if (!this->gpuHandoffReady)
+			return false;
+		std::lock_guard<std::mutex> lock(this->gpuHandoffLock);
+		*store = std::move(this->gpuHandoff);
+		this->gpuHandoff = MoleculeStore();
+		this->gpuHandoffReady = false;
+		return true;
+	}
+
+	// One frame of the game: handles a pending reset, runs the fixed steps the input clock asks for,
+	// tests the lasers and writes the result into frame
+	void step(const SceneInput& input, SceneFrame& frame)
+	{
+		AllocationTagScope tagScope(AllocationTag::Gameplay);
+		if ((this->won || this->lost) && input.resetRequests != this->resetsSeen)
+			this->restart();
+		this->resetsSeen = input.resetRequests;
+		if (input.stressMolecules != this->stressMolecules)
+		{
+			this->stressMolecules = input.stressMolecules;
+			this->reset();
+		}
+
+		// Fixed timestep, so the game runs at the same speed whatever the frame rate.
+		// After a long stall the excess is dropped instead of being caught up in one frame.
+		this->accumulator = std::min(this->accumulator + (float)std::max(input.time - this->time, 0.0), MOLECULE_STEP_SECONDS * MOLECULE_MAX_STEPS);
+		this->time = input.time;
+		while (this->accumulator >= MOLECULE_STEP_SECONDS)
+		{
+			this->simulate(MOLECULE_STEP_SECONDS);
+			this->accumulator -= MOLECULE_STEP_SECONDS;
+			this->steps++;
+		}
+
+		// The GPU takes a stress scene over as soon as it is built, from then on the simulation only counts steps.
+		// A game is left on the CPU, its rules need every molecule every step.
+		frame.gpuMolecules = this->stressMolecules && input.gpuMolecules;
+		if (frame.gpuMolecules && !this->molecules.empty())
+		{
+			std::lock_guard<std::mutex> lock(this->gpuHandoffLock);
+			this->gpuHandoff = std::move(this->molecules);
+			this->molecules = MoleculeStore();
+			this->gpuHandoffReady = true;
+		}
+		frame.steps = this->steps;
+		frame.leftRay = input.leftRay;
+		frame.rightRay = input.rightRay;
+		frame.picking = input.leftTrigger && input.rightTrigger;
+
+		// The lasers only move once per frame, so that is how often they are tested
+		this->pick(input.leftRay, input.rightRay, input.leftTrigger, input.rightTrigger);
+		for (uint32_t p = 0; p < std::min(input.otherPlayerCount, SCENE_INPUT_MAX_OTHER_PLAYERS); p++)
+		{
+			const ScenePlayer& player = input.otherPlayers[p];
+			this->pick(player.leftRay, player.rightRay, player.leftTrigger, player.rightTrigger);
+		}
+		this->drainMoleculeEvents();
+
+		frame.co2Transforms.clear();
+		frame.o2Transforms.clear();
+		frame.co2Transforms.reserve(this->molecules.capacity());
+		frame.o2Transforms.reserve(this->molecules.capacity());
+		// Lost, the render thread draws the loss field in their place
+		if (!this->lost)
+		{
+			for (size_t i = 0; i < this->molecules.size(); i++)
+			{
+				const glm::mat4 transform = this->molecules.transform(i, MOLECULE_SCALE);
+				(this->molecules.type[i] == MoleculeType::CO2 && !this->won) ? frame.co2Transforms.push_back(transform) : frame.o2Transforms.push_back(transform);
+			}
+		}
+		frame.won = this->won;
+		frame.lost = this->lost;
+		frame.conversions = this->conversions;
+		frame.conversionPoints.assign(this->conversionPoints.begin(), this->conversionPoints.end());
+		this->conversionPoints.clear();
+	}
+
+private:
+	// Builds the start of a round and keeps it in roundStart for restart()
+	void reset()
+	{
+		this->setUp();
+		this->molecules.capture(&this->roundStart);
+	}
+
+	// The next round, from roundStart rather than built again: the store copied back and the engine seeded anew, so
+	// the round plays out differently from the one before. Allocation free.
+	void restart()
+	{
+		this->molecules.restore(this->roundStart);
+		this->o2Order.clear();
+		this->o2Next = 0;
+		this->grid.clear();
+		this->won = false;
+		this->lost = false;
+		this->accumulator = 0;
+		this->duration = 0;
+		this->rounds++;
+		this->random.seed(this->config.seed + this->rounds, RANDOM_STREAM_MOLECULES);
+	}
+
+	// Builds the gameplay state of a round from nothing, spawning with the engine
+	void setUp()
+	{
+		this->molecules.setCapacity(this->stressMolecules ? this->stressMolecules : this->config.capacity);
+		this->o2Order.clear();
+		this->o2Order.reserve(this->config.capacity);
+		this->o2Next = 0;
+		this->grid.clear();
+		this->won = false;
+		this->lost = false;
+		this->accumulator = 0;
+		this->duration = 0;
+
+		const MoleculeBounds& bounds = MOLECULE_GAME_BOUNDS;
+		if (this->stressMolecules)
+		{
+			// Every position at once, an axis at a time
+			const uint32_t n = this->stressMolecules;
+			vector<float> positions(3 * n);
+			RandomFill fill(this->config.seed, RANDOM_STREAM_MOLECULES);
+			fill.fill(positions.data(), n, bounds.min.x, bounds.max.x);
+			fill.fill(positions.data() + n, n, bounds.min.y, bounds.max.y);
+			fill.fill(positions.data() + 2 * n, n, bounds.min.z, bounds.max.z);
+			for (uint32_t i = 0; i < n; i++)
+				this->spawn(glm::vec3(positions[i], positions[n + i], positions[2 * n + i]));
+			return;
+		}
+
+		for (int i = 0; i < 5; i++)
+			this->spawn(this->random.uniform(glm::vec3(-0.7f, -1.0f, -2.4f), glm::vec3(0.7f, 0.0f, -0.4f)));
+	}
+
+	// Adds a CO2 molecule at position with a random drift and spin
+	void spawn(const glm::vec3& position)
+	{
+		glm::vec3 velocity = this->random.uniform(glm::vec3(0.0003f), glm::vec3(0.0008f));
+		velocity.x *= this->random.sign();
+		velocity.y *= this->random.sign();
+		velocity.z *= this->random.sign();
+		const float r = this->random.uniform(0.01f, 0.02f);
+		const glm::vec3 axis = this->random.uniform(glm::vec3(0.0f), glm::vec3(1.0f));
+		if (this->molecules.full())
+			this->despawnOldestO2();
+		this->molecules.add(MoleculeType::CO2, position, velocity, r, axis);
+	}
+
+	// Makes room in a full round. The grid mirrors the store by index and shrinks the same way, the molecule moved
+	// into the hole is put right by the next grid update.
+	void despawnOldestO2()
+	{
+		while (this->o2Next < this->o2Order.size())
+		{
+			if (this->molecules.remove(this->o2Order[this->o2Next++]))
+			{
+				this->grid.pop();
+				return;
+			}
+		}
+	}
+
+	// The store's events since the last step: counts the conversions and queues the new O2s to be despawned first come,
+	// first served. Anything else keeping handles would catch up here too.
+	void drainMoleculeEvents()
+	{
+		for (const MoleculeEvent& event : this->molecules.events())
+		{
+			if (event.kind == MoleculeEventKind::Converted && event.type == MoleculeType::O2)
+			{
+				this->conversions++;
+				const size_t index = this->molecules.indexOf(event.handle);
+				if (index != SIZE_MAX && this->conversionPoints.size() < MOLECULE_MAX_CONVERSION_POINTS)
+					this->conversionPoints.push_back(this->molecules.position(index));
+				// Compacted once the served half is most of it, spawns stay allocation free
+				if (this->o2Order.size() == this->o2Order.capacity() && this->o2Next > 0)
+				{
+					this->o2Order.erase(this->o2Order.begin(), this->o2Order.begin() + this->o2Next);
+					this->o2Next = 0;
+				}
+				this->o2Order.push_back(event.handle);
+			}
+		}
+		this->molecules.clearEvents();
+	}
+
+	// Advances the game by one fixed step of dt seconds
+	void simulate(float dt)
+	{
+		// A stress scene only moves
+		if (!this->stressMolecules)
+		{
+			// Every molecule has been turned into O2
+			if (!this->molecules.empty() && this->molecules.count(MoleculeType::CO2) == 0)
+				this->won = true;
+			if (this->molecules.count(MoleculeType::CO2) >= 10)
+				this->lost = true;
+			if (this->won || this->lost)
+				return;
+
+			// Checking whether to spawn a CO2, the timer runs on simulated (wall clock) time
+			this->duration += dt;
+			if (this->duration > 1.5f)
+			{
+				this->duration = 0;
+				// New molecules come out of the factory chimney
+				this->spawn(glm::vec3(0.0f, -0.8f, -2.0f));
+			}
+		}
+
+		// Move, bounce and spin everything in one pass over the packed arrays
+		this->jobs.parallelFor(this->molecules.size(), MOLECULE_JOB_GRAIN, [&](size_t begin, size_t end) {
+			this->molecules.integrate(MOLECULE_GAME_BOUNDS, begin, end);
+		});
+		this->collide();
+		for (size_t i = 0; i < this->molecules.size(); i++)
+			this->grid.update((uint32_t)i, this->molecules.position(i));
+	}
+
+	// Bounces the molecules that moved into each other this step, the new velocities take them apart from the next
+	void collide()
+	{
+		if (!this->config.collisions)
+			return;
+		this->collisions.build(this->molecules);
+		this->jobs.parallelFor(this->molecules.size(), MOLECULE_COLLISION_GRAIN, [&](size_t begin, size_t end) {
+			this->collisions.collide(this->molecules, begin, end);
+		});
+		this->collisions.apply(this->molecules, 0, this->molecules.size());
+	}
+
+	// Tests both lasers against every molecule, once per frame. A CO2 molecule caught by both
+	// lasers while both triggers are held turns into O2. The factory stops the lasers. Once the models have loaded,
+	// the molecules near a laser are hit against the CO2 mesh itself, until then against a sphere around their centre.
+	void pick(const PickRay& left, const PickRay& right, bool leftTrigger, bool rightTrigger)
+	{
+		if (this->won || this->lost || !leftTrigger || !rightTrigger)
+			return;
+
+		shared_ptr<const ModelShape> co2, factory;
+		glm::mat4 factoryWorld;
+		{
+			std::lock_guard<std::mutex> lock(this->shapeLock);
+			co2 = this->co2Shape;
+			factory = this->factoryShape;
+			factoryWorld = this->factoryWorld;
+		}
+
+		const PickRay rays[2] = { left, right };
+		float reach[2] = { FLT_MAX, FLT_MAX };
+		for (int r = 0; r < 2 && factory; r++)
+			factory->raycast(rays[r], factoryWorld, FLT_MAX, &reach[r]);
+		// Wide enough for any part of the molecule when its mesh decides
+		const float radius = co2 ? co2->radius * MOLECULE_SCALE : 0.06f;
+		const uint8_t both = 0x3;
+		this->hitMasks.resize(this->molecules.size());
+		if (this->molecules.size() < PICK_GRID_THRESHOLD)
+		{
+			_pickPoints(this->molecules.posX.data(), this->molecules.posY.data(), this->molecules.posZ.data(), this->molecules.size(),
+				rays, 2, radius, this->hitMasks.data());
+		}
+		else
+		{
+			// Large scenes: only look at the molecules in the cells each laser passes through
+			std::fill(this->hitMasks.begin(), this->hitMasks.end(), 0);
+			for (int r = 0; r < 2; r++)
+			{
+				this->grid.queryRay(rays[r], radius, reach[r], [&](uint32_t id, float t) {
+					this->hitMasks[id] |= (uint8_t)(1 << r);
+				});
+			}
+		}
+
+		for (size_t i = 0; i < this->molecules.size(); i++)
+		{
+			// Both near, then both intersected in front of the factory
+			if (this->hitMasks[i] != both || this->molecules.type[i] != MoleculeType::CO2)
+				continue;
+			const glm::vec3 centre(this->molecules.posX[i], this->molecules.posY[i], this->molecules.posZ[i]);
+			const glm::mat4 transform = co2 ? this->molecules.transform(i, MOLECULE_SCALE) : glm::mat4();
+			bool caught = true;
+			for (int r = 0; r < 2 && caught; r++)
+			{
+				float t;
+				caught = co2 ? co2->raycast(rays[r], transform, reach[r], &t) : glm::dot(centre - rays[r].origin, rays[r].direction) < reach[r];
+			}
+			if (caught)
+				this->molecules.setType(i, MoleculeType::O2);
+		}
+	}
+
+	const MoleculeGameConfig config;
+	JobSystem& jobs;
+	// Everything the game places or sets spinning, from config.seed
+	Random random;
+	MoleculeStore molecules;
+	// The O2 molecules in the order they were converted, from o2Next on the ones not yet despawned
+	vector<MoleculeHandle> o2Order;
+	size_t o2Next = 0;
+	// Seconds since the last CO2 spawn
+	float duration = 0.0f;
+	bool won = false;
+	bool lost = false;
+	uint32_t conversions = 0;
+	// Where this frame's conversions were, handed on in the SceneFrame
+	vector<glm::vec3> conversionPoints;
+	// Simulated time not yet consumed by a full MOLECULE_STEP_SECONDS step, and the input clock it was taken at
+	float accumulator = 0.0f;
+	double time = 0.0;
+	uint32_t resetsSeen = 0;
+	// The store as reset() left it, and the rounds restart() has begun from it since
+	MoleculeStoreSnapshot roundStart;
+	uint32_t rounds = 0;
+	// Set from SceneInput: a box full of this many molecules and no game, see BenchConfig
+	uint32_t stressMolecules = 0;
+	uint64_t steps = 0;
+	// Per molecule laser hits, bit 0 left hand, bit 1 right hand
+	vector<uint8_t> hitMasks;
+	// Molecule positions bucketed for ray queries, kept in step with molecules
+	SpatialGrid grid;
+	// Rebuilt from molecules every step, see MoleculeCollisions
+	MoleculeCollisions collisions;
+	std::mutex gpuHandoffLock;
+	MoleculeStore gpuHandoff;
+	std::atomic<bool> gpuHandoffReady{ false };
+	std::mutex shapeLock;
+	shared_ptr<const ModelShape> co2Shape;
+	shared_ptr<const ModelShape> factoryShape;
+	glm::mat4 factoryWorld;
+};
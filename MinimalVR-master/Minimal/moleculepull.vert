@@ -0,0 +1,106 @@
+#version 330 core
+// STEREO_MULTIVIEW is defined by the app for the GL_OVR_multiview2 variant, see RiftApp::StereoMode
+#ifdef STEREO_MULTIVIEW
+#extension GL_OVR_multiview2 : require
+layout(num_views = 2) in;
+#endif
+// Every molecule type and level from MoleculeArena, no vertex attributes but the instance's: gl_VertexID is the
+// instance's gl_VertexID-th index of its mesh, which names a PackedVertex. Both are fetched from buffer textures.
+// The instance's model matrix, with the arena mesh it draws in the bottom right element, see MoleculeArena::tag
+layout (location = 5) in mat4 instanceTransform;
+// PackedVertex as four ints: the position's shorts in x and y, the 2_10_10_10 normal in z
+uniform isamplerBuffer arenaVertices;
+uniform usamplerBuffer arenaIndices;
+// Per mesh: first index, index count, first part, bounding radius
+uniform vec4 arenaMeshes[MOLECULE_ARENA_MESHES];
+// Per part, two elements: positionScale and the end of its indices, positionBias and its first vertex
+uniform vec4 arenaParts[MOLECULE_ARENA_MAX_PARTS * 2];
+
+// World space, what the scene light and the clustered point lights are worked out in
+out vec3 WorldPos;
+out vec3 WorldNormal;
+// The part's material, shader.frag reads it from the STATIC_BATCH block
+flat out int vertMaterial;
+
+// Element 0 is the left eye. Mono rendering only uses element 0.
+// With LATE_LATCH the cameras come from the block RiftApp rewrites right before the draws are issued.
+#ifdef LATE_LATCH
+layout(std140) uniform LateLatch
+{
+	mat4 view[2];
+	mat4 projection[2];
+	mat4 hands[2];
+};
+#else
+uniform mat4 view[2];
+uniform mat4 projection[2];
+#endif
+// Instanced stereo: every draw is issued with eyeCount times the instances, eye = gl_InstanceID % eyeCount.
+// eyeViewport squeezes each eye into its half of the shared target: xy scale, zw offset in NDC.
+uniform int eyeCount = 1;
+uniform vec4 eyeViewport[2];
+
+#ifdef BILLBOARD_FADE
+// As molecule.vert, with the mesh's bounding radius in place of lodRadius
+uniform vec2 lodFade = vec2(0.0, -1.0);
+uniform vec3 lodEye;
+uniform float lodFocal;
+flat out float billboardFade;
+#endif
+
+vec3 octahedralDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+	if (n.z < 0.0f)
+		n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	return normalize(n);
+}
+
+void main()
+{
+	mat4 model = instanceTransform;
+	vec4 mesh = arenaMeshes[int(model[3][3])];
+	model[3][3] = 1.0f;
+#ifdef BILLBOARD_FADE
+	billboardFade = 0.0f;
+#endif
+	// A mesh shorter than the level's longest: its part of the draw ends here, as triangles outside the clip volume
+	if (gl_VertexID >= int(mesh.y))
+	{
+		gl_Position = vec4(2.0f, 2.0f, 2.0f, 1.0f);
+		WorldPos = vec3(0.0f);
+		WorldNormal = vec3(0.0f, 0.0f, 1.0f);
+		vertMaterial = 0;
+		return;
+	}
+	int index = int(mesh.x) + gl_VertexID;
+	int part = int(mesh.z);
+	while (index >= int(arenaParts[2 * part].w))
+		part++;
+	ivec4 texel = texelFetch(arenaVertices, int(texelFetch(arenaIndices, index).r) + int(arenaParts[2 * part + 1].w));
+	vec3 position = vec3((texel.x << 16) >> 16, texel.x >> 16, (texel.y << 16) >> 16) * arenaParts[2 * part].xyz + arenaParts[2 * part + 1].xyz;
+	vec3 normal = octahedralDecode(vec2((texel.z << 22) >> 22, (texel.z << 12) >> 22) / 511.0f);
+	vertMaterial = part;
+
+#ifdef STEREO_MULTIVIEW
+	int eye = int(gl_ViewID_OVR);
+#else
+	int eye = gl_InstanceID % eyeCount;
+#endif
+	vec4 clip = projection[eye] * view[eye] * model * vec4(position, 1.0f);
+#ifndef STEREO_MULTIVIEW
+	if (eyeCount > 1)
+	{
+		// Keep each eye out of the other's half, GL_CLIP_DISTANCE0 is enabled by RiftApp
+		gl_ClipDistance[0] = eye == 0 ? clip.w - clip.x : clip.w + clip.x;
+		clip.xy = clip.xy * eyeViewport[eye].xy + eyeViewport[eye].zw * clip.w;
+	}
+#endif
+	gl_Position = clip;
+	WorldPos = vec3(model * vec4(position, 1.0f));
+	WorldNormal = mat3(model) * normal;
+#ifdef BILLBOARD_FADE
+	float size = mesh.w * length(model[0].xyz) * lodFocal / max(length(lodEye - model[3].xyz), 0.01f);
+	billboardFade = clamp((lodFade.x - size) / (lodFade.x - lodFade.y), 0.0f, 1.0f);
+#endif
+}
@@ -0,0 +1,655 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "moleculegame.h"
+#include "scenegraph.h"
+
+// The molecules of a round, sent from the server (moleculeserver.h) to its clients in a few hundred bytes a snapshot
+// where their transforms whole would take 64 bytes a molecule.
+//
+// Each molecule is quantized: its position to MOLECULE_REPLICATION_POSITION_BITS per axis across
+// MOLECULE_GAME_BOUNDS, its orientation to the smallest three components of the quaternion at
+// MOLECULE_REPLICATION_ROTATION_BITS each, with 2 bits for which was left out. A snapshot is coded against the
+// newest one the client has acknowledged, a record per molecule that changed since, bit packed: a component that
+// moved little goes as its difference in a few bits, one that moved more, or a molecule new to its slot, whole.
+//
+// A snapshot has at most MOLECULE_REPLICATION_BUDGET_BYTES. The changed molecules go in order of priority, which
+// every snapshot a molecule waits adds its relevance to: how near it is to the player's lasers. Spawns, conversions
+// and despawns go first. What doesn't fit stays as the client had it and is sent in a later snapshot, so a session
+// of any size keeps to the budget and the molecules that matter update every time.
+//
+// Both ends keep MOLECULE_REPLICATION_HISTORY snapshots by tick, the server what it sent and the client what it
+// decoded, and the client plays them back MOLECULE_REPLICATION_INTERPOLATION_SECONDS late, interpolating between two.
+
+#define MOLECULE_REPLICATION_POSITION_BITS 12
+#define MOLECULE_REPLICATION_ROTATION_BITS 9
+// A component whose difference fits this many bits, signed, goes as that difference
+#define MOLECULE_REPLICATION_POSITION_DELTA_BITS 7
+#define MOLECULE_REPLICATION_ROTATION_DELTA_BITS 8
+// Snapshots either end keeps, a power of two; an acknowledgment older than this is no baseline
+#define MOLECULE_REPLICATION_HISTORY 32
+// Header and records of one snapshot, one datagram under a typical MTU
+#define MOLECULE_REPLICATION_BUDGET_BYTES 1200
+// Metres from a laser over which a molecule's relevance halves
+#define MOLECULE_REPLICATION_RELEVANCE_METRES 0.5f
+// What a spawn, conversion or despawn adds to a molecule's priority, more than any wait does
+#define MOLECULE_REPLICATION_EVENT_PRIORITY 1000.0f
+// How far behind the newest snapshot the client plays
+#define MOLECULE_REPLICATION_INTERPOLATION_SECONDS 0.1
+// Playback further than this from where it should be jumps there, nearer it is eased in
+#define MOLECULE_REPLICATION_RESYNC_SECONDS 0.25
+#define MOLECULE_REPLICATION_MAGIC 0x524D // "MR"
+#define MOLECULE_REPLICATION_WON 1
+#define MOLECULE_REPLICATION_LOST 2
+// The snapshot is coded against baseline, otherwise against a session with no molecules
+#define MOLECULE_REPLICATION_BASELINE 4
+
+static_assert(((MOLECULE_REPLICATION_HISTORY - 1) & MOLECULE_REPLICATION_HISTORY) == 0, "Snapshots are kept by tick modulo the history");
+static_assert((int)MoleculeType::Count <= 2, "A record has one bit for the type");
+
+// Leads every snapshot, the records follow as a bit stream
+struct MoleculeSnapshotHeader
+{
+	uint16_t magic;
+	// MOLECULE_REPLICATION_WON | MOLECULE_REPLICATION_LOST | MOLECULE_REPLICATION_BASELINE
+	uint8_t flags;
+	uint8_t reserved;
+	uint32_t session;
+	// The server tick of the snapshot, and of the one it is coded against
+	uint32_t tick;
+	uint32_t baseline;
+	// SceneFrame::conversions
+	uint32_t conversions;
+	// Slots of the session's store, what the records' slots are coded in
+	uint16_t slotCount;
+	uint16_t recordCount;
+};
+static_assert(sizeof(MoleculeSnapshotHeader) == 24, "MoleculeSnapshotHeader is sent as it is");
+
+// One slot of the store as the network sees it
+struct QuantizedMolecule
+{
+	// Server: the handle's generation. Client: goes up whenever the slot is a different molecule, so the playback
+	// knows not to interpolate between the two.
+	uint32_t generation;
+	uint16_t position[3];
+	uint16_t rotation[3];
+	// Which component of the quaternion the three leave out
+	uint8_t largest;
+	MoleculeType type;
+	bool present;
+};
+
+// Writes values of up to 32 bits into a byte buffer, low bits first
+class BitWriter
+{
+public:
+	BitWriter(uint8_t* data, size_t capacity) : data(data), capacity(capacity * 8) {}
+
+	void write(uint32_t value, uint32_t bits)
+	{
+		for (uint32_t b = 0; b < bits; b++, this->at++)
+		{
+			if (this->at >= this->capacity)
+			{
+				this->overflowed = true;
+				continue;
+			}
+			const size_t byte = this->at >> 3;
+			const uint8_t mask = (uint8_t)(1u << (this->at & 7));
+			this->data[byte] = (uint8_t)((value >> b) & 1 ? this->data[byte] | mask : this->data[byte] & ~mask);
+		}
+	}
+
+	// Where the stream is, for going back to after a write that didn't fit
+	size_t position() const { return this->at; }
+	void rewind(size_t position)
+	{
+		this->at = position;
+		this->overflowed = false;
+	}
+	bool full() const { return this->overflowed; }
+	size_t bytes() const { return (std::min(this->at, this->capacity) + 7) / 8; }
+
+private:
+	uint8_t* data;
+	size_t capacity;
+	size_t at = 0;
+	bool overflowed = false;
+};
+
+class BitReader
+{
+public:
+	BitReader(const uint8_t* data, size_t size) : data(data), size(size * 8) {}
+
+	uint32_t read(uint32_t bits)
+	{
+		uint32_t value = 0;
+		for (uint32_t b = 0; b < bits; b++, this->at++)
+		{
+			if (this->at >= this->size)
+			{
+				this->overran = true;
+				continue;
+			}
+			value |= (uint32_t)((this->data[this->at >> 3] >> (this->at & 7)) & 1) << b;
+		}
+		return value;
+	}
+
+	// Read past the end, whatever came after is garbage
+	bool failed() const { return this->overran; }
+
+private:
+	const uint8_t* data;
+	size_t size;
+	size_t at = 0;
+	bool overran = false;
+};
+
+static inline uint32_t _replicationQuantize(float value, float low, float high, uint32_t bits)
+{
+	const float steps = (float)((1u << bits) - 1);
+	const float t = glm::clamp((value - low) / (high - low), 0.0f, 1.0f);
+	return (uint32_t)(t * steps + 0.5f);
+}
+
+static inline float _replicationDequantize(uint32_t value, float low, float high, uint32_t bits)
+{
+	return low + (high - low) * (float)value / (float)((1u << bits) - 1);
+}
+
+// Once the largest component is left out the others are within +-1/sqrt(2)
+#define MOLECULE_REPLICATION_ROTATION_RANGE 0.70710678f
+
+static void _quantizeRotation(const glm::quat& rotation, uint8_t* largest, uint16_t quantized[3])
+{
+	const float q[4] = { rotation.x, rotation.y, rotation.z, rotation.w };
+	uint8_t l = 0;
+	for (uint8_t i = 1; i < 4; i++)
+	{
+		if (fabsf(q[i]) > fabsf(q[l]))
+			l = i;
+	}
+	// q and -q are the same rotation, the one with the left out component positive is sent
+	const float sign = q[l] < 0.0f ? -1.0f : 1.0f;
+	for (uint8_t i = 0, k = 0; i < 4; i++)
+	{
+		if (i != l)
+			quantized[k++] = (uint16_t)_replicationQuantize(q[i] * sign, -MOLECULE_REPLICATION_ROTATION_RANGE, MOLECULE_REPLICATION_ROTATION_RANGE,
+				MOLECULE_REPLICATION_ROTATION_BITS);
+	}
+	*largest = l;
+}
+
+static glm::quat _dequantizeRotation(uint8_t largest, const uint16_t quantized[3])
+{
+	float q[4];
+	float sum = 0.0f;
+	for (uint8_t i = 0, k = 0; i < 4; i++)
+	{
+		if (i == largest)
+			continue;
+		q[i] = _replicationDequantize(quantized[k++], -MOLECULE_REPLICATION_ROTATION_RANGE, MOLECULE_REPLICATION_ROTATION_RANGE,
+			MOLECULE_REPLICATION_ROTATION_BITS);
+		sum += q[i] * q[i];
+	}
+	q[largest] = sqrtf(std::max(1.0f - sum, 0.0f));
+	return glm::normalize(glm::quat(q[3], q[0], q[1], q[2]));
+}
+
+static glm::vec3 _dequantizePosition(const uint16_t quantized[3])
+{
+	const MoleculeBounds& bounds = MOLECULE_GAME_BOUNDS;
+	return glm::vec3(
+		_replicationDequantize(quantized[0], bounds.min.x, bounds.max.x, MOLECULE_REPLICATION_POSITION_BITS),
+		_replicationDequantize(quantized[1], bounds.min.y, bounds.max.y, MOLECULE_REPLICATION_POSITION_BITS),
+		_replicationDequantize(quantized[2], bounds.min.z, bounds.max.z, MOLECULE_REPLICATION_POSITION_BITS));
+}
+
+// Every slot of store, present or not, into out
+static void _quantizeMolecules(const MoleculeStore& store, vector<QuantizedMolecule>* out)
+{
+	QuantizedMolecule absent;
+	memset(&absent, 0, sizeof(absent));
+	out->assign(store.capacity(), absent);
+	const MoleculeBounds& bounds = MOLECULE_GAME_BOUNDS;
+	for (size_t i = 0; i < store.size(); i++)
+	{
+		const MoleculeHandle handle = store.handle(i);
+		QuantizedMolecule& molecule = (*out)[handle.slot];
+		molecule.generation = handle.generation;
+		molecule.present = true;
+		molecule.type = store.type[i];
+		molecule.position[0] = (uint16_t)_replicationQuantize(store.posX[i], bounds.min.x, bounds.max.x, MOLECULE_REPLICATION_POSITION_BITS);
+		molecule.position[1] = (uint16_t)_replicationQuantize(store.posY[i], bounds.min.y, bounds.max.y, MOLECULE_REPLICATION_POSITION_BITS);
+		molecule.position[2] = (uint16_t)_replicationQuantize(store.posZ[i], bounds.min.z, bounds.max.z, MOLECULE_REPLICATION_POSITION_BITS);
+		_quantizeRotation(glm::quat(store.rotW[i], store.rotX[i], store.rotY[i], store.rotZ[i]), &molecule.largest, molecule.rotation);
+	}
+}
+
+// Bits a slot index takes for a store of slotCount
+static uint32_t _replicationSlotBits(uint32_t slotCount)
+{
+	uint32_t bits = 1;
+	while (bits < 16 && (1u << bits) < slotCount)
+		bits++;
+	return bits;
+}
+
+// A component as its difference from baseline if that fits deltaBits, otherwise whole
+static void _writeReplicatedComponent(BitWriter& writer, uint32_t value, uint32_t baseline, uint32_t bits, uint32_t deltaBits)
+{
+	const int32_t delta = (int32_t)value - (int32_t)baseline;
+	const int32_t half = 1 << (deltaBits - 1);
+	if (delta >= -half && delta < half)
+	{
+		writer.write(0, 1);
+		writer.write((uint32_t)(delta + half), deltaBits);
+	}
+	else
+	{
+		writer.write(1, 1);
+		writer.write(value, bits);
+	}
+}
+
+static uint32_t _readReplicatedComponent(BitReader& reader, uint32_t baseline, uint32_t bits, uint32_t deltaBits)
+{
+	if (reader.read(1))
+		return reader.read(bits);
+	const int32_t half = 1 << (deltaBits - 1);
+	return (uint32_t)((int32_t)baseline + (int32_t)reader.read(deltaBits) - half) & ((1u << bits) - 1);
+}
+
+// Server side, one per client: codes each snapshot against the newest the client acknowledged, and keeps what the
+// client will have from it for coding the next ones
+class MoleculeReplicator
+{
+public:
+	MoleculeReplicator() {}
+
+	// A client new to the session, with nothing
+	void reset()
+	{
+		for (int h = 0; h < MOLECULE_REPLICATION_HISTORY; h++)
+			this->history[h].valid = false;
+		this->priority.clear();
+		this->hasAcknowledged = false;
+	}
+
+	// The newest snapshot the client has decoded, from its input
+	void acknowledge(uint32_t tick)
+	{
+		if (!this->hasAcknowledged || (int32_t)(tick - this->acknowledged) > 0)
+			this->acknowledged = tick;
+		this->hasAcknowledged = true;
+	}
+
+	// Codes molecules, _quantizeMolecules' slots of the session at tick, into out, which has room for
+	// MOLECULE_REPLICATION_BUDGET_BYTES; rays are the client's lasers, what relevance is measured from. The bytes
+	// to send.
+	size_t encode(const vector<QuantizedMolecule>& molecules, const SceneFrame& frame, uint32_t session, uint32_t tick, const PickRay rays[2], uint8_t* out)
+	{
+		const Sent* baseline = this->baseline(tick, (uint32_t)molecules.size());
+		Sent& sent = this->history[tick & (MOLECULE_REPLICATION_HISTORY - 1)];
+		sent.valid = true;
+		sent.tick = tick;
+		if (baseline)
+		{
+			sent.molecules = baseline->molecules;
+		}
+		else
+		{
+			QuantizedMolecule absent;
+			memset(&absent, 0, sizeof(absent));
+			sent.molecules.assign(molecules.size(), absent);
+		}
+		this->priority.resize(molecules.size(), 0.0f);
+
+		// Each changed molecule's wait, and the order they go in
+		this->order.clear();
+		for (uint32_t s = 0; s < (uint32_t)molecules.size(); s++)
+		{
+			const QuantizedMolecule& now = molecules[s];
+			const QuantizedMolecule& had = sent.molecules[s];
+			if (!now.present && !had.present)
+			{
+				this->priority[s] = 0.0f;
+				continue;
+			}
+			if (now.present != had.present || now.generation != had.generation || now.type != had.type)
+			{
+				this->priority[s] += MOLECULE_REPLICATION_EVENT_PRIORITY;
+			}
+			else if (memcmp(now.position, had.position, sizeof(now.position)) || memcmp(now.rotation, had.rotation, sizeof(now.rotation))
+				|| now.largest != had.largest)
+			{
+				this->priority[s] += this->relevance(_dequantizePosition(now.position), rays);
+			}
+			else
+			{
+				this->priority[s] = 0.0f;
+				continue;
+			}
+			this->order.push_back(s);
+		}
+		std::sort(this->order.begin(), this->order.end(), [this](uint32_t a, uint32_t b) { return this->priority[a] > this->priority[b]; });
+
+		MoleculeSnapshotHeader header;
+		memset(&header, 0, sizeof(header));
+		header.magic = MOLECULE_REPLICATION_MAGIC;
+		header.flags = (uint8_t)((frame.won ? MOLECULE_REPLICATION_WON : 0) | (frame.lost ? MOLECULE_REPLICATION_LOST : 0)
+			| (baseline ? MOLECULE_REPLICATION_BASELINE : 0));
+		header.session = session;
+		header.tick = tick;
+		header.baseline = baseline ? baseline->tick : tick;
+		header.conversions = frame.conversions;
+		header.slotCount = (uint16_t)molecules.size();
+		const uint32_t slotBits = _replicationSlotBits(header.slotCount);
+		uint8_t* payload = out + sizeof(header);
+		BitWriter writer(payload, MOLECULE_REPLICATION_BUDGET_BYTES - sizeof(header));
+		for (uint32_t s : this->order)
+		{
+			const size_t mark = writer.position();
+			this->write(writer, s, slotBits, molecules[s], sent.molecules[s]);
+			if (writer.full())
+			{
+				// Out of room, the rest wait for the next snapshot with their priority kept
+				writer.rewind(mark);
+				break;
+			}
+			sent.molecules[s] = molecules[s];
+			this->priority[s] = 0.0f;
+			header.recordCount++;
+		}
+		memcpy(out, &header, sizeof(header));
+		return sizeof(header) + writer.bytes();
+	}
+
+private:
+	struct Sent
+	{
+		bool valid = false;
+		uint32_t tick = 0;
+		vector<QuantizedMolecule> molecules;
+	};
+
+	// The acknowledged snapshot if it is still kept and of a store the same size, null to code against nothing
+	const Sent* baseline(uint32_t tick, uint32_t slotCount) const
+	{
+		if (!this->hasAcknowledged || tick == this->acknowledged || (uint32_t)(tick - this->acknowledged) >= MOLECULE_REPLICATION_HISTORY)
+			return nullptr;
+		const Sent& sent = this->history[this->acknowledged & (MOLECULE_REPLICATION_HISTORY - 1)];
+		if (!sent.valid || sent.tick != this->acknowledged || sent.molecules.size() != slotCount)
+			return nullptr;
+		return &sent;
+	}
+
+	// 1 on a laser, halving every MOLECULE_REPLICATION_RELEVANCE_METRES further from the nearer
+	static float relevance(const glm::vec3& position, const PickRay rays[2])
+	{
+		float nearest = FLT_MAX;
+		for (int r = 0; r < 2; r++)
+		{
+			const glm::vec3 offset = position - rays[r].origin;
+			const float along = glm::dot(offset, rays[r].direction);
+			const float distance = along > 0.0f ? glm::length(glm::cross(offset, rays[r].direction)) : glm::length(offset);
+			nearest = std::min(nearest, distance);
+		}
+		return 1.0f / (1.0f + nearest / MOLECULE_REPLICATION_RELEVANCE_METRES);
+	}
+
+	// slot, then whether it holds a molecule; one new to the slot goes whole, otherwise against had
+	static void write(BitWriter& writer, uint32_t slot, uint32_t slotBits, const QuantizedMolecule& now, const QuantizedMolecule& had)
+	{
+		writer.write(slot, slotBits);
+		writer.write(now.present ? 1 : 0, 1);
+		if (!now.present)
+			return;
+		writer.write((uint32_t)now.type, 1);
+		const bool fresh = !had.present || had.generation != now.generation;
+		writer.write(fresh ? 1 : 0, 1);
+		if (fresh)
+		{
+			for (int i = 0; i < 3; i++)
+				writer.write(now.position[i], MOLECULE_REPLICATION_POSITION_BITS);
+			writer.write(now.largest, 2);
+			for (int i = 0; i < 3; i++)
+				writer.write(now.rotation[i], MOLECULE_REPLICATION_ROTATION_BITS);
+			return;
+		}
+		for (int i = 0; i < 3; i++)
+			_writeReplicatedComponent(writer, now.position[i], had.position[i], MOLECULE_REPLICATION_POSITION_BITS, MOLECULE_REPLICATION_POSITION_DELTA_BITS);
+		// The three are of other components once the largest changes, so they go whole
+		const bool sameLargest = now.largest == had.largest;
+		writer.write(sameLargest ? 0 : 1, 1);
+		if (!sameLargest)
+			writer.write(now.largest, 2);
+		for (int i = 0; i < 3; i++)
+		{
+			if (sameLargest)
+				_writeReplicatedComponent(writer, now.rotation[i], had.rotation[i], MOLECULE_REPLICATION_ROTATION_BITS, MOLECULE_REPLICATION_ROTATION_DELTA_BITS);
+			else
+				writer.write(now.rotation[i], MOLECULE_REPLICATION_ROTATION_BITS);
+		}
+	}
+
+	Sent history[MOLECULE_REPLICATION_HISTORY];
+	// Per slot, what waiting has added up to since the molecule was last sent
+	vector<float> priority;
+	vector<uint32_t> order;
+	uint32_t acknowledged = 0;
+	bool hasAcknowledged = false;
+};
+
+// Client side: decodes the server's snapshots against the ones it kept, and plays them back interpolated
+class MoleculeReplica
+{
+public:
+	// tickSeconds is the server's tick, what turns snapshot ticks into time
+	explicit MoleculeReplica(double tickSeconds) : tickSeconds(tickSeconds) {}
+
+	// The session whose snapshots receive() takes, starting from nothing
+	void join(uint32_t session)
+	{
+		this->session = session;
+		for (int h = 0; h < MOLECULE_REPLICATION_HISTORY; h++)
+			this->history[h].valid = false;
+		this->hasNewest = false;
+	}
+
+	// One snapshot datagram. False if it isn't one, is another session's, is older than the newest, or its baseline
+	// is no longer kept.
+	bool receive(const uint8_t* data, size_t length)
+	{
+		MoleculeSnapshotHeader header;
+		if (length < sizeof(header))
+			return false;
+		memcpy(&header, data, sizeof(header));
+		if (header.magic != MOLECULE_REPLICATION_MAGIC || header.session != this->session || (this->hasNewest && (int32_t)(header.tick - this->newest) <= 0))
+			return false;
+		Snapshot decoded;
+		decoded.valid = true;
+		decoded.tick = header.tick;
+		decoded.won = (header.flags & MOLECULE_REPLICATION_WON) != 0;
+		decoded.lost = (header.flags & MOLECULE_REPLICATION_LOST) != 0;
+		decoded.conversions = header.conversions;
+		if (header.flags & MOLECULE_REPLICATION_BASELINE)
+		{
+			const Snapshot& baseline = this->history[header.baseline & (MOLECULE_REPLICATION_HISTORY - 1)];
+			if (!baseline.valid || baseline.tick != header.baseline || baseline.molecules.size() != header.slotCount)
+				return false;
+			decoded.molecules = baseline.molecules;
+		}
+		else
+		{
+			QuantizedMolecule absent;
+			memset(&absent, 0, sizeof(absent));
+			decoded.molecules.assign(header.slotCount, absent);
+		}
+		const uint32_t slotBits = _replicationSlotBits(header.slotCount);
+		BitReader reader(data + sizeof(header), length - sizeof(header));
+		for (uint32_t r = 0; r < header.recordCount; r++)
+		{
+			const uint32_t slot = reader.read(slotBits);
+			if (slot >= header.slotCount || reader.failed())
+				return false;
+			this->read(reader, decoded.molecules[slot]);
+		}
+		if (reader.failed())
+			return false;
+		this->history[header.tick & (MOLECULE_REPLICATION_HISTORY - 1)] = std::move(decoded);
+		this->newest = header.tick;
+		if (!this->hasNewest)
+			this->playTime = this->newest * this->tickSeconds - MOLECULE_REPLICATION_INTERPOLATION_SECONDS;
+		this->hasNewest = true;
+		return true;
+	}
+
+	// What the client's input acknowledges
+	bool hasSnapshot() const { return this->hasNewest; }
+	uint32_t acknowledged() const { return this->newest; }
+
+	// The newest snapshot's slots as decoded, null before one; what --check-replication compares
+	const vector<QuantizedMolecule>* newestMolecules() const
+	{
+		return this->hasNewest ? &this->history[this->newest & (MOLECULE_REPLICATION_HISTORY - 1)].molecules : nullptr;
+	}
+
+	// Moves the playback on by deltaSeconds of the client's clock, easing it toward
+	// MOLECULE_REPLICATION_INTERPOLATION_SECONDS behind the newest snapshot
+	void advance(double deltaSeconds)
+	{
+		if (!this->hasNewest)
+			return;
+		this->playTime += deltaSeconds;
+		const double target = this->newest * this->tickSeconds - MOLECULE_REPLICATION_INTERPOLATION_SECONDS;
+		if (fabs(target - this->playTime) > MOLECULE_REPLICATION_RESYNC_SECONDS)
+			this->playTime = target;
+		else
+			this->playTime += (target - this->playTime) * 0.1;
+	}
+
+	// The molecules at the playback time into frame, as MoleculeGame::step() would have written them
+	void sample(SceneFrame* frame) const
+	{
+		frame->co2Transforms.clear();
+		frame->o2Transforms.clear();
+		const Snapshot* from = nullptr;
+		const Snapshot* to = nullptr;
+		for (int h = 0; h < MOLECULE_REPLICATION_HISTORY; h++)
+		{
+			const Snapshot& snapshot = this->history[h];
+			if (!snapshot.valid)
+				continue;
+			const double time = snapshot.tick * this->tickSeconds;
+			if (time <= this->playTime && (!from || snapshot.tick > from->tick))
+				from = &snapshot;
+			if (time > this->playTime && (!to || snapshot.tick < to->tick))
+				to = &snapshot;
+		}
+		// Before the oldest or past the newest, that one held
+		if (!from)
+			from = to;
+		if (!to)
+			to = from;
+		if (!to)
+			return;
+		const double span = (to->tick - from->tick) * this->tickSeconds;
+		const float t = span > 0.0 ? (float)glm::clamp((this->playTime - from->tick * this->tickSeconds) / span, 0.0, 1.0) : 1.0f;
+		frame->won = to->won;
+		frame->lost = to->lost;
+		frame->conversions = to->conversions;
+		if (to->lost)
+			return;
+		for (size_t s = 0; s < to->molecules.size(); s++)
+		{
+			const QuantizedMolecule& b = to->molecules[s];
+			if (!b.present)
+				continue;
+			glm::vec3 position = _dequantizePosition(b.position);
+			glm::quat rotation = _dequantizeRotation(b.largest, b.rotation);
+			if (s < from->molecules.size() && from->molecules[s].present && from->molecules[s].generation == b.generation)
+			{
+				const QuantizedMolecule& a = from->molecules[s];
+				glm::quat start = _dequantizeRotation(a.largest, a.rotation);
+				// The shorter way round
+				if (glm::dot(start, rotation) < 0.0f)
+					start = -start;
+				position = glm::mix(_dequantizePosition(a.position), position, t);
+				rotation = glm::normalize(start * (1.0f - t) + rotation * t);
+			}
+			const glm::mat4 transform = _composeTransform(position, rotation, glm::vec3(MOLECULE_SCALE));
+			(b.type == MoleculeType::CO2 && !to->won) ? frame->co2Transforms.push_back(transform) : frame->o2Transforms.push_back(transform);
+		}
+	}
+
+private:
+	struct Snapshot
+	{
+		bool valid = false;
+		uint32_t tick = 0;
+		bool won = false;
+		bool lost = false;
+		uint32_t conversions = 0;
+		vector<QuantizedMolecule> molecules;
+	};
+
+	// One record into molecule, which holds the baseline's
+	static void read(BitReader& reader, QuantizedMolecule& molecule)
+	{
+		const bool present = reader.read(1) != 0;
+		if (!present)
+		{
+			molecule.present = false;
+			return;
+		}
+		molecule.type = (MoleculeType)reader.read(1);
+		const bool fresh = reader.read(1) != 0;
+		if (fresh || !molecule.present)
+		{
+			// Whatever is read, a different molecule from the one the slot had
+			molecule.generation++;
+			molecule.present = true;
+		}
+		if (fresh)
+		{
+			for (int i = 0; i < 3; i++)
+				molecule.position[i] = (uint16_t)reader.read(MOLECULE_REPLICATION_POSITION_BITS);
+			molecule.largest = (uint8_t)reader.read(2);
+			for (int i = 0; i < 3; i++)
+				molecule.rotation[i] = (uint16_t)reader.read(MOLECULE_REPLICATION_ROTATION_BITS);
+			return;
+		}
+		for (int i = 0; i < 3; i++)
+			molecule.position[i] = (uint16_t)_readReplicatedComponent(reader, molecule.position[i], MOLECULE_REPLICATION_POSITION_BITS, MOLECULE_REPLICATION_POSITION_DELTA_BITS);
+		const bool sameLargest = reader.read(1) == 0;
+		if (!sameLargest)
+			molecule.largest = (uint8_t)reader.read(2);
+		for (int i = 0; i < 3; i++)
+		{
+			if (sameLargest)
+				molecule.rotation[i] = (uint16_t)_readReplicatedComponent(reader, molecule.rotation[i], MOLECULE_REPLICATION_ROTATION_BITS, MOLECULE_REPLICATION_ROTATION_DELTA_BITS);
+			else
+				molecule.rotation[i] = (uint16_t)reader.read(MOLECULE_REPLICATION_ROTATION_BITS);
+		}
+	}
+
+	const double tickSeconds;
+	uint32_t session = 0;
+	Snapshot history[MOLECULE_REPLICATION_HISTORY];
+	uint32_t newest = 0;
+	bool hasNewest = false;
+	double playTime = 0.0;
+};
@@ -0,0 +1,388 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "scenegraph.h"
+
+enum class MoleculeType : uint8_t
+{
+	CO2 = 0,
+	O2 = 1,
+	Count
+};
+
+// Axis aligned box the molecules bounce around in
+struct MoleculeBounds
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// A molecule that stays the same molecule however the store packs its arrays. slot picks the entry of the store's
+// slot table, generation is what that entry's has to still be: a despawned molecule's slot is reused with the next
+// generation, so old handles to it stop resolving instead of finding whoever came after.
+struct MoleculeHandle
+{
+	uint32_t slot;
+	uint32_t generation;
+
+	bool operator==(const MoleculeHandle& other) const { return this->slot == other.slot && this->generation == other.generation; }
+	bool operator!=(const MoleculeHandle& other) const { return !(*this == other); }
+};
+
+// Never handed out, generations start at 1
+static const MoleculeHandle MOLECULE_HANDLE_NONE = { 0, 0 };
+
+enum class MoleculeEventKind : uint8_t
+{
+	Spawned,
+	// Relabelled from one type to another, type is the new one
+	Converted,
+	Despawned,
+};
+
+struct MoleculeEvent
+{
+	MoleculeEventKind kind;
+	MoleculeHandle handle;
+	MoleculeType type;
+};
+
+// Position, velocity, orientation and spin, the float arrays of a MoleculeStore
+#define MOLECULE_STORE_FLOAT_ARRAYS 14
+
+// A MoleculeStore's molecules at one moment, flat, for restore() to copy back
+struct MoleculeStoreSnapshot
+{
+	size_t size = 0;
+	size_t capacity = 0;
+	size_t counts[(int)MoleculeType::Count] = {};
+	// The float arrays one after another, size floats each
+	vector<float> values;
+	vector<MoleculeType> type;
+	vector<uint32_t> slotIndices;
+	vector<uint32_t> indexSlots;
+	vector<uint32_t> freeSlots;
+	vector<MoleculeEvent> pending;
+};
+
+// Structure-of-arrays pool of molecules. Index i of every array describes the same molecule;
+// removal swaps the last molecule into the hole, so indices are not stable across removeAt().
+// Anything holding on to a molecule past the current step keeps a MoleculeHandle and resolves it with indexOf().
+//
+// setCapacity() sizes every array and the slot table once, after which add() and removal never allocate. Every
+// add, conversion and removal is also recorded in events() until the owner calls clearEvents().
+class MoleculeStore
+{
+public:
+	/*  Molecule Data  */
+	// Position and per-step velocity, one array per component so the update kernel can work 4 molecules at a time
+	vector<float> posX, posY, posZ;
+	vector<float> velX, velY, velZ;
+	// Orientation, and the rotation every step applies to it, as unit quaternions one component per array
+	vector<float> rotX, rotY, rotZ, rotW;
+	vector<float> spinX, spinY, spinZ, spinW;
+	vector<MoleculeType> type;
+
+	size_t size() const { return this->type.size(); }
+	bool empty() const { return this->type.empty(); }
+	size_t count(MoleculeType t) const { return this->counts[(int)t]; }
+	size_t capacity() const { return this->slotIndices.size(); }
+	bool full() const { return this->freeSlots.empty(); }
+
+	void reserve(size_t capacity)
+	{
+		this->posX.reserve(capacity); this->posY.reserve(capacity); this->posZ.reserve(capacity);
+		this->velX.reserve(capacity); this->velY.reserve(capacity); this->velZ.reserve(capacity);
+		this->rotX.reserve(capacity); this->rotY.reserve(capacity); this->rotZ.reserve(capacity); this->rotW.reserve(capacity);
+		this->spinX.reserve(capacity); this->spinY.reserve(capacity); this->spinZ.reserve(capacity); this->spinW.reserve(capacity);
+		this->type.reserve(capacity);
+		this->indexSlots.reserve(capacity);
+	}
+
+	// Room for capacity molecules and no more, add() refuses the rest. Clears the store, handles from before included.
+	void setCapacity(size_t capacity)
+	{
+		this->clear();
+		this->reserve(capacity);
+		this->slotIndices.resize(capacity);
+		this->generations.resize(capacity, 0);
+		this->freeSlots.reserve(capacity);
+		// A few steps' worth of spawns and conversions between clearEvents()
+		this->pending.reserve(64);
+		this->releaseSlots();
+	}
+
+	void clear()
+	{
+		this->posX.clear(); this->posY.clear(); this->posZ.clear();
+		this->velX.clear(); this->velY.clear(); this->velZ.clear();
+		this->rotX.clear(); this->rotY.clear(); this->rotZ.clear(); this->rotW.clear();
+		this->spinX.clear(); this->spinY.clear(); this->spinZ.clear(); this->spinW.clear();
+		this->type.clear();
+		for (int t = 0; t < (int)MoleculeType::Count; t++)
+			this->counts[t] = 0;
+		// Not despawns, the whole round goes at once
+		this->indexSlots.clear();
+		this->pending.clear();
+		this->releaseSlots();
+	}
+
+	// Copies the molecules, slot table and pending events into snapshot
+	void capture(MoleculeStoreSnapshot* snapshot) const
+	{
+		const vector<float>* arrays[MOLECULE_STORE_FLOAT_ARRAYS] = { &this->posX, &this->posY, &this->posZ, &this->velX, &this->velY, &this->velZ,
+			&this->rotX, &this->rotY, &this->rotZ, &this->rotW, &this->spinX, &this->spinY, &this->spinZ, &this->spinW };
+		const size_t n = this->size();
+		snapshot->size = n;
+		snapshot->capacity = this->capacity();
+		for (int t = 0; t < (int)MoleculeType::Count; t++)
+			snapshot->counts[t] = this->counts[t];
+		snapshot->values.resize(n * MOLECULE_STORE_FLOAT_ARRAYS);
+		for (int a = 0; a < MOLECULE_STORE_FLOAT_ARRAYS; a++)
+			memcpy(snapshot->values.data() + a * n, arrays[a]->data(), n * sizeof(float));
+		snapshot->type = this->type;
+		snapshot->slotIndices = this->slotIndices;
+		snapshot->indexSlots = this->indexSlots;
+		snapshot->freeSlots = this->freeSlots;
+		snapshot->pending = this->pending;
+	}
+
+	// Puts the store back as capture() found it, a memcpy per array. Allocation free into a store of the snapshot's
+	// capacity. Every slot gets a new generation, as with clear(), so no handle from before resolves; the restored
+	// molecules and their pending events carry the new one.
+	void restore(const MoleculeStoreSnapshot& snapshot)
+	{
+		if (this->capacity() != snapshot.capacity)
+			this->setCapacity(snapshot.capacity);
+		vector<float>* arrays[MOLECULE_STORE_FLOAT_ARRAYS] = { &this->posX, &this->posY, &this->posZ, &this->velX, &this->velY, &this->velZ,
+			&this->rotX, &this->rotY, &this->rotZ, &this->rotW, &this->spinX, &this->spinY, &this->spinZ, &this->spinW };
+		const size_t n = snapshot.size;
+		for (int a = 0; a < MOLECULE_STORE_FLOAT_ARRAYS; a++)
+		{
+			arrays[a]->resize(n);
+			memcpy(arrays[a]->data(), snapshot.values.data() + a * n, n * sizeof(float));
+		}
+		this->type.resize(n);
+		memcpy(this->type.data(), snapshot.type.data(), n * sizeof(MoleculeType));
+		for (int t = 0; t < (int)MoleculeType::Count; t++)
+			this->counts[t] = snapshot.counts[t];
+		memcpy(this->slotIndices.data(), snapshot.slotIndices.data(), snapshot.capacity * sizeof(uint32_t));
+		this->indexSlots.resize(n);
+		memcpy(this->indexSlots.data(), snapshot.indexSlots.data(), n * sizeof(uint32_t));
+		this->freeSlots.resize(snapshot.freeSlots.size());
+		memcpy(this->freeSlots.data(), snapshot.freeSlots.data(), snapshot.freeSlots.size() * sizeof(uint32_t));
+		for (size_t s = 0; s < this->generations.size(); s++)
+			this->generations[s]++;
+		this->pending.clear();
+		for (MoleculeEvent event : snapshot.pending)
+		{
+			event.handle.generation = this->generations[event.handle.slot];
+			this->pending.push_back(event);
+		}
+	}
+
+	// Starts unrotated, turning by spinRate radians a step around spinAxis. MOLECULE_HANDLE_NONE when the store is
+	// full; the new molecule is at index size() - 1 otherwise.
+	MoleculeHandle add(MoleculeType t, const glm::vec3& position, const glm::vec3& velocity, float spinRate, const glm::vec3& spinAxis)
+	{
+		if (this->freeSlots.empty())
+			return MOLECULE_HANDLE_NONE;
+		const uint32_t slot = this->freeSlots.back();
+		this->freeSlots.pop_back();
+		this->slotIndices[slot] = (uint32_t)this->size();
+		this->indexSlots.push_back(slot);
+		this->posX.push_back(position.x); this->posY.push_back(position.y); this->posZ.push_back(position.z);
+		this->velX.push_back(velocity.x); this->velY.push_back(velocity.y); this->velZ.push_back(velocity.z);
+		this->rotX.push_back(0.0f); this->rotY.push_back(0.0f); this->rotZ.push_back(0.0f); this->rotW.push_back(1.0f);
+		const glm::vec3 half = glm::normalize(spinAxis) * sinf(spinRate * 0.5f);
+		this->spinX.push_back(half.x); this->spinY.push_back(half.y); this->spinZ.push_back(half.z);
+		this->spinW.push_back(cosf(spinRate * 0.5f));
+		this->type.push_back(t);
+		this->counts[(int)t]++;
+		const MoleculeHandle handle = { slot, this->generations[slot] };
+		this->pending.push_back({ MoleculeEventKind::Spawned, handle, t });
+		return handle;
+	}
+
+	void setType(size_t i, MoleculeType t)
+	{
+		this->counts[(int)this->type[i]]--;
+		this->counts[(int)t]++;
+		this->type[i] = t;
+		this->pending.push_back({ MoleculeEventKind::Converted, this->handle(i), t });
+	}
+
+	MoleculeHandle handle(size_t i) const
+	{
+		const uint32_t slot = this->indexSlots[i];
+		const MoleculeHandle handle = { slot, this->generations[slot] };
+		return handle;
+	}
+
+	// Where the molecule is now, or SIZE_MAX once it has been removed
+	size_t indexOf(const MoleculeHandle& handle) const
+	{
+		if (handle.slot >= this->generations.size() || this->generations[handle.slot] != handle.generation)
+			return SIZE_MAX;
+		return this->slotIndices[handle.slot];
+	}
+
+	bool alive(const MoleculeHandle& handle) const { return this->indexOf(handle) != SIZE_MAX; }
+
+	// false when it was already gone
+	bool remove(const MoleculeHandle& handle)
+	{
+		const size_t i = this->indexOf(handle);
+		if (i == SIZE_MAX)
+			return false;
+		this->removeAt(i);
+		return true;
+	}
+
+	// O(1) removal, the last molecule moves into slot i
+	void removeAt(size_t i)
+	{
+		const uint32_t slot = this->indexSlots[i];
+		this->pending.push_back({ MoleculeEventKind::Despawned, this->handle(i), this->type[i] });
+		// The old generation no longer resolves, the next molecule in the slot gets the new one
+		this->generations[slot]++;
+		this->freeSlots.push_back(slot);
+		this->slotIndices[this->indexSlots.back()] = (uint32_t)i;
+		_swapRemove(this->indexSlots, i);
+		this->counts[(int)this->type[i]]--;
+		_swapRemove(this->posX, i); _swapRemove(this->posY, i); _swapRemove(this->posZ, i);
+		_swapRemove(this->velX, i); _swapRemove(this->velY, i); _swapRemove(this->velZ, i);
+		_swapRemove(this->rotX, i); _swapRemove(this->rotY, i); _swapRemove(this->rotZ, i); _swapRemove(this->rotW, i);
+		_swapRemove(this->spinX, i); _swapRemove(this->spinY, i); _swapRemove(this->spinZ, i); _swapRemove(this->spinW, i);
+		_swapRemove(this->type, i);
+	}
+
+	glm::vec3 position(size_t i) const
+	{
+		return glm::vec3(this->posX[i], this->posY[i], this->posZ[i]);
+	}
+
+	// Spawns, conversions and despawns since the last clearEvents(), oldest first
+	const vector<MoleculeEvent>& events() const { return this->pending; }
+	void clearEvents() { this->pending.clear(); }
+
+	// Model matrix for molecule i: translate, spin, then uniform scale
+	glm::mat4 transform(size_t i, float scale) const
+	{
+		return _composeTransform(this->position(i), glm::quat(this->rotW[i], this->rotX[i], this->rotY[i], this->rotZ[i]), glm::vec3(scale));
+	}
+
+	// One simulation step: move every molecule by its velocity, then reverse the velocity on each
+	// axis where the new position touches the bounds, and turn it by its spin.
+	void integrate(const MoleculeBounds& bounds)
+	{
+		this->integrate(bounds, 0, this->size());
+	}
+
+	// The same for molecules [begin, end) only. Molecules are independent, so disjoint ranges can run in parallel.
+	void integrate(const MoleculeBounds& bounds, size_t begin, size_t end)
+	{
+		const size_t n = end - begin;
+		_integrateAxis(this->posX.data() + begin, this->velX.data() + begin, n, bounds.min.x, bounds.max.x);
+		_integrateAxis(this->posY.data() + begin, this->velY.data() + begin, n, bounds.min.y, bounds.max.y);
+		_integrateAxis(this->posZ.data() + begin, this->velZ.data() + begin, n, bounds.min.z, bounds.max.z);
+		_integrateRotation(this->rotX.data() + begin, this->rotY.data() + begin, this->rotZ.data() + begin, this->rotW.data() + begin,
+			this->spinX.data() + begin, this->spinY.data() + begin, this->spinZ.data() + begin, this->spinW.data() + begin, n);
+	}
+
+private:
+	size_t counts[(int)MoleculeType::Count] = {};
+	// Slot table: a slot's molecule index and generation, and back from index to slot
+	vector<uint32_t> slotIndices;
+	vector<uint32_t> generations;
+	vector<uint32_t> indexSlots;
+	// Unused slots, taken from the back
+	vector<uint32_t> freeSlots;
+	vector<MoleculeEvent> pending;
+
+	// Every slot free with a new generation, so none of the handles given out so far resolve any more
+	void releaseSlots()
+	{
+		this->freeSlots.clear();
+		for (size_t s = this->slotIndices.size(); s-- > 0;)
+		{
+			this->generations[s]++;
+			this->freeSlots.push_back((uint32_t)s);
+		}
+	}
+
+	template <typename T>
+	static void _swapRemove(vector<T>& values, size_t i)
+	{
+		values[i] = values.back();
+		values.pop_back();
+	}
+
+	static void _integrateAxis(float* pos, float* vel, size_t n, float lo, float hi)
+	{
+		const __m128 vlo = _mm_set1_ps(lo);
+		const __m128 vhi = _mm_set1_ps(hi);
+		const __m128 sign = _mm_set1_ps(-0.0f);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128 p = _mm_add_ps(_mm_loadu_ps(pos + i), _mm_loadu_ps(vel + i));
+			__m128 outside = _mm_or_ps(_mm_cmpge_ps(p, vhi), _mm_cmple_ps(p, vlo));
+			// Flip the sign bit of the velocity lanes that left the box
+			__m128 v = _mm_xor_ps(_mm_loadu_ps(vel + i), _mm_and_ps(outside, sign));
+			_mm_storeu_ps(pos + i, p);
+			_mm_storeu_ps(vel + i, v);
+		}
+		for (; i < n; i++)
+		{
+			pos[i] += vel[i];
+			if (pos[i] >= hi || pos[i] <= lo)
+				vel[i] = -vel[i];
+		}
+	}
+
+	// q = spin * q, then one Newton step of q / |q| from |q| = 1, which holds the length at 1 however many steps the
+	// rounding has to build up over
+	static void _integrateRotation(float* x, float* y, float* z, float* w, const float* sx, const float* sy, const float* sz,
+		const float* sw, size_t n)
+	{
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 threeHalves = _mm_set1_ps(1.5f);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			const __m128 qx = _mm_loadu_ps(x + i), qy = _mm_loadu_ps(y + i), qz = _mm_loadu_ps(z + i), qw = _mm_loadu_ps(w + i);
+			const __m128 dx = _mm_loadu_ps(sx + i), dy = _mm_loadu_ps(sy + i), dz = _mm_loadu_ps(sz + i), dw = _mm_loadu_ps(sw + i);
+			__m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dw, qx), _mm_mul_ps(dx, qw)), _mm_sub_ps(_mm_mul_ps(dy, qz), _mm_mul_ps(dz, qy)));
+			__m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dw, qy), _mm_mul_ps(dy, qw)), _mm_sub_ps(_mm_mul_ps(dz, qx), _mm_mul_ps(dx, qz)));
+			__m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dw, qz), _mm_mul_ps(dz, qw)), _mm_sub_ps(_mm_mul_ps(dx, qy), _mm_mul_ps(dy, qx)));
+			__m128 rw = _mm_sub_ps(_mm_mul_ps(dw, qw), _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+			const __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_add_ps(_mm_mul_ps(rz, rz), _mm_mul_ps(rw, rw)));
+			const __m128 correction = _mm_sub_ps(threeHalves, _mm_mul_ps(half, length2));
+			_mm_storeu_ps(x + i, _mm_mul_ps(rx, correction));
+			_mm_storeu_ps(y + i, _mm_mul_ps(ry, correction));
+			_mm_storeu_ps(z + i, _mm_mul_ps(rz, correction));
+			_mm_storeu_ps(w + i, _mm_mul_ps(rw, correction));
+		}
+		for (; i < n; i++)
+		{
+			const float rx = sw[i] * x[i] + sx[i] * w[i] + sy[i] * z[i] - sz[i] * y[i];
+			const float ry = sw[i] * y[i] + sy[i] * w[i] + sz[i] * x[i] - sx[i] * z[i];
+			const float rz = sw[i] * z[i] + sz[i] * w[i] + sx[i] * y[i] - sy[i] * x[i];
+			const float rw = sw[i] * w[i] - sx[i] * x[i] - sy[i] * y[i] - sz[i] * z[i];
+			const float correction = 1.5f - 0.5f * (rx * rx + ry * ry + rz * rz + rw * rw);
+			x[i] = rx * correction;
+			y[i] = ry * correction;
+			z[i] = rz * correction;
+			w[i] = rw * correction;
+		}
+	}
+};
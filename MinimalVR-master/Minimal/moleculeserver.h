@@ -0,0 +1,534 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <algorithm>
+using namespace std;
+// Windows Includes
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "moleculegame.h"
+#include "moleculereplication.h"
+#include "flathashmap.h"
+#include "jobs.h"
+#include "timing.h"
+
+#define MOLECULE_SERVER_DEFAULT_PORT 40290
+// Sessions one server hosts at most, input for further ones is ignored
+#define MOLECULE_SERVER_MAX_SESSIONS 512
+// Clients of one session the state goes to, the players and whoever watches them
+#define MOLECULE_SERVER_SESSION_CLIENTS 4
+static_assert(MOLECULE_SERVER_SESSION_CLIENTS - 1 <= SCENE_INPUT_MAX_OTHER_PLAYERS, "Every client of a session plays in its input");
+// The server's frame: every session steps this often. The game itself runs its fixed MOLECULE_STEP_SECONDS steps
+// inside, as on the headset.
+#define MOLECULE_SERVER_TICK_SECONDS (1.0 / 60.0)
+// Ticks between the snapshots sent to each client, 20 a second; the client interpolates between them
+#define MOLECULE_SERVER_SNAPSHOT_TICKS 3
+// A client not heard from for this long is dropped, a session without clients is closed
+#define MOLECULE_SERVER_IDLE_SECONDS 10.0
+// How often the server prints its sessions and what a tick took
+#define MOLECULE_SERVER_REPORT_SECONDS 10.0
+#define MOLECULE_INPUT_MAGIC 0x494D // "MI"
+#define MOLECULE_INPUT_LEFT_TRIGGER 1
+#define MOLECULE_INPUT_RIGHT_TRIGGER 2
+// acknowledged holds a snapshot the client has; without it the client has none yet and 0 is no tick
+#define MOLECULE_INPUT_ACKNOWLEDGED 4
+
+// What a client sends every frame: its lasers and buttons, as the headset app hands them its own simulation
+struct MoleculeInputPacket
+{
+	uint16_t magic;
+	// MOLECULE_INPUT_LEFT_TRIGGER | MOLECULE_INPUT_RIGHT_TRIGGER | MOLECULE_INPUT_ACKNOWLEDGED
+	uint16_t buttons;
+	// The session to play in, any number the clients of one round agree on
+	uint32_t session;
+	// Counts up with every packet a client sends, one arriving after a newer is dropped
+	uint32_t sequence;
+	// SceneInput::resetRequests
+	uint32_t resetRequests;
+	// MoleculeReplica::acknowledged(), the newest snapshot the client has, with MOLECULE_INPUT_ACKNOWLEDGED
+	uint32_t acknowledged;
+	PickRay left;
+	PickRay right;
+};
+static_assert(sizeof(MoleculeInputPacket) == 68, "MoleculeInputPacket is sent as it is");
+
+// Hosts rounds of the molecule game for players elsewhere, without a headset, window or GL. Clients send a
+// MoleculeInputPacket a frame to the session they play in, which opens with the first; every tick each session
+// steps on the job system, as many at once as there are workers, and every MOLECULE_SERVER_SNAPSHOT_TICKS a snapshot
+// of its molecules goes back to every client it has heard from, coded for each against what that client has
+// (moleculereplication.h). Every client plays: each picks with its own lasers and the triggers it held since the last
+// tick, and a reset any of them asks for restarts the round. The clock is the server's, so a round runs at the same
+// speed whatever the clients' frame rates. MoleculeClient, below, is the headset's end.
+class MoleculeServer
+{
+public:
+	explicit MoleculeServer(JobSystem& jobs) : jobs(jobs) {}
+	~MoleculeServer() { this->close(); }
+
+	MoleculeServer(const MoleculeServer&) = delete;
+	MoleculeServer& operator=(const MoleculeServer&) = delete;
+
+	bool open(uint16_t port)
+	{
+		WSADATA data;
+		if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		{
+			printf("ERROR::MOLECULE_SERVER::WINSOCK_NOT_STARTED\n");
+			return false;
+		}
+		this->started = true;
+		this->socket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		unsigned long nonBlocking = 1;
+		if (this->socket == INVALID_SOCKET || ::bind(this->socket, (const sockaddr*)&address, sizeof(address)) == SOCKET_ERROR
+			|| ioctlsocket(this->socket, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+		{
+			printf("ERROR::MOLECULE_SERVER::SOCKET_NOT_BOUND %d\n", WSAGetLastError());
+			this->close();
+			return false;
+		}
+		printf("Molecule server on port %u\n", (unsigned)port);
+		return true;
+	}
+
+	void close()
+	{
+		this->sessions.clear();
+		this->index.clear();
+		if (this->socket != INVALID_SOCKET)
+			closesocket(this->socket);
+		this->socket = INVALID_SOCKET;
+		if (this->started)
+			WSACleanup();
+		this->started = false;
+	}
+
+	bool isOpen() const { return this->socket != INVALID_SOCKET; }
+
+	// Ticks until the process is ended, sleeping out what each tick leaves of MOLECULE_SERVER_TICK_SECONDS
+	void run()
+	{
+		Deadline next = Deadline::in(MOLECULE_SERVER_TICK_SECONDS);
+		double reported = _sessionSeconds();
+		while (this->isOpen())
+		{
+			_sleepUntil(next, false);
+			next.ticks += _timeSecondsToTicks(MOLECULE_SERVER_TICK_SECONDS);
+			// Fallen behind, the ticks missed are dropped rather than run back to back
+			if (next.passed())
+				next = Deadline::in(MOLECULE_SERVER_TICK_SECONDS);
+			this->tick(_sessionSeconds());
+			if (_sessionSeconds() - reported >= MOLECULE_SERVER_REPORT_SECONDS)
+			{
+				reported = _sessionSeconds();
+				this->report();
+			}
+		}
+	}
+
+	// One server frame: takes the input that came in, steps every session to now and, on a snapshot tick, codes and
+	// sends out their snapshots
+	void tick(double now)
+	{
+		const int64_t start = _timeTicks();
+		this->receive(now);
+		this->closeIdle(now);
+		for (const unique_ptr<Session>& session : this->sessions)
+		{
+			session->input.time = now - session->opened;
+			this->gather(*session);
+		}
+		const bool snapshot = this->ticks % MOLECULE_SERVER_SNAPSHOT_TICKS == 0;
+		const uint32_t tick = (uint32_t)this->ticks;
+		this->jobs.parallelFor(this->sessions.size(), 1, [this, snapshot, tick](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+			{
+				Session& session = *this->sessions[i];
+				session.game.step(session.input, session.frame);
+				if (snapshot)
+					this->encode(session, tick);
+			}
+		});
+		if (snapshot)
+		{
+			for (const unique_ptr<Session>& session : this->sessions)
+				this->send(*session);
+		}
+		this->ticks++;
+		this->reportTicks++;
+		this->tickSeconds += _timeTicksToSeconds(_timeTicks() - start);
+	}
+
+	size_t sessionCount() const { return this->sessions.size(); }
+
+private:
+	struct Client
+	{
+		sockaddr_in address;
+		uint32_t sequence;
+		double heard;
+		// Its lasers, what its snapshots are prioritised by and it picks with
+		PickRay rays[2];
+		// Its newest buttons, and every button it held since the session last stepped, so a press between two
+		// ticks isn't lost to a later packet
+		uint16_t buttons;
+		uint16_t latched;
+		// Its own count of resets asked for, the session counts one whenever it goes up
+		uint32_t resetRequests;
+		MoleculeReplicator replicator;
+		// The snapshot encode() coded for it, for send()
+		uint8_t snapshot[MOLECULE_REPLICATION_BUDGET_BYTES];
+		size_t snapshotLength;
+	};
+
+	struct Session
+	{
+		Session(uint32_t id, const MoleculeGameConfig& config, JobSystem& jobs, double now)
+			: id(id), game(config, jobs), opened(now) {}
+
+		uint32_t id;
+		MoleculeGame game;
+		SceneInput input;
+		SceneFrame frame;
+		// The molecules as snapshots carry them, quantized once for all of its clients
+		vector<QuantizedMolecule> quantized;
+		// When it opened, the zero of its input clock
+		double opened;
+		Client clients[MOLECULE_SERVER_SESSION_CLIENTS];
+		uint32_t clientCount = 0;
+	};
+
+	// Drains the socket into the sessions' inputs
+	void receive(double now)
+	{
+		for (;;)
+		{
+			sockaddr_in from;
+			int fromLength = sizeof(from);
+			const int length = recvfrom(this->socket, (char*)this->datagram, sizeof(this->datagram), 0, (sockaddr*)&from, &fromLength);
+			if (length == SOCKET_ERROR)
+			{
+				// WSAECONNRESET is an ICMP from a client that has gone, WSAEMSGSIZE a datagram bigger than any input (and
+				// dropped); the socket keeps working after either
+				const int error = WSAGetLastError();
+				if (error == WSAECONNRESET || error == WSAEMSGSIZE)
+					continue;
+				break;
+			}
+			this->bytesReceived += length;
+			MoleculeInputPacket packet;
+			if (length != (int)sizeof(packet))
+				continue;
+			memcpy(&packet, this->datagram, sizeof(packet));
+			if (packet.magic != MOLECULE_INPUT_MAGIC)
+				continue;
+			Session* session = this->find(packet.session, now);
+			Client* client = session ? this->client(*session, from, packet.sequence, packet.resetRequests, now) : nullptr;
+			if (!client || (int32_t)(packet.sequence - client->sequence) <= 0)
+				continue;
+			client->sequence = packet.sequence;
+			client->heard = now;
+			client->rays[0] = packet.left;
+			client->rays[1] = packet.right;
+			if (packet.buttons & MOLECULE_INPUT_ACKNOWLEDGED)
+				client->replicator.acknowledge(packet.acknowledged);
+			client->buttons = packet.buttons & (MOLECULE_INPUT_LEFT_TRIGGER | MOLECULE_INPUT_RIGHT_TRIGGER);
+			client->latched |= client->buttons;
+			if (packet.resetRequests != client->resetRequests)
+				session->input.resetRequests++;
+			client->resetRequests = packet.resetRequests;
+		}
+	}
+
+	// Every client's lasers and latched triggers into the session's input, the first client's as the first player's,
+	// and the latches back to what each holds now
+	void gather(Session& session)
+	{
+		SceneInput& input = session.input;
+		input.otherPlayerCount = 0;
+		input.leftTrigger = input.rightTrigger = false;
+		for (uint32_t c = 0; c < session.clientCount; c++)
+		{
+			Client& client = session.clients[c];
+			ScenePlayer player;
+			player.leftRay = client.rays[0];
+			player.rightRay = client.rays[1];
+			player.leftTrigger = (client.latched & MOLECULE_INPUT_LEFT_TRIGGER) != 0;
+			player.rightTrigger = (client.latched & MOLECULE_INPUT_RIGHT_TRIGGER) != 0;
+			client.latched = client.buttons;
+			if (c == 0)
+			{
+				input.leftRay = player.leftRay;
+				input.rightRay = player.rightRay;
+				input.leftTrigger = player.leftTrigger;
+				input.rightTrigger = player.rightTrigger;
+			}
+			else
+			{
+				input.otherPlayers[input.otherPlayerCount++] = player;
+			}
+		}
+	}
+
+	// The session id, opened with a round seeded by id if it isn't yet. Null once MOLECULE_SERVER_MAX_SESSIONS are.
+	Session* find(uint32_t id, double now)
+	{
+		if (const uint32_t* slot = this->index.find(id))
+			return this->sessions[*slot].get();
+		if (this->sessions.size() >= MOLECULE_SERVER_MAX_SESSIONS)
+			return nullptr;
+		MoleculeGameConfig config;
+		config.seed = id;
+		this->index.insert(id) = (uint32_t)this->sessions.size();
+		this->sessions.emplace_back(new Session(id, config, this->jobs, now));
+		return this->sessions.back().get();
+	}
+
+	// address among session's clients, added if there is room as having sent up to just before sequence
+	Client* client(Session& session, const sockaddr_in& address, uint32_t sequence, uint32_t resetRequests, double now)
+	{
+		for (uint32_t c = 0; c < session.clientCount; c++)
+		{
+			const sockaddr_in& known = session.clients[c].address;
+			if (known.sin_addr.s_addr == address.sin_addr.s_addr && known.sin_port == address.sin_port)
+				return &session.clients[c];
+		}
+		if (session.clientCount == MOLECULE_SERVER_SESSION_CLIENTS)
+			return nullptr;
+		Client& client = session.clients[session.clientCount++];
+		client.address = address;
+		client.sequence = sequence - 1;
+		client.heard = now;
+		client.rays[0] = client.rays[1] = PickRay{ glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+		client.buttons = client.latched = 0;
+		// What it asked for before joining was for another round
+		client.resetRequests = resetRequests;
+		client.replicator.reset();
+		client.snapshotLength = 0;
+		return &client;
+	}
+
+	// Drops the clients gone quiet and closes the sessions left without any. FlatHashMap has no erase, the index is
+	// built again when a session goes.
+	void closeIdle(double now)
+	{
+		bool closed = false;
+		for (size_t i = 0; i < this->sessions.size();)
+		{
+			Session& session = *this->sessions[i];
+			for (uint32_t c = 0; c < session.clientCount;)
+			{
+				if (now - session.clients[c].heard > MOLECULE_SERVER_IDLE_SECONDS)
+					session.clients[c] = std::move(session.clients[--session.clientCount]);
+				else
+					c++;
+			}
+			if (session.clientCount)
+			{
+				i++;
+				continue;
+			}
+			this->sessions[i] = std::move(this->sessions.back());
+			this->sessions.pop_back();
+			closed = true;
+		}
+		if (!closed)
+			return;
+		this->index.clear();
+		for (size_t i = 0; i < this->sessions.size(); i++)
+			this->index.insert(this->sessions[i]->id) = (uint32_t)i;
+	}
+
+	// Codes session's molecules at tick for each of its clients. On the job running the session's step.
+	void encode(Session& session, uint32_t tick)
+	{
+		_quantizeMolecules(session.game.moleculeStore(), &session.quantized);
+		for (uint32_t c = 0; c < session.clientCount; c++)
+		{
+			Client& client = session.clients[c];
+			client.snapshotLength = client.replicator.encode(session.quantized, session.frame, session.id, tick, client.rays, client.snapshot);
+		}
+	}
+
+	// The snapshots encode() coded to session's clients
+	void send(const Session& session)
+	{
+		for (uint32_t c = 0; c < session.clientCount; c++)
+		{
+			const Client& client = session.clients[c];
+			const int length = (int)client.snapshotLength;
+			if (length && sendto(this->socket, (const char*)client.snapshot, length, 0, (const sockaddr*)&client.address, sizeof(sockaddr_in)) == length)
+				this->bytesSent += length;
+		}
+	}
+
+	void report()
+	{
+		size_t clients = 0;
+		for (const unique_ptr<Session>& session : this->sessions)
+			clients += session->clientCount;
+		printf("Molecule server: %u sessions, %u clients, %.2f ms a tick, %.1f kB/s out, %.1f kB/s in\n",
+			(unsigned)this->sessions.size(), (unsigned)clients, this->reportTicks ? this->tickSeconds * 1000.0 / this->reportTicks : 0.0,
+			this->bytesSent / 1024.0 / MOLECULE_SERVER_REPORT_SECONDS, this->bytesReceived / 1024.0 / MOLECULE_SERVER_REPORT_SECONDS);
+		this->reportTicks = 0;
+		this->tickSeconds = 0.0;
+		this->bytesSent = 0;
+		this->bytesReceived = 0;
+	}
+
+	JobSystem& jobs;
+	vector<unique_ptr<Session>> sessions;
+	// Session id to its place in sessions
+	FlatHashMap<uint32_t, uint32_t> index;
+	SOCKET socket = INVALID_SOCKET;
+	bool started = false;
+	uint64_t ticks = 0;
+	// What report() prints, since it last did
+	uint64_t reportTicks = 0;
+	double tickSeconds = 0.0;
+	uint64_t bytesSent = 0;
+	uint64_t bytesReceived = 0;
+	// What receive() reads into, bigger than any input so oversized ones are seen whole and dropped
+	uint8_t datagram[MOLECULE_REPLICATION_BUDGET_BYTES];
+};
+
+// The headset's end of --serve: sends the player's input to a server's session every frame and, in place of the
+// local simulation, plays back the snapshots that come in, see ExampleApp::simulationStep. Owned by whichever
+// thread steps the game, as MoleculeGame is.
+class MoleculeClient
+{
+public:
+	MoleculeClient() : replica(MOLECULE_SERVER_TICK_SECONDS) {}
+	~MoleculeClient() { this->close(); }
+
+	MoleculeClient(const MoleculeClient&) = delete;
+	MoleculeClient& operator=(const MoleculeClient&) = delete;
+
+	bool open(const char* host, uint16_t port, uint32_t session)
+	{
+		WSADATA data;
+		if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		{
+			printf("ERROR::MOLECULE_CLIENT::WINSOCK_NOT_STARTED\n");
+			return false;
+		}
+		this->started = true;
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_protocol = IPPROTO_UDP;
+		addrinfo* found = nullptr;
+		if (getaddrinfo(host, nullptr, &hints, &found) != 0 || !found)
+		{
+			printf("ERROR::MOLECULE_CLIENT::HOST_NOT_FOUND %s\n", host);
+			this->close();
+			return false;
+		}
+		memcpy(&this->server, found->ai_addr, sizeof(this->server));
+		this->server.sin_port = htons(port);
+		freeaddrinfo(found);
+
+		this->socket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		unsigned long nonBlocking = 1;
+		if (this->socket == INVALID_SOCKET || ::bind(this->socket, (const sockaddr*)&address, sizeof(address)) == SOCKET_ERROR
+			|| ioctlsocket(this->socket, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+		{
+			printf("ERROR::MOLECULE_CLIENT::SOCKET_NOT_BOUND %d\n", WSAGetLastError());
+			this->close();
+			return false;
+		}
+		this->session = session;
+		this->replica.join(session);
+		printf("Molecule client: session %u on %s:%u\n", session, host, (unsigned)port);
+		return true;
+	}
+
+	void close()
+	{
+		if (this->socket != INVALID_SOCKET)
+			closesocket(this->socket);
+		this->socket = INVALID_SOCKET;
+		if (this->started)
+			WSACleanup();
+		this->started = false;
+	}
+
+	bool isOpen() const { return this->socket != INVALID_SOCKET; }
+
+	// One frame in place of MoleculeGame::step(): the input goes out, the snapshots that came in are decoded, and
+	// frame gets the molecules at the playback time. Until the first snapshot arrives the frame is empty.
+	void step(const SceneInput& input, SceneFrame& frame)
+	{
+		const double deltaSeconds = this->stepped ? input.time - this->time : 0.0;
+		this->time = input.time;
+		this->stepped = true;
+
+		MoleculeInputPacket packet;
+		memset(&packet, 0, sizeof(packet));
+		packet.magic = MOLECULE_INPUT_MAGIC;
+		packet.buttons = (uint16_t)((input.leftTrigger ? MOLECULE_INPUT_LEFT_TRIGGER : 0) | (input.rightTrigger ? MOLECULE_INPUT_RIGHT_TRIGGER : 0)
+			| (this->replica.hasSnapshot() ? MOLECULE_INPUT_ACKNOWLEDGED : 0));
+		packet.session = this->session;
+		packet.sequence = ++this->sequence;
+		packet.resetRequests = input.resetRequests;
+		packet.acknowledged = this->replica.hasSnapshot() ? this->replica.acknowledged() : 0;
+		packet.left = input.leftRay;
+		packet.right = input.rightRay;
+		sendto(this->socket, (const char*)&packet, sizeof(packet), 0, (const sockaddr*)&this->server, sizeof(this->server));
+
+		for (;;)
+		{
+			sockaddr_in from;
+			int fromLength = sizeof(from);
+			const int length = recvfrom(this->socket, (char*)this->datagram, sizeof(this->datagram), 0, (sockaddr*)&from, &fromLength);
+			if (length == SOCKET_ERROR)
+			{
+				// WSAECONNRESET is an ICMP from a server not there (yet), WSAEMSGSIZE a datagram bigger than any snapshot
+				// (and dropped); the socket keeps working after either
+				const int error = WSAGetLastError();
+				if (error == WSAECONNRESET || error == WSAEMSGSIZE)
+					continue;
+				break;
+			}
+			if (from.sin_addr.s_addr != this->server.sin_addr.s_addr || from.sin_port != this->server.sin_port)
+				continue;
+			this->replica.receive(this->datagram, (size_t)length);
+		}
+
+		this->replica.advance(deltaSeconds);
+		frame.won = frame.lost = false;
+		frame.conversions = 0;
+		frame.conversionPoints.clear();
+		frame.gpuMolecules = false;
+		frame.picking = false;
+		this->replica.sample(&frame);
+	}
+
+private:
+	SOCKET socket = INVALID_SOCKET;
+	bool started = false;
+	sockaddr_in server = {};
+	uint32_t session = 0;
+	uint32_t sequence = 0;
+	double time = 0.0;
+	bool stepped = false;
+	MoleculeReplica replica;
+	// Snapshots are at most MOLECULE_REPLICATION_BUDGET_BYTES, anything longer is cut and fails to decode
+	uint8_t datagram[MOLECULE_REPLICATION_BUDGET_BYTES];
+};
+
+// Open while --join plays a server's round
+static MoleculeClient _moleculeClient;
@@ -0,0 +1,109 @@
+#pragma once
+// Std. Includes
+#include <iostream>
+#include <cstring>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+// GL Includes
+#include <GL/glew.h>
+#include "gldebug.h"
+
+// NV_gpu_multicast is newer than the GLEW in Include/glew, its tokens and entry points are declared here and looked
+// up through wglGetProcAddress once the extension is listed
+#define EYE_GPUS_MULTICAST_GPUS_NV 0x92BA
+
+typedef void (GLAPIENTRY* EyeGpusRenderMask)(GLbitfield mask);
+typedef void (GLAPIENTRY* EyeGpusCopyImage)(GLuint srcGpu, GLbitfield dstGpuMask, GLuint srcName, GLenum srcTarget, GLint srcLevel,
+	GLint srcX, GLint srcY, GLint srcZ, GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ,
+	GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth);
+typedef void (GLAPIENTRY* EyeGpusWaitSync)(GLuint signalGpu, GLbitfield waitGpuMask);
+
+// Each eye on its own GPU of a linked pair through NV_gpu_multicast. The one context spans both GPUs: uploads,
+// buffer writes and texture loads go to both, so the scene's resources exist on each without being set up twice,
+// and everything drawn goes to the GPUs of the render mask. The eye passes are submitted once per eye as in
+// sequential stereo, each masked to its eye's GPU, so the two GPUs work on their eyes at the same time. Everything
+// else runs on both.
+//
+// Both GPUs draw into their own copy of the same side by side eye texture, the left eye's GPU into the left half
+// and the right eye's into the right. gather() copies the right half across to the GPU the compositor reads, before
+// the frame is committed.
+//
+// The driver only lists the extension for an application it runs with multicast on (an SLI profile); without it,
+// or with a single GPU, init() is false and the eyes render on one GPU as before.
+class EyeGpus
+{
+public:
+	EyeGpus() {}
+
+	EyeGpus(const EyeGpus&) = delete;
+	EyeGpus& operator=(const EyeGpus&) = delete;
+
+	bool init()
+	{
+		if (!this->hasExtension())
+			return false;
+		GLint gpus = 0;
+		glGetIntegerv(EYE_GPUS_MULTICAST_GPUS_NV, &gpus);
+		this->renderMask = (EyeGpusRenderMask)wglGetProcAddress("glRenderGpuMaskNV");
+		this->copyImage = (EyeGpusCopyImage)wglGetProcAddress("glMulticastCopyImageSubDataNV");
+		this->waitSync = (EyeGpusWaitSync)wglGetProcAddress("glMulticastWaitSyncNV");
+		if (gpus < 2 || !this->renderMask || !this->copyImage || !this->waitSync)
+		{
+			std::cout << "ERROR::MULTI_GPU::UNUSABLE with " << gpus << " GPUs, both eyes on one" << std::endl;
+			this->renderMask = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	bool active() const { return this->renderMask != nullptr; }
+
+	// What follows only draws on eye's GPU, GPU 0 for the left eye and 1 for the right
+	void renderEye(int eye)
+	{
+		if (this->renderMask)
+			this->renderMask(1u << eye);
+	}
+
+	// What follows draws on both
+	void renderBoth()
+	{
+		if (this->renderMask)
+			this->renderMask(3u);
+	}
+
+	// Copies the right eye's rectangle of texture from the right eye's GPU to the left's, into the same place. The
+	// right eye's GPU first waits for the left's to be done with the texture, the left's then waits for the copy
+	// before anything after reads it.
+	void gather(GLuint texture, GLint x, GLint y, GLsizei width, GLsizei height)
+	{
+		if (!this->renderMask)
+			return;
+		GLDebugGroup group("multi-gpu gather");
+		this->renderBoth();
+		this->waitSync(0, 1u << 1);
+		this->copyImage(1, 1u << 0, texture, GL_TEXTURE_2D, 0, x, y, 0, texture, GL_TEXTURE_2D, 0, x, y, 0, width, height, 1);
+		this->waitSync(1, 1u << 0);
+	}
+
+private:
+	bool hasExtension() const
+	{
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (name && !strcmp(name, "GL_NV_gpu_multicast"))
+				return true;
+		}
+		return false;
+	}
+
+	EyeGpusRenderMask renderMask = nullptr;
+	EyeGpusCopyImage copyImage = nullptr;
+	EyeGpusWaitSync waitSync = nullptr;
+};
+
+static EyeGpus _eyeGpus;
@@ -0,0 +1,515 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <emmintrin.h>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <assimp/types.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include "mesh.h"
+#include "mappedfile.h"
+#include "assetpack.h"
+#include "assimpio.h"
+#include "flathashmap.h"
+#include "jobs.h"
+
+// Native OBJ and MTL import, the opt-in alternative to Assimp for the plain models the scenes use (--native-obj).
+//
+// The file is read in place from its mapping or the asset pack, and parsed in OBJ_IMPORT_CHUNK sized chunks
+// split at line ends on the job system: a first pass counts each chunk's v, vt and vn lines so the second knows
+// where its attributes go and can resolve relative indices. Lines are found 16 bytes at a time with SSE2, tokens
+// are short enough that they are scanned one byte at a time. Faces are fanned into triangles, each run of faces
+// under one usemtl becomes a mesh, and the meshes' corners are welded into indexed vertices in parallel.
+// Texture coordinates come out flipped, as aiProcess_FlipUVs would leave them. Only the diffuse, ambient and
+// specular colors of the materials are read, which is all Model uses.
+
+// Bytes of the file per parsing job
+#define OBJ_IMPORT_CHUNK (1 << 20)
+
+// Set by WinMain from --native-obj, Model then loads .obj files with _importObj instead of Assimp
+static bool _nativeObjImport = false;
+
+static bool _isObjPath(const string& path)
+{
+	string extension = path.substr(path.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == "obj";
+}
+
+// One mesh, vertices in Model's layout, colors diffuse, ambient, specular
+struct ObjMesh
+{
+	vector<Vertex> vertices;
+	vector<GLuint> indices;
+	vector<aiColor3D> colors;
+};
+
+// Position, texture coordinate and normal of one face corner, 0 based, -1 where the face leaves one out
+struct ObjCorner
+{
+	int32_t position;
+	int32_t texCoord;
+	int32_t normal;
+};
+
+// What one chunk of the file held
+struct ObjChunk
+{
+	const char* begin;
+	const char* end;
+	// Attribute lines, from the counting pass, and the first index of each in the file
+	uint32_t positionCount = 0;
+	uint32_t texCoordCount = 0;
+	uint32_t normalCount = 0;
+	uint32_t positionBase = 0;
+	uint32_t texCoordBase = 0;
+	uint32_t normalBase = 0;
+	// Three corners per triangle
+	vector<ObjCorner> corners;
+	// Where each usemtl in the chunk starts in corners
+	vector<pair<size_t, string>> materials;
+	vector<string> libraries;
+	bool failed = false;
+};
+
+// Next '\n' at or after p, end if there is none
+static const char* _findObjLineEnd(const char* p, const char* end)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	while (p + 16 <= end)
+	{
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newline));
+		if (mask)
+		{
+			while (!(mask & 1))
+			{
+				mask >>= 1;
+				p++;
+			}
+			return p;
+		}
+		p += 16;
+	}
+	while (p < end && *p != '\n')
+		p++;
+	return p;
+}
+
+static inline const char* _skipObjSpace(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+	return p;
+}
+
+static inline bool _isObjKeyword(const char* p, const char* end, const char* keyword, size_t length)
+{
+	return (size_t)(end - p) > length && memcmp(p, keyword, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+}
+
+// Decimal float with optional sign, fraction and exponent, what OBJ writers emit, independent of the C locale
+static const char* _parseObjFloat(const char* p, const char* end, float* value)
+{
+	p = _skipObjSpace(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	double result = 0.0;
+	while (p < end && *p >= '0' && *p <= '9')
+		result = result * 10.0 + (*p++ - '0');
+	if (p < end && *p == '.')
+	{
+		double scale = 0.1;
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, scale *= 0.1)
+			result += (*p - '0') * scale;
+	}
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		bool negativeExponent = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negativeExponent = *p++ == '-';
+		int exponent = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+			exponent = exponent * 10 + (*p++ - '0');
+		result *= pow(10.0, negativeExponent ? -exponent : exponent);
+	}
+	*value = (float)(negative ? -result : result);
+	return p;
+}
+
+// An index of a face corner made 0 based, count being the attributes before this line for relative ones.
+// false if there is no number at p.
+static bool _parseObjIndex(const char** cursor, const char* end, uint32_t count, int32_t* index)
+{
+	const char* p = *cursor;
+	bool negative = false;
+	if (p < end && *p == '-')
+	{
+		negative = true;
+		p++;
+	}
+	if (p == end || *p < '0' || *p > '9')
+		return false;
+	int64_t value = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+		value = value * 10 + (*p++ - '0');
+	*index = (int32_t)(negative ? (int64_t)count - value : value - 1);
+	*cursor = p;
+	return true;
+}
+
+static string _objRestOfLine(const char* p, const char* end)
+{
+	p = _skipObjSpace(p, end);
+	while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+		end--;
+	return string(p, end);
+}
+
+// First pass over a chunk: how many of each attribute it declares
+static void _countObjChunk(ObjChunk& chunk)
+{
+	for (const char* line = chunk.begin; line < chunk.end;)
+	{
+		const char* lineEnd = _findObjLineEnd(line, chunk.end);
+		const char* p = _skipObjSpace(line, lineEnd);
+		if (lineEnd - p > 1 && p[0] == 'v')
+		{
+			if (p[1] == ' ' || p[1] == '\t')
+				chunk.positionCount++;
+			else if (_isObjKeyword(p, lineEnd, "vt", 2))
+				chunk.texCoordCount++;
+			else if (_isObjKeyword(p, lineEnd, "vn", 2))
+				chunk.normalCount++;
+		}
+		line = lineEnd + 1;
+	}
+}
+
+// Second pass: the chunk's attributes into their place in the file's arrays, and its faces as triangles
+static void _parseObjChunk(ObjChunk& chunk, glm::vec3* positions, glm::vec2* texCoords, glm::vec3* normals)
+{
+	uint32_t positionCount = chunk.positionBase;
+	uint32_t texCoordCount = chunk.texCoordBase;
+	uint32_t normalCount = chunk.normalBase;
+	vector<ObjCorner> face;
+	for (const char* line = chunk.begin; line < chunk.end;)
+	{
+		const char* lineEnd = _findObjLineEnd(line, chunk.end);
+		const char* p = _skipObjSpace(line, lineEnd);
+		if (_isObjKeyword(p, lineEnd, "v", 1))
+		{
+			glm::vec3& position = positions[positionCount++];
+			p = _parseObjFloat(p + 1, lineEnd, &position.x);
+			p = _parseObjFloat(p, lineEnd, &position.y);
+			_parseObjFloat(p, lineEnd, &position.z);
+		}
+		else if (_isObjKeyword(p, lineEnd, "vt", 2))
+		{
+			glm::vec2& texCoord = texCoords[texCoordCount++];
+			p = _parseObjFloat(p + 2, lineEnd, &texCoord.x);
+			_parseObjFloat(p, lineEnd, &texCoord.y);
+			texCoord.y = 1.0f - texCoord.y;
+		}
+		else if (_isObjKeyword(p, lineEnd, "vn", 2))
+		{
+			glm::vec3& normal = normals[normalCount++];
+			p = _parseObjFloat(p + 2, lineEnd, &normal.x);
+			p = _parseObjFloat(p, lineEnd, &normal.y);
+			_parseObjFloat(p, lineEnd, &normal.z);
+		}
+		else if (_isObjKeyword(p, lineEnd, "f", 1))
+		{
+			// v, v/vt, v//vn or v/vt/vn per corner
+			face.clear();
+			p = _skipObjSpace(p + 1, lineEnd);
+			while (p < lineEnd)
+			{
+				ObjCorner corner = { -1, -1, -1 };
+				if (!_parseObjIndex(&p, lineEnd, positionCount, &corner.position))
+				{
+					chunk.failed = true;
+					break;
+				}
+				if (p < lineEnd && *p == '/')
+				{
+					p++;
+					_parseObjIndex(&p, lineEnd, texCoordCount, &corner.texCoord);
+					if (p < lineEnd && *p == '/')
+					{
+						p++;
+						_parseObjIndex(&p, lineEnd, normalCount, &corner.normal);
+					}
+				}
+				face.push_back(corner);
+				p = _skipObjSpace(p, lineEnd);
+			}
+			// Fanned from the first corner, as aiProcess_Triangulate does for convex polygons. Points and lines draw nothing.
+			for (size_t i = 2; i < face.size(); i++)
+			{
+				chunk.corners.push_back(face[0]);
+				chunk.corners.push_back(face[i - 1]);
+				chunk.corners.push_back(face[i]);
+			}
+		}
+		else if (_isObjKeyword(p, lineEnd, "usemtl", 6))
+		{
+			chunk.materials.push_back(make_pair(chunk.corners.size(), _objRestOfLine(p + 6, lineEnd)));
+		}
+		else if (_isObjKeyword(p, lineEnd, "mtllib", 6))
+		{
+			chunk.libraries.push_back(_objRestOfLine(p + 6, lineEnd));
+		}
+		line = lineEnd + 1;
+	}
+}
+
+// The file at path, from _assetPack if it's packed, otherwise mapped into file
+static bool _openObjFile(const string& path, MappedFile* file, AssetSpan* span)
+{
+	if (_assetPack.find(path, span))
+		return true;
+	if (!file->open(path))
+		return false;
+	span->data = file->data();
+	span->size = file->size();
+	return true;
+}
+
+// Kd, Ka and Ks of every newmtl in the MTL at path into colors, in the order Model's colors are
+static void _parseObjMaterials(const string& path, map<string, vector<aiColor3D>>* colors)
+{
+	MappedFile file;
+	AssetSpan span;
+	if (!_openObjFile(path, &file, &span))
+	{
+		cout << "ERROR::OBJ::MTL_NOT_FOUND " << path << endl;
+		return;
+	}
+	const char* end = (const char*)span.data + span.size;
+	vector<aiColor3D>* current = nullptr;
+	for (const char* line = (const char*)span.data; line < end;)
+	{
+		const char* lineEnd = _findObjLineEnd(line, end);
+		const char* p = _skipObjSpace(line, lineEnd);
+		int slot = -1;
+		if (_isObjKeyword(p, lineEnd, "newmtl", 6))
+		{
+			current = &(*colors)[_objRestOfLine(p + 6, lineEnd)];
+			current->assign(3, aiColor3D(1.0f, 1.0f, 1.0f));
+		}
+		else if (_isObjKeyword(p, lineEnd, "Kd", 2))
+			slot = 0;
+		else if (_isObjKeyword(p, lineEnd, "Ka", 2))
+			slot = 1;
+		else if (_isObjKeyword(p, lineEnd, "Ks", 2))
+			slot = 2;
+		if (slot >= 0 && current)
+		{
+			aiColor3D& color = (*current)[slot];
+			p = _parseObjFloat(p + 2, lineEnd, &color.r);
+			p = _parseObjFloat(p, lineEnd, &color.g);
+			_parseObjFloat(p, lineEnd, &color.b);
+		}
+		line = lineEnd + 1;
+	}
+}
+
+// A run of triangles under one material, possibly spread over several chunks
+struct ObjMeshRun
+{
+	struct Span
+	{
+		const ObjChunk* chunk;
+		size_t begin;
+		size_t end;
+	};
+	vector<Span> spans;
+	string material;
+};
+
+// Welds one run's corners into vertices. The (texture coordinate, normal) pairs get dense ids first, so the key of
+// a corner fits in 64 bits without ever mistaking one corner for another.
+static void _weldObjMesh(const ObjMeshRun& run, const glm::vec3* positions, uint32_t positionCount, const glm::vec2* texCoords,
+	uint32_t texCoordCount, const glm::vec3* normals, uint32_t normalCount, ObjMesh* mesh)
+{
+	FlatHashMap<uint64_t, uint32_t> pairs;
+	FlatHashMap<uint64_t, GLuint> welded;
+	for (const ObjMeshRun::Span& span : run.spans)
+	{
+		for (size_t i = span.begin; i < span.end; i++)
+		{
+			const ObjCorner& corner = span.chunk->corners[i];
+			const bool validPosition = corner.position >= 0 && (uint32_t)corner.position < positionCount;
+			const bool validTexCoord = corner.texCoord >= 0 && (uint32_t)corner.texCoord < texCoordCount;
+			const bool validNormal = corner.normal >= 0 && (uint32_t)corner.normal < normalCount;
+			bool inserted = false;
+			const uint64_t pairKey = ((uint64_t)(uint32_t)(validTexCoord ? corner.texCoord + 1 : 0) << 32) | (uint32_t)(validNormal ? corner.normal + 1 : 0);
+			uint32_t& pair = pairs.insert(pairKey, &inserted);
+			if (inserted)
+				pair = (uint32_t)pairs.size() - 1;
+			const uint64_t key = ((uint64_t)(uint32_t)(validPosition ? corner.position : 0) << 32) | pair;
+			GLuint& index = welded.insert(key, &inserted);
+			if (inserted)
+			{
+				index = (GLuint)mesh->vertices.size();
+				Vertex vertex;
+				vertex.Position = validPosition ? positions[corner.position] : glm::vec3(0.0f);
+				vertex.Normal = validNormal ? normals[corner.normal] : glm::vec3(0.0f);
+				vertex.TexCoords = validTexCoord ? texCoords[corner.texCoord] : glm::vec2(0.0f);
+				mesh->vertices.push_back(vertex);
+			}
+			mesh->indices.push_back(index);
+		}
+	}
+}
+
+// Imports the OBJ at path and the MTL files it names, false if it can't be read or a face doesn't parse
+static bool _importObj(const string& path, vector<ObjMesh>* meshes)
+{
+	MappedFile file;
+	AssetSpan span;
+	if (!_openObjFile(path, &file, &span))
+	{
+		cout << "ERROR::OBJ::NOT_FOUND " << path << endl;
+		return false;
+	}
+
+	// Chunks end just past a line end, so no line is split between two
+	const char* data = (const char*)span.data;
+	const char* end = data + span.size;
+	vector<ObjChunk> chunks;
+	for (const char* begin = data; begin < end;)
+	{
+		const char* chunkEnd = begin + std::min<size_t>(OBJ_IMPORT_CHUNK, end - begin);
+		chunkEnd = chunkEnd < end ? std::min(_findObjLineEnd(chunkEnd, end) + 1, end) : end;
+		chunks.emplace_back();
+		chunks.back().begin = begin;
+		chunks.back().end = chunkEnd;
+		begin = chunkEnd;
+	}
+
+	_jobs.parallelFor(chunks.size(), 1, [&chunks](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			_countObjChunk(chunks[i]);
+	});
+	uint32_t positionCount = 0, texCoordCount = 0, normalCount = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.positionBase = positionCount;
+		chunk.texCoordBase = texCoordCount;
+		chunk.normalBase = normalCount;
+		positionCount += chunk.positionCount;
+		texCoordCount += chunk.texCoordCount;
+		normalCount += chunk.normalCount;
+	}
+	vector<glm::vec3> positions(positionCount);
+	vector<glm::vec2> texCoords(texCoordCount);
+	vector<glm::vec3> normals(normalCount);
+	_jobs.parallelFor(chunks.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			_parseObjChunk(chunks[i], positions.data(), texCoords.data(), normals.data());
+	});
+
+	// Runs of one material in file order, a material carried over from one chunk into the next
+	map<string, vector<aiColor3D>> colors;
+	const string directory = path.substr(0, path.find_last_of("/\\") + 1);
+	vector<ObjMeshRun> runs(1);
+	for (const ObjChunk& chunk : chunks)
+	{
+		if (chunk.failed)
+		{
+			cout << "ERROR::OBJ::BAD_FACE " << path << endl;
+			return false;
+		}
+		for (const string& library : chunk.libraries)
+			_parseObjMaterials(directory + library, &colors);
+		size_t begin = 0;
+		for (size_t m = 0; m <= chunk.materials.size(); m++)
+		{
+			const size_t spanEnd = m < chunk.materials.size() ? chunk.materials[m].first : chunk.corners.size();
+			if (spanEnd > begin)
+				runs.back().spans.push_back({ &chunk, begin, spanEnd });
+			if (m < chunk.materials.size())
+			{
+				if (!runs.back().spans.empty())
+					runs.emplace_back();
+				runs.back().material = chunk.materials[m].second;
+			}
+			begin = spanEnd;
+		}
+	}
+	if (runs.back().spans.empty())
+		runs.pop_back();
+
+	meshes->assign(runs.size(), ObjMesh());
+	_jobs.parallelFor(runs.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			_weldObjMesh(runs[i], positions.data(), positionCount, texCoords.data(), texCoordCount, normals.data(), normalCount, &(*meshes)[i]);
+			auto material = colors.find(runs[i].material);
+			(*meshes)[i].colors = material != colors.end() ? material->second : vector<aiColor3D>(3, aiColor3D(1.0f, 1.0f, 1.0f));
+		}
+	});
+	return true;
+}
+
+// --bench-obj <file>: times Assimp and the native importer on the same OBJ, both up to triangulated meshes with
+// their colors, without any GL work
+static void _benchmarkObjImport(const string& path)
+{
+	size_t assimpVertices = 0, assimpIndices = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	{
+		ImporterPool::Handle importer = _importers.acquire();
+		const aiScene* scene = importer->ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+		if (!scene)
+		{
+			cout << "ERROR::ASSIMP:: " << importer->GetErrorString() << endl;
+			return;
+		}
+		for (unsigned i = 0; i < scene->mNumMeshes; i++)
+		{
+			assimpVertices += scene->mMeshes[i]->mNumVertices;
+			assimpIndices += scene->mMeshes[i]->mNumFaces * 3;
+		}
+	}
+	std::chrono::duration<double, std::milli> assimpTime = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	vector<ObjMesh> meshes;
+	if (!_importObj(path, &meshes))
+		return;
+	std::chrono::duration<double, std::milli> nativeTime = std::chrono::steady_clock::now() - start;
+	size_t nativeVertices = 0, nativeIndices = 0;
+	for (const ObjMesh& mesh : meshes)
+	{
+		nativeVertices += mesh.vertices.size();
+		nativeIndices += mesh.indices.size();
+	}
+
+	char message[512];
+	snprintf(message, sizeof(message), "%s: Assimp %.1f ms (%zu vertices, %zu indices), native %.1f ms (%zu welded vertices, %zu indices, %zu meshes)\n",
+		path.c_str(), assimpTime.count(), assimpVertices, assimpIndices, nativeTime.count(), nativeVertices, nativeIndices, meshes.size());
+	OutputDebugStringA(message);
+	cout << message;
+}
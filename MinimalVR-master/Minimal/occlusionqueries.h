@@ -0,0 +1,267 @@
+#pragma once
+// Std. Includes
+#include <iostream>
+#include <vector>
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "glstate.h"
+#include "gldebug.h"
+#include "glcapture.h"
+#include "culling.h"
+#include "flathashmap.h"
+#include "renderstats.h"
+
+// Frames an object may go unqueried before its query objects go back to the pool
+#define OCCLUSION_QUERY_IDLE_FRAMES 120
+// Boxes are grown by this much, in metres, so what moves a little between frames isn't hidden by last frame's box
+#define OCCLUSION_QUERY_MARGIN 0.05f
+
+// The box's 14 vertex strip from the vertex index alone, scaled to boxMin..boxMax
+static const char OCCLUSION_BOX_VERTEX[] =
+	"#version 410 core\n"
+	"uniform mat4 viewProj;\n"
+	"uniform vec3 boxMin;\n"
+	"uniform vec3 boxMax;\n"
+	"void main() {\n"
+	"    int i = gl_VertexID;\n"
+	"    vec3 corner = vec3((0x287a >> i) & 1, (0x02af >> i) & 1, (0x31e3 >> i) & 1);\n"
+	"    gl_Position = viewProj * vec4(mix(boxMin, boxMax, corner), 1.0);\n"
+	"}\n";
+
+static const char OCCLUSION_BOX_FRAGMENT[] =
+	"#version 410 core\n"
+	"void main() {\n"
+	"}\n";
+
+// Occlusion queries on the bounding boxes of a few expensive objects, whose draws are then wrapped in conditional
+// rendering on the query from the frame before.
+//
+// Each frame query() draws an object's box, with color and depth writes off, against the depth of what is already
+// drawn; beginConditional() the next frame skips the object's draws on the GPU if none of that box passed. The
+// conditional render doesn't wait (GL_QUERY_NO_WAIT), a result that isn't in yet draws the object, so nothing
+// stalls and the worst case is the draw that would have been issued anyway. Objects are keyed by the caller's id
+// and a view, one query per eye. Each keeps two query objects, one written this frame while the other is read,
+// and gives them back to the pool after OCCLUSION_QUERY_IDLE_FRAMES unqueried.
+//
+// A box the camera is inside has its front faces clipped away and can't be tested, so it isn't queried and its
+// object draws unconditionally the next frame.
+class OcclusionQueries
+{
+public:
+	OcclusionQueries() {}
+	~OcclusionQueries()
+	{
+		this->entries.forEach([this](uint64_t, Entry& entry)
+		{
+			this->pool.push_back(entry.queries[0]);
+			this->pool.push_back(entry.queries[1]);
+		});
+		if (!this->pool.empty())
+			glDeleteQueries((GLsizei)this->pool.size(), this->pool.data());
+		if (this->program)
+			glDeleteProgram(this->program);
+		if (this->vertexArray)
+			glDeleteVertexArrays(1, &this->vertexArray);
+	}
+
+	OcclusionQueries(const OcclusionQueries&) = delete;
+	OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+
+	bool init()
+	{
+		GLuint vertex = this->compile(GL_VERTEX_SHADER, OCCLUSION_BOX_VERTEX);
+		GLuint fragment = this->compile(GL_FRAGMENT_SHADER, OCCLUSION_BOX_FRAGMENT);
+		if (!vertex || !fragment)
+		{
+			glDeleteShader(vertex);
+			glDeleteShader(fragment);
+			return false;
+		}
+		this->program = glCreateProgram();
+		glAttachShader(this->program, vertex);
+		glAttachShader(this->program, fragment);
+		glLinkProgram(this->program);
+		_glCapture.programSources(this->program, OCCLUSION_BOX_VERTEX, OCCLUSION_BOX_FRAGMENT);
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		GLint success = 0;
+		glGetProgramiv(this->program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetProgramInfoLog(this->program, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::OCCLUSION::LINKING_FAILED\n" << infoLog << std::endl;
+			glDeleteProgram(this->program);
+			this->program = 0;
+			return false;
+		}
+		this->viewProjLocation = glGetUniformLocation(this->program, "viewProj");
+		this->boxMinLocation = glGetUniformLocation(this->program, "boxMin");
+		this->boxMaxLocation = glGetUniformLocation(this->program, "boxMax");
+		// The boxes read no attributes, but a core context still wants a vertex array bound
+		glGenVertexArrays(1, &this->vertexArray);
+		_glLabel(GL_PROGRAM, this->program, "occlusion boxes");
+		return true;
+	}
+
+	bool initialized() const { return this->program != 0; }
+
+	// Before any query or conditional of frame. Every OCCLUSION_QUERY_IDLE_FRAMES, objects that went unqueried that
+	// long give their query objects back to the pool.
+	void beginFrame(uint64_t frame)
+	{
+		this->frame = frame;
+		if (frame < this->sweepFrame + OCCLUSION_QUERY_IDLE_FRAMES)
+			return;
+		this->sweepFrame = frame;
+		FlatHashMap<uint64_t, Entry> kept;
+		this->entries.forEach([&](uint64_t key, Entry& entry)
+		{
+			if (entry.used + OCCLUSION_QUERY_IDLE_FRAMES < frame)
+			{
+				this->pool.push_back(entry.queries[0]);
+				this->pool.push_back(entry.queries[1]);
+			}
+			else
+			{
+				kept.insert(key) = entry;
+			}
+		});
+		this->entries = kept;
+	}
+
+	// Sets up the box draws of one view, against the depth of the bound framebuffer. Color writes stay off until
+	// end(), depth is tested but not written, and faces aren't culled, the far side of a box counts too.
+	void begin(const glm::mat4& viewProj, const glm::vec3& viewPos)
+	{
+		this->viewPos = viewPos;
+		this->cullFace = glIsEnabled(GL_CULL_FACE) == GL_TRUE;
+		glDisable(GL_CULL_FACE);
+		_glState.useProgram(this->program);
+		_glState.bindVertexArray(this->vertexArray);
+		_glState.colorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		_glState.depthMask(GL_FALSE);
+		_glState.depthFunc(GL_LEQUAL);
+		glUniformMatrix4fv(this->viewProjLocation, 1, GL_FALSE, &viewProj[0][0]);
+	}
+
+	// Queries id's world space box from view, for the next frame's beginConditional(id, view)
+	void query(uintptr_t id, int view, const Aabb& box)
+	{
+		if (box.empty())
+			return;
+		const glm::vec3 low = box.min - glm::vec3(OCCLUSION_QUERY_MARGIN);
+		const glm::vec3 high = box.max + glm::vec3(OCCLUSION_QUERY_MARGIN);
+		Entry& entry = this->entry(id, view);
+		entry.used = this->frame;
+		if (glm::all(glm::greaterThanEqual(this->viewPos, low)) && glm::all(glm::lessThanEqual(this->viewPos, high)))
+			return;
+		const uint32_t slot = (uint32_t)(this->frame & 1);
+		glUniform3fv(this->boxMinLocation, 1, &low.x);
+		glUniform3fv(this->boxMaxLocation, 1, &high.x);
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, entry.queries[slot]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 14);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+		_renderStats.draw(GL_TRIANGLE_STRIP, 14);
+		entry.issued[slot] = this->frame;
+	}
+
+	// Back to color writes, depth writes and the culling begin() found
+	void end()
+	{
+		_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		_glState.depthMask(GL_TRUE);
+		if (this->cullFace)
+			glEnable(GL_CULL_FACE);
+	}
+
+	// Starts conditional rendering of id's draws in view on its box query of the frame before, false, with nothing
+	// started, if there is none. Draws until endConditional() are skipped on the GPU if that box was hidden.
+	bool beginConditional(uintptr_t id, int view)
+	{
+		const Entry* entry = this->entries.find(this->key(id, view));
+		const uint32_t slot = (uint32_t)((this->frame + 1) & 1);
+		if (!entry || this->frame == 0 || entry->issued[slot] != this->frame - 1)
+			return false;
+		glBeginConditionalRender(entry->queries[slot], GL_QUERY_NO_WAIT);
+		return true;
+	}
+
+	void endConditional()
+	{
+		glEndConditionalRender();
+	}
+
+	// Objects with query objects, for the stats
+	size_t objects() const { return this->entries.size(); }
+
+private:
+	struct Entry
+	{
+		GLuint queries[2];
+		// The frame each query was last issued, ~0 for never
+		uint64_t issued[2];
+		// The latest frame query() was called for the object, whether or not it issued one
+		uint64_t used;
+	};
+
+	// Views are small and ids are addresses, at least 4 byte aligned
+	static uint64_t key(uintptr_t id, int view) { return (uint64_t)id | (uint64_t)(view & 3); }
+
+	Entry& entry(uintptr_t id, int view)
+	{
+		bool inserted = false;
+		Entry& entry = this->entries.insert(this->key(id, view), &inserted);
+		if (inserted)
+		{
+			for (int i = 0; i < 2; ++i)
+			{
+				if (this->pool.empty())
+				{
+					glGenQueries(1, &entry.queries[i]);
+				}
+				else
+				{
+					entry.queries[i] = this->pool.back();
+					this->pool.pop_back();
+				}
+				entry.issued[i] = ~0ull;
+			}
+		}
+		return entry;
+	}
+
+	GLuint compile(GLenum type, const char* source)
+	{
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+		GLint success = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::OCCLUSION::COMPILATION_FAILED\n" << infoLog << std::endl;
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+
+	GLuint program = 0;
+	GLuint vertexArray = 0;
+	GLint viewProjLocation = -1;
+	GLint boxMinLocation = -1;
+	GLint boxMaxLocation = -1;
+	FlatHashMap<uint64_t, Entry> entries;
+	// Query objects of objects that went idle, handed out before new ones are generated
+	vector<GLuint> pool;
+	uint64_t frame = 0;
+	uint64_t sweepFrame = 0;
+	glm::vec3 viewPos = glm::vec3(0.0f);
+	bool cullFace = false;
+};
@@ -0,0 +1,239 @@
+#pragma once
+// Std. Includes
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "glstate.h"
+#include "gldebug.h"
+#include "glcapture.h"
+#include "renderstats.h"
+
+// The targets the translucent draws accumulate into: premultiplied colour and coverage summed at half float, and
+// the product of what each fragment lets through, which only ever shrinks from 1 so 8 bits hold it
+#define OIT_ACCUM_FORMAT GL_RGBA16F
+#define OIT_REVEALAGE_FORMAT GL_R8
+// Texture units the composite samples them from, above MOLECULE_ARENA_INDEX_UNIT
+#define OIT_ACCUM_UNIT 18
+#define OIT_REVEALAGE_UNIT 19
+
+// Full screen triangle from the vertex index alone
+static const char OIT_COMPOSITE_VERTEX[] =
+	"#version 330 core\n"
+	"void main() {\n"
+	"    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+	"    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+	"}\n";
+
+// The weighted average of every translucent fragment over the pixel, covering what they let through between them.
+// Pixels nothing translucent landed on are left alone. The multisampled variant takes the pixel's samples
+// averaged, the edges of translucent surfaces lose their antialiasing but nothing needs per sample shading.
+static const char OIT_COMPOSITE_FRAGMENT[] =
+	"#ifdef OIT_MULTISAMPLE\n"
+	"uniform sampler2DMS accum;\n"
+	"uniform sampler2DMS revealage;\n"
+	"uniform int samples;\n"
+	"#else\n"
+	"uniform sampler2D accum;\n"
+	"uniform sampler2D revealage;\n"
+	"#endif\n"
+	"out vec4 color;\n"
+	"void main() {\n"
+	"    ivec2 pixel = ivec2(gl_FragCoord.xy);\n"
+	"#ifdef OIT_MULTISAMPLE\n"
+	"    vec4 sum = vec4(0.0);\n"
+	"    float revealed = 0.0;\n"
+	"    for (int i = 0; i < samples; i++) {\n"
+	"        sum += texelFetch(accum, pixel, i);\n"
+	"        revealed += texelFetch(revealage, pixel, i).r;\n"
+	"    }\n"
+	"    sum /= float(samples);\n"
+	"    revealed /= float(samples);\n"
+	"#else\n"
+	"    vec4 sum = texelFetch(accum, pixel, 0);\n"
+	"    float revealed = texelFetch(revealage, pixel, 0).r;\n"
+	"#endif\n"
+	"    if (revealed >= 1.0)\n"
+	"        discard;\n"
+	"    color = vec4(sum.rgb / clamp(sum.a, 1e-4, 5e4), 1.0 - revealed);\n"
+	"}\n";
+
+// Weighted blended order-independent transparency (McGuire and Bavoil): translucent draws go into an accumulation
+// and a revealage target in any order, each fragment weighted by its coverage and distance, and one full screen
+// pass puts their average over the opaque image. Nothing has to be sorted by depth, and the cost is the fragments
+// drawn plus the one pass, however many draws there are.
+//
+// The render graph owns the targets, see RiftApp::_declareTranslucentPasses. The translucent pass draws with the
+// eye depth attached for testing, not writing, between begin() and end(); the fragment shaders write the two
+// targets themselves (AvatarFragmentShader.glsl's WEIGHTED_OIT). The composite pass then blends them over the
+// colour target. With MSAA the targets have the eye target's samples, as the depth they are drawn with has to.
+// Per target blend functions need GL_ARB_draw_buffers_blend.
+class WeightedBlendedOit
+{
+public:
+	WeightedBlendedOit() {}
+	~WeightedBlendedOit()
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			if (this->programs[i])
+				glDeleteProgram(this->programs[i]);
+		}
+		if (this->vertexArray)
+			glDeleteVertexArrays(1, &this->vertexArray);
+	}
+
+	WeightedBlendedOit(const WeightedBlendedOit&) = delete;
+	WeightedBlendedOit& operator=(const WeightedBlendedOit&) = delete;
+
+	static bool supported()
+	{
+		return GLEW_ARB_draw_buffers_blend != 0;
+	}
+
+	bool init()
+	{
+		if (this->programs[0])
+			return true;
+		this->programs[0] = this->link("");
+		this->programs[1] = this->link("#define OIT_MULTISAMPLE\n");
+		if (!this->programs[0] || !this->programs[1])
+		{
+			glDeleteProgram(this->programs[0]);
+			glDeleteProgram(this->programs[1]);
+			this->programs[0] = this->programs[1] = 0;
+			return false;
+		}
+		this->samplesLocation = glGetUniformLocation(this->programs[1], "samples");
+		glGenVertexArrays(1, &this->vertexArray);
+		return true;
+	}
+
+	bool initialized() const { return this->programs[0] != 0; }
+
+	// Clears the pass's targets, accumulation at colour attachment 0 and revealage at 1, and sets their blending.
+	// Depth is tested but not written, so the translucent draws don't hide each other.
+	void begin()
+	{
+		static const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		static const GLfloat one[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		glClearBufferfv(GL_COLOR, 0, zero);
+		glClearBufferfv(GL_COLOR, 1, one);
+		_glCapture.clear(GL_COLOR_BUFFER_BIT);
+		glBlendFunci(0, GL_ONE, GL_ONE);
+		glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+		_glState.depthMask(GL_FALSE);
+	}
+
+	// Puts back the one blend function ExampleApp::initGl set, on every target
+	void end()
+	{
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		_glState.blend(false);
+		_glState.depthMask(GL_TRUE);
+	}
+
+	// Over the colour target bound for drawing, width by height of it. samples above 1 for the MSAA target's.
+	void composite(GLuint accum, GLuint revealage, GLsizei width, GLsizei height, GLint samples)
+	{
+		const bool multisampled = samples > 1;
+		const GLuint program = this->programs[multisampled ? 1 : 0];
+		if (!program)
+			return;
+		GLDebugGroup debugGroup("oit composite");
+		const GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+		const GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_CULL_FACE);
+		_glState.useProgram(program);
+		if (multisampled)
+		{
+			_glState.bindMultisampleTexture(OIT_ACCUM_UNIT, accum);
+			_glState.bindMultisampleTexture(OIT_REVEALAGE_UNIT, revealage);
+			glUniform1i(this->samplesLocation, samples);
+		}
+		else
+		{
+			_glState.bindTexture(OIT_ACCUM_UNIT, accum);
+			_glState.bindTexture(OIT_REVEALAGE_UNIT, revealage);
+		}
+		_glState.bindVertexArray(this->vertexArray);
+		// What the translucent surfaces let through of the opaque image, plus their average colour over the rest
+		_glState.blend(true);
+		glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+		glViewport(0, 0, width, height);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		_glCapture.drawArrays(GL_TRIANGLES, 0, 3);
+		_renderStats.draw(GL_TRIANGLES, 3);
+
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		_glState.blend(false);
+		if (depthTest)
+			glEnable(GL_DEPTH_TEST);
+		if (cullFace)
+			glEnable(GL_CULL_FACE);
+	}
+
+private:
+	// Single sampled and multisampled
+	GLuint programs[2] = { 0, 0 };
+	GLuint vertexArray = 0;
+	GLint samplesLocation = -1;
+
+	GLuint link(const char* defines)
+	{
+		const char* fragmentSources[3] = { "#version 330 core\n", defines, OIT_COMPOSITE_FRAGMENT };
+		const char* vertexSource = OIT_COMPOSITE_VERTEX;
+		GLuint vertex = this->compile(GL_VERTEX_SHADER, 1, &vertexSource);
+		GLuint fragment = this->compile(GL_FRAGMENT_SHADER, 3, fragmentSources);
+		if (!vertex || !fragment)
+		{
+			glDeleteShader(vertex);
+			glDeleteShader(fragment);
+			return 0;
+		}
+		GLuint program = glCreateProgram();
+		glAttachShader(program, vertex);
+		glAttachShader(program, fragment);
+		glLinkProgram(program);
+		_glCapture.programSources(program, OIT_COMPOSITE_VERTEX, OIT_COMPOSITE_FRAGMENT);
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		GLint success = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetProgramInfoLog(program, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::OIT::LINKING_FAILED\n" << infoLog << std::endl;
+			glDeleteProgram(program);
+			return 0;
+		}
+		_glLabel(GL_PROGRAM, program, defines[0] ? "oit composite multisampled" : "oit composite");
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, "accum"), OIT_ACCUM_UNIT);
+		glUniform1i(glGetUniformLocation(program, "revealage"), OIT_REVEALAGE_UNIT);
+		glUseProgram(0);
+		return program;
+	}
+
+	GLuint compile(GLenum type, GLsizei count, const char** sources)
+	{
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, count, sources, NULL);
+		glCompileShader(shader);
+		GLint success = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::OIT::COMPILATION_FAILED\n" << infoLog << std::endl;
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+};
+
+static WeightedBlendedOit _oit;
@@ -0,0 +1,120 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "vertexlayout.h"
+
+// Vertex at half the size, read by programs built with PACKED_VERTEX (see molecule.vert):
+// position as shorts the vertex shader scales back into the mesh's bounding box, the normal octahedral encoded
+// into the x and y of a GL_INT_2_10_10_10_REV, and the texture coordinates as halves.
+// Both integer attributes are fetched unnormalized and scaled in the shader, which sidesteps GL 4.1 and 4.2
+// disagreeing on how signed normalized values map back to floats.
+struct PackedVertex
+{
+	GLshort position[4];
+	GLuint normal;
+	GLushort texCoords[2];
+};
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay 16 bytes");
+
+// Unnormalized, PACKED_VERTEX scales them
+template <>
+struct VertexLayout<PackedVertex>
+{
+	static constexpr VertexAttributes attributes()
+	{
+		return { 3, {
+			{ 0, 3, GL_SHORT, GL_FALSE, false, offsetof(PackedVertex, position), GL_FLOAT_VEC3, "packedPosition" },
+			{ 1, 4, GL_INT_2_10_10_10_REV, GL_FALSE, false, offsetof(PackedVertex, normal), GL_FLOAT_VEC4, "packedNormal" },
+			{ 2, 2, GL_HALF_FLOAT, GL_FALSE, false, offsetof(PackedVertex, texCoords), GL_FLOAT_VEC2, "texCoords" },
+		} };
+	}
+};
+
+// Largest quantized position coordinate and octahedral component
+#define PACKED_POSITION_RANGE 32767.0f
+#define PACKED_NORMAL_RANGE 511.0f
+
+// Round to nearest, no denormals: anything below the smallest normal half flushes to zero
+static GLushort _packHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	const uint32_t sign = (bits >> 16) & 0x8000u;
+	const int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFFu;
+	if (exponent <= 0)
+		return (GLushort)sign;
+	if (exponent >= 31)
+		return (GLushort)(sign | 0x7C00u);
+	mantissa += 0x1000u;
+	uint32_t half = ((uint32_t)exponent << 10) + (mantissa >> 13);
+	if (half >= 0x7C00u)
+		half = 0x7C00u;
+	return (GLushort)(sign | half);
+}
+
+// Unit vector onto the octahedron, folded into [-1, 1]^2, then 10 bits signed each in x and y
+static GLuint _packOctahedral(const glm::vec3& normal)
+{
+	const float sum = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+	float x = 0.0f, y = 0.0f;
+	if (sum > 0.0f)
+	{
+		x = normal.x / sum;
+		y = normal.y / sum;
+		if (normal.z < 0.0f)
+		{
+			const float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			const float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = fx;
+			y = fy;
+		}
+	}
+	const int32_t ix = (int32_t)floorf(glm::clamp(x, -1.0f, 1.0f) * PACKED_NORMAL_RANGE + 0.5f);
+	const int32_t iy = (int32_t)floorf(glm::clamp(y, -1.0f, 1.0f) * PACKED_NORMAL_RANGE + 0.5f);
+	return ((GLuint)ix & 0x3FFu) | (((GLuint)iy & 0x3FFu) << 10);
+}
+
+// Fills out with count packed vertices, Source being Vertex or anything else with its three members.
+// position = stored * scale + bias gives back the original to within half a step, 1/65535 of the mesh's extent.
+template <typename Source>
+static void _packVertices(const Source* vertices, size_t count, PackedVertex* out, glm::vec3* scale, glm::vec3* bias)
+{
+	glm::vec3 lo(0.0f), hi(0.0f);
+	if (count)
+	{
+		lo = hi = vertices[0].Position;
+		for (size_t i = 1; i < count; i++)
+		{
+			lo = glm::min(lo, vertices[i].Position);
+			hi = glm::max(hi, vertices[i].Position);
+		}
+	}
+	const glm::vec3 center = (lo + hi) * 0.5f;
+	glm::vec3 halfExtent = (hi - lo) * 0.5f;
+	// A flat axis still needs a non zero scale to divide by
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (halfExtent[axis] <= 0.0f)
+			halfExtent[axis] = 1.0f;
+	}
+	*scale = halfExtent / PACKED_POSITION_RANGE;
+	*bias = center;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const glm::vec3 unit = (vertices[i].Position - center) / halfExtent;
+		for (int axis = 0; axis < 3; axis++)
+			out[i].position[axis] = (GLshort)floorf(glm::clamp(unit[axis], -1.0f, 1.0f) * PACKED_POSITION_RANGE + 0.5f);
+		out[i].position[3] = 0;
+		out[i].normal = _packOctahedral(vertices[i].Normal);
+		out[i].texCoords[0] = _packHalf(vertices[i].TexCoords.x);
+		out[i].texCoords[1] = _packHalf(vertices[i].TexCoords.y);
+	}
+}
@@ -0,0 +1,66 @@
+#version 410 core
+#extension GL_ARB_shader_storage_buffer_object : require
+// STEREO_MULTIVIEW is defined by the app for the GL_OVR_multiview2 variant, see RiftApp::StereoMode
+#ifdef STEREO_MULTIVIEW
+#extension GL_OVR_multiview2 : require
+layout(num_views = 2) in;
+#endif
+// GpuParticles' live particles, read straight from the buffers its compute passes write. There are no vertex
+// attributes: every instance is a strip of four vertices facing the eye, shrinking and fading as the particle ages.
+struct Particle { vec4 position; vec4 velocity; vec4 color; };
+layout(std430) readonly buffer Particles { Particle particles[]; };
+layout(std430) readonly buffer Live { uint liveCount; uint live[]; };
+
+// Half the side of a new particle's card in world units
+uniform float particleSize;
+
+out vec4 particleColor;
+// -1 to 1 across the card
+out vec2 particleCorner;
+
+// Element 0 is the left eye. Mono rendering only uses element 0.
+// With LATE_LATCH the cameras come from the block RiftApp rewrites right before the draws are issued.
+#ifdef LATE_LATCH
+layout(std140) uniform LateLatch
+{
+	mat4 view[2];
+	mat4 projection[2];
+	mat4 hands[2];
+};
+#else
+uniform mat4 view[2];
+uniform mat4 projection[2];
+#endif
+// Instanced stereo: every draw is issued with eyeCount times the instances, eye = gl_InstanceID % eyeCount.
+// eyeViewport squeezes each eye into its half of the shared target: xy scale, zw offset in NDC.
+uniform int eyeCount = 1;
+uniform vec4 eyeViewport[2];
+
+void main()
+{
+#ifdef STEREO_MULTIVIEW
+	int eye = int(gl_ViewID_OVR);
+	Particle particle = particles[live[gl_InstanceID]];
+#else
+	int eye = gl_InstanceID % eyeCount;
+	Particle particle = particles[live[gl_InstanceID / eyeCount]];
+#endif
+	// position.w is the age, velocity.w the lifetime
+	float left = clamp(1.0 - particle.position.w / particle.velocity.w, 0.0, 1.0);
+
+	vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.0f - 1.0f;
+	vec4 centre = view[eye] * vec4(particle.position.xyz, 1.0f);
+	centre.xy += corner * particleSize * (0.5f + 0.5f * left);
+	vec4 clip = projection[eye] * centre;
+#ifndef STEREO_MULTIVIEW
+	if (eyeCount > 1)
+	{
+		// Keep each eye out of the other's half, GL_CLIP_DISTANCE0 is enabled by RiftApp
+		gl_ClipDistance[0] = eye == 0 ? clip.w - clip.x : clip.w + clip.x;
+		clip.xy = clip.xy * eyeViewport[eye].xy + eyeViewport[eye].zw * clip.w;
+	}
+#endif
+	gl_Position = clip;
+	particleColor = vec4(particle.color.rgb, particle.color.a * left);
+	particleCorner = corner;
+}
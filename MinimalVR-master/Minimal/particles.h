@@ -0,0 +1,342 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "glstate.h"
+#include "shader.h"
+#include "gldebug.h"
+#include "renderstats.h"
+
+// Particles alive at once, the ring the bursts are written into wraps over the oldest
+#define PARTICLE_CAPACITY 16384
+// Bursts one update can emit, more in a frame are dropped
+#define PARTICLE_MAX_BURSTS 16
+// Particles per burst
+#define PARTICLE_BURST_SIZE 96
+// Invocations per work group of the compute passes
+#define PARTICLE_GROUP_SIZE 64
+// Longest a particle lives, in seconds; each one gets between half of it and all of it
+#define PARTICLE_LIFETIME 0.8f
+// Selects the particle variant of shader.frag
+#define PARTICLE_DEFINE "#define PARTICLE\n"
+
+static const char GPU_PARTICLE_COMMON[] =
+	"#version 410 core\n"
+	"#extension GL_ARB_compute_shader : require\n"
+	"#extension GL_ARB_shader_storage_buffer_object : require\n"
+	"layout(local_size_x = 64) in;\n"
+	"struct Particle { vec4 position; vec4 velocity; vec4 color; };\n"
+	"layout(std430) buffer Particles { Particle particles[]; };\n"
+	"layout(std430) buffer Live { uint liveCount; uint live[]; };\n"
+	"uniform uint capacity;\n";
+
+// New particles from head on round the ring, burstFirst[b] being the first of burst b's. Each flies off its burst's
+// centre in a random direction, position.w its age and velocity.w its lifetime.
+static const char GPU_PARTICLE_EMIT[] =
+	"uniform uint head;\n"
+	"uniform uint total;\n"
+	"uniform int burstCount;\n"
+	"uniform uint burstFirst[16];\n"
+	"uniform vec3 burstCentre[16];\n"
+	"uniform vec4 burstColor[16];\n"
+	"uniform uint seed;\n"
+	"uniform float speed;\n"
+	"uniform float lifetime;\n"
+	"uint hash(uint x)\n"
+	"{\n"
+	"	x ^= x >> 16; x *= 0x7feb352du; x ^= x >> 15; x *= 0x846ca68bu; x ^= x >> 16;\n"
+	"	return x;\n"
+	"}\n"
+	"float random(inout uint state)\n"
+	"{\n"
+	"	state = hash(state);\n"
+	"	return float(state >> 8) / 16777216.0;\n"
+	"}\n"
+	"void main()\n"
+	"{\n"
+	"	uint i = gl_GlobalInvocationID.x;\n"
+	"	if (i >= total)\n"
+	"		return;\n"
+	"	int b = 0;\n"
+	"	while (b + 1 < burstCount && burstFirst[b + 1] <= i)\n"
+	"		b++;\n"
+	"	uint state = seed ^ (i * 0x9e3779b9u);\n"
+	"	float z = random(state) * 2.0 - 1.0;\n"
+	"	float a = random(state) * 6.2831853;\n"
+	"	float r = sqrt(max(1.0 - z * z, 0.0));\n"
+	"	vec3 direction = vec3(r * cos(a), r * sin(a), z);\n"
+	"	float s = speed * (0.4 + 0.6 * random(state));\n"
+	"	float life = lifetime * (0.5 + 0.5 * random(state));\n"
+	"	particles[(head + i) % capacity] = Particle(vec4(burstCentre[b], 0.0), vec4(direction * s, life), burstColor[b]);\n"
+	"}\n";
+
+// Ages and moves every particle, and lists the ones still alive for the draw. liveCount is zeroed before.
+static const char GPU_PARTICLE_UPDATE[] =
+	"uniform float dt;\n"
+	"uniform vec3 gravity;\n"
+	"uniform float damping;\n"
+	"void main()\n"
+	"{\n"
+	"	uint i = gl_GlobalInvocationID.x;\n"
+	"	if (i >= capacity)\n"
+	"		return;\n"
+	"	Particle particle = particles[i];\n"
+	"	if (particle.position.w >= particle.velocity.w)\n"
+	"		return;\n"
+	"	particle.position.w += dt;\n"
+	"	particle.velocity.xyz = (particle.velocity.xyz + gravity * dt) * damping;\n"
+	"	particle.position.xyz += particle.velocity.xyz * dt;\n"
+	"	particles[i] = particle;\n"
+	"	if (particle.position.w < particle.velocity.w)\n"
+	"		live[atomicAdd(liveCount, 1u)] = i;\n"
+	"}\n";
+
+// The strip of four vertices per live particle, eyeCount instances each in instanced stereo
+static const char GPU_PARTICLE_FINALIZE[] =
+	"layout(std430) buffer Command { uint count; uint instanceCount; uint first; uint baseInstance; };\n"
+	"uniform uint eyeCount;\n"
+	"void main()\n"
+	"{\n"
+	"	if (gl_GlobalInvocationID.x != 0u)\n"
+	"		return;\n"
+	"	count = 4u;\n"
+	"	instanceCount = liveCount * eyeCount;\n"
+	"	first = 0u;\n"
+	"	baseInstance = 0u;\n"
+	"}\n";
+
+static GLuint _compileParticleProgram(const char* name, const char* body)
+{
+	const char* sources[2] = { GPU_PARTICLE_COMMON, body };
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 2, sources, NULL);
+	glCompileShader(shader);
+	GLint success = 0;
+	char infoLog[512];
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+		std::cout << "ERROR::GPU_PARTICLES::COMPILATION_FAILED " << name << "\n" << infoLog << std::endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glLinkProgram(program);
+	glDeleteShader(shader);
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(program, sizeof(infoLog), NULL, infoLog);
+		std::cout << "ERROR::GPU_PARTICLES::LINKING_FAILED " << name << "\n" << infoLog << std::endl;
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+// Short lived sparks emitted, moved and drawn entirely on the GPU, so the CPU's cost per frame is the same however
+// many there are: a handful of uniforms per burst and four dispatches, then one glDrawArraysIndirect whose instance
+// count the finalize pass fills in from the live list. The particles sit in a ring of PARTICLE_CAPACITY, new bursts
+// overwriting the oldest, and once the last burst has had PARTICLE_LIFETIME to die out nothing is dispatched or
+// drawn at all. Needs the same extensions as GpuMoleculeSimulation, see supported().
+class GpuParticles
+{
+public:
+	GpuParticles() {}
+	~GpuParticles()
+	{
+		GLuint buffers[] = { this->particleBuffer, this->liveBuffer, this->commandBuffer };
+		glDeleteBuffers(3, buffers);
+		if (this->vertexArray)
+			glDeleteVertexArrays(1, &this->vertexArray);
+		GLuint programs[] = { this->emitProgram, this->updateProgram, this->finalizeProgram };
+		for (GLuint program : programs)
+		{
+			if (program)
+				glDeleteProgram(program);
+		}
+	}
+
+	GpuParticles(const GpuParticles&) = delete;
+	GpuParticles& operator=(const GpuParticles&) = delete;
+
+	static bool supported()
+	{
+		return GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_program_interface_query
+			&& GLEW_ARB_draw_indirect;
+	}
+
+	// False if a program doesn't build, bursts are then ignored
+	bool init()
+	{
+		this->emitProgram = _compileParticleProgram("emit", GPU_PARTICLE_EMIT);
+		this->updateProgram = _compileParticleProgram("update", GPU_PARTICLE_UPDATE);
+		this->finalizeProgram = _compileParticleProgram("finalize", GPU_PARTICLE_FINALIZE);
+		if (!this->emitProgram || !this->updateProgram || !this->finalizeProgram)
+			return false;
+		this->bindBlocks(this->emitProgram);
+		this->bindBlocks(this->updateProgram);
+		this->bindBlocks(this->finalizeProgram);
+
+		// Zeroed particles are dead ones, their age is not below their lifetime
+		const vector<glm::vec4> dead(3 * PARTICLE_CAPACITY, glm::vec4(0.0f));
+		glGenBuffers(1, &this->particleBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->particleBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, dead.size() * sizeof(glm::vec4), dead.data(), GL_DYNAMIC_COPY);
+		glGenBuffers(1, &this->liveBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->liveBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (PARTICLE_CAPACITY + 1), NULL, GL_DYNAMIC_COPY);
+		glGenBuffers(1, &this->commandBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->commandBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 4, NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		// Nothing to source, core profiles just won't draw without one bound
+		glGenVertexArrays(1, &this->vertexArray);
+		this->ready = true;
+		return true;
+	}
+
+	bool initialized() const { return this->ready; }
+
+	// Points a program drawn with particle.vert at the buffers
+	void attach(Shader& shader) const
+	{
+		glShaderStorageBlockBinding(shader.Program, glGetProgramResourceIndex(shader.Program, GL_SHADER_STORAGE_BLOCK, "Particles"), 0);
+		glShaderStorageBlockBinding(shader.Program, glGetProgramResourceIndex(shader.Program, GL_SHADER_STORAGE_BLOCK, "Live"), 1);
+	}
+
+	// Queues PARTICLE_BURST_SIZE particles at centre, world space, for the next update
+	void burst(const glm::vec3& centre, const glm::vec4& color)
+	{
+		if (!this->ready || this->burstCount == PARTICLE_MAX_BURSTS)
+			return;
+		this->burstFirst[this->burstCount] = (GLuint)(this->burstCount * PARTICLE_BURST_SIZE);
+		this->burstCentres[this->burstCount] = centre;
+		this->burstColors[this->burstCount] = color;
+		this->burstCount++;
+	}
+
+	// Render thread, once a frame before the eye passes: emits the queued bursts and moves everything dt seconds on
+	void update(float dt)
+	{
+		if (!this->ready)
+			return;
+		if (this->burstCount)
+			this->quiet = 0.0f;
+		else
+			this->quiet += dt;
+		if (!this->active())
+			return;
+		GLDebugGroup group("particles");
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->particleBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->liveBuffer);
+		if (this->burstCount)
+		{
+			const GLuint total = (GLuint)(this->burstCount * PARTICLE_BURST_SIZE);
+			const GLuint emit = this->emitProgram;
+			_glState.useProgram(emit);
+			glUniform1ui(glGetUniformLocation(emit, "capacity"), PARTICLE_CAPACITY);
+			glUniform1ui(glGetUniformLocation(emit, "head"), this->head);
+			glUniform1ui(glGetUniformLocation(emit, "total"), total);
+			glUniform1i(glGetUniformLocation(emit, "burstCount"), (GLint)this->burstCount);
+			glUniform1uiv(glGetUniformLocation(emit, "burstFirst"), (GLsizei)this->burstCount, this->burstFirst);
+			glUniform3fv(glGetUniformLocation(emit, "burstCentre"), (GLsizei)this->burstCount, glm::value_ptr(this->burstCentres[0]));
+			glUniform4fv(glGetUniformLocation(emit, "burstColor"), (GLsizei)this->burstCount, glm::value_ptr(this->burstColors[0]));
+			glUniform1ui(glGetUniformLocation(emit, "seed"), this->seed++ * 0x9e3779b9u);
+			glUniform1f(glGetUniformLocation(emit, "speed"), 0.6f);
+			glUniform1f(glGetUniformLocation(emit, "lifetime"), PARTICLE_LIFETIME);
+			glDispatchCompute((total + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			this->head = (this->head + total) % PARTICLE_CAPACITY;
+			this->burstCount = 0;
+		}
+
+		const GLuint zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->liveBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		_renderStats.uploaded(sizeof(zero));
+		const GLuint update = this->updateProgram;
+		_glState.useProgram(update);
+		glUniform1ui(glGetUniformLocation(update, "capacity"), PARTICLE_CAPACITY);
+		glUniform1f(glGetUniformLocation(update, "dt"), dt);
+		glUniform3f(glGetUniformLocation(update, "gravity"), 0.0f, -0.5f, 0.0f);
+		// Air slowing them to a fifth over their longest life
+		glUniform1f(glGetUniformLocation(update, "damping"), std::pow(0.2f, dt / PARTICLE_LIFETIME));
+		glDispatchCompute(PARTICLE_CAPACITY / PARTICLE_GROUP_SIZE, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// Every live particle, additively blended over what is drawn, without writing depth. shader is a particle.vert
+	// program, attached and with its view uniforms and particleSize set; eyeCount is 1 for multiview.
+	void draw(Shader& shader, GLuint eyeCount)
+	{
+		if (!this->ready || !this->active())
+			return;
+		GLDebugGroup group("particles");
+		const GLuint finalize = this->finalizeProgram;
+		_glState.useProgram(finalize);
+		glUniform1ui(glGetUniformLocation(finalize, "eyeCount"), eyeCount);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->liveBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, this->commandBuffer);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+
+		shader.Use();
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->particleBuffer);
+		_glState.bindVertexArray(this->vertexArray);
+		_glState.depthMask(GL_FALSE);
+		_glState.blend(true);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->commandBuffer);
+		glDrawArraysIndirect(GL_TRIANGLE_STRIP, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		// Back to the function ExampleApp::initGl sets
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		_glState.blend(false);
+		_glState.depthMask(GL_TRUE);
+	}
+
+private:
+	// Some particle may still be alive
+	bool active() const { return this->quiet < PARTICLE_LIFETIME; }
+
+	void bindBlocks(GLuint program)
+	{
+		const char* names[3] = { "Particles", "Live", "Command" };
+		for (GLuint binding = 0; binding < 3; binding++)
+		{
+			const GLuint index = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, names[binding]);
+			if (index != GL_INVALID_INDEX)
+				glShaderStorageBlockBinding(program, index, binding);
+		}
+	}
+
+	bool ready = false;
+	GLuint emitProgram = 0;
+	GLuint updateProgram = 0;
+	GLuint finalizeProgram = 0;
+	GLuint particleBuffer = 0;
+	GLuint liveBuffer = 0;
+	GLuint commandBuffer = 0;
+	GLuint vertexArray = 0;
+	// Where the next burst starts in the ring
+	GLuint head = 0;
+	GLuint seed = 1;
+	// Seconds since the last burst, starting out with nothing alive
+	float quiet = PARTICLE_LIFETIME;
+	GLuint burstFirst[PARTICLE_MAX_BURSTS] = {};
+	glm::vec3 burstCentres[PARTICLE_MAX_BURSTS];
+	glm::vec4 burstColors[PARTICLE_MAX_BURSTS];
+	size_t burstCount = 0;
+};
@@ -0,0 +1,86 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <cstddef>
+#include <emmintrin.h>
+// GL Includes
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Rays tested by one _pickPoints call, one bit per ray in the hit mask
+#define PICK_MAX_RAYS 8
+
+// A controller laser: starts at the hand and extends forever along direction (unit length)
+struct PickRay
+{
+	glm::vec3 origin;
+	glm::vec3 direction;
+};
+
+// The laser leaves the controller along its local -Z axis
+static PickRay _pickRayFromPose(const glm::vec3& position, const glm::quat& orientation)
+{
+	PickRay ray;
+	ray.origin = position;
+	ray.direction = glm::normalize(orientation * glm::vec3(0.0f, 0.0f, -1.0f));
+	return ray;
+}
+
+// Squared distance from point to the ray, points behind the origin measure to the origin itself
+static inline float _rayDistanceSquared(const PickRay& ray, const glm::vec3& point)
+{
+	glm::vec3 w = point - ray.origin;
+	float t = glm::max(glm::dot(w, ray.direction), 0.0f);
+	glm::vec3 closest = w - ray.direction * t;
+	return glm::dot(closest, closest);
+}
+
+// Tests n points, given as separate x/y/z arrays, against rayCount rays in one pass.
+// Bit r of hits[i] is set when point i lies within radius of ray r; all other bits are cleared.
+// Works on squared distances only, four points per iteration.
+static void _pickPoints(const float* x, const float* y, const float* z, size_t n, const PickRay* rays, size_t rayCount, float radius, uint8_t* hits)
+{
+	const __m128 r2 = _mm_set1_ps(radius * radius);
+	const __m128 zero = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128 px = _mm_loadu_ps(x + i);
+		const __m128 py = _mm_loadu_ps(y + i);
+		const __m128 pz = _mm_loadu_ps(z + i);
+		int lanes[4] = { 0, 0, 0, 0 };
+		for (size_t r = 0; r < rayCount; r++)
+		{
+			const PickRay& ray = rays[r];
+			__m128 wx = _mm_sub_ps(px, _mm_set1_ps(ray.origin.x));
+			__m128 wy = _mm_sub_ps(py, _mm_set1_ps(ray.origin.y));
+			__m128 wz = _mm_sub_ps(pz, _mm_set1_ps(ray.origin.z));
+			__m128 dx = _mm_set1_ps(ray.direction.x);
+			__m128 dy = _mm_set1_ps(ray.direction.y);
+			__m128 dz = _mm_set1_ps(ray.direction.z);
+			// t = max(dot(w, d), 0), closest = w - d * t
+			__m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(wx, dx), _mm_mul_ps(wy, dy)), _mm_mul_ps(wz, dz));
+			t = _mm_max_ps(t, zero);
+			__m128 cx = _mm_sub_ps(wx, _mm_mul_ps(dx, t));
+			__m128 cy = _mm_sub_ps(wy, _mm_mul_ps(dy, t));
+			__m128 cz = _mm_sub_ps(wz, _mm_mul_ps(dz, t));
+			__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy)), _mm_mul_ps(cz, cz));
+			int mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+			for (int lane = 0; lane < 4; lane++)
+				lanes[lane] |= ((mask >> lane) & 1) << r;
+		}
+		for (int lane = 0; lane < 4; lane++)
+			hits[i + lane] = (uint8_t)lanes[lane];
+	}
+	const float radiusSquared = radius * radius;
+	for (; i < n; i++)
+	{
+		uint8_t mask = 0;
+		for (size_t r = 0; r < rayCount; r++)
+		{
+			if (_rayDistanceSquared(rays[r], glm::vec3(x[i], y[i], z[i])) <= radiusSquared)
+				mask |= (uint8_t)(1 << r);
+		}
+		hits[i] = mask;
+	}
+}
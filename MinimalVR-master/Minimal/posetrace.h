@@ -0,0 +1,160 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+using namespace std;
+// OVR Includes
+#include <OVR_CAPI.h>
+#include "mappedfile.h"
+
+// Layout of a pose trace. The file starts with a PoseTraceHeader, then one record per value the app took from the
+// headset, in the order it took them: a PoseTraceRecord and the value as it is in memory, padded to 8.
+#define POSE_TRACE_MAGIC 0x43525450u // "PTRC"
+#define POSE_TRACE_VERSION 1
+
+enum class PoseTraceKind : uint32_t
+{
+	// Seconds since the last frame, one at the start of every frame
+	FrameDelta = 1,
+	Tracking = 2,
+	Input = 3,
+};
+
+struct PoseTraceHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	// What the game's random numbers started from
+	uint32_t seed;
+	uint32_t reserved;
+};
+
+struct PoseTraceRecord
+{
+	PoseTraceKind kind;
+	uint32_t size;
+};
+
+static_assert(sizeof(PoseTraceHeader) == 16 && sizeof(PoseTraceRecord) == 8, "PoseTrace structures are written as they are");
+
+// Records everything a run depends on that changes from one run to the next: the tracking and input the headset
+// reported, how long each frame took, and the seed of the game's random numbers. Replaying a trace hands the same
+// values back in the same order, so the game plays out the same however fast the machine is.
+// Only meaningful for the build that recorded it, the LibOVR structures are stored as they are.
+class PoseTrace
+{
+public:
+	PoseTrace() {}
+	~PoseTrace() { this->close(); }
+
+	PoseTrace(const PoseTrace&) = delete;
+	PoseTrace& operator=(const PoseTrace&) = delete;
+
+	bool record(const char* path)
+	{
+		this->close();
+		this->file = fopen(path, "wb");
+		if (!this->file)
+		{
+			printf("ERROR::POSE_TRACE::NOT_OPENED %s\n", path);
+			return false;
+		}
+		const PoseTraceHeader header = { POSE_TRACE_MAGIC, POSE_TRACE_VERSION, this->seedValue, 0 };
+		fwrite(&header, sizeof(header), 1, this->file);
+		return true;
+	}
+
+	bool replay(const char* path)
+	{
+		this->close();
+		PoseTraceHeader header;
+		if (!this->trace.open(path) || this->trace.size() < sizeof(header))
+		{
+			printf("ERROR::POSE_TRACE::NOT_READ %s\n", path);
+			this->trace.close();
+			return false;
+		}
+		memcpy(&header, this->trace.data(), sizeof(header));
+		if (header.magic != POSE_TRACE_MAGIC || header.version != POSE_TRACE_VERSION)
+		{
+			printf("ERROR::POSE_TRACE::NOT_A_TRACE %s\n", path);
+			this->trace.close();
+			return false;
+		}
+		this->seedValue = header.seed;
+		this->offset = sizeof(header);
+		this->replaying = true;
+		return true;
+	}
+
+	void close()
+	{
+		if (this->file)
+			fclose(this->file);
+		this->file = nullptr;
+		this->trace.close();
+		this->replaying = false;
+	}
+
+	bool recording() const { return this->file != nullptr; }
+	bool active() const { return this->file || this->replaying; }
+	// The replay ran out of records, or stopped matching what the app asked for
+	bool finished() const { return this->ended; }
+
+	// Seeds the game's random numbers. A new one every run, unless a trace being replayed says otherwise.
+	uint32_t seed() const { return this->seedValue; }
+
+	// The trace's value in place of value while replaying, value into the trace while recording.
+	// Nothing happens once a replay has finished, the app goes on with its live values.
+	template <typename T>
+	void exchange(PoseTraceKind kind, T* value)
+	{
+		if (this->file)
+		{
+			const PoseTraceRecord record = { kind, (uint32_t)sizeof(T) };
+			static const uint8_t padding[8] = {};
+			fwrite(&record, sizeof(record), 1, this->file);
+			fwrite(value, sizeof(T), 1, this->file);
+			fwrite(padding, 1, (8 - sizeof(T) % 8) % 8, this->file);
+		}
+		else if (this->replaying)
+		{
+			const uint64_t padded = (sizeof(T) + 7) & ~(uint64_t)7;
+			PoseTraceRecord record;
+			if (this->offset + sizeof(record) + padded > this->trace.size())
+			{
+				this->end(nullptr);
+				return;
+			}
+			memcpy(&record, this->trace.data() + this->offset, sizeof(record));
+			if (record.kind != kind || record.size != sizeof(T))
+			{
+				this->end("ERROR::POSE_TRACE::OUT_OF_STEP");
+				return;
+			}
+			memcpy(value, this->trace.data() + this->offset + sizeof(record), sizeof(T));
+			this->offset += sizeof(record) + padded;
+		}
+	}
+
+private:
+	void end(const char* error)
+	{
+		if (error)
+			printf("%s %u\n", error, (uint32_t)this->offset);
+		this->replaying = false;
+		this->ended = true;
+		this->trace.close();
+	}
+
+	FILE* file = nullptr;
+	MappedFile trace;
+	bool replaying = false;
+	bool ended = false;
+	uint64_t offset = 0;
+	uint32_t seedValue = (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count();
+};
+
+static PoseTrace _poseTrace;
@@ -0,0 +1,285 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "trace.h"
+#include "telemetrysink.h"
+
+// Phases a FrameProfiler can track
+#define PROFILER_MAX_PHASES 16
+// Per frame counters, written to the CSV after the phases
+#define PROFILER_MAX_COUNTERS 64
+// Frames between issuing GPU queries and reading them back, so reading never stalls the pipeline
+#define PROFILER_LATENCY 4
+static_assert((2 + PROFILER_MAX_PHASES * 2) * sizeof(float) <= TELEMETRY_MAX_PARTS * TELEMETRY_RECORD_PAYLOAD
+	&& PROFILER_MAX_COUNTERS * sizeof(uint32_t) <= TELEMETRY_MAX_PARTS * TELEMETRY_RECORD_PAYLOAD, "A frame's records fit their parts");
+
+// Per-frame CPU and GPU timings of named phases.
+//
+// CPU ranges use steady_clock. GPU ranges are pairs of GL_TIMESTAMP queries rather than
+// GL_TIME_ELAPSED, so phases may nest. Queries sit in a ring PROFILER_LATENCY frames deep and a
+// frame's GPU numbers are resolved that many frames later, which is also when its CSV row is written.
+// Each phase is timed at most once per frame; further begin/end pairs in the same frame are ignored.
+// Counters are plain numbers the app reports once per frame (state changes, say) and travel with the frame's timings.
+// With a TelemetrySink the resolved frames go to it as FrameProfile and FrameCounters records instead of being
+// written out here, off the thread that draws.
+class FrameProfiler
+{
+public:
+	FrameProfiler() {}
+	~FrameProfiler()
+	{
+		if (this->csv)
+			fclose(this->csv);
+	}
+
+	FrameProfiler(const FrameProfiler&) = delete;
+	FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+	// Registers a phase, all phases must be added before init()
+	int addPhase(const char* name)
+	{
+		if (this->names.size() >= PROFILER_MAX_PHASES)
+			return -1;
+		this->names.push_back(name);
+		return (int)this->names.size() - 1;
+	}
+
+	// Registers a counter, all counters must be added before init()
+	int addCounter(const char* name)
+	{
+		if (this->counterNames.size() >= PROFILER_MAX_COUNTERS)
+			return -1;
+		this->counterNames.push_back(name);
+		return (int)this->counterNames.size() - 1;
+	}
+
+	// Needs a current GL context. csvPath may be null to skip the log, sink to write no records.
+	void init(const char* csvPath, TelemetrySink* sink = nullptr)
+	{
+		glGenQueries(PROFILER_LATENCY * PROFILER_MAX_PHASES * 2, &this->queries[0][0][0]);
+		if (sink && sink->isOpen())
+		{
+			this->sink = sink;
+			string phases = "f32 cpu_frame_ms,gpu_frame_ms";
+			for (size_t i = 0; i < this->names.size(); i++)
+				phases += "," + this->names[i] + "_cpu_ms," + this->names[i] + "_gpu_ms";
+			string counters = "u32 ";
+			for (size_t i = 0; i < this->counterNames.size(); i++)
+				counters += (i ? "," : "") + this->counterNames[i];
+			sink->describe(TelemetryKind::FrameProfile, phases);
+			sink->describe(TelemetryKind::FrameCounters, counters);
+		}
+		if (csvPath)
+		{
+			this->csv = fopen(csvPath, "w");
+			if (this->csv)
+			{
+				fprintf(this->csv, "frame");
+				for (size_t i = 0; i < this->names.size(); i++)
+					fprintf(this->csv, ",%s_cpu_ms,%s_gpu_ms", this->names[i].c_str(), this->names[i].c_str());
+				for (size_t i = 0; i < this->counterNames.size(); i++)
+					fprintf(this->csv, ",%s", this->counterNames[i].c_str());
+				fprintf(this->csv, "\n");
+			}
+			else
+			{
+				printf("ERROR::PROFILER::CSV_NOT_OPENED %s\n", csvPath);
+			}
+		}
+		this->initialized = true;
+	}
+
+	size_t phaseCount() const { return this->names.size(); }
+	const string& phaseName(int phase) const { return this->names[phase]; }
+	size_t counterCount() const { return this->counterNames.size(); }
+	const string& counterName(int counter) const { return this->counterNames[counter]; }
+
+	void beginFrame(uint64_t frameIndex)
+	{
+		if (!this->initialized)
+			return;
+		this->slot = (this->slot + 1) % PROFILER_LATENCY;
+		Frame& frame = this->frames[this->slot];
+		// The slot is about to be reused, so whatever it held must be collected first
+		if (frame.pending)
+			this->resolve(frame, true);
+		frame.index = frameIndex;
+		frame.pending = true;
+		for (int i = 0; i < PROFILER_MAX_PHASES; i++)
+		{
+			frame.cpuMs[i] = 0.0f;
+			frame.state[i] = PHASE_UNUSED;
+		}
+		for (int i = 0; i < PROFILER_MAX_COUNTERS; i++)
+			frame.counters[i] = 0;
+		this->frameStart = std::chrono::steady_clock::now();
+	}
+
+	void begin(int phase)
+	{
+		if (!this->initialized || phase < 0)
+			return;
+		Frame& frame = this->frames[this->slot];
+		if (frame.state[phase] != PHASE_UNUSED)
+			return;
+		frame.state[phase] = PHASE_OPEN;
+		this->cpuStart[phase] = std::chrono::steady_clock::now();
+		glQueryCounter(this->queries[this->slot][phase][0], GL_TIMESTAMP);
+	}
+
+	void end(int phase)
+	{
+		if (!this->initialized || phase < 0)
+			return;
+		Frame& frame = this->frames[this->slot];
+		if (frame.state[phase] != PHASE_OPEN)
+			return;
+		frame.state[phase] = PHASE_CLOSED;
+		glQueryCounter(this->queries[this->slot][phase][1], GL_TIMESTAMP);
+		frame.cpuMs[phase] = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - this->cpuStart[phase]).count();
+	}
+
+	// Sets a counter of the current frame, the last value before endFrame() is the one kept
+	void count(int counter, uint32_t value)
+	{
+		if (!this->initialized || counter < 0)
+			return;
+		this->frames[this->slot].counters[counter] = value;
+	}
+
+	// Collects the oldest frame whose queries have landed
+	void endFrame()
+	{
+		if (!this->initialized)
+			return;
+		this->frames[this->slot].cpuFrameMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - this->frameStart).count();
+		Frame& oldest = this->frames[(this->slot + 1) % PROFILER_LATENCY];
+		if (oldest.pending)
+			this->resolve(oldest, false);
+	}
+
+	// Latest fully resolved numbers, PROFILER_LATENCY frames old
+	float cpuMs(int phase) const { return phase < 0 ? 0.0f : this->latest.cpuMs[phase]; }
+	float gpuMs(int phase) const { return phase < 0 ? 0.0f : this->latest.gpuMs[phase]; }
+	// Whole frame: CPU from beginFrame to endFrame, GPU from the first phase start to the last phase end
+	float cpuFrameMs() const { return this->latest.cpuFrameMs; }
+	float gpuFrameMs() const { return this->latest.gpuFrameMs; }
+	uint32_t counter(int counter) const { return counter < 0 ? 0 : this->latest.counters[counter]; }
+	uint64_t resolvedFrame() const { return this->latest.index; }
+
+private:
+	enum : uint8_t { PHASE_UNUSED, PHASE_OPEN, PHASE_CLOSED };
+
+	struct Frame
+	{
+		uint64_t index = 0;
+		bool pending = false;
+		uint8_t state[PROFILER_MAX_PHASES];
+		float cpuMs[PROFILER_MAX_PHASES];
+		float gpuMs[PROFILER_MAX_PHASES];
+		uint32_t counters[PROFILER_MAX_COUNTERS] = {};
+		float cpuFrameMs = 0.0f;
+		float gpuFrameMs = 0.0f;
+	};
+
+	vector<string> names;
+	vector<string> counterNames;
+	bool initialized = false;
+	GLuint queries[PROFILER_LATENCY][PROFILER_MAX_PHASES][2];
+	Frame frames[PROFILER_LATENCY];
+	Frame latest;
+	int slot = 0;
+	std::chrono::steady_clock::time_point frameStart;
+	std::chrono::steady_clock::time_point cpuStart[PROFILER_MAX_PHASES];
+	FILE* csv = nullptr;
+	TelemetrySink* sink = nullptr;
+
+	// Reads the GPU side of a frame. Unless forced, gives up without blocking if a result isn't there yet.
+	void resolve(Frame& frame, bool force)
+	{
+		int frameSlot = (int)(&frame - this->frames);
+		if (!force)
+		{
+			for (size_t i = 0; i < this->names.size(); i++)
+			{
+				if (frame.state[i] != PHASE_CLOSED)
+					continue;
+				GLint available = 0;
+				glGetQueryObjectiv(this->queries[frameSlot][i][1], GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available)
+					return;
+			}
+		}
+
+		GLuint64 first = ~(GLuint64)0, last = 0;
+		for (size_t i = 0; i < this->names.size(); i++)
+		{
+			frame.gpuMs[i] = 0.0f;
+			if (frame.state[i] != PHASE_CLOSED)
+				continue;
+			GLuint64 start = 0, stop = 0;
+			glGetQueryObjectui64v(this->queries[frameSlot][i][0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(this->queries[frameSlot][i][1], GL_QUERY_RESULT, &stop);
+			frame.gpuMs[i] = (float)((double)(stop - start) * 1e-6);
+			TRACE_GPU_PHASE(this->names[i].c_str(), frame.index, frame.gpuMs[i]);
+			first = std::min(first, start);
+			last = std::max(last, stop);
+		}
+		frame.gpuFrameMs = last > first ? (float)((double)(last - first) * 1e-6) : 0.0f;
+		frame.pending = false;
+		this->latest = frame;
+
+		if (this->sink)
+		{
+			float times[2 + PROFILER_MAX_PHASES * 2];
+			times[0] = frame.cpuFrameMs;
+			times[1] = frame.gpuFrameMs;
+			for (size_t i = 0; i < this->names.size(); i++)
+			{
+				times[2 + i * 2] = frame.cpuMs[i];
+				times[3 + i * 2] = frame.gpuMs[i];
+			}
+			this->sink->writeParts(TelemetryKind::FrameProfile, times, (2 + this->names.size() * 2) * sizeof(float), (uint32_t)frame.index);
+			if (!this->counterNames.empty())
+				this->sink->writeParts(TelemetryKind::FrameCounters, frame.counters, this->counterNames.size() * sizeof(uint32_t), (uint32_t)frame.index);
+		}
+		if (this->csv)
+		{
+			fprintf(this->csv, "%llu", (unsigned long long)frame.index);
+			for (size_t i = 0; i < this->names.size(); i++)
+				fprintf(this->csv, ",%.3f,%.3f", frame.cpuMs[i], frame.gpuMs[i]);
+			for (size_t i = 0; i < this->counterNames.size(); i++)
+				fprintf(this->csv, ",%u", frame.counters[i]);
+			fprintf(this->csv, "\n");
+		}
+	}
+};
+
+// Times the enclosing block as one phase
+class ProfileScope
+{
+public:
+	ProfileScope(FrameProfiler& profiler, int phase) : profiler(profiler), phase(phase)
+	{
+		this->profiler.begin(this->phase);
+	}
+	~ProfileScope()
+	{
+		this->profiler.end(this->phase);
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	FrameProfiler& profiler;
+	int phase;
+};
@@ -0,0 +1,264 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+// GL Includes
+#include <GL/glew.h>
+#include "glcapture.h"
+
+// Linked programs saved with glGetProgramBinary, one file per program in PROGRAM_CACHE_DIRECTORY named by its key.
+//
+// The key hashes every source string together with the GL vendor, renderer and version, so editing a shader,
+// changing its defines or updating the driver all miss the cache rather than loading a stale binary. A driver
+// may still reject a binary it wrote (after a silent update, say); the caller then compiles as usual and the
+// fresh binary replaces the old file.
+#define PROGRAM_CACHE_DIRECTORY "shadercache"
+#define PROGRAM_CACHE_MAGIC 0x4D475250 // "PRGM"
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t binaryFormat;
+	uint32_t length;
+};
+
+static inline uint64_t _programCacheHash(const void* data, size_t size, uint64_t hash)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+// False when the driver offers no binary formats, which turns the cache off
+static bool _programCacheAvailable()
+{
+	static int formats = -1;
+	if (formats < 0)
+	{
+		formats = 0;
+		if (GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	}
+	return formats > 0;
+}
+
+static uint64_t _programCacheKey(const char* const* sources, int count)
+{
+	uint64_t hash = 14695981039346656037ull;
+	const GLenum identity[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (int i = 0; i < 3; i++)
+	{
+		const char* text = (const char*)glGetString(identity[i]);
+		if (text)
+			hash = _programCacheHash(text, strlen(text) + 1, hash);
+	}
+	for (int i = 0; i < count; i++)
+	{
+		// Lengths go in too, so moving text from one stage to the next changes the key
+		uint64_t length = strlen(sources[i]);
+		hash = _programCacheHash(&length, sizeof(length), hash);
+		hash = _programCacheHash(sources[i], (size_t)length, hash);
+	}
+	return hash;
+}
+
+static string _programCachePath(uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+	return string(PROGRAM_CACHE_DIRECTORY "/") + name;
+}
+
+// A linked program rebuilt from the cached binary for key, or 0 if there is none or the driver refuses it
+static GLuint _loadProgramBinary(uint64_t key)
+{
+	if (!_programCacheAvailable())
+		return 0;
+	const string path = _programCachePath(key);
+	ifstream in(path.c_str(), ios::binary);
+	if (!in)
+		return 0;
+	ProgramCacheHeader header;
+	in.read((char*)&header, sizeof(header));
+	if (!in || header.magic != PROGRAM_CACHE_MAGIC || header.version != PROGRAM_CACHE_VERSION)
+		return 0;
+	vector<char> binary(header.length);
+	in.read(binary.data(), binary.size());
+	if (!in)
+		return 0;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, (GLenum)header.binaryFormat, binary.data(), (GLsizei)binary.size());
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+// Call before linking a program that will be stored, some drivers only keep the binary when asked up front
+static void _markProgramRetrievable(GLuint program)
+{
+	if (_programCacheAvailable())
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+// Programs linked from source this run rather than loaded from the cache, in link order. The driver has never drawn
+// with them, see ProgramWarmup. Whoever warms them up clears the list.
+static vector<GLuint> _freshPrograms;
+
+// Saves a successfully linked program under key. Written to a temporary name first, like the mesh cache.
+static bool _storeProgramBinary(uint64_t key, GLuint program)
+{
+	_freshPrograms.push_back(program);
+	if (!_programCacheAvailable())
+		return false;
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return false;
+	vector<char> binary(length);
+	GLenum binaryFormat = 0;
+	glGetProgramBinary(program, length, &length, &binaryFormat, binary.data());
+
+	CreateDirectoryA(PROGRAM_CACHE_DIRECTORY, NULL);
+	const string path = _programCachePath(key);
+	const string tempPath = path + ".tmp";
+	{
+		ofstream out(tempPath.c_str(), ios::binary | ios::trunc);
+		if (!out)
+			return false;
+		ProgramCacheHeader header;
+		header.magic = PROGRAM_CACHE_MAGIC;
+		header.version = PROGRAM_CACHE_VERSION;
+		header.binaryFormat = binaryFormat;
+		header.length = (uint32_t)length;
+		out.write((const char*)&header, sizeof(header));
+		out.write(binary.data(), length);
+		if (!out)
+		{
+			out.close();
+			DeleteFileA(tempPath.c_str());
+			return false;
+		}
+	}
+	if (!MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileA(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+// With KHR_parallel_shader_compile, or the ARB extension it was promoted from, compiles and links run on the driver's
+// threads and GL_COMPLETION_STATUS tells whether one is through without waiting for it. Any other query of a shader
+// or program still waits, so a build only gets to run beside other work when nothing asks about it in between.
+static bool _parallelShaderCompileAvailable()
+{
+	static int available = -1;
+	if (available < 0)
+	{
+		available = GLEW_ARB_parallel_shader_compile || glewIsSupported("GL_KHR_parallel_shader_compile") ? 1 : 0;
+		// As many compiler threads as the driver likes
+		if (GLEW_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFFu);
+	}
+	return available > 0;
+}
+
+// A program handed to the driver by _beginProgramBuild() and not yet collected by _finishProgramBuild()
+struct ProgramBuild
+{
+	GLuint program = 0;
+	GLuint shaders[2] = { 0, 0 };
+	uint64_t cacheKey = 0;
+	// Loaded from the cache, linked already
+	bool cached = false;
+};
+
+// Loads the program of the two stages from the cache, or issues both compiles and the link without asking how they
+// went. A stage that fails to compile just fails the link, _finishProgramBuild() reports it.
+static ProgramBuild _beginProgramBuild(const char* vertexSource, const char* fragmentSource)
+{
+	ProgramBuild build;
+	const char* sources[2] = { vertexSource, fragmentSource };
+	build.cacheKey = _programCacheKey(sources, 2);
+	build.program = _loadProgramBinary(build.cacheKey);
+	if (build.program)
+	{
+		build.cached = true;
+		_glCapture.programSources(build.program, vertexSource, fragmentSource);
+		return build;
+	}
+	const GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	build.program = glCreateProgram();
+	for (int i = 0; i < 2; i++)
+	{
+		build.shaders[i] = glCreateShader(types[i]);
+		glShaderSource(build.shaders[i], 1, &sources[i], NULL);
+		glCompileShader(build.shaders[i]);
+		glAttachShader(build.program, build.shaders[i]);
+	}
+	_markProgramRetrievable(build.program);
+	glLinkProgram(build.program);
+	_glCapture.programSources(build.program, vertexSource, fragmentSource);
+	return build;
+}
+
+// Whether _finishProgramBuild() would return without waiting on the driver. Without the extension there's no telling,
+// and waiting for it to say so would gain nothing, so always true.
+static bool _programBuildDone(const ProgramBuild& build)
+{
+	if (build.cached || !build.program || !_parallelShaderCompileAvailable())
+		return true;
+	GLint done = GL_FALSE;
+	glGetProgramiv(build.program, GL_COMPLETION_STATUS_ARB, &done);
+	return done == GL_TRUE;
+}
+
+// The linked program, waiting for it if it isn't done, and stored in the cache if it was built from source. 0 if it
+// failed, with the failing stage's log, or the link's, in errorBuffer.
+static GLuint _finishProgramBuild(ProgramBuild& build, size_t errorBufferSize, char* errorBuffer)
+{
+	GLuint program = build.program;
+	build.program = 0;
+	if (build.cached || !program)
+		return program;
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (linked)
+	{
+		_storeProgramBinary(build.cacheKey, program);
+	}
+	else
+	{
+		errorBuffer[0] = '\0';
+		for (int i = 0; i < 2 && !errorBuffer[0]; i++)
+		{
+			GLint compiled = GL_FALSE;
+			glGetShaderiv(build.shaders[i], GL_COMPILE_STATUS, &compiled);
+			if (!compiled)
+				glGetShaderInfoLog(build.shaders[i], (GLsizei)errorBufferSize, NULL, errorBuffer);
+		}
+		if (!errorBuffer[0])
+			glGetProgramInfoLog(program, (GLsizei)errorBufferSize, NULL, errorBuffer);
+		glDeleteProgram(program);
+		program = 0;
+	}
+	for (int i = 0; i < 2; i++)
+		glDeleteShader(build.shaders[i]);
+	return program;
+}
@@ -0,0 +1,149 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <functional>
+using namespace std;
+#include "telemetry.h"
+
+// Frames between two steps of any knob, longer than PROFILER_LATENCY so each step is measured before the next
+#define QUALITY_INTERVAL 8
+// Below this fraction of the target the frame has room to step a knob back up; between it and the target nothing
+// moves, so the knobs don't oscillate
+#define QUALITY_RAISE_FRACTION 0.8f
+// A step the cost model says would take off less than this isn't worth its visible change
+#define QUALITY_MIN_STEP_MS 0.05f
+// The SDK's adaptive GPU scale below this means the compositor sees the app running over
+#define QUALITY_ADAPTIVE_SCALE_FLOOR 0.95f
+
+// Priorities the app's knobs register at, the lowest gives way first and comes back last
+#define QUALITY_PRIORITY_SPECTATOR 0
+#define QUALITY_PRIORITY_MSAA 10
+#define QUALITY_PRIORITY_SHADING_RATE 20
+#define QUALITY_PRIORITY_MOLECULE_LOD 30
+#define QUALITY_PRIORITY_AVATAR_SHADING 40
+#define QUALITY_PRIORITY_RESOLUTION 50
+
+// What one adjustment is decided on
+struct QualityFrame
+{
+	uint64_t frame = 0;
+	// The profiler's latest GPU frame time and what it is steered to
+	float gpuMs = 0.0f;
+	float targetMs = 0.0f;
+};
+
+// One thing the governor can trade for GPU time, registered by the subsystem that owns it. A knob steps down to
+// cheaper and back up to better; how far a step goes is the knob's business, the dynamic resolution for one takes
+// bigger steps the further over the frame is.
+struct QualityKnob
+{
+	const char* name = "";
+	// Where it goes in the governor's order, see QUALITY_PRIORITY_SPECTATOR
+	int priority = 0;
+	// Whether it can go cheaper still, and whether it is below its best, so there is something to give back
+	std::function<bool()> lowerable;
+	std::function<bool()> lowered;
+	// The cost model: GPU ms the next step down would take off the frame, and the next step up put back on
+	std::function<float(const QualityFrame&)> lowerSavesMs;
+	std::function<float(const QualityFrame&)> raiseCostsMs;
+	std::function<void(const QualityFrame&)> lower;
+	std::function<void(const QualityFrame&)> raise;
+	// Where the knob stands, for the log
+	std::function<float()> value;
+	// Frames after the knob last moved before it may go up again, for knobs that reallocate
+	uint32_t raiseInterval = 0;
+	uint64_t changedFrame = 0;
+};
+
+// The one control loop over everything scalable, so the features don't fight each other over the budget.
+//
+// Knobs are kept in priority order, the first is the first to give way: over the target the governor steps
+// the first knob that can go lower and whose step the cost model says is worth it; with clear room it gives back in
+// the reverse order, the knob that went last comes back first, and only a step whose cost still fits under the
+// target. One step of one knob every QUALITY_INTERVAL frames at most.
+//
+// GPU time comes from the profiler. The compositor's summaries, every TELEMETRY_SUMMARY_FRAMES, count as being over
+// when they show dropped frames with the GPU over target or the SDK asks for less through its adaptive scale; until
+// a summary without that comes in, the knobs only go down. Every step is logged.
+class QualityGovernor
+{
+public:
+	void setEnabled(bool enabled) { this->on = enabled; }
+	bool enabled() const { return this->on; }
+
+	// At init, by the subsystem that owns the knob; knobs of the same priority keep the order they came in
+	void add(const QualityKnob& knob)
+	{
+		size_t at = this->knobs.size();
+		while (at > 0 && this->knobs[at - 1].priority > knob.priority)
+			at--;
+		this->knobs.insert(this->knobs.begin() + at, knob);
+	}
+
+	// Listens to telemetry's summaries
+	void compositor(const TelemetrySummary& summary, float targetMs)
+	{
+		const bool dropped = (summary.appDroppedRecently > 0 || summary.compositorDroppedRecently > 0) && summary.appGpuP90 > targetMs;
+		this->compositorOver = dropped || summary.adaptiveGpuScale < QUALITY_ADAPTIVE_SCALE_FLOOR;
+		// Pressure is acted on once, the next summary tells whether it was enough
+		this->compositorPending = this->compositorOver;
+	}
+
+	// Once a frame, before the frame uses the knobs
+	void update(const QualityFrame& frame)
+	{
+		if (!this->on || frame.gpuMs <= 0.0f || frame.frame - this->changedFrame < QUALITY_INTERVAL)
+			return;
+		const bool over = frame.gpuMs > frame.targetMs || this->compositorPending;
+		if (over)
+		{
+			for (size_t i = 0; i < this->knobs.size(); i++)
+			{
+				QualityKnob& knob = this->knobs[i];
+				if (!knob.lowerable() || knob.lowerSavesMs(frame) < QUALITY_MIN_STEP_MS)
+					continue;
+				knob.lower(frame);
+				this->changed(knob, frame, "lowered");
+				this->compositorPending = false;
+				return;
+			}
+			return;
+		}
+		if (this->compositorOver || frame.gpuMs >= frame.targetMs * QUALITY_RAISE_FRACTION)
+			return;
+		for (size_t i = this->knobs.size(); i-- > 0;)
+		{
+			QualityKnob& knob = this->knobs[i];
+			if (!knob.lowered())
+				continue;
+			// The last one down comes back first; until it may, nothing before it does either
+			if (frame.frame - knob.changedFrame < knob.raiseInterval || frame.gpuMs + knob.raiseCostsMs(frame) > frame.targetMs)
+				return;
+			knob.raise(frame);
+			this->changed(knob, frame, "raised");
+			return;
+		}
+	}
+
+	// Steps taken so far
+	uint32_t steps() const { return this->stepCount; }
+
+private:
+	vector<QualityKnob> knobs;
+	bool on = true;
+	bool compositorOver = false;
+	bool compositorPending = false;
+	uint64_t changedFrame = 0;
+	uint32_t stepCount = 0;
+
+	void changed(QualityKnob& knob, const QualityFrame& frame, const char* how)
+	{
+		knob.changedFrame = this->changedFrame = frame.frame;
+		this->stepCount++;
+		printf("Quality: %s %s to %g, GPU %.2f ms against %.2f\r\n", knob.name, how, knob.value(), frame.gpuMs, frame.targetMs);
+	}
+};
+
+static QualityGovernor _qualityGovernor;
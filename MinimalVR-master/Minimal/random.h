@@ -0,0 +1,172 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <emmintrin.h>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+#include "jobs.h"
+
+// Seeded random numbers for the simulation, the scene and the benchmarks, in place of rand(): rand() shares one
+// unseeded state between every thread, and a float from it costs a division.
+//
+// Everything that draws numbers of its own gets a stream: a generator seeded from a seed and the stream's number, so
+// that two streams of one seed never overlap in practice and a replay with the trace's seed draws the same on each.
+// Work split across threads keeps determinism by keying streams on the work (a session, a chunk), not on whichever
+// thread ran it; _threadRandom() is there for whatever doesn't need to replay the same.
+//
+// The generator is xoshiro128**, 16 bytes of state. Floats take the top 24 bits straight into the mantissa range.
+// RandomFill makes four lanes of xoshiro128+ at once in SSE2, for filling arrays of uniforms.
+
+// Streams of the game, one per part that draws its own
+#define RANDOM_STREAM_MOLECULES 1
+#define RANDOM_STREAM_LOSS_FIELD 2
+#define RANDOM_STREAM_BENCHMARK 3
+// Threads' streams start here, a worker's is this plus its index
+#define RANDOM_STREAM_THREADS 0x10000
+
+// splitmix64, what turns a seed into generator state without the state ever being all zero
+static inline uint64_t _splitMix64(uint64_t& x)
+{
+	uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+static inline uint32_t _rotl32(uint32_t x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+class Random
+{
+public:
+	Random() { this->seed(0, 0); }
+	Random(uint64_t seed, uint64_t stream) { this->seed(seed, stream); }
+
+	void seed(uint64_t seed, uint64_t stream)
+	{
+		uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ull);
+		const uint64_t a = _splitMix64(x);
+		const uint64_t b = _splitMix64(x);
+		this->s[0] = (uint32_t)a;
+		this->s[1] = (uint32_t)(a >> 32);
+		this->s[2] = (uint32_t)b;
+		this->s[3] = (uint32_t)(b >> 32);
+	}
+
+	uint32_t next()
+	{
+		const uint32_t result = _rotl32(this->s[1] * 5, 7) * 9;
+		const uint32_t t = this->s[1] << 9;
+		this->s[2] ^= this->s[0];
+		this->s[3] ^= this->s[1];
+		this->s[1] ^= this->s[2];
+		this->s[0] ^= this->s[3];
+		this->s[2] ^= t;
+		this->s[3] = _rotl32(this->s[3], 11);
+		return result;
+	}
+
+	// [0, 1)
+	float uniform() { return (this->next() >> 8) * (1.0f / 16777216.0f); }
+	// [low, high)
+	float uniform(float low, float high) { return low + (high - low) * this->uniform(); }
+	glm::vec3 uniform(const glm::vec3& low, const glm::vec3& high)
+	{
+		const float x = this->uniform();
+		const float y = this->uniform();
+		const float z = this->uniform();
+		return low + (high - low) * glm::vec3(x, y, z);
+	}
+	// [0, n), without the bias of next() % n
+	uint32_t below(uint32_t n) { return (uint32_t)(((uint64_t)this->next() * n) >> 32); }
+	// -1 or 1
+	float sign() { return (this->next() & 0x80000000u) ? -1.0f : 1.0f; }
+
+private:
+	uint32_t s[4];
+};
+
+// Four xoshiro128+ generators side by side, filling arrays of uniforms four at a time
+class RandomFill
+{
+public:
+	RandomFill(uint64_t seed, uint64_t stream)
+	{
+		uint32_t lanes[4][4];
+		for (int lane = 0; lane < 4; lane++)
+		{
+			Random random(seed, stream * 4 + lane);
+			for (int i = 0; i < 4; i++)
+				lanes[i][lane] = random.next();
+		}
+		for (int i = 0; i < 4; i++)
+			this->s[i] = _mm_loadu_si128((const __m128i*)lanes[i]);
+	}
+
+	// count uniforms in [low, high) into out
+	void fill(float* out, size_t count, float low, float high)
+	{
+		const __m128 vlow = _mm_set1_ps(low);
+		const __m128 scale = _mm_set1_ps((high - low) * (1.0f / 16777216.0f));
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps(out + i, _mm_add_ps(vlow, _mm_mul_ps(this->next(), scale)));
+		if (i < count)
+		{
+			float tail[4];
+			_mm_storeu_ps(tail, _mm_add_ps(vlow, _mm_mul_ps(this->next(), scale)));
+			for (size_t j = 0; i < count; i++, j++)
+				out[i] = tail[j];
+		}
+	}
+
+private:
+	// Four 24 bit integers as floats, one per lane
+	__m128 next()
+	{
+		const __m128i result = _mm_add_epi32(this->s[0], this->s[3]);
+		const __m128i t = _mm_slli_epi32(this->s[1], 9);
+		this->s[2] = _mm_xor_si128(this->s[2], this->s[0]);
+		this->s[3] = _mm_xor_si128(this->s[3], this->s[1]);
+		this->s[1] = _mm_xor_si128(this->s[1], this->s[2]);
+		this->s[0] = _mm_xor_si128(this->s[0], this->s[3]);
+		this->s[2] = _mm_xor_si128(this->s[2], t);
+		this->s[3] = _mm_or_si128(_mm_slli_epi32(this->s[3], 11), _mm_srli_epi32(this->s[3], 21));
+		return _mm_cvtepi32_ps(_mm_srli_epi32(result, 8));
+	}
+
+	__m128i s[4];
+};
+
+// The seed _threadRandom() streams come from, and how many times it has been set
+static std::atomic<uint64_t> _randomSeed{ 0 };
+static std::atomic<uint32_t> _randomSeedGeneration{ 0 };
+
+// Seeds every thread's _threadRandom(), from the next draw on. A replay sets the trace's seed.
+static void _seedRandom(uint64_t seed)
+{
+	_randomSeed.store(seed);
+	_randomSeedGeneration.fetch_add(1);
+}
+
+// The calling thread's own generator, seeded by _seedRandom() and the thread: a worker's stream is its index, so
+// a worker draws the same whichever run, other threads take theirs in the order they first draw
+static Random& _threadRandom()
+{
+	static std::atomic<uint32_t> others{ 0 };
+	static thread_local Random random;
+	static thread_local uint32_t generation = UINT32_MAX;
+	static thread_local uint32_t stream = _jobWorkerIndex() >= 0 ? (uint32_t)_jobWorkerIndex() : 0x8000u + others.fetch_add(1);
+	const uint32_t current = _randomSeedGeneration.load(std::memory_order_relaxed);
+	if (generation != current)
+	{
+		generation = current;
+		random.seed(_randomSeed.load(), RANDOM_STREAM_THREADS + stream);
+	}
+	return random;
+}
@@ -0,0 +1,267 @@
+#pragma once
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "glstate.h"
+#include "gpumemory.h"
+#include "gldebug.h"
+#include "glcapture.h"
+
+// Reflection through plane, whose xyz is the unit normal and w the offset (dot(xyz, p) + w = 0 on the plane).
+// glm takes the columns, the translation is the last one.
+static glm::mat4 _computeReflectionMatrix(const glm::vec4& plane)
+{
+	return glm::mat4(
+		1.0f - 2.0f * plane.x * plane.x,
+		-2.0f * plane.x * plane.y,
+		-2.0f * plane.x * plane.z,
+		0.0f,
+
+		-2.0f * plane.y * plane.x,
+		1.0f - 2.0f * plane.y * plane.y,
+		-2.0f * plane.y * plane.z,
+		0.0f,
+
+		-2.0f * plane.z * plane.x,
+		-2.0f * plane.z * plane.y,
+		1.0f - 2.0f * plane.z * plane.z,
+		0.0f,
+
+		-2.0f * plane.w * plane.x,
+		-2.0f * plane.w * plane.y,
+		-2.0f * plane.w * plane.z,
+		1.0f
+	);
+}
+
+// The camera a reflection pass renders with: the viewer's own position looking straight at the mirror, the world
+// reflected through it, and an off axis frustum through the mirror's edges. The tangents, of the frustum's sides
+// against that forward, are in ovrFovPort order.
+struct ReflectionCamera
+{
+	glm::mat4 view;
+	glm::vec3 viewPos;
+	float upTan, downTan, leftTan, rightTan;
+	// Distance to the mirror, the near plane, so nothing behind the mirror gets into the reflection
+	float nearPlane;
+};
+
+// A rectangular planar mirror. The reflection is rendered once a frame from the middle of the eyes into a texture,
+// at a resolution of its own, and both eyes then draw the rectangle textured with it. The eyes lose their parallax
+// in the reflection, which at arm's length isn't noticeable, for one extra pass instead of one per eye.
+class PlanarMirror
+{
+public:
+	PlanarMirror() {}
+	~PlanarMirror()
+	{
+		this->release();
+		if (this->vertexArray)
+			glDeleteVertexArrays(1, &this->vertexArray);
+		if (this->vertexBuffer)
+			glDeleteBuffers(1, &this->vertexBuffer);
+	}
+
+	PlanarMirror(const PlanarMirror&) = delete;
+	PlanarMirror& operator=(const PlanarMirror&) = delete;
+
+	// program must have worldViewProj and reflection uniforms and take position/texcoord at locations 0/1.
+	// The mirror faces along normal, up is its vertical edge and size its width and height in meters.
+	// resolution is the texture's larger side in pixels.
+	void init(GLuint program, const glm::vec3& centre, const glm::vec3& normal, const glm::vec3& up, const glm::vec2& size,
+		GLsizei resolution, GLenum depthFormat)
+	{
+		this->program = program;
+		this->worldViewProjLocation = glGetUniformLocation(program, "worldViewProj");
+		this->reflectionLocation = glGetUniformLocation(program, "reflection");
+		this->centre = centre;
+		this->normal = glm::normalize(normal);
+		this->right = glm::normalize(glm::cross(up, this->normal));
+		this->up = glm::cross(this->normal, this->right);
+		this->halfSize = size * 0.5f;
+
+		// Corners as a strip, with the texture coordinates the reflection pass lays its image out in
+		const glm::vec3 r = this->right * this->halfSize.x, u = this->up * this->halfSize.y;
+		const glm::vec3 corners[4] = { centre - r - u, centre + r - u, centre - r + u, centre + r + u };
+		float vertices[4 * 5];
+		for (int i = 0; i < 4; i++)
+		{
+			vertices[i * 5 + 0] = corners[i].x;
+			vertices[i * 5 + 1] = corners[i].y;
+			vertices[i * 5 + 2] = corners[i].z;
+			vertices[i * 5 + 3] = (float)(i & 1);
+			vertices[i * 5 + 4] = (float)(i >> 1);
+		}
+		glGenVertexArrays(1, &this->vertexArray);
+		glGenBuffers(1, &this->vertexBuffer);
+		_glState.bindVertexArray(this->vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), 0);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+		glEnableVertexAttribArray(1);
+		_glState.bindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		this->resize(resolution, depthFormat);
+	}
+
+	// Reallocates the texture, its larger side resolution pixels and the other following the mirror's shape
+	void resize(GLsizei resolution, GLenum depthFormat)
+	{
+		this->release();
+		if (resolution <= 0)
+			return;
+		const float aspect = this->halfSize.x / this->halfSize.y;
+		this->width = aspect >= 1.0f ? resolution : std::max((GLsizei)(resolution * aspect), (GLsizei)1);
+		this->height = aspect >= 1.0f ? std::max((GLsizei)(resolution / aspect), (GLsizei)1) : resolution;
+
+		// Stored as it is written, like the eye textures, so sampling it needs no conversion
+		glGenTextures(1, &this->colorTexture);
+		glBindTexture(GL_TEXTURE_2D, this->colorTexture);
+		_glLabel(GL_TEXTURE, this->colorTexture, "reflection color");
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, this->width, this->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenRenderbuffers(1, &this->depthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->depthBuffer);
+		_glLabel(GL_RENDERBUFFER, this->depthBuffer, "reflection depth");
+		glRenderbufferStorage(GL_RENDERBUFFER, depthFormat, this->width, this->height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &this->framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->framebuffer);
+		_glLabel(GL_FRAMEBUFFER, this->framebuffer, "reflection target");
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->colorTexture, 0);
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depthBuffer);
+		if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cout << "ERROR::PLANAR_MIRROR::FRAMEBUFFER_INCOMPLETE" << std::endl;
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+			this->release();
+			return;
+		}
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		this->memory.reset(GpuMemoryCategory::EyeTargets,
+			_gpuImageBytes(GL_RGBA8, this->width, this->height) + _gpuImageBytes(depthFormat, this->width, this->height));
+	}
+
+	bool enabled() const { return this->framebuffer != 0; }
+
+	// The plane the mirror lies in, positive on the side it faces
+	glm::vec4 plane() const
+	{
+		return glm::vec4(this->normal, -glm::dot(this->normal, this->centre));
+	}
+
+	// Whether a sphere can show up in the reflection at all, i.e. isn't entirely behind the mirror
+	bool reflects(const glm::vec3& position, float radius) const
+	{
+		return glm::dot(this->normal, position - this->centre) + radius >= 0.0f;
+	}
+
+	// False, with nothing to render this frame, when the viewer is behind the mirror
+	bool camera(const glm::vec3& viewer, ReflectionCamera* camera) const
+	{
+		const float distance = glm::dot(this->normal, viewer - this->centre);
+		if (distance <= 0.0f)
+			return false;
+		const glm::mat4 reflection = _computeReflectionMatrix(this->plane());
+		camera->view = glm::lookAt(viewer, viewer - this->normal, this->up) * reflection;
+		const glm::vec4 reflected = reflection * glm::vec4(viewer, 1.0f);
+		camera->viewPos = glm::vec3(reflected.x, reflected.y, reflected.z);
+		// The rectangle's edges relative to the point of the plane straight ahead of the viewer
+		const glm::vec3 offset = this->centre - viewer;
+		const float x = glm::dot(offset, this->right), y = glm::dot(offset, this->up);
+		camera->leftTan = (this->halfSize.x - x) / distance;
+		camera->rightTan = (this->halfSize.x + x) / distance;
+		camera->downTan = (this->halfSize.y - y) / distance;
+		camera->upTan = (this->halfSize.y + y) / distance;
+		camera->nearPlane = distance;
+		return true;
+	}
+
+	// Binds and clears the texture's framebuffer, the reflection is drawn after this with a camera() and
+	// front faces flipped, the reflection turning the winding around
+	void begin()
+	{
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->framebuffer);
+		glViewport(0, 0, this->width, this->height);
+		_glState.depthMask(GL_TRUE);
+		_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		_glCapture.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		_glState.frontFace(GL_CW);
+	}
+
+	void end()
+	{
+		_glState.frontFace(GL_CCW);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		this->rendered = true;
+	}
+
+	// The mirror into the bound target, textured with this frame's reflection if there is one
+	void draw(const glm::mat4& worldViewProj)
+	{
+		if (!this->rendered)
+			return;
+		_glState.depthMask(GL_TRUE);
+		_glState.depthFunc(GL_LESS);
+		_glState.useProgram(this->program);
+		glUniformMatrix4fv(this->worldViewProjLocation, 1, GL_FALSE, glm::value_ptr(worldViewProj));
+		glUniform1i(this->reflectionLocation, 0);
+		_glState.bindTexture(0, this->colorTexture);
+		_glState.bindVertexArray(this->vertexArray);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		_glCapture.drawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		_renderStats.draw(GL_TRIANGLE_STRIP, 4);
+		_glState.bindVertexArray(0);
+	}
+
+	// A frame the viewer was behind the mirror leaves nothing to draw
+	void beginFrame() { this->rendered = false; }
+
+private:
+	void release()
+	{
+		if (this->framebuffer)
+			glDeleteFramebuffers(1, &this->framebuffer);
+		if (this->colorTexture)
+			glDeleteTextures(1, &this->colorTexture);
+		if (this->depthBuffer)
+			glDeleteRenderbuffers(1, &this->depthBuffer);
+		this->framebuffer = this->colorTexture = this->depthBuffer = 0;
+		this->memory.reset();
+		this->rendered = false;
+	}
+
+	GLuint program = 0;
+	GLint worldViewProjLocation = -1;
+	GLint reflectionLocation = -1;
+	GLuint vertexArray = 0;
+	GLuint vertexBuffer = 0;
+	GLuint framebuffer = 0;
+	GLuint colorTexture = 0;
+	GLuint depthBuffer = 0;
+	GpuAllocation memory;
+	GLsizei width = 0;
+	GLsizei height = 0;
+	bool rendered = false;
+
+	glm::vec3 centre;
+	glm::vec3 normal;
+	glm::vec3 right;
+	glm::vec3 up;
+	glm::vec2 halfSize;
+};
@@ -0,0 +1,998 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+using namespace std;
+// Windows Includes
+#include <winsock2.h>
+#include <ws2tcpip.h>
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include "jobs.h"
+#include "timing.h"
+#include "gpumemory.h"
+
+#define REMOTE_DEFAULT_PORT 40310
+// Stream the rate control aims at, in megabits a second, --remote-bitrate changes it
+#define REMOTE_DEFAULT_MBPS 100
+// Square tiles the eyes are coded in, in pixels. The depth goes along at one sample a tile.
+#define REMOTE_TILE 16
+// Bands of tile rows each eye is cut into. A band is coded on a job of its own and goes out as soon as it is; it
+// decodes on its own, given the frame it is predicted from.
+#define REMOTE_SLICES_PER_EYE 4
+#define REMOTE_SLICES (REMOTE_SLICES_PER_EYE * 2)
+// Payload of one datagram, the slice's bytes are cut into these. With the IP, UDP and fragment headers it stays under
+// a 1500 byte Ethernet MTU.
+#define REMOTE_FRAGMENT_BYTES 1400
+// Data fragments one parity fragment covers, any one of them lost is rebuilt from the rest and the parity
+#define REMOTE_FEC_GROUP 8
+// The quantizer's range. 1 is lossless; the rate control moves the fovea's between these, the periphery's grows from it.
+#define REMOTE_MIN_QUANT 1.0f
+#define REMOTE_MAX_QUANT 48.0f
+// Foveated bitrate: tiles within this tangent of the lens centre are coded at the frame's quantizer, beyond it the
+// quantizer grows by the slope per unit of tangent
+#define REMOTE_FOVEA_TAN 0.4f
+#define REMOTE_FOVEATION_SLOPE 3.0f
+// A headset not heard from for this long has gone, the session then reads as not visible
+#define REMOTE_HEADSET_TIMEOUT 2.0
+// Motion to photon the prediction assumes until the headset has measured its own, in seconds
+#define REMOTE_DEFAULT_LATENCY 0.040f
+// Longest the GL thread waits for a frame's readback, in nanoseconds; a frame taking longer isn't sent
+#define REMOTE_READBACK_TIMEOUT 50000000ull
+// How often the stream's rate and quantizer are printed
+#define REMOTE_REPORT_SECONDS 10.0
+#define REMOTE_POSE_MAGIC 0x5052 // "RP"
+#define REMOTE_FRAGMENT_MAGIC 0x5352 // "RS"
+// RemoteFragmentHeader::flags
+#define REMOTE_FRAGMENT_PARITY 1
+// RemotePosePacket::flags: the headset lost a slice it couldn't rebuild, and asks for a frame predicted from nothing
+#define REMOTE_POSE_KEY_FRAME 1
+// RemoteSliceInfo::flags
+#define REMOTE_SLICE_KEY 1
+#define REMOTE_SLICE_REVERSED_DEPTH 2
+#define REMOTE_SLICE_LINEAR 4
+#define REMOTE_SLICE_DEPTH 8
+
+// A tracked pose as it goes over the wire, in the headset's tracking space, when the headset sampled it
+struct RemotePose
+{
+	float orientation[4];
+	float position[3];
+	float angularVelocity[3];
+	float linearVelocity[3];
+};
+static_assert(sizeof(RemotePose) == 52, "RemotePose is sent as it is");
+
+// What the headset sends every frame of its own
+struct RemotePosePacket
+{
+	uint16_t magic;
+	// REMOTE_POSE_KEY_FRAME
+	uint16_t flags;
+	// Counts up with every packet, one arriving after a newer is dropped
+	uint32_t sequence;
+	// The newest frame the headset has decoded all of
+	uint32_t decoded;
+	// Seconds from sampling the pose a frame was rendered with, RemoteSliceInfo::poseSequence, to showing the frame,
+	// as the headset last measured it
+	float latency;
+	RemotePose head;
+	RemotePose hands[2];
+	// ovrInputState's, the buttons and touches as its bits
+	uint32_t buttons;
+	uint32_t touches;
+	float indexTrigger[2];
+	float handTrigger[2];
+	float thumbstick[2][2];
+	// The headset's optics: each eye's tangents up, down, left and right, the distance between the eyes, the panel
+	// per eye and its refresh rate. The first headset's are the ones the app renders for.
+	float fov[2][4];
+	float ipd;
+	float refreshRate;
+	uint16_t eyeWidth;
+	uint16_t eyeHeight;
+};
+static_assert(sizeof(RemotePosePacket) == 256, "RemotePosePacket is sent as it is");
+
+// Ahead of every datagram of a slice
+struct RemoteFragmentHeader
+{
+	uint16_t magic;
+	uint8_t slice;
+	// REMOTE_FRAGMENT_PARITY
+	uint8_t flags;
+	uint32_t frame;
+	// Bytes of the whole slice, its data fragments are REMOTE_FRAGMENT_BYTES each but the last
+	uint32_t bytes;
+	// Which data fragment of the slice, or for a parity fragment which group
+	uint16_t index;
+	uint16_t reserved;
+};
+static_assert(sizeof(RemoteFragmentHeader) == 16, "RemoteFragmentHeader is sent as it is");
+
+// The start of every slice's bytes
+struct RemoteSliceInfo
+{
+	uint32_t frame;
+	// The frame the tiles are predicted from, frame itself for a key frame
+	uint32_t reference;
+	// RemotePosePacket::sequence of the newest pose when the frame was rendered
+	uint32_t poseSequence;
+	// REMOTE_SLICE_*
+	uint16_t flags;
+	uint16_t eye;
+	// The eye's image in pixels, and the rows of tiles in this slice, counted from the bottom
+	uint16_t width;
+	uint16_t height;
+	uint16_t firstRow;
+	uint16_t rows;
+	// Where the eye was rendered from and with which tangents, up, down, left and right, and clip planes
+	float orientation[4];
+	float position[3];
+	float fov[4];
+	float nearPlane;
+	float farPlane;
+};
+static_assert(sizeof(RemoteSliceInfo) == 76, "RemoteSliceInfo is sent as it is");
+
+// The headset the app renders for when --remote is on: a standalone one somewhere on the network, which sends its
+// poses and controllers and is sent the frames. RiftApp draws as it would for the runtime, through the _hmd calls
+// benchhmd.h routes here, and the swap chains are plain textures as for --bench.
+//
+// Poses come in as RemotePosePackets and are extrapolated by their velocities to the predicted display time, which is
+// now plus the motion to photon time the headset measures and reports back. Frames are paced at the headset's
+// refresh rate. The submitted scene layer is read back at the end of the frame with the eyes' depth, which
+// RiftApp copies out in a render graph pass of its own (see depthTexture()), at one sample per tile. The other
+// layers, the loading screen, HUD and overlays, are the local compositor's and aren't sent.
+//
+// Each eye is coded as REMOTE_SLICES_PER_EYE bands of REMOTE_TILE square tiles, each band on a job, sent as soon as
+// it is coded. A slice is its RemoteSliceInfo, then every tile bottom row first, left to right, then the depth.
+// A tile is the varint of its quantizer, 0 for a tile unchanged from the reference, and then 384 levels: the 256 Y
+// and the 64 Co and 64 Cg of YCoCg-R, chroma averaged over 2x2 and each plane row by row. A level times the
+// quantizer is the value's difference from its prediction, which is the reference frame's value at the same place,
+// or for key frames the value reconstructed to its left, below it in the first column, and 128 or 0 at the first.
+// Levels are coded as runs: the varint of the zeros before a level, then its zigzagged varint, until the count is
+// full, always ending on a run. The depth is the slice's tiles' 16 bit window depths coded the same way and losslessly.
+// The quantizer is foveated, growing away from the lens centre, and scaled by a rate control aiming at --remote-bitrate.
+//
+// The slice's bytes go out as fragments with a RemoteFragmentHeader, each REMOTE_FEC_GROUP of them followed by
+// their XOR as a parity fragment, so one lost in a group is rebuilt. A headset that loses more asks for a key frame.
+// The encoder is software, on the job threads; a hardware one would take the same readback and slices.
+class RemoteHmd
+{
+public:
+	RemoteHmd() {}
+	~RemoteHmd() { this->close(); }
+
+	RemoteHmd(const RemoteHmd&) = delete;
+	RemoteHmd& operator=(const RemoteHmd&) = delete;
+
+	bool open(uint16_t port, uint32_t mbps)
+	{
+		WSADATA data;
+		if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		{
+			printf("ERROR::REMOTE_HMD::WINSOCK_NOT_STARTED\n");
+			return false;
+		}
+		this->started = true;
+		this->socket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		unsigned long nonBlocking = 1;
+		// A frame's fragments all go out at once, the buffer holds a key frame's worth
+		int sendBuffer = 8 << 20;
+		if (this->socket == INVALID_SOCKET || ::bind(this->socket, (const sockaddr*)&address, sizeof(address)) == SOCKET_ERROR
+			|| ioctlsocket(this->socket, FIONBIO, &nonBlocking) == SOCKET_ERROR
+			|| setsockopt(this->socket, SOL_SOCKET, SO_SNDBUF, (const char*)&sendBuffer, sizeof(sendBuffer)) == SOCKET_ERROR)
+		{
+			printf("ERROR::REMOTE_HMD::SOCKET_NOT_BOUND %d\n", WSAGetLastError());
+			this->close();
+			return false;
+		}
+		this->port = port;
+		this->mbps = std::max(mbps, 1u);
+		return true;
+	}
+
+	void close()
+	{
+		_jobs.wait(this->encoded);
+		this->releaseGl();
+		if (this->socket != INVALID_SOCKET)
+			closesocket(this->socket);
+		this->socket = INVALID_SOCKET;
+		if (this->started)
+			WSACleanup();
+		this->started = false;
+	}
+
+	bool active() const { return this->socket != INVALID_SOCKET; }
+
+	// Blocks until the first headset is heard from, whose optics the app then renders for
+	void waitForHeadset()
+	{
+		printf("Remote: waiting for a headset on port %u\r\n", (unsigned)this->port);
+		while (!this->heardFrom)
+		{
+			this->receive();
+			if (!this->heardFrom)
+				_sleepFor(0.01, false);
+		}
+	}
+
+	ovrHmdDesc hmdDesc() const
+	{
+		ovrHmdDesc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.Type = ovrHmd_Other;
+		strcpy(desc.ProductName, "Remote HMD");
+		for (int eye = 0; eye < ovrEye_Count; eye++)
+		{
+			ovrFovPort& fov = desc.DefaultEyeFov[eye];
+			fov.UpTan = this->optics.fov[eye][0];
+			fov.DownTan = this->optics.fov[eye][1];
+			fov.LeftTan = this->optics.fov[eye][2];
+			fov.RightTan = this->optics.fov[eye][3];
+			desc.MaxEyeFov[eye] = fov;
+		}
+		desc.Resolution.w = this->optics.eyeWidth * 2;
+		desc.Resolution.h = this->optics.eyeHeight;
+		desc.DisplayRefreshRate = this->refreshRate();
+		return desc;
+	}
+
+	ovrEyeRenderDesc renderDesc(ovrEyeType eye, const ovrFovPort& fov) const
+	{
+		ovrEyeRenderDesc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.Eye = eye;
+		desc.Fov = fov;
+		desc.DistortedViewport.Pos.x = eye == ovrEye_Left ? 0 : this->optics.eyeWidth;
+		desc.DistortedViewport.Size.w = this->optics.eyeWidth;
+		desc.DistortedViewport.Size.h = this->optics.eyeHeight;
+		desc.PixelsPerTanAngleAtCenter.x = this->pixelsPerTan(eye).x;
+		desc.PixelsPerTanAngleAtCenter.y = this->pixelsPerTan(eye).y;
+		desc.HmdToEyeOffset.x = (eye == ovrEye_Left ? -0.5f : 0.5f) * this->optics.ipd;
+		return desc;
+	}
+
+	// The panel's pixels at the centre, as the runtime sizes an eye's texture
+	ovrSizei fovTextureSize(ovrEyeType eye, const ovrFovPort& fov, float density) const
+	{
+		ovrSizei size;
+		size.w = (int)ceilf((fov.LeftTan + fov.RightTan) * this->pixelsPerTan(eye).x * density);
+		size.h = (int)ceilf((fov.UpTan + fov.DownTan) * this->pixelsPerTan(eye).y * density);
+		return size;
+	}
+
+	float refreshRate() const
+	{
+		return this->optics.refreshRate > 0.0f ? this->optics.refreshRate : 72.0f;
+	}
+
+	double seconds() const { return _sessionSeconds(); }
+
+	// When a frame begun now reaches the headset's panel
+	double displayTime() const { return this->seconds() + this->latency; }
+
+	// Holds the frame back to the headset's refresh rate, what the compositor does for a local one
+	void waitToBegin()
+	{
+		const double period = 1.0 / this->refreshRate();
+		_sleepUntil(this->next);
+		this->next.ticks += _timeSecondsToTicks(period);
+		if (this->next.passed())
+			this->next = Deadline::in(period);
+	}
+
+	// The newest poses carried on to displayTime by their velocities
+	ovrTrackingState tracking(double displayTime)
+	{
+		this->receive();
+		this->renderedSequence = this->pose.sequence;
+		const double ahead = glm::clamp(displayTime - this->heard, 0.0, 0.1);
+		ovrTrackingState state;
+		memset(&state, 0, sizeof(state));
+		state.HeadPose = predict(this->pose.head, ahead, displayTime);
+		state.StatusFlags = this->connected() ? ovrStatus_OrientationTracked | ovrStatus_PositionTracked : 0;
+		for (int hand = 0; hand < ovrHand_Count; hand++)
+		{
+			state.HandPoses[hand] = predict(this->pose.hands[hand], ahead, displayTime);
+			state.HandStatusFlags[hand] = state.StatusFlags;
+		}
+		state.CalibratedOrigin.Orientation.w = 1.0f;
+		return state;
+	}
+
+	ovrInputState input() const
+	{
+		ovrInputState state;
+		memset(&state, 0, sizeof(state));
+		state.TimeInSeconds = this->heard;
+		state.ControllerType = ovrControllerType_Touch;
+		state.Buttons = this->pose.buttons;
+		state.Touches = this->pose.touches;
+		for (int hand = 0; hand < ovrHand_Count; hand++)
+		{
+			state.IndexTrigger[hand] = state.IndexTriggerNoDeadzone[hand] = state.IndexTriggerRaw[hand] = this->pose.indexTrigger[hand];
+			state.HandTrigger[hand] = state.HandTriggerNoDeadzone[hand] = state.HandTriggerRaw[hand] = this->pose.handTrigger[hand];
+			state.Thumbstick[hand].x = state.ThumbstickNoDeadzone[hand].x = state.ThumbstickRaw[hand].x = this->pose.thumbstick[hand][0];
+			state.Thumbstick[hand].y = state.ThumbstickNoDeadzone[hand].y = state.ThumbstickRaw[hand].y = this->pose.thumbstick[hand][1];
+		}
+		return state;
+	}
+
+	// Worn and visible while the headset keeps sending, which idles the app while it doesn't, see SessionMonitor
+	ovrSessionStatus status()
+	{
+		this->receive();
+		ovrSessionStatus status;
+		memset(&status, 0, sizeof(status));
+		const ovrBool connected = this->connected() ? ovrTrue : ovrFalse;
+		status.IsVisible = connected;
+		status.HmdPresent = ovrTrue;
+		status.HmdMounted = connected;
+		status.HasInputFocus = connected;
+		return status;
+	}
+
+	// How the depth sent along reads back to distances, and whether the colour is linear rather than sRGB encoded
+	void setProjection(float nearPlane, float farPlane, bool reversedDepth, bool linear)
+	{
+		this->nearPlane = nearPlane;
+		this->farPlane = farPlane;
+		this->reversedDepth = reversedDepth;
+		this->linear = linear;
+	}
+
+	// The texture of size and the eye depth's format that RiftApp's remote depth pass copies the eyes' depth into,
+	// made when the size or format changes. depthDrawn() then says where each eye's is.
+	GLuint depthTexture(const glm::uvec2& size, GLenum format)
+	{
+		if (this->depth && this->depthSize == size && this->depthFormat == format)
+			return this->depth;
+		this->releaseDepth();
+		this->depthSize = size;
+		this->depthFormat = format;
+		// Sized for the most tiles the two eyes of the target can have between them
+		this->coarseSize = glm::uvec2(size.x / REMOTE_TILE + 2, size.y / REMOTE_TILE + 1);
+		// Made mid frame, the unit's binding goes back to what _glState knows it as
+		GLint bound = 0;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+		GLuint textures[2];
+		glGenTextures(2, textures);
+		this->depth = textures[0];
+		this->coarse = textures[1];
+		glBindTexture(GL_TEXTURE_2D, this->depth);
+		glTexStorage2D(GL_TEXTURE_2D, 1, format, size.x, size.y);
+		glBindTexture(GL_TEXTURE_2D, this->coarse);
+		glTexStorage2D(GL_TEXTURE_2D, 1, format, this->coarseSize.x, this->coarseSize.y);
+		glBindTexture(GL_TEXTURE_2D, bound);
+		_gpuMemory.charge(GpuMemoryCategory::EyeTargets, _gpuImageBytes(format, size.x, size.y) +
+			_gpuImageBytes(format, this->coarseSize.x, this->coarseSize.y));
+		GLuint framebuffers[2];
+		glGenFramebuffers(2, framebuffers);
+		this->depthFramebuffer = framebuffers[0];
+		this->coarseFramebuffer = framebuffers[1];
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, this->depthFramebuffer);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->depth, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, this->coarseFramebuffer);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->coarse, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		return this->depth;
+	}
+
+	// The eyes' viewports in depthTexture() this frame, which may be smaller than the colour's when it is upscaled
+	void depthDrawn(const ovrRecti viewports[ovrEye_Count])
+	{
+		this->depthViewports[ovrEye_Left] = viewports[ovrEye_Left];
+		this->depthViewports[ovrEye_Right] = viewports[ovrEye_Right];
+		this->depthFresh = true;
+	}
+
+	// Sends the scene layer, its eyes in texture, to the headset. Waits for the GPU to finish the frame and the last
+	// frame's slices to be out, then codes and sends this one's on the job threads.
+	void submit(GLuint texture, const ovrLayerEyeFov& layer)
+	{
+		this->receive();
+		_jobs.wait(this->encoded);
+		if (this->mapped)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pack);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			this->mapped = nullptr;
+		}
+		this->control();
+		this->report();
+		const bool withDepth = this->depthFresh;
+		this->depthFresh = false;
+		if (!this->connected())
+			return;
+
+		// Where each eye's pixels and depth are in the pack buffer
+		size_t bytes = 0;
+		bool resized = false;
+		for (int i = 0; i < ovrEye_Count; i++)
+		{
+			Eye& eye = this->eyes[i];
+			const ovrSizei& size = layer.Viewport[i].Size;
+			resized = resized || eye.width != size.w || eye.height != size.h;
+			eye.width = size.w;
+			eye.height = size.h;
+			eye.tilesX = (size.w + REMOTE_TILE - 1) / REMOTE_TILE;
+			eye.tilesY = (size.h + REMOTE_TILE - 1) / REMOTE_TILE;
+			eye.pose = layer.RenderPose[i];
+			eye.fov = layer.Fov[i];
+			eye.pixelOffset = bytes;
+			bytes += (size_t)size.w * size.h * 4;
+		}
+		for (int i = 0; i < ovrEye_Count; i++)
+		{
+			this->eyes[i].depthOffset = bytes;
+			bytes += (size_t)this->eyes[i].tilesX * this->eyes[i].tilesY * sizeof(uint16_t);
+		}
+		if (resized)
+		{
+			// The reference is of another size, the next frame can't be predicted from it
+			for (int i = 0; i < ovrEye_Count; i++)
+			{
+				Eye& eye = this->eyes[i];
+				const size_t tiles = (size_t)eye.tilesX * eye.tilesY;
+				eye.y.assign(tiles * REMOTE_TILE * REMOTE_TILE, 0);
+				eye.co.assign(tiles * REMOTE_TILE * REMOTE_TILE / 4, 0);
+				eye.cg.assign(tiles * REMOTE_TILE * REMOTE_TILE / 4, 0);
+				eye.depth.assign(tiles, 0);
+			}
+			this->keyDue = true;
+		}
+		if (!this->readBack(texture, layer, bytes, withDepth))
+			return;
+
+		this->frame++;
+		this->frameKey = this->keyDue;
+		this->frameDepth = withDepth;
+		this->reference = this->frameKey ? this->frame : this->frame - 1;
+		this->keyDue = false;
+		this->frameSequence = this->renderedSequence;
+		this->frameTarget = this->headset;
+		this->frameBytes = 0;
+		this->frameQuant = this->quant;
+		if (this->frameKey)
+			this->keyFrames++;
+		for (int slice = 0; slice < REMOTE_SLICES; slice++)
+		{
+			_jobs.run([this, slice]() { this->encodeSlice(slice); }, &this->encoded);
+		}
+	}
+
+private:
+	struct Eye
+	{
+		uint16_t width = 0;
+		uint16_t height = 0;
+		uint32_t tilesX = 0;
+		uint32_t tilesY = 0;
+		ovrPosef pose;
+		ovrFovPort fov;
+		size_t pixelOffset = 0;
+		size_t depthOffset = 0;
+		// The reference the headset predicts the next frame from, as reconstructed: Y a pixel, Co and Cg a 2x2,
+		// and the depth a tile, each plane a whole number of tiles wide
+		vector<int16_t> y;
+		vector<int16_t> co;
+		vector<int16_t> cg;
+		vector<uint16_t> depth;
+	};
+
+	// Levels, as zero runs and the varints of the zigzagged levels between them
+	struct RunWriter
+	{
+		vector<uint8_t>& out;
+		uint32_t run;
+
+		explicit RunWriter(vector<uint8_t>& out) : out(out), run(0) {}
+
+		void level(int32_t value)
+		{
+			if (!value)
+			{
+				this->run++;
+				return;
+			}
+			putVarint(this->out, this->run);
+			putVarint(this->out, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+			this->run = 0;
+		}
+
+		void finish()
+		{
+			putVarint(this->out, this->run);
+			this->run = 0;
+		}
+	};
+
+	static void putVarint(vector<uint8_t>& out, uint32_t value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back((uint8_t)(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back((uint8_t)value);
+	}
+
+	static int32_t quantize(int32_t difference, int32_t q)
+	{
+		return difference >= 0 ? (difference + q / 2) / q : -((-difference + q / 2) / q);
+	}
+
+	// Levels of one side by side plane of a tile against its prediction, see the class comment. recon, stride apart,
+	// holds the reference and is left holding what the headset reconstructs. True if any level isn't 0.
+	static bool codePlane(const int32_t* values, int side, int32_t* levels, int16_t* recon, size_t stride, int32_t q, bool key,
+		int32_t origin, int32_t low, int32_t high)
+	{
+		bool any = false;
+		for (int row = 0; row < side; row++)
+		{
+			int16_t* line = recon + row * stride;
+			for (int col = 0; col < side; col++)
+			{
+				int32_t predicted = line[col];
+				if (key)
+					predicted = col > 0 ? line[col - 1] : row > 0 ? recon[(row - 1) * stride] : origin;
+				const int32_t level = quantize(values[row * side + col] - predicted, q);
+				levels[row * side + col] = level;
+				any = any || level != 0;
+				line[col] = (int16_t)glm::clamp(predicted + level * q, low, high);
+			}
+		}
+		return any;
+	}
+
+	static ovrPoseStatef predict(const RemotePose& pose, double ahead, double displayTime)
+	{
+		const glm::vec3 angular(pose.angularVelocity[0], pose.angularVelocity[1], pose.angularVelocity[2]);
+		const glm::vec3 linear(pose.linearVelocity[0], pose.linearVelocity[1], pose.linearVelocity[2]);
+		glm::quat orientation(pose.orientation[3], pose.orientation[0], pose.orientation[1], pose.orientation[2]);
+		const float speed = glm::length(angular);
+		// Angular velocity is in tracking space, so the turn goes on the left
+		if (speed > 1e-6f)
+			orientation = glm::normalize(glm::angleAxis(speed * (float)ahead, angular / speed) * orientation);
+		const glm::vec3 position = glm::vec3(pose.position[0], pose.position[1], pose.position[2]) + linear * (float)ahead;
+		ovrPoseStatef state;
+		memset(&state, 0, sizeof(state));
+		state.ThePose.Orientation.x = orientation.x;
+		state.ThePose.Orientation.y = orientation.y;
+		state.ThePose.Orientation.z = orientation.z;
+		state.ThePose.Orientation.w = orientation.w;
+		state.ThePose.Position.x = position.x;
+		state.ThePose.Position.y = position.y;
+		state.ThePose.Position.z = position.z;
+		state.AngularVelocity.x = angular.x;
+		state.AngularVelocity.y = angular.y;
+		state.AngularVelocity.z = angular.z;
+		state.LinearVelocity.x = linear.x;
+		state.LinearVelocity.y = linear.y;
+		state.LinearVelocity.z = linear.z;
+		state.TimeInSeconds = displayTime;
+		return state;
+	}
+
+	glm::vec2 pixelsPerTan(int eye) const
+	{
+		const float* fov = this->optics.fov[eye];
+		return glm::vec2(this->optics.eyeWidth / std::max(fov[2] + fov[3], 1e-3f), this->optics.eyeHeight / std::max(fov[0] + fov[1], 1e-3f));
+	}
+
+	bool connected() const
+	{
+		return this->heardFrom && this->seconds() - this->heard < REMOTE_HEADSET_TIMEOUT;
+	}
+
+	// Drains the socket into the newest pose. Another headset is only taken on once the one before has gone.
+	void receive()
+	{
+		for (;;)
+		{
+			sockaddr_in from;
+			int fromLength = sizeof(from);
+			RemotePosePacket packet;
+			const int length = recvfrom(this->socket, (char*)&packet, sizeof(packet), 0, (sockaddr*)&from, &fromLength);
+			if (length == SOCKET_ERROR)
+			{
+				// WSAECONNRESET is an ICMP from a headset that has gone, the socket keeps working
+				if (WSAGetLastError() == WSAECONNRESET)
+					continue;
+				break;
+			}
+			if (length != (int)sizeof(packet) || packet.magic != REMOTE_POSE_MAGIC)
+				continue;
+			const bool same = this->heardFrom && from.sin_addr.s_addr == this->headset.sin_addr.s_addr && from.sin_port == this->headset.sin_port;
+			if (!same && this->connected())
+				continue;
+			if (same && (int32_t)(packet.sequence - this->pose.sequence) <= 0)
+				continue;
+			if (!same)
+			{
+				char name[INET_ADDRSTRLEN] = "";
+				inet_ntop(AF_INET, &from.sin_addr, name, sizeof(name));
+				printf("Remote: headset at %s:%u, %ux%u per eye at %.0f Hz\r\n", name, (unsigned)ntohs(from.sin_port), (unsigned)packet.eyeWidth,
+					(unsigned)packet.eyeHeight, packet.refreshRate);
+				if (!this->heardFrom)
+					this->optics = packet;
+				this->headset = from;
+				this->keyDue = true;
+			}
+			this->heardFrom = true;
+			this->heard = this->seconds();
+			this->pose = packet;
+			if (packet.flags & REMOTE_POSE_KEY_FRAME)
+				this->keyDue = true;
+			if (packet.latency > 0.0f && packet.latency < 1.0f)
+				this->latency += (packet.latency - this->latency) * 0.1f;
+		}
+	}
+
+	// Reads the eyes of texture and, with depth, their depth a sample a tile into the pack buffer and maps it once
+	// the GPU is through. False if it didn't finish in time, the frame is then not sent.
+	bool readBack(GLuint texture, const ovrLayerEyeFov& layer, size_t bytes, bool withDepth)
+	{
+		if (!this->readFramebuffer)
+		{
+			glGenFramebuffers(1, &this->readFramebuffer);
+			glGenBuffers(1, &this->pack);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pack);
+		if (bytes > this->packBytes)
+		{
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+			this->packBytes = bytes;
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, this->readFramebuffer);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		for (int i = 0; i < ovrEye_Count; i++)
+		{
+			const ovrRecti& vp = layer.Viewport[i];
+			glReadPixels(vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)this->eyes[i].pixelOffset);
+		}
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+		if (withDepth && this->depth)
+		{
+			// Each eye's depth down to a sample a tile, side by side in the coarse texture, then read from there
+			GLint x = 0;
+			for (int i = 0; i < ovrEye_Count; i++)
+			{
+				const ovrRecti& vp = this->depthViewports[i];
+				const Eye& eye = this->eyes[i];
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, this->depthFramebuffer);
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->coarseFramebuffer);
+				glBlitFramebuffer(vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h, x, 0, x + eye.tilesX, eye.tilesY,
+					GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, this->coarseFramebuffer);
+				glReadPixels(x, 0, eye.tilesX, eye.tilesY, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, (GLvoid*)eye.depthOffset);
+				x += eye.tilesX;
+			}
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		const GLenum waited = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, REMOTE_READBACK_TIMEOUT);
+		glDeleteSync(fence);
+		if (waited == GL_TIMEOUT_EXPIRED || waited == GL_WAIT_FAILED)
+		{
+			printf("ERROR::REMOTE_HMD::READBACK_LATE\n");
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			return false;
+		}
+		this->mapped = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		return this->mapped != nullptr;
+	}
+
+	// One band of tiles of one eye, on a job: coded against the eye's reference, which it brings up to date, and sent
+	void encodeSlice(int slice)
+	{
+		Eye& eye = this->eyes[slice / REMOTE_SLICES_PER_EYE];
+		const int band = slice % REMOTE_SLICES_PER_EYE;
+		const uint32_t firstRow = eye.tilesY * band / REMOTE_SLICES_PER_EYE;
+		const uint32_t endRow = eye.tilesY * (band + 1) / REMOTE_SLICES_PER_EYE;
+		vector<uint8_t>& out = this->slices[slice];
+		out.clear();
+
+		RemoteSliceInfo info;
+		memset(&info, 0, sizeof(info));
+		info.frame = this->frame;
+		info.reference = this->reference;
+		info.poseSequence = this->frameSequence;
+		info.flags = (uint16_t)((this->frameKey ? REMOTE_SLICE_KEY : 0) | (this->reversedDepth ? REMOTE_SLICE_REVERSED_DEPTH : 0) |
+			(this->linear ? REMOTE_SLICE_LINEAR : 0) | (this->frameDepth ? REMOTE_SLICE_DEPTH : 0));
+		info.eye = (uint16_t)(slice / REMOTE_SLICES_PER_EYE);
+		info.width = eye.width;
+		info.height = eye.height;
+		info.firstRow = (uint16_t)firstRow;
+		info.rows = (uint16_t)(endRow - firstRow);
+		info.orientation[0] = eye.pose.Orientation.x;
+		info.orientation[1] = eye.pose.Orientation.y;
+		info.orientation[2] = eye.pose.Orientation.z;
+		info.orientation[3] = eye.pose.Orientation.w;
+		info.position[0] = eye.pose.Position.x;
+		info.position[1] = eye.pose.Position.y;
+		info.position[2] = eye.pose.Position.z;
+		info.fov[0] = eye.fov.UpTan;
+		info.fov[1] = eye.fov.DownTan;
+		info.fov[2] = eye.fov.LeftTan;
+		info.fov[3] = eye.fov.RightTan;
+		info.nearPlane = this->nearPlane;
+		info.farPlane = this->farPlane;
+		out.resize(sizeof(info));
+		memcpy(out.data(), &info, sizeof(info));
+
+		// The lens centre, where the quantizer is the frame's, and the tangent a pixel spans
+		const float tanWidth = eye.fov.LeftTan + eye.fov.RightTan;
+		const float tanHeight = eye.fov.UpTan + eye.fov.DownTan;
+		const glm::vec2 centre(eye.width * eye.fov.LeftTan / tanWidth, eye.height * eye.fov.DownTan / tanHeight);
+		const glm::vec2 tanPerPixel(tanWidth / eye.width, tanHeight / eye.height);
+		for (uint32_t ty = firstRow; ty < endRow; ty++)
+		{
+			for (uint32_t tx = 0; tx < eye.tilesX; tx++)
+			{
+				const glm::vec2 middle((tx + 0.5f) * REMOTE_TILE, (ty + 0.5f) * REMOTE_TILE);
+				const float eccentricity = glm::length((middle - centre) * tanPerPixel);
+				const float q = this->frameQuant * (1.0f + std::max(eccentricity - REMOTE_FOVEA_TAN, 0.0f) * REMOTE_FOVEATION_SLOPE);
+				this->encodeTile(eye, tx, ty, (int32_t)std::min(q + 0.5f, REMOTE_MAX_QUANT), out);
+			}
+		}
+		if (this->frameDepth)
+		{
+			const uint16_t* samples = (const uint16_t*)(this->mapped + eye.depthOffset);
+			RunWriter writer(out);
+			for (uint32_t ty = firstRow; ty < endRow; ty++)
+			{
+				for (uint32_t tx = 0; tx < eye.tilesX; tx++)
+				{
+					const size_t i = (size_t)ty * eye.tilesX + tx;
+					int32_t predicted = eye.depth[i];
+					if (this->frameKey)
+						predicted = tx > 0 ? samples[i - 1] : ty > firstRow ? samples[i - eye.tilesX] : 0;
+					writer.level((int32_t)samples[i] - predicted);
+					eye.depth[i] = samples[i];
+				}
+			}
+			writer.finish();
+		}
+		this->send((uint8_t)slice, out);
+	}
+
+	void encodeTile(Eye& eye, uint32_t tx, uint32_t ty, int32_t q, vector<uint8_t>& out)
+	{
+		// The tile in YCoCg-R, chroma summed over each 2x2 and then averaged. Pixels past the edge repeat it.
+		int32_t values[REMOTE_TILE * REMOTE_TILE * 3 / 2];
+		int32_t* y = values;
+		int32_t* co = values + REMOTE_TILE * REMOTE_TILE;
+		int32_t* cg = co + REMOTE_TILE * REMOTE_TILE / 4;
+		memset(co, 0, sizeof(int32_t) * REMOTE_TILE * REMOTE_TILE / 2);
+		const uint8_t* pixels = this->mapped + eye.pixelOffset;
+		for (int py = 0; py < REMOTE_TILE; py++)
+		{
+			const uint32_t sy = std::min(ty * REMOTE_TILE + py, (uint32_t)eye.height - 1);
+			for (int px = 0; px < REMOTE_TILE; px++)
+			{
+				const uint32_t sx = std::min(tx * REMOTE_TILE + px, (uint32_t)eye.width - 1);
+				const uint8_t* p = pixels + ((size_t)sy * eye.width + sx) * 4;
+				const int32_t pco = (int32_t)p[0] - p[2];
+				const int32_t t = p[2] + (pco >> 1);
+				const int32_t pcg = (int32_t)p[1] - t;
+				y[py * REMOTE_TILE + px] = t + (pcg >> 1);
+				co[(py >> 1) * (REMOTE_TILE / 2) + (px >> 1)] += pco;
+				cg[(py >> 1) * (REMOTE_TILE / 2) + (px >> 1)] += pcg;
+			}
+		}
+		for (int i = 0; i < REMOTE_TILE * REMOTE_TILE / 4; i++)
+		{
+			co[i] = quantize(co[i], 4);
+			cg[i] = quantize(cg[i], 4);
+		}
+
+		int32_t levels[REMOTE_TILE * REMOTE_TILE * 3 / 2];
+		const size_t lumaStride = (size_t)eye.tilesX * REMOTE_TILE;
+		const size_t chromaStride = lumaStride / 2;
+		int16_t* lumaRecon = &eye.y[(size_t)ty * REMOTE_TILE * lumaStride + tx * REMOTE_TILE];
+		int16_t* coRecon = &eye.co[(size_t)ty * (REMOTE_TILE / 2) * chromaStride + tx * (REMOTE_TILE / 2)];
+		int16_t* cgRecon = &eye.cg[(size_t)ty * (REMOTE_TILE / 2) * chromaStride + tx * (REMOTE_TILE / 2)];
+		// An unchanged tile is skipped, which leaves the reference as it was; codePlane() only changes it by the levels
+		const bool key = this->frameKey;
+		bool any = codePlane(y, REMOTE_TILE, levels, lumaRecon, lumaStride, q, key, 128, 0, 255);
+		any = codePlane(co, REMOTE_TILE / 2, levels + REMOTE_TILE * REMOTE_TILE, coRecon, chromaStride, q, key, 0, -255, 255) || any;
+		any = codePlane(cg, REMOTE_TILE / 2, levels + REMOTE_TILE * REMOTE_TILE * 5 / 4, cgRecon, chromaStride, q, key, 0, -255, 255) || any;
+		if (!any && !key)
+		{
+			out.push_back(0);
+			return;
+		}
+		putVarint(out, (uint32_t)q);
+		RunWriter writer(out);
+		for (int i = 0; i < REMOTE_TILE * REMOTE_TILE * 3 / 2; i++)
+			writer.level(levels[i]);
+		writer.finish();
+	}
+
+	// The slice's bytes as fragments, a parity fragment after every REMOTE_FEC_GROUP of them and after the last
+	void send(uint8_t slice, const vector<uint8_t>& bytes)
+	{
+		uint8_t datagram[sizeof(RemoteFragmentHeader) + REMOTE_FRAGMENT_BYTES];
+		uint8_t parity[REMOTE_FRAGMENT_BYTES];
+		RemoteFragmentHeader header;
+		header.magic = REMOTE_FRAGMENT_MAGIC;
+		header.slice = slice;
+		header.frame = this->frame;
+		header.bytes = (uint32_t)bytes.size();
+		header.reserved = 0;
+		const size_t fragments = (bytes.size() + REMOTE_FRAGMENT_BYTES - 1) / REMOTE_FRAGMENT_BYTES;
+		uint32_t sent = 0;
+		for (size_t i = 0; i < fragments; i++)
+		{
+			if (i % REMOTE_FEC_GROUP == 0)
+				memset(parity, 0, sizeof(parity));
+			const size_t offset = i * REMOTE_FRAGMENT_BYTES;
+			const size_t length = std::min((size_t)REMOTE_FRAGMENT_BYTES, bytes.size() - offset);
+			for (size_t k = 0; k < length; k++)
+				parity[k] ^= bytes[offset + k];
+			header.flags = 0;
+			header.index = (uint16_t)i;
+			memcpy(datagram, &header, sizeof(header));
+			memcpy(datagram + sizeof(header), &bytes[offset], length);
+			sent += this->sendDatagram(datagram, sizeof(header) + length);
+			if (i % REMOTE_FEC_GROUP == REMOTE_FEC_GROUP - 1 || i + 1 == fragments)
+			{
+				header.flags = REMOTE_FRAGMENT_PARITY;
+				header.index = (uint16_t)(i / REMOTE_FEC_GROUP);
+				memcpy(datagram, &header, sizeof(header));
+				memcpy(datagram + sizeof(header), parity, sizeof(parity));
+				sent += this->sendDatagram(datagram, sizeof(datagram));
+			}
+		}
+		this->frameBytes += sent;
+	}
+
+	uint32_t sendDatagram(const uint8_t* datagram, size_t length)
+	{
+		const int sent = sendto(this->socket, (const char*)datagram, (int)length, 0, (const sockaddr*)&this->frameTarget, sizeof(sockaddr_in));
+		return sent == SOCKET_ERROR ? 0 : (uint32_t)sent;
+	}
+
+	// Moves the quantizer toward the frame size --remote-bitrate allows, by what the last frame came to. Key frames
+	// cost what they cost and aren't counted.
+	void control()
+	{
+		const uint32_t bytes = this->frameBytes.load();
+		this->reportBytes += bytes;
+		if (!bytes || this->frameKey)
+			return;
+		const double target = this->mbps * 1e6 / 8.0 / this->refreshRate();
+		const float step = (float)glm::clamp(sqrt(bytes / target), 0.8, 1.25);
+		this->quant = glm::clamp(this->frameQuant * step, REMOTE_MIN_QUANT, REMOTE_MAX_QUANT);
+	}
+
+	void report()
+	{
+		const double now = this->seconds();
+		if (now - this->reported < REMOTE_REPORT_SECONDS)
+			return;
+		if (this->connected())
+		{
+			printf("Remote: %.1f Mbps, quantizer %.1f, %u key frames, latency %.1f ms\r\n", this->reportBytes * 8.0 / (now - this->reported) / 1e6,
+				this->quant, this->keyFrames, this->latency * 1000.0f);
+		}
+		this->reported = now;
+		this->reportBytes = 0;
+		this->keyFrames = 0;
+	}
+
+	void releaseDepth()
+	{
+		if (this->depth)
+		{
+			_gpuMemory.release(GpuMemoryCategory::EyeTargets, _gpuImageBytes(this->depthFormat, this->depthSize.x, this->depthSize.y) +
+				_gpuImageBytes(this->depthFormat, this->coarseSize.x, this->coarseSize.y));
+			const GLuint textures[2] = { this->depth, this->coarse };
+			glDeleteTextures(2, textures);
+			const GLuint framebuffers[2] = { this->depthFramebuffer, this->coarseFramebuffer };
+			glDeleteFramebuffers(2, framebuffers);
+		}
+		this->depth = this->coarse = 0;
+		this->depthFramebuffer = this->coarseFramebuffer = 0;
+	}
+
+	void releaseGl()
+	{
+		if (this->mapped)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pack);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			this->mapped = nullptr;
+		}
+		this->releaseDepth();
+		if (this->readFramebuffer)
+		{
+			glDeleteFramebuffers(1, &this->readFramebuffer);
+			glDeleteBuffers(1, &this->pack);
+		}
+		this->readFramebuffer = this->pack = 0;
+		this->packBytes = 0;
+	}
+
+	SOCKET socket = INVALID_SOCKET;
+	bool started = false;
+	uint16_t port = 0;
+	uint32_t mbps = REMOTE_DEFAULT_MBPS;
+
+	// The headset frames go to, its newest packet, and the first headset's packet, whose optics are rendered for
+	sockaddr_in headset = {};
+	bool heardFrom = false;
+	double heard = 0.0;
+	RemotePosePacket pose = {};
+	RemotePosePacket optics = {};
+	float latency = REMOTE_DEFAULT_LATENCY;
+	uint32_t renderedSequence = 0;
+	Deadline next;
+
+	float nearPlane = 0.01f;
+	float farPlane = 1000.0f;
+	bool reversedDepth = false;
+	bool linear = false;
+
+	GLuint readFramebuffer = 0;
+	GLuint pack = 0;
+	size_t packBytes = 0;
+	// The pack buffer while the slices read it, from the frame's readback to the next submit
+	const uint8_t* mapped = nullptr;
+	GLuint depth = 0;
+	GLuint coarse = 0;
+	GLuint depthFramebuffer = 0;
+	GLuint coarseFramebuffer = 0;
+	glm::uvec2 depthSize = glm::uvec2(0);
+	glm::uvec2 coarseSize = glm::uvec2(0);
+	GLenum depthFormat = GL_NONE;
+	ovrRecti depthViewports[ovrEye_Count] = {};
+	bool depthFresh = false;
+
+	// The frame the slices are coding, set before they start and read by them only
+	Eye eyes[ovrEye_Count];
+	vector<uint8_t> slices[REMOTE_SLICES];
+	JobCounter encoded;
+	uint32_t frame = 0;
+	uint32_t reference = 0;
+	uint32_t frameSequence = 0;
+	bool frameKey = false;
+	bool frameDepth = false;
+	float frameQuant = 4.0f;
+	sockaddr_in frameTarget = {};
+	std::atomic<uint32_t> frameBytes{ 0 };
+	bool keyDue = true;
+	float quant = 4.0f;
+
+	double reported = 0.0;
+	uint64_t reportBytes = 0;
+	uint32_t keyFrames = 0;
+};
+
+static RemoteHmd _remoteHmd;
@@ -0,0 +1,614 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <functional>
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "gpumemory.h"
+#include "gldebug.h"
+
+typedef int RenderGraphTarget;
+typedef int RenderGraphPass;
+#define RENDER_GRAPH_NONE -1
+
+// What a transient target is allocated as. Two transients with the same description share one renderbuffer when
+// their lifetimes don't overlap; GL has no placed resources, so only targets of one size, format and sample count
+// can alias each other's memory. A sampled one is a texture instead, for a later pass to read in its shaders.
+struct RenderTargetDesc
+{
+	glm::uvec2 size = glm::uvec2(0);
+	GLenum format = GL_NONE;
+	GLint samples = 1;
+	bool sampled = false;
+
+	bool operator==(const RenderTargetDesc& other) const
+	{
+		return this->size == other.size && this->format == other.format && this->samples == other.samples &&
+			this->sampled == other.sampled;
+	}
+};
+
+// The render targets of a frame and the passes between them, declared up front instead of each pass creating and
+// binding its own framebuffer.
+//
+// A pass reads and writes targets at attachment points. compile() drops the passes nothing that is an output
+// depends on, orders the rest by those dependencies, declaration order where there are none, and works out where
+// each transient target's contents start and stop mattering. Transients are renderbuffers, or textures where a pass
+// samples them, the graph owns and gives out from a pool, so a target that is no longer written costs nothing and targets dead at different times share
+// memory; imported targets are the swap chain textures, set every frame, and framebuffers the app owns, like the
+// window's.
+//
+// execute() runs the passes in that order with the pass's targets bound: what it writes on GL_DRAW_FRAMEBUFFER,
+// what it reads on GL_READ_FRAMEBUFFER. Transients are invalidated before their first writer, which then has to
+// clear or cover what it uses, and after their last reader, so a tiler never loads or stores them.
+//
+// The graph is compiled again when its shape changes, the samples of the MSAA target say; physical targets that
+// still fit are kept across, the rest are freed.
+class RenderGraph
+{
+public:
+	RenderGraph() {}
+	~RenderGraph()
+	{
+		this->reset();
+		this->releasePool(true);
+	}
+
+	RenderGraph(const RenderGraph&) = delete;
+	RenderGraph& operator=(const RenderGraph&) = delete;
+
+	// Forgets the passes and targets for a new declaration, the physical targets stay pooled for the next compile
+	void reset()
+	{
+		for (size_t i = 0; i < this->passes.size(); i++)
+		{
+			if (this->passes[i].ownsDraw)
+				glDeleteFramebuffers(1, &this->passes[i].drawFramebuffer);
+			if (this->passes[i].readFramebuffer)
+				glDeleteFramebuffers(1, &this->passes[i].readFramebuffer);
+		}
+		this->passes.clear();
+		this->targets.clear();
+		this->order.clear();
+		this->compiled = false;
+	}
+
+	// reset(), and the pooled physical targets freed as well: the next compile allocates every one afresh
+	void release()
+	{
+		this->reset();
+		this->releasePool(true);
+	}
+
+	RenderGraphTarget transient(const char* name, const RenderTargetDesc& desc)
+	{
+		Target target;
+		target.name = name;
+		target.kind = TargetKind::Transient;
+		target.desc = desc;
+		this->targets.push_back(target);
+		return (RenderGraphTarget)this->targets.size() - 1;
+	}
+
+	// A texture the pass attaches each frame, set with setTexture() before execute()
+	RenderGraphTarget importedTexture(const char* name)
+	{
+		Target target;
+		target.name = name;
+		target.kind = TargetKind::Texture;
+		this->targets.push_back(target);
+		return (RenderGraphTarget)this->targets.size() - 1;
+	}
+
+	// A whole framebuffer, bound as it is; 0 is the window's
+	RenderGraphTarget importedFramebuffer(const char* name, GLuint framebuffer)
+	{
+		Target target;
+		target.name = name;
+		target.kind = TargetKind::Framebuffer;
+		target.object = framebuffer;
+		this->targets.push_back(target);
+		return (RenderGraphTarget)this->targets.size() - 1;
+	}
+
+	// Kept however the passes after it go; everything that leaves the frame is one
+	void output(RenderGraphTarget target) { this->targets[target].output = true; }
+
+	// condition, if there is one, is asked every frame: a pass it turns down is skipped, the lifetimes are worked
+	// out as if it ran
+	RenderGraphPass pass(const char* name, function<void()> execute, function<bool()> condition = nullptr)
+	{
+		Pass pass;
+		pass.name = name;
+		pass.execute = execute;
+		pass.condition = condition;
+		this->passes.push_back(pass);
+		return (RenderGraphPass)this->passes.size() - 1;
+	}
+
+	// GL_NONE reads a sampled transient through texture(), nothing is attached for it
+	void read(RenderGraphPass pass, RenderGraphTarget target, GLenum attachment)
+	{
+		this->passes[pass].reads.push_back({ target, attachment });
+	}
+	void write(RenderGraphPass pass, RenderGraphTarget target, GLenum attachment = GL_NONE)
+	{
+		this->passes[pass].writes.push_back({ target, attachment });
+	}
+
+	// Culls, orders, allocates and builds the framebuffers. False if a framebuffer of only transients is
+	// incomplete, the driver turned its format or samples down; the graph then isn't executed.
+	bool compile()
+	{
+		this->cull();
+		if (!this->sort())
+			return false;
+		this->lifetimes();
+		this->allocate();
+		this->compiled = this->framebuffers();
+		return this->compiled;
+	}
+
+	void setTexture(RenderGraphTarget target, GLuint texture) { this->targets[target].object = texture; }
+
+	void execute()
+	{
+		if (!this->compiled)
+			return;
+		for (size_t i = 0; i < this->order.size(); i++)
+		{
+			Pass& pass = this->passes[this->order[i]];
+			if (pass.condition && !pass.condition())
+				continue;
+			this->bind(pass, true);
+			if (GLEW_ARB_invalidate_subdata && !pass.discardBefore.empty())
+				glInvalidateFramebuffer(GL_DRAW_FRAMEBUFFER, (GLsizei)pass.discardBefore.size(), pass.discardBefore.data());
+			pass.execute();
+			// The pass may have bound others on the way, the invalidations are of its own
+			this->bind(pass, false);
+			if (GLEW_ARB_invalidate_subdata && !pass.discardDraw.empty())
+				glInvalidateFramebuffer(GL_DRAW_FRAMEBUFFER, (GLsizei)pass.discardDraw.size(), pass.discardDraw.data());
+			if (GLEW_ARB_invalidate_subdata && !pass.discardRead.empty())
+				glInvalidateFramebuffer(GL_READ_FRAMEBUFFER, (GLsizei)pass.discardRead.size(), pass.discardRead.data());
+			this->detach(pass);
+		}
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	}
+
+	bool culled(RenderGraphPass pass) const { return pass == RENDER_GRAPH_NONE || !this->passes[pass].live; }
+	// What the pass draws into, for code inside it that binds something else and comes back
+	GLuint framebuffer(RenderGraphPass pass) const { return this->passes[pass].drawFramebuffer; }
+	// The renderbuffer a live transient was given, 0 if nothing needs it
+	GLuint renderbuffer(RenderGraphTarget target) const
+	{
+		const int physical = this->targets[target].physical;
+		return physical < 0 ? 0 : this->pool[physical].renderbuffer;
+	}
+	// The texture a live sampled transient was given
+	GLuint texture(RenderGraphTarget target) const
+	{
+		const int physical = this->targets[target].physical;
+		return physical < 0 ? 0 : this->pool[physical].texture;
+	}
+	// Transients against the renderbuffers behind them, for the log
+	size_t transientCount() const
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < this->targets.size(); i++)
+			count += this->targets[i].physical >= 0;
+		return count;
+	}
+	size_t physicalCount() const { return this->pool.size(); }
+
+private:
+	enum class TargetKind { Transient, Texture, Framebuffer };
+
+	struct Target
+	{
+		const char* name = "";
+		TargetKind kind = TargetKind::Transient;
+		RenderTargetDesc desc;
+		// The imported texture or framebuffer
+		GLuint object = 0;
+		bool output = false;
+		// Positions in order, -1 while unused
+		int firstUse = -1;
+		int lastUse = -1;
+		int physical = -1;
+	};
+
+	struct Access
+	{
+		RenderGraphTarget target;
+		GLenum attachment;
+	};
+
+	struct Pass
+	{
+		const char* name = "";
+		function<void()> execute;
+		function<bool()> condition;
+		vector<Access> reads;
+		vector<Access> writes;
+		bool live = false;
+		GLuint drawFramebuffer = 0;
+		GLuint readFramebuffer = 0;
+		bool ownsDraw = false;
+		vector<GLenum> discardBefore;
+		vector<GLenum> discardDraw;
+		vector<GLenum> discardRead;
+	};
+
+	struct Physical
+	{
+		RenderTargetDesc desc;
+		GLuint renderbuffer = 0;
+		GLuint texture = 0;
+		GpuAllocation memory;
+		// Position in order the current holder stops being used at, -1 while free
+		int busyUntil = -1;
+		bool assigned = false;
+	};
+
+	vector<Target> targets;
+	vector<Pass> passes;
+	vector<RenderGraphPass> order;
+	vector<Physical> pool;
+	bool compiled = false;
+
+	// Backwards from the outputs: a pass is live if it writes a target something live reads or that is an output
+	void cull()
+	{
+		vector<bool> needed(this->targets.size(), false);
+		for (size_t i = 0; i < this->targets.size(); i++)
+			needed[i] = this->targets[i].output;
+		for (size_t i = this->passes.size(); i-- > 0;)
+		{
+			Pass& pass = this->passes[i];
+			pass.live = false;
+			for (size_t w = 0; w < pass.writes.size(); w++)
+				pass.live = pass.live || needed[pass.writes[w].target];
+			if (!pass.live)
+				continue;
+			for (size_t r = 0; r < pass.reads.size(); r++)
+				needed[pass.reads[r].target] = true;
+		}
+	}
+
+	bool touches(const Pass& pass, RenderGraphTarget target, bool writes) const
+	{
+		const vector<Access>& accesses = writes ? pass.writes : pass.reads;
+		for (size_t i = 0; i < accesses.size(); i++)
+		{
+			if (accesses[i].target == target)
+				return true;
+		}
+		return false;
+	}
+
+	// A live pass goes after every earlier one it reads from, writes after or overwrites a read of; of the passes
+	// that are ready, the first declared goes first
+	bool sort()
+	{
+		this->order.clear();
+		vector<int> pending;
+		for (size_t i = 0; i < this->passes.size(); i++)
+		{
+			if (this->passes[i].live)
+				pending.push_back((int)i);
+		}
+		vector<bool> done(this->passes.size(), false);
+		while (!pending.empty())
+		{
+			size_t ready = pending.size();
+			for (size_t p = 0; p < pending.size() && ready == pending.size(); p++)
+			{
+				const Pass& pass = this->passes[pending[p]];
+				bool blocked = false;
+				for (int before = 0; before < pending[p] && !blocked; before++)
+				{
+					if (!this->passes[before].live || done[before])
+						continue;
+					blocked = this->depends(pass, this->passes[before]);
+				}
+				if (!blocked)
+					ready = p;
+			}
+			if (ready == pending.size())
+			{
+				std::cout << "ERROR::RENDER_GRAPH::CYCLE at " << this->passes[pending[0]].name << std::endl;
+				return false;
+			}
+			done[pending[ready]] = true;
+			this->order.push_back(pending[ready]);
+			pending.erase(pending.begin() + ready);
+		}
+		return true;
+	}
+
+	bool depends(const Pass& pass, const Pass& before) const
+	{
+		for (size_t w = 0; w < before.writes.size(); w++)
+		{
+			const RenderGraphTarget target = before.writes[w].target;
+			if (this->touches(pass, target, false) || this->touches(pass, target, true))
+				return true;
+		}
+		for (size_t r = 0; r < before.reads.size(); r++)
+		{
+			if (this->touches(pass, before.reads[r].target, true))
+				return true;
+		}
+		return false;
+	}
+
+	void lifetimes()
+	{
+		for (size_t i = 0; i < this->targets.size(); i++)
+		{
+			this->targets[i].firstUse = this->targets[i].lastUse = -1;
+			this->targets[i].physical = -1;
+		}
+		for (size_t position = 0; position < this->order.size(); position++)
+		{
+			const Pass& pass = this->passes[this->order[position]];
+			for (int writes = 0; writes < 2; writes++)
+			{
+				const vector<Access>& accesses = writes ? pass.writes : pass.reads;
+				for (size_t i = 0; i < accesses.size(); i++)
+				{
+					Target& target = this->targets[accesses[i].target];
+					if (target.firstUse < 0)
+						target.firstUse = (int)position;
+					target.lastUse = (int)position;
+				}
+			}
+		}
+	}
+
+	// In order of first use, each live transient takes a pooled renderbuffer of its description that is free by
+	// then, or a new one; what is left over from the last compile is freed
+	void allocate()
+	{
+		for (size_t i = 0; i < this->pool.size(); i++)
+		{
+			this->pool[i].assigned = false;
+			this->pool[i].busyUntil = -1;
+		}
+		for (int position = 0; position < (int)this->order.size(); position++)
+		{
+			for (size_t t = 0; t < this->targets.size(); t++)
+			{
+				Target& target = this->targets[t];
+				if (target.kind != TargetKind::Transient || target.firstUse != position)
+					continue;
+				int found = -1;
+				// One already holding a target that is dead by now first, then one unassigned
+				for (size_t i = 0; i < this->pool.size() && found < 0; i++)
+				{
+					if (this->pool[i].assigned && this->pool[i].desc == target.desc && this->pool[i].busyUntil < position)
+						found = (int)i;
+				}
+				for (size_t i = 0; i < this->pool.size() && found < 0; i++)
+				{
+					if (!this->pool[i].assigned && this->pool[i].desc == target.desc)
+						found = (int)i;
+				}
+				if (found < 0)
+				{
+					Physical physical;
+					physical.desc = target.desc;
+					if (target.desc.sampled)
+						this->createTexture(physical);
+					else
+					{
+						glGenRenderbuffers(1, &physical.renderbuffer);
+						glBindRenderbuffer(GL_RENDERBUFFER, physical.renderbuffer);
+						if (target.desc.samples > 1)
+							glRenderbufferStorageMultisample(GL_RENDERBUFFER, target.desc.samples, target.desc.format, target.desc.size.x, target.desc.size.y);
+						else
+							glRenderbufferStorage(GL_RENDERBUFFER, target.desc.format, target.desc.size.x, target.desc.size.y);
+						glBindRenderbuffer(GL_RENDERBUFFER, 0);
+					}
+					physical.memory.reset(GpuMemoryCategory::EyeTargets,
+						_gpuImageBytes(target.desc.format, target.desc.size.x, target.desc.size.y, 1, target.desc.samples));
+					this->pool.push_back(std::move(physical));
+					found = (int)this->pool.size() - 1;
+				}
+				Physical& physical = this->pool[found];
+				physical.assigned = true;
+				// An output lives to the end of the frame
+				physical.busyUntil = target.output ? (int)this->order.size() : target.lastUse;
+				target.physical = found;
+				if (physical.texture)
+					_glLabel(GL_TEXTURE, physical.texture, target.name);
+				else
+					_glLabel(GL_RENDERBUFFER, physical.renderbuffer, target.name);
+			}
+		}
+		this->releasePool(false);
+	}
+
+	// Point filtered; the pass reading it sets the filtering it wants on its own unit. Multisampled ones are
+	// GL_TEXTURE_2D_MULTISAMPLE, which only texelFetch reads.
+	void createTexture(Physical& physical)
+	{
+		const GLenum format = physical.desc.format;
+		const bool depth = format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32F;
+		glGenTextures(1, &physical.texture);
+		if (physical.desc.samples > 1)
+		{
+			glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, physical.texture);
+			glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, physical.desc.samples, format, physical.desc.size.x, physical.desc.size.y, GL_TRUE);
+			glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+			return;
+		}
+		glBindTexture(GL_TEXTURE_2D, physical.texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, physical.desc.size.x, physical.desc.size.y, 0,
+			depth ? GL_DEPTH_COMPONENT : GL_RGBA, depth ? GL_FLOAT : GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// A renderbuffer or sampled transient on the bound framebuffer
+	void attachTransient(GLenum framebuffer, GLenum attachment, const Physical& physical)
+	{
+		if (physical.texture)
+			glFramebufferTexture2D(framebuffer, attachment, physical.desc.samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, physical.texture, 0);
+		else
+			glFramebufferRenderbuffer(framebuffer, attachment, GL_RENDERBUFFER, physical.renderbuffer);
+	}
+
+	// Frees the physical targets nothing was given, or all of them
+	void releasePool(bool all)
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < this->pool.size(); i++)
+		{
+			if (all || !this->pool[i].assigned)
+			{
+				glDeleteRenderbuffers(1, &this->pool[i].renderbuffer);
+				glDeleteTextures(1, &this->pool[i].texture);
+				continue;
+			}
+			// Targets refer to the pool by index, renumber theirs as the pool closes up
+			for (size_t t = 0; t < this->targets.size(); t++)
+			{
+				if (this->targets[t].physical == (int)i)
+					this->targets[t].physical = (int)kept;
+			}
+			if (kept != i)
+				this->pool[kept] = std::move(this->pool[i]);
+			kept++;
+		}
+		this->pool.resize(kept);
+	}
+
+	// Transient attachments are attached once here, imported textures every frame in bind()
+	bool framebuffers()
+	{
+		for (size_t position = 0; position < this->order.size(); position++)
+		{
+			Pass& pass = this->passes[this->order[position]];
+			pass.discardBefore.clear();
+			pass.discardDraw.clear();
+			pass.discardRead.clear();
+			bool onlyTransients = true;
+			bool importedDraw = false;
+
+			for (size_t w = 0; w < pass.writes.size(); w++)
+			{
+				const Target& target = this->targets[pass.writes[w].target];
+				if (target.kind == TargetKind::Framebuffer)
+				{
+					pass.drawFramebuffer = target.object;
+					importedDraw = true;
+				}
+			}
+			if (!importedDraw && !pass.writes.empty())
+			{
+				glGenFramebuffers(1, &pass.drawFramebuffer);
+				pass.ownsDraw = true;
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pass.drawFramebuffer);
+				// Every colour attachment is drawn to, in the order of their attachment points
+				vector<GLenum> drawBuffers;
+				for (size_t w = 0; w < pass.writes.size(); w++)
+				{
+					const GLenum attachment = pass.writes[w].attachment;
+					if (attachment >= GL_COLOR_ATTACHMENT0 && attachment <= GL_COLOR_ATTACHMENT15)
+					{
+						const size_t index = attachment - GL_COLOR_ATTACHMENT0;
+						if (drawBuffers.size() <= index)
+							drawBuffers.resize(index + 1, GL_NONE);
+						drawBuffers[index] = attachment;
+					}
+				}
+				if (drawBuffers.size() > 1)
+					glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+				for (size_t w = 0; w < pass.writes.size(); w++)
+				{
+					const Target& target = this->targets[pass.writes[w].target];
+					if (target.kind != TargetKind::Transient)
+					{
+						onlyTransients = false;
+						continue;
+					}
+					this->attachTransient(GL_DRAW_FRAMEBUFFER, pass.writes[w].attachment, this->pool[target.physical]);
+					if (target.firstUse == (int)position)
+						pass.discardBefore.push_back(pass.writes[w].attachment);
+					if (target.lastUse == (int)position && !target.output)
+						pass.discardDraw.push_back(pass.writes[w].attachment);
+				}
+				_glLabel(GL_FRAMEBUFFER, pass.drawFramebuffer, pass.name);
+				if (onlyTransients && glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+				{
+					std::cout << "ERROR::RENDER_GRAPH::FRAMEBUFFER_INCOMPLETE " << pass.name << std::endl;
+					glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+					return false;
+				}
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+			}
+
+			// Sampled reads are the pass's own to bind, only attached reads need a framebuffer
+			bool attachedReads = false;
+			for (size_t r = 0; r < pass.reads.size(); r++)
+				attachedReads = attachedReads || pass.reads[r].attachment != GL_NONE;
+			if (attachedReads)
+			{
+				glGenFramebuffers(1, &pass.readFramebuffer);
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, pass.readFramebuffer);
+				for (size_t r = 0; r < pass.reads.size(); r++)
+				{
+					const Target& target = this->targets[pass.reads[r].target];
+					if (target.kind != TargetKind::Transient || pass.reads[r].attachment == GL_NONE)
+						continue;
+					this->attachTransient(GL_READ_FRAMEBUFFER, pass.reads[r].attachment, this->pool[target.physical]);
+					if (target.lastUse == (int)position && !target.output)
+						pass.discardRead.push_back(pass.reads[r].attachment);
+				}
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+			}
+		}
+		return true;
+	}
+
+	void bind(const Pass& pass, bool attach)
+	{
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pass.drawFramebuffer);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, pass.readFramebuffer);
+		if (!attach)
+			return;
+		this->attachTextures(pass, false);
+	}
+
+	void detach(const Pass& pass)
+	{
+		this->attachTextures(pass, true);
+	}
+
+	void attachTextures(const Pass& pass, bool detach)
+	{
+		if (pass.ownsDraw)
+		{
+			for (size_t w = 0; w < pass.writes.size(); w++)
+			{
+				const Target& target = this->targets[pass.writes[w].target];
+				if (target.kind == TargetKind::Texture)
+					glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, pass.writes[w].attachment, GL_TEXTURE_2D, detach ? 0 : target.object, 0);
+			}
+		}
+		for (size_t r = 0; r < pass.reads.size(); r++)
+		{
+			const Target& target = this->targets[pass.reads[r].target];
+			if (target.kind == TargetKind::Texture && pass.reads[r].attachment != GL_NONE)
+				glFramebufferTexture2D(GL_READ_FRAMEBUFFER, pass.reads[r].attachment, GL_TEXTURE_2D, detach ? 0 : target.object, 0);
+		}
+	}
+};
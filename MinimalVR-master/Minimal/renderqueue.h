@@ -0,0 +1,250 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "glstate.h"
+#include "gpubuckets.h"
+
+// Passes are submitted in this order. The depth pass lays down depth alone, with color writes masked, for the
+// passes after it to test against. Decals test against depth the earlier passes wrote (GL_EQUAL), so they go
+// after everything they can land on. Only the depth and opaque passes draw with blending off.
+#define RENDER_PASS_DEPTH 0
+#define RENDER_PASS_OPAQUE 1
+#define RENDER_PASS_BLENDED 2
+#define RENDER_PASS_DECAL 3
+#define RENDER_PASS_COUNT 4
+// submit()'s mask of the passes it draws
+#define RENDER_PASS_BIT(pass) (1u << (pass))
+#define RENDER_PASSES_ALL ((1u << RENDER_PASS_COUNT) - 1)
+
+// Distances past this share the farthest depth bucket, in world units
+#define RENDER_QUEUE_DEPTH_RANGE 16.0f
+
+// The camera one submit() draws with
+struct RenderView
+{
+	glm::mat4 view;
+	glm::mat4 proj;
+	// proj * view, multiplied once per view rather than per draw
+	glm::mat4 viewProj;
+	glm::vec3 viewPos;
+	// Which of the owner's command lists, prepared ahead for this view, the draws replay. -1 when they have none
+	// and work out their uniforms as they go.
+	int list = -1;
+};
+
+struct RenderItem;
+
+// Issues one item's draw with its program and vertex array already bound. materialChanged is false when the
+// item before it used the same material with the same program, so that material's textures and uniforms
+// are still in place.
+typedef void (*RenderCallback)(const RenderItem& item, const RenderView& view, bool materialChanged);
+
+struct RenderItem
+{
+	uint64_t key;
+	GLuint program;
+	GLuint vertexArray;
+	// Whatever identifies the material to the owner, only compared
+	const void* material;
+	RenderCallback draw;
+	// For the owner, typically an index into its own per frame array
+	uint32_t data;
+	// Insertion order, keeps equal keys in the order they were pushed
+	uint32_t sequence;
+};
+
+// Draws collected once and submitted sorted, as often as there are views to draw them into (once per eye).
+//
+// Keys hold, most significant first, the pass (4 bits), program (12), material (16), vertex array (16) and
+// depth (16), so items within a pass come out grouped by state, nearest first. Blended passes move depth up
+// under the pass and invert it, giving back to front order whatever the state. Submitting binds a program or
+// vertex array only when it differs from the previous item's; the counters say how many binds that saved.
+class RenderQueue
+{
+public:
+	struct Stats
+	{
+		uint32_t items;
+		uint32_t programBinds;
+		uint32_t vertexArrayBinds;
+		uint32_t materialBinds;
+	};
+
+	RenderQueue()
+	{
+		for (int i = 0; i < RENDER_PASS_COUNT; i++)
+			this->passBuckets[i] = -1;
+	}
+
+	RenderQueue(const RenderQueue&) = delete;
+	RenderQueue& operator=(const RenderQueue&) = delete;
+
+	static uint64_t makeKey(uint32_t pass, GLuint program, const void* material, GLuint vertexArray, float depth, bool backToFront)
+	{
+		uint64_t depthBits = (uint64_t)(glm::clamp(depth / RENDER_QUEUE_DEPTH_RANGE, 0.0f, 1.0f) * 65535.0f);
+		// The upper bits of a pointer are the same for every material, fold them into the 16 the key has
+		uint64_t materialBits = ((uint64_t)(uintptr_t)material * 0x9E3779B97F4A7C15ull) >> 48;
+		uint64_t state = ((uint64_t)(program & 0xFFF) << 32) | (materialBits << 16) | (uint64_t)(vertexArray & 0xFFFF);
+		uint64_t key = (uint64_t)(pass & 0xF) << 60;
+		if (backToFront)
+			return key | ((65535 - depthBits) << 44) | (state >> 16);
+		return key | (state << 16) | depthBits;
+	}
+
+	// Starts a new frame, keeping the storage
+	void clear()
+	{
+		this->items.clear();
+		this->sorted = true;
+	}
+
+	void push(uint64_t key, GLuint program, GLuint vertexArray, const void* material, RenderCallback draw, uint32_t data)
+	{
+		RenderItem item;
+		item.key = key;
+		item.program = program;
+		item.vertexArray = vertexArray;
+		item.material = material;
+		item.draw = draw;
+		item.data = data;
+		item.sequence = (uint32_t)this->items.size();
+		this->items.push_back(item);
+		this->sorted = false;
+	}
+
+	bool empty() const { return this->items.empty(); }
+
+	// Gives every item the key keyOf(item) returns, for a queue kept from an earlier frame whose draws moved. Only
+	// a key that changed leaves the items to be sorted again.
+	template <typename KeyOf>
+	void rekey(KeyOf keyOf)
+	{
+		for (size_t i = 0; i < this->items.size(); i++)
+		{
+			const uint64_t key = keyOf(this->items[i]);
+			if (key != this->items[i].key)
+			{
+				this->items[i].key = key;
+				this->sorted = false;
+			}
+		}
+	}
+
+	// Trades items with other, each keeping its own pass timing, so a kept queue can be set aside while another
+	// view's draws go through this one
+	void swap(RenderQueue& other)
+	{
+		this->items.swap(other.items);
+		std::swap(this->sorted, other.sorted);
+	}
+
+	// Whether anything was pushed to pass
+	bool has(uint32_t pass) const
+	{
+		for (size_t i = 0; i < this->items.size(); i++)
+		{
+			if ((uint32_t)(this->items[i].key >> 60) == pass)
+				return true;
+		}
+		return false;
+	}
+
+	// Attributes pass's GPU time to one of _gpuBuckets' buckets in every submit(), -1 for none. Passes of one
+	// bucket next to each other are timed as one range.
+	void timePass(uint32_t pass, int bucket)
+	{
+		this->passBuckets[pass] = bucket;
+	}
+
+	// Puts the items in submit order. Touches no GL, so a job thread can do it while the GL thread is busy with
+	// something else, as long as nothing pushes or submits meanwhile.
+	void sort()
+	{
+		if (this->sorted)
+			return;
+		std::sort(this->items.begin(), this->items.end(), [](const RenderItem& a, const RenderItem& b)
+		{
+			return a.key != b.key ? a.key < b.key : a.sequence < b.sequence;
+		});
+		this->sorted = true;
+	}
+
+	// Sorts on the first submit after a push unless sort() already did, later views reuse the order. Binds,
+	// blending and the color mask go through _glState, which is left with blending off and color writes on.
+	// passes masks out the passes another submit draws, into other targets; the stats count what was drawn.
+	void submit(const RenderView& view, uint32_t passes = RENDER_PASSES_ALL)
+	{
+		this->sort();
+
+		Stats stats = {};
+		uint32_t pass = RENDER_PASS_OPAQUE;
+		_glState.blend(false);
+		_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		GLuint program = 0;
+		GLuint vertexArray = 0;
+		const void* material = nullptr;
+		int bucket = -1;
+		bool first = true;
+		for (size_t i = 0; i < this->items.size(); i++)
+		{
+			const RenderItem& item = this->items[i];
+			const uint32_t itemPass = (uint32_t)(item.key >> 60);
+			if (!(passes & RENDER_PASS_BIT(itemPass)))
+				continue;
+			// Material uniforms belong to the program, so a new program needs the material set again
+			bool materialChanged = first || item.material != material || item.program != program;
+			if (this->passBuckets[itemPass] != bucket)
+			{
+				_gpuBuckets.end(bucket);
+				bucket = this->passBuckets[itemPass];
+				_gpuBuckets.begin(bucket);
+			}
+			if (itemPass != pass)
+			{
+				_glState.blend(itemPass > RENDER_PASS_OPAQUE);
+				const GLboolean color = itemPass != RENDER_PASS_DEPTH;
+				_glState.colorMask(color, color, color, color);
+				pass = itemPass;
+			}
+			if (first || item.program != program)
+			{
+				_glState.useProgram(item.program);
+				program = item.program;
+				stats.programBinds++;
+			}
+			if (first || item.vertexArray != vertexArray)
+			{
+				_glState.bindVertexArray(item.vertexArray);
+				vertexArray = item.vertexArray;
+				stats.vertexArrayBinds++;
+			}
+			if (materialChanged)
+			{
+				material = item.material;
+				stats.materialBinds++;
+			}
+			first = false;
+			stats.items++;
+			item.draw(item, view, materialChanged);
+		}
+		_gpuBuckets.end(bucket);
+		_glState.blend(false);
+		_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		this->last = stats;
+	}
+
+	// Counters of the latest submit()
+	const Stats& stats() const { return this->last; }
+
+private:
+	vector<RenderItem> items;
+	bool sorted = true;
+	Stats last = {};
+	int passBuckets[RENDER_PASS_COUNT];
+};
@@ -0,0 +1,180 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+
+// What a draw was for. Other is everything outside the passes below: uploads between frames, pre-skinning, the
+// mirror, the profiler overlay and the HUD.
+enum class RenderPass : uint8_t {
+	Other,
+	Scene,
+	Avatar,
+	Reflection,
+	Inset,
+	Spectator,
+	Environment,
+	Count,
+};
+
+// Which eye a pass draws. Both when one pass covers the two, the stereo scene modes and the reflection say.
+enum class RenderEye : uint8_t {
+	Left,
+	Right,
+	Both,
+	Count,
+};
+
+// What one pass of one eye asked of GL during a frame
+struct RenderCounts
+{
+	uint32_t draws = 0;
+	// Of instanced draws, plain draws count one. Indirect draws count none, the GPU writes how many.
+	uint32_t instances = 0;
+	// Elements of indexed draws and vertices of the rest, times instances
+	uint64_t indices = 0;
+	uint64_t triangles = 0;
+	// Binds that reached the driver, ones GLStateCache filtered out aren't counted
+	uint32_t programBinds = 0;
+	uint32_t vertexArrayBinds = 0;
+	uint32_t textureBinds = 0;
+	// Uniform block bytes written, the uniform ring's and the blocks filled in place
+	uint64_t uniformBytes = 0;
+	// Vertex, index, instance and texture bytes handed to GL
+	uint64_t uploadBytes = 0;
+	// Meshes and instances culling dropped
+	uint32_t culled = 0;
+
+	void add(const RenderCounts& other)
+	{
+		this->draws += other.draws;
+		this->instances += other.instances;
+		this->indices += other.indices;
+		this->triangles += other.triangles;
+		this->programBinds += other.programBinds;
+		this->vertexArrayBinds += other.vertexArrayBinds;
+		this->textureBinds += other.textureBinds;
+		this->uniformBytes += other.uniformBytes;
+		this->uploadBytes += other.uploadBytes;
+		this->culled += other.culled;
+	}
+};
+
+struct RenderFrameStats
+{
+	RenderCounts passes[(int)RenderPass::Count][(int)RenderEye::Count];
+
+	const RenderCounts& at(RenderPass pass, RenderEye eye) const
+	{
+		return this->passes[(int)pass][(int)eye];
+	}
+
+	// Every eye of pass
+	RenderCounts pass(RenderPass pass) const
+	{
+		RenderCounts counts;
+		for (int eye = 0; eye < (int)RenderEye::Count; eye++)
+			counts.add(this->passes[(int)pass][eye]);
+		return counts;
+	}
+
+	RenderCounts total() const
+	{
+		RenderCounts counts;
+		for (int i = 0; i < (int)RenderPass::Count; i++)
+			counts.add(this->pass((RenderPass)i));
+		return counts;
+	}
+};
+
+// Per frame counts of what the render thread asked of GL, kept by pass and eye.
+//
+// The draw paths, GLStateCache and the upload paths report into whichever pass is current, RenderPassScope sets
+// it around a pass the way ProfileScope times it. frame() is the frame being drawn and fills up as it goes, last()
+// the one before it, complete. Render thread only.
+class RenderStats
+{
+public:
+	RenderStats() {}
+
+	RenderStats(const RenderStats&) = delete;
+	RenderStats& operator=(const RenderStats&) = delete;
+
+	void beginFrame()
+	{
+		this->current = RenderFrameStats();
+		this->setPass(RenderPass::Other, RenderEye::Both);
+	}
+
+	void endFrame()
+	{
+		this->previous = this->current;
+	}
+
+	void setPass(RenderPass pass, RenderEye eye)
+	{
+		this->pass = pass;
+		this->eye = eye;
+		this->counts = &this->current.passes[(int)pass][(int)eye];
+	}
+	RenderPass currentPass() const { return this->pass; }
+	RenderEye currentEye() const { return this->eye; }
+
+	// A draw of count elements or vertices of mode, instances times
+	void draw(GLenum mode, GLsizei count, GLsizei instances = 1)
+	{
+		this->counts->draws++;
+		this->counts->instances += (uint32_t)instances;
+		const uint64_t total = (uint64_t)count * (uint64_t)instances;
+		this->counts->indices += total;
+		switch (mode)
+		{
+		case GL_TRIANGLES: this->counts->triangles += total / 3; break;
+		case GL_TRIANGLE_STRIP: case GL_TRIANGLE_FAN:
+			if (count > 2)
+				this->counts->triangles += (uint64_t)(count - 2) * (uint64_t)instances;
+			break;
+		}
+	}
+
+	void programBind() { this->counts->programBinds++; }
+	void vertexArrayBind() { this->counts->vertexArrayBinds++; }
+	void textureBind() { this->counts->textureBinds++; }
+	void uniforms(GLsizeiptr bytes) { this->counts->uniformBytes += (uint64_t)bytes; }
+	void uploaded(GLsizeiptr bytes) { this->counts->uploadBytes += (uint64_t)bytes; }
+	void culled(uint32_t count) { this->counts->culled += count; }
+
+	const RenderFrameStats& frame() const { return this->current; }
+	const RenderFrameStats& last() const { return this->previous; }
+
+private:
+	RenderFrameStats current;
+	RenderFrameStats previous;
+	RenderPass pass = RenderPass::Other;
+	RenderEye eye = RenderEye::Both;
+	RenderCounts* counts = &current.passes[0][(int)RenderEye::Both];
+};
+
+static RenderStats _renderStats;
+
+// Makes pass and eye current for its lifetime, then puts back whatever was
+class RenderPassScope
+{
+public:
+	RenderPassScope(RenderPass pass, RenderEye eye) : outerPass(_renderStats.currentPass()), outerEye(_renderStats.currentEye())
+	{
+		_renderStats.setPass(pass, eye);
+	}
+	~RenderPassScope()
+	{
+		_renderStats.setPass(this->outerPass, this->outerEye);
+	}
+
+	RenderPassScope(const RenderPassScope&) = delete;
+	RenderPassScope& operator=(const RenderPassScope&) = delete;
+
+private:
+	RenderPass outerPass;
+	RenderEye outerEye;
+};
@@ -0,0 +1,97 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <map>
+#include <memory>
+using namespace std;
+#include "shader.h"
+#include "model.h"
+#include "streaming.h"
+#include "hitchrecorder.h"
+
+// Owns models and shader programs for the lifetime of the app so that scenes can be torn down and
+// rebuilt (e.g. on a game reset) without re-importing meshes or recompiling programs.
+// Resources are keyed by their source path(s); asking twice returns the same shared handle.
+class ResourceRegistry
+{
+public:
+	// While _assets runs, the handle comes back at once holding a proxy box of proxyHalfExtent, and the
+	// real meshes replace it in place once the loader has them on the GPU. format, lodLevels, repeats and bake apply to the real meshes only.
+	shared_ptr<Model> model(const string& path, const string& name, float proxyHalfExtent = 1.0f, VertexFormat format = VertexFormat::Full,
+		uint32_t lodLevels = 1, RepeatedMeshes repeats = RepeatedMeshes::Separate, const LightBakeOptions& bake = LightBakeOptions())
+	{
+		auto found = this->models.find(path);
+		if (found != this->models.end())
+			return found->second;
+
+		if (!_assets.running())
+		{
+			shared_ptr<Model> model = make_shared<Model>(path.c_str(), name, MeshRetention::ReleaseCpuData, format, lodLevels, repeats, bake);
+			this->models[path] = model;
+			return model;
+		}
+
+		shared_ptr<Model> model = Model::proxy(name, proxyHalfExtent);
+		shared_ptr<Model> loaded = make_shared<Model>();
+		_assets.request([loaded, path, name, format, lodLevels, repeats, bake]()
+			{ *loaded = Model(path.c_str(), name, MeshRetention::ReleaseCpuData, format, lodLevels, repeats, bake); },
+			[model, loaded, path]() {
+				model->adopt(std::move(*loaded));
+				_hitchRecorder.note(HitchEventKind::Model, 0, path.c_str());
+			});
+		this->models[path] = model;
+		return model;
+	}
+
+	// Starts the variant building so that shader() only has to collect it, see Shader::beginBuild. Preparing every
+	// variant before asking for the first lets the driver compile them side by side.
+	void prepareShader(const string& vertexPath, const string& fragmentPath, const string& defines = string())
+	{
+		const string key = vertexPath + "|" + fragmentPath + "|" + defines;
+		if (this->shaders.count(key) || this->pendingShaders.count(key))
+			return;
+		this->pendingShaders[key] = Shader::beginBuild(vertexPath.c_str(), fragmentPath.c_str(), defines);
+	}
+
+	// defines selects a variant of the same sources, see Shader
+	shared_ptr<Shader> shader(const string& vertexPath, const string& fragmentPath, const string& defines = string())
+	{
+		const string key = vertexPath + "|" + fragmentPath + "|" + defines;
+		auto found = this->shaders.find(key);
+		if (found != this->shaders.end())
+			return found->second;
+
+		shared_ptr<Shader> shader;
+		auto pending = this->pendingShaders.find(key);
+		if (pending != this->pendingShaders.end())
+		{
+			shader = make_shared<Shader>(pending->second);
+			this->pendingShaders.erase(pending);
+		}
+		else
+		{
+			shader = make_shared<Shader>(vertexPath.c_str(), fragmentPath.c_str(), defines);
+		}
+		this->shaders[key] = shader;
+		return shader;
+	}
+
+	// Drops the registry's references, must be called while the GL context is still current
+	void clear()
+	{
+		this->models.clear();
+		this->shaders.clear();
+		// Prepared and never asked for
+		for (auto& pending : this->pendingShaders)
+		{
+			char infoLog[512];
+			glDeleteProgram(_finishProgramBuild(pending.second, sizeof(infoLog), infoLog));
+		}
+		this->pendingShaders.clear();
+	}
+
+private:
+	map<string, shared_ptr<Model>> models;
+	map<string, shared_ptr<Shader>> shaders;
+	map<string, ProgramBuild> pendingShaders;
+};
@@ -0,0 +1,87 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Model matrix of scale, then rotation, then translation, written straight into the columns rather than through
+// translate/rotate/scale each multiplying a full matrix. rotation must be unit length.
+static glm::mat4 _composeTransform(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	const float x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+	const float xx = x * x, yy = y * y, zz = z * z;
+	const float xy = x * y, xz = x * z, yz = y * z;
+	const float wx = w * x, wy = w * y, wz = w * z;
+	return glm::mat4(
+		(1.0f - 2.0f * (yy + zz)) * scale.x, 2.0f * (xy + wz) * scale.x, 2.0f * (xz - wy) * scale.x, 0.0f,
+		2.0f * (xy - wz) * scale.y, (1.0f - 2.0f * (xx + zz)) * scale.y, 2.0f * (yz + wx) * scale.y, 0.0f,
+		2.0f * (xz + wy) * scale.z, 2.0f * (yz - wx) * scale.z, (1.0f - 2.0f * (xx + yy)) * scale.z, 0.0f,
+		position.x, position.y, position.z, 1.0f);
+}
+
+// Parent of the nodes at the top of a TransformHierarchy
+static const int32_t TRANSFORM_ROOT = -1;
+
+// The scene's placed objects as a flat transform hierarchy. Every node keeps its position, rotation and scale
+// relative to its parent, world matrices are only recomputed for nodes changed since the last update() and
+// what hangs off them. Parents always come before their children, so one pass in index order sees every
+// parent's world matrix up to date before its children need it, and nodes are never removed.
+class TransformHierarchy
+{
+public:
+	// Returns the new node's index, parent must be TRANSFORM_ROOT or an earlier node
+	uint32_t add(int32_t parent, const glm::vec3& position, const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+		const glm::vec3& scale = glm::vec3(1.0f))
+	{
+		this->parents.push_back(parent < (int32_t)this->parents.size() ? parent : TRANSFORM_ROOT);
+		this->positions.push_back(position);
+		this->rotations.push_back(rotation);
+		this->scales.push_back(scale);
+		this->worlds.push_back(glm::mat4());
+		this->dirty.push_back(1);
+		return (uint32_t)this->parents.size() - 1;
+	}
+
+	void setPosition(uint32_t node, const glm::vec3& position) { this->positions[node] = position; this->dirty[node] = 1; }
+	void setRotation(uint32_t node, const glm::quat& rotation) { this->rotations[node] = rotation; this->dirty[node] = 1; }
+	void setScale(uint32_t node, const glm::vec3& scale) { this->scales[node] = scale; this->dirty[node] = 1; }
+
+	const glm::vec3& position(uint32_t node) const { return this->positions[node]; }
+
+	// As of the last update()
+	const glm::mat4& world(uint32_t node) const { return this->worlds[node]; }
+
+	size_t size() const { return this->parents.size(); }
+
+	// Brings the world matrices of changed nodes and their descendants up to date, returns how many were recomputed
+	uint32_t update()
+	{
+		uint32_t updated = 0;
+		for (size_t i = 0; i < this->parents.size(); i++)
+		{
+			const int32_t parent = this->parents[i];
+			// A recomputed parent stays flagged until the pass is through, which is what carries it down
+			if (parent != TRANSFORM_ROOT && this->dirty[parent])
+				this->dirty[i] = 1;
+			if (!this->dirty[i])
+				continue;
+			const glm::mat4 local = _composeTransform(this->positions[i], this->rotations[i], this->scales[i]);
+			this->worlds[i] = parent == TRANSFORM_ROOT ? local : this->worlds[parent] * local;
+			updated++;
+		}
+		std::fill(this->dirty.begin(), this->dirty.end(), (uint8_t)0);
+		return updated;
+	}
+
+private:
+	vector<int32_t> parents;
+	vector<glm::vec3> positions;
+	vector<glm::quat> rotations;
+	vector<glm::vec3> scales;
+	vector<glm::mat4> worlds;
+	vector<uint8_t> dirty;
+};
@@ -0,0 +1,357 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <mferror.h>
+#include <wrl/client.h>
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "framepipeline.h"
+#include "gldebug.h"
+#include "trace.h"
+#include "threading.h"
+
+// Readbacks that can be on the way at once, from glReadPixels via the GPU and the encoder to free again
+#define SESSION_RECORD_SLOTS 4
+#define SESSION_RECORD_QUEUE 8
+// Bits per second of the H.264 stream per pixel at 30 Hz, about 4 Mbit/s for the default 800x600 window
+#define SESSION_RECORD_BITS_PER_PIXEL 8
+
+// Times of one recorded frame, what the sidecar keeps next to the video
+struct RecordedFrameInfo
+{
+	uint64_t frame;
+	double seconds;
+	// The profiler's numbers are a few frames old, this is the frame they are of
+	uint64_t timedFrame;
+	float cpuMs;
+	float gpuMs;
+};
+
+// Records the desktop window into an H.264 .mp4 for QA, --record-session <file.mp4>.
+//
+// Each mirrored frame is read from the window's back buffer before the swap, asynchronously: glReadPixels goes into
+// one of SESSION_RECORD_SLOTS pixel pack buffers and fences, and a later frame hands the slot to the encoder thread
+// once the fence has passed, so the render thread never waits for the GPU. With ARB_buffer_storage the buffers stay
+// mapped and the encoder reads the pixels straight out of them; without it the render thread maps the buffer and
+// copies it out. The encoder thread feeds a Media Foundation sink writer with hardware transforms enabled, which
+// takes the GPU vendor's H.264 encoder (NVENC, AMF, Quick Sync) where the driver has one and the software one
+// elsewhere. Frames the encoder hasn't kept up with are dropped, not waited for.
+//
+// The profiler's frame times go into <file.mp4>.frames.csv, one line per recorded frame at the frame's
+// presentation time in the video; an .mp4 has nowhere to keep numbers of each sample.
+class SessionRecorder
+{
+public:
+	SessionRecorder() {}
+	~SessionRecorder()
+	{
+		this->close();
+	}
+
+	SessionRecorder(const SessionRecorder&) = delete;
+	SessionRecorder& operator=(const SessionRecorder&) = delete;
+
+	// With the context current. size is the window's, hz the rate frames are expected at.
+	bool open(const char* path, const glm::uvec2& size, float hz)
+	{
+		this->close();
+		// The encoder wants even sizes, an odd last row or column is left out
+		this->width = size.x & ~1u;
+		this->height = size.y & ~1u;
+		this->hz = hz > 0.0f ? hz : 30.0f;
+		if (!this->width || !this->height)
+			return false;
+		this->path = path;
+		this->persistent = GLEW_ARB_buffer_storage != 0;
+		const GLsizeiptr bytes = (GLsizeiptr)this->frameBytes();
+		for (int i = 0; i < SESSION_RECORD_SLOTS; i++)
+		{
+			Slot& slot = this->slots[i];
+			glGenBuffers(1, &slot.buffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+			_glLabel(GL_BUFFER, slot.buffer, "session readback");
+			if (this->persistent)
+			{
+				const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+				glBufferStorage(GL_PIXEL_PACK_BUFFER, bytes, NULL, flags);
+				slot.pixels = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, flags);
+			}
+			else
+			{
+				glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+				slot.copy.resize((size_t)bytes);
+				slot.pixels = slot.copy.data();
+			}
+			slot.state.store(SlotFree, std::memory_order_relaxed);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		this->stopping = false;
+		this->failed = false;
+		this->encoder = std::thread([this]() { this->run(); });
+		return true;
+	}
+
+	// With the context current, after the last capture(). Whatever is still on the GPU is lost.
+	void close()
+	{
+		if (this->encoder.joinable())
+		{
+			this->stopping = true;
+			this->encoder.join();
+		}
+		for (int i = 0; i < SESSION_RECORD_SLOTS; i++)
+		{
+			Slot& slot = this->slots[i];
+			if (slot.fence)
+				glDeleteSync(slot.fence);
+			slot.fence = 0;
+			if (slot.buffer)
+			{
+				if (this->persistent)
+				{
+					glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+					glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+					glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+				}
+				glDeleteBuffers(1, &slot.buffer);
+			}
+			slot.buffer = 0;
+			slot.pixels = nullptr;
+			slot.copy.clear();
+		}
+	}
+
+	bool recording() const { return this->encoder.joinable() && !this->failed; }
+
+	// Render thread, every frame: slots whose readback has landed go to the encoder
+	void poll()
+	{
+		if (!this->recording())
+			return;
+		for (int i = 0; i < SESSION_RECORD_SLOTS; i++)
+		{
+			const int index = (this->next + i) % SESSION_RECORD_SLOTS;
+			Slot& slot = this->slots[index];
+			if (!slot.fence)
+				continue;
+			if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+				continue;
+			glDeleteSync(slot.fence);
+			slot.fence = 0;
+			if (!this->persistent)
+			{
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+				const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)this->frameBytes(), GL_MAP_READ_BIT);
+				if (mapped)
+					memcpy(slot.copy.data(), mapped, this->frameBytes());
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			}
+			slot.state.store(SlotEncoding, std::memory_order_release);
+			if (!this->queue.push((uint32_t)index))
+				slot.state.store(SlotFree, std::memory_order_release);
+		}
+	}
+
+	// Render thread, with the window's back buffer holding the mirrored frame: starts reading it back. Dropped when
+	// every slot is still busy.
+	void capture(const RecordedFrameInfo& info)
+	{
+		if (!this->recording())
+			return;
+		Slot& slot = this->slots[this->next];
+		if (slot.fence || slot.state.load(std::memory_order_acquire) != SlotFree)
+		{
+			this->droppedFrames++;
+			return;
+		}
+		slot.info = info;
+		slot.state.store(SlotReading, std::memory_order_relaxed);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glReadBuffer(GL_BACK);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		// BGRA is what the window's format is and what Media Foundation's RGB32 is, so the driver copies it as is
+		glReadPixels(0, 0, this->width, this->height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		this->next = (this->next + 1) % SESSION_RECORD_SLOTS;
+	}
+
+	// Frames the render thread had no free slot for so far
+	uint32_t dropped() const { return this->droppedFrames; }
+
+private:
+	enum SlotState { SlotFree, SlotReading, SlotEncoding };
+
+	struct Slot
+	{
+		GLuint buffer = 0;
+		GLsync fence = 0;
+		const uint8_t* pixels = nullptr;
+		// Where the pixels are copied to without ARB_buffer_storage
+		vector<uint8_t> copy;
+		RecordedFrameInfo info;
+		// Handed back and forth between the render thread and the encoder
+		std::atomic<int> state{ SlotFree };
+	};
+
+	size_t frameBytes() const { return (size_t)this->width * this->height * 4; }
+
+	void run()
+	{
+		using Microsoft::WRL::ComPtr;
+		TRACE_THREAD("session recorder");
+		_threadPolicy.apply(ThreadRole::Background);
+		// Media Foundation is COM, like WIC in texturecache.h
+		const HRESULT apartment = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+		ComPtr<IMFSinkWriter> writer;
+		DWORD stream = 0;
+		FILE* sidecar = nullptr;
+		if (FAILED(MFStartup(MF_VERSION)))
+		{
+			std::cout << "ERROR::SESSION_RECORD::MEDIA_FOUNDATION_UNAVAILABLE" << std::endl;
+			this->failed = true;
+		}
+		else if (!this->createWriter(writer.GetAddressOf(), &stream))
+		{
+			std::cout << "ERROR::SESSION_RECORD::WRITER_NOT_CREATED " << this->path << std::endl;
+			writer.Reset();
+			this->failed = true;
+		}
+		else
+		{
+			sidecar = fopen((this->path + ".frames.csv").c_str(), "w");
+			if (sidecar)
+				fprintf(sidecar, "frame,video_seconds,timed_frame,cpu_ms,gpu_ms\n");
+		}
+
+		double firstSeconds = -1.0;
+		uint32_t index;
+		for (;;)
+		{
+			if (!this->queue.pop(&index))
+			{
+				if (this->stopping)
+					break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+				continue;
+			}
+			Slot& slot = this->slots[index];
+			if (writer.Get())
+			{
+				if (firstSeconds < 0.0)
+					firstSeconds = slot.info.seconds;
+				const double videoSeconds = slot.info.seconds - firstSeconds;
+				if (this->writeFrame(writer.Get(), stream, slot.pixels, videoSeconds) && sidecar)
+					fprintf(sidecar, "%llu,%.6f,%llu,%.3f,%.3f\n", (unsigned long long)slot.info.frame, videoSeconds,
+						(unsigned long long)slot.info.timedFrame, slot.info.cpuMs, slot.info.gpuMs);
+			}
+			slot.state.store(SlotFree, std::memory_order_release);
+		}
+
+		if (writer.Get() && FAILED(writer->Finalize()))
+			std::cout << "ERROR::SESSION_RECORD::FINALIZE_FAILED " << this->path << std::endl;
+		writer.Reset();
+		if (sidecar)
+			fclose(sidecar);
+		MFShutdown();
+		if (SUCCEEDED(apartment))
+			CoUninitialize();
+	}
+
+	bool createWriter(IMFSinkWriter** writer, DWORD* stream)
+	{
+		using Microsoft::WRL::ComPtr;
+		int wideLength = MultiByteToWideChar(CP_UTF8, 0, this->path.c_str(), -1, nullptr, 0);
+		if (wideLength <= 0)
+			return false;
+		vector<WCHAR> widePath(wideLength);
+		MultiByteToWideChar(CP_UTF8, 0, this->path.c_str(), -1, widePath.data(), wideLength);
+
+		ComPtr<IMFAttributes> attributes;
+		if (FAILED(MFCreateAttributes(&attributes, 2)) ||
+			FAILED(attributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE)) ||
+			FAILED(attributes->SetUINT32(MF_SINK_WRITER_DISABLE_THROTTLING, TRUE)) ||
+			FAILED(MFCreateSinkWriterFromURL(widePath.data(), nullptr, attributes.Get(), writer)))
+		{
+			return false;
+		}
+
+		const UINT32 rate = (UINT32)(this->hz + 0.5f);
+		ComPtr<IMFMediaType> output;
+		ComPtr<IMFMediaType> input;
+		return SUCCEEDED(MFCreateMediaType(&output)) &&
+			SUCCEEDED(output->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video)) &&
+			SUCCEEDED(output->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264)) &&
+			SUCCEEDED(output->SetUINT32(MF_MT_AVG_BITRATE, (UINT32)(this->width * this->height * SESSION_RECORD_BITS_PER_PIXEL * this->hz / 30.0f))) &&
+			SUCCEEDED(output->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive)) &&
+			SUCCEEDED(MFSetAttributeSize(output.Get(), MF_MT_FRAME_SIZE, this->width, this->height)) &&
+			SUCCEEDED(MFSetAttributeRatio(output.Get(), MF_MT_FRAME_RATE, rate, 1)) &&
+			SUCCEEDED(MFSetAttributeRatio(output.Get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1)) &&
+			SUCCEEDED((*writer)->AddStream(output.Get(), stream)) &&
+			SUCCEEDED(MFCreateMediaType(&input)) &&
+			SUCCEEDED(input->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video)) &&
+			SUCCEEDED(input->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32)) &&
+			SUCCEEDED(input->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive)) &&
+			// glReadPixels rows run bottom up, which a negative stride says
+			SUCCEEDED(input->SetUINT32(MF_MT_DEFAULT_STRIDE, (UINT32)-(INT32)(this->width * 4))) &&
+			SUCCEEDED(MFSetAttributeSize(input.Get(), MF_MT_FRAME_SIZE, this->width, this->height)) &&
+			SUCCEEDED(MFSetAttributeRatio(input.Get(), MF_MT_FRAME_RATE, rate, 1)) &&
+			SUCCEEDED(MFSetAttributeRatio(input.Get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1)) &&
+			SUCCEEDED((*writer)->SetInputMediaType(*stream, input.Get(), nullptr)) &&
+			SUCCEEDED((*writer)->BeginWriting());
+	}
+
+	bool writeFrame(IMFSinkWriter* writer, DWORD stream, const uint8_t* pixels, double videoSeconds)
+	{
+		using Microsoft::WRL::ComPtr;
+		const DWORD bytes = (DWORD)this->frameBytes();
+		ComPtr<IMFMediaBuffer> buffer;
+		ComPtr<IMFSample> sample;
+		BYTE* data = nullptr;
+		if (FAILED(MFCreateMemoryBuffer(bytes, &buffer)) || FAILED(buffer->Lock(&data, nullptr, nullptr)))
+			return false;
+		memcpy(data, pixels, bytes);
+		buffer->Unlock();
+		// Media Foundation's clock runs in 100 ns units
+		return SUCCEEDED(buffer->SetCurrentLength(bytes)) &&
+			SUCCEEDED(MFCreateSample(&sample)) &&
+			SUCCEEDED(sample->AddBuffer(buffer.Get())) &&
+			SUCCEEDED(sample->SetSampleTime((LONGLONG)(videoSeconds * 1e7))) &&
+			SUCCEEDED(sample->SetSampleDuration((LONGLONG)(1e7 / this->hz))) &&
+			SUCCEEDED(writer->WriteSample(stream, sample.Get()));
+	}
+
+	std::string path;
+	GLsizei width = 0;
+	GLsizei height = 0;
+	float hz = 30.0f;
+	bool persistent = false;
+	Slot slots[SESSION_RECORD_SLOTS];
+	// The render thread's alone
+	int next = 0;
+	uint32_t droppedFrames = 0;
+	SpscQueue<uint32_t, SESSION_RECORD_QUEUE> queue;
+	std::thread encoder;
+	std::atomic<bool> stopping{ false };
+	std::atomic<bool> failed{ false };
+};
+
+static SessionRecorder _sessionRecorder;
@@ -0,0 +1,87 @@
+#pragma once
+// Std. Includes
+#include <chrono>
+#include <cstdint>
+#include <thread>
+using namespace std;
+// OVR Includes
+#include <OVR_CAPI.h>
+#include "benchhmd.h"
+
+// Milliseconds an idle frame sleeps before polling the session again, the most a headset put back on waits
+#define SESSION_IDLE_POLL_MS 50
+// Seconds idle before the eye targets are given back, so lifting the headset for a moment reallocates nothing
+#define SESSION_IDLE_RELEASE_SECONDS 30.0
+
+// Why the frames are or aren't drawn
+enum class SessionActivity
+{
+	Active,
+	// The app is visible but nobody has the HMD on
+	Unmounted,
+	// Another app or the runtime's own UI has the HMD
+	Hidden,
+};
+
+// RiftApp's reading of ovrSessionStatus, polled at the top of every frame.
+//
+// Frames are only worth drawing while the app is visible in the HMD and someone is wearing it. Otherwise the app
+// is idle: the frame polls and sleeps SESSION_IDLE_POLL_MS, the simulation and the molecules' spawning stand
+// still, and no eye buffer is drawn or submitted. An idle stretch that lasts SESSION_IDLE_RELEASE_SECONDS gives
+// the render graph's targets back once, see releaseDue(). The first poll that finds the app visible and the HMD
+// on resumes drawing that same frame, with no catch-up: the time spent idle never reaches the simulation.
+//
+// ShouldQuit asks the app to close, whether idle or not.
+class SessionMonitor
+{
+public:
+	SessionMonitor() {}
+
+	SessionMonitor(const SessionMonitor&) = delete;
+	SessionMonitor& operator=(const SessionMonitor&) = delete;
+
+	// True when idle() changed, activity() has why. A failed poll leaves everything as it was.
+	bool poll(ovrSession session, double seconds)
+	{
+		ovrSessionStatus status;
+		if (!OVR_SUCCESS(_hmdGetSessionStatus(session, &status)))
+			return false;
+		this->quit = status.ShouldQuit != ovrFalse;
+		const bool wasIdle = this->idle();
+		this->current = !status.IsVisible ? SessionActivity::Hidden
+			: !status.HmdMounted ? SessionActivity::Unmounted : SessionActivity::Active;
+		if (!wasIdle && this->idle())
+		{
+			this->idleSince = seconds;
+			this->released = false;
+		}
+		return wasIdle != this->idle();
+	}
+
+	SessionActivity activity() const { return this->current; }
+	bool idle() const { return this->current != SessionActivity::Active; }
+	bool shouldQuit() const { return this->quit; }
+
+	// An idle frame's whole work
+	void wait() const
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(SESSION_IDLE_POLL_MS));
+	}
+
+	// True once an idle stretch, when it has lasted SESSION_IDLE_RELEASE_SECONDS
+	bool releaseDue(double seconds)
+	{
+		if (!this->idle() || this->released || seconds - this->idleSince < SESSION_IDLE_RELEASE_SECONDS)
+			return false;
+		this->released = true;
+		return true;
+	}
+
+private:
+	SessionActivity current = SessionActivity::Active;
+	double idleSince = 0.0;
+	bool released = false;
+	bool quit = false;
+};
+
+static SessionMonitor _sessionMonitor;
@@ -14,32 +14,350 @@ struct Light {
     vec3 specular;
 };
 
-in vec3 FragPos;  
-in vec3 vertNormal;  
+// HALF_PRECISION: the lighting's directions, terms and colours in the 16 bit floats of the #extension the app puts
+// ahead of it, see _halfPrecisionDefine. Positions, depths, texture coordinates and the specular power stay 32 bit.
+// Without it the 16 bit types are plain floats.
+#ifndef HALF_PRECISION
+#define float16_t float
+#define f16vec3 vec3
+#endif
+
+#ifdef SPHERE_IMPOSTOR
+// From impostor.vert, castImpostor() fills in what the mesh programs interpolate
+in vec3 impostorPoint;
+flat in vec4 impostorSphere;
+flat in vec3 impostorEye;
+flat in vec4 impostorClipZ;
+flat in vec4 impostorClipW;
+flat in vec3 atomDiffuse;
+// Clip depth runs 0..1 with glClipControl, -1..1 otherwise
+uniform bool depthZeroToOne;
+vec3 WorldPos;
+vec3 WorldNormal;
+#elif defined(MOLECULE_BILLBOARD)
+// From billboard.vert, sampleBillboard() fills in the normal from the atlas
+in vec3 WorldPos;
+in vec2 atlasCoord;
+flat in mat3 cardBasis;
+uniform sampler2D billboardColor;
+uniform sampler2D billboardNormal;
+vec3 WorldNormal;
+#elif defined(PARTICLE)
+// From particle.vert, unlit
+in vec4 particleColor;
+in vec2 particleCorner;
+vec3 WorldPos;
+vec3 WorldNormal;
+#elif defined(LASER_BEAM)
+// From beam.vert, unlit
+in vec4 beamTint;
+in vec2 beamCoord;
+vec3 WorldPos;
+vec3 WorldNormal;
+#else
+in vec3 WorldPos;
+in vec3 WorldNormal;
+#endif
+#ifdef BILLBOARD_FADE
+// How far the molecule is into the crossfade from its meshes to its billboard, 0 to 1
+flat in float billboardFade;
+#endif
+#ifdef BAKED_LIGHTING
+// See _packLightBake: the ambient occlusion, the scene light's Lambert term with its shadow, and its visibility
+in vec4 vertBake;
+#endif
+  
+#ifdef VIRTUAL_TEXTURE
+// The mesh's virtual texture, see VirtualTexture: the resident pages, and the page table with a mip per level.
+// virtualScale is the image's share of the square the pages cover, virtualPageLayout the page size, its border and
+// the physical texture's size in texels. Meshes without one draw with virtualTextured off.
+in vec2 vertTexCoords;
+uniform bool virtualTextured;
+uniform sampler2D virtualPages;
+uniform usampler2D virtualTable;
+uniform vec2 virtualScale;
+uniform int virtualPagesWide;
+uniform int virtualLevels;
+uniform int virtualSlot;
+uniform vec3 virtualPageLayout;
+// The feedback pass only: how much larger the eye target is than the feedback target
+uniform float virtualFeedbackScale = 1.0;
+#endif
   
+#ifdef BILLBOARD_BAKE
+// MoleculeBillboards' atlases: diffuse with coverage, and the normal in the baked camera's space
+layout(location = 0) out vec4 color;
+layout(location = 1) out vec4 bakedNormal;
+#elif defined(VIRTUAL_TEXTURE_FEEDBACK)
+// VirtualTextureCache's feedback, the page each pixel wants
+out uint feedback;
+#else
 out vec4 color;
+#endif
   
 uniform vec3 viewPos;
+#ifdef STATIC_BATCH
+// Every material of a merged model, bound by StaticBatch::draw, or of the molecules' parts by MoleculeArena::draw
+layout(std140) uniform StaticBatchMaterials
+{
+	Material batchMaterials[STATIC_BATCH_MAX_MATERIALS];
+};
+flat in int vertMaterial;
+#define material batchMaterials[vertMaterial]
+#elif defined(SPHERE_IMPOSTOR) || defined(MOLECULE_BILLBOARD)
+// The atom's put together by castImpostor(), or the atlas texel's by sampleBillboard()
+Material material;
+#else
 uniform Material material;
+#endif
+// The scene light. The app bakes it in as the SCENE_LIGHT_* constants (SCENE_LIGHT_DEFINE) for the programs that
+// draw the scene, the rest take it as uniforms.
+#ifdef SCENE_LIGHT_POSITION
+const Light light = Light(SCENE_LIGHT_POSITION, SCENE_LIGHT_AMBIENT, SCENE_LIGHT_DIFFUSE, SCENE_LIGHT_SPECULAR);
+#else
 uniform Light light;
+#endif
+
+// The lighting model, the cheapest that draws the material right (see LightingModel): LIGHTING_UNLIT the ambient
+// term alone, LIGHTING_LAMBERT ambient and diffuse without the specular power, Phong with neither defined
+
+// Point lights sorted into the clusters of one camera, see ClusteredLights. The array length is CLUSTER_MAX_LIGHTS.
+struct PointLight {
+    vec4 positionRange;
+    vec4 color;
+};
+layout(std140) uniform ClusterLights
+{
+    PointLight pointLights[256];
+};
+// Per cluster offset and count into clusterIndices
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform mat4 clusterView;
+// x / -z and y / -z the grid spans: min x, max x, min y, max y
+uniform vec4 clusterTangents;
+uniform ivec3 clusterSize;
+// Near plane of the slices and log(far / near)
+uniform vec2 clusterDepth;
+// 0 without any lights, the grid is then left alone
+uniform int clusterLightCount;
+// The depth pre-pass: color writes are masked, so skip the lighting
+uniform bool depthOnly;
 
+// The scene light's shadows, see ShadowMaps: the factory's cached map and the molecules' redrawn one. The lookups
+// take a world position to each map's coordinates and reference depth. Off until both maps have been drawn.
+uniform bool shadowsEnabled;
+uniform sampler2DShadow shadowStatic;
+uniform sampler2DShadow shadowDynamic;
+uniform mat4 shadowStaticLookup;
+uniform mat4 shadowDynamicLookup;
+
+// 1 where the scene light reaches the fragment, 0 where either map has something nearer to it. The bake has the
+// static map's shadows in it already.
+float lightVisibility()
+{
+    if (!shadowsEnabled)
+        return 1.0;
+    float visibility = textureProj(shadowDynamic, shadowDynamicLookup * vec4(WorldPos, 1.0));
+#ifndef BAKED_LIGHTING
+    visibility *= textureProj(shadowStatic, shadowStaticLookup * vec4(WorldPos, 1.0));
+#endif
+    return visibility;
+}
+
+// The lights of the fragment's cluster, ClusteredLights::assign maps positions the same way
+vec3 clusterLighting(vec3 norm, vec3 viewDir)
+{
+    vec3 p = (clusterView * vec4(WorldPos, 1.0)).xyz;
+    float depth = max(-p.z, clusterDepth.x);
+    vec2 tile = floor((p.xy / depth - clusterTangents.xz) / (clusterTangents.yw - clusterTangents.xz) * vec2(clusterSize.xy));
+    float slice = floor(log(depth / clusterDepth.x) / clusterDepth.y * float(clusterSize.z));
+    ivec3 c = clamp(ivec3(ivec2(tile), int(slice)), ivec3(0), clusterSize - 1);
+    uvec2 cell = texelFetch(clusterGrid, (c.z * clusterSize.y + c.y) * clusterSize.x + c.x).xy;
+    f16vec3 n = f16vec3(norm);
+    f16vec3 result = f16vec3(0.0);
+    for (uint i = 0u; i < cell.y; i++)
+    {
+        PointLight point = pointLights[texelFetch(clusterIndices, int(cell.x + i)).x];
+        vec3 toLight = point.positionRange.xyz - WorldPos;
+        float d = length(toLight);
+        float16_t falloff = float16_t(clamp(1.0 - d / point.positionRange.w, 0.0, 1.0));
+        f16vec3 dir = f16vec3(toLight / max(d, 0.0001));
+        float16_t diff = max(dot(n, dir), float16_t(0.0));
+#ifdef LIGHTING_LAMBERT
+        result += f16vec3(point.color.rgb) * (float16_t(point.color.w) * falloff * falloff) * (diff * f16vec3(material.diffuse));
+#else
+        float16_t spec = float16_t(pow(float(max(dot(f16vec3(viewDir), reflect(-dir, n)), float16_t(0.0))), material.shininess));
+        result += f16vec3(point.color.rgb) * (float16_t(point.color.w) * falloff * falloff) * (diff * f16vec3(material.diffuse) + spec * f16vec3(material.specular));
+#endif
+    }
+    return vec3(result);
+}
+
+#ifdef SPHERE_IMPOSTOR
+// The nearest point of the sphere along the eye's ray through this fragment, with its depth. The quad covers the
+// sphere's silhouette, the fragments around it miss.
+void castImpostor()
+{
+    vec3 ray = normalize(impostorPoint - impostorEye);
+    vec3 fromCentre = impostorEye - impostorSphere.xyz;
+    float b = dot(fromCentre, ray);
+    float h = b * b - (dot(fromCentre, fromCentre) - impostorSphere.w * impostorSphere.w);
+    if (h < 0.0)
+        discard;
+    vec3 hit = impostorEye + ray * (-b - sqrt(h));
+    vec3 normal = (hit - impostorSphere.xyz) / impostorSphere.w;
+    WorldPos = hit;
+    WorldNormal = normal;
+    float depth = dot(impostorClipZ, vec4(hit, 1.0)) / dot(impostorClipW, vec4(hit, 1.0));
+    gl_FragDepth = depthZeroToOne ? depth : depth * 0.5 + 0.5;
+    // As Mesh binds the molecules' own materials
+    material = Material(vec3(1.0), atomDiffuse, vec3(0.5), 50.0);
+}
+#endif
+
+#ifdef BILLBOARD_FADE
+// Per pixel threshold the meshes and the billboard dither against, one drawn exactly where the other isn't
+float fadeThreshold()
+{
+    return fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+}
+#endif
+
+#ifdef MOLECULE_BILLBOARD
+void sampleBillboard()
+{
+    vec4 albedo = texture(billboardColor, atlasCoord);
+    if (albedo.a < 0.5 || billboardFade <= fadeThreshold())
+        discard;
+    WorldNormal = normalize(cardBasis * (texture(billboardNormal, atlasCoord).xyz * 2.0 - 1.0));
+    // As Mesh binds the molecules' own materials, but for the diffuse the atlas has
+    material = Material(vec3(1.0), albedo.rgb, vec3(0.5), 96.0);
+}
+#endif
+
+#ifdef VIRTUAL_TEXTURE
+// The level whose texels are about the size of the fragment's pixels, scale larger for a smaller target
+float virtualLevel(vec2 uv, float scale)
+{
+    vec2 texels = uv * float(virtualPagesWide) * (virtualPageLayout.x - 2.0 * virtualPageLayout.y);
+    vec2 dx = dFdx(texels) * scale;
+    vec2 dy = dFdy(texels) * scale;
+    return clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0, float(virtualLevels - 1));
+}
+
+// From the finest resident page at or above the level wanted, white until even the top page is in
+vec4 sampleVirtual()
+{
+    vec2 uv = clamp(vertTexCoords * virtualScale, vec2(0.0), vec2(0.99999));
+    for (int level = int(virtualLevel(uv, 1.0)); level < virtualLevels; level++)
+    {
+        vec2 page = uv * float(virtualPagesWide >> level);
+        uvec4 entry = texelFetch(virtualTable, ivec2(page), level);
+        if (entry.b != 0u)
+        {
+            vec2 texel = vec2(entry.rg) * virtualPageLayout.x + virtualPageLayout.y + fract(page) * (virtualPageLayout.x - 2.0 * virtualPageLayout.y);
+            return textureLod(virtualPages, texel / virtualPageLayout.z, 0.0);
+        }
+    }
+    return vec4(1.0);
+}
+#endif
+
+// c as the eye buffer stores it. The lighting works on display values as it always has, a linear eye buffer takes
+// them decoded.
+vec3 eyeColor(vec3 c)
+{
+#ifdef LINEAR_EYE_BUFFER
+    return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), step(vec3(0.04045), c));
+#else
+    return c;
+#endif
+}
+
+#ifdef VIRTUAL_TEXTURE_FEEDBACK
+// The page wanted, as VirtualTextureCache reads it back: x, y, level and texture from the low bits up, 12, 12, 4, 4
+void main()
+{
+    vec2 uv = clamp(vertTexCoords * virtualScale, vec2(0.0), vec2(0.99999));
+    int level = int(virtualLevel(uv, virtualFeedbackScale));
+    uvec2 page = uvec2(uv * float(virtualPagesWide >> level));
+    feedback = virtualTextured ? page.x | (page.y << 12) | (uint(level) << 24) | (uint(virtualSlot) << 28) : 0u;
+}
+#elif defined(PARTICLE)
+// A soft round spark, GpuParticles::draw adds it onto what is behind
+void main()
+{
+    float falloff = 1.0 - dot(particleCorner, particleCorner);
+    if (falloff <= 0.0)
+        discard;
+    color = vec4(eyeColor(particleColor.rgb), particleColor.a * falloff * falloff);
+}
+#elif defined(LASER_BEAM)
+// A white hot core in the hand's colour, paling towards the end like the old lines; LaserBeams::draw adds it on
+void main()
+{
+    float core = 1.0 - beamCoord.x * beamCoord.x;
+    color = vec4(eyeColor(mix(beamTint.rgb, vec3(1.0), beamCoord.y * 0.5 + core * core * 0.5)), beamTint.a * core);
+}
+#else
 void main()
 {
+#ifdef SPHERE_IMPOSTOR
+    castImpostor();
+#elif defined(MOLECULE_BILLBOARD)
+    sampleBillboard();
+#elif defined(BILLBOARD_FADE)
+    if (billboardFade > fadeThreshold())
+        discard;
+#endif
+#ifdef BILLBOARD_BAKE
+    color = vec4(material.diffuse, 1.0);
+    bakedNormal = vec4(normalize(WorldNormal) * 0.5 + 0.5, 1.0);
+    return;
+#endif
+    if (depthOnly)
+    {
+        color = vec4(0.0);
+        return;
+    }
+#ifdef VIRTUAL_TEXTURE
+    vec3 albedo = virtualTextured ? sampleVirtual().rgb : vec3(1.0);
+#else
+    vec3 albedo = vec3(1.0);
+#endif
+
+#ifdef BAKED_LIGHTING
+    // The scene light as baked, no specular: nothing is worked out per fragment but the molecules' shadow
+    vec3 result = (light.ambient * material.ambient * vertBake.r + light.diffuse * material.diffuse * (vertBake.g * lightVisibility())) * albedo;
+#elif defined(LIGHTING_UNLIT)
+    // No diffuse or specular to light, from the scene light or the point lights: the ambient term is all there is
+    color = vec4(eyeColor(light.ambient * material.ambient * albedo), 1.0f);
+    return;
+#else
     // Ambient
-    vec3 ambient = light.ambient * material.ambient;
+    f16vec3 ambient = f16vec3(light.ambient * material.ambient * albedo);
   	
     // Diffuse 
-    vec3 norm = normalize(vertNormal);
-    vec3 lightDir = normalize(light.position - FragPos);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * (diff * material.diffuse);
+    f16vec3 norm = f16vec3(normalize(WorldNormal));
+    f16vec3 lightDir = f16vec3(normalize(light.position - WorldPos));
+    float16_t diff = max(dot(norm, lightDir), float16_t(0.0));
+    f16vec3 diffuse = f16vec3(light.diffuse) * (diff * f16vec3(material.diffuse * albedo));
+#ifdef LIGHTING_LAMBERT
+    vec3 result = vec3(ambient + diffuse * float16_t(lightVisibility()));
+#else
     
-    // Specular
-    vec3 viewDir = normalize(viewPos - FragPos);
-    vec3 reflectDir = reflect(-lightDir, norm);  
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * (spec * material.specular);  
+    // Specular, its power at 32 bits: the highlight of a shininess of a hundred would band at 16
+    f16vec3 viewDir = f16vec3(normalize(viewPos - WorldPos));
+    f16vec3 reflectDir = reflect(-lightDir, norm);  
+    float16_t spec = float16_t(pow(float(max(dot(viewDir, reflectDir), float16_t(0.0))), material.shininess));
+    f16vec3 specular = f16vec3(light.specular) * (spec * f16vec3(material.specular));  
         
-    vec3 result = ambient + diffuse + specular;
-    color = vec4(result, 1.0f);
-} 
\ No newline at end of file
+    vec3 result = vec3(ambient + (diffuse + specular) * float16_t(lightVisibility()));
+#endif
+#endif
+    if (clusterLightCount > 0)
+        result += clusterLighting(normalize(WorldNormal), normalize(viewPos - WorldPos));
+    color = vec4(eyeColor(result), 1.0f);
+}
+#endif 
\ No newline at end of file
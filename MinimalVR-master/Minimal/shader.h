@@ -5,8 +5,31 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
 
 #include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "programcache.h"
+#include "glstate.h"
+#include "assetpack.h"
+
+// FNV-1a hash of a uniform name, usable at compile time
+inline constexpr uint32_t _uniformHash(const char* name, uint32_t hash = 2166136261u)
+{
+	return *name ? _uniformHash(name + 1, (hash ^ (uint8_t)*name) * 16777619u) : hash;
+}
+
+// A resolved uniform slot inside a Shader, cheaper to use than the name in hot loops
+struct UniformHandle
+{
+	int slot = -1;
+	bool valid() const { return slot >= 0; }
+};
 
 class Shader
 {
@@ -14,7 +37,27 @@ public:
 	GLuint Program;
 	// Constructor generates the shader on the fly
 	Shader() {}
-	Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
+	// defines, if given, are inserted right after the #version line of both stages to build shader variants
+	Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const std::string& defines = std::string())
+		: Shader(beginBuild(vertexPath, fragmentPath, defines))
+	{
+	}
+	// Collects a build started by beginBuild(), waiting for it if the driver isn't through with it yet
+	explicit Shader(ProgramBuild build)
+	{
+		char infoLog[512];
+		this->Program = _finishProgramBuild(build, sizeof(infoLog), infoLog);
+		if (!this->Program)
+		{
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+			return;
+		}
+		this->reflectUniforms();
+	}
+
+	// Reads both sources and hands them to the driver, or loads the program linked on an earlier run if the driver
+	// still takes it. Builds begun back to back compile side by side where the driver can.
+	static ProgramBuild beginBuild(const GLchar* vertexPath, const GLchar* fragmentPath, const std::string& defines = std::string())
 	{
 		// 1. Retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
@@ -24,75 +67,206 @@ public:
 		// ensures ifstream objects can throw exceptions:
 		vShaderFile.exceptions(std::ifstream::badbit);
 		fShaderFile.exceptions(std::ifstream::badbit);
-		try
+		// Both out of the asset pack if it has them, otherwise both from disk
+		AssetSpan vPacked, fPacked;
+		if (_assetPack.find(vertexPath, &vPacked) && _assetPack.find(fragmentPath, &fPacked))
 		{
-			// Open files
-			vShaderFile.open(vertexPath);
-			fShaderFile.open(fragmentPath);
-			std::stringstream vShaderStream, fShaderStream;
-			// Read file's buffer contents into streams
-			vShaderStream << vShaderFile.rdbuf();
-			fShaderStream << fShaderFile.rdbuf();
-			// close file handlers
-			vShaderFile.close();
-			fShaderFile.close();
-			// Convert stream into string
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
+			vertexCode.assign((const char*)vPacked.data, vPacked.size);
+			fragmentCode.assign((const char*)fPacked.data, fPacked.size);
 		}
-		catch (std::ifstream::failure e)
+		else
 		{
-			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+			try
+			{
+				// Open files
+				vShaderFile.open(vertexPath);
+				fShaderFile.open(fragmentPath);
+				std::stringstream vShaderStream, fShaderStream;
+				// Read file's buffer contents into streams
+				vShaderStream << vShaderFile.rdbuf();
+				fShaderStream << fShaderFile.rdbuf();
+				// close file handlers
+				vShaderFile.close();
+				fShaderFile.close();
+				// Convert stream into string
+				vertexCode = vShaderStream.str();
+				fragmentCode = fShaderStream.str();
+			}
+			catch (std::ifstream::failure e)
+			{
+				std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+			}
 		}
-		const GLchar* vShaderCode = vertexCode.c_str();
-		const GLchar * fShaderCode = fragmentCode.c_str();
-		// 2. Compile shaders
-		GLuint vertex, fragment;
-		GLint success;
-		GLchar infoLog[512];
-		// Vertex Shader
-		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
-		glCompileShader(vertex);
-		// Print compile errors if any
-		glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-		if (!success)
+		if (!defines.empty())
 		{
-			glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+			_insertDefines(vertexCode, defines);
+			_insertDefines(fragmentCode, defines);
 		}
-		// Fragment Shader
-		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
-		glCompileShader(fragment);
-		// Print compile errors if any
-		glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-		if (!success)
+		return _beginProgramBuild(vertexCode.c_str(), fragmentCode.c_str());
+	}
+	// Uses the current shader
+	void Use()
+	{
+		_glState.useProgram(this->Program);
+	}
+
+	// Points a uniform block at a binding, blocks the program doesn't have are ignored
+	void bindUniformBlock(const char* name, GLuint binding)
+	{
+		GLuint index = glGetUniformBlockIndex(this->Program, name);
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(this->Program, index, binding);
+	}
+
+	// Looks up a uniform by name in the table built after link, no GL call involved
+	UniformHandle uniform(const char* name) const
+	{
+		UniformHandle handle;
+		if (!this->uniforms)
+			return handle;
+		auto found = this->uniforms->lookup.find(_uniformHash(name));
+		if (found != this->uniforms->lookup.end() && this->uniforms->slots[found->second].name == name)
+			handle.slot = (int)found->second;
+		return handle;
+	}
+
+	GLint location(const char* name) const
+	{
+		UniformHandle handle = this->uniform(name);
+		return handle.valid() ? this->uniforms->slots[handle.slot].location : -1;
+	}
+
+	// Typed setters. The program must be current (Use()) and values equal to the last upload are skipped.
+	// Uniforms that aren't active in the program are ignored, same as glUniform* with location -1.
+	void set(UniformHandle handle, GLint value) { if (this->changed(handle, GL_INT, &value, sizeof(value))) glUniform1i(this->slotLocation(handle), value); }
+	void set(UniformHandle handle, GLfloat value) { if (this->changed(handle, GL_FLOAT, &value, sizeof(value))) glUniform1f(this->slotLocation(handle), value); }
+	void set(UniformHandle handle, const glm::vec2& value) { if (this->changed(handle, GL_FLOAT_VEC2, glm::value_ptr(value), sizeof(value))) glUniform2fv(this->slotLocation(handle), 1, glm::value_ptr(value)); }
+	void set(UniformHandle handle, const glm::ivec3& value) { if (this->changed(handle, GL_INT_VEC3, glm::value_ptr(value), sizeof(value))) glUniform3iv(this->slotLocation(handle), 1, glm::value_ptr(value)); }
+	void set(UniformHandle handle, const glm::vec3& value) { if (this->changed(handle, GL_FLOAT_VEC3, glm::value_ptr(value), sizeof(value))) glUniform3fv(this->slotLocation(handle), 1, glm::value_ptr(value)); }
+	void set(UniformHandle handle, const glm::vec4& value) { if (this->changed(handle, GL_FLOAT_VEC4, glm::value_ptr(value), sizeof(value))) glUniform4fv(this->slotLocation(handle), 1, glm::value_ptr(value)); }
+	void set(UniformHandle handle, const glm::mat4& value) { if (this->changed(handle, GL_FLOAT_MAT4, glm::value_ptr(value), sizeof(value))) glUniformMatrix4fv(this->slotLocation(handle), 1, GL_FALSE, glm::value_ptr(value)); }
+
+	// Array uploads, count elements starting at element 0
+	void set(UniformHandle handle, const glm::vec4* values, GLsizei count) { if (this->changed(handle, GL_FLOAT_VEC4, values, sizeof(glm::vec4), count)) glUniform4fv(this->slotLocation(handle), count, glm::value_ptr(values[0])); }
+	void set(UniformHandle handle, const glm::mat4* values, GLsizei count) { if (this->changed(handle, GL_FLOAT_MAT4, values, sizeof(glm::mat4), count)) glUniformMatrix4fv(this->slotLocation(handle), count, GL_FALSE, glm::value_ptr(values[0])); }
+
+	template <typename T>
+	void set(const char* name, const T& value) { this->set(this->uniform(name), value); }
+	template <typename T>
+	void set(const char* name, const T* values, GLsizei count) { this->set(this->uniform(name), values, count); }
+
+	// Forgets the cached values, needed if anything uploads to this program behind the setters' back
+	void invalidateUniforms()
+	{
+		if (!this->uniforms)
+			return;
+		for (size_t i = 0; i < this->uniforms->slots.size(); i++)
+			this->uniforms->slots[i].cached = false;
+	}
+
+private:
+	struct UniformSlot
+	{
+		std::string name;
+		GLint location;
+		GLenum type;
+		GLint size;
+		bool cached = false;
+		bool reported = false;
+		// Last uploaded value, room for a mat4 per array element
+		std::vector<GLfloat> value;
+	};
+
+	struct UniformTable
+	{
+		std::vector<UniformSlot> slots;
+		std::unordered_map<uint32_t, size_t> lookup;
+	};
+
+	// Shared so that copies of a Shader see the same locations and the same cached values
+	std::shared_ptr<UniformTable> uniforms;
+
+	// Reads every active uniform once after link. Array uniforms are also reachable without the "[0]" suffix.
+	void reflectUniforms()
+	{
+		this->uniforms = std::make_shared<UniformTable>();
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(this->Program, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> nameBuffer(maxLength + 1);
+		for (GLint i = 0; i < count; i++)
 		{
-			glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+			GLint size;
+			GLenum type;
+			glGetActiveUniform(this->Program, (GLuint)i, (GLsizei)nameBuffer.size(), NULL, &size, &type, nameBuffer.data());
+			UniformSlot slot;
+			slot.name = nameBuffer.data();
+			slot.location = glGetUniformLocation(this->Program, slot.name.c_str());
+			// Uniform block members have no location
+			if (slot.location < 0)
+				continue;
+			slot.type = type;
+			slot.size = size;
+			slot.value.resize((size_t)size * 16);
+			size_t bracket = slot.name.find('[');
+			if (bracket != std::string::npos)
+				slot.name = slot.name.substr(0, bracket);
+			this->addSlot(slot);
 		}
-		// Shader Program
-		this->Program = glCreateProgram();
-		glAttachShader(this->Program, vertex);
-		glAttachShader(this->Program, fragment);
-		glLinkProgram(this->Program);
-		// Print linking errors if any
-		glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
-		if (!success)
+	}
+
+	static void _insertDefines(std::string& code, const std::string& defines)
+	{
+		size_t line = code.find("#version");
+		line = line == std::string::npos ? 0 : code.find('\n', line);
+		line = line == std::string::npos ? code.size() : line + 1;
+		code.insert(line, defines);
+	}
+
+	void addSlot(const UniformSlot& slot)
+	{
+		uint32_t hash = _uniformHash(slot.name.c_str());
+		if (this->uniforms->lookup.count(hash))
 		{
-			glGetProgramInfoLog(this->Program, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+			std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION " << slot.name << std::endl;
+			return;
 		}
-		// Delete the shaders as they're linked into our program now and no longer necessery
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
+		this->uniforms->lookup[hash] = this->uniforms->slots.size();
+		this->uniforms->slots.push_back(slot);
+	}
 
+	GLint slotLocation(UniformHandle handle) const
+	{
+		return this->uniforms->slots[handle.slot].location;
 	}
-	// Uses the current shader
-	void Use()
+
+	// Returns true (and remembers the value) if the upload is needed
+	bool changed(UniformHandle handle, GLenum type, const void* value, size_t size, GLsizei count = 1)
 	{
-		glUseProgram(this->Program);
+		if (!handle.valid())
+			return false;
+		UniformSlot& slot = this->uniforms->slots[handle.slot];
+		bool isSampler = type == GL_INT && (slot.type == GL_SAMPLER_2D || slot.type == GL_SAMPLER_CUBE || slot.type == GL_BOOL);
+		if (slot.type != type && !isSampler)
+		{
+			if (!slot.reported)
+				std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH " << slot.name << std::endl;
+			slot.reported = true;
+			return false;
+		}
+		if (count > slot.size)
+		{
+			if (!slot.reported)
+				std::cout << "ERROR::SHADER::UNIFORM_ARRAY_OVERFLOW " << slot.name << std::endl;
+			slot.reported = true;
+			return false;
+		}
+		size *= (size_t)count;
+		if (slot.cached && memcmp(slot.value.data(), value, size) == 0)
+			return false;
+		memcpy(slot.value.data(), value, size);
+		slot.cached = true;
+		return true;
 	}
 };
 
@@ -1,20 +1,78 @@
 #version 330 core
+// STEREO_MULTIVIEW is defined by the app for the GL_OVR_multiview2 variant, see RiftApp::StereoMode
+#ifdef STEREO_MULTIVIEW
+#extension GL_OVR_multiview2 : require
+layout(num_views = 2) in;
+#endif
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texCoords;
 
-out vec3 FragPos;
-out vec3 vertNormal;
+// World space, what the scene light and the clustered point lights are worked out in
+out vec3 WorldPos;
+out vec3 WorldNormal;
+// STATIC_BATCH: the mesh of a merged model, see StaticBatch. Passed on to pick the material.
+#ifdef STATIC_BATCH
+layout (location = 9) in int materialIndex;
+flat out int vertMaterial;
+#endif
+// BAKED_LIGHTING: the batch's per vertex bake, see _bakeLighting. Passed on in place of lighting the scene light.
+#ifdef BAKED_LIGHTING
+layout (location = 3) in vec4 lightBake;
+out vec4 vertBake;
+#endif
+// VIRTUAL_TEXTURE: where the mesh's virtual texture is sampled, see VirtualTexture
+#ifdef VIRTUAL_TEXTURE
+out vec2 vertTexCoords;
+#endif
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Element 0 is the left eye. Mono rendering only uses element 0.
+// With LATE_LATCH the cameras come from the block RiftApp rewrites right before the draws are issued.
+#ifdef LATE_LATCH
+layout(std140) uniform LateLatch
+{
+	mat4 view[2];
+	mat4 projection[2];
+	mat4 hands[2];
+};
+#else
+uniform mat4 view[2];
+uniform mat4 projection[2];
+#endif
+// Instanced stereo: every draw is issued with eyeCount times the instances, eye = gl_InstanceID % eyeCount.
+// eyeViewport squeezes each eye into its half of the shared target: xy scale, zw offset in NDC.
+uniform int eyeCount = 1;
+uniform vec4 eyeViewport[2];
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f);
-	vertNormal = normal;
-    FragPos = vec3(texCoords, 1.0f);
+#ifdef STEREO_MULTIVIEW
+	int eye = int(gl_ViewID_OVR);
+#else
+	int eye = gl_InstanceID % eyeCount;
+#endif
+    vec4 clip = projection[eye] * view[eye] * model * vec4(position, 1.0f);
+#ifndef STEREO_MULTIVIEW
+	if (eyeCount > 1)
+	{
+		// Keep each eye out of the other's half, GL_CLIP_DISTANCE0 is enabled by RiftApp
+		gl_ClipDistance[0] = eye == 0 ? clip.w - clip.x : clip.w + clip.x;
+		clip.xy = clip.xy * eyeViewport[eye].xy + eyeViewport[eye].zw * clip.w;
+	}
+#endif
+    gl_Position = clip;
+	WorldPos = vec3(model * vec4(position, 1.0f));
+	WorldNormal = mat3(model) * normal;
+#ifdef STATIC_BATCH
+	vertMaterial = materialIndex;
+#endif
+#ifdef BAKED_LIGHTING
+	vertBake = lightBake;
+#endif
+#ifdef VIRTUAL_TEXTURE
+	vertTexCoords = texCoords;
+#endif
 }
 
 /*
@@ -0,0 +1,251 @@
+#pragma once
+// Std. Includes
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include "glstate.h"
+
+// NV_shading_rate_image is newer than the GLEW in Include/glew, its tokens and entry points are declared here and
+// looked up through wglGetProcAddress once the extension is listed.
+#define SHADING_RATE_IMAGE_NV 0x9563
+#define SHADING_RATE_1_INVOCATION_PER_PIXEL_NV 0x9565
+#define SHADING_RATE_1_INVOCATION_PER_2X2_PIXELS_NV 0x9568
+#define SHADING_RATE_1_INVOCATION_PER_4X4_PIXELS_NV 0x956B
+#define SHADING_RATE_IMAGE_TEXEL_WIDTH_NV 0x955B
+#define SHADING_RATE_IMAGE_TEXEL_HEIGHT_NV 0x955C
+#define SHADING_RATE_IMAGE_PALETTE_SIZE_NV 0x955D
+
+typedef void (GLAPIENTRY* ShadingRateBindImage)(GLuint texture);
+typedef void (GLAPIENTRY* ShadingRatePalette)(GLuint viewport, GLuint first, GLsizei count, const GLenum* rates);
+
+// Tangent of the angle off the lens axis up to which the eye is always shaded per pixel, and past which the coarsest
+// level shades 4x4. The CV1's lenses are sharp to about 35 degrees and blur quickly beyond 45.
+#define SHADING_RATE_INNER_TAN 0.7f
+#define SHADING_RATE_OUTER_TAN 1.0f
+// Texture unit the images are bound to while the rings are rewritten, next to the Hi-Z pyramid's
+#define SHADING_RATE_TEXTURE_UNIT 14
+// Level 0 is per pixel everywhere, see ShadingRateImage::setLevel
+#define SHADING_RATE_LEVELS 3
+
+// Coarse shading of the eye periphery through NV_shading_rate_image. Every texel of the image covers a tile of the
+// eye target and holds the ring of the lens it lies in, 0 inside SHADING_RATE_INNER_TAN, 1 up to
+// SHADING_RATE_OUTER_TAN and 2 beyond. The level maps the rings to rates through the palette, so the quality
+// controller changes it without touching the image:
+//   level 1: 1x1, 1x1, 2x2
+//   level 2: 1x1, 2x2, 4x4
+// Rates only change how often fragments are shaded, depth and coverage stay per sample.
+//
+// The image is in framebuffer coordinates: one covers the side by side eye target the sequential and instanced
+// passes draw into, a two layer array covers the multiview target with each eye at its layer's lower left corner.
+// Anything drawn into other targets or reading depth per pixel, the Hi-Z reduction say, has to suspend() it.
+class ShadingRateImage
+{
+public:
+	ShadingRateImage() {}
+	~ShadingRateImage()
+	{
+		if (this->image)
+			glDeleteTextures(1, &this->image);
+		if (this->layeredImage)
+			glDeleteTextures(1, &this->layeredImage);
+	}
+
+	ShadingRateImage(const ShadingRateImage&) = delete;
+	ShadingRateImage& operator=(const ShadingRateImage&) = delete;
+
+	// For an eye target of targetSize and, if not zero, a multiview target of layerSize per layer. False, and
+	// everything is shaded per pixel, without the extension.
+	bool init(glm::uvec2 targetSize, glm::uvec2 layerSize)
+	{
+		if (!this->hasExtension() || !GLEW_ARB_texture_storage)
+			return false;
+		this->bindImage = (ShadingRateBindImage)wglGetProcAddress("glBindShadingRateImageNV");
+		this->palette = (ShadingRatePalette)wglGetProcAddress("glShadingRateImagePaletteNV");
+		GLint paletteSize = 0;
+		glGetIntegerv(SHADING_RATE_IMAGE_TEXEL_WIDTH_NV, &this->texelWidth);
+		glGetIntegerv(SHADING_RATE_IMAGE_TEXEL_HEIGHT_NV, &this->texelHeight);
+		glGetIntegerv(SHADING_RATE_IMAGE_PALETTE_SIZE_NV, &paletteSize);
+		if (!this->bindImage || !this->palette || this->texelWidth <= 0 || this->texelHeight <= 0 || paletteSize < 3)
+		{
+			std::cout << "ERROR::SHADING_RATE::UNUSABLE, shading per pixel" << std::endl;
+			this->bindImage = nullptr;
+			return false;
+		}
+
+		// The image has to be immutable R8UI
+		this->imageSize = this->tiles(targetSize);
+		glGenTextures(1, &this->image);
+		glBindTexture(GL_TEXTURE_2D, this->image);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8UI, this->imageSize.x, this->imageSize.y);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		if (layerSize.x && layerSize.y)
+		{
+			this->layerTiles = this->tiles(layerSize);
+			glGenTextures(1, &this->layeredImage);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, this->layeredImage);
+			glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R8UI, this->layerTiles.x, this->layerTiles.y, ovrEye_Count);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		}
+		memset(this->builtViewports, 0, sizeof(this->builtViewports));
+		return true;
+	}
+
+	bool supported() const { return this->bindImage != nullptr; }
+
+	int level() const { return this->currentLevel; }
+
+	// 0 to SHADING_RATE_LEVELS - 1, 0 shading every pixel without the image enabled at all
+	void setLevel(int level)
+	{
+		level = this->supported() ? glm::clamp(level, 0, SHADING_RATE_LEVELS - 1) : 0;
+		if (level == this->currentLevel)
+			return;
+		this->currentLevel = level;
+		if (!level)
+			return;
+		const GLenum rates[2][3] = {
+			{ SHADING_RATE_1_INVOCATION_PER_PIXEL_NV, SHADING_RATE_1_INVOCATION_PER_PIXEL_NV, SHADING_RATE_1_INVOCATION_PER_2X2_PIXELS_NV },
+			{ SHADING_RATE_1_INVOCATION_PER_PIXEL_NV, SHADING_RATE_1_INVOCATION_PER_2X2_PIXELS_NV, SHADING_RATE_1_INVOCATION_PER_4X4_PIXELS_NV } };
+		this->palette(0, 0, 3, rates[level - 1]);
+	}
+
+	// Rebuilds the rings when the eye viewports moved or changed size since the last call
+	void update(const ovrRecti viewports[2], const ovrFovPort fovs[2])
+	{
+		if (!this->supported() || !memcmp(this->builtViewports, viewports, sizeof(this->builtViewports)))
+			return;
+		memcpy(this->builtViewports, viewports, sizeof(this->builtViewports));
+
+		vector<uint8_t> rings(this->imageSize.x * this->imageSize.y);
+		for (GLint ty = 0; ty < this->imageSize.y; ty++)
+		{
+			for (GLint tx = 0; tx < this->imageSize.x; tx++)
+			{
+				const glm::vec2 pixel((tx + 0.5f) * this->texelWidth, (ty + 0.5f) * this->texelHeight);
+				const int eye = pixel.x >= viewports[ovrEye_Right].Pos.x ? ovrEye_Right : ovrEye_Left;
+				rings[ty * this->imageSize.x + tx] = this->ring(pixel, viewports[eye], fovs[eye]);
+			}
+		}
+		// Called inside the frame, the binds go through the state cache
+		_glState.selectTexture(SHADING_RATE_TEXTURE_UNIT, this->image);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, this->imageSize.x, this->imageSize.y, GL_RED_INTEGER, GL_UNSIGNED_BYTE, rings.data());
+
+		if (!this->layeredImage)
+		{
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			return;
+		}
+		rings.resize(this->layerTiles.x * this->layerTiles.y);
+		_glState.selectTextureArray(SHADING_RATE_TEXTURE_UNIT, this->layeredImage);
+		for (int eye = 0; eye < ovrEye_Count; eye++)
+		{
+			ovrRecti cornered = viewports[eye];
+			cornered.Pos.x = cornered.Pos.y = 0;
+			for (GLint ty = 0; ty < this->layerTiles.y; ty++)
+			{
+				for (GLint tx = 0; tx < this->layerTiles.x; tx++)
+				{
+					const glm::vec2 pixel((tx + 0.5f) * this->texelWidth, (ty + 0.5f) * this->texelHeight);
+					rings[ty * this->layerTiles.x + tx] = this->ring(pixel, cornered, fovs[eye]);
+				}
+			}
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, eye, this->layerTiles.x, this->layerTiles.y, 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE,
+				rings.data());
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+
+	// Coarse shading from here on into the eye target, or the multiview target if layered. Nothing at level 0.
+	void begin(bool layered)
+	{
+		if (!this->currentLevel || (layered && !this->layeredImage))
+		{
+			this->end();
+			return;
+		}
+		this->bindImage(layered ? this->layeredImage : this->image);
+		glEnable(SHADING_RATE_IMAGE_NV);
+		this->enabled = true;
+	}
+
+	void end()
+	{
+		if (!this->enabled)
+			return;
+		glDisable(SHADING_RATE_IMAGE_NV);
+		this->enabled = false;
+	}
+
+	// Per pixel shading until resume(), true if it was coarse before
+	bool suspend()
+	{
+		if (!this->enabled)
+			return false;
+		glDisable(SHADING_RATE_IMAGE_NV);
+		this->enabled = false;
+		return true;
+	}
+
+	void resume()
+	{
+		glEnable(SHADING_RATE_IMAGE_NV);
+		this->enabled = true;
+	}
+
+private:
+	bool hasExtension() const
+	{
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (name && !strcmp(name, "GL_NV_shading_rate_image"))
+				return true;
+		}
+		return false;
+	}
+
+	glm::ivec2 tiles(glm::uvec2 size) const
+	{
+		return glm::ivec2(((GLint)size.x + this->texelWidth - 1) / this->texelWidth, ((GLint)size.y + this->texelHeight - 1) / this->texelHeight);
+	}
+
+	// The lens ring of pixel, bottom left origin, in viewport drawn with fov. Outside the viewport it doesn't matter.
+	uint8_t ring(glm::vec2 pixel, const ovrRecti& viewport, const ovrFovPort& fov) const
+	{
+		const float u = (pixel.x - viewport.Pos.x) / std::max(viewport.Size.w, 1);
+		const float v = (pixel.y - viewport.Pos.y) / std::max(viewport.Size.h, 1);
+		if (u < 0.0f || u > 1.0f || v < 0.0f || v > 1.0f)
+			return 0;
+		const glm::vec2 tangent(-fov.LeftTan + u * (fov.LeftTan + fov.RightTan), -fov.DownTan + v * (fov.DownTan + fov.UpTan));
+		const float off = glm::length(tangent);
+		return off < SHADING_RATE_INNER_TAN ? 0 : off < SHADING_RATE_OUTER_TAN ? 1 : 2;
+	}
+
+	ShadingRateBindImage bindImage{ nullptr };
+	ShadingRatePalette palette{ nullptr };
+	GLint texelWidth{ 16 };
+	GLint texelHeight{ 16 };
+	GLuint image{ 0 };
+	GLuint layeredImage{ 0 };
+	glm::ivec2 imageSize;
+	glm::ivec2 layerTiles;
+	ovrRecti builtViewports[2];
+	int currentLevel{ 0 };
+	bool enabled{ false };
+};
+
+static ShadingRateImage _shadingRate;
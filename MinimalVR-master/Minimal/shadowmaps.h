@@ -0,0 +1,242 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "glstate.h"
+#include "gpumemory.h"
+#include "gldebug.h"
+#include "glcapture.h"
+
+// Texture units the lit programs sample the maps from
+#define SHADOW_STATIC_UNIT 9
+#define SHADOW_DYNAMIC_UNIT 10
+// The static map covers the whole factory and is kept, the dynamic one only the molecules' box and is redrawn every frame
+#define SHADOW_STATIC_SIZE 2048
+#define SHADOW_DYNAMIC_SIZE 1024
+// Near plane of the light's cameras, the spheres they are aimed at stop them coming closer
+#define SHADOW_MIN_NEAR 0.05f
+// Slope and constant depth offset of the casters, against self shadowing
+#define SHADOW_OFFSET_FACTOR 2.0f
+#define SHADOW_OFFSET_UNITS 4.0f
+
+enum class ShadowMap : uint8_t {
+	Static,
+	Dynamic,
+	Count,
+};
+
+// The one scene light's shadows, as two maps it sees through cameras of its own. What doesn't move, the factory,
+// goes into the static map, rendered once and again only when the light, the sphere it's aimed at or the casters'
+// revision change; what does, the molecules, into the small dynamic map every frame. A fragment is lit by the
+// nearer of the two, so the molecules shadow the factory and the factory them without either map holding both.
+//
+// The light is a point light, so the cameras are perspectives from it, each just wide enough for its sphere. Depth
+// follows the eye targets' convention, reversed-Z included: the maps are cleared and tested like them, and the
+// lookups compare the way round that matches. Outside its camera a map reads as lit.
+class ShadowMaps
+{
+public:
+	ShadowMaps() {}
+	~ShadowMaps()
+	{
+		for (int i = 0; i < (int)ShadowMap::Count; i++)
+		{
+			if (this->maps[i].texture)
+				glDeleteTextures(1, &this->maps[i].texture);
+			if (this->maps[i].framebuffer)
+				glDeleteFramebuffers(1, &this->maps[i].framebuffer);
+		}
+	}
+
+	ShadowMaps(const ShadowMaps&) = delete;
+	ShadowMaps& operator=(const ShadowMaps&) = delete;
+
+	// reversed as the eye targets are, see _initDepth
+	bool init(bool reversed)
+	{
+		this->reversed = reversed;
+		const GLenum format = reversed ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24;
+		const GLsizei sizes[(int)ShadowMap::Count] = { SHADOW_STATIC_SIZE, SHADOW_DYNAMIC_SIZE };
+		const char* names[(int)ShadowMap::Count] = { "shadow static", "shadow dynamic" };
+		int64_t bytes = 0;
+		for (int i = 0; i < (int)ShadowMap::Count; i++)
+		{
+			Map& map = this->maps[i];
+			map.size = sizes[i];
+			glGenTextures(1, &map.texture);
+			glBindTexture(GL_TEXTURE_2D, map.texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, format, map.size, map.size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+			// Hardware 2x2 filtering of the comparisons, and the far plane all round the camera
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+			const GLfloat border[4] = { reversed ? 0.0f : 1.0f, 0.0f, 0.0f, 0.0f };
+			glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, reversed ? GL_GEQUAL : GL_LEQUAL);
+			_glLabel(GL_TEXTURE, map.texture, names[i]);
+
+			glGenFramebuffers(1, &map.framebuffer);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, map.framebuffer);
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, map.texture, 0);
+			glDrawBuffer(GL_NONE);
+			const bool complete = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+			_glLabel(GL_FRAMEBUFFER, map.framebuffer, names[i]);
+			if (!complete)
+			{
+				std::cout << "ERROR::SHADOW::FRAMEBUFFER_INCOMPLETE " << names[i] << std::endl;
+				glBindTexture(GL_TEXTURE_2D, 0);
+				return false;
+			}
+			bytes += _gpuImageBytes(format, map.size, map.size);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		this->memory.reset(GpuMemoryCategory::EyeTargets, bytes);
+		this->ready = true;
+		return true;
+	}
+
+	bool initialized() const { return this->ready; }
+
+	// Points map's camera from light at the sphere it has to cover, casters and receivers both
+	void aim(ShadowMap which, const glm::vec3& light, const glm::vec3& centre, float radius)
+	{
+		Map& map = this->maps[(int)which];
+		const float distance = std::max(glm::length(centre - light), radius + SHADOW_MIN_NEAR);
+		const glm::vec3 forward = (centre - light) / std::max(glm::length(centre - light), 0.0001f);
+		// Any up that isn't along the light's direction
+		const glm::vec3 up = fabsf(forward.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		const float halfAngle = asinf(glm::clamp(radius / distance, 0.0f, 0.999f));
+		const float nearPlane = std::max(distance - radius, SHADOW_MIN_NEAR);
+		const float farPlane = distance + radius;
+		map.view = glm::lookAt(light, light + forward, up);
+		map.projection = this->perspective(tanf(halfAngle), nearPlane, farPlane);
+		map.light = light;
+		map.sphere = glm::vec4(centre, radius);
+	}
+
+	const glm::mat4& view(ShadowMap which) const { return this->maps[(int)which].view; }
+	const glm::mat4& projection(ShadowMap which) const { return this->maps[(int)which].projection; }
+
+	// Whether the static map has to be drawn again: it never was, its camera moved since, or the caller's revision
+	// of what it holds changed
+	bool staticDue(uint32_t revision) const
+	{
+		const Map& map = this->maps[(int)ShadowMap::Static];
+		return !map.rendered || map.light != map.renderedLight || map.sphere != map.renderedSphere || revision != this->staticRevision;
+	}
+
+	// map as the draw target, cleared, with the casters' depth offset; the viewport and target bound before come
+	// back with end()
+	void begin(ShadowMap which)
+	{
+		Map& map = this->maps[(int)which];
+		glGetIntegerv(GL_VIEWPORT, this->savedViewport);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &this->savedFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, map.framebuffer);
+		glViewport(0, 0, map.size, map.size);
+		_glState.colorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		_glState.depthMask(GL_TRUE);
+		_glState.depthFunc(GL_LESS);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		_glCapture.clear(GL_DEPTH_BUFFER_BIT);
+		// Away from the light, which is towards 0 with reversed depth
+		const float sign = this->reversed ? -1.0f : 1.0f;
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(sign * SHADOW_OFFSET_FACTOR, sign * SHADOW_OFFSET_UNITS);
+	}
+
+	// revision is what staticDue() is asked with next, only the static map keeps it
+	void end(ShadowMap which, uint32_t revision = 0)
+	{
+		Map& map = this->maps[(int)which];
+		glDisable(GL_POLYGON_OFFSET_FILL);
+		_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->savedFramebuffer);
+		glViewport(this->savedViewport[0], this->savedViewport[1], this->savedViewport[2], this->savedViewport[3]);
+		map.rendered = true;
+		map.renderedLight = map.light;
+		map.renderedSphere = map.sphere;
+		if (which == ShadowMap::Static)
+			this->staticRevision = revision;
+	}
+
+	// Whether both maps have been drawn, the lit programs sample them from then on
+	bool sampled() const
+	{
+		return this->ready && this->maps[(int)ShadowMap::Static].rendered && this->maps[(int)ShadowMap::Dynamic].rendered;
+	}
+
+	// World position to the map's texture coordinates and reference depth, for textureProj
+	glm::mat4 lookup(ShadowMap which) const
+	{
+		const Map& map = this->maps[(int)which];
+		// Reversed depth clips to [0, 1] already, the conventional way from [-1, 1]
+		const float depthScale = this->reversed ? 1.0f : 0.5f;
+		glm::mat4 bias(1.0f);
+		bias[0][0] = bias[1][1] = 0.5f;
+		bias[2][2] = depthScale;
+		bias[3] = glm::vec4(0.5f, 0.5f, 1.0f - depthScale, 1.0f);
+		return bias * map.projection * map.view;
+	}
+
+	// For the lit programs' draws, after both maps are done
+	void bind()
+	{
+		_glState.bindTexture(SHADOW_STATIC_UNIT, this->maps[(int)ShadowMap::Static].texture);
+		_glState.bindTexture(SHADOW_DYNAMIC_UNIT, this->maps[(int)ShadowMap::Dynamic].texture);
+	}
+
+private:
+	struct Map
+	{
+		GLuint texture = 0;
+		GLuint framebuffer = 0;
+		GLsizei size = 0;
+		glm::mat4 view = glm::mat4(1.0f);
+		glm::mat4 projection = glm::mat4(1.0f);
+		// What the camera was aimed with, and with when the map was last drawn
+		glm::vec3 light = glm::vec3(0.0f);
+		glm::vec4 sphere = glm::vec4(0.0f);
+		glm::vec3 renderedLight = glm::vec3(0.0f);
+		glm::vec4 renderedSphere = glm::vec4(0.0f);
+		bool rendered = false;
+	};
+
+	Map maps[(int)ShadowMap::Count];
+	GpuAllocation memory;
+	bool reversed = false;
+	bool ready = false;
+	uint32_t staticRevision = 0;
+	GLint savedViewport[4] = { 0, 0, 0, 0 };
+	GLint savedFramebuffer = 0;
+
+	// Square, tangent the half width of the view; near maps to 1 and far to 0 with reversed depth, as the eyes'
+	// ovrProjection_FarLessThanNear does, and to -1 and 1 otherwise
+	glm::mat4 perspective(float tangent, float nearPlane, float farPlane) const
+	{
+		glm::mat4 projection(0.0f);
+		projection[0][0] = projection[1][1] = 1.0f / tangent;
+		projection[2][3] = -1.0f;
+		if (this->reversed)
+		{
+			projection[2][2] = nearPlane / (farPlane - nearPlane);
+			projection[3][2] = farPlane * nearPlane / (farPlane - nearPlane);
+		}
+		else
+		{
+			projection[2][2] = -(farPlane + nearPlane) / (farPlane - nearPlane);
+			projection[3][2] = -2.0f * farPlane * nearPlane / (farPlane - nearPlane);
+		}
+		return projection;
+	}
+};
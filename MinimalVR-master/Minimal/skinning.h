@@ -0,0 +1,113 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <emmintrin.h>
+// GL Includes
+#include <glm/glm.hpp>
+#include <OVR_Avatar.h>
+
+// Affine transform with the implicit (0, 0, 0, 1) bottom row dropped, stored row-major:
+// m[4 * r + c] for the 3x3 part and m[4 * r + 3] for the translation of row r.
+// Three rows are three SSE registers, which is what makes composing joints cheap.
+struct Affine34
+{
+	float m[12];
+};
+
+// T * R * S straight from the avatar transform, no intermediate 4x4 products
+static inline void _affineFromOvrAvatarTransform(const ovrAvatarTransform& transform, Affine34* target)
+{
+	const float x = transform.orientation.x, y = transform.orientation.y, z = transform.orientation.z, w = transform.orientation.w;
+	const float sx = transform.scale.x, sy = transform.scale.y, sz = transform.scale.z;
+	float* m = target->m;
+	m[0] = (1.0f - 2.0f * (y * y + z * z)) * sx;
+	m[1] = 2.0f * (x * y - w * z) * sy;
+	m[2] = 2.0f * (x * z + w * y) * sz;
+	m[3] = transform.position.x;
+	m[4] = 2.0f * (x * y + w * z) * sx;
+	m[5] = (1.0f - 2.0f * (x * x + z * z)) * sy;
+	m[6] = 2.0f * (y * z - w * x) * sz;
+	m[7] = transform.position.y;
+	m[8] = 2.0f * (x * z - w * y) * sx;
+	m[9] = 2.0f * (y * z + w * x) * sy;
+	m[10] = (1.0f - 2.0f * (x * x + y * y)) * sz;
+	m[11] = transform.position.z;
+}
+
+static inline void _affineFromMat4(const glm::mat4& source, Affine34* target)
+{
+	for (int r = 0; r < 3; r++)
+		for (int c = 0; c < 4; c++)
+			target->m[4 * r + c] = source[c][r];
+}
+
+// glm (and std140) matrices are column-major, so this is a transpose plus the constant last row
+static inline void _affineToMat4(const Affine34& source, glm::mat4* target)
+{
+	for (int c = 0; c < 4; c++)
+	{
+		(*target)[c] = glm::vec4(source.m[c], source.m[4 + c], source.m[8 + c], c == 3 ? 1.0f : 0.0f);
+	}
+}
+
+// out = a * b. Row r of the result is a linear combination of the rows of b, plus a's translation.
+// out may alias neither a nor b.
+static inline void _affineMultiply(const Affine34& a, const Affine34& b, Affine34* out)
+{
+	const __m128 b0 = _mm_loadu_ps(b.m);
+	const __m128 b1 = _mm_loadu_ps(b.m + 4);
+	const __m128 b2 = _mm_loadu_ps(b.m + 8);
+	for (int r = 0; r < 3; r++)
+	{
+		const float* ar = a.m + 4 * r;
+		__m128 row = _mm_mul_ps(_mm_set1_ps(ar[0]), b0);
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(ar[1]), b1));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(ar[2]), b2));
+		row = _mm_add_ps(row, _mm_set_ps(ar[3], 0.0f, 0.0f, 0.0f));
+		_mm_storeu_ps(out->m + 4 * r, row);
+	}
+}
+
+// Final skinning palette of one pose: palette[i] = world pose of joint i * inverseBindPose[i].
+// Joints must be ordered parents first, which the avatar SDK guarantees.
+static void _evaluateSkinningPalette(const ovrAvatarSkinnedMeshPose& pose, const Affine34* inverseBindPose, glm::mat4* palette)
+{
+	Affine34 world[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
+	Affine34 local, skinned;
+	for (uint32_t i = 0; i < pose.jointCount; ++i)
+	{
+		int parentIndex = pose.jointParents[i];
+		if (parentIndex < 0)
+		{
+			_affineFromOvrAvatarTransform(pose.jointTransform[i], &world[i]);
+		}
+		else
+		{
+			_affineFromOvrAvatarTransform(pose.jointTransform[i], &local);
+			_affineMultiply(world[parentIndex], local, &world[i]);
+		}
+		_affineMultiply(world[i], inverseBindPose[i], &skinned);
+		_affineToMat4(skinned, &palette[i]);
+	}
+}
+
+// Model space position of every joint of a pose, composed the same way as _evaluateSkinningPalette
+static void _evaluateJointPositions(const ovrAvatarSkinnedMeshPose& pose, glm::vec3* positions)
+{
+	Affine34 world[OVR_AVATAR_MAXIMUM_JOINT_COUNT];
+	Affine34 local;
+	for (uint32_t i = 0; i < pose.jointCount; ++i)
+	{
+		int parentIndex = pose.jointParents[i];
+		if (parentIndex < 0)
+		{
+			_affineFromOvrAvatarTransform(pose.jointTransform[i], &world[i]);
+		}
+		else
+		{
+			_affineFromOvrAvatarTransform(pose.jointTransform[i], &local);
+			_affineMultiply(world[parentIndex], local, &world[i]);
+		}
+		positions[i] = glm::vec3(world[i].m[3], world[i].m[7], world[i].m[11]);
+	}
+}
@@ -0,0 +1,264 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+#include "picking.h"
+
+// Uniform grid over a fixed box for point objects identified by dense ids (0..n-1).
+//
+// Each object sits in exactly one cell. update() only touches the cell lists when an object
+// crosses a cell boundary, so keeping the grid in sync with moving objects is cheap.
+// Ray queries walk only the cells the ray crosses (3D DDA) plus their neighbours, which is
+// enough as long as the query radius is no larger than the cell size.
+class SpatialGrid
+{
+public:
+	SpatialGrid() {}
+
+	SpatialGrid(const glm::vec3& boundsMin, const glm::vec3& boundsMax, float cellSize)
+	{
+		this->init(boundsMin, boundsMax, cellSize);
+	}
+
+	// The box is padded by one cell on every side so objects that overshoot it slightly still land in a real cell
+	void init(const glm::vec3& boundsMin, const glm::vec3& boundsMax, float cellSize)
+	{
+		this->cellSize = cellSize;
+		this->origin = boundsMin - glm::vec3(cellSize);
+		glm::vec3 extent = (boundsMax + glm::vec3(cellSize)) - this->origin;
+		this->dims = glm::ivec3(glm::max(glm::ceil(extent / cellSize), glm::vec3(1.0f)));
+		this->cells.assign((size_t)this->dims.x * this->dims.y * this->dims.z, vector<uint32_t>());
+		this->cellStamps.assign(this->cells.size(), 0);
+		this->stamp = 0;
+		this->clear();
+	}
+
+	void clear()
+	{
+		for (size_t i = 0; i < this->cells.size(); i++)
+			this->cells[i].clear();
+		this->positions.clear();
+		this->objectCells.clear();
+		this->objectSlots.clear();
+	}
+
+	size_t size() const { return this->positions.size(); }
+
+	// Inserts id if it's new (ids must be added densely), otherwise moves it
+	void update(uint32_t id, const glm::vec3& position)
+	{
+		if (id >= this->positions.size())
+		{
+			this->positions.resize(id + 1);
+			this->objectCells.resize(id + 1, NO_CELL);
+			this->objectSlots.resize(id + 1, 0);
+		}
+		this->positions[id] = position;
+
+		uint32_t cell = this->cellIndex(this->cellOf(position));
+		if (cell == this->objectCells[id])
+			return;
+		if (this->objectCells[id] != NO_CELL)
+			this->unlink(id);
+		this->link(id, cell);
+	}
+
+	// Removes the last id, for mirroring a pool that shrinks
+	void pop()
+	{
+		if (this->positions.empty())
+			return;
+		uint32_t id = (uint32_t)this->positions.size() - 1;
+		if (this->objectCells[id] != NO_CELL)
+			this->unlink(id);
+		this->positions.pop_back();
+		this->objectCells.pop_back();
+		this->objectSlots.pop_back();
+	}
+
+	// Calls visit(id, t) for every object within radius of the ray, t being the distance along the ray
+	// to the closest approach. Objects farther than maxDistance along the ray are skipped.
+	template <typename Visitor>
+	void queryRay(const PickRay& ray, float radius, float maxDistance, Visitor visit)
+	{
+		float tEnter, tExit;
+		if (!this->clipRay(ray, maxDistance, &tEnter, &tExit))
+			return;
+
+		this->beginQuery();
+		const float radiusSquared = radius * radius;
+		glm::vec3 start = ray.origin + ray.direction * tEnter;
+		glm::ivec3 cell = this->cellOf(start);
+		glm::ivec3 step;
+		glm::vec3 tMax, tDelta;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float d = ray.direction[axis];
+			step[axis] = d > 0.0f ? 1 : (d < 0.0f ? -1 : 0);
+			if (step[axis] == 0)
+			{
+				tMax[axis] = FLT_MAX;
+				tDelta[axis] = FLT_MAX;
+				continue;
+			}
+			float boundary = this->origin[axis] + (cell[axis] + (step[axis] > 0 ? 1 : 0)) * this->cellSize;
+			tMax[axis] = tEnter + (boundary - start[axis]) / d;
+			tDelta[axis] = this->cellSize / fabsf(d);
+		}
+
+		float t = tEnter;
+		while (t <= tExit)
+		{
+			this->visitNeighbourhood(cell, [&](uint32_t id)
+			{
+				float along = glm::max(glm::dot(this->positions[id] - ray.origin, ray.direction), 0.0f);
+				if (along <= maxDistance && _rayDistanceSquared(ray, this->positions[id]) <= radiusSquared)
+					visit(id, along);
+			});
+
+			int axis = tMax.x < tMax.y ? (tMax.x < tMax.z ? 0 : 2) : (tMax.y < tMax.z ? 1 : 2);
+			t = tMax[axis];
+			cell[axis] += step[axis];
+			if (cell[axis] < 0 || cell[axis] >= this->dims[axis])
+				break;
+			tMax[axis] += tDelta[axis];
+		}
+	}
+
+	// Closest object along the ray within radius of it, -1 if none. Suited to hover feedback and haptics.
+	int raycastNearest(const PickRay& ray, float radius, float maxDistance = FLT_MAX)
+	{
+		int nearest = -1;
+		float nearestT = FLT_MAX;
+		this->queryRay(ray, radius, maxDistance, [&](uint32_t id, float t)
+		{
+			if (t < nearestT)
+			{
+				nearestT = t;
+				nearest = (int)id;
+			}
+		});
+		return nearest;
+	}
+
+	// Calls visit(id) for every object within radius of center (radius no larger than the cell size)
+	template <typename Visitor>
+	void querySphere(const glm::vec3& center, float radius, Visitor visit)
+	{
+		this->beginQuery();
+		const float radiusSquared = radius * radius;
+		this->visitNeighbourhood(this->cellOf(center), [&](uint32_t id)
+		{
+			glm::vec3 d = this->positions[id] - center;
+			if (glm::dot(d, d) <= radiusSquared)
+				visit(id);
+		});
+	}
+
+private:
+	static const uint32_t NO_CELL = 0xFFFFFFFFu;
+
+	glm::vec3 origin;
+	glm::ivec3 dims;
+	float cellSize = 1.0f;
+
+	vector<vector<uint32_t>> cells;
+	// Per object: position, owning cell and index inside that cell's list
+	vector<glm::vec3> positions;
+	vector<uint32_t> objectCells;
+	vector<uint32_t> objectSlots;
+
+	// Marks cells already visited by the current query so neighbourhoods don't report objects twice
+	vector<uint32_t> cellStamps;
+	uint32_t stamp = 0;
+
+	glm::ivec3 cellOf(const glm::vec3& position) const
+	{
+		glm::ivec3 cell = glm::ivec3(glm::floor((position - this->origin) / this->cellSize));
+		return glm::clamp(cell, glm::ivec3(0), this->dims - glm::ivec3(1));
+	}
+
+	uint32_t cellIndex(const glm::ivec3& cell) const
+	{
+		return (uint32_t)((cell.z * this->dims.y + cell.y) * this->dims.x + cell.x);
+	}
+
+	void link(uint32_t id, uint32_t cell)
+	{
+		this->objectCells[id] = cell;
+		this->objectSlots[id] = (uint32_t)this->cells[cell].size();
+		this->cells[cell].push_back(id);
+	}
+
+	// Swap-removes id from its cell and fixes up the slot of the object that took its place
+	void unlink(uint32_t id)
+	{
+		vector<uint32_t>& list = this->cells[this->objectCells[id]];
+		uint32_t slot = this->objectSlots[id];
+		uint32_t moved = list.back();
+		list[slot] = moved;
+		this->objectSlots[moved] = slot;
+		list.pop_back();
+		this->objectCells[id] = NO_CELL;
+	}
+
+	void beginQuery()
+	{
+		if (++this->stamp == 0)
+		{
+			std::fill(this->cellStamps.begin(), this->cellStamps.end(), 0);
+			this->stamp = 1;
+		}
+	}
+
+	template <typename Visitor>
+	void visitNeighbourhood(const glm::ivec3& cell, Visitor visit)
+	{
+		glm::ivec3 lo = glm::max(cell - glm::ivec3(1), glm::ivec3(0));
+		glm::ivec3 hi = glm::min(cell + glm::ivec3(1), this->dims - glm::ivec3(1));
+		for (int z = lo.z; z <= hi.z; z++)
+			for (int y = lo.y; y <= hi.y; y++)
+				for (int x = lo.x; x <= hi.x; x++)
+				{
+					uint32_t index = this->cellIndex(glm::ivec3(x, y, z));
+					if (this->cellStamps[index] == this->stamp)
+						continue;
+					this->cellStamps[index] = this->stamp;
+					const vector<uint32_t>& list = this->cells[index];
+					for (size_t i = 0; i < list.size(); i++)
+						visit(list[i]);
+				}
+	}
+
+	// Slab test against the grid box, returns the parametric range of the ray inside it
+	bool clipRay(const PickRay& ray, float maxDistance, float* tEnter, float* tExit) const
+	{
+		glm::vec3 boxMax = this->origin + glm::vec3(this->dims) * this->cellSize;
+		float t0 = 0.0f, t1 = maxDistance;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float d = ray.direction[axis];
+			if (fabsf(d) < 1e-8f)
+			{
+				if (ray.origin[axis] < this->origin[axis] || ray.origin[axis] > boxMax[axis])
+					return false;
+				continue;
+			}
+			float a = (this->origin[axis] - ray.origin[axis]) / d;
+			float b = (boxMax[axis] - ray.origin[axis]) / d;
+			t0 = std::max(t0, std::min(a, b));
+			t1 = std::min(t1, std::max(a, b));
+			if (t0 > t1)
+				return false;
+		}
+		*tEnter = t0;
+		*tExit = t1;
+		return true;
+	}
+};
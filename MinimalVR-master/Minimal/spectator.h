@@ -0,0 +1,176 @@
+#pragma once
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "glstate.h"
+#include "gpumemory.h"
+#include "gldebug.h"
+#include "glcapture.h"
+
+// Rate the spectator view is drawn at unless --mirror-hz says otherwise
+#define SPECTATOR_DEFAULT_HZ 30.0f
+// Vertical field of view of the spectator camera
+#define SPECTATOR_FOV_DEGREES 60.0f
+// What one press of an arrow key turns the camera by, and one of Page Up/Down moves it in or out by
+#define SPECTATOR_ORBIT_STEP_DEGREES 15.0f
+#define SPECTATOR_ZOOM_STEP 1.25f
+#define SPECTATOR_MIN_DISTANCE 0.5f
+#define SPECTATOR_MAX_DISTANCE 20.0f
+// How fast the point the camera orbits catches up with the head, per second; it lags so the view doesn't shake
+#define SPECTATOR_FOLLOW_RATE 3.0f
+
+// The desktop window's third person view for whoever watches the player. The camera orbits a point that follows
+// the player's head, and draws into a target of its own at a fraction of the window's size that is then scaled up
+// into the window. RiftApp draws it after the frame is submitted, only on the frames _mirrorDue() picks, so the
+// headset frame never waits on it.
+class SpectatorView
+{
+public:
+	SpectatorView() {}
+	~SpectatorView()
+	{
+		this->release();
+	}
+
+	SpectatorView(const SpectatorView&) = delete;
+	SpectatorView& operator=(const SpectatorView&) = delete;
+
+	// Reallocates the target at size, the window's size times the --spectator-scale
+	void resize(const glm::uvec2& size, GLenum depthFormat)
+	{
+		this->release();
+		if (!size.x || !size.y)
+			return;
+		this->size = size;
+
+		glGenTextures(1, &this->colorTexture);
+		glBindTexture(GL_TEXTURE_2D, this->colorTexture);
+		_glLabel(GL_TEXTURE, this->colorTexture, "spectator color");
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenRenderbuffers(1, &this->depthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->depthBuffer);
+		_glLabel(GL_RENDERBUFFER, this->depthBuffer, "spectator depth");
+		glRenderbufferStorage(GL_RENDERBUFFER, depthFormat, size.x, size.y);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &this->framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->framebuffer);
+		_glLabel(GL_FRAMEBUFFER, this->framebuffer, "spectator target");
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->colorTexture, 0);
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depthBuffer);
+		if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cout << "ERROR::SPECTATOR::FRAMEBUFFER_INCOMPLETE" << std::endl;
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+			this->release();
+			return;
+		}
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		this->memory.reset(GpuMemoryCategory::EyeTargets,
+			_gpuImageBytes(GL_RGBA8, size.x, size.y) + _gpuImageBytes(depthFormat, size.x, size.y));
+	}
+
+	bool enabled() const { return this->framebuffer != 0; }
+	glm::uvec2 targetSize() const { return this->size; }
+
+	// The camera's frustum as tangents in ovrFovPort order, for ovrMatrix4f_Projection
+	void tangents(float* upTan, float* downTan, float* leftTan, float* rightTan) const
+	{
+		const float vertical = tanf(glm::radians(SPECTATOR_FOV_DEGREES) * 0.5f);
+		const float horizontal = vertical * (float)this->size.x / (float)std::max(this->size.y, 1u);
+		*upTan = *downTan = vertical;
+		*leftTan = *rightTan = horizontal;
+	}
+
+	// Moves the orbited point towards head, the first call puts it there
+	void follow(const glm::vec3& head, float deltaSeconds)
+	{
+		if (!this->placed)
+		{
+			this->target = head;
+			this->placed = true;
+			return;
+		}
+		const float t = 1.0f - expf(-SPECTATOR_FOLLOW_RATE * std::max(deltaSeconds, 0.0f));
+		this->target += (head - this->target) * t;
+	}
+
+	// Arrow keys: yawSteps and pitchSteps of SPECTATOR_ORBIT_STEP_DEGREES, Page Up/Down: zoomSteps of SPECTATOR_ZOOM_STEP
+	void orbit(int yawSteps, int pitchSteps)
+	{
+		this->yaw += yawSteps * SPECTATOR_ORBIT_STEP_DEGREES;
+		this->pitch = glm::clamp(this->pitch + pitchSteps * SPECTATOR_ORBIT_STEP_DEGREES, -80.0f, 80.0f);
+	}
+	void zoom(int zoomSteps)
+	{
+		this->distance = glm::clamp(this->distance * powf(SPECTATOR_ZOOM_STEP, (float)zoomSteps), SPECTATOR_MIN_DISTANCE, SPECTATOR_MAX_DISTANCE);
+	}
+
+	glm::vec3 position() const
+	{
+		const float yawRadians = glm::radians(this->yaw), pitchRadians = glm::radians(this->pitch);
+		const glm::vec3 offset(sinf(yawRadians) * cosf(pitchRadians), -sinf(pitchRadians), cosf(yawRadians) * cosf(pitchRadians));
+		return this->target + offset * this->distance;
+	}
+
+	glm::mat4 view() const
+	{
+		return glm::lookAt(this->position(), this->target, glm::vec3(0.0f, 1.0f, 0.0f));
+	}
+
+	// Binds and clears the target for the spectator's draws
+	void begin()
+	{
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->framebuffer);
+		glViewport(0, 0, this->size.x, this->size.y);
+		_glState.depthMask(GL_TRUE);
+		_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		_glCapture.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+
+	// Scales what was drawn up into the window's back buffer
+	void present(const glm::uvec2& windowSize)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, this->framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, this->size.x, this->size.y, 0, 0, windowSize.x, windowSize.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	}
+
+private:
+	void release()
+	{
+		if (this->framebuffer)
+			glDeleteFramebuffers(1, &this->framebuffer);
+		if (this->colorTexture)
+			glDeleteTextures(1, &this->colorTexture);
+		if (this->depthBuffer)
+			glDeleteRenderbuffers(1, &this->depthBuffer);
+		this->framebuffer = this->colorTexture = this->depthBuffer = 0;
+		this->memory.reset();
+	}
+
+	GLuint framebuffer = 0;
+	GLuint colorTexture = 0;
+	GLuint depthBuffer = 0;
+	GpuAllocation memory;
+	glm::uvec2 size = glm::uvec2(0);
+	// Behind the player and a little above, looking down at them
+	glm::vec3 target = glm::vec3(0.0f);
+	bool placed = false;
+	float yaw = 0.0f;
+	float pitch = -20.0f;
+	float distance = 2.5f;
+};
+
+static SpectatorView _spectator;
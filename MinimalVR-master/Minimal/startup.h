@@ -0,0 +1,307 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <initializer_list>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+using namespace std;
+#include "trace.h"
+#include "jobs.h"
+#include "threading.h"
+
+typedef uint32_t StartupTask;
+// Depending on it is depending on nothing
+static const StartupTask STARTUP_TASK_NONE = UINT32_MAX;
+
+enum class StartupTaskState : uint8_t {
+	Waiting,
+	Running,
+	Succeeded,
+	Failed,
+	// Something it comes after failed, so it never ran
+	Skipped,
+};
+
+// Startup as named tasks, each run once the tasks it comes after have succeeded. A background task gets a thread of
+// its own as soon as it is added, since most of what startup waits on (the platform service, the network, the disk)
+// blocks rather than computes. A main thread task needs the GL context or the render thread's state and is run by
+// pump() instead, which the render loop calls once a frame.
+//
+// All times are milliseconds since the StartupTasks was constructed, for the global one that is about when the
+// process started. pump() prints the timeline once every task is through.
+class StartupTasks
+{
+public:
+	StartupTasks() : origin(std::chrono::steady_clock::now()) {}
+	~StartupTasks()
+	{
+		this->join();
+	}
+
+	StartupTasks(const StartupTasks&) = delete;
+	StartupTasks& operator=(const StartupTasks&) = delete;
+
+	// body returns whether it succeeded. Tasks in after must already have been added. Render thread only.
+	StartupTask add(const char* name, std::function<bool()> body, std::initializer_list<StartupTask> after = {}, bool mainThread = false)
+	{
+		std::unique_ptr<Entry> entry(new Entry());
+		entry->name = name;
+		entry->body = body;
+		entry->mainThread = mainThread;
+		for (StartupTask task : after)
+		{
+			if (task != STARTUP_TASK_NONE)
+				entry->after.push_back(task);
+		}
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		const StartupTask task = (StartupTask)this->entries.size();
+		this->entries.push_back(std::move(entry));
+		if (!mainThread)
+			this->threads.push_back(std::thread([this, task]() { this->runBackground(task); }));
+		return task;
+	}
+
+	// Runs the main thread tasks that are ready and prints the timeline the first time everything is through
+	void pump()
+	{
+		for (;;)
+		{
+			StartupTask ready = STARTUP_TASK_NONE;
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				for (StartupTask task = 0; task < (StartupTask)this->entries.size() && ready == STARTUP_TASK_NONE; task++)
+				{
+					Entry& entry = *this->entries[task];
+					if (!entry.mainThread || entry.state != StartupTaskState::Waiting)
+						continue;
+					const StartupTaskState after = this->afterState(entry);
+					if (after == StartupTaskState::Failed)
+					{
+						this->settle(entry, StartupTaskState::Skipped);
+						this->changed.notify_all();
+					}
+					else if (after == StartupTaskState::Succeeded)
+						ready = task;
+				}
+				if (ready == STARTUP_TASK_NONE)
+				{
+					if (!this->logged && this->allSettled())
+					{
+						this->logged = true;
+						this->print();
+					}
+					return;
+				}
+				this->begin(*this->entries[ready]);
+			}
+			this->finish(ready, this->entries[ready]->body());
+		}
+	}
+
+	// Blocks until task has settled, true if it succeeded. Not for a main thread task or one that comes after one,
+	// nothing would pump them meanwhile.
+	bool wait(StartupTask task)
+	{
+		if (task == STARTUP_TASK_NONE)
+			return true;
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->changed.wait(lock, [this, task]() { return this->settled(*this->entries[task]); });
+		return this->entries[task]->state == StartupTaskState::Succeeded;
+	}
+
+	// STARTUP_TASK_NONE counts as having succeeded
+	StartupTaskState state(StartupTask task) const
+	{
+		if (task == STARTUP_TASK_NONE)
+			return StartupTaskState::Succeeded;
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->entries[task]->state;
+	}
+
+	// A point on the timeline that isn't a task, the first frame reaching the headset say
+	void mark(const char* name)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->marks.push_back(Mark{ name, this->now() });
+	}
+
+	// Once every task has settled, visit gets each task that ran with how long it took and each mark with when it
+	// was reached, in ms. False, and nothing visited, until then.
+	bool timeline(std::function<void(const char* name, float ms)> visit) const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (!this->allSettled())
+			return false;
+		for (size_t i = 0; i < this->entries.size(); i++)
+		{
+			const Entry& entry = *this->entries[i];
+			if (entry.state == StartupTaskState::Succeeded || entry.state == StartupTaskState::Failed)
+				visit(entry.name.c_str(), entry.endMs - entry.startMs);
+		}
+		for (size_t i = 0; i < this->marks.size(); i++)
+			visit(this->marks[i].name.c_str(), this->marks[i].ms);
+		return true;
+	}
+
+	// Set once join() has started, a background task that polls should give up when it is
+	bool stopping() const { return this->stopRequested.load(std::memory_order_acquire); }
+
+	// Waits for every background task. Ones still waiting on what they come after are skipped.
+	void join()
+	{
+		this->stopRequested.store(true, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			for (size_t i = 0; i < this->entries.size(); i++)
+			{
+				if (this->entries[i]->state == StartupTaskState::Waiting)
+					this->settle(*this->entries[i], StartupTaskState::Skipped);
+			}
+		}
+		this->changed.notify_all();
+		for (size_t i = 0; i < this->threads.size(); i++)
+			this->threads[i].join();
+		this->threads.clear();
+	}
+
+private:
+	struct Entry
+	{
+		std::string name;
+		std::function<bool()> body;
+		vector<StartupTask> after;
+		bool mainThread = false;
+		StartupTaskState state = StartupTaskState::Waiting;
+		float startMs = 0.0f;
+		float endMs = 0.0f;
+	};
+
+	struct Mark
+	{
+		std::string name;
+		float ms;
+	};
+
+	std::chrono::steady_clock::time_point origin;
+	mutable std::mutex mutex;
+	std::condition_variable changed;
+	vector<std::unique_ptr<Entry>> entries;
+	vector<std::thread> threads;
+	vector<Mark> marks;
+	std::atomic<bool> stopRequested{ false };
+	bool logged = false;
+
+	float now() const
+	{
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - this->origin).count();
+	}
+
+	static bool settled(const Entry& entry)
+	{
+		return entry.state != StartupTaskState::Waiting && entry.state != StartupTaskState::Running;
+	}
+
+	// Succeeded once all of entry's are, Failed as soon as one didn't, Waiting otherwise
+	StartupTaskState afterState(const Entry& entry) const
+	{
+		StartupTaskState result = StartupTaskState::Succeeded;
+		for (size_t i = 0; i < entry.after.size(); i++)
+		{
+			const StartupTaskState state = this->entries[entry.after[i]]->state;
+			if (state == StartupTaskState::Failed || state == StartupTaskState::Skipped)
+				return StartupTaskState::Failed;
+			if (state != StartupTaskState::Succeeded)
+				result = StartupTaskState::Waiting;
+		}
+		return result;
+	}
+
+	bool allSettled() const
+	{
+		for (size_t i = 0; i < this->entries.size(); i++)
+		{
+			if (!settled(*this->entries[i]))
+				return false;
+		}
+		return true;
+	}
+
+	// Under the lock
+	void begin(Entry& entry)
+	{
+		entry.state = StartupTaskState::Running;
+		entry.startMs = this->now();
+	}
+
+	// Under the lock
+	void settle(Entry& entry, StartupTaskState state)
+	{
+		entry.state = state;
+		entry.endMs = this->now();
+		if (state == StartupTaskState::Skipped)
+			entry.startMs = entry.endMs;
+	}
+
+	void finish(StartupTask task, bool succeeded)
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->settle(*this->entries[task], succeeded ? StartupTaskState::Succeeded : StartupTaskState::Failed);
+		}
+		this->changed.notify_all();
+	}
+
+	void runBackground(StartupTask task)
+	{
+		// entries only grows, by unique_ptr, so the Entry stays put while the lock is let go to run it
+		Entry* running;
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			Entry& entry = *this->entries[task];
+			running = &entry;
+			this->changed.wait(lock, [this, &entry]() { return entry.state != StartupTaskState::Waiting || this->afterState(entry) != StartupTaskState::Waiting; });
+			// Skipped by join()
+			if (entry.state != StartupTaskState::Waiting)
+				return;
+			if (this->afterState(entry) == StartupTaskState::Failed)
+			{
+				this->settle(entry, StartupTaskState::Skipped);
+				lock.unlock();
+				this->changed.notify_all();
+				return;
+			}
+			this->begin(entry);
+		}
+		TRACE_THREAD(running->name.c_str());
+		_threadPolicy.apply(ThreadRole::Background);
+		_jobPriority() = JobPriority::Background;
+		this->finish(task, running->body());
+	}
+
+	// Under the lock
+	void print() const
+	{
+		static const char* states[] = { "waiting", "running", "ok", "failed", "skipped" };
+		printf("Startup timeline (ms):\r\n");
+		for (size_t i = 0; i < this->entries.size(); i++)
+		{
+			const Entry& entry = *this->entries[i];
+			printf("  %8.1f - %8.1f  %-24s %s%s\r\n", entry.startMs, entry.endMs, entry.name.c_str(), states[(int)entry.state],
+				entry.mainThread ? " (main thread)" : "");
+		}
+		for (size_t i = 0; i < this->marks.size(); i++)
+			printf("  %8.1f             %s\r\n", this->marks[i].ms, this->marks[i].name.c_str());
+	}
+};
+
+// Everything the app starts up, WinMain adds the first tasks
+static StartupTasks _startup;
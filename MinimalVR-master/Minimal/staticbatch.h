@@ -0,0 +1,481 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "glstate.h"
+#include "instancing.h"
+#include "mesh.h"
+#include "glcapture.h"
+#include "lightbake.h"
+#include "meshlets.h"
+#include "culling.h"
+#include "gldebug.h"
+
+// Uniform block binding of StaticBatchMaterials in shader.frag
+#define STATIC_BATCH_BINDING 3
+// Attribute location of the per draw material index, after the instance transform's four slots
+#define STATIC_BATCH_MATERIAL_LOCATION 9
+// Length of the material array in shader.frag, 48 bytes each keeps the block well inside the 16KB minimum
+#define STATIC_BATCH_MAX_MATERIALS 256
+// Every instance of a draw reads the material index at its baseInstance, however many instances it has
+#define STATIC_BATCH_MATERIAL_DIVISOR 0x40000000u
+// Shader defines of the batch programs, the array length has to be spelled out to match the one above
+#define STATIC_BATCH_DEFINE "#define STATIC_BATCH\n#define STATIC_BATCH_MAX_MATERIALS 256\n"
+
+// std140 element of the StaticBatchMaterials array: vec3s are 16 byte aligned, shininess fills out the last one
+struct StaticBatchMaterial
+{
+	glm::vec4 ambient;
+	glm::vec4 diffuse;
+	glm::vec3 specular;
+	float shininess;
+};
+static_assert(sizeof(StaticBatchMaterial) == 48, "StaticBatchMaterial must match the std140 layout of Material");
+
+// Layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// The meshes of a static model merged into one vertex and one index buffer behind a single VAO, with their
+// materials in a uniform block, so the whole model is drawn at once.
+//
+// Materials are deduplicated into a palette, and the meshes sharing one are merged into a single part: their
+// indices are rebased onto one another, so each part is a single draw however many meshes went into it. Meshes
+// with placements are pretransformed, a copy per placement, into the part of their material.
+//
+// With ARB_multi_draw_indirect (and ARB_base_instance) that is one glMultiDrawElementsIndirect: each command's
+// baseInstance picks its element of an instanced material index attribute, which shader.vert passes on to
+// index StaticBatchMaterials. On plain GL 4.1 the same buffers are drawn with one
+// glDrawElementsInstancedBaseVertex per part, the index set as a constant attribute in between,
+// which still saves the per mesh VAO and material uniform changes.
+// Given the meshes' meshlets and compute shaders, the batch also keeps one command per meshlet of every copy, for
+// drawMeshlets after cullMeshlets has zeroed the ones no eye sees.
+// Built and drawn on the drawing context. The meshes' buffers are read back once to merge them, so they may have
+// dropped their CPU data.
+class StaticBatch
+{
+public:
+	StaticBatch() {}
+	~StaticBatch()
+	{
+		if (this->vertexArray)
+			glDeleteVertexArrays(1, &this->vertexArray);
+		GLuint buffers[8] = { this->vertexBuffer, this->elementBuffer, this->materialBuffer, this->materialIndexBuffer, this->commandBuffer,
+			this->lightBakeBuffer, this->meshletBuffer, this->meshletCommandBuffer };
+		for (int i = 0; i < 8; i++)
+		{
+			if (buffers[i])
+				glDeleteBuffers(1, &buffers[i]);
+		}
+		if (this->meshletProgram)
+			glDeleteProgram(this->meshletProgram);
+	}
+
+	StaticBatch(const StaticBatch&) = delete;
+	StaticBatch& operator=(const StaticBatch&) = delete;
+
+	static bool multiDrawSupported()
+	{
+		return GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+	}
+
+	static bool meshletsSupported()
+	{
+		return multiDrawSupported() && GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_program_interface_query;
+	}
+
+	// placements, if given, has the model space transforms of every copy of each mesh, see Model::DrawPlaced.
+	// lightBakes, if given, has each mesh's baked lighting copy after copy, see _bakeLighting; it is dropped if it
+	// doesn't match the uploaded vertices. meshlets, if given, has each mesh's _buildMeshlets, dropped the same way
+	// if they don't cover its uploaded indices. False, leaving the batch empty, if a mesh is textured or there are
+	// more materials than the block holds.
+	bool build(const vector<Mesh>& meshes, const vector<vector<glm::mat4>>* placements = nullptr,
+		const vector<vector<uint32_t>>* lightBakes = nullptr, const vector<vector<Meshlet>>* meshlets = nullptr)
+	{
+		if (meshes.empty())
+			return false;
+		if (lightBakes && lightBakes->size() != meshes.size())
+			lightBakes = nullptr;
+		if (meshlets && (meshlets->size() != meshes.size() || !meshletsSupported()))
+			meshlets = nullptr;
+		for (size_t i = 0; meshlets && i < meshes.size(); i++)
+		{
+			const vector<Meshlet>& cut = (*meshlets)[i];
+			if (cut.empty() || cut.back().firstIndex + cut.back().indexCount != (uint32_t)meshes[i].uploadedIndices())
+				meshlets = nullptr;
+		}
+		for (size_t i = 0; lightBakes && i < meshes.size(); i++)
+		{
+			const size_t copies = placements ? (*placements)[i].size() : 1;
+			if ((*lightBakes)[i].size() != (size_t)meshes[i].uploadedVertices() * copies)
+				lightBakes = nullptr;
+		}
+		// Palette of the distinct materials, and the one each mesh uses
+		vector<StaticBatchMaterial> materials;
+		vector<uint32_t> meshMaterials(meshes.size());
+		bool wide = false;
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			const Mesh& mesh = meshes[i];
+			if (!mesh.batchable())
+				return false;
+			StaticBatchMaterial material;
+			material.ambient = glm::vec4(mesh.ambient(), 0.0f);
+			material.diffuse = glm::vec4(mesh.diffuse(), 0.0f);
+			material.specular = mesh.specular();
+			// Mesh::bindMaterial's fixed shininess
+			material.shininess = 50.0f;
+			size_t m = 0;
+			while (m < materials.size() && memcmp(&materials[m], &material, sizeof(StaticBatchMaterial)) != 0)
+				m++;
+			if (m == materials.size())
+			{
+				if (materials.size() == STATIC_BATCH_MAX_MATERIALS)
+					return false;
+				materials.push_back(material);
+			}
+			meshMaterials[i] = (uint32_t)m;
+			// A mesh too large for 16 bit indices makes all of them 32 bit, otherwise parts are split to fit
+			wide = wide || mesh.uploadedVertices() > 65536;
+		}
+		this->multiDraw = multiDrawSupported();
+		this->indexType = wide ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+
+		vector<Vertex> vertices;
+		vector<GLuint> indices;
+		vector<uint32_t> bakes;
+		vector<Vertex> meshVertices;
+		vector<GLuint> meshIndices;
+		vector<GLint> materialIndices;
+		this->commands.clear();
+		this->meshlets.clear();
+		this->partMeshes.clear();
+		this->partFirstMesh.clear();
+		for (uint32_t m = 0; m < materials.size(); m++)
+		{
+			bool open = false;
+			for (size_t i = 0; i < meshes.size(); i++)
+			{
+				if (meshMaterials[i] != m)
+					continue;
+				const Mesh& mesh = meshes[i];
+				readBack(mesh, &meshVertices, &meshIndices);
+				const glm::mat4 identity;
+				const size_t copies = placements ? (*placements)[i].size() : 1;
+				for (size_t c = 0; c < copies; c++)
+				{
+					// A new part when 16 bit indices would overflow, parts always start at their own baseVertex
+					if (open && !wide && vertices.size() - this->commands.back().baseVertex + meshVertices.size() > 65536)
+						open = false;
+					if (!open)
+					{
+						DrawElementsIndirectCommand command = { 0, 1, (GLuint)indices.size(), (GLint)vertices.size(), (GLuint)this->commands.size() };
+						this->commands.push_back(command);
+						this->partFirstMesh.push_back((uint32_t)this->partMeshes.size());
+						materialIndices.push_back((GLint)m);
+						open = true;
+					}
+					DrawElementsIndirectCommand& command = this->commands.back();
+					const GLuint rebase = (GLuint)(vertices.size() - command.baseVertex);
+					if (meshlets)
+						appendMeshlets((*meshlets)[i], placements ? &(*placements)[i][c] : nullptr, command, (GLuint)indices.size());
+					appendCopy(meshVertices, meshIndices, placements ? (*placements)[i][c] : identity, rebase, &vertices, &indices);
+					if (lightBakes)
+					{
+						const uint32_t* copyBake = (*lightBakes)[i].data() + c * meshVertices.size();
+						bakes.insert(bakes.end(), copyBake, copyBake + meshVertices.size());
+					}
+					command.count = (GLuint)indices.size() - command.firstIndex;
+					if (this->partMeshes.size() == this->partFirstMesh.back() || this->partMeshes.back() != (uint32_t)i)
+						this->partMeshes.push_back((uint32_t)i);
+				}
+			}
+		}
+		this->partFirstMesh.push_back((uint32_t)this->partMeshes.size());
+
+		glGenBuffers(1, &this->vertexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+		glGenBuffers(1, &this->elementBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, this->elementBuffer);
+		if (wide)
+		{
+			glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+		}
+		else
+		{
+			vector<GLushort> narrow(indices.begin(), indices.end());
+			glBufferData(GL_COPY_WRITE_BUFFER, narrow.size() * sizeof(GLushort), narrow.data(), GL_STATIC_DRAW);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		glGenBuffers(1, &this->materialBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, this->materialBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, materials.size() * sizeof(StaticBatchMaterial), materials.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		glGenVertexArrays(1, &this->vertexArray);
+		_glState.bindVertexArray(this->vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertexBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->elementBuffer);
+		_setVertexAttributes<Vertex>();
+		if (lightBakes)
+		{
+			glGenBuffers(1, &this->lightBakeBuffer);
+			glBindBuffer(GL_ARRAY_BUFFER, this->lightBakeBuffer);
+			glBufferData(GL_ARRAY_BUFFER, bakes.size() * sizeof(uint32_t), bakes.data(), GL_STATIC_DRAW);
+			glEnableVertexAttribArray(LIGHT_BAKE_LOCATION);
+			glVertexAttribPointer(LIGHT_BAKE_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(uint32_t), (GLvoid*)0);
+		}
+		if (this->multiDraw)
+		{
+			glGenBuffers(1, &this->materialIndexBuffer);
+			glBindBuffer(GL_ARRAY_BUFFER, this->materialIndexBuffer);
+			glBufferData(GL_ARRAY_BUFFER, materialIndices.size() * sizeof(GLint), materialIndices.data(), GL_STATIC_DRAW);
+			glEnableVertexAttribArray(STATIC_BATCH_MATERIAL_LOCATION);
+			glVertexAttribIPointer(STATIC_BATCH_MATERIAL_LOCATION, 1, GL_INT, sizeof(GLint), (GLvoid*)0);
+			glVertexAttribDivisor(STATIC_BATCH_MATERIAL_LOCATION, STATIC_BATCH_MATERIAL_DIVISOR);
+
+			glGenBuffers(1, &this->commandBuffer);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->commandBuffer);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, this->commands.size() * sizeof(DrawElementsIndirectCommand), this->commands.data(), GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+		if (!this->meshlets.empty())
+			this->uploadMeshlets();
+		this->materialIndices = std::move(materialIndices);
+		_glState.bindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return true;
+	}
+
+	void attachInstanceBuffer(GLuint buffer, GLuint divisor = 1)
+	{
+		_attachInstanceTransforms(this->vertexArray, buffer, divisor);
+	}
+
+	// Every mesh instanceCount times, with a program that has the STATIC_BATCH inputs. visible, if given, has one
+	// entry per mesh, a part is skipped when none of the meshes in it has a nonzero one.
+	void draw(GLsizei instanceCount, const uint8_t* visible = nullptr)
+	{
+		if (instanceCount <= 0)
+			return;
+		_glState.bindVertexArray(this->vertexArray);
+		glBindBufferBase(GL_UNIFORM_BUFFER, STATIC_BATCH_BINDING, this->materialBuffer);
+		if (this->multiDraw)
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->commandBuffer);
+			// Culled meshes keep their command with no instances. The commands are only rewritten when the stereo
+			// mode or what is visible changes, not every frame.
+			bool changed = false;
+			for (size_t i = 0; i < this->commands.size(); i++)
+			{
+				const GLuint count = this->partVisible(i, visible) ? (GLuint)instanceCount : 0;
+				changed = changed || this->commands[i].instanceCount != count;
+				this->commands[i].instanceCount = count;
+			}
+			if (changed)
+				glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, this->commands.size() * sizeof(DrawElementsIndirectCommand), this->commands.data());
+			glMultiDrawElementsIndirect(GL_TRIANGLES, this->indexType, 0, (GLsizei)this->commands.size(), 0);
+			_glCapture.drawElementsIndirect(GL_TRIANGLES, this->indexType, 0, (GLsizei)this->commands.size(), 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			return;
+		}
+		const size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		for (size_t i = 0; i < this->commands.size(); i++)
+		{
+			if (!this->partVisible(i, visible))
+				continue;
+			const DrawElementsIndirectCommand& command = this->commands[i];
+			glVertexAttribI1i(STATIC_BATCH_MATERIAL_LOCATION, this->materialIndices[i]);
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)command.count, this->indexType,
+				(GLvoid*)(command.firstIndex * indexSize), instanceCount, command.baseVertex);
+			_glCapture.drawElements(GL_TRIANGLES, (GLsizei)command.count, this->indexType,
+				(GLvoid*)(command.firstIndex * indexSize), instanceCount, command.baseVertex);
+			_renderStats.draw(GL_TRIANGLES, (GLsizei)command.count, instanceCount);
+		}
+	}
+
+	size_t partCount() const { return this->commands.size(); }
+
+	// Has meshlet commands that cullMeshlets can fill in
+	bool meshletCulled() const { return this->meshletProgram != 0; }
+	size_t meshletCount() const { return this->meshletCommands; }
+
+	// Writes the meshlet commands for eyes at eyes with frustum's planes, both in world space, the batch's vertices
+	// moved there by model: instanceCount instances of every meshlet either eye sees, none of the others. Leaves the
+	// cull program in use.
+	void cullMeshlets(const StereoFrustum& frustum, const glm::mat4& model, const glm::vec3 eyes[2], GLuint instanceCount)
+	{
+		GLDebugGroup group("meshlet cull");
+		glm::vec4 planes[12];
+		for (int e = 0; e < 2; e++)
+		{
+			for (int k = 0; k < 6; k++)
+				planes[e * 6 + k] = frustum.eyes[e].planes[k];
+		}
+		const glm::vec3 scales(glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2])));
+		const float scale = std::max(scales.x, std::max(scales.y, scales.z));
+		const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+		const GLuint cull = this->meshletProgram;
+		_glState.useProgram(cull);
+		glUniform1ui(glGetUniformLocation(cull, "count"), (GLuint)this->meshletCommands);
+		glUniformMatrix4fv(glGetUniformLocation(cull, "model"), 1, GL_FALSE, glm::value_ptr(model));
+		glUniformMatrix3fv(glGetUniformLocation(cull, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+		glUniform1f(glGetUniformLocation(cull, "modelScale"), scale);
+		// As in _transformMeshlet, a model scaled unevenly keeps the spheres but not the cones
+		glUniform1i(glGetUniformLocation(cull, "coneCulling"), std::min(scales.x, std::min(scales.y, scales.z)) >= scale * 0.999f ? 1 : 0);
+		glUniform4fv(glGetUniformLocation(cull, "planes"), 12, glm::value_ptr(planes[0]));
+		glUniform3fv(glGetUniformLocation(cull, "eyes"), 2, glm::value_ptr(eyes[0]));
+		glUniform1ui(glGetUniformLocation(cull, "instanceCount"), instanceCount);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->meshletBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->meshletCommandBuffer);
+		glDispatchCompute((GLuint)((this->meshletCommands + MESHLET_CULL_GROUP_SIZE - 1) / MESHLET_CULL_GROUP_SIZE), 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+	}
+
+	// The meshlet commands of the last cullMeshlets, with a program that has the STATIC_BATCH inputs
+	void drawMeshlets()
+	{
+		_glState.bindVertexArray(this->vertexArray);
+		glBindBufferBase(GL_UNIFORM_BUFFER, STATIC_BATCH_BINDING, this->materialBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->meshletCommandBuffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, this->indexType, 0, (GLsizei)this->meshletCommands, 0);
+		_glCapture.drawElementsIndirect(GL_TRIANGLES, this->indexType, 0, (GLsizei)this->meshletCommands, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// The vertices carry their baked lighting at LIGHT_BAKE_LOCATION
+	bool lightBaked() const { return this->lightBakeBuffer != 0; }
+
+private:
+	bool partVisible(size_t part, const uint8_t* visible) const
+	{
+		if (!visible)
+			return true;
+		for (uint32_t i = this->partFirstMesh[part]; i < this->partFirstMesh[part + 1]; i++)
+		{
+			if (visible[this->partMeshes[i]])
+				return true;
+		}
+		return false;
+	}
+
+	// The mesh's uploaded vertices and indices, indices widened to GLuint
+	static void readBack(const Mesh& mesh, vector<Vertex>* vertices, vector<GLuint>* indices)
+	{
+		vertices->resize(mesh.uploadedVertices());
+		glBindBuffer(GL_COPY_READ_BUFFER, mesh.vertexBlock().buffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, mesh.vertexBlock().offset, vertices->size() * sizeof(Vertex), vertices->data());
+		indices->resize(mesh.uploadedIndices());
+		glBindBuffer(GL_COPY_READ_BUFFER, mesh.elementBlock().buffer);
+		if (mesh.elementType() == GL_UNSIGNED_SHORT)
+		{
+			vector<GLushort> narrow(indices->size());
+			glGetBufferSubData(GL_COPY_READ_BUFFER, mesh.elementBlock().offset, narrow.size() * sizeof(GLushort), narrow.data());
+			std::copy(narrow.begin(), narrow.end(), indices->begin());
+		}
+		else
+		{
+			glGetBufferSubData(GL_COPY_READ_BUFFER, mesh.elementBlock().offset, indices->size() * sizeof(GLuint), indices->data());
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	// The meshlets of one copy of a mesh, moved by placement if it has one, its first index at firstIndex in the
+	// element buffer and drawn as part of command
+	void appendMeshlets(const vector<Meshlet>& cut, const glm::mat4* placement, const DrawElementsIndirectCommand& command, GLuint firstIndex)
+	{
+		for (const Meshlet& source : cut)
+		{
+			Meshlet meshlet = placement ? _transformMeshlet(source, *placement) : source;
+			meshlet.firstIndex += firstIndex;
+			meshlet.baseVertex = command.baseVertex;
+			meshlet.baseInstance = command.baseInstance;
+			this->meshlets.push_back(meshlet);
+		}
+	}
+
+	// The meshlets for the cull pass and room for its commands, the CPU copy is dropped after. Without the program
+	// the batch draws parts only.
+	void uploadMeshlets()
+	{
+		this->meshletProgram = _compileMeshletCullProgram();
+		if (!this->meshletProgram)
+		{
+			vector<Meshlet>().swap(this->meshlets);
+			return;
+		}
+		this->meshletCommands = this->meshlets.size();
+		glGenBuffers(1, &this->meshletBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->meshletBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, this->meshlets.size() * sizeof(Meshlet), this->meshlets.data(), GL_STATIC_DRAW);
+		glGenBuffers(1, &this->meshletCommandBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->meshletCommandBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, this->meshlets.size() * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		vector<Meshlet>().swap(this->meshlets);
+	}
+
+	// Appends one copy of a mesh moved by transform, its indices offset by rebase. Mirroring transforms flip the
+	// triangles so they keep facing out.
+	static void appendCopy(const vector<Vertex>& meshVertices, const vector<GLuint>& meshIndices, const glm::mat4& transform, GLuint rebase,
+		vector<Vertex>* vertices, vector<GLuint>* indices)
+	{
+		const bool moved = transform != glm::mat4();
+		const glm::mat3 normalTransform = glm::transpose(glm::inverse(glm::mat3(transform)));
+		for (const Vertex& source : meshVertices)
+		{
+			Vertex vertex = source;
+			if (moved)
+			{
+				vertex.Position = glm::vec3(transform * glm::vec4(source.Position, 1.0f));
+				if (source.Normal != glm::vec3(0.0f))
+					vertex.Normal = glm::normalize(normalTransform * source.Normal);
+			}
+			vertices->push_back(vertex);
+		}
+		const bool mirrored = glm::determinant(glm::mat3(transform)) < 0.0f;
+		for (size_t i = 0; i + 2 < meshIndices.size(); i += 3)
+		{
+			indices->push_back(meshIndices[i] + rebase);
+			indices->push_back(meshIndices[mirrored ? i + 2 : i + 1] + rebase);
+			indices->push_back(meshIndices[mirrored ? i + 1 : i + 2] + rebase);
+		}
+	}
+
+	GLuint vertexArray = 0;
+	GLuint vertexBuffer = 0;
+	GLuint elementBuffer = 0;
+	GLuint materialBuffer = 0;
+	GLuint materialIndexBuffer = 0;
+	GLuint commandBuffer = 0;
+	GLuint lightBakeBuffer = 0;
+	GLuint meshletBuffer = 0;
+	GLuint meshletCommandBuffer = 0;
+	GLuint meshletProgram = 0;
+	bool multiDraw = false;
+	GLenum indexType = GL_UNSIGNED_INT;
+	vector<DrawElementsIndirectCommand> commands;
+	// Every copy's meshlets, rebased into the merged buffers and onto their part's command, until uploaded
+	vector<Meshlet> meshlets;
+	size_t meshletCommands = 0;
+	// Material of each part, for the draws without multi draw
+	vector<GLint> materialIndices;
+	// The meshes merged into part p are partMeshes[partFirstMesh[p]] up to partFirstMesh[p + 1]
+	vector<uint32_t> partMeshes;
+	vector<uint32_t> partFirstMesh;
+};
@@ -0,0 +1,205 @@
+#pragma once
+// Std. Includes
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include "trace.h"
+#include "jobs.h"
+#include "threading.h"
+#include "timing.h"
+
+// Loads assets off the render thread.
+//
+// A loader thread owns a hidden window whose context shares objects with the app's, so the buffers,
+// textures and programs it creates can be drawn by the render thread. Each request's load() runs there
+// and may fan its parsing out over _jobs. A fence goes in behind its uploads, and the request's ready()
+// runs on the render thread from the first update() that finds that fence signalled.
+// Contexts share buffers but not VAOs, so anything loaded here must leave its VAOs to the drawing thread.
+// Before init(), or if the shared context couldn't be made, requests load inline on the calling thread.
+class AssetStreamer
+{
+public:
+	typedef std::function<void()> Step;
+	typedef std::function<void(float ms)> LoadListener;
+
+	AssetStreamer() {}
+	~AssetStreamer()
+	{
+		this->shutdown();
+	}
+
+	AssetStreamer(const AssetStreamer&) = delete;
+	AssetStreamer& operator=(const AssetStreamer&) = delete;
+
+	// Main thread (GLFW only creates windows there), with shareWith's context current
+	void init(GLFWwindow* shareWith)
+	{
+		if (this->context)
+			return;
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		this->context = glfwCreateWindow(1, 1, "loader", nullptr, shareWith);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+		if (!this->context)
+		{
+			cout << "ERROR::STREAMER::CONTEXT_NOT_CREATED" << endl;
+			return;
+		}
+		this->stopping = false;
+		this->loader = std::thread([this]() { this->run(); });
+	}
+
+	// Finishes the load in progress and drops everything else, with the app's context current
+	void shutdown()
+	{
+		if (!this->running())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stopping = true;
+			this->requests.clear();
+		}
+		this->wake.notify_one();
+		this->loader.join();
+
+		// Finished but never handed over, the objects are shared so they can be freed from this context
+		for (size_t i = 0; i < this->completed.size(); i++)
+			glDeleteSync(this->completed[i].fence);
+		for (size_t i = 0; i < this->landing.size(); i++)
+			glDeleteSync(this->landing[i].fence);
+		this->completed.clear();
+		this->landing.clear();
+		this->outstanding = 0;
+		glfwDestroyWindow(this->context);
+		this->context = nullptr;
+	}
+
+	bool running() const { return this->loader.joinable(); }
+
+	// Load listeners are called on the render thread right after each ready(), with the ms since its request
+	void subscribeLoads(LoadListener listener)
+	{
+		this->loadListeners.push_back(listener);
+	}
+
+	// Requests whose ready() hasn't run yet
+	int pending() const { return this->outstanding.load(std::memory_order_relaxed); }
+
+	// load runs on the loader thread with its context current, ready on the render thread once the GPU has the uploads
+	void request(Step load, Step ready)
+	{
+		if (!this->running())
+		{
+			load();
+			ready();
+			return;
+		}
+		this->outstanding.fetch_add(1, std::memory_order_relaxed);
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->requests.push_back(Request{ std::move(load), std::move(ready), _timeTicks() });
+		}
+		this->wake.notify_one();
+	}
+
+	// Render thread, once per frame: hands over every request whose uploads have landed. Never blocks.
+	void update()
+	{
+		TRACE_ZONE("asset update");
+		if (!this->running())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			for (size_t i = 0; i < this->completed.size(); i++)
+				this->landing.push_back(std::move(this->completed[i]));
+			this->completed.clear();
+		}
+
+		size_t kept = 0;
+		for (size_t i = 0; i < this->landing.size(); i++)
+		{
+			GLenum status = glClientWaitSync(this->landing[i].fence, 0, 0);
+			if (status == GL_TIMEOUT_EXPIRED)
+			{
+				this->landing[kept++] = std::move(this->landing[i]);
+				continue;
+			}
+			glDeleteSync(this->landing[i].fence);
+			if (status == GL_WAIT_FAILED)
+				cout << "ERROR::STREAMER::FENCE_WAIT_FAILED" << endl;
+			this->landing[i].ready();
+			this->outstanding.fetch_sub(1, std::memory_order_relaxed);
+			const float ms = (float)(_timeTicksToSeconds(_timeTicks() - this->landing[i].requested) * 1000.0);
+			for (const LoadListener& listener : this->loadListeners)
+				listener(ms);
+		}
+		this->landing.resize(kept);
+	}
+
+private:
+	struct Request
+	{
+		Step load;
+		Step ready;
+		int64_t requested;
+	};
+
+	struct Completion
+	{
+		GLsync fence;
+		Step ready;
+		int64_t requested;
+	};
+
+	GLFWwindow* context = nullptr;
+	std::thread loader;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	deque<Request> requests;
+	// Written by the loader under mutex, then moved to landing, which only the render thread touches
+	vector<Completion> completed;
+	vector<Completion> landing;
+	std::atomic<int> outstanding{ 0 };
+	vector<LoadListener> loadListeners;
+
+	void run()
+	{
+		TRACE_THREAD("asset loader");
+		_threadPolicy.apply(ThreadRole::Loader);
+		// What loading fans out over the workers waits behind the frame's jobs
+		_jobPriority() = JobPriority::Background;
+		glfwMakeContextCurrent(this->context);
+		std::unique_lock<std::mutex> lock(this->mutex);
+		for (;;)
+		{
+			this->wake.wait(lock, [this]() { return this->stopping || !this->requests.empty(); });
+			if (this->stopping)
+				break;
+			Request request = std::move(this->requests.front());
+			this->requests.pop_front();
+			lock.unlock();
+
+			request.load();
+			GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			// Unflushed, the fence could sit in this context's queue and never signal for the render thread
+			glFlush();
+
+			lock.lock();
+			this->completed.push_back(Completion{ fence, std::move(request.ready), request.requested });
+		}
+		lock.unlock();
+		glfwMakeContextCurrent(nullptr);
+	}
+};
+
+// The app's loader, started and stopped by GlfwApp::run
+static AssetStreamer _assets;
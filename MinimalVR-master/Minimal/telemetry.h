@@ -0,0 +1,230 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <algorithm>
+using namespace std;
+// OVR Includes
+#include <OVR_CAPI.h>
+#include "telemetrysink.h"
+
+// Compositor frames kept for the rolling percentiles, a bit under six seconds at 90 Hz
+#define TELEMETRY_WINDOW 512
+// Compositor frames between two summaries, which is also how often listeners are called and the log is written
+#define TELEMETRY_SUMMARY_FRAMES 90
+
+// Fixed size window of the most recent samples of one quantity
+class RollingStat
+{
+public:
+	RollingStat()
+	{
+		this->samples.reserve(TELEMETRY_WINDOW);
+		this->scratch.reserve(TELEMETRY_WINDOW);
+	}
+
+	void add(float value)
+	{
+		if (this->samples.size() < TELEMETRY_WINDOW)
+			this->samples.push_back(value);
+		else
+			this->samples[this->next] = value;
+		this->next = (this->next + 1) % TELEMETRY_WINDOW;
+	}
+
+	void clear()
+	{
+		this->samples.clear();
+		this->next = 0;
+	}
+
+	// p in [0, 1], 0 when there are no samples yet
+	float percentile(float p) const
+	{
+		if (this->samples.empty())
+			return 0.0f;
+		this->scratch.assign(this->samples.begin(), this->samples.end());
+		size_t rank = std::min((size_t)(p * (this->scratch.size() - 1) + 0.5f), this->scratch.size() - 1);
+		std::nth_element(this->scratch.begin(), this->scratch.begin() + rank, this->scratch.end());
+		return this->scratch[rank];
+	}
+
+private:
+	vector<float> samples;
+	mutable vector<float> scratch;
+	size_t next = 0;
+};
+
+// What the Oculus debug tool shows, over the last TELEMETRY_WINDOW compositor frames. Times are in milliseconds,
+// counters are totals since CompositorTelemetry::open().
+struct TelemetrySummary
+{
+	uint32_t compositorFrames = 0;
+	int appDroppedFrames = 0;
+	int compositorDroppedFrames = 0;
+	// Dropped since the previous summary, what a quality controller usually reacts to
+	int appDroppedRecently = 0;
+	int compositorDroppedRecently = 0;
+
+	bool aswAvailable = false;
+	bool aswActive = false;
+	int aswActivations = 0;
+	int aswPresentedFrames = 0;
+	int aswFailedFrames = 0;
+
+	float appGpuP50 = 0.0f, appGpuP90 = 0.0f, appGpuP99 = 0.0f;
+	float appCpuP50 = 0.0f, appCpuP99 = 0.0f;
+	float compositorGpuP50 = 0.0f, compositorGpuP99 = 0.0f;
+	float latencyP50 = 0.0f, latencyP99 = 0.0f;
+	// The SDK's own suggestion, below 1 means the app should render less
+	float adaptiveGpuScale = 1.0f;
+};
+
+// Reads ovr_GetPerfStats once per submitted frame. The SDK hands back up to ovrMaxProvidedFrameStats
+// compositor frames per call, newest first; every one not seen before is folded into the rolling stats.
+// Summaries go to the CSV log and, as Compositor records, to a TelemetrySink if there is one.
+class CompositorTelemetry
+{
+public:
+	typedef std::function<void(const TelemetrySummary&)> Listener;
+	typedef std::function<void(const ovrPerfStatsPerCompositorFrame&)> FrameListener;
+
+	CompositorTelemetry() {}
+	~CompositorTelemetry()
+	{
+		if (this->log)
+			fclose(this->log);
+	}
+
+	CompositorTelemetry(const CompositorTelemetry&) = delete;
+	CompositorTelemetry& operator=(const CompositorTelemetry&) = delete;
+
+	// Starts a session: the SDK counters are reset so they count from here. logPath may be null to skip the log,
+	// sink to write no records.
+	void open(ovrSession session, const char* logPath, TelemetrySink* sink = nullptr)
+	{
+		ovr_ResetPerfStats(session);
+		this->sink = sink && sink->isOpen() ? sink : nullptr;
+		if (this->sink)
+			this->sink->describe(TelemetryKind::Compositor, "TelemetrySummary");
+		this->lastCompositorFrame = -1;
+		this->framesSinceSummary = 0;
+		this->current = TelemetrySummary();
+		this->reported = TelemetrySummary();
+		if (!logPath)
+			return;
+		this->log = fopen(logPath, "w");
+		if (!this->log)
+		{
+			printf("ERROR::TELEMETRY::LOG_NOT_OPENED %s\n", logPath);
+			return;
+		}
+		fprintf(this->log, "compositor_frames,app_dropped,compositor_dropped,asw_active,asw_activations,asw_presented,asw_failed,"
+			"app_gpu_p50_ms,app_gpu_p90_ms,app_gpu_p99_ms,app_cpu_p50_ms,app_cpu_p99_ms,compositor_gpu_p50_ms,compositor_gpu_p99_ms,"
+			"latency_p50_ms,latency_p99_ms,adaptive_gpu_scale\n");
+	}
+
+	// Listeners are called on the render thread, right after poll() completes a summary
+	void subscribe(Listener listener)
+	{
+		this->listeners.push_back(listener);
+	}
+
+	// Frame listeners are called on the render thread from poll(), for each compositor frame not seen before, oldest
+	// first. ovr_GetPerfStats only returns a frame once, anything else that wants them has to get them from here.
+	void subscribeFrames(FrameListener listener)
+	{
+		this->frameListeners.push_back(listener);
+	}
+
+	// Call right after ovr_SubmitFrame, on the same thread
+	void poll(ovrSession session)
+	{
+		ovrPerfStats stats;
+		if (!OVR_SUCCESS(ovr_GetPerfStats(session, &stats)))
+			return;
+		this->current.aswAvailable = stats.AswIsAvailable != ovrFalse;
+		this->current.adaptiveGpuScale = stats.AdaptiveGpuPerformanceScale;
+
+		// Oldest first so the window stays in order
+		for (int i = stats.FrameStatsCount - 1; i >= 0; i--)
+		{
+			const ovrPerfStatsPerCompositorFrame& f = stats.FrameStats[i];
+			if (f.CompositorFrameIndex <= this->lastCompositorFrame)
+				continue;
+			this->lastCompositorFrame = f.CompositorFrameIndex;
+			this->newest = f;
+			for (const FrameListener& listener : this->frameListeners)
+				listener(f);
+
+			this->appGpu.add(f.AppGpuElapsedTime * 1000.0f);
+			this->appCpu.add(f.AppCpuElapsedTime * 1000.0f);
+			this->compositorGpu.add(f.CompositorGpuElapsedTime * 1000.0f);
+			this->latency.add(f.AppMotionToPhotonLatency * 1000.0f);
+
+			this->current.compositorFrames++;
+			this->current.appDroppedFrames = f.AppDroppedFrameCount;
+			this->current.compositorDroppedFrames = f.CompositorDroppedFrameCount;
+			this->current.aswActive = f.AswIsActive != ovrFalse;
+			this->current.aswActivations = f.AswActivatedToggleCount;
+			this->current.aswPresentedFrames = f.AswPresentedFrameCount;
+			this->current.aswFailedFrames = f.AswFailedFrameCount;
+			this->framesSinceSummary++;
+		}
+
+		if (this->framesSinceSummary >= TELEMETRY_SUMMARY_FRAMES)
+			this->summarize();
+	}
+
+	// The last completed summary
+	const TelemetrySummary& summary() const { return this->reported; }
+
+	// The newest compositor frame poll() has seen, null before the first
+	const ovrPerfStatsPerCompositorFrame* newestFrame() const { return this->lastCompositorFrame >= 0 ? &this->newest : nullptr; }
+
+private:
+	vector<Listener> listeners;
+	vector<FrameListener> frameListeners;
+	FILE* log = nullptr;
+	TelemetrySink* sink = nullptr;
+	int lastCompositorFrame = -1;
+	ovrPerfStatsPerCompositorFrame newest;
+	uint32_t framesSinceSummary = 0;
+	// Counters as of the latest compositor frame, percentiles are only filled in by summarize()
+	TelemetrySummary current;
+	TelemetrySummary reported;
+	RollingStat appGpu, appCpu, compositorGpu, latency;
+
+	void summarize()
+	{
+		TelemetrySummary s = this->current;
+		s.appDroppedRecently = s.appDroppedFrames - this->reported.appDroppedFrames;
+		s.compositorDroppedRecently = s.compositorDroppedFrames - this->reported.compositorDroppedFrames;
+		s.appGpuP50 = this->appGpu.percentile(0.5f);
+		s.appGpuP90 = this->appGpu.percentile(0.9f);
+		s.appGpuP99 = this->appGpu.percentile(0.99f);
+		s.appCpuP50 = this->appCpu.percentile(0.5f);
+		s.appCpuP99 = this->appCpu.percentile(0.99f);
+		s.compositorGpuP50 = this->compositorGpu.percentile(0.5f);
+		s.compositorGpuP99 = this->compositorGpu.percentile(0.99f);
+		s.latencyP50 = this->latency.percentile(0.5f);
+		s.latencyP99 = this->latency.percentile(0.99f);
+		this->reported = s;
+		this->framesSinceSummary = 0;
+
+		if (this->sink)
+			this->sink->write(TelemetryKind::Compositor, s, s.compositorFrames);
+		if (this->log)
+		{
+			fprintf(this->log, "%u,%d,%d,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+				s.compositorFrames, s.appDroppedFrames, s.compositorDroppedFrames, s.aswActive ? 1 : 0, s.aswActivations,
+				s.aswPresentedFrames, s.aswFailedFrames, s.appGpuP50, s.appGpuP90, s.appGpuP99, s.appCpuP50, s.appCpuP99,
+				s.compositorGpuP50, s.compositorGpuP99, s.latencyP50, s.latencyP99, s.adaptiveGpuScale);
+			fflush(this->log);
+		}
+		for (size_t i = 0; i < this->listeners.size(); i++)
+			this->listeners[i](s);
+	}
+};
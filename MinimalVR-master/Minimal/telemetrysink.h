@@ -0,0 +1,496 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <type_traits>
+using namespace std;
+// Windows Includes
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "framepipeline.h"
+#include "threading.h"
+#include "timing.h"
+#include "trace.h"
+
+// Records the queue holds, about half a MB of them; whatever finds it full is counted and dropped
+#define TELEMETRY_SINK_CAPACITY 4096
+#define TELEMETRY_RECORD_PAYLOAD 112
+// Records of one file block, and how long the writer sleeps when there is nothing to drain
+#define TELEMETRY_SINK_BLOCK_RECORDS 256
+#define TELEMETRY_SINK_DRAIN_MS 10
+// A file is closed and the next one started past this many bytes, and only the newest files are kept
+#define TELEMETRY_SINK_ROTATE_BYTES (16 << 20)
+#define TELEMETRY_SINK_FILES 4
+// Largest datagram sent, under a typical MTU, and how often the schema goes out again for listeners that joined late
+#define TELEMETRY_SINK_DATAGRAM 1200
+#define TELEMETRY_SINK_SCHEMA_SECONDS 5.0
+#define TELEMETRY_SCHEMA_MAGIC 0x314d4c54u
+#define TELEMETRY_BLOCK_MAGIC 0x4b4c4254u
+#define TELEMETRY_MAX_KINDS 16
+#define TELEMETRY_MAX_PARTS 8
+
+// What a record holds. A value larger than one record goes out as parts of the same key.
+enum class TelemetryKind : uint16_t
+{
+	// FrameProfiler: the frame's CPU and GPU ms, then each phase's CPU and GPU ms, floats, keyed by frame
+	FrameProfile,
+	// FrameProfiler: the frame's counters, uint32s, keyed by frame
+	FrameCounters,
+	// CompositorTelemetry: a TelemetrySummary as it is, keyed by compositor frame
+	Compositor,
+	// GpuBucketTimer: each bucket's GPU ms averaged over a window, then each one's worst frame, floats, keyed by
+	// the window's last frame
+	DrawBuckets,
+	Count
+};
+static_assert((int)TelemetryKind::Count <= TELEMETRY_MAX_KINDS, "Kinds index the writer's references");
+
+// One fixed size record, what producers copy into the queue. Unused payload bytes are zero, which is most of what
+// the compression takes out.
+struct TelemetryRecord
+{
+	// _timeTicks() when it was written
+	int64_t ticks;
+	uint16_t kind;
+	uint8_t part;
+	// Payload bytes used
+	uint8_t size;
+	// Frame index or whatever else ties the parts and kinds of one moment together
+	uint32_t key;
+	uint8_t payload[TELEMETRY_RECORD_PAYLOAD];
+};
+static_assert(sizeof(TelemetryRecord) == 128, "TelemetryRecord is written as it is");
+
+// Starts the schema, which starts every file and goes again into it whenever it changes: per described kind a
+// uint16 kind, a uint16 length and the text follow
+struct TelemetrySchemaHeader
+{
+	uint32_t magic;
+	uint16_t recordBytes;
+	uint16_t schemaCount;
+	int64_t ticksPerSecond;
+};
+static_assert(sizeof(TelemetrySchemaHeader) == 16, "TelemetrySchemaHeader is written as it is");
+
+// Starts each block of a file and each datagram. A block decodes on its own; dropped is the sink's total so far,
+// so a reader sees where records went missing.
+struct TelemetryBlockHeader
+{
+	uint32_t magic;
+	uint16_t records;
+	uint16_t codedBytes;
+	uint64_t dropped;
+};
+static_assert(sizeof(TelemetryBlockHeader) == 16, "TelemetryBlockHeader is written as it is");
+
+// Compression of one record: the XOR with the previous record of its kind and part in the block, which is mostly
+// zeros, run length coded as pairs of a zero run and a literal run, each at most 255, with the literals after them;
+// the same coding as the avatar stream's, see avatarnet.h. References keep their kind and part zeroed, so a reader
+// gets those back before it needs to know which reference to take.
+static void _encodeTelemetryRecord(const TelemetryRecord& record, const TelemetryRecord& reference, vector<uint8_t>* out)
+{
+	const uint8_t* data = (const uint8_t*)&record;
+	const uint8_t* previous = (const uint8_t*)&reference;
+	const uint32_t size = (uint32_t)sizeof(TelemetryRecord);
+	uint32_t i = 0;
+	while (i < size)
+	{
+		uint32_t zeros = 0;
+		while (i + zeros < size && zeros < 255 && data[i + zeros] == previous[i + zeros])
+			zeros++;
+		i += zeros;
+		const size_t literalsAt = out->size() + 1;
+		out->push_back((uint8_t)zeros);
+		out->push_back(0);
+		uint32_t literals = 0;
+		while (i < size && literals < 255 && data[i] != previous[i])
+		{
+			out->push_back(data[i] ^ previous[i]);
+			literals++;
+			i++;
+		}
+		(*out)[literalsAt] = (uint8_t)literals;
+	}
+}
+
+// Most bytes one record can code to, every other byte changed
+#define TELEMETRY_RECORD_CODED_MAX (sizeof(TelemetryRecord) * 3 / 2 + 2)
+
+// The records of one block, false if the block is damaged. For tools reading what the sink wrote.
+static bool _decodeTelemetryBlock(const TelemetryBlockHeader& header, const uint8_t* coded, vector<TelemetryRecord>* out)
+{
+	if (header.magic != TELEMETRY_BLOCK_MAGIC)
+		return false;
+	TelemetryRecord references[TELEMETRY_MAX_KINDS][TELEMETRY_MAX_PARTS];
+	memset(references, 0, sizeof(references));
+	size_t c = 0;
+	for (uint32_t r = 0; r < header.records; r++)
+	{
+		TelemetryRecord record;
+		uint8_t* bytes = (uint8_t*)&record;
+		uint32_t o = 0;
+		while (o < sizeof(TelemetryRecord))
+		{
+			if (c + 2 > header.codedBytes)
+				return false;
+			const uint32_t zeros = coded[c], literals = coded[c + 1];
+			c += 2;
+			if (o + zeros + literals > sizeof(TelemetryRecord) || c + literals > header.codedBytes)
+				return false;
+			memset(bytes + o, 0, zeros);
+			o += zeros;
+			memcpy(bytes + o, coded + c, literals);
+			o += literals;
+			c += literals;
+		}
+		// References keep their kind and part zeroed, so those come out of the XOR as they are
+		if (record.kind >= TELEMETRY_MAX_KINDS || record.part >= TELEMETRY_MAX_PARTS)
+			return false;
+		TelemetryRecord& reference = references[record.kind][record.part];
+		const uint8_t* previous = (const uint8_t*)&reference;
+		for (size_t i = 0; i < sizeof(TelemetryRecord); i++)
+			bytes[i] ^= previous[i];
+		out->push_back(record);
+		reference = record;
+		reference.kind = 0;
+		reference.part = 0;
+	}
+	return c == header.codedBytes;
+}
+
+// Where instrumentation writes, from any thread, without ever touching a file or a socket itself: records go into a
+// lock-free queue of bounded size and a background thread drains it into rotating compressed files, a UDP
+// listener or both. A full queue drops the record and counts it; nothing on the frame waits.
+//
+// Files are <path>.0, <path>.1 and so on, each TELEMETRY_SINK_ROTATE_BYTES or so, the TELEMETRY_SINK_FILES newest
+// kept. Each is a run of chunks, either the schema (TelemetrySchemaHeader, first and whenever a kind is described)
+// or a block of records (TelemetryBlockHeader and the coded records, _decodeTelemetryBlock reads them back).
+// Datagrams are one chunk each, the schema going out again now and then for listeners that joined late.
+class TelemetrySink
+{
+public:
+	TelemetrySink() {}
+	~TelemetrySink() { this->close(); }
+
+	TelemetrySink(const TelemetrySink&) = delete;
+	TelemetrySink& operator=(const TelemetrySink&) = delete;
+
+	// Either may be null. endpoint is "address:port", numeric.
+	bool open(const char* path, const char* endpoint)
+	{
+		this->close();
+		if (path && path[0])
+		{
+			this->path = path;
+			this->fileIndex = 0;
+			if (!this->nextFile())
+				this->path.clear();
+		}
+		if (endpoint && endpoint[0] && !this->openSocket(endpoint))
+			this->closeSocket();
+		if (!this->file && this->socket == INVALID_SOCKET)
+			return false;
+		this->stopping = false;
+		this->opened.store(true, std::memory_order_release);
+		this->writer = std::thread([this]() { this->run(); });
+		return true;
+	}
+
+	// Writes out whatever is queued and stops the writer
+	void close()
+	{
+		this->opened.store(false, std::memory_order_release);
+		if (this->writer.joinable())
+		{
+			this->stopping = true;
+			this->writer.join();
+		}
+		if (this->file)
+			fclose(this->file);
+		this->file = nullptr;
+		this->closeSocket();
+	}
+
+	bool isOpen() const { return this->opened.load(std::memory_order_acquire); }
+
+	// Names what a kind's payload holds, e.g. "f32 cpu_ms,gpu_ms". Once at startup, not on the frame.
+	void describe(TelemetryKind kind, const std::string& schema)
+	{
+		std::lock_guard<std::mutex> lock(this->schemaLock);
+		this->schema[(int)kind] = schema;
+		this->schemaChanged.store(true);
+	}
+
+	// Any thread. False, and counted, if the queue is full.
+	bool write(TelemetryKind kind, const void* payload, size_t size, uint32_t key, uint8_t part = 0)
+	{
+		if (!this->isOpen() || size > TELEMETRY_RECORD_PAYLOAD || part >= TELEMETRY_MAX_PARTS || kind >= TelemetryKind::Count)
+			return false;
+		TelemetryRecord record;
+		record.ticks = _timeTicks();
+		record.kind = (uint16_t)kind;
+		record.part = part;
+		record.size = (uint8_t)size;
+		record.key = key;
+		memcpy(record.payload, payload, size);
+		memset(record.payload + size, 0, TELEMETRY_RECORD_PAYLOAD - size);
+		if (this->queue.push(record))
+			return true;
+		this->droppedRecords.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	template <typename T>
+	bool write(TelemetryKind kind, const T& payload, uint32_t key)
+	{
+		static_assert(sizeof(T) <= TELEMETRY_RECORD_PAYLOAD, "One record's payload");
+		static_assert(std::is_trivially_copyable<T>::value, "Payloads are copied as bytes");
+		return this->write(kind, &payload, sizeof(T), key);
+	}
+
+	// size bytes as as many parts as they take, up to TELEMETRY_MAX_PARTS
+	bool writeParts(TelemetryKind kind, const void* payload, size_t size, uint32_t key)
+	{
+		bool written = true;
+		const uint8_t* bytes = (const uint8_t*)payload;
+		uint8_t part = 0;
+		do
+		{
+			const size_t taken = std::min(size, (size_t)TELEMETRY_RECORD_PAYLOAD);
+			written = this->write(kind, bytes, taken, key, part) && written;
+			bytes += taken;
+			size -= taken;
+		} while (size > 0 && ++part < TELEMETRY_MAX_PARTS);
+		return written && size == 0;
+	}
+
+	// Records lost to a full queue since open()
+	uint64_t dropped() const { return this->droppedRecords.load(std::memory_order_relaxed); }
+
+private:
+	MpscQueue<TelemetryRecord, TELEMETRY_SINK_CAPACITY> queue;
+	std::atomic<uint64_t> droppedRecords{ 0 };
+	std::atomic<bool> opened{ false };
+	std::atomic<bool> stopping{ false };
+	std::thread writer;
+
+	std::mutex schemaLock;
+	std::string schema[TELEMETRY_MAX_KINDS];
+	std::atomic<bool> schemaChanged{ false };
+
+	std::string path;
+	FILE* file = nullptr;
+	uint32_t fileIndex = 0;
+	size_t fileBytes = 0;
+
+	SOCKET socket = INVALID_SOCKET;
+	sockaddr_in endpoint;
+	bool winsockStarted = false;
+	double schemaSentSeconds = -1.0;
+
+	// Writer thread only
+	TelemetryRecord batch[TELEMETRY_SINK_BLOCK_RECORDS];
+	TelemetryRecord references[TELEMETRY_MAX_KINDS][TELEMETRY_MAX_PARTS];
+	vector<uint8_t> coded;
+
+	void run()
+	{
+		TRACE_THREAD("telemetry sink");
+		_threadPolicy.apply(ThreadRole::Background);
+		for (;;)
+		{
+			size_t count = 0;
+			while (count < TELEMETRY_SINK_BLOCK_RECORDS && this->queue.pop(&this->batch[count]))
+				count++;
+			if (this->schemaChanged.exchange(false))
+				this->writeSchema(true);
+			else if (this->socket != INVALID_SOCKET && _sessionSeconds() - this->schemaSentSeconds > TELEMETRY_SINK_SCHEMA_SECONDS)
+				this->writeSchema(false);
+			if (count)
+			{
+				if (this->file)
+					this->writeFile(count);
+				if (this->socket != INVALID_SOCKET)
+					this->send(count);
+				continue;
+			}
+			if (this->stopping)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(TELEMETRY_SINK_DRAIN_MS));
+		}
+	}
+
+	// Codes records from first on into this->coded until limit bytes could be passed, how many it took
+	size_t encode(size_t first, size_t count, size_t limit)
+	{
+		memset(this->references, 0, sizeof(this->references));
+		this->coded.resize(sizeof(TelemetryBlockHeader));
+		size_t r = first;
+		for (; r < count && this->coded.size() + TELEMETRY_RECORD_CODED_MAX <= limit; r++)
+		{
+			const TelemetryRecord& record = this->batch[r];
+			TelemetryRecord& reference = this->references[record.kind][record.part];
+			_encodeTelemetryRecord(record, reference, &this->coded);
+			reference = record;
+			reference.kind = 0;
+			reference.part = 0;
+		}
+		TelemetryBlockHeader header;
+		header.magic = TELEMETRY_BLOCK_MAGIC;
+		header.records = (uint16_t)(r - first);
+		header.codedBytes = (uint16_t)(this->coded.size() - sizeof(TelemetryBlockHeader));
+		header.dropped = this->dropped();
+		memcpy(this->coded.data(), &header, sizeof(header));
+		return r - first;
+	}
+
+	void writeFile(size_t count)
+	{
+		for (size_t first = 0; first < count;)
+		{
+			first += this->encode(first, count, 65535);
+			if (fwrite(this->coded.data(), 1, this->coded.size(), this->file) != this->coded.size())
+			{
+				printf("ERROR::TELEMETRY_SINK::WRITE_FAILED %s\n", this->path.c_str());
+				fclose(this->file);
+				this->file = nullptr;
+				return;
+			}
+			this->fileBytes += this->coded.size();
+		}
+		fflush(this->file);
+		if (this->fileBytes >= TELEMETRY_SINK_ROTATE_BYTES)
+		{
+			fclose(this->file);
+			this->file = nullptr;
+			this->nextFile();
+		}
+	}
+
+	void send(size_t count)
+	{
+		for (size_t first = 0; first < count;)
+		{
+			first += this->encode(first, count, TELEMETRY_SINK_DATAGRAM);
+			// Nothing is resent: a datagram the network drops is as lost as a record the queue drops
+			sendto(this->socket, (const char*)this->coded.data(), (int)this->coded.size(), 0, (const sockaddr*)&this->endpoint, sizeof(this->endpoint));
+		}
+	}
+
+	// The schema as it is now, into the file as well if it has changed, otherwise only to the listener
+	void writeSchema(bool changed)
+	{
+		vector<uint8_t> bytes;
+		{
+			std::lock_guard<std::mutex> lock(this->schemaLock);
+			this->schemaBytes(&bytes);
+		}
+		if (changed && this->file)
+		{
+			fwrite(bytes.data(), 1, bytes.size(), this->file);
+			this->fileBytes += bytes.size();
+		}
+		if (this->socket != INVALID_SOCKET)
+		{
+			// A schema that doesn't fit a datagram goes out cut short
+			sendto(this->socket, (const char*)bytes.data(), (int)std::min(bytes.size(), (size_t)TELEMETRY_SINK_DATAGRAM), 0,
+				(const sockaddr*)&this->endpoint, sizeof(this->endpoint));
+			this->schemaSentSeconds = _sessionSeconds();
+		}
+	}
+
+	void schemaBytes(vector<uint8_t>* bytes)
+	{
+		TelemetrySchemaHeader header;
+		header.magic = TELEMETRY_SCHEMA_MAGIC;
+		header.recordBytes = (uint16_t)sizeof(TelemetryRecord);
+		header.schemaCount = 0;
+		header.ticksPerSecond = _timeTicksPerSecond();
+		bytes->resize(sizeof(header));
+		for (int kind = 0; kind < TELEMETRY_MAX_KINDS; kind++)
+		{
+			const std::string& text = this->schema[kind];
+			if (text.empty())
+				continue;
+			const uint16_t fields[2] = { (uint16_t)kind, (uint16_t)std::min(text.size(), (size_t)UINT16_MAX) };
+			bytes->insert(bytes->end(), (const uint8_t*)fields, (const uint8_t*)fields + sizeof(fields));
+			bytes->insert(bytes->end(), text.begin(), text.begin() + fields[1]);
+			header.schemaCount++;
+		}
+		memcpy(bytes->data(), &header, sizeof(header));
+	}
+
+	// Opens <path>.<fileIndex>, writes the schema into it and deletes the file that falls out of the kept ones
+	bool nextFile()
+	{
+		const std::string name = this->path + "." + std::to_string(this->fileIndex);
+		this->file = fopen(name.c_str(), "wb");
+		if (!this->file)
+		{
+			printf("ERROR::TELEMETRY_SINK::FILE_NOT_OPENED %s\n", name.c_str());
+			return false;
+		}
+		if (this->fileIndex >= TELEMETRY_SINK_FILES)
+			remove((this->path + "." + std::to_string(this->fileIndex - TELEMETRY_SINK_FILES)).c_str());
+		this->fileIndex++;
+		vector<uint8_t> bytes;
+		{
+			std::lock_guard<std::mutex> lock(this->schemaLock);
+			this->schemaBytes(&bytes);
+		}
+		fwrite(bytes.data(), 1, bytes.size(), this->file);
+		this->fileBytes = bytes.size();
+		return true;
+	}
+
+	bool openSocket(const char* address)
+	{
+		char host[64];
+		unsigned port = 0;
+		if (sscanf(address, "%63[^:]:%u", host, &port) != 2 || !port || port > 65535)
+		{
+			printf("ERROR::TELEMETRY_SINK::BAD_ENDPOINT %s\n", address);
+			return false;
+		}
+		WSADATA data;
+		if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		{
+			printf("ERROR::TELEMETRY_SINK::WINSOCK_NOT_STARTED\n");
+			return false;
+		}
+		this->winsockStarted = true;
+		memset(&this->endpoint, 0, sizeof(this->endpoint));
+		this->endpoint.sin_family = AF_INET;
+		this->endpoint.sin_port = htons((u_short)port);
+		if (inet_pton(AF_INET, host, &this->endpoint.sin_addr) != 1)
+		{
+			printf("ERROR::TELEMETRY_SINK::BAD_ENDPOINT %s\n", address);
+			return false;
+		}
+		this->socket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (this->socket == INVALID_SOCKET)
+		{
+			printf("ERROR::TELEMETRY_SINK::SOCKET_NOT_CREATED %d\n", WSAGetLastError());
+			return false;
+		}
+		this->schemaSentSeconds = -1.0;
+		return true;
+	}
+
+	void closeSocket()
+	{
+		if (this->socket != INVALID_SOCKET)
+			closesocket(this->socket);
+		this->socket = INVALID_SOCKET;
+		if (this->winsockStarted)
+			WSACleanup();
+		this->winsockStarted = false;
+	}
+};
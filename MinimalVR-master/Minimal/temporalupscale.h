@@ -0,0 +1,305 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include "glstate.h"
+#include "gpumemory.h"
+#include "gldebug.h"
+#include "glcapture.h"
+
+// Texture units the reconstruction samples its inputs from, below the Hi-Z pyramid's
+#define TEMPORAL_UPSCALE_COLOR_UNIT 12
+#define TEMPORAL_UPSCALE_DEPTH_UNIT 13
+#define TEMPORAL_UPSCALE_HISTORY_UNIT 14
+// Jitter positions before the sequence repeats, the Halton (2, 3) points
+#define TEMPORAL_UPSCALE_PHASES 8
+// How much of each output pixel is the reprojected history, the rest is the frame's own sample
+#define TEMPORAL_UPSCALE_HISTORY_WEIGHT 0.9f
+// Resolution scale the upscaler starts the eyes at, the quality governor raises it where there is room
+#define TEMPORAL_UPSCALE_SCALE 0.7f
+
+// Full screen triangle from the vertex index alone
+static const char TEMPORAL_UPSCALE_VERTEX[] =
+	"#version 410 core\n"
+	"void main() {\n"
+	"    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+	"    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+	"}\n";
+
+// One output pixel of one eye: the frame's colour where the pixel's centre landed in the jittered,
+// lower resolution input, and the history where the pixel's point was last frame, found from the input's depth.
+// The history is clamped to the colours around the input sample, which is what keeps what moved on its own, and
+// what the reprojection got wrong, from ghosting.
+static const char TEMPORAL_UPSCALE_FRAGMENT[] =
+	"#version 410 core\n"
+	"uniform sampler2D color;\n"
+	"uniform sampler2D depth;\n"
+	"uniform sampler2D history;\n"
+	"uniform vec4 inputRect;\n"
+	"uniform vec4 outputRect;\n"
+	"uniform vec2 jitter;\n"
+	"uniform vec2 depthToNdc;\n"
+	"uniform mat4 reprojection;\n"
+	"uniform float historyWeight;\n"
+	"layout(location = 0) out vec4 display;\n"
+	"layout(location = 1) out vec4 accumulated;\n"
+	"void main() {\n"
+	"    vec2 uv = (gl_FragCoord.xy - outputRect.xy) / outputRect.zw;\n"
+	"    vec2 inputSize = vec2(textureSize(color, 0));\n"
+	"    vec2 sample = inputRect.xy + uv * inputRect.zw + jitter;\n"
+	"    vec4 current = texture(color, sample / inputSize);\n"
+	"    ivec2 center = ivec2(sample);\n"
+	"    ivec2 low = ivec2(inputRect.xy);\n"
+	"    ivec2 high = low + ivec2(inputRect.zw) - 1;\n"
+	"    vec4 lowest = current, highest = current;\n"
+	"    for (int y = -1; y <= 1; y++) {\n"
+	"        for (int x = -1; x <= 1; x++) {\n"
+	"            vec4 neighbour = texelFetch(color, clamp(center + ivec2(x, y), low, high), 0);\n"
+	"            lowest = min(lowest, neighbour);\n"
+	"            highest = max(highest, neighbour);\n"
+	"        }\n"
+	"    }\n"
+	"    float z = texelFetch(depth, clamp(center, low, high), 0).r * depthToNdc.x + depthToNdc.y;\n"
+	"    vec4 previous = reprojection * vec4(uv * 2.0 - 1.0, z, 1.0);\n"
+	"    vec2 previousUv = previous.xy / previous.w * 0.5 + 0.5;\n"
+	"    float weight = historyWeight;\n"
+	"    if (any(lessThan(previousUv, vec2(0.0))) || any(greaterThan(previousUv, vec2(1.0))))\n"
+	"        weight = 0.0;\n"
+	"    vec2 historyUv = (outputRect.xy + previousUv * outputRect.zw) / vec2(textureSize(history, 0));\n"
+	"    vec4 past = clamp(texture(history, historyUv), lowest, highest);\n"
+	"    display = mix(current, past, weight);\n"
+	"    accumulated = display;\n"
+	"}\n";
+
+// Temporal upscaling under the dynamic resolution: the eyes render into a target at the scaled viewports with
+// their projections moved by a sub-pixel jitter() each frame, and resolve() reconstructs the full eye viewports
+// from that and the accumulated history, into the swap chain texture and the next history at once. Over a few
+// frames each output pixel gathers samples from across its area, so the eye layer goes to the compositor at full
+// size from fewer shaded pixels.
+//
+// The motion is the camera's, from the input depth and the last frame's view projection; whatever moves in the
+// world, the molecules and the hands, only has the neighbourhood clamp. The history is dropped whenever a frame
+// is skipped or the output viewports change, the first frame after is the input alone, scaled up.
+//
+// Colours are the encoded values the eye target holds, the swap chain texture is written without
+// GL_FRAMEBUFFER_SRGB, so they are filtered and blended as they are. The history keeps them at half float.
+class TemporalUpscaler
+{
+public:
+	TemporalUpscaler() {}
+	~TemporalUpscaler()
+	{
+		if (this->program)
+			glDeleteProgram(this->program);
+		if (this->vertexArray)
+			glDeleteVertexArrays(1, &this->vertexArray);
+		if (this->historyTextures[0])
+			glDeleteTextures(2, this->historyTextures);
+	}
+
+	TemporalUpscaler(const TemporalUpscaler&) = delete;
+	TemporalUpscaler& operator=(const TemporalUpscaler&) = delete;
+
+	// targetSize is the swap chain texture's, the history is laid out like it
+	bool init(const glm::uvec2& targetSize)
+	{
+		GLuint vertex = this->compile(GL_VERTEX_SHADER, TEMPORAL_UPSCALE_VERTEX);
+		GLuint fragment = this->compile(GL_FRAGMENT_SHADER, TEMPORAL_UPSCALE_FRAGMENT);
+		if (!vertex || !fragment)
+		{
+			glDeleteShader(vertex);
+			glDeleteShader(fragment);
+			return false;
+		}
+		this->program = glCreateProgram();
+		glAttachShader(this->program, vertex);
+		glAttachShader(this->program, fragment);
+		glLinkProgram(this->program);
+		_glCapture.programSources(this->program, TEMPORAL_UPSCALE_VERTEX, TEMPORAL_UPSCALE_FRAGMENT);
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		GLint success = 0;
+		glGetProgramiv(this->program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetProgramInfoLog(this->program, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::UPSCALE::LINKING_FAILED\n" << infoLog << std::endl;
+			glDeleteProgram(this->program);
+			this->program = 0;
+			return false;
+		}
+		_glLabel(GL_PROGRAM, this->program, "temporal upscale");
+		glUseProgram(this->program);
+		glUniform1i(glGetUniformLocation(this->program, "color"), TEMPORAL_UPSCALE_COLOR_UNIT);
+		glUniform1i(glGetUniformLocation(this->program, "depth"), TEMPORAL_UPSCALE_DEPTH_UNIT);
+		glUniform1i(glGetUniformLocation(this->program, "history"), TEMPORAL_UPSCALE_HISTORY_UNIT);
+		glUseProgram(0);
+		this->inputRectLocation = glGetUniformLocation(this->program, "inputRect");
+		this->outputRectLocation = glGetUniformLocation(this->program, "outputRect");
+		this->jitterLocation = glGetUniformLocation(this->program, "jitter");
+		this->depthToNdcLocation = glGetUniformLocation(this->program, "depthToNdc");
+		this->reprojectionLocation = glGetUniformLocation(this->program, "reprojection");
+		this->historyWeightLocation = glGetUniformLocation(this->program, "historyWeight");
+		glGenVertexArrays(1, &this->vertexArray);
+
+		glGenTextures(2, this->historyTextures);
+		for (int i = 0; i < 2; i++)
+		{
+			glBindTexture(GL_TEXTURE_2D, this->historyTextures[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, targetSize.x, targetSize.y, 0, GL_RGBA, GL_FLOAT, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			_glLabel(GL_TEXTURE, this->historyTextures[i], "upscale history");
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		this->memory.reset(GpuMemoryCategory::EyeTargets, 2 * _gpuImageBytes(GL_RGBA16F, targetSize.x, targetSize.y));
+		return true;
+	}
+
+	bool initialized() const { return this->program != 0; }
+
+	// The offset for frame in NDC, for a viewport size pixels across; the projection is moved by it before the
+	// perspective divide, so the whole image shifts by under a pixel
+	glm::vec2 jitter(uint64_t frame, const ovrSizei& size) const
+	{
+		const uint32_t index = (uint32_t)(frame % TEMPORAL_UPSCALE_PHASES) + 1;
+		const glm::vec2 offset(this->halton(index, 2) - 0.5f, this->halton(index, 3) - 0.5f);
+		return offset * 2.0f / glm::vec2((float)size.w, (float)size.h);
+	}
+
+	static glm::mat4 jittered(const glm::mat4& projection, const glm::vec2& jitter)
+	{
+		return glm::translate(glm::mat4(1.0f), glm::vec3(jitter, 0.0f)) * projection;
+	}
+
+	// This frame's history, for the reconstruction to write as its second colour attachment
+	GLuint historyTarget() const { return this->historyTextures[this->current]; }
+
+	// Before the eyes are resolved: the history from last frame is only used if it came from the frame before
+	// with the same output viewports
+	void begin(uint64_t frame, const ovrRecti outputs[2])
+	{
+		bool same = this->lastFrame + 1 == frame;
+		for (int eye = 0; eye < 2; eye++)
+		{
+			same = same && outputs[eye].Pos.x == this->outputs[eye].Pos.x && outputs[eye].Pos.y == this->outputs[eye].Pos.y &&
+				outputs[eye].Size.w == this->outputs[eye].Size.w && outputs[eye].Size.h == this->outputs[eye].Size.h;
+			this->outputs[eye] = outputs[eye];
+		}
+		this->historyValid = same;
+		this->lastFrame = frame;
+	}
+
+	// One eye from the eye target's color and depth into the bound draw framebuffer, whose first attachment is the
+	// swap chain texture and second historyTarget(). input is the eye's viewport in the eye target, viewProj its
+	// camera without the jitter. Leaves the viewport at the eye's output.
+	void resolve(int eye, GLuint color, GLuint depth, const ovrRecti& input, const glm::vec2& jitterNdc,
+		const glm::mat4& viewProj, bool reversed)
+	{
+		const ovrRecti& output = this->outputs[eye];
+		const glm::mat4 reprojection = this->historyValid ? this->previousViewProj[eye] * glm::inverse(viewProj) : glm::mat4(1.0f);
+		// The jitter moved the geometry by this many input pixels
+		const glm::vec2 jitterPixels = jitterNdc * 0.5f * glm::vec2((float)input.Size.w, (float)input.Size.h);
+
+		const GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+		const GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_CULL_FACE);
+		_glState.blend(false);
+		_glState.useProgram(this->program);
+		_glState.bindVertexArray(this->vertexArray);
+		_glState.selectTexture(TEMPORAL_UPSCALE_COLOR_UNIT, color);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		_glState.selectTexture(TEMPORAL_UPSCALE_DEPTH_UNIT, depth);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+		_glState.selectTexture(TEMPORAL_UPSCALE_HISTORY_UNIT, this->historyTextures[1 - this->current]);
+
+		glUniform4f(this->inputRectLocation, (float)input.Pos.x, (float)input.Pos.y, (float)input.Size.w, (float)input.Size.h);
+		glUniform4f(this->outputRectLocation, (float)output.Pos.x, (float)output.Pos.y, (float)output.Size.w, (float)output.Size.h);
+		glUniform2f(this->jitterLocation, jitterPixels.x, jitterPixels.y);
+		// Reversed depth clips to [0, 1], the conventional way to [-1, 1]
+		glUniform2f(this->depthToNdcLocation, reversed ? 1.0f : 2.0f, reversed ? 0.0f : -1.0f);
+		glUniformMatrix4fv(this->reprojectionLocation, 1, GL_FALSE, &reprojection[0][0]);
+		glUniform1f(this->historyWeightLocation, this->historyValid ? TEMPORAL_UPSCALE_HISTORY_WEIGHT : 0.0f);
+		glViewport(output.Pos.x, output.Pos.y, output.Size.w, output.Size.h);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		_glCapture.drawArrays(GL_TRIANGLES, 0, 3);
+		_renderStats.draw(GL_TRIANGLES, 3);
+
+		_glState.blend(true);
+		if (depthTest)
+			glEnable(GL_DEPTH_TEST);
+		if (cullFace)
+			glEnable(GL_CULL_FACE);
+		this->previousViewProj[eye] = viewProj;
+	}
+
+	// After both eyes: what was written becomes the history the next frame reads
+	void end()
+	{
+		this->current = 1 - this->current;
+	}
+
+private:
+	GLuint program = 0;
+	GLuint vertexArray = 0;
+	GLuint historyTextures[2] = { 0, 0 };
+	GpuAllocation memory;
+	int current = 0;
+	bool historyValid = false;
+	uint64_t lastFrame = 0;
+	ovrRecti outputs[2] = {};
+	glm::mat4 previousViewProj[2];
+	GLint inputRectLocation = -1;
+	GLint outputRectLocation = -1;
+	GLint jitterLocation = -1;
+	GLint depthToNdcLocation = -1;
+	GLint reprojectionLocation = -1;
+	GLint historyWeightLocation = -1;
+
+	static float halton(uint32_t index, uint32_t base)
+	{
+		float result = 0.0f;
+		float fraction = 1.0f / (float)base;
+		while (index > 0)
+		{
+			result += fraction * (float)(index % base);
+			index /= base;
+			fraction /= (float)base;
+		}
+		return result;
+	}
+
+	GLuint compile(GLenum type, const char* source)
+	{
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+		GLint success = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::UPSCALE::COMPILATION_FAILED\n" << infoLog << std::endl;
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+};
+
+static TemporalUpscaler _temporalUpscaler;
@@ -0,0 +1,607 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cctype>
+#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+#include <wincodec.h>
+#include <wrl/client.h>
+// GL Includes
+#include <GL/glew.h>
+#include "jobs.h"
+#include "compressedtexture.h"
+#include "gpumemory.h"
+#include "gldebug.h"
+#include "trace.h"
+
+// An image decoded to RGBA8 with its full mip chain, level 0 first
+struct DecodedImage
+{
+	struct Level
+	{
+		GLsizei width;
+		GLsizei height;
+		vector<uint8_t> pixels;
+	};
+	vector<Level> levels;
+};
+
+// Decodes any format WIC has a codec for (PNG, JPEG, BMP, TIFF, GIF...) into level 0 of image. Rows stay top down,
+// which is what Assimp's FlipUVs texture coordinates expect. Usable from any thread.
+static bool _decodeImage(const string& path, DecodedImage* image)
+{
+	using Microsoft::WRL::ComPtr;
+	// WIC is COM, so every decoding thread needs an apartment. Already having one (of either kind) is fine.
+	static thread_local HRESULT apartment = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	(void)apartment;
+
+	ComPtr<IWICImagingFactory> factory;
+	if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory))))
+		return false;
+
+	int wideLength = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+	if (wideLength <= 0)
+		return false;
+	vector<WCHAR> widePath(wideLength);
+	MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, widePath.data(), wideLength);
+
+	ComPtr<IWICBitmapDecoder> decoder;
+	ComPtr<IWICBitmapFrameDecode> frame;
+	ComPtr<IWICFormatConverter> converter;
+	if (FAILED(factory->CreateDecoderFromFilename(widePath.data(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder)) ||
+		FAILED(decoder->GetFrame(0, &frame)) ||
+		FAILED(factory->CreateFormatConverter(&converter)) ||
+		FAILED(converter->Initialize(frame.Get(), GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom)))
+	{
+		return false;
+	}
+
+	UINT width = 0, height = 0;
+	if (FAILED(converter->GetSize(&width, &height)) || width == 0 || height == 0)
+		return false;
+	image->levels.resize(1);
+	DecodedImage::Level& base = image->levels[0];
+	base.width = (GLsizei)width;
+	base.height = (GLsizei)height;
+	base.pixels.resize((size_t)width * height * 4);
+	return SUCCEEDED(converter->CopyPixels(nullptr, width * 4, (UINT)base.pixels.size(), base.pixels.data()));
+}
+
+// Appends the rest of the mip chain to a decoded level 0, each level a 2x2 box filter of the one above.
+// On odd sizes the last row or column is reused rather than read past.
+static void _buildMipChain(DecodedImage* image)
+{
+	while (image->levels.back().width > 1 || image->levels.back().height > 1)
+	{
+		const DecodedImage::Level& above = image->levels.back();
+		DecodedImage::Level level;
+		level.width = std::max(above.width / 2, 1);
+		level.height = std::max(above.height / 2, 1);
+		level.pixels.resize((size_t)level.width * level.height * 4);
+		for (GLsizei y = 0; y < level.height; y++)
+		{
+			const GLsizei y0 = std::min(y * 2, above.height - 1), y1 = std::min(y * 2 + 1, above.height - 1);
+			for (GLsizei x = 0; x < level.width; x++)
+			{
+				const GLsizei x0 = std::min(x * 2, above.width - 1), x1 = std::min(x * 2 + 1, above.width - 1);
+				const uint8_t* a = &above.pixels[((size_t)y0 * above.width + x0) * 4];
+				const uint8_t* b = &above.pixels[((size_t)y0 * above.width + x1) * 4];
+				const uint8_t* c = &above.pixels[((size_t)y1 * above.width + x0) * 4];
+				const uint8_t* d = &above.pixels[((size_t)y1 * above.width + x1) * 4];
+				uint8_t* out = &level.pixels[((size_t)y * level.width + x) * 4];
+				for (int channel = 0; channel < 4; channel++)
+					out[channel] = (uint8_t)((a[channel] + b[channel] + c[channel] + d[channel] + 2) / 4);
+			}
+		}
+		// Moved in last, push_back may reallocate and above refers into levels
+		image->levels.push_back(std::move(level));
+	}
+}
+
+// Uploads every level of image into a new texture, needs a current GL context
+static GLuint _uploadImage(const DecodedImage& image)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	for (size_t i = 0; i < image.levels.size(); i++)
+	{
+		const DecodedImage::Level& level = image.levels[i];
+		glTexImage2D(GL_TEXTURE_2D, (GLint)i, GL_RGBA8, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, level.pixels.data());
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+// Opens the block compressed form of path: path itself if it is a .dds or .ktx, otherwise a .ktx or .dds
+// next to it with the same name, as written by _compressImageFile
+static bool _openCompressedSibling(const string& path, CompressedImage* image)
+{
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	string stem = (dot != string::npos && (slash == string::npos || dot > slash)) ? path.substr(0, dot) : path;
+	string extension = path.substr(stem.size());
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	if (extension == ".dds" || extension == ".ktx")
+		return image->open(path);
+	return image->open(stem + ".ktx") || image->open(stem + ".dds");
+}
+
+// Decodes any WIC readable image and writes it with its full mip chain as a BC1 DDS, or BC3 when withAlpha.
+// The levels are encoded in parallel on the job system.
+static bool _compressImageFile(const string& inputPath, const string& outputPath, bool withAlpha)
+{
+	DecodedImage image;
+	if (!_decodeImage(inputPath, &image))
+	{
+		cout << "ERROR::TEXTURE::DECODE_FAILED " << inputPath << endl;
+		return false;
+	}
+	_buildMipChain(&image);
+	vector<vector<uint8_t>> blocks(image.levels.size());
+	_jobs.parallelFor(image.levels.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			_encodeCompressedLevel(image.levels[i].pixels.data(), image.levels[i].width, image.levels[i].height, withAlpha, &blocks[i]);
+	});
+	return _writeCompressedDDS(outputPath, image.levels[0].width, image.levels[0].height, withAlpha, blocks);
+}
+
+// Compressed textures larger than this on a side come up with only the levels this size and smaller, the finer ones
+// stream in once a draw shows the texture large enough to need them
+#define TEXTURE_STREAM_RESIDENT_SIZE 128
+// Bytes of streamed levels uploaded per frame, the rest wait for the next
+#define TEXTURE_STREAM_FRAME_BYTES (4 << 20)
+// Level loads out on the job system at once
+#define TEXTURE_STREAM_MAX_LOADS 4
+// Frames a streamed level stays needed after the last draw that asked for it, trim() only drops older ones
+#define TEXTURE_STREAM_KEEP_FRAMES 90
+
+// Every texture loaded from a file, keyed by its path and reference counted, so an image many
+// materials point at is decoded and uploaded once. A prebuilt .ktx/.dds beside the source is preferred and
+// uploaded as is. Otherwise decoding and mip generation run on the job system, and only the upload happens
+// on the calling thread (whose context must share with the one drawing).
+// A texture nothing references any more stays loaded, so a scene loaded again finds it, until evict() wants the
+// room back; the least recently released goes first. Every texture is charged to GpuMemoryCategory::Textures.
+// Large compressed textures are streamed: only their coarse levels are uploaded at first, and GL_TEXTURE_BASE_LEVEL
+// keeps sampling to the levels that are there. Draws report how large they show a texture with want(), stream()
+// loads the finer levels that asks for from the file or _assetPack on the job system and uploads them a few a frame,
+// and trim() drops the finest levels nothing has needed lately when the budget wants memory back. The texture's id
+// never changes, so meshes keep their references throughout. WIC decoded textures are always whole.
+// Acquiring and releasing are safe from the render and loader threads at once, streaming is the render thread's.
+class TextureCache
+{
+public:
+	TextureCache() {}
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// --no-texture-streaming uploads every level of every texture when it is acquired
+	void setStreaming(bool streaming) { this->streaming = streaming; }
+
+	// One reference per path, ids[i] is 0 where the file couldn't be decoded
+	void acquire(const vector<string>& paths, vector<GLuint>* ids)
+	{
+		AllocationTagScope tagScope(AllocationTag::Textures);
+		ids->assign(paths.size(), 0);
+
+		// Hits are taken right away, each missing file is decoded once however often the batch names it
+		vector<string> missing;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			for (size_t i = 0; i < paths.size(); i++)
+			{
+				auto found = this->byPath.find(paths[i]);
+				if (found != this->byPath.end())
+				{
+					this->reference(found->second);
+					(*ids)[i] = found->second.id;
+				}
+				else if (std::find(missing.begin(), missing.end(), paths[i]) == missing.end())
+				{
+					missing.push_back(paths[i]);
+				}
+			}
+		}
+		if (missing.empty())
+			return;
+
+		// Compressed files need no decoding, their blocks go straight from the mapping to the driver
+		vector<GLuint> uploaded(missing.size(), 0);
+		vector<int64_t> sizes(missing.size(), 0);
+		vector<Entry> streamed(missing.size());
+		vector<size_t> toDecode;
+		for (size_t m = 0; m < missing.size(); m++)
+		{
+			CompressedImage compressed;
+			if (_openCompressedSibling(missing[m], &compressed))
+			{
+				const vector<CompressedImage::Level>& levels = compressed.mipLevels();
+				size_t first = 0;
+				if (this->streaming)
+				{
+					while (first + 1 < levels.size() && std::max(levels[first].width, levels[first].height) > TEXTURE_STREAM_RESIDENT_SIZE)
+						first++;
+				}
+				uploaded[m] = _uploadCompressedImage(compressed, first);
+				for (size_t i = first; i < levels.size(); i++)
+					sizes[m] += levels[i].size;
+				if (first > 0)
+				{
+					Entry& stream = streamed[m];
+					stream.format = compressed.format();
+					stream.size = std::max(levels[0].width, levels[0].height);
+					for (size_t i = 0; i < levels.size(); i++)
+						stream.levelBytes.push_back(levels[i].size);
+					stream.base = (int)first;
+					stream.resident = (int)first;
+					stream.needed = (int)first;
+				}
+			}
+			else
+			{
+				toDecode.push_back(m);
+			}
+		}
+
+		vector<DecodedImage> images(toDecode.size());
+		vector<char> decoded(toDecode.size(), 0);
+		_jobs.parallelFor(toDecode.size(), 1, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				decoded[i] = _decodeImage(missing[toDecode[i]], &images[i]);
+				if (decoded[i])
+					_buildMipChain(&images[i]);
+			}
+		});
+		for (size_t i = 0; i < toDecode.size(); i++)
+		{
+			if (!decoded[i])
+			{
+				cout << "ERROR::TEXTURE::DECODE_FAILED " << missing[toDecode[i]] << endl;
+				continue;
+			}
+			uploaded[toDecode[i]] = _uploadImage(images[i]);
+			for (size_t level = 0; level < images[i].levels.size(); level++)
+				sizes[toDecode[i]] += (int64_t)images[i].levels[level].pixels.size();
+			vector<DecodedImage::Level>().swap(images[i].levels);
+		}
+
+		for (size_t m = 0; m < missing.size(); m++)
+		{
+			GLuint id = uploaded[m];
+			if (!id)
+				continue;
+			_glLabel(GL_TEXTURE, id, missing[m].c_str());
+
+			std::lock_guard<std::mutex> lock(this->mutex);
+			auto found = this->byPath.find(missing[m]);
+			if (found != this->byPath.end())
+			{
+				// Another thread loaded it meanwhile, keep theirs
+				glDeleteTextures(1, &id);
+				id = found->second.id;
+			}
+			else
+			{
+				Entry entry = std::move(streamed[m]);
+				entry.id = id;
+				entry.references = 0;
+				entry.bytes = sizes[m];
+				entry.released = 0;
+				_gpuMemory.charge(GpuMemoryCategory::Textures, entry.bytes);
+				// Unused until the references below
+				this->unused += entry.bytes;
+				this->byPath[missing[m]] = entry;
+				this->pathOf[id] = missing[m];
+				found = this->byPath.find(missing[m]);
+			}
+			for (size_t i = 0; i < paths.size(); i++)
+			{
+				if (paths[i] == missing[m])
+				{
+					this->reference(found->second);
+					(*ids)[i] = id;
+				}
+			}
+		}
+	}
+
+	GLuint acquire(const string& path)
+	{
+		vector<GLuint> ids;
+		this->acquire(vector<string>(1, path), &ids);
+		return ids[0];
+	}
+
+	// Drops one reference to id, with the last one the texture becomes unused and evict() may delete it. 0 is
+	// ignored.
+	void release(GLuint id)
+	{
+		if (!id)
+			return;
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto path = this->pathOf.find(id);
+		if (path == this->pathOf.end())
+			return;
+		Entry& entry = this->byPath.find(path->second)->second;
+		if (--entry.references > 0)
+			return;
+		entry.released = ++this->releases;
+		this->unused += entry.bytes;
+	}
+
+	// Deletes unused textures, least recently released first, until bytes are given back or none are left. Returns
+	// what was given back. Needs a current context.
+	int64_t evict(int64_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		int64_t freed = 0;
+		while (freed < bytes && this->unused > 0)
+		{
+			auto oldest = this->byPath.end();
+			for (auto it = this->byPath.begin(); it != this->byPath.end(); ++it)
+			{
+				if (it->second.references == 0 && (oldest == this->byPath.end() || it->second.released < oldest->second.released))
+					oldest = it;
+			}
+			if (oldest == this->byPath.end())
+				break;
+			glDeleteTextures(1, &oldest->second.id);
+			_gpuMemory.release(GpuMemoryCategory::Textures, oldest->second.bytes);
+			this->unused -= oldest->second.bytes;
+			freed += oldest->second.bytes;
+			this->pathOf.erase(oldest->second.id);
+			this->byPath.erase(oldest);
+		}
+		return freed;
+	}
+
+	// A draw shows id about pixels across on the texture's larger side, so the level that is about one texel per
+	// pixel is needed. Render thread, 0 and textures that aren't streamed are ignored.
+	void want(GLuint id, float pixels)
+	{
+		if (!id)
+			return;
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto path = this->pathOf.find(id);
+		if (path == this->pathOf.end())
+			return;
+		Entry& entry = this->byPath.find(path->second)->second;
+		if (entry.levelBytes.empty())
+			return;
+		const float level = std::floor(std::log2((float)entry.size / std::max(pixels, 1.0f)));
+		entry.wanted = std::min(entry.wanted, (int)std::min(std::max(level, 0.0f), (float)entry.base));
+	}
+
+	// Render thread, once a frame after the draws have called want(): uploads up to uploadBytes of the levels that
+	// have been loaded, coarsest first so every upload can lower the base level, then sends the textures needing
+	// finer levels than they have off to load them. Needs a current context.
+	void stream(uint64_t frame, int64_t uploadBytes)
+	{
+		vector<Arrival> arrived;
+		{
+			std::lock_guard<std::mutex> lock(this->arrivalMutex);
+			arrived.swap(this->arrived);
+		}
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->frame = frame;
+		int64_t uploaded = 0;
+		for (size_t a = 0; a < arrived.size(); a++)
+		{
+			Arrival& arrival = arrived[a];
+			auto found = this->byPath.find(arrival.path);
+			// Evicted while loading, or evicted and loaded again with another id
+			if (found == this->byPath.end() || found->second.id != arrival.id)
+				continue;
+			Entry& entry = found->second;
+			if (arrival.levels.empty())
+			{
+				// The file went away, what is resident is all there will be
+				entry.base = entry.resident;
+				entry.loading = false;
+				continue;
+			}
+			glBindTexture(GL_TEXTURE_2D, entry.id);
+			while (!arrival.levels.empty() && (uploaded < uploadBytes || uploaded == 0))
+			{
+				const int level = entry.resident - 1;
+				const vector<uint8_t>& data = arrival.levels.back();
+				glCompressedTexImage2D(GL_TEXTURE_2D, level, entry.format, arrival.widths.back(), arrival.heights.back(), 0, (GLsizei)data.size(), data.data());
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+				entry.resident = level;
+				entry.bytes += (int64_t)data.size();
+				if (entry.references == 0)
+					this->unused += (int64_t)data.size();
+				_gpuMemory.charge(GpuMemoryCategory::Textures, (int64_t)data.size());
+				uploaded += (int64_t)data.size();
+				arrival.levels.pop_back();
+				arrival.widths.pop_back();
+				arrival.heights.pop_back();
+			}
+			glBindTexture(GL_TEXTURE_2D, 0);
+			if (arrival.levels.empty())
+			{
+				entry.loading = false;
+			}
+			else
+			{
+				// Out of this frame's budget, the rest go up next frame
+				std::lock_guard<std::mutex> arrivalLock(this->arrivalMutex);
+				this->arrived.push_back(std::move(arrival));
+			}
+		}
+
+		// A need lasts TEXTURE_STREAM_KEEP_FRAMES past the last draw that asked for it, unless a finer one comes
+		const JobPriority priority = _jobPriority();
+		_jobPriority() = JobPriority::Background;
+		for (auto it = this->byPath.begin(); it != this->byPath.end(); ++it)
+		{
+			Entry& entry = it->second;
+			if (entry.levelBytes.empty())
+				continue;
+			if (entry.wanted <= entry.needed || (entry.wanted != INT_MAX && frame - entry.neededFrame > TEXTURE_STREAM_KEEP_FRAMES))
+			{
+				entry.needed = entry.wanted;
+				entry.neededFrame = frame;
+			}
+			entry.wanted = INT_MAX;
+			if (entry.loading || entry.needed >= entry.resident || entry.references == 0 || this->loads.load() >= TEXTURE_STREAM_MAX_LOADS)
+				continue;
+			entry.loading = true;
+			this->loads++;
+			const string path = it->first;
+			const GLuint id = entry.id;
+			const int first = entry.needed, last = entry.resident;
+			_jobs.run([this, path, id, first, last]()
+			{
+				TRACE_ZONE("stream texture levels");
+				Arrival arrival;
+				arrival.path = path;
+				arrival.id = id;
+				CompressedImage image;
+				if (_openCompressedSibling(path, &image) && (int)image.mipLevels().size() >= last)
+				{
+					// Copying out of the mapping is what reads the file, so it happens here rather than in the upload
+					for (int level = first; level < last; level++)
+					{
+						const CompressedImage::Level& source = image.mipLevels()[level];
+						arrival.levels.emplace_back(source.data, source.data + source.size);
+						arrival.widths.push_back(source.width);
+						arrival.heights.push_back(source.height);
+					}
+				}
+				std::lock_guard<std::mutex> lock(this->arrivalMutex);
+				this->arrived.push_back(std::move(arrival));
+				this->loads--;
+			});
+		}
+		_jobPriority() = priority;
+	}
+
+	// Drops the finest streamed levels nothing has needed for TEXTURE_STREAM_KEEP_FRAMES, longest unneeded first,
+	// until bytes are given back or none are left. Textures keep their ids and sample from the next coarser level, a
+	// draw wanting them again streams them back. Returns what was given back. Needs a current context.
+	int64_t trim(int64_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		int64_t freed = 0;
+		while (freed < bytes)
+		{
+			Entry* oldest = nullptr;
+			for (auto it = this->byPath.begin(); it != this->byPath.end(); ++it)
+			{
+				Entry& entry = it->second;
+				if (entry.levelBytes.empty() || entry.loading || entry.resident >= entry.base)
+					continue;
+				const bool stale = entry.resident < entry.needed || this->frame - entry.neededFrame > TEXTURE_STREAM_KEEP_FRAMES;
+				if (stale && (!oldest || entry.neededFrame < oldest->neededFrame))
+					oldest = &entry;
+			}
+			if (!oldest)
+				break;
+			// Redefined empty, which frees its storage; levels below the base level don't count for completeness
+			const int level = oldest->resident;
+			glBindTexture(GL_TEXTURE_2D, oldest->id);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			const int64_t levelBytes = oldest->levelBytes[level];
+			oldest->resident = level + 1;
+			oldest->bytes -= levelBytes;
+			if (oldest->references == 0)
+				this->unused -= levelBytes;
+			_gpuMemory.release(GpuMemoryCategory::Textures, levelBytes);
+			freed += levelBytes;
+		}
+		return freed;
+	}
+
+	size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->byPath.size();
+	}
+
+	// Bytes of the textures nothing references
+	int64_t unusedBytes() const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->unused;
+	}
+
+private:
+	struct Entry
+	{
+		GLuint id;
+		int references;
+		int64_t bytes;
+		// Order the last reference went in, the oldest unused texture is evicted first
+		uint64_t released;
+		// Streamed textures only, levelBytes is empty for the rest. The compressed format, level 0's larger side and
+		// each level's size; the coarsest level that is ever streamed (those after it stay resident), the finest
+		// one uploaded, the finest one draws asked for since the last stream(), and the finest one needed as of
+		// neededFrame. loading is set while a job reads levels for it.
+		GLenum format = 0;
+		GLsizei size = 0;
+		vector<GLsizei> levelBytes;
+		int base = 0;
+		int resident = 0;
+		int wanted = INT_MAX;
+		int needed = 0;
+		uint64_t neededFrame = 0;
+		bool loading = false;
+	};
+
+	// Levels [first, resident) of one texture read by a stream() job, finest first
+	struct Arrival
+	{
+		string path;
+		GLuint id;
+		vector<vector<uint8_t>> levels;
+		vector<GLsizei> widths;
+		vector<GLsizei> heights;
+	};
+
+	mutable std::mutex mutex;
+	map<string, Entry> byPath;
+	map<GLuint, string> pathOf;
+	uint64_t releases = 0;
+	int64_t unused = 0;
+	bool streaming = true;
+	// The frame stream() last ran for
+	uint64_t frame = 0;
+	// Filled by the stream() jobs, taken by the next stream()
+	std::mutex arrivalMutex;
+	vector<Arrival> arrived;
+	std::atomic<int> loads{ 0 };
+
+	// With the lock held
+	void reference(Entry& entry)
+	{
+		if (entry.references++ == 0)
+			this->unused -= entry.bytes;
+	}
+};
+
+// Shared by every model, see Mesh for who holds the references
+static TextureCache _textures;
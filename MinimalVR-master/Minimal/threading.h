@@ -0,0 +1,151 @@
+#pragma once
+// Std. Includes
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+#include <avrt.h>
+
+// Fewest logical processors --pin-threads lays threads out on; on less there aren't cores to spare for the frame
+#define THREAD_PIN_MIN_PROCESSORS 4
+
+// What a thread is for, which decides its priority and the cores it may run on
+enum class ThreadRole : uint8_t
+{
+	// GlfwApp::run, the one that draws and submits
+	Render,
+	// The FrameWorker stepping the simulation
+	Simulation,
+	// InputPoller, short and frequent, it only matters that it wakes on time
+	Input,
+	// AssetStreamer and the jobs it fans out
+	Loader,
+	// JobSystem's workers
+	Worker,
+	// Everything else: startup tasks, the loading layer, voice, the session recorder, the GL debug drainer
+	Background,
+	Count,
+};
+
+static const char* _threadRoleNames[(size_t)ThreadRole::Count] = { "render", "simulation", "input", "loader", "worker", "background" };
+
+// The MMCSS task the render thread joins, --mmcss games|audio|off
+enum class MmcssTask : uint8_t
+{
+	Off,
+	// "Games" is what the scheduler gives the foreground game, high priority without starving the system
+	Games,
+	// "Pro Audio" is scheduled before almost anything else, for machines that run agents behind the app
+	ProAudio,
+};
+
+// How the app's threads are scheduled. Each thread applies its role once, first thing when it starts: the render
+// thread joins the MMCSS task, which lifts it above background processes on a busy machine without needing
+// realtime priority, and every thread gets its role's priority and, if set, affinity mask. Masks are of logical
+// processors and 0 leaves the thread wherever Windows puts it; the workers each take the next core of their mask
+// in turn, so two don't start on the same one.
+struct ThreadConfig
+{
+	MmcssTask mmcss = MmcssTask::Games;
+	int priority[(size_t)ThreadRole::Count] = {
+		THREAD_PRIORITY_NORMAL,
+		THREAD_PRIORITY_ABOVE_NORMAL,
+		THREAD_PRIORITY_HIGHEST,
+		THREAD_PRIORITY_BELOW_NORMAL,
+		THREAD_PRIORITY_NORMAL,
+		THREAD_PRIORITY_BELOW_NORMAL,
+	};
+	uint64_t affinity[(size_t)ThreadRole::Count] = {};
+};
+
+// The thread's MMCSS registration, so it can leave its task again
+static HANDLE& _threadMmcssHandle()
+{
+	static thread_local HANDLE handle = nullptr;
+	return handle;
+}
+
+// Applies the ThreadConfig to the threads that start after it is set, see ThreadConfig
+class ThreadPolicy
+{
+public:
+	ThreadConfig& config() { return this->settings; }
+
+	// --pin-threads: render, simulation and input on cores of their own, away from core 0 where most interrupts
+	// land, the workers on every core but the render thread's, the loader and background threads on what is left
+	void pinDefault()
+	{
+		const unsigned processors = std::min(std::thread::hardware_concurrency(), 64u);
+		if (processors < THREAD_PIN_MIN_PROCESSORS)
+		{
+			std::cout << "ERROR::THREADING::TOO_FEW_PROCESSORS_TO_PIN " << processors << std::endl;
+			return;
+		}
+		const uint64_t all = processors == 64 ? ~0ull : (1ull << processors) - 1;
+		const uint64_t render = 1ull << 1, simulation = 1ull << 2, input = 1ull << 3;
+		uint64_t* affinity = this->settings.affinity;
+		affinity[(size_t)ThreadRole::Render] = render;
+		affinity[(size_t)ThreadRole::Simulation] = simulation;
+		affinity[(size_t)ThreadRole::Input] = input;
+		affinity[(size_t)ThreadRole::Worker] = all & ~render;
+		// With only four there is nothing left over, the loader then shares the workers' cores
+		const uint64_t rest = all & ~(render | simulation | input);
+		affinity[(size_t)ThreadRole::Loader] = rest ? rest : all & ~render;
+		affinity[(size_t)ThreadRole::Background] = affinity[(size_t)ThreadRole::Loader];
+	}
+
+	// First thing on a thread. index picks the worker's core out of its mask.
+	void apply(ThreadRole role, unsigned index = 0)
+	{
+		const HANDLE thread = GetCurrentThread();
+		if (!SetThreadPriority(thread, this->settings.priority[(size_t)role]))
+			std::cout << "ERROR::THREADING::PRIORITY_NOT_SET " << _threadRoleNames[(size_t)role] << std::endl;
+		uint64_t mask = this->settings.affinity[(size_t)role];
+		if (mask && role == ThreadRole::Worker)
+			mask = nthBit(mask, index);
+		if (mask && !SetThreadAffinityMask(thread, (DWORD_PTR)mask))
+			std::cout << "ERROR::THREADING::AFFINITY_NOT_SET " << _threadRoleNames[(size_t)role] << std::endl;
+		if (role == ThreadRole::Render && this->settings.mmcss != MmcssTask::Off && !_threadMmcssHandle())
+		{
+			DWORD taskIndex = 0;
+			const char* task = this->settings.mmcss == MmcssTask::ProAudio ? "Pro Audio" : "Games";
+			_threadMmcssHandle() = AvSetMmThreadCharacteristicsA(task, &taskIndex);
+			if (!_threadMmcssHandle())
+				std::cout << "ERROR::THREADING::MMCSS_NOT_JOINED " << task << std::endl;
+			else
+				AvSetMmThreadPriority(_threadMmcssHandle(), AVRT_PRIORITY_HIGH);
+		}
+	}
+
+	// Last thing on a thread that applied Render, it leaves the MMCSS task
+	void leave()
+	{
+		if (_threadMmcssHandle())
+			AvRevertMmThreadCharacteristics(_threadMmcssHandle());
+		_threadMmcssHandle() = nullptr;
+	}
+
+private:
+	ThreadConfig settings;
+
+	// The index-th set bit of mask, wrapping around the bits that are set
+	static uint64_t nthBit(uint64_t mask, unsigned index)
+	{
+		unsigned bits = 0;
+		for (uint64_t m = mask; m; m &= m - 1)
+			bits++;
+		index %= bits;
+		for (uint64_t m = mask; m; m &= m - 1)
+		{
+			if (index-- == 0)
+				return m & (~m + 1);
+		}
+		return mask;
+	}
+};
+
+static ThreadPolicy _threadPolicy;
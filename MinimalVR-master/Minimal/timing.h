@@ -0,0 +1,121 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+
+// How long before a deadline _sleepUntil() stops sleeping and spins instead; a high resolution timer wakes within
+// a few hundred microseconds, a plain one only within a scheduler tick
+#define TIMING_SPIN_SECONDS 0.0005
+#define TIMING_SPIN_SECONDS_COARSE 0.002
+
+// The performance counter, as the clock everything budgeted or paced reads. It is monotonic and the same on
+// every core, and kept as ticks and doubles rather than float seconds, which stop resolving milliseconds after a
+// few hours of a session.
+static int64_t _timeTicks()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+static int64_t _timeTicksPerSecond()
+{
+	static const int64_t frequency = []() {
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		return f.QuadPart;
+	}();
+	return frequency;
+}
+
+static double _timeTicksToSeconds(int64_t ticks)
+{
+	return (double)ticks / (double)_timeTicksPerSecond();
+}
+
+static int64_t _timeSecondsToTicks(double seconds)
+{
+	return (int64_t)(seconds * (double)_timeTicksPerSecond());
+}
+
+// Seconds since the first call, which WinMain makes first thing
+static double _sessionSeconds()
+{
+	static const int64_t origin = _timeTicks();
+	return _timeTicksToSeconds(_timeTicks() - origin);
+}
+
+// A point on _timeTicks()' clock a budget runs out at: work loops check passed() between steps rather than adding
+// up the steps' times
+struct Deadline
+{
+	int64_t ticks = 0;
+
+	static Deadline in(double seconds)
+	{
+		Deadline deadline;
+		deadline.ticks = _timeTicks() + _timeSecondsToTicks(seconds);
+		return deadline;
+	}
+
+	bool passed() const { return _timeTicks() >= this->ticks; }
+	// 0 once passed
+	double remaining() const
+	{
+		const int64_t left = this->ticks - _timeTicks();
+		return left > 0 ? _timeTicksToSeconds(left) : 0.0;
+	}
+};
+
+// The calling thread's waitable timer, high resolution where Windows has them (10 1803 and later)
+static HANDLE _timingTimer(bool* highResolution)
+{
+	struct Timer
+	{
+		HANDLE handle = nullptr;
+		bool highResolution = false;
+		Timer()
+		{
+			this->handle = CreateWaitableTimerExA(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+			this->highResolution = this->handle != nullptr;
+			if (!this->handle)
+				this->handle = CreateWaitableTimerExA(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+		}
+		~Timer()
+		{
+			if (this->handle)
+				CloseHandle(this->handle);
+		}
+	};
+	static thread_local Timer timer;
+	*highResolution = timer.highResolution;
+	return timer.handle;
+}
+
+// Returns at deadline, not before and as little after as the machine allows: sleeps on the waitable timer for
+// all but the last stretch, then spins it out. Pacing loops use it where sleep_until would wake up to a tick late.
+// Without spin it only sleeps, for loops that wake so often the spinning would cost a core.
+static void _sleepUntil(const Deadline& deadline, bool spin = true)
+{
+	bool highResolution;
+	const HANDLE timer = _timingTimer(&highResolution);
+	const double margin = !spin ? 0.0 : highResolution ? TIMING_SPIN_SECONDS : TIMING_SPIN_SECONDS_COARSE;
+	const double sleep = deadline.remaining() - margin;
+	if (timer && sleep > 0.0)
+	{
+		// Negative is relative, in 100 ns units
+		LARGE_INTEGER due;
+		due.QuadPart = -(LONGLONG)(sleep * 1e7);
+		if (SetWaitableTimer(timer, &due, 0, nullptr, nullptr, FALSE))
+			WaitForSingleObject(timer, INFINITE);
+	}
+	while (spin && !deadline.passed())
+		YieldProcessor();
+}
+
+static void _sleepFor(double seconds, bool spin = true)
+{
+	_sleepUntil(Deadline::in(seconds), spin);
+}
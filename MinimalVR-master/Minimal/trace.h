@@ -0,0 +1,113 @@
+#pragma once
+// Std. Includes
+#include <mutex>
+#include <cstdint>
+using namespace std;
+
+// Timeline profiler hooks for looking at every thread at once, which FrameProfiler's per phase numbers can't show.
+// MINIMAL_TRACE picks the backend at compile time:
+//
+//   MINIMAL_TRACE_NONE   The default. Every macro below expands to nothing and TRACE_MUTEX to a plain std::mutex.
+//   MINIMAL_TRACE_TRACY  Tracy. Its public directory goes on the include path and its TracyClient.cpp into the
+//                        project, dbghelp.lib with it. GPU zones are Tracy's own timestamp queries.
+//   MINIMAL_TRACE_ETW    TraceLogging events from the "MinimalVR" provider, for recording with WPR and reading in
+//                        WPA. Zones are Start/Stop pairs of a "Zone" event. GPU times come from FrameProfiler's
+//                        queries once they resolve, as "GpuPhase" events PROFILER_LATENCY frames late. Mutexes
+//                        stay plain, ETW's own context switch events show who waited on whom.
+//
+// Zone and plot names must be string literals, Tracy keeps the pointers.
+#define MINIMAL_TRACE_NONE 0
+#define MINIMAL_TRACE_TRACY 1
+#define MINIMAL_TRACE_ETW 2
+#ifndef MINIMAL_TRACE
+#define MINIMAL_TRACE MINIMAL_TRACE_NONE
+#endif
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#if MINIMAL_TRACE == MINIMAL_TRACE_TRACY
+
+#define TRACY_ENABLE
+// GL Includes, only Tracy's GPU zones need them, so the headless server can use the job system without GL
+#include <GL/glew.h>
+#include <tracy/Tracy.hpp>
+#include <tracy/TracyOpenGL.hpp>
+
+#define TRACE_INIT()
+#define TRACE_SHUTDOWN()
+// The enclosing block as a zone of the calling thread
+#define TRACE_ZONE(name) ZoneScopedN(name)
+#define TRACE_FRAME() FrameMark
+#define TRACE_PLOT(name, value) TracyPlot(name, (double)(value))
+#define TRACE_THREAD(name) tracy::SetThreadName(name)
+// A std::mutex member whose waits and holds show on the timeline, locked through TraceMutex
+#define TRACE_MUTEX(var, name) TracyLockableN(std::mutex, var, name)
+typedef LockableBase(std::mutex) TraceMutex;
+// With the context current, after glewInit
+#define TRACE_GPU_CONTEXT() TracyGpuContext
+#define TRACE_GPU_ZONE(name) TracyGpuZone(name)
+// Once a frame, after the swap
+#define TRACE_GPU_COLLECT() TracyGpuCollect
+#define TRACE_GPU_PHASE(name, frame, ms)
+
+#elif MINIMAL_TRACE == MINIMAL_TRACE_ETW
+
+// Windows Includes
+#include <Windows.h>
+#include <winmeta.h>
+#include <TraceLoggingProvider.h>
+
+// {6C3E29A4-51B7-4F0D-9E82-3D7A1C05B6F1}
+TRACELOGGING_DEFINE_PROVIDER(_traceProvider, "MinimalVR",
+	(0x6c3e29a4, 0x51b7, 0x4f0d, 0x9e, 0x82, 0x3d, 0x7a, 0x1c, 0x05, 0xb6, 0xf1));
+
+class TraceZone
+{
+public:
+	explicit TraceZone(const char* name) : name(name)
+	{
+		TraceLoggingWrite(_traceProvider, "Zone", TraceLoggingOpcode(WINEVENT_OPCODE_START), TraceLoggingString(this->name, "Name"));
+	}
+	~TraceZone()
+	{
+		TraceLoggingWrite(_traceProvider, "Zone", TraceLoggingOpcode(WINEVENT_OPCODE_STOP), TraceLoggingString(this->name, "Name"));
+	}
+
+	TraceZone(const TraceZone&) = delete;
+	TraceZone& operator=(const TraceZone&) = delete;
+
+private:
+	const char* name;
+};
+
+#define TRACE_INIT() TraceLoggingRegister(_traceProvider)
+#define TRACE_SHUTDOWN() TraceLoggingUnregister(_traceProvider)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(_traceZone, __LINE__)(name)
+#define TRACE_FRAME() TraceLoggingWrite(_traceProvider, "Frame")
+#define TRACE_PLOT(name, value) TraceLoggingWrite(_traceProvider, "Plot", TraceLoggingString(name, "Name"), TraceLoggingFloat64((double)(value), "Value"))
+#define TRACE_THREAD(name) TraceLoggingWrite(_traceProvider, "ThreadName", TraceLoggingString(name, "Name"))
+#define TRACE_MUTEX(var, name) std::mutex var
+typedef std::mutex TraceMutex;
+#define TRACE_GPU_CONTEXT()
+#define TRACE_GPU_ZONE(name)
+#define TRACE_GPU_COLLECT()
+#define TRACE_GPU_PHASE(name, frame, ms) TraceLoggingWrite(_traceProvider, "GpuPhase", TraceLoggingString(name, "Name"), \
+	TraceLoggingUInt64((uint64_t)(frame), "Frame"), TraceLoggingFloat32((float)(ms), "Milliseconds"))
+
+#else
+
+#define TRACE_INIT()
+#define TRACE_SHUTDOWN()
+#define TRACE_ZONE(name)
+#define TRACE_FRAME()
+#define TRACE_PLOT(name, value)
+#define TRACE_THREAD(name)
+#define TRACE_MUTEX(var, name) std::mutex var
+typedef std::mutex TraceMutex;
+#define TRACE_GPU_CONTEXT()
+#define TRACE_GPU_ZONE(name)
+#define TRACE_GPU_COLLECT()
+#define TRACE_GPU_PHASE(name, frame, ms)
+
+#endif
@@ -0,0 +1,113 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+#include <cstring>
+using namespace std;
+// GL Includes
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/transform.hpp>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include <OVR_Avatar.h>
+#include "benchhmd.h"
+#include "picking.h"
+#include "transforms.h"
+
+// One hand of a TrackingSnapshot, in every form its consumers take it
+struct TrackedHand
+{
+	ovrPoseStatef state;
+	glm::vec3 position;
+	glm::quat orientation;
+	// translate(position) * rotation, as the late latch block and the shaders take it
+	glm::mat4 transform;
+	ovrAvatarTransform avatar;
+	// Where the hand's laser points and picks
+	PickRay ray;
+};
+
+// The whole of one frame's tracking, taken once for the frame's predicted display time. The avatar, the game's
+// input, picking and the cameras all read it rather than asking the runtime again, so they see the same sample.
+struct TrackingSnapshot
+{
+	// The frame of the split frame API it was predicted for
+	long long frame = 0;
+	double displayTime = 0.0;
+	// When it was sampled, the scene layer's SensorSampleTime
+	double sampleTime = 0.0;
+	ovrTrackingState state;
+	ovrPosef eyePoses[ovrEye_Count];
+	glm::vec3 headPosition;
+	glm::quat headOrientation;
+	ovrAvatarTransform head;
+	TrackedHand hands[ovrHand_Count];
+	// Only taken when sample() is asked for it, zeroed otherwise
+	ovrInputState input;
+	bool hasInput = false;
+	// Set once relatch() has replaced the poses with a later sample for the same display time
+	bool relatched = false;
+};
+
+// Takes the frame's TrackingSnapshot and hands it out read only. Sampled in RiftApp::draw after the frame's slot is
+// granted; everything after reads snapshot() until the next frame's sample.
+class TrackingService
+{
+public:
+	// The frame's sample at displayTime. latencyMarker tells the runtime this is the sample latency is measured
+	// from. The input state only comes along with withInput, a pose trace then has it right after the tracking.
+	const TrackingSnapshot& sample(ovrSession session, long long frame, double displayTime, const ovrVector3f hmdToEyeOffset[ovrEye_Count],
+		bool latencyMarker, bool withInput)
+	{
+		TrackingSnapshot& snapshot = this->current;
+		snapshot.frame = frame;
+		snapshot.displayTime = displayTime;
+		snapshot.relatched = false;
+		this->samplePoses(session, hmdToEyeOffset, latencyMarker);
+		snapshot.hasInput = withInput && OVR_SUCCESS(_hmdGetInputState(session, ovrControllerType_Active, &snapshot.input));
+		if (!snapshot.hasInput)
+			memset(&snapshot.input, 0, sizeof(snapshot.input));
+		return snapshot;
+	}
+
+	// Newer poses for the same frame and display time, right before the draws that can still take them. The input
+	// state stays the frame's first one, the buttons were already acted on.
+	const TrackingSnapshot& relatch(ovrSession session, const ovrVector3f hmdToEyeOffset[ovrEye_Count])
+	{
+		this->samplePoses(session, hmdToEyeOffset, true);
+		this->current.relatched = true;
+		return this->current;
+	}
+
+	const TrackingSnapshot& snapshot() const { return this->current; }
+
+private:
+	TrackingSnapshot current;
+
+	void samplePoses(ovrSession session, const ovrVector3f hmdToEyeOffset[ovrEye_Count], bool latencyMarker)
+	{
+		TrackingSnapshot& snapshot = this->current;
+		// Right before the query, so the compositor measures latency from this sample
+		snapshot.sampleTime = _hmdGetTimeInSeconds();
+		snapshot.state = _hmdGetTrackingState(session, snapshot.displayTime, latencyMarker ? ovrTrue : ovrFalse);
+		ovr_CalcEyePoses(snapshot.state.HeadPose.ThePose, hmdToEyeOffset, snapshot.eyePoses);
+		snapshot.headPosition = vec3(snapshot.state.HeadPose.ThePose.Position);
+		snapshot.headOrientation = quat(snapshot.state.HeadPose.ThePose.Orientation);
+		_ovrAvatarTransformFromOvrPose(snapshot.state.HeadPose.ThePose, &snapshot.head);
+		for (int i = 0; i < ovrHand_Count; i++)
+		{
+			TrackedHand& hand = snapshot.hands[i];
+			hand.state = snapshot.state.HandPoses[i];
+			hand.position = vec3(hand.state.ThePose.Position);
+			hand.orientation = quat(hand.state.ThePose.Orientation);
+			hand.transform = _mat4FromOvrPose(hand.state.ThePose);
+			_ovrAvatarTransformFromOvrPose(hand.state.ThePose, &hand.avatar);
+			hand.ray = _pickRayFromPose(hand.position, hand.orientation);
+		}
+	}
+
+	static glm::vec3 vec3(const ovrVector3f& v) { return glm::vec3(v.x, v.y, v.z); }
+	static glm::quat quat(const ovrQuatf& q) { return glm::quat(q.w, q.x, q.y, q.z); }
+};
+
+static TrackingService _tracking;
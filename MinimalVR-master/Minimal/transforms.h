@@ -0,0 +1,250 @@
+#pragma once
+// Std. Includes
+#include <cmath>
+#include <cstring>
+// GL Includes
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+// OVR Includes
+#include <OVR_CAPI.h>
+#include <OVR_Avatar.h>
+
+// Rotation then translation, what every tracking pose is. The rotation is x, y, z, w like ovrQuatf and ovrAvatarQuatf,
+// so converting from the runtime's types is a copy, and the translation is padded to four floats so both load as
+// one SSE register each.
+struct RigidTransform
+{
+	float rotation[4];
+	float translation[4];
+};
+
+// Translation * rotation * scale, what the avatar SDK's transforms are. Laid out as RigidTransform plus the scale.
+struct TrsTransform
+{
+	float rotation[4];
+	float translation[4];
+	float scale[4];
+};
+
+static inline void _rigidFromOvrPose(const ovrPosef& pose, RigidTransform* target)
+{
+	memcpy(target->rotation, &pose.Orientation.x, sizeof(float) * 4);
+	memcpy(target->translation, &pose.Position.x, sizeof(float) * 3);
+	target->translation[3] = 0.0f;
+}
+
+static inline void _rigidFromGlm(const glm::vec3& position, const glm::quat& orientation, RigidTransform* target)
+{
+	target->rotation[0] = orientation.x;
+	target->rotation[1] = orientation.y;
+	target->rotation[2] = orientation.z;
+	target->rotation[3] = orientation.w;
+	target->translation[0] = position.x;
+	target->translation[1] = position.y;
+	target->translation[2] = position.z;
+	target->translation[3] = 0.0f;
+}
+
+static inline void _ovrPoseFromRigid(const RigidTransform& source, ovrPosef* target)
+{
+	memcpy(&target->Orientation.x, source.rotation, sizeof(float) * 4);
+	memcpy(&target->Position.x, source.translation, sizeof(float) * 3);
+}
+
+static inline void _trsFromOvrAvatarTransform(const ovrAvatarTransform& transform, TrsTransform* target)
+{
+	memcpy(target->rotation, &transform.orientation.x, sizeof(float) * 4);
+	memcpy(target->translation, &transform.position.x, sizeof(float) * 3);
+	memcpy(target->scale, &transform.scale.x, sizeof(float) * 3);
+	target->translation[3] = 0.0f;
+	target->scale[3] = 0.0f;
+}
+
+static inline void _ovrAvatarTransformFromTrs(const TrsTransform& source, ovrAvatarTransform* target)
+{
+	memcpy(&target->orientation.x, source.rotation, sizeof(float) * 4);
+	memcpy(&target->position.x, source.translation, sizeof(float) * 3);
+	memcpy(&target->scale.x, source.scale, sizeof(float) * 3);
+}
+
+// A tracked pose as the avatar SDK takes it, unit scale
+static inline void _ovrAvatarTransformFromOvrPose(const ovrPosef& pose, ovrAvatarTransform* target)
+{
+	memcpy(&target->orientation.x, &pose.Orientation.x, sizeof(float) * 4);
+	memcpy(&target->position.x, &pose.Position.x, sizeof(float) * 3);
+	target->scale.x = 1.0f;
+	target->scale.y = 1.0f;
+	target->scale.z = 1.0f;
+}
+
+// Column-major translate(t) * mat4_cast(q) * scale(s) written straight from the quaternion, the same terms as
+// _affineFromOvrAvatarTransform, without the three 4x4 temporaries and their two products
+static inline void _mat4FromQuatTranslationScale(const float* q, const float* t, float sx, float sy, float sz, glm::mat4* target)
+{
+	const float x = q[0], y = q[1], z = q[2], w = q[3];
+	glm::mat4& m = *target;
+	m[0] = glm::vec4((1.0f - 2.0f * (y * y + z * z)) * sx, 2.0f * (x * y + w * z) * sx, 2.0f * (x * z - w * y) * sx, 0.0f);
+	m[1] = glm::vec4(2.0f * (x * y - w * z) * sy, (1.0f - 2.0f * (x * x + z * z)) * sy, 2.0f * (y * z + w * x) * sy, 0.0f);
+	m[2] = glm::vec4(2.0f * (x * z + w * y) * sz, 2.0f * (y * z - w * x) * sz, (1.0f - 2.0f * (x * x + y * y)) * sz, 0.0f);
+	m[3] = glm::vec4(t[0], t[1], t[2], 1.0f);
+}
+
+static inline void _mat4FromRigid(const RigidTransform& source, glm::mat4* target)
+{
+	_mat4FromQuatTranslationScale(source.rotation, source.translation, 1.0f, 1.0f, 1.0f, target);
+}
+
+static inline void _mat4FromTrs(const TrsTransform& source, glm::mat4* target)
+{
+	_mat4FromQuatTranslationScale(source.rotation, source.translation, source.scale[0], source.scale[1], source.scale[2], target);
+}
+
+static inline glm::mat4 _mat4FromOvrPose(const ovrPosef& pose)
+{
+	glm::mat4 result;
+	_mat4FromQuatTranslationScale(&pose.Orientation.x, &pose.Position.x, 1.0f, 1.0f, 1.0f, &result);
+	return result;
+}
+
+static inline void _mat4FromOvrAvatarTransform(const ovrAvatarTransform& transform, glm::mat4* target)
+{
+	_mat4FromQuatTranslationScale(&transform.orientation.x, &transform.position.x, transform.scale.x, transform.scale.y, transform.scale.z, target);
+}
+
+// Hamilton product a * b of two x, y, z, w quaternions. out may alias a or b.
+static inline void _quatMultiply(const float* a, const float* b, float* out)
+{
+	const float x = a[3] * b[0] + a[0] * b[3] + a[1] * b[2] - a[2] * b[1];
+	const float y = a[3] * b[1] - a[0] * b[2] + a[1] * b[3] + a[2] * b[0];
+	const float z = a[3] * b[2] + a[0] * b[1] - a[1] * b[0] + a[2] * b[3];
+	const float w = a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2];
+	out[0] = x;
+	out[1] = y;
+	out[2] = z;
+	out[3] = w;
+}
+
+// q * v * conjugate(q) for a unit q, as v + w * t + cross(q, t) with t = 2 * cross(q, v). out may alias v.
+static inline void _quatRotate(const float* q, const float* v, float* out)
+{
+	const float tx = 2.0f * (q[1] * v[2] - q[2] * v[1]);
+	const float ty = 2.0f * (q[2] * v[0] - q[0] * v[2]);
+	const float tz = 2.0f * (q[0] * v[1] - q[1] * v[0]);
+	const float x = v[0] + q[3] * tx + (q[1] * tz - q[2] * ty);
+	const float y = v[1] + q[3] * ty + (q[2] * tx - q[0] * tz);
+	const float z = v[2] + q[3] * tz + (q[0] * ty - q[1] * tx);
+	out[0] = x;
+	out[1] = y;
+	out[2] = z;
+}
+
+// out = a * b, b applied first. out may alias a or b.
+static inline void _rigidMultiply(const RigidTransform& a, const RigidTransform& b, RigidTransform* out)
+{
+	float translation[3];
+	_quatRotate(a.rotation, b.translation, translation);
+	out->translation[0] = a.translation[0] + translation[0];
+	out->translation[1] = a.translation[1] + translation[1];
+	out->translation[2] = a.translation[2] + translation[2];
+	out->translation[3] = 0.0f;
+	_quatMultiply(a.rotation, b.rotation, out->rotation);
+}
+
+// The conjugate rotation and the translation rotated back by it and negated. out may alias source.
+static inline void _rigidInverse(const RigidTransform& source, RigidTransform* out)
+{
+	const float conjugate[4] = { -source.rotation[0], -source.rotation[1], -source.rotation[2], source.rotation[3] };
+	float translation[3];
+	_quatRotate(conjugate, source.translation, translation);
+	memcpy(out->rotation, conjugate, sizeof(conjugate));
+	out->translation[0] = -translation[0];
+	out->translation[1] = -translation[1];
+	out->translation[2] = -translation[2];
+	out->translation[3] = 0.0f;
+}
+
+static inline glm::vec3 _rigidTransformPoint(const RigidTransform& transform, const glm::vec3& point)
+{
+	float rotated[3];
+	_quatRotate(transform.rotation, &point.x, rotated);
+	return glm::vec3(rotated[0] + transform.translation[0], rotated[1] + transform.translation[1], rotated[2] + transform.translation[2]);
+}
+
+// Inverse of a matrix with an orthonormal 3x3 part, a camera or a tracked pose: the transposed rotation and
+// -transpose(R) * t. glm::affineInverse pays for a general 3x3 inverse to get the same.
+static inline glm::mat4 _rigidInverseMat4(const glm::mat4& m)
+{
+	glm::mat4 result;
+	result[0] = glm::vec4(m[0][0], m[1][0], m[2][0], 0.0f);
+	result[1] = glm::vec4(m[0][1], m[1][1], m[2][1], 0.0f);
+	result[2] = glm::vec4(m[0][2], m[1][2], m[2][2], 0.0f);
+	const glm::vec3 t(m[3]);
+	result[3] = glm::vec4(-glm::dot(glm::vec3(m[0]), t), -glm::dot(glm::vec3(m[1]), t), -glm::dot(glm::vec3(m[2]), t), 1.0f);
+	return result;
+}
+
+// Unit x, y, z, w quaternion of the rotation with columns c0, c1, c2, from the largest of w, x, y and z so the
+// division stays well conditioned (Shepperd's method)
+static inline void _quatFromRotationColumns(const glm::vec3& c0, const glm::vec3& c1, const glm::vec3& c2, float* q)
+{
+	const float trace = c0.x + c1.y + c2.z;
+	if (trace > 0.0f)
+	{
+		const float s = 0.5f / sqrtf(trace + 1.0f);
+		q[0] = (c1.z - c2.y) * s;
+		q[1] = (c2.x - c0.z) * s;
+		q[2] = (c0.y - c1.x) * s;
+		q[3] = 0.25f / s;
+	}
+	else if (c0.x > c1.y && c0.x > c2.z)
+	{
+		const float s = 2.0f * sqrtf(1.0f + c0.x - c1.y - c2.z);
+		q[0] = 0.25f * s;
+		q[1] = (c1.x + c0.y) / s;
+		q[2] = (c2.x + c0.z) / s;
+		q[3] = (c1.z - c2.y) / s;
+	}
+	else if (c1.y > c2.z)
+	{
+		const float s = 2.0f * sqrtf(1.0f + c1.y - c0.x - c2.z);
+		q[0] = (c1.x + c0.y) / s;
+		q[1] = 0.25f * s;
+		q[2] = (c2.y + c1.z) / s;
+		q[3] = (c2.x - c0.z) / s;
+	}
+	else
+	{
+		const float s = 2.0f * sqrtf(1.0f + c2.z - c0.x - c1.y);
+		q[0] = (c2.x + c0.z) / s;
+		q[1] = (c2.y + c1.z) / s;
+		q[2] = 0.25f * s;
+		q[3] = (c0.y - c1.x) / s;
+	}
+}
+
+// Translation, rotation and scale of an affine T * R * S matrix, what glm::decompose gives for one without shear or
+// perspective: the scale is the length of each column, negated on all three axes for a mirroring matrix as
+// glm::decompose does, and the rotation comes from the columns with the scale divided out
+static inline void _trsFromAffine(const glm::mat4& m, TrsTransform* target)
+{
+	glm::vec3 c0(m[0]), c1(m[1]), c2(m[2]);
+	float sx = glm::length(c0), sy = glm::length(c1), sz = glm::length(c2);
+	if (glm::dot(c0, glm::cross(c1, c2)) < 0.0f)
+	{
+		sx = -sx;
+		sy = -sy;
+		sz = -sz;
+	}
+	c0 /= sx;
+	c1 /= sy;
+	c2 /= sz;
+	_quatFromRotationColumns(c0, c1, c2, target->rotation);
+	target->translation[0] = m[3].x;
+	target->translation[1] = m[3].y;
+	target->translation[2] = m[3].z;
+	target->translation[3] = 0.0f;
+	target->scale[0] = sx;
+	target->scale[1] = sy;
+	target->scale[2] = sz;
+	target->scale[3] = 0.0f;
+}
@@ -0,0 +1,138 @@
+#pragma once
+// Std. Includes
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "renderstats.h"
+#include "gpumemory.h"
+#include "gldebug.h"
+
+// Frames of uniform data in flight, the buffer is split into this many regions
+#define UNIFORM_RING_FRAMES 3
+// Bytes a frame may write, a few hundred avatar draws across every view come to well under this
+#define UNIFORM_RING_REGION_BYTES (1024 * 1024)
+
+// Per draw uniform blocks for the frame being drawn. Every push() copies the block to the end of this frame's
+// region and binds it there, in place of a glUniform call per member.
+//
+// With ARB_buffer_storage the regions are one persistently mapped, coherent buffer, and beginFrame() only waits
+// if the GPU is still reading the region from UNIFORM_RING_FRAMES frames ago. Without it the buffer is orphaned
+// every frame and filled with glBufferSubData, still one call per draw.
+class UniformRing
+{
+public:
+	UniformRing() {}
+
+	UniformRing(const UniformRing&) = delete;
+	UniformRing& operator=(const UniformRing&) = delete;
+
+	void init(GLsizeiptr regionBytes = UNIFORM_RING_REGION_BYTES)
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		this->alignment = std::max(alignment, 16);
+		this->regionBytes = regionBytes;
+
+		glGenBuffers(1, &this->buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, this->buffer);
+		_glLabel(GL_BUFFER, this->buffer, "uniform ring");
+		if (GLEW_ARB_buffer_storage)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			const GLsizeiptr size = regionBytes * UNIFORM_RING_FRAMES;
+			glBufferStorage(GL_UNIFORM_BUFFER, size, NULL, flags);
+			this->mapped = (uint8_t*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+		}
+		else
+		{
+			glBufferData(GL_UNIFORM_BUFFER, regionBytes, NULL, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		// Orphaning keeps a few regions alive in the driver too, the charge is the same either way
+		this->memory.reset(GpuMemoryCategory::UniformRing, regionBytes * UNIFORM_RING_FRAMES);
+	}
+
+	// Before the frame's first push
+	void beginFrame()
+	{
+		if (!this->buffer)
+			return;
+		this->head = 0;
+		if (this->mapped)
+		{
+			this->region = (this->region + 1) % UNIFORM_RING_FRAMES;
+			GLsync& fence = this->fences[this->region];
+			if (fence)
+			{
+				glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+				glDeleteSync(fence);
+				fence = 0;
+			}
+		}
+		else
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, this->buffer);
+			glBufferData(GL_UNIFORM_BUFFER, this->regionBytes, NULL, GL_STREAM_DRAW);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+	}
+
+	// Copies size bytes of block into the ring and binds them to the uniform block binding. False, with the
+	// binding left as it was, once the frame's region is full.
+	bool push(GLuint binding, const void* block, GLsizeiptr size)
+	{
+		if (!this->buffer)
+			return false;
+		if (this->head + size > this->regionBytes)
+		{
+			if (!this->reported)
+				std::cout << "ERROR::UNIFORM_RING::REGION_FULL" << std::endl;
+			this->reported = true;
+			return false;
+		}
+		const GLintptr offset = this->region * this->regionBytes + this->head;
+		if (this->mapped)
+		{
+			memcpy(this->mapped + offset, block, (size_t)size);
+		}
+		else
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, this->buffer);
+			glBufferSubData(GL_UNIFORM_BUFFER, offset, size, block);
+		}
+		glBindBufferRange(GL_UNIFORM_BUFFER, binding, this->buffer, offset, size);
+		_renderStats.uniforms(size);
+		this->head += (size + this->alignment - 1) / this->alignment * this->alignment;
+		this->peak = std::max(this->peak, this->head);
+		return true;
+	}
+
+	// After the frame's last draw
+	void endFrame()
+	{
+		if (this->mapped && this->head)
+			this->fences[this->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	// Most bytes any one frame has written
+	GLsizeiptr highWater() const { return this->peak; }
+
+private:
+	GLuint buffer = 0;
+	GLsizeiptr regionBytes = 0;
+	GLsizeiptr alignment = 256;
+	// Persistent mapping of all regions, null when falling back to orphaning. The fallback has the one region.
+	uint8_t* mapped = nullptr;
+	GLsync fences[UNIFORM_RING_FRAMES] = {};
+	int region = 0;
+	GLsizeiptr head = 0;
+	GLsizeiptr peak = 0;
+	bool reported = false;
+	GpuAllocation memory;
+};
+
+static UniformRing _uniformRing;
@@ -0,0 +1,154 @@
+#pragma once
+// Std. Includes
+#include <cstddef>
+#include <string>
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+
+// One table per vertex format says where each attribute is, how the GPU fetches it and what the vertex shader reads
+// it as. The attribute pointers, the shader's input declarations and the check that a program agrees are all made
+// from it, so a new format is a struct and a table, and none of them can drift from the others.
+//
+// A format's table is a specialization of VertexLayout with a constexpr attributes() returning a VertexAttributes.
+// _setVertexAttributes<V>() is unrolled over it at compile time, with no switch on the format while a VAO is built.
+
+struct VertexAttribute
+{
+	GLuint location;
+	GLint components;
+	// What the buffer holds, and whether fixed point is normalized into [0, 1] / [-1, 1]
+	GLenum type;
+	GLboolean normalized;
+	// Fetched as integers (glVertexAttribIPointer), for an int/ivec input
+	bool integer;
+	size_t offset;
+	// What the shader declares, GL_FLOAT_VEC3 and so on, and the name it declares it under
+	GLenum shaderType;
+	const char* name;
+};
+
+// Up to VERTEX_LAYOUT_MAX_ATTRIBUTES attributes, count of them used
+#define VERTEX_LAYOUT_MAX_ATTRIBUTES 8
+
+struct VertexAttributes
+{
+	size_t count;
+	VertexAttribute attributes[VERTEX_LAYOUT_MAX_ATTRIBUTES];
+};
+
+template <typename V>
+struct VertexLayout;
+
+// Bytes one of components of type takes
+static constexpr size_t _vertexComponentBytes(GLenum type, GLint components)
+{
+	return type == GL_INT_2_10_10_10_REV || type == GL_UNSIGNED_INT_2_10_10_10_REV ? 4
+		: (type == GL_FLOAT || type == GL_INT || type == GL_UNSIGNED_INT ? 4
+		: (type == GL_SHORT || type == GL_UNSIGNED_SHORT || type == GL_HALF_FLOAT ? 2 : 1)) * (size_t)components;
+}
+
+// Every attribute from i on lies inside V, and no two from i on share a location
+template <typename V>
+static constexpr bool _vertexLayoutFrom(const VertexAttributes& layout, size_t i, size_t j)
+{
+	return i >= layout.count ? true
+		: j >= layout.count ? (layout.attributes[i].offset + _vertexComponentBytes(layout.attributes[i].type, layout.attributes[i].components) <= sizeof(V)
+			&& _vertexLayoutFrom<V>(layout, i + 1, i + 2))
+		: layout.attributes[i].location != layout.attributes[j].location && _vertexLayoutFrom<V>(layout, i, j + 1);
+}
+
+template <typename V>
+static constexpr bool _vertexLayoutValid()
+{
+	return VertexLayout<V>::attributes().count <= VERTEX_LAYOUT_MAX_ATTRIBUTES && _vertexLayoutFrom<V>(VertexLayout<V>::attributes(), 0, 1);
+}
+
+template <typename V, size_t I>
+struct VertexAttributeSetup
+{
+	static void apply(GLintptr base)
+	{
+		VertexAttributeSetup<V, I - 1>::apply(base);
+		const VertexAttribute a = VertexLayout<V>::attributes().attributes[I - 1];
+		glEnableVertexAttribArray(a.location);
+		if (a.integer)
+			glVertexAttribIPointer(a.location, a.components, a.type, sizeof(V), (const GLvoid*)(base + a.offset));
+		else
+			glVertexAttribPointer(a.location, a.components, a.type, a.normalized, sizeof(V), (const GLvoid*)(base + a.offset));
+	}
+};
+
+template <typename V>
+struct VertexAttributeSetup<V, 0>
+{
+	static void apply(GLintptr) {}
+};
+
+// Points and enables every attribute of V, reading the bound GL_ARRAY_BUFFER from base on
+template <typename V>
+static void _setVertexAttributes(GLintptr base = 0)
+{
+	static_assert(_vertexLayoutValid<V>(), "Vertex layout attribute outside its vertex, or two at one location");
+	VertexAttributeSetup<V, VertexLayout<V>::attributes().count>::apply(base);
+}
+
+static const char* _vertexShaderTypeName(GLenum shaderType)
+{
+	switch (shaderType)
+	{
+	case GL_FLOAT: return "float";
+	case GL_FLOAT_VEC2: return "vec2";
+	case GL_FLOAT_VEC3: return "vec3";
+	case GL_FLOAT_VEC4: return "vec4";
+	case GL_INT: return "int";
+	case GL_INT_VEC4: return "ivec4";
+	case GL_UNSIGNED_INT: return "uint";
+	case GL_UNSIGNED_INT_VEC4: return "uvec4";
+	default: return "?";
+	}
+}
+
+// The vertex shader's inputs for V, one "layout (location = n) in type name;" line each
+template <typename V>
+static std::string _vertexInputDeclarations()
+{
+	std::string declarations;
+	const VertexAttributes layout = VertexLayout<V>::attributes();
+	for (size_t i = 0; i < layout.count; i++)
+	{
+		const VertexAttribute& a = layout.attributes[i];
+		declarations += "layout (location = " + std::to_string(a.location) + ") in " + _vertexShaderTypeName(a.shaderType) + " " + a.name + ";\n";
+	}
+	return declarations;
+}
+
+// Whether program reads V's locations as V declares them. Inputs V doesn't have (the instance attributes) and
+// attributes the program doesn't read are fine; an input at one of V's locations of another type is not.
+template <typename V>
+static bool _checkVertexInputs(GLuint program, const char* label)
+{
+	const VertexAttributes layout = VertexLayout<V>::attributes();
+	GLint inputs = 0;
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &inputs);
+	bool matches = true;
+	for (GLint i = 0; i < inputs; i++)
+	{
+		GLchar name[64];
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveAttrib(program, (GLuint)i, sizeof(name), nullptr, &size, &type, name);
+		const GLint location = glGetAttribLocation(program, name);
+		for (size_t a = 0; a < layout.count; a++)
+		{
+			if ((GLint)layout.attributes[a].location == location && layout.attributes[a].shaderType != type)
+			{
+				std::cout << "ERROR::VERTEX_LAYOUT::MISMATCH " << label << " reads " << name << " at " << location << " as "
+					<< _vertexShaderTypeName(type) << ", the layout has " << _vertexShaderTypeName(layout.attributes[a].shaderType) << std::endl;
+				matches = false;
+			}
+		}
+	}
+	return matches;
+}
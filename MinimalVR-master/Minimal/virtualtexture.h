@@ -0,0 +1,565 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "shader.h"
+#include "texturecache.h"
+#include "jobs.h"
+#include "glstate.h"
+#include "gpumemory.h"
+#include "gldebug.h"
+#include "glcapture.h"
+#include "trace.h"
+
+// Texels a side of a page, its border included, and the border: the texels of the neighbouring pages each side
+// carries so bilinear filtering never reads past it
+#define VIRTUAL_TEXTURE_PAGE_SIZE 128
+#define VIRTUAL_TEXTURE_PAGE_BORDER 4
+// The physical cache is this many pages a side, 4096 x 4096 RGBA8: the fixed memory every virtual texture shares
+#define VIRTUAL_TEXTURE_CACHE_PAGES 32
+// Largest texture, in level 0 pages a side; the feedback packs a page's x and y into 12 bits each
+#define VIRTUAL_TEXTURE_MAX_PAGES_WIDE 4096
+// Textures open at once, the feedback has 4 bits for which (0 is none)
+#define VIRTUAL_TEXTURE_MAX_TEXTURES 15
+// The feedback pass's target a side, and the readbacks it can have in flight
+#define VIRTUAL_TEXTURE_FEEDBACK_SIZE 128
+#define VIRTUAL_TEXTURE_FEEDBACK_SLOTS 3
+// Pages uploaded per frame, and tiles decoding on the job system at once
+#define VIRTUAL_TEXTURE_FRAME_PAGES 16
+#define VIRTUAL_TEXTURE_MAX_LOADS 8
+// Units the programs sample the physical pages and the page table from
+#define VIRTUAL_TEXTURE_PAGES_UNIT 7
+#define VIRTUAL_TEXTURE_TABLE_UNIT 8
+// The shader.vert/shader.frag variants: sampling the texture, and writing the pages wanted instead of a color
+#define VIRTUAL_TEXTURE_DEFINE "#define VIRTUAL_TEXTURE\n"
+#define VIRTUAL_TEXTURE_FEEDBACK_DEFINE "#define VIRTUAL_TEXTURE_FEEDBACK\n"
+
+// One image too large to ever be resident, cut into pages that VirtualTextureCache brings in as the feedback asks
+// for them. On disk it is a directory:
+//   virtualtexture.txt               "width height extension", the image's size in texels and its tiles' file type
+//   <level>/<x>_<y>.<extension>      the page at x, y of level, VIRTUAL_TEXTURE_PAGE_SIZE square, border included
+// Level 0 is the full resolution and each level halves the one before, until one page covers the image. The pages
+// cover a square of a power of two pages a side; tiles wholly past the image's edge can be left out. Any format WIC
+// decodes will do for the tiles.
+// The page table has a mip per level and an entry per page there: its physical page's x and y, and 1 in b when
+// it's resident. The program walks up the levels from the one it wants to the first resident page.
+class VirtualTexture
+{
+public:
+	VirtualTexture() {}
+	~VirtualTexture()
+	{
+		if (this->table)
+			glDeleteTextures(1, &this->table);
+	}
+
+	VirtualTexture(const VirtualTexture&) = delete;
+	VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+	const string& directory() const { return this->path; }
+	int levels() const { return this->levelCount; }
+	GLsizei pagesWide() const { return this->pageCount; }
+
+	// For a VIRTUAL_TEXTURE program's draw, what Mesh::bindMaterial calls for a texture_virtual
+	void bind(Shader& shader) const
+	{
+		_glState.bindTexture(VIRTUAL_TEXTURE_PAGES_UNIT, this->pages);
+		_glState.bindTexture(VIRTUAL_TEXTURE_TABLE_UNIT, this->table);
+		const float content = (float)(VIRTUAL_TEXTURE_PAGE_SIZE - 2 * VIRTUAL_TEXTURE_PAGE_BORDER) * this->pageCount;
+		shader.set("virtualTextured", (GLint)1);
+		shader.set("virtualPages", (GLint)VIRTUAL_TEXTURE_PAGES_UNIT);
+		shader.set("virtualTable", (GLint)VIRTUAL_TEXTURE_TABLE_UNIT);
+		shader.set("virtualScale", glm::vec2(this->width / content, this->height / content));
+		shader.set("virtualPagesWide", (GLint)this->pageCount);
+		shader.set("virtualLevels", (GLint)this->levelCount);
+		shader.set("virtualSlot", (GLint)this->slot);
+		shader.set("virtualPageLayout", glm::vec3((float)VIRTUAL_TEXTURE_PAGE_SIZE, (float)VIRTUAL_TEXTURE_PAGE_BORDER,
+			(float)(VIRTUAL_TEXTURE_CACHE_PAGES * VIRTUAL_TEXTURE_PAGE_SIZE)));
+	}
+
+private:
+	friend class VirtualTextureCache;
+
+	string path;
+	string extension;
+	GLsizei width = 0;
+	GLsizei height = 0;
+	GLsizei pageCount = 0;
+	int levelCount = 0;
+	// 1 based, what the feedback names it by
+	int slot = 0;
+	GLuint table = 0;
+	// The cache's physical pages
+	GLuint pages = 0;
+	GpuAllocation memory;
+
+	string tilePath(int level, uint32_t x, uint32_t y) const
+	{
+		return this->path + '/' + to_string(level) + '/' + to_string(x) + '_' + to_string(y) + '.' + this->extension;
+	}
+};
+
+// Every virtual texture's resident pages, in one RGBA8 texture of VIRTUAL_TEXTURE_CACHE_PAGES pages a side, so
+// however large the textures are they take the same memory.
+//
+// Which pages are wanted comes from the feedback pass: the virtual textured meshes drawn small from the last eye
+// camera with the VIRTUAL_TEXTURE_FEEDBACK program, which writes each pixel's texture, level and page instead of a
+// color. It's read back without waiting, and a later update() takes whatever has landed. A page wanted brings in
+// the ones above it too, so there's always a coarser page to fall back on while it loads. Tiles are read and
+// decoded on the job system, coarsest first, and a few are uploaded a frame. When the cache is full the page used
+// longest ago makes room; the top page of every texture never goes.
+// Render thread only, but for the decoding jobs.
+class VirtualTextureCache
+{
+public:
+	VirtualTextureCache() {}
+	~VirtualTextureCache()
+	{
+		this->textures.clear();
+		if (this->physical)
+			glDeleteTextures(1, &this->physical);
+		if (this->feedbackColor)
+			glDeleteTextures(1, &this->feedbackColor);
+		if (this->feedbackDepth)
+			glDeleteRenderbuffers(1, &this->feedbackDepth);
+		if (this->feedbackFramebuffer)
+			glDeleteFramebuffers(1, &this->feedbackFramebuffer);
+		for (int i = 0; i < VIRTUAL_TEXTURE_FEEDBACK_SLOTS; i++)
+		{
+			if (this->slots[i].fence)
+				glDeleteSync(this->slots[i].fence);
+			if (this->slots[i].buffer)
+				glDeleteBuffers(1, &this->slots[i].buffer);
+		}
+	}
+
+	VirtualTextureCache(const VirtualTextureCache&) = delete;
+	VirtualTextureCache& operator=(const VirtualTextureCache&) = delete;
+
+	// reversed as the eye targets are, for the feedback pass's depth
+	bool init(bool reversed)
+	{
+		const GLsizei size = VIRTUAL_TEXTURE_CACHE_PAGES * VIRTUAL_TEXTURE_PAGE_SIZE;
+		glGenTextures(1, &this->physical);
+		_glState.selectTexture(VIRTUAL_TEXTURE_PAGES_UNIT, this->physical);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		_glLabel(GL_TEXTURE, this->physical, "virtual texture pages");
+		this->memory.reset(GpuMemoryCategory::Textures, _gpuImageBytes(GL_RGBA8, size, size));
+		this->owners.assign(VIRTUAL_TEXTURE_CACHE_PAGES * VIRTUAL_TEXTURE_CACHE_PAGES, 0);
+
+		glGenTextures(1, &this->feedbackColor);
+		_glState.selectTexture(VIRTUAL_TEXTURE_PAGES_UNIT, this->feedbackColor);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, VIRTUAL_TEXTURE_FEEDBACK_SIZE, VIRTUAL_TEXTURE_FEEDBACK_SIZE, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		_glLabel(GL_TEXTURE, this->feedbackColor, "virtual texture feedback");
+		_glState.selectTexture(VIRTUAL_TEXTURE_PAGES_UNIT, this->physical);
+		glGenRenderbuffers(1, &this->feedbackDepth);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->feedbackDepth);
+		glRenderbufferStorage(GL_RENDERBUFFER, reversed ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24,
+			VIRTUAL_TEXTURE_FEEDBACK_SIZE, VIRTUAL_TEXTURE_FEEDBACK_SIZE);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &this->feedbackFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->feedbackFramebuffer);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->feedbackColor, 0);
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->feedbackDepth);
+		const bool complete = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		_glLabel(GL_FRAMEBUFFER, this->feedbackFramebuffer, "virtual texture feedback");
+		if (!complete)
+		{
+			std::cout << "ERROR::VIRTUAL_TEXTURE::FRAMEBUFFER_INCOMPLETE" << std::endl;
+			return false;
+		}
+		this->feedbackMemory.reset(GpuMemoryCategory::EyeTargets, _gpuImageBytes(GL_R32UI, VIRTUAL_TEXTURE_FEEDBACK_SIZE, VIRTUAL_TEXTURE_FEEDBACK_SIZE) +
+			_gpuImageBytes(reversed ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24, VIRTUAL_TEXTURE_FEEDBACK_SIZE, VIRTUAL_TEXTURE_FEEDBACK_SIZE));
+
+		for (int i = 0; i < VIRTUAL_TEXTURE_FEEDBACK_SLOTS; i++)
+		{
+			glGenBuffers(1, &this->slots[i].buffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, this->slots[i].buffer);
+			glBufferData(GL_PIXEL_PACK_BUFFER, this->feedbackBytes(), NULL, GL_STREAM_READ);
+			_glLabel(GL_BUFFER, this->slots[i].buffer, "virtual texture feedback readback");
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		this->feedbackPixels.resize(VIRTUAL_TEXTURE_FEEDBACK_SIZE * VIRTUAL_TEXTURE_FEEDBACK_SIZE);
+		this->ready = true;
+		return true;
+	}
+
+	bool initialized() const { return this->ready; }
+
+	// Whether there's anything for the feedback pass to draw
+	bool active() const { return this->ready && !this->textures.empty(); }
+
+	// Opens the texture in directory and makes its page table. nullptr, with the reason printed, if the descriptor is
+	// missing or malformed, or VIRTUAL_TEXTURE_MAX_TEXTURES are open. The cache owns it.
+	VirtualTexture* open(const string& directory)
+	{
+		if (!this->ready || this->textures.size() >= VIRTUAL_TEXTURE_MAX_TEXTURES)
+			return nullptr;
+		unique_ptr<VirtualTexture> texture(new VirtualTexture());
+		std::ifstream descriptor(directory + "/virtualtexture.txt");
+		if (!(descriptor >> texture->width >> texture->height >> texture->extension) || texture->width <= 0 || texture->height <= 0)
+		{
+			std::cout << "ERROR::VIRTUAL_TEXTURE::BAD_DESCRIPTOR " << directory << std::endl;
+			return nullptr;
+		}
+		const GLsizei content = VIRTUAL_TEXTURE_PAGE_SIZE - 2 * VIRTUAL_TEXTURE_PAGE_BORDER;
+		const GLsizei needed = (std::max(texture->width, texture->height) + content - 1) / content;
+		texture->pageCount = 1;
+		texture->levelCount = 1;
+		while (texture->pageCount < needed)
+		{
+			texture->pageCount *= 2;
+			texture->levelCount++;
+		}
+		if (texture->pageCount > VIRTUAL_TEXTURE_MAX_PAGES_WIDE)
+		{
+			std::cout << "ERROR::VIRTUAL_TEXTURE::TOO_LARGE " << directory << std::endl;
+			return nullptr;
+		}
+		texture->path = directory;
+		texture->slot = (int)this->textures.size() + 1;
+		texture->pages = this->physical;
+
+		// Nothing resident to start with
+		glGenTextures(1, &texture->table);
+		_glState.selectTexture(VIRTUAL_TEXTURE_TABLE_UNIT, texture->table);
+		vector<uint8_t> empty((size_t)texture->pageCount * texture->pageCount * 4, 0);
+		int64_t bytes = 0;
+		for (int level = 0; level < texture->levelCount; level++)
+		{
+			const GLsizei side = texture->pageCount >> level;
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8UI, side, side, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, empty.data());
+			bytes += _gpuImageBytes(GL_RGBA8UI, side, side);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture->levelCount - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		_glLabel(GL_TEXTURE, texture->table, (directory + " page table").c_str());
+		texture->memory.reset(GpuMemoryCategory::Textures, bytes);
+		this->textures.push_back(std::move(texture));
+		return this->textures.back().get();
+	}
+
+	// The feedback pass's target, cleared, as the draw target; the viewport and target bound before come back with
+	// endFeedback(). False, and nothing bound, when every readback is still in flight.
+	bool beginFeedback()
+	{
+		if (!this->active() || this->slots[this->nextSlot].fence)
+			return false;
+		glGetIntegerv(GL_VIEWPORT, this->savedViewport);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &this->savedFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->feedbackFramebuffer);
+		glViewport(0, 0, VIRTUAL_TEXTURE_FEEDBACK_SIZE, VIRTUAL_TEXTURE_FEEDBACK_SIZE);
+		_glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		_glState.depthMask(GL_TRUE);
+		_glState.depthFunc(GL_LESS);
+		const GLuint none[4] = { 0, 0, 0, 0 };
+		glClearBufferuiv(GL_COLOR, 0, none);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		_glCapture.clear(GL_DEPTH_BUFFER_BIT);
+		return true;
+	}
+
+	// Starts reading the feedback back, update() takes it once it's there
+	void endFeedback()
+	{
+		FeedbackSlot& slot = this->slots[this->nextSlot];
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, this->feedbackFramebuffer);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, VIRTUAL_TEXTURE_FEEDBACK_SIZE, VIRTUAL_TEXTURE_FEEDBACK_SIZE, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		this->nextSlot = (this->nextSlot + 1) % VIRTUAL_TEXTURE_FEEDBACK_SLOTS;
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->savedFramebuffer);
+		glViewport(this->savedViewport[0], this->savedViewport[1], this->savedViewport[2], this->savedViewport[3]);
+	}
+
+	// Render thread, once a frame outside the eye passes: the feedback that has landed marks its pages used and
+	// asks for the missing ones, then up to VIRTUAL_TEXTURE_FRAME_PAGES decoded tiles go up
+	void update(uint64_t frame)
+	{
+		if (!this->active())
+			return;
+		TRACE_ZONE("virtual texture update");
+		this->frame = frame;
+		this->readFeedback();
+		for (const unique_ptr<VirtualTexture>& texture : this->textures)
+			this->want(*texture, texture->levelCount - 1, 0, 0);
+		this->load();
+		this->upload();
+	}
+
+	size_t residentPages() const { return this->resident; }
+
+private:
+	enum PageState : uint8_t
+	{
+		PageLoading,
+		PageResident,
+		// The tile is missing or didn't decode, not asked for again
+		PageFailed,
+	};
+
+	struct Page
+	{
+		PageState state;
+		// Index into owners while resident
+		uint32_t physical;
+		uint64_t used;
+	};
+
+	struct FeedbackSlot
+	{
+		GLuint buffer = 0;
+		GLsync fence = 0;
+	};
+
+	// A decoded tile, empty pixels if it couldn't be
+	struct Arrival
+	{
+		uint64_t key;
+		vector<uint8_t> pixels;
+	};
+
+	vector<unique_ptr<VirtualTexture>> textures;
+	GLuint physical = 0;
+	GpuAllocation memory;
+	// Per physical page, the key of the page in it plus one, 0 while free
+	vector<uint64_t> owners;
+	unordered_map<uint64_t, Page> pages;
+	size_t resident = 0;
+	uint64_t frame = 0;
+	// Pages this frame wants and hasn't got, with the level first so the coarsest load first
+	vector<uint64_t> missing;
+
+	GLuint feedbackFramebuffer = 0;
+	GLuint feedbackColor = 0;
+	GLuint feedbackDepth = 0;
+	GpuAllocation feedbackMemory;
+	FeedbackSlot slots[VIRTUAL_TEXTURE_FEEDBACK_SLOTS];
+	int nextSlot = 0;
+	vector<uint32_t> feedbackPixels;
+	unordered_set<uint32_t> feedbackSeen;
+	GLint savedViewport[4] = { 0, 0, 0, 0 };
+	GLint savedFramebuffer = 0;
+	bool ready = false;
+
+	// Filled by the decoding jobs, taken by upload()
+	std::mutex arrivalMutex;
+	vector<Arrival> arrived;
+	vector<Arrival> landing;
+	std::atomic<int> loads{ 0 };
+
+	static uint64_t pageKey(int slot, int level, uint32_t x, uint32_t y)
+	{
+		return (uint64_t)slot << 48 | (uint64_t)level << 40 | (uint64_t)y << 20 | x;
+	}
+
+	static int keySlot(uint64_t key) { return (int)(key >> 48); }
+	static int keyLevel(uint64_t key) { return (int)((key >> 40) & 0xff); }
+	static uint32_t keyY(uint64_t key) { return (uint32_t)((key >> 20) & 0xfffff); }
+	static uint32_t keyX(uint64_t key) { return (uint32_t)(key & 0xfffff); }
+
+	GLsizeiptr feedbackBytes() const
+	{
+		return (GLsizeiptr)VIRTUAL_TEXTURE_FEEDBACK_SIZE * VIRTUAL_TEXTURE_FEEDBACK_SIZE * sizeof(uint32_t);
+	}
+
+	// The oldest readback that has landed, if any: every distinct value wants its page
+	void readFeedback()
+	{
+		for (int i = 0; i < VIRTUAL_TEXTURE_FEEDBACK_SLOTS; i++)
+		{
+			FeedbackSlot& slot = this->slots[(this->nextSlot + i) % VIRTUAL_TEXTURE_FEEDBACK_SLOTS];
+			if (!slot.fence || glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+				continue;
+			glDeleteSync(slot.fence);
+			slot.fence = 0;
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+			const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, this->feedbackBytes(), GL_MAP_READ_BIT);
+			if (mapped)
+				memcpy(this->feedbackPixels.data(), mapped, (size_t)this->feedbackBytes());
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			if (!mapped)
+				continue;
+
+			this->feedbackSeen.clear();
+			for (uint32_t value : this->feedbackPixels)
+			{
+				if (value && this->feedbackSeen.insert(value).second)
+				{
+					const int slotIndex = (int)(value >> 28);
+					if (slotIndex < 1 || slotIndex > (int)this->textures.size())
+						continue;
+					const VirtualTexture& texture = *this->textures[slotIndex - 1];
+					this->want(texture, std::min((int)((value >> 24) & 0xf), texture.levelCount - 1), value & 0xfff, (value >> 12) & 0xfff);
+				}
+			}
+		}
+	}
+
+	// Marks the page and every one above it used this frame, the missing ones go into missing
+	void want(const VirtualTexture& texture, int level, uint32_t x, uint32_t y)
+	{
+		for (; level < texture.levelCount; level++, x >>= 1, y >>= 1)
+		{
+			const uint32_t side = (uint32_t)(texture.pageCount >> level);
+			if (x >= side || y >= side)
+				return;
+			const uint64_t key = pageKey(texture.slot, level, x, y);
+			auto found = this->pages.find(key);
+			if (found != this->pages.end())
+			{
+				// Its parents are already known to have been asked for this frame
+				if (found->second.used == this->frame)
+					return;
+				found->second.used = this->frame;
+				continue;
+			}
+			this->missing.push_back(key);
+		}
+	}
+
+	// Sends the coarsest missing pages off to decode, as many as there's room for
+	void load()
+	{
+		std::sort(this->missing.begin(), this->missing.end(), [](uint64_t a, uint64_t b) { return keyLevel(a) > keyLevel(b); });
+		this->missing.erase(std::unique(this->missing.begin(), this->missing.end()), this->missing.end());
+		const JobPriority priority = _jobPriority();
+		_jobPriority() = JobPriority::Background;
+		for (uint64_t key : this->missing)
+		{
+			if (this->loads.load() >= VIRTUAL_TEXTURE_MAX_LOADS)
+				break;
+			if (this->pages.find(key) != this->pages.end())
+				continue;
+			this->pages[key] = Page{ PageLoading, 0, this->frame };
+			this->loads++;
+			const string path = this->textures[keySlot(key) - 1]->tilePath(keyLevel(key), keyX(key), keyY(key));
+			_jobs.run([this, key, path]()
+			{
+				TRACE_ZONE("virtual texture tile");
+				Arrival arrival;
+				arrival.key = key;
+				DecodedImage image;
+				if (_decodeImage(path, &image) && image.levels[0].width == VIRTUAL_TEXTURE_PAGE_SIZE && image.levels[0].height == VIRTUAL_TEXTURE_PAGE_SIZE)
+					arrival.pixels = std::move(image.levels[0].pixels);
+				std::lock_guard<std::mutex> lock(this->arrivalMutex);
+				this->arrived.push_back(std::move(arrival));
+				this->loads--;
+			});
+		}
+		_jobPriority() = priority;
+		this->missing.clear();
+	}
+
+	// The tiles that have decoded into the physical pages, and their table entries
+	void upload()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->arrivalMutex);
+			this->landing.insert(this->landing.end(), std::make_move_iterator(this->arrived.begin()), std::make_move_iterator(this->arrived.end()));
+			this->arrived.clear();
+		}
+		size_t uploaded = 0;
+		for (; uploaded < this->landing.size() && uploaded < VIRTUAL_TEXTURE_FRAME_PAGES; uploaded++)
+		{
+			Arrival& arrival = this->landing[uploaded];
+			auto found = this->pages.find(arrival.key);
+			if (found == this->pages.end() || found->second.state != PageLoading)
+				continue;
+			if (arrival.pixels.empty())
+			{
+				std::cout << "ERROR::VIRTUAL_TEXTURE::TILE_FAILED " << this->textures[keySlot(arrival.key) - 1]->tilePath(keyLevel(arrival.key),
+					keyX(arrival.key), keyY(arrival.key)) << std::endl;
+				found->second.state = PageFailed;
+				continue;
+			}
+			const int64_t physical = this->allocate();
+			if (physical < 0)
+			{
+				// Everything resident is in use this frame, the feedback asks again
+				this->pages.erase(found);
+				continue;
+			}
+			this->owners[physical] = arrival.key + 1;
+			found->second.state = PageResident;
+			found->second.physical = (uint32_t)physical;
+			this->resident++;
+
+			const GLint px = (GLint)(physical % VIRTUAL_TEXTURE_CACHE_PAGES), py = (GLint)(physical / VIRTUAL_TEXTURE_CACHE_PAGES);
+			_glState.selectTexture(VIRTUAL_TEXTURE_PAGES_UNIT, this->physical);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, px * VIRTUAL_TEXTURE_PAGE_SIZE, py * VIRTUAL_TEXTURE_PAGE_SIZE, VIRTUAL_TEXTURE_PAGE_SIZE,
+				VIRTUAL_TEXTURE_PAGE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, arrival.pixels.data());
+			const uint8_t entry[4] = { (uint8_t)px, (uint8_t)py, 1, 0 };
+			this->writeEntry(arrival.key, entry);
+		}
+		this->landing.erase(this->landing.begin(), this->landing.begin() + uploaded);
+	}
+
+	// A free physical page, or the one whose page was used longest ago and not this frame; never a top page. -1 when
+	// there's none.
+	int64_t allocate()
+	{
+		int64_t oldest = -1;
+		uint64_t oldestUsed = this->frame;
+		for (size_t i = 0; i < this->owners.size(); i++)
+		{
+			if (!this->owners[i])
+				return (int64_t)i;
+			const uint64_t key = this->owners[i] - 1;
+			if (keyLevel(key) == this->textures[keySlot(key) - 1]->levelCount - 1)
+				continue;
+			const Page& page = this->pages.find(key)->second;
+			if (page.used < oldestUsed)
+			{
+				oldestUsed = page.used;
+				oldest = (int64_t)i;
+			}
+		}
+		if (oldest < 0)
+			return -1;
+		const uint64_t evicted = this->owners[oldest] - 1;
+		const uint8_t none[4] = { 0, 0, 0, 0 };
+		this->writeEntry(evicted, none);
+		this->pages.erase(evicted);
+		this->owners[oldest] = 0;
+		this->resident--;
+		return oldest;
+	}
+
+	void writeEntry(uint64_t key, const uint8_t* entry)
+	{
+		_glState.selectTexture(VIRTUAL_TEXTURE_TABLE_UNIT, this->textures[keySlot(key) - 1]->table);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexSubImage2D(GL_TEXTURE_2D, keyLevel(key), (GLint)keyX(key), (GLint)keyY(key), 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entry);
+	}
+};
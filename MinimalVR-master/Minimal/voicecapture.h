@@ -0,0 +1,144 @@
+#pragma once
+// Std. Includes
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+// OVR Includes
+#include <OVR_Platform.h>
+#include "trace.h"
+#include "threading.h"
+
+// Samples the ring holds, a third of a second at the microphone's 48 kHz. Must be a power of two.
+#define VOICE_RING_SAMPLES 16384
+// Most samples one frame hands the avatar, the newest ones; a 90 Hz frame brings about 530
+#define VOICE_WINDOW_SAMPLES 1024
+// Most samples the capture thread takes from the microphone in one read
+#define VOICE_READ_SAMPLES 2048
+// How often the capture thread wakes
+#define VOICE_POLL_MS 10
+
+// Microphone samples for the avatar's voice visualization, away from the frame.
+//
+// A thread of its own reads the platform microphone every VOICE_POLL_MS into a single producer, single consumer
+// ring of floats. Each frame window() takes what came in since the last one, at most VOICE_WINDOW_SAMPLES, into a
+// buffer the class owns; the older ones are skipped rather than shown late. The frame neither touches the
+// microphone nor holds a large buffer on its stack. When the frame falls behind, the thread drops what doesn't
+// fit, so the ring never blocks either side.
+class VoiceCapture
+{
+public:
+	VoiceCapture() {}
+	~VoiceCapture()
+	{
+		this->stop();
+	}
+
+	VoiceCapture(const VoiceCapture&) = delete;
+	VoiceCapture& operator=(const VoiceCapture&) = delete;
+
+	bool running() const { return this->thread.joinable(); }
+
+	// Once the platform is initialized, from any thread. False if there is no microphone to open.
+	bool start()
+	{
+		if (this->running())
+			return true;
+		this->mic = ovr_Microphone_Create();
+		if (!this->mic)
+			return false;
+		ovr_Microphone_Start(this->mic);
+		this->stopping = false;
+		this->thread = std::thread([this]() { this->run(); });
+		return true;
+	}
+
+	void stop()
+	{
+		if (!this->running())
+			return;
+		this->stopping = true;
+		this->thread.join();
+		ovr_Microphone_Stop(this->mic);
+		ovr_Microphone_Destroy(this->mic);
+		this->mic = nullptr;
+	}
+
+	// Frame side: the samples captured since the last call, newest VOICE_WINDOW_SAMPLES at most. Valid until the
+	// next call, count is 0 when nothing came in.
+	const float* window(uint32_t* count)
+	{
+		const size_t tail = this->tail.load(std::memory_order_acquire);
+		size_t head = this->head.load(std::memory_order_relaxed);
+		if (tail - head > VOICE_WINDOW_SAMPLES)
+			head = tail - VOICE_WINDOW_SAMPLES;
+		const size_t samples = tail - head;
+		const size_t first = head & (VOICE_RING_SAMPLES - 1);
+		const size_t split = samples < VOICE_RING_SAMPLES - first ? samples : VOICE_RING_SAMPLES - first;
+		memcpy(this->prepared, this->ring + first, split * sizeof(float));
+		memcpy(this->prepared + split, this->ring, (samples - split) * sizeof(float));
+		this->head.store(tail, std::memory_order_release);
+		*count = (uint32_t)samples;
+		return this->prepared;
+	}
+
+	// Samples the thread threw away for want of room so far
+	uint64_t dropped() const { return this->droppedSamples.load(std::memory_order_relaxed); }
+
+private:
+	void run()
+	{
+		TRACE_THREAD("voice capture");
+		_threadPolicy.apply(ThreadRole::Background);
+		while (!this->stopping)
+		{
+			// Everything the microphone has buffered, a read at a time
+			for (;;)
+			{
+				const size_t read = ovr_Microphone_ReadData(this->mic, this->chunk, VOICE_READ_SAMPLES);
+				if (read == 0)
+					break;
+				this->push(this->chunk, read);
+				if (read < VOICE_READ_SAMPLES)
+					break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(VOICE_POLL_MS));
+		}
+	}
+
+	// Producer side
+	void push(const float* samples, size_t count)
+	{
+		const size_t tail = this->tail.load(std::memory_order_relaxed);
+		const size_t room = VOICE_RING_SAMPLES - (tail - this->head.load(std::memory_order_acquire));
+		if (count > room)
+		{
+			this->droppedSamples.fetch_add(count - room, std::memory_order_relaxed);
+			count = room;
+		}
+		const size_t first = tail & (VOICE_RING_SAMPLES - 1);
+		const size_t split = count < VOICE_RING_SAMPLES - first ? count : VOICE_RING_SAMPLES - first;
+		memcpy(this->ring + first, samples, split * sizeof(float));
+		memcpy(this->ring, samples + split, (count - split) * sizeof(float));
+		this->tail.store(tail + count, std::memory_order_release);
+	}
+
+	static_assert((VOICE_RING_SAMPLES & (VOICE_RING_SAMPLES - 1)) == 0, "VOICE_RING_SAMPLES must be a power of two");
+
+	ovrMicrophoneHandle mic = nullptr;
+	std::thread thread;
+	std::atomic<bool> stopping{ false };
+	float ring[VOICE_RING_SAMPLES];
+	// Kept on their own cache lines so the two threads don't fight over one
+	alignas(64) std::atomic<size_t> head{ 0 };
+	alignas(64) std::atomic<size_t> tail{ 0 };
+	std::atomic<uint64_t> droppedSamples{ 0 };
+	// The capture thread's alone
+	float chunk[VOICE_READ_SAMPLES];
+	// The frame's alone
+	float prepared[VOICE_WINDOW_SAMPLES];
+};
+
+static VoiceCapture _voiceCapture;
@@ -0,0 +1,212 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h>
+#include "programcache.h"
+
+// Side of the offscreen target warm-up draws into
+#define WARMUP_TARGET_SIZE 8
+// Uniform buffer bindings warm-up saves and puts back, more than any program here uses
+#define WARMUP_UNIFORM_BINDINGS 16
+
+// Drivers finish a program for the state it is drawn with on its first draw call, not when it links, and a frame
+// that draws with a new one stalls for it. _warmUpPrograms() makes those first calls ahead of time: every program
+// draws one triangle into an offscreen target once opaque, once blended and once depth only, the three ways the
+// render queue's passes draw.
+//
+// Its vertex array has one attribute of each active attribute's type, all reading the same zeroed buffer, and every
+// active uniform block reads zeros too. Nearly every vertex shader then puts all three vertices at the origin, so
+// nothing is rasterized, but the variant is built at the draw call regardless. What a fragment shader that does run
+// samples is unbound and reads as zero. Elsewhere GL state is put back as it was found, except that no program or
+// vertex array is left bound.
+class ProgramWarmup
+{
+public:
+	// Once, with the context current
+	void init()
+	{
+		glGenFramebuffers(1, &this->fbo);
+		glGenRenderbuffers(2, this->renderbuffers);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->renderbuffers[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WARMUP_TARGET_SIZE, WARMUP_TARGET_SIZE);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->renderbuffers[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, WARMUP_TARGET_SIZE, WARMUP_TARGET_SIZE);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		GLint drawFbo = 0;
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->fbo);
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->renderbuffers[0]);
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->renderbuffers[1]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFbo);
+
+		// Three vertices of the widest attribute, a mat4
+		const vector<uint8_t> zeros(3 * sizeof(float) * 16, 0);
+		glGenBuffers(1, &this->vertices);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertices);
+		glBufferData(GL_ARRAY_BUFFER, zeros.size(), zeros.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glGenBuffers(1, &this->uniforms);
+	}
+
+	// Draws with each program once in each of the three states, returns how many programs that was. Programs
+	// deleted since they were listed are passed over.
+	uint32_t run(const vector<GLuint>& programs)
+	{
+		if (!this->fbo || programs.empty())
+			return 0;
+
+		GLint drawFbo = 0, viewport[4];
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFbo);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		const GLboolean blend = glIsEnabled(GL_BLEND), depthTest = glIsEnabled(GL_DEPTH_TEST), cull = glIsEnabled(GL_CULL_FACE);
+		GLboolean depthMask, colorMask[4];
+		glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+		glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+		GLint bindings[WARMUP_UNIFORM_BINDINGS];
+		GLint64 starts[WARMUP_UNIFORM_BINDINGS], sizes[WARMUP_UNIFORM_BINDINGS];
+		for (GLuint i = 0; i < WARMUP_UNIFORM_BINDINGS; i++)
+		{
+			glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, i, &bindings[i]);
+			glGetInteger64i_v(GL_UNIFORM_BUFFER_START, i, &starts[i]);
+			glGetInteger64i_v(GL_UNIFORM_BUFFER_SIZE, i, &sizes[i]);
+		}
+
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->fbo);
+		glViewport(0, 0, WARMUP_TARGET_SIZE, WARMUP_TARGET_SIZE);
+		glDisable(GL_CULL_FACE);
+		glEnable(GL_DEPTH_TEST);
+		uint32_t warmed = 0;
+		for (size_t i = 0; i < programs.size(); i++)
+		{
+			if (!glIsProgram(programs[i]))
+				continue;
+			GLint linked = 0;
+			glGetProgramiv(programs[i], GL_LINK_STATUS, &linked);
+			if (!linked)
+				continue;
+			glUseProgram(programs[i]);
+			GLuint vertexArray = this->bindInputs(programs[i]);
+			// Opaque, blended, then depth only
+			for (int state = 0; state < 3; state++)
+			{
+				if (state == 1)
+					glEnable(GL_BLEND);
+				else
+					glDisable(GL_BLEND);
+				glDepthMask(state != 1);
+				const GLboolean color = state != 2;
+				glColorMask(color, color, color, color);
+				glDrawArrays(GL_TRIANGLES, 0, 3);
+			}
+			glBindVertexArray(0);
+			glDeleteVertexArrays(1, &vertexArray);
+			warmed++;
+		}
+		// The driver does the work once the calls reach it
+		glFinish();
+
+		glUseProgram(0);
+		for (GLuint i = 0; i < WARMUP_UNIFORM_BINDINGS; i++)
+		{
+			if (sizes[i] > 0)
+				glBindBufferRange(GL_UNIFORM_BUFFER, i, bindings[i], (GLintptr)starts[i], (GLsizeiptr)sizes[i]);
+			else
+				glBindBufferBase(GL_UNIFORM_BUFFER, i, bindings[i]);
+		}
+		glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]);
+		glDepthMask(depthMask);
+		if (blend)
+			glEnable(GL_BLEND);
+		else
+			glDisable(GL_BLEND);
+		if (depthTest)
+			glEnable(GL_DEPTH_TEST);
+		else
+			glDisable(GL_DEPTH_TEST);
+		if (cull)
+			glEnable(GL_CULL_FACE);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFbo);
+		return warmed;
+	}
+
+private:
+	GLuint fbo = 0;
+	GLuint renderbuffers[2] = { 0, 0 };
+	GLuint vertices = 0;
+	GLuint uniforms = 0;
+	GLsizeiptr uniformsSize = 0;
+
+	// A vertex array over the zeroed buffer for program's attributes, and its uniform blocks pointed at zeros
+	GLuint bindInputs(GLuint program)
+	{
+		GLuint vertexArray;
+		glGenVertexArrays(1, &vertexArray);
+		glBindVertexArray(vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertices);
+		GLint attributes = 0;
+		glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &attributes);
+		for (GLint i = 0; i < attributes; i++)
+		{
+			char name[64];
+			GLint arraySize;
+			GLenum type;
+			glGetActiveAttrib(program, (GLuint)i, sizeof(name), nullptr, &arraySize, &type, name);
+			const GLint location = glGetAttribLocation(program, name);
+			// Built-ins like gl_VertexID are active but have no location
+			if (location < 0)
+				continue;
+			GLint components, columns = 1;
+			bool integer = false;
+			switch (type)
+			{
+			case GL_FLOAT: components = 1; break;
+			case GL_FLOAT_VEC2: components = 2; break;
+			case GL_FLOAT_VEC3: components = 3; break;
+			case GL_FLOAT_MAT3: components = 3; columns = 3; break;
+			case GL_FLOAT_MAT4: components = 4; columns = 4; break;
+			case GL_INT: case GL_UNSIGNED_INT: components = 1; integer = true; break;
+			case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: components = 2; integer = true; break;
+			case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: components = 3; integer = true; break;
+			case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: components = 4; integer = true; break;
+			default: components = 4; break;
+			}
+			for (GLint column = 0; column < columns * arraySize; column++)
+			{
+				glEnableVertexAttribArray(location + column);
+				if (integer)
+					glVertexAttribIPointer(location + column, components, GL_INT, 0, nullptr);
+				else
+					glVertexAttribPointer(location + column, components, GL_FLOAT, GL_FALSE, 0, nullptr);
+			}
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		GLint blocks = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &blocks);
+		for (GLint i = 0; i < blocks; i++)
+		{
+			GLint binding = 0, size = 0;
+			glGetActiveUniformBlockiv(program, (GLuint)i, GL_UNIFORM_BLOCK_BINDING, &binding);
+			glGetActiveUniformBlockiv(program, (GLuint)i, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+			if (binding >= WARMUP_UNIFORM_BINDINGS)
+				continue;
+			if (size > this->uniformsSize)
+			{
+				const vector<uint8_t> zeros((size_t)size, 0);
+				glBindBuffer(GL_UNIFORM_BUFFER, this->uniforms);
+				glBufferData(GL_UNIFORM_BUFFER, size, zeros.data(), GL_STATIC_DRAW);
+				glBindBuffer(GL_UNIFORM_BUFFER, 0);
+				this->uniformsSize = size;
+			}
+			glBindBufferRange(GL_UNIFORM_BUFFER, (GLuint)binding, this->uniforms, 0, size);
+		}
+		return vertexArray;
+	}
+};
+
+static ProgramWarmup _programWarmup;
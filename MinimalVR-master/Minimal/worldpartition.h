@@ -0,0 +1,485 @@
+#pragma once
+// Std. Includes
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <iterator>
+#include <iostream>
+using namespace std;
+// Windows Includes
+#include <Windows.h>
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "model.h"
+#include "culling.h"
+#include "streaming.h"
+#include "assetpack.h"
+#include "mappedfile.h"
+#include "objimport.h"
+#include "meshlod.h"
+#include "json.h"
+#include "hitchrecorder.h"
+
+// A cell is loaded once the head, or where it is headed, comes within this many cells of it, and unloaded once
+// both are past WORLD_UNLOAD_FACTOR times that. The gap keeps a cell on a boundary from loading and unloading in turn.
+#define WORLD_LOAD_CELLS 1.5f
+#define WORLD_UNLOAD_FACTOR 1.5f
+// How far ahead of the head cells are loaded, at the speed it has been moving. A cell takes a few hundred ms on
+// the loader, someone walking briskly covers about a metre in that.
+#define WORLD_PREDICT_SECONDS 1.5f
+// How much of each frame's movement the speed estimate takes, so a turn of the head doesn't send it elsewhere
+#define WORLD_VELOCITY_SMOOTHING 0.1f
+// Cells on the loader at once. Other assets queue behind them, and a cell done early is only of use if it is
+// still wanted when it lands.
+#define WORLD_MAX_LOADS 2
+// Default bound on the full cells' meshes, --world-budget <MB> sets another. The proxies are always resident.
+#define WORLD_DEFAULT_BUDGET_MB 512
+// Fraction of a cell's triangles its proxy keeps
+#define WORLD_PROXY_RATIO 0.05f
+#define WORLD_PROXY_MIN_TRIANGLES 12
+
+// One grid cell of the manifest
+struct WorldCell
+{
+	string name;
+	Aabb bounds;
+	string modelPath;
+	string proxyPath;
+	// The full meshes' vertex and index bytes, what they count against the budget
+	size_t bytes = 0;
+	shared_ptr<Model> full;
+	shared_ptr<Model> proxy;
+	bool loading = false;
+	// Distance of the nearer of the head and where it is headed from the cell's box, along the floor
+	float distance = FLT_MAX;
+	// The cell's model drawn this frame, chosen by cull
+	Model* drawn = nullptr;
+};
+
+// A facility too large to keep resident, split offline by _partitionWorld into a grid of cells along the floor,
+// each with a simplified proxy.
+//
+// The proxies all load when the manifest opens and stay. Full cells stream in through _assets as the tracked head,
+// and where it is headed, comes near them, nearest first and at most WORLD_MAX_LOADS at a time, and out again once
+// both are well past. Loads go through the loader's shared context and its fence, so a cell is never waited on: it
+// draws as its proxy until it has landed. The full cells' bytes stay within the budget, a nearer cell that doesn't
+// fit evicting the farthest resident one, and one that lands no longer wanted is dropped. Files come from
+// _assetPack when it has them, like every other model.
+//
+// Render thread only. Cells are in the factory's model space and draw with its transform. Loads still on the loader
+// when the partition goes away land into nothing.
+class WorldPartition
+{
+public:
+	WorldPartition() {}
+
+	WorldPartition(const WorldPartition&) = delete;
+	WorldPartition& operator=(const WorldPartition&) = delete;
+
+	// Reads the manifest _partitionWorld wrote and starts the proxies loading, false if it can't be read
+	bool open(const string& manifest)
+	{
+		MappedFile file;
+		AssetSpan span;
+		if (!_assetPack.find(manifest, &span))
+		{
+			if (!file.open(manifest))
+			{
+				cout << "ERROR::WORLD::MANIFEST_NOT_FOUND " << manifest << endl;
+				return false;
+			}
+			span.data = file.data();
+			span.size = file.size();
+		}
+		const char* text = (const char*)span.data;
+		JsonValue document;
+		if (!_parseJson(text, text + span.size, &document) || document.type != JsonValue::Type::Object)
+		{
+			cout << "ERROR::WORLD::MANIFEST_NOT_JSON " << manifest << endl;
+			return false;
+		}
+		const JsonValue* cells = document.get("cells");
+		this->cellSize = (float)document.numberOr("cell_size", 0.0);
+		if (!cells || cells->type != JsonValue::Type::Array || this->cellSize <= 0.0f)
+		{
+			cout << "ERROR::WORLD::MANIFEST_WITHOUT_CELLS " << manifest << endl;
+			return false;
+		}
+
+		const string directory = manifest.substr(0, manifest.find_last_of("/\\") + 1);
+		this->cells.clear();
+		this->cells.resize(cells->items.size());
+		for (size_t i = 0; i < cells->items.size(); i++)
+		{
+			const JsonValue& entry = cells->items[i];
+			WorldCell& cell = this->cells[i];
+			cell.name = entry.textOr("name", "");
+			cell.modelPath = directory + entry.textOr("model", "");
+			cell.proxyPath = directory + entry.textOr("proxy", "");
+			cell.bytes = (size_t)entry.numberOr("bytes", 0.0);
+			const JsonValue* lo = entry.get("min");
+			const JsonValue* hi = entry.get("max");
+			if (lo && hi && lo->items.size() == 3 && hi->items.size() == 3)
+			{
+				cell.bounds.add(glm::vec3((float)lo->items[0].number, (float)lo->items[1].number, (float)lo->items[2].number));
+				cell.bounds.add(glm::vec3((float)hi->items[0].number, (float)hi->items[1].number, (float)hi->items[2].number));
+			}
+		}
+		for (size_t i = 0; i < this->cells.size(); i++)
+			this->loadProxy(i);
+		printf("World: %u cells of %.1f from %s, %.1f MB budget\r\n", (unsigned)this->cells.size(), this->cellSize, manifest.c_str(),
+			this->budget / (1024.0 * 1024.0));
+		return true;
+	}
+
+	bool loaded() const { return !this->cells.empty(); }
+
+	void setBudget(size_t bytes) { this->budget = bytes; }
+
+	// Once a frame with the head in the cells' space: unloads what is out of range, then starts the nearest cells
+	// wanted that aren't resident
+	void update(const glm::vec3& head, float deltaSeconds)
+	{
+		if (this->cells.empty())
+			return;
+		if (this->tracked && deltaSeconds > 0.0f)
+		{
+			const glm::vec3 velocity = (head - this->lastHead) / deltaSeconds;
+			this->velocity += (velocity - this->velocity) * WORLD_VELOCITY_SMOOTHING;
+		}
+		this->lastHead = head;
+		this->tracked = true;
+		const glm::vec3 ahead = head + this->velocity * WORLD_PREDICT_SECONDS;
+
+		const float loadRadius = this->cellSize * WORLD_LOAD_CELLS;
+		for (WorldCell& cell : this->cells)
+		{
+			cell.distance = std::min(floorDistance(cell.bounds, head), floorDistance(cell.bounds, ahead));
+			if (cell.full && cell.distance > loadRadius * WORLD_UNLOAD_FACTOR)
+				this->unload(cell);
+		}
+
+		this->order.clear();
+		for (size_t i = 0; i < this->cells.size(); i++)
+		{
+			const WorldCell& cell = this->cells[i];
+			if (!cell.full && !cell.loading && cell.distance <= loadRadius)
+				this->order.push_back(i);
+		}
+		std::sort(this->order.begin(), this->order.end(),
+			[this](size_t a, size_t b) { return this->cells[a].distance < this->cells[b].distance; });
+		for (size_t i : this->order)
+		{
+			if (this->loads >= WORLD_MAX_LOADS)
+				break;
+			WorldCell& cell = this->cells[i];
+			if (!this->makeRoom(cell))
+				break;
+			this->load(i);
+		}
+	}
+
+	// Picks each cell's full model if it has landed, its proxy otherwise, and culls its meshes against both eyes.
+	// Returns the meshes culled.
+	uint32_t cull(const StereoFrustum& frustum, const glm::mat4& transform)
+	{
+		uint32_t culled = 0;
+		for (WorldCell& cell : this->cells)
+		{
+			cell.drawn = cell.full ? cell.full.get() : cell.proxy.get();
+			if (cell.drawn)
+				culled += cell.drawn->cull(frustum, transform);
+		}
+		return culled;
+	}
+
+	// Every cell as cull picked it, eyeCount instances of each mesh like the factory's. The program must be in use
+	// with its view and model uniforms set.
+	void draw(Shader& shader, GLsizei eyeCount)
+	{
+		for (WorldCell& cell : this->cells)
+		{
+			if (cell.drawn)
+				cell.drawn->DrawInstanced(shader, eyeCount);
+		}
+	}
+
+	size_t residentBytes() const { return this->resident; }
+	size_t budgetBytes() const { return this->budget; }
+	uint32_t residentCells() const
+	{
+		uint32_t count = 0;
+		for (const WorldCell& cell : this->cells)
+			count += cell.full ? 1 : 0;
+		return count;
+	}
+	uint32_t loadsInFlight() const { return this->loads; }
+	size_t cellCount() const { return this->cells.size(); }
+
+private:
+	vector<WorldCell> cells;
+	float cellSize = 0.0f;
+	size_t budget = (size_t)WORLD_DEFAULT_BUDGET_MB * 1024 * 1024;
+	// Full cells resident or on the loader, against the budget
+	size_t resident = 0;
+	uint32_t loads = 0;
+	glm::vec3 lastHead = glm::vec3(0.0f);
+	glm::vec3 velocity = glm::vec3(0.0f);
+	bool tracked = false;
+	vector<size_t> order;
+	// What the loads' ready steps hold weakly, gone with the partition
+	shared_ptr<WorldPartition*> self = make_shared<WorldPartition*>(this);
+
+	// Distance from point to box ignoring height, zero inside it
+	static float floorDistance(const Aabb& box, const glm::vec3& point)
+	{
+		const float dx = std::max(std::max(box.min.x - point.x, point.x - box.max.x), 0.0f);
+		const float dz = std::max(std::max(box.min.z - point.z, point.z - box.max.z), 0.0f);
+		return std::sqrt(dx * dx + dz * dz);
+	}
+
+	// Evicts resident cells farther than cell, farthest first, until it fits. False if it still doesn't.
+	bool makeRoom(const WorldCell& cell)
+	{
+		while (this->resident + cell.bytes > this->budget)
+		{
+			WorldCell* farthest = nullptr;
+			for (WorldCell& other : this->cells)
+			{
+				if (other.full && other.distance > cell.distance && (!farthest || other.distance > farthest->distance))
+					farthest = &other;
+			}
+			if (!farthest)
+				return false;
+			this->unload(*farthest);
+		}
+		return true;
+	}
+
+	void unload(WorldCell& cell)
+	{
+		cell.full.reset();
+		cell.drawn = nullptr;
+		this->resident -= std::min(cell.bytes, this->resident);
+	}
+
+	void loadProxy(size_t index)
+	{
+		const string path = this->cells[index].proxyPath;
+		shared_ptr<Model> loaded = make_shared<Model>();
+		weak_ptr<WorldPartition*> self = this->self;
+		_assets.request([loaded, path]() { *loaded = Model(path.c_str(), "CO2", MeshRetention::ReleaseCpuData); },
+			[self, index, loaded]() {
+				if (shared_ptr<WorldPartition*> partition = self.lock())
+					(*partition)->cells[index].proxy = loaded;
+			});
+	}
+
+	// The cell's bytes count from here, so that what is on the loader is within the budget too
+	void load(size_t index)
+	{
+		WorldCell& cell = this->cells[index];
+		cell.loading = true;
+		this->resident += cell.bytes;
+		this->loads++;
+		const string path = cell.modelPath;
+		shared_ptr<Model> loaded = make_shared<Model>();
+		weak_ptr<WorldPartition*> self = this->self;
+		_assets.request([loaded, path]() { *loaded = Model(path.c_str(), "CO2", MeshRetention::ReleaseCpuData); },
+			[self, index, loaded]() {
+				if (shared_ptr<WorldPartition*> partition = self.lock())
+					(*partition)->landed(index, loaded);
+			});
+	}
+
+	// Kept only if the cell is still in range; the meshes of one that isn't go with the last reference
+	void landed(size_t index, const shared_ptr<Model>& loaded)
+	{
+		WorldCell& cell = this->cells[index];
+		cell.loading = false;
+		this->loads--;
+		if (cell.distance > this->cellSize * WORLD_LOAD_CELLS * WORLD_UNLOAD_FACTOR)
+		{
+			this->resident -= std::min(cell.bytes, this->resident);
+			return;
+		}
+		cell.full = loaded;
+		_hitchRecorder.note(HitchEventKind::WorldCell, index, cell.name.c_str());
+	}
+};
+
+/************************************************************************************
+* Offline split, --partition-world
+************************************************************************************/
+
+// The meshes of one cell as they are split off, each keeping its source mesh's material
+struct WorldCellBuild
+{
+	vector<ObjMesh> meshes;
+	Aabb bounds;
+};
+
+static void _writeWorldMaterials(const string& path, const vector<ObjMesh>& meshes)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file)
+	{
+		printf("ERROR::WORLD::NOT_WRITTEN %s\n", path.c_str());
+		return;
+	}
+	// Kd, Ka and Ks, in the order _parseObjMaterials reads them into
+	static const char* keys[3] = { "Kd", "Ka", "Ks" };
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		fprintf(file, "newmtl m%u\n", (unsigned)m);
+		for (size_t c = 0; c < 3; c++)
+		{
+			const aiColor3D color = c < meshes[m].colors.size() ? meshes[m].colors[c] : aiColor3D(1.0f, 1.0f, 1.0f);
+			fprintf(file, "%s %g %g %g\n", keys[c], color.r, color.g, color.b);
+		}
+	}
+	fclose(file);
+}
+
+// An OBJ of meshes, mesh m under material m of library
+static bool _writeWorldObj(const string& path, const string& library, const vector<ObjMesh>& meshes)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file)
+	{
+		printf("ERROR::WORLD::NOT_WRITTEN %s\n", path.c_str());
+		return false;
+	}
+	fprintf(file, "mtllib %s\n", library.c_str());
+	size_t base = 1;
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		const ObjMesh& mesh = meshes[m];
+		for (const Vertex& v : mesh.vertices)
+		{
+			fprintf(file, "v %g %g %g\nvt %g %g\nvn %g %g %g\n", v.Position.x, v.Position.y, v.Position.z,
+				v.TexCoords.x, v.TexCoords.y, v.Normal.x, v.Normal.y, v.Normal.z);
+		}
+		fprintf(file, "usemtl m%u\n", (unsigned)m);
+		for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+		{
+			const size_t a = base + mesh.indices[i], b = base + mesh.indices[i + 1], c = base + mesh.indices[i + 2];
+			fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", (unsigned)a, (unsigned)a, (unsigned)a, (unsigned)b, (unsigned)b, (unsigned)b,
+				(unsigned)c, (unsigned)c, (unsigned)c);
+		}
+		base += mesh.vertices.size();
+	}
+	const bool written = !ferror(file);
+	fclose(file);
+	return written;
+}
+
+// Splits the OBJ at path into cells of cellSize along the floor, each triangle going to the cell its centre is in,
+// and writes each cell, a proxy of it keeping WORLD_PROXY_RATIO of its triangles, and world.json naming them all
+// into directory. Needs _jobs running.
+static bool _partitionWorld(const string& path, float cellSize, const string& directory)
+{
+	vector<ObjMesh> meshes;
+	if (cellSize <= 0.0f || !_importObj(path, &meshes))
+		return false;
+	CreateDirectoryA(directory.c_str(), nullptr);
+
+	map<pair<int, int>, WorldCellBuild> cells;
+	vector<GLuint> remap;
+	vector<uint32_t> stamp;
+	uint32_t pass = 0;
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		const ObjMesh& source = meshes[m];
+		remap.assign(source.vertices.size(), 0);
+		stamp.assign(source.vertices.size(), 0);
+		// Triangles by cell, so each cell's vertices are gathered in one pass
+		vector<pair<pair<int, int>, size_t>> triangles;
+		triangles.reserve(source.indices.size() / 3);
+		for (size_t i = 0; i + 2 < source.indices.size(); i += 3)
+		{
+			const glm::vec3 centre = (source.vertices[source.indices[i]].Position + source.vertices[source.indices[i + 1]].Position
+				+ source.vertices[source.indices[i + 2]].Position) / 3.0f;
+			triangles.push_back(make_pair(make_pair((int)std::floor(centre.x / cellSize), (int)std::floor(centre.z / cellSize)), i));
+		}
+		std::sort(triangles.begin(), triangles.end());
+		for (size_t t = 0; t < triangles.size();)
+		{
+			WorldCellBuild& cell = cells[triangles[t].first];
+			cell.meshes.emplace_back();
+			ObjMesh& mesh = cell.meshes.back();
+			mesh.colors = source.colors;
+			pass++;
+			const pair<int, int> key = triangles[t].first;
+			for (; t < triangles.size() && triangles[t].first == key; t++)
+			{
+				for (size_t corner = 0; corner < 3; corner++)
+				{
+					const GLuint index = source.indices[triangles[t].second + corner];
+					if (stamp[index] != pass)
+					{
+						stamp[index] = pass;
+						remap[index] = (GLuint)mesh.vertices.size();
+						mesh.vertices.push_back(source.vertices[index]);
+						cell.bounds.add(source.vertices[index].Position);
+					}
+					mesh.indices.push_back(remap[index]);
+				}
+			}
+		}
+	}
+
+	string manifest = "{\n\t\"version\": 1,\n\t\"source\": \"" + path + "\",\n\t\"cell_size\": " + std::to_string(cellSize) + ",\n\t\"cells\": [\n";
+	size_t fullBytes = 0, proxyBytes = 0;
+	bool written = true;
+	for (auto it = cells.begin(); it != cells.end(); ++it)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "cell_%d_%d", it->first.first, it->first.second);
+		const WorldCellBuild& cell = it->second;
+		vector<ObjMesh> proxy(cell.meshes.size());
+		size_t bytes = 0;
+		for (size_t m = 0; m < cell.meshes.size(); m++)
+		{
+			const ObjMesh& mesh = cell.meshes[m];
+			bytes += mesh.vertices.size() * sizeof(Vertex) + mesh.indices.size() * sizeof(GLuint);
+			const size_t target = std::max((size_t)(mesh.indices.size() / 3 * WORLD_PROXY_RATIO), (size_t)WORLD_PROXY_MIN_TRIANGLES);
+			_simplifyClustered(mesh.vertices, mesh.indices, target, &proxy[m].vertices, &proxy[m].indices);
+			proxy[m].colors = mesh.colors;
+			proxyBytes += proxy[m].vertices.size() * sizeof(Vertex) + proxy[m].indices.size() * sizeof(GLuint);
+		}
+		fullBytes += bytes;
+		const string library = string(name) + ".mtl";
+		_writeWorldMaterials(directory + "/" + library, cell.meshes);
+		written = _writeWorldObj(directory + "/" + name + ".obj", library, cell.meshes) && written;
+		written = _writeWorldObj(directory + "/" + name + "_proxy.obj", library, proxy) && written;
+
+		char entry[512];
+		snprintf(entry, sizeof(entry), "\t\t{ \"name\": \"%s\", \"model\": \"%s.obj\", \"proxy\": \"%s_proxy.obj\", \"bytes\": %u, "
+			"\"min\": [%g, %g, %g], \"max\": [%g, %g, %g] }%s\n", name, name, name, (unsigned)bytes,
+			cell.bounds.min.x, cell.bounds.min.y, cell.bounds.min.z, cell.bounds.max.x, cell.bounds.max.y, cell.bounds.max.z,
+			std::next(it) == cells.end() ? "" : ",");
+		manifest += entry;
+	}
+	manifest += "\t]\n}\n";
+
+	const string manifestPath = directory + "/world.json";
+	FILE* file = fopen(manifestPath.c_str(), "w");
+	if (!file)
+	{
+		printf("ERROR::WORLD::NOT_WRITTEN %s\n", manifestPath.c_str());
+		return false;
+	}
+	fputs(manifest.c_str(), file);
+	written = !ferror(file) && written;
+	fclose(file);
+	printf("World: %u cells of %.1f from %s, %.1f MB full, %.1f MB of proxies, into %s\r\n", (unsigned)cells.size(), cellSize,
+		path.c_str(), fullBytes / (1024.0 * 1024.0), proxyBytes / (1024.0 * 1024.0), manifestPath.c_str());
+	return written;
+}
@@ -0,0 +1,5 @@
+#version 330 core
+// The avatar depth pass, with AvatarVertexShader.glsl built with DEPTH_ONLY. Color writes are masked, only the
+// depth of the self-occluding parts is wanted.
+void main() {
+}
@@ -17,6 +17,14 @@
 
 #define MAX_LAYER_COUNT 8
 
+// HALF_PRECISION: the layers blended and the colour carried through in the 16 bit floats of the #extension the app
+// puts ahead of it, see _halfPrecisionDefine in main.cpp. Sampling, masks and the OIT weight stay 32 bit.
+#ifndef HALF_PRECISION
+#define float16_t float
+#define f16vec3 vec3
+#define f16vec4 vec4
+#endif
+
 in vec3 vertexWorldPos;
 in vec3 vertexViewDir;
 in vec3 vertexObjPos;
@@ -24,44 +32,141 @@ in vec3 vertexNormal;
 in vec3 vertexTangent;
 in vec3 vertexBitangent;
 in vec2 vertexUV;
+#ifdef WEIGHTED_OIT
+// A translucent part into WeightedBlendedOit's targets: the weighted, premultiplied colour and its coverage summed,
+// and what it lets through multiplied in
+layout(location = 0) out vec4 fragmentColor;
+layout(location = 1) out vec4 fragmentRevealage;
+#else
 out vec4 fragmentColor;
+#endif
+
+// Per part material, uploaded by the avatar material cache (AVATAR_MATERIAL_BINDING) only when it changes.
+// The member order and std140 layout must match AvatarMaterialBlock in main.cpp.
+layout(std140) uniform AvatarMaterial {
+    vec4 baseColor;
+    vec4 baseMaskParameters;
+    vec4 baseMaskAxis;
+    vec4 alphaMaskScaleOffset;
+    vec4 normalMapScaleOffset;
+    vec4 parallaxMapScaleOffset;
+    vec4 roughnessMapScaleOffset;
+    mat4 projectorInv;
+    int baseMaskType;
+    int layerCount;
+    bool useAlpha;
+    bool useNormalMap;
+    bool useRoughnessMap;
+    bool useProjector;
+    int layerSamplerModes[MAX_LAYER_COUNT];
+    int layerBlendModes[MAX_LAYER_COUNT];
+    int layerMaskTypes[MAX_LAYER_COUNT];
+    vec4 layerColors[MAX_LAYER_COUNT];
+    vec4 layerSurfaceScaleOffsets[MAX_LAYER_COUNT];
+    vec4 layerSampleParameters[MAX_LAYER_COUNT];
+    vec4 layerMaskParameters[MAX_LAYER_COUNT];
+    vec4 layerMaskAxes[MAX_LAYER_COUNT];
+    // Layer of each texture in the array it is bound from: alpha mask, normal, parallax and roughness map
+    ivec4 mapLayers;
+    int layerSurfaceLayers[MAX_LAYER_COUNT];
+    // With BINDLESS_TEXTURES the resident handles of those arrays, two to an element in the same order, zero otherwise
+    uvec4 textureHandles[(4 + MAX_LAYER_COUNT) / 2];
+};
+
+// Every avatar texture is a layer of a texture array. Bound, the texture units are fixed and assigned once at
+// startup; bindless, the arrays come from handles in the material block and nothing is bound per draw.
+#ifdef BINDLESS_TEXTURES
+uvec2 textureHandle(int slot)
+{
+	uvec4 pair = textureHandles[slot / 2];
+	return (slot % 2) == 0 ? pair.xy : pair.zw;
+}
+#define alphaMask sampler2DArray(textureHandle(0))
+#define normalMap sampler2DArray(textureHandle(1))
+#define parallaxMap sampler2DArray(textureHandle(2))
+#define roughnessMap sampler2DArray(textureHandle(3))
+#define LAYER_SURFACE(i) sampler2DArray(textureHandle(4 + (i)))
+#else
+uniform sampler2DArray alphaMask;
+uniform sampler2DArray normalMap;
+uniform sampler2DArray parallaxMap;
+uniform sampler2DArray roughnessMap;
+uniform sampler2DArray layerSurfaces[MAX_LAYER_COUNT];
+#define LAYER_SURFACE(i) layerSurfaces[i]
+#endif
 
-uniform vec4 baseColor;
-uniform int baseMaskType;
-uniform vec4 baseMaskParameters;
-uniform vec4 baseMaskAxis;
-uniform sampler2D alphaMask;
-uniform vec4 alphaMaskScaleOffset;
-uniform sampler2D normalMap;
-uniform vec4 normalMapScaleOffset;
-uniform sampler2D parallaxMap;
-uniform vec4 parallaxMapScaleOffset;
-uniform sampler2D roughnessMap;
-uniform vec4 roughnessMapScaleOffset;
-
-uniform mat4 projectorInv;
-
-uniform bool useAlpha;
-uniform bool useNormalMap;
-uniform bool useRoughnessMap;
-uniform bool useProjector;
 uniform float elapsedSeconds;
 
-uniform int layerCount;
+// AVATAR_DECAL: a projector's material laid over this part in the same draw, instead of drawing the part again
+// with GL_EQUAL depth. The members are AvatarMaterial's, filled in by the same code, and only the bindless
+// variant is compiled with it, the projector's textures coming from its handles. See _queueAvatarDecals in main.cpp.
+#ifdef AVATAR_DECAL
+layout(std140) uniform AvatarDecal {
+    vec4 baseColor;
+    vec4 baseMaskParameters;
+    vec4 baseMaskAxis;
+    vec4 alphaMaskScaleOffset;
+    vec4 normalMapScaleOffset;
+    vec4 parallaxMapScaleOffset;
+    vec4 roughnessMapScaleOffset;
+    mat4 projectorInv;
+    int baseMaskType;
+    int layerCount;
+    bool useAlpha;
+    bool useNormalMap;
+    bool useRoughnessMap;
+    bool useProjector;
+    int layerSamplerModes[MAX_LAYER_COUNT];
+    int layerBlendModes[MAX_LAYER_COUNT];
+    int layerMaskTypes[MAX_LAYER_COUNT];
+    vec4 layerColors[MAX_LAYER_COUNT];
+    vec4 layerSurfaceScaleOffsets[MAX_LAYER_COUNT];
+    vec4 layerSampleParameters[MAX_LAYER_COUNT];
+    vec4 layerMaskParameters[MAX_LAYER_COUNT];
+    vec4 layerMaskAxes[MAX_LAYER_COUNT];
+    ivec4 mapLayers;
+    int layerSurfaceLayers[MAX_LAYER_COUNT];
+    uvec4 textureHandles[(4 + MAX_LAYER_COUNT) / 2];
+} decal;
+
+uvec2 decalHandle(int slot)
+{
+	uvec4 pair = decal.textureHandles[slot / 2];
+	return (slot % 2) == 0 ? pair.xy : pair.zw;
+}
+#endif
 
-uniform int layerSamplerModes[MAX_LAYER_COUNT];
-uniform int layerBlendModes[MAX_LAYER_COUNT];
-uniform int layerMaskTypes[MAX_LAYER_COUNT];
-uniform vec4 layerColors[MAX_LAYER_COUNT];
-uniform sampler2D layerSurfaces[MAX_LAYER_COUNT];
-uniform vec4 layerSurfaceScaleOffsets[MAX_LAYER_COUNT];
-uniform vec4 layerSampleParameters[MAX_LAYER_COUNT];
-uniform vec4 layerMaskParameters[MAX_LAYER_COUNT];
-uniform vec4 layerMaskAxes[MAX_LAYER_COUNT];
+// Material switches. Compiled with AVATAR_PERMUTATION (see _avatarProgramDefines in main.cpp) they are constants
+// for one material, so the mode branches fold away and the fixed count layer loop unrolls. Otherwise they are
+// read from AvatarMaterial and any material can be drawn.
+#ifdef AVATAR_PERMUTATION
+const int permLayerSamplerModes[MAX_LAYER_COUNT] = int[MAX_LAYER_COUNT](PERM_LAYER_SAMPLER_MODES);
+const int permLayerMaskTypes[MAX_LAYER_COUNT] = int[MAX_LAYER_COUNT](PERM_LAYER_MASK_TYPES);
+const int permLayerBlendModes[MAX_LAYER_COUNT] = int[MAX_LAYER_COUNT](PERM_LAYER_BLEND_MODES);
+#define MATERIAL_USE_ALPHA PERM_USE_ALPHA
+#define MATERIAL_USE_NORMAL_MAP PERM_USE_NORMAL_MAP
+#define MATERIAL_USE_ROUGHNESS_MAP PERM_USE_ROUGHNESS_MAP
+#define MATERIAL_USE_PROJECTOR PERM_USE_PROJECTOR
+#define MATERIAL_BASE_MASK_TYPE PERM_BASE_MASK_TYPE
+#define MATERIAL_LAYER_COUNT PERM_LAYER_COUNT
+#define MATERIAL_LAYER_SAMPLER_MODE(i) permLayerSamplerModes[i]
+#define MATERIAL_LAYER_MASK_TYPE(i) permLayerMaskTypes[i]
+#define MATERIAL_LAYER_BLEND_MODE(i) permLayerBlendModes[i]
+#else
+#define MATERIAL_USE_ALPHA useAlpha
+#define MATERIAL_USE_NORMAL_MAP useNormalMap
+#define MATERIAL_USE_ROUGHNESS_MAP useRoughnessMap
+#define MATERIAL_USE_PROJECTOR useProjector
+#define MATERIAL_BASE_MASK_TYPE baseMaskType
+#define MATERIAL_LAYER_COUNT layerCount
+#define MATERIAL_LAYER_SAMPLER_MODE(i) layerSamplerModes[i]
+#define MATERIAL_LAYER_MASK_TYPE(i) layerMaskTypes[i]
+#define MATERIAL_LAYER_BLEND_MODE(i) layerBlendModes[i]
+#endif
 
 vec3 ComputeNormal(mat3 tangentTransform, vec3 worldNormal, vec3 surfaceNormal, float surfaceStrength)
 {
-	if (useNormalMap)
+	if (MATERIAL_USE_NORMAL_MAP)
 	{
 		vec3 surface = mix(vec3(0.0, 0.0, 1.0), surfaceNormal, surfaceStrength);
 		return normalize(surface * tangentTransform);
@@ -72,28 +177,28 @@ vec3 ComputeNormal(mat3 tangentTransform, vec3 worldNormal, vec3 surfaceNormal,
 	}
 }
 
-vec3 ComputeColor(int sampleMode, vec2 uv, vec4 color, sampler2D surface, vec4 surfaceScaleOffset, vec4 sampleParameters, mat3 tangentTransform, vec3 worldNormal, vec3 surfaceNormal)
+vec3 ComputeColor(int sampleMode, vec2 uv, vec4 color, sampler2DArray surface, int surfaceLayer, vec4 surfaceScaleOffset, vec4 sampleParameters, mat3 tangentTransform, vec3 worldNormal, vec3 surfaceNormal)
 {
 	if (sampleMode == SAMPLE_MODE_TEXTURE)
 	{
 		vec2 panning = elapsedSeconds * sampleParameters.xy;
-		return texture(surface, (uv + panning) * surfaceScaleOffset.xy + surfaceScaleOffset.zw).rgb * color.rgb;
+		return texture(surface, vec3((uv + panning) * surfaceScaleOffset.xy + surfaceScaleOffset.zw, surfaceLayer)).rgb * color.rgb;
 	}
 	else if (sampleMode == SAMPLE_MODE_TEXTURE_SINGLE_CHANNEL)
 	{
 		vec4 channelMask = sampleParameters;
-		vec4 channels = texture(surface, uv * surfaceScaleOffset.xy + surfaceScaleOffset.zw);
+		vec4 channels = texture(surface, vec3(uv * surfaceScaleOffset.xy + surfaceScaleOffset.zw, surfaceLayer));
 		return dot(channelMask, channels) * color.rgb;
 	}
 	else if (sampleMode == SAMPLE_MODE_PARALLAX)
 	{
 		float parallaxMinHeight = sampleParameters.x;
 		float parallaxMaxHeight = sampleParameters.y;
-		float parallaxValue = texture(parallaxMap, uv * parallaxMapScaleOffset.xy + parallaxMapScaleOffset.zw).r;
+		float parallaxValue = texture(parallaxMap, vec3(uv * parallaxMapScaleOffset.xy + parallaxMapScaleOffset.zw, mapLayers.z)).r;
 		float scaledHeight = mix(parallaxMinHeight, parallaxMaxHeight, parallaxValue);
 		vec2 parallaxUV = (vertexViewDir * tangentTransform).xy * scaledHeight;
 
-		return texture(surface, (uv + parallaxUV) * surfaceScaleOffset.xy + surfaceScaleOffset.zw).rgb * color.rgb;
+		return texture(surface, vec3((uv + parallaxUV) * surfaceScaleOffset.xy + surfaceScaleOffset.zw, surfaceLayer)).rgb * color.rgb;
 	}
 	else if (sampleMode == SAMPLE_MODE_RSRM)
 	{
@@ -101,16 +206,16 @@ vec3 ComputeColor(int sampleMode, vec2 uv, vec4 color, sampler2D surface, vec4 s
 		float roughnessMax = sampleParameters.y;
 
 		float scaledRoughness = roughnessMin;
-		if (useRoughnessMap)
+		if (MATERIAL_USE_ROUGHNESS_MAP)
 		{
-			float roughnessValue = texture(roughnessMap, uv * roughnessMapScaleOffset.xy + roughnessMapScaleOffset.zw).r;
+			float roughnessValue = texture(roughnessMap, vec3(uv * roughnessMapScaleOffset.xy + roughnessMapScaleOffset.zw, mapLayers.w)).r;
 			scaledRoughness = mix(roughnessMin, roughnessMax, roughnessValue);
 		}
 
 		float normalMapStrength = sampleParameters.z;
 		vec3 viewReflect = reflect(-vertexViewDir, ComputeNormal(tangentTransform, worldNormal, surfaceNormal, normalMapStrength));
 		float viewAngle = viewReflect.y * 0.5 + 0.5;
-		return texture(surface, vec2(scaledRoughness, viewAngle)).rgb * color.rgb;
+		return texture(surface, vec3(scaledRoughness, viewAngle, surfaceLayer)).rgb * color.rgb;
 	}
 	return color.rgb;
 }
@@ -160,7 +265,7 @@ float ComputeMask(int maskType, vec4 maskParameters, vec4 maskAxis, mat3 tangent
 	return 1.0;
 }
 
-vec3 ComputeBlend(int blendMode, vec3 dst, vec3 src, float mask)
+f16vec3 ComputeBlend(int blendMode, f16vec3 dst, f16vec3 src, float16_t mask)
 {
 	if (blendMode == BLEND_MODE_MULTIPLY)
 	{
@@ -171,12 +276,48 @@ vec3 ComputeBlend(int blendMode, vec3 dst, vec3 src, float mask)
 	}
 }
 
+#ifdef AVATAR_DECAL
+// The projector's colour where its box takes in this fragment, nothing outside it. Parallax and roughness
+// sampled layers read the part's own maps.
+vec4 ComputeDecal(mat3 tangentTransform, vec3 worldNormal)
+{
+	vec4 projectorPos = decal.projectorInv * vec4(vertexWorldPos, 1.0);
+	if (abs(projectorPos.x) > 1.0 || abs(projectorPos.y) > 1.0 || abs(projectorPos.z) > 1.0)
+	{
+		return vec4(0.0);
+	}
+	vec2 uv = projectorPos.xy * 0.5 + 0.5;
+
+	vec3 surfaceNormal = vec3(0.0, 0.0, 1.0);
+	if (decal.useNormalMap)
+	{
+		surfaceNormal.xy = texture(sampler2DArray(decalHandle(1)), vec3(uv * decal.normalMapScaleOffset.xy + decal.normalMapScaleOffset.zw, decal.mapLayers.y)).xy * 2.0 - 1.0;
+		surfaceNormal.z = sqrt(1.0 - dot(surfaceNormal.xy, surfaceNormal.xy));
+	}
+
+	vec4 color = decal.baseColor;
+	for (int i = 0; i < decal.layerCount; ++i)
+	{
+		vec3 layerColor = ComputeColor(decal.layerSamplerModes[i], uv, decal.layerColors[i], sampler2DArray(decalHandle(4 + i)), decal.layerSurfaceLayers[i], decal.layerSurfaceScaleOffsets[i], decal.layerSampleParameters[i], tangentTransform, worldNormal, surfaceNormal);
+		float layerMask = ComputeMask(decal.layerMaskTypes[i], decal.layerMaskParameters[i], decal.layerMaskAxes[i], tangentTransform, worldNormal, surfaceNormal);
+		color.rgb = vec3(ComputeBlend(decal.layerBlendModes[i], f16vec3(color.rgb), f16vec3(layerColor), float16_t(layerMask)));
+	}
+
+	if (decal.useAlpha)
+	{
+		color.a *= texture(sampler2DArray(decalHandle(0)), vec3(uv * decal.alphaMaskScaleOffset.xy + decal.alphaMaskScaleOffset.zw, decal.mapLayers.x)).r;
+	}
+	color.a *= ComputeMask(decal.baseMaskType, decal.baseMaskParameters, decal.baseMaskAxis, tangentTransform, worldNormal, surfaceNormal);
+	return color;
+}
+#endif
+
 void main() {
 	vec3 worldNormal = normalize(vertexNormal);
 	mat3 tangentTransform = mat3(vertexTangent, vertexBitangent, worldNormal);
 
 	vec2 uv = vertexUV;
-	if (useProjector)
+	if (MATERIAL_USE_PROJECTOR)
 	{
 		vec4 projectorPos = projectorInv * vec4(vertexWorldPos, 1.0);
 		if (abs(projectorPos.x) > 1.0 || abs(projectorPos.y) > 1.0 || abs(projectorPos.z) > 1.0)
@@ -188,24 +329,43 @@ void main() {
 	}
 
 	vec3 surfaceNormal = vec3(0.0, 0.0, 1.0);
-	if (useNormalMap)
+	if (MATERIAL_USE_NORMAL_MAP)
 	{
-		surfaceNormal.xy = texture2D(normalMap, uv * normalMapScaleOffset.xy + normalMapScaleOffset.zw).xy * 2.0 - 1.0;
+		surfaceNormal.xy = texture(normalMap, vec3(uv * normalMapScaleOffset.xy + normalMapScaleOffset.zw, mapLayers.y)).xy * 2.0 - 1.0;
 		surfaceNormal.z = sqrt(1.0 - dot(surfaceNormal.xy, surfaceNormal.xy));
 	}
 
-	vec4 color = baseColor;
-	for (int i = 0; i < layerCount; ++i)
+	f16vec4 layered = f16vec4(baseColor);
+	for (int i = 0; i < MATERIAL_LAYER_COUNT; ++i)
 	{
-		vec3 layerColor = ComputeColor(layerSamplerModes[i], uv, layerColors[i], layerSurfaces[i], layerSurfaceScaleOffsets[i], layerSampleParameters[i], tangentTransform, worldNormal, surfaceNormal);
-		float layerMask = ComputeMask(layerMaskTypes[i], layerMaskParameters[i], layerMaskAxes[i], tangentTransform, worldNormal, surfaceNormal);
-		color.rgb = ComputeBlend(layerBlendModes[i], color.rgb, layerColor, layerMask);
+		vec3 layerColor = ComputeColor(MATERIAL_LAYER_SAMPLER_MODE(i), uv, layerColors[i], LAYER_SURFACE(i), layerSurfaceLayers[i], layerSurfaceScaleOffsets[i], layerSampleParameters[i], tangentTransform, worldNormal, surfaceNormal);
+		float layerMask = ComputeMask(MATERIAL_LAYER_MASK_TYPE(i), layerMaskParameters[i], layerMaskAxes[i], tangentTransform, worldNormal, surfaceNormal);
+		layered.rgb = ComputeBlend(MATERIAL_LAYER_BLEND_MODE(i), layered.rgb, f16vec3(layerColor), float16_t(layerMask));
 	}
 
-	if (useAlpha)
+	if (MATERIAL_USE_ALPHA)
 	{
-		color.a *= texture(alphaMask, uv * alphaMaskScaleOffset.xy + alphaMaskScaleOffset.zw).r;
+		layered.a *= float16_t(texture(alphaMask, vec3(uv * alphaMaskScaleOffset.xy + alphaMaskScaleOffset.zw, mapLayers.x)).r);
 	}
-	color.a *= ComputeMask(baseMaskType, baseMaskParameters, baseMaskAxis, tangentTransform, worldNormal, surfaceNormal);
+	layered.a *= float16_t(ComputeMask(MATERIAL_BASE_MASK_TYPE, baseMaskParameters, baseMaskAxis, tangentTransform, worldNormal, surfaceNormal));
+#ifdef AVATAR_DECAL
+	// Over the part as the decal pass blended it
+	f16vec4 projected = f16vec4(ComputeDecal(tangentTransform, worldNormal));
+	layered.rgb = mix(layered.rgb, projected.rgb, clamp(projected.a, float16_t(0.0), float16_t(1.0)));
+#endif
+	vec4 color = vec4(layered);
+#ifdef LINEAR_EYE_BUFFER
+	// Decoded for a linear eye buffer, as scene programs do
+	color.rgb = mix(color.rgb / 12.92, pow((color.rgb + 0.055) / 1.055, vec3(2.4)), step(vec3(0.04045), color.rgb));
+#endif
+#ifdef WEIGHTED_OIT
+	// Nearer and more opaque fragments count for more, by the eye distance gl_FragCoord.w leaves whichever way depth
+	// runs (McGuire and Bavoil's equation 7, in metres)
+	float distance = 1.0 / gl_FragCoord.w;
+	float weight = color.a * clamp(10.0 / (1e-5 + pow(distance / 5.0, 2.0) + pow(distance / 200.0, 6.0)), 1e-2, 3e3);
+	fragmentColor = vec4(color.rgb * color.a, color.a) * weight;
+	fragmentRevealage = vec4(color.a);
+#else
 	fragmentColor = color;
+#endif
 }
\ No newline at end of file
@@ -3,10 +3,17 @@
 in vec2 vertexUV;
 out vec4 fragmentColor;
 
-uniform sampler2D albedo;
-uniform sampler2D surface;
+// Layers of the avatar texture arrays the textures are in
+uniform sampler2DArray albedo;
+uniform sampler2DArray surface;
+uniform int albedoLayer;
+uniform int surfaceLayer;
 
 void main() {
-	vec4 color = texture2D(albedo, vertexUV);
+	vec4 color = texture(albedo, vec3(vertexUV, albedoLayer));
+#ifdef LINEAR_EYE_BUFFER
+	// Decoded for a linear eye buffer, as scene programs do
+	color.rgb = mix(color.rgb / 12.92, pow((color.rgb + 0.055) / 1.055, vec3(2.4)), step(vec3(0.04045), color.rgb));
+#endif
 	fragmentColor = color;
 }
\ No newline at end of file
@@ -0,0 +1,31 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec4 tangent;
+layout (location = 3) in vec2 texCoord;
+layout (location = 4) in vec4 poseIndices;
+layout (location = 5) in vec4 poseWeights;
+// Captured by transform feedback in this order, as AvatarSkinnedVertex
+out vec3 skinnedPosition;
+out vec3 skinnedNormal;
+out vec4 skinnedTangent;
+out vec2 skinnedUV;
+out vec3 skinnedObjPosition;
+// Skinning palette of the part being skinned (AVATAR_POSE_BINDING)
+layout(std140) uniform MeshPose {
+    mat4 meshPose[64];
+};
+void main() {
+    // The weighted palette once, instead of four matrix products for each of position, normal and tangent
+    mat4 pose = meshPose[int(poseIndices[0])] * poseWeights[0];
+    pose += meshPose[int(poseIndices[1])] * poseWeights[1];
+    pose += meshPose[int(poseIndices[2])] * poseWeights[2];
+    pose += meshPose[int(poseIndices[3])] * poseWeights[3];
+
+    skinnedPosition = (pose * vec4(position, 1.0)).xyz;
+    skinnedNormal = normalize((pose * vec4(normal, 0.0)).xyz);
+    skinnedTangent = vec4(normalize((pose * vec4(tangent.xyz, 0.0)).xyz), tangent.w);
+    skinnedUV = texCoord;
+    skinnedObjPosition = position;
+    gl_Position = vec4(skinnedPosition, 1.0);
+}
@@ -3,8 +3,17 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec4 tangent;
 layout (location = 3) in vec2 texCoord;
+#ifdef PRESKINNED
+// Already skinned by AvatarSkinShader.glsl, the bind pose position comes along for the object space effects
+layout (location = 6) in vec3 objPosition;
+#else
 layout (location = 4) in vec4 poseIndices;
 layout (location = 5) in vec4 poseWeights;
+#endif
+// The depth pass and the color passes after it compare equal depths, DEPTH_ONLY computes the same position and
+// skips the rest
+invariant gl_Position;
+#ifndef DEPTH_ONLY
 out vec3 vertexWorldPos;
 out vec3 vertexViewDir;
 out vec3 vertexObjPos;
@@ -12,16 +21,34 @@ out vec3 vertexNormal;
 out vec3 vertexTangent;
 out vec3 vertexBitangent;
 out vec2 vertexUV;
-uniform vec3 viewPos;
-uniform mat4 world;
-uniform mat4 viewProj;
-uniform mat4 meshPose[64];
+#endif
+// Written per draw into the uniform ring (AVATAR_TRANSFORM_BINDING)
+layout(std140) uniform MeshTransform {
+    mat4 world;
+    mat4 viewProj;
+    vec3 viewPos;
+};
+#ifndef PRESKINNED
+// Skinning palette, filled once per frame by the avatar pose cache (AVATAR_POSE_BINDING)
+layout(std140) uniform MeshPose {
+    mat4 meshPose[64];
+};
+#endif
 void main() {
+#if defined(PRESKINNED) && defined(DEPTH_ONLY)
+    vec4 vertexPose = vec4(position, 1.0);
+#elif defined(PRESKINNED)
+    vec4 vertexPose = vec4(position, 1.0);
+    vec4 normalPose = vec4(normal, 0.0);
+    vec4 tangentPose = vec4(tangent.xyz, 0.0);
+    vertexObjPos = objPosition;
+#else
     vec4 vertexPose;
     vertexPose = meshPose[int(poseIndices[0])] * vec4(position, 1.0) * poseWeights[0];
     vertexPose += meshPose[int(poseIndices[1])] * vec4(position, 1.0) * poseWeights[1];
     vertexPose += meshPose[int(poseIndices[2])] * vec4(position, 1.0) * poseWeights[2];
     vertexPose += meshPose[int(poseIndices[3])] * vec4(position, 1.0) * poseWeights[3];
+#ifndef DEPTH_ONLY
     
     vec4 normalPose;
     normalPose = meshPose[int(poseIndices[0])] * vec4(normal, 0.0) * poseWeights[0];
@@ -36,13 +63,19 @@ void main() {
     tangentPose += meshPose[int(poseIndices[2])] * vec4(tangent.xyz, 0.0) * poseWeights[2];
     tangentPose += meshPose[int(poseIndices[3])] * vec4(tangent.xyz, 0.0) * poseWeights[3];
 	tangentPose = normalize(tangentPose);
+    vertexObjPos = position.xyz;
+#endif
+#endif
 
+#ifdef DEPTH_ONLY
+	gl_Position = viewProj * vec4(vec3(world * vertexPose), 1.0);
+#else
 	vertexWorldPos = vec3(world * vertexPose);
 	gl_Position = viewProj * vec4(vertexWorldPos, 1.0);
 	vertexViewDir = normalize(viewPos - vertexWorldPos.xyz);
-    vertexObjPos = position.xyz;
 	vertexNormal = (world * normalPose).xyz;
 	vertexTangent = (world * tangentPose).xyz;
 	vertexBitangent = normalize(cross(vertexNormal, vertexTangent) * tangent.w);
 	vertexUV = texCoord;
+#endif
 }
\ No newline at end of file
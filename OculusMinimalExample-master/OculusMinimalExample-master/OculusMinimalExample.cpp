@@ -22,6 +22,11 @@ limitations under the License.
 #include <memory>
 #include <exception>
 #include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
 
 #include <Windows.h>
 
@@ -615,27 +620,122 @@ namespace Attribute {
         Normal = 2,
         Color = 3,
         TexCoord1 = 4,
+        // The first of up to four slots, as many as the InstanceFormat needs
         InstanceTransform = 5,
     };
 }
 
-static const char * VERTEX_SHADER = R"SHADER(
-#version 410 core
+// What each instance's transform is stored as. Fewer bytes per instance is less for the vertex fetch to read,
+// which is what limits the grid at hundreds of thousands of cubes. The values are INSTANCE_FORMAT in the shaders.
+enum class InstanceFormat {
+    // mat4, 64 bytes in four slots
+    Matrix = 0,
+    // Translation and uniform scale in one vec4, 16 bytes. There is no rotation, the cubes don't spin.
+    TranslationScale = 1,
+    // Half floats: translation and scale, then the rotation as a quaternion, 16 bytes in two slots. Halves are
+    // exact to 1/1024 of the distance from the origin, fine for the default grid, visibly coarse 100 units out.
+    QuaternionHalf = 2,
+    // The top three rows of the matrix, 48 bytes in three slots
+    Affine = 3,
+};
+
+static const GLsizei INSTANCE_STRIDES[] = { sizeof(mat4), sizeof(vec4), 8 * sizeof(GLushort), 3 * sizeof(vec4) };
+static const GLuint INSTANCE_SLOTS[] = { 4, 1, 2, 3 };
 
+// A shader body below with its #version line and INSTANCE_FORMAT defined in front
+static std::string instanceShaderSource(const char * body, InstanceFormat format) {
+    return "#version 410 core\n#define INSTANCE_FORMAT " + std::to_string((int)format) + "\n" + body;
+}
+
+static const char * VERTEX_SHADER = R"SHADER(
 uniform mat4 ProjectionMatrix = mat4(1);
 uniform mat4 CameraMatrix = mat4(1);
 
 layout(location = 0) in vec4 Position;
 layout(location = 2) in vec3 Normal;
+#if INSTANCE_FORMAT == 0
 layout(location = 5) in mat4 InstanceTransform;
+#elif INSTANCE_FORMAT == 1
+layout(location = 5) in vec4 InstanceTranslationScale;
+#elif INSTANCE_FORMAT == 2
+layout(location = 5) in vec4 InstanceTranslationScale;
+layout(location = 6) in vec4 InstanceRotation;
+#else
+layout(location = 5) in vec4 InstanceRows[3];
+#endif
 
 out vec3 vertNormal;
 
 void main(void) {
-   mat4 ViewXfm = CameraMatrix * InstanceTransform;
-   //mat4 ViewXfm = CameraMatrix;
+#if INSTANCE_FORMAT == 0
+   vec4 worldPosition = InstanceTransform * Position;
+#elif INSTANCE_FORMAT == 1
+   vec4 worldPosition = vec4(InstanceTranslationScale.xyz + Position.xyz * InstanceTranslationScale.w, 1.0);
+#elif INSTANCE_FORMAT == 2
+   vec3 v = Position.xyz * InstanceTranslationScale.w;
+   vec3 q = InstanceRotation.xyz;
+   v += 2.0 * cross(q, cross(q, v) + InstanceRotation.w * v);
+   vec4 worldPosition = vec4(InstanceTranslationScale.xyz + v, 1.0);
+#else
+   vec4 worldPosition = vec4(dot(InstanceRows[0], Position), dot(InstanceRows[1], Position), dot(InstanceRows[2], Position), 1.0);
+#endif
    vertNormal = Normal;
-   gl_Position = ProjectionMatrix * ViewXfm * Position;
+   gl_Position = ProjectionMatrix * CameraMatrix * worldPosition;
+}
+)SHADER";
+
+// Moves each cube of the grid from its place in it and writes the result in the INSTANCE_FORMAT, for the transform
+// feedback update. animateInstance() and writeInstance() below are the same on the CPU, keep them in step.
+static const char * ANIMATE_SHADER = R"SHADER(
+uniform float Time = 0.0;
+
+layout(location = 0) in vec3 BasePosition;
+
+#if INSTANCE_FORMAT == 2
+flat out uvec4 Instance0;
+#else
+out vec4 Instance0;
+out vec4 Instance1;
+out vec4 Instance2;
+out vec4 Instance3;
+#endif
+
+// Truncating, no denormals, as packHalf() on the CPU
+uint toHalf(float value) {
+    uint bits = floatBitsToUint(value);
+    uint sign = (bits >> 16) & 0x8000u;
+    int exponent = int((bits >> 23) & 0xFFu) - 112;
+    if (exponent <= 0) {
+        return sign;
+    }
+    if (exponent >= 31) {
+        return sign | 0x7C00u;
+    }
+    return sign | (uint(exponent) << 10) | ((bits & 0x7FFFFFu) >> 13);
+}
+
+void main(void) {
+    float phase = length(BasePosition) * 0.35;
+    float angle = Time * 0.5 + phase;
+    vec3 position = BasePosition + vec3(0.0, sin(Time * 2.0 - phase) * 0.5, 0.0);
+    float c = cos(angle), s = sin(angle);
+#if INSTANCE_FORMAT == 0
+    Instance0 = vec4(c, 0.0, -s, 0.0);
+    Instance1 = vec4(0.0, 1.0, 0.0, 0.0);
+    Instance2 = vec4(s, 0.0, c, 0.0);
+    Instance3 = vec4(position, 1.0);
+#elif INSTANCE_FORMAT == 1
+    Instance0 = vec4(position, 1.0);
+#elif INSTANCE_FORMAT == 2
+    // The rotation about y, as a quaternion (x, y, z, w)
+    vec4 rotation = vec4(0.0, sin(angle * 0.5), 0.0, cos(angle * 0.5));
+    Instance0 = uvec4(toHalf(position.x) | (toHalf(position.y) << 16), toHalf(position.z) | (toHalf(1.0) << 16),
+        toHalf(rotation.x) | (toHalf(rotation.y) << 16), toHalf(rotation.z) | (toHalf(rotation.w) << 16));
+#else
+    Instance0 = vec4(c, 0.0, s, position.x);
+    Instance1 = vec4(0.0, 1.0, 0.0, position.y);
+    Instance2 = vec4(-s, 0.0, c, position.z);
+#endif
 }
 )SHADER";
 
@@ -654,6 +754,186 @@ void main(void) {
 }
 )SHADER";
 
+// How the instance transforms change from frame to frame
+enum class InstanceUpdate {
+    // Built once and never touched again
+    Static,
+    // Animated on the CPU and written into an InstanceRing segment
+    Cpu,
+    // Animated by ANIMATE_SHADER through transform feedback into an InstanceRing segment
+    Gpu,
+};
+
+// Frames the instance data is buffered over, so the CPU never writes what the GPU may still be reading
+#define INSTANCE_RING_FRAMES 3
+
+// Where a cube is and how far it has turned about y
+struct InstancePose {
+    vec3 position;
+    float angle;
+};
+
+// The CPU mirror of ANIMATE_SHADER
+static InstancePose animateInstance(const vec3 & base, float time) {
+    float phase = glm::length(base) * 0.35f;
+    return { base + vec3(0.0f, sinf(time * 2.0f - phase) * 0.5f, 0.0f), time * 0.5f + phase };
+}
+
+// Truncating, no denormals, as toHalf() in ANIMATE_SHADER
+static GLushort packHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const int exponent = (int)((bits >> 23) & 0xFFu) - 112;
+    if (exponent <= 0) {
+        return (GLushort)sign;
+    }
+    if (exponent >= 31) {
+        return (GLushort)(sign | 0x7C00u);
+    }
+    return (GLushort)(sign | ((uint32_t)exponent << 10) | ((bits & 0x7FFFFFu) >> 13));
+}
+
+// One instance in the format, INSTANCE_STRIDES[format] bytes at destination
+static void writeInstance(InstanceFormat format, const InstancePose & pose, void * destination) {
+    const float c = cosf(pose.angle), s = sinf(pose.angle);
+    const vec3 & p = pose.position;
+    switch (format) {
+    case InstanceFormat::Matrix: {
+        const mat4 transform(vec4(c, 0, -s, 0), vec4(0, 1, 0, 0), vec4(s, 0, c, 0), vec4(p, 1));
+        memcpy(destination, &transform, sizeof(transform));
+        break;
+    }
+    case InstanceFormat::TranslationScale: {
+        const vec4 translationScale(p, 1.0f);
+        memcpy(destination, &translationScale, sizeof(translationScale));
+        break;
+    }
+    case InstanceFormat::QuaternionHalf: {
+        const GLushort halves[8] = {
+            packHalf(p.x), packHalf(p.y), packHalf(p.z), packHalf(1.0f),
+            packHalf(0.0f), packHalf(sinf(pose.angle * 0.5f)), packHalf(0.0f), packHalf(cosf(pose.angle * 0.5f)),
+        };
+        memcpy(destination, halves, sizeof(halves));
+        break;
+    }
+    case InstanceFormat::Affine: {
+        const vec4 rows[3] = { vec4(c, 0, s, p.x), vec4(0, 1, 0, p.y), vec4(-s, 0, c, p.z) };
+        memcpy(destination, rows, sizeof(rows));
+        break;
+    }
+    }
+}
+
+// Points the instance attributes of the bound vertex array at the buffer bound to GL_ARRAY_BUFFER, from offset
+static void pointInstanceAttributes(InstanceFormat format, GLintptr offset) {
+    const GLsizei stride = INSTANCE_STRIDES[(int)format];
+    if (format == InstanceFormat::QuaternionHalf) {
+        for (GLuint i = 0; i < 2; ++i) {
+            glVertexAttribPointer(Attribute::InstanceTransform + i, 4, GL_HALF_FLOAT, GL_FALSE, stride,
+                (void*)(offset + 4 * sizeof(GLushort) * i));
+        }
+        return;
+    }
+    for (GLuint i = 0; i < INSTANCE_SLOTS[(int)format]; ++i) {
+        glVertexAttribPointer(Attribute::InstanceTransform + i, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offset + sizeof(vec4) * i));
+    }
+}
+
+// One buffer holding INSTANCE_RING_FRAMES segments of per frame data, each frame writing the next one.
+//
+// With GL_ARB_buffer_storage the buffer is mapped once, persistently and coherently, and a frame writes straight
+// through the pointer. Otherwise each frame maps only its segment, unsynchronized and invalidated, which never
+// makes the driver wait on the GPU or copy the rest. Either way a fence placed after a segment's draws is waited
+// on before the CPU writes that segment again; writes from the GPU, such as transform feedback, need no fence.
+class InstanceRing {
+public:
+    InstanceRing() {}
+    ~InstanceRing() {
+        for (int i = 0; i < INSTANCE_RING_FRAMES; ++i) {
+            if (fences[i]) {
+                glDeleteSync(fences[i]);
+            }
+        }
+        if (buffer) {
+            if (persistent) {
+                glBindBuffer(GL_ARRAY_BUFFER, buffer);
+                glUnmapBuffer(GL_ARRAY_BUFFER);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+            }
+            glDeleteBuffers(1, &buffer);
+        }
+    }
+
+    InstanceRing(const InstanceRing &) = delete;
+    InstanceRing & operator=(const InstanceRing &) = delete;
+
+    void init(GLsizeiptr bytesPerFrame) {
+        // Segment starts stay aligned for streaming, for transform feedback and for mat4 attributes alike
+        segmentSize = (bytesPerFrame + 255) & ~(GLsizeiptr)255;
+        const GLsizeiptr size = segmentSize * INSTANCE_RING_FRAMES;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        persistent = GLEW_ARB_buffer_storage != 0;
+        if (persistent) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+            mapped = (uint8_t *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+            if (!mapped) {
+                FAIL("Unable to map the instance ring");
+            }
+        } else {
+            glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Moves on to this frame's segment. Everything issued so far, last frame's draws included, is fenced off
+    // against the CPU writing the segment it used.
+    void advance() {
+        if (fences[current]) {
+            glDeleteSync(fences[current]);
+        }
+        fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        current = (current + 1) % INSTANCE_RING_FRAMES;
+    }
+
+    // CPU writes: the current segment, once the GPU is done with it. unmap() before drawing from it.
+    void * map() {
+        if (fences[current]) {
+            while (glClientWaitSync(fences[current], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+            }
+            glDeleteSync(fences[current]);
+            fences[current] = 0;
+        }
+        if (persistent) {
+            return mapped + offset();
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        return glMapBufferRange(GL_ARRAY_BUFFER, offset(), segmentSize,
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    }
+
+    void unmap() {
+        if (!persistent) {
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+    }
+
+    GLuint id() const { return buffer; }
+    GLintptr offset() const { return segmentSize * current; }
+    GLsizeiptr size() const { return segmentSize; }
+
+private:
+    GLuint buffer { 0 };
+    GLsizeiptr segmentSize { 0 };
+    int current { 0 };
+    bool persistent { false };
+    uint8_t * mapped { nullptr };
+    GLsync fences[INSTANCE_RING_FRAMES] {};
+};
+
 // a class for encapsulating building and rendering an RGB cube
 struct ColorCubeScene {
 
@@ -666,10 +946,23 @@ struct ColorCubeScene {
 
     // VBOs for the cube's vertices and normals
 
-    const unsigned int GRID_SIZE { 5 };
+    // Cubes along each side of the grid, the one in the middle left out for the viewer
+    const unsigned int gridSize;
+    const InstanceUpdate instanceUpdate;
+    const InstanceFormat instanceFormat;
+    // Animated updates: each cube's place in the grid, the ring its transforms are written to each frame and, for
+    // the GPU update, the transform feedback program with its vertex array over basePositions
+    std::vector<vec3> basePositions;
+    InstanceRing ring;
+    GLuint animateProgram { 0 };
+    GLuint animateVao { 0 };
+    GLuint basePositionBuffer { 0 };
+    GLint timeLocation { -1 };
 
 public:
-    ColorCubeScene() : cube({ "Position", "Normal" }, oglplus::shapes::Cube()) {
+    ColorCubeScene(unsigned int gridSize, InstanceUpdate instanceUpdate, InstanceFormat instanceFormat)
+        : cube({ "Position", "Normal" }, oglplus::shapes::Cube()), gridSize(gridSize), instanceUpdate(instanceUpdate),
+        instanceFormat(instanceFormat) {
         using namespace oglplus;
         try {
             // attach the shaders to the program
@@ -680,7 +973,7 @@ public:
                 );
             prog.AttachShader(
                 VertexShader()
-                .Source(GLSLSource(String(VERTEX_SHADER)))
+                .Source(GLSLSource(String(instanceShaderSource(VERTEX_SHADER, instanceFormat))))
                 .Compile()
                 );
             prog.Link();
@@ -695,35 +988,91 @@ public:
         vao.Bind();
         // Create a cube of cubes
         {
-            std::vector<mat4> instance_positions;
-            for (unsigned int z = 0; z < GRID_SIZE; ++z) {
-                for (unsigned int y = 0; y < GRID_SIZE; ++y) {
-                    for (unsigned int x = 0; x < GRID_SIZE; ++x) {
-                        int xpos = (x - (GRID_SIZE / 2)) * 2;
-                        int ypos = (y - (GRID_SIZE / 2)) * 2;
-                        int zpos = (z - (GRID_SIZE / 2)) * 2;
-                        vec3 relativePosition = vec3(xpos, ypos, zpos);
+            const int half = (int)gridSize / 2;
+            for (int z = 0; z < (int)gridSize; ++z) {
+                for (int y = 0; y < (int)gridSize; ++y) {
+                    for (int x = 0; x < (int)gridSize; ++x) {
+                        vec3 relativePosition = vec3(x - half, y - half, z - half) * 2.0f;
                         if (relativePosition == vec3(0)) {
                             continue;
                         }
-                        instance_positions.push_back(glm::translate(glm::mat4(1.0f), relativePosition));
+                        basePositions.push_back(relativePosition);
                     }
                 }
             }
+            instanceCount = (GLuint)basePositions.size();
 
-            Context::Bound(Buffer::Target::Array, instances).Data(instance_positions);
-            instanceCount = (GLuint)instance_positions.size();
-            int stride = sizeof(mat4);
-            for (int i = 0; i < 4; ++i) {
-                VertexArrayAttrib instance_attr(prog, Attribute::InstanceTransform + i);
-                size_t offset = sizeof(vec4) * i;
-                instance_attr.Pointer(4, DataType::Float, false, stride, (void*)offset);
-                instance_attr.Divisor(1);
-                instance_attr.Enable();
+            const GLsizei stride = INSTANCE_STRIDES[(int)instanceFormat];
+            if (instanceUpdate == InstanceUpdate::Static) {
+                std::vector<uint8_t> instance_data(instanceCount * stride);
+                for (GLuint i = 0; i < instanceCount; ++i) {
+                    writeInstance(instanceFormat, { basePositions[i], 0.0f }, &instance_data[i * stride]);
+                }
+                Context::Bound(Buffer::Target::Array, instances).Data(instance_data);
+            } else {
+                // update() points the attributes at each frame's segment
+                ring.init(instanceCount * stride);
+                glBindBuffer(GL_ARRAY_BUFFER, ring.id());
+            }
+            pointInstanceAttributes(instanceFormat, 0);
+            for (GLuint i = 0; i < INSTANCE_SLOTS[(int)instanceFormat]; ++i) {
+                glVertexAttribDivisor(Attribute::InstanceTransform + i, 1);
+                glEnableVertexAttribArray(Attribute::InstanceTransform + i);
             }
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+
+        if (instanceUpdate == InstanceUpdate::Gpu) {
+            initAnimation();
         }
     }
 
+    ~ColorCubeScene() {
+        if (animateProgram) {
+            glDeleteProgram(animateProgram);
+        }
+        if (animateVao) {
+            glDeleteVertexArrays(1, &animateVao);
+        }
+        if (basePositionBuffer) {
+            glDeleteBuffers(1, &basePositionBuffer);
+        }
+    }
+
+    // Once per frame before the eyes render, time in seconds
+    void update(float time) {
+        if (instanceUpdate == InstanceUpdate::Static) {
+            return;
+        }
+        ring.advance();
+        const GLsizei stride = INSTANCE_STRIDES[(int)instanceFormat];
+        if (instanceUpdate == InstanceUpdate::Cpu) {
+            uint8_t * instances = (uint8_t *)ring.map();
+            for (GLuint i = 0; i < instanceCount; ++i) {
+                writeInstance(instanceFormat, animateInstance(basePositions[i], time), instances + i * stride);
+            }
+            ring.unmap();
+        } else {
+            glEnable(GL_RASTERIZER_DISCARD);
+            glUseProgram(animateProgram);
+            glUniform1f(timeLocation, time);
+            glBindVertexArray(animateVao);
+            glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, ring.id(), ring.offset(), instanceCount * stride);
+            glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, 0, instanceCount);
+            glEndTransformFeedback();
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+            glBindVertexArray(0);
+            glDisable(GL_RASTERIZER_DISCARD);
+        }
+
+        // Both eyes draw from this frame's segment
+        vao.Bind();
+        glBindBuffer(GL_ARRAY_BUFFER, ring.id());
+        pointInstanceAttributes(instanceFormat, ring.offset());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
     void render(const mat4 & projection, const mat4 & modelview) {
         using namespace oglplus;
         prog.Use();
@@ -732,8 +1081,58 @@ public:
         vao.Bind();
         cube.Draw(instanceCount);
     }
+
+private:
+    // The transform feedback program writes each instance's outputs interleaved, so the ring segment is laid out
+    // as writeInstance() lays out the Static and Cpu updates
+    void initAnimation() {
+        GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+        const std::string source = instanceShaderSource(ANIMATE_SHADER, instanceFormat);
+        const char * sourceText = source.c_str();
+        glShaderSource(shader, 1, &sourceText, nullptr);
+        glCompileShader(shader);
+        GLint success = 0;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            char infoLog[512];
+            glGetShaderInfoLog(shader, sizeof(infoLog), nullptr, infoLog);
+            FAIL(infoLog);
+        }
+        animateProgram = glCreateProgram();
+        glAttachShader(animateProgram, shader);
+        static const char * varyings[] = { "Instance0", "Instance1", "Instance2", "Instance3" };
+        // The packed format's one uvec4 holds both of its slots
+        const GLsizei varyingCount = instanceFormat == InstanceFormat::QuaternionHalf ? 1 : INSTANCE_SLOTS[(int)instanceFormat];
+        glTransformFeedbackVaryings(animateProgram, varyingCount, varyings, GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(animateProgram);
+        glDeleteShader(shader);
+        glGetProgramiv(animateProgram, GL_LINK_STATUS, &success);
+        if (!success) {
+            char infoLog[512];
+            glGetProgramInfoLog(animateProgram, sizeof(infoLog), nullptr, infoLog);
+            FAIL(infoLog);
+        }
+        timeLocation = glGetUniformLocation(animateProgram, "Time");
+
+        glGenBuffers(1, &basePositionBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, basePositionBuffer);
+        glBufferData(GL_ARRAY_BUFFER, basePositions.size() * sizeof(vec3), basePositions.data(), GL_STATIC_DRAW);
+        glGenVertexArrays(1, &animateVao);
+        glBindVertexArray(animateVao);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), nullptr);
+        glEnableVertexAttribArray(0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
 };
 
+// Cubes along each side of the grid, --grid <n>. 64 is more than a quarter million cubes.
+static unsigned int _gridSize = 5;
+// --static-instances keeps the grid as it was built, --cpu-instances animates it on the CPU instead of the GPU
+static InstanceUpdate _instanceUpdate = InstanceUpdate::Gpu;
+// --instance-format matrix|vec4|quat|affine, see InstanceFormat
+static InstanceFormat _instanceFormat = InstanceFormat::QuaternionHalf;
+
 
 // An example application that renders a simple cube
 class ExampleApp : public RiftApp {
@@ -748,13 +1147,17 @@ protected:
         glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
         glEnable(GL_DEPTH_TEST);
         ovr_RecenterTrackingOrigin(_session);
-        cubeScene = std::shared_ptr<ColorCubeScene>(new ColorCubeScene());
+        cubeScene = std::shared_ptr<ColorCubeScene>(new ColorCubeScene(_gridSize, _instanceUpdate, _instanceFormat));
     }
 
     void shutdownGl() override {
         cubeScene.reset();
     }
 
+    void update() override {
+        cubeScene->update((float)ovr_GetTimeInSeconds());
+    }
+
     void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose) override {
         cubeScene->render(projection, glm::inverse(headPose));
     }
@@ -763,6 +1166,31 @@ protected:
 // Execute our example class
 int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
     int result = -1;
+    if (lpCmdLine) {
+        const char * grid = strstr(lpCmdLine, "--grid ");
+        if (grid) {
+            sscanf(grid + strlen("--grid "), "%u", &_gridSize);
+            _gridSize = std::max(_gridSize, 1u);
+        }
+        if (strstr(lpCmdLine, "--static-instances")) {
+            _instanceUpdate = InstanceUpdate::Static;
+        } else if (strstr(lpCmdLine, "--cpu-instances")) {
+            _instanceUpdate = InstanceUpdate::Cpu;
+        }
+        const char * format = strstr(lpCmdLine, "--instance-format ");
+        if (format) {
+            format += strlen("--instance-format ");
+            if (!strncmp(format, "matrix", 6)) {
+                _instanceFormat = InstanceFormat::Matrix;
+            } else if (!strncmp(format, "vec4", 4)) {
+                _instanceFormat = InstanceFormat::TranslationScale;
+            } else if (!strncmp(format, "quat", 4)) {
+                _instanceFormat = InstanceFormat::QuaternionHalf;
+            } else if (!strncmp(format, "affine", 6)) {
+                _instanceFormat = InstanceFormat::Affine;
+            }
+        }
+    }
     try {
         if (!OVR_SUCCESS(ovr_Initialize(nullptr))) {
             FAIL("Failed to initialize the Oculus SDK");
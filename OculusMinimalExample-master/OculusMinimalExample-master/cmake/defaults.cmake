@@ -64,6 +64,13 @@ if (WIN32)
   # always produce symbols as PDB files
   set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} /Zi")
   set(CMAKE_EXE_LINKER_FLAGS "${CMAKE_EXE_LINKER_FLAGS} /DEBUG /OPT:REF /OPT:ICF")
+  # whole program optimization for release, /GL objects have to be linked with /LTCG
+  set(CMAKE_CXX_FLAGS_RELEASE "${CMAKE_CXX_FLAGS_RELEASE} /GL")
+  set(CMAKE_EXE_LINKER_FLAGS_RELEASE "${CMAKE_EXE_LINKER_FLAGS_RELEASE} /LTCG")
+  # -DSIMD_ARCH=AVX2 builds for AVX2 machines only
+  if (SIMD_ARCH STREQUAL "AVX2")
+    set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} /arch:AVX2")
+  endif ()
 endif()
 
 if (POLICY CMP0028)